@@ -0,0 +1,228 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "bitmap.h"
+#include "file.h"
+#include "macro.h"
+#include "mem.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BITMAP_WORD_BITS 64
+#define BITMAP_WORD_FULL UINT64_MAX
+
+struct bitmap {
+	uint64_t *words;
+	size_t size;	  /* number of bits */
+	size_t n_words;	  /* number of words */
+	size_t free_word; /* all words below are full */
+};
+
+#define BITMAP_WORD(bit) ((bit) / BITMAP_WORD_BITS)
+#define BITMAP_MASK(bit) ((uint64_t)1 << ((bit) % BITMAP_WORD_BITS))
+
+/*
+ * The bits of the last word beyond the size are kept set, so that they are never
+ * allocated by bitmap_set_next().
+ */
+static void
+bitmap_set_padding(bitmap_t *bitmap)
+{
+	if (bitmap->size % BITMAP_WORD_BITS)
+		bitmap->words[bitmap->n_words - 1] |= BITMAP_WORD_FULL
+						       << (bitmap->size % BITMAP_WORD_BITS);
+}
+
+bitmap_t *
+bitmap_new(size_t size)
+{
+	ASSERT(size > 0 && size <= INT_MAX);
+
+	bitmap_t *bitmap = mem_new0(bitmap_t, 1);
+	bitmap->size = size;
+	bitmap->n_words = (size + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+	bitmap->words = mem_new0(uint64_t, bitmap->n_words);
+	bitmap_set_padding(bitmap);
+
+	return bitmap;
+}
+
+bitmap_t *
+bitmap_new_from_file(const char *file, size_t size)
+{
+	ASSERT(file);
+
+	bitmap_t *bitmap = bitmap_new(size);
+	size_t len = bitmap->n_words * sizeof(uint64_t);
+
+	off_t file_len = file_size(file);
+	if (file_len < 0 || (size_t)file_len % sizeof(uint64_t)) {
+		ERROR("Invalid bitmap file %s", file);
+		bitmap_free(bitmap);
+		return NULL;
+	}
+	if ((size_t)file_len < len)
+		len = file_len;
+
+	if (len && file_read(file, (char *)bitmap->words, len) != (int)len) {
+		ERROR("Failed to read bitmap file %s", file);
+		bitmap_free(bitmap);
+		return NULL;
+	}
+	bitmap_set_padding(bitmap);
+
+	return bitmap;
+}
+
+void
+bitmap_free(bitmap_t *bitmap)
+{
+	IF_NULL_RETURN(bitmap);
+
+	mem_free0(bitmap->words);
+	mem_free0(bitmap);
+}
+
+size_t
+bitmap_get_size(const bitmap_t *bitmap)
+{
+	ASSERT(bitmap);
+	return bitmap->size;
+}
+
+bool
+bitmap_test(const bitmap_t *bitmap, size_t bit)
+{
+	ASSERT(bitmap);
+
+	if (bit >= bitmap->size)
+		return false;
+
+	return bitmap->words[BITMAP_WORD(bit)] & BITMAP_MASK(bit);
+}
+
+int
+bitmap_set(bitmap_t *bitmap, size_t bit)
+{
+	ASSERT(bitmap);
+
+	if (bit >= bitmap->size || bitmap_test(bitmap, bit))
+		return -1;
+
+	bitmap->words[BITMAP_WORD(bit)] |= BITMAP_MASK(bit);
+	return 0;
+}
+
+void
+bitmap_clear(bitmap_t *bitmap, size_t bit)
+{
+	ASSERT(bitmap);
+
+	IF_TRUE_RETURN(bit >= bitmap->size);
+
+	bitmap->words[BITMAP_WORD(bit)] &= ~BITMAP_MASK(bit);
+	if (BITMAP_WORD(bit) < bitmap->free_word)
+		bitmap->free_word = BITMAP_WORD(bit);
+}
+
+int
+bitmap_set_range(bitmap_t *bitmap, size_t start, size_t len)
+{
+	ASSERT(bitmap);
+
+	if (start >= bitmap->size || len > bitmap->size - start)
+		return -1;
+
+	for (size_t bit = start; bit < start + len; bit++)
+		if (bitmap_test(bitmap, bit))
+			return -1;
+
+	for (size_t bit = start; bit < start + len; bit++)
+		bitmap->words[BITMAP_WORD(bit)] |= BITMAP_MASK(bit);
+
+	return 0;
+}
+
+void
+bitmap_clear_range(bitmap_t *bitmap, size_t start, size_t len)
+{
+	ASSERT(bitmap);
+
+	for (size_t bit = start; bit < bitmap->size && bit - start < len; bit++)
+		bitmap_clear(bitmap, bit);
+}
+
+int
+bitmap_set_next(bitmap_t *bitmap)
+{
+	ASSERT(bitmap);
+
+	while (bitmap->free_word < bitmap->n_words &&
+	       bitmap->words[bitmap->free_word] == BITMAP_WORD_FULL)
+		bitmap->free_word++;
+
+	IF_TRUE_RETVAL(bitmap->free_word == bitmap->n_words, -1);
+
+	uint64_t *word = &bitmap->words[bitmap->free_word];
+	int bit = __builtin_ctzll(~*word);
+	*word |= (uint64_t)1 << bit;
+
+	return bitmap->free_word * BITMAP_WORD_BITS + bit;
+}
+
+int
+bitmap_write(const bitmap_t *bitmap, const char *file)
+{
+	ASSERT(bitmap);
+	ASSERT(file);
+
+	int ret = -1;
+	ssize_t len = bitmap->n_words * sizeof(uint64_t);
+	char *tmp_file = mem_printf("%s.tmp", file);
+
+	// do not store the padding, which would be restored as set bits in a larger bitmap
+	uint64_t *words = mem_new(uint64_t, bitmap->n_words);
+	memcpy(words, bitmap->words, len);
+	if (bitmap->size % BITMAP_WORD_BITS)
+		words[bitmap->n_words - 1] &= ~(BITMAP_WORD_FULL << (bitmap->size % BITMAP_WORD_BITS));
+
+	if (file_write(tmp_file, (const char *)words, len) != len) {
+		ERROR("Failed to write bitmap file %s", tmp_file);
+		goto out;
+	}
+	if (rename(tmp_file, file)) {
+		ERROR_ERRNO("Failed to rename %s to %s", tmp_file, file);
+		unlink(tmp_file);
+		goto out;
+	}
+	ret = 0;
+out:
+	mem_free0(words);
+	mem_free0(tmp_file);
+	return ret;
+}
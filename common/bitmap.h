@@ -0,0 +1,129 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/**
+ * @file bitmap.h
+ *
+ * Implements a fixed size bitmap which allocates the lowest free bit, e.g., the
+ * offset of a resource assigned to a container. The words below the lowest one
+ * with a free bit are skipped, so that an allocation does not scan all bits which
+ * are in use. Single bits as well as ranges of bits can be set or reserved
+ * explicitly. A bitmap can be stored to and restored from a file, in host byte
+ * order.
+ */
+
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct bitmap bitmap_t;
+
+/**
+ * Creates a new bitmap with all bits cleared.
+ *
+ * @param size The number of bits of the bitmap.
+ * @return The newly created bitmap.
+ */
+bitmap_t *
+bitmap_new(size_t size);
+
+/**
+ * Creates a new bitmap of the given size from a file written by bitmap_write().
+ * Bits beyond the end of the file are cleared, bits of the file beyond size are
+ * ignored.
+ *
+ * @param file The file to be read.
+ * @param size The number of bits of the bitmap.
+ * @return The restored bitmap or NULL if the file could not be read.
+ */
+bitmap_t *
+bitmap_new_from_file(const char *file, size_t size);
+
+/**
+ * Frees the bitmap.
+ */
+void
+bitmap_free(bitmap_t *bitmap);
+
+/**
+ * Returns the number of bits of the bitmap.
+ */
+size_t
+bitmap_get_size(const bitmap_t *bitmap);
+
+/**
+ * Returns true if and only if the bit is set. Bits beyond the size of the bitmap
+ * are never set.
+ */
+bool
+bitmap_test(const bitmap_t *bitmap, size_t bit);
+
+/**
+ * Sets the bit.
+ *
+ * @return 0 on success, -1 if the bit was already set or is out of range
+ */
+int
+bitmap_set(bitmap_t *bitmap, size_t bit);
+
+/**
+ * Clears the bit. Bits out of range are ignored.
+ */
+void
+bitmap_clear(bitmap_t *bitmap, size_t bit);
+
+/**
+ * Reserves the range of len bits starting at start, i.e., sets them only if all
+ * of them are cleared.
+ *
+ * @return 0 on success, -1 if any bit of the range was set or is out of range
+ */
+int
+bitmap_set_range(bitmap_t *bitmap, size_t start, size_t len);
+
+/**
+ * Clears the range of len bits starting at start. Bits out of range are ignored.
+ */
+void
+bitmap_clear_range(bitmap_t *bitmap, size_t start, size_t len);
+
+/**
+ * Sets the lowest cleared bit.
+ *
+ * @return The index of the bit or -1 if all bits are set.
+ */
+int
+bitmap_set_next(bitmap_t *bitmap);
+
+/**
+ * Atomically replaces file by the contents of the bitmap.
+ *
+ * @return 0 on success, -1 on error
+ */
+int
+bitmap_write(const bitmap_t *bitmap, const char *file);
+
+#endif /* BITMAP_H */
@@ -0,0 +1,187 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "munit.h"
+
+#include "bitmap.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+	return NULL;
+}
+
+static void
+tear_down(UNUSED void *fixture)
+{
+	// No clean-up needed for now
+}
+
+static MunitResult
+test_set_next(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	bitmap_t *bitmap = bitmap_new(130);
+
+	// allocates the lowest free bits in order, across word boundaries
+	for (int i = 0; i < 130; i++)
+		munit_assert_int(bitmap_set_next(bitmap), ==, i);
+	munit_assert_int(bitmap_set_next(bitmap), ==, -1);
+
+	// released bits are reused lowest first
+	bitmap_clear(bitmap, 100);
+	bitmap_clear(bitmap, 3);
+	munit_assert_false(bitmap_test(bitmap, 3));
+	munit_assert_int(bitmap_set_next(bitmap), ==, 3);
+	munit_assert_int(bitmap_set_next(bitmap), ==, 100);
+	munit_assert_int(bitmap_set_next(bitmap), ==, -1);
+
+	// bits out of range are never set
+	munit_assert_false(bitmap_test(bitmap, 130));
+	munit_assert_int(bitmap_set(bitmap, 130), ==, -1);
+
+	bitmap_free(bitmap);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_set_range(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	bitmap_t *bitmap = bitmap_new(200);
+
+	munit_assert_int(bitmap_set(bitmap, 0), ==, 0);
+	munit_assert_int(bitmap_set(bitmap, 0), ==, -1);
+
+	// a range is only reserved if all of its bits are free
+	munit_assert_int(bitmap_set_range(bitmap, 60, 80), ==, 0);
+	munit_assert_int(bitmap_set_range(bitmap, 139, 2), ==, -1);
+	munit_assert_false(bitmap_test(bitmap, 140));
+	munit_assert_int(bitmap_set_range(bitmap, 190, 11), ==, -1);
+	munit_assert_int(bitmap_set_range(bitmap, 190, 10), ==, 0);
+
+	munit_assert_int(bitmap_set_next(bitmap), ==, 1);
+	for (int i = 2; i < 60; i++)
+		munit_assert_int(bitmap_set_next(bitmap), ==, i);
+	munit_assert_int(bitmap_set_next(bitmap), ==, 140);
+
+	bitmap_clear_range(bitmap, 70, 10);
+	munit_assert_true(bitmap_test(bitmap, 69));
+	munit_assert_false(bitmap_test(bitmap, 70));
+	munit_assert_false(bitmap_test(bitmap, 79));
+	munit_assert_true(bitmap_test(bitmap, 80));
+	munit_assert_int(bitmap_set_next(bitmap), ==, 70);
+
+	bitmap_free(bitmap);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_write_restore(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	char *dir = mem_strdup("/tmp/bitmap-test-XXXXXX");
+	munit_assert_not_null(mkdtemp(dir));
+	char *file = mem_printf("%s/bitmap", dir);
+
+	bitmap_t *bitmap = bitmap_new(100);
+	munit_assert_int(bitmap_set(bitmap, 5), ==, 0);
+	munit_assert_int(bitmap_set(bitmap, 99), ==, 0);
+	munit_assert_int(bitmap_write(bitmap, file), ==, 0);
+	bitmap_free(bitmap);
+
+	munit_assert_null(bitmap_new_from_file("/nonexistent/bitmap", 100));
+
+	bitmap = bitmap_new_from_file(file, 100);
+	munit_assert_not_null(bitmap);
+	munit_assert_true(bitmap_test(bitmap, 5));
+	munit_assert_true(bitmap_test(bitmap, 99));
+	munit_assert_int(bitmap_set_next(bitmap), ==, 0);
+	bitmap_free(bitmap);
+
+	// a larger bitmap keeps the stored bits, a smaller one drops the bits beyond its size
+	bitmap = bitmap_new_from_file(file, 1000);
+	munit_assert_true(bitmap_test(bitmap, 99));
+	munit_assert_false(bitmap_test(bitmap, 100));
+	munit_assert_false(bitmap_test(bitmap, 128));
+	bitmap_free(bitmap);
+
+	bitmap = bitmap_new_from_file(file, 10);
+	munit_assert_true(bitmap_test(bitmap, 5));
+	munit_assert_false(bitmap_test(bitmap, 99));
+	for (int i = 0; i < 9; i++)
+		munit_assert_int(bitmap_set_next(bitmap), ==, i < 5 ? i : i + 1);
+	munit_assert_int(bitmap_set_next(bitmap), ==, -1);
+	bitmap_free(bitmap);
+
+	unlink(file);
+	rmdir(dir);
+	mem_free0(file);
+	mem_free0(dir);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/set next",		/* name */
+		test_set_next,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/set range",		/* name */
+		test_set_range,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/write and restore",	/* name */
+		test_write_restore,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite bitmap_suite = {
+	"/bitmap",		/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
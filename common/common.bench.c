@@ -0,0 +1,1054 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * Micro-benchmarks of the common primitives, built by "make common.bench".
+ *
+ * Usage: common.bench [-r <rounds>] [-u <uevent capture>] [<benchmark name prefix>...]
+ *        common.bench -R <uevent capture> [-n <count>]
+ *
+ * Each benchmark is run for each of its parameters (e.g. the number of registrations
+ * or the block size) in the given number of rounds after one warm-up round. One JSON
+ * object is printed to stdout per benchmark and parameter, so the results of releases
+ * can be compared by scripts:
+ *
+ * {"bench":"event_io","param":100,"unit":"op","count":100000,"rounds":5,
+ *  "min_ns":..., "median_ns":..., "max_ns":..., "ns_per_unit":..., "units_per_sec":...,
+ *  "cpu_ns_per_unit":...}
+ *
+ * count is the number of units (operations or bytes) processed per round, ns_per_unit
+ * and units_per_sec are derived from the median round, cpu_ns_per_unit from the median
+ * CPU time of the process per round. Only the run of a round is timed, not the setup
+ * and teardown of its fixture.
+ *
+ * The uevent benchmarks replay the capture given with -u, by default the USB storm
+ * of testdata/uevent.capture. With -R, the kernel uevents of the device are recorded
+ * to a capture instead, e.g. during a coldboot or while plugging in USB devices.
+ */
+
+#define _GNU_SOURCE
+
+#include "event.h"
+#include "file.h"
+#include "hashmap.h"
+#include "list.h"
+#include "logf.h"
+#include "macro.h"
+#include "mem.h"
+#include "nl.h"
+#include "protobuf.h"
+#include "ssl_util.h"
+#include "str.h"
+#include "uevent.h"
+
+#include "audit.pb-c.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_ROUNDS_DEFAULT 5
+#define BENCH_ROUNDS_MAX 100
+
+// number of callbacks dispatched per round of the event benchmarks
+#define BENCH_EVENT_DISPATCHES 100000
+// number of lookups per round of the list and hashmap benchmarks
+#define BENCH_LOOKUPS 100000
+// number of messages per round of the protobuf benchmarks
+#define BENCH_MESSAGES 20000
+// size of the file copied and hashed by the file benchmarks
+#define BENCH_FILE_SIZE (16 * 1024 * 1024)
+// number of appends per round of the str benchmarks
+#define BENCH_APPENDS 1000000
+// number of passes over the capture per round of the uevent benchmark
+#define BENCH_UEVENT_PASSES 20000
+
+#define BENCH_UEVENT_CAPTURE "testdata/uevent.capture"
+// entries of the device allow list of each container of the uevent dispatch benchmark
+#define BENCH_UEVENT_CONTAINER_DEVS 12
+
+typedef struct bench {
+	const char *name;
+	const char *unit;     // "op" or "byte"
+	const size_t *params; // parameters the benchmark is run for
+	size_t params_len;
+	void *(*setup)(size_t param);		    // returns the fixture or NULL on error
+	size_t (*run)(void *fixture, size_t param); // returns the processed units, 0 on error
+	void (*teardown)(void *fixture);
+} bench_t;
+
+static uint64_t
+bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t
+bench_cpu_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static char *bench_tmpdir = NULL;
+static const char *bench_uevent_capture = BENCH_UEVENT_CAPTURE;
+
+/******************************************************************************/
+
+/*
+ * Event loop dispatch: the fixture registers param events which are all ready at
+ * once, e.g. pipes with unread data. After BENCH_EVENT_DISPATCHES callbacks, each
+ * event removes itself on its next callback, which leaves the loop. An event must not
+ * remove others, they may be pending in the same epoll batch.
+ */
+typedef struct bench_event {
+	size_t n;
+	size_t count;
+	int *fds; // pipes of the io benchmark, files of the inotify benchmark
+	char **paths;
+	event_io_t **ios;
+	event_timer_t **timers;
+	event_inotify_t **inotifies;
+} bench_event_t;
+
+static void
+bench_event_free(void *fixture)
+{
+	bench_event_t *b = fixture;
+	IF_NULL_RETURN(b);
+
+	for (size_t i = 0; i < b->n; i++) {
+		if (b->ios && b->ios[i])
+			event_io_free(b->ios[i]);
+		if (b->timers && b->timers[i])
+			event_timer_free(b->timers[i]);
+		if (b->inotifies && b->inotifies[i])
+			event_inotify_free(b->inotifies[i]);
+		if (b->paths && b->paths[i]) {
+			unlink(b->paths[i]);
+			mem_free0(b->paths[i]);
+		}
+	}
+	for (size_t i = 0; b->fds && i < 2 * b->n; i++)
+		if (b->fds[i] >= 0)
+			close(b->fds[i]);
+	mem_free0(b->fds);
+	mem_free0(b->paths);
+	mem_free0(b->ios);
+	mem_free0(b->timers);
+	mem_free0(b->inotifies);
+	mem_free0(b);
+}
+
+static bench_event_t *
+bench_event_new(size_t n)
+{
+	bench_event_t *b = mem_new0(bench_event_t, 1);
+	b->n = n;
+	b->fds = mem_new(int, 2 * n);
+	for (size_t i = 0; i < 2 * n; i++)
+		b->fds[i] = -1;
+	return b;
+}
+
+static void
+bench_event_io_cb(UNUSED int fd, UNUSED unsigned events, event_io_t *io, void *data)
+{
+	bench_event_t *b = data;
+	if (++b->count >= BENCH_EVENT_DISPATCHES)
+		event_remove_io(io);
+}
+
+static void *
+bench_event_io_setup(size_t n)
+{
+	bench_event_t *b = bench_event_new(n);
+	b->ios = mem_new0(event_io_t *, n);
+
+	for (size_t i = 0; i < n; i++) {
+		IF_TRUE_GOTO_ERROR_ERRNO(pipe2(&b->fds[2 * i], O_CLOEXEC | O_NONBLOCK) < 0, err);
+		// the data is never read, the pipe stays readable
+		IF_TRUE_GOTO_ERROR_ERRNO(write(b->fds[2 * i + 1], "x", 1) != 1, err);
+		b->ios[i] = event_io_new(b->fds[2 * i], EVENT_IO_READ, bench_event_io_cb, b);
+	}
+	return b;
+err:
+	bench_event_free(b);
+	return NULL;
+}
+
+static size_t
+bench_event_io_run(void *fixture, UNUSED size_t n)
+{
+	bench_event_t *b = fixture;
+	b->count = 0;
+	for (size_t i = 0; i < b->n; i++)
+		event_add_io(b->ios[i]);
+	event_loop();
+	return b->count;
+}
+
+static void
+bench_event_timer_cb(event_timer_t *timer, void *data)
+{
+	bench_event_t *b = data;
+	if (++b->count >= BENCH_EVENT_DISPATCHES)
+		event_remove_timer(timer);
+}
+
+static void *
+bench_event_timer_setup(size_t n)
+{
+	bench_event_t *b = bench_event_new(n);
+	b->timers = mem_new0(event_timer_t *, n);
+
+	// expired timers are due again at once
+	for (size_t i = 0; i < n; i++)
+		b->timers[i] =
+			event_timer_new(0, EVENT_TIMER_REPEAT_FOREVER, bench_event_timer_cb, b);
+	return b;
+}
+
+static size_t
+bench_event_timer_run(void *fixture, UNUSED size_t n)
+{
+	bench_event_t *b = fixture;
+	b->count = 0;
+	for (size_t i = 0; i < b->n; i++)
+		event_add_timer(b->timers[i]);
+	event_loop();
+	return b->count;
+}
+
+/*
+ * Each inotify callback modifies the next of the watched files, so a single event is
+ * pending at a time and the lookup of its handler among all watches is measured.
+ */
+static void
+bench_event_inotify_cb(UNUSED const char *path, UNUSED uint32_t mask, event_inotify_t *inotify,
+		       void *data)
+{
+	bench_event_t *b = data;
+	if (++b->count >= BENCH_EVENT_DISPATCHES) {
+		for (size_t i = 0; i < b->n; i++)
+			event_remove_inotify(b->inotifies[i]);
+		return;
+	}
+
+	size_t i = 0;
+	while (b->inotifies[i] != inotify)
+		i++;
+	i = (i + 1) % b->n;
+	if (pwrite(b->fds[i], "x", 1, 0) != 1)
+		FATAL_ERRNO("Could not write %s", b->paths[i]);
+}
+
+static void *
+bench_event_inotify_setup(size_t n)
+{
+	bench_event_t *b = bench_event_new(n);
+	b->paths = mem_new0(char *, n);
+	b->inotifies = mem_new0(event_inotify_t *, n);
+
+	for (size_t i = 0; i < n; i++) {
+		b->paths[i] = mem_printf("%s/inotify.%zu", bench_tmpdir, i);
+		b->fds[i] = open(b->paths[i], O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+		IF_TRUE_GOTO_ERROR_ERRNO(b->fds[i] < 0, err);
+		b->inotifies[i] =
+			event_inotify_new(b->paths[i], IN_MODIFY, bench_event_inotify_cb, b);
+	}
+	return b;
+err:
+	bench_event_free(b);
+	return NULL;
+}
+
+static size_t
+bench_event_inotify_run(void *fixture, UNUSED size_t n)
+{
+	bench_event_t *b = fixture;
+	b->count = 0;
+	for (size_t i = 0; i < b->n; i++)
+		IF_TRUE_RETVAL(event_add_inotify(b->inotifies[i]) < 0, 0);
+	IF_TRUE_RETVAL(pwrite(b->fds[0], "x", 1, 0) != 1, 0);
+	event_loop();
+	return b->count;
+}
+
+/******************************************************************************/
+
+/*
+ * Lookup of string keys among param entries, by walking a list as most registries
+ * do and by a hashmap.
+ */
+typedef struct bench_lookup {
+	size_t n;
+	char **keys;
+	list_t *list;
+	hashmap_t *map;
+} bench_lookup_t;
+
+static void
+bench_lookup_teardown(void *fixture)
+{
+	bench_lookup_t *b = fixture;
+	list_delete(b->list);
+	if (b->map)
+		hashmap_free(b->map);
+	for (size_t i = 0; i < b->n; i++)
+		mem_free0(b->keys[i]);
+	mem_free0(b->keys);
+	mem_free0(b);
+}
+
+static void *
+bench_lookup_setup(size_t n)
+{
+	bench_lookup_t *b = mem_new0(bench_lookup_t, 1);
+	b->n = n;
+	b->keys = mem_new0(char *, n);
+	b->map = hashmap_new_str();
+	for (size_t i = 0; i < n; i++) {
+		// keys with a common prefix like the uuids and paths of the registries
+		b->keys[i] = mem_printf("00000000-0000-0000-0000-%012zu", i);
+		b->list = list_append(b->list, b->keys[i]);
+		hashmap_put(b->map, b->keys[i], b->keys[i]);
+	}
+	return b;
+}
+
+static size_t
+bench_lookup_list_run(void *fixture, UNUSED size_t n)
+{
+	bench_lookup_t *b = fixture;
+	size_t found = 0;
+	for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+		const char *key = b->keys[(i * 7919) % b->n];
+		for (list_t *l = b->list; l; l = l->next) {
+			if (!strcmp(l->data, key)) {
+				found++;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+static size_t
+bench_lookup_hashmap_run(void *fixture, UNUSED size_t n)
+{
+	bench_lookup_t *b = fixture;
+	size_t found = 0;
+	for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+		if (hashmap_get(b->map, b->keys[(i * 7919) % b->n]))
+			found++;
+	}
+	return found;
+}
+
+/******************************************************************************/
+
+/*
+ * Audit records with param meta entries, packed only or sent and received over a
+ * socketpair as the daemons do with their control messages.
+ */
+typedef struct bench_protobuf {
+	AuditRecord record;
+	AuditRecord__Meta *metas;
+	AuditRecord__Meta **meta_ptrs;
+	int sv[2];
+} bench_protobuf_t;
+
+static void
+bench_protobuf_teardown(void *fixture)
+{
+	bench_protobuf_t *b = fixture;
+	if (b->sv[0] >= 0)
+		close(b->sv[0]);
+	if (b->sv[1] >= 0)
+		close(b->sv[1]);
+	mem_free0(b->meta_ptrs);
+	mem_free0(b->metas);
+	mem_free0(b);
+}
+
+static void *
+bench_protobuf_setup(size_t n)
+{
+	bench_protobuf_t *b = mem_new0(bench_protobuf_t, 1);
+	AuditRecord record = AUDIT_RECORD__INIT;
+	b->record = record;
+	b->record.timestamp = 1700000000;
+	b->record.type = "CONTAINER_MGMT";
+	b->record.subject_id = "00000000-0000-0000-0000-000000000000";
+
+	b->metas = mem_new0(AuditRecord__Meta, n);
+	b->meta_ptrs = mem_new0(AuditRecord__Meta *, n);
+	for (size_t i = 0; i < n; i++) {
+		AuditRecord__Meta meta = AUDIT_RECORD__META__INIT;
+		b->metas[i] = meta;
+		b->metas[i].key = "name";
+		b->metas[i].value = "container-value";
+		b->meta_ptrs[i] = &b->metas[i];
+	}
+	b->record.n_meta = n;
+	b->record.meta = b->meta_ptrs;
+
+	b->sv[0] = b->sv[1] = -1;
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, b->sv) < 0) {
+		ERROR_ERRNO("Could not create socketpair");
+		bench_protobuf_teardown(b);
+		return NULL;
+	}
+	return b;
+}
+
+static size_t
+bench_protobuf_pack_run(void *fixture, UNUSED size_t n)
+{
+	bench_protobuf_t *b = fixture;
+	for (size_t i = 0; i < BENCH_MESSAGES; i++) {
+		uint8_t *buf = NULL;
+		protobuf_pack_message_new((ProtobufCMessage *)&b->record, &buf);
+		IF_NULL_RETVAL(buf, 0);
+		mem_free0(buf);
+	}
+	return BENCH_MESSAGES;
+}
+
+static size_t
+bench_protobuf_send_recv_run(void *fixture, UNUSED size_t n)
+{
+	bench_protobuf_t *b = fixture;
+	for (size_t i = 0; i < BENCH_MESSAGES; i++) {
+		IF_TRUE_RETVAL(protobuf_send_message(b->sv[0], (ProtobufCMessage *)&b->record) < 0,
+			       0);
+		ProtobufCMessage *msg = protobuf_recv_message(b->sv[1], &audit_record__descriptor);
+		IF_NULL_RETVAL(msg, 0);
+		protobuf_free_message(msg);
+	}
+	return BENCH_MESSAGES;
+}
+
+/******************************************************************************/
+
+/*
+ * A file of BENCH_FILE_SIZE random bytes, copied with param as block size or hashed.
+ * The file stays in the page cache, so the copy and hash code is measured, not the disk.
+ */
+typedef struct bench_file {
+	char *in;
+	char *out;
+} bench_file_t;
+
+static void
+bench_file_teardown(void *fixture)
+{
+	bench_file_t *b = fixture;
+	unlink(b->in);
+	unlink(b->out);
+	mem_free0(b->in);
+	mem_free0(b->out);
+	mem_free0(b);
+}
+
+static void *
+bench_file_setup(UNUSED size_t param)
+{
+	bench_file_t *b = mem_new0(bench_file_t, 1);
+	b->in = mem_printf("%s/file.in", bench_tmpdir);
+	b->out = mem_printf("%s/file.out", bench_tmpdir);
+
+	char *data = mem_alloc(BENCH_FILE_SIZE);
+	srand(42);
+	for (size_t i = 0; i < BENCH_FILE_SIZE; i++)
+		data[i] = rand();
+	int ret = file_write(b->in, data, BENCH_FILE_SIZE);
+	mem_free0(data);
+
+	if (ret < 0) {
+		bench_file_teardown(b);
+		return NULL;
+	}
+	return b;
+}
+
+static size_t
+bench_file_copy_run(void *fixture, size_t bs)
+{
+	bench_file_t *b = fixture;
+	unlink(b->out);
+	IF_TRUE_RETVAL(file_copy(b->in, b->out, -1, bs, 0) < 0, 0);
+	return BENCH_FILE_SIZE;
+}
+
+static size_t
+bench_ssl_hash_file_run(void *fixture, UNUSED size_t param)
+{
+	bench_file_t *b = fixture;
+	unsigned int len;
+	unsigned char *hash = ssl_hash_file(b->in, &len, "SHA256");
+	IF_NULL_RETVAL(hash, 0);
+	mem_free0(hash);
+	return BENCH_FILE_SIZE;
+}
+
+/******************************************************************************/
+
+/*
+ * Appends of param bytes to a str_t which grows from empty.
+ */
+static void *
+bench_str_setup(size_t len)
+{
+	char *s = mem_alloc(len + 1);
+	memset(s, 'x', len);
+	s[len] = '\0';
+	return s;
+}
+
+static void
+bench_str_teardown(void *fixture)
+{
+	mem_free0(fixture);
+}
+
+static size_t
+bench_str_append_run(void *fixture, UNUSED size_t len)
+{
+	str_t *str = str_new(NULL);
+	for (size_t i = 0; i < BENCH_APPENDS; i++)
+		str_append(str, fixture);
+	str_free(str, true);
+	return BENCH_APPENDS;
+}
+
+/******************************************************************************/
+
+/*
+ * Parsing of uevents recorded by "udevadm monitor --kernel --property", the events
+ * are separated by empty lines.
+ */
+typedef struct bench_uevent {
+	list_t *events; // strings of the recorded events
+	size_t n;
+} bench_uevent_t;
+
+static void
+bench_uevent_teardown(void *fixture)
+{
+	bench_uevent_t *b = fixture;
+	for (list_t *l = b->events; l; l = l->next)
+		mem_free(l->data);
+	list_delete(b->events);
+	mem_free0(b);
+}
+
+static void *
+bench_uevent_setup(UNUSED size_t param)
+{
+	char *capture = file_read_new(bench_uevent_capture, UEVENT_BUF_LEN * 1024);
+	IF_NULL_RETVAL_ERROR(capture, NULL);
+
+	bench_uevent_t *b = mem_new0(bench_uevent_t, 1);
+	for (char *ev = capture; *ev;) {
+		char *end = strstr(ev, "\n\n");
+		size_t len = end ? (size_t)(end - ev + 1) : strlen(ev);
+		if (len > 1) {
+			b->events = list_append(b->events, mem_strndup(ev, len));
+			b->n++;
+		}
+		ev += end ? len + 1 : len;
+	}
+	mem_free0(capture);
+
+	if (!b->n) {
+		ERROR("No uevents in %s", bench_uevent_capture);
+		bench_uevent_teardown(b);
+		return NULL;
+	}
+	return b;
+}
+
+static size_t
+bench_uevent_parse_run(void *fixture, UNUSED size_t param)
+{
+	bench_uevent_t *b = fixture;
+	for (size_t i = 0; i < BENCH_UEVENT_PASSES; i++) {
+		for (list_t *l = b->events; l; l = l->next) {
+			uevent_event_t *event = uevent_parse_from_string_new(l->data);
+			IF_NULL_RETVAL(event, 0);
+			uevent_event_free(event);
+		}
+	}
+	return BENCH_UEVENT_PASSES * b->n;
+}
+
+/*
+ * Dispatch of the recorded uevents to the uevs which cmld registers for param
+ * containers: per container, c_hotplug registers one uev for all events with a device
+ * number and one for usb interfaces, and checks the device against the allow list of
+ * c_cgroups. hotplug registers one uev for net devices. The events are passed in raw,
+ * as received from the netlink socket, without creating device nodes or injecting them.
+ */
+typedef struct bench_uevent_dev {
+	char type;
+	int major;
+	int minor; // -1 for all
+} bench_uevent_dev_t;
+
+typedef struct bench_uevent_container {
+	char uuid[37];
+	list_t *allowed_devs; // bench_uevent_dev_t
+	uevent_uev_t *uev;
+	uevent_uev_t *uev_usbif;
+	size_t forwarded; // events which c_hotplug would inject into the container
+} bench_uevent_container_t;
+
+typedef struct bench_uevent_dispatch {
+	bench_uevent_t *capture;
+	char **msgs; // raw uevents in the format of the netlink socket
+	size_t *lens;
+	bench_uevent_container_t *containers;
+	size_t n_containers;
+	uevent_uev_t *uev_net;
+	size_t handled;
+} bench_uevent_dispatch_t;
+
+/*
+ * Converts an event recorded in the udevadm format into a raw kernel uevent, i.e.
+ * "<action>@<devpath>" followed by the properties, separated by NUL.
+ */
+static char *
+bench_uevent_raw_new(const char *ev, size_t *len)
+{
+	const char *props = ev;
+	if (!strncmp(props, "KERNEL[", 7) || !strncmp(props, "UDEV", 4))
+		props = strchr(props, '\n') ? strchr(props, '\n') + 1 : "";
+
+	const char *action = strstr(props, "ACTION=");
+	const char *devpath = strstr(props, "DEVPATH=");
+	IF_TRUE_RETVAL(!action || !devpath, NULL);
+
+	str_t *raw = str_new(NULL);
+	str_append_len(raw, action + 7, strcspn(action + 7, "\n"));
+	str_append(raw, "@");
+	str_append_len(raw, devpath + 8, strcspn(devpath + 8, "\n"));
+	str_append_len(raw, "", 1);
+	for (const char *line = props; *line;) {
+		size_t n = strcspn(line, "\n");
+		if (n > 0) {
+			str_append_len(raw, line, n);
+			str_append_len(raw, "", 1);
+		}
+		line += line[n] ? n + 1 : n;
+	}
+
+	*len = str_length(raw);
+	return str_free(raw, false);
+}
+
+static void
+bench_uevent_net_cb(UNUSED unsigned actions, UNUSED uevent_event_t *event, void *data)
+{
+	bench_uevent_dispatch_t *b = data;
+	b->handled++;
+}
+
+static bool
+bench_uevent_is_dev_allowed(const bench_uevent_container_t *c, char type, int major, int minor)
+{
+	for (list_t *l = c->allowed_devs; l; l = l->next) {
+		const bench_uevent_dev_t *dev = l->data;
+		if (dev->type == type && dev->major == major &&
+		    (dev->minor == minor || dev->minor == -1))
+			return true;
+	}
+	return false;
+}
+
+static void
+bench_uevent_hotplug_cb(UNUSED unsigned actions, uevent_event_t *event, void *data)
+{
+	bench_uevent_container_t *c = data;
+
+	if (!strncmp(uevent_event_get_subsystem(event), "usb", 3) &&
+	    !strncmp(uevent_event_get_devtype(event), "usb_interface", 13)) {
+		c->forwarded++;
+		return;
+	}
+
+	const char *devtype = uevent_event_get_devtype(event);
+	char type = (!strcmp(devtype, "disk") || !strcmp(devtype, "partition")) ? 'b' : 'c';
+	if (!bench_uevent_is_dev_allowed(c, type, uevent_event_get_major(event),
+					 uevent_event_get_minor(event)))
+		return;
+
+	// coldboot events are only handled by their target container
+	const char *synth_uuid = uevent_event_get_synth_uuid(event);
+	if (synth_uuid && *synth_uuid && strcmp(synth_uuid, c->uuid))
+		return;
+	c->forwarded++;
+}
+
+static void
+bench_uevent_dispatch_teardown(void *fixture)
+{
+	bench_uevent_dispatch_t *b = fixture;
+
+	for (size_t i = 0; i < b->n_containers; i++) {
+		bench_uevent_container_t *c = &b->containers[i];
+		uevent_remove_uev(c->uev);
+		uevent_uev_free(c->uev);
+		uevent_remove_uev(c->uev_usbif);
+		uevent_uev_free(c->uev_usbif);
+		for (list_t *l = c->allowed_devs; l; l = l->next)
+			mem_free(l->data);
+		list_delete(c->allowed_devs);
+	}
+	mem_free0(b->containers);
+	if (b->uev_net) {
+		uevent_remove_uev(b->uev_net);
+		uevent_uev_free(b->uev_net);
+	}
+
+	for (size_t i = 0; b->msgs && i < b->capture->n; i++)
+		mem_free0(b->msgs[i]);
+	mem_free0(b->msgs);
+	mem_free0(b->lens);
+	bench_uevent_teardown(b->capture);
+	mem_free0(b);
+}
+
+static void *
+bench_uevent_dispatch_setup(size_t param)
+{
+	// the generic allow list of c_cgroups and a usb and a block device of the container
+	static const bench_uevent_dev_t allowed[BENCH_UEVENT_CONTAINER_DEVS] = {
+		{ 'c', 0, 0 },	  { 'c', 1, 3 },   { 'c', 1, 5 },   { 'c', 1, 7 },
+		{ 'c', 1, 8 },	  { 'c', 1, 9 },   { 'c', 5, 2 },   { 'c', 10, 183 },
+		{ 'c', 10, 200 }, { 'c', 10, 229 }, { 'c', 189, -1 }, { 'b', 8, -1 },
+	};
+
+	bench_uevent_t *capture = bench_uevent_setup(0);
+	IF_NULL_RETVAL(capture, NULL);
+
+	bench_uevent_dispatch_t *b = mem_new0(bench_uevent_dispatch_t, 1);
+	b->capture = capture;
+	b->msgs = mem_new0(char *, capture->n);
+	b->lens = mem_new0(size_t, capture->n);
+	size_t i = 0;
+	for (list_t *l = capture->events; l; l = l->next, i++) {
+		b->msgs[i] = bench_uevent_raw_new(l->data, &b->lens[i]);
+		if (!b->msgs[i] || b->lens[i] >= UEVENT_BUF_LEN) {
+			ERROR("Invalid uevent in %s: %s", bench_uevent_capture, (char *)l->data);
+			goto err;
+		}
+	}
+
+	unsigned actions = UEVENT_ACTION_ADD | UEVENT_ACTION_CHANGE | UEVENT_ACTION_REMOVE |
+			   UEVENT_ACTION_BIND | UEVENT_ACTION_UNBIND;
+	b->containers = mem_new0(bench_uevent_container_t, param);
+	for (size_t n = 0; n < param; n++) {
+		bench_uevent_container_t *c = &b->containers[b->n_containers++];
+		snprintf(c->uuid, sizeof(c->uuid), "00000000-0000-0000-0000-%012zu", n);
+		for (size_t d = 0; d < BENCH_UEVENT_CONTAINER_DEVS; d++)
+			c->allowed_devs = list_append(c->allowed_devs,
+						      mem_memcpy((const unsigned char *)&allowed[d],
+								 sizeof(allowed[d])));
+
+		c->uev = uevent_uev_new_filtered(UEVENT_UEV_TYPE_KERNEL, actions, NULL, NULL,
+						 UEVENT_UEV_FILTER_DEVNUM, bench_uevent_hotplug_cb,
+						 c);
+		c->uev_usbif = uevent_uev_new_filtered(UEVENT_UEV_TYPE_KERNEL, actions, "usb",
+						       "usb_interface", 0, bench_uevent_hotplug_cb,
+						       c);
+		IF_TRUE_GOTO(uevent_add_uev(c->uev) || uevent_add_uev(c->uev_usbif), err);
+	}
+
+	b->uev_net = uevent_uev_new_filtered(UEVENT_UEV_TYPE_KERNEL, UEVENT_ACTION_ADD, "net",
+					     NULL, 0, bench_uevent_net_cb, b);
+	IF_TRUE_GOTO(uevent_add_uev(b->uev_net), err);
+	return b;
+
+err:
+	bench_uevent_dispatch_teardown(b);
+	return NULL;
+}
+
+static size_t
+bench_uevent_dispatch_run(void *fixture, UNUSED size_t param)
+{
+	bench_uevent_dispatch_t *b = fixture;
+	for (size_t i = 0; i < BENCH_UEVENT_PASSES; i++) {
+		for (size_t j = 0; j < b->capture->n; j++)
+			IF_TRUE_RETVAL(uevent_replay(b->msgs[j], b->lens[j]) < 0, 0);
+	}
+	return BENCH_UEVENT_PASSES * b->capture->n;
+}
+
+/******************************************************************************/
+
+static const size_t bench_registrations[] = { 10, 100, 1000 };
+static const size_t bench_meta_entries[] = { 1, 16, 256 };
+static const size_t bench_block_sizes[] = { 4096, 65536, 1024 * 1024 };
+static const size_t bench_append_lens[] = { 8, 64, 512 };
+static const size_t bench_containers[] = { 1, 16, 128 };
+static const size_t bench_none[] = { 0 };
+
+#define BENCH_PARAMS(p) p, sizeof(p) / sizeof(p[0])
+
+static const bench_t benches[] = {
+	{ "event_io", "op", BENCH_PARAMS(bench_registrations), bench_event_io_setup,
+	  bench_event_io_run, bench_event_free },
+	{ "event_timer", "op", BENCH_PARAMS(bench_registrations), bench_event_timer_setup,
+	  bench_event_timer_run, bench_event_free },
+	{ "event_inotify", "op", BENCH_PARAMS(bench_registrations), bench_event_inotify_setup,
+	  bench_event_inotify_run, bench_event_free },
+	{ "lookup_list", "op", BENCH_PARAMS(bench_registrations), bench_lookup_setup,
+	  bench_lookup_list_run, bench_lookup_teardown },
+	{ "lookup_hashmap", "op", BENCH_PARAMS(bench_registrations), bench_lookup_setup,
+	  bench_lookup_hashmap_run, bench_lookup_teardown },
+	{ "protobuf_pack", "op", BENCH_PARAMS(bench_meta_entries), bench_protobuf_setup,
+	  bench_protobuf_pack_run, bench_protobuf_teardown },
+	{ "protobuf_send_recv", "op", BENCH_PARAMS(bench_meta_entries), bench_protobuf_setup,
+	  bench_protobuf_send_recv_run, bench_protobuf_teardown },
+	{ "file_copy", "byte", BENCH_PARAMS(bench_block_sizes), bench_file_setup,
+	  bench_file_copy_run, bench_file_teardown },
+	{ "ssl_hash_file", "byte", BENCH_PARAMS(bench_none), bench_file_setup,
+	  bench_ssl_hash_file_run, bench_file_teardown },
+	{ "str_append", "op", BENCH_PARAMS(bench_append_lens), bench_str_setup,
+	  bench_str_append_run, bench_str_teardown },
+	{ "uevent_parse", "op", BENCH_PARAMS(bench_none), bench_uevent_setup,
+	  bench_uevent_parse_run, bench_uevent_teardown },
+	{ "uevent_dispatch", "op", BENCH_PARAMS(bench_containers), bench_uevent_dispatch_setup,
+	  bench_uevent_dispatch_run, bench_uevent_dispatch_teardown },
+};
+
+static int
+bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Runs the benchmark for one parameter and prints its result. Returns -1 on error.
+ */
+static int
+bench_run(const bench_t *bench, size_t param, int rounds)
+{
+	uint64_t times[BENCH_ROUNDS_MAX], cpu_times[BENCH_ROUNDS_MAX];
+	size_t count = 0;
+
+	// the first round warms up caches and is not accounted
+	for (int r = -1; r < rounds; r++) {
+		void *fixture = bench->setup(param);
+		if (!fixture) {
+			ERROR("Setup of %s(%zu) failed", bench->name, param);
+			return -1;
+		}
+
+		uint64_t start = bench_now_ns(), cpu_start = bench_cpu_ns();
+		count = bench->run(fixture, param);
+		uint64_t end = bench_now_ns(), cpu_end = bench_cpu_ns();
+
+		bench->teardown(fixture);
+		if (!count) {
+			ERROR("Run of %s(%zu) failed", bench->name, param);
+			return -1;
+		}
+		if (r >= 0) {
+			times[r] = end - start;
+			cpu_times[r] = cpu_end - cpu_start;
+		}
+	}
+
+	qsort(times, rounds, sizeof(uint64_t), bench_cmp_u64);
+	qsort(cpu_times, rounds, sizeof(uint64_t), bench_cmp_u64);
+	uint64_t median = times[rounds / 2];
+
+	printf("{\"bench\":\"%s\",\"param\":%zu,\"unit\":\"%s\",\"count\":%zu,\"rounds\":%d,"
+	       "\"min_ns\":%" PRIu64 ",\"median_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64
+	       ",\"ns_per_unit\":%.3f,\"units_per_sec\":%.0f,\"cpu_ns_per_unit\":%.3f}\n",
+	       bench->name, param, bench->unit, count, rounds, times[0], median, times[rounds - 1],
+	       (double)median / count, count * 1e9 / MAX(median, (uint64_t)1),
+	       (double)cpu_times[rounds / 2] / count);
+	fflush(stdout);
+	return 0;
+}
+
+static volatile sig_atomic_t bench_record_stop = 0;
+
+static void
+bench_record_sigint(UNUSED int signum)
+{
+	bench_record_stop = 1;
+}
+
+/*
+ * Records the kernel uevents of the netlink socket in the format of "udevadm monitor
+ * --kernel --property" to file, until count events are recorded (0 for no limit) or
+ * SIGINT is received. The recording can be replayed with -u.
+ */
+static int
+bench_uevent_record(const char *file, size_t count)
+{
+	nl_sock_t *nl = nl_sock_uevent_new(0);
+	IF_NULL_RETVAL_ERROR(nl, -1);
+
+	FILE *f = fopen(file, "we");
+	if (!f) {
+		ERROR_ERRNO("Could not create %s", file);
+		nl_sock_free(nl);
+		return -1;
+	}
+
+	// without SA_RESTART, so that SIGINT interrupts the poll
+	struct sigaction sa = { .sa_handler = bench_record_sigint };
+	sigaction(SIGINT, &sa, NULL);
+
+	char *buf = mem_alloc(UEVENT_BUF_LEN);
+	struct pollfd pfd = { .fd = nl_sock_get_fd(nl), .events = POLLIN };
+	size_t recorded = 0;
+	while (!bench_record_stop && (!count || recorded < count)) {
+		int len;
+		if (poll(&pfd, 1, -1) < 0 || nl_msg_receive_uevents(nl, &buf, UEVENT_BUF_LEN - 1,
+								     &len, 1) != 1 || len <= 0)
+			continue;
+		buf[len] = '\0';
+
+		// udev messages start with "libudev", only the kernel uevents are recorded
+		char *at = strchr(buf, '@');
+		if (!strncmp(buf, "libudev", 7) || !at)
+			continue;
+
+		const char *subsystem = "";
+		for (char *p = buf + strlen(buf) + 1; p < buf + len; p += strlen(p) + 1) {
+			if (!strncmp(p, "SUBSYSTEM=", 10))
+				subsystem = p + 10;
+		}
+
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		fprintf(f, "KERNEL[%ld.%06ld] %-8.*s %s (%s)\n", (long)ts.tv_sec,
+			ts.tv_nsec / 1000, (int)(at - buf), buf, at + 1, subsystem);
+		for (char *p = buf + strlen(buf) + 1; p < buf + len; p += strlen(p) + 1) {
+			if (*p)
+				fprintf(f, "%s\n", p);
+		}
+		fprintf(f, "\n");
+		recorded++;
+	}
+
+	mem_free0(buf);
+	nl_sock_free(nl);
+	if (fclose(f) != 0) {
+		ERROR_ERRNO("Could not write %s", file);
+		return -1;
+	}
+	fprintf(stderr, "Recorded %zu uevents to %s\n", recorded, file);
+	return 0;
+}
+
+static bool
+bench_selected(const bench_t *bench, int argc, char **argv)
+{
+	if (argc == 0)
+		return true;
+	for (int i = 0; i < argc; i++)
+		if (!strncmp(bench->name, argv[i], strlen(argv[i])))
+			return true;
+	return false;
+}
+
+int
+main(int argc, char **argv)
+{
+	int rounds = BENCH_ROUNDS_DEFAULT;
+	const char *record_file = NULL;
+	size_t record_count = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:u:R:n:")) != -1) {
+		if (opt == 'r' && atoi(optarg) > 0 && atoi(optarg) <= BENCH_ROUNDS_MAX) {
+			rounds = atoi(optarg);
+		} else if (opt == 'u') {
+			bench_uevent_capture = optarg;
+		} else if (opt == 'R') {
+			record_file = optarg;
+		} else if (opt == 'n') {
+			record_count = strtoul(optarg, NULL, 10);
+		} else {
+			fprintf(stderr,
+				"Usage: %s [-r <rounds 1-%d>] [-u <uevent capture>] "
+				"[<benchmark name prefix>...]\n"
+				"       %s -R <uevent capture> [-n <count>]\n",
+				argv[0], BENCH_ROUNDS_MAX, argv[0]);
+			return 2;
+		}
+	}
+
+	logf_handler_set_prio(logf_register(&logf_file_write, stderr), LOGF_PRIO_WARN);
+
+	if (record_file)
+		return bench_uevent_record(record_file, record_count) < 0 ? 1 : 0;
+
+	char tmpdir[] = "/tmp/common.bench.XXXXXX";
+	if (!mkdtemp(tmpdir)) {
+		ERROR_ERRNO("Could not create temporary directory");
+		return 1;
+	}
+	bench_tmpdir = tmpdir;
+
+	event_init();
+	ssl_init(false, NULL);
+	// uevents are only replayed, without receiving those of the host
+	uevent_replay_enable();
+
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (!bench_selected(&benches[i], argc - optind, argv + optind))
+			continue;
+		for (size_t p = 0; p < benches[i].params_len; p++)
+			if (bench_run(&benches[i], benches[i].params[p], rounds) < 0)
+				failed++;
+	}
+
+	ssl_free();
+	rmdir(tmpdir);
+	return failed ? 1 : 0;
+}
@@ -3,6 +3,20 @@
 extern MunitSuite mem_suite;
 extern MunitSuite macro_suite;
 extern MunitSuite ssl_util_suite;
+extern MunitSuite hashmap_suite;
+extern MunitSuite vector_suite;
+extern MunitSuite file_suite;
+extern MunitSuite dir_suite;
+extern MunitSuite nl_suite;
+extern MunitSuite bitmap_suite;
+extern MunitSuite logf_suite;
+extern MunitSuite logrotate_suite;
+extern MunitSuite fd_suite;
+extern MunitSuite ns_suite;
+extern MunitSuite str_suite;
+extern MunitSuite digest_suite;
+extern MunitSuite metrics_suite;
+extern MunitSuite fsverity_suite;
 
 int
 main(int argc, char *argv[MUNIT_ARRAY_PARAM(argc + 1)])
@@ -12,6 +26,20 @@ main(int argc, char *argv[MUNIT_ARRAY_PARAM(argc + 1)])
 	failed += munit_suite_main(&mem_suite, NULL, argc, argv);
 	failed += munit_suite_main(&macro_suite, NULL, argc, argv);
 	failed += munit_suite_main(&ssl_util_suite, NULL, argc, argv);
+	failed += munit_suite_main(&hashmap_suite, NULL, argc, argv);
+	failed += munit_suite_main(&vector_suite, NULL, argc, argv);
+	failed += munit_suite_main(&file_suite, NULL, argc, argv);
+	failed += munit_suite_main(&dir_suite, NULL, argc, argv);
+	failed += munit_suite_main(&nl_suite, NULL, argc, argv);
+	failed += munit_suite_main(&bitmap_suite, NULL, argc, argv);
+	failed += munit_suite_main(&logf_suite, NULL, argc, argv);
+	failed += munit_suite_main(&logrotate_suite, NULL, argc, argv);
+	failed += munit_suite_main(&fd_suite, NULL, argc, argv);
+	failed += munit_suite_main(&ns_suite, NULL, argc, argv);
+	failed += munit_suite_main(&str_suite, NULL, argc, argv);
+	failed += munit_suite_main(&digest_suite, NULL, argc, argv);
+	failed += munit_suite_main(&metrics_suite, NULL, argc, argv);
+	failed += munit_suite_main(&fsverity_suite, NULL, argc, argv);
 
 	return failed;
 }
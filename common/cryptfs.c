@@ -37,10 +37,12 @@
 #include <sys/param.h>
 #include <string.h>
 #include <sys/mount.h>
+#include <sys/ioctl.h>
 #include <errno.h>
 #include <linux/kdev_t.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <sys/sysmacros.h>
 
 #include "cryptfs.h"
 #include "macro.h"
@@ -49,15 +51,26 @@
 #include "file.h"
 #include "dm.h"
 
-#define TABLE_LOAD_RETRIES 10
 #define INTEGRITY_TAG_SIZE 32
+#define SECTOR_SIZE 512
 #define CRYPTO_TYPE_AUTHENC "capi:authenc(hmac(sha256),xts(aes))-random"
 #define CRYPTO_TYPE "aes-xts-plain64"
+// blk-crypto mode of the inline encryption hardware and the dm target using it
+#define INLINE_CRYPT_MODE "AES-256-XTS"
+#define INLINE_CRYPT_TARGET "default-key"
 
 /* taken from vold */
-#define DEVMAPPER_BUFFER_SIZE 4096
 #define DM_CRYPT_BUF_SIZE 4096
 #define DM_INTEGRITY_BUF_SIZE 4096
+// size of the writes by which a new integrity protected volume is wiped without BLKZEROOUT
+#define CRYPTFS_WIPE_BUF_SIZE (1024 * 1024)
+
+// bytes at the start and the end of a volume formatted with CRYPTFS_FLAG_LAZY_INIT
+#define CRYPTFS_LAZY_INIT_EDGE (1024 * 1024)
+
+#ifndef BLKZEROOUT
+#define BLKZEROOUT _IO(0x12, 127)
+#endif
 
 /* FIXME Rejig library to record & use errno instead */
 #ifndef DM_EXISTS_FLAG
@@ -101,317 +114,204 @@ convert_key_to_hex_ascii(unsigned char *master_key, unsigned int keysize,
 }
 #endif
 
-static int
-load_integrity_mapping_table(int fd, const char *real_blk_name, const char *meta_blk_name,
-			     const char *name, int fs_size)
-{
-	// General variables
-	int ioctl_ret;
-
-	// Load mapping variables
-	char mapping_buffer[DM_INTEGRITY_BUF_SIZE];
-	struct dm_target_spec *tgt;
-	struct dm_ioctl *mapping_io;
-	char *integrity_params;
-	char *extra_params = mem_printf("1 meta_device:%s", meta_blk_name);
-	int mapping_counter;
-
-	mapping_io = (struct dm_ioctl *)mapping_buffer;
-
-	/* Load the mapping table for this device */
-	tgt = (struct dm_target_spec *)&mapping_buffer[sizeof(struct dm_ioctl)];
-
-	// Configure parameters for ioctl
-	dm_ioctl_init(mapping_io, INDEX_DM_TABLE_LOAD, DM_INTEGRITY_BUF_SIZE, name, NULL, 0, 0, 0,
-		      0);
-	mapping_io->target_count = 1;
-	tgt->status = 0;
-	tgt->sector_start = 0;
-	tgt->length = fs_size;
-	strcpy(tgt->target_type, "integrity");
-
-	// Write the intergity parameters at the end after dm_target_spec
-	integrity_params = mapping_buffer + sizeof(struct dm_ioctl) + sizeof(struct dm_target_spec);
-
-	// Write parameter
-	// these parameters are used in [1] as well as by dmsetup when traced with strace
-	snprintf(integrity_params,
-		 DM_INTEGRITY_BUF_SIZE - sizeof(struct dm_ioctl) - sizeof(struct dm_target_spec),
-		 "%s 0 %d J %s", real_blk_name, INTEGRITY_TAG_SIZE, extra_params);
-
-	mem_free0(extra_params);
-
-	// Set pointer behind parameter
-	integrity_params += strlen(integrity_params) + 1;
-	// Byte align the parameter
-	integrity_params = (char *)(((unsigned long)integrity_params + 7) &
-				    ~8); /* Align to an 8 byte boundary */
-	// Set tgt->next right behind dm_target_spec
-	tgt->next = integrity_params - mapping_buffer;
-
-	for (mapping_counter = 0; mapping_counter < TABLE_LOAD_RETRIES; mapping_counter++) {
-		ioctl_ret = dm_ioctl(fd, DM_TABLE_LOAD, mapping_io);
-
-		if (ioctl_ret == 0) {
-			DEBUG("DM_TABLE_LOAD successfully returned %d", ioctl_ret);
-			break;
-		}
-		NANOSLEEP(0, 500000000)
-	}
-
-	// Check that loading the table worked
-	if (mapping_counter >= TABLE_LOAD_RETRIES) {
-		ERROR_ERRNO("Loading integrity mapping table did not work after %d tries",
-			    mapping_counter);
-		return -1;
-	}
-	return mapping_counter + 1;
-}
-
-static int
-load_crypto_mapping_table(int fd, const char *real_blk_name, const char *master_key_ascii,
-			  const char *name, int fs_size, bool integrity)
-{
-	char buffer[DM_CRYPT_BUF_SIZE];
-	struct dm_ioctl *io;
-	struct dm_target_spec *tgt;
-	char *crypt_params;
-	char *extra_params = integrity ? mem_printf("1 integrity:%d:aead", INTEGRITY_TAG_SIZE) :
-					 mem_printf("1 allow_discards");
-
-	const char *crypto_type = integrity ? CRYPTO_TYPE_AUTHENC : CRYPTO_TYPE;
-
-	int i;
-	int ioctl_ret;
-
-	TRACE("Loading crypto mapping table (%s,%s,%s,%s,%d,%d)", real_blk_name, crypto_type,
-	      master_key_ascii, name, fs_size, fd);
-
-	io = (struct dm_ioctl *)buffer;
-
-	/* Load the mapping table for this device */
-	tgt = (struct dm_target_spec *)&buffer[sizeof(struct dm_ioctl)];
-
-	dm_ioctl_init(io, INDEX_DM_TABLE_LOAD, DM_CRYPT_BUF_SIZE, name, NULL, DM_EXISTS_FLAG, 0, 0,
-		      0);
-	io->target_count = 1;
-	tgt->status = 0;
-	tgt->sector_start = 0;
-	tgt->length = fs_size;
-	strcpy(tgt->target_type, "crypt");
-
-	crypt_params = buffer + sizeof(struct dm_ioctl) + sizeof(struct dm_target_spec);
-	snprintf(crypt_params,
-		 DM_CRYPT_BUF_SIZE - sizeof(struct dm_ioctl) - sizeof(struct dm_target_spec),
-		 "%s %s 0 %s 0 %s", crypto_type, master_key_ascii, real_blk_name, extra_params);
-	mem_free0(extra_params);
-
-	crypt_params += strlen(crypt_params) + 1;
-	crypt_params =
-		(char *)(((unsigned long)crypt_params + 7) & ~8); /* Align to an 8 byte boundary */
-	tgt->next = crypt_params - buffer;
-
-	for (i = 0; i < TABLE_LOAD_RETRIES; i++) {
-		ioctl_ret = dm_ioctl(fd, DM_TABLE_LOAD, io);
-		if (!ioctl_ret) {
-			DEBUG("Loading device table successfull.");
-			break;
-		}
-		NANOSLEEP(0, 500000000)
-	}
-
-	if (i == TABLE_LOAD_RETRIES) {
-		/* We failed to load the table, return an error */
-		ERROR_ERRNO("Loading crypto mapping table did not work after %d tries", i);
-		return -1;
-	} else {
-		return i + 1;
-	}
-}
-
 /**
- * Creates an integrity block device with DM_DEV_CREATE ioctl, reloads the mapping
- * table with DM_TABLE_LOADE ioctl and resumes the device with DM_DEV_SUSPEND ioctl
+ * Creates an integrity block device which stores the integrity tags of the dm-crypt
+ * device on top on a separate meta device.
  *
  * [1] https://www.kernel.org/doc/html/latest/admin-guide/device-mapper/dm-integrity.html
  * [2] https://wiki.gentoo.org/wiki/Device-mapper#Integrity
  *
- * @return int 0 if successful, otherwise -1
+ * @return The path of the device node or NULL on error
  */
-static int
-create_integrity_blk_dev(const char *real_blk_name, const char *meta_blk_name, const char *name,
-			 const unsigned long fs_size)
+static char *
+create_integrity_blk_dev_new(int fd, const char *real_blk_name, const char *meta_blk_name,
+			     const char *name, unsigned long fs_size, const cryptfs_opts_t *opts)
 {
-	int fd;
-	int ioctl_ret;
-	int load_count = -1;
-	char create_buffer[DM_INTEGRITY_BUF_SIZE];
-	struct dm_ioctl *create_io;
-	int create_counter;
-
-	// Open device mapper
-	if ((fd = open(DM_CONTROL, O_RDWR)) < 0) {
-		ERROR_ERRNO("Cannot open device-mapper");
-	}
-
-	// Create blk device
-	// Initialize create_io struct
-	create_io = (struct dm_ioctl *)create_buffer;
-	dm_ioctl_init(create_io, INDEX_DM_DEV_CREATE, DM_INTEGRITY_BUF_SIZE, name, NULL, 0, 0, 0,
-		      0);
-
-	for (create_counter = 0; create_counter < TABLE_LOAD_RETRIES; create_counter++) {
-		ioctl_ret = dm_ioctl(fd, DM_DEV_CREATE, create_io);
-		if (!ioctl_ret) {
-			DEBUG("Creating block device worked!");
-			break;
-		}
-
-		NANOSLEEP(0, 500000000)
-	}
-
-	if (create_counter >= TABLE_LOAD_RETRIES) {
-		ERROR_ERRNO("Failed to create block device after %d tries", create_counter);
-		goto errout;
-	}
-
-	// Load Integrity map table
-	DEBUG("Loading Integrity mapping table");
+	// the tags are provided by dm-crypt, thus the bitmap mode, which requires an
+	// internal hash, is not available and the journal can only be skipped entirely
+	char mode_char = (opts->integrity_mode == CRYPTFS_INTEGRITY_DIRECT) ? 'D' : 'J';
+	char *params;
 
-	load_count = load_integrity_mapping_table(fd, real_blk_name, meta_blk_name, name, fs_size);
-	if (load_count < 0) {
-		ERROR("Error while loading mapping table");
-		goto errout;
-	} else {
-		INFO("Loading integrity map took %d tries", load_count);
-	}
+	// these parameters are used in [1] as well as by dmsetup when traced with strace
+	if (opts->sector_size > SECTOR_SIZE)
+		params = mem_printf("%s 0 %d %c 2 meta_device:%s block_size:%u", real_blk_name,
+				    INTEGRITY_TAG_SIZE, mode_char, meta_blk_name,
+				    opts->sector_size);
+	else
+		params = mem_printf("%s 0 %d %c 1 meta_device:%s", real_blk_name,
+				    INTEGRITY_TAG_SIZE, mode_char, meta_blk_name);
+
+	dm_target_t target = {
+		.start = 0, .length = fs_size, .type = "integrity", .params = params
+	};
+	char *device = cryptfs_get_device_path_new(name);
 
-	// Resume this device to activate it
-	DEBUG("Resuming the blk device");
-	dm_ioctl_init(create_io, INDEX_DM_DEV_SUSPEND, DM_INTEGRITY_BUF_SIZE, name, NULL, 0, 0, 0,
-		      0);
+	DEBUG("Creating integrity blk device %s in mode %c", name, mode_char);
+	int ret = dm_create_dev(fd, name, &target, 1, device);
+	mem_free0(params);
 
-	ioctl_ret = dm_ioctl(fd, DM_DEV_SUSPEND, create_io);
-	if (ioctl_ret != 0) {
-		ERROR_ERRNO("Cannot resume the dm-integrity device (ioctl ret: %d, errno:%d)",
-			    ioctl_ret, errno);
-		goto errout;
+	if (ret < 0) {
+		ERROR("Failed integrity block creation");
+		mem_free0(device);
+		return NULL;
 	}
+	return device;
+}
 
-	close(fd);
-	return 0;
-
-errout:
-	ERROR("Failed integrity block creation");
-	close(fd);
-	return -1;
+/**
+ * Joins n optional table parameters, preceded by their count, and frees them.
+ */
+static char *
+extra_params_join_new(char **params, int n)
+{
+	char *extra_params = mem_printf("%d", n);
+	for (int i = 0; i < n; i++) {
+		char *tmp = mem_printf("%s %s", extra_params, params[i]);
+		mem_free0(extra_params);
+		mem_free0(params[i]);
+		extra_params = tmp;
+	}
+	return extra_params;
 }
 
-static int
-create_crypto_blk_dev(const char *real_blk_name, const char *master_key, const char *name,
-		      unsigned long fs_size, bool integrity)
+/**
+ * Builds the optional parameters of the dm-crypt table, including their count.
+ */
+static char *
+crypto_extra_params_new(const cryptfs_opts_t *opts, bool integrity)
 {
-	char buffer[DM_CRYPT_BUF_SIZE];
-	struct dm_ioctl *io;
-	int fd;
-	int retval = -1;
-	int load_count;
-	int i;
-	int ioctl_ret;
-
-	DEBUG("Creating crypto blk device");
-	if ((fd = open(DM_CONTROL, O_RDWR)) < 0) {
-		ERROR("Cannot open device-mapper\n");
-		goto errout;
-	}
+	char *params[8];
+	int n = 0;
+
+	if (integrity)
+		params[n++] = mem_printf("integrity:%d:aead", INTEGRITY_TAG_SIZE);
+	else if (opts->flags & CRYPTFS_FLAG_ALLOW_DISCARDS)
+		params[n++] = mem_strdup("allow_discards");
+	if (opts->flags & CRYPTFS_FLAG_SAME_CPU_CRYPT)
+		params[n++] = mem_strdup("same_cpu_crypt");
+	if (opts->flags & CRYPTFS_FLAG_SUBMIT_FROM_CRYPT_CPUS)
+		params[n++] = mem_strdup("submit_from_crypt_cpus");
+	if (opts->flags & CRYPTFS_FLAG_NO_READ_WORKQUEUE)
+		params[n++] = mem_strdup("no_read_workqueue");
+	if (opts->flags & CRYPTFS_FLAG_NO_WRITE_WORKQUEUE)
+		params[n++] = mem_strdup("no_write_workqueue");
+	if (opts->sector_size > SECTOR_SIZE)
+		params[n++] = mem_printf("sector_size:%u", opts->sector_size);
+
+	return extra_params_join_new(params, n);
+}
 
-	io = (struct dm_ioctl *)buffer;
-	dm_ioctl_init(io, INDEX_DM_DEV_CREATE, DM_CRYPT_BUF_SIZE, name, NULL, 0, 0, 0, 0);
+/**
+ * Creates a dm-crypt block device on top of real_blk_name, using authenticated
+ * encryption if real_blk_name is an integrity device.
+ *
+ * @return The path of the device node or NULL on error
+ */
+static char *
+create_crypto_blk_dev_new(int fd, const char *real_blk_name, const char *master_key,
+			  const char *name, unsigned long fs_size, bool integrity,
+			  const cryptfs_opts_t *opts)
+{
+	const char *crypto_type = integrity ? CRYPTO_TYPE_AUTHENC : CRYPTO_TYPE;
+	char *extra_params = crypto_extra_params_new(opts, integrity);
+	char *params = mem_printf("%s %s 0 %s 0 %s", crypto_type, master_key, real_blk_name,
+				  extra_params);
+	dm_target_t target = { .start = 0, .length = fs_size, .type = "crypt", .params = params };
+	char *device = cryptfs_get_device_path_new(name);
 
-	for (i = 0; i < TABLE_LOAD_RETRIES; i++) {
-		ioctl_ret = dm_ioctl(fd, DM_DEV_CREATE, io);
+	DEBUG("Creating crypto blk device %s with options '%s'", name, extra_params);
+	int ret = dm_create_dev(fd, name, &target, 1, device);
 
-		if (!ioctl_ret) {
-			DEBUG("Cryptp DM_DEV_CREATE worked!");
-			break;
-		}
-		NANOSLEEP(0, 500000000)
-	}
+	mem_memset0(params, strlen(params));
+	mem_free0(params);
+	mem_free0(extra_params);
 
-	if (i == TABLE_LOAD_RETRIES) {
-		/* We failed to load the table, return an error */
+	if (ret < 0) {
 		ERROR("Cannot create dm-crypt device");
-		goto errout;
-	}
-
-	load_count =
-		load_crypto_mapping_table(fd, real_blk_name, master_key, name, fs_size, integrity);
-	if (load_count < 0) {
-		ERROR("Cannot load dm-crypt mapping table");
-		goto errout;
-	} else if (load_count > 1) {
-		INFO("Took %d tries to load dmcrypt table.\n", load_count);
-	}
-
-	/* Resume this device to activate it */
-	dm_ioctl_init(io, INDEX_DM_DEV_SUSPEND, DM_CRYPT_BUF_SIZE, name, NULL, 0, 0, 0, 0);
-
-	if (dm_ioctl(fd, DM_DEV_SUSPEND, io)) {
-		ERROR_ERRNO("Cannot resume the dm-crypt device\n");
-		goto errout;
+		mem_free0(device);
+		return NULL;
 	}
+	return device;
+}
 
-	/* We made it here with no errors.  Woot! */
-	retval = 0;
-
-errout:
-	close(fd); /* If fd is <0 from a failed open call, it's safe to just ignore the close error */
-	DEBUG("Returning %d from create_crypte_bkl_dev", retval);
-	return retval;
+/**
+ * Checks if the inline encryption hardware of real_blk_name supports AES-256-XTS with data
+ * units of the sector size, as reported by blk-crypto in sysfs, and if the kernel provides
+ * the dm target to use it for a whole block device.
+ */
+static bool
+inline_crypt_supported(int fd, const char *real_blk_name, unsigned int sector_size)
+{
+	struct stat st;
+	IF_TRUE_RETVAL(stat(real_blk_name, &st) < 0 || !S_ISBLK(st.st_mode), false);
+
+	// partitions have no request queue of their own, it is the one of their disk
+	char *sys = mem_printf("/sys/dev/block/%u:%u", major(st.st_rdev), minor(st.st_rdev));
+	char *modes = mem_printf("%s/queue/crypto/modes/%s", sys, INLINE_CRYPT_MODE);
+	if (!file_exists(modes)) {
+		mem_free0(modes);
+		modes = mem_printf("%s/../queue/crypto/modes/%s", sys, INLINE_CRYPT_MODE);
+	}
+	// bitmask of the supported data unit sizes in bytes
+	char *mask_str = file_read_new(modes, 32);
+	unsigned long mask = mask_str ? strtoul(mask_str, NULL, 16) : 0;
+	mem_free0(mask_str);
+	mem_free0(modes);
+	mem_free0(sys);
+
+	if (!(mask & (sector_size ? sector_size : SECTOR_SIZE))) {
+		DEBUG("No inline encryption of %s with sector size %u", real_blk_name,
+		      sector_size);
+		return false;
+	}
+	if (!dm_has_target_type(fd, INLINE_CRYPT_TARGET)) {
+		DEBUG("Kernel does not provide dm target %s", INLINE_CRYPT_TARGET);
+		return false;
+	}
+	return true;
 }
 
-/* TODO:
- * maybe we need to wait a bit before device is created
+/**
+ * Creates a dm-default-key block device on top of real_blk_name, which attaches the key
+ * to the requests and leaves the encryption to the inline encryption hardware.
+ *
+ * @return The path of the device node or NULL on error
  */
 static char *
-create_device_node(const char *name)
+create_inline_crypt_blk_dev_new(int fd, const char *real_blk_name, const char *master_key,
+				const char *name, unsigned long fs_size, const cryptfs_opts_t *opts)
 {
-	char *buffer = mem_new(char, DEVMAPPER_BUFFER_SIZE);
-
-	int fd = open(DM_CONTROL, O_RDWR);
-	if (fd < 0) {
-		ERROR_ERRNO("Error opening devmapper");
-		mem_free0(buffer);
-		return NULL;
-	}
-
-	struct dm_ioctl *io = (struct dm_ioctl *)buffer;
-
-	dm_ioctl_init(io, INDEX_DM_DEV_STATUS, DEVMAPPER_BUFFER_SIZE, name, NULL, 0, 0, 0, 0);
-	if (dm_ioctl(fd, DM_DEV_STATUS, io)) {
-		if (errno != ENXIO) {
-			ERROR_ERRNO("DM_DEV_STATUS ioctl failed for lookup");
-		}
-		mem_free0(buffer);
-		close(fd);
-		return NULL;
-	}
-	close(fd);
+	char *extra[3];
+	int n = 0;
+
+	if (opts->flags & CRYPTFS_FLAG_ALLOW_DISCARDS)
+		extra[n++] = mem_strdup("allow_discards");
+	if (opts->sector_size > SECTOR_SIZE) {
+		// the target requires data units to be numbered in units of the sector size
+		extra[n++] = mem_printf("sector_size:%u", opts->sector_size);
+		extra[n++] = mem_strdup("iv_large_sectors");
+	}
+
+	char *extra_params = extra_params_join_new(extra, n);
+	char *params = mem_printf("%s %s 0 %s 0 %s", CRYPTO_TYPE, master_key, real_blk_name,
+				  extra_params);
+	dm_target_t target = {
+		.start = 0, .length = fs_size, .type = INLINE_CRYPT_TARGET, .params = params
+	};
+	char *device = cryptfs_get_device_path_new(name);
 
-	/* should not be necassery for android */
-	mkdir("/dev/block", 00777);
+	DEBUG("Creating inline crypt blk device %s with options '%s'", name, extra_params);
+	int ret = dm_create_dev(fd, name, &target, 1, device);
 
-	char *device = cryptfs_get_device_path_new(name);
+	mem_memset0(params, strlen(params));
+	mem_free0(params);
+	mem_free0(extra_params);
 
-	if (mknod(device, S_IFBLK | 00777, io->dev) != 0 && errno != EEXIST) {
-		ERROR_ERRNO("Cannot mknod device %s", device);
-		mem_free0(buffer);
+	if (ret < 0) {
+		ERROR("Cannot create dm-default-key device");
 		mem_free0(device);
 		return NULL;
-	} else if (errno == EEXIST) {
-		DEBUG("Device %s already exists, continuing", device);
 	}
-	mem_free0(buffer);
 	return device;
 }
 
@@ -493,11 +393,62 @@ errout:
 	return provided_data_sectors;
 }
 
+/*
+ * Writes zeros through the crypto device to len bytes at off, which generates the integrity
+ * tags of the sectors. BLKZEROOUT lets the kernel write zero pages without copying them from
+ * user space, as dm-crypt does not support write zeroes, it falls back to large writes.
+ */
+static int
+cryptfs_wipe(const char *crypto_blkdev, uint64_t off, uint64_t len)
+{
+	int fd = open(crypto_blkdev, O_WRONLY | O_DIRECT | O_CLOEXEC);
+	if (fd < 0) {
+		ERROR_ERRNO("Cannot open volume %s", crypto_blkdev);
+		return -1;
+	}
+
+	uint64_t range[2] = { off, len };
+	if (ioctl(fd, BLKZEROOUT, range) == 0) {
+		close(fd);
+		return 0;
+	}
+	DEBUG_ERRNO("BLKZEROOUT failed on %s, writing zeros", crypto_blkdev);
+
+	void *zeros = NULL;
+	if (posix_memalign(&zeros, DM_INTEGRITY_BUF_SIZE, CRYPTFS_WIPE_BUF_SIZE)) {
+		ERROR("Could not allocate buffer to wipe %s", crypto_blkdev);
+		close(fd);
+		return -1;
+	}
+	memset(zeros, 0, CRYPTFS_WIPE_BUF_SIZE);
+
+	int ret = 0;
+	for (uint64_t end = off + len; off < end;) {
+		size_t n = MIN(end - off, (uint64_t)CRYPTFS_WIPE_BUF_SIZE);
+		ssize_t written = pwrite(fd, zeros, n, off);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0) {
+			ERROR_ERRNO("Could not write empty block at %" PRIu64 " to %s", off,
+				    crypto_blkdev);
+			ret = -1;
+			break;
+		}
+		off += written;
+	}
+
+	free(zeros);
+	close(fd);
+	return ret;
+}
+
 static char *
 cryptfs_setup_volume_integrity_new(const char *label, const char *real_blkdev,
-				   const char *meta_blkdev, const char *key, unsigned long fs_size)
+				   const char *meta_blkdev, const char *key, unsigned long fs_size,
+				   const cryptfs_opts_t *opts)
 {
 	bool initial_format = false;
+	char *integrity_dev = NULL;
 	char *crypto_blkdev = NULL;
 	char *integrity_dev_label = mem_printf("%s-%s", label, "integrity");
 	TRACE("cryptfs_setup_volume_integrity_new");
@@ -505,55 +456,61 @@ cryptfs_setup_volume_integrity_new(const char *label, const char *real_blkdev,
 	/* check if meta device is initialized */
 	initial_format = get_provided_data_sectors(meta_blkdev) != fs_size;
 
-	if (create_integrity_blk_dev(real_blkdev, meta_blkdev, integrity_dev_label, fs_size) < 0) {
-		DEBUG("create_integrity_blk_dev failed!");
-		goto error;
-	}
+	// both layers of the stack are set up using the same control fd
+	int control_fd = dm_open_control();
+	IF_TRUE_GOTO(control_fd < 0, error);
 
-	char *integrity_dev = create_device_node(integrity_dev_label);
-	mem_free0(integrity_dev_label);
+	integrity_dev = create_integrity_blk_dev_new(control_fd, real_blkdev, meta_blkdev,
+						     integrity_dev_label, fs_size, opts);
 	if (!integrity_dev) {
-		ERROR("Could not create device node");
-		return NULL;
-	} else {
-		DEBUG("Successfully created device node");
+		DEBUG("create_integrity_blk_dev failed!");
+		dm_close_control(control_fd);
+		goto error;
 	}
 
-	if (create_crypto_blk_dev(integrity_dev, key, label, fs_size, true) < 0) {
+	crypto_blkdev = create_crypto_blk_dev_new(control_fd, integrity_dev, key, label, fs_size,
+						  true, opts);
+	dm_close_control(control_fd);
+	if (!crypto_blkdev) {
 		ERROR("Could not create crypto block device");
-		return NULL;
+		delete_integrity_blk_dev(integrity_dev_label);
+		goto error;
 	}
 
-	crypto_blkdev = create_device_node(label);
-
-	if (initial_format) {
+	if (initial_format && (opts->flags & CRYPTFS_FLAG_LAZY_INIT) &&
+	    opts->sector_size == CRYPTFS_LAZY_INIT_SECTOR_SIZE) {
+		/*
+		 * Skip the initial tags. The sectors fail to read until they are written
+		 * once, which a file system with blocks of the sector size never does for
+		 * blocks it has not written before. Only the edges of the volume are
+		 * formatted, so that probing it for signatures, e.g., by mkfs, succeeds.
+		 */
+		uint64_t len = fs_size * SECTOR_SIZE;
+		uint64_t edge = MIN((uint64_t)CRYPTFS_LAZY_INIT_EDGE, len / 2);
+		INFO("Skipping the initial format of %s, unwritten sectors are not readable",
+		     crypto_blkdev);
+		IF_TRUE_GOTO(cryptfs_wipe(crypto_blkdev, 0, edge) < 0, error);
+		IF_TRUE_GOTO(cryptfs_wipe(crypto_blkdev, len - edge, edge) < 0, error);
+	} else if (initial_format) {
 		/*
 		 * format crypto device, otherwise I/O errors may occur
 		 * also during write attempts which are not bound to
 		 * sector/block size for which no integrity data exist yet.
 		 * This is due to the block has to be read first than.
 		 */
+		if (opts->flags & CRYPTFS_FLAG_LAZY_INIT)
+			WARN("Lazy init of %s requires a sector size of %d, formatting it",
+			     crypto_blkdev, CRYPTFS_LAZY_INIT_SECTOR_SIZE);
 		DEBUG("Formatting crypto blkdev %s. Generating initial MAC on "
 		      "integrity_dev %s",
 		      crypto_blkdev, integrity_dev);
-		int fd;
-		if ((fd = open(crypto_blkdev, O_WRONLY | O_DIRECT)) < 0) {
-			ERROR("Cannot open volume %s", crypto_blkdev);
-			goto error;
-		}
-		char zeros[DM_INTEGRITY_BUF_SIZE] __attribute__((__aligned__(512)));
-		for (unsigned long i = 0; i < fs_size / 8; ++i) {
-			if (write(fd, zeros, DM_INTEGRITY_BUF_SIZE) < DM_INTEGRITY_BUF_SIZE) {
-				ERROR_ERRNO("Could not write empty block %lu to %s", i,
-					    crypto_blkdev);
-				close(fd);
-				goto error;
-			}
-		}
-		close(fd);
+		IF_TRUE_GOTO(cryptfs_wipe(crypto_blkdev, 0, fs_size * SECTOR_SIZE) < 0, error);
 	}
+	mem_free0(integrity_dev);
+	mem_free0(integrity_dev_label);
 	return crypto_blkdev;
 error:
+	mem_free0(integrity_dev);
 	mem_free0(integrity_dev_label);
 	mem_free0(crypto_blkdev);
 	return NULL;
@@ -561,26 +518,37 @@ error:
 
 char *
 cryptfs_setup_volume_new(const char *label, const char *real_blkdev, const char *key,
-			 const char *meta_blkdev)
+			 const char *meta_blkdev, const cryptfs_opts_t *opts)
 {
 	int fd;
 	// The file system size in sectors
 	uint64_t fs_size;
+	cryptfs_opts_t default_opts = CRYPTFS_OPTS_DEFAULT;
+
+	if (!opts)
+		opts = &default_opts;
+
+	if (opts->sector_size &&
+	    (opts->sector_size < SECTOR_SIZE || opts->sector_size > 4096 ||
+	     (opts->sector_size & (opts->sector_size - 1)))) {
+		ERROR("Invalid crypto sector size %u", opts->sector_size);
+		return NULL;
+	}
 
 	/* Update the fs_size field to be the size of the volume */
 	if ((fd = open(real_blkdev, O_RDONLY)) < 0) {
 		ERROR("Cannot open volume %s", real_blkdev);
 		return NULL;
 	}
-	// BLKGETSIZE64 returns size in bytes, we require size in sectors
-	int sector_size = dm_get_blkdev_sector_size(fd);
-	if (!(sector_size > 0)) {
-		ERROR("dm_get_blkdev_sector_size returned %d\n", sector_size);
-		return NULL;
-	}
-	fs_size = dm_get_blkdev_size64(fd) / sector_size;
+	// BLKGETSIZE64 returns size in bytes, dm tables always count 512 byte sectors,
+	// independent of the logical block size of the device
+	fs_size = dm_get_blkdev_size64(fd) / SECTOR_SIZE;
 	close(fd);
 
+	// the volume has to consist of whole encryption sectors
+	if (opts->sector_size > SECTOR_SIZE)
+		fs_size -= fs_size % (opts->sector_size / SECTOR_SIZE);
+
 	if (fs_size == 0) {
 		ERROR("Cannot get size of volume %s", real_blkdev);
 		return NULL;
@@ -589,20 +557,38 @@ cryptfs_setup_volume_new(const char *label, const char *real_blkdev, const char
 
 	if (meta_blkdev)
 		return cryptfs_setup_volume_integrity_new(label, real_blkdev, meta_blkdev, key,
-							  fs_size);
+							  fs_size, opts);
 
 	// do dmcrypt device setup only
 
 	/* Use only the first 64 hex digits of master key for 512 bit xts mode */
 	IF_TRUE_RETVAL(strlen(key) < CRYPTFS_FDE_KEY_LEN, NULL);
-	char enc_key[CRYPTFS_FDE_KEY_LEN + 1];
-	memcpy(enc_key, key, CRYPTFS_FDE_KEY_LEN);
-	enc_key[CRYPTFS_FDE_KEY_LEN] = '\0';
+	char enc_key[CRYPTFS_INLINE_KEY_LEN + 1];
 
-	if (create_crypto_blk_dev(real_blkdev, enc_key, label, fs_size, false) < 0)
+	if ((fd = dm_open_control()) < 0)
 		return NULL;
 
-	return create_device_node(label);
+	char *crypto_blkdev = NULL;
+	if ((opts->flags & CRYPTFS_FLAG_INLINE_CRYPT) && strlen(key) >= CRYPTFS_INLINE_KEY_LEN &&
+	    inline_crypt_supported(fd, real_blkdev, opts->sector_size)) {
+		/* AES-256-XTS takes the first 128 hex digits */
+		memcpy(enc_key, key, CRYPTFS_INLINE_KEY_LEN);
+		enc_key[CRYPTFS_INLINE_KEY_LEN] = '\0';
+		crypto_blkdev = create_inline_crypt_blk_dev_new(fd, real_blkdev, enc_key, label,
+								fs_size, opts);
+	} else {
+		if (opts->flags & CRYPTFS_FLAG_INLINE_CRYPT)
+			INFO("Inline encryption not available for %s, using dm-crypt",
+			     real_blkdev);
+		memcpy(enc_key, key, CRYPTFS_FDE_KEY_LEN);
+		enc_key[CRYPTFS_FDE_KEY_LEN] = '\0';
+		crypto_blkdev = create_crypto_blk_dev_new(fd, real_blkdev, enc_key, label, fs_size,
+							  false, opts);
+	}
+	dm_close_control(fd);
+	mem_memset0(enc_key, sizeof(enc_key));
+
+	return crypto_blkdev;
 }
 
 int
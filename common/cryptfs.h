@@ -35,6 +35,57 @@
 #include <stdbool.h>
 
 #define CRYPTFS_FDE_KEY_LEN 64
+// hex digits of the key of a volume encrypted by inline encryption hardware (AES-256-XTS)
+#define CRYPTFS_INLINE_KEY_LEN 128
+
+/**
+ * Write mode of the dm-integrity device below an authenticated dm-crypt volume
+ */
+typedef enum cryptfs_integrity_mode {
+	// data and integrity tags are written atomically through the journal
+	CRYPTFS_INTEGRITY_JOURNAL,
+	// data and tags are written directly without journal, which avoids writing
+	// the data twice. A crash during a write may leave sectors with mismatching
+	// tags, which fail to read until they are rewritten.
+	CRYPTFS_INTEGRITY_DIRECT,
+} cryptfs_integrity_mode_t;
+
+// process decryption in the context of the request instead of the kcryptd workqueue
+#define CRYPTFS_FLAG_NO_READ_WORKQUEUE (1 << 0)
+// process encryption in the context of the request instead of the kcryptd workqueue
+#define CRYPTFS_FLAG_NO_WRITE_WORKQUEUE (1 << 1)
+// encrypt on the cpu which submitted the request
+#define CRYPTFS_FLAG_SAME_CPU_CRYPT (1 << 2)
+// submit writes from the encrypting cpus instead of a single thread
+#define CRYPTFS_FLAG_SUBMIT_FROM_CRYPT_CPUS (1 << 3)
+// pass discards to the device below, not supported for integrity protected volumes
+#define CRYPTFS_FLAG_ALLOW_DISCARDS (1 << 4)
+// do not write the initial integrity tags of a new integrity protected volume, only
+// applied with a sector size of CRYPTFS_LAZY_INIT_SECTOR_SIZE, see cryptfs_setup_volume_new()
+#define CRYPTFS_FLAG_LAZY_INIT (1 << 5)
+// encrypt by the inline encryption hardware of the storage through dm-default-key, if the
+// device and the kernel support it, see cryptfs_setup_volume_new()
+#define CRYPTFS_FLAG_INLINE_CRYPT (1 << 6)
+
+#define CRYPTFS_LAZY_INIT_SECTOR_SIZE 4096
+
+/**
+ * Options of a dm-crypt volume
+ */
+typedef struct cryptfs_opts {
+	cryptfs_integrity_mode_t integrity_mode; // only used with a meta device
+	unsigned int flags;			 // CRYPTFS_FLAG_* bits
+	// encryption sector size in bytes, 0 for 512 bytes. The sector size is part of
+	// the on-disk format and must not be changed for existing volumes.
+	unsigned int sector_size;
+} cryptfs_opts_t;
+
+// options used if none are given, which match the previous fixed table
+#define CRYPTFS_OPTS_DEFAULT                                                                       \
+	{                                                                                          \
+		.integrity_mode = CRYPTFS_INTEGRITY_JOURNAL, .flags = CRYPTFS_FLAG_ALLOW_DISCARDS, \
+		.sector_size = 0                                                                   \
+	}
 
 /**
  * Get the full path of a cryptfs device with the specified name
@@ -47,16 +98,23 @@ cryptfs_get_device_path_new(const char *label);
 
 /**
  * Create a new cryptfs device with the specified name,
+ * A new volume with a meta device is formatted by writing zeros to all sectors, which
+ * generates their integrity tags, unless CRYPTFS_FLAG_LAZY_INIT is set.
+ * With CRYPTFS_FLAG_INLINE_CRYPT, a volume without meta device is encrypted by the inline
+ * encryption hardware of real_blk_dev if it supports AES-256-XTS with the sector size and the
+ * kernel provides the default-key target, otherwise dm-crypt is used. Both use different keys,
+ * thus the flag is part of the on-disk format of the volume, just as the sector size.
  *
  * @param label The name of the volume
  * @param real_blk_dev The name of the loop device
  * @param ascii_key The key for the volume
  * @param meta_blk_dev The meta loop device
+ * @param opts The options of the volume or NULL for CRYPTFS_OPTS_DEFAULT
  * @return char* The path of the newly created volume
  */
 char *
 cryptfs_setup_volume_new(const char *label, const char *real_blk_dev, const char *ascii_key,
-			 const char *meta_blk_dev);
+			 const char *meta_blk_dev, const cryptfs_opts_t *opts);
 
 /**
  * Close a device-mapper volume
@@ -0,0 +1,91 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2021 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "digest.h"
+#include "hex.h"
+#include "macro.h"
+#include "mem.h"
+
+#include <string.h>
+
+int
+digest_set(digest_t *d, const uint8_t *data, size_t len)
+{
+	ASSERT(d);
+
+	d->len = 0;
+	IF_TRUE_RETVAL(len > DIGEST_MAX_LEN, -1);
+
+	memcpy(d->data, data, len);
+	d->len = len;
+	return 0;
+}
+
+int
+digest_from_hex(digest_t *d, const char *hex)
+{
+	ASSERT(d);
+
+	d->len = 0;
+	IF_NULL_RETVAL(hex, -1);
+
+	size_t len = strlen(hex);
+	IF_TRUE_RETVAL(len < 2 || len > 2 * DIGEST_MAX_LEN, -1);
+	IF_TRUE_RETVAL(convert_hex_to_bin(hex, len, d->data, len / 2) < 0, -1);
+
+	d->len = len / 2;
+	return 0;
+}
+
+char *
+digest_to_hex(const digest_t *d, char *buf)
+{
+	ASSERT(d);
+	ASSERT(buf);
+
+	hex_encode(d->data, d->len, buf);
+	return buf;
+}
+
+char *
+digest_to_hex_new(const digest_t *d)
+{
+	IF_TRUE_RETVAL(!digest_is_set(d), NULL);
+
+	return digest_to_hex(d, mem_alloc(2 * d->len + 1));
+}
+
+bool
+digest_is_set(const digest_t *d)
+{
+	return d && d->len > 0;
+}
+
+bool
+digest_equal(const digest_t *a, const digest_t *b)
+{
+	IF_TRUE_RETVAL(!digest_is_set(a) || !digest_is_set(b), false);
+
+	return a->len == b->len && memcmp(a->data, b->data, a->len) == 0;
+}
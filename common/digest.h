@@ -0,0 +1,98 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2021 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/**
+ * @file digest.h
+ *
+ * Fixed size binary representation of a hash value. Digests are kept in binary form
+ * from the point they are computed or parsed from a config to their comparison, hex
+ * strings are only produced for logs and text protocols.
+ */
+
+#ifndef DIGEST_H_
+#define DIGEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Size of the largest supported digest (SHA512) */
+#define DIGEST_MAX_LEN 64
+
+/** Size of a buffer receiving the hex string of any digest including the terminating null */
+#define DIGEST_HEX_SIZE (2 * DIGEST_MAX_LEN + 1)
+
+/**
+ * A digest of len bytes, a digest with len 0 is unset, e.g. because hashing failed.
+ */
+typedef struct digest {
+	uint8_t len;
+	uint8_t data[DIGEST_MAX_LEN];
+} digest_t;
+
+/**
+ * Sets the digest to the len bytes of data.
+ *
+ * @return 0 on success, -1 if len exceeds DIGEST_MAX_LEN (the digest is unset then)
+ */
+int
+digest_set(digest_t *d, const uint8_t *data, size_t len);
+
+/**
+ * Parses the hex string into the digest.
+ *
+ * @return 0 on success, -1 if hex is NULL, too long or no valid hex string (the digest
+ *	   is unset then)
+ */
+int
+digest_from_hex(digest_t *d, const char *hex);
+
+/**
+ * Writes the lower case hex string of the digest to buf.
+ *
+ * @param buf buffer of at least DIGEST_HEX_SIZE bytes
+ * @return buf
+ */
+char *
+digest_to_hex(const digest_t *d, char *buf);
+
+/**
+ * Returns a newly allocated lower case hex string of the digest or NULL if it is unset.
+ */
+char *
+digest_to_hex_new(const digest_t *d);
+
+/**
+ * Returns true if the digest holds a value.
+ */
+bool
+digest_is_set(const digest_t *d);
+
+/**
+ * Returns true if both digests are set and equal.
+ */
+bool
+digest_equal(const digest_t *a, const digest_t *b);
+
+#endif /* DIGEST_H_ */
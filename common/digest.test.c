@@ -0,0 +1,143 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "munit.h"
+
+#include "digest.h"
+#include "hex.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <string.h>
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+	return NULL;
+}
+
+static void
+tear_down(UNUSED void *fixture)
+{
+	// No clean-up needed for now
+}
+
+static MunitResult
+test_hex(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	const uint8_t bin[] = { 0x00, 0x1f, 0xa0, 0xff };
+	uint8_t out[sizeof(bin)];
+
+	char *hex = convert_bin_to_hex_new(bin, sizeof(bin));
+	munit_assert_string_equal(hex, "001fa0ff");
+	mem_free0(hex);
+
+	munit_assert_int(convert_hex_to_bin("001FA0ff", 8, out, sizeof(out)), ==, 0);
+	munit_assert_memory_equal(sizeof(bin), out, bin);
+	munit_assert_int(convert_hex_to_bin("001fa0f", 7, out, sizeof(out)), ==, -1);
+	munit_assert_int(convert_hex_to_bin("001fa0", 6, out, sizeof(out)), ==, -2);
+	munit_assert_int(convert_hex_to_bin("001fa0fg", 8, out, sizeof(out)), ==, -3);
+
+	int len;
+	uint8_t *padded = convert_hex_to_bin_new("1fa0ff", &len);
+	munit_assert_int(len, ==, 3);
+	munit_assert_memory_equal(3, padded, bin + 1);
+	mem_free0(padded);
+	padded = convert_hex_to_bin_new("fa0ff", &len);
+	munit_assert_int(len, ==, 3);
+	munit_assert_memory_equal(3, padded, "\x0f\xa0\xff");
+	mem_free0(padded);
+	munit_assert_null(convert_hex_to_bin_new("0x12", &len));
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_digest(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	digest_t a, b;
+	char buf[DIGEST_HEX_SIZE];
+
+	munit_assert_int(digest_from_hex(&a, "00112233445566778899AABBCCDDEEFF01234567"), ==, 0);
+	munit_assert_int(a.len, ==, 20);
+	munit_assert_string_equal(digest_to_hex(&a, buf),
+				  "00112233445566778899aabbccddeeff01234567");
+
+	munit_assert_int(digest_set(&b, a.data, a.len), ==, 0);
+	munit_assert_true(digest_equal(&a, &b));
+	b.data[19] ^= 1;
+	munit_assert_false(digest_equal(&a, &b));
+	b.data[19] ^= 1;
+	b.len--;
+	munit_assert_false(digest_equal(&a, &b));
+
+	char *hex = digest_to_hex_new(&a);
+	munit_assert_string_equal(hex, buf);
+	mem_free0(hex);
+
+	// invalid input leaves the digest unset, unset digests never match
+	munit_assert_int(digest_from_hex(&b, "0011x2"), ==, -1);
+	munit_assert_false(digest_is_set(&b));
+	munit_assert_false(digest_equal(&b, &b));
+	munit_assert_int(digest_from_hex(&b, NULL), ==, -1);
+	munit_assert_null(digest_to_hex_new(&b));
+
+	uint8_t big[DIGEST_MAX_LEN + 1] = { 0 };
+	munit_assert_int(digest_set(&b, big, sizeof(big)), ==, -1);
+	munit_assert_int(digest_set(&b, big, DIGEST_MAX_LEN), ==, 0);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/hex",			/* name */
+		test_hex,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/digest",		/* name */
+		test_digest,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite digest_suite = {
+	"/digest",		/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
@@ -27,12 +27,23 @@
 #include "macro.h"
 #include "logf.h"
 #include "mem.h"
+#include "list.h"
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <string.h>
 #include <unistd.h>
 
+#ifndef IFTODT
+#define IFTODT(mode) (((mode)&S_IFMT) >> 12)
+#endif
+
+/* Number of handled entries after which the progress callback is invoked */
+#define DIR_PROGRESS_STEP 1024
+
 int
 dir_foreach(const char *path, int (*func)(const char *path, const char *file, void *data),
 	    void *data)
@@ -73,6 +84,61 @@ dir_foreach(const char *path, int (*func)(const char *path, const char *file, vo
 	return n;
 }
 
+int
+dir_foreach_at(int dirfd, int (*func)(int dirfd, const char *name, unsigned char type, void *data),
+	       void *data)
+{
+	struct dirent *dp;
+	DIR *dirp;
+	int n = 0;
+
+	IF_TRUE_RETVAL(dirfd < 0, -1);
+	IF_NULL_RETVAL(func, -1);
+
+	// use an own open file description to keep the offset of dirfd
+	int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || !(dirp = fdopendir(fd))) {
+		WARN_ERRNO("Could not open dir fd %d", dirfd);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	while ((dp = readdir(dirp)) != NULL) {
+		if (strcmp(dp->d_name, ".") == 0)
+			continue;
+		if (strcmp(dp->d_name, "..") == 0)
+			continue;
+
+		int ret = func(fd, dp->d_name, dp->d_type, data);
+		if (ret < 0) {
+			DEBUG("Callback of dir_foreach_at returned %d", ret);
+			n = -1;
+			break;
+		} else if (ret > 0) {
+			n++;
+		}
+	}
+
+	closedir(dirp);
+
+	return n;
+}
+
+unsigned char
+dir_entry_type(int dirfd, const char *name, unsigned char type)
+{
+	struct stat s;
+
+	if (type != DT_UNKNOWN)
+		return type;
+
+	if (fstatat(dirfd, name, &s, AT_SYMLINK_NOFOLLOW) < 0)
+		return DT_UNKNOWN;
+
+	return IFTODT(s.st_mode);
+}
+
 int
 dir_mkdir_p(const char *path, mode_t mode)
 {
@@ -110,176 +176,388 @@ out:
 	return ret;
 }
 
-static int
-dir_unlink_folder_contents_cb(const char *path, const char *name, UNUSED void *data)
+/*
+ * Parallel directory walker used by dir_delete_folder() and dir_copy_folder().
+ *
+ * Each job covers one directory. Its entries are handled relative to the open
+ * directory fd (fstatat, unlinkat, mkdirat, ...), and subdirectories are pushed
+ * as new jobs, which are picked up by whichever thread is idle. The calling
+ * thread works on jobs as well and is the only one invoking the progress
+ * callback. Worker threads do not log; errors are counted and the first one is
+ * reported by the calling thread after the walk.
+ */
+typedef struct dir_walk dir_walk_t;
+
+typedef struct dir_walk_job {
+	char *src; // directory to be walked
+	char *dst; // target directory for copying, NULL for deletion
+} dir_walk_job_t;
+
+struct dir_walk {
+	void (*entry_cb)(dir_walk_t *walk, const dir_walk_job_t *job, int src_fd, int dst_fd,
+			 const char *name, unsigned char type);
+	bool (*filter)(const char *file, void *data);
+	void *filter_data;
+	void (*progress_cb)(size_t entries, void *data);
+	void *progress_data;
+	bool keep_dirs; // remember walked directories for removal
+
+	pthread_t owner;
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // signaled on new jobs and finished jobs
+	list_t *jobs;	     // pending jobs, newest first
+	list_t *dirs;	     // walked directories, children before parents
+	unsigned busy;	     // number of jobs in progress
+	size_t entries;	     // number of handled entries
+	size_t progress;     // value of entries at the last progress callback
+	size_t errors;
+	int error_errno;
+	char *error; // path of the first failed entry
+};
+
+static void
+dir_walk_push(dir_walk_t *walk, char *src, char *dst)
 {
-	struct stat stat_buffer;
-	int ret = 0;
-	char *file_to_remove = mem_printf("%s/%s", path, name);
-	if (stat(file_to_remove, &stat_buffer) == 0 && !S_ISDIR(stat_buffer.st_mode)) {
-		TRACE("Unlinking file %s", file_to_remove);
-		if (unlink(file_to_remove) == -1) {
-			ERROR_ERRNO("Could not delete file %s", file_to_remove);
-			ret--;
+	dir_walk_job_t *job = mem_new0(dir_walk_job_t, 1);
+	job->src = src;
+	job->dst = dst;
+
+	pthread_mutex_lock(&walk->lock);
+	walk->jobs = list_prepend(walk->jobs, job);
+	if (walk->keep_dirs)
+		walk->dirs = list_prepend(walk->dirs, mem_strdup(src));
+	pthread_cond_signal(&walk->cond);
+	pthread_mutex_unlock(&walk->lock);
+}
+
+static void
+dir_walk_error(dir_walk_t *walk, const char *dir, const char *name)
+{
+	int errno_backup = errno;
+
+	pthread_mutex_lock(&walk->lock);
+	if (!walk->errors++) {
+		walk->error_errno = errno_backup;
+		walk->error = name ? mem_printf("%s/%s", dir, name) : mem_strdup(dir);
+	}
+	pthread_mutex_unlock(&walk->lock);
+}
+
+/*
+ * Adds n handled entries and, if running on the calling thread, reports the
+ * progress every DIR_PROGRESS_STEP entries.
+ */
+static void
+dir_walk_account(dir_walk_t *walk, size_t n)
+{
+	size_t entries = 0;
+
+	pthread_mutex_lock(&walk->lock);
+	walk->entries += n;
+	if (walk->progress_cb && pthread_equal(walk->owner, pthread_self()) &&
+	    walk->entries - walk->progress >= DIR_PROGRESS_STEP)
+		entries = walk->progress = walk->entries;
+	pthread_mutex_unlock(&walk->lock);
+
+	if (entries)
+		walk->progress_cb(entries, walk->progress_data);
+}
+
+static void
+dir_walk_do_job(dir_walk_t *walk, const dir_walk_job_t *job)
+{
+	struct dirent *dp;
+	DIR *dirp;
+	int dst_fd = -1;
+	size_t n = 0;
+
+	int fd = open(job->src, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 || !(dirp = fdopendir(fd))) {
+		dir_walk_error(walk, job->src, NULL);
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	if (job->dst) {
+		dst_fd = open(job->dst, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (dst_fd < 0) {
+			dir_walk_error(walk, job->dst, NULL);
+			closedir(dirp);
+			return;
 		}
-	} else {
-		TRACE("Path %s is dir", file_to_remove);
-		if (dir_foreach(file_to_remove, &dir_unlink_folder_contents_cb, NULL) < 0) {
-			ERROR_ERRNO("Could not delete all dir contents in %s", file_to_remove);
-			ret--;
+	}
+
+	while ((dp = readdir(dirp)) != NULL) {
+		if (strcmp(dp->d_name, ".") == 0)
+			continue;
+		if (strcmp(dp->d_name, "..") == 0)
+			continue;
+
+		walk->entry_cb(walk, job, fd, dst_fd, dp->d_name, dp->d_type);
+
+		if (++n == DIR_PROGRESS_STEP) {
+			dir_walk_account(walk, n);
+			n = 0;
 		}
-		TRACE("Removing now empty dir %s", file_to_remove);
-		if (rmdir(file_to_remove) < 0) {
-			ERROR_ERRNO("Could not delete dir %s", file_to_remove);
-			ret--;
+	}
+	dir_walk_account(walk, n);
+
+	if (dst_fd >= 0)
+		close(dst_fd);
+	closedir(dirp);
+}
+
+static void *
+dir_walk_thread(void *data)
+{
+	dir_walk_t *walk = data;
+
+	pthread_mutex_lock(&walk->lock);
+	while (walk->jobs || walk->busy) {
+		if (!walk->jobs) {
+			pthread_cond_wait(&walk->cond, &walk->lock);
+			// report the progress made by the other threads
+			if (pthread_equal(walk->owner, pthread_self())) {
+				pthread_mutex_unlock(&walk->lock);
+				dir_walk_account(walk, 0);
+				pthread_mutex_lock(&walk->lock);
+			}
+			continue;
 		}
+
+		list_t *head = walk->jobs;
+		dir_walk_job_t *job = head->data;
+		walk->jobs = list_unlink(walk->jobs, head);
+		walk->busy++;
+		pthread_mutex_unlock(&walk->lock);
+
+		dir_walk_do_job(walk, job);
+		mem_free0(job->src);
+		mem_free0(job->dst);
+		mem_free0(job);
+
+		pthread_mutex_lock(&walk->lock);
+		walk->busy--;
+		// wake up idle threads for new jobs, or all of them if the walk is done
+		pthread_cond_broadcast(&walk->cond);
 	}
-	mem_free0(file_to_remove);
-	return ret;
+	pthread_mutex_unlock(&walk->lock);
+
+	return NULL;
 }
 
-int
-dir_delete_folder(const char *path, const char *dir_name)
+/*
+ * Processes all pushed jobs with up to threads threads including the calling
+ * one, 0 selects one thread per online CPU (at most DIR_THREADS_MAX).
+ * Returns 0 if all entries were handled successfully, -1 otherwise.
+ */
+static int
+dir_walk_run(dir_walk_t *walk, unsigned threads)
 {
-	int ret = 0;
-	char *dir_to_remove = mem_printf("%s/%s", path, dir_name);
+	pthread_t tids[DIR_THREADS_MAX];
+	unsigned spawned = 0;
+	sigset_t all, old;
 
-	DEBUG("Deleting %s", dir_to_remove);
-	if (dir_foreach(dir_to_remove, &dir_unlink_folder_contents_cb, NULL) < 0) {
-		ERROR_ERRNO("Could not delete all dir contents in %s", dir_to_remove);
-		ret--;
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned)cpus : 1;
 	}
-	TRACE("Removing now empty dir %s", dir_to_remove);
-	if (rmdir(dir_to_remove) < 0) {
-		ERROR_ERRNO("Could not delete dir %s", dir_to_remove);
-		ret--;
+	threads = MIN(threads, (unsigned)DIR_THREADS_MAX);
+
+	// signals must still be delivered to the calling thread
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (unsigned i = 1; i < threads; i++) {
+		if (pthread_create(&tids[spawned], NULL, dir_walk_thread, walk) != 0) {
+			WARN("Could only spawn %u directory walker threads", spawned);
+			break;
+		}
+		spawned++;
 	}
-	mem_free0(dir_to_remove);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
 
-	return ret;
-}
+	dir_walk_thread(walk);
+	for (unsigned i = 0; i < spawned; i++)
+		pthread_join(tids[i], NULL);
 
-typedef struct dir_copy_params {
-	char *target;
-	void *data;
-	bool (*filter)(const char *file, void *data);
-} dir_copy_params_t;
+	if (walk->progress_cb && walk->entries != walk->progress)
+		walk->progress_cb(walk->entries, walk->progress_data);
+
+	if (walk->errors) {
+		errno = walk->error_errno;
+		ERROR_ERRNO("Failed to handle %zu entries, first failure at %s", walk->errors,
+			    walk->error);
+		return -1;
+	}
+	return 0;
+}
 
-static dir_copy_params_t *
-dir_copy_params_new(const char *path, const char *name,
-		    bool (*filter)(const char *file, void *data), void *data)
+static void
+dir_walk_init(dir_walk_t *walk)
 {
-	struct dir_copy_params *params = mem_new0(struct dir_copy_params, 1);
-	params->target = name ? mem_printf("%s/%s", path, name) : mem_strdup(path);
-	params->data = data;
-	params->filter = filter;
-	return params;
+	memset(walk, 0, sizeof(dir_walk_t));
+	walk->owner = pthread_self();
+	pthread_mutex_init(&walk->lock, NULL);
+	pthread_cond_init(&walk->cond, NULL);
 }
+
 static void
-dir_copy_params_free(dir_copy_params_t *params)
+dir_walk_destroy(dir_walk_t *walk)
 {
-	mem_free0(params->target);
-	mem_free0(params);
+	for (list_t *l = walk->dirs; l; l = l->next)
+		mem_free(l->data);
+	list_delete(walk->dirs);
+	mem_free0(walk->error);
+	pthread_cond_destroy(&walk->cond);
+	pthread_mutex_destroy(&walk->lock);
 }
 
-static int
-dir_copy_folder_contents_cb(const char *path, const char *name, void *data)
+static void
+dir_delete_entry_cb(dir_walk_t *walk, const dir_walk_job_t *job, int fd, UNUSED int dst_fd,
+		    const char *name, unsigned char type)
 {
-	dir_copy_params_t *p = data;
-	ASSERT(p);
+	type = dir_entry_type(fd, name, type);
+	if (type == DT_UNKNOWN) {
+		dir_walk_error(walk, job->src, name);
+		return;
+	}
 
-	struct stat s;
+	// directories are removed after the walk, once they are empty
+	if (type == DT_DIR)
+		dir_walk_push(walk, mem_printf("%s/%s", job->src, name), NULL);
+	else if (unlinkat(fd, name, 0) < 0)
+		dir_walk_error(walk, job->src, name);
+}
 
+int
+dir_delete_folder_parallel(const char *path, const char *dir_name, unsigned threads,
+			   void (*progress_cb)(size_t entries, void *data), void *data)
+{
+	dir_walk_t walk;
 	int ret = 0;
-	char *file_src = mem_printf("%s/%s", path, name);
-	dir_copy_params_t *params = dir_copy_params_new(p->target, name, p->filter, p->data);
-	char *file_dst = params->target;
 
-	IF_NULL_GOTO_ERROR(file_dst, out);
+	IF_NULL_RETVAL(path, -1);
+	IF_NULL_RETVAL(dir_name, -1);
+
+	dir_walk_init(&walk);
+	walk.entry_cb = dir_delete_entry_cb;
+	walk.progress_cb = progress_cb;
+	walk.progress_data = data;
+	walk.keep_dirs = true;
+
+	char *dir_to_remove = mem_printf("%s/%s", path, dir_name);
+	DEBUG("Deleting %s", dir_to_remove);
+
+	dir_walk_push(&walk, mem_strdup(dir_to_remove), NULL);
+	if (dir_walk_run(&walk, threads) < 0) {
+		ERROR("Could not delete all dir contents in %s", dir_to_remove);
+		ret--;
+	}
+
+	for (list_t *l = walk.dirs; l; l = l->next) {
+		if (rmdir(l->data) < 0) {
+			ERROR_ERRNO("Could not delete dir %s", (char *)l->data);
+			ret--;
+		}
+	}
+
+	dir_walk_destroy(&walk);
+	mem_free0(dir_to_remove);
+	return ret;
+}
+
+int
+dir_delete_folder(const char *path, const char *dir_name)
+{
+	return dir_delete_folder_parallel(path, dir_name, 0, NULL, NULL);
+}
 
-	TRACE("p->taget:%s params->target: %s", p->target, params->target);
+static void
+dir_copy_entry_cb(dir_walk_t *walk, const dir_walk_job_t *job, int fd, int dst_fd,
+		  const char *name, UNUSED unsigned char type)
+{
+	struct stat s;
 
 	// skip filtered files
-	if (params->filter && (!params->filter(file_src, params->data)))
-		goto out;
+	if (walk->filter) {
+		char *file_src = mem_printf("%s/%s", job->src, name);
+		bool copy = walk->filter(file_src, walk->filter_data);
+		mem_free0(file_src);
+		if (!copy)
+			return;
+	}
 
-	IF_TRUE_GOTO((ret = lstat(file_src, &s)), out);
+	if (fstatat(fd, name, &s, AT_SYMLINK_NOFOLLOW) < 0)
+		goto err;
 
 	switch (s.st_mode & S_IFMT) {
 	case S_IFBLK:
 	case S_IFCHR:
-		TRACE("Copying device node %s -> %s", file_src, file_dst);
-		if ((ret = mknod(file_dst, s.st_mode, s.st_rdev)) < 0)
-			ERROR_ERRNO("Could not mknod at %s", file_dst);
-		if ((ret = chown(file_dst, s.st_uid, s.st_gid)) < 0)
-			ERROR_ERRNO("Could not chown node '%s' to (%d:%d)", file_dst, s.st_uid,
-				    s.st_gid);
+		if (mknodat(dst_fd, name, s.st_mode, s.st_rdev) < 0)
+			goto err;
+		if (fchownat(dst_fd, name, s.st_uid, s.st_gid, AT_SYMLINK_NOFOLLOW) < 0)
+			goto err;
 		break;
 	case S_IFLNK: {
 		char *target = mem_alloc0(s.st_size + 1);
-		if (target == NULL) {
-			ret = -1;
-			goto out;
-		}
-		TRACE("Copying link %s -> %s", file_src, file_dst);
-		ret = readlink(file_src, target, s.st_size + 1);
-		if (ret < 0 || ret > s.st_size) {
-			ERROR_ERRNO("Failed to read lnk");
+		ssize_t len = readlinkat(fd, name, target, s.st_size + 1);
+		if (len < 0 || len > s.st_size) {
 			mem_free0(target);
-			ret = -1;
-			break;
+			goto err;
 		}
-		target[ret] = 0;
+		target[len] = 0;
 
-		if ((ret = symlink(target, file_dst)) < 0)
-			ERROR_ERRNO("Could not create symlink %s at %s", target, file_dst);
+		int ret = symlinkat(target, dst_fd, name);
 		mem_free0(target);
+		if (ret < 0)
+			goto err;
 	} break;
 	case S_IFIFO:
 	case S_IFSOCK:
-		TRACE("Skip FIFO, SOCK %s -> %s", file_src, file_dst);
-		ret = 0;
+		// skipped
 		break;
 	case S_IFDIR:
-		if (!file_exists(file_dst)) {
-			TRACE("Creating target dir %s", file_dst);
-			if (mkdir(file_dst, s.st_mode) < 0) {
-				ERROR_ERRNO("Could not mkdir target dir %s", file_dst);
-				ret--;
-			} else if (chown(file_dst, s.st_uid, s.st_gid) < 0) {
-				ERROR_ERRNO("Could not chown dir '%s' to (%d:%d)", file_dst,
-					    s.st_uid, s.st_gid);
-				ret--;
-			}
-		}
-		if (dir_foreach(file_src, &dir_copy_folder_contents_cb, params) < 0) {
-			ERROR("Could not copy all dir contents of %s -> %s ", file_src, file_dst);
-			ret--;
+		if (mkdirat(dst_fd, name, s.st_mode) == 0) {
+			if (fchownat(dst_fd, name, s.st_uid, s.st_gid, AT_SYMLINK_NOFOLLOW) < 0)
+				goto err;
+		} else if (errno != EEXIST) {
+			goto err;
 		}
+		dir_walk_push(walk, mem_printf("%s/%s", job->src, name),
+			      mem_printf("%s/%s", job->dst, name));
 		break;
-	case S_IFREG:
-		TRACE("Copying reg file %s -> %s", file_src, file_dst);
-		if (file_copy(file_src, file_dst, -1, 512, 0)) {
-			ERROR("Could not copy file %s -> %s", file_src, file_dst);
-			ret--;
-		} else if (chown(file_dst, s.st_uid, s.st_gid) < 0) {
-			ERROR_ERRNO("Could not chown file '%s' to (%d:%d)", file_dst, s.st_uid,
-				    s.st_gid);
-			ret--;
-		} else if (chmod(file_dst, s.st_mode))
-			WARN_ERRNO("Could not preserve mode for file_dst %s", file_dst);
+	case S_IFREG: {
+		char *file_src = mem_printf("%s/%s", job->src, name);
+		char *file_dst = mem_printf("%s/%s", job->dst, name);
+		int ret = file_copy(file_src, file_dst, -1, 512, 0);
+		mem_free0(file_src);
+		mem_free0(file_dst);
+		if (ret < 0)
+			goto err;
+		if (fchownat(dst_fd, name, s.st_uid, s.st_gid, AT_SYMLINK_NOFOLLOW) < 0)
+			goto err;
+		if (fchmodat(dst_fd, name, s.st_mode & 07777, 0) < 0)
+			goto err;
+	} break;
 	}
-out:
-	dir_copy_params_free(params);
-	mem_free0(file_src);
-	return ret;
+	return;
+
+err:
+	dir_walk_error(walk, job->src, name);
 }
 
 int
-dir_copy_folder(const char *source, const char *target,
-		bool (*filter)(const char *file, void *data), void *filter_data)
+dir_copy_folder_parallel(const char *source, const char *target,
+			 bool (*filter)(const char *file, void *data), void *filter_data,
+			 unsigned threads, void (*progress_cb)(size_t entries, void *data),
+			 void *progress_data)
 {
+	dir_walk_t walk;
 	struct stat s;
+
+	IF_NULL_RETVAL(source, -1);
+	IF_NULL_RETVAL(target, -1);
 	IF_TRUE_RETVAL(stat(source, &s), -1);
 
 	int ret = 0;
@@ -292,13 +570,30 @@ dir_copy_folder(const char *source, const char *target,
 			ret--;
 		}
 	}
-	dir_copy_params_t *params = dir_copy_params_new(target, NULL, filter, filter_data);
-	if (dir_foreach(source, &dir_copy_folder_contents_cb, params) < 0) {
+
+	dir_walk_init(&walk);
+	walk.entry_cb = dir_copy_entry_cb;
+	walk.filter = filter;
+	walk.filter_data = filter_data;
+	walk.progress_cb = progress_cb;
+	walk.progress_data = progress_data;
+
+	dir_walk_push(&walk, mem_strdup(source), mem_strdup(target));
+	if (dir_walk_run(&walk, threads) < 0) {
 		ERROR("Could not copy all dir contents in %s", source);
 		ret--;
 	}
 
+	dir_walk_destroy(&walk);
 	umask(old_mask);
-	dir_copy_params_free(params);
 	return ret;
 }
+
+int
+dir_copy_folder(const char *source, const char *target,
+		bool (*filter)(const char *file, void *data), void *filter_data)
+{
+	// filters are not required to be thread-safe
+	return dir_copy_folder_parallel(source, target, filter, filter_data, filter ? 1 : 0,
+					NULL, NULL);
+}
@@ -33,7 +33,9 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <dirent.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /**
  * Read a directory and call a callback for each entry.
@@ -48,23 +50,109 @@ int
 dir_foreach(const char *path, int (*func)(const char *path, const char *file, void *data),
 	    void *data);
 
+/**
+ * Read the directory referred to by the open fd dirfd and call a callback for
+ * each entry, like dir_foreach(). Instead of path strings, the callback gets the
+ * fd of the directory, which may be used with the *at() syscalls such as
+ * fstatat() or openat(), and the type of the entry from the dirent (d_type),
+ * which saves a stat for most file systems, see dir_entry_type().
+ * The given dirfd is neither closed nor is its file offset changed.
+ *
+ * @param dirfd The fd of the directory, e.g., opened with O_DIRECTORY.
+ * @param func The callback to be called for each directory entry. Return <0 to stop calling
+ * callbacks and >0 to increment the return value of dir_foreach_at by one.
+ * @param data A data object given to each callback function.
+ * @returns -1 on error and the number of callbacks which returned a value > 0 on success.
+ */
+int
+dir_foreach_at(int dirfd, int (*func)(int dirfd, const char *name, unsigned char type, void *data),
+	       void *data);
+
+/**
+ * Returns the type (DT_DIR, DT_REG, DT_LNK, ...) of a directory entry as passed
+ * to the dir_foreach_at() callback. If the file system did not provide the
+ * type (DT_UNKNOWN), the entry is looked up by fstatat() without following
+ * symbolic links.
+ *
+ * @param dirfd The fd of the directory containing the entry.
+ * @param name The name of the entry.
+ * @param type The type as passed to the callback.
+ * @return The type of the entry, DT_UNKNOWN on error.
+ */
+unsigned char
+dir_entry_type(int dirfd, const char *name, unsigned char type);
+
 int
 dir_mkdir_p(const char *path, mode_t mode);
 
+/**
+ * Maximum number of threads used by dir_delete_folder_parallel() and
+ * dir_copy_folder_parallel().
+ */
+#define DIR_THREADS_MAX 8
+
+/**
+ * Delete the directory path/dir_name recursively, see dir_delete_folder_parallel().
+ * Uses one thread per online CPU.
+ *
+ * @param path The parent directory.
+ * @param dir_name The name of the directory to be deleted.
+ * @return 0 on success, a negative value on error.
+ */
 int
 dir_delete_folder(const char *path, const char *dir_name);
 
+/**
+ * Delete the directory path/dir_name recursively. Subdirectories are walked
+ * concurrently by up to threads threads including the calling one. Symbolic
+ * links are removed but not followed.
+ *
+ * @param path The parent directory.
+ * @param dir_name The name of the directory to be deleted.
+ * @param threads The maximum number of threads, 0 for one per online CPU
+ *	(at most DIR_THREADS_MAX).
+ * @param progress_cb Optional callback invoked from the calling thread with the
+ *	number of entries handled so far.
+ * @param data A data object given to the progress_cb() callback function.
+ * @return 0 on success, a negative value on error.
+ */
+int
+dir_delete_folder_parallel(const char *path, const char *dir_name, unsigned threads,
+			   void (*progress_cb)(size_t entries, void *data), void *data);
+
 /**
  * Copy a directory recursively. If the callback function filter() is defined,
- * it is used to filter out files accordingly during copy.
+ * it is used to filter out files accordingly during copy. The copy is done
+ * concurrently, see dir_copy_folder_parallel(), unless a filter is given.
  *
  * @param source source path to be copied from.
  * @param target target path which should be created and copied to.
  * @param filter_data A data object given to the filter() callback function.
- * @returns -1 on error and the number of callbacks which returned a value > 0 on success.
+ * @return 0 on success, a negative value on error.
  */
 int
 dir_copy_folder(const char *source, const char *target,
 		bool (*filter)(const char *file, void *data), void *filter_data);
 
+/**
+ * Copy a directory recursively with up to threads threads including the calling
+ * one. The filter() callback, if defined, may be called concurrently from
+ * several threads.
+ *
+ * @param source source path to be copied from.
+ * @param target target path which should be created and copied to.
+ * @param filter_data A data object given to the filter() callback function.
+ * @param threads The maximum number of threads, 0 for one per online CPU
+ *	(at most DIR_THREADS_MAX).
+ * @param progress_cb Optional callback invoked from the calling thread with the
+ *	number of entries handled so far.
+ * @param progress_data A data object given to the progress_cb() callback function.
+ * @return 0 on success, a negative value on error.
+ */
+int
+dir_copy_folder_parallel(const char *source, const char *target,
+			 bool (*filter)(const char *file, void *data), void *filter_data,
+			 unsigned threads, void (*progress_cb)(size_t entries, void *data),
+			 void *progress_data);
+
 #endif /* DIR_H */
@@ -0,0 +1,249 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "munit.h"
+
+#include "dir.h"
+#include "file.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_TREE_WIDTH 6
+#define TEST_TREE_DEPTH 3
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+
+	char *dir = mem_strdup("/tmp/dir-test-XXXXXX");
+	munit_assert_not_null(mkdtemp(dir));
+	return dir;
+}
+
+static void
+tear_down(void *fixture)
+{
+	char *dir = fixture;
+	rmdir(dir);
+	mem_free0(dir);
+}
+
+/*
+ * Creates TEST_TREE_WIDTH files and subdirectories per level and returns the
+ * number of created entries.
+ */
+static size_t
+create_tree(const char *path, int depth)
+{
+	size_t n = 0;
+
+	munit_assert_int(mkdir(path, 0755), ==, 0);
+	for (int i = 0; i < TEST_TREE_WIDTH; i++) {
+		char *file = mem_printf("%s/file%d", path, i);
+		munit_assert_int(file_printf(file, "%s", file), >, 0);
+		mem_free0(file);
+		n++;
+
+		if (depth > 0) {
+			char *dir = mem_printf("%s/dir%d", path, i);
+			n += create_tree(dir, depth - 1) + 1;
+			mem_free0(dir);
+		}
+	}
+
+	char *link = mem_printf("%s/link", path);
+	munit_assert_int(symlink("file0", link), ==, 0);
+	mem_free0(link);
+
+	return n + 1;
+}
+
+static void
+check_tree(const char *path, const char *orig, int depth)
+{
+	for (int i = 0; i < TEST_TREE_WIDTH; i++) {
+		char *file = mem_printf("%s/file%d", path, i);
+		char *expected = mem_printf("%s/file%d", orig, i);
+		char *content = file_read_new(file, 4096);
+		munit_assert_not_null(content);
+		munit_assert_string_equal(content, expected);
+		mem_free0(content);
+		mem_free0(expected);
+		mem_free0(file);
+
+		if (depth > 0) {
+			char *dir = mem_printf("%s/dir%d", path, i);
+			char *orig_dir = mem_printf("%s/dir%d", orig, i);
+			check_tree(dir, orig_dir, depth - 1);
+			mem_free0(orig_dir);
+			mem_free0(dir);
+		}
+	}
+
+	char *link = mem_printf("%s/link", path);
+	char target[16] = { 0 };
+	munit_assert_int(readlink(link, target, sizeof(target) - 1), ==, 5);
+	munit_assert_string_equal(target, "file0");
+	mem_free0(link);
+}
+
+static void
+progress_cb(size_t entries, void *data)
+{
+	size_t *progress = data;
+
+	// called from the calling thread with increasing counts only
+	munit_assert_size(entries, >, *progress);
+	*progress = entries;
+}
+
+static MunitResult
+test_copy_and_delete(UNUSED const MunitParameter params[], void *fixture)
+{
+	char *src = mem_printf("%s/src", (char *)fixture);
+	char *dst = mem_printf("%s/dst", (char *)fixture);
+	size_t progress = 0;
+
+	size_t n = create_tree(src, TEST_TREE_DEPTH);
+
+	munit_assert_int(dir_copy_folder_parallel(src, dst, NULL, NULL, 4, progress_cb, &progress),
+			 ==, 0);
+	munit_assert_size(progress, ==, n);
+	check_tree(dst, src, TEST_TREE_DEPTH);
+
+	// links are removed, but their targets are kept
+	char *outside = mem_printf("%s/outside", (char *)fixture);
+	char *link = mem_printf("%s/dir0/outside", dst);
+	munit_assert_int(mkdir(outside, 0755), ==, 0);
+	munit_assert_int(symlink(outside, link), ==, 0);
+
+	progress = 0;
+	munit_assert_int(dir_delete_folder_parallel(fixture, "dst", 4, progress_cb, &progress),
+			 ==, 0);
+	munit_assert_size(progress, ==, n + 1);
+	munit_assert_false(file_exists(dst));
+	munit_assert_true(file_is_dir(outside));
+
+	// serial operation
+	munit_assert_int(dir_copy_folder(src, dst, NULL, NULL), ==, 0);
+	check_tree(dst, src, TEST_TREE_DEPTH);
+	munit_assert_int(dir_delete_folder_parallel(fixture, "dst", 1, NULL, NULL), ==, 0);
+	munit_assert_int(dir_delete_folder(fixture, "src"), ==, 0);
+	munit_assert_false(file_exists(src));
+
+	// a missing directory is an error
+	munit_assert_int(dir_delete_folder(fixture, "src"), <, 0);
+
+	rmdir(outside);
+	mem_free0(link);
+	mem_free0(outside);
+	mem_free0(src);
+	mem_free0(dst);
+
+	return MUNIT_OK;
+}
+
+static int
+count_types_cb(int dirfd, const char *name, unsigned char type, void *data)
+{
+	size_t *count = data;
+
+	switch (dir_entry_type(dirfd, name, type)) {
+	case DT_REG:
+		count[0]++;
+		break;
+	case DT_DIR:
+		count[1]++;
+		break;
+	case DT_LNK:
+		count[2]++;
+		break;
+	}
+	// only files are counted by the return value
+	return type == DT_REG ? 1 : 0;
+}
+
+static MunitResult
+test_foreach_at(UNUSED const MunitParameter params[], void *fixture)
+{
+	char *src = mem_printf("%s/src", (char *)fixture);
+	size_t count[3] = { 0 };
+
+	create_tree(src, 1);
+	int fd = open(src, O_RDONLY | O_DIRECTORY);
+	munit_assert_int(fd, >=, 0);
+
+	munit_assert_int(dir_foreach_at(fd, count_types_cb, count), ==, TEST_TREE_WIDTH);
+	munit_assert_size(count[0], ==, TEST_TREE_WIDTH);
+	munit_assert_size(count[1], ==, TEST_TREE_WIDTH);
+	munit_assert_size(count[2], ==, 1);
+
+	// the given fd can be used for another walk
+	munit_assert_int(dir_foreach_at(fd, count_types_cb, count), ==, TEST_TREE_WIDTH);
+	munit_assert_size(count[0], ==, 2 * TEST_TREE_WIDTH);
+	close(fd);
+
+	munit_assert_int(dir_foreach_at(-1, count_types_cb, count), ==, -1);
+	munit_assert_int(dir_delete_folder(fixture, "src"), ==, 0);
+	mem_free0(src);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/copy and delete",	/* name */
+		test_copy_and_delete,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/foreach_at",		/* name */
+		test_foreach_at,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite dir_suite = {
+	"/dir",			/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
@@ -36,6 +36,8 @@
 #include <sys/mount.h>
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "macro.h"
 #include "mem.h"
@@ -43,6 +45,9 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
+#define DM_IOCTL_RETRIES 10
+#define DM_TABLE_BUF_SIZE 4096
+
 struct dm_cmd_table cmd_table[] = {
 	{ DM_DEV_CREATE, { 4, 0, 0 } },	  { DM_TABLE_LOAD, { 4, 0, 0 } },
 	{ DM_DEV_REMOVE, { 4, 0, 0 } },	  { DM_REMOVE_ALL, { 4, 0, 0 } },
@@ -124,6 +129,100 @@ dm_close_control(int fd)
 		close(fd);
 }
 
+/**
+ * Issues a dm ioctl, retrying on transient failures as e.g. the loop device
+ * below may still be busy while it is set up.
+ */
+static int
+dm_ioctl_retry(int fd, enum dm_cmd_index idx, struct dm_ioctl *io)
+{
+	for (int i = 0; i < DM_IOCTL_RETRIES; i++) {
+		if (dm_ioctl(fd, cmd_table[idx].cmd, io) == 0) {
+			if (i > 0)
+				INFO("dm ioctl %d for %s took %d tries", idx, io->name, i + 1);
+			return 0;
+		}
+		if (errno == EEXIST || errno == ENXIO || errno == EINVAL)
+			break;
+		NANOSLEEP(0, 500000000)
+	}
+	return -1;
+}
+
+int
+dm_create_dev(int fd, const char *name, const dm_target_t *targets, unsigned int count,
+	      const char *node)
+{
+	uint8_t buf[DM_TABLE_BUF_SIZE] __attribute__((__aligned__(8)));
+	struct dm_ioctl *io = (struct dm_ioctl *)buf;
+	int ret = -1;
+
+	ASSERT(name && targets);
+
+	dm_ioctl_init(io, INDEX_DM_DEV_CREATE, sizeof(buf), name, NULL, 0, 0, 0, 0);
+	if (dm_ioctl_retry(fd, INDEX_DM_DEV_CREATE, io) < 0) {
+		ERROR_ERRNO("DM_DEV_CREATE failed for %s", name);
+		goto out;
+	}
+
+	dm_ioctl_init(io, INDEX_DM_TABLE_LOAD, sizeof(buf), name, NULL, 0, 0, count, 0);
+
+	// the targets follow the header, each one with its parameters 8-byte aligned
+	size_t off = sizeof(struct dm_ioctl);
+	for (unsigned int i = 0; i < count; i++) {
+		struct dm_target_spec *tgt = (struct dm_target_spec *)&buf[off];
+		size_t params_len = strlen(targets[i].params) + 1;
+		size_t spec_len = (sizeof(*tgt) + params_len + 7) & ~7UL;
+
+		if (off + spec_len > sizeof(buf)) {
+			ERROR("Table of %s exceeds %d bytes", name, DM_TABLE_BUF_SIZE);
+			goto remove;
+		}
+
+		tgt->sector_start = targets[i].start;
+		tgt->length = targets[i].length;
+		tgt->status = 0;
+		strncpy(tgt->target_type, targets[i].type, sizeof(tgt->target_type) - 1);
+		memcpy((char *)(tgt + 1), targets[i].params, params_len);
+		// offset from this to the next target spec
+		tgt->next = spec_len;
+		off += spec_len;
+	}
+
+	if (dm_ioctl_retry(fd, INDEX_DM_TABLE_LOAD, io) < 0) {
+		ERROR_ERRNO("DM_TABLE_LOAD failed for %s", name);
+		goto remove;
+	}
+
+	// resume the device to activate the loaded table
+	dm_ioctl_init(io, INDEX_DM_DEV_SUSPEND, sizeof(buf), name, NULL, 0, 0, 0, 0);
+	if (dm_ioctl(fd, cmd_table[INDEX_DM_DEV_SUSPEND].cmd, io) < 0) {
+		ERROR_ERRNO("Cannot resume dm-device %s", name);
+		goto remove;
+	}
+
+	if (node && mknod(node, S_IFBLK | 00777, io->dev) < 0) {
+		if (errno != EEXIST) {
+			ERROR_ERRNO("Cannot mknod device %s", node);
+			goto remove;
+		}
+		DEBUG("Device %s already exists, continuing", node);
+	}
+
+	DEBUG("Successfully created dm-device %s", name);
+	ret = 0;
+	goto out;
+
+remove:
+	dm_ioctl_init(io, INDEX_DM_DEV_REMOVE, sizeof(buf), name, NULL, 0, 0, 0, 0);
+	if (dm_ioctl(fd, cmd_table[INDEX_DM_DEV_REMOVE].cmd, io) < 0)
+		WARN_ERRNO("Failed to remove dm-device %s", name);
+out:
+	// the table may contain key material
+	mem_memset0(buf, sizeof(buf));
+	return ret;
+}
+
 uint64_t
 dm_get_blkdev_size64(int fd)
 {
@@ -196,6 +295,37 @@ dm_list_versions(int fd)
 	return 0;
 }
 
+bool
+dm_has_target_type(int fd, const char *type)
+{
+	uint8_t buf[16384] = { 0 };
+	struct dm_ioctl *dmi = (struct dm_ioctl *)buf;
+
+	dm_ioctl_init(dmi, INDEX_DM_LIST_VERSIONS, sizeof(buf), NULL, NULL, DM_EXISTS_FLAG, 0, 0,
+		      0);
+	if (dm_ioctl(fd, cmd_table[INDEX_DM_LIST_VERSIONS].cmd, dmi) != 0) {
+		WARN_ERRNO("DM_LIST_VERSIONS ioctl failed");
+		return false;
+	}
+	IF_TRUE_RETVAL(dmi->flags & DM_BUFFER_FULL_FLAG, false);
+	// terminates the name of a truncated last record
+	buf[sizeof(buf) - 1] = '\0';
+
+	// the targets are a chain of records, each with the offset of the next one
+	size_t off = dmi->data_start;
+	while (off + sizeof(struct dm_target_versions) < MIN(dmi->data_size, sizeof(buf))) {
+		struct dm_target_versions *tv = (struct dm_target_versions *)&buf[off];
+		if (!strcmp(tv->name, type)) {
+			TRACE("Found dm target %s %u.%u.%u", tv->name, tv->version[0],
+			      tv->version[1], tv->version[2]);
+			return true;
+		}
+		IF_TRUE_RETVAL(tv->next == 0, false);
+		off += tv->next;
+	}
+	return false;
+}
+
 char *
 dm_get_target_type_new(int fd, const char *name)
 {
@@ -25,6 +25,8 @@
 #define DM_H
 
 #include <linux/dm-ioctl.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #define DM_NAME_LEN 128
 #define DM_UUID_LEN 129
@@ -107,6 +109,35 @@ dm_open_control(void);
 void
 dm_close_control(int fd);
 
+/**
+ * One target of a device-mapper table, see dm_create_dev()
+ */
+typedef struct dm_target {
+	uint64_t start;	    // first sector covered by the target
+	uint64_t length;    // number of sectors
+	const char *type;   // target type, e.g. "crypt"
+	const char *params; // target specific parameters
+} dm_target_t;
+
+/**
+ * Creates and activates a dm-device with a table of one or more targets.
+ * The device is created, its table loaded and it is resumed using the given
+ * control fd. The device node is created by mknod with the dev_t returned by
+ * the kernel, thus there is no need to wait for it to show up. Stacked devices
+ * are set up with one call per layer, reusing the same control fd. If the device
+ * cannot be activated, it is removed again.
+ *
+ * @param fd The /dev/mapper/control file descriptor, see dm_open_control()
+ * @param name The name of the new dm-device
+ * @param targets The targets of the table in order of their start sectors
+ * @param count The number of targets
+ * @param node The path of the device node to be created or NULL
+ * @return int 0 in case of success, -1 in case of failure
+ */
+int
+dm_create_dev(int fd, const char *name, const dm_target_t *targets, unsigned int count,
+	      const char *node);
+
 /**
  * Get the size of a Linux special block device in bytes
  *
@@ -160,6 +191,17 @@ dm_read_version(int fd);
 int
 dm_list_versions(int fd);
 
+/**
+ * Checks whether the kernel provides a device-mapper target type, e.g., one which is only
+ * available in some kernels like "default-key".
+ *
+ * @param fd The /dev/mapper/control file descriptor (can be retrieved via dm_open_control)
+ * @param type The name of the target type
+ * @return true if the target type is registered, false otherwise or on error
+ */
+bool
+dm_has_target_type(int fd, const char *type);
+
 /**
  * Get the target_type of a dm-device
  *
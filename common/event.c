@@ -28,6 +28,12 @@
 #include "mem.h"
 #include "list.h"
 #include "macro.h"
+#include "probe.h"
+
+#ifdef EVENT_IO_URING
+#include "uring.h"
+#include <poll.h>
+#endif
 
 #include <errno.h>
 #include <limits.h>
@@ -36,6 +42,8 @@
 #include <signal.h>
 #include <sys/epoll.h>
 #include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -83,6 +91,8 @@ struct event_timer {
 	struct timespec next;	  /**< next timeout, absolute value */
 	int repeat;		  /**< how often to repeat, -1 means repeat indefinitely */
 	int repeated;		  /**< how often the timer already expired */
+	size_t heap_idx;	  /**< position in base->timer_heap or EVENT_TIMER_NOT_QUEUED */
+	event_base_t *base;	  /**< the event base the timer was added to */
 };
 
 struct event_io {
@@ -91,6 +101,10 @@ struct event_io {
 	void *data;		  /**< a data pointer to pass to the callback function */
 	int fd;			  /**< the file descriptor which should be watched */
 	unsigned events;	  /**< mask of events to listen for */
+	event_base_t *base;	  /**< the event base the io event was added to */
+#ifdef EVENT_IO_URING
+	uint64_t ring_data; /**< user_data of the pending poll request (generation | slot) */
+#endif
 };
 
 struct event_inotify {
@@ -101,6 +115,7 @@ struct event_inotify {
 	uint32_t mask;		  /**< a bit-mask of events to be watched for */
 	int wd;			  /**< the watch descriptor */
 	bool todo;		  /**< helper variable for event_inotify_handler() */
+	event_base_t *base;	  /**< the event base the inotify event was added to */
 };
 
 struct event_signal {
@@ -111,51 +126,345 @@ struct event_signal {
 	bool todo;		  /**< helper variable for event_signal_handler() */
 };
 
-static list_t *event_timer_list = NULL;
+struct event_child {
+	void (*func)(pid_t pid, int status, event_child_t *child,
+		     void *data); /**< the function to call when the child terminated */
+	void *data;		  /**< a data pointer to pass to the callback function */
+	pid_t pid;		  /**< the pid of the child to be reaped */
+	event_io_t *io;		  /**< io event on the pidfd, NULL if reaped on SIGCHLD */
+	bool active;		  /**< the child event is added */
+};
+
+struct event_base {
+	int epoll_fd;		     /**< the epoll fd of this loop, -1 if not yet created */
+	unsigned io_active;	     /**< number of io events registered in epoll_fd */
+	event_timer_t **timer_heap;  /**< binary min-heap of active timers, ordered by next */
+	size_t timer_heap_len;	     /**< number of timers in timer_heap */
+	size_t timer_heap_size;	     /**< allocated size of timer_heap */
+	list_t **inotify_buckets;    /**< registered inotify events, hashed by watch descriptor */
+	size_t inotify_buckets_size; /**< number of buckets, a power of two */
+	size_t inotify_count;	     /**< number of registered inotify events */
+	event_io_t *inotify_io;	     /**< io event wrapping the inotify fd */
+#ifdef EVENT_IO_URING
+	uring_t *ring;		  /**< io_uring used instead of epoll_fd, if available */
+	bool ring_disabled;	  /**< io_uring is not available, epoll_fd is used instead */
+	event_io_t **ring_slots;  /**< io events by slot, encoded in the poll user_data */
+	size_t *ring_free;	  /**< stack of unused slots */
+	size_t ring_slots_len;	  /**< number of slots ever used */
+	size_t ring_slots_size;	  /**< allocated size of ring_slots and ring_free */
+	size_t ring_free_len;	  /**< number of entries in ring_free */
+	uint32_t ring_gen;	  /**< generation counter to detect stale completions */
+#endif
+	bool stats_enabled;	  /**< account handler invocations in stats */
+	event_stats_t *stats;	  /**< open addressing table of handler stats, keyed by func */
+	size_t stats_len;	  /**< number of used entries in stats */
+	size_t stats_size;	  /**< allocated size of stats, a power of two */
+};
+
+#define EVENT_TIMER_NOT_QUEUED ((size_t)-1)
+
+/*
+ * The default base is used by every thread which did not bind its own base
+ * by event_base_set_current(). Only the default base handles signals, since
+ * signal dispositions are process wide anyway.
+ */
+static event_base_t event_base_default = { .epoll_fd = -1 };
+static __thread event_base_t *event_base_current = NULL;
+
 static list_t *event_signal_list = NULL;
-static list_t *event_inotify_list = NULL;
 static bool event_signal_received0[NSIG] = { false };
 static bool event_signal_received1[NSIG] = { false };
 static bool *event_signal_received = event_signal_received0;
-static unsigned event_io_active = 0;
 static bool event_initialized = false;
-static event_io_t *event_inotify_io = NULL;
+
+static list_t *event_child_list = NULL;	      /**< child events without pidfd */
+static event_signal_t *event_child_sig = NULL; /**< SIGCHLD handler for event_child_list */
 
 /******************************************************************************/
 
-static int
-event_timeout(void)
+static event_base_t *
+event_base_get(void)
 {
-	struct timespec next, now, diff;
-	event_timer_t *timer;
-	list_t *l;
+	return event_base_current ? event_base_current : &event_base_default;
+}
 
-	if (!event_timer_list)
-		return -1;
+event_base_t *
+event_base_new(void)
+{
+	event_base_t *base = mem_new0(event_base_t, 1);
+	base->epoll_fd = -1;
 
-	l = event_timer_list;
-	timer = l->data;
+	return base;
+}
 
-	ASSERT(timer);
+void
+event_base_free(event_base_t *base)
+{
+	IF_NULL_RETURN(base);
+	IF_TRUE_RETURN(base == &event_base_default);
 
-	timespec_set(&timer->next, &next);
+	if (base->timer_heap_len || base->inotify_count || base->io_active)
+		WARN("Freeing event base %p with pending events", (void *)base);
 
-	// find the smallest next time in list
-	for (l = l->next; l; l = l->next) {
-		timer = l->data;
+	if (event_base_current == base)
+		event_base_current = NULL;
 
-		ASSERT(timer);
+	if (base->inotify_io) {
+		close(base->inotify_io->fd);
+		event_io_free(base->inotify_io);
+	}
+	for (size_t i = 0; i < base->timer_heap_len; i++)
+		base->timer_heap[i]->heap_idx = EVENT_TIMER_NOT_QUEUED;
+	for (size_t i = 0; i < base->inotify_buckets_size; i++)
+		list_delete(base->inotify_buckets[i]);
+	mem_free0(base->inotify_buckets);
+	mem_free0(base->timer_heap);
+	mem_free0(base->stats);
+#ifdef EVENT_IO_URING
+	uring_free(base->ring);
+	mem_free0(base->ring_slots);
+	mem_free0(base->ring_free);
+#endif
+	if (base->epoll_fd >= 0)
+		close(base->epoll_fd);
+	mem_free0(base);
+}
 
-		if (timespec_cmp(&next, &timer->next, >))
-			timespec_set(&timer->next, &next);
+void
+event_base_set_current(event_base_t *base)
+{
+	event_base_current = (base == &event_base_default) ? NULL : base;
+}
+
+event_base_t *
+event_base_get_current(void)
+{
+	return event_base_get();
+}
+
+/******************************************************************************/
+
+static uint64_t
+timespec_to_ns(const struct timespec *a)
+{
+	return (uint64_t)a->tv_sec * 1000000000ULL + (uint64_t)a->tv_nsec;
+}
+
+static size_t
+event_stats_hash(const void *func, size_t mask)
+{
+	// fibonacci hashing, the low bits of code addresses are mostly zero
+	return (size_t)(((uintptr_t)func * 11400714819323198485ULL) >> 32) & mask;
+}
+
+static event_stats_t *
+event_stats_lookup(event_base_t *base, const void *func, const char *type)
+{
+	if (2 * (base->stats_len + 1) > base->stats_size) {
+		event_stats_t *old = base->stats;
+		size_t old_size = base->stats_size;
+
+		base->stats_size = old_size ? 2 * old_size : 64;
+		base->stats = mem_new0(event_stats_t, base->stats_size);
+		base->stats_len = 0;
+		for (size_t i = 0; i < old_size; i++) {
+			if (!old[i].func)
+				continue;
+			*event_stats_lookup(base, old[i].func, old[i].type) = old[i];
+		}
+		mem_free0(old);
 	}
 
+	size_t mask = base->stats_size - 1;
+	for (size_t i = event_stats_hash(func, mask);; i = (i + 1) & mask) {
+		event_stats_t *stats = &base->stats[i];
+		if (stats->func == func)
+			return stats;
+		if (!stats->func) {
+			stats->func = func;
+			stats->type = type;
+			base->stats_len++;
+			return stats;
+		}
+	}
+}
+
+/*
+ * Returns true and stores the start time if the handler about to be called
+ * should be accounted. The result has to be kept by the caller, since the
+ * handler itself might toggle accounting.
+ */
+static bool
+event_stats_begin(event_base_t *base, struct timespec *start)
+{
+	if (!base->stats_enabled)
+		return false;
+
+	timespec_now(start);
+	return true;
+}
+
+static void
+event_stats_end(event_base_t *base, const void *func, const char *type,
+		const struct timespec *start, const struct timespec *scheduled)
+{
+	struct timespec now, diff;
+	event_stats_t *stats = event_stats_lookup(base, func, type);
+
 	timespec_now(&now);
+	timespec_sub(&now, start, &diff);
+
+	uint64_t time = timespec_to_ns(&diff);
+	stats->count++;
+	stats->time_total += time;
+	stats->time_max = MAX(stats->time_max, time);
+
+	if (scheduled && timespec_cmp(start, scheduled, >)) {
+		timespec_sub(start, scheduled, &diff);
+		uint64_t lag = timespec_to_ns(&diff);
+		stats->lag_total += lag;
+		stats->lag_max = MAX(stats->lag_max, lag);
+	}
+}
+
+void
+event_stats_enable(bool enable)
+{
+	event_base_t *base = event_base_get();
+
+	// the table is kept on disable, a handler may currently be accounted
+	if (enable && !base->stats_enabled && base->stats) {
+		memset(base->stats, 0, base->stats_size * sizeof(event_stats_t));
+		base->stats_len = 0;
+	}
+	base->stats_enabled = enable;
+}
+
+bool
+event_stats_is_enabled(void)
+{
+	return event_base_get()->stats_enabled;
+}
+
+event_stats_t *
+event_stats_get(size_t *len)
+{
+	event_base_t *base = event_base_get();
+	event_stats_t *stats;
+	size_t n = 0;
+
+	IF_NULL_RETVAL(len, NULL);
+
+	*len = 0;
+	IF_FALSE_RETVAL(base->stats_len, NULL);
+
+	stats = mem_new0(event_stats_t, base->stats_len);
+	for (size_t i = 0; i < base->stats_size; i++) {
+		if (base->stats[i].func)
+			stats[n++] = base->stats[i];
+	}
+	*len = n;
 
-	if (timespec_cmp(&next, &now, <))
+	return stats;
+}
+
+/******************************************************************************/
+
+static void
+event_timer_heap_set(event_base_t *base, size_t idx, event_timer_t *timer)
+{
+	base->timer_heap[idx] = timer;
+	timer->heap_idx = idx;
+}
+
+static void
+event_timer_heap_sift_up(event_base_t *base, size_t idx)
+{
+	event_timer_t *timer = base->timer_heap[idx];
+
+	while (idx > 0) {
+		size_t parent = (idx - 1) / 2;
+		if (!timespec_cmp(&timer->next, &base->timer_heap[parent]->next, <))
+			break;
+		event_timer_heap_set(base, idx, base->timer_heap[parent]);
+		idx = parent;
+	}
+	event_timer_heap_set(base, idx, timer);
+}
+
+static void
+event_timer_heap_sift_down(event_base_t *base, size_t idx)
+{
+	event_timer_t *timer = base->timer_heap[idx];
+
+	for (;;) {
+		size_t child = 2 * idx + 1;
+		if (child >= base->timer_heap_len)
+			break;
+		if (child + 1 < base->timer_heap_len &&
+		    timespec_cmp(&base->timer_heap[child + 1]->next, &base->timer_heap[child]->next,
+				 <))
+			child++;
+		if (!timespec_cmp(&base->timer_heap[child]->next, &timer->next, <))
+			break;
+		event_timer_heap_set(base, idx, base->timer_heap[child]);
+		idx = child;
+	}
+	event_timer_heap_set(base, idx, timer);
+}
+
+static void
+event_timer_heap_insert(event_base_t *base, event_timer_t *timer)
+{
+	if (base->timer_heap_len == base->timer_heap_size) {
+		base->timer_heap_size = base->timer_heap_size ? 2 * base->timer_heap_size : 16;
+		base->timer_heap =
+			mem_renew(event_timer_t *, base->timer_heap, base->timer_heap_size);
+	}
+
+	event_timer_heap_set(base, base->timer_heap_len++, timer);
+	event_timer_heap_sift_up(base, timer->heap_idx);
+}
+
+static void
+event_timer_heap_delete(event_timer_t *timer)
+{
+	event_base_t *base = timer->base;
+	size_t idx = timer->heap_idx;
+
+	ASSERT(idx < base->timer_heap_len && base->timer_heap[idx] == timer);
+
+	timer->heap_idx = EVENT_TIMER_NOT_QUEUED;
+	if (idx == --base->timer_heap_len)
+		return;
+
+	// move last element into the gap and restore heap order in both directions
+	event_timer_t *last = base->timer_heap[base->timer_heap_len];
+	event_timer_heap_set(base, idx, last);
+	event_timer_heap_sift_up(base, idx);
+	event_timer_heap_sift_down(base, last->heap_idx);
+}
+
+static int
+event_timeout(event_base_t *base)
+{
+	struct timespec now, diff;
+	event_timer_t *timer;
+
+	if (!base->timer_heap_len)
+		return -1;
+
+	// the timer with the smallest next time is always on top of the heap
+	timer = base->timer_heap[0];
+
+	ASSERT(timer);
+
+	timespec_now(&now);
+
+	if (timespec_cmp(&timer->next, &now, <))
 		return 0;
 
-	timespec_sub(&next, &now, &diff);
+	timespec_sub(&timer->next, &now, &diff);
 
 	// should not happen, because timeout was an int too
 	ASSERT(diff.tv_sec <= (INT_MAX / 1000));
@@ -165,48 +474,53 @@ event_timeout(void)
 }
 
 static void
-event_timeout_handler(void)
+event_timeout_handler(event_base_t *base)
 {
 	struct timespec now;
 
-	IF_NULL_RETURN(event_timer_list);
-
 	timespec_now(&now);
 
-	for (list_t *l = event_timer_list; l;) {
-		event_timer_t *timer = l->data;
+	// timer->func might add, remove or even free timers, thus we
+	// always look at the current top of the heap again
+	while (base->timer_heap_len) {
+		event_timer_t *timer = base->timer_heap[0];
 
 		ASSERT(timer);
 
-		if (timespec_cmp(&now, &timer->next, >)) {
-			if (!timer->repeated) {
-				event_remove_timer(timer);
-			} else {
-				if (timer->repeated > 0)
-					timer->repeated--;
-				if (!timer->repeated)
-					event_remove_timer(timer);
-				else
-					timespec_add(&timer->diff, &timer->next, &timer->next);
-
-				TRACE("Handling timer event %p (func=%p, data=%p, diff=%u.%09us, repeat=%d)",
-				      (void *)timer, CAST_FUNCPTR_VOIDPTR timer->func, timer->data,
-				      (unsigned)timer->diff.tv_sec, (unsigned)timer->diff.tv_nsec,
-				      timer->repeat);
-
-				(timer->func)(timer, timer->data);
-			}
+		if (!timespec_cmp(&now, &timer->next, >))
+			break;
 
-			// event_timer_remove modifies the timer list
-			// and timer->func might modify the timer list
-			// so we will start again at its head...
-			if (event_timer_list)
-				l = event_timer_list;
-			else
-				break;
+		if (!timer->repeated) {
+			event_remove_timer(timer);
+			continue;
+		}
+
+		struct timespec scheduled;
+		timespec_set(&timer->next, &scheduled);
+
+		if (timer->repeated > 0)
+			timer->repeated--;
+		if (!timer->repeated) {
+			event_remove_timer(timer);
 		} else {
-			l = l->next;
+			timespec_add(&timer->diff, &timer->next, &timer->next);
+			event_timer_heap_sift_down(base, timer->heap_idx);
 		}
+
+		TRACE("Handling timer event %p (func=%p, data=%p, diff=%u.%09us, repeat=%d)",
+		      (void *)timer, CAST_FUNCPTR_VOIDPTR timer->func, timer->data,
+		      (unsigned)timer->diff.tv_sec, (unsigned)timer->diff.tv_nsec, timer->repeat);
+
+		struct timespec start;
+		const void *func = CAST_FUNCPTR_VOIDPTR timer->func;
+		bool stats = event_stats_begin(base, &start);
+		PROBE3(event_dispatch, "timer", func, -1);
+
+		(timer->func)(timer, timer->data);
+
+		PROBE2(event_done, "timer", func);
+		if (stats)
+			event_stats_end(base, func, "timer", &start, &scheduled);
 	}
 }
 
@@ -226,6 +540,8 @@ event_timer_new(int timeout, int repeat, void (*func)(event_timer_t *timer, void
 	timer->next.tv_sec = 0;
 	timer->next.tv_nsec = 0;
 	timer->repeat = repeat;
+	timer->heap_idx = EVENT_TIMER_NOT_QUEUED;
+	timer->base = NULL;
 
 	return timer;
 }
@@ -235,6 +551,10 @@ event_timer_free(event_timer_t *timer)
 {
 	IF_NULL_RETURN(timer);
 
+	// never leave a dangling pointer in the heap
+	if (timer->heap_idx != EVENT_TIMER_NOT_QUEUED)
+		event_timer_heap_delete(timer);
+
 	mem_free0(timer);
 }
 
@@ -245,11 +565,22 @@ event_add_timer(event_timer_t *timer)
 
 	IF_NULL_RETURN(timer);
 
+	event_base_t *base = event_base_get();
+
 	timespec_now(&now);
 	timespec_add(&now, &timer->diff, &timer->next);
 	timer->repeated = timer->repeat;
 
-	event_timer_list = list_append(event_timer_list, timer);
+	// re-adding an already queued timer just reschedules it
+	if (timer->heap_idx != EVENT_TIMER_NOT_QUEUED && timer->base == base) {
+		event_timer_heap_sift_up(base, timer->heap_idx);
+		event_timer_heap_sift_down(base, timer->heap_idx);
+	} else {
+		if (timer->heap_idx != EVENT_TIMER_NOT_QUEUED)
+			event_timer_heap_delete(timer);
+		timer->base = base;
+		event_timer_heap_insert(base, timer);
+	}
 
 	TRACE("Added timer event %p (func=%p, data=%p, diff=%u.%09us, repeat=%d)", (void *)timer,
 	      CAST_FUNCPTR_VOIDPTR timer->func, timer->data, (unsigned)timer->diff.tv_sec,
@@ -261,8 +592,11 @@ event_remove_timer(event_timer_t *timer)
 {
 	IF_NULL_RETURN(timer);
 
-	TRACE("Removing timer event %p from list %p", (void *)timer, (void *)event_timer_list);
-	event_timer_list = list_remove(event_timer_list, timer);
+	TRACE("Removing timer event %p from heap of base %p", (void *)timer, (void *)timer->base);
+	if (timer->heap_idx == EVENT_TIMER_NOT_QUEUED)
+		return;
+
+	event_timer_heap_delete(timer);
 
 	TRACE("Removed timer event %p (func=%p, data=%p, diff=%u.%09us, repeat=%d)", (void *)timer,
 	      CAST_FUNCPTR_VOIDPTR timer->func, timer->data, (unsigned)timer->diff.tv_sec,
@@ -272,9 +606,9 @@ event_remove_timer(event_timer_t *timer)
 /******************************************************************************/
 
 static int
-event_epoll_fd(int reset)
+event_epoll_fd(event_base_t *base, int reset)
 {
-	static int fd = -1;
+	int fd = base->epoll_fd;
 
 	if (fd < 0 || (fd >= 0 && reset == 1)) {
 		if (fd >= 0 && close(fd) < 0) {
@@ -295,26 +629,279 @@ event_epoll_fd(int reset)
 		oldflags |= FD_CLOEXEC;
 		if (fcntl(fd, F_SETFD, oldflags) < 0)
 			WARN_ERRNO("fcntl failed");
+
+		base->epoll_fd = fd;
 	}
 
 	return fd;
 }
 
+#ifdef EVENT_IO_URING
+/*
+ * io_uring backend: every io event is a oneshot IORING_OP_POLL_ADD request,
+ * which is re-armed after its callback returned. This keeps the level
+ * triggered semantics of epoll, while all adds, removes and re-arms queued
+ * during one loop iteration are submitted together with the next wait.
+ */
+
+#define EVENT_URING_ENTRIES 256
+#define EVENT_URING_DATA_SLOT(d) ((size_t)((d)&UINT32_MAX))
+/* user_data of requests without an io event, e.g. POLL_REMOVE */
+#define EVENT_URING_DATA_INTERNAL ((uint64_t)UINT32_MAX)
+
+static uring_t *
+event_uring(event_base_t *base)
+{
+	if (!base->ring && !base->ring_disabled) {
+		base->ring = uring_new(EVENT_URING_ENTRIES);
+		if (!base->ring) {
+			INFO("io_uring not available, using epoll for event base %p",
+			     (void *)base);
+			base->ring_disabled = true;
+		}
+	}
+
+	return base->ring;
+}
+
 static void
-event_reset_fd(void)
+event_uring_reset(event_base_t *base)
 {
-	event_epoll_fd(1);
+	// in a forked child this only drops our mappings of the parent's ring
+	uring_free(base->ring);
+	base->ring = NULL;
+	base->ring_slots_len = 0;
+	base->ring_free_len = 0;
+}
+
+static unsigned
+event_uring_poll_mask(unsigned events)
+{
+	unsigned mask = 0;
+
+	mask |= (events & EVENT_IO_READ) ? POLLIN : 0;
+	mask |= (events & EVENT_IO_WRITE) ? POLLOUT : 0;
+	mask |= (events & EVENT_IO_PRI) ? POLLPRI : 0;
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+	// poll32_events is stored with swapped half words on big endian
+	mask = (mask << 16) | (mask >> 16);
+#endif
+	return mask;
+}
+
+/*
+ * Moves all io events of base from io_uring to epoll, if no more requests can be queued.
+ * Completions which were not handled yet are reported again by the level triggered epoll.
+ */
+static void
+event_uring_fallback(event_base_t *base)
+{
+	WARN("io_uring submission queue of event base %p stuck, falling back to epoll",
+	     (void *)base);
+
+	for (size_t slot = 0; slot < base->ring_slots_len; slot++) {
+		event_io_t *io = base->ring_slots[slot];
+		if (!io)
+			continue;
+
+		struct epoll_event epoll_event;
+		epoll_event.events = 0;
+		epoll_event.events |= (io->events & EVENT_IO_READ) ? EPOLLIN : 0;
+		epoll_event.events |= (io->events & EVENT_IO_WRITE) ? EPOLLOUT : 0;
+		epoll_event.events |= (io->events & EVENT_IO_PRI) ? EPOLLPRI : 0;
+		epoll_event.data.ptr = io;
+
+		if (epoll_ctl(event_epoll_fd(base, 0), EPOLL_CTL_ADD, io->fd, &epoll_event) < 0) {
+			WARN_ERRNO("Could not move io event %p (fd=%d) to epoll", (void *)io,
+				   io->fd);
+			io->base = NULL;
+			base->io_active--;
+		}
+	}
+
+	event_uring_reset(base);
+	base->ring_disabled = true;
+}
+
+/*
+ * Returns a submission queue entry of the ring of base. uring_get_sqe() already submits the
+ * queued entries if the queue is full, thus a failure is retried once, in case the submit
+ * was interrupted. If this fails as well, the base falls back to epoll and NULL is returned.
+ */
+static struct io_uring_sqe *
+event_uring_get_sqe(event_base_t *base)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(base->ring);
+	if (!sqe)
+		sqe = uring_get_sqe(base->ring);
+	if (!sqe)
+		event_uring_fallback(base);
+
+	return sqe;
 }
 
-// compiling with -Wall, -Werror
-// must cast types appropriately in wrapper functions
 static void
-wrapped_remove_timer(void *elem)
+event_uring_arm(event_base_t *base, event_io_t *io)
 {
-	event_remove_timer((event_timer_t *)elem);
-	event_timer_free(elem);
+	// on failure io has been moved to epoll with all other io events
+	struct io_uring_sqe *sqe = event_uring_get_sqe(base);
+	IF_NULL_RETURN(sqe);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = io->fd;
+	sqe->poll32_events = event_uring_poll_mask(io->events);
+	sqe->user_data = io->ring_data;
 }
 
+static void
+event_uring_add_io(event_base_t *base, event_io_t *io)
+{
+	size_t slot;
+
+	if (base->ring_free_len) {
+		slot = base->ring_free[--base->ring_free_len];
+	} else {
+		if (base->ring_slots_len == base->ring_slots_size) {
+			size_t size = base->ring_slots_size ? 2 * base->ring_slots_size : 16;
+			base->ring_slots_size = size;
+			base->ring_slots =
+				mem_renew(event_io_t *, base->ring_slots, base->ring_slots_size);
+			base->ring_free = mem_renew(size_t, base->ring_free, base->ring_slots_size);
+		}
+		slot = base->ring_slots_len++;
+	}
+
+	base->ring_slots[slot] = io;
+	io->ring_data = ((uint64_t)++base->ring_gen << 32) | slot;
+	event_uring_arm(base, io);
+}
+
+static int
+event_uring_release_slot(event_base_t *base, event_io_t *io)
+{
+	size_t slot = EVENT_URING_DATA_SLOT(io->ring_data);
+
+	if (slot >= base->ring_slots_len || base->ring_slots[slot] != io)
+		return -1;
+
+	base->ring_slots[slot] = NULL;
+	base->ring_free[base->ring_free_len++] = slot;
+
+	return 0;
+}
+
+/*
+ * Returns 0 if the poll request of io is removed, 1 if the base fell back to epoll
+ * meanwhile, where io is still registered, and -1 if io is not registered.
+ */
+static int
+event_uring_remove_io(event_base_t *base, event_io_t *io)
+{
+	size_t slot = EVENT_URING_DATA_SLOT(io->ring_data);
+
+	if (!base->ring || slot >= base->ring_slots_len || base->ring_slots[slot] != io)
+		return -1;
+
+	struct io_uring_sqe *sqe = event_uring_get_sqe(base);
+	IF_NULL_RETVAL(sqe, 1);
+
+	// a completion which is already queued is dropped as stale in event_uring_wait()
+	event_uring_release_slot(base, io);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = io->ring_data;
+	sqe->user_data = EVENT_URING_DATA_INTERNAL;
+
+	return 0;
+}
+
+static int
+event_uring_wait(event_base_t *base, int timeout)
+{
+	uring_t *ring = base->ring;
+	struct io_uring_cqe cqe;
+	int n = 0;
+
+	TRACE("Calling io_uring wait with timeout=%dms", timeout);
+	int ret = uring_submit_and_wait(ring, timeout);
+	if (ret == -ETIME)
+		return 0;
+	if (ret < 0) {
+		errno = -ret;
+		if (errno == EINTR) // caused by suspend (no real error)
+			TRACE_ERRNO("io_uring wait interrupted by system");
+		else
+			DEBUG_ERRNO("io_uring wait failed");
+		return -1;
+	}
+
+	// io->func may reset the base, which replaces the ring
+	while (base->ring == ring && uring_pop_cqe(ring, &cqe)) {
+		size_t slot = EVENT_URING_DATA_SLOT(cqe.user_data);
+
+		if (slot >= base->ring_slots_len)
+			continue;
+
+		event_io_t *io = base->ring_slots[slot];
+		if (!io || io->ring_data != cqe.user_data)
+			continue;
+
+		if (cqe.res < 0) {
+			// the request failed, treat it like a failed epoll_ctl(EPOLL_CTL_ADD)
+			errno = -cqe.res;
+			WARN_ERRNO("Poll request for io event %p (fd=%d) failed", (void *)io,
+				   io->fd);
+			event_uring_release_slot(base, io);
+			io->base = NULL;
+			base->io_active--;
+			continue;
+		}
+
+		unsigned e = 0;
+		e |= (cqe.res & POLLIN) ? EVENT_IO_READ : 0;
+		e |= (cqe.res & POLLOUT) ? EVENT_IO_WRITE : 0;
+		e |= (cqe.res & (POLLERR | POLLHUP)) ? EVENT_IO_EXCEPT : 0;
+		e |= (cqe.res & POLLPRI) ? EVENT_IO_PRI : 0;
+
+		TRACE("Handling io event %p (func=%p, data=%p, fd=%d, events=0x%x)", (void *)io,
+		      CAST_FUNCPTR_VOIDPTR io->func, io->data, io->fd, io->events);
+
+		struct timespec start;
+		const void *func = CAST_FUNCPTR_VOIDPTR io->func;
+		bool stats = event_stats_begin(base, &start);
+		PROBE3(event_dispatch, "io", func, io->fd);
+
+		(io->func)(io->fd, e, io, io->data);
+		n++;
+
+		PROBE2(event_done, "io", func);
+		if (stats)
+			event_stats_end(base, func, "io", &start, NULL);
+
+		TRACE("Finished io handling");
+
+		// re-arm unless the callback removed (and maybe re-added) the io event
+		if (base->ring == ring && slot < base->ring_slots_len &&
+		    base->ring_slots[slot] == io && io->ring_data == cqe.user_data)
+			event_uring_arm(base, io);
+	}
+
+	return n;
+}
+#endif /* EVENT_IO_URING */
+
+static void
+event_reset_fd(event_base_t *base)
+{
+#ifdef EVENT_IO_URING
+	event_uring_reset(base);
+#endif
+	event_epoll_fd(base, 1);
+}
+
+// compiling with -Wall, -Werror
+// must cast types appropriately in wrapper functions
 static void
 wrapped_remove_signal(void *elem)
 {
@@ -323,10 +910,9 @@ wrapped_remove_signal(void *elem)
 }
 
 static void
-wrapped_remove_inotify(void *elem)
+wrapped_free_inotify(void *elem)
 {
-	event_inotify_list = list_unlink(event_inotify_list, elem);
-	event_inotify_free(elem);
+	event_inotify_free((event_inotify_t *)elem);
 }
 
 event_io_t *
@@ -343,6 +929,7 @@ event_io_new(int fd, unsigned events,
 	io->data = data;
 	io->fd = fd;
 	io->events = events;
+	io->base = NULL;
 
 	return io;
 }
@@ -370,45 +957,127 @@ event_add_io(event_io_t *io)
 
 	IF_NULL_RETURN(io);
 
+	event_base_t *base = event_base_get();
+
+#ifdef EVENT_IO_URING
+	if (event_uring(base)) {
+		// accounted first, as the base may fall back to epoll while arming
+		io->base = base;
+		base->io_active++;
+		event_uring_add_io(base, io);
+		goto out;
+	}
+#endif
+
 	epoll_event.events = 0;
 	epoll_event.events |= (io->events & EVENT_IO_READ) ? EPOLLIN : 0;
 	epoll_event.events |= (io->events & EVENT_IO_WRITE) ? EPOLLOUT : 0;
 	epoll_event.events |= (io->events & EVENT_IO_PRI) ? EPOLLPRI : 0;
 	epoll_event.data.ptr = io;
 
-	if (epoll_ctl(event_epoll_fd(0), EPOLL_CTL_ADD, io->fd, &epoll_event) < 0)
-		WARN_ERRNO("epoll_ctl failed"); // TODO: handle error?
-	else
-		event_io_active++;
+	if (epoll_ctl(event_epoll_fd(base, 0), EPOLL_CTL_ADD, io->fd, &epoll_event) < 0) {
+		WARN_ERRNO_RATELIMIT("epoll_ctl failed"); // TODO: handle error?
+	} else {
+		io->base = base;
+		base->io_active++;
+	}
 
+#ifdef EVENT_IO_URING
+out:
+#endif
 	TRACE("Added io event %p (func=%p, data=%p, fd=%d, events=0x%x)", (void *)io,
 	      CAST_FUNCPTR_VOIDPTR io->func, io->data, io->fd, io->events);
 }
 
+void
+event_io_set_events(event_io_t *io, unsigned events)
+{
+	struct epoll_event epoll_event;
+
+	IF_NULL_RETURN(io);
+	IF_TRUE_RETURN(io->events == events);
+
+	io->events = events;
+	IF_NULL_RETURN(io->base); // applies on the next event_add_io()
+
+#ifdef EVENT_IO_URING
+	if (io->base->ring) {
+		// a pending poll request cannot be modified, replace it by a new one
+		int ret = event_uring_remove_io(io->base, io);
+		if (ret == 0)
+			event_uring_add_io(io->base, io);
+		if (ret <= 0 || !io->base)
+			goto out;
+		// fell back to epoll, modify the io event there
+	}
+#endif
+
+	epoll_event.events = 0;
+	epoll_event.events |= (io->events & EVENT_IO_READ) ? EPOLLIN : 0;
+	epoll_event.events |= (io->events & EVENT_IO_WRITE) ? EPOLLOUT : 0;
+	epoll_event.events |= (io->events & EVENT_IO_PRI) ? EPOLLPRI : 0;
+	epoll_event.data.ptr = io;
+
+	if (epoll_ctl(event_epoll_fd(io->base, 0), EPOLL_CTL_MOD, io->fd, &epoll_event) < 0)
+		WARN_ERRNO_RATELIMIT("epoll_ctl failed");
+
+#ifdef EVENT_IO_URING
+out:
+#endif
+	TRACE("Modified io event %p (fd=%d, events=0x%x)", (void *)io, io->fd, io->events);
+}
+
 void
 event_remove_io(event_io_t *io)
 {
 	IF_NULL_RETURN(io);
 	TRACE("Removing io event %p", (void *)io);
 
-	if (epoll_ctl(event_epoll_fd(0), EPOLL_CTL_DEL, io->fd, NULL) < 0)
-		WARN_ERRNO("epoll_ctl failed"); // TODO: handle error?
-	else
-		event_io_active--;
+	event_base_t *base = io->base ? io->base : event_base_get();
+
+#ifdef EVENT_IO_URING
+	if (!base->ring_disabled) {
+		int ret = event_uring_remove_io(base, io);
+		if (ret < 0) {
+			WARN("io event %p not registered with io_uring", (void *)io);
+		} else if (ret == 0) {
+			io->base = NULL;
+			base->io_active--;
+		}
+		if (ret <= 0)
+			goto out;
+		// fell back to epoll, remove the io event there
+	}
+#endif
 
+	if (epoll_ctl(event_epoll_fd(base, 0), EPOLL_CTL_DEL, io->fd, NULL) < 0) {
+		WARN_ERRNO_RATELIMIT("epoll_ctl failed"); // TODO: handle error?
+	} else {
+		io->base = NULL;
+		base->io_active--;
+	}
+
+#ifdef EVENT_IO_URING
+out:
+#endif
 	TRACE("Removed io event %p (func=%p, data=%p, fd=%d, events=0x%x)", (void *)io,
 	      CAST_FUNCPTR_VOIDPTR io->func, io->data, io->fd, io->events);
 	//TODO unlink?
 }
 
 static int
-event_epoll(int timeout)
+event_epoll(event_base_t *base, int timeout)
 {
 	struct epoll_event epoll_events[128];
 	int n, i;
 
+#ifdef EVENT_IO_URING
+	if (event_uring(base))
+		return event_uring_wait(base, timeout);
+#endif
+
 	TRACE("Calling epoll_wait with timeout=%ums", timeout);
-	n = epoll_wait(event_epoll_fd(0), epoll_events, ELEMENTSOF(epoll_events), timeout);
+	n = epoll_wait(event_epoll_fd(base, 0), epoll_events, ELEMENTSOF(epoll_events), timeout);
 	if (n < 0) {
 		if (errno == EINTR) // caused by suspend (no real error)
 			TRACE_ERRNO("epoll_wait interrupted by system");
@@ -434,8 +1103,17 @@ event_epoll(int timeout)
 			      (void *)io, CAST_FUNCPTR_VOIDPTR io->func, io->data, io->fd,
 			      io->events);
 
+			struct timespec start;
+			const void *func = CAST_FUNCPTR_VOIDPTR io->func;
+			bool stats = event_stats_begin(base, &start);
+			PROBE3(event_dispatch, "io", func, io->fd);
+
 			(io->func)(io->fd, e, io, io->data);
 
+			PROBE2(event_done, "io", func);
+			if (stats)
+				event_stats_end(base, func, "io", &start, NULL);
+
 			TRACE("Finished io handling");
 		}
 	} // else timeout
@@ -445,10 +1123,55 @@ event_epoll(int timeout)
 
 /******************************************************************************/
 
+static list_t **
+event_inotify_bucket(const event_base_t *base, int wd)
+{
+	// watch descriptors are allocated sequentially, thus no need to hash them
+	return &base->inotify_buckets[(size_t)wd & (base->inotify_buckets_size - 1)];
+}
+
+static void
+event_inotify_index_insert(event_base_t *base, event_inotify_t *inotify)
+{
+	if (base->inotify_count >= base->inotify_buckets_size) {
+		list_t **old = base->inotify_buckets;
+		size_t old_size = base->inotify_buckets_size;
+
+		base->inotify_buckets_size = old_size ? 2 * old_size : 64;
+		base->inotify_buckets = mem_new0(list_t *, base->inotify_buckets_size);
+
+		// keeps the registration order of events sharing a watch descriptor
+		for (size_t i = 0; i < old_size; i++) {
+			for (list_t *l = old[i]; l; l = l->next) {
+				event_inotify_t *cur = l->data;
+				list_t **bucket = event_inotify_bucket(base, cur->wd);
+				*bucket = list_append(*bucket, cur);
+			}
+			list_delete(old[i]);
+		}
+		mem_free0(old);
+	}
+
+	list_t **bucket = event_inotify_bucket(base, inotify->wd);
+	*bucket = list_append(*bucket, inotify);
+	base->inotify_count++;
+}
+
 static void
-event_inotify_handler(int wd, const char *path, uint32_t mask)
+event_inotify_index_remove(event_base_t *base, event_inotify_t *inotify)
 {
-	for (list_t *l = event_inotify_list; l; l = l->next) {
+	list_t **bucket = event_inotify_bucket(base, inotify->wd);
+
+	*bucket = list_remove(*bucket, inotify);
+	base->inotify_count--;
+}
+
+static void
+event_inotify_handler(event_base_t *base, int wd, const char *path, uint32_t mask)
+{
+	IF_FALSE_RETURN(base->inotify_count);
+
+	for (list_t *l = *event_inotify_bucket(base, wd); l; l = l->next) {
 		event_inotify_t *inotify = l->data;
 
 		ASSERT(inotify);
@@ -457,7 +1180,7 @@ event_inotify_handler(int wd, const char *path, uint32_t mask)
 		inotify->todo = true;
 	}
 
-	for (list_t *l = event_inotify_list; l;) {
+	for (list_t *l = *event_inotify_bucket(base, wd); l;) {
 		event_inotify_t *inotify = l->data;
 
 		ASSERT(inotify);
@@ -471,6 +1194,11 @@ event_inotify_handler(int wd, const char *path, uint32_t mask)
 			      (void *)inotify, CAST_FUNCPTR_VOIDPTR inotify->func, inotify->data,
 			      wd, inotify->path, inotify->mask);
 
+			struct timespec start;
+			const void *func = CAST_FUNCPTR_VOIDPTR inotify->func;
+			bool stats = event_stats_begin(base, &start);
+			PROBE3(event_dispatch, "inotify", func, wd);
+
 			if (path) {
 				char *full_path = mem_printf("%s/%s", inotify->path, path);
 				(inotify->func)(full_path, mask, inotify, inotify->data);
@@ -479,10 +1207,14 @@ event_inotify_handler(int wd, const char *path, uint32_t mask)
 				(inotify->func)(inotify->path, mask, inotify, inotify->data);
 			}
 
-			// inotify->func might modify the inotify list
-			// so we will start again at its head
-			if (event_inotify_list)
-				l = event_inotify_list;
+			PROBE2(event_done, "inotify", func);
+			if (stats)
+				event_stats_end(base, func, "inotify", &start, NULL);
+
+			// inotify->func might modify the inotify index
+			// so we will start again at the head of the bucket
+			if (base->inotify_count)
+				l = *event_inotify_bucket(base, wd);
 			else
 				break;
 		} else {
@@ -492,8 +1224,10 @@ event_inotify_handler(int wd, const char *path, uint32_t mask)
 }
 
 static void
-event_inotify_cb(int fd, unsigned events, UNUSED event_io_t *io, UNUSED void *data)
+event_inotify_cb(int fd, unsigned events, UNUSED event_io_t *io, void *data)
 {
+	event_base_t *base = data;
+
 	char buf[(8 * (sizeof(struct inotify_event) + NAME_MAX + 1))] __attribute__((aligned(8)));
 	char *p;
 	ssize_t n;
@@ -507,10 +1241,23 @@ event_inotify_cb(int fd, unsigned events, UNUSED event_io_t *io, UNUSED void *da
 	if (!n)
 		return;
 
+	const struct inotify_event *prev = NULL;
 	for (p = buf; p < buf + n;) {
 		struct inotify_event *e = (struct inotify_event *)p;
 		const char *name = e->len ? e->name : NULL;
 
+		p += sizeof(struct inotify_event) + e->len;
+
+		// coalesce bursts of identical events, e.g., repeated IN_MODIFY
+		if (prev && prev->wd == e->wd && prev->mask == e->mask &&
+		    prev->cookie == e->cookie && prev->len == e->len &&
+		    !memcmp(prev->name, e->name, e->len)) {
+			TRACE("Skipping duplicate inotify event (wd=%d, mask=0x%08x)", e->wd,
+			      e->mask);
+			continue;
+		}
+		prev = e;
+
 		TRACE("Read inotify event %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s"
 		      "(wd=%d, mask=0x%08x, cookie=0x%08x, name=%s)",
 		      e->mask & IN_ACCESS ? "IN_ACCESS " : "",
@@ -529,48 +1276,45 @@ event_inotify_cb(int fd, unsigned events, UNUSED event_io_t *io, UNUSED void *da
 		      e->mask & IN_Q_OVERFLOW ? "IN_Q_OVERFLOW " : "",
 		      e->mask & IN_IGNORED ? "IN_IGNORED " : "", e->wd, e->mask, e->cookie, name);
 
-		event_inotify_handler(e->wd, name, e->mask);
-
-		p += sizeof(struct inotify_event) + e->len;
+		event_inotify_handler(base, e->wd, name, e->mask);
 	}
 }
 
 static int
-event_inotify_fd(void)
+event_inotify_fd(event_base_t *base)
 {
-	if (event_inotify_io && event_inotify_io->fd >= 0) {
-		TRACE("Using existing event_inotify_io %p (fd=%d)", (void *)event_inotify_io,
-		      event_inotify_io->fd);
-		return event_inotify_io->fd;
+	if (base->inotify_io && base->inotify_io->fd >= 0) {
+		TRACE("Using existing inotify_io %p (fd=%d)", (void *)base->inotify_io,
+		      base->inotify_io->fd);
+		return base->inotify_io->fd;
 	}
 
 	int fd = inotify_init();
 	if (fd < 0)
 		FATAL_ERRNO("Could not init inotify");
 
-	event_io_t *io = event_io_new(fd, EVENT_IO_READ, &event_inotify_cb, NULL);
+	event_io_t *io = event_io_new(fd, EVENT_IO_READ, &event_inotify_cb, base);
 
 	if (NULL == io) {
-		FATAL_ERRNO("Could not init event_inotify_io (fd=%d)", fd);
+		FATAL_ERRNO("Could not init inotify_io (fd=%d)", fd);
 	}
 
-	TRACE("Setting event_inotify_io=%p (fd=%d)", (void *)event_inotify_io,
-	      event_inotify_io->fd);
+	TRACE("Setting inotify_io=%p (fd=%d)", (void *)io, io->fd);
 
-	event_inotify_io = io;
+	base->inotify_io = io;
 
 	return fd;
 }
 
 static void
-event_inotify_reset_fd(void)
+event_inotify_reset_fd(event_base_t *base)
 {
-	IF_NULL_RETURN_TRACE(event_inotify_io);
+	IF_NULL_RETURN_TRACE(base->inotify_io);
 
-	event_remove_io(event_inotify_io);
-	close(event_inotify_io->fd);
-	event_io_free(event_inotify_io);
-	event_inotify_io = NULL;
+	event_remove_io(base->inotify_io);
+	close(base->inotify_io->fd);
+	event_io_free(base->inotify_io);
+	base->inotify_io = NULL;
 }
 
 event_inotify_t *
@@ -591,6 +1335,7 @@ event_inotify_new(const char *path, uint32_t mask,
 	inotify->mask = mask;
 	inotify->wd = -1;
 	inotify->todo = false;
+	inotify->base = NULL;
 
 	return inotify;
 }
@@ -613,23 +1358,28 @@ event_add_inotify(event_inotify_t *inotify)
 
 	IF_NULL_RETVAL(inotify, -1);
 
-	if (event_inotify_io)
-		event_remove_io(event_inotify_io);
+	event_base_t *base = event_base_get();
+
+	if (base->inotify_io)
+		event_remove_io(base->inotify_io);
 
-	if (list_contains(event_inotify_list, list_find(event_inotify_list, inotify))) {
+	if (inotify->base) {
 		ERROR("Could not add inotify event twice!");
-		return -EEXIST;
+		ret = -EEXIST;
+		goto out;
 	}
 
-	inotify->wd =
-		inotify_add_watch(event_inotify_fd(), inotify->path, inotify->mask | IN_MASK_ADD);
+	inotify->wd = inotify_add_watch(event_inotify_fd(base), inotify->path,
+					inotify->mask | IN_MASK_ADD);
 	if (inotify->wd < 0) {
 		ERROR_ERRNO("Could not add inotify watch for %s", inotify->path);
 		ret = -1;
 		goto out;
 	}
 
-	event_inotify_list = list_append(event_inotify_list, inotify);
+	inotify->base = base;
+	inotify->todo = false;
+	event_inotify_index_insert(base, inotify);
 
 	TRACE("Added inotify event %p (func=%p, data=%p, wd=%d, path=%s, mask=0x%08x)",
 	      (void *)inotify, CAST_FUNCPTR_VOIDPTR inotify->func, inotify->data, inotify->wd,
@@ -637,7 +1387,7 @@ event_add_inotify(event_inotify_t *inotify)
 
 out:
 	// needs to be (re)added to epoll after a new watch is added
-	event_add_io(event_inotify_io);
+	event_add_io(base->inotify_io);
 
 	return ret;
 }
@@ -648,30 +1398,51 @@ event_remove_inotify(event_inotify_t *inotify)
 	IF_NULL_RETURN(inotify);
 
 	TRACE("Removing inotify event %p", (void *)inotify);
-	event_inotify_list = list_remove(event_inotify_list, inotify);
 
-	/* walk through list and check if there are other handlers on the same
+	if (!inotify->base) {
+		WARN("Could not remove inotify event %p which was not added", (void *)inotify);
+		return;
+	}
+
+	event_base_t *base = inotify->base;
+	event_inotify_index_remove(base, inotify);
+	inotify->base = NULL;
+
+	/* walk through the bucket and check if there are other handlers on the same
 	 * watch descriptor */
 	bool others = false;
-	for (list_t *l = event_inotify_list; l; l = l->next) {
+	list_t *moved = NULL;
+	for (list_t *l = *event_inotify_bucket(base, inotify->wd); l; l = l->next) {
 		event_inotify_t *inotify_cur = l->data;
 		if (inotify_cur->wd == inotify->wd) {
 			if (!others)
 				/* If the handler is the first of the others it should overwrite the mask */
-				inotify_cur->wd = inotify_add_watch(
-					event_inotify_fd(), inotify_cur->path, inotify_cur->mask);
+				inotify_cur->wd = inotify_add_watch(event_inotify_fd(base),
+								    inotify_cur->path,
+								    inotify_cur->mask);
 			else
 				/* There was already another handler which reset the mask, so we add now */
 				inotify_cur->wd =
-					inotify_add_watch(event_inotify_fd(), inotify_cur->path,
+					inotify_add_watch(event_inotify_fd(base), inotify_cur->path,
 							  inotify_cur->mask | IN_MASK_ADD);
 			others = true;
+			if (inotify_cur->wd != inotify->wd)
+				moved = list_append(moved, inotify_cur);
 		}
 	}
 
+	// rehash handlers which got a new watch descriptor, e.g., if the path was replaced
+	for (list_t *l = moved; l; l = l->next) {
+		list_t **bucket = event_inotify_bucket(base, inotify->wd);
+		*bucket = list_remove(*bucket, l->data);
+		base->inotify_count--;
+		event_inotify_index_insert(base, l->data);
+	}
+	list_delete(moved);
+
 	if (!others) {
 		/* If there were no other handlers with the same watch descriptor we remove it completely */
-		if (inotify_rm_watch(event_inotify_fd(), inotify->wd) < 0) {
+		if (inotify_rm_watch(event_inotify_fd(base), inotify->wd) < 0) {
 			WARN_ERRNO("Could not remove inotify watch for %s", inotify->path);
 			return;
 		}
@@ -682,7 +1453,8 @@ event_remove_inotify(event_inotify_t *inotify)
 	      inotify->path, inotify->mask);
 
 	// if last watcher is removed also close inotify fd
-	event_inotify_reset_fd();
+	if (!base->inotify_count)
+		event_inotify_reset_fd(base);
 }
 
 /******************************************************************************/
@@ -777,8 +1549,17 @@ event_signal_handler(void)
 			      (void *)sig, CAST_FUNCPTR_VOIDPTR sig->func, sig->data, sig->signum,
 			      strsignal(sig->signum));
 
+			struct timespec start;
+			const void *func = CAST_FUNCPTR_VOIDPTR sig->func;
+			bool stats = event_stats_begin(&event_base_default, &start);
+			PROBE3(event_dispatch, "signal", func, sig->signum);
+
 			(sig->func)(sig->signum, sig, sig->data);
 
+			PROBE2(event_done, "signal", func);
+			if (stats)
+				event_stats_end(&event_base_default, func, "signal", &start, NULL);
+
 			// sig->func might modify the signal list
 			// so we will start again at its head
 			if (event_signal_list)
@@ -796,6 +1577,182 @@ event_signal_handler(void)
 
 /******************************************************************************/
 
+/*
+ * Child events are bound to a pidfd, so only the handler of the exited child
+ * is woken up. Without pidfd support, the children are kept in a list which
+ * is checked by a single internal SIGCHLD handler on the default base.
+ */
+
+static int
+event_pidfd_open(pid_t pid)
+{
+#ifdef __NR_pidfd_open
+	return syscall(__NR_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static pid_t
+event_child_waitpid(event_child_t *child, int *status)
+{
+	pid_t ret;
+
+	while ((ret = waitpid(child->pid, status, WNOHANG)) == -1 && errno == EINTR)
+		TRACE_ERRNO("waitpid interrupted for child %d, wait again", child->pid);
+
+	if (ret < 0) {
+		// somebody else reaped the child, the caller gets an invalid status
+		WARN_ERRNO("Could not reap child %d", child->pid);
+		*status = -1;
+	}
+
+	return ret;
+}
+
+static void
+event_child_dispatch(event_child_t *child, int status)
+{
+	event_base_t *base = event_base_get();
+	struct timespec start;
+	const void *func = CAST_FUNCPTR_VOIDPTR child->func;
+
+	// oneshot, child->func may free or re-add the child event
+	event_remove_child(child);
+
+	TRACE("Handling child event %p (func=%p, data=%p, pid=%d, status=0x%x)", (void *)child,
+	      func, child->data, child->pid, status);
+
+	bool stats = event_stats_begin(base, &start);
+	PROBE3(event_dispatch, "child", func, child->pid);
+
+	(child->func)(child->pid, status, child, child->data);
+
+	PROBE2(event_done, "child", func);
+	if (stats)
+		event_stats_end(base, func, "child", &start, NULL);
+}
+
+static void
+event_child_io_cb(UNUSED int fd, UNUSED unsigned events, UNUSED event_io_t *io, void *data)
+{
+	event_child_t *child = data;
+	int status = 0;
+
+	ASSERT(child);
+
+	// pidfd is readable once the process terminated
+	if (!event_child_waitpid(child, &status))
+		return;
+
+	event_child_dispatch(child, status);
+}
+
+static void
+event_child_sigchld_cb(UNUSED int signum, UNUSED event_signal_t *sig, UNUSED void *data)
+{
+	for (list_t *l = event_child_list; l;) {
+		event_child_t *child = l->data;
+		int status = 0;
+
+		ASSERT(child);
+
+		if (!event_child_waitpid(child, &status)) {
+			l = l->next;
+			continue;
+		}
+
+		event_child_dispatch(child, status);
+
+		// child->func might modify the child list
+		// so we will start again at its head
+		l = event_child_list;
+	}
+}
+
+event_child_t *
+event_child_new(pid_t pid, void (*func)(pid_t pid, int status, event_child_t *child, void *data),
+		void *data)
+{
+	event_child_t *child;
+
+	IF_NULL_RETVAL(func, NULL);
+	IF_FALSE_RETVAL(pid > 0, NULL);
+
+	child = mem_new0(event_child_t, 1);
+	child->func = func;
+	child->data = data;
+	child->pid = pid;
+	child->io = NULL;
+	child->active = false;
+
+	return child;
+}
+
+void
+event_child_free(event_child_t *child)
+{
+	IF_NULL_RETURN(child);
+
+	if (child->active)
+		event_remove_child(child);
+
+	mem_free0(child);
+}
+
+void
+event_add_child(event_child_t *child)
+{
+	IF_NULL_RETURN(child);
+	IF_TRUE_RETURN_WARN(child->active);
+
+	int fd = event_pidfd_open(child->pid);
+	if (fd >= 0) {
+		child->io = event_io_new(fd, EVENT_IO_READ, event_child_io_cb, child);
+		event_add_io(child->io);
+	} else {
+		TRACE_ERRNO("No pidfd for child %d, falling back to SIGCHLD", child->pid);
+		event_child_list = list_append(event_child_list, child);
+		if (!event_child_sig) {
+			event_child_sig = event_signal_new(SIGCHLD, event_child_sigchld_cb, NULL);
+			event_add_signal(event_child_sig);
+		}
+	}
+	child->active = true;
+
+	TRACE("Added child event %p (func=%p, data=%p, pid=%d, pidfd=%d)", (void *)child,
+	      CAST_FUNCPTR_VOIDPTR child->func, child->data, child->pid, fd);
+}
+
+void
+event_remove_child(event_child_t *child)
+{
+	IF_NULL_RETURN(child);
+	IF_FALSE_RETURN_TRACE(child->active);
+
+	if (child->io) {
+		event_remove_io(child->io);
+		close(child->io->fd);
+		event_io_free(child->io);
+		child->io = NULL;
+	} else {
+		event_child_list = list_remove(event_child_list, child);
+		// do not keep the event loop alive for an unused SIGCHLD handler
+		if (!event_child_list && event_child_sig) {
+			event_remove_signal(event_child_sig);
+			event_signal_free(event_child_sig);
+			event_child_sig = NULL;
+		}
+	}
+	child->active = false;
+
+	TRACE("Removed child event %p (func=%p, data=%p, pid=%d)", (void *)child,
+	      CAST_FUNCPTR_VOIDPTR child->func, child->data, child->pid);
+}
+
+/******************************************************************************/
+
 static void
 event_sigaction(int signum, const struct sigaction *act, struct sigaction *oldact)
 {
@@ -843,16 +1800,21 @@ event_loop(void)
 		WARN("Called event_loop() without prior initialization through event_init(). Signals might have been lost!.");
 		event_init();
 	}
-	DEBUG("Starting event loop");
 
-	while (event_signal_list || event_timer_list || event_io_active) {
+	event_base_t *base = event_base_get();
+	bool signals = (base == &event_base_default);
+
+	DEBUG("Starting event loop (base=%p)", (void *)base);
+
+	while ((signals && event_signal_list) || base->timer_heap_len || base->io_active) {
 		int timeout;
 
-		event_signal_handler();
+		if (signals)
+			event_signal_handler();
 
-		timeout = event_timeout();
-		if (!event_epoll(timeout))
-			event_timeout_handler();
+		timeout = event_timeout(base);
+		if (!event_epoll(base, timeout))
+			event_timeout_handler(base);
 
 		TRACE("Handled event");
 	}
@@ -874,22 +1836,36 @@ event_reset()
 	// TRACE("Resetting event inotify fd");
 	// event_inotify_reset_fd();
 
+	event_base_t *base = event_base_get();
+
 	TRACE("Resetting event epoll fd");
-	event_reset_fd();
+	event_reset_fd(base);
 
-	if (event_timer_list) {
+	if (base->timer_heap_len) {
 		TRACE("Resetting event timers");
-		list_foreach(event_timer_list, wrapped_remove_timer);
-		event_timer_list = NULL;
+		while (base->timer_heap_len) {
+			event_timer_t *timer = base->timer_heap[base->timer_heap_len - 1];
+			event_remove_timer(timer);
+			event_timer_free(timer);
+		}
 	}
-	if (event_signal_list) {
+	if (event_signal_list && base == &event_base_default) {
 		TRACE("Resetting event signal handler list");
 		list_foreach(event_signal_list, wrapped_remove_signal);
 		event_signal_list = NULL;
+		// event_child_sig was freed along with the other signal events
+		event_child_sig = NULL;
+		list_delete(event_child_list);
+		event_child_list = NULL;
 	}
-	if (event_inotify_list) {
-		TRACE("Resetting event inotify list");
-		list_foreach(event_inotify_list, wrapped_remove_inotify);
-		event_inotify_list = NULL;
+	if (base->inotify_buckets) {
+		TRACE("Resetting event inotify index");
+		for (size_t i = 0; i < base->inotify_buckets_size; i++) {
+			list_foreach(base->inotify_buckets[i], wrapped_free_inotify);
+			list_delete(base->inotify_buckets[i]);
+		}
+		mem_free0(base->inotify_buckets);
+		base->inotify_buckets_size = 0;
+		base->inotify_count = 0;
 	}
 }
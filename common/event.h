@@ -31,12 +31,60 @@
  * registered callback functions for I/O and signal events will be invoked whenever
  * one of the monitored events or signals occur, respectively. Both I/O and signal
  * events will be active until they get explicitly removed.
+ *
+ * All events are registered with the event base (loop) of the calling thread.
+ * Threads which do not bind an own base by event_base_set_current() share the
+ * process wide default base, which is also the only base that handles signals.
+ *
+ * If built with EVENT_IO_URING (WITH_IO_URING=y), I/O events are polled through
+ * io_uring, falling back to epoll at runtime if the kernel does not support it.
  */
 
 #ifndef EVENT_H
 #define EVENT_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct event_base event_base_t;
+
+/**
+ * Creates a new, empty event base which may be driven by event_loop()
+ * from a thread other than the main thread.
+ *
+ * @return The newly created event base.
+ */
+event_base_t *
+event_base_new(void);
+
+/**
+ * Frees an event base created by event_base_new(). All events should
+ * have been removed from the base before. The default base cannot be freed.
+ *
+ * @param base The event base to be freed.
+ */
+void
+event_base_free(event_base_t *base);
+
+/**
+ * Binds the event base to the calling thread. Afterwards, all events added
+ * by this thread are registered with this base and event_loop() runs it.
+ *
+ * @param base The event base to be used by the calling thread or NULL for
+ *             the default base.
+ */
+void
+event_base_set_current(event_base_t *base);
+
+/**
+ * Returns the event base bound to the calling thread.
+ *
+ * @return The current event base of the calling thread.
+ */
+event_base_t *
+event_base_get_current(void);
 
 typedef struct event_timer event_timer_t;
 
@@ -125,6 +173,17 @@ event_io_get_fd(const event_io_t *io);
 void
 event_add_io(event_io_t *io);
 
+/**
+ * Changes the events monitored by the I/O event. If the I/O event is already
+ * added to the event loop, the change takes effect immediately. This may also be
+ * called from within the callback of the I/O event.
+ *
+ * @param io The I/O event to be modified.
+ * @param events Bitwise-or'd events to be monitored on the fd.
+ */
+void
+event_io_set_events(event_io_t *io, unsigned events);
+
 /**
  * Removes the I/O event from the event loop.
  *
@@ -197,6 +256,48 @@ event_add_signal(event_signal_t *sig);
 void
 event_remove_signal(event_signal_t *sig);
 
+typedef struct event_child event_child_t;
+
+/**
+ * Creates a new child event which reaps the given child process once it
+ * terminated and then invokes the callback with the status as returned by
+ * waitpid(). The status is -1 if the child was already reaped by someone else.
+ * Child events are oneshot, they are removed before the callback is invoked.
+ *
+ * @param pid The pid of a child process of the caller.
+ * @param func A pointer to the callback function.
+ * @param data Payload data to be passed to the callback function.
+ * @return The newly created child event.
+ */
+event_child_t *
+event_child_new(pid_t pid, void (*func)(pid_t pid, int status, event_child_t *child, void *data),
+		void *data);
+
+/**
+ * Frees the allocated memory of the child event, removing it if still added.
+ *
+ * @param child The child event to be freed.
+ */
+void
+event_child_free(event_child_t *child);
+
+/**
+ * Adds the child event to the event loop. The child is watched through a pidfd
+ * if supported by the kernel, otherwise by a SIGCHLD handler on the default base.
+ *
+ * @param child The child event to be added to the event loop.
+ */
+void
+event_add_child(event_child_t *child);
+
+/**
+ * Removes the child event from the event loop. The child will not be reaped.
+ *
+ * @param child The child event to be removed from the event loop.
+ */
+void
+event_remove_child(event_child_t *child);
+
 /**
  * Initializes the event loop. Should be called before event_add_signal() is used;
  * otherwise, signals that occur before event_loop() is started might be lost and
@@ -206,9 +307,50 @@ void
 event_init(void);
 
 /**
- * Invokes the event loop that handles all registered timer, I/O, and signal
- * events. The function returns if there are no more registered timer, I/O, and
- * signal events.
+ * Accounting record of one callback function, see event_stats_enable().
+ * All times are given in nanoseconds.
+ */
+typedef struct event_stats {
+	const void *func;    /**< address of the callback function */
+	const char *type;    /**< "timer", "io", "inotify", "signal" or "child" */
+	uint64_t count;	     /**< number of invocations */
+	uint64_t time_total; /**< cumulative run time */
+	uint64_t time_max;   /**< longest run time of a single invocation */
+	uint64_t lag_total;  /**< timers only: cumulative delay of expiries */
+	uint64_t lag_max;    /**< timers only: longest delay of an expiry */
+} event_stats_t;
+
+/**
+ * Enables or disables the accounting of callback invocations of the calling
+ * thread's event base. Enabling the accounting resets all counters.
+ *
+ * @param enable true to start accounting, false to stop it.
+ */
+void
+event_stats_enable(bool enable);
+
+/**
+ * Checks if the accounting of callback invocations is enabled.
+ *
+ * @return true if the accounting is enabled for the calling thread's event base.
+ */
+bool
+event_stats_is_enabled(void);
+
+/**
+ * Returns a snapshot of the accounting records of the calling thread's event
+ * base, one record per callback function.
+ *
+ * @param len Pointer to store the number of records to.
+ * @return Array of records which has to be freed by the caller or NULL if empty.
+ */
+event_stats_t *
+event_stats_get(size_t *len);
+
+/**
+ * Invokes the event loop of the calling thread's event base that handles all
+ * registered timer, I/O, and signal events. The function returns if there are
+ * no more registered timer, I/O, and signal events.
  */
 void
 event_loop(void);
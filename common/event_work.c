@@ -0,0 +1,191 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+//#define LOGF_LOG_MIN_PRIO LOGF_PRIO_TRACE
+
+#include "event_work.h"
+
+#include "event.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+typedef struct event_work event_work_t;
+
+struct event_work {
+	int (*func)(void *data);		/**< the blocking function run by a worker */
+	void (*done_cb)(int ret, void *data);	/**< completion callback run by the event loop */
+	void *data;				/**< payload passed to func and done_cb */
+	int ret;				/**< return value of func */
+	int efd;				/**< eventfd signaling completion to the event loop */
+	event_io_t *io;				/**< io event watching efd in the originating loop */
+	event_work_t *next;			/**< next element in the work queue */
+};
+
+static pthread_mutex_t event_work_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_work_cond = PTHREAD_COND_INITIALIZER;
+static event_work_t *event_work_queue_head = NULL;
+static event_work_t *event_work_queue_tail = NULL;
+static unsigned event_work_threads = 0;
+static unsigned event_work_idle = 0;
+
+static void *
+event_work_thread(UNUSED void *arg)
+{
+	for (;;) {
+		event_work_t *work;
+
+		pthread_mutex_lock(&event_work_mutex);
+		event_work_idle++;
+		while (!event_work_queue_head)
+			pthread_cond_wait(&event_work_cond, &event_work_mutex);
+		event_work_idle--;
+
+		work = event_work_queue_head;
+		event_work_queue_head = work->next;
+		if (!event_work_queue_head)
+			event_work_queue_tail = NULL;
+		pthread_mutex_unlock(&event_work_mutex);
+
+		work->ret = work->func(work->data);
+
+		// wake up the originating event loop
+		while (eventfd_write(work->efd, 1) < 0 && errno == EINTR)
+			;
+	}
+
+	return NULL;
+}
+
+/*
+ * Spawns another worker if all existing ones are busy and the pool limit is
+ * not reached yet. Must be called with event_work_mutex held.
+ */
+static void
+event_work_spawn_thread(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all, old;
+
+	if (event_work_idle > 0 || event_work_threads >= EVENT_WORK_THREADS_MAX)
+		return;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (event_work_threads > 0 && cpus > 0 && event_work_threads >= (unsigned)cpus)
+		return;
+
+	// signals must still be delivered to the event loop's thread
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, event_work_thread, NULL) == 0)
+		event_work_threads++;
+	else
+		WARN("Could not spawn event worker thread");
+	pthread_attr_destroy(&attr);
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	TRACE("Event worker pool has %u threads", event_work_threads);
+}
+
+static void
+event_work_done_cb(int fd, unsigned events, event_io_t *io, void *data)
+{
+	event_work_t *work = data;
+	eventfd_t val;
+
+	IF_FALSE_RETURN(events & EVENT_IO_READ);
+
+	if (eventfd_read(fd, &val) < 0) {
+		TRACE_ERRNO("eventfd_read failed");
+		return;
+	}
+
+	event_remove_io(io);
+	event_io_free(io);
+	close(work->efd);
+
+	if (work->done_cb)
+		work->done_cb(work->ret, work->data);
+
+	mem_free0(work);
+}
+
+int
+event_submit_work(int (*func)(void *data), void (*done_cb)(int ret, void *data), void *data)
+{
+	IF_NULL_RETVAL(func, -1);
+
+	event_work_t *work = mem_new0(event_work_t, 1);
+	work->func = func;
+	work->done_cb = done_cb;
+	work->data = data;
+
+	work->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (work->efd < 0) {
+		ERROR_ERRNO("Could not create eventfd for work item");
+		mem_free0(work);
+		return -1;
+	}
+
+	work->io = event_io_new(work->efd, EVENT_IO_READ, event_work_done_cb, work);
+	event_add_io(work->io);
+
+	pthread_mutex_lock(&event_work_mutex);
+	if (event_work_queue_tail)
+		event_work_queue_tail->next = work;
+	else
+		event_work_queue_head = work;
+	event_work_queue_tail = work;
+
+	event_work_spawn_thread();
+	if (!event_work_threads) {
+		// no worker available, unqueue again
+		event_work_queue_head = event_work_queue_tail = NULL;
+		pthread_mutex_unlock(&event_work_mutex);
+		ERROR("No event worker thread available");
+		event_remove_io(work->io);
+		event_io_free(work->io);
+		close(work->efd);
+		mem_free0(work);
+		return -1;
+	}
+	pthread_cond_signal(&event_work_cond);
+	pthread_mutex_unlock(&event_work_mutex);
+
+	TRACE("Submitted work %p (func=%p, data=%p)", (void *)work, CAST_FUNCPTR_VOIDPTR func,
+	      data);
+
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/**
+ * @file event_work.h
+ *
+ * Offloads blocking work, e.g. hashing of large images, to a small pool of
+ * worker threads. The completion callback is invoked from the event loop of
+ * the thread which submitted the work, thus it may safely use the common
+ * event and logging functions.
+ *
+ * The work function itself runs on a worker thread. It must not touch any
+ * event loop state, logging is serialized and thus may be used.
+ * Users of this module have to link with -pthread.
+ */
+
+#ifndef EVENT_WORK_H
+#define EVENT_WORK_H
+
+/**
+ * Maximum number of worker threads spawned by the pool.
+ */
+#define EVENT_WORK_THREADS_MAX 4
+
+/**
+ * Runs func(data) on a worker thread and afterwards calls done_cb(ret, data)
+ * from the event loop of the calling thread, where ret is the return value of func.
+ * The worker threads are started lazily on first use.
+ *
+ * @param func The blocking function to be run on a worker thread.
+ * @param done_cb The completion callback invoked on the originating event loop; may be NULL.
+ * @param data Payload data passed to both func and done_cb.
+ * @return 0 if the work was queued successfully, -1 otherwise.
+ */
+int
+event_submit_work(int (*func)(void *data), void (*done_cb)(int ret, void *data), void *data);
+
+#endif /* EVENT_WORK_H */
@@ -21,15 +21,52 @@
  * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
  */
 
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 #include "mem.h"
 #include "macro.h"
+#include "dir.h"
 #include "fd.h"
 
+#ifndef CLOSE_RANGE_UNSHARE
+#define CLOSE_RANGE_UNSHARE (1U << 1)
+#endif
+
+// clang-format off
+#ifndef __NR_close_range
+	#if defined _MIPS_SIM
+		#if _MIPS_SIM == _MIPS_SIM_ABI32        /* o32 */
+			#define __NR_close_range (436 + 4000)
+		#endif
+		#if _MIPS_SIM == _MIPS_SIM_NABI32       /* n32 */
+			#define __NR_close_range (436 + 6000)
+		#endif
+		#if _MIPS_SIM == _MIPS_SIM_ABI64        /* n64 */
+			#define __NR_close_range (436 + 5000)
+		#endif
+	#elif defined __ia64__
+		#define __NR_close_range (436 + 1024)
+	#else
+		#define __NR_close_range 436
+	#endif
+#endif
+// clang-format on
+
+typedef struct {
+	int dirfd;
+	int min_fd;
+	const int *keep;
+	size_t keep_len;
+} fd_close_all_t;
+
 int
 fd_write(int fd, const char *buf, size_t len)
 {
@@ -174,3 +211,122 @@ fd_is_closed(int fd)
 	errno = 0;
 	return fcntl(fd, F_GETFD) == -1 && errno == EBADF;
 }
+
+static int
+fd_close_all_cmp(const void *a, const void *b)
+{
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+
+static bool
+fd_close_all_is_kept(const fd_close_all_t *ctx, int fd)
+{
+	for (size_t i = 0; i < ctx->keep_len; i++) {
+		if (ctx->keep[i] == fd)
+			return true;
+	}
+	return false;
+}
+
+static int
+fd_close_all_cb(int dirfd, const char *file, UNUSED unsigned char type, void *data)
+{
+	fd_close_all_t *ctx = data;
+	int fd = atoi(file);
+
+	// keep the fds of the directory which is currently read
+	if (fd < ctx->min_fd || fd == dirfd || fd == ctx->dirfd || fd_close_all_is_kept(ctx, fd))
+		return 0;
+
+	close(fd);
+	return 0;
+}
+
+static int
+fd_close_all_procfs(int min_fd, const int *keep, size_t keep_len)
+{
+	int fd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		WARN_ERRNO("Could not open /proc/self/fd directory, /proc not mounted?");
+		return -1;
+	}
+
+	fd_close_all_t ctx = { .dirfd = fd, .min_fd = min_fd, .keep = keep, .keep_len = keep_len };
+	int ret = dir_foreach_at(fd, &fd_close_all_cb, &ctx);
+	close(fd);
+
+	return ret < 0 ? -1 : 0;
+}
+
+int
+fd_close_all(int min_fd, const int *keep, size_t keep_len)
+{
+	ASSERT(min_fd >= 0);
+	ASSERT(keep || !keep_len);
+
+	int *sorted = NULL;
+	if (keep_len) {
+		sorted = mem_new(int, keep_len);
+		memcpy(sorted, keep, keep_len * sizeof(int));
+		qsort(sorted, keep_len, sizeof(int), &fd_close_all_cmp);
+	}
+
+	// close the gaps between the fds to be kept
+	unsigned int first = min_fd;
+	int ret = 0;
+	for (size_t i = 0; i <= keep_len; i++) {
+		unsigned int last = ~0U;
+		if (i < keep_len) {
+			if (sorted[i] < (int)first)
+				continue;
+			if (sorted[i] == (int)first) {
+				first++;
+				continue;
+			}
+			last = sorted[i] - 1;
+		}
+
+		if (syscall(__NR_close_range, first, last, CLOSE_RANGE_UNSHARE) < 0) {
+			if (errno == ENOSYS || errno == EINVAL) {
+				TRACE("close_range() not supported, falling back to /proc/self/fd");
+				ret = fd_close_all_procfs(min_fd, keep, keep_len);
+			} else {
+				WARN_ERRNO("close_range(%u, %u) failed", first, last);
+				ret = -1;
+			}
+			break;
+		}
+		if (i < keep_len)
+			first = sorted[i] + 1;
+	}
+
+	mem_free0(sorted);
+	return ret;
+}
+
+int
+fd_memfd_sealed_new(const char *name, const void *buf, size_t len)
+{
+	ASSERT(name);
+	ASSERT(buf || !len);
+
+	int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	IF_TRUE_RETVAL_ERROR_ERRNO(fd < 0, -1);
+
+	if (fd_write(fd, (const char *)buf, len) != (int)len) {
+		ERROR_ERRNO("Failed to write %zu bytes to memfd %s", len, name);
+		goto err;
+	}
+
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+		ERROR_ERRNO("Failed to seal memfd %s", name);
+		goto err;
+	}
+
+	return fd;
+err:
+	close(fd);
+	return -1;
+}
@@ -88,4 +88,31 @@ fd_make_non_blocking(int fd);
 int
 fd_is_closed(int fd);
 
+/**
+ * Closes all file descriptors starting from min_fd except the ones given in keep,
+ * e.g., in a child before exec. The fd table is unshared first if it is shared with
+ * another process. Uses close_range() and, on kernels without it, falls back to
+ * closing the fds listed in /proc/self/fd.
+ *
+ * @param min_fd the lowest fd to be closed
+ * @param keep array of fds which must survive; may be NULL if keep_len is 0
+ * @param keep_len number of fds in keep
+ * @return 0 on success, -1 on error
+ */
+int
+fd_close_all(int min_fd, const int *keep, size_t keep_len);
+
+/**
+ * Creates an anonymous memory file holding a copy of the given buffer and seals it,
+ * so neither its size nor its contents can be changed afterwards. The fd can be
+ * passed to another process which maps it instead of receiving a copy of the buffer.
+ *
+ * @param name the name of the memfd, only used for debugging
+ * @param buf pointer to the buffer; may be NULL if len is 0
+ * @param len length of the buffer
+ * @return the close-on-exec fd of the memfd on success, -1 on error
+ */
+int
+fd_memfd_sealed_new(const char *name, const void *buf, size_t len);
+
 #endif // FD_H
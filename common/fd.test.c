@@ -0,0 +1,172 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "munit.h"
+
+#include "fd.h"
+#include "logf.h"
+#include "macro.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_FD_BASE 100
+#define TEST_FD_COUNT 8
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+	return NULL;
+}
+
+/*
+ * Opens TEST_FD_COUNT fds starting at TEST_FD_BASE and closes them with fd_close_all in a
+ * child, so that the fds of the test runner are not affected. Returns the exit status of
+ * the child, which is the number of fds in the wrong state.
+ */
+static int
+run_close_all(int min_fd, const int *keep, size_t keep_len)
+{
+	pid_t pid = fork();
+	munit_assert_int(pid, >=, 0);
+
+	if (pid == 0) {
+		int failed = 0;
+		for (int i = 0; i < TEST_FD_COUNT; i++) {
+			if (dup2(STDERR_FILENO, TEST_FD_BASE + i) < 0)
+				_exit(127);
+		}
+		if (fd_close_all(min_fd, keep, keep_len) < 0)
+			_exit(126);
+
+		for (int fd = TEST_FD_BASE; fd < TEST_FD_BASE + TEST_FD_COUNT; fd++) {
+			bool kept = fd < min_fd;
+			for (size_t i = 0; i < keep_len; i++)
+				kept |= keep[i] == fd;
+			if (kept == (bool)fd_is_closed(fd))
+				failed++;
+		}
+		// fds below min_fd are untouched
+		if (fd_is_closed(STDERR_FILENO))
+			failed++;
+		_exit(failed);
+	}
+
+	int status;
+	munit_assert_int(waitpid(pid, &status, 0), ==, pid);
+	munit_assert_true(WIFEXITED(status));
+	return WEXITSTATUS(status);
+}
+
+static MunitResult
+test_close_all(UNUSED const MunitParameter params[], UNUSED void *fixture)
+{
+	munit_assert_int(run_close_all(TEST_FD_BASE, NULL, 0), ==, 0);
+	munit_assert_int(run_close_all(TEST_FD_BASE + 3, NULL, 0), ==, 0);
+
+	// unsorted, duplicate and out of range fds to be kept
+	const int keep[] = { TEST_FD_BASE + 5, TEST_FD_BASE, TEST_FD_BASE + 2, TEST_FD_BASE + 2,
+			     TEST_FD_BASE + TEST_FD_COUNT - 1, 3 };
+	munit_assert_int(run_close_all(TEST_FD_BASE, keep, sizeof(keep) / sizeof(keep[0])), ==,
+			 0);
+
+	// consecutive fds to be kept at the start of the range
+	const int keep_first[] = { TEST_FD_BASE + 1, TEST_FD_BASE };
+	munit_assert_int(run_close_all(TEST_FD_BASE, keep_first, 2), ==, 0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_memfd_sealed_new(UNUSED const MunitParameter params[], UNUSED void *fixture)
+{
+	const char data[] = "sealed test data";
+
+	int fd = fd_memfd_sealed_new("test", data, sizeof(data));
+	munit_assert_int(fd, >=, 0);
+	munit_assert_int(fcntl(fd, F_GETFD) & FD_CLOEXEC, ==, FD_CLOEXEC);
+
+	struct stat st;
+	munit_assert_int(fstat(fd, &st), ==, 0);
+	munit_assert_int(st.st_size, ==, sizeof(data));
+
+	void *map = mmap(NULL, sizeof(data), PROT_READ, MAP_SHARED, fd, 0);
+	munit_assert_ptr_not_equal(map, MAP_FAILED);
+	munit_assert_memory_equal(sizeof(data), map, data);
+	munit_assert_int(munmap(map, sizeof(data)), ==, 0);
+
+	// neither contents nor size can be changed
+	munit_assert_int(pwrite(fd, "x", 1, 0), ==, -1);
+	munit_assert_int(ftruncate(fd, 0), ==, -1);
+	munit_assert_int(ftruncate(fd, 2 * sizeof(data)), ==, -1);
+	munit_assert_ptr_equal(mmap(NULL, sizeof(data), PROT_WRITE, MAP_SHARED, fd, 0),
+			       MAP_FAILED);
+	close(fd);
+
+	// empty buffers are sealed as well
+	fd = fd_memfd_sealed_new("test-empty", NULL, 0);
+	munit_assert_int(fd, >=, 0);
+	munit_assert_int(fstat(fd, &st), ==, 0);
+	munit_assert_int(st.st_size, ==, 0);
+	munit_assert_int(ftruncate(fd, 1), ==, -1);
+	close(fd);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/close_all",		/* name */
+		test_close_all,		/* test */
+		setup,			/* setup */
+		NULL,			/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/memfd_sealed_new",	/* name */
+		test_memfd_sealed_new,	/* test */
+		setup,			/* setup */
+		NULL,			/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite fd_suite = {
+	"/fd",			/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
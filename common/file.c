@@ -36,8 +36,35 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
 #include <fcntl.h>
 #include <alloca.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef EVENT_IO_URING
+#include "uring.h"
+#endif
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+/* Buffer size for the read/write fallback of file_copy() */
+#define FILE_COPY_BUF_SIZE (1024 * 1024)
+/* Maximum number of bytes handed to the kernel with one copy call */
+#define FILE_COPY_CHUNK_SIZE (64 * 1024 * 1024)
+/* Size of each of the two buffers of file_copy_direct() */
+#define FILE_COPY_DIRECT_BUF_SIZE (4 * 1024 * 1024)
+/* Alignment of buffers, offsets and lengths for O_DIRECT */
+#define FILE_DIRECT_IO_ALIGN 4096
+#define FILE_DIRECT_IO_ROUND_UP(n)                                                                \
+	(((n) + FILE_DIRECT_IO_ALIGN - 1) & ~(off_t)(FILE_DIRECT_IO_ALIGN - 1))
 
 /******************************************************************************/
 
@@ -123,12 +150,82 @@ file_is_fifo(const char *file)
 	return !lstat(file, &s) && S_ISFIFO(s.st_mode);
 }
 
+/*
+ * Copy methods in the order they are tried. A method is dropped for the rest of
+ * a copy operation as soon as the kernel or the file system does not support it.
+ */
+enum file_copy_method {
+	FILE_COPY_METHOD_RANGE,
+	FILE_COPY_METHOD_SENDFILE,
+	FILE_COPY_METHOD_BUFFER,
+};
+
+/*
+ * Copies up to len bytes from in_fd at in_off to out_fd at out_off using the
+ * given method or the next slower one if it is not supported. The buffer for the
+ * read/write fallback is allocated on first use.
+ * Returns the number of bytes copied, 0 at end of input, or -1 on error.
+ */
+static ssize_t
+file_copy_chunk(int in_fd, off_t in_off, int out_fd, off_t out_off, size_t len,
+		enum file_copy_method *method, unsigned char **buf)
+{
+	ssize_t n;
+
+	if (*method == FILE_COPY_METHOD_RANGE) {
+#ifdef __NR_copy_file_range
+		loff_t in_loff = in_off, out_loff = out_off;
+		n = syscall(__NR_copy_file_range, in_fd, &in_loff, out_fd, &out_loff, len, 0);
+		// special files (e.g. in procfs) may report 0 bytes although there is data
+		if (n > 0)
+			return n;
+		if (n < 0 && errno != EXDEV && errno != EINVAL && errno != ENOSYS &&
+		    errno != EOPNOTSUPP && errno != EBADF)
+			return -1;
+		TRACE("copy_file_range not usable, falling back to sendfile");
+#endif
+		*method = FILE_COPY_METHOD_SENDFILE;
+	}
+
+	if (*method == FILE_COPY_METHOD_SENDFILE) {
+		if (lseek(out_fd, out_off, SEEK_SET) < 0)
+			return -1;
+		n = sendfile(out_fd, in_fd, &in_off, len);
+		if (n >= 0)
+			return n;
+		if (errno != EINVAL && errno != ENOSYS)
+			return -1;
+		TRACE("sendfile not usable, falling back to read/write");
+		*method = FILE_COPY_METHOD_BUFFER;
+	}
+
+	if (!*buf)
+		*buf = mem_alloc(FILE_COPY_BUF_SIZE);
+
+	do {
+		n = pread(in_fd, *buf, MIN(len, (size_t)FILE_COPY_BUF_SIZE), in_off);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return n;
+
+	for (ssize_t done = 0; done < n;) {
+		ssize_t w = pwrite(out_fd, *buf + done, n - done, out_off + done);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w < 0)
+			return -1;
+		done += w;
+	}
+
+	return n;
+}
+
 int
 file_copy(const char *in_file, const char *out_file, ssize_t count, size_t bs, off_t seek)
 {
 	int in_fd, out_fd, ret = 0;
-	ssize_t i;
-	unsigned char *buf;
+	struct stat in_st, out_st;
+	unsigned char *buf = NULL;
 
 	IF_NULL_RETVAL(in_file, -1);
 	IF_NULL_RETVAL(out_file, -1);
@@ -147,36 +244,76 @@ file_copy(const char *in_file, const char *out_file, ssize_t count, size_t bs, o
 		return -1;
 	}
 
-	buf = mem_alloc0(bs);
-
-	ret = lseek(out_fd, seek * bs, SEEK_SET);
-	if (ret < 0) {
-		DEBUG_ERRNO("Could not lseek in output file %s", out_file);
+	if (fstat(in_fd, &in_st) < 0 || fstat(out_fd, &out_st) < 0) {
+		DEBUG_ERRNO("Could not stat %s or %s", in_file, out_file);
+		ret = -1;
 		goto out;
 	}
 
-	for (i = 0; i != count; i++) {
-		ssize_t len;
+	// files in procfs or sysfs are regular but report a size of 0
+	bool sized = S_ISREG(in_st.st_mode) && in_st.st_size > 0;
+	bool regular = sized && S_ISREG(out_st.st_mode);
+	off_t out_start = MUL_WITH_OVERFLOW_CHECK(seek, (off_t)bs);
+
+	/*
+	 * Number of input bytes to copy, -1 if unknown, e.g., for block devices,
+	 * which are then copied until end of file.
+	 */
+	off_t end = count < 0 ? -1 : (off_t)MUL_WITH_OVERFLOW_CHECK((size_t)count, bs);
+	if (sized && (end < 0 || end > in_st.st_size))
+		end = in_st.st_size;
+
+	// share the data extents if the file system supports it (btrfs, xfs)
+	if (regular && count < 0 && seek == 0 && ioctl(out_fd, FICLONE, in_fd) == 0) {
+		TRACE("Cloned %s to %s", in_file, out_file);
+		goto out;
+	}
 
-		len = read(in_fd, buf, bs);
+	enum file_copy_method method =
+		regular ? FILE_COPY_METHOD_RANGE : FILE_COPY_METHOD_SENDFILE;
+	off_t pos = 0;
+
+	for (unsigned i = 0; end < 0 || pos < end; i++) {
+		off_t data_end = end;
+
+		// skip holes of sparse images; block devices must be written completely
+		if (regular) {
+			off_t data = lseek(in_fd, pos, SEEK_DATA);
+			if (data < 0 && errno == ENXIO)
+				break;
+			if (data >= 0) {
+				off_t hole = lseek(in_fd, data, SEEK_HOLE);
+				pos = data;
+				if (hole >= 0 && hole < end)
+					data_end = hole;
+			}
+			if (pos >= end)
+				break;
+		}
 
-		if (0 == (i % 1024))
-			TRACE("Copied %zd bytes from %s to %s", MUL_WITH_OVERFLOW_CHECK(bs, i),
-			      in_file, out_file);
+		size_t len = FILE_COPY_CHUNK_SIZE;
+		if (data_end >= 0)
+			len = MIN(len, (size_t)(data_end - pos));
 
-		if (len == 0) {
-			goto out;
-		} else if (len < 0) {
-			DEBUG_ERRNO("Could not read from input file %s", in_file);
+		ssize_t n =
+			file_copy_chunk(in_fd, pos, out_fd, out_start + pos, len, &method, &buf);
+		if (n < 0) {
+			DEBUG_ERRNO("Could not copy %s to %s", in_file, out_file);
 			ret = -1;
 			goto out;
-		} else /* if (len > 0) */ {
-			if (write(out_fd, buf, len) < 0) {
-				DEBUG_ERRNO("Could not write to output file %s", out_file);
-				ret = -1;
-				goto out;
-			}
 		}
+		if (n == 0)
+			break;
+		pos += n;
+
+		if (0 == (i % 64))
+			TRACE("Copied %jd bytes from %s to %s", (intmax_t)pos, in_file, out_file);
+	}
+
+	// a trailing hole has not been written, extend the output to its full size
+	if (regular && ftruncate(out_fd, out_start + end) < 0) {
+		DEBUG_ERRNO("Could not truncate output file %s", out_file);
+		ret = -1;
 	}
 
 out:
@@ -187,6 +324,193 @@ out:
 	return ret;
 }
 
+/*
+ * Opens file with O_DIRECT, or through the page cache if the file system does not
+ * support direct I/O (e.g. tmpfs).
+ */
+static int
+file_open_direct(const char *file, int flags, mode_t mode)
+{
+	int fd = open(file, flags | O_DIRECT, mode);
+	if (fd < 0 && errno == EINVAL) {
+		TRACE("No direct I/O for %s, using the page cache", file);
+		fd = open(file, flags, mode);
+	}
+	return fd;
+}
+
+/*
+ * Reads of file_copy_direct(). If an io_uring is available, a read is only queued by
+ * file_copy_direct_read_start() and runs in the background until it is collected by
+ * file_copy_direct_read_wait(). Otherwise, it is done synchronously.
+ */
+typedef struct {
+	int fd;
+#ifdef EVENT_IO_URING
+	uring_t *ring;
+	bool queued;
+#endif
+	ssize_t res; // number of bytes read or negative errno
+} file_copy_direct_reader_t;
+
+static void
+file_copy_direct_read_start(file_copy_direct_reader_t *r, void *buf, size_t len, off_t off)
+{
+#ifdef EVENT_IO_URING
+	struct io_uring_sqe *sqe = r->ring ? uring_get_sqe(r->ring) : NULL;
+	if (sqe) {
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = r->fd;
+		sqe->addr = (uintptr_t)buf;
+		sqe->len = len;
+		sqe->off = off;
+		r->res = uring_submit(r->ring);
+		r->queued = (r->res == 0);
+		return;
+	}
+#endif
+	do {
+		r->res = pread(r->fd, buf, len, off);
+	} while (r->res < 0 && errno == EINTR);
+	if (r->res < 0)
+		r->res = -errno;
+}
+
+static ssize_t
+file_copy_direct_read_wait(file_copy_direct_reader_t *r)
+{
+#ifdef EVENT_IO_URING
+	if (r->queued) {
+		struct io_uring_cqe cqe;
+		while (!uring_pop_cqe(r->ring, &cqe)) {
+			int ret = uring_submit_and_wait(r->ring, -1);
+			if (ret < 0 && ret != -EINTR) {
+				// the buffer may still be in use by the kernel
+				FATAL("Failed to wait for read from fd %d (%d)", r->fd, ret);
+			}
+		}
+		r->queued = false;
+		r->res = cqe.res;
+	}
+#endif
+	return r->res;
+}
+
+static int
+file_copy_direct_write(int fd, const unsigned char *buf, size_t len, off_t off)
+{
+	// only the last block may be unaligned, which direct I/O cannot write
+	if (len % FILE_DIRECT_IO_ALIGN) {
+		int flags = fcntl(fd, F_GETFL);
+		if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) < 0)
+			return -1;
+	}
+
+	for (size_t done = 0; done < len;) {
+		ssize_t w = pwrite(fd, buf + done, len - done, off + done);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w < 0)
+			return -1;
+		done += w;
+	}
+	return 0;
+}
+
+int
+file_copy_direct(const char *in_file, const char *out_file)
+{
+	int in_fd, out_fd, ret = -1;
+	struct stat in_st;
+	void *buf[2] = { NULL, NULL };
+
+	IF_NULL_RETVAL(in_file, -1);
+	IF_NULL_RETVAL(out_file, -1);
+
+	in_fd = file_open_direct(in_file, O_RDONLY, 0);
+	if (in_fd < 0) {
+		DEBUG_ERRNO("Could not open input file %s", in_file);
+		return -1;
+	}
+
+	out_fd = file_open_direct(out_file, O_WRONLY | O_CREAT | O_TRUNC, 00666);
+	if (out_fd < 0) {
+		DEBUG_ERRNO("Could not open output file %s", out_file);
+		close(in_fd);
+		return -1;
+	}
+
+	if (fstat(in_fd, &in_st) < 0 || !S_ISREG(in_st.st_mode)) {
+		DEBUG_ERRNO("Input file %s is not a regular file", in_file);
+		goto out;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		int r = posix_memalign(&buf[i], FILE_DIRECT_IO_ALIGN, FILE_COPY_DIRECT_BUF_SIZE);
+		if (r) {
+			errno = r;
+			ERROR_ERRNO("Could not allocate aligned buffer");
+			goto out;
+		}
+	}
+
+	file_copy_direct_reader_t reader = { .fd = in_fd };
+#ifdef EVENT_IO_URING
+	reader.ring = uring_new(2);
+#endif
+
+	off_t size = in_st.st_size;
+	const off_t bs = FILE_COPY_DIRECT_BUF_SIZE;
+
+	// the reads are rounded up to the alignment, the last one ends at end of file
+	if (size > 0)
+		file_copy_direct_read_start(&reader, buf[0],
+					    FILE_DIRECT_IO_ROUND_UP(MIN(bs, size)), 0);
+
+	ret = 0;
+	for (off_t off = 0, i = 0; off < size; off += bs, i++) {
+		size_t len = MIN(bs, size - off);
+		ssize_t n = file_copy_direct_read_wait(&reader);
+		if (n < 0 || (size_t)n != len) {
+			errno = n < 0 ? -n : EIO;
+			DEBUG_ERRNO("Could not read %s at offset %jd", in_file, (intmax_t)off);
+			ret = -1;
+			break;
+		}
+
+		// read the next block while the current one is written
+		off_t next = off + bs;
+		if (next < size)
+			file_copy_direct_read_start(
+				&reader, buf[(i + 1) % 2],
+				FILE_DIRECT_IO_ROUND_UP(MIN(bs, size - next)), next);
+
+		if (file_copy_direct_write(out_fd, buf[i % 2], len, off) < 0) {
+			DEBUG_ERRNO("Could not write %s at offset %jd", out_file, (intmax_t)off);
+			ret = -1;
+			break;
+		}
+	}
+	// collect a read which is still running before its buffer is freed
+	file_copy_direct_read_wait(&reader);
+#ifdef EVENT_IO_URING
+	uring_free(reader.ring);
+#endif
+
+	if (ret == 0 && fsync(out_fd) < 0) {
+		DEBUG_ERRNO("Could not sync output file %s", out_file);
+		ret = -1;
+	}
+
+out:
+	free(buf[0]);
+	free(buf[1]);
+	close(out_fd);
+	close(in_fd);
+
+	return ret;
+}
+
 int
 file_move(const char *src, const char *dst, size_t bs)
 {
@@ -282,6 +606,59 @@ file_printf_append(const char *file, const char *fmt, ...)
 	return ret;
 }
 
+int
+file_write_at(int dirfd, const char *file, const char *buf, ssize_t len)
+{
+	ssize_t n;
+
+	IF_NULL_RETVAL(file, -1);
+	IF_NULL_RETVAL(buf, -1);
+
+	int fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		DEBUG_ERRNO("Could not open output file %s", file);
+		return -1;
+	}
+
+	if (len < 0)
+		len = strlen(buf);
+
+	do {
+		n = pwrite(fd, buf, len, 0);
+	} while (n < 0 && errno == EINTR);
+
+	int errno_backup = errno;
+	close(fd);
+
+	if (n < 0) {
+		errno = errno_backup;
+		DEBUG_ERRNO("Could not write to output file %s", file);
+		return -1;
+	}
+	return n;
+}
+
+int
+file_printf_at(int dirfd, const char *file, const char *fmt, ...)
+{
+	va_list ap;
+	char *buf;
+	int ret;
+
+	IF_NULL_RETVAL(file, -1);
+
+	va_start(ap, fmt);
+	buf = mem_vprintf(fmt, ap);
+	va_end(ap);
+
+	ret = file_write_at(dirfd, file, buf, -1);
+
+	int errno_backup = errno;
+	mem_free0(buf);
+	errno = errno_backup;
+	return ret;
+}
+
 int
 file_read(const char *file, char *buf, size_t len)
 {
@@ -387,6 +764,90 @@ file_syncfs(const char *file)
 	close(fd);
 }
 
+int
+file_discard(const char *file)
+{
+	IF_NULL_RETVAL(file, -1);
+
+	int ret = -1;
+	struct stat st;
+	int fd = open(file, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		DEBUG_ERRNO("Could not open %s for discarding", file);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		DEBUG_ERRNO("Could not stat %s", file);
+		goto out;
+	}
+
+	if (S_ISBLK(st.st_mode)) {
+		uint64_t range[2] = { 0, 0 };
+		if (ioctl(fd, BLKGETSIZE64, &range[1]) < 0) {
+			DEBUG_ERRNO("Could not get size of block device %s", file);
+			goto out;
+		}
+		if (ioctl(fd, BLKDISCARD, range) < 0) {
+			DEBUG_ERRNO("Could not discard block device %s", file);
+			goto out;
+		}
+	} else if (S_ISREG(st.st_mode)) {
+		if (st.st_size > 0 &&
+		    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, st.st_size) < 0) {
+			DEBUG_ERRNO("Could not punch hole into %s", file);
+			goto out;
+		}
+	} else {
+		DEBUG("%s is neither a regular file nor a block device", file);
+		goto out;
+	}
+	ret = 0;
+out:
+	close(fd);
+	return ret;
+}
+
+int
+file_shred(const char *file)
+{
+	IF_NULL_RETVAL(file, -1);
+
+	int ret = -1;
+	struct stat st;
+	char buf[4096] = { 0 };
+	int fd = open(file, O_WRONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0) {
+		DEBUG_ERRNO("Could not open %s for shredding", file);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		DEBUG("%s is not a regular file", file);
+		goto out;
+	}
+
+	for (off_t off = 0; off < st.st_size;) {
+		size_t len = MIN((off_t)sizeof(buf), st.st_size - off);
+		ssize_t n = pwrite(fd, buf, len, off);
+		if (n < 0) {
+			DEBUG_ERRNO("Could not overwrite %s", file);
+			goto out;
+		}
+		off += n;
+	}
+	if (fsync(fd) < 0) {
+		DEBUG_ERRNO("Could not sync %s", file);
+		goto out;
+	}
+	if (unlink(file) < 0) {
+		DEBUG_ERRNO("Could not unlink %s", file);
+		goto out;
+	}
+	ret = 0;
+out:
+	close(fd);
+	return ret;
+}
+
 bool
 file_on_same_fs(const char *path1, const char *path2)
 {
@@ -437,17 +898,35 @@ file_disk_space_used(const char *path)
 	return (s.f_blocks - s.f_bfree) * s.f_frsize;
 }
 
+int
+file_disk_space_stat(const char *path, off_t *total, off_t *free_space, off_t *used)
+{
+	IF_NULL_RETVAL(path, -1);
+	struct statvfs s;
+
+	if (statvfs(path, &s) < 0)
+		return -1;
+
+	if (total)
+		*total = s.f_blocks * s.f_frsize;
+	if (free_space)
+		*free_space = s.f_bfree * s.f_frsize;
+	if (used)
+		*used = (s.f_blocks - s.f_bfree) * s.f_frsize;
+
+	return 0;
+}
+
 bool
 file_disk_space_available(const char *path, off_t required, float threshold)
 {
 	ASSERT(path);
 	IF_TRUE_RETVAL_ERROR((threshold < 0 || threshold > 1), false);
 
-	off_t available = file_disk_space_free(path);
-	IF_TRUE_RETVAL_ERROR(available < 0, false);
-
-	off_t min_free_space = file_disk_space(path);
-	IF_TRUE_RETVAL_ERROR(min_free_space < 0, false);
+	// a single statvfs for both the total and the free space
+	off_t min_free_space, available;
+	IF_TRUE_RETVAL_ERROR(file_disk_space_stat(path, &min_free_space, &available, NULL) < 0,
+			     false);
 
 	min_free_space *= threshold;
 
@@ -62,16 +62,37 @@ file_is_fifo(const char *file);
 
 /**
  * Copy a file.
+ *
+ * Whole regular files are cloned (FICLONE) if the file system supports it.
+ * Otherwise the data is copied in the kernel by copy_file_range() or sendfile()
+ * and only if both are not available by a large read/write buffer. Holes of
+ * sparse regular files are preserved if the output is a regular file, too.
+ *
  * @param in_file The file to be read.
  * @param out_file The file to be written.
  * @param count Copy count input blocks, may be -1 to copy until end of file.
- * @param bs Read and write up to bs bytes at a time.
+ * @param bs The block size in bytes used for count and seek.
  * @param seek Skip seek blocks at start of output.
  * @return -1 on error else 0.
  */
 int
 file_copy(const char *in_file, const char *out_file, ssize_t count, size_t bs, off_t seek);
 
+/**
+ * Copy a regular file with direct I/O, e.g., to flash an image to a partition.
+ *
+ * The data bypasses the page cache in aligned blocks of 4 MiB. Two
+ * buffers are used alternately, so that the next block is read while the current one
+ * is written if io_uring is available. Files which do not support O_DIRECT are
+ * accessed through the page cache. The output is synced before returning.
+ *
+ * @param in_file The regular file to be read.
+ * @param out_file The file or block device to be written.
+ * @return -1 on error else 0.
+ */
+int
+file_copy_direct(const char *in_file, const char *out_file);
+
 /**
  * Move a file.
  * @param src The source file name.
@@ -120,6 +141,35 @@ file_printf(const char *file, const char *fmt, ...);
 int
 file_printf_append(const char *file, const char *fmt, ...);
 
+/**
+ * Write a string with a single pwrite() at offset 0 to a file relative to the
+ * directory fd dirfd, see openat(). Meant for the attribute files of procfs,
+ * sysfs and cgroupfs, e.g., through a cgroup directory fd which is kept open,
+ * where every write is a separate command. The file is not created or
+ * truncated.
+ * @param dirfd The directory fd the file name is relative to, or AT_FDCWD.
+ * @param file The file name.
+ * @param buf The buffer to be written.
+ * @param len The length of buffer, maybe -1 to determine buffer length with strlen().
+ * @return -1 on error (with errno set) else the number of bytes written.
+ */
+int
+file_write_at(int dirfd, const char *file, const char *buf, ssize_t len);
+
+/**
+ * Write a string to a file relative to dirfd using printf, see file_write_at().
+ * @param dirfd The directory fd the file name is relative to, or AT_FDCWD.
+ * @param file The file name.
+ * @param fmt The format string.
+ * @return -1 on error (with errno set) else the number of bytes written.
+ */
+int
+file_printf_at(int dirfd, const char *file, const char *fmt, ...)
+#if defined(__GNUC__)
+	__attribute__((format(printf, 3, 4)))
+#endif
+	;
+
 /**
  * Read a string from a file.
  * @param file The file name.
@@ -170,6 +220,27 @@ file_touch(const char *file);
 void
 file_syncfs(const char *file);
 
+/**
+ * Discards the whole content of a block device or a regular file, i.e., the blocks
+ * are passed to the storage as unused (BLKDISCARD, resp. FALLOC_FL_PUNCH_HOLE).
+ * The size of a regular file is kept, reading returns zeroes afterwards.
+ *
+ * @param file The block device or regular file.
+ * @return -1 on error, e.g., if discarding is not supported, else 0.
+ */
+int
+file_discard(const char *file);
+
+/**
+ * Overwrites a regular file with zeroes, syncs and unlinks it, e.g., to destroy a
+ * (wrapped) key. Flash storage may still keep the blocks with the old content.
+ *
+ * @param file The regular file, symlinks are not followed.
+ * @return -1 on error else 0.
+ */
+int
+file_shred(const char *file);
+
 /**
  * Check whether to files/dirs are on the same file system
  * @param path1 path to first file or directory
@@ -206,6 +277,18 @@ file_disk_space_free(const char *path);
 off_t
 file_disk_space_used(const char *path);
 
+/**
+ * get size, free and used disk space of underlying file system of the corresponding
+ * file or directory at path with a single statvfs() call.
+ * @param path The file name or directory name
+ * @param total Set to the size of the file system, may be NULL
+ * @param free_space Set to the free space in the file system, may be NULL
+ * @param used Set to the used disk space of the file system, may be NULL
+ * @return 0 on success, -1 on error
+ */
+int
+file_disk_space_stat(const char *path, off_t *total, off_t *free_space, off_t *used);
+
 /**
  * check if enough disk space is available on underlying file system of the corresponding
  * file or directory at path.
@@ -0,0 +1,330 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "munit.h"
+
+#include "file.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TEST_DATA_SIZE (3 * 1024 * 1024 + 77)
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+
+	char *dir = mem_strdup("/tmp/file-test-XXXXXX");
+	munit_assert_not_null(mkdtemp(dir));
+	return dir;
+}
+
+static void
+tear_down(void *fixture)
+{
+	char *dir = fixture;
+	char *src = mem_printf("%s/src", dir);
+	char *dst = mem_printf("%s/dst", dir);
+
+	unlink(src);
+	unlink(dst);
+	rmdir(dir);
+
+	mem_free0(src);
+	mem_free0(dst);
+	mem_free0(dir);
+}
+
+static unsigned char *
+create_data(const char *file, size_t len)
+{
+	unsigned char *data = mem_alloc(len);
+	for (size_t i = 0; i < len; i++)
+		data[i] = (unsigned char)munit_rand_uint32();
+
+	munit_assert_int(file_write(file, (char *)data, len), ==, (int)len);
+	return data;
+}
+
+static MunitResult
+test_copy_content(UNUSED const MunitParameter params[], void *fixture)
+{
+	char *src = mem_printf("%s/src", (char *)fixture);
+	char *dst = mem_printf("%s/dst", (char *)fixture);
+	unsigned char *data = create_data(src, TEST_DATA_SIZE);
+
+	// block size is only the unit of count and seek and does not limit the copy
+	munit_assert_int(file_copy(src, dst, -1, 512, 0), ==, 0);
+	munit_assert_int(file_size(dst), ==, TEST_DATA_SIZE);
+
+	unsigned char *copy = mem_alloc(TEST_DATA_SIZE);
+	int fd = open(dst, O_RDONLY);
+	munit_assert_int(fd, >=, 0);
+	munit_assert_int(read(fd, copy, TEST_DATA_SIZE), ==, TEST_DATA_SIZE);
+	close(fd);
+	munit_assert_memory_equal(TEST_DATA_SIZE, copy, data);
+
+	// copying overwrites an existing, larger output file
+	munit_assert_int(file_write(src, "small", -1), ==, 5);
+	munit_assert_int(file_copy(src, dst, -1, 512, 0), ==, 0);
+	munit_assert_int(file_size(dst), ==, 5);
+
+	mem_free0(copy);
+	mem_free0(data);
+	mem_free0(src);
+	mem_free0(dst);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_copy_count_seek_and_holes(UNUSED const MunitParameter params[], void *fixture)
+{
+	char *src = mem_printf("%s/src", (char *)fixture);
+	char *dst = mem_printf("%s/dst", (char *)fixture);
+	const char *head = "head", *tail = "tail";
+	const off_t hole = 8 * 1024 * 1024;
+
+	// sparse input with data at the start and at the end
+	int fd = open(src, O_WRONLY | O_CREAT | O_TRUNC, 00666);
+	munit_assert_int(fd, >=, 0);
+	munit_assert_int(write(fd, head, 4), ==, 4);
+	munit_assert_int(pwrite(fd, tail, 4, hole), ==, 4);
+	close(fd);
+
+	munit_assert_int(file_copy(src, dst, -1, 4096, 0), ==, 0);
+	munit_assert_int(file_size(dst), ==, hole + 4);
+
+	char buf[5] = { 0 };
+	fd = open(dst, O_RDONLY);
+	munit_assert_int(pread(fd, buf, 4, 0), ==, 4);
+	munit_assert_string_equal(buf, head);
+	munit_assert_int(pread(fd, buf, 4, hole / 2), ==, 4);
+	munit_assert_memory_equal(4, buf, "\0\0\0\0");
+	munit_assert_int(pread(fd, buf, 4, hole), ==, 4);
+	munit_assert_string_equal(buf, tail);
+	close(fd);
+
+	// count and seek are given in blocks
+	unsigned char *data = create_data(src, 10 * 512);
+	munit_assert_int(file_copy(src, dst, 3, 512, 2), ==, 0);
+	munit_assert_int(file_size(dst), ==, 5 * 512);
+
+	unsigned char *copy = mem_alloc0(5 * 512);
+	fd = open(dst, O_RDONLY);
+	munit_assert_int(read(fd, copy, 5 * 512), ==, 5 * 512);
+	close(fd);
+	munit_assert_memory_equal(3 * 512, copy + 2 * 512, data);
+
+	mem_free0(copy);
+	mem_free0(data);
+	mem_free0(src);
+	mem_free0(dst);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_copy_direct(UNUSED const MunitParameter params[], void *fixture)
+{
+	char *src = mem_printf("%s/src", (char *)fixture);
+	char *dst = mem_printf("%s/dst", (char *)fixture);
+	// several blocks of the double buffer and an unaligned tail
+	const size_t len = 9 * 1024 * 1024 + 4096 + 77;
+	unsigned char *data = create_data(src, len);
+
+	munit_assert_int(file_write(dst, "previous content", -1), ==, 16);
+	munit_assert_int(file_copy_direct(src, dst), ==, 0);
+	munit_assert_int(file_size(dst), ==, len);
+
+	unsigned char *copy = mem_alloc(len);
+	munit_assert_int(file_read(dst, (char *)copy, len), ==, (int)len);
+	munit_assert_memory_equal(len, copy, data);
+
+	// empty input
+	munit_assert_int(file_write(src, "", 0), ==, 0);
+	munit_assert_int(file_copy_direct(src, dst), ==, 0);
+	munit_assert_int(file_size(dst), ==, 0);
+
+	// only regular files can be copied
+	munit_assert_int(file_copy_direct(fixture, dst), ==, -1);
+
+	mem_free0(copy);
+	mem_free0(data);
+	mem_free0(src);
+	mem_free0(dst);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_discard_and_shred(UNUSED const MunitParameter params[], void *fixture)
+{
+	char *src = mem_printf("%s/src", (char *)fixture);
+	const size_t len = 1024 * 1024;
+	unsigned char *data = create_data(src, len);
+	unsigned char *copy = mem_alloc(len);
+	unsigned char *zero = mem_alloc0(len);
+
+	// the size is kept, the content is gone
+	if (file_discard(src) == 0) {
+		munit_assert_int(file_size(src), ==, len);
+		munit_assert_int(file_read(src, (char *)copy, len), ==, (int)len);
+		munit_assert_memory_equal(len, copy, zero);
+	}
+	munit_assert_int(file_discard(fixture), ==, -1);
+
+	mem_free0(data);
+	data = create_data(src, len);
+	munit_assert_int(file_shred(src), ==, 0);
+	munit_assert_false(file_exists(src));
+	munit_assert_int(file_shred(src), ==, -1);
+	munit_assert_int(file_shred(fixture), ==, -1);
+
+	mem_free0(zero);
+	mem_free0(copy);
+	mem_free0(data);
+	mem_free0(src);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_write_at(UNUSED const MunitParameter params[], void *fixture)
+{
+	char *dst = mem_printf("%s/dst", (char *)fixture);
+	char buf[16] = { 0 };
+
+	int dirfd = open(fixture, O_RDONLY | O_DIRECTORY);
+	munit_assert_int(dirfd, >=, 0);
+
+	// files are not created
+	munit_assert_int(file_printf_at(dirfd, "dst", "%d", 42), ==, -1);
+	munit_assert_int(errno, ==, ENOENT);
+
+	munit_assert_int(file_write(dst, "0000", -1), ==, 4);
+	munit_assert_int(file_printf_at(dirfd, "dst", "%d", 42), ==, 2);
+	munit_assert_int(file_write_at(dirfd, "dst", "1", -1), ==, 1);
+
+	// every write starts at offset 0 and does not truncate
+	munit_assert_int(file_read(dst, buf, sizeof(buf) - 1), ==, 4);
+	munit_assert_string_equal(buf, "1200");
+
+	close(dirfd);
+	mem_free0(dst);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_disk_space_stat(UNUSED const MunitParameter params[], void *fixture)
+{
+	off_t total = -1, free_space = -1, used = -1;
+
+	munit_assert_int(file_disk_space_stat(fixture, &total, &free_space, &used), ==, 0);
+	munit_assert_int64(total, ==, file_disk_space(fixture));
+	munit_assert_int64(free_space + used, ==, total);
+
+	// each of the outputs is optional
+	used = -1;
+	munit_assert_int(file_disk_space_stat(fixture, NULL, NULL, &used), ==, 0);
+	munit_assert_int64(used, >=, 0);
+	munit_assert_int64(used, <=, total);
+
+	char *missing = mem_printf("%s/missing", (char *)fixture);
+	munit_assert_int(file_disk_space_stat(missing, &total, &free_space, &used), ==, -1);
+	mem_free0(missing);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/copy content",	/* name */
+		test_copy_content,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/copy with count, seek and holes", /* name */
+		test_copy_count_seek_and_holes,	    /* test */
+		setup,				    /* setup */
+		tear_down,			    /* tear_down */
+		MUNIT_TEST_OPTION_NONE,		    /* options */
+		NULL				    /* parameters */
+	},
+	{
+		"/copy direct",		/* name */
+		test_copy_direct,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/discard and shred",	/* name */
+		test_discard_and_shred, /* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/write at",		/* name */
+		test_write_at,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/disk space stat",	/* name */
+		test_disk_space_stat,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite file_suite = {
+	"/file",		/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
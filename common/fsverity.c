@@ -0,0 +1,99 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2022 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "fsverity.h"
+
+#include "macro.h"
+#include "mem.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fsverity.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// the Merkle tree block size, which has to match the page size for older kernels
+#define FSVERITY_BLOCK_SIZE 4096
+
+int
+fsverity_enable(const char *path)
+{
+	struct fsverity_enable_arg arg = { 0 };
+	int ret = -1;
+
+	IF_NULL_RETVAL(path, -1);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		DEBUG_ERRNO("Could not open %s", path);
+		return -1;
+	}
+
+	arg.version = 1;
+	arg.hash_algorithm = FS_VERITY_HASH_ALG_SHA256;
+	arg.block_size = FSVERITY_BLOCK_SIZE;
+
+	if (ioctl(fd, FS_IOC_ENABLE_VERITY, &arg) == 0) {
+		DEBUG("Enabled fs-verity for %s", path);
+		ret = 0;
+	} else if (errno == EEXIST) {
+		TRACE("fs-verity already enabled for %s", path);
+		ret = 0;
+	} else {
+		DEBUG_ERRNO("Could not enable fs-verity for %s", path);
+	}
+
+	close(fd);
+	return ret;
+}
+
+int
+fsverity_measure(const char *path, digest_t *digest)
+{
+	int ret = -1;
+
+	ASSERT(digest);
+	digest->len = 0;
+	IF_NULL_RETVAL(path, -1);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		DEBUG_ERRNO("Could not open %s", path);
+		return -1;
+	}
+
+	struct fsverity_digest *m = mem_alloc0(sizeof(struct fsverity_digest) + DIGEST_MAX_LEN);
+	m->digest_size = DIGEST_MAX_LEN;
+
+	if (ioctl(fd, FS_IOC_MEASURE_VERITY, m) < 0)
+		TRACE_ERRNO("Could not measure fs-verity digest of %s", path);
+	else if (m->digest_algorithm != FS_VERITY_HASH_ALG_SHA256)
+		WARN("Unexpected fs-verity hash algorithm %u of %s", m->digest_algorithm, path);
+	else
+		ret = digest_set(digest, m->digest, m->digest_size);
+
+	mem_free0(m);
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2022 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/**
+ * @file fsverity.h
+ *
+ * Helpers for fs-verity, the file based integrity protection of the kernel. Once enabled,
+ * a file is read-only and each page read from it is verified against its Merkle tree.
+ * The kernel then provides the digest of the whole file without reading it.
+ */
+
+#ifndef FSVERITY_H
+#define FSVERITY_H
+
+#include "digest.h"
+
+/**
+ * Enables fs-verity with SHA256 for the given file. This builds the Merkle tree and
+ * thus reads the whole file once. Afterwards, the file cannot be written anymore.
+ *
+ * @param path The path of the file
+ * @return 0 on success or if fs-verity was already enabled, -1 otherwise, e.g., if the
+ *	   file system does not support fs-verity or the file is opened for writing
+ */
+int
+fsverity_enable(const char *path);
+
+/**
+ * Retrieves the SHA256 fs-verity digest of the given file from the kernel.
+ *
+ * @param path The path of the file
+ * @param digest The digest to be set, it is unset on error
+ * @return 0 on success, -1 if fs-verity is not enabled for the file or not supported
+ */
+int
+fsverity_measure(const char *path, digest_t *digest);
+
+#endif // FSVERITY_H
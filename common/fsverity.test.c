@@ -0,0 +1,120 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "munit.h"
+
+#include "fsverity.h"
+#include "file.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+
+	char *file = mem_strdup("/tmp/fsverity-test-XXXXXX");
+	int fd = mkstemp(file);
+	munit_assert_int(fd, >=, 0);
+	munit_assert_int(write(fd, "fsverity", 8), ==, 8);
+	close(fd);
+	return file;
+}
+
+static void
+tear_down(void *fixture)
+{
+	char *file = fixture;
+	unlink(file);
+	mem_free0(file);
+}
+
+static MunitResult
+test_fsverity_measure_disabled(UNUSED const MunitParameter params[], void *data)
+{
+	const char *file = data;
+	digest_t digest;
+
+	// a newly created file never has fs-verity enabled
+	digest_set(&digest, (const uint8_t *)"x", 1);
+	munit_assert_int(fsverity_measure(file, &digest), ==, -1);
+	munit_assert_false(digest_is_set(&digest));
+
+	munit_assert_int(fsverity_measure("/tmp/fsverity-test-does-not-exist", &digest), ==, -1);
+	munit_assert_false(digest_is_set(&digest));
+	munit_assert_int(fsverity_enable("/tmp/fsverity-test-does-not-exist"), ==, -1);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_fsverity_enable(UNUSED const MunitParameter params[], void *data)
+{
+	const char *file = data;
+	digest_t digest;
+
+	// not all file systems support fs-verity, e.g., tmpfs
+	if (fsverity_enable(file) < 0)
+		return MUNIT_SKIP;
+
+	munit_assert_int(fsverity_enable(file), ==, 0);
+	munit_assert_int(fsverity_measure(file, &digest), ==, 0);
+	munit_assert_int(digest.len, ==, 32);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/fsverity_measure_disabled",	/* name */
+		test_fsverity_measure_disabled, /* test */
+		setup,				/* setup */
+		tear_down,			/* tear_down */
+		MUNIT_TEST_OPTION_NONE,		/* options */
+		NULL				/* parameters */
+	},
+	{
+		"/fsverity_enable",	/* name */
+		test_fsverity_enable,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite fsverity_suite = {
+	"/fsverity",		/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
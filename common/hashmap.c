@@ -0,0 +1,254 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "hashmap.h"
+#include "macro.h"
+#include "mem.h"
+
+#include <string.h>
+
+#define HASHMAP_MIN_SIZE 16
+
+typedef struct {
+	const void *key;
+	void *value;
+	size_t hash;
+	bool used;
+} hashmap_entry_t;
+
+struct hashmap {
+	size_t (*hash)(const void *key);
+	bool (*equal)(const void *a, const void *b);
+	hashmap_entry_t *entries;
+	size_t size; /* number of slots, always a power of two */
+	size_t len;  /* number of used slots */
+};
+
+size_t
+hashmap_str_hash(const void *key)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (const unsigned char *c = key; *c; c++) {
+		h ^= *c;
+		h *= 1099511628211ULL;
+	}
+	return (size_t)h;
+}
+
+bool
+hashmap_str_equal(const void *a, const void *b)
+{
+	return !strcmp(a, b);
+}
+
+static size_t
+hashmap_int_hash(const void *key)
+{
+	// finalizer of splitmix64, spreads consecutive values such as pids
+	uint64_t h = (uint64_t)(uintptr_t)key;
+
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return (size_t)(h ^ (h >> 31));
+}
+
+static bool
+hashmap_int_equal(const void *a, const void *b)
+{
+	return a == b;
+}
+
+hashmap_t *
+hashmap_new(size_t (*hash)(const void *key), bool (*equal)(const void *a, const void *b))
+{
+	ASSERT(hash);
+	ASSERT(equal);
+
+	hashmap_t *map = mem_new0(hashmap_t, 1);
+	map->hash = hash;
+	map->equal = equal;
+
+	return map;
+}
+
+hashmap_t *
+hashmap_new_str(void)
+{
+	return hashmap_new(hashmap_str_hash, hashmap_str_equal);
+}
+
+hashmap_t *
+hashmap_new_int(void)
+{
+	return hashmap_new(hashmap_int_hash, hashmap_int_equal);
+}
+
+void
+hashmap_free(hashmap_t *map)
+{
+	IF_NULL_RETURN(map);
+
+	mem_free0(map->entries);
+	mem_free0(map);
+}
+
+/*
+ * Returns the slot containing key or the empty slot where it would be inserted.
+ * There is always at least one empty slot since the load factor is kept below 1.
+ */
+static size_t
+hashmap_find_slot(const hashmap_t *map, const void *key, size_t hash)
+{
+	size_t mask = map->size - 1;
+	size_t i = hash & mask;
+
+	while (map->entries[i].used) {
+		if (map->entries[i].hash == hash && map->equal(map->entries[i].key, key))
+			break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+static void
+hashmap_resize(hashmap_t *map, size_t size)
+{
+	hashmap_entry_t *old = map->entries;
+	size_t old_size = map->size;
+
+	map->entries = mem_new0(hashmap_entry_t, size);
+	map->size = size;
+
+	for (size_t i = 0; i < old_size; i++) {
+		if (!old[i].used)
+			continue;
+		map->entries[hashmap_find_slot(map, old[i].key, old[i].hash)] = old[i];
+	}
+	mem_free0(old);
+}
+
+void *
+hashmap_put(hashmap_t *map, const void *key, void *value)
+{
+	ASSERT(map);
+
+	// keep the load factor at most 3/4
+	if (4 * (map->len + 1) > 3 * map->size)
+		hashmap_resize(map, map->size ? map->size * 2 : HASHMAP_MIN_SIZE);
+
+	size_t hash = map->hash(key);
+	hashmap_entry_t *entry = &map->entries[hashmap_find_slot(map, key, hash)];
+
+	if (entry->used) {
+		void *old = entry->value;
+		entry->key = key;
+		entry->value = value;
+		return old;
+	}
+
+	entry->key = key;
+	entry->value = value;
+	entry->hash = hash;
+	entry->used = true;
+	map->len++;
+
+	return NULL;
+}
+
+void *
+hashmap_get(const hashmap_t *map, const void *key)
+{
+	IF_NULL_RETVAL(map, NULL);
+
+	if (!map->len)
+		return NULL;
+
+	hashmap_entry_t *entry = &map->entries[hashmap_find_slot(map, key, map->hash(key))];
+	return entry->used ? entry->value : NULL;
+}
+
+bool
+hashmap_contains(const hashmap_t *map, const void *key)
+{
+	IF_NULL_RETVAL(map, false);
+
+	if (!map->len)
+		return false;
+
+	return map->entries[hashmap_find_slot(map, key, map->hash(key))].used;
+}
+
+void *
+hashmap_remove(hashmap_t *map, const void *key)
+{
+	IF_NULL_RETVAL(map, NULL);
+
+	if (!map->len)
+		return NULL;
+
+	size_t mask = map->size - 1;
+	size_t i = hashmap_find_slot(map, key, map->hash(key));
+	if (!map->entries[i].used)
+		return NULL;
+
+	void *value = map->entries[i].value;
+
+	/*
+	 * Backward shift deletion: move following entries of the probe sequence
+	 * into the gap, unless they are already placed at or after their home slot.
+	 * This keeps lookups correct without tombstones.
+	 */
+	for (size_t j = (i + 1) & mask; map->entries[j].used; j = (j + 1) & mask) {
+		size_t home = map->entries[j].hash & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			map->entries[i] = map->entries[j];
+			i = j;
+		}
+	}
+	memset(&map->entries[i], 0, sizeof(hashmap_entry_t));
+	map->len--;
+
+	return value;
+}
+
+size_t
+hashmap_size(const hashmap_t *map)
+{
+	IF_NULL_RETVAL(map, 0);
+
+	return map->len;
+}
+
+void
+hashmap_foreach(const hashmap_t *map, void (*func)(const void *key, void *value, void *data),
+		void *data)
+{
+	IF_NULL_RETURN(map);
+	ASSERT(func);
+
+	for (size_t i = 0; i < map->size; i++) {
+		if (map->entries[i].used)
+			func(map->entries[i].key, map->entries[i].value, data);
+	}
+}
@@ -0,0 +1,163 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/**
+ * @file hashmap.h
+ *
+ * Implements a hash map with open addressing (linear probing) which maps
+ * keys to payload pointers. Keys are not copied, i.e., the memory of a key
+ * must stay valid as long as the entry is contained in the map. This is
+ * usually the case if the key is a member of the stored value, e.g.,
+ * the uuid string of a container.
+ *
+ * Besides generic keys with own hash and compare functions, the map
+ * provides functions for string keys and for keys which are plain
+ * integer or pointer values (see HASHMAP_INT_KEY).
+ */
+
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct hashmap hashmap_t;
+
+/**
+ * Converts an integer value, e.g., a pid, to a key for maps created with
+ * hashmap_new_int().
+ */
+#define HASHMAP_INT_KEY(i) ((const void *)(intptr_t)(i))
+
+/**
+ * Creates a new, empty hash map.
+ *
+ * @param hash Function which computes the hash of a key.
+ * @param equal Function which returns true if two keys are equal.
+ * @return The newly created hash map.
+ */
+hashmap_t *
+hashmap_new(size_t (*hash)(const void *key), bool (*equal)(const void *a, const void *b));
+
+/**
+ * Creates a new, empty hash map with NUL terminated strings as keys.
+ *
+ * @return The newly created hash map.
+ */
+hashmap_t *
+hashmap_new_str(void);
+
+/**
+ * Creates a new, empty hash map whose keys are compared by their value
+ * instead of the memory they point to. Use HASHMAP_INT_KEY() for integer keys.
+ *
+ * @return The newly created hash map.
+ */
+hashmap_t *
+hashmap_new_int(void);
+
+/**
+ * Frees the hash map. The stored keys and values are not freed.
+ *
+ * @param map The hash map to be freed.
+ */
+void
+hashmap_free(hashmap_t *map);
+
+/**
+ * Inserts the value for the given key. If the map already contains the key,
+ * its value is replaced.
+ *
+ * @param map The hash map.
+ * @param key The key; must stay valid while the entry is stored.
+ * @param value The payload; may be NULL.
+ * @return The replaced value or NULL if the key was not contained in the map.
+ */
+void *
+hashmap_put(hashmap_t *map, const void *key, void *value);
+
+/**
+ * Looks up the value stored for the given key.
+ *
+ * @param map The hash map.
+ * @param key The key to search for.
+ * @return The stored value or NULL if the key is not contained in the map.
+ */
+void *
+hashmap_get(const hashmap_t *map, const void *key);
+
+/**
+ * Returns true if and only if the map contains the key.
+ *
+ * @param map The hash map.
+ * @param key The key to search for.
+ * @return true if the map contains the key, false otherwise.
+ */
+bool
+hashmap_contains(const hashmap_t *map, const void *key);
+
+/**
+ * Removes the entry for the given key.
+ *
+ * @param map The hash map.
+ * @param key The key of the entry to be removed.
+ * @return The value of the removed entry or NULL if the key was not contained in the map.
+ */
+void *
+hashmap_remove(hashmap_t *map, const void *key);
+
+/**
+ * Returns the number of entries contained in the map.
+ *
+ * @param map The hash map.
+ * @return Number of entries contained in the map.
+ */
+size_t
+hashmap_size(const hashmap_t *map);
+
+/**
+ * Calls func for each entry of the map in no particular order. The map must
+ * not be modified by func.
+ *
+ * @param map The hash map.
+ * @param func The function to be called for each entry.
+ * @param data Payload data to be passed to func.
+ */
+void
+hashmap_foreach(const hashmap_t *map, void (*func)(const void *key, void *value, void *data),
+		void *data);
+
+/**
+ * Hash function for NUL terminated string keys (FNV-1a).
+ */
+size_t
+hashmap_str_hash(const void *key);
+
+/**
+ * Compare function for NUL terminated string keys.
+ */
+bool
+hashmap_str_equal(const void *a, const void *b);
+
+#endif /* HASHMAP_H */
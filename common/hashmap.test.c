@@ -0,0 +1,191 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "munit.h"
+
+#include "hashmap.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <string.h>
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+	return NULL;
+}
+
+static void
+tear_down(UNUSED void *fixture)
+{
+	// No clean-up needed for now
+}
+
+static MunitResult
+test_put_get_remove_str(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	hashmap_t *map = hashmap_new_str();
+	int a = 1, b = 2, c = 3;
+
+	// an empty map contains nothing
+	munit_assert_size(hashmap_size(map), ==, 0);
+	munit_assert_null(hashmap_get(map, "a"));
+	munit_assert_false(hashmap_contains(map, "a"));
+	munit_assert_null(hashmap_remove(map, "a"));
+
+	munit_assert_null(hashmap_put(map, "a", &a));
+	munit_assert_null(hashmap_put(map, "b", &b));
+	munit_assert_size(hashmap_size(map), ==, 2);
+
+	// keys are compared by content, not by address
+	char *key = mem_strdup("a");
+	munit_assert_ptr_equal(hashmap_get(map, key), &a);
+	munit_assert_true(hashmap_contains(map, key));
+	mem_free0(key);
+
+	// putting an existing key replaces its value
+	munit_assert_ptr_equal(hashmap_put(map, "b", &c), &b);
+	munit_assert_ptr_equal(hashmap_get(map, "b"), &c);
+	munit_assert_size(hashmap_size(map), ==, 2);
+
+	// NULL values can be stored
+	munit_assert_null(hashmap_put(map, "null", NULL));
+	munit_assert_true(hashmap_contains(map, "null"));
+	munit_assert_null(hashmap_get(map, "null"));
+
+	munit_assert_ptr_equal(hashmap_remove(map, "a"), &a);
+	munit_assert_false(hashmap_contains(map, "a"));
+	munit_assert_null(hashmap_remove(map, "a"));
+	munit_assert_size(hashmap_size(map), ==, 2);
+
+	hashmap_free(map);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_int_keys_match_reference(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	hashmap_t *map = hashmap_new_int();
+	const int n = 4096;
+	int *values = mem_new0(int, n);
+	bool *present = mem_new0(bool, n);
+	size_t len = 0;
+
+	// random inserts and removals, checked against a plain array
+	for (int round = 0; round < 8 * n; round++) {
+		int k = munit_rand_int_range(0, n - 1);
+		if (munit_rand_int_range(0, 2)) {
+			void *old = hashmap_put(map, HASHMAP_INT_KEY(k), &values[k]);
+			munit_assert_ptr_equal(old, present[k] ? &values[k] : NULL);
+			len += present[k] ? 0 : 1;
+			present[k] = true;
+		} else {
+			void *old = hashmap_remove(map, HASHMAP_INT_KEY(k));
+			munit_assert_ptr_equal(old, present[k] ? &values[k] : NULL);
+			len -= present[k] ? 1 : 0;
+			present[k] = false;
+		}
+		munit_assert_size(hashmap_size(map), ==, len);
+	}
+
+	for (int k = 0; k < n; k++) {
+		munit_assert_ptr_equal(hashmap_get(map, HASHMAP_INT_KEY(k)),
+				       present[k] ? &values[k] : NULL);
+		munit_assert(hashmap_contains(map, HASHMAP_INT_KEY(k)) == present[k]);
+	}
+
+	hashmap_free(map);
+	mem_free0(values);
+	mem_free0(present);
+
+	return MUNIT_OK;
+}
+
+static void
+count_cb(UNUSED const void *key, void *value, void *data)
+{
+	size_t *sum = data;
+	*sum += *(int *)value;
+}
+
+static MunitResult
+test_foreach_visits_all_entries(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	hashmap_t *map = hashmap_new_int();
+	int values[100];
+	size_t sum = 0, expected = 0;
+
+	for (int i = 0; i < 100; i++) {
+		values[i] = i;
+		expected += i;
+		hashmap_put(map, HASHMAP_INT_KEY(i), &values[i]);
+	}
+
+	hashmap_foreach(map, count_cb, &sum);
+	munit_assert_size(sum, ==, expected);
+
+	hashmap_free(map);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/put, get and remove string keys", /* name */
+		test_put_get_remove_str,	    /* test */
+		setup,				    /* setup */
+		tear_down,			    /* tear_down */
+		MUNIT_TEST_OPTION_NONE,		    /* options */
+		NULL				    /* parameters */
+	},
+	{
+		"/integer keys match reference", /* name */
+		test_int_keys_match_reference,	 /* test */
+		setup,				 /* setup */
+		tear_down,			 /* tear_down */
+		MUNIT_TEST_OPTION_NONE,		 /* options */
+		NULL				 /* parameters */
+	},
+	{
+		"/foreach visits all entries",	 /* name */
+		test_foreach_visits_all_entries, /* test */
+		setup,				 /* setup */
+		tear_down,			 /* tear_down */
+		MUNIT_TEST_OPTION_NONE,		 /* options */
+		NULL				 /* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite hashmap_suite = {
+	"/hashmap",		/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
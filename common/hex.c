@@ -22,17 +22,56 @@
  */
 
 #include <stdint.h>
-#include <stdio.h>
 #include <string.h>
+#include "hex.h"
+#include "logf.h"
 #include "macro.h"
 #include "mem.h"
 
+static const char hex_digits[] = "0123456789abcdef";
+
+/*
+ * Values of the hex digits plus one indexed by character, 0 for characters which are no
+ * hex digit.
+ */
+static const uint8_t hex_values[256] = {
+	['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,  ['5'] = 6,  ['6'] = 7,
+	['7'] = 8,  ['8'] = 9,  ['9'] = 10, ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14,
+	['e'] = 15, ['f'] = 16, ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15,
+	['F'] = 16,
+};
+
+#define HEX_VALUE(c) ((int)hex_values[(uint8_t)(c)] - 1)
+
+static int
+hex_decode(const char *in, size_t len, uint8_t *out)
+{
+	for (size_t i = 0; i < len; i++) {
+		int hi = HEX_VALUE(in[2 * i]);
+		int lo = HEX_VALUE(in[2 * i + 1]);
+		if ((hi | lo) < 0)
+			return -1;
+		out[i] = (uint8_t)(hi << 4 | lo);
+	}
+	return 0;
+}
+
+void
+hex_encode(const uint8_t *in, size_t inlen, char *out)
+{
+	for (size_t i = 0; i < inlen; i++) {
+		out[2 * i] = hex_digits[in[i] >> 4];
+		out[2 * i + 1] = hex_digits[in[i] & 0x0f];
+	}
+	out[2 * inlen] = '\0';
+}
+
 int
 convert_hex_to_bin(const char *in, size_t inlen, uint8_t *out, size_t outlen)
 {
 	ASSERT(inlen >= 2);
 
-	char *pos = (char *)in;
+	const char *pos = in;
 	size_t len = inlen;
 	if (strncmp("0X", in, 2) == 0) {
 		pos += 2;
@@ -44,17 +83,8 @@ convert_hex_to_bin(const char *in, size_t inlen, uint8_t *out, size_t outlen)
 	if (outlen != (len / 2)) {
 		return -2;
 	}
-	for (size_t i = 0; i < outlen; i++) {
-		if ((uint8_t)*pos < 0x30 || (uint8_t)*pos > 0x66 ||
-		    ((uint8_t)*pos > 0x39 && (uint8_t)*pos < 0x40) ||
-		    ((uint8_t)*pos > 0x46 && (uint8_t)*pos < 0x61) ||
-		    (uint8_t) * (pos + 1) < 0x30 || (uint8_t) * (pos + 1) > 0x66 ||
-		    ((uint8_t) * (pos + 1) > 0x39 && (uint8_t) * (pos + 1) < 0x40) ||
-		    ((uint8_t) * (pos + 1) > 0x46 && (uint8_t) * (pos + 1) < 0x61)) {
-			return -3;
-		}
-		sscanf(pos, "%2hhx", &out[i]);
-		pos += 2;
+	if (hex_decode(pos, outlen, out) < 0) {
+		return -3;
 	}
 	return 0;
 }
@@ -69,11 +99,7 @@ convert_bin_to_hex(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen)
 		return -1;
 	}
 
-	for (size_t i = 0; i < inlen; ++i) {
-		// remember snprintf additionally writes a '0' byte
-		snprintf((char *)(out + i * 2), 3, "%.2x", in[i]);
-	}
-
+	hex_encode(in, inlen, (char *)out);
 	return 0;
 }
 
@@ -83,12 +109,36 @@ convert_bin_to_hex_new(const uint8_t *bin, int length)
 	size_t len = MUL_WITH_OVERFLOW_CHECK(length, (size_t)2);
 	len = MUL_WITH_OVERFLOW_CHECK(len, sizeof(char));
 	len = ADD_WITH_OVERFLOW_CHECK(len, 1);
-	char *hex = mem_alloc0(len);
+	char *hex = mem_alloc(len);
+
+	hex_encode(bin, length, hex);
+	return hex;
+}
 
-	for (int i = 0; i < length; ++i) {
-		// remember snprintf additionally writes a '0' byte
-		snprintf(hex + i * 2, 3, "%.2x", bin[i]);
+uint8_t *
+convert_hex_to_bin_new(const char *hex_str, int *out_length)
+{
+	ASSERT(hex_str);
+	ASSERT(out_length);
+
+	size_t len = strlen(hex_str);
+	*out_length = (len + 1) / 2;
+
+	uint8_t *bin = mem_alloc0(*out_length);
+	uint8_t *out = bin;
+
+	if (len % 2 == 1) {
+		// odd length -> the first digit is the low nibble of the first byte
+		int lo = HEX_VALUE(hex_str[0]);
+		IF_TRUE_GOTO(lo < 0, err);
+		*out++ = lo;
+		hex_str++;
 	}
+	IF_TRUE_GOTO(hex_decode(hex_str, len / 2, out) < 0, err);
 
-	return hex;
-}
\ No newline at end of file
+	return bin;
+err:
+	ERROR("Conversion of hex string to bin failed!");
+	mem_free0(bin);
+	return NULL;
+}
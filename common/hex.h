@@ -24,6 +24,16 @@
 #ifndef HEX_H_
 #define HEX_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Writes the lower case hex representation of in and a terminating null to out, which
+ * has to provide 2 * inlen + 1 bytes.
+ */
+void
+hex_encode(const uint8_t *in, size_t inlen, char *out);
+
 int
 convert_hex_to_bin(const char *in, size_t inlen, uint8_t *out, size_t outlen);
 
@@ -33,4 +43,15 @@ convert_bin_to_hex(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen)
 char *
 convert_bin_to_hex_new(const uint8_t *bin, int length);
 
+/**
+ * Converts a hex string into a newly allocated binary buffer. A hex string of odd length
+ * is padded with a leading zero.
+ *
+ * @param hex_str the hex string
+ * @param out_length receives the size of the returned buffer
+ * @return the binary buffer or NULL if hex_str contains characters which are no hex digits
+ */
+uint8_t *
+convert_hex_to_bin_new(const char *hex_str, int *out_length);
+
 #endif // HEX_H_
@@ -33,6 +33,7 @@
 
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <syslog.h>
@@ -41,12 +42,39 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 // TODO: we should not include this in production builds...
 #ifndef LOGF_FILE_STRIP
 #define LOGF_FILE_STRIP "device/fraunhofer/common/cml/"
 #endif
 
+logf_prio_t logf_handlers_min_prio = LOGF_PRIO_SILENT;
+
+// skip the formatting of messages which would not be written by any handler
+#define LOGF_PRIO_SKIP(prio) ((prio) < __atomic_load_n(&logf_handlers_min_prio, __ATOMIC_RELAXED))
+
+/*
+ * The call site of the message currently written by logf_write, for handlers which
+ * store it separately, i.e., logf_binary_write. The message starts with a prefix of
+ * logf_record_prefix bytes formatted from file and line.
+ */
+static __thread const char *logf_record_file = NULL;
+static __thread int logf_record_line = 0;
+static __thread int logf_record_prefix = 0;
+
+static void
+logf_write_file(logf_prio_t prio, const char *file, int line, const char *msg, int prefix)
+{
+	logf_record_file = file;
+	logf_record_line = line;
+	logf_record_prefix = prefix;
+	logf_write(prio, msg);
+	logf_record_file = NULL;
+	logf_record_line = 0;
+	logf_record_prefix = 0;
+}
+
 void
 logf_message(logf_prio_t prio, const char *fmt, ...)
 {
@@ -54,6 +82,9 @@ logf_message(logf_prio_t prio, const char *fmt, ...)
 	va_list ap;
 	int n;
 
+	if (LOGF_PRIO_SKIP(prio))
+		return;
+
 	va_start(ap, fmt);
 	n = vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
@@ -72,6 +103,9 @@ logf_message_errno(logf_prio_t prio, const char *fmt, ...)
 	va_list ap;
 	int n;
 
+	if (LOGF_PRIO_SKIP(prio))
+		return;
+
 	va_start(ap, fmt);
 	n = vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
@@ -92,7 +126,10 @@ logf_message_file(logf_prio_t prio, const char *file, int line, const char *fmt,
 {
 	char buf[4096];
 	va_list ap;
-	int n;
+	int n, prefix;
+
+	if (LOGF_PRIO_SKIP(prio))
+		return;
 
 	if (file && strstr(file, LOGF_FILE_STRIP) == file)
 		file += strlen(LOGF_FILE_STRIP);
@@ -101,6 +138,7 @@ logf_message_file(logf_prio_t prio, const char *file, int line, const char *fmt,
 
 	if (n < 0)
 		return;
+	prefix = n;
 
 	va_start(ap, fmt);
 	n += vsnprintf(buf + n, sizeof(buf) - n, fmt, ap);
@@ -109,7 +147,7 @@ logf_message_file(logf_prio_t prio, const char *file, int line, const char *fmt,
 	if (n < 0)
 		return;
 
-	logf_write(prio, buf);
+	logf_write_file(prio, file, line, buf, prefix);
 }
 
 void
@@ -118,7 +156,10 @@ logf_message_file_errno(logf_prio_t prio, const char *file, int line, const char
 	char buf[4096];
 	int errno_backup = errno;
 	va_list ap;
-	int n;
+	int n, prefix;
+
+	if (LOGF_PRIO_SKIP(prio))
+		return;
 
 	if (file && strstr(file, LOGF_FILE_STRIP) == file)
 		file += strlen(LOGF_FILE_STRIP);
@@ -127,6 +168,7 @@ logf_message_file_errno(logf_prio_t prio, const char *file, int line, const char
 
 	if (n < 0)
 		return;
+	prefix = n;
 
 	va_start(ap, fmt);
 	n += vsnprintf(buf + n, sizeof(buf) - n, fmt, ap);
@@ -140,7 +182,7 @@ logf_message_file_errno(logf_prio_t prio, const char *file, int line, const char
 	if (n < 0)
 		return;
 
-	logf_write(prio, buf);
+	logf_write_file(prio, file, line, buf, prefix);
 }
 
 void
@@ -151,6 +193,9 @@ logf_message_hexdump(logf_prio_t prio, const void *b, size_t len, const char *fm
 	size_t i;
 	int n;
 
+	if (LOGF_PRIO_SKIP(prio))
+		return;
+
 	if (len > 1024) {
 		logf_write(prio, "Buffer too long for log");
 		return;
@@ -184,7 +229,10 @@ logf_message_file_hexdump(logf_prio_t prio, const char *file, int line, const vo
 	char buf[4096 * 4];
 	va_list ap;
 	size_t i;
-	int n;
+	int n, prefix;
+
+	if (LOGF_PRIO_SKIP(prio))
+		return;
 
 	if (len > 1024) {
 		logf_write(prio, "Buffer too long for log");
@@ -195,6 +243,7 @@ logf_message_file_hexdump(logf_prio_t prio, const char *file, int line, const vo
 
 	if (n < 0)
 		return;
+	prefix = n;
 
 	va_start(ap, fmt);
 	n += vsnprintf(buf + n, sizeof(buf) - n, fmt, ap);
@@ -214,28 +263,103 @@ logf_message_file_hexdump(logf_prio_t prio, const char *file, int line, const vo
 			return;
 	}
 
-	logf_write(prio, buf);
+	logf_write_file(prio, file, line, buf, prefix);
+}
+
+// serializes the token buckets of all call sites
+static pthread_mutex_t logf_ratelimit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int
+logf_ratelimit(logf_ratelimit_t *rl, logf_prio_t prio, const char *file, int line)
+{
+	struct timespec ts;
+	unsigned suppressed;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 1;
+	// offset by one to keep 0 for unused buckets
+	unsigned long long now = ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000 + 1;
+
+	pthread_mutex_lock(&logf_ratelimit_mutex);
+	if (!rl->stamp_ms) {
+		rl->stamp_ms = now;
+		rl->tokens = LOGF_RATELIMIT_BURST;
+	}
+
+	unsigned long long refill = (now - rl->stamp_ms) / LOGF_RATELIMIT_REFILL_MS;
+	if (refill >= LOGF_RATELIMIT_BURST - rl->tokens) {
+		rl->tokens = LOGF_RATELIMIT_BURST;
+		rl->stamp_ms = now;
+	} else if (refill) {
+		rl->tokens += refill;
+		rl->stamp_ms += refill * LOGF_RATELIMIT_REFILL_MS;
+	}
+
+	if (!rl->tokens) {
+		rl->suppressed++;
+		pthread_mutex_unlock(&logf_ratelimit_mutex);
+		return 0;
+	}
+	rl->tokens--;
+	suppressed = rl->suppressed;
+	rl->suppressed = 0;
+	pthread_mutex_unlock(&logf_ratelimit_mutex);
+
+	if (suppressed) {
+		// keep errno for the message itself
+		int errno_backup = errno;
+		if (file)
+			logf_message_file(prio, file, line, "%u messages suppressed by rate limit",
+					  suppressed);
+		else
+			logf_message(prio, "%u messages suppressed by rate limit", suppressed);
+		errno = errno_backup;
+	}
+
+	return 1;
 }
 
 /******************************************************************************/
 
 static list_t *logf_handler_list = NULL;
 
+// serializes the handlers, since e.g. worker threads of event_work may log as well
+static pthread_mutex_t logf_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 struct logf_handler {
 	void (*func)(logf_prio_t prio, const char *msg, void *data);
 	void *data;
 	logf_prio_t prio;
 };
 
+// must be called with logf_mutex held
+static void
+logf_handlers_update_min_prio(void)
+{
+	logf_prio_t min_prio = LOGF_PRIO_SILENT;
+
+	for (list_t *l = logf_handler_list; l; l = l->next) {
+		logf_handler_t *h = l->data;
+		if (h && h->func && h->prio < min_prio)
+			min_prio = h->prio;
+	}
+	__atomic_store_n(&logf_handlers_min_prio, min_prio, __ATOMIC_RELAXED);
+}
+
 void
 logf_write(logf_prio_t prio, const char *msg)
 {
+	if (LOGF_PRIO_SKIP(prio))
+		return;
+
+	pthread_mutex_lock(&logf_mutex);
 	for (list_t *l = logf_handler_list; l; l = l->next) {
 		logf_handler_t *h = l->data;
 		if (h && h->func && prio >= h->prio) {
 			(h->func)(prio, msg, h->data);
 		}
 	}
+	pthread_mutex_unlock(&logf_mutex);
 }
 
 logf_handler_t *
@@ -247,7 +371,10 @@ logf_register(void (*func)(logf_prio_t prio, const char *msg, void *data), void
 	handler->data = data;
 	handler->prio = LOGF_PRIO_TRACE;
 
+	pthread_mutex_lock(&logf_mutex);
 	logf_handler_list = list_append(logf_handler_list, handler);
+	logf_handlers_update_min_prio();
+	pthread_mutex_unlock(&logf_mutex);
 
 	return handler;
 }
@@ -256,7 +383,10 @@ void
 logf_unregister(logf_handler_t *handler)
 {
 	IF_NULL_RETURN(handler);
+	pthread_mutex_lock(&logf_mutex);
 	logf_handler_list = list_remove(logf_handler_list, handler);
+	logf_handlers_update_min_prio();
+	pthread_mutex_unlock(&logf_mutex);
 
 	mem_free0(handler);
 }
@@ -265,7 +395,11 @@ void
 logf_handler_set_prio(logf_handler_t *handler, logf_prio_t prio)
 {
 	ASSERT(handler);
+
+	pthread_mutex_lock(&logf_mutex);
 	handler->prio = prio;
+	logf_handlers_update_min_prio();
+	pthread_mutex_unlock(&logf_mutex);
 }
 
 /******************************************************************************/
@@ -324,26 +458,41 @@ logf_file_close(void *file)
 	fclose(f);
 }
 
+/*
+ * Set by the writer thread of logf_async_new to the time a record was logged and to
+ * skip the flush of every single record, which is done once per batch instead.
+ */
+static __thread const struct timeval *logf_file_tv = NULL;
+static __thread bool logf_file_batch = false;
+
 static void
 logf_file_write_timestamp(FILE *stream)
 {
-	char buf1[64], buf2[64];
+	// the formatted time is cached for the current second
+	static __thread time_t cached_sec = (time_t)-1;
+	static __thread char buf1[64], buf2[64];
 	struct timeval tv;
-	struct tm *tm;
-
-	IF_TRUE_RETURN_ERROR_ERRNO((gettimeofday(&tv, NULL) < 0));
+	struct tm tm;
 
-	tm = localtime(&tv.tv_sec);
-	IF_NULL_RETURN_ERROR_ERRNO(tm);
+	if (logf_file_tv)
+		tv = *logf_file_tv;
+	else
+		IF_TRUE_RETURN_ERROR_ERRNO((gettimeofday(&tv, NULL) < 0));
 
 	if (!stream)
 		return;
 
-	if (!strftime(buf1, sizeof(buf1) - 1, "%Y-%m-%dT%H:%M:%S", tm))
-		return;
+	if (tv.tv_sec != cached_sec) {
+		IF_NULL_RETURN_ERROR_ERRNO(localtime_r(&tv.tv_sec, &tm));
 
-	if (!strftime(buf2, sizeof(buf2) - 1, "%z", tm))
-		return;
+		cached_sec = (time_t)-1;
+		if (!strftime(buf1, sizeof(buf1) - 1, "%Y-%m-%dT%H:%M:%S", &tm))
+			return;
+
+		if (!strftime(buf2, sizeof(buf2) - 1, "%z", &tm))
+			return;
+		cached_sec = tv.tv_sec;
+	}
 
 	// rfc3339 format: 2014-05-23T21:29:11.150495+02:00
 	fprintf(stream, "%s.%06u%s ", buf1, (unsigned)tv.tv_usec, buf2);
@@ -378,7 +527,8 @@ logf_file_write(logf_prio_t prio, const char *msg, void *data)
 
 	logf_file_write_timestamp(data);
 	fprintf(data, "[%u] %s %s\n", getpid(), prio_str(prio), msg);
-	fflush(data);
+	if (!logf_file_batch)
+		fflush(data);
 }
 
 void
@@ -391,6 +541,125 @@ logf_test_write(logf_prio_t prio, const char *msg, void *data)
 	fflush(data);
 }
 
+/*
+ * Binary log records are LogRecord messages of logf.proto, each preceded by its length
+ * as varint (the delimited format of protobuf). They are encoded directly, since the
+ * core of libcommon does not depend on protobuf-c.
+ */
+#define LOGF_BINARY_MSG_MAX (4096 * 4)
+// re-anchor the monotonic timestamps to the wall clock every minute
+#define LOGF_BINARY_ANCHOR_NS (60 * 1000000000ULL)
+
+#define LOGF_PB_VARINT 0
+#define LOGF_PB_LEN 2
+
+typedef struct {
+	FILE *file;
+	unsigned long long anchor_ns; // monotonic time of the last realtime anchor
+} logf_binary_t;
+
+static size_t
+logf_pb_varint(uint8_t *buf, unsigned long long v)
+{
+	size_t n = 0;
+	while (v >= 0x80) {
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+	return n;
+}
+
+static size_t
+logf_pb_uint(uint8_t *buf, unsigned field, unsigned long long v)
+{
+	size_t n = logf_pb_varint(buf, field << 3 | LOGF_PB_VARINT);
+	return n + logf_pb_varint(buf + n, v);
+}
+
+static size_t
+logf_pb_string(uint8_t *buf, unsigned field, const char *str, size_t len)
+{
+	size_t n = logf_pb_varint(buf, field << 3 | LOGF_PB_LEN);
+	n += logf_pb_varint(buf + n, len);
+	memcpy(buf + n, str, len);
+	return n + len;
+}
+
+static unsigned long long
+logf_clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	if (clock_gettime(clock, &ts) < 0)
+		return 0;
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void *
+logf_binary_new(const char *name)
+{
+	logf_binary_t *binary = mem_new0(logf_binary_t, 1);
+	char *name_with_time_of_day = logf_file_new_name(name);
+
+	binary->file = fopen(name_with_time_of_day, "w");
+	if (!binary->file)
+		FATAL_ERRNO("Failed to open binary log file\n");
+
+	mem_free0(name_with_time_of_day);
+	return binary;
+}
+
+void
+logf_binary_close(void *data)
+{
+	logf_binary_t *binary = data;
+
+	IF_NULL_RETURN(binary);
+	fclose(binary->file);
+	mem_free0(binary);
+}
+
+void
+logf_binary_write(logf_prio_t prio, const char *msg, void *data)
+{
+	logf_binary_t *binary = data;
+	// record and both strings may need up to 10 bytes for tag and length, each
+	uint8_t buf[LOGF_BINARY_MSG_MAX + 256];
+	uint8_t len_buf[10];
+
+	if (!binary)
+		return;
+
+	const char *file = logf_record_file;
+	size_t msg_len = strlen(msg);
+	if (file && (size_t)logf_record_prefix <= msg_len) {
+		msg += logf_record_prefix;
+		msg_len -= logf_record_prefix;
+	} else {
+		file = NULL;
+	}
+	msg_len = MIN(msg_len, LOGF_BINARY_MSG_MAX);
+
+	unsigned long long now_ns = logf_clock_ns(CLOCK_MONOTONIC);
+	size_t n = logf_pb_uint(buf, 1, prio);
+	if (file) {
+		n += logf_pb_string(buf + n, 2, file, MIN(strlen(file), 128));
+		n += logf_pb_uint(buf + n, 3, logf_record_line);
+	}
+	n += logf_pb_uint(buf + n, 4, getpid());
+	n += logf_pb_uint(buf + n, 5, now_ns);
+	n += logf_pb_string(buf + n, 6, msg, msg_len);
+	if (!binary->anchor_ns || now_ns - binary->anchor_ns >= LOGF_BINARY_ANCHOR_NS) {
+		n += logf_pb_uint(buf + n, 7, logf_clock_ns(CLOCK_REALTIME));
+		binary->anchor_ns = now_ns;
+	}
+
+	fwrite(len_buf, 1, logf_pb_varint(len_buf, n), binary->file);
+	fwrite(buf, 1, n, binary->file);
+	if (!logf_file_batch)
+		fflush(binary->file);
+}
+
 void *
 logf_syslog_new(const char *name)
 {
@@ -519,3 +788,249 @@ logf_klog_write(UNUSED logf_prio_t prio, UNUSED const char *msg, UNUSED void *da
 	return;
 }
 #endif
+
+/******************************************************************************/
+
+/*
+ * Records are queued in a byte ring of LOGF_ASYNC_RING_SIZE, which has a single
+ * producer, as all handlers are called with logf_mutex held, and the writer thread as
+ * single consumer. Thus, head and tail are only published with atomic stores and
+ * producers take no lock, except for waking up the writer, if it waits for records.
+ */
+#define LOGF_ASYNC_RING_SIZE (256 * 1024)
+#define LOGF_ASYNC_ALIGN(len) (((len) + 7) & ~(size_t)7)
+// give up waiting for the writer thread to catch up in logf_async_flush after 1s
+#define LOGF_ASYNC_FLUSH_POLLS 1000
+
+typedef struct {
+	uint32_t len; // length of the record including this header, 0 to wrap around
+	int prio;
+	struct timeval tv;
+	char msg[];
+} logf_async_rec_t;
+
+typedef struct {
+	void (*func)(logf_prio_t prio, const char *msg, void *data);
+	void *data;
+
+	uint8_t *buf;
+	size_t head; // written by the producer
+	size_t tail; // written by the writer thread
+	size_t flushed; // tail after the last flush of the writer
+
+	unsigned long dropped;
+	unsigned long dropped_reported;
+
+	pid_t pid; // the child of a fork/clone has no writer thread
+	pthread_t thread;
+	bool running;
+	bool stop;
+	bool sleeping;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} logf_async_t;
+
+static void
+logf_async_wakeup(logf_async_t *async)
+{
+	if (!__atomic_load_n(&async->sleeping, __ATOMIC_SEQ_CST))
+		return;
+
+	pthread_mutex_lock(&async->lock);
+	pthread_cond_signal(&async->cond);
+	pthread_mutex_unlock(&async->lock);
+}
+
+/*
+ * Writes all queued records with the writer function in a batch.
+ * Returns true if there were records to write.
+ */
+static bool
+logf_async_drain(logf_async_t *async)
+{
+	size_t tail = async->tail;
+	size_t head = __atomic_load_n(&async->head, __ATOMIC_ACQUIRE);
+	unsigned long dropped = __atomic_load_n(&async->dropped, __ATOMIC_RELAXED);
+
+	if (tail == head && dropped == async->dropped_reported)
+		return false;
+
+	logf_file_batch = true;
+	while (tail != head) {
+		size_t pos = tail & (LOGF_ASYNC_RING_SIZE - 1);
+		logf_async_rec_t *rec = (logf_async_rec_t *)(async->buf + pos);
+
+		if (LOGF_ASYNC_RING_SIZE - pos < sizeof(logf_async_rec_t) || rec->len == 0) {
+			tail += LOGF_ASYNC_RING_SIZE - pos;
+			continue;
+		}
+
+		logf_file_tv = &rec->tv;
+		(async->func)(rec->prio, rec->msg, async->data);
+		tail += rec->len;
+		__atomic_store_n(&async->tail, tail, __ATOMIC_RELEASE);
+	}
+	logf_file_tv = NULL;
+
+	// report the messages dropped while the batch was written as well
+	dropped = __atomic_load_n(&async->dropped, __ATOMIC_RELAXED);
+	if (dropped != async->dropped_reported) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%lu log messages dropped, log ring was full",
+			 dropped - async->dropped_reported);
+		(async->func)(LOGF_PRIO_WARN, buf, async->data);
+		async->dropped_reported = dropped;
+	}
+	logf_file_batch = false;
+
+	if (async->func == &logf_file_write || async->func == &logf_test_write)
+		fflush(async->data);
+	else if (async->func == &logf_binary_write)
+		fflush(((logf_binary_t *)async->data)->file);
+	__atomic_store_n(&async->flushed, tail, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static void *
+logf_async_thread(void *data)
+{
+	logf_async_t *async = data;
+
+	for (;;) {
+		if (logf_async_drain(async))
+			continue;
+
+		pthread_mutex_lock(&async->lock);
+		__atomic_store_n(&async->sleeping, true, __ATOMIC_SEQ_CST);
+		// recheck after announcing the sleep, a producer may have missed it
+		if (async->tail == __atomic_load_n(&async->head, __ATOMIC_SEQ_CST) && !async->stop)
+			pthread_cond_wait(&async->cond, &async->lock);
+		__atomic_store_n(&async->sleeping, false, __ATOMIC_SEQ_CST);
+		bool stop = async->stop;
+		pthread_mutex_unlock(&async->lock);
+
+		if (stop && !logf_async_drain(async))
+			break;
+	}
+
+	return NULL;
+}
+
+void *
+logf_async_new(void (*func)(logf_prio_t prio, const char *msg, void *data), void *data)
+{
+	logf_async_t *async = mem_new0(logf_async_t, 1);
+
+	async->func = func;
+	async->data = data;
+	async->buf = mem_alloc(LOGF_ASYNC_RING_SIZE);
+	async->pid = getpid();
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->cond, NULL);
+
+	if (pthread_create(&async->thread, NULL, logf_async_thread, async) != 0) {
+		WARN("Could not start log writer thread, logging synchronously");
+		return async;
+	}
+	async->running = true;
+
+	return async;
+}
+
+void
+logf_async_write(logf_prio_t prio, const char *msg, void *data)
+{
+	logf_async_t *async = data;
+
+	if (!async)
+		return;
+
+	if (!async->running || async->pid != getpid()) {
+		(async->func)(prio, msg, async->data);
+		return;
+	}
+
+	size_t msg_len = strlen(msg) + 1;
+	size_t len = LOGF_ASYNC_ALIGN(sizeof(logf_async_rec_t) + msg_len);
+	size_t head = async->head;
+	size_t tail = __atomic_load_n(&async->tail, __ATOMIC_ACQUIRE);
+	size_t pos = head & (LOGF_ASYNC_RING_SIZE - 1);
+	// records are contiguous, skip the end of the ring if the record does not fit
+	size_t skip = LOGF_ASYNC_RING_SIZE - pos < len ? LOGF_ASYNC_RING_SIZE - pos : 0;
+
+	if (len > LOGF_ASYNC_RING_SIZE / 2 || LOGF_ASYNC_RING_SIZE - (head - tail) < skip + len) {
+		__atomic_fetch_add(&async->dropped, 1, __ATOMIC_RELAXED);
+		logf_async_wakeup(async);
+		return;
+	}
+
+	if (skip) {
+		if (skip >= sizeof(logf_async_rec_t))
+			((logf_async_rec_t *)(async->buf + pos))->len = 0;
+		head += skip;
+		pos = 0;
+	}
+
+	logf_async_rec_t *rec = (logf_async_rec_t *)(async->buf + pos);
+	rec->len = len;
+	rec->prio = prio;
+	gettimeofday(&rec->tv, NULL);
+	memcpy(rec->msg, msg, msg_len);
+
+	__atomic_store_n(&async->head, head + len, __ATOMIC_SEQ_CST);
+	logf_async_wakeup(async);
+
+	// the process is about to abort
+	if (prio >= LOGF_PRIO_FATAL)
+		logf_async_flush(async);
+}
+
+void
+logf_async_flush(void *data)
+{
+	logf_async_t *async = data;
+
+	IF_NULL_RETURN(async);
+	if (!async->running || async->pid != getpid() ||
+	    pthread_equal(async->thread, pthread_self()))
+		return;
+
+	size_t head = __atomic_load_n(&async->head, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < LOGF_ASYNC_FLUSH_POLLS; i++) {
+		if (__atomic_load_n(&async->flushed, __ATOMIC_ACQUIRE) >= head)
+			return;
+		logf_async_wakeup(async);
+		nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 1000000 }, NULL);
+	}
+}
+
+unsigned long
+logf_async_get_dropped(void *data)
+{
+	logf_async_t *async = data;
+
+	IF_NULL_RETVAL(async, 0);
+	return __atomic_load_n(&async->dropped, __ATOMIC_RELAXED);
+}
+
+void
+logf_async_free(void *data)
+{
+	logf_async_t *async = data;
+
+	IF_NULL_RETURN(async);
+
+	if (async->running && async->pid == getpid()) {
+		pthread_mutex_lock(&async->lock);
+		async->stop = true;
+		pthread_cond_signal(&async->cond);
+		pthread_mutex_unlock(&async->lock);
+		pthread_join(async->thread, NULL);
+	}
+
+	pthread_mutex_destroy(&async->lock);
+	pthread_cond_destroy(&async->cond);
+	mem_free0(async->buf);
+	mem_free0(async);
+}
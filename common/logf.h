@@ -51,6 +51,13 @@
  *
  * // Log to the kernel ring buffer using tag `sometag' (may be viewed with the `dmesg' command):
  * logf_register(&logf_klog_write, logf_klog_new("sometag"));
+ *
+ * // Log LogRecords of logf.proto to file `somefile.pb' (decoded by scripts/logf-decode.py):
+ * logf_register(&logf_binary_write, logf_binary_new("somefile.pb"));
+ *
+ * // Log to file `somefile.log' asynchronously from a writer thread:
+ * void *async = logf_async_new(&logf_file_write, logf_file_new("somefile.log"));
+ * logf_register(&logf_async_write, async);
  * @endcode
  */
 
@@ -69,6 +76,44 @@ typedef enum {
 
 typedef struct logf_handler logf_handler_t;
 
+/*
+ * Global minimum priority of the build. Messages of lower priority are compiled out in
+ * all files regardless of LOGF_LOG_MIN_PRIO, e.g., with -DLOGF_BUILD_MIN_PRIO=LOGF_PRIO_INFO
+ */
+#ifndef LOGF_BUILD_MIN_PRIO
+#define LOGF_BUILD_MIN_PRIO LOGF_PRIO_TRACE
+#endif
+
+/**
+ * The lowest priority of all registered handlers, LOGF_PRIO_SILENT if there are none.
+ * Only used implicitly by the logging macros to skip arguments and formatting of
+ * messages which no handler would write.
+ */
+extern logf_prio_t logf_handlers_min_prio;
+
+// the rate limited logging macros allow bursts of 10 messages, refilled every 500ms
+#define LOGF_RATELIMIT_BURST 10
+#define LOGF_RATELIMIT_REFILL_MS 500
+
+/**
+ * Token bucket of a call site of the rate limited logging macros.
+ */
+typedef struct {
+	unsigned long long stamp_ms; // time of the last refill, 0 if not used yet
+	unsigned tokens;
+	unsigned suppressed;
+} logf_ratelimit_t;
+
+/**
+ * This function is only implicitly used by the rate limited logging macros.
+ * Takes a token from the bucket of the call site. If a token was available and
+ * messages of the call site have been suppressed before, their number is logged.
+ *
+ * @return 1 if the message may be logged, 0 if it is suppressed
+ */
+int
+logf_ratelimit(logf_ratelimit_t *rl, logf_prio_t prio, const char *file, int line);
+
 /**
  * This function is only implicitly used by the logging macros defined in macro.h
  */
@@ -135,20 +180,21 @@ logf_message_file_hexdump(logf_prio_t prio, const char *file, int line, const vo
 #ifndef LOGF_LOG_MIN_PRIO
 #define LOGF_LOG_MIN_PRIO LOGF_PRIO_INFO
 #endif
+#define LOGF_RATELIMIT_FILE ((const char *)0)
 
 #define logf_message_guard(level, ...)                                                             \
 	do {                                                                                       \
-		if (level >= LOGF_LOG_MIN_PRIO)                                                    \
+		if (logf_prio_enabled(level))                                                      \
 			logf_message(level, __VA_ARGS__);                                          \
 	} while (0)
 #define logf_message_errno_guard(level, ...)                                                       \
 	do {                                                                                       \
-		if (level >= LOGF_LOG_MIN_PRIO)                                                    \
+		if (logf_prio_enabled(level))                                                      \
 			logf_message_errno(level, __VA_ARGS__);                                    \
 	} while (0)
 #define logf_message_hexdump_guard(level, buf, len, ...)                                           \
 	do {                                                                                       \
-		if (level >= LOGF_LOG_MIN_PRIO)                                                    \
+		if (logf_prio_enabled(level))                                                      \
 			logf_message_hexdump(level, buf, len, __VA_ARGS__);                        \
 	} while (0)
 
@@ -162,26 +208,49 @@ logf_message_file_hexdump(logf_prio_t prio, const char *file, int line, const vo
 #ifndef LOGF_LOG_MIN_PRIO
 #define LOGF_LOG_MIN_PRIO LOGF_PRIO_DEBUG
 #endif
+#define LOGF_RATELIMIT_FILE __FILE__
 
 #define logf_message_guard(level, ...)                                                             \
 	do {                                                                                       \
-		if (level >= LOGF_LOG_MIN_PRIO)                                                    \
+		if (logf_prio_enabled(level))                                                      \
 			logf_message_file(level, __FILE__, __LINE__, __VA_ARGS__);                 \
 	} while (0)
 #define logf_message_errno_guard(level, ...)                                                       \
 	do {                                                                                       \
-		if (level >= LOGF_LOG_MIN_PRIO)                                                    \
+		if (logf_prio_enabled(level))                                                      \
 			logf_message_file_errno(level, __FILE__, __LINE__, __VA_ARGS__);           \
 	} while (0)
 #define logf_message_hexdump_guard(level, buf, len, ...)                                           \
 	do {                                                                                       \
-		if (level >= LOGF_LOG_MIN_PRIO)                                                    \
+		if (logf_prio_enabled(level))                                                      \
 			logf_message_file_hexdump(level, __FILE__, __LINE__, buf, len,             \
 						  __VA_ARGS__);                                    \
 	} while (0)
 
 #endif /* DEBUG_BUILD */
 
+/**
+ * True if messages of the given priority are logged, i.e., if they are neither compiled
+ * out nor below the priority of all registered handlers. The arguments of the logging
+ * macros are only evaluated if this is true. May also be used to guard the preparation
+ * of expensive log output.
+ */
+#define logf_prio_enabled(level)                                                                   \
+	((level) >= LOGF_LOG_MIN_PRIO && (level) >= LOGF_BUILD_MIN_PRIO &&                         \
+	 (level) >= logf_handlers_min_prio)
+
+/*
+ * Rate limited variant of the given guard for messages which may be logged at a high
+ * rate, e.g., in error paths of event handlers. Each call site has its own token bucket.
+ */
+#define logf_message_ratelimit_guard(level, guard, ...)                                            \
+	do {                                                                                       \
+		static logf_ratelimit_t logf_ratelimit_state;                                      \
+		if (logf_prio_enabled(level) &&                                                    \
+		    logf_ratelimit(&logf_ratelimit_state, level, LOGF_RATELIMIT_FILE, __LINE__))   \
+			guard(level, __VA_ARGS__);                                                 \
+	} while (0)
+
 #define logf_fatal(...) logf_message_guard(LOGF_PRIO_FATAL, __VA_ARGS__)
 #define logf_fatal_errno(...) logf_message_errno_guard(LOGF_PRIO_FATAL, __VA_ARGS__)
 
@@ -200,6 +269,31 @@ logf_message_file_hexdump(logf_prio_t prio, const char *file, int line, const vo
 #define logf_trace(...) logf_message_guard(LOGF_PRIO_TRACE, __VA_ARGS__)
 #define logf_trace_errno(...) logf_message_errno_guard(LOGF_PRIO_TRACE, __VA_ARGS__)
 
+#define logf_error_ratelimit(...)                                                                  \
+	logf_message_ratelimit_guard(LOGF_PRIO_ERROR, logf_message_guard, __VA_ARGS__)
+#define logf_error_errno_ratelimit(...)                                                            \
+	logf_message_ratelimit_guard(LOGF_PRIO_ERROR, logf_message_errno_guard, __VA_ARGS__)
+
+#define logf_warn_ratelimit(...)                                                                   \
+	logf_message_ratelimit_guard(LOGF_PRIO_WARN, logf_message_guard, __VA_ARGS__)
+#define logf_warn_errno_ratelimit(...)                                                             \
+	logf_message_ratelimit_guard(LOGF_PRIO_WARN, logf_message_errno_guard, __VA_ARGS__)
+
+#define logf_info_ratelimit(...)                                                                   \
+	logf_message_ratelimit_guard(LOGF_PRIO_INFO, logf_message_guard, __VA_ARGS__)
+#define logf_info_errno_ratelimit(...)                                                             \
+	logf_message_ratelimit_guard(LOGF_PRIO_INFO, logf_message_errno_guard, __VA_ARGS__)
+
+#define logf_debug_ratelimit(...)                                                                  \
+	logf_message_ratelimit_guard(LOGF_PRIO_DEBUG, logf_message_guard, __VA_ARGS__)
+#define logf_debug_errno_ratelimit(...)                                                            \
+	logf_message_ratelimit_guard(LOGF_PRIO_DEBUG, logf_message_errno_guard, __VA_ARGS__)
+
+#define logf_trace_ratelimit(...)                                                                  \
+	logf_message_ratelimit_guard(LOGF_PRIO_TRACE, logf_message_guard, __VA_ARGS__)
+#define logf_trace_errno_ratelimit(...)                                                            \
+	logf_message_ratelimit_guard(LOGF_PRIO_TRACE, logf_message_errno_guard, __VA_ARGS__)
+
 #define logf_error_hexdump(...) logf_message_hexdump_guard(LOGF_PRIO_ERROR, __VA_ARGS__)
 
 #define logf_info_hexdump(...) logf_message_hexdump_guard(LOGF_PRIO_INFO, __VA_ARGS__)
@@ -288,6 +382,37 @@ logf_file_write(logf_prio_t prio, const char *msg, void *data);
 void
 logf_test_write(logf_prio_t prio, const char *msg, void *data);
 
+/**
+ * Opens the binary log file for logf_binary_write.
+ * This will append a unique timestamp to the filename like logf_file_new.
+ *
+ * @param name Name of the log file.
+ * @return A pointer to the binary log.
+ */
+void *
+logf_binary_new(const char *name);
+
+/**
+ * Closes the binary log returned by logf_binary_new.
+ *
+ * @param binary A pointer to the binary log.
+ */
+void
+logf_binary_close(void *binary);
+
+/**
+ * Logs LogRecords of logf.proto with the priority, call site, pid, monotonic timestamp
+ * and message, each preceded by its length as varint. The call site is only known if
+ * this writer is registered directly, through logf_async_write it remains a prefix of
+ * the message.
+ *
+ * @param prio Priority of the log message.
+ * @param msg The log message.
+ * @param data The binary log.
+ */
+void
+logf_binary_write(logf_prio_t prio, const char *msg, void *data);
+
 /**
  * Opens syslog for logf_syslog_write and sets the log tag.
  *
@@ -345,4 +470,55 @@ logf_klog_new(const char *name);
 void
 logf_klog_write(logf_prio_t prio, const char *msg, void *data);
 
+/**
+ * Starts a writer thread for logf_async_write, which writes the log messages queued
+ * by logf_async_write with one of the logf_*_write functions, e.g., logf_file_write.
+ * Messages are queued into a lock-free ring buffer and written in batches. If the ring
+ * is full, messages are dropped and the number of dropped messages is logged once the
+ * writer has caught up. If the writer thread cannot be started, or in a child process,
+ * the messages are written synchronously.
+ *
+ * @param func The log writer used by the writer thread.
+ * @param data The data of the log writer, e.g., the log file.
+ * @return A pointer to the async logger.
+ */
+void *
+logf_async_new(void (*func)(logf_prio_t prio, const char *msg, void *data), void *data);
+
+/**
+ * Queues a log message for the writer thread. Fatal messages are flushed before
+ * returning, since the process is about to abort.
+ *
+ * @param prio Priority of the log message.
+ * @param msg The log message.
+ * @param data The async logger returned by logf_async_new.
+ */
+void
+logf_async_write(logf_prio_t prio, const char *msg, void *data);
+
+/**
+ * Waits (at most one second) until all messages queued so far are written.
+ *
+ * @param async The async logger returned by logf_async_new.
+ */
+void
+logf_async_flush(void *async);
+
+/**
+ * Returns the number of messages dropped since the ring buffer was full.
+ *
+ * @param async The async logger returned by logf_async_new.
+ */
+unsigned long
+logf_async_get_dropped(void *async);
+
+/**
+ * Writes all queued messages, stops the writer thread and frees the async logger.
+ * The data of the log writer, e.g., the log file, is not closed.
+ *
+ * @param async The async logger returned by logf_async_new.
+ */
+void
+logf_async_free(void *async);
+
 #endif /* LOGF_H */
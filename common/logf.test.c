@@ -0,0 +1,401 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "munit.h"
+
+// compile out DEBUG and TRACE messages in this file, see test_build_min_prio
+#define LOGF_BUILD_MIN_PRIO LOGF_PRIO_INFO
+
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_MSGS 1000
+
+static int test_count;
+static int test_warn_count;
+static bool test_in_order;
+static bool test_blocked;
+static pthread_mutex_t test_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t test_cond = PTHREAD_COND_INITIALIZER;
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+
+	test_count = 0;
+	test_warn_count = 0;
+	test_in_order = true;
+	test_blocked = false;
+	return NULL;
+}
+
+static void
+tear_down(UNUSED void *fixture)
+{
+	// No clean-up needed for now
+}
+
+// counts the messages, which are expected as "msg <n>" in order, blocks if test_blocked
+static void
+test_write(logf_prio_t prio, const char *msg, UNUSED void *data)
+{
+	pthread_mutex_lock(&test_lock);
+	while (test_blocked)
+		pthread_cond_wait(&test_cond, &test_lock);
+	pthread_mutex_unlock(&test_lock);
+
+	if (prio == LOGF_PRIO_WARN) {
+		test_warn_count++;
+		return;
+	}
+
+	int n = -1;
+	if (sscanf(msg, "msg %d", &n) != 1 || n < test_count || prio != LOGF_PRIO_INFO)
+		test_in_order = false;
+	test_count++;
+}
+
+static void
+test_unblock(void)
+{
+	pthread_mutex_lock(&test_lock);
+	test_blocked = false;
+	pthread_cond_broadcast(&test_cond);
+	pthread_mutex_unlock(&test_lock);
+}
+
+static MunitResult
+test_async_order(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	void *async = logf_async_new(&test_write, NULL);
+	char buf[64];
+
+	for (int i = 0; i < TEST_MSGS; i++) {
+		snprintf(buf, sizeof(buf), "msg %d", i);
+		logf_async_write(LOGF_PRIO_INFO, buf, async);
+	}
+	logf_async_flush(async);
+
+	munit_assert_int(test_count, ==, TEST_MSGS);
+	munit_assert_true(test_in_order);
+	munit_assert_int(test_warn_count, ==, 0);
+	munit_assert_ulong(logf_async_get_dropped(async), ==, 0);
+
+	logf_async_free(async);
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_async_drop(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	void *async = logf_async_new(&test_write, NULL);
+	char *buf = mem_new0(char, 4096);
+
+	// the writer blocks on the first message, so that the ring fills up
+	test_blocked = true;
+	for (int i = 0; i < TEST_MSGS; i++) {
+		memset(buf, 'x', 4095);
+		snprintf(buf, 32, "msg %d", i);
+		buf[strlen(buf)] = ' ';
+		logf_async_write(LOGF_PRIO_INFO, buf, async);
+	}
+	unsigned long dropped = logf_async_get_dropped(async);
+	munit_assert_ulong(dropped, >, 0);
+	munit_assert_ulong(dropped, <, TEST_MSGS);
+
+	test_unblock();
+	// messages are accepted again, once the writer caught up
+	logf_async_flush(async);
+	snprintf(buf, 32, "msg %d", TEST_MSGS);
+	logf_async_write(LOGF_PRIO_INFO, buf, async);
+	logf_async_free(async);
+
+	munit_assert_int(test_count + dropped, ==, TEST_MSGS + 1);
+	munit_assert_true(test_in_order);
+	munit_assert_int(test_warn_count, ==, 1);
+
+	mem_free0(buf);
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_async_file(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	FILE *f = tmpfile();
+	munit_assert_not_null(f);
+
+	void *async = logf_async_new(&logf_file_write, f);
+	logf_async_write(LOGF_PRIO_INFO, "first", async);
+	logf_async_write(LOGF_PRIO_ERROR, "second", async);
+	logf_async_free(async);
+
+	char line[256];
+	char *expected = mem_printf("[%u] <INFO>  first\n", getpid());
+	rewind(f);
+	munit_assert_not_null(fgets(line, sizeof(line), f));
+	// rfc3339 timestamp, followed by the message
+	munit_assert_char(line[4], ==, '-');
+	munit_assert_char(line[10], ==, 'T');
+	munit_assert_not_null(strstr(line, expected));
+	mem_free0(expected);
+
+	expected = mem_printf("[%u] <ERROR> second\n", getpid());
+	munit_assert_not_null(fgets(line, sizeof(line), f));
+	munit_assert_not_null(strstr(line, expected));
+	munit_assert_null(fgets(line, sizeof(line), f));
+	mem_free0(expected);
+
+	fclose(f);
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_build_min_prio(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	int evaluated = 0;
+
+	// arguments of messages below the minimum priority are not evaluated
+	TRACE("trace %d", evaluated++);
+	DEBUG("debug %d", evaluated++);
+	munit_assert_int(evaluated, ==, 0);
+	munit_assert_false(logf_prio_enabled(LOGF_PRIO_DEBUG));
+
+	INFO("info %d", evaluated++);
+	munit_assert_int(evaluated, ==, 1);
+	munit_assert_true(logf_prio_enabled(LOGF_PRIO_INFO));
+
+	return MUNIT_OK;
+}
+
+static int test_suppressed;
+
+static void
+test_ratelimit_write(UNUSED logf_prio_t prio, const char *msg, UNUSED void *data)
+{
+	unsigned n;
+
+	// debug builds prefix the messages with the call site
+	const char *p = strstr(msg, ": ");
+	if (sscanf(p ? p + 2 : msg, "%u messages suppressed", &n) == 1)
+		test_suppressed += n;
+	else if (strstr(msg, "storm"))
+		test_count++;
+}
+
+static void
+test_storm(int i)
+{
+	WARN_RATELIMIT("storm %d", i);
+}
+
+static MunitResult
+test_ratelimit(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	logf_handler_t *h = logf_register(&test_ratelimit_write, NULL);
+	test_suppressed = 0;
+
+	// only a burst passes, the remaining messages of the call site are counted
+	for (int i = 0; i < TEST_MSGS; i++)
+		test_storm(i);
+	munit_assert_int(test_count, ==, LOGF_RATELIMIT_BURST);
+	munit_assert_int(test_suppressed, ==, 0);
+
+	// another call site has its own bucket
+	WARN_RATELIMIT("storm elsewhere");
+	munit_assert_int(test_count, ==, LOGF_RATELIMIT_BURST + 1);
+
+	// after a refill, the number of suppressed messages precedes the next message
+	usleep((LOGF_RATELIMIT_REFILL_MS + 50) * 1000);
+	test_storm(TEST_MSGS);
+	test_storm(TEST_MSGS + 1);
+	munit_assert_int(test_count, ==, LOGF_RATELIMIT_BURST + 2);
+	munit_assert_int(test_suppressed, ==, TEST_MSGS - LOGF_RATELIMIT_BURST);
+
+	logf_unregister(h);
+	return MUNIT_OK;
+}
+
+static unsigned long long
+test_varint(const uint8_t **p)
+{
+	unsigned long long v = 0;
+	for (int shift = 0;; shift += 7) {
+		uint8_t b = *(*p)++;
+		v |= (unsigned long long)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return v;
+	}
+}
+
+static MunitResult
+test_binary(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	char dir[] = "/tmp/logf-test-XXXXXX";
+	munit_assert_not_null(mkdtemp(dir));
+
+	char *name = mem_printf("%s/log.pb", dir);
+	void *binary = logf_binary_new(name);
+	logf_handler_t *h = logf_register(&logf_binary_write, binary);
+	WARN("binary %d", 42);
+	logf_unregister(h);
+	logf_binary_close(binary);
+	mem_free0(name);
+
+	DIR *d = opendir(dir);
+	munit_assert_not_null(d);
+	struct dirent *de;
+	while ((de = readdir(d)) && de->d_name[0] == '.')
+		;
+	munit_assert_not_null(de);
+	name = mem_printf("%s/%s", dir, de->d_name);
+	closedir(d);
+
+	uint8_t buf[512];
+	FILE *f = fopen(name, "r");
+	munit_assert_not_null(f);
+	size_t len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	unlink(name);
+	rmdir(dir);
+	mem_free0(name);
+
+	// a single length prefixed LogRecord
+	const uint8_t *p = buf;
+	size_t rec_len = test_varint(&p);
+	munit_assert_size(rec_len + (p - buf), ==, len);
+
+	const uint8_t *end = p + rec_len;
+	unsigned long long fields[8] = { 0 };
+	const char *msg = NULL, *file = NULL;
+	size_t msg_len = 0, file_len = 0;
+	while (p < end) {
+		unsigned long long key = test_varint(&p);
+		munit_assert_ullong(key >> 3, <, 8);
+		if ((key & 7) == 2) {
+			size_t n = test_varint(&p);
+			if (key >> 3 == 2) {
+				file = (const char *)p;
+				file_len = n;
+			} else if (key >> 3 == 6) {
+				msg = (const char *)p;
+				msg_len = n;
+			}
+			p += n;
+		} else {
+			fields[key >> 3] = test_varint(&p);
+		}
+	}
+	munit_assert_ullong(fields[1], ==, LOGF_PRIO_WARN);
+	munit_assert_ullong(fields[4], ==, (unsigned long long)getpid());
+	munit_assert_ullong(fields[5], >, 0);
+	munit_assert_ullong(fields[7], >, 0);
+	munit_assert_not_null(msg);
+	munit_assert_memory_equal(msg_len, msg, "binary 42");
+	munit_assert_size(msg_len, ==, strlen("binary 42"));
+#ifdef DEBUG_BUILD
+	// the call site is stored separately instead of prefixing the message
+	munit_assert_not_null(file);
+	munit_assert_size(file_len, >=, strlen("logf.test.c"));
+	munit_assert_memory_equal(strlen("logf.test.c"), file + file_len - strlen("logf.test.c"),
+				  "logf.test.c");
+	munit_assert_ullong(fields[3], >, 0);
+#else
+	(void)file;
+	(void)file_len;
+#endif
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/async order",		/* name */
+		test_async_order,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/async drop",		/* name */
+		test_async_drop,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/async file",		/* name */
+		test_async_file,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/build min prio",	/* name */
+		test_build_min_prio,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/ratelimit",		/* name */
+		test_ratelimit,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/binary",		/* name */
+		test_binary,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite logf_suite = {
+	"/logf",		/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
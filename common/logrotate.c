@@ -0,0 +1,358 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "logrotate.h"
+
+#include "dir.h"
+#include "event.h"
+#include "list.h"
+#include "logf.h"
+#include "macro.h"
+#include "mem.h"
+
+#include <errno.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// interval in which the size and the age of the log file are checked
+#define LOGROTATE_CHECK_INTERVAL 60000
+// nice value of the compressing child, which must not compete with the daemon
+#define LOGROTATE_CHILD_NICE 10
+
+struct logrotate {
+	char *name;
+	FILE *file;
+	time_t opened;
+	size_t max_size;
+	unsigned int max_age;
+	unsigned int keep;
+	logrotate_callback_t cb;
+	void *data;
+	event_timer_t *timer;
+	event_child_t *child;
+	bool pending; // rotated while the child was running
+};
+
+typedef struct logrotate_entry {
+	char *file;
+	time_t mtime;
+} logrotate_entry_t;
+
+typedef struct logrotate_dir {
+	const char *prefix;
+	struct stat current;
+	bool has_current;
+	list_t *entries; // logrotate_entry_t
+} logrotate_dir_t;
+
+static time_t
+logrotate_now(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+	return ts.tv_sec;
+}
+
+static bool
+logrotate_is_compressed(const char *file)
+{
+	size_t len = strlen(file);
+	size_t suffix_len = strlen(LOGROTATE_SUFFIX);
+	return len > suffix_len && !strcmp(file + len - suffix_len, LOGROTATE_SUFFIX);
+}
+
+/*
+ * Collects the rotated files of a log file, i.e., all files named <name>.<timestamp>, except the
+ * file which is currently written. The current file is identified by its inode, as cmld may
+ * rename log files created before the system time was set, see cmld_rename_logfiles().
+ */
+static int
+logrotate_collect_cb(const char *path, const char *file, void *data)
+{
+	logrotate_dir_t *dir = data;
+	struct stat st;
+
+	if (strncmp(file, dir->prefix, strlen(dir->prefix)))
+		return 0;
+
+	char *file_path = mem_printf("%s/%s", path, file);
+	int ret = lstat(file_path, &st);
+	mem_free0(file_path);
+	if (ret < 0 || !S_ISREG(st.st_mode))
+		return 0;
+	if (dir->has_current && st.st_dev == dir->current.st_dev &&
+	    st.st_ino == dir->current.st_ino)
+		return 0;
+
+	logrotate_entry_t *entry = mem_new0(logrotate_entry_t, 1);
+	entry->file = mem_printf("%s/%s", path, file);
+	entry->mtime = st.st_mtime;
+	dir->entries = list_append(dir->entries, entry);
+	return 0;
+}
+
+static list_t *
+logrotate_collect(const char *name, FILE *current)
+{
+	char *dir_name = mem_strdup(name);
+	char *base_name = mem_strdup(name);
+	char *prefix = mem_printf("%s.", basename(base_name));
+	logrotate_dir_t dir = { .prefix = prefix, .entries = NULL };
+
+	dir.has_current = current && !fstat(fileno(current), &dir.current);
+	if (dir_foreach(dirname(dir_name), &logrotate_collect_cb, &dir) < 0)
+		WARN("Could not list rotated files of %s", name);
+
+	mem_free0(prefix);
+	mem_free0(base_name);
+	mem_free0(dir_name);
+	return dir.entries;
+}
+
+static void
+logrotate_entries_free(list_t *entries)
+{
+	for (list_t *l = entries; l; l = l->next) {
+		logrotate_entry_t *entry = l->data;
+		mem_free0(entry->file);
+		mem_free0(entry);
+	}
+	list_delete(entries);
+}
+
+static int
+logrotate_entry_compare(const void *a, const void *b)
+{
+	const logrotate_entry_t *ea = *(logrotate_entry_t *const *)a;
+	const logrotate_entry_t *eb = *(logrotate_entry_t *const *)b;
+
+	if (ea->mtime != eb->mtime)
+		return ea->mtime < eb->mtime ? -1 : 1;
+	return strcmp(ea->file, eb->file);
+}
+
+int
+logrotate_prune(const char *name, FILE *current, unsigned int keep)
+{
+	IF_NULL_RETVAL(name, -1);
+
+	list_t *entries = logrotate_collect(name, current);
+	size_t n = list_length(entries);
+	int deleted = 0;
+
+	if (n > keep) {
+		logrotate_entry_t **sorted = mem_new0(logrotate_entry_t *, n);
+		size_t i = 0;
+		for (list_t *l = entries; l; l = l->next)
+			sorted[i++] = l->data;
+		qsort(sorted, n, sizeof(logrotate_entry_t *), &logrotate_entry_compare);
+
+		for (i = 0; i < n - keep; i++) {
+			DEBUG("Deleting rotated log file %s", sorted[i]->file);
+			if (unlink(sorted[i]->file) < 0)
+				WARN_ERRNO("Could not delete rotated log file %s", sorted[i]->file);
+			else
+				deleted++;
+		}
+		mem_free0(sorted);
+	}
+
+	logrotate_entries_free(entries);
+	return deleted;
+}
+
+/*
+ * Compresses a rotated file with zstd, which removes the uncompressed file on success.
+ * This runs in the logrotate child, thus the log of the daemon is not used on errors.
+ */
+static int
+logrotate_compress(const char *file)
+{
+	const char *const argv[] = { "zstd", "-q", "-f", "--rm", file, NULL };
+	int status;
+
+	pid_t pid = fork();
+	switch (pid) {
+	case -1:
+		return -1;
+	case 0:
+		execvp(argv[0], (char *const *)argv);
+		_exit(127);
+	default:
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR)
+				return -1;
+		}
+		return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+	}
+}
+
+static int
+logrotate_child_main(const char *name, FILE *current, unsigned int keep)
+{
+	int ret = 0;
+
+	if (nice(LOGROTATE_CHILD_NICE) < 0)
+		TRACE_ERRNO("Could not lower priority of logrotate child");
+
+	list_t *entries = logrotate_collect(name, current);
+	for (list_t *l = entries; l; l = l->next) {
+		logrotate_entry_t *entry = l->data;
+		if (logrotate_is_compressed(entry->file))
+			continue;
+		if (logrotate_compress(entry->file) < 0)
+			ret = -1;
+	}
+	logrotate_entries_free(entries);
+
+	if (keep && logrotate_prune(name, current, keep) < 0)
+		ret = -1;
+	return ret;
+}
+
+static void
+logrotate_start_child(logrotate_t *rotate);
+
+static void
+logrotate_child_cb(pid_t pid, int status, event_child_t *child, void *data)
+{
+	logrotate_t *rotate = data;
+	ASSERT(rotate);
+
+	bool success = WIFEXITED(status) && !WEXITSTATUS(status);
+	if (success)
+		DEBUG("Compressed rotated files of %s (PID=%d)", rotate->name, pid);
+	else
+		WARN("Could not compress all rotated files of %s (PID=%d)", rotate->name, pid);
+
+	event_child_free(child);
+	rotate->child = NULL;
+
+	if (rotate->pending)
+		logrotate_start_child(rotate);
+}
+
+static void
+logrotate_start_child(logrotate_t *rotate)
+{
+	// the running child would race with a second one for the same files
+	if (rotate->child) {
+		rotate->pending = true;
+		return;
+	}
+	rotate->pending = false;
+
+	pid_t pid = fork();
+	switch (pid) {
+	case -1:
+		ERROR_ERRNO("Could not fork to compress rotated files of %s", rotate->name);
+		return;
+	case 0:
+		_exit(logrotate_child_main(rotate->name, rotate->file, rotate->keep) < 0 ? 1 : 0);
+	default:
+		rotate->child = event_child_new(pid, &logrotate_child_cb, rotate);
+		event_add_child(rotate->child);
+	}
+}
+
+int
+logrotate_rotate(logrotate_t *rotate)
+{
+	IF_NULL_RETVAL(rotate, -1);
+
+	DEBUG("Rotating log file %s", rotate->name);
+	FILE *file = logf_file_new(rotate->name);
+	IF_NULL_RETVAL(file, -1);
+
+	rotate->cb(file, rotate->data);
+	rotate->file = file;
+	rotate->opened = logrotate_now();
+
+	logrotate_start_child(rotate);
+	return 0;
+}
+
+static void
+logrotate_timer_cb(UNUSED event_timer_t *timer, void *data)
+{
+	logrotate_t *rotate = data;
+	ASSERT(rotate);
+
+	struct stat st;
+	if (rotate->max_size && !fstat(fileno(rotate->file), &st) &&
+	    (size_t)st.st_size >= rotate->max_size) {
+		DEBUG("Log file %s exceeds %zu bytes", rotate->name, rotate->max_size);
+		logrotate_rotate(rotate);
+	} else if (rotate->max_age && logrotate_now() - rotate->opened >= rotate->max_age) {
+		DEBUG("Log file %s is older than %u seconds", rotate->name, rotate->max_age);
+		logrotate_rotate(rotate);
+	}
+}
+
+logrotate_t *
+logrotate_new(const char *name, FILE *file, size_t max_size, unsigned int max_age,
+	      unsigned int keep, logrotate_callback_t cb, void *data)
+{
+	IF_NULL_RETVAL(name, NULL);
+	IF_NULL_RETVAL(file, NULL);
+	IF_NULL_RETVAL(cb, NULL);
+
+	logrotate_t *rotate = mem_new0(logrotate_t, 1);
+	rotate->name = mem_strdup(name);
+	rotate->file = file;
+	rotate->opened = logrotate_now();
+	rotate->max_size = max_size;
+	rotate->max_age = max_age;
+	rotate->keep = keep;
+	rotate->cb = cb;
+	rotate->data = data;
+
+	rotate->timer = event_timer_new(LOGROTATE_CHECK_INTERVAL, EVENT_TIMER_REPEAT_FOREVER,
+					&logrotate_timer_cb, rotate);
+	event_add_timer(rotate->timer);
+
+	// compress the files rotated before, e.g., in a previous boot
+	logrotate_start_child(rotate);
+	return rotate;
+}
+
+void
+logrotate_free(logrotate_t *rotate)
+{
+	IF_NULL_RETURN(rotate);
+
+	event_remove_timer(rotate->timer);
+	event_timer_free(rotate->timer);
+	// a running child is not waited for, it only works on rotated files
+	if (rotate->child)
+		event_child_free(rotate->child);
+	mem_free0(rotate->name);
+	mem_free0(rotate);
+}
@@ -0,0 +1,93 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/**
+  * @file logrotate.h
+  *
+  * Rotates log files opened by logf_file_new() once they exceed a size or an age. The rotation
+  * itself only opens a new file on the event loop, the rotated files are compressed with zstd
+  * by a child process, which also deletes the oldest rotated files beyond a retention limit.
+  */
+
+#ifndef LOGROTATE_H
+#define LOGROTATE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/** Suffix of rotated log files compressed by the logrotate child. */
+#define LOGROTATE_SUFFIX ".zst"
+
+typedef struct logrotate logrotate_t;
+
+/**
+ * Called on rotation with the new log file. The callback replaces the registered log handler
+ * of the previous file, which it closes afterwards, with one for the new file.
+ */
+typedef void (*logrotate_callback_t)(FILE *file, void *data);
+
+/**
+ * Starts rotating the given log file. The size and the age of the log file are checked
+ * periodically on the event loop. Rotated files which are still uncompressed, e.g., from a
+ * previous boot, are compressed right away.
+ *
+ * @param name The name of the log file as passed to logf_file_new().
+ * @param file The log file currently registered, as returned by logf_file_new().
+ * @param max_size The size in bytes after which the log file is rotated, 0 for no limit.
+ * @param max_age The time in seconds after which the log file is rotated, 0 for no limit.
+ * @param keep The number of rotated files to keep, 0 to keep all.
+ * @param cb The callback which registers a new log file.
+ * @param data Data passed to the callback.
+ * @return The logrotate object or NULL on error.
+ */
+logrotate_t *
+logrotate_new(const char *name, FILE *file, size_t max_size, unsigned int max_age,
+	      unsigned int keep, logrotate_callback_t cb, void *data);
+
+/**
+ * Stops rotating the log file. The log file itself is left open.
+ */
+void
+logrotate_free(logrotate_t *rotate);
+
+/**
+ * Rotates the log file immediately, regardless of its size and age.
+ *
+ * @return -1 on error else 0.
+ */
+int
+logrotate_rotate(logrotate_t *rotate);
+
+/**
+ * Deletes the oldest rotated files of the log file with the given name, such that at most
+ * keep of them are left. The logrotate child calls this after compressing the rotated files.
+ *
+ * @param name The name of the log file as passed to logf_file_new().
+ * @param current The log file currently written, which is never deleted, or NULL.
+ * @param keep The number of rotated files to keep.
+ * @return The number of deleted files or -1 on error.
+ */
+int
+logrotate_prune(const char *name, FILE *current, unsigned int keep);
+
+#endif /* LOGROTATE_H */
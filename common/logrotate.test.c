@@ -0,0 +1,136 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "munit.h"
+
+#include "logrotate.h"
+#include "dir.h"
+#include "file.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define TEST_ROTATED_FILES 5
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	logf_register(&logf_test_write, stderr);
+
+	char *dir = mem_strdup("/tmp/logrotate-test-XXXXXX");
+	munit_assert_not_null(mkdtemp(dir));
+	return dir;
+}
+
+static void
+tear_down(void *fixture)
+{
+	char *dir = fixture;
+	munit_assert_int(dir_delete_folder(dir, ""), ==, 0);
+	rmdir(dir);
+	mem_free0(dir);
+}
+
+static void
+create_rotated(const char *dir, int i, const char *suffix)
+{
+	char *file = mem_printf("%s/test.%d%s", dir, i, suffix);
+	munit_assert_int(file_printf(file, "rotated %d", i), >, 0);
+
+	// the file rotated first is the oldest
+	struct timeval tv[2] = { { .tv_sec = 1000 + i }, { .tv_sec = 1000 + i } };
+	munit_assert_int(utimes(file, tv), ==, 0);
+	mem_free0(file);
+}
+
+static bool
+rotated_exists(const char *dir, int i, const char *suffix)
+{
+	char *file = mem_printf("%s/test.%d%s", dir, i, suffix);
+	bool exists = file_exists(file);
+	mem_free0(file);
+	return exists;
+}
+
+static MunitResult
+test_prune(UNUSED const MunitParameter params[], void *fixture)
+{
+	const char *dir = fixture;
+	char *name = mem_printf("%s/test", dir);
+	char *other = mem_printf("%s/other.1", dir);
+
+	for (int i = 0; i < TEST_ROTATED_FILES; i++)
+		create_rotated(dir, i, i % 2 ? LOGROTATE_SUFFIX : "");
+	munit_assert_int(file_printf(other, "not rotated"), >, 0);
+
+	// the current log file is older than all rotated files, but must be kept anyway
+	FILE *current = logf_file_new(name);
+	munit_assert_not_null(current);
+	struct timeval tv[2] = { { .tv_sec = 1 }, { .tv_sec = 1 } };
+	munit_assert_int(futimes(fileno(current), tv), ==, 0);
+
+	munit_assert_int(logrotate_prune(name, current, TEST_ROTATED_FILES), ==, 0);
+	munit_assert_int(logrotate_prune(name, current, 2), ==, TEST_ROTATED_FILES - 2);
+	for (int i = 0; i < TEST_ROTATED_FILES - 2; i++)
+		munit_assert_false(rotated_exists(dir, i, i % 2 ? LOGROTATE_SUFFIX : ""));
+	munit_assert_true(rotated_exists(dir, 3, LOGROTATE_SUFFIX));
+	munit_assert_true(rotated_exists(dir, 4, ""));
+	munit_assert_true(file_exists(other));
+
+	// without the current log file, it counts as rotated
+	munit_assert_int(logrotate_prune(name, NULL, 2), ==, 1);
+	munit_assert_true(rotated_exists(dir, 3, LOGROTATE_SUFFIX));
+	munit_assert_true(rotated_exists(dir, 4, ""));
+
+	logf_file_close(current);
+	munit_assert_int(logrotate_prune(NULL, NULL, 0), ==, -1);
+	mem_free0(other);
+	mem_free0(name);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/prune",		/* name */
+		test_prune,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite logrotate_suite = {
+	"/logrotate",		/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
@@ -28,16 +28,23 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <sys/sysmacros.h>
 
 #include "loopdev.h"
 
 #include "macro.h"
 #include "mem.h"
+#include "file.h"
 
 #ifndef LOOP_CTL_GET_FREE
 #define LOOP_CTL_GET_FREE 0x4C82
 #endif
 
+#ifndef LOOP_CTL_ADD
+#define LOOP_CTL_ADD 0x4C80
+#endif
+
 #ifdef ANDROID
 #define LOOP_DEV_PREFIX "/dev/block/loop"
 #else
@@ -49,6 +56,89 @@
 #define SECTOR_SHIFT 9
 #define SECTOR_SIZE (1 << SECTOR_SHIFT)
 
+// LOOP_CONFIGURE is available since kernel 5.8
+#ifndef LOOP_CONFIGURE
+#define LOOP_CONFIGURE 0x4C0A
+struct loop_config {
+	__u32 fd;
+	__u32 block_size;
+	struct loop_info64 info;
+	__u64 __reserved[8];
+};
+#endif
+
+// control fd kept open by loopdev_pool_init()
+static int loopdev_control_fd = -1;
+
+static bool loopdev_direct_io = true;
+
+void
+loopdev_set_direct_io(bool enable)
+{
+	loopdev_direct_io = enable;
+}
+
+/**
+ * Get the logical block size of the block device which stores the image file.
+ * Direct I/O requires the block size of the loop device to be a multiple of it.
+ * @return The block size or 0 if it is unknown, e.g., for images on tmpfs.
+ */
+static size_t
+loopdev_backing_block_size(int img_fd)
+{
+	struct stat st;
+	char *path;
+	char *lbs = NULL;
+
+	if (fstat(img_fd, &st) < 0)
+		return 0;
+
+	// partitions do not have a queue, it is provided by the parent disk
+	path = mem_printf("/sys/dev/block/%u:%u/queue/logical_block_size", major(st.st_dev),
+			  minor(st.st_dev));
+	if (!file_exists(path)) {
+		mem_free0(path);
+		path = mem_printf("/sys/dev/block/%u:%u/../queue/logical_block_size",
+				  major(st.st_dev), minor(st.st_dev));
+	}
+	if (file_exists(path))
+		lbs = file_read_new(path, 64);
+	mem_free0(path);
+
+	size_t size = lbs ? strtoul(lbs, NULL, 10) : 0;
+	mem_free0(lbs);
+	return size;
+}
+
+int
+loopdev_pool_init(unsigned int size)
+{
+	char dev[64];
+	struct stat st;
+
+	if (loopdev_control_fd < 0) {
+		loopdev_control_fd = open(LOOP_CONTROL, O_RDONLY | O_CLOEXEC);
+		if (loopdev_control_fd < 0) {
+			ERROR_ERRNO("Cannot open %s", LOOP_CONTROL);
+			return -1;
+		}
+	}
+
+	for (unsigned int i = 0; i < size; i++) {
+		if (snprintf(dev, sizeof(dev), "%s%u", LOOP_DEV_PREFIX, i) < 0)
+			return -1;
+		if (!stat(dev, &st))
+			continue;
+		if (ioctl(loopdev_control_fd, LOOP_CTL_ADD, i) < 0 && errno != EEXIST) {
+			ERROR_ERRNO("Cannot add loop device %s", dev);
+			return -1;
+		}
+	}
+
+	DEBUG("Pre-allocated %u loop devices", size);
+	return 0;
+}
+
 /**
  * Get a free loop device.
  * @return The path of the loop device or NULL in case of an error.
@@ -60,14 +150,15 @@ loopdev_new(void)
 	char dev[64];
 	struct stat st;
 
-	fd = open(LOOP_CONTROL, O_RDONLY);
+	fd = (loopdev_control_fd < 0) ? open(LOOP_CONTROL, O_RDONLY) : loopdev_control_fd;
 	if (fd < 0) {
 		ERROR_ERRNO("Cannot open %s", LOOP_CONTROL);
 		return NULL;
 	}
 
 	i = ioctl(fd, LOOP_CTL_GET_FREE);
-	close(fd);
+	if (fd != loopdev_control_fd)
+		close(fd);
 	if (i < 0) {
 		ERROR("Cannot get free loop device");
 		return NULL;
@@ -91,6 +182,93 @@ loopdev_new(void)
 	return mem_strdup(dev);
 }
 
+/**
+ * Binds the image to the loop device using the ioctls of kernels before 5.8.
+ * @return 0 on success, -1 on error with errno set to EBUSY if the device is in use.
+ */
+static int
+loopdev_configure_legacy(int loop_fd, const char *loop_dev, int img_fd,
+			 const struct loop_info64 *info, size_t blocksize)
+{
+	struct loop_info64 status;
+
+	if (ioctl(loop_fd, LOOP_SET_FD, img_fd) < 0) {
+		if (errno != EBUSY)
+			ERROR_ERRNO("LOOP_SET_FD ioctl failed");
+		return -1;
+	}
+
+	if (blocksize > SECTOR_SIZE) {
+		ioctl(loop_fd, LOOP_SET_BLOCK_SIZE, (unsigned long)blocksize);
+	}
+
+	if (ioctl(loop_fd, LOOP_SET_STATUS64, info) < 0) {
+		ERROR_ERRNO("Failed to set AUTOCLEAR for loop device %s", loop_dev);
+		goto error;
+	}
+
+	mem_memset0(&status, sizeof(status));
+	if (ioctl(loop_fd, LOOP_GET_STATUS64, &status) < 0) {
+		ERROR_ERRNO("Failed to get status64 for loop device %s", loop_dev);
+		goto error;
+	}
+
+	// Verify that autoclear is set
+	if (!(status.lo_flags & LO_FLAGS_AUTOCLEAR)) {
+		ERROR("Autoclear not successfully set");
+		goto error;
+	}
+
+	// bypass the page cache of the loop device, the image is cached by its file system
+	if (loopdev_direct_io && ioctl(loop_fd, LOOP_SET_DIRECT_IO, 1) < 0)
+		DEBUG_ERRNO("Direct I/O not supported for %s, using buffered I/O", loop_dev);
+
+	return 0;
+
+error:
+	ioctl(loop_fd, LOOP_CLR_FD, 0);
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * Binds the image to the loop device atomically using LOOP_CONFIGURE with direct I/O,
+ * falling back to buffered I/O and to loopdev_configure_legacy() on older kernels.
+ * @return 0 on success, -1 on error with errno set to EBUSY if the device is in use.
+ */
+static int
+loopdev_configure(int loop_fd, const char *loop_dev, int img_fd, const struct loop_info64 *info,
+		  size_t blocksize)
+{
+	struct loop_config config;
+	mem_memset0(&config, sizeof(config));
+
+	config.fd = img_fd;
+	config.block_size = (blocksize > SECTOR_SIZE) ? blocksize : 0;
+	config.info = *info;
+	if (loopdev_direct_io)
+		config.info.lo_flags |= LO_FLAGS_DIRECT_IO;
+
+	if (ioctl(loop_fd, LOOP_CONFIGURE, &config) == 0)
+		return 0;
+
+	// direct I/O may be rejected, e.g., if the image is stored on tmpfs
+	if (errno == EINVAL && loopdev_direct_io) {
+		config.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+		if (ioctl(loop_fd, LOOP_CONFIGURE, &config) == 0)
+			return 0;
+	}
+
+	if (errno != EINVAL && errno != ENOTTY) {
+		if (errno != EBUSY)
+			ERROR_ERRNO("LOOP_CONFIGURE ioctl failed");
+		return -1;
+	}
+
+	TRACE("LOOP_CONFIGURE not supported, falling back to LOOP_SET_FD");
+	return loopdev_configure_legacy(loop_fd, loop_dev, img_fd, info, blocksize);
+}
+
 char *
 loopdev_create_new(int *loop_fd, const char *img, int readonly, size_t blocksize)
 {
@@ -99,6 +277,8 @@ loopdev_create_new(int *loop_fd, const char *img, int readonly, size_t blocksize
 	int img_fd;
 	char *loop_dev = NULL;
 
+	*loop_fd = -1;
+
 	img_fd = open(img, (readonly ? O_RDONLY : O_RDWR) | O_EXCL);
 	if (img_fd < 0) {
 		ERROR_ERRNO("Could not open image file %s with readonly = %d", img, readonly);
@@ -109,6 +289,18 @@ loopdev_create_new(int *loop_fd, const char *img, int readonly, size_t blocksize
 	strncpy((char *)info.lo_file_name, img, sizeof(info.lo_file_name) - 1);
 	// Do not require detach after umount
 	info.lo_flags |= LO_FLAGS_AUTOCLEAR;
+	if (readonly)
+		info.lo_flags |= LO_FLAGS_READ_ONLY;
+
+	// align the default block size to the backing device, otherwise direct I/O fails
+	if (loopdev_direct_io && blocksize == 0) {
+		size_t backing_blocksize = loopdev_backing_block_size(img_fd);
+		if (backing_blocksize > SECTOR_SIZE) {
+			TRACE("Using block size %zu of backing device for %s", backing_blocksize,
+			      img);
+			blocksize = backing_blocksize;
+		}
+	}
 
 	do {
 		loop_dev = loopdev_new();
@@ -123,11 +315,10 @@ loopdev_create_new(int *loop_fd, const char *img, int readonly, size_t blocksize
 			goto error;
 		}
 
-		if (ioctl(*loop_fd, LOOP_SET_FD, img_fd) < 0) {
-			if (errno != EBUSY) {
-				ERROR_ERRNO("LOOP_SET_FD ioctl failed");
+		// the free device may have been taken concurrently, retry with the next one
+		if (loopdev_configure(*loop_fd, loop_dev, img_fd, &info, blocksize) < 0) {
+			if (errno != EBUSY)
 				goto error;
-			}
 			mem_free(loop_dev);
 			loop_dev = NULL;
 			close(*loop_fd);
@@ -135,29 +326,6 @@ loopdev_create_new(int *loop_fd, const char *img, int readonly, size_t blocksize
 		}
 	} while (*loop_fd < 0);
 
-	if (blocksize > SECTOR_SIZE) {
-		ioctl(*loop_fd, LOOP_SET_BLOCK_SIZE, (unsigned long)blocksize);
-	}
-
-	// TODO For kernel 5.8 and later, LOOP_CONFIGURE could be used instead
-	// (https://man7.org/linux/man-pages/man4/loop.4.html)
-	if (ioctl(*loop_fd, LOOP_SET_STATUS64, &info) < 0) {
-		ERROR_ERRNO("Failed to set AUTOCLEAR for loop device %s", loop_dev);
-		goto error;
-	}
-
-	mem_memset0(&info, sizeof(info));
-	if (ioctl(*loop_fd, LOOP_GET_STATUS64, &info) < 0) {
-		ERROR_ERRNO("Failed to get status64 for loop device %s", loop_dev);
-		goto error;
-	}
-
-	// Verify that autoclear is set
-	if (!(info.lo_flags & LO_FLAGS_AUTOCLEAR)) {
-		ERROR("Autoclear not successfully set");
-		goto error;
-	}
-
 	close(img_fd);
 	return loop_dev;
 
@@ -165,10 +333,8 @@ error:
 	if (img_fd >= 0)
 		close(img_fd);
 
-	if (*loop_fd >= 0) {
-		ioctl(*loop_fd, LOOP_CLR_FD, 0);
+	if (*loop_fd >= 0)
 		close(*loop_fd);
-	}
 	if (loop_dev)
 		mem_free0(loop_dev);
 	return NULL;
@@ -32,12 +32,37 @@
 #ifndef LOOPDEV_H
 #define LOOPDEV_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Pre-allocates the loop devices 0 to size - 1, if they do not exist yet, and keeps
+ * the loop control device open. Thus, setting up many images concurrently does not
+ * have to wait for new loop devices to be created.
+ * @param size The number of loop devices in the pool.
+ * @return 0 on success, -1 on error
+ */
+int
+loopdev_pool_init(unsigned int size);
+
+/**
+ * Enables or disables direct I/O on newly created loop devices, enabled by default.
+ * With direct I/O, the loop device bypasses the page cache of the image file, so
+ * image data is only cached once above the loop device. This saves memory at the
+ * cost of slower rereads of data which was evicted from that cache.
+ * @param enable true to use direct I/O if supported by the backing file system
+ */
+void
+loopdev_set_direct_io(bool enable);
+
 /**
- * Setup a loop device for an image file.
+ * Setup a loop device for an image file. The device is configured atomically with
+ * LOOP_CONFIGURE and uses direct I/O on the image file if supported.
  * @param loop_fd The file descriptor for the newly created loop device
  * @param img The path to an image file.
  * @param readonly 1 for readonly, 0 for read-write
- * @param blocksize The blocksize of the device
+ * @param blocksize The blocksize of the device, 0 for the default, which is aligned
+ *                  to the backing device if direct I/O is enabled
  *
  * @return The path to the newly created loop device on success,
  * otherwise NULL
@@ -85,6 +85,19 @@
 		abort();                                                                           \
 	} while (0)
 
+// rate limited logging for call sites which may flood the log, e.g., hot error paths,
+// see logf_message_ratelimit_guard
+#define TRACE_RATELIMIT(...) logf_trace_ratelimit(__VA_ARGS__)
+#define DEBUG_RATELIMIT(...) logf_debug_ratelimit(__VA_ARGS__)
+#define INFO_RATELIMIT(...) logf_info_ratelimit(__VA_ARGS__)
+#define WARN_RATELIMIT(...) logf_warn_ratelimit(__VA_ARGS__)
+#define ERROR_RATELIMIT(...) logf_error_ratelimit(__VA_ARGS__)
+#define TRACE_ERRNO_RATELIMIT(...) logf_trace_errno_ratelimit(__VA_ARGS__)
+#define DEBUG_ERRNO_RATELIMIT(...) logf_debug_errno_ratelimit(__VA_ARGS__)
+#define INFO_ERRNO_RATELIMIT(...) logf_info_errno_ratelimit(__VA_ARGS__)
+#define WARN_ERRNO_RATELIMIT(...) logf_warn_errno_ratelimit(__VA_ARGS__)
+#define ERROR_ERRNO_RATELIMIT(...) logf_error_errno_ratelimit(__VA_ARGS__)
+
 #define ASSERT(expr)                                                                               \
 	do {                                                                                       \
 		if (!(expr)) {                                                                     \
@@ -22,15 +22,26 @@
  */
 
 #define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 //#define LOGF_LOG_MIN_PRIO LOGF_PRIO_TRACE
 
+// this file implements the plain allocation functions wrapped in MEM_STATS builds
+#define MEM_STATS_NO_WRAP
 #include "mem.h"
 #include "macro.h"
 
+#ifdef MEM_STATS
+#include <pthread.h>
+
+static void
+mem_stats_untrack(void *ptr);
+#endif
+
 #define DEBUG_THRESHOLD(size)                                                                      \
 	do {                                                                                       \
 		if (size > (1024 * 1024))                                                          \
@@ -128,6 +139,9 @@ mem_free_array(void **array, size_t size)
 		while (i < size) {
 			if (array[i] != NULL) {
 				DEBUG("[MEM] Freeing element %zu", i);
+#ifdef MEM_STATS
+				mem_stats_untrack(array[i]);
+#endif
 				mem_free0(array[i]);
 			}
 
@@ -135,6 +149,604 @@ mem_free_array(void **array, size_t size)
 		}
 
 		DEBUG("[MEM] Freeing array");
+#ifdef MEM_STATS
+		mem_stats_untrack(array);
+#endif
 		mem_free0(array);
 	}
 }
+
+#define MEM_ARENA_BLOCK_SIZE 4096
+
+// strictest alignment of fundamental types, as guaranteed by malloc(3)
+typedef union {
+	long double ld;
+	long long ll;
+	void *p;
+} mem_arena_align_t;
+
+#define MEM_ARENA_ALIGNMENT __alignof__(mem_arena_align_t)
+#define MEM_ARENA_ALIGN(size) (((size) + MEM_ARENA_ALIGNMENT - 1) & ~(MEM_ARENA_ALIGNMENT - 1))
+
+typedef struct mem_arena_block mem_arena_block_t;
+struct mem_arena_block {
+	mem_arena_block_t *next;
+	size_t size; /* usable bytes in data */
+	size_t used;
+	mem_arena_align_t data[];
+};
+
+struct mem_arena {
+	mem_arena_block_t *blocks; /* the head is the block currently allocated from */
+	size_t block_size;
+};
+
+static mem_arena_block_t *
+mem_arena_block_new(size_t size)
+{
+	size_t total;
+	if (__builtin_add_overflow(sizeof(mem_arena_block_t), size, &total))
+		FATAL("Detected integer overflow in arena allocation size.");
+
+	mem_arena_block_t *block = mem_alloc(total);
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+
+	return block;
+}
+
+mem_arena_t *
+mem_arena_new(size_t block_size)
+{
+	mem_arena_t *arena = mem_new0(mem_arena_t, 1);
+	arena->block_size = MEM_ARENA_ALIGN(block_size ? block_size : MEM_ARENA_BLOCK_SIZE);
+	arena->blocks = mem_arena_block_new(arena->block_size);
+
+	return arena;
+}
+
+void
+mem_arena_reset(mem_arena_t *arena)
+{
+	IF_NULL_RETURN(arena);
+
+	/*
+	 * Keep the oldest block of the default size. Blocks of the default size are
+	 * prepended, thus it is the last one of them, but large blocks may follow it.
+	 */
+	mem_arena_block_t *keep = NULL;
+	for (mem_arena_block_t *b = arena->blocks; b; b = b->next) {
+		if (b->size == arena->block_size)
+			keep = b;
+	}
+	ASSERT(keep);
+
+	while (arena->blocks) {
+		mem_arena_block_t *next = arena->blocks->next;
+		if (arena->blocks != keep)
+			mem_free0(arena->blocks);
+		arena->blocks = next;
+	}
+	keep->next = NULL;
+	keep->used = 0;
+	arena->blocks = keep;
+}
+
+size_t
+mem_arena_get_size(const mem_arena_t *arena)
+{
+	IF_NULL_RETVAL(arena, 0);
+
+	size_t size = 0;
+	for (const mem_arena_block_t *b = arena->blocks; b; b = b->next)
+		size += b->size;
+	return size;
+}
+
+void
+mem_arena_free(mem_arena_t *arena)
+{
+	IF_NULL_RETURN(arena);
+
+	while (arena->blocks) {
+		mem_arena_block_t *next = arena->blocks->next;
+		mem_free0(arena->blocks);
+		arena->blocks = next;
+	}
+	mem_free0(arena);
+}
+
+void *
+mem_arena_alloc(mem_arena_t *arena, size_t size)
+{
+	ASSERT(arena);
+
+	if (size > SIZE_MAX - MEM_ARENA_ALIGNMENT)
+		FATAL("Detected integer overflow in arena allocation size.");
+	size = MEM_ARENA_ALIGN(size ? size : 1);
+
+	mem_arena_block_t *block = arena->blocks;
+	if (block->size - block->used < size) {
+		if (size > arena->block_size / 4) {
+			/*
+			 * Large allocations get a block of their own behind the current one,
+			 * so that the remaining space of the current block is not wasted.
+			 */
+			mem_arena_block_t *large = mem_arena_block_new(size);
+			large->used = size;
+			large->next = block->next;
+			block->next = large;
+			return large->data;
+		}
+		block = mem_arena_block_new(arena->block_size);
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	void *p = (char *)block->data + block->used;
+	block->used += size;
+
+	return p;
+}
+
+void *
+mem_arena_alloc0(mem_arena_t *arena, size_t size)
+{
+	void *p = mem_arena_alloc(arena, size);
+	memset(p, 0, size);
+	return p;
+}
+
+char *
+mem_arena_strdup(mem_arena_t *arena, const char *str)
+{
+	ASSERT(str);
+
+	size_t len = strlen(str) + 1;
+	return memcpy(mem_arena_alloc(arena, len), str, len);
+}
+
+char *
+mem_arena_vprintf(mem_arena_t *arena, const char *fmt, va_list ap)
+{
+	va_list aq;
+	ASSERT(arena);
+	ASSERT(fmt);
+
+	// try to print into the remaining space of the current block first
+	mem_arena_block_t *block = arena->blocks;
+	char *p = (char *)block->data + block->used;
+	size_t avail = block->size - block->used;
+
+	va_copy(aq, ap);
+	int len = vsnprintf(p, avail, fmt, aq);
+	va_end(aq);
+	ASSERT(len >= 0);
+
+	// used and size of a block are aligned, so this claims exactly the printed string
+	if ((size_t)len < avail)
+		return mem_arena_alloc(arena, len + 1);
+
+	p = mem_arena_alloc(arena, (size_t)len + 1);
+	ASSERT(vsnprintf(p, (size_t)len + 1, fmt, ap) == len);
+	return p;
+}
+
+char *
+mem_arena_printf(mem_arena_t *arena, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	char *p = mem_arena_vprintf(arena, fmt, ap);
+	va_end(ap);
+	return p;
+}
+
+struct mem_pool {
+	void *free_list; /* cached objects, linked through their first bytes */
+	size_t free_len;
+	size_t max_cached;
+	size_t obj_size;
+};
+
+mem_pool_t *
+mem_pool_new(size_t obj_size, size_t max_cached)
+{
+	ASSERT(obj_size > 0);
+
+	mem_pool_t *pool = mem_new0(mem_pool_t, 1);
+	pool->obj_size = obj_size;
+	pool->max_cached = max_cached;
+
+	return pool;
+}
+
+void
+mem_pool_free(mem_pool_t *pool)
+{
+	IF_NULL_RETURN(pool);
+
+	while (pool->free_list) {
+		void *next = *(void **)pool->free_list;
+		mem_free0(pool->free_list);
+		pool->free_list = next;
+	}
+	mem_free0(pool);
+}
+
+void *
+mem_pool_alloc(mem_pool_t *pool)
+{
+	ASSERT(pool);
+
+	if (!pool->free_list)
+		return mem_alloc(MAX(pool->obj_size, sizeof(void *)));
+
+	void *obj = pool->free_list;
+	pool->free_list = *(void **)obj;
+	pool->free_len--;
+
+	return obj;
+}
+
+void
+mem_pool_release(mem_pool_t *pool, void *obj)
+{
+	ASSERT(pool);
+	IF_NULL_RETURN_TRACE(obj);
+
+	if (pool->free_len >= pool->max_cached) {
+		mem_free(obj);
+		return;
+	}
+
+	*(void **)obj = pool->free_list;
+	pool->free_list = obj;
+	pool->free_len++;
+}
+
+size_t
+mem_pool_get_obj_size(const mem_pool_t *pool)
+{
+	ASSERT(pool);
+
+	return pool->obj_size;
+}
+
+#ifdef MEM_STATS
+/*
+ * Allocation tracking. The tables are kept in plain libc memory, so tracking
+ * never recurses into itself. Live allocations are indexed by their address,
+ * call sites by file and line; both use open addressing with linear probing.
+ */
+typedef struct {
+	void *ptr; /* NULL marks an empty slot */
+	size_t size;
+	uint32_t site;
+} mem_stats_rec_t;
+
+static pthread_mutex_t mem_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static mem_stats_rec_t *mem_stats_recs = NULL;
+static size_t mem_stats_recs_size = 0;
+static size_t mem_stats_recs_len = 0;
+
+static mem_stats_site_t *mem_stats_sites = NULL; /* dense array of all sites */
+static size_t mem_stats_sites_len = 0;
+static size_t mem_stats_sites_alloc = 0;
+static uint32_t *mem_stats_site_index = NULL; /* site number + 1, 0 marks an empty slot */
+static size_t mem_stats_site_index_size = 0;
+
+static uint64_t mem_stats_live_bytes = 0;
+static uint64_t mem_stats_peak_bytes = 0;
+
+static size_t
+mem_stats_hash(uintptr_t key)
+{
+	return (size_t)((key ^ (key >> 17)) * 0x9e3779b97f4a7c15ULL);
+}
+
+static size_t
+mem_stats_site_hash(const char *file, int line)
+{
+	return mem_stats_hash((uintptr_t)file ^ ((uintptr_t)line << 20));
+}
+
+static bool
+mem_stats_site_index_grow(void)
+{
+	size_t size = mem_stats_site_index_size ? mem_stats_site_index_size * 2 : 1024;
+	uint32_t *index = calloc(size, sizeof(uint32_t));
+	if (!index)
+		return false;
+
+	for (size_t n = 0; n < mem_stats_sites_len; n++) {
+		mem_stats_site_t *site = &mem_stats_sites[n];
+		size_t i = mem_stats_site_hash(site->file, site->line) & (size - 1);
+		while (index[i])
+			i = (i + 1) & (size - 1);
+		index[i] = n + 1;
+	}
+	free(mem_stats_site_index);
+	mem_stats_site_index = index;
+	mem_stats_site_index_size = size;
+	return true;
+}
+
+/* returns the number of the site, creating it if necessary, or -1 if out of memory */
+static long
+mem_stats_site_get(const char *file, int line)
+{
+	if (2 * (mem_stats_sites_len + 1) > mem_stats_site_index_size &&
+	    !mem_stats_site_index_grow())
+		return -1;
+
+	size_t mask = mem_stats_site_index_size - 1;
+	size_t i = mem_stats_site_hash(file, line) & mask;
+	for (; mem_stats_site_index[i]; i = (i + 1) & mask) {
+		mem_stats_site_t *site = &mem_stats_sites[mem_stats_site_index[i] - 1];
+		if (site->file == file && site->line == line)
+			return mem_stats_site_index[i] - 1;
+	}
+
+	if (mem_stats_sites_len == mem_stats_sites_alloc) {
+		size_t alloc = mem_stats_sites_alloc ? mem_stats_sites_alloc * 2 : 512;
+		mem_stats_site_t *sites =
+			realloc(mem_stats_sites, alloc * sizeof(mem_stats_site_t));
+		if (!sites)
+			return -1;
+		mem_stats_sites = sites;
+		mem_stats_sites_alloc = alloc;
+	}
+
+	mem_stats_site_t *site = &mem_stats_sites[mem_stats_sites_len];
+	memset(site, 0, sizeof(mem_stats_site_t));
+	site->file = file;
+	site->line = line;
+	mem_stats_site_index[i] = ++mem_stats_sites_len;
+
+	return mem_stats_sites_len - 1;
+}
+
+static bool
+mem_stats_recs_grow(void)
+{
+	size_t size = mem_stats_recs_size ? mem_stats_recs_size * 2 : 4096;
+	mem_stats_rec_t *recs = calloc(size, sizeof(mem_stats_rec_t));
+	if (!recs)
+		return false;
+
+	for (size_t n = 0; n < mem_stats_recs_size; n++) {
+		if (!mem_stats_recs[n].ptr)
+			continue;
+		size_t i = mem_stats_hash((uintptr_t)mem_stats_recs[n].ptr) & (size - 1);
+		while (recs[i].ptr)
+			i = (i + 1) & (size - 1);
+		recs[i] = mem_stats_recs[n];
+	}
+	free(mem_stats_recs);
+	mem_stats_recs = recs;
+	mem_stats_recs_size = size;
+	return true;
+}
+
+static void
+mem_stats_track(void *ptr, size_t size, const char *file, int line)
+{
+	pthread_mutex_lock(&mem_stats_lock);
+
+	long n = mem_stats_site_get(file, line);
+	if (n < 0)
+		goto out;
+	if (4 * (mem_stats_recs_len + 1) > 3 * mem_stats_recs_size && !mem_stats_recs_grow())
+		goto out;
+
+	size_t mask = mem_stats_recs_size - 1;
+	size_t i = mem_stats_hash((uintptr_t)ptr) & mask;
+	while (mem_stats_recs[i].ptr)
+		i = (i + 1) & mask;
+	mem_stats_recs[i].ptr = ptr;
+	mem_stats_recs[i].size = size;
+	mem_stats_recs[i].site = n;
+	mem_stats_recs_len++;
+
+	mem_stats_site_t *site = &mem_stats_sites[n];
+	site->alloc_count++;
+	site->live_count++;
+	site->live_bytes += size;
+	site->peak_bytes = MAX(site->peak_bytes, site->live_bytes);
+
+	mem_stats_live_bytes += size;
+	mem_stats_peak_bytes = MAX(mem_stats_peak_bytes, mem_stats_live_bytes);
+out:
+	pthread_mutex_unlock(&mem_stats_lock);
+}
+
+static void
+mem_stats_untrack(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	pthread_mutex_lock(&mem_stats_lock);
+
+	if (!mem_stats_recs_len)
+		goto out;
+
+	// memory which has not been tracked, e.g., allocated by libc, is just ignored
+	size_t mask = mem_stats_recs_size - 1;
+	size_t i = mem_stats_hash((uintptr_t)ptr) & mask;
+	while (mem_stats_recs[i].ptr && mem_stats_recs[i].ptr != ptr)
+		i = (i + 1) & mask;
+	if (!mem_stats_recs[i].ptr)
+		goto out;
+
+	mem_stats_site_t *site = &mem_stats_sites[mem_stats_recs[i].site];
+	site->free_count++;
+	site->live_count--;
+	site->live_bytes -= mem_stats_recs[i].size;
+	mem_stats_live_bytes -= mem_stats_recs[i].size;
+
+	// backward shift deletion, see hashmap.c
+	for (size_t j = (i + 1) & mask; mem_stats_recs[j].ptr; j = (j + 1) & mask) {
+		size_t home = mem_stats_hash((uintptr_t)mem_stats_recs[j].ptr) & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			mem_stats_recs[i] = mem_stats_recs[j];
+			i = j;
+		}
+	}
+	memset(&mem_stats_recs[i], 0, sizeof(mem_stats_rec_t));
+	mem_stats_recs_len--;
+out:
+	pthread_mutex_unlock(&mem_stats_lock);
+}
+
+void *
+mem_alloc_at(size_t size, const char *file, int line)
+{
+	void *p = mem_alloc(size);
+	mem_stats_track(p, size, file, line);
+	return p;
+}
+
+void *
+mem_alloc0_at(size_t size, const char *file, int line)
+{
+	void *p = mem_alloc0(size);
+	mem_stats_track(p, size, file, line);
+	return p;
+}
+
+void *
+mem_realloc_at(void *mem, size_t size, const char *file, int line)
+{
+	mem_stats_untrack(mem);
+	void *p = mem_realloc(mem, size);
+	mem_stats_track(p, size, file, line);
+	return p;
+}
+
+char *
+mem_strdup_at(const char *str, const char *file, int line)
+{
+	char *p = mem_strdup(str);
+	mem_stats_track(p, strlen(p) + 1, file, line);
+	return p;
+}
+
+char *
+mem_strndup_at(const char *str, size_t len, const char *file, int line)
+{
+	char *p = mem_strndup(str, len);
+	mem_stats_track(p, strlen(p) + 1, file, line);
+	return p;
+}
+
+unsigned char *
+mem_memcpy_at(const unsigned char *mem, size_t size, const char *file, int line)
+{
+	unsigned char *p = mem_memcpy(mem, size);
+	mem_stats_track(p, size, file, line);
+	return p;
+}
+
+char *
+mem_vprintf_at(const char *file, int line, const char *fmt, va_list ap)
+{
+	char *p = mem_vprintf(fmt, ap);
+	mem_stats_track(p, strlen(p) + 1, file, line);
+	return p;
+}
+
+char *
+mem_printf_at(const char *file, int line, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	char *p = mem_vprintf_at(file, line, fmt, ap);
+	va_end(ap);
+	return p;
+}
+
+void
+mem_free_at(void *ptr)
+{
+	mem_stats_untrack(ptr);
+	free(ptr);
+}
+#endif /* MEM_STATS */
+
+bool
+mem_stats_is_enabled(void)
+{
+#ifdef MEM_STATS
+	return true;
+#else
+	return false;
+#endif
+}
+
+mem_stats_site_t *
+mem_stats_get(size_t *len, uint64_t *live_bytes, uint64_t *peak_bytes)
+{
+	ASSERT(len);
+	mem_stats_site_t *sites = NULL;
+
+	*len = 0;
+	if (live_bytes)
+		*live_bytes = 0;
+	if (peak_bytes)
+		*peak_bytes = 0;
+
+#ifdef MEM_STATS
+	pthread_mutex_lock(&mem_stats_lock);
+	if (mem_stats_sites_len) {
+		// plain allocation, the snapshot itself should not show up in the statistics
+		sites = mem_new(mem_stats_site_t, mem_stats_sites_len);
+		memcpy(sites, mem_stats_sites, mem_stats_sites_len * sizeof(mem_stats_site_t));
+		*len = mem_stats_sites_len;
+	}
+	if (live_bytes)
+		*live_bytes = mem_stats_live_bytes;
+	if (peak_bytes)
+		*peak_bytes = mem_stats_peak_bytes;
+	pthread_mutex_unlock(&mem_stats_lock);
+#endif
+
+	return sites;
+}
+
+static int
+mem_stats_cmp_live_bytes(const void *a, const void *b)
+{
+	const mem_stats_site_t *sa = a, *sb = b;
+	return (sa->live_bytes < sb->live_bytes) - (sa->live_bytes > sb->live_bytes);
+}
+
+void
+mem_stats_dump(size_t max_sites)
+{
+	size_t len;
+	uint64_t live, peak;
+
+	if (!mem_stats_is_enabled()) {
+		INFO("Allocation statistics not available, build with WITH_MEM_STATS=y");
+		return;
+	}
+
+	mem_stats_site_t *sites = mem_stats_get(&len, &live, &peak);
+	INFO("Allocation statistics: %" PRIu64 " bytes live, %" PRIu64 " bytes peak, %zu sites",
+	     live, peak, len);
+
+	if (sites)
+		qsort(sites, len, sizeof(mem_stats_site_t), mem_stats_cmp_live_bytes);
+	for (size_t i = 0; i < MIN(len, max_sites); i++) {
+		INFO("  %s:%d: %" PRIu64 " bytes live in %" PRIu64 " allocations "
+		     "(peak %" PRIu64 " bytes, %" PRIu64 " allocs, %" PRIu64 " frees)",
+		     sites[i].file, sites[i].line, sites[i].live_bytes, sites[i].live_count,
+		     sites[i].peak_bytes, sites[i].alloc_count, sites[i].free_count);
+	}
+
+	mem_free0(sites);
+}
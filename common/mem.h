@@ -32,8 +32,10 @@
 #ifndef MEM_H
 #define MEM_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 
 /**
@@ -214,6 +216,156 @@ mem_free_array(void **array, size_t size);
 		(struct_type *)aligned_alloc(alignment, _total_len);                               \
 	})
 
+typedef struct mem_arena mem_arena_t;
+
+/**
+ * Creates a new arena (region) allocator. Memory allocated from the arena is
+ * not freed individually but all at once by mem_arena_reset() or mem_arena_free().
+ * This is intended for many small, short-lived allocations within one scope,
+ * e.g., the handling of a single request.
+ *
+ * @param block_size Size of the memory blocks the arena allocates from the heap,
+ *                   0 selects a default size.
+ * @return The newly created arena.
+ */
+mem_arena_t *
+mem_arena_new(size_t block_size);
+
+/**
+ * Frees the arena itself and all memory allocated from it.
+ *
+ * @param arena The arena to be freed.
+ */
+void
+mem_arena_free(mem_arena_t *arena);
+
+/**
+ * Releases all memory allocated from the arena at once. One block of the
+ * default size is kept to serve further allocations, larger blocks are freed.
+ *
+ * @param arena The arena to be reset.
+ */
+void
+mem_arena_reset(mem_arena_t *arena);
+
+/**
+ * Returns the number of bytes the arena currently holds in its blocks,
+ * regardless of how much of it is allocated.
+ *
+ * @param arena The arena.
+ * @return The size of all blocks of the arena.
+ */
+size_t
+mem_arena_get_size(const mem_arena_t *arena);
+
+/**
+ * Allocates memory from the arena. The memory is not initialized and is
+ * suitably aligned for any type.
+ *
+ * @param arena The arena to allocate from.
+ * @param size The number of bytes to allocate.
+ * @return Pointer to the allocated memory, valid until the arena is reset or freed.
+ */
+void *
+mem_arena_alloc(mem_arena_t *arena, size_t size);
+
+/**
+ * Allocates memory from the arena. The memory is set to zero.
+ *
+ * @param arena The arena to allocate from.
+ * @param size The number of bytes to allocate.
+ * @return Pointer to the allocated memory, valid until the arena is reset or freed.
+ */
+void *
+mem_arena_alloc0(mem_arena_t *arena, size_t size);
+
+/**
+ * Duplicates a string into memory of the arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param str The string to duplicate.
+ * @return Pointer to the new string, valid until the arena is reset or freed.
+ */
+char *
+mem_arena_strdup(mem_arena_t *arena, const char *str);
+
+/**
+ * Prints to a string allocated from the arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param fmt The format string.
+ * @param ap va_list
+ * @return Pointer to the formatted string, valid until the arena is reset or freed.
+ */
+char *
+mem_arena_vprintf(mem_arena_t *arena, const char *fmt, va_list ap);
+
+/**
+ * Prints to a string allocated from the arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param fmt The format string.
+ * @return Pointer to the formatted string, valid until the arena is reset or freed.
+ */
+char *
+mem_arena_printf(mem_arena_t *arena, const char *fmt, ...)
+#if defined(__GNUC__)
+	__attribute__((format(printf, 2, 3)))
+#endif
+	;
+
+typedef struct mem_pool mem_pool_t;
+
+/**
+ * Creates a pool of equally sized objects. Released objects are kept in the
+ * pool and handed out again by mem_pool_alloc(), which saves the round trip
+ * through the general allocator for large or frequently allocated objects.
+ * A pool must only be used by one thread at a time.
+ *
+ * @param obj_size The size of each object in bytes.
+ * @param max_cached The maximum number of released objects kept in the pool;
+ *                   further released objects are freed.
+ * @return The newly created pool.
+ */
+mem_pool_t *
+mem_pool_new(size_t obj_size, size_t max_cached);
+
+/**
+ * Frees the pool and all objects cached in it. Objects still in use are not
+ * affected and must not be released to the pool afterwards.
+ *
+ * @param pool The pool to be freed.
+ */
+void
+mem_pool_free(mem_pool_t *pool);
+
+/**
+ * Returns an object of the pool's object size. The memory is not initialized.
+ *
+ * @param pool The pool to allocate from.
+ * @return Pointer to the object.
+ */
+void *
+mem_pool_alloc(mem_pool_t *pool);
+
+/**
+ * Gives an object obtained by mem_pool_alloc() back to the pool.
+ *
+ * @param pool The pool the object was allocated from.
+ * @param obj The object to be released; may be NULL.
+ */
+void
+mem_pool_release(mem_pool_t *pool, void *obj);
+
+/**
+ * Returns the object size of the pool.
+ *
+ * @param pool The pool.
+ * @return The size of each object in bytes.
+ */
+size_t
+mem_pool_get_obj_size(const mem_pool_t *pool);
+
 static inline void
 mem_memset0(void *ptr, size_t num)
 {
@@ -227,4 +379,88 @@ mem_memset(void *ptr, int value, size_t num)
 	memset(ptr, value, num);
 }
 
+/**
+ * Allocation statistics of one call site, see mem_stats_get().
+ */
+typedef struct mem_stats_site {
+	const char *file;	/**< source file of the call site */
+	int line;		/**< source line of the call site */
+	uint64_t alloc_count;	/**< number of allocations */
+	uint64_t free_count;	/**< number of tracked frees */
+	uint64_t live_count;	/**< number of allocations not yet freed */
+	uint64_t live_bytes;	/**< bytes allocated and not yet freed */
+	uint64_t peak_bytes;	/**< high-water mark of live_bytes */
+} mem_stats_site_t;
+
+/**
+ * Checks if allocation tracking has been compiled in (MEM_STATS, see below).
+ *
+ * @return true if allocations are tracked.
+ */
+bool
+mem_stats_is_enabled(void);
+
+/**
+ * Returns a snapshot of the tracked call sites.
+ *
+ * @param len Pointer to store the number of sites to.
+ * @param live_bytes Pointer to store the total of live bytes to; may be NULL.
+ * @param peak_bytes Pointer to store the high-water mark of live bytes to; may be NULL.
+ * @return Array of sites which has to be freed by the caller or NULL if empty.
+ */
+mem_stats_site_t *
+mem_stats_get(size_t *len, uint64_t *live_bytes, uint64_t *peak_bytes);
+
+/**
+ * Logs the totals and the call sites with the most live bytes.
+ *
+ * @param max_sites The maximum number of call sites to be logged.
+ */
+void
+mem_stats_dump(size_t max_sites);
+
+/*
+ * If built with MEM_STATS (WITH_MEM_STATS=y), the allocation functions above
+ * are replaced by variants which record the calling file and line. Memory which
+ * is not released through mem_free() or mem_free0() stays accounted as live.
+ */
+#ifdef MEM_STATS
+void *
+mem_alloc_at(size_t size, const char *file, int line);
+void *
+mem_alloc0_at(size_t size, const char *file, int line);
+void *
+mem_realloc_at(void *mem, size_t size, const char *file, int line);
+char *
+mem_strdup_at(const char *str, const char *file, int line);
+char *
+mem_strndup_at(const char *str, size_t len, const char *file, int line);
+unsigned char *
+mem_memcpy_at(const unsigned char *mem, size_t size, const char *file, int line);
+char *
+mem_vprintf_at(const char *file, int line, const char *fmt, va_list ap);
+char *
+mem_printf_at(const char *file, int line, const char *fmt, ...)
+#if defined(__GNUC__)
+	__attribute__((format(printf, 3, 4)))
+#endif
+	;
+void
+mem_free_at(void *ptr);
+
+#ifndef MEM_STATS_NO_WRAP
+#define mem_alloc(size) mem_alloc_at((size), __FILE__, __LINE__)
+#define mem_alloc0(size) mem_alloc0_at((size), __FILE__, __LINE__)
+#define mem_realloc(mem, size) mem_realloc_at((mem), (size), __FILE__, __LINE__)
+#define mem_strdup(str) mem_strdup_at((str), __FILE__, __LINE__)
+#define mem_strndup(str, len) mem_strndup_at((str), (len), __FILE__, __LINE__)
+#define mem_memcpy(mem, size) mem_memcpy_at((mem), (size), __FILE__, __LINE__)
+#define mem_vprintf(fmt, ap) mem_vprintf_at(__FILE__, __LINE__, (fmt), (ap))
+#define mem_printf(...) mem_printf_at(__FILE__, __LINE__, __VA_ARGS__)
+#define mem_free(ptr) mem_free_at(ptr)
+#undef mem_free0
+#define mem_free0(ptr) ((void)(mem_free_at(ptr), (ptr) = NULL))
+#endif /* MEM_STATS_NO_WRAP */
+#endif /* MEM_STATS */
+
 #endif /* MEM_H */
@@ -294,6 +294,153 @@ test_mem_memset0(UNUSED const MunitParameter params[], UNUSED void *data)
 	return MUNIT_OK;
 }
 
+static MunitResult
+test_arena_alloc_strdup_printf(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	mem_arena_t *arena = mem_arena_new(256);
+
+	// allocations are aligned and do not overlap
+	char *prev = NULL;
+	for (int i = 0; i < 100; i++) {
+		char *p = mem_arena_alloc0(arena, 1 + i % 7);
+		munit_assert_not_null(p);
+		munit_assert_size((uintptr_t)p % sizeof(void *), ==, 0);
+		munit_assert_char(p[0], ==, 0);
+		if (prev)
+			munit_assert_char(prev[0], ==, 'x');
+		p[0] = 'x';
+		prev = p;
+	}
+
+	char *s = mem_arena_strdup(arena, "some string");
+	munit_assert_string_equal(s, "some string");
+
+	char *f = mem_arena_printf(arena, "%s-%d", "number", 42);
+	munit_assert_string_equal(f, "number-42");
+
+	// strings larger than a block are printed completely
+	char *large = mem_arena_printf(arena, "%1000d", 7);
+	munit_assert_size(strlen(large), ==, 1000);
+	munit_assert_char(large[999], ==, '7');
+
+	// large allocations do not clobber the current block
+	char *after = mem_arena_strdup(arena, "after");
+	munit_assert_string_equal(s, "some string");
+	munit_assert_string_equal(f, "number-42");
+	munit_assert_string_equal(after, "after");
+
+	mem_arena_free(arena);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_arena_reset(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	mem_arena_t *arena = mem_arena_new(0);
+
+	char *first = mem_arena_strdup(arena, "first");
+	for (int i = 0; i < 1000; i++)
+		mem_arena_printf(arena, "%d", i);
+
+	// after a reset, memory of the first block is handed out again
+	mem_arena_reset(arena);
+	char *again = mem_arena_strdup(arena, "again");
+	munit_assert_ptr_equal(first, again);
+	munit_assert_string_equal(again, "again");
+
+	// a large block linked behind the first one is released, one default block is kept
+	mem_arena_reset(arena);
+	size_t block_size = mem_arena_get_size(arena);
+	first = mem_arena_strdup(arena, "first");
+	mem_arena_alloc(arena, 64 * 1024);
+	munit_assert_size(mem_arena_get_size(arena), >, 64 * 1024);
+	mem_arena_reset(arena);
+	munit_assert_size(mem_arena_get_size(arena), ==, block_size);
+	again = mem_arena_strdup(arena, "again");
+	munit_assert_ptr_equal(first, again);
+
+	mem_arena_reset(arena);
+	mem_arena_free(arena);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_pool_reuses_objects(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	mem_pool_t *pool = mem_pool_new(sizeof(struct complex_t), 2);
+	munit_assert_size(mem_pool_get_obj_size(pool), ==, sizeof(struct complex_t));
+
+	struct complex_t *a = mem_pool_alloc(pool);
+	struct complex_t *b = mem_pool_alloc(pool);
+	struct complex_t *c = mem_pool_alloc(pool);
+	munit_assert_ptr_not_equal(a, b);
+	a->int_field = 0xdead;
+
+	// released objects are handed out again, at most max_cached are kept
+	mem_pool_release(pool, a);
+	mem_pool_release(pool, b);
+	mem_pool_release(pool, c);
+	mem_pool_release(pool, NULL);
+
+	struct complex_t *d = mem_pool_alloc(pool);
+	struct complex_t *e = mem_pool_alloc(pool);
+	munit_assert_ptr_equal(d, b);
+	munit_assert_ptr_equal(e, a);
+
+	mem_pool_release(pool, d);
+	mem_pool_free(pool);
+	mem_free0(e);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_stats_track_call_sites(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	size_t len;
+	uint64_t live, peak;
+	mem_stats_site_t *sites;
+
+	if (!mem_stats_is_enabled()) {
+		// without MEM_STATS the snapshot is always empty
+		sites = mem_stats_get(&len, &live, &peak);
+		munit_assert_null(sites);
+		munit_assert_size(len, ==, 0);
+		munit_assert_uint64(live, ==, 0);
+		return MUNIT_OK;
+	}
+
+	// the call site below is identified by its line
+	char *p[3];
+	int line = __LINE__ + 2;
+	for (int i = 0; i < 3; i++)
+		p[i] = mem_alloc(100);
+	mem_free0(p[0]);
+
+	sites = mem_stats_get(&len, &live, &peak);
+	mem_stats_site_t *site = NULL;
+	for (size_t i = 0; i < len; i++) {
+		if (sites[i].line == line && !strcmp(sites[i].file, __FILE__))
+			site = &sites[i];
+	}
+	munit_assert_not_null(site);
+	munit_assert_uint64(site->alloc_count, ==, 3);
+	munit_assert_uint64(site->free_count, ==, 1);
+	munit_assert_uint64(site->live_count, ==, 2);
+	munit_assert_uint64(site->live_bytes, ==, 200);
+	munit_assert_uint64(site->peak_bytes, >=, 300);
+	munit_assert_uint64(live, >=, 200);
+	munit_assert_uint64(peak, >=, live);
+	mem_free0(sites);
+
+	mem_free0(p[1]);
+	mem_free0(p[2]);
+
+	return MUNIT_OK;
+}
+
 static MunitTest tests[] = {
 	{
 		"/allocate primitives and structs",	  /* name */
@@ -375,6 +522,38 @@ static MunitTest tests[] = {
 		MUNIT_TEST_OPTION_NONE,		   /* options */
 		NULL				   /* parameters */
 	},
+	{
+		"/arena allocations, strdup and printf", /* name */
+		test_arena_alloc_strdup_printf,		 /* test */
+		setup,					 /* setup */
+		tear_down,				 /* tear_down */
+		MUNIT_TEST_OPTION_NONE,			 /* options */
+		NULL					 /* parameters */
+	},
+	{
+		"/arena reset reuses memory", /* name */
+		test_arena_reset,	      /* test */
+		setup,			      /* setup */
+		tear_down,		      /* tear_down */
+		MUNIT_TEST_OPTION_NONE,	      /* options */
+		NULL			      /* parameters */
+	},
+	{
+		"/pool reuses released objects", /* name */
+		test_pool_reuses_objects,	 /* test */
+		setup,				 /* setup */
+		tear_down,			 /* tear_down */
+		MUNIT_TEST_OPTION_NONE,		 /* options */
+		NULL				 /* parameters */
+	},
+	{
+		"/stats track call sites",   /* name */
+		test_stats_track_call_sites, /* test */
+		setup,			     /* setup */
+		tear_down,		     /* tear_down */
+		MUNIT_TEST_OPTION_NONE,	     /* options */
+		NULL			     /* parameters */
+	},
 
 	// Mark the end of the array with an entry where the test function is NULL
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
@@ -0,0 +1,451 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2017 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+
+#include "macro.h"
+#include "mem.h"
+#include "list.h"
+#include "event.h"
+#include "file.h"
+#include "sock.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+typedef struct metrics_family {
+	char *name;
+	char *help;
+	metrics_type_t type;
+	list_t *series;
+} metrics_family_t;
+
+struct metrics {
+	metrics_family_t *family;
+	char *labels;
+	unsigned refs;
+	uint64_t value; // count of a counter or the bits of the double value of a gauge
+	double *bounds;
+	size_t len;
+	uint64_t *buckets; // histograms only, len + 1 non-cumulative counts, the last is +Inf
+	double sum;
+	uint64_t count;
+};
+
+struct metrics_collector {
+	void (*func)(str_t *out, void *data);
+	void *data;
+};
+
+struct metrics_server {
+	char *path;
+	int sock;
+	event_io_t *io;
+};
+
+const double metrics_latency_buckets[] = { 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.025, 0.05,
+					   0.1,	   0.25,   0.5,	  1,	 2.5,  5,     10 };
+const size_t metrics_latency_buckets_len = ELEMENTSOF(metrics_latency_buckets);
+
+// protects the families and the values of the histograms
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static list_t *metrics_family_list = NULL;
+// only touched by the exporting thread
+static list_t *metrics_collector_list = NULL;
+
+static const char *metrics_type_names[] = {
+	[METRICS_COUNTER] = "counter",
+	[METRICS_GAUGE] = "gauge",
+	[METRICS_HISTOGRAM] = "histogram",
+};
+
+static metrics_family_t *
+metrics_family_get(const char *name, metrics_type_t type, const char *help)
+{
+	for (list_t *l = metrics_family_list; l; l = l->next) {
+		metrics_family_t *family = l->data;
+		if (strcmp(family->name, name))
+			continue;
+		if (family->type != type) {
+			WARN("Metric %s is already registered as %s", name,
+			     metrics_type_names[family->type]);
+			return NULL;
+		}
+		return family;
+	}
+
+	metrics_family_t *family = mem_new0(metrics_family_t, 1);
+	family->name = mem_strdup(name);
+	family->help = mem_strdup(help ? help : "");
+	family->type = type;
+	metrics_family_list = list_append(metrics_family_list, family);
+	return family;
+}
+
+static metrics_t *
+metrics_new(const char *name, const char *labels, const char *help, metrics_type_t type,
+	    const double *bounds, size_t len)
+{
+	ASSERT(name);
+
+	pthread_mutex_lock(&metrics_lock);
+	metrics_family_t *family = metrics_family_get(name, type, help);
+	if (!family) {
+		pthread_mutex_unlock(&metrics_lock);
+		return NULL;
+	}
+
+	if (labels && !*labels)
+		labels = NULL;
+	for (list_t *l = family->series; l; l = l->next) {
+		metrics_t *m = l->data;
+		if ((!m->labels && !labels) || (m->labels && labels && !strcmp(m->labels, labels))) {
+			m->refs++;
+			pthread_mutex_unlock(&metrics_lock);
+			return m;
+		}
+	}
+
+	metrics_t *m = mem_new0(metrics_t, 1);
+	m->family = family;
+	m->labels = labels ? mem_strdup(labels) : NULL;
+	m->refs = 1;
+	if (type == METRICS_HISTOGRAM) {
+		m->bounds = mem_new0(double, len);
+		memcpy(m->bounds, bounds, len * sizeof(double));
+		m->len = len;
+		m->buckets = mem_new0(uint64_t, len + 1);
+	}
+	family->series = list_append(family->series, m);
+	pthread_mutex_unlock(&metrics_lock);
+
+	return m;
+}
+
+metrics_t *
+metrics_counter_new(const char *name, const char *labels, const char *help)
+{
+	return metrics_new(name, labels, help, METRICS_COUNTER, NULL, 0);
+}
+
+metrics_t *
+metrics_gauge_new(const char *name, const char *labels, const char *help)
+{
+	return metrics_new(name, labels, help, METRICS_GAUGE, NULL, 0);
+}
+
+metrics_t *
+metrics_histogram_new(const char *name, const char *labels, const char *help,
+		      const double *bounds, size_t len)
+{
+	ASSERT(bounds || len == 0);
+	return metrics_new(name, labels, help, METRICS_HISTOGRAM, bounds, len);
+}
+
+void
+metrics_free(metrics_t *m)
+{
+	IF_NULL_RETURN(m);
+
+	pthread_mutex_lock(&metrics_lock);
+	if (--m->refs > 0) {
+		pthread_mutex_unlock(&metrics_lock);
+		return;
+	}
+
+	metrics_family_t *family = m->family;
+	family->series = list_remove(family->series, m);
+	if (!family->series) {
+		metrics_family_list = list_remove(metrics_family_list, family);
+		mem_free0(family->name);
+		mem_free0(family->help);
+		mem_free0(family);
+	}
+	pthread_mutex_unlock(&metrics_lock);
+
+	if (m->labels)
+		mem_free0(m->labels);
+	if (m->bounds)
+		mem_free0(m->bounds);
+	if (m->buckets)
+		mem_free0(m->buckets);
+	mem_free0(m);
+}
+
+void
+metrics_counter_add(metrics_t *m, uint64_t value)
+{
+	IF_NULL_RETURN_TRACE(m);
+	__atomic_add_fetch(&m->value, value, __ATOMIC_RELAXED);
+}
+
+void
+metrics_counter_inc(metrics_t *m)
+{
+	metrics_counter_add(m, 1);
+}
+
+void
+metrics_gauge_set(metrics_t *m, double value)
+{
+	IF_NULL_RETURN_TRACE(m);
+
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	__atomic_store_n(&m->value, bits, __ATOMIC_RELAXED);
+}
+
+static double
+metrics_gauge_get(const metrics_t *m)
+{
+	uint64_t bits = __atomic_load_n(&m->value, __ATOMIC_RELAXED);
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+void
+metrics_histogram_observe(metrics_t *m, double value)
+{
+	IF_NULL_RETURN_TRACE(m);
+
+	size_t i = 0;
+	while (i < m->len && value > m->bounds[i])
+		i++;
+
+	pthread_mutex_lock(&metrics_lock);
+	m->buckets[i]++;
+	m->sum += value;
+	m->count++;
+	pthread_mutex_unlock(&metrics_lock);
+}
+
+void
+metrics_histogram_observe_since(metrics_t *m, const struct timespec *start)
+{
+	ASSERT(start);
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	metrics_histogram_observe(m, (now.tv_sec - start->tv_sec) +
+					     (now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+metrics_collector_t *
+metrics_collector_new(void (*func)(str_t *out, void *data), void *data)
+{
+	ASSERT(func);
+
+	metrics_collector_t *collector = mem_new0(metrics_collector_t, 1);
+	collector->func = func;
+	collector->data = data;
+	metrics_collector_list = list_append(metrics_collector_list, collector);
+	return collector;
+}
+
+void
+metrics_collector_free(metrics_collector_t *collector)
+{
+	IF_NULL_RETURN(collector);
+
+	metrics_collector_list = list_remove(metrics_collector_list, collector);
+	mem_free0(collector);
+}
+
+void
+metrics_format_header(str_t *out, const char *name, metrics_type_t type, const char *help)
+{
+	ASSERT(out);
+	ASSERT(name);
+
+	str_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help ? help : "", name,
+			  metrics_type_names[type]);
+}
+
+void
+metrics_format_value(str_t *out, const char *name, const char *labels, double value)
+{
+	ASSERT(out);
+	ASSERT(name);
+
+	if (labels && *labels)
+		str_append_printf(out, "%s{%s} %.15g\n", name, labels, value);
+	else
+		str_append_printf(out, "%s %.15g\n", name, value);
+}
+
+static void
+metrics_format_histogram(str_t *out, const char *name, const metrics_t *m)
+{
+	const char *labels = m->labels ? m->labels : "";
+	const char *sep = m->labels ? "," : "";
+	uint64_t count = 0;
+
+	for (size_t i = 0; i < m->len; i++) {
+		count += m->buckets[i];
+		str_append_printf(out, "%s_bucket{%s%sle=\"%g\"} %" PRIu64 "\n", name, labels, sep,
+				  m->bounds[i], count);
+	}
+	str_append_printf(out, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, sep,
+			  m->count);
+
+	if (m->labels) {
+		str_append_printf(out, "%s_sum{%s} %.15g\n%s_count{%s} %" PRIu64 "\n", name,
+				  labels, m->sum, name, labels, m->count);
+	} else {
+		str_append_printf(out, "%s_sum %.15g\n%s_count %" PRIu64 "\n", name, m->sum, name,
+				  m->count);
+	}
+}
+
+char *
+metrics_export_new(void)
+{
+	str_t *out = str_new(NULL);
+
+	pthread_mutex_lock(&metrics_lock);
+	for (list_t *l = metrics_family_list; l; l = l->next) {
+		metrics_family_t *family = l->data;
+		metrics_format_header(out, family->name, family->type, family->help);
+
+		for (list_t *s = family->series; s; s = s->next) {
+			metrics_t *m = s->data;
+			if (family->type == METRICS_COUNTER) {
+				uint64_t value = __atomic_load_n(&m->value, __ATOMIC_RELAXED);
+				if (m->labels)
+					str_append_printf(out, "%s{%s} %" PRIu64 "\n",
+							  family->name, m->labels, value);
+				else
+					str_append_printf(out, "%s %" PRIu64 "\n", family->name,
+							  value);
+			} else if (family->type == METRICS_GAUGE) {
+				metrics_format_value(out, family->name, m->labels,
+						     metrics_gauge_get(m));
+			} else {
+				metrics_format_histogram(out, family->name, m);
+			}
+		}
+	}
+	pthread_mutex_unlock(&metrics_lock);
+
+	for (list_t *l = metrics_collector_list; l; l = l->next) {
+		metrics_collector_t *collector = l->data;
+		collector->func(out, collector->data);
+	}
+
+	return str_free(out, false);
+}
+
+int
+metrics_export_file(const char *file)
+{
+	ASSERT(file);
+
+	char *text = metrics_export_new();
+	char *tmp = mem_printf("%s.tmp", file);
+	int ret = -1;
+
+	if (file_write(tmp, text, -1) < 0) {
+		WARN("Could not write metrics to %s", tmp);
+		goto out;
+	}
+	if (rename(tmp, file) < 0) {
+		WARN_ERRNO("Could not rename %s to %s", tmp, file);
+		unlink(tmp);
+		goto out;
+	}
+	ret = 0;
+out:
+	mem_free0(tmp);
+	mem_free0(text);
+	return ret;
+}
+
+static void
+metrics_server_cb_accept(int fd, UNUSED unsigned events, UNUSED event_io_t *io,
+			 UNUSED void *data)
+{
+	int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (client < 0) {
+		WARN_ERRNO("Could not accept metrics client");
+		return;
+	}
+
+	char *text = metrics_export_new();
+	size_t len = strlen(text);
+
+	// the export has to fit into the socket buffer, a slow client never blocks the loop
+	for (size_t off = 0; off < len;) {
+		ssize_t n = send(client, text + off, len - off, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			WARN_ERRNO("Could not send metrics, %zu of %zu bytes sent", off, len);
+			break;
+		}
+		off += n;
+	}
+
+	mem_free0(text);
+	close(client);
+}
+
+metrics_server_t *
+metrics_server_new(const char *path)
+{
+	ASSERT(path);
+
+	int sock = sock_unix_create_and_bind(SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, path);
+	IF_TRUE_RETVAL(sock < 0, NULL);
+
+	if (sock_unix_listen(sock) < 0) {
+		sock_unix_close_and_unlink(sock, path);
+		return NULL;
+	}
+
+	metrics_server_t *server = mem_new0(metrics_server_t, 1);
+	server->path = mem_strdup(path);
+	server->sock = sock;
+	server->io = event_io_new(sock, EVENT_IO_READ, metrics_server_cb_accept, server);
+	event_add_io(server->io);
+
+	return server;
+}
+
+void
+metrics_server_free(metrics_server_t *server)
+{
+	IF_NULL_RETURN(server);
+
+	event_remove_io(server->io);
+	event_io_free(server->io);
+	sock_unix_close_and_unlink(server->sock, server->path);
+	mem_free0(server->path);
+	mem_free0(server);
+}
@@ -0,0 +1,162 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2017 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/**
+ * @file metrics.h
+ *
+ * Registry of counters, gauges and histograms which is exported in the Prometheus text
+ * exposition format, either to each client connecting to a unix socket or to a file.
+ *
+ * Each metric is one series, i.e., a name and a set of labels, e.g.,
+ * name "cml_scd_request_seconds" and labels "mode=\"async\"". Series of the same name form
+ * a family which shares the type and the help text of the first series created.
+ * Counters and gauges are updated lock free and may be used from any thread, histograms
+ * take a lock. Values which are cheaper to compute on demand, e.g., the number of
+ * containers per state, are written by collectors which are called on each export.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "str.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef enum { METRICS_COUNTER = 0, METRICS_GAUGE, METRICS_HISTOGRAM } metrics_type_t;
+
+typedef struct metrics metrics_t;
+typedef struct metrics_collector metrics_collector_t;
+typedef struct metrics_server metrics_server_t;
+
+/**
+ * Default bucket bounds in seconds for latency histograms, from 100us to 10s.
+ */
+extern const double metrics_latency_buckets[];
+extern const size_t metrics_latency_buckets_len;
+
+/**
+ * Creates and registers a counter.
+ *
+ * @param name The name of the family, e.g., "cml_uevents_total".
+ * @param labels The labels of the series without braces, may be NULL; values are not escaped.
+ * @param help The help text of the family.
+ * @return The new series, NULL if a family of another type exists with this name. If the
+ *	   series exists already, it is returned and has to be freed once more.
+ */
+metrics_t *
+metrics_counter_new(const char *name, const char *labels, const char *help);
+
+/**
+ * Creates and registers a gauge, see metrics_counter_new().
+ */
+metrics_t *
+metrics_gauge_new(const char *name, const char *labels, const char *help);
+
+/**
+ * Creates and registers a histogram, see metrics_counter_new().
+ *
+ * @param bounds The ascending upper bounds of the buckets, the +Inf bucket is implicit.
+ * @param len The number of bounds.
+ */
+metrics_t *
+metrics_histogram_new(const char *name, const char *labels, const char *help,
+		      const double *bounds, size_t len);
+
+/**
+ * Drops a reference to a series, which is unregistered and freed with the last one.
+ */
+void
+metrics_free(metrics_t *m);
+
+void
+metrics_counter_add(metrics_t *m, uint64_t value);
+
+void
+metrics_counter_inc(metrics_t *m);
+
+void
+metrics_gauge_set(metrics_t *m, double value);
+
+void
+metrics_histogram_observe(metrics_t *m, double value);
+
+/**
+ * Observes the time elapsed since start, taken from CLOCK_MONOTONIC, in seconds.
+ */
+void
+metrics_histogram_observe_since(metrics_t *m, const struct timespec *start);
+
+/**
+ * Registers func to be called on each export to append its samples to out,
+ * see metrics_format_header() and metrics_format_value().
+ */
+metrics_collector_t *
+metrics_collector_new(void (*func)(str_t *out, void *data), void *data);
+
+void
+metrics_collector_free(metrics_collector_t *collector);
+
+/**
+ * Appends the HELP and TYPE lines of a family to out, to be used by collectors.
+ */
+void
+metrics_format_header(str_t *out, const char *name, metrics_type_t type, const char *help);
+
+/**
+ * Appends a sample to out, to be used by collectors.
+ *
+ * @param labels The labels of the sample without braces, may be NULL.
+ */
+void
+metrics_format_value(str_t *out, const char *name, const char *labels, double value);
+
+/**
+ * Returns all registered series and the samples of all collectors in the text format.
+ * The returned string has to be freed by the caller.
+ */
+char *
+metrics_export_new(void);
+
+/**
+ * Writes the export to file, which is replaced atomically through a temporary file.
+ *
+ * @return 0 on success, -1 on error
+ */
+int
+metrics_export_file(const char *file);
+
+/**
+ * Creates a unix stream socket at path which is served by the event loop of the calling
+ * thread. Each connecting client gets the export written and the connection closed,
+ * its request, if any, is not read. Thus, a scrape is, e.g., 'socat - UNIX:<path>'.
+ */
+metrics_server_t *
+metrics_server_new(const char *path);
+
+void
+metrics_server_free(metrics_server_t *server);
+
+#endif /* METRICS_H */
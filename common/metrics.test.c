@@ -0,0 +1,157 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "munit.h"
+
+#include "metrics.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <string.h>
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+	return NULL;
+}
+
+static void
+tear_down(UNUSED void *fixture)
+{
+	// No clean-up needed for now
+}
+
+static void
+collect(str_t *out, void *data)
+{
+	metrics_format_header(out, "test_collected", METRICS_GAUGE, "collected");
+	metrics_format_value(out, "test_collected", "id=\"1\"", *(int *)data);
+}
+
+static MunitResult
+test_export(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	metrics_t *c1 = metrics_counter_new("test_total", "src=\"a\"", "events");
+	metrics_t *c2 = metrics_counter_new("test_total", "src=\"b\"", NULL);
+	metrics_t *g = metrics_gauge_new("test_gauge", NULL, "gauge");
+	munit_assert_not_null(c1);
+	munit_assert_not_null(c2);
+	munit_assert_not_null(g);
+
+	// a name is bound to the type of its first series
+	munit_assert_null(metrics_gauge_new("test_total", NULL, NULL));
+	// an existing series is shared
+	munit_assert_ptr_equal(metrics_counter_new("test_total", "src=\"a\"", NULL), c1);
+	metrics_free(c1);
+
+	metrics_counter_inc(c1);
+	metrics_counter_add(c2, 41);
+	metrics_counter_inc(c2);
+	metrics_gauge_set(g, 2.5);
+
+	int value = 7;
+	metrics_collector_t *collector = metrics_collector_new(collect, &value);
+
+	char *text = metrics_export_new();
+	munit_assert_string_equal(text, "# HELP test_total events\n"
+					"# TYPE test_total counter\n"
+					"test_total{src=\"a\"} 1\n"
+					"test_total{src=\"b\"} 42\n"
+					"# HELP test_gauge gauge\n"
+					"# TYPE test_gauge gauge\n"
+					"test_gauge 2.5\n"
+					"# HELP test_collected collected\n"
+					"# TYPE test_collected gauge\n"
+					"test_collected{id=\"1\"} 7\n");
+	mem_free0(text);
+
+	// the family is dropped with its last series
+	metrics_free(c1);
+	metrics_free(c2);
+	metrics_free(g);
+	metrics_collector_free(collector);
+	text = metrics_export_new();
+	munit_assert_string_equal(text, "");
+	mem_free0(text);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_histogram(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	const double bounds[] = { 0.1, 1 };
+	metrics_t *h = metrics_histogram_new("test_seconds", "op=\"x\"", "latency", bounds,
+					     ELEMENTSOF(bounds));
+	munit_assert_not_null(h);
+
+	metrics_histogram_observe(h, 0.05);
+	metrics_histogram_observe(h, 0.1);
+	metrics_histogram_observe(h, 0.5);
+	metrics_histogram_observe(h, 4);
+
+	char *text = metrics_export_new();
+	munit_assert_string_equal(text, "# HELP test_seconds latency\n"
+					"# TYPE test_seconds histogram\n"
+					"test_seconds_bucket{op=\"x\",le=\"0.1\"} 2\n"
+					"test_seconds_bucket{op=\"x\",le=\"1\"} 3\n"
+					"test_seconds_bucket{op=\"x\",le=\"+Inf\"} 4\n"
+					"test_seconds_sum{op=\"x\"} 4.65\n"
+					"test_seconds_count{op=\"x\"} 4\n");
+	mem_free0(text);
+	metrics_free(h);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/export",		/* name */
+		test_export,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/histogram",		/* name */
+		test_histogram,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite metrics_suite = {
+	"/metrics",		/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
@@ -30,13 +30,18 @@
 #include "mem.h"
 #include "file.h"
 #include "proc.h"
+#include "nft.h"
 
 #include <arpa/inet.h>
 #include <inttypes.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <linux/ethtool.h>
 #include <linux/netlink.h>
+#include <linux/sockios.h>
 #include <linux/genetlink.h>
 #include <linux/nl80211.h>
 
@@ -63,6 +68,9 @@
 #define LOOPBACK_PREFIX 16
 #define LOCALHOST_IP "127.0.0.1"
 
+// program NAT, forwarding and mac filters with nftables instead of iptables
+static bool network_nftables = false;
+
 static int
 network_call_ip(const char *addr, uint32_t subnet, const char *interface, char *action)
 {
@@ -237,11 +245,20 @@ network_setup_port_forwarding(const char *srcip, uint16_t srcport, const char *d
 	return error;
 }
 
+void
+network_set_nftables(bool enable)
+{
+	network_nftables = enable;
+}
+
 int
 network_setup_masquerading(const char *subnet, bool enable)
 {
 	ASSERT(subnet);
 
+	if (network_nftables)
+		return nft_setup_masquerading(subnet, enable);
+
 	DEBUG("%s IP forwarding from %s", enable ? "Enabling" : "Disabling", subnet);
 
 	// outgoing
@@ -293,39 +310,26 @@ network_enable_ip_forwarding(void)
 	INFO("IP forwarding enabled!");
 }
 
-/**
- * This function brings the network interface ifi_name either ip or down,
- * using either the flag IFF_UP or IFF_DOWN
- * with a netlink message using the netlink socket.
- */
-int
-network_set_flag(const char *ifi_name, const uint32_t flag)
+nl_msg_t *
+network_set_flag_msg_new(const char *ifi_name, const uint32_t flag)
 {
 	ASSERT(ifi_name && (flag == IFF_UP || flag == IFF_DOWN));
 
 	DEBUG("Bringing %s interface \"%s\"", flag == IFF_UP ? "up" : "down", ifi_name);
 
-	nl_sock_t *nl_sock = NULL;
 	unsigned int ifi_index;
 	nl_msg_t *req = NULL;
 
 	/* Get the interface index of the interface name */
 	if (!(ifi_index = if_nametoindex(ifi_name))) {
 		ERROR("net interface name '%s' could not be resolved", ifi_name);
-		return -1;
-	}
-
-	/* Open netlink socket */
-	if (!(nl_sock = nl_sock_routing_new())) {
-		ERROR("failed to allocate netlink socket");
-		return -1;
+		return NULL;
 	}
 
 	/* Create netlink message */
 	if (!(req = nl_msg_new())) {
 		ERROR("failed to allocate netlink message");
-		nl_sock_free(nl_sock);
-		return -1;
+		return NULL;
 	}
 
 	/* Prepare the request message */
@@ -346,20 +350,47 @@ network_set_flag(const char *ifi_name, const uint32_t flag)
 	if (nl_msg_set_link_req(req, &link_req))
 		goto msg_err;
 
-	/* Send request message and wait for the response message */
-	if (nl_msg_send_kernel_verify(nl_sock, req))
-		goto msg_err;
+	return req;
 
+msg_err:
+	ERROR("failed to create netlink message");
 	nl_msg_free(req);
-	nl_sock_free(nl_sock);
+	return NULL;
+}
 
-	return 0;
+/**
+ * This function brings the network interface ifi_name either ip or down,
+ * using either the flag IFF_UP or IFF_DOWN
+ * with a netlink message using the netlink socket.
+ */
+int
+network_set_flag(const char *ifi_name, const uint32_t flag)
+{
+	nl_sock_t *nl_sock = NULL;
+	nl_msg_t *req = NULL;
+
+	if (!(req = network_set_flag_msg_new(ifi_name, flag)))
+		return -1;
+
+	/* Open netlink socket */
+	if (!(nl_sock = nl_sock_routing_new())) {
+		ERROR("failed to allocate netlink socket");
+		nl_msg_free(req);
+		return -1;
+	}
+
+	/* Send request message and wait for the response message */
+	if (nl_msg_send_kernel_verify(nl_sock, req)) {
+		ERROR("failed to send netlink message");
+		nl_msg_free(req);
+		nl_sock_free(nl_sock);
+		return -1;
+	}
 
-msg_err:
-	ERROR("failed to create/send netlink message");
 	nl_msg_free(req);
 	nl_sock_free(nl_sock);
-	return -1;
+
+	return 0;
 }
 
 #ifdef USE_LOCALNET_ROUTING
@@ -434,6 +465,33 @@ network_interface_is_wifi(const char *if_name)
 	return ret;
 }
 
+int
+network_set_gro(const char *if_name, bool enable)
+{
+	ASSERT(if_name);
+
+	struct ethtool_value eval = { .cmd = ETHTOOL_SGRO, .data = enable };
+	struct ifreq ifr = { .ifr_data = (void *)&eval };
+	int ret = -1;
+
+	IF_TRUE_RETVAL_ERROR(strlen(if_name) >= IFNAMSIZ, -1);
+	strncpy(ifr.ifr_name, if_name, IFNAMSIZ - 1);
+
+	int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		ERROR_ERRNO("Could not open socket for ethtool ioctl");
+		return -1;
+	}
+
+	if (ioctl(sock, SIOCETHTOOL, &ifr) < 0)
+		ERROR_ERRNO("Could not %s GRO of %s", enable ? "enable" : "disable", if_name);
+	else
+		ret = 0;
+
+	close(sock);
+	return ret;
+}
+
 list_t *
 network_get_physical_interfaces_new()
 {
@@ -834,3 +892,32 @@ network_phys_allow_mac(const char *chain, const char *netif, uint8_t mac[6], boo
 	mem_free0(mac_str);
 	return ret;
 }
+
+int
+network_setup_mac_filter(const char *netif, const list_t *mac_whitelist, bool add)
+{
+	ASSERT(netif);
+
+	if (network_nftables)
+		return nft_setup_mac_filter(netif, mac_whitelist, add);
+
+	int ret;
+	ret = network_iptables_phys_deny("INPUT", netif, add);
+	ret |= network_iptables_phys_deny("FORWARD", netif, add);
+	if (ret) {
+		ERROR("Failed to %s deny all on %s", add ? "apply" : "reset", netif);
+		return -1;
+	}
+	for (const list_t *l = mac_whitelist; l; l = l->next) {
+		uint8_t *mac = l->data;
+		ret = network_phys_allow_mac("INPUT", netif, mac, add);
+		ret |= network_phys_allow_mac("FORWARD", netif, mac, add);
+		if (ret) {
+			char *mac_str = network_mac_addr_to_str_new(mac);
+			ERROR("Failed to allow %s on %s", mac_str, netif);
+			mem_free0(mac_str);
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -34,6 +34,7 @@
 #include <stdbool.h>
 #include <sys/types.h>
 #include "list.h"
+#include "nl.h"
 
 #include <net/if.h>
 
@@ -95,6 +96,16 @@ int
 network_setup_port_forwarding(const char *srcip, uint16_t srcport, const char *dstip,
 			      uint16_t dstport, bool enable);
 
+/**
+ * Selects nftables instead of the iptables binary to program the rules of
+ * network_setup_masquerading() and network_setup_mac_filter(). With nftables,
+ * the rules of a subnet or interface are applied atomically in a table of their own.
+ * As separate base chains of nftables and iptables are both evaluated, traffic
+ * accepted by these rules must not be dropped by other iptables rules or policies.
+ */
+void
+network_set_nftables(bool enable);
+
 /**
  * Enable or disable IP masquerading (forwarding) from given subnet.
  */
@@ -121,6 +132,14 @@ network_enable_ip_forwarding(void);
 int
 network_set_flag(const char *ifi_name, const uint32_t flag);
 
+/**
+ * This function creates the netlink request of network_set_flag(), e.g., to send it
+ * as part of a batch of requests.
+ * @return the request message or NULL on failure
+ */
+nl_msg_t *
+network_set_flag_msg_new(const char *ifi_name, const uint32_t flag);
+
 /**
  * Bring up the loopback interface and shrink its subnet.
  */
@@ -158,6 +177,13 @@ network_get_physical_interfaces_new(void);
 bool
 network_interface_is_wifi(const char *if_name);
 
+/**
+ * Enables or disables generic receive offload (GRO) of an interface by the ethtool ioctl.
+ * @return 0 on success, -1 on error
+ */
+int
+network_set_gro(const char *if_name, bool enable);
+
 /**
  * This function moves a wifi interface too the netns of pid.
  *
@@ -268,4 +294,12 @@ network_iptables_phys_deny(const char *chain, const char *netif, bool add);
 int
 network_phys_allow_mac(const char *chain, const char *netif, uint8_t mac[6], bool add);
 
+/**
+ * Adds/Removes the firewall rules to drop all input traffic on the physical
+ * (bridge-port) interface netif, except for the traffic of the clients with the
+ * mac addresses (uint8_t[6]) in mac_whitelist.
+ */
+int
+network_setup_mac_filter(const char *netif, const list_t *mac_whitelist, bool add);
+
 #endif /* NETWORK_H */
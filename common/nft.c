@@ -0,0 +1,550 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2020 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "nft.h"
+#include "nl.h"
+#include "macro.h"
+#include "mem.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nf_conntrack_common.h>
+#include <linux/netfilter_bridge.h>
+
+/* Priorities of the base chains, i.e., 'srcnat' and 'filter' */
+#define NFT_PRIO_SRCNAT 100
+#define NFT_PRIO_FILTER 0
+
+/* Data type of ether_addr sets as used by the nft tool */
+#define NFT_TYPE_ETHERADDR 9
+
+#define NFT_MAC_SET_NAME "allowed"
+#define NFT_MAC_SET_ID 1
+
+#define ETHER_SADDR_OFFSET 6
+#define ETHER_ADDR_LEN 6
+#define IPV4_SADDR_OFFSET 12
+#define IPV4_DADDR_OFFSET 16
+
+static nl_msg_t *
+nft_msg_new(uint16_t type, uint8_t family, uint16_t flags)
+{
+	nl_msg_t *msg = nl_msg_new();
+	IF_NULL_RETVAL_ERROR(msg, NULL);
+
+	struct nfgenmsg nfg = { .nfgen_family = family, .version = NFNETLINK_V0 };
+
+	IF_TRUE_GOTO(nl_msg_set_type(msg, (NFNL_SUBSYS_NFTABLES << 8) | type), err);
+	IF_TRUE_GOTO(nl_msg_set_flags(msg, NLM_F_REQUEST | NLM_F_ACK | flags), err);
+	IF_TRUE_GOTO(nl_msg_set_nfgen_hdr(msg, &nfg), err);
+	return msg;
+err:
+	nl_msg_free(msg);
+	return NULL;
+}
+
+/**
+ * Appends msg to the batch and frees it.
+ */
+static int
+nft_batch_add_free(nl_batch_t *batch, nl_msg_t *msg)
+{
+	IF_NULL_RETVAL(msg, -1);
+
+	int ret = nl_batch_add(batch, msg);
+	nl_msg_free(msg);
+	return ret < 0 ? -1 : 0;
+}
+
+static int
+nft_add_be32(nl_msg_t *msg, int type, uint32_t val)
+{
+	return nl_msg_add_u32(msg, type, htonl(val));
+}
+
+/**
+ * Adds the nested NFTA_DATA_VALUE attribute type with the given data.
+ */
+static int
+nft_add_data_value(nl_msg_t *msg, int type, const void *data, size_t len)
+{
+	struct nlattr *nest = nl_msg_start_nested_attr(msg, type);
+	IF_NULL_RETVAL(nest, -1);
+	IF_TRUE_RETVAL(nl_msg_add_buffer(msg, NFTA_DATA_VALUE, data, len), -1);
+	return nl_msg_end_nested_attr(msg, nest);
+}
+
+/**
+ * Adds an empty table, which replaces an existing table of that name, or only
+ * deletes the table if replace is false.
+ */
+static int
+nft_batch_add_table(nl_batch_t *batch, uint8_t family, const char *table, bool replace)
+{
+	nl_msg_t *msg;
+
+	/* creating the table first ensures that the deletion does not fail */
+	for (int i = 0; i < (replace ? 3 : 2); i++) {
+		msg = nft_msg_new(i == 1 ? NFT_MSG_DELTABLE : NFT_MSG_NEWTABLE, family,
+				  i == 1 ? 0 : NLM_F_CREATE);
+		IF_NULL_RETVAL(msg, -1);
+		if (nl_msg_add_string(msg, NFTA_TABLE_NAME, table)) {
+			nl_msg_free(msg);
+			return -1;
+		}
+		IF_TRUE_RETVAL(nft_batch_add_free(batch, msg), -1);
+	}
+	return 0;
+}
+
+static int
+nft_batch_add_chain(nl_batch_t *batch, uint8_t family, const char *table, const char *chain,
+		    const char *type, uint32_t hook, int32_t prio)
+{
+	struct nlattr *nest;
+	nl_msg_t *msg = nft_msg_new(NFT_MSG_NEWCHAIN, family, NLM_F_CREATE);
+	IF_NULL_RETVAL(msg, -1);
+
+	IF_TRUE_GOTO(nl_msg_add_string(msg, NFTA_CHAIN_TABLE, table), err);
+	IF_TRUE_GOTO(nl_msg_add_string(msg, NFTA_CHAIN_NAME, chain), err);
+	IF_TRUE_GOTO(nl_msg_add_string(msg, NFTA_CHAIN_TYPE, type), err);
+	IF_NULL_GOTO(nest = nl_msg_start_nested_attr(msg, NFTA_CHAIN_HOOK), err);
+	IF_TRUE_GOTO(nft_add_be32(msg, NFTA_HOOK_HOOKNUM, hook), err);
+	IF_TRUE_GOTO(nft_add_be32(msg, NFTA_HOOK_PRIORITY, (uint32_t)prio), err);
+	IF_TRUE_GOTO(nl_msg_end_nested_attr(msg, nest), err);
+	IF_TRUE_GOTO(nft_add_be32(msg, NFTA_CHAIN_POLICY, NF_ACCEPT), err);
+
+	return nft_batch_add_free(batch, msg);
+err:
+	nl_msg_free(msg);
+	return -1;
+}
+
+/**
+ * Starts a new expression in the NFTA_RULE_EXPRESSIONS list of a rule. Its
+ * attributes are added to the returned NFTA_EXPR_DATA attribute.
+ */
+static struct nlattr *
+nft_expr_start(nl_msg_t *msg, const char *name, struct nlattr **elem)
+{
+	IF_NULL_RETVAL(*elem = nl_msg_start_nested_attr(msg, NFTA_LIST_ELEM), NULL);
+	IF_TRUE_RETVAL(nl_msg_add_string(msg, NFTA_EXPR_NAME, name), NULL);
+	return nl_msg_start_nested_attr(msg, NFTA_EXPR_DATA);
+}
+
+static int
+nft_expr_end(nl_msg_t *msg, struct nlattr *data, struct nlattr *elem)
+{
+	IF_TRUE_RETVAL(nl_msg_end_nested_attr(msg, data), -1);
+	return nl_msg_end_nested_attr(msg, elem);
+}
+
+/* Loads len bytes at offset of the header base into register 1 */
+static int
+nft_expr_payload(nl_msg_t *msg, uint32_t base, uint32_t offset, uint32_t len)
+{
+	struct nlattr *elem, *data = nft_expr_start(msg, "payload", &elem);
+	IF_NULL_RETVAL(data, -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_PAYLOAD_DREG, NFT_REG_1), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_PAYLOAD_BASE, base), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_PAYLOAD_OFFSET, offset), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_PAYLOAD_LEN, len), -1);
+	return nft_expr_end(msg, data, elem);
+}
+
+/* Loads the meta data key into register 1 */
+static int
+nft_expr_meta(nl_msg_t *msg, uint32_t key)
+{
+	struct nlattr *elem, *data = nft_expr_start(msg, "meta", &elem);
+	IF_NULL_RETVAL(data, -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_META_DREG, NFT_REG_1), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_META_KEY, key), -1);
+	return nft_expr_end(msg, data, elem);
+}
+
+/* Loads the conntrack key into register 1 */
+static int
+nft_expr_ct(nl_msg_t *msg, uint32_t key)
+{
+	struct nlattr *elem, *data = nft_expr_start(msg, "ct", &elem);
+	IF_NULL_RETVAL(data, -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_CT_DREG, NFT_REG_1), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_CT_KEY, key), -1);
+	return nft_expr_end(msg, data, elem);
+}
+
+/* Masks the len bytes of register 1 with mask */
+static int
+nft_expr_bitwise(nl_msg_t *msg, const void *mask, uint32_t len)
+{
+	uint8_t zero[16] = { 0 };
+	ASSERT(len <= sizeof(zero));
+
+	struct nlattr *elem, *data = nft_expr_start(msg, "bitwise", &elem);
+	IF_NULL_RETVAL(data, -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_BITWISE_SREG, NFT_REG_1), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_BITWISE_DREG, NFT_REG_1), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_BITWISE_LEN, len), -1);
+	IF_TRUE_RETVAL(nft_add_data_value(msg, NFTA_BITWISE_MASK, mask, len), -1);
+	IF_TRUE_RETVAL(nft_add_data_value(msg, NFTA_BITWISE_XOR, zero, len), -1);
+	return nft_expr_end(msg, data, elem);
+}
+
+/* Compares the len bytes of register 1 with value */
+static int
+nft_expr_cmp(nl_msg_t *msg, uint32_t op, const void *value, uint32_t len)
+{
+	struct nlattr *elem, *data = nft_expr_start(msg, "cmp", &elem);
+	IF_NULL_RETVAL(data, -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_CMP_SREG, NFT_REG_1), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_CMP_OP, op), -1);
+	IF_TRUE_RETVAL(nft_add_data_value(msg, NFTA_CMP_DATA, value, len), -1);
+	return nft_expr_end(msg, data, elem);
+}
+
+/* Looks up register 1 in the set */
+static int
+nft_expr_lookup(nl_msg_t *msg, const char *set, uint32_t set_id)
+{
+	struct nlattr *elem, *data = nft_expr_start(msg, "lookup", &elem);
+	IF_NULL_RETVAL(data, -1);
+	IF_TRUE_RETVAL(nl_msg_add_string(msg, NFTA_LOOKUP_SET, set), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_LOOKUP_SET_ID, set_id), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_LOOKUP_SREG, NFT_REG_1), -1);
+	return nft_expr_end(msg, data, elem);
+}
+
+static int
+nft_expr_verdict(nl_msg_t *msg, uint32_t code)
+{
+	struct nlattr *imm, *verdict;
+	struct nlattr *elem, *data = nft_expr_start(msg, "immediate", &elem);
+	IF_NULL_RETVAL(data, -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT), -1);
+	IF_NULL_RETVAL(imm = nl_msg_start_nested_attr(msg, NFTA_IMMEDIATE_DATA), -1);
+	IF_NULL_RETVAL(verdict = nl_msg_start_nested_attr(msg, NFTA_DATA_VERDICT), -1);
+	IF_TRUE_RETVAL(nft_add_be32(msg, NFTA_VERDICT_CODE, code), -1);
+	IF_TRUE_RETVAL(nl_msg_end_nested_attr(msg, verdict), -1);
+	IF_TRUE_RETVAL(nl_msg_end_nested_attr(msg, imm), -1);
+	return nft_expr_end(msg, data, elem);
+}
+
+static int
+nft_expr_masq(nl_msg_t *msg)
+{
+	struct nlattr *elem, *data = nft_expr_start(msg, "masq", &elem);
+	IF_NULL_RETVAL(data, -1);
+	return nft_expr_end(msg, data, elem);
+}
+
+/* Matches the interface the packet entered through */
+static int
+nft_expr_iifname(nl_msg_t *msg, const char *ifname)
+{
+	char name[IFNAMSIZ] = { 0 };
+	strncpy(name, ifname, IFNAMSIZ - 1);
+
+	IF_TRUE_RETVAL(nft_expr_meta(msg, NFT_META_IIFNAME), -1);
+	return nft_expr_cmp(msg, NFT_CMP_EQ, name, sizeof(name));
+}
+
+/* Matches the ipv4 source or destination address against the prefix net/mask */
+static int
+nft_expr_ipv4_prefix(nl_msg_t *msg, uint32_t offset, struct in_addr net, struct in_addr mask)
+{
+	IF_TRUE_RETVAL(nft_expr_payload(msg, NFT_PAYLOAD_NETWORK_HEADER, offset, 4), -1);
+	IF_TRUE_RETVAL(nft_expr_bitwise(msg, &mask, 4), -1);
+	return nft_expr_cmp(msg, NFT_CMP_EQ, &net, 4);
+}
+
+/* Matches the conntrack states established and related */
+static int
+nft_expr_ct_established(nl_msg_t *msg)
+{
+	uint32_t state = NF_CT_STATE_BIT(IP_CT_ESTABLISHED) | NF_CT_STATE_BIT(IP_CT_RELATED);
+	uint32_t zero = 0;
+
+	IF_TRUE_RETVAL(nft_expr_ct(msg, NFT_CT_STATE), -1);
+	IF_TRUE_RETVAL(nft_expr_bitwise(msg, &state, sizeof(state)), -1);
+	return nft_expr_cmp(msg, NFT_CMP_NEQ, &zero, sizeof(zero));
+}
+
+/**
+ * Creates a rule, which is appended to the chain. The expressions of the rule have to be
+ * added and the returned expression list has to be closed by nft_rule_end().
+ */
+static nl_msg_t *
+nft_rule_new(uint8_t family, const char *table, const char *chain, struct nlattr **exprs)
+{
+	nl_msg_t *msg = nft_msg_new(NFT_MSG_NEWRULE, family, NLM_F_CREATE | NLM_F_APPEND);
+	IF_NULL_RETVAL(msg, NULL);
+
+	IF_TRUE_GOTO(nl_msg_add_string(msg, NFTA_RULE_TABLE, table), err);
+	IF_TRUE_GOTO(nl_msg_add_string(msg, NFTA_RULE_CHAIN, chain), err);
+	IF_NULL_GOTO(*exprs = nl_msg_start_nested_attr(msg, NFTA_RULE_EXPRESSIONS), err);
+	return msg;
+err:
+	nl_msg_free(msg);
+	return NULL;
+}
+
+static int
+nft_rule_end(nl_batch_t *batch, nl_msg_t *msg, struct nlattr *exprs)
+{
+	if (nl_msg_end_nested_attr(msg, exprs)) {
+		nl_msg_free(msg);
+		return -1;
+	}
+	return nft_batch_add_free(batch, msg);
+}
+
+static int
+nft_batch_send(nl_batch_t *batch, const char *table)
+{
+	nl_sock_t *nl = nl_sock_default_new(NETLINK_NETFILTER);
+	if (!nl) {
+		ERROR("Failed to open nfnetlink socket to program table %s", table);
+		return -1;
+	}
+
+	int ret = nl_batch_send_kernel_verify(nl, batch);
+	if (ret) {
+		for (int i = 0; i < nl_batch_get_len(batch); i++) {
+			if ((errno = nl_batch_get_error(batch, i))) {
+				ERROR_ERRNO("Failed to program table %s", table);
+				break;
+			}
+		}
+	}
+
+	nl_sock_free(nl);
+	return ret;
+}
+
+/**
+ * Returns the table name prefix_<name>, with all characters of name, which are not
+ * alphanumeric, replaced by '_'.
+ */
+static char *
+nft_table_name_new(const char *prefix, const char *name)
+{
+	char *table = mem_printf("%s_%s", prefix, name);
+	for (char *c = table + strlen(prefix) + 1; *c; c++) {
+		if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+		      (*c >= '0' && *c <= '9')))
+			*c = '_';
+	}
+	return table;
+}
+
+static int
+nft_parse_subnet(const char *subnet, struct in_addr *net, struct in_addr *mask)
+{
+	char *addr = mem_strdup(subnet);
+	char *prefix = strchr(addr, '/');
+	int len = 32;
+
+	if (prefix) {
+		*prefix++ = '\0';
+		char *end;
+		len = strtol(prefix, &end, 10);
+		if (*end || len < 0 || len > 32)
+			goto err;
+	}
+	if (inet_pton(AF_INET, addr, net) != 1)
+		goto err;
+
+	mask->s_addr = len ? htonl(~((1ULL << (32 - len)) - 1)) : 0;
+	net->s_addr &= mask->s_addr;
+
+	mem_free0(addr);
+	return 0;
+err:
+	ERROR("Invalid subnet %s", subnet);
+	mem_free0(addr);
+	return -1;
+}
+
+int
+nft_setup_masquerading(const char *subnet, bool enable)
+{
+	ASSERT(subnet);
+
+	struct in_addr net, mask;
+	IF_TRUE_RETVAL(nft_parse_subnet(subnet, &net, &mask), -1);
+
+	int ret = -1;
+	struct nlattr *exprs;
+	nl_msg_t *msg;
+	char *table = nft_table_name_new("cml_nat", subnet);
+	nl_batch_t *batch = nl_batch_nfnl_new(NFNL_SUBSYS_NFTABLES);
+
+	DEBUG("%s IP forwarding from %s in table %s", enable ? "Enabling" : "Disabling", subnet,
+	      table);
+
+	IF_TRUE_GOTO(nft_batch_add_table(batch, NFPROTO_IPV4, table, enable), out);
+	if (!enable)
+		goto send;
+
+	IF_TRUE_GOTO(nft_batch_add_chain(batch, NFPROTO_IPV4, table, "postrouting", "nat",
+					 NF_INET_POST_ROUTING, NFT_PRIO_SRCNAT),
+		     out);
+	IF_TRUE_GOTO(nft_batch_add_chain(batch, NFPROTO_IPV4, table, "forward", "filter",
+					 NF_INET_FORWARD, NFT_PRIO_FILTER),
+		     out);
+
+	// outgoing: ip saddr <subnet> masquerade
+	IF_NULL_GOTO(msg = nft_rule_new(NFPROTO_IPV4, table, "postrouting", &exprs), out);
+	IF_TRUE_GOTO(nft_expr_ipv4_prefix(msg, IPV4_SADDR_OFFSET, net, mask), err_msg);
+	IF_TRUE_GOTO(nft_expr_masq(msg), err_msg);
+	IF_TRUE_GOTO(nft_rule_end(batch, msg, exprs), out);
+
+	// outgoing: ip saddr <subnet> accept
+	IF_NULL_GOTO(msg = nft_rule_new(NFPROTO_IPV4, table, "forward", &exprs), out);
+	IF_TRUE_GOTO(nft_expr_ipv4_prefix(msg, IPV4_SADDR_OFFSET, net, mask), err_msg);
+	IF_TRUE_GOTO(nft_expr_verdict(msg, NF_ACCEPT), err_msg);
+	IF_TRUE_GOTO(nft_rule_end(batch, msg, exprs), out);
+
+	// incoming: ip daddr <subnet> ct state established,related accept
+	IF_NULL_GOTO(msg = nft_rule_new(NFPROTO_IPV4, table, "forward", &exprs), out);
+	IF_TRUE_GOTO(nft_expr_ipv4_prefix(msg, IPV4_DADDR_OFFSET, net, mask), err_msg);
+	IF_TRUE_GOTO(nft_expr_ct_established(msg), err_msg);
+	IF_TRUE_GOTO(nft_expr_verdict(msg, NF_ACCEPT), err_msg);
+	IF_TRUE_GOTO(nft_rule_end(batch, msg, exprs), out);
+
+send:
+	ret = nft_batch_send(batch, table);
+	goto out;
+err_msg:
+	nl_msg_free(msg);
+out:
+	if (ret)
+		ERROR("Failed to setup IP forwarding from %s", subnet);
+	nl_batch_free(batch);
+	mem_free0(table);
+	return ret;
+}
+
+static int
+nft_batch_add_mac_set(nl_batch_t *batch, const char *table, const list_t *mac_whitelist)
+{
+	nl_msg_t *msg = nft_msg_new(NFT_MSG_NEWSET, NFPROTO_BRIDGE, NLM_F_CREATE);
+	IF_NULL_RETVAL(msg, -1);
+
+	IF_TRUE_GOTO(nl_msg_add_string(msg, NFTA_SET_TABLE, table), err);
+	IF_TRUE_GOTO(nl_msg_add_string(msg, NFTA_SET_NAME, NFT_MAC_SET_NAME), err);
+	IF_TRUE_GOTO(nft_add_be32(msg, NFTA_SET_ID, NFT_MAC_SET_ID), err);
+	IF_TRUE_GOTO(nft_add_be32(msg, NFTA_SET_KEY_TYPE, NFT_TYPE_ETHERADDR), err);
+	IF_TRUE_GOTO(nft_add_be32(msg, NFTA_SET_KEY_LEN, ETHER_ADDR_LEN), err);
+	IF_TRUE_RETVAL(nft_batch_add_free(batch, msg), -1);
+
+	IF_NULL_RETVAL(mac_whitelist, 0);
+
+	struct nlattr *elems;
+	msg = nft_msg_new(NFT_MSG_NEWSETELEM, NFPROTO_BRIDGE, NLM_F_CREATE);
+	IF_NULL_RETVAL(msg, -1);
+
+	IF_TRUE_GOTO(nl_msg_add_string(msg, NFTA_SET_ELEM_LIST_TABLE, table), err);
+	IF_TRUE_GOTO(nl_msg_add_string(msg, NFTA_SET_ELEM_LIST_SET, NFT_MAC_SET_NAME), err);
+	IF_TRUE_GOTO(nft_add_be32(msg, NFTA_SET_ELEM_LIST_SET_ID, NFT_MAC_SET_ID), err);
+	IF_NULL_GOTO(elems = nl_msg_start_nested_attr(msg, NFTA_SET_ELEM_LIST_ELEMENTS), err);
+	for (const list_t *l = mac_whitelist; l; l = l->next) {
+		struct nlattr *elem = nl_msg_start_nested_attr(msg, NFTA_LIST_ELEM);
+		IF_NULL_GOTO(elem, err);
+		IF_TRUE_GOTO(nft_add_data_value(msg, NFTA_SET_ELEM_KEY, l->data, ETHER_ADDR_LEN),
+			     err);
+		IF_TRUE_GOTO(nl_msg_end_nested_attr(msg, elem), err);
+	}
+	IF_TRUE_GOTO(nl_msg_end_nested_attr(msg, elems), err);
+
+	return nft_batch_add_free(batch, msg);
+err:
+	nl_msg_free(msg);
+	return -1;
+}
+
+int
+nft_setup_mac_filter(const char *netif, const list_t *mac_whitelist, bool enable)
+{
+	ASSERT(netif);
+
+	int ret = -1;
+	nl_msg_t *msg;
+	char *table = nft_table_name_new("cml_mac", netif);
+	nl_batch_t *batch = nl_batch_nfnl_new(NFNL_SUBSYS_NFTABLES);
+
+	DEBUG("%s mac filter for %s in table %s", enable ? "Enabling" : "Disabling", netif, table);
+
+	IF_TRUE_GOTO(nft_batch_add_table(batch, NFPROTO_BRIDGE, table, enable), out);
+	if (!enable)
+		goto send;
+
+	IF_TRUE_GOTO(nft_batch_add_mac_set(batch, table, mac_whitelist), out);
+
+	// traffic to the host and bridged traffic, as with the INPUT and FORWARD iptables rules
+	const char *chains[] = { "input", "forward" };
+	const uint32_t hooks[] = { NF_BR_LOCAL_IN, NF_BR_FORWARD };
+
+	for (size_t i = 0; i < 2; i++) {
+		struct nlattr *exprs;
+
+		IF_TRUE_GOTO(nft_batch_add_chain(batch, NFPROTO_BRIDGE, table, chains[i], "filter",
+						 hooks[i], NFT_PRIO_FILTER),
+			     out);
+
+		// iifname <netif> ether saddr @allowed accept
+		IF_NULL_GOTO(msg = nft_rule_new(NFPROTO_BRIDGE, table, chains[i], &exprs), out);
+		IF_TRUE_GOTO(nft_expr_iifname(msg, netif), err_msg);
+		IF_TRUE_GOTO(nft_expr_payload(msg, NFT_PAYLOAD_LL_HEADER, ETHER_SADDR_OFFSET,
+					      ETHER_ADDR_LEN),
+			     err_msg);
+		IF_TRUE_GOTO(nft_expr_lookup(msg, NFT_MAC_SET_NAME, NFT_MAC_SET_ID), err_msg);
+		IF_TRUE_GOTO(nft_expr_verdict(msg, NF_ACCEPT), err_msg);
+		IF_TRUE_GOTO(nft_rule_end(batch, msg, exprs), out);
+
+		// iifname <netif> drop
+		IF_NULL_GOTO(msg = nft_rule_new(NFPROTO_BRIDGE, table, chains[i], &exprs), out);
+		IF_TRUE_GOTO(nft_expr_iifname(msg, netif), err_msg);
+		IF_TRUE_GOTO(nft_expr_verdict(msg, NF_DROP), err_msg);
+		IF_TRUE_GOTO(nft_rule_end(batch, msg, exprs), out);
+	}
+
+send:
+	ret = nft_batch_send(batch, table);
+	goto out;
+err_msg:
+	nl_msg_free(msg);
+out:
+	if (ret)
+		ERROR("Failed to %s mac filter for %s", enable ? "apply" : "reset", netif);
+	nl_batch_free(batch);
+	mem_free0(table);
+	return ret;
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2020 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/**
+ * @file nft.h
+ *
+ * Programs the nftables firewall rules of the CML over netlink. Each ruleset is kept
+ * in its own table, which is replaced or deleted as a whole with a single nfnetlink
+ * batch transaction, so that no rule handles have to be tracked.
+ */
+
+#ifndef NFT_H
+#define NFT_H
+
+#include <stdbool.h>
+#include "list.h"
+
+/**
+ * Masquerades the traffic of the given subnet (x.x.x.x/y) and accepts its forwarded
+ * traffic in the table 'ip cml_nat_<subnet>', see network_setup_masquerading().
+ * @return 0 on success, -1 on error
+ */
+int
+nft_setup_masquerading(const char *subnet, bool enable);
+
+/**
+ * Drops all traffic entering the bridge through its port netif, except for the
+ * traffic of the given mac addresses, in the table 'bridge cml_mac_<netif>'.
+ * The mac addresses are looked up in a hash set of that table.
+ * @return 0 on success, -1 on error
+ */
+int
+nft_setup_mac_filter(const char *netif, const list_t *mac_whitelist, bool enable);
+
+#endif /* NFT_H */
@@ -23,6 +23,7 @@
 
 #include "nl.h"
 #include <sys/uio.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,6 +48,15 @@
 #define NL_DEFAULT_SOCK_SNDBUF_SIZE 32768
 #define NL_UEVENT_SOCK_RCVBUF_SIZE (256 * 1024)
 
+/**
+ * Limits for batched requests, see nl_batch_send_kernel_verify()
+ */
+#define NL_BATCH_MAX_MSGS 0xffff
+#define NL_BATCH_CHUNK_MSGS 16
+#define NL_BATCH_CHUNK_SIZE (NL_DEFAULT_SOCK_RCVBUF_SIZE / 4)
+#define NL_BATCH_SEQ_FLAG (1U << 31)
+#define NL_BATCH_GEN_MASK 0x7fff
+
 #define NLA_DATA(nla) (char *)nla + NLA_HDRLEN
 
 #define NL_HDR_OFFSET(len) len + NLMSG_ALIGN(len);
@@ -181,7 +191,7 @@ nl_mgrp(uint32_t group)
  * @return failure: -1, success: 0
  */
 static int
-nl_sock_conf_uevent_sock(nl_sock_t *sock)
+nl_sock_conf_uevent_sock(nl_sock_t *sock, uint32_t groups)
 {
 	ASSERT(sock);
 	int passcreds = 1;
@@ -207,7 +217,7 @@ nl_sock_conf_uevent_sock(nl_sock_t *sock)
 	}
 
 	sock->local.nl_family = AF_NETLINK;
-	sock->local.nl_groups = 0xffffffff;
+	sock->local.nl_groups = groups;
 
 	return 0;
 }
@@ -241,7 +251,7 @@ nl_sock_new(int protocol, uint32_t groups)
 
 	switch (protocol) {
 	case NETLINK_KOBJECT_UEVENT:
-		if (nl_sock_conf_uevent_sock(ret)) {
+		if (nl_sock_conf_uevent_sock(ret, groups)) {
 			goto err;
 		}
 		break;
@@ -285,9 +295,33 @@ nl_sock_uevent_new(pid_t udevd_pid)
 {
 	TRACE("Creating uevent nl socket");
 	trusted_udevd_pid = udevd_pid;
+	return nl_sock_new(NETLINK_KOBJECT_UEVENT, 0xffffffff);
+}
+
+nl_sock_t *
+nl_sock_uevent_send_new()
+{
+	TRACE("Creating uevent nl socket for sending");
 	return nl_sock_new(NETLINK_KOBJECT_UEVENT, 0);
 }
 
+nl_sock_t *
+nl_sock_new_from_fd(int fd)
+{
+	nl_sock_t *ret = mem_new0(nl_sock_t, 1);
+	socklen_t socklen = sizeof(ret->local);
+
+	ret->fd = fd;
+	if (getsockname(fd, (struct sockaddr *)&ret->local, &socklen) < 0 ||
+	    socklen != sizeof(ret->local) || ret->local.nl_family != AF_NETLINK) {
+		TRACE_ERRNO("fd %d is not a bound netlink socket", fd);
+		nl_sock_free(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
 nl_sock_t *
 nl_sock_routing_new()
 {
@@ -303,6 +337,13 @@ nl_sock_ifaddr_new()
 	return nl_sock_new(NETLINK_ROUTE, nl_groups);
 }
 
+nl_sock_t *
+nl_sock_link_new()
+{
+	TRACE("Creating routing nl socket for link events");
+	return nl_sock_new(NETLINK_ROUTE, nl_mgrp(RTNLGRP_LINK));
+}
+
 nl_sock_t *
 nl_sock_xfrm_new()
 {
@@ -556,6 +597,68 @@ nl_msg_receive_nocred(const nl_sock_t *nl, char *buf, const size_t len)
 	return nl_msg_receive(nl, buf, len, false, false);
 }
 
+static int
+nl_msg_receive_batch(const nl_sock_t *nl, char **bufs, size_t len, int *lens, unsigned n,
+		     bool receive_uevent)
+{
+	ASSERT(nl);
+
+	struct sockaddr_nl nladdr[NL_RECV_BATCH_MAX];
+	char control[NL_RECV_BATCH_MAX][CMSG_SPACE(sizeof(struct ucred))];
+	struct iovec iov[NL_RECV_BATCH_MAX];
+	struct mmsghdr mm[NL_RECV_BATCH_MAX];
+	int received;
+
+	IF_TRUE_RETVAL_ERROR(n == 0 || n > NL_RECV_BATCH_MAX, -1);
+
+	mem_memset0(mm, n * sizeof(struct mmsghdr));
+	for (unsigned i = 0; i < n; i++) {
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = len;
+		mm[i].msg_hdr.msg_name = &nladdr[i];
+		mm[i].msg_hdr.msg_namelen = sizeof(nladdr[i]);
+		mm[i].msg_hdr.msg_iov = &iov[i];
+		mm[i].msg_hdr.msg_iovlen = 1;
+		mm[i].msg_hdr.msg_control = control[i];
+		mm[i].msg_hdr.msg_controllen = sizeof(control[i]);
+	}
+
+	do {
+		received = recvmmsg(nl->fd, mm, n, MSG_DONTWAIT, NULL);
+	} while (received < 0 && errno == EINTR);
+
+	if (received < 0) {
+		TRACE_ERRNO("recvmmsg failed");
+		return -1;
+	}
+
+	// same sanity checks as nl_msg_receive() for each message of the batch
+	for (int i = 0; i < received; i++) {
+		lens[i] = mm[i].msg_len;
+		if ((receive_uevent && nl_verify_uevent_source(&mm[i].msg_hdr, nladdr[i])) ||
+		    (mm[i].msg_hdr.msg_flags & MSG_TRUNC) || nladdr[i].nl_family != AF_NETLINK) {
+			TRACE("Purged message %d of batch, as it did not pass sanity checks", i);
+			mem_memset(bufs[i], 0, lens[i]);
+			lens[i] = -1;
+		}
+	}
+
+	TRACE("Received %d messages with a single recvmmsg", received);
+	return received;
+}
+
+int
+nl_msg_receive_uevents(const nl_sock_t *nl, char **bufs, size_t len, int *lens, unsigned n)
+{
+	return nl_msg_receive_batch(nl, bufs, len, lens, n, true);
+}
+
+int
+nl_msg_receive_kernel_batch(const nl_sock_t *nl, char **bufs, size_t len, int *lens, unsigned n)
+{
+	return nl_msg_receive_batch(nl, bufs, len, lens, n, false);
+}
+
 /**
  * This function may possibly block!
  */
@@ -673,6 +776,234 @@ nl_msg_send_kernel_verify(const nl_sock_t *nl_sock, const nl_msg_t *req)
 	return nl_eval_ack(nl_sock, req->nlmsghdr.nlmsg_seq);
 }
 
+/**
+ * Batch of netlink requests, concatenated in a single buffer
+ */
+struct nl_batch {
+	char *buf;	 //!< concatenated requests
+	size_t size;	 //!< allocated size of buf
+	size_t *offsets; //!< offset of each request in buf, offsets[n] is the used length
+	int *errors;	 //!< error of each request reported by its ACK
+	int n;		 //!< number of requests
+	bool nfnl;	 //!< enclose the requests in an nfnetlink batch transaction
+	uint16_t res_id; //!< nfnetlink subsystem of the transaction
+};
+
+nl_batch_t *
+nl_batch_new(void)
+{
+	nl_batch_t *batch = mem_new0(nl_batch_t, 1);
+	batch->offsets = mem_new0(size_t, 1);
+	return batch;
+}
+
+nl_batch_t *
+nl_batch_nfnl_new(uint16_t res_id)
+{
+	nl_batch_t *batch = nl_batch_new();
+	batch->nfnl = true;
+	batch->res_id = res_id;
+	return batch;
+}
+
+void
+nl_batch_free(nl_batch_t *batch)
+{
+	IF_NULL_RETURN(batch);
+
+	mem_free0(batch->buf);
+	mem_free0(batch->offsets);
+	mem_free0(batch->errors);
+	mem_free0(batch);
+}
+
+int
+nl_batch_add(nl_batch_t *batch, const nl_msg_t *req)
+{
+	ASSERT(batch && req);
+
+	if (!(req->nlmsghdr.nlmsg_flags & NLM_F_ACK)) {
+		ERROR("nl request message must have the NLM_F_ACK flag set");
+		return -1;
+	}
+	IF_TRUE_RETVAL_ERROR(batch->n >= NL_BATCH_MAX_MSGS, -1);
+
+	size_t len = NLMSG_ALIGN(req->nlmsghdr.nlmsg_len);
+	size_t used = batch->offsets[batch->n];
+
+	if (used + len > batch->size) {
+		batch->size = MAX(2 * batch->size, used + len);
+		batch->buf = mem_realloc(batch->buf, batch->size);
+	}
+	mem_memset(batch->buf + used, 0, len);
+	memcpy(batch->buf + used, &req->nlmsghdr, req->nlmsghdr.nlmsg_len);
+
+	batch->n++;
+	batch->offsets = mem_renew(size_t, batch->offsets, batch->n + 1);
+	batch->offsets[batch->n] = used + len;
+	batch->errors = mem_renew(int, batch->errors, batch->n);
+	batch->errors[batch->n - 1] = 0;
+
+	return batch->n - 1;
+}
+
+int
+nl_batch_get_len(const nl_batch_t *batch)
+{
+	ASSERT(batch);
+	return batch->n;
+}
+
+int
+nl_batch_get_error(const nl_batch_t *batch, int idx)
+{
+	ASSERT(batch && idx >= 0 && idx < batch->n);
+	return batch->errors[idx];
+}
+
+/**
+ * Fills the nfnetlink message hdr of type NFNL_MSG_BATCH_BEGIN or NFNL_MSG_BATCH_END,
+ * which encloses an nfnetlink batch transaction.
+ */
+static void
+nl_batch_nfnl_hdr(const nl_batch_t *batch, struct nlmsghdr *hdr, uint16_t type, uint32_t seq)
+{
+	*hdr = (struct nlmsghdr){ .nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg)),
+				  .nlmsg_type = type,
+				  .nlmsg_flags = NLM_F_REQUEST,
+				  .nlmsg_seq = seq };
+	struct nfgenmsg *nfg = NLMSG_DATA(hdr);
+	*nfg = (struct nfgenmsg){ .nfgen_family = AF_UNSPEC,
+				  .version = NFNETLINK_V0,
+				  .res_id = htons(batch->res_id) };
+}
+
+/**
+ * Sends the requests first to last of the batch with a single sendmsg() call and
+ * waits for their ACKs, which are matched by the sequence numbers starting at seq.
+ * @return the number of failed requests
+ */
+static int
+nl_batch_send_chunk(const nl_sock_t *nl, nl_batch_t *batch, int first, int last, uint32_t seq)
+{
+	int pending = last - first + 1;
+	char *buf = NULL;
+
+	for (int i = first; i <= last; i++) {
+		struct nlmsghdr *nlmsg = (struct nlmsghdr *)(batch->buf + batch->offsets[i]);
+		nlmsg->nlmsg_seq = seq + i;
+		batch->errors[i] = EIO;
+	}
+
+	/* Errors of the whole transaction are reported for its begin message */
+	uint32_t seq_nfnl = seq + NL_BATCH_MAX_MSGS;
+	char begin[NLMSG_SPACE(sizeof(struct nfgenmsg))];
+	char end[NLMSG_SPACE(sizeof(struct nfgenmsg))];
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct iovec iov[3] = {
+		{ .iov_base = begin, .iov_len = sizeof(begin) },
+		{ .iov_base = batch->buf + batch->offsets[first],
+		  .iov_len = batch->offsets[last + 1] - batch->offsets[first] },
+		{ .iov_base = end, .iov_len = sizeof(end) },
+	};
+	struct msghdr m = { .msg_name = &nladdr,
+			    .msg_namelen = sizeof(nladdr),
+			    .msg_iov = batch->nfnl ? iov : &iov[1],
+			    .msg_iovlen = batch->nfnl ? 3 : 1 };
+
+	if (batch->nfnl) {
+		nl_batch_nfnl_hdr(batch, (struct nlmsghdr *)begin, NFNL_MSG_BATCH_BEGIN, seq_nfnl);
+		nl_batch_nfnl_hdr(batch, (struct nlmsghdr *)end, NFNL_MSG_BATCH_END, seq_nfnl);
+	}
+
+	TRACE("Sending %d batched messages (%zu bytes) on socket with fd %d to kernel", pending,
+	      iov[1].iov_len, nl->fd);
+
+	if (sendmsg(nl->fd, &m, 0) < 0) {
+		ERROR_ERRNO("Failed to send batched netlink messages");
+		for (int i = first; i <= last; i++)
+			batch->errors[i] = errno;
+		return pending;
+	}
+
+	buf = mem_new0(char, NL_DEFAULT_SOCK_RCVBUF_SIZE);
+
+	while (pending > 0) {
+		int rcvd = nl_msg_receive_kernel(nl, buf, NL_DEFAULT_SOCK_RCVBUF_SIZE, false);
+		if (rcvd <= 0) {
+			ERROR("Failed to receive ACKs of batched netlink messages");
+			break;
+		}
+
+		for (struct nlmsghdr *msg = (struct nlmsghdr *)buf;
+		     NLMSG_OK(msg, (unsigned int)rcvd); msg = NLMSG_NEXT(msg, rcvd)) {
+			/* skip responses of other requests and non ACK responses of ours */
+			if (nl->local.nl_pid != msg->nlmsg_pid || msg->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			struct nlmsgerr *errack = NLMSG_DATA(msg);
+
+			if (batch->nfnl && msg->nlmsg_seq == seq_nfnl) {
+				errno = -(errack->error);
+				ERROR_ERRNO("nfnetlink batch transaction failed");
+				for (int i = first; i <= last; i++)
+					batch->errors[i] = errno ? errno : EIO;
+				pending = 0;
+				break;
+			}
+			if (msg->nlmsg_seq < seq + first || msg->nlmsg_seq > seq + last)
+				continue;
+
+			int i = msg->nlmsg_seq - seq;
+
+			batch->errors[i] = -(errack->error);
+			pending--;
+			if (batch->errors[i]) {
+				errno = batch->errors[i];
+				DEBUG_ERRNO("ACK reports an error for batched message %d", i);
+			}
+		}
+	}
+	mem_free0(buf);
+
+	int failed = 0;
+	for (int i = first; i <= last; i++)
+		if (batch->errors[i])
+			failed++;
+	return failed;
+}
+
+int
+nl_batch_send_kernel_verify(const nl_sock_t *nl, nl_batch_t *batch)
+{
+	ASSERT(nl && batch);
+
+	static uint32_t nl_batch_gen = 0;
+	int failed = 0;
+
+	/* Sequence numbers of batches never match the fd used by single requests */
+	uint32_t seq = NL_BATCH_SEQ_FLAG | ((++nl_batch_gen & NL_BATCH_GEN_MASK) << 16);
+
+	for (int first = 0, last; first < batch->n; first = last + 1) {
+		/* Limit chunks, so that all ACKs, which echo the failed requests, fit into
+		 * the receive buffer of the socket. A transaction is not split. */
+		for (last = first; last + 1 < batch->n && last + 1 - first < NL_BATCH_CHUNK_MSGS;
+		     last++) {
+			if (batch->offsets[last + 2] - batch->offsets[first] > NL_BATCH_CHUNK_SIZE)
+				break;
+		}
+		if (batch->nfnl)
+			last = batch->n - 1;
+		failed += nl_batch_send_chunk(nl, batch, first, last, seq);
+	}
+
+	if (failed) {
+		ERROR("%d of %d batched netlink requests failed", failed, batch->n);
+		return -1;
+	}
+	return 0;
+}
+
 nl_msg_t *
 nl_msg_new()
 {
@@ -799,6 +1130,16 @@ nl_msg_set_genl_hdr(nl_msg_t *msg, const struct genlmsghdr *hdr)
 	return nl_msg_set_len(msg, GENL_HDRLEN);
 }
 
+int
+nl_msg_set_nfgen_hdr(nl_msg_t *msg, const struct nfgenmsg *hdr)
+{
+	ASSERT(msg);
+
+	memcpy(NLMSG_DATA(&msg->nlmsghdr), hdr, sizeof(struct nfgenmsg));
+
+	return nl_msg_set_len(msg, sizeof(struct nfgenmsg));
+}
+
 int
 nl_msg_receive_and_check_kernel(const nl_sock_t *nl)
 {
@@ -969,3 +1310,71 @@ msg_err:
 		mem_free0(buf);
 	return 0;
 }
+
+int
+nl_link_stats_dump(const nl_sock_t *nl, nl_link_stats_cb_t func, void *data)
+{
+	ASSERT(nl && func);
+
+	int ret = -1;
+	bool nlmsg_done = false;
+	char *buf = NULL;
+	struct ifinfomsg ifmsg = { .ifi_family = AF_UNSPEC };
+
+	nl_msg_t *req = nl_msg_new();
+	IF_NULL_RETVAL_ERROR(req, -1);
+
+	IF_TRUE_GOTO_ERROR(nl_msg_set_type(req, RTM_GETLINK), out);
+	IF_TRUE_GOTO_ERROR(nl_msg_set_link_req(req, &ifmsg), out);
+	IF_TRUE_GOTO_ERROR(nl_msg_set_flags(req, NLM_F_REQUEST | NLM_F_DUMP), out);
+	IF_TRUE_GOTO_ERROR(nl_msg_send_kernel(nl, req) < 0, out);
+
+	buf = mem_new0(char, NL_DEFAULT_SOCK_RCVBUF_SIZE);
+
+	while (!nlmsg_done) {
+		struct nlmsghdr *msg;
+		int rcvd = nl_msg_receive_nocred(nl, buf, NL_DEFAULT_SOCK_RCVBUF_SIZE);
+		IF_TRUE_GOTO_ERROR(rcvd <= 0, out);
+
+		for (msg = (struct nlmsghdr *)buf; NLMSG_OK(msg, (unsigned int)rcvd);
+		     msg = NLMSG_NEXT(msg, rcvd)) {
+			// skip left overs of previous requests on this socket
+			if (msg->nlmsg_seq != (unsigned int)nl->fd)
+				continue;
+
+			IF_TRUE_GOTO_ERROR(msg->nlmsg_type == NLMSG_ERROR, out);
+			if (msg->nlmsg_type == NLMSG_DONE) {
+				nlmsg_done = true;
+				break;
+			}
+			if (msg->nlmsg_type != RTM_NEWLINK)
+				continue;
+
+			struct ifinfomsg *ifi = NLMSG_DATA(msg);
+			int len = IFLA_PAYLOAD(msg);
+			const char *ifname = NULL;
+			struct rtnl_link_stats64 stats;
+			bool has_stats = false;
+
+			for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+			     rta = RTA_NEXT(rta, len)) {
+				if (rta->rta_type == IFLA_IFNAME) {
+					ifname = RTA_DATA(rta);
+				} else if (rta->rta_type == IFLA_STATS64 &&
+					   RTA_PAYLOAD(rta) >= sizeof(stats)) {
+					// attribute payloads are only 4 byte aligned
+					memcpy(&stats, RTA_DATA(rta), sizeof(stats));
+					has_stats = true;
+				}
+			}
+			if (ifname && has_stats)
+				func(ifname, &stats, data);
+		}
+	}
+	ret = 0;
+out:
+	nl_msg_free(req);
+	if (buf)
+		mem_free0(buf);
+	return ret;
+}
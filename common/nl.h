@@ -40,6 +40,7 @@
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <linux/genetlink.h>
+#include <linux/netfilter/nfnetlink.h>
 #include <stdbool.h>
 
 /* Define some missing netlink defines in BIONIC */
@@ -49,6 +50,7 @@
 
 typedef struct nl_sock nl_sock_t;
 typedef struct nl_msg nl_msg_t;
+typedef struct nl_batch nl_batch_t;
 
 /**
  * Allocates, opens and returns a nl_sock object of family NETLINK_KOBJECT_UEVENT with various netlink options.
@@ -58,6 +60,22 @@ typedef struct nl_msg nl_msg_t;
 nl_sock_t *
 nl_sock_uevent_new(pid_t udevd_pid);
 
+/**
+ * Allocates, opens and returns a nl_sock object of family NETLINK_KOBJECT_UEVENT which
+ * does not join any multicast group, e.g., to inject uevents and receive their ACKs.
+ * @return Pointer to nl_sock; NULL in case of failure
+ */
+nl_sock_t *
+nl_sock_uevent_send_new();
+
+/**
+ * Wraps a bound netlink socket, e.g., one received from another process, into a
+ * nl_sock object, which takes ownership of fd.
+ * @return Pointer to nl_sock; NULL if fd is not a bound netlink socket, fd is closed then
+ */
+nl_sock_t *
+nl_sock_new_from_fd(int fd);
+
 /**
  * Allocates, opens and returns a nl_sock object of family NETLINK_ROUTE with various netlink options.
  * Depending on the protocol, the socket options are implicitly set.
@@ -88,6 +106,16 @@ nl_sock_xfrm_new();
 nl_sock_t *
 nl_sock_ifaddr_new();
 
+/**
+ * Allocates, opens and returns a nl_sock object of family NETLINK_ROUTE with various netlink options.
+ * The socket is subscribed to RTMGRP_LINK events, i.e., RTM_NEWLINK and RTM_DELLINK.
+ * Priviledges are required, because this socket is using a RCVBUFFORCE flag option overwriting
+ * the max recv-buf file.
+ * @return Pointer to nl_sock; NULL in case of failure
+ */
+nl_sock_t *
+nl_sock_link_new();
+
 /**
  * Allocates, opens and returns a nl_sock object of a different netlink family than the other
  * sock_*_new functions without specific netlink options.
@@ -127,6 +155,32 @@ nl_msg_send_kernel(const nl_sock_t *sock, const nl_msg_t *msg);
 int
 nl_msg_receive_kernel(const nl_sock_t *sock, char *buf, size_t len, bool receive_uevent);
 
+/* maximum number of messages received by one call of nl_msg_receive_*_batch() */
+#define NL_RECV_BATCH_MAX 16
+/* maximum number of uevents received by one call of nl_msg_receive_uevents() */
+#define NL_UEVENT_RECV_BATCH_MAX NL_RECV_BATCH_MAX
+
+/**
+ * Receive up to n pending uevents from a non-blocking uevent socket with a single
+ * recvmmsg call. Each message is checked like by nl_msg_receive_kernel() with
+ * receive_uevent set. Messages which fail the checks are purged, their length is -1.
+ * @param bufs n preallocated buffers of len bytes each, filled with the messages
+ * @param lens array of n lengths, filled with the number of bytes of each message
+ * @return the number of received messages, -1 on failure, e.g. if none is pending
+ */
+int
+nl_msg_receive_uevents(const nl_sock_t *sock, char **bufs, size_t len, int *lens, unsigned n);
+
+/**
+ * Receive up to n pending messages from a non-blocking netlink socket with a single
+ * recvmmsg call, like nl_msg_receive_uevents() but without the checks of the uevent source.
+ * Truncated messages are purged, their length is -1.
+ * @return the number of received messages, -1 on failure, e.g. if none is pending
+ */
+int
+nl_msg_receive_kernel_batch(const nl_sock_t *sock, char **bufs, size_t len, int *lens,
+			    unsigned n);
+
 /**
  * Transmit a message with ACKNOWLEDGEMENT flag
  * and check the ACK response for success.
@@ -137,6 +191,62 @@ nl_msg_receive_kernel(const nl_sock_t *sock, char *buf, size_t len, bool receive
 int
 nl_msg_send_kernel_verify(const nl_sock_t *sock, const nl_msg_t *req);
 
+/**
+ * Allocates an empty batch of netlink requests, which are sent to the kernel
+ * with a single nl_batch_send_kernel_verify() call.
+ */
+nl_batch_t *
+nl_batch_new(void);
+
+/**
+ * Allocates an empty batch of nfnetlink requests for the subsystem res_id, e.g.,
+ * NFNL_SUBSYS_NFTABLES. Its requests are enclosed in NFNL_MSG_BATCH_BEGIN/END
+ * messages and sent with a single sendmsg() call, thus, the kernel applies either
+ * all or none of them. An error of the whole transaction is reported for all requests.
+ */
+nl_batch_t *
+nl_batch_nfnl_new(uint16_t res_id);
+
+/**
+ * Frees a batch of netlink requests.
+ */
+void
+nl_batch_free(nl_batch_t *batch);
+
+/**
+ * Appends a copy of the request req to the batch. The request must have the NLM_F_ACK
+ * flag set and may be freed or reused by the caller afterwards.
+ * @return In case of failure, return -1, in case of success, return the index of the
+ *         request in the batch
+ */
+int
+nl_batch_add(nl_batch_t *batch, const nl_msg_t *req);
+
+/**
+ * Returns the number of requests in the batch.
+ */
+int
+nl_batch_get_len(const nl_batch_t *batch);
+
+/**
+ * Transmits all requests of the batch with increasing sequence numbers and collects
+ * their ACK responses. Instead of waiting for the ACK of each request before the next
+ * one is sent, the requests are sent in chunks with a single sendmsg() call each,
+ * limited to what the socket is able to take including the ACKs. Requests following
+ * a failed one are still processed by the kernel.
+ * This is a blocking function, as it calls the nl_receive_kernel function.
+ * @return In case any request failed, return -1, in case of success, return 0
+ */
+int
+nl_batch_send_kernel_verify(const nl_sock_t *sock, nl_batch_t *batch);
+
+/**
+ * Returns the error reported by the ACK of the request with index idx after the batch
+ * was sent, i.e., 0 on success, otherwise the errno of the failed request.
+ */
+int
+nl_batch_get_error(const nl_batch_t *batch, int idx);
+
 /**
  * Allocates a raw netlink message, which can be completed
  * with the set/add functions.
@@ -255,6 +365,14 @@ nl_msg_set_buf_unaligned(nl_msg_t *msg, char *buf, size_t size);
 int
 nl_msg_set_genl_hdr(nl_msg_t *msg, const struct genlmsghdr *hdr);
 
+/**
+ * Sets the request according to the given struct nfgenmsg
+ * The message length is adapted accordingly.
+ * @return failure: -1, success: 0
+ */
+int
+nl_msg_set_nfgen_hdr(nl_msg_t *msg, const struct nfgenmsg *hdr);
+
 /**
  * Receives and checks a response from the netlink socket nl
  * The errno is set accordingly, if the recevied message had an error code set.
@@ -271,4 +389,15 @@ nl_msg_receive_and_check_kernel(const nl_sock_t *nl);
 uint16_t
 nl_genl_family_getid(const char *family_name);
 
+typedef void (*nl_link_stats_cb_t)(const char *ifname, const struct rtnl_link_stats64 *stats,
+				   void *data);
+
+/**
+ * Dumps the statistics of all links in the network namespace of the NETLINK_ROUTE
+ * socket nl with a single RTM_GETLINK request and calls func for each link.
+ * @return failure: -1, success: 0
+ */
+int
+nl_link_stats_dump(const nl_sock_t *nl, nl_link_stats_cb_t func, void *data);
+
 #endif /* NL_H_ */
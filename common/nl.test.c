@@ -0,0 +1,242 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "munit.h"
+
+#include "nl.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+#include "fd.h"
+
+#include <errno.h>
+#include <net/if.h>
+#include <linux/netfilter/nf_tables.h>
+
+#define TEST_BATCH_LEN 40
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+
+	nl_sock_t *nl = nl_sock_routing_new();
+	munit_assert_not_null(nl);
+	return nl;
+}
+
+static void
+tear_down(void *fixture)
+{
+	nl_sock_free(fixture);
+}
+
+static int
+add_getlink(nl_batch_t *batch, int ifindex, uint16_t flags)
+{
+	struct ifinfomsg link_req = { .ifi_family = AF_UNSPEC, .ifi_index = ifindex };
+
+	nl_msg_t *req = nl_msg_new();
+	munit_assert_not_null(req);
+	munit_assert_int(nl_msg_set_type(req, RTM_GETLINK), ==, 0);
+	munit_assert_int(nl_msg_set_flags(req, flags), ==, 0);
+	munit_assert_int(nl_msg_set_link_req(req, &link_req), ==, 0);
+
+	int idx = nl_batch_add(batch, req);
+	nl_msg_free(req);
+	return idx;
+}
+
+static MunitResult
+test_batch(UNUSED const MunitParameter params[], void *fixture)
+{
+	nl_sock_t *nl = fixture;
+	int lo = if_nametoindex("lo");
+	munit_assert_int(lo, >, 0);
+
+	nl_batch_t *batch = nl_batch_new();
+	munit_assert_not_null(batch);
+
+	// more requests than fit into a single chunk
+	for (int i = 0; i < TEST_BATCH_LEN; i++)
+		munit_assert_int(add_getlink(batch, lo, NLM_F_REQUEST | NLM_F_ACK), ==, i);
+	munit_assert_int(nl_batch_get_len(batch), ==, TEST_BATCH_LEN);
+
+	// requests without NLM_F_ACK are rejected
+	munit_assert_int(add_getlink(batch, lo, NLM_F_REQUEST), ==, -1);
+	munit_assert_int(nl_batch_get_len(batch), ==, TEST_BATCH_LEN);
+
+	munit_assert_int(nl_batch_send_kernel_verify(nl, batch), ==, 0);
+	for (int i = 0; i < TEST_BATCH_LEN; i++)
+		munit_assert_int(nl_batch_get_error(batch, i), ==, 0);
+
+	// a batch can be sent again on the same socket
+	munit_assert_int(nl_batch_send_kernel_verify(nl, batch), ==, 0);
+
+	nl_batch_free(batch);
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_batch_error(UNUSED const MunitParameter params[], void *fixture)
+{
+	nl_sock_t *nl = fixture;
+	int lo = if_nametoindex("lo");
+	munit_assert_int(lo, >, 0);
+
+	nl_batch_t *batch = nl_batch_new();
+	munit_assert_not_null(batch);
+
+	munit_assert_int(add_getlink(batch, lo, NLM_F_REQUEST | NLM_F_ACK), ==, 0);
+	munit_assert_int(add_getlink(batch, 0x7fffffff, NLM_F_REQUEST | NLM_F_ACK), ==, 1);
+	munit_assert_int(add_getlink(batch, lo, NLM_F_REQUEST | NLM_F_ACK), ==, 2);
+
+	// the error is mapped to the failed request, the following one is still processed
+	munit_assert_int(nl_batch_send_kernel_verify(nl, batch), ==, -1);
+	munit_assert_int(nl_batch_get_error(batch, 0), ==, 0);
+	munit_assert_int(nl_batch_get_error(batch, 1), ==, ENODEV);
+	munit_assert_int(nl_batch_get_error(batch, 2), ==, 0);
+
+	// an empty batch succeeds
+	nl_batch_t *empty = nl_batch_new();
+	munit_assert_int(nl_batch_send_kernel_verify(nl, empty), ==, 0);
+	nl_batch_free(empty);
+
+	nl_batch_free(batch);
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_batch_nfnl(UNUSED const MunitParameter params[], UNUSED void *fixture)
+{
+	nl_sock_t *nl = nl_sock_default_new(NETLINK_NETFILTER);
+	munit_assert_not_null(nl);
+
+	nl_batch_t *batch = nl_batch_nfnl_new(NFNL_SUBSYS_NFTABLES);
+	munit_assert_not_null(batch);
+
+	// getting the ruleset generation is no batch operation, thus the transaction fails
+	// either for the request or as a whole for unprivileged sockets
+	nl_msg_t *req = nl_msg_new();
+	struct nfgenmsg nfg = { .nfgen_family = AF_UNSPEC, .version = NFNETLINK_V0 };
+	munit_assert_int(nl_msg_set_type(req, (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_GETGEN), ==,
+			 0);
+	munit_assert_int(nl_msg_set_flags(req, NLM_F_REQUEST | NLM_F_ACK), ==, 0);
+	munit_assert_int(nl_msg_set_nfgen_hdr(req, &nfg), ==, 0);
+	munit_assert_int(nl_batch_add(batch, req), ==, 0);
+	nl_msg_free(req);
+
+	munit_assert_int(nl_batch_send_kernel_verify(nl, batch), ==, -1);
+	munit_assert_int(nl_batch_get_error(batch, 0), !=, 0);
+
+	nl_batch_free(batch);
+	nl_sock_free(nl);
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_receive_batch(UNUSED const MunitParameter params[], void *fixture)
+{
+	nl_sock_t *nl = fixture;
+	int lo = if_nametoindex("lo");
+	munit_assert_int(lo, >, 0);
+
+	char bufs_mem[3][4096];
+	char *bufs[3] = { bufs_mem[0], bufs_mem[1], bufs_mem[2] };
+	int lens[3];
+
+	munit_assert_int(fd_make_non_blocking(nl_sock_get_fd(nl)), ==, 0);
+
+	// nothing pending
+	munit_assert_int(nl_msg_receive_kernel_batch(nl, bufs, sizeof(bufs_mem[0]), lens, 3), ==,
+			 -1);
+
+	// the link and the ACK are received as two messages of one batch
+	struct ifinfomsg link_req = { .ifi_family = AF_UNSPEC, .ifi_index = lo };
+	nl_msg_t *req = nl_msg_new();
+	munit_assert_int(nl_msg_set_type(req, RTM_GETLINK), ==, 0);
+	munit_assert_int(nl_msg_set_flags(req, NLM_F_REQUEST | NLM_F_ACK), ==, 0);
+	munit_assert_int(nl_msg_set_link_req(req, &link_req), ==, 0);
+	munit_assert_int(nl_msg_send_kernel(nl, req), >=, 0);
+	nl_msg_free(req);
+
+	munit_assert_int(nl_msg_receive_kernel_batch(nl, bufs, sizeof(bufs_mem[0]), lens, 3), ==,
+			 2);
+	munit_assert_int(lens[0], >, 0);
+	munit_assert_int(lens[1], >, 0);
+	munit_assert_int(((struct nlmsghdr *)bufs[0])->nlmsg_type, ==, RTM_NEWLINK);
+	munit_assert_int(((struct nlmsghdr *)bufs[1])->nlmsg_type, ==, NLMSG_ERROR);
+
+	munit_assert_int(nl_msg_receive_kernel_batch(nl, bufs, sizeof(bufs_mem[0]), lens,
+						     NL_RECV_BATCH_MAX + 1),
+			 ==, -1);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/batch",		/* name */
+		test_batch,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/batch error",		/* name */
+		test_batch_error,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/batch nfnl",		/* name */
+		test_batch_nfnl,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/receive batch",	/* name */
+		test_receive_batch,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite nl_suite = {
+	"/nl",			/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
@@ -30,6 +30,9 @@
 #include <sys/mount.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <signal.h>
 #include <stdbool.h>
 
 #include <grp.h>
@@ -192,6 +195,58 @@ error:
 	return -1;
 }
 
+/*
+ * Joins the namespaces of namespace_pid given by the clone flags in namespaces and changes the
+ * uid as described for namespace_exec(). Only to be called in a child of cmld.
+ */
+static int
+namespace_join(pid_t namespace_pid, const int namespaces, int uid, int cap)
+{
+	if (namespaces & CLONE_NEWCGROUP) {
+		TRACE("Join cgroup namespace");
+		IF_TRUE_RETVAL(do_join_namespace("cgroup", namespace_pid) == -1, -1);
+	}
+	if (namespaces & CLONE_NEWIPC) {
+		TRACE("Join ipc namespace");
+		IF_TRUE_RETVAL(do_join_namespace("ipc", namespace_pid) == -1, -1);
+	}
+	if (namespaces & CLONE_NEWNET) {
+		TRACE("Join net namespace");
+		IF_TRUE_RETVAL(do_join_namespace("net", namespace_pid) == -1, -1);
+	}
+	if (namespaces & CLONE_NEWUTS) {
+		TRACE("Join uts namespace");
+		IF_TRUE_RETVAL(do_join_namespace("uts", namespace_pid) == -1, -1);
+	}
+	if (namespaces & CLONE_NEWPID) {
+		TRACE("Join pid namespace");
+		IF_TRUE_RETVAL(do_join_namespace("pid_for_children", namespace_pid) == -1, -1);
+	}
+	if (namespaces & CLONE_NEWUSER) {
+		TRACE("Join user namespace");
+		IF_TRUE_RETVAL(do_join_namespace("user", namespace_pid) == -1, -1);
+	}
+	if (namespaces & CLONE_NEWTIME) {
+		TRACE("Join time namespace");
+		IF_TRUE_RETVAL(do_join_namespace("time_for_children", namespace_pid) == -1, -1);
+	}
+	//after joining the mount namespace the container init process has pid 1 in procfs
+	if (namespaces & CLONE_NEWNS) {
+		TRACE("Join mnt namespace");
+		IF_TRUE_RETVAL(do_join_namespace("mnt", namespace_pid) == -1, -1);
+	}
+	if ((namespaces & CLONE_NEWUSER) && uid == 0) {
+		TRACE("Becoming root in target namespace");
+		IF_TRUE_RETVAL(namespace_setuid0() == -1, -1);
+	}
+	if (!(namespaces & CLONE_NEWUSER) && cap) {
+		TRACE("Preserve system wide cap in target namespace");
+		IF_TRUE_RETVAL(namespace_setuid_keep_cap(uid, cap) == -1, -1);
+	}
+
+	return 0;
+}
+
 int
 namespace_exec(pid_t namespace_pid, const int namespaces, int uid, int cap,
 	       int (*func)(const void *), const void *data)
@@ -210,57 +265,8 @@ namespace_exec(pid_t namespace_pid, const int namespaces, int uid, int cap,
 		event_reset(); // do not handle signals in child
 		TRACE("Child to join namespaces forked");
 
-		if (namespaces & CLONE_NEWCGROUP) {
-			TRACE("Join cgroup namespace");
-			if (do_join_namespace("cgroup", namespace_pid) == -1)
-				_exit(-1);
-		}
-		if (namespaces & CLONE_NEWIPC) {
-			TRACE("Join ipc namespace");
-			if (do_join_namespace("ipc", namespace_pid) == -1)
-				_exit(-1);
-		}
-		if (namespaces & CLONE_NEWNET) {
-			TRACE("Join net namespace");
-			if (do_join_namespace("net", namespace_pid) == -1)
-				_exit(-1);
-		}
-		if (namespaces & CLONE_NEWUTS) {
-			TRACE("Join uts namespace");
-			if (do_join_namespace("uts", namespace_pid) == -1)
-				_exit(-1);
-		}
-		if (namespaces & CLONE_NEWPID) {
-			TRACE("Join pid namespace");
-			if (do_join_namespace("pid_for_children", namespace_pid) == -1)
-				_exit(-1);
-		}
-		if (namespaces & CLONE_NEWUSER) {
-			TRACE("Join user namespace");
-			if (do_join_namespace("user", namespace_pid) == -1)
-				_exit(-1);
-		}
-		if (namespaces & CLONE_NEWTIME) {
-			TRACE("Join time namespace");
-			if (do_join_namespace("time_for_children", namespace_pid) == -1)
-				_exit(-1);
-		}
-		//after joining the mount namespace the container init process has pid 1 in procfs
-		if (namespaces & CLONE_NEWNS) {
-			TRACE("Join mnt namespace");
-			if (do_join_namespace("mnt", namespace_pid) == -1)
-				_exit(-1);
-		}
-		if ((namespaces & CLONE_NEWUSER) && uid == 0) {
-			TRACE("Becoming root in target namespace");
-			if (namespace_setuid0() == -1)
-				_exit(-1);
-		}
-		if (!(namespaces & CLONE_NEWUSER) && cap) {
-			TRACE("Preserve system wide cap in target namespace");
-			if (namespace_setuid_keep_cap(uid, cap) == -1)
-				_exit(-1);
-		}
+		if (namespace_join(namespace_pid, namespaces, uid, cap) == -1)
+			_exit(-1);
 
 		TRACE("Executing namespaced function");
 
@@ -292,6 +298,180 @@ namespace_exec(pid_t namespace_pid, const int namespaces, int uid, int cap,
 	return -1;
 }
 
+struct ns_helper {
+	int namespaces;
+	int cap;
+	pid_t ns_pid; // pid whose namespaces the running helper joined
+	int uid;      // uid the running helper changed to
+	pid_t pid;    // pid of the helper, -1 if not running
+	int sock;
+};
+
+typedef struct {
+	int (*func)(const void *);
+	size_t data_len;
+} ns_helper_req_t;
+
+/*
+ * Main loop of the helper process: executes the functions of the requests received on sock
+ * one after another and replies with their return values until sock is closed.
+ */
+static void
+ns_helper_loop(int sock)
+{
+	size_t buf_len = sizeof(ns_helper_req_t) + NS_HELPER_DATA_MAX;
+	unsigned char *buf = mem_alloc(buf_len);
+
+	for (;;) {
+		ssize_t len = recv(sock, buf, buf_len, 0);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		int ret = -1;
+		ns_helper_req_t req;
+		if ((size_t)len >= sizeof(req)) {
+			memcpy(&req, buf, sizeof(req));
+			if (req.data_len == len - sizeof(req)) {
+				TRACE("Executing namespaced function");
+				ret = req.func(buf + sizeof(req));
+				TRACE("Namespaced function returned %d", ret);
+			}
+		}
+
+		if (send(sock, &ret, sizeof(ret), MSG_NOSIGNAL) != sizeof(ret))
+			break;
+	}
+
+	TRACE("Namespace helper exits");
+	_exit(0); // don't call atexit registered cleanup of main process
+}
+
+static int
+ns_helper_start(ns_helper_t *helper, pid_t ns_pid, int uid)
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		ERROR_ERRNO("Could not create socketpair for namespace helper");
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		ERROR_ERRNO("Could not fork namespace helper for namespaces of %d", ns_pid);
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	} else if (pid == 0) {
+		event_reset(); // do not handle signals in child
+		close(sv[0]);
+		// do not outlive cmld
+		if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0)
+			_exit(-1);
+
+		if (namespace_join(ns_pid, helper->namespaces, uid, helper->cap) == -1)
+			_exit(-1);
+
+		ns_helper_loop(sv[1]);
+	}
+
+	close(sv[1]);
+	DEBUG("Started namespace helper %d for namespaces of %d", pid, ns_pid);
+	helper->pid = pid;
+	helper->sock = sv[0];
+	helper->ns_pid = ns_pid;
+	helper->uid = uid;
+	return 0;
+}
+
+ns_helper_t *
+ns_helper_new(const int namespaces, int cap)
+{
+	ns_helper_t *helper = mem_new0(ns_helper_t, 1);
+	helper->namespaces = namespaces;
+	helper->cap = cap;
+	helper->pid = -1;
+	helper->sock = -1;
+	return helper;
+}
+
+void
+ns_helper_stop(ns_helper_t *helper)
+{
+	IF_NULL_RETURN(helper);
+	IF_TRUE_RETURN(helper->pid < 0);
+
+	DEBUG("Stopping namespace helper %d", helper->pid);
+	close(helper->sock);
+	kill(helper->pid, SIGKILL);
+	if (proc_waitpid(helper->pid, NULL, 0) != helper->pid)
+		WARN_ERRNO("Could not waitpid for namespace helper %d", helper->pid);
+
+	helper->pid = -1;
+	helper->sock = -1;
+}
+
+void
+ns_helper_free(ns_helper_t *helper)
+{
+	IF_NULL_RETURN(helper);
+	ns_helper_stop(helper);
+	mem_free0(helper);
+}
+
+int
+ns_helper_exec(ns_helper_t *helper, pid_t ns_pid, int uid, int (*func)(const void *),
+	       const void *data, size_t data_len)
+{
+	ASSERT(helper);
+	ASSERT(func);
+
+	if (ns_pid < 1) {
+		ERROR("Invalid namespace PID given: %d", ns_pid);
+		return -1;
+	}
+	if (data_len > NS_HELPER_DATA_MAX) {
+		ERROR("Data of namespaced function too large (%zu bytes)", data_len);
+		return -1;
+	}
+
+	// the namespaces were replaced, e.g., by a restart of the container
+	if (helper->pid > 0 && (helper->ns_pid != ns_pid || helper->uid != uid))
+		ns_helper_stop(helper);
+
+	if (helper->pid < 0)
+		IF_TRUE_RETVAL(ns_helper_start(helper, ns_pid, uid), -1);
+
+	ns_helper_req_t req = { .func = func, .data_len = data_len };
+	struct iovec iov[2] = { { .iov_base = &req, .iov_len = sizeof(req) },
+				{ .iov_base = (void *)data, .iov_len = data_len } };
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = data_len ? 2 : 1 };
+
+	int ret;
+	if (sendmsg(helper->sock, &msg, MSG_NOSIGNAL) < 0) {
+		WARN_ERRNO("Could not send request to namespace helper %d", helper->pid);
+		goto error;
+	}
+
+	ssize_t len;
+	do {
+		len = recv(helper->sock, &ret, sizeof(ret), 0);
+	} while (len < 0 && errno == EINTR);
+
+	if (len != sizeof(ret)) {
+		// the helper failed to join the namespaces or died executing func
+		WARN("Namespace helper %d did not reply", helper->pid);
+		goto error;
+	}
+
+	return ret;
+
+error:
+	ns_helper_stop(helper);
+	return -1;
+}
+
 #define MAX_NS 16
 static int fd[MAX_NS] = { 0 };
 
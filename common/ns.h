@@ -65,6 +65,63 @@ int
 namespace_exec(pid_t namespace_pid, const int namespaces, int uid, int cap,
 	       int (*func)(const void *), const void *data);
 
+/**
+ * Maximum size of the data of a function executed by a namespace helper.
+ */
+#define NS_HELPER_DATA_MAX 4096
+
+typedef struct ns_helper ns_helper_t;
+
+/**
+ * Creates a namespace helper, which executes functions in the namespaces of a process like
+ * namespace_exec(), but in a long-lived child. The child is forked on first use, joins the
+ * namespaces once and serves the requests of ns_helper_exec() one after another over a
+ * socketpair, which saves a fork, setns and exit per function.
+ *
+ * As the child does not share the memory of the caller, the data of a function is copied
+ * into the request and must not contain pointers to memory allocated after the fork of
+ * the child. Also, state changed by a function persists in the child for later requests.
+ *
+ * @param namespaces clone-flags of the namespaces to join
+ * @param cap keep system-wide capability after setuid, see namespace_exec()
+ * @returns the new helper, the child is not yet started
+ */
+ns_helper_t *
+ns_helper_new(const int namespaces, int cap);
+
+/**
+ * Executes func in the namespaces of ns_pid using the helper. The child of the helper is
+ * (re-)started if it is not running or if it was started for another ns_pid or uid.
+ *
+ * @param helper the namespace helper
+ * @param ns_pid pid of the namespace to join
+ * @param uid uid to change to after joining the namespaces, see namespace_exec()
+ * @param func function pointer that gets executed inside the given namespaces
+ * @param data data passed as a copy to func; at most NS_HELPER_DATA_MAX bytes
+ * @param data_len length of data
+ * @returns the return value of func or -1 if it could not be executed
+ */
+int
+ns_helper_exec(ns_helper_t *helper, pid_t ns_pid, int uid, int (*func)(const void *),
+	       const void *data, size_t data_len);
+
+/**
+ * Terminates the child of the helper if it is running, e.g., when the namespaces are about
+ * to be destroyed. The next ns_helper_exec() starts a new child.
+ *
+ * @param helper the namespace helper
+ */
+void
+ns_helper_stop(ns_helper_t *helper);
+
+/**
+ * Terminates the child of the helper and frees the helper.
+ *
+ * @param helper the namespace helper
+ */
+void
+ns_helper_free(ns_helper_t *helper);
+
 /**
  * This function joins the current process to all namespaces of a process given
  * by its pid. The userns is joined only if switch userns is true.
@@ -0,0 +1,120 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "munit.h"
+
+#include "ns.h"
+#include "logf.h"
+#include "macro.h"
+#include "mem.h"
+
+#include <string.h>
+#include <unistd.h>
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+	return NULL;
+}
+
+static int counter = 0;
+
+static int
+test_helper_func(const void *data)
+{
+	// counts the calls in the helper, the counter of the test runner is not changed
+	return ++counter + *(const int *)data;
+}
+
+static int
+test_helper_exit_func(UNUSED const void *data)
+{
+	_exit(0);
+}
+
+static MunitResult
+test_helper(UNUSED const MunitParameter params[], UNUSED void *fixture)
+{
+	// no namespaces to join, so the helper also runs unprivileged
+	ns_helper_t *helper = ns_helper_new(0, 0);
+	int data = 100;
+
+	// the helper is started once and keeps its state
+	munit_assert_int(ns_helper_exec(helper, getpid(), 0, test_helper_func, &data, sizeof(data)),
+			 ==, 101);
+	data = 200;
+	munit_assert_int(ns_helper_exec(helper, getpid(), 0, test_helper_func, &data, sizeof(data)),
+			 ==, 202);
+	munit_assert_int(counter, ==, 0);
+
+	// a new helper is started for another uid
+	munit_assert_int(ns_helper_exec(helper, getpid(), 1, test_helper_func, &data, sizeof(data)),
+			 ==, 201);
+
+	// a helper which died is restarted on the next request
+	munit_assert_int(ns_helper_exec(helper, getpid(), 1, test_helper_exit_func, NULL, 0), ==,
+			 -1);
+	munit_assert_int(ns_helper_exec(helper, getpid(), 1, test_helper_func, &data, sizeof(data)),
+			 ==, 201);
+
+	ns_helper_stop(helper);
+	munit_assert_int(ns_helper_exec(helper, getpid(), 1, test_helper_func, &data, sizeof(data)),
+			 ==, 201);
+
+	// invalid requests
+	munit_assert_int(ns_helper_exec(helper, 0, 1, test_helper_func, &data, sizeof(data)), ==,
+			 -1);
+	char *big = mem_alloc0(NS_HELPER_DATA_MAX + 1);
+	munit_assert_int(ns_helper_exec(helper, getpid(), 1, test_helper_func, big,
+					NS_HELPER_DATA_MAX + 1),
+			 ==, -1);
+	mem_free0(big);
+
+	ns_helper_free(helper);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/helper",		/* name */
+		test_helper,		/* test */
+		setup,			/* setup */
+		NULL,			/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite ns_suite = {
+	"/ns",			/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
@@ -0,0 +1,63 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2017 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/**
+ * @file probe.h
+ *
+ * Static user space tracepoints (USDT) for the hot paths of cmld, scd and tpm2d.
+ * The probes are placed in the "cml" provider and can be attached to with bpftrace or
+ * perf, e.g., 'bpftrace -e "usdt:/usr/sbin/cmld:cml:event_io { @[arg0] = count(); }"'.
+ * A probe which nobody is attached to costs a single nop. Without <sys/sdt.h> (systemtap-sdt-dev)
+ * or with CML_NO_USDT defined, the probes are compiled out.
+ * Like macro.h, there is only a header file.
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#if !defined(CML_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define CML_HAVE_USDT
+#endif
+#endif
+
+#ifdef CML_HAVE_USDT
+#include <sys/sdt.h>
+
+#define PROBE(name) DTRACE_PROBE(cml, name)
+#define PROBE1(name, a) DTRACE_PROBE1(cml, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(cml, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(cml, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(cml, name, a, b, c, d)
+#else
+#define PROBE(name)                                                                                \
+	do {                                                                                       \
+	} while (0)
+#define PROBE1(name, a) PROBE(name)
+#define PROBE2(name, a, b) PROBE(name)
+#define PROBE3(name, a, b, c) PROBE(name)
+#define PROBE4(name, a, b, c, d) PROBE(name)
+#endif
+
+#endif /* PROBE_H */
@@ -367,16 +367,13 @@ struct proc_meminfo {
 	ssize_t mem_available;
 };
 
-proc_meminfo_t *
-proc_meminfo_new()
+static proc_meminfo_t *
+proc_meminfo_parse_new(const char *buf)
 {
 	proc_meminfo_t *meminfo;
-	char *buf, *tmp;
+	char *tmp;
 	int n;
 
-	buf = file_read_new("/proc/meminfo", 4096);
-	IF_NULL_RETVAL(buf, NULL);
-
 	meminfo = mem_new0(proc_meminfo_t, 1);
 
 	n = sscanf(buf, "MemTotal:\t%zd kB", &meminfo->mem_total);
@@ -395,14 +392,37 @@ proc_meminfo_new()
 	IF_FALSE_GOTO(n == 1, error);
 	TRACE("Parsed MemAvailable: %zd kB", meminfo->mem_available);
 
-	mem_free0(buf);
 	return meminfo;
 error:
 	mem_free0(meminfo);
-	mem_free0(buf);
 	return NULL;
 }
 
+proc_meminfo_t *
+proc_meminfo_new()
+{
+	char *buf = file_read_new("/proc/meminfo", 4096);
+	IF_NULL_RETVAL(buf, NULL);
+
+	proc_meminfo_t *meminfo = proc_meminfo_parse_new(buf);
+
+	mem_free0(buf);
+	return meminfo;
+}
+
+proc_meminfo_t *
+proc_meminfo_new_from_fd(int fd)
+{
+	char buf[4096];
+
+	// the fields we parse are at the start, a truncated read does not matter
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+	IF_TRUE_RETVAL_TRACE(len <= 0, NULL);
+	buf[len] = '\0';
+
+	return proc_meminfo_parse_new(buf);
+}
+
 void
 proc_meminfo_free(proc_meminfo_t *meminfo)
 {
@@ -102,6 +102,15 @@ typedef struct proc_meminfo proc_meminfo_t;
 proc_meminfo_t *
 proc_meminfo_new();
 
+/**
+ * Parses /proc/meminfo into an internal struct, reading it with pread() from the
+ * given file descriptor which can be kept open for repeated sampling
+ * @param fd file descriptor of /proc/meminfo
+ * @return pointer to the newly allocated struct, NULL on error
+ */
+proc_meminfo_t *
+proc_meminfo_new_from_fd(int fd);
+
 /**
  * Frees the meminfo internal struct
  * @param meminfo pointer to struct which should be freed
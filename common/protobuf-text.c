@@ -33,8 +33,28 @@
 #include "fd.h"
 #include "file.h"
 
+#include <fcntl.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+
+#define PROTOBUF_CACHE_MAGIC "CMLPBC01"
+#define PROTOBUF_CACHE_SUFFIX ".pb"
+
+/*
+ * Header of a binary cache file, followed by the packed message. All fields but
+ * packed_len have to match the text the message is loaded from.
+ */
+struct protobuf_cache_header {
+	char magic[8];
+	uint64_t text_len;
+	uint64_t sig_len;
+	uint64_t hash; // FNV-1a of the message name, the text and the signature
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t packed_len;
+};
 
 // TODO update naming scheme
 
@@ -142,6 +162,179 @@ protobuf_message_new_from_buf(const uint8_t *buf, size_t buflen,
 	return msg;
 }
 
+char *
+protobuf_message_cache_file_new(const char *filename)
+{
+	ASSERT(filename);
+	return mem_printf("%s%s", filename, PROTOBUF_CACHE_SUFFIX);
+}
+
+static uint64_t
+protobuf_cache_hash(uint64_t hash, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		hash ^= buf[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static ProtobufCMessage *
+protobuf_cache_read(const char *cache_file, const struct protobuf_cache_header *expected,
+		    const ProtobufCMessageDescriptor *descriptor)
+{
+	off_t size = file_size(cache_file);
+	if (size < (off_t)sizeof(*expected))
+		return NULL;
+
+	ProtobufCMessage *msg = NULL;
+	uint8_t *cache = mem_alloc(size);
+	const struct protobuf_cache_header *hdr = (const struct protobuf_cache_header *)cache;
+
+	if (file_read(cache_file, (char *)cache, size) != size) {
+		WARN("Could not read protobuf cache \"%s\".", cache_file);
+		goto out;
+	}
+	if (memcmp(hdr, expected, offsetof(struct protobuf_cache_header, packed_len)) ||
+	    hdr->packed_len != size - sizeof(*hdr)) {
+		TRACE("Protobuf cache \"%s\" is stale.", cache_file);
+		goto out;
+	}
+	msg = protobuf_unpack_message(descriptor, cache + sizeof(*hdr), hdr->packed_len);
+	if (!msg)
+		WARN("Failed to unpack protobuf message (%s) from cache \"%s\".",
+		     descriptor->name ? descriptor->name : "UNKNOWN", cache_file);
+out:
+	mem_free0(cache);
+	return msg;
+}
+
+static void
+protobuf_cache_write(const char *cache_file, struct protobuf_cache_header *hdr,
+		     const ProtobufCMessage *message)
+{
+	uint8_t *packed = NULL;
+	hdr->packed_len = protobuf_pack_message_new(message, &packed);
+
+	// write to a temporary file first, a torn cache must never be picked up
+	char *tmp_file = mem_printf("%s.tmp", cache_file);
+	int fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		WARN_ERRNO("Could not create protobuf cache \"%s\".", tmp_file);
+		goto out;
+	}
+	if (fd_write(fd, (char *)hdr, sizeof(*hdr)) < 0 ||
+	    fd_write(fd, (char *)packed, hdr->packed_len) < 0) {
+		WARN("Could not write protobuf cache \"%s\".", tmp_file);
+		close(fd);
+		unlink(tmp_file);
+		goto out;
+	}
+	close(fd);
+	if (rename(tmp_file, cache_file) < 0) {
+		WARN_ERRNO("Could not move protobuf cache to \"%s\".", cache_file);
+		unlink(tmp_file);
+	}
+out:
+	mem_free0(tmp_file);
+	mem_free0(packed);
+}
+
+static ProtobufCMessage *
+protobuf_message_new_cached_internal(const uint8_t *buf, size_t buflen, const uint8_t *sig_buf,
+				     size_t sig_len, const struct stat *st, const char *cache_file,
+				     const ProtobufCMessageDescriptor *descriptor)
+{
+	struct protobuf_cache_header hdr;
+	mem_memset(&hdr, 0, sizeof(hdr));
+
+	memcpy(hdr.magic, PROTOBUF_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.text_len = buflen;
+	hdr.sig_len = sig_buf ? sig_len : 0;
+	hdr.hash = 0xcbf29ce484222325ULL;
+	if (descriptor->name)
+		hdr.hash = protobuf_cache_hash(hdr.hash, (const uint8_t *)descriptor->name,
+					       strlen(descriptor->name));
+	hdr.hash = protobuf_cache_hash(hdr.hash, buf, buflen);
+	if (sig_buf)
+		hdr.hash = protobuf_cache_hash(hdr.hash, sig_buf, sig_len);
+	if (st) {
+		hdr.mtime_sec = st->st_mtim.tv_sec;
+		hdr.mtime_nsec = st->st_mtim.tv_nsec;
+	}
+
+	ProtobufCMessage *msg = protobuf_cache_read(cache_file, &hdr, descriptor);
+	if (msg) {
+		TRACE("Loaded protobuf message (%s) from cache \"%s\".",
+		      descriptor->name ? descriptor->name : "UNKNOWN", cache_file);
+		return msg;
+	}
+
+	msg = protobuf_message_new_from_buf(buf, buflen, descriptor);
+	if (msg)
+		protobuf_cache_write(cache_file, &hdr, msg);
+	return msg;
+}
+
+ProtobufCMessage *
+protobuf_message_new_from_buf_cached(const uint8_t *buf, size_t buflen, const uint8_t *sig_buf,
+				     size_t sig_len, const char *cache_file,
+				     const ProtobufCMessageDescriptor *descriptor)
+{
+	ASSERT(buf);
+	ASSERT(cache_file);
+	ASSERT(descriptor);
+
+	return protobuf_message_new_cached_internal(buf, buflen, sig_buf, sig_len, NULL,
+						    cache_file, descriptor);
+}
+
+ProtobufCMessage *
+protobuf_message_new_from_textfile_cached(const char *filename, const char *sig_file,
+					  const ProtobufCMessageDescriptor *descriptor)
+{
+	ASSERT(filename);
+	ASSERT(descriptor);
+
+	ProtobufCMessage *msg = NULL;
+	uint8_t *buf = NULL, *sig_buf = NULL;
+	off_t sig_len = 0;
+	char *cache_file = NULL;
+	struct stat st;
+
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		WARN_ERRNO("Could not open file \"%s\" for reading.", filename);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		WARN_ERRNO("Could not stat file \"%s\".", filename);
+		goto out;
+	}
+	buf = mem_alloc(st.st_size + 1);
+	if (fd_read(fd, (char *)buf, st.st_size) != st.st_size) {
+		WARN("Could not read file \"%s\".", filename);
+		goto out;
+	}
+	if (sig_file && (sig_len = file_size(sig_file)) > 0) {
+		sig_buf = mem_alloc(sig_len);
+		if (file_read(sig_file, (char *)sig_buf, sig_len) != sig_len) {
+			WARN("Could not read signature file \"%s\".", sig_file);
+			goto out;
+		}
+	}
+
+	cache_file = protobuf_message_cache_file_new(filename);
+	msg = protobuf_message_new_cached_internal(buf, st.st_size, sig_buf, sig_len, &st,
+						   cache_file, descriptor);
+out:
+	close(fd);
+	mem_free0(cache_file);
+	mem_free0(sig_buf);
+	mem_free0(buf);
+	return msg;
+}
+
 ssize_t
 protobuf_message_write_to_file(const char *filename, const ProtobufCMessage *message)
 {
@@ -79,6 +79,49 @@ ProtobufCMessage *
 protobuf_message_new_from_buf(const uint8_t *buf, size_t buflen,
 			      const ProtobufCMessageDescriptor *descriptor);
 
+/**
+ * Parses a protobuf message from the given text buffer like protobuf_message_new_from_buf(),
+ * but keeps the packed message in the binary cache_file. If the cache was written for the
+ * same text and signature, the message is unpacked from the cache instead of parsing the
+ * text. Otherwise, the cache is rewritten after parsing.
+ *
+ * @param buf           the text of the protobuf message
+ * @param buflen        the length of the text
+ * @param sig_buf       the signature of the text, or NULL
+ * @param sig_len       the length of the signature
+ * @param cache_file    name of the binary cache file
+ * @param descriptor    the protobuf message descriptor that defines the message structure
+ * @return  a pointer to the parsed protobuf message struct;
+ *          must be released with protobuf_free_message()
+ */
+ProtobufCMessage *
+protobuf_message_new_from_buf_cached(const uint8_t *buf, size_t buflen, const uint8_t *sig_buf,
+				     size_t sig_len, const char *cache_file,
+				     const ProtobufCMessageDescriptor *descriptor);
+
+/**
+ * Parses a protobuf message from the given text file like
+ * protobuf_message_new_from_textfile(), using the binary cache file named by
+ * protobuf_message_cache_file_new(). Besides the text and the signature, the cache
+ * is validated by the modification time of the text file.
+ *
+ * @param filename      name of the text file containing the protobuf message
+ * @param sig_file      name of the signature file of the text file, or NULL
+ * @param descriptor    the protobuf message descriptor that defines the message structure
+ * @return  a pointer to the parsed protobuf message struct;
+ *          must be released with protobuf_free_message()
+ */
+ProtobufCMessage *
+protobuf_message_new_from_textfile_cached(const char *filename, const char *sig_file,
+					  const ProtobufCMessageDescriptor *descriptor);
+
+/**
+ * Returns the name of the binary cache file next to the given text file.
+ * The returned string must be freed by the caller.
+ */
+char *
+protobuf_message_cache_file_new(const char *filename);
+
 /**
  * Writes a textual representation of the given protobuf message to the given file.
  *
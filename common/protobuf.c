@@ -29,12 +29,37 @@
 #include "mem.h"
 #include "fd.h"
 #include "file.h"
+#include "probe.h"
 
 #include <unistd.h>
 #include <arpa/inet.h>
 
 // TODO update naming scheme
 
+/*
+ * Receive buffers of protobuf_recv_message() up to this size are taken from a
+ * per-thread pool, since most control messages are small and short-lived.
+ */
+#define PROTOBUF_RECV_POOL_BUF_SIZE 4096
+#define PROTOBUF_RECV_POOL_CACHED 4
+static __thread mem_pool_t *protobuf_recv_pool = NULL;
+
+/*
+ * protobuf_send_message() packs into a per-thread buffer which is reused as long
+ * as it does not exceed this size, larger buffers are released after sending.
+ */
+#define PROTOBUF_SEND_BUF_KEEP_SIZE (64 * 1024)
+static __thread uint8_t *protobuf_send_buf = NULL;
+static __thread size_t protobuf_send_buf_size = 0;
+
+static int (*protobuf_send_redirect)(int fd, const uint8_t *buf, uint32_t buflen) = NULL;
+
+void
+protobuf_set_send_redirect(int (*func)(int fd, const uint8_t *buf, uint32_t buflen))
+{
+	protobuf_send_redirect = func;
+}
+
 uint32_t
 protobuf_pack_message_new(const ProtobufCMessage *message, uint8_t **ptr)
 {
@@ -60,6 +85,16 @@ protobuf_send_message_packed(int fd, const uint8_t *buf, uint32_t buflen)
 	ASSERT(buf);
 
 	IF_FALSE_RETVAL(buflen < PROTOBUF_MAX_MESSAGE_SIZE, -1);
+	PROBE2(protobuf_send, fd, buflen);
+
+	// fds of a protobuf_conn_t are written non-blocking through its send queue
+	if (protobuf_send_redirect) {
+		int ret = protobuf_send_redirect(fd, buf, buflen);
+		if (ret < 0)
+			goto error_write;
+		if (ret > 0)
+			return buflen;
+	}
 
 	ssize_t bytes_sent = fd_write(fd, (char *)&(uint32_t){ htonl(buflen) }, sizeof(uint32_t));
 	if (-1 == bytes_sent)
@@ -93,33 +128,53 @@ protobuf_send_message(int fd, const ProtobufCMessage *message)
 {
 	ASSERT(message);
 
-	uint8_t *buf = NULL;
-	uint32_t buflen = protobuf_pack_message_new(message, &buf);
-
-	if (!(buflen < PROTOBUF_MAX_MESSAGE_SIZE)) {
+	size_t packed_len = protobuf_c_message_get_packed_size(message);
+	if (!(packed_len < PROTOBUF_MAX_MESSAGE_SIZE)) {
 		ERROR("Packed message exceeds PROTOBUF_MAX_MESSAGE_SIZE");
-		if (buf)
-			mem_free0(buf);
-
 		return -1;
 	}
 
+	// the buffer is not released in between to avoid an allocation per message
+	if (packed_len > protobuf_send_buf_size) {
+		size_t size = MAX(packed_len, (size_t)PROTOBUF_MAX_OVERHEAD);
+		mem_free0(protobuf_send_buf);
+		protobuf_send_buf = mem_alloc(size);
+		protobuf_send_buf_size = size;
+	}
+	uint8_t *buf = protobuf_send_buf;
+
+	uint32_t buflen = protobuf_c_message_pack(message, buf);
+	ASSERT(buflen == packed_len);
+
 	TRACE("Sending protobuf message with len %u", buflen);
 	TRACE_HEXDUMP(buf, buflen, "Message");
 
-	if (-1 == protobuf_send_message_packed(fd, buf, buflen)) {
+	ssize_t ret = protobuf_send_message_packed(fd, buf, buflen);
+
+	if (protobuf_send_buf_size > PROTOBUF_SEND_BUF_KEEP_SIZE) {
+		mem_free0(protobuf_send_buf);
+		protobuf_send_buf_size = 0;
+	}
+
+	if (-1 == ret) {
 		ERROR_ERRNO("Failed to write packed protobuf message to fd %d.", fd);
-		mem_free0(buf);
 		return -1;
 	}
 
-	mem_free0(buf);
-
 	return buflen;
 }
 
-uint8_t *
-protobuf_recv_message_packed_new(int fd, ssize_t *ret_len)
+static void
+protobuf_recv_buf_free(uint8_t *buf, size_t buflen, mem_pool_t *pool)
+{
+	if (pool && buflen <= mem_pool_get_obj_size(pool))
+		mem_pool_release(pool, buf);
+	else
+		mem_free(buf);
+}
+
+static uint8_t *
+protobuf_recv_packed(int fd, ssize_t *ret_len, mem_pool_t *pool)
 {
 	ASSERT(ret_len);
 	uint32_t buflen = 0;
@@ -155,12 +210,13 @@ protobuf_recv_message_packed_new(int fd, ssize_t *ret_len)
 		return NULL;
 	}
 
-	uint8_t *buf = mem_alloc(buflen);
+	uint8_t *buf = (pool && buflen <= mem_pool_get_obj_size(pool)) ? mem_pool_alloc(pool) :
+									 mem_alloc(buflen);
 	do {
 		bytes_read = fd_read(fd, (char *)buf, buflen);
 	} while (-1 == bytes_read && errno == EINTR);
 	if (-1 == bytes_read) {
-		mem_free0(buf);
+		protobuf_recv_buf_free(buf, buflen, pool);
 		goto error_read;
 	}
 	TRACE("read protobuf message data (%zd bytes read, %u bytes expected)", bytes_read, buflen);
@@ -170,13 +226,14 @@ protobuf_recv_message_packed_new(int fd, ssize_t *ret_len)
 	if ((size_t)bytes_read != buflen) {
 		ERROR("Dropped protobuf message (expected length : %zd bytes read != %u bytes expected)",
 		      bytes_read, buflen);
-		mem_free0(buf);
+		protobuf_recv_buf_free(buf, buflen, pool);
 		goto error_read;
 	}
 	// TODO: what if only part of a message could be read?
 	// need good (generic?!) solution that interacts nicely with event handling!
 
 	*ret_len = bytes_read;
+	PROBE2(protobuf_recv, fd, buflen);
 
 	return buf;
 
@@ -186,13 +243,24 @@ error_read:
 	return NULL;
 }
 
+uint8_t *
+protobuf_recv_message_packed_new(int fd, ssize_t *ret_len)
+{
+	return protobuf_recv_packed(fd, ret_len, NULL);
+}
+
 ProtobufCMessage *
 protobuf_recv_message(int fd, const ProtobufCMessageDescriptor *descriptor)
 {
 	ASSERT(descriptor);
 
 	ssize_t buflen = 0;
-	uint8_t *buf = protobuf_recv_message_packed_new(fd, &buflen);
+
+	if (!protobuf_recv_pool)
+		protobuf_recv_pool =
+			mem_pool_new(PROTOBUF_RECV_POOL_BUF_SIZE, PROTOBUF_RECV_POOL_CACHED);
+
+	uint8_t *buf = protobuf_recv_packed(fd, &buflen, protobuf_recv_pool);
 
 	// zero length data represents a message with all default values
 	// => use unpack to construct it (and initialize it with these defaults)
@@ -221,7 +289,7 @@ protobuf_recv_message(int fd, const ProtobufCMessageDescriptor *descriptor)
 	TRACE("Received protobuf message with len %zd", buflen);
 	TRACE_HEXDUMP(buf, buflen, "Message");
 
-	mem_free0(buf);
+	protobuf_recv_buf_free(buf, buflen, protobuf_recv_pool);
 	return msg;
 }
 
@@ -236,6 +304,45 @@ protobuf_unpack_message(const ProtobufCMessageDescriptor *descriptor, uint8_t *b
 	return msg;
 }
 
+static void *
+protobuf_arena_alloc(void *allocator_data, size_t size)
+{
+	return mem_arena_alloc(allocator_data, size);
+}
+
+// the memory is released as a whole with the arena
+static void
+protobuf_arena_free(UNUSED void *allocator_data, UNUSED void *pointer)
+{
+}
+
+ProtobufCMessage *
+protobuf_unpack_message_arena(const ProtobufCMessageDescriptor *descriptor, const uint8_t *buf,
+			      uint32_t buf_len, mem_arena_t *arena)
+{
+	ASSERT(descriptor);
+	ASSERT(arena);
+
+	ProtobufCAllocator allocator = {
+		.alloc = protobuf_arena_alloc,
+		.free = protobuf_arena_free,
+		.allocator_data = arena,
+	};
+	return protobuf_c_message_unpack(descriptor, &allocator, buf_len, buf);
+}
+
+ProtobufCMessage *
+protobuf_dup_message(const ProtobufCMessage *message)
+{
+	ASSERT(message);
+
+	uint8_t *buf = NULL;
+	uint32_t buf_len = protobuf_pack_message_new(message, &buf);
+	ProtobufCMessage *copy = protobuf_unpack_message(message->descriptor, buf, buf_len);
+	mem_free0(buf);
+	return copy;
+}
+
 void
 protobuf_free_message(ProtobufCMessage *message)
 {
@@ -34,6 +34,8 @@
 
 #include <protobuf-c/protobuf-c.h>
 
+#include "mem.h"
+
 #include <sys/types.h>
 #include <stdbool.h>
 
@@ -120,6 +122,44 @@ ProtobufCMessage *
 protobuf_unpack_message(const ProtobufCMessageDescriptor *descriptor, uint8_t *buf,
 			uint32_t buf_len);
 
+/**
+ * Unpacks the given, packed protobuf message into memory of the given arena, thus
+ * the repeated fields, strings and submessages need no allocations of their own.
+ * The message must not be freed by protobuf_free_message(), it is released with
+ * all other allocations of the arena by mem_arena_reset() or mem_arena_free(),
+ * e.g., once the request it belongs to has been handled. Fields of the message
+ * must not be replaced by memory allocated otherwise.
+ *
+ * @param descriptor the protobuf message descriptor that defines the message structure
+ * @param buf buffer containing the packed protobuf message
+ * @param buf_len length of the packed protobuf message
+ * @param arena the arena the message is allocated from
+ * @return the unpacked message or NULL on error
+ */
+ProtobufCMessage *
+protobuf_unpack_message_arena(const ProtobufCMessageDescriptor *descriptor, const uint8_t *buf,
+			      uint32_t buf_len, mem_arena_t *arena);
+
+/**
+ * Creates a deep copy of an unpacked protobuf message, e.g., to keep a received
+ * message beyond the callback it was passed to.
+ *
+ * @param message the message to copy
+ * @return the copy, to be freed by protobuf_free_message(), or NULL on error
+ */
+ProtobufCMessage *
+protobuf_dup_message(const ProtobufCMessage *message);
+
+/**
+ * Registers a function which is tried first by protobuf_send_message_packed().
+ * It returns 1 if it took over the message for the fd, 0 if the message should
+ * be written directly and -1 on error. Used by protobuf_conn.c.
+ *
+ * @param func the redirect function or NULL to remove it
+ */
+void
+protobuf_set_send_redirect(int (*func)(int fd, const uint8_t *buf, uint32_t buflen));
+
 /**
  * Frees an unpacked protobuf message struct (e.g. created by protobuf_recv_message()).
  *
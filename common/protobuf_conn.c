@@ -0,0 +1,1048 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "protobuf_conn.h"
+
+//#define LOGF_LOG_MIN_PRIO LOGF_PRIO_TRACE
+#include "macro.h"
+#include "mem.h"
+#include "event.h"
+#include "fd.h"
+#include "hashmap.h"
+#include "probe.h"
+#include "sock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// reading is resumed once the send queue has drained below this mark
+#define PROTOBUF_CONN_LOW_WATER (PROTOBUF_CONN_HIGH_WATER / 4)
+// hard limit of the send queue, further messages are rejected
+#define PROTOBUF_CONN_MAX_PENDING ((size_t)2 * PROTOBUF_MAX_MESSAGE_SIZE)
+// receive buffer of stream sockets, larger messages are read into a buffer of their own
+#define PROTOBUF_CONN_RECV_BUF_SIZE (16 * 1024)
+// maximum number of records read per io event, so other events are not starved
+#define PROTOBUF_CONN_RECV_BATCH 8
+// maximum number of queued chunks written by one writev()
+#define PROTOBUF_CONN_FLUSH_IOV 16
+// maximum number of fds passed ahead of one message, see protobuf_conn_take_fd()
+#define PROTOBUF_CONN_RECV_FDS_MAX 4
+// block size of the arena received messages are unpacked into
+#define PROTOBUF_CONN_ARENA_BLOCK_SIZE (16 * 1024)
+
+typedef struct protobuf_conn_chunk protobuf_conn_chunk_t;
+struct protobuf_conn_chunk {
+	protobuf_conn_chunk_t *next;
+	size_t len;
+	size_t pos;  /* bytes already written */
+	int pass_fd; /* fd passed along with the single data byte, -1 for plain data */
+	uint8_t data[];
+};
+
+struct protobuf_conn {
+	int fd;
+	bool records; /* each write is one record, e.g., SOCK_SEQPACKET */
+	event_io_t *io;
+	bool io_added;
+	const ProtobufCMessageDescriptor *descriptor;
+	void (*msg_cb)(protobuf_conn_t *conn, ProtobufCMessage *msg, void *data);
+	void (*close_cb)(protobuf_conn_t *conn, void *data);
+	void *data;
+
+	/* receive buffer of stream sockets, holds unparsed data from rbuf_start to rbuf_len */
+	uint8_t *rbuf;
+	size_t rbuf_start;
+	size_t rbuf_len;
+
+	/* holds the message passed to msg_cb, reset once it returns */
+	mem_arena_t *arena;
+
+	/* body of a message which is read on its own, i.e., a record or a large message */
+	uint8_t *body;
+	uint32_t body_len;
+	size_t body_pos;
+
+	/* fds passed ahead of the next message on record sockets, -1 once taken */
+	int recv_fds[PROTOBUF_CONN_RECV_FDS_MAX];
+	size_t recv_fds_len;
+	size_t recv_fds_next;
+
+	/* send queue of data the socket did not accept yet */
+	protobuf_conn_chunk_t *queue_head;
+	protobuf_conn_chunk_t *queue_tail;
+	size_t pending;
+
+	/* messages posted by other threads, see protobuf_conn_set_shared() */
+	int post_fd; /* eventfd which wakes up the owning thread, -1 if not shared */
+	event_io_t *post_io;
+	protobuf_conn_chunk_t *post_head;
+	protobuf_conn_chunk_t *post_tail;
+
+	bool paused;	  /* reading is paused because of backpressure */
+	bool failed;	  /* the connection is not usable anymore, close_cb is due */
+	bool dispatching; /* inside the io callback of the connection */
+	bool freed;	  /* protobuf_conn_free() was called while dispatching */
+};
+
+// connections of this thread by fd, see protobuf_conn_send_redirect()
+static __thread hashmap_t *protobuf_conn_map = NULL;
+
+// shared connections of all threads by fd and their posted messages
+static pthread_mutex_t protobuf_conn_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static hashmap_t *protobuf_conn_shared_map = NULL;
+
+static int
+protobuf_conn_send(protobuf_conn_t *conn, const uint8_t *buf, uint32_t buflen);
+
+static protobuf_conn_chunk_t *
+protobuf_conn_chunk_new(size_t len)
+{
+	protobuf_conn_chunk_t *chunk = mem_alloc(sizeof(protobuf_conn_chunk_t) + len);
+	chunk->next = NULL;
+	chunk->len = len;
+	chunk->pos = 0;
+	chunk->pass_fd = -1;
+
+	return chunk;
+}
+
+static void
+protobuf_conn_chunk_free_list(protobuf_conn_chunk_t *chunk)
+{
+	while (chunk) {
+		protobuf_conn_chunk_t *next = chunk->next;
+		if (chunk->pass_fd >= 0)
+			close(chunk->pass_fd);
+		mem_free0(chunk);
+		chunk = next;
+	}
+}
+
+static void
+protobuf_conn_update_events(protobuf_conn_t *conn)
+{
+	if (conn->paused && conn->pending <= PROTOBUF_CONN_LOW_WATER) {
+		DEBUG("Send queue of fd %d drained, resume reading", conn->fd);
+		conn->paused = false;
+	} else if (!conn->paused && conn->pending > PROTOBUF_CONN_HIGH_WATER) {
+		DEBUG("Send queue of fd %d exceeds %d bytes, pause reading", conn->fd,
+		      PROTOBUF_CONN_HIGH_WATER);
+		conn->paused = true;
+	}
+
+	unsigned events = conn->paused ? 0 : EVENT_IO_READ;
+	// a failed connection is reported through the next io event
+	if (conn->queue_head || conn->failed)
+		events |= EVENT_IO_WRITE;
+
+	event_io_set_events(conn->io, events);
+}
+
+static void
+protobuf_conn_append(protobuf_conn_t *conn, protobuf_conn_chunk_t *chunk)
+{
+	if (conn->queue_tail)
+		conn->queue_tail->next = chunk;
+	else
+		conn->queue_head = chunk;
+	conn->queue_tail = chunk;
+	conn->pending += chunk->len;
+}
+
+/*
+ * Copies the given data to one new chunk of the send queue, omitting the first
+ * skip bytes which have already been written.
+ */
+static void
+protobuf_conn_enqueue(protobuf_conn_t *conn, const struct iovec *iov, int iovcnt, size_t skip)
+{
+	size_t len = 0;
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	len -= skip;
+
+	protobuf_conn_chunk_t *chunk = protobuf_conn_chunk_new(len);
+
+	uint8_t *p = chunk->data;
+	for (int i = 0; i < iovcnt; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		memcpy(p, (uint8_t *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+		p += iov[i].iov_len - skip;
+		skip = 0;
+	}
+
+	protobuf_conn_append(conn, chunk);
+}
+
+/*
+ * Writes data directly as long as nothing is queued and the socket accepts it,
+ * the remainder is queued as one chunk. Returns -1 on error, 0 otherwise.
+ */
+static int
+protobuf_conn_writev(protobuf_conn_t *conn, const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	ssize_t n = 0;
+	if (!conn->queue_head) {
+		do {
+			n = writev(conn->fd, iov, iovcnt);
+		} while (-1 == n && errno == EINTR);
+
+		if (-1 == n) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				WARN_ERRNO("Failed to write to fd %d", conn->fd);
+				return -1;
+			}
+			n = 0;
+		}
+	}
+
+	// only stream sockets write partially, thus the remainder can be one chunk
+	if ((size_t)n < len)
+		protobuf_conn_enqueue(conn, iov, iovcnt, n);
+
+	return 0;
+}
+
+/*
+ * Passes fd with a single data byte like sock_unix_send_fd(), but without blocking.
+ * Returns 1 if the fd was passed, 0 if the socket would block and -1 on error.
+ */
+static int
+protobuf_conn_sendmsg_fd(protobuf_conn_t *conn, int fd)
+{
+	char byte = 0;
+	struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+
+	memset(control.buf, 0, sizeof(control.buf));
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	ssize_t n;
+	do {
+		n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+	} while (-1 == n && errno == EINTR);
+
+	if (n == 1)
+		return 1;
+	if (-1 == n && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+
+	WARN_ERRNO("Failed to pass fd %d on fd %d", fd, conn->fd);
+	return -1;
+}
+
+/*
+ * Passes fd right away if nothing is queued, otherwise a duplicate of fd is queued
+ * behind the data sent before. Returns -1 on error, 0 otherwise.
+ */
+static int
+protobuf_conn_queue_fd(protobuf_conn_t *conn, int fd)
+{
+	if (!conn->queue_head) {
+		int ret = protobuf_conn_sendmsg_fd(conn, fd);
+		if (ret != 0)
+			return ret < 0 ? -1 : 0;
+	}
+
+	int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	IF_TRUE_RETVAL_ERROR_ERRNO(dup_fd < 0, -1);
+
+	protobuf_conn_chunk_t *chunk = protobuf_conn_chunk_new(1);
+	chunk->data[0] = 0;
+	chunk->pass_fd = dup_fd;
+	protobuf_conn_append(conn, chunk);
+
+	return 0;
+}
+
+/*
+ * Writes queued chunks until the socket would block. On stream sockets multiple
+ * chunks are written at once. Returns -1 on error, 0 otherwise.
+ */
+static int
+protobuf_conn_flush(protobuf_conn_t *conn)
+{
+	struct iovec iov[PROTOBUF_CONN_FLUSH_IOV];
+
+	while (conn->queue_head) {
+		// a passed fd goes with a sendmsg() of its own
+		if (conn->queue_head->pass_fd >= 0) {
+			int ret = protobuf_conn_sendmsg_fd(conn, conn->queue_head->pass_fd);
+			if (ret <= 0)
+				return ret;
+
+			protobuf_conn_chunk_t *chunk = conn->queue_head;
+			conn->queue_head = chunk->next;
+			if (!conn->queue_head)
+				conn->queue_tail = NULL;
+			conn->pending -= chunk->len;
+			chunk->next = NULL;
+			protobuf_conn_chunk_free_list(chunk);
+			continue;
+		}
+
+		int iovcnt = 0;
+		for (protobuf_conn_chunk_t *chunk = conn->queue_head;
+		     chunk && chunk->pass_fd < 0 &&
+		     iovcnt < (conn->records ? 1 : PROTOBUF_CONN_FLUSH_IOV);
+		     chunk = chunk->next) {
+			iov[iovcnt].iov_base = chunk->data + chunk->pos;
+			iov[iovcnt].iov_len = chunk->len - chunk->pos;
+			iovcnt++;
+		}
+
+		ssize_t n = writev(conn->fd, iov, iovcnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			WARN_ERRNO("Failed to write to fd %d", conn->fd);
+			return -1;
+		}
+		if (n == 0)
+			return 0;
+
+		conn->pending -= n;
+		while (n > 0) {
+			protobuf_conn_chunk_t *chunk = conn->queue_head;
+			size_t remain = chunk->len - chunk->pos;
+			if ((size_t)n < remain) {
+				chunk->pos += n;
+				break;
+			}
+			n -= remain;
+			conn->queue_head = chunk->next;
+			if (!conn->queue_head)
+				conn->queue_tail = NULL;
+			mem_free0(chunk);
+		}
+	}
+	TRACE("Send queue of fd %d flushed", conn->fd);
+
+	return 0;
+}
+
+static int
+protobuf_conn_read_error(protobuf_conn_t *conn, ssize_t n)
+{
+	if (n == 0) {
+		TRACE("client on fd %d closed connection.", conn->fd);
+		return -1;
+	}
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return 0;
+	if (errno == ECONNRESET) {
+		TRACE("client on fd %d reset connection.", conn->fd);
+		return -1;
+	}
+
+	WARN_ERRNO("Failed to read from fd %d", conn->fd);
+	return -1;
+}
+
+/*
+ * Closes the passed fds which were not taken by the handler of the message.
+ */
+static void
+protobuf_conn_close_recv_fds(protobuf_conn_t *conn)
+{
+	for (size_t i = 0; i < conn->recv_fds_len; i++) {
+		if (conn->recv_fds[i] >= 0) {
+			TRACE("Closing passed fd %d not taken on fd %d", conn->recv_fds[i],
+			      conn->fd);
+			close(conn->recv_fds[i]);
+		}
+	}
+	conn->recv_fds_len = 0;
+	conn->recv_fds_next = 0;
+}
+
+static void
+protobuf_conn_dispatch(protobuf_conn_t *conn, uint8_t *buf, uint32_t buflen)
+{
+	TRACE("Received protobuf message on fd %d with len %u", conn->fd, buflen);
+	TRACE_HEXDUMP(buf, buflen, "Received packed message: ");
+	PROBE2(protobuf_recv, conn->fd, buflen);
+
+	if (!conn->arena)
+		conn->arena = mem_arena_new(PROTOBUF_CONN_ARENA_BLOCK_SIZE);
+
+	ProtobufCMessage *msg =
+		protobuf_unpack_message_arena(conn->descriptor, buf, buflen, conn->arena);
+	if (!msg) {
+		WARN("Failed to parse received protobuf message on fd %d", conn->fd);
+		conn->failed = true;
+		mem_arena_reset(conn->arena);
+		protobuf_conn_close_recv_fds(conn);
+		return;
+	}
+
+	conn->msg_cb(conn, msg, conn->data);
+	// releases the message as a whole, the freeing of conn is deferred while dispatching
+	mem_arena_reset(conn->arena);
+	protobuf_conn_close_recv_fds(conn);
+}
+
+static bool
+protobuf_conn_check_len(protobuf_conn_t *conn, uint32_t len)
+{
+	if (len < PROTOBUF_MAX_MESSAGE_SIZE)
+		return true;
+
+	ERROR("Protocol violation on fd %d: message length %u exceeds limit", conn->fd, len);
+	conn->failed = true;
+	return false;
+}
+
+/*
+ * Continues reading a message body which did not fit into the receive buffer.
+ * Returns 1 if the body is complete, 0 if more data is needed and -1 on EOF or error.
+ */
+static int
+protobuf_conn_read_body(protobuf_conn_t *conn)
+{
+	ssize_t n = read(conn->fd, conn->body + conn->body_pos, conn->body_len - conn->body_pos);
+	if (n <= 0)
+		return protobuf_conn_read_error(conn, n);
+
+	conn->body_pos += n;
+	TRACE("read protobuf message data on fd %d (%zu of %u bytes)", conn->fd, conn->body_pos,
+	      conn->body_len);
+
+	return conn->body_pos == conn->body_len ? 1 : 0;
+}
+
+static void
+protobuf_conn_dispatch_body(protobuf_conn_t *conn)
+{
+	uint8_t *body = conn->body;
+	uint32_t body_len = conn->body_len;
+
+	conn->body = NULL;
+	conn->body_len = 0;
+	conn->body_pos = 0;
+
+	protobuf_conn_dispatch(conn, body, body_len);
+	mem_free(body);
+}
+
+/*
+ * Dispatches all complete messages of the receive buffer in order. A message
+ * which is too large for the buffer is moved to a body buffer of its own.
+ */
+static void
+protobuf_conn_dispatch_buffered(protobuf_conn_t *conn)
+{
+	while (!conn->paused && !conn->failed && !conn->freed) {
+		size_t avail = conn->rbuf_len - conn->rbuf_start;
+		uint32_t len;
+
+		if (avail < sizeof(len))
+			break;
+
+		memcpy(&len, conn->rbuf + conn->rbuf_start, sizeof(len));
+		len = ntohl(len);
+		if (!protobuf_conn_check_len(conn, len))
+			break;
+
+		if (avail - sizeof(len) < len) {
+			if (sizeof(len) + len > PROTOBUF_CONN_RECV_BUF_SIZE) {
+				conn->body = mem_alloc(len);
+				conn->body_len = len;
+				conn->body_pos = avail - sizeof(len);
+				memcpy(conn->body, conn->rbuf + conn->rbuf_start + sizeof(len),
+				       conn->body_pos);
+				conn->rbuf_start = conn->rbuf_len = 0;
+			}
+			break;
+		}
+
+		uint8_t *buf = conn->rbuf + conn->rbuf_start + sizeof(len);
+		conn->rbuf_start += sizeof(len) + len;
+		protobuf_conn_dispatch(conn, buf, len);
+	}
+
+	if (conn->rbuf_start == conn->rbuf_len)
+		conn->rbuf_start = conn->rbuf_len = 0;
+}
+
+/*
+ * Receives on a stream socket. Everything available, up to the size of the
+ * receive buffer, is read at once and all complete messages are dispatched.
+ * Returns -1 on EOF or error, 0 otherwise.
+ */
+static int
+protobuf_conn_recv_stream(protobuf_conn_t *conn)
+{
+	if (conn->body) {
+		int ret = protobuf_conn_read_body(conn);
+		if (ret > 0)
+			protobuf_conn_dispatch_body(conn);
+		return ret < 0 ? -1 : 0;
+	}
+
+	if (conn->rbuf_start > 0) {
+		memmove(conn->rbuf, conn->rbuf + conn->rbuf_start,
+			conn->rbuf_len - conn->rbuf_start);
+		conn->rbuf_len -= conn->rbuf_start;
+		conn->rbuf_start = 0;
+	}
+
+	ssize_t n = read(conn->fd, conn->rbuf + conn->rbuf_len,
+			 PROTOBUF_CONN_RECV_BUF_SIZE - conn->rbuf_len);
+	if (n <= 0)
+		return protobuf_conn_read_error(conn, n);
+
+	conn->rbuf_len += n;
+	TRACE("read %zd bytes from fd %d", n, conn->fd);
+
+	protobuf_conn_dispatch_buffered(conn);
+	return 0;
+}
+
+/*
+ * Reads the record of a length prefix, which may also be the single data byte of an
+ * fd passed by protobuf_conn_send_fd(). Passed fds are kept for the handler of the
+ * next message. Returns the number of bytes read, 0 on EOF and -1 on error.
+ */
+static ssize_t
+protobuf_conn_read_prefix(protobuf_conn_t *conn, uint32_t *len, bool *passed_fd)
+{
+	struct iovec iov = { .iov_base = len, .iov_len = sizeof(*len) };
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(PROTOBUF_CONN_RECV_FDS_MAX * sizeof(int))];
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+
+	*passed_fd = false;
+	ssize_t n = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC);
+	IF_TRUE_RETVAL(n < 0, n);
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		size_t nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < nfds; i++) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (conn->recv_fds_len == PROTOBUF_CONN_RECV_FDS_MAX) {
+				ERROR("Protocol violation on fd %d: too many passed fds", conn->fd);
+				close(fd);
+				conn->failed = true;
+				continue;
+			}
+			conn->recv_fds[conn->recv_fds_len++] = fd;
+			*passed_fd = true;
+		}
+	}
+	if (msg.msg_flags & MSG_CTRUNC) {
+		ERROR("Protocol violation on fd %d: passed fds truncated", conn->fd);
+		conn->failed = true;
+	}
+
+	return n;
+}
+
+/*
+ * Receives the next record of a SOCK_SEQPACKET socket, i.e., the length prefix or
+ * the body of a message. Reads must not exceed the expected size, since data of
+ * the next record would be discarded. Returns -1 on EOF or error, 0 otherwise.
+ */
+static int
+protobuf_conn_recv_record(protobuf_conn_t *conn)
+{
+	if (!conn->body) {
+		uint32_t len;
+		bool passed_fd;
+		ssize_t n = protobuf_conn_read_prefix(conn, &len, &passed_fd);
+		if (n <= 0)
+			return protobuf_conn_read_error(conn, n);
+		IF_TRUE_RETVAL(conn->failed, -1);
+		// the fd is taken by the handler of the message following it
+		if (n == 1 && passed_fd) {
+			TRACE("Received passed fd on fd %d", conn->fd);
+			return 0;
+		}
+		if ((size_t)n != sizeof(len)) {
+			ERROR("Protocol violation on fd %d: short length prefix", conn->fd);
+			return -1;
+		}
+
+		len = ntohl(len);
+		if (!protobuf_conn_check_len(conn, len))
+			return -1;
+
+		// serialized form of message with all default values has zero length
+		if (len == 0) {
+			protobuf_conn_dispatch(conn, NULL, 0);
+			return 0;
+		}
+
+		conn->body = mem_alloc(len);
+		conn->body_len = len;
+		conn->body_pos = 0;
+	}
+
+	int ret = protobuf_conn_read_body(conn);
+	if (ret > 0)
+		protobuf_conn_dispatch_body(conn);
+
+	return ret < 0 ? -1 : 0;
+}
+
+static void
+protobuf_conn_destroy(protobuf_conn_t *conn)
+{
+	protobuf_conn_chunk_free_list(conn->queue_head);
+	conn->queue_head = conn->queue_tail = NULL;
+	if (conn->pending)
+		DEBUG("Dropped %zu unsent bytes of fd %d", conn->pending, conn->fd);
+
+	protobuf_conn_close_recv_fds(conn);
+	mem_free0(conn->rbuf);
+	mem_free0(conn->body);
+	mem_arena_free(conn->arena);
+	event_io_free(conn->io);
+	mem_free0(conn);
+}
+
+static void
+protobuf_conn_io_cb(UNUSED int fd, unsigned events, UNUSED event_io_t *io, void *data)
+{
+	protobuf_conn_t *conn = data;
+	ASSERT(conn);
+
+	conn->dispatching = true;
+
+	if ((events & EVENT_IO_WRITE) && !conn->failed && protobuf_conn_flush(conn) < 0)
+		conn->failed = true;
+
+	// messages which were held back by the backpressure come first
+	if (conn->pending <= PROTOBUF_CONN_LOW_WATER)
+		conn->paused = false;
+	protobuf_conn_dispatch_buffered(conn);
+
+	/*
+	 * Always read pending data first, since also if the peer called close()
+	 * and there is pending data on the socket the READ and EXCEPT flags are set.
+	 * EOF is then detected by the read itself.
+	 */
+	if ((events & EVENT_IO_READ) && !conn->paused) {
+		if (conn->records) {
+			for (int i = 0; i < PROTOBUF_CONN_RECV_BATCH; i++) {
+				if (conn->failed || conn->freed || conn->paused)
+					break;
+				if (protobuf_conn_recv_record(conn) < 0)
+					conn->failed = true;
+			}
+		} else if (!conn->failed && !conn->freed) {
+			if (protobuf_conn_recv_stream(conn) < 0)
+				conn->failed = true;
+		}
+	} else if (events & EVENT_IO_EXCEPT) {
+		TRACE("EVENT_IO_EXCEPT on fd %d", conn->fd);
+		conn->failed = true;
+	}
+
+	conn->dispatching = false;
+
+	if (conn->freed) {
+		protobuf_conn_destroy(conn);
+		return;
+	}
+
+	if (conn->failed) {
+		// report only once, the owner is expected to free the connection
+		event_remove_io(conn->io);
+		conn->io_added = false;
+		conn->close_cb(conn, conn->data);
+		return;
+	}
+
+	protobuf_conn_update_events(conn);
+}
+
+/*
+ * Hands the chunk over to the thread owning the shared connection on fd.
+ * Returns false if fd does not belong to a shared connection of another thread.
+ */
+static bool
+protobuf_conn_post(int fd, protobuf_conn_chunk_t *chunk)
+{
+	pthread_mutex_lock(&protobuf_conn_shared_lock);
+	protobuf_conn_t *conn = protobuf_conn_shared_map ?
+					hashmap_get(protobuf_conn_shared_map, HASHMAP_INT_KEY(fd)) :
+					NULL;
+	if (conn) {
+		if (conn->post_tail)
+			conn->post_tail->next = chunk;
+		else
+			conn->post_head = chunk;
+		conn->post_tail = chunk;
+
+		while (eventfd_write(conn->post_fd, 1) < 0 && errno == EINTR)
+			;
+	}
+	pthread_mutex_unlock(&protobuf_conn_shared_lock);
+
+	return conn != NULL;
+}
+
+/*
+ * Hook of protobuf_send_message_packed() which queues messages for fds that
+ * belong to a connection instead of writing them blocking.
+ */
+static int
+protobuf_conn_send_redirect(int fd, const uint8_t *buf, uint32_t buflen)
+{
+	protobuf_conn_t *conn = protobuf_conn_get_by_fd(fd);
+	if (conn)
+		return protobuf_conn_send_packed(conn, buf, buflen) < 0 ? -1 : 1;
+
+	// a shared connection of another thread, hand the message over to that thread
+	protobuf_conn_chunk_t *chunk = protobuf_conn_chunk_new(buflen);
+	if (buflen > 0)
+		memcpy(chunk->data, buf, buflen);
+
+	if (!protobuf_conn_post(fd, chunk)) {
+		mem_free0(chunk);
+		return 0;
+	}
+	return 1;
+}
+
+static protobuf_conn_chunk_t *
+protobuf_conn_take_posted(protobuf_conn_t *conn)
+{
+	pthread_mutex_lock(&protobuf_conn_shared_lock);
+	protobuf_conn_chunk_t *head = conn->post_head;
+	conn->post_head = conn->post_tail = NULL;
+	pthread_mutex_unlock(&protobuf_conn_shared_lock);
+
+	return head;
+}
+
+/*
+ * Queues the messages posted by other threads, so they are sent before anything
+ * the owning thread sends afterwards.
+ */
+static void
+protobuf_conn_send_posted(protobuf_conn_t *conn)
+{
+	IF_TRUE_RETURN(conn->post_fd < 0);
+
+	protobuf_conn_chunk_t *chunk = protobuf_conn_take_posted(conn);
+	for (protobuf_conn_chunk_t *c = chunk; c; c = c->next) {
+		if (conn->failed || conn->freed)
+			break;
+		if (c->pass_fd < 0)
+			protobuf_conn_send(conn, c->data, c->len);
+		else if (protobuf_conn_queue_fd(conn, c->pass_fd) < 0)
+			conn->failed = true;
+	}
+	protobuf_conn_chunk_free_list(chunk);
+}
+
+static void
+protobuf_conn_post_cb(int fd, unsigned events, UNUSED event_io_t *io, void *data)
+{
+	protobuf_conn_t *conn = data;
+	ASSERT(conn);
+
+	eventfd_t val;
+	IF_FALSE_RETURN(events & EVENT_IO_READ);
+	if (eventfd_read(fd, &val) < 0 && errno != EAGAIN)
+		TRACE_ERRNO("eventfd_read failed");
+
+	protobuf_conn_send_posted(conn);
+}
+
+protobuf_conn_t *
+protobuf_conn_new(int fd, const ProtobufCMessageDescriptor *descriptor,
+		  void (*msg_cb)(protobuf_conn_t *conn, ProtobufCMessage *msg, void *data),
+		  void (*close_cb)(protobuf_conn_t *conn, void *data), void *data)
+{
+	IF_TRUE_RETVAL(fd < 0, NULL);
+	IF_NULL_RETVAL(descriptor, NULL);
+	IF_NULL_RETVAL(msg_cb, NULL);
+	IF_NULL_RETVAL(close_cb, NULL);
+
+	if (fd_make_non_blocking(fd) < 0)
+		return NULL;
+
+	protobuf_conn_t *conn = mem_new0(protobuf_conn_t, 1);
+	conn->fd = fd;
+	conn->descriptor = descriptor;
+	conn->msg_cb = msg_cb;
+	conn->close_cb = close_cb;
+	conn->data = data;
+	conn->post_fd = -1;
+
+	int type;
+	socklen_t type_len = sizeof(type);
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) == 0)
+		conn->records = type != SOCK_STREAM;
+	if (!conn->records)
+		conn->rbuf = mem_alloc(PROTOBUF_CONN_RECV_BUF_SIZE);
+
+	conn->io = event_io_new(fd, EVENT_IO_READ, protobuf_conn_io_cb, conn);
+	event_add_io(conn->io);
+	conn->io_added = true;
+
+	if (!protobuf_conn_map) {
+		protobuf_conn_map = hashmap_new_int();
+		protobuf_set_send_redirect(protobuf_conn_send_redirect);
+	}
+	hashmap_put(protobuf_conn_map, HASHMAP_INT_KEY(fd), conn);
+
+	TRACE("Created protobuf connection %p on fd %d", (void *)conn, fd);
+
+	return conn;
+}
+
+void
+protobuf_conn_free(protobuf_conn_t *conn)
+{
+	IF_NULL_RETURN(conn);
+
+	if (conn->io_added) {
+		event_remove_io(conn->io);
+		conn->io_added = false;
+	}
+
+	// the fd may already be reused by a new connection
+	if (hashmap_get(protobuf_conn_map, HASHMAP_INT_KEY(conn->fd)) == conn)
+		hashmap_remove(protobuf_conn_map, HASHMAP_INT_KEY(conn->fd));
+
+	if (conn->post_fd >= 0) {
+		pthread_mutex_lock(&protobuf_conn_shared_lock);
+		if (hashmap_get(protobuf_conn_shared_map, HASHMAP_INT_KEY(conn->fd)) == conn)
+			hashmap_remove(protobuf_conn_shared_map, HASHMAP_INT_KEY(conn->fd));
+		pthread_mutex_unlock(&protobuf_conn_shared_lock);
+
+		protobuf_conn_chunk_free_list(protobuf_conn_take_posted(conn));
+		event_remove_io(conn->post_io);
+		event_io_free(conn->post_io);
+		conn->post_io = NULL;
+		close(conn->post_fd);
+		conn->post_fd = -1;
+	}
+
+	// the io callback releases the memory once the current message is handled
+	if (conn->dispatching) {
+		conn->freed = true;
+		return;
+	}
+
+	protobuf_conn_destroy(conn);
+}
+
+int
+protobuf_conn_get_fd(const protobuf_conn_t *conn)
+{
+	IF_NULL_RETVAL(conn, -1);
+
+	return conn->fd;
+}
+
+protobuf_conn_t *
+protobuf_conn_get_by_fd(int fd)
+{
+	IF_NULL_RETVAL_TRACE(protobuf_conn_map, NULL);
+
+	return hashmap_get(protobuf_conn_map, HASHMAP_INT_KEY(fd));
+}
+
+size_t
+protobuf_conn_get_pending(const protobuf_conn_t *conn)
+{
+	IF_NULL_RETVAL(conn, 0);
+
+	return conn->pending;
+}
+
+int
+protobuf_conn_set_shared(protobuf_conn_t *conn)
+{
+	ASSERT(conn);
+	IF_TRUE_RETVAL(conn->post_fd >= 0, 0);
+
+	conn->post_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	IF_TRUE_RETVAL_ERROR_ERRNO(conn->post_fd < 0, -1);
+
+	conn->post_io = event_io_new(conn->post_fd, EVENT_IO_READ, protobuf_conn_post_cb, conn);
+	event_add_io(conn->post_io);
+
+	pthread_mutex_lock(&protobuf_conn_shared_lock);
+	if (!protobuf_conn_shared_map)
+		protobuf_conn_shared_map = hashmap_new_int();
+	hashmap_put(protobuf_conn_shared_map, HASHMAP_INT_KEY(conn->fd), conn);
+	pthread_mutex_unlock(&protobuf_conn_shared_lock);
+
+	TRACE("Protobuf connection on fd %d is shared with other threads", conn->fd);
+
+	return 0;
+}
+
+int
+protobuf_conn_send_fd(int sock, int fd)
+{
+	protobuf_conn_t *conn = protobuf_conn_get_by_fd(sock);
+	if (!conn) {
+		int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		IF_TRUE_RETVAL_ERROR_ERRNO(dup_fd < 0, -1);
+
+		protobuf_conn_chunk_t *chunk = protobuf_conn_chunk_new(1);
+		chunk->data[0] = 0;
+		chunk->pass_fd = dup_fd;
+		if (protobuf_conn_post(sock, chunk))
+			return 0;
+
+		protobuf_conn_chunk_free_list(chunk);
+		return sock_unix_send_fd(sock, fd);
+	}
+
+	protobuf_conn_send_posted(conn);
+	IF_TRUE_RETVAL(conn->failed || conn->freed, -1);
+
+	if (protobuf_conn_queue_fd(conn, fd) < 0)
+		conn->failed = true;
+
+	if (!conn->dispatching && conn->io_added)
+		protobuf_conn_update_events(conn);
+
+	return conn->failed ? -1 : 0;
+}
+
+int
+protobuf_conn_take_fd(protobuf_conn_t *conn)
+{
+	ASSERT(conn);
+
+	IF_TRUE_RETVAL(conn->recv_fds_next == conn->recv_fds_len, -1);
+
+	int fd = conn->recv_fds[conn->recv_fds_next];
+	conn->recv_fds[conn->recv_fds_next++] = -1;
+	return fd;
+}
+
+int
+protobuf_conn_send_packed(protobuf_conn_t *conn, const uint8_t *buf, uint32_t buflen)
+{
+	ASSERT(conn);
+
+	// keep the order with messages which other threads sent before
+	protobuf_conn_send_posted(conn);
+
+	return protobuf_conn_send(conn, buf, buflen);
+}
+
+static int
+protobuf_conn_send(protobuf_conn_t *conn, const uint8_t *buf, uint32_t buflen)
+{
+	IF_TRUE_RETVAL(conn->failed || conn->freed, -1);
+	IF_FALSE_RETVAL(buflen < PROTOBUF_MAX_MESSAGE_SIZE, -1);
+	IF_TRUE_RETVAL(buflen > 0 && !buf, -1);
+
+	if (conn->pending + sizeof(uint32_t) + buflen > PROTOBUF_CONN_MAX_PENDING) {
+		WARN("Send queue of fd %d is full, dropping message (len=%u)", conn->fd, buflen);
+		return -1;
+	}
+
+	uint32_t hdr = htonl(buflen);
+	struct iovec iov[2] = { { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+				{ .iov_base = (void *)buf, .iov_len = buflen } };
+	int ret = 0;
+	if (conn->records) {
+		// prefix and body are separate records, see protobuf_recv_message()
+		ret = protobuf_conn_writev(conn, &iov[0], 1);
+		if (ret == 0 && buflen > 0)
+			ret = protobuf_conn_writev(conn, &iov[1], 1);
+	} else {
+		ret = protobuf_conn_writev(conn, iov, buflen > 0 ? 2 : 1);
+	}
+
+	if (ret < 0) {
+		conn->failed = true;
+		// let the io callback report the failure, if not already in there
+		if (!conn->dispatching && conn->io_added)
+			protobuf_conn_update_events(conn);
+		return -1;
+	}
+	TRACE("sent protobuf message on fd %d (len=%u, %zu bytes queued)", conn->fd, buflen,
+	      conn->pending);
+
+	if (!conn->dispatching && conn->io_added)
+		protobuf_conn_update_events(conn);
+	else if (conn->dispatching && conn->pending > PROTOBUF_CONN_HIGH_WATER)
+		conn->paused = true;
+
+	return 0;
+}
+
+int
+protobuf_conn_send_message(protobuf_conn_t *conn, const ProtobufCMessage *message)
+{
+	ASSERT(conn);
+	ASSERT(message);
+
+	// packs into the reused buffer of protobuf_send_message() which ends up in
+	// protobuf_conn_send_packed() through the send redirect of this connection
+	ASSERT(protobuf_conn_get_by_fd(conn->fd) == conn);
+
+	return protobuf_send_message(conn->fd, message) < 0 ? -1 : 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/**
+ * @file protobuf_conn.h
+ *
+ * Implements a non-blocking connection which exchanges length prefixed protobuf
+ * messages (see protobuf.h) over a socket which is watched by the event loop.
+ *
+ * Incoming data is collected incrementally until a message is complete, so a
+ * client which sends only part of a message does not block the event loop. On
+ * stream sockets, everything available is read at once and all complete
+ * messages are dispatched in order before waiting for the next wakeup.
+ * Outgoing messages are written as far as the socket accepts them and the
+ * remainder is queued and flushed when the socket becomes writable again. While
+ * more than PROTOBUF_CONN_HIGH_WATER bytes are queued, no further requests are
+ * read from the client (backpressure), until the queue has drained.
+ *
+ * While a connection exists, protobuf_send_message() and
+ * protobuf_send_message_packed() on its fd are redirected to the connection,
+ * thus existing message handlers which reply on the fd work unchanged.
+ *
+ * A connection must only be used by the thread which created it. Message headers
+ * and bodies are written separately, so the framing also works on SOCK_SEQPACKET
+ * sockets which are read by the blocking protobuf_recv_message().
+ *
+ * Other threads can reply on the fd of a connection which was marked by
+ * protobuf_conn_set_shared(). Their messages are handed over to the owning thread,
+ * which sends them in order before its own following messages.
+ */
+
+#ifndef PROTOBUF_CONN_H
+#define PROTOBUF_CONN_H
+
+#include "protobuf.h"
+
+#include <stddef.h>
+
+/**
+ * Number of queued bytes above which reading from the client is paused.
+ */
+#define PROTOBUF_CONN_HIGH_WATER (1024 * 1024)
+
+typedef struct protobuf_conn protobuf_conn_t;
+
+/**
+ * Creates a new connection for the given, connected socket and adds it to the
+ * event loop. The socket is switched to non-blocking mode.
+ *
+ * For each received message msg_cb is called. The message is freed after msg_cb
+ * returns. If the peer closed the connection, an I/O error happened, or a
+ * received message could not be parsed, close_cb is called. The owner is then
+ * responsible to free the connection by protobuf_conn_free() and to close the fd.
+ * Both callbacks may free the connection.
+ *
+ * @param fd The connected socket.
+ * @param descriptor The descriptor of the messages received on the connection.
+ * @param msg_cb Callback for received messages.
+ * @param close_cb Callback invoked if the connection is no longer usable.
+ * @param data Payload data passed to the callbacks.
+ * @return The newly created connection or NULL on error.
+ */
+protobuf_conn_t *
+protobuf_conn_new(int fd, const ProtobufCMessageDescriptor *descriptor,
+		  void (*msg_cb)(protobuf_conn_t *conn, ProtobufCMessage *msg, void *data),
+		  void (*close_cb)(protobuf_conn_t *conn, void *data), void *data);
+
+/**
+ * Removes the connection from the event loop and frees it. Messages which are still
+ * queued are dropped. The fd is not closed.
+ *
+ * @param conn The connection to be freed.
+ */
+void
+protobuf_conn_free(protobuf_conn_t *conn);
+
+/**
+ * Returns the fd of the connection.
+ *
+ * @param conn The connection.
+ * @return The fd of the connection.
+ */
+int
+protobuf_conn_get_fd(const protobuf_conn_t *conn);
+
+/**
+ * Returns the connection registered for the given fd.
+ *
+ * @param fd The fd of the connection.
+ * @return The connection or NULL if the fd does not belong to a connection.
+ */
+protobuf_conn_t *
+protobuf_conn_get_by_fd(int fd);
+
+/**
+ * Allows other threads to send on the fd of the connection. Messages which they send
+ * by protobuf_send_message() are posted to the thread which created the connection
+ * and written from its event loop. Must be called by the thread which owns the
+ * connection. Once the connection is freed, messages of other threads are no longer
+ * redirected.
+ *
+ * @param conn The connection.
+ * @return 0 on success, -1 on error.
+ */
+int
+protobuf_conn_set_shared(protobuf_conn_t *conn);
+
+/**
+ * Passes fd to the peer of the UNIX socket sock like sock_unix_send_fd(), but in
+ * order with the messages sent on sock before. If sock belongs to a connection of
+ * this thread, or to a shared connection of another thread, a duplicate of fd is
+ * queued behind those messages. Otherwise, fd is passed directly.
+ *
+ * @param sock The UNIX socket to pass the fd on.
+ * @param fd The fd to be passed, it stays open for the caller.
+ * @return 0 if the fd was passed or queued, -1 on error.
+ */
+int
+protobuf_conn_send_fd(int sock, int fd);
+
+/**
+ * Takes the next fd which the peer passed by protobuf_conn_send_fd() ahead of the
+ * message currently handled by msg_cb. Fds are taken in the order they were passed,
+ * those not taken are closed once msg_cb returns. Only supported on record sockets,
+ * e.g., SOCK_SEQPACKET.
+ *
+ * @param conn The connection.
+ * @return The passed fd, which is owned by the caller, or -1 if no fd is left.
+ */
+int
+protobuf_conn_take_fd(protobuf_conn_t *conn);
+
+/**
+ * Returns the number of bytes which are queued for sending.
+ *
+ * @param conn The connection.
+ * @return Number of queued bytes.
+ */
+size_t
+protobuf_conn_get_pending(const protobuf_conn_t *conn);
+
+/**
+ * Sends a serialized protobuf message with length prefix without blocking.
+ * Whatever cannot be written immediately is copied to the send queue.
+ *
+ * @param conn The connection.
+ * @param buf The serialized protobuf message.
+ * @param buflen The length of the serialized message.
+ * @return 0 if the message was sent or queued, -1 on error.
+ */
+int
+protobuf_conn_send_packed(protobuf_conn_t *conn, const uint8_t *buf, uint32_t buflen);
+
+/**
+ * Serializes the given protobuf message and sends it without blocking,
+ * see protobuf_conn_send_packed().
+ *
+ * @param conn The connection.
+ * @param message The protobuf message struct to be sent.
+ * @return 0 if the message was sent or queued, -1 on error.
+ */
+int
+protobuf_conn_send_message(protobuf_conn_t *conn, const ProtobufCMessage *message);
+
+#endif /* PROTOBUF_CONN_H */
@@ -29,6 +29,7 @@
 #include "mem.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/un.h>
@@ -227,6 +228,11 @@ sock_inet_connect_addrinfo(struct addrinfo *addrinfo)
 	}
 
 	if (connect(sock, addrinfo->ai_addr, addrinfo->ai_addrlen) == -1) {
+		// a non-blocking socket completes the connection in the background
+		if (errno == EINPROGRESS) {
+			INFO("Connecting to %s in progress", addrinfo->ai_canonname);
+			return sock;
+		}
 		WARN_ERRNO("Could not connect socket");
 		close(sock);
 		return -1;
@@ -305,6 +311,74 @@ sock_unix_get_peer_pid(int sock, uint32_t *peer_pid)
 	return 0;
 }
 
+int
+sock_unix_send_fd(int sock, int fd)
+{
+	char data = 0;
+	struct iovec iov = { .iov_base = &data, .iov_len = 1 };
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+
+	memset(control.buf, 0, sizeof(control.buf));
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) {
+		ERROR_ERRNO("Failed to pass fd %d on socket %d", fd, sock);
+		return -1;
+	}
+	return 0;
+}
+
+int
+sock_unix_recv_fd(int sock)
+{
+	char data;
+	struct iovec iov = { .iov_base = &data, .iov_len = 1 };
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+
+	ssize_t len;
+	do {
+		len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (len < 0 && errno == EINTR);
+
+	if (len != 1) {
+		ERROR_ERRNO("Failed to receive fd on socket %d", sock);
+		return -1;
+	}
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+		ERROR("No fd received on socket %d", sock);
+		return -1;
+	}
+
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
+
 static char *
 sock_get_env_var_name_new(const char *sock_name)
 {
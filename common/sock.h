@@ -206,6 +206,9 @@ sock_inet_create_and_bind(int type, const char *ip, int port);
  * connection as well as an IPv4 connection transparently.
  * If there are multiple hosts behind a node/service combination it connects to the
  * first returned by getaddrinfo.
+ * For a SOCK_NONBLOCK socket, the connection may still be in progress on return.
+ * Wait until the fd becomes writable and check the result with getsockopt(SO_ERROR).
+ * Other addresses are not tried then. Resolving the node still blocks.
  *
  * @param type  type of the socket (e.g. SOCK_STREAM, SOCK_SEQPACKET, ...)
  *              (bitwise OR with SOCK_NONBLOCK saves extra call to fcntl)
@@ -236,6 +239,26 @@ sock_unix_get_peer_uid(int sock, uint32_t *peer_uid);
 int
 sock_unix_get_peer_pid(int sock, uint32_t *peer_pid);
 
+/**
+ * Passes a duplicate of the file descriptor fd to the peer of the connected UNIX
+ * socket, along with a single byte of data.
+ *
+ * @param sock	the UNIX socket file descriptor
+ * @param fd	the file descriptor to be passed
+ * @return	0 on success, -1 on error
+ */
+int
+sock_unix_send_fd(int sock, int fd);
+
+/**
+ * Receives a file descriptor passed by sock_unix_send_fd() on the UNIX socket.
+ *
+ * @param sock	the UNIX socket file descriptor
+ * @return	the received file descriptor, or -1 on error
+ */
+int
+sock_unix_recv_fd(int sock);
+
 /**
  * Get filesystem path for a given socket name
  * 
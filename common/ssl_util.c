@@ -26,6 +26,7 @@
 #include "macro.h"
 #include "mem.h"
 #include "file.h"
+#include "hashmap.h"
 
 #include <openssl/err.h>
 #include <openssl/sha.h>
@@ -41,7 +42,13 @@
 #include <openssl/evp.h>
 #include <openssl/params.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 //#undef LOGF_LOG_MIN_PRIO
@@ -72,7 +79,11 @@
 
 #define RSA_KEY_EXPONENT RSA_F4
 /* Chunk size for reading sig-/hashfiles */
-#define SIGN_HASH_BUFFER_SIZE 4096
+#define SIGN_HASH_BUFFER_SIZE (1024 * 1024)
+/* Size of the windows in which regular files are mapped for hashing */
+#define SSL_HASH_MMAP_WINDOW (64 * 1024 * 1024)
+/* Maximum number of cached public keys */
+#define SSL_PKEY_CACHE_MAX 32
 
 /*** self provisioning flags and functions */
 #define TEST_C "DE"
@@ -116,6 +127,10 @@ add_ext_req(STACK_OF(X509_EXTENSION) * sk, int nid, char *value);
 static int
 ssl_set_pkey_ctx_rsa_pss(EVP_PKEY_CTX *ctx, const EVP_MD *hash_fct);
 
+/* drops all cached trust stores, verification results and public keys */
+static void
+ssl_cache_clear(void);
+
 OSSL_PROVIDER *tpm_provider = NULL;
 OSSL_PROVIDER *default_provider = NULL;
 
@@ -164,6 +179,8 @@ error:
 void
 ssl_free(void)
 {
+	ssl_cache_clear();
+
 	if (default_provider) {
 		OSSL_PROVIDER_unload(default_provider);
 		default_provider = NULL;
@@ -899,41 +916,227 @@ cb_verify_ignore_time(int ok, X509_STORE_CTX *ctx)
 	return ok;
 }
 
+/*** verification caches
+ *
+ * Trust stores are kept per root certificate file and reloaded if the file changes.
+ * Public keys of certificates passed to ssl_verify_signature_from_digest() are kept by
+ * the SHA-256 of the certificate. Results of verifications are not cached, as scd
+ * verifies in short-lived children, which would drop them anyway. */
+
+typedef struct ssl_store_cache_entry {
+	char *root_cert_file;
+	struct stat st; ///< state of root_cert_file when it was loaded
+	X509_STORE *store;
+} ssl_store_cache_entry_t;
+
+typedef struct ssl_pkey_cache_entry {
+	uint8_t digest[SHA256_DIGEST_LENGTH]; ///< digest of the PEM certificate
+	EVP_PKEY *pkey;
+} ssl_pkey_cache_entry_t;
+
+static hashmap_t *ssl_store_cache = NULL; ///< root_cert_file -> ssl_store_cache_entry_t
+static hashmap_t *ssl_pkey_cache = NULL;  ///< digest -> ssl_pkey_cache_entry_t
+static pthread_mutex_t ssl_pkey_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t
+ssl_cache_digest_hash(const void *key)
+{
+	size_t hash;
+	memcpy(&hash, key, sizeof(hash));
+	return hash;
+}
+
+static bool
+ssl_cache_digest_equal(const void *a, const void *b)
+{
+	return !memcmp(a, b, SHA256_DIGEST_LENGTH);
+}
+
+static void
+ssl_cache_free_pkey_cb(UNUSED const void *key, void *value, UNUSED void *data)
+{
+	ssl_pkey_cache_entry_t *entry = value;
+	EVP_PKEY_free(entry->pkey);
+	mem_free0(entry);
+}
+
+static void
+ssl_cache_free_store_cb(UNUSED const void *key, void *value, UNUSED void *data)
+{
+	ssl_store_cache_entry_t *entry = value;
+	X509_STORE_free(entry->store);
+	mem_free0(entry->root_cert_file);
+	mem_free0(entry);
+}
+
+static void
+ssl_cache_clear(void)
+{
+	if (ssl_store_cache) {
+		hashmap_foreach(ssl_store_cache, ssl_cache_free_store_cb, NULL);
+		hashmap_free(ssl_store_cache);
+		ssl_store_cache = NULL;
+	}
+	pthread_mutex_lock(&ssl_pkey_cache_lock);
+	if (ssl_pkey_cache) {
+		hashmap_foreach(ssl_pkey_cache, ssl_cache_free_pkey_cb, NULL);
+		hashmap_free(ssl_pkey_cache);
+		ssl_pkey_cache = NULL;
+	}
+	pthread_mutex_unlock(&ssl_pkey_cache_lock);
+}
+
+static bool
+ssl_cache_stat_equal(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+	       a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+	       a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+	       a->st_ctim.tv_sec == b->st_ctim.tv_sec && a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+/*
+ * Returns the cached trust store for root_cert_file, (re)loading it if the file was not
+ * loaded yet or modified since. The store is owned by the cache.
+ */
+static ssl_store_cache_entry_t *
+ssl_store_cache_get(const char *root_cert_file)
+{
+	IF_NULL_RETVAL_ERROR(root_cert_file, NULL);
+
+	struct stat st;
+	if (stat(root_cert_file, &st) < 0) {
+		ERROR_ERRNO("Failed to load root CA %s", root_cert_file);
+		return NULL;
+	}
+
+	if (!ssl_store_cache)
+		ssl_store_cache = hashmap_new_str();
+
+	ssl_store_cache_entry_t *entry = hashmap_get(ssl_store_cache, root_cert_file);
+	if (entry && ssl_cache_stat_equal(&entry->st, &st))
+		return entry;
+
+	X509_STORE *store = X509_STORE_new();
+	if (store == NULL) {
+		ERROR("Error in certificate verification (setup store)");
+		return NULL;
+	}
+	if (!X509_STORE_load_locations(store, root_cert_file, NULL)) {
+		ERROR("Failed to load root CA");
+		X509_STORE_free(store);
+		return NULL;
+	}
+
+	if (entry) {
+		DEBUG("Root CA %s changed, reloading it", root_cert_file);
+		hashmap_remove(ssl_store_cache, root_cert_file);
+		ssl_cache_free_store_cb(NULL, entry, NULL);
+	}
+
+	entry = mem_new0(ssl_store_cache_entry_t, 1);
+	entry->root_cert_file = mem_strdup(root_cert_file);
+	entry->st = st;
+	entry->store = store;
+	hashmap_put(ssl_store_cache, entry->root_cert_file, entry);
+
+	return entry;
+}
+
+/*
+ * Returns the public key of the PEM certificate in cert_buf, using the cache of already
+ * parsed certificates. The caller owns a reference of the returned key.
+ * The pkey cache is locked, as signatures may be verified from worker threads.
+ */
+static EVP_PKEY *
+ssl_pkey_cache_get(const char *cert_buf, size_t cert_len)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	EVP_PKEY *pkey = NULL;
+	IF_NULL_RETVAL(SHA256((const unsigned char *)cert_buf, cert_len, digest), NULL);
+
+	pthread_mutex_lock(&ssl_pkey_cache_lock);
+
+	if (!ssl_pkey_cache)
+		ssl_pkey_cache = hashmap_new(ssl_cache_digest_hash, ssl_cache_digest_equal);
+
+	ssl_pkey_cache_entry_t *entry = hashmap_get(ssl_pkey_cache, digest);
+	if (entry) {
+		if (EVP_PKEY_up_ref(entry->pkey))
+			pkey = entry->pkey;
+		goto out;
+	}
+
+	BIO *mem = BIO_new_mem_buf(cert_buf, cert_len);
+	IF_NULL_GOTO(mem, out);
+	X509 *cert = PEM_read_bio_X509(mem, NULL, 0, NULL);
+	BIO_free(mem);
+	IF_NULL_GOTO(cert, out);
+
+	pkey = X509_get_pubkey(cert);
+	X509_free(cert);
+	IF_NULL_GOTO(pkey, out);
+
+	if (hashmap_size(ssl_pkey_cache) >= SSL_PKEY_CACHE_MAX) {
+		hashmap_foreach(ssl_pkey_cache, ssl_cache_free_pkey_cb, NULL);
+		hashmap_free(ssl_pkey_cache);
+		ssl_pkey_cache = hashmap_new(ssl_cache_digest_hash, ssl_cache_digest_equal);
+	}
+	if (EVP_PKEY_up_ref(pkey)) {
+		entry = mem_new0(ssl_pkey_cache_entry_t, 1);
+		memcpy(entry->digest, digest, sizeof(entry->digest));
+		entry->pkey = pkey;
+		hashmap_put(ssl_pkey_cache, entry->digest, entry);
+	}
+
+out:
+	pthread_mutex_unlock(&ssl_pkey_cache_lock);
+	return pkey;
+}
+
+int
+ssl_preload_root_cert(const char *root_cert_file)
+{
+	return ssl_store_cache_get(root_cert_file) ? 0 : -1;
+}
+
 int
 ssl_verify_certificate(const char *test_cert_file, const char *root_cert_file, bool ignore_time)
 {
 	X509 *test_cert = NULL;
-	X509_STORE *store = NULL;
 	X509_STORE_CTX *context = NULL;
 	STACK_OF(X509) *chainstack = NULL;
 	BIO *stackbio = NULL;
+	char *test_cert_buf = NULL;
 	int ret = 0;
 
-	if ((store = X509_STORE_new()) == NULL) {
-		ERROR("Error in certificate verification (setup store)");
+	ssl_store_cache_entry_t *store_entry = ssl_store_cache_get(root_cert_file);
+	if (store_entry == NULL) {
 		ret = -2;
 		goto end;
 	}
 
-	if ((context = X509_STORE_CTX_new()) == NULL) {
-		ERROR("Error in certificate verification (setup store_ctx)");
+	off_t test_cert_len = test_cert_file ? file_size(test_cert_file) : -1;
+	if (test_cert_len <= 0) {
+		ERROR("Error loading certificate chain");
 		ret = -2;
 		goto end;
 	}
-
-	if (ignore_time) {
-		DEBUG("Certificate expiration and not yet valid case will be ignored");
-		X509_STORE_set_verify_cb(store, cb_verify_ignore_time);
+	test_cert_buf = mem_alloc(test_cert_len);
+	if (file_read(test_cert_file, test_cert_buf, test_cert_len) != test_cert_len) {
+		ERROR("Error loading certificate chain");
+		ret = -2;
+		goto end;
 	}
 
-	if (!X509_STORE_load_locations(store, root_cert_file, NULL)) {
-		ERROR("Failed to load root CA");
+	if ((context = X509_STORE_CTX_new()) == NULL) {
+		ERROR("Error in certificate verification (setup store_ctx)");
 		ret = -2;
 		goto end;
 	}
 
-	stackbio = BIO_new(BIO_s_file());
-	if (BIO_read_filename(stackbio, test_cert_file) <= 0) {
+	stackbio = BIO_new_mem_buf(test_cert_buf, test_cert_len);
+	if (stackbio == NULL) {
 		ERROR("Error loading certificate chain");
 		ret = -2;
 		goto end;
@@ -964,12 +1167,17 @@ ssl_verify_certificate(const char *test_cert_file, const char *root_cert_file, b
 	if (!sk_X509_num(chainstack))
 		WARN("Certificate under test has no chain");
 
-	if (!X509_STORE_CTX_init(context, store, test_cert, chainstack)) {
+	if (!X509_STORE_CTX_init(context, store_entry->store, test_cert, chainstack)) {
 		ERROR("Error in certificate verification (init store_ctx)");
 		ret = -2;
 		goto end;
 	}
 
+	if (ignore_time) {
+		DEBUG("Certificate expiration and not yet valid case will be ignored");
+		X509_STORE_CTX_set_verify_cb(context, cb_verify_ignore_time);
+	}
+
 	int verify_ret = X509_verify_cert(context);
 	const char *verify_string =
 		X509_verify_cert_error_string(X509_STORE_CTX_get_error(context));
@@ -999,10 +1207,9 @@ end:
 		X509_STORE_CTX_cleanup(context);
 		X509_STORE_CTX_free(context);
 	}
-	if (store != NULL)
-		X509_STORE_free(store);
 	if (stackbio != NULL)
 		BIO_free(stackbio);
+	mem_free0(test_cert_buf);
 	if (chainstack != NULL)
 		sk_X509_pop_free(chainstack, X509_free);
 	if (test_cert != NULL)
@@ -1054,18 +1261,10 @@ ssl_verify_signature_from_digest(const char *cert_buf, size_t cert_len, const ui
 	IF_FALSE_RETVAL_ERROR(0 < hash_len, -1);
 
 	int ret = 0;
-	X509 *cert;
 	EVP_PKEY *key = NULL;
-	BIO *mem;
 	EVP_PKEY_CTX *pkey_ctx = NULL;
 
-	// load certificate
-	mem = BIO_new(BIO_s_mem());
-	BIO_write(mem, cert_buf, cert_len);
-	cert = PEM_read_bio_X509(mem, NULL, 0, NULL);
-	BIO_free(mem);
-
-	if ((key = X509_get_pubkey(cert)) == NULL) {
+	if ((key = ssl_pkey_cache_get(cert_buf, cert_len)) == NULL) {
 		ERROR("Error in signature verification (loading pubkey failed)");
 		ret = -2;
 		goto error;
@@ -1133,8 +1332,6 @@ ssl_verify_signature_from_digest(const char *cert_buf, size_t cert_len, const ui
 	}
 
 error:
-	if (cert)
-		X509_free(cert);
 	if (key)
 		EVP_PKEY_free(key);
 	if (pkey_ctx)
@@ -1183,47 +1380,126 @@ error:
 	return ret;
 }
 
+/*
+ * Feeds the regular file fd of the given size to the digest, mapping it in windows of
+ * SSL_HASH_MMAP_WINDOW bytes. Returns -1 if the file cannot be mapped, e.g., on
+ * file systems without mmap support, and -2 if hashing failed.
+ */
+static int
+ssl_hash_fd_mmap(EVP_MD_CTX *md_ctx, int fd, off_t size)
+{
+	for (off_t off = 0; off < size; off += SSL_HASH_MMAP_WINDOW) {
+		size_t len = MIN((off_t)SSL_HASH_MMAP_WINDOW, size - off);
+		void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, off);
+		if (map == MAP_FAILED) {
+			IF_TRUE_RETVAL(off == 0, -1);
+			ERROR_ERRNO("Error in file hashing (mapping file at offset %jd)",
+				    (intmax_t)off);
+			return -2;
+		}
+		if (madvise(map, len, MADV_SEQUENTIAL))
+			TRACE_ERRNO("madvise MADV_SEQUENTIAL failed");
+
+		int ok = EVP_DigestUpdate(md_ctx, map, len);
+		munmap(map, len);
+		if (!ok) {
+			ERROR("Error in file hashing (hashing file failed)");
+			return -2;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Feeds fd to the digest until EOF using SIGN_HASH_BUFFER_SIZE sized reads. If size is
+ * not negative, exactly size bytes are hashed and a shorter file is an error.
+ */
+static int
+ssl_hash_fd_read(EVP_MD_CTX *md_ctx, int fd, off_t size)
+{
+	unsigned char *buffer = mem_alloc(SIGN_HASH_BUFFER_SIZE);
+	ssize_t len;
+	int ret = 0;
+
+	while (size != 0) {
+		size_t chunk = size < 0 ? SIGN_HASH_BUFFER_SIZE :
+					  (size_t)MIN(size, (off_t)SIGN_HASH_BUFFER_SIZE);
+		if ((len = read(fd, buffer, chunk)) == 0)
+			break;
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			ERROR_ERRNO("Error in file hashing (reading file failed)");
+			ret = -1;
+			break;
+		}
+		if (!EVP_DigestUpdate(md_ctx, buffer, len)) {
+			ERROR("Error in file hashing (hashing file failed)");
+			ret = -1;
+			break;
+		}
+		if (size > 0)
+			size -= len;
+	}
+	if (ret == 0 && size > 0) {
+		ERROR("Error in file hashing (file is too short)");
+		ret = -1;
+	}
+
+	mem_free0(buffer);
+	return ret;
+}
+
 unsigned char *
 ssl_hash_file(const char *file_to_hash, unsigned int *calc_len, const char *hash_algo)
+{
+	return ssl_hash_file_len(file_to_hash, -1, calc_len, hash_algo);
+}
+
+unsigned char *
+ssl_hash_file_len(const char *file_to_hash, off_t len, unsigned int *calc_len,
+		  const char *hash_algo)
 {
 	ASSERT(file_to_hash);
 	ASSERT(hash_algo);
 
 	unsigned char *ret = NULL;
-	FILE *fp = NULL;
+	int fd = -1;
+	struct stat st;
 	const EVP_MD *hash_fct;
 	EVP_MD_CTX *md_ctx = NULL;
 
-	if (!(fp = fopen(file_to_hash, "rb"))) {
-		ERROR("Error in file hasing (opening hash file)");
-		return NULL;
+	if ((fd = open(file_to_hash, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0) {
+		ERROR_ERRNO("Error in file hasing (opening hash file)");
+		goto error;
 	}
 
 	if ((hash_fct = EVP_get_digestbyname(hash_algo)) == NULL) {
 		ERROR("Error in file hasing (unable to initialize hash function");
-		fclose(fp);
-		return NULL;
+		goto error;
 	}
 
 	if ((md_ctx = EVP_MD_CTX_new()) == NULL) {
 		ERROR("Allocating EVP_MD failed!");
-		fclose(fp);
-		return NULL;
+		goto error;
 	}
 
 	EVP_DigestInit(md_ctx, hash_fct);
 
-	int len = 0;
-	unsigned char buffer[SIGN_HASH_BUFFER_SIZE];
+	// images are read exactly once from start to end, let the kernel read ahead
+	if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL))
+		TRACE("posix_fadvise POSIX_FADV_SEQUENTIAL failed for %s", file_to_hash);
 
-	while ((len = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-		if (!EVP_DigestUpdate(md_ctx, buffer, len)) {
-			ERROR("Error in file hashing (reading/hashing file failed");
-			fclose(fp);
-			goto error;
-		}
-	}
-	fclose(fp);
+	/*
+	 * Regular files are mapped, which avoids copying each block into a user buffer.
+	 * Files which report no size (e.g. in procfs) or cannot be mapped are read.
+	 */
+	int res = -1;
+	if (S_ISREG(st.st_mode) && st.st_size > 0 && len <= st.st_size)
+		res = ssl_hash_fd_mmap(md_ctx, fd, len < 0 ? st.st_size : len);
+	if (res == -1)
+		res = ssl_hash_fd_read(md_ctx, fd, len);
+	IF_TRUE_GOTO(res < 0, error);
 
 	ret = (unsigned char *)mem_alloc0(EVP_MAX_MD_SIZE);
 	if (EVP_DigestFinal(md_ctx, ret, calc_len) != 1) {
@@ -1239,6 +1515,8 @@ ssl_hash_file(const char *file_to_hash, unsigned int *calc_len, const char *hash
 	*/
 
 error:
+	if (fd >= 0)
+		close(fd);
 	EVP_MD_CTX_free(md_ctx);
 	return ret;
 }
@@ -1748,16 +2026,6 @@ ssl_verify_signature_from_buf(uint8_t *cert_buf, size_t cert_len, const uint8_t
 
 	int ret = 0;
 
-	// certificate variables
-	X509 *cert;
-	BIO *mem;
-
-	// load certificate
-	mem = BIO_new(BIO_s_mem());
-	BIO_write(mem, cert_buf, cert_len);
-	cert = PEM_read_bio_X509(mem, NULL, 0, NULL);
-	BIO_free(mem);
-
 	DEBUG("Hash algo: %s", digest_algo);
 	unsigned int hash_len = 0;
 	unsigned char *hash = ssl_hash_buf(buf, buf_len, &hash_len, digest_algo);
@@ -1770,8 +2038,6 @@ ssl_verify_signature_from_buf(uint8_t *cert_buf, size_t cert_len, const uint8_t
 	}
 
 	mem_free0(hash);
-	if (cert)
-		X509_free(cert);
 
 	return ret;
 }
@@ -1784,33 +2050,40 @@ ssl_verify_signature(const char *cert_file, const char *signature_file, const ch
 	ASSERT(signature_file);
 	ASSERT(signed_file);
 
+	int ret = -1;
+	unsigned char *sig_buf = NULL;
+	unsigned char *hash = NULL;
 	off_t cert_len = file_size(cert_file);
 	char *cert_buf = mem_alloc0(cert_len);
 
 	if (0 > file_read(cert_file, cert_buf, cert_len)) {
 		ERROR("Failed to read cert file");
-		return -1;
+		goto out;
 	}
 
 	int sig_len = file_size(signature_file);
-	unsigned char *sig_buf = mem_alloc0(sig_len);
+	sig_buf = mem_alloc0(sig_len);
 
 	if (0 > file_read(signature_file, (char *)sig_buf, sig_len)) {
 		ERROR("Failed to read signature file");
-		return -1;
+		goto out;
 	}
 
 	unsigned int hash_len;
-	unsigned char *hash = ssl_hash_file(signed_file, &hash_len, digest_algo);
+	hash = ssl_hash_file(signed_file, &hash_len, digest_algo);
 
 	if (!hash) {
 		ERROR("Failed to hash file: %s", signed_file);
-		return -1;
+		goto out;
 	}
 
-	int ret = ssl_verify_signature_from_digest(cert_buf, cert_len, sig_buf, sig_len, hash,
-						   hash_len, digest_algo);
+	ret = ssl_verify_signature_from_digest(cert_buf, cert_len, sig_buf, sig_len, hash,
+					       hash_len, digest_algo);
 
+out:
+	mem_free0(hash);
+	mem_free0(sig_buf);
+	mem_free0(cert_buf);
 	return ret;
 }
 
@@ -25,6 +25,7 @@
 #define P12UTIL_H
 
 #include <stdbool.h>
+#include <sys/types.h>
 
 #include <openssl/evp.h>
 #include <openssl/x509v3.h>
@@ -106,12 +107,23 @@ ssl_unwrap_key_sym(const unsigned char *kek, const unsigned char *wrapped_key,
  * the root certificate in root_cert_file.
  * The parameter ignore_time specifies whether the fields notBefore and notAfter should be considered for the
  * verification result or not.
+ * Trust stores are loaded once per root_cert_file and reloaded when the file changes.
+ * The cache is not thread safe and is dropped by ssl_free().
  * @return Returns 0 on success, -1 if the verification failed and -2 in case of
  * an unexpected verification error.
  */
 int
 ssl_verify_certificate(const char *test_cert_file, const char *root_cert_file, bool ignore_time);
 
+/**
+ * Loads the trust store for root_cert_file into the cache used by ssl_verify_certificate(),
+ * or reloads it if the file changed. Long-lived processes which verify in forked children
+ * call this before forking, so that the children inherit the loaded store.
+ * @return Returns 0 on success, -1 if the root certificate could not be loaded.
+ */
+int
+ssl_preload_root_cert(const char *root_cert_file);
+
 /**
  * verifies a signature stored in signed_file with a certificate stored in cert_file. Thereby, the original
  * file located in signature_file is hashed with the hash algorithm hash_algo.
@@ -162,6 +174,15 @@ ssl_hash_buf(const unsigned char *buf_to_hash, unsigned int buf_len, unsigned in
 unsigned char *
 ssl_hash_file(const char *file_to_hash, unsigned int *calc_len, const char *hash_algo);
 
+/**
+ * Like ssl_hash_file(), but only the first len bytes of file_to_hash are hashed, e.g., of
+ * a partition which is larger than the image flashed to it. If len is negative, the
+ * whole file is hashed. A file shorter than len is an error.
+ */
+unsigned char *
+ssl_hash_file_len(const char *file_to_hash, off_t len, unsigned int *calc_len,
+		  const char *hash_algo);
+
 /**
  * creates a pkcs 12 softtoken located in the file token_file, locked with the password passphrase.
  * The corresponding (currently) self-signed certificate is stored in the file cert_file, if specified
@@ -691,6 +691,48 @@ test_ssl_verify_cert_null_untrusted_complete_chain(UNUSED const MunitParameter p
 	return MUNIT_OK;
 }
 
+// Test that the cached trust store follows changes of the root CA file
+static MunitResult
+test_ssl_verify_cert_cache_root_changed(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	char root[] = "/tmp/ssl_verify_cache_root.XXXXXX";
+	int fd = mkstemp(root);
+	munit_assert_int(fd, >=, 0);
+	close(fd);
+
+	munit_assert_int(file_copy("testdata/testpki/ssig_rootca.cert", root, -1, 512, 0), ==, 0);
+
+	munit_assert_int(ssl_preload_root_cert(root), ==, 0);
+
+	// FUT: verify twice, both with the preloaded store
+	for (int i = 0; i < 2; i++)
+		munit_assert_int(ssl_verify_certificate("testdata/testpki/ssig_cml.cert", root,
+							false),
+				 ==, 0);
+
+	// the store does not accept other chains
+	for (int i = 0; i < 2; i++)
+		munit_assert_int(ssl_verify_certificate("testdata/testpki_untrusted/ssig_cml.cert",
+							root, false),
+				 ==, -1);
+
+	// replacing the root CA reloads the store
+	munit_assert_int(unlink(root), ==, 0);
+	munit_assert_int(file_copy("testdata/testpki_untrusted/ssig_rootca.cert", root, -1, 512,
+				   0),
+			 ==, 0);
+	munit_assert_int(ssl_verify_certificate("testdata/testpki/ssig_cml.cert", root, false), ==,
+			 -1);
+	munit_assert_int(ssl_verify_certificate("testdata/testpki_untrusted/ssig_cml.cert", root,
+						false),
+			 ==, 0);
+
+	unlink(root);
+	munit_assert_int(ssl_preload_root_cert(root), ==, -1);
+
+	return MUNIT_OK;
+}
+
 static MunitResult
 test_ssl_aes_ecb_pad_success(UNUSED const MunitParameter params[], UNUSED void *data)
 {
@@ -963,6 +1005,91 @@ test_ssl_aes_ctr_fail_key(UNUSED const MunitParameter params[], UNUSED void *dat
 	return MUNIT_OK;
 }
 
+static MunitResult
+test_ssl_hash_file(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	char path[] = "/tmp/ssl_hash_file_test.XXXXXX";
+	int fd = mkstemp(path);
+	munit_assert_int(fd, >=, 0);
+	close(fd);
+
+	// an empty file and sizes which do not align with the internal read buffer
+	size_t sizes[] = { 0, 17, 1024 * 1024, 3 * 1024 * 1024 + 4097 };
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		unsigned char *buf = mem_alloc0(sizes[i] + 1);
+		munit_rand_memory(sizes[i], buf);
+		munit_assert_int(file_write(path, (char *)buf, sizes[i]), ==, (int)sizes[i]);
+
+		// FUT: hash from file must match hash over the same content in memory
+		unsigned int file_len = 0, buf_len = 0;
+		unsigned char *file_hash = ssl_hash_file(path, &file_len, "SHA256");
+		unsigned char *buf_hash = ssl_hash_buf(buf, sizes[i], &buf_len, "SHA256");
+		munit_assert_not_null(file_hash);
+		munit_assert_not_null(buf_hash);
+		munit_assert_uint(file_len, ==, 32);
+		munit_assert_uint(file_len, ==, buf_len);
+		munit_assert_memory_equal(file_len, file_hash, buf_hash);
+
+		mem_free0(file_hash);
+		mem_free0(buf_hash);
+		mem_free0(buf);
+	}
+
+	unlink(path);
+	munit_assert_null(ssl_hash_file(path, &(unsigned int){ 0 }, "SHA256"));
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_ssl_hash_file_len(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	char path[] = "/tmp/ssl_hash_file_test.XXXXXX";
+	int fd = mkstemp(path);
+	munit_assert_int(fd, >=, 0);
+	close(fd);
+
+	size_t size = 3 * 1024 * 1024 + 4097;
+	unsigned char *buf = mem_alloc0(size);
+	munit_rand_memory(size, buf);
+	munit_assert_int(file_write(path, (char *)buf, size), ==, (int)size);
+
+	// FUT: only the prefix of the file is hashed
+	unsigned int file_len = 0, buf_len = 0;
+	unsigned char *file_hash = ssl_hash_file_len(path, 1024 * 1024 + 5, &file_len, "SHA256");
+	unsigned char *buf_hash = ssl_hash_buf(buf, 1024 * 1024 + 5, &buf_len, "SHA256");
+	munit_assert_not_null(file_hash);
+	munit_assert_not_null(buf_hash);
+	munit_assert_uint(file_len, ==, buf_len);
+	munit_assert_memory_equal(file_len, file_hash, buf_hash);
+	mem_free0(file_hash);
+	mem_free0(buf_hash);
+
+	// the file must not be shorter than the hashed length
+	munit_assert_null(ssl_hash_file_len(path, size + 1, &file_len, "SHA256"));
+
+	// files which cannot be mapped are read, e.g., a pipe like a block device
+	int pipe_fd[2];
+	munit_assert_int(pipe(pipe_fd), ==, 0);
+	munit_assert_int(write(pipe_fd[1], buf, 100), ==, 100);
+	close(pipe_fd[1]);
+	char *pipe_path = mem_printf("/proc/self/fd/%d", pipe_fd[0]);
+	file_hash = ssl_hash_file_len(pipe_path, 50, &file_len, "SHA256");
+	buf_hash = ssl_hash_buf(buf, 50, &buf_len, "SHA256");
+	munit_assert_not_null(file_hash);
+	munit_assert_not_null(buf_hash);
+	munit_assert_memory_equal(file_len, file_hash, buf_hash);
+	mem_free0(file_hash);
+	mem_free0(buf_hash);
+	close(pipe_fd[0]);
+	mem_free0(pipe_path);
+
+	mem_free0(buf);
+	unlink(path);
+
+	return MUNIT_OK;
+}
+
 static MunitTest tests[] = {
 	{ "test_ssl_verify_signature_from_buf_ssa_ssacert",
 	  test_ssl_verify_signature_from_buf_ssa_ssacert, setup, tear_down, MUNIT_TEST_OPTION_NONE,
@@ -1045,6 +1172,12 @@ static MunitTest tests[] = {
 	  MUNIT_TEST_OPTION_NONE, NULL },
 	{ "test_ssl_aes_ctr_fail_key", test_ssl_aes_ctr_fail_key, setup, tear_down,
 	  MUNIT_TEST_OPTION_NONE, NULL },
+	{ "test_ssl_verify_cert_cache_root_changed", test_ssl_verify_cert_cache_root_changed, setup,
+	  tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+	{ "test_ssl_hash_file", test_ssl_hash_file, setup, tear_down, MUNIT_TEST_OPTION_NONE,
+	  NULL },
+	{ "test_ssl_hash_file_len", test_ssl_hash_file_len, setup, tear_down,
+	  MUNIT_TEST_OPTION_NONE, NULL },
 	//Mark the end of the array with an entry where the test function is NULL
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
@@ -30,32 +30,65 @@
 #include "mem.h"
 #include "macro.h"
 
+/* Define the size of the inline buffer used until a string outgrows it */
+#define STR_INLINE_SIZE 64
+
 struct str {
-	char *buf;
+	char *buf; // points to inline while the string fits into it
 	ssize_t len;
 	size_t allocated_len;
+	char inline_buf[STR_INLINE_SIZE];
 };
 
+/*
+ * Makes room for len more bytes and the terminating null. The buffer grows at least by
+ * half of its size, so that appending n bytes is amortized O(n).
+ */
 static void
 str_expand(str_t *str, size_t len)
 {
 	IF_NULL_RETURN(str);
 
-	if (str->len + len < str->allocated_len)
+	size_t needed = str->len + len + 1;
+	if (needed <= str->allocated_len)
 		return;
 
-	str->allocated_len = str->len + len + 1;
-	str->buf = mem_realloc(str->buf, str->allocated_len);
+	size_t allocated_len = MAX(needed, str->allocated_len + str->allocated_len / 2);
+	if (str->buf == str->inline_buf) {
+		str->buf = mem_alloc(allocated_len);
+		memcpy(str->buf, str->inline_buf, str->len + 1);
+	} else {
+		str->buf = mem_realloc(str->buf, allocated_len);
+	}
+	str->allocated_len = allocated_len;
 }
 
+/*
+ * Formats into the spare capacity of the buffer, which is only expanded if the output
+ * does not fit.
+ */
 static void
 str_append_printf_internal(str_t *str, const char *fmt, va_list ap)
 {
-	char *buf;
+	IF_NULL_RETURN(str);
 
-	buf = mem_vprintf(fmt, ap);
-	str_insert_len(str, -1, buf, -1);
-	mem_free0(buf);
+	va_list ap_retry;
+	va_copy(ap_retry, ap);
+
+	size_t spare = str->allocated_len - str->len;
+	int len = vsnprintf(str->buf + str->len, spare, fmt, ap);
+	if (len < 0) {
+		str->buf[str->len] = 0;
+		goto out;
+	}
+
+	if ((size_t)len >= spare) {
+		str_expand(str, len);
+		vsnprintf(str->buf + str->len, len + 1, fmt, ap_retry);
+	}
+	str->len += len;
+out:
+	va_end(ap_retry);
 }
 
 str_t *
@@ -82,11 +115,11 @@ str_new_len(size_t len)
 
 	str = mem_new(str_t, 1);
 
-	str->allocated_len = 0;
+	str->buf = str->inline_buf;
+	str->allocated_len = STR_INLINE_SIZE;
 	str->len = 0;
-	str->buf = NULL;
 
-	str_expand(str, MAX(len, 2));
+	str_expand(str, len);
 	str->buf[0] = 0;
 
 	return str;
@@ -192,12 +225,12 @@ str_insert_len(str_t *str, ssize_t pos, const char *buf, ssize_t len)
 	else if (pos > str->len)
 		return;
 
-	str_expand(str, len);
-
+	// inserting a part of the string itself, which may be moved by the expansion
 	if (buf >= str->buf && buf <= str->buf + str->len) {
 		ssize_t offset = buf - str->buf;
 		ssize_t precount = 0;
 
+		str_expand(str, len);
 		buf = str->buf + offset;
 
 		if (pos < str->len)
@@ -211,6 +244,8 @@ str_insert_len(str_t *str, ssize_t pos, const char *buf, ssize_t len)
 		if (len > precount)
 			memcpy(str->buf + pos + precount, buf + precount + len, len - precount);
 	} else {
+		str_expand(str, len);
+
 		if (pos < str->len)
 			memmove(str->buf + pos + len, str->buf + pos, str->len - pos);
 
@@ -252,12 +287,17 @@ str_free(str_t *str, bool free_buf)
 	IF_NULL_RETVAL(str, NULL);
 
 	if (free_buf) {
-		mem_free0(str->buf);
 		buf = NULL;
+	} else if (str->buf == str->inline_buf) {
+		buf = (char *)mem_memcpy((unsigned char *)str->buf, str->len + 1);
 	} else {
 		buf = str->buf;
+		str->buf = NULL;
 	}
 
+	if (str->buf != str->inline_buf)
+		mem_free0(str->buf);
+
 	mem_free0(str);
 
 	return buf;
@@ -266,7 +306,7 @@ str_free(str_t *str, bool free_buf)
 str_t *
 str_hexdump_new(unsigned char *mem, size_t len)
 {
-	str_t *ret = str_new_len(len * 2 + 1);
+	str_t *ret = str_new_len(len * 3);
 
 	while (len--) {
 		str_append_printf(ret, "%02x ", *mem);
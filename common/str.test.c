@@ -0,0 +1,230 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "munit.h"
+
+#include "str.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+#include <string.h>
+#include <time.h>
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+	return NULL;
+}
+
+static void
+tear_down(UNUSED void *fixture)
+{
+	// No clean-up needed for now
+}
+
+static MunitResult
+test_append(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	str_t *str = str_new("ab");
+	munit_assert_string_equal(str_buffer(str), "ab");
+
+	// grows from the inline buffer to the heap
+	for (int i = 0; i < 1000; i++)
+		str_append(str, "0123456789");
+	munit_assert_size(str_length(str), ==, 2 + 1000 * 10);
+	munit_assert_memory_equal(2, str_buffer(str), "ab");
+	for (int i = 0; i < 1000; i++)
+		munit_assert_memory_equal(10, str_buffer(str) + 2 + i * 10, "0123456789");
+
+	str_append_len(str, "xyz", 2);
+	munit_assert_string_equal(str_buffer(str) + str_length(str) - 3, "9xy");
+
+	str_truncate(str, 1);
+	munit_assert_string_equal(str_buffer(str), "a");
+
+	str_free(str, true);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_printf(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	str_t *str = str_new_printf("%d-%s", 42, "x");
+	munit_assert_string_equal(str_buffer(str), "42-x");
+
+	// output which does not fit into the spare capacity
+	char *big = mem_alloc0(5001);
+	memset(big, 'b', 5000);
+	str_append_printf(str, "<%s>", big);
+	munit_assert_size(str_length(str), ==, 4 + 5002);
+	munit_assert_string_equal(str_buffer(str) + 4 + 5001, ">");
+
+	str_assign_printf(str, "%s", "new");
+	munit_assert_string_equal(str_buffer(str), "new");
+
+	mem_free0(big);
+	str_free(str, true);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_insert(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	str_t *str = str_new("world");
+	str_insert(str, 0, "hello ");
+	munit_assert_string_equal(str_buffer(str), "hello world");
+
+	// insert a part of the string itself, which has to be expanded
+	for (int i = 0; i < 8; i++)
+		str_insert_len(str, 0, str_buffer(str), str_length(str));
+	munit_assert_size(str_length(str), ==, 11 * 256);
+	for (int i = 0; i < 256; i++)
+		munit_assert_memory_equal(11, str_buffer(str) + i * 11, "hello world");
+
+	// positions behind the end are ignored
+	str_insert(str, str_length(str) + 1, "x");
+	munit_assert_size(str_length(str), ==, 11 * 256);
+
+	str_free(str, true);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_free_keep_buffer(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// the buffer of short strings is inline and has to be copied
+	char *buf = str_free(str_new("short"), false);
+	munit_assert_string_equal(buf, "short");
+	mem_free0(buf);
+
+	str_t *str = str_new_len(1000);
+	str_append(str, "long");
+	buf = str_free(str, false);
+	munit_assert_string_equal(buf, "long");
+	mem_free0(buf);
+
+	unsigned char mem[] = { 0x00, 0xab, 0xff };
+	str = str_hexdump_new(mem, sizeof(mem));
+	munit_assert_string_equal(str_buffer(str), "00 ab ff ");
+	str_free(str, true);
+
+	return MUNIT_OK;
+}
+
+static double
+elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static MunitResult
+test_benchmark(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	const int n = 200000;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	str_t *str = str_new(NULL);
+	for (int i = 0; i < n; i++)
+		str_append(str, "-A FORWARD ");
+	munit_assert_size(str_length(str), ==, (size_t)n * 11);
+	str_free(str, true);
+	munit_logf(MUNIT_LOG_INFO, "%d appends: %.1f ms", n, elapsed_ms(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	str = str_new(NULL);
+	for (int i = 0; i < n; i++)
+		str_append_printf(str, "%02x ", i & 0xff);
+	munit_assert_size(str_length(str), ==, (size_t)n * 3);
+	str_free(str, true);
+	munit_logf(MUNIT_LOG_INFO, "%d printf appends: %.1f ms", n, elapsed_ms(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < n; i++)
+		str_free(str_new_printf("%s:%d", "iface", i), true);
+	munit_logf(MUNIT_LOG_INFO, "%d short strings: %.1f ms", n, elapsed_ms(&start));
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/append",		/* name */
+		test_append,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/printf",		/* name */
+		test_printf,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/insert",		/* name */
+		test_insert,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/free keep buffer",	/* name */
+		test_free_keep_buffer,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/benchmark",		/* name */
+		test_benchmark,		/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite str_suite = {
+	"/str",			/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
@@ -31,11 +31,13 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <sched.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <grp.h>
+#include <linux/filter.h>
 
 #include "event.h"
 #include "fd.h"
@@ -43,9 +45,12 @@
 #include "dir.h"
 #include "macro.h"
 #include "mem.h"
+#include "metrics.h"
 #include "nl.h"
 #include "proc.h"
+#include "sock.h"
 #include "list.h"
+#include "hashmap.h"
 
 #ifndef UEVENT_SEND
 #define UEVENT_SEND 16
@@ -53,10 +58,50 @@
 
 static nl_sock_t *uevent_netlink_sock = NULL;
 static event_io_t *uevent_io_event = NULL;
+static bool uevent_replay_active = false; // events are only passed in by uevent_replay()
+
+// number of released events kept for reuse, enough to absorb coldboot bursts
+#define UEVENT_POOL_CACHED 16
+static mem_pool_t *uevent_event_pool = NULL;
+
+// number of uevents received with a single syscall, at most NL_UEVENT_RECV_BATCH_MAX
+#define UEVENT_RECV_BATCH 8
+
+/*
+ * Registered uevs of one type. Uevs restricted to a subsystem are indexed by it, so
+ * that an event only visits the uevs interested in its subsystem.
+ */
+typedef struct uevent_uev_registry {
+	list_t *any;	       // uevs without subsystem filter
+	list_t *any_devnum;    // uevs without subsystem filter for events with MAJOR/MINOR
+	hashmap_t *subsystems; // subsystem -> list_t of uevs for that subsystem
+	size_t count;
+} uevent_uev_registry_t;
 
 // registerd uev events
-static list_t *uevent_uev_kernel_list = NULL;
-static list_t *uevent_uev_udev_list = NULL;
+static uevent_uev_registry_t uevent_uev_kernel = { NULL, NULL, NULL, 0 };
+static uevent_uev_registry_t uevent_uev_udev = { NULL, NULL, NULL, 0 };
+
+// registration order of uevs, which is kept when dispatching an event
+static unsigned long uevent_uev_seq = 0;
+
+// kernel and udev uevents received, and receive buffer overruns
+static metrics_t *uevent_metrics_kernel = NULL;
+static metrics_t *uevent_metrics_udev = NULL;
+static metrics_t *uevent_metrics_overruns = NULL;
+
+/*
+ * Devices in sysfs which have a device number, hashed by their DEVPATH. The index is
+ * built by the first coldboot trigger and kept current by the received kernel uevents,
+ * later coldboot triggers use it instead of walking all of /sys/devices.
+ */
+typedef struct uevent_sysfs_dev {
+	char *devpath; // relative to /sys, key in the index
+	int major;
+	int minor;
+} uevent_sysfs_dev_t;
+
+static hashmap_t *uevent_sysfs_dev_index = NULL;
 
 #define UDEV_MONITOR_TAG "libudev"
 #define UDEV_MONITOR_MAGIC 0xfeedcafe
@@ -64,6 +109,10 @@ static list_t *uevent_uev_udev_list = NULL;
 struct uevent_uev {
 	uevent_uev_type_t type;
 	unsigned actions;
+	char *subsystem; // NULL matches all subsystems
+	char *devtype;	 // NULL matches all devtypes
+	unsigned flags;	 // UEVENT_UEV_FILTER_* flags
+	unsigned long seq;
 	void (*func)(unsigned actions, uevent_event_t *event, void *data);
 	void *data;
 };
@@ -115,12 +164,41 @@ struct uevent_event {
 	unsigned long long seqnum; //!< The seuqunze number of the uevent
 };
 
+/*
+ * Events are taken from a pool to avoid a large allocation per uevent. Only the
+ * parsed fields and the start of the raw buffer are cleared, the buffer itself
+ * is valid up to msg_len, which has to be terminated by its producer.
+ */
+static uevent_event_t *
+uevent_event_alloc(void)
+{
+	if (!uevent_event_pool)
+		uevent_event_pool = mem_pool_new(sizeof(uevent_event_t), UEVENT_POOL_CACHED);
+
+	uevent_event_t *event = mem_pool_alloc(uevent_event_pool);
+	memset(&event->msg.nlh, 0, sizeof(event->msg.nlh));
+	memset(&event->msg_len, 0, sizeof(uevent_event_t) - offsetof(uevent_event_t, msg_len));
+
+	return event;
+}
+
+void
+uevent_event_free(uevent_event_t *event)
+{
+	IF_NULL_RETURN(event);
+
+	if (uevent_event_pool)
+		mem_pool_release(uevent_event_pool, event);
+	else
+		mem_free0(event);
+}
+
 static void
 uevent_trace(uevent_event_t *uevent, char *raw_p)
 {
 	int i = 0;
 	char *_raw_p = raw_p;
-	while (*_raw_p || _raw_p < uevent->msg.raw + uevent->msg_len) {
+	while (_raw_p < uevent->msg.raw + uevent->msg_len) {
 		TRACE("uevent_raw[%d] '%s'", i++, _raw_p);
 		/* advance to after the next \0 */
 		while (*_raw_p++)
@@ -233,15 +311,20 @@ uevent_parse_from_string_new(const char *uev)
 {
 	IF_NULL_RETVAL_ERROR(uev, NULL);
 
-	int len = strlen(uev);
+	size_t len = strlen(uev);
+	if (len >= UEVENT_BUF_LEN) {
+		WARN("uevent string too long (%zu bytes), truncating", len);
+		len = UEVENT_BUF_LEN - 1;
+	}
 
-	uevent_event_t *event = mem_new0(uevent_event_t, 1);
+	uevent_event_t *event = uevent_event_alloc();
 
 	memcpy(event->msg.raw, uev, len);
+	event->msg.raw[len] = '\0';
 	event->msg_len = len;
 
 	// replace newlines by null bytes
-	for (int i = 0; i < len; i++) {
+	for (size_t i = 0; i < len; i++) {
 		if ('\n' == event->msg.raw[i]) {
 			event->msg.raw[i] = '\0';
 		}
@@ -292,7 +375,7 @@ uevent_replace_member(const uevent_event_t *uevent, char *oldmember, char *newme
 	ASSERT(uevent);
 	ASSERT(oldmember > uevent->msg.raw && oldmember < uevent->msg.raw + uevent->msg_len);
 
-	uevent_event_t *newevent = mem_new(uevent_event_t, 1);
+	uevent_event_t *newevent = uevent_event_alloc();
 	//interface name is located in name and devpath members
 	int diff_len = strlen(newmember) - strlen(oldmember);
 
@@ -340,8 +423,7 @@ uevent_replace_member(const uevent_event_t *uevent, char *oldmember, char *newme
 	return newevent;
 
 error:
-	if (newevent)
-		mem_free0(newevent);
+	uevent_event_free(newevent);
 
 	return NULL;
 }
@@ -440,16 +522,87 @@ uevent_event_replace_synth_uuid_new(const uevent_event_t *event, char *uuid_stri
 uevent_event_t *
 uevent_event_copy_new(const uevent_event_t *event)
 {
-	uevent_event_t *event_clone = mem_new0(uevent_event_t, 1);
-	memcpy(event_clone, event, sizeof(uevent_event_t));
+	uevent_event_t *event_clone = uevent_event_alloc();
+
+	// only copy the used part of the raw buffer
+	memcpy(event_clone->msg.raw, event->msg.raw, event->msg_len);
+	event_clone->msg.raw[MIN(event->msg_len, (size_t)UEVENT_BUF_LEN - 1)] = '\0';
+	memcpy(&event_clone->msg_len, &event->msg_len,
+	       sizeof(uevent_event_t) - offsetof(uevent_event_t, msg_len));
 
 	// update internal pointers to cloned raw buffer
-	if (uevent_parse_nl(event_clone) == -1)
-		mem_free0(event_clone);
+	if (uevent_parse_nl(event_clone) == -1) {
+		uevent_event_free(event_clone);
+		return NULL;
+	}
 
 	return event_clone;
 }
 
+/*
+ * Joins the netns (and userns) of netns_pid, to be called in a forked child only.
+ */
+static void
+uevent_join_netns(pid_t netns_pid, bool join_userns)
+{
+	if (join_userns) {
+		char *usrns = mem_printf("/proc/%d/ns/user", netns_pid);
+		int usrns_fd = open(usrns, O_RDONLY);
+		if (usrns_fd == -1)
+			FATAL_ERRNO("Could not open userns file %s!", usrns);
+		mem_free0(usrns);
+		if (setns(usrns_fd, CLONE_NEWUSER) == -1)
+			FATAL_ERRNO("Could not join uesr namespace of pid %d!", netns_pid);
+		if (setuid(0) < 0)
+			FATAL_ERRNO("Could setuid to root in user namespace of pid %d!", netns_pid);
+		if (setgid(0) < 0)
+			FATAL_ERRNO("Could setgid to root in user namespace of pid %d!", netns_pid);
+		if (setgroups(0, NULL) < 0)
+			FATAL_ERRNO("Could setgroups to root in user namespace of pid %d!",
+				    netns_pid);
+	}
+	char *netns = mem_printf("/proc/%d/ns/net", netns_pid);
+	int netns_fd = open(netns, O_RDONLY);
+	if (netns_fd == -1)
+		FATAL_ERRNO("Could not open netns file %s!", netns);
+	mem_free0(netns);
+	if (setns(netns_fd, CLONE_NEWNET) == -1)
+		FATAL_ERRNO("Could not join network namespace of pid %d!", netns_pid);
+}
+
+static int
+uevent_send_nl(nl_sock_t *target, const uevent_event_t *event)
+{
+	int ret = -1;
+	nl_msg_t *nl_msg = nl_msg_new();
+	IF_NULL_RETVAL_ERROR_ERRNO(nl_msg, -1);
+
+	if (nl_msg_set_type(nl_msg, UEVENT_SEND) < 0) {
+		ERROR("Could not set type UEVENT_SEND of nl_msg!");
+		goto out;
+	}
+	if (nl_msg_set_flags(nl_msg, NLM_F_ACK | NLM_F_REQUEST)) {
+		ERROR("Could not set flages for acked request of nl_msg!");
+		goto out;
+	}
+	if (nl_msg_set_buf_unaligned(nl_msg, (char *)event->msg.raw, event->msg_len) < 0) {
+		ERROR_ERRNO("Could not add uevent to nl_msg!");
+		goto out;
+	}
+	if (nl_msg_send_kernel(target, nl_msg) < 0) {
+		ERROR_ERRNO("Could not inject uevent!");
+		goto out;
+	}
+	if (nl_msg_receive_and_check_kernel(target)) {
+		ERROR_ERRNO("Could not verify resp to injected uevent!");
+		goto out;
+	}
+	ret = 0;
+out:
+	nl_msg_free(nl_msg);
+	return ret;
+}
+
 /**
  * This function forks a new child in the target netns (and userns) of netns_pid
  * in which the uevents should be injected. In the child the UEVENT netlink socket
@@ -460,8 +613,6 @@ int
 uevent_event_inject_into_netns(uevent_event_t *event, pid_t netns_pid, bool join_userns)
 {
 	int status;
-	char *uevent = event->msg.raw;
-	size_t size = event->msg_len;
 
 	pid_t pid = fork();
 
@@ -469,49 +620,13 @@ uevent_event_inject_into_netns(uevent_event_t *event, pid_t netns_pid, bool join
 		ERROR_ERRNO("Could not fork for switching to netns of %d", netns_pid);
 		return -1;
 	} else if (pid == 0) {
-		if (join_userns) {
-			char *usrns = mem_printf("/proc/%d/ns/user", netns_pid);
-			int usrns_fd = open(usrns, O_RDONLY);
-			if (usrns_fd == -1)
-				FATAL_ERRNO("Could not open userns file %s!", usrns);
-			mem_free0(usrns);
-			if (setns(usrns_fd, CLONE_NEWUSER) == -1)
-				FATAL_ERRNO("Could not join uesr namespace of pid %d!", netns_pid);
-			if (setuid(0) < 0)
-				FATAL_ERRNO("Could setuid to root in user namespace of pid %d!",
-					    netns_pid);
-			if (setgid(0) < 0)
-				FATAL_ERRNO("Could setgid to root in user namespace of pid %d!",
-					    netns_pid);
-			if (setgroups(0, NULL) < 0)
-				FATAL_ERRNO("Could setgroups to root in user namespace of pid %d!",
-					    netns_pid);
-		}
-		char *netns = mem_printf("/proc/%d/ns/net", netns_pid);
-		int netns_fd = open(netns, O_RDONLY);
-		if (netns_fd == -1)
-			FATAL_ERRNO("Could not open netns file %s!", netns);
-		mem_free0(netns);
-		if (setns(netns_fd, CLONE_NEWNET) == -1)
-			FATAL_ERRNO("Could not join network namespace of pid %d!", netns_pid);
+		uevent_join_netns(netns_pid, join_userns);
 		nl_sock_t *target = nl_sock_uevent_new(0);
 		if (NULL == target)
 			FATAL("Could not connect to nl socket!");
-		nl_msg_t *nl_msg = nl_msg_new();
-		if (NULL == nl_msg)
-			FATAL_ERRNO("Could not allocate nl_msg!");
-		if (nl_msg_set_type(nl_msg, UEVENT_SEND) < 0)
-			FATAL("Could not set type UEVENT_SEND of nl_msg!");
-		if (nl_msg_set_flags(nl_msg, NLM_F_ACK | NLM_F_REQUEST))
-			FATAL("Could not set flages for acked request of nl_msg!");
-		if (nl_msg_set_buf_unaligned(nl_msg, uevent, size) < 0)
-			FATAL_ERRNO("Could not add uevent to nl_msg!");
-		if (nl_msg_send_kernel(target, nl_msg) < 0)
-			FATAL_ERRNO("Could not inject uevent!");
-		if (nl_msg_receive_and_check_kernel(target))
-			FATAL_ERRNO("Could not verify resp to injected uevent!");
+		if (uevent_send_nl(target, event))
+			FATAL("Could not inject uevent into netns of pid %d!", netns_pid);
 		nl_sock_free(target);
-		nl_msg_free(nl_msg);
 		_exit(0);
 	} else {
 		if (proc_waitpid(pid, &status, 0) != pid) {
@@ -525,6 +640,86 @@ uevent_event_inject_into_netns(uevent_event_t *event, pid_t netns_pid, bool join
 	return -1;
 }
 
+struct uevent_injector {
+	pid_t netns_pid;
+	nl_sock_t *sock; // uevent socket bound to the netns of netns_pid
+};
+
+uevent_injector_t *
+uevent_injector_new(pid_t netns_pid, bool join_userns)
+{
+	int sv[2];
+	int status;
+	int fd = -1;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) {
+		ERROR_ERRNO("Could not create socketpair for uevent injector");
+		return NULL;
+	}
+
+	pid_t pid = fork();
+
+	if (pid == -1) {
+		ERROR_ERRNO("Could not fork for switching to netns of %d", netns_pid);
+		close(sv[0]);
+		close(sv[1]);
+		return NULL;
+	} else if (pid == 0) {
+		close(sv[0]);
+		uevent_join_netns(netns_pid, join_userns);
+		nl_sock_t *target = nl_sock_uevent_send_new();
+		if (NULL == target)
+			FATAL("Could not connect to nl socket!");
+		if (sock_unix_send_fd(sv[1], nl_sock_get_fd(target)))
+			FATAL("Could not pass nl socket of netns of pid %d!", netns_pid);
+		_exit(0);
+	}
+
+	close(sv[1]);
+	fd = sock_unix_recv_fd(sv[0]);
+	close(sv[0]);
+
+	if (proc_waitpid(pid, &status, 0) != pid)
+		WARN_ERRNO("Could not waitpid for '%d'", pid);
+
+	IF_TRUE_RETVAL_ERROR(fd < 0, NULL);
+
+	nl_sock_t *sock = nl_sock_new_from_fd(fd);
+	IF_NULL_RETVAL_ERROR(sock, NULL);
+
+	uevent_injector_t *injector = mem_new0(uevent_injector_t, 1);
+	injector->netns_pid = netns_pid;
+	injector->sock = sock;
+
+	DEBUG("Created uevent injector for netns of pid %d", netns_pid);
+	return injector;
+}
+
+void
+uevent_injector_free(uevent_injector_t *injector)
+{
+	IF_NULL_RETURN(injector);
+
+	nl_sock_free(injector->sock);
+	mem_free0(injector);
+}
+
+pid_t
+uevent_injector_get_netns_pid(const uevent_injector_t *injector)
+{
+	ASSERT(injector);
+	return injector->netns_pid;
+}
+
+int
+uevent_injector_inject(uevent_injector_t *injector, uevent_event_t *event)
+{
+	ASSERT(injector);
+	ASSERT(event);
+
+	return uevent_send_nl(injector->sock, event);
+}
+
 static unsigned
 uevent_action_from_string(const char *action)
 {
@@ -545,47 +740,236 @@ uevent_action_from_string(const char *action)
 }
 
 static void
-handle_uev_list(uevent_event_t *uevent, list_t *event_list)
+uevent_sysfs_dev_free(uevent_sysfs_dev_t *dev)
+{
+	mem_free0(dev->devpath);
+	mem_free0(dev);
+}
+
+static void
+uevent_sysfs_dev_free_cb(UNUSED const void *key, void *value, UNUSED void *data)
+{
+	uevent_sysfs_dev_free(value);
+}
+
+/*
+ * Drops the index if it may have missed events, it is rebuilt by the next coldboot.
+ */
+static void
+uevent_sysfs_dev_index_drop(void)
+{
+	IF_NULL_RETURN(uevent_sysfs_dev_index);
+
+	TRACE("Dropping sysfs device index");
+	hashmap_foreach(uevent_sysfs_dev_index, &uevent_sysfs_dev_free_cb, NULL);
+	hashmap_free(uevent_sysfs_dev_index);
+	uevent_sysfs_dev_index = NULL;
+}
+
+static void
+uevent_sysfs_dev_index_put(hashmap_t *index, const char *devpath, int major, int minor)
+{
+	uevent_sysfs_dev_t *dev = hashmap_get(index, devpath);
+
+	if (!dev) {
+		dev = mem_new0(uevent_sysfs_dev_t, 1);
+		dev->devpath = mem_strdup(devpath);
+		hashmap_put(index, dev->devpath, dev);
+	}
+	dev->major = major;
+	dev->minor = minor;
+}
+
+static void
+uevent_sysfs_dev_index_remove(hashmap_t *index, const char *devpath)
+{
+	uevent_sysfs_dev_t *dev = hashmap_remove(index, devpath);
+	if (dev)
+		uevent_sysfs_dev_free(dev);
+}
+
+static void
+uevent_sysfs_dev_index_update(const uevent_event_t *uevent, unsigned action)
+{
+	IF_NULL_RETURN(uevent_sysfs_dev_index);
+	IF_FALSE_RETURN(uevent->devpath[0]);
+
+	if (action & UEVENT_ACTION_REMOVE) {
+		uevent_sysfs_dev_index_remove(uevent_sysfs_dev_index, uevent->devpath);
+	} else if (action & UEVENT_ACTION_MOVE) {
+		// the old DEVPATH is not tracked, rebuild the index on the next coldboot
+		uevent_sysfs_dev_index_drop();
+	} else if (uevent->major >= 0 && uevent->minor >= 0) {
+		uevent_sysfs_dev_index_put(uevent_sysfs_dev_index, uevent->devpath, uevent->major,
+					   uevent->minor);
+	}
+}
+
+static list_t *
+uevent_uev_next(list_t **lists, size_t n)
+{
+	list_t **min = NULL;
+
+	for (size_t i = 0; i < n; i++) {
+		if (lists[i] && (!min || ((uevent_uev_t *)lists[i]->data)->seq <
+						 ((uevent_uev_t *)(*min)->data)->seq))
+			min = &lists[i];
+	}
+	IF_NULL_RETVAL(min, NULL);
+
+	list_t *l = *min;
+	*min = l->next;
+	return l;
+}
+
+static void
+handle_uev_list(uevent_event_t *uevent, const uevent_uev_registry_t *reg)
 {
 	TRACE("handle_udev_event");
 
+	unsigned action = uevent_action_from_string(uevent->action);
+	bool has_devnum = uevent->major >= 0 && uevent->minor >= 0;
+	IF_FALSE_RETURN_TRACE(action);
+
+	// only the uevs which may be interested in this event, merged in registration order
+	list_t *lists[] = {
+		reg->any,
+		has_devnum ? reg->any_devnum : NULL,
+		reg->subsystems ? hashmap_get(reg->subsystems, uevent->subsystem) : NULL,
+	};
+
 	/* handle registerd uev udev events */
-	for (list_t *l = event_list; l; l = l->next) {
+	for (list_t *l; (l = uevent_uev_next(lists, ELEMENTSOF(lists)));) {
 		uevent_uev_t *uev = l->data;
-		unsigned action = uevent_action_from_string(uevent->action);
-		if (action & uev->actions)
-			uev->func(action, uevent, uev->data);
+		if (!(action & uev->actions))
+			continue;
+		if (uev->devtype && strcmp(uev->devtype, uevent->devtype))
+			continue;
+		if ((uev->flags & UEVENT_UEV_FILTER_DEVNUM) && !has_devnum)
+			continue;
+		uev->func(action, uevent, uev->data);
 	}
 	TRACE("Handled uevent seqnum=%llu.", uevent->seqnum);
 }
 
 static void
-uevent_handle(UNUSED int fd, UNUSED unsigned events, UNUSED event_io_t *io, UNUSED void *data)
+uevent_handle_one(uevent_event_t *uev, int len)
 {
-	uevent_event_t *uev = mem_new0(uevent_event_t, 1);
-
-	// read uevent into raw buffer and assure that last char is '\0'
-	if ((uev->msg_len = nl_msg_receive_kernel(uevent_netlink_sock, uev->msg.raw,
-						  sizeof(uev->msg.raw) - 1, true)) <= 0) {
-		WARN("could not read uevent");
-		goto err;
+	if (len <= 0) {
+		WARN_RATELIMIT("could not read uevent");
+		return;
 	}
 
-	IF_TRUE_GOTO_TRACE(uevent_parse_nl(uev) == -1, err);
+	// assure that last char is '\0'
+	uev->msg_len = len;
+	uev->msg.raw[len] = '\0';
+
+	IF_TRUE_RETURN_TRACE(uevent_parse_nl(uev) == -1);
 
 	char *raw_p = uev->msg.raw;
 
 	if (uevent_event_is_udev(uev)) {
 		/* udev message */
 		TRACE("udev uevent: %s", raw_p ? raw_p : "NULL");
-		handle_uev_list(uev, uevent_uev_udev_list);
+		metrics_counter_inc(uevent_metrics_udev);
+		handle_uev_list(uev, &uevent_uev_udev);
 	} else if (strchr(raw_p, '@')) {
 		/* kernel message */
 		TRACE("kernel uevent: %s", raw_p ? raw_p : "NULL");
-		handle_uev_list(uev, uevent_uev_kernel_list);
+		metrics_counter_inc(uevent_metrics_kernel);
+		uevent_sysfs_dev_index_update(uev, uevent_action_from_string(uev->action));
+		handle_uev_list(uev, &uevent_uev_kernel);
 	}
-err:
-	mem_free0(uev);
+}
+
+/*
+ * Drains up to UEVENT_RECV_BATCH pending uevents with a single syscall. If more are
+ * pending, the level triggered io event fires again right away.
+ */
+static void
+uevent_handle(UNUSED int fd, UNUSED unsigned events, UNUSED event_io_t *io, UNUSED void *data)
+{
+	uevent_event_t *uevs[UEVENT_RECV_BATCH];
+	char *bufs[UEVENT_RECV_BATCH];
+	int lens[UEVENT_RECV_BATCH];
+
+	for (int i = 0; i < UEVENT_RECV_BATCH; i++) {
+		uevs[i] = uevent_event_alloc();
+		bufs[i] = uevs[i]->msg.raw;
+	}
+
+	int n = nl_msg_receive_uevents(uevent_netlink_sock, bufs, sizeof(uevs[0]->msg.raw) - 1,
+				       lens, UEVENT_RECV_BATCH);
+	if (n < 0 && errno != EAGAIN)
+		WARN_ERRNO_RATELIMIT("could not read uevents");
+	// uevents were lost due to an overrun of the receive buffer
+	if (n < 0 && errno == ENOBUFS) {
+		metrics_counter_inc(uevent_metrics_overruns);
+		uevent_sysfs_dev_index_drop();
+	}
+
+	for (int i = 0; i < n; i++)
+		uevent_handle_one(uevs[i], lens[i]);
+
+	// release in reverse order, so that the next batch gets the same buffers
+	for (int i = UEVENT_RECV_BATCH - 1; i >= 0; i--)
+		uevent_event_free(uevs[i]);
+}
+
+void
+uevent_replay_enable(void)
+{
+	if (uevent_uev_udev.count || uevent_uev_kernel.count)
+		WARN("Enabling uevent replay with registered uevs");
+	uevent_replay_active = true;
+}
+
+int
+uevent_replay(const char *msg, size_t len)
+{
+	IF_TRUE_RETVAL_ERROR(len >= UEVENT_BUF_LEN, -1);
+
+	uevent_event_t *uev = uevent_event_alloc();
+	memcpy(uev->msg.raw, msg, len);
+	uevent_handle_one(uev, len);
+	uevent_event_free(uev);
+	return 0;
+}
+
+/*
+ * Classic BPF socket filter, which drops udev messages in the kernel unless a udev
+ * handler is registered. Messages of udev start with the "libudev" prefix of
+ * struct udev_monitor_netlink_header, followed by the magic in network order.
+ * Kernel messages start with "<action>@<devpath>" and are always accepted.
+ */
+static int
+uevent_attach_filter(void)
+{
+	IF_NULL_RETVAL_TRACE(uevent_netlink_sock, 0);
+
+	uint32_t udev_ret = uevent_uev_udev.count ? 0xffffffff : 0;
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x6c696275 /* "libu" */, 0, 6),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 4),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x64657600 /* "dev\0" */, 0, 4),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+			 offsetof(struct udev_monitor_netlink_header, magic)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, UDEV_MONITOR_MAGIC, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, udev_ret),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+	};
+	struct sock_fprog prog = { .len = ELEMENTSOF(filter), .filter = filter };
+
+	if (setsockopt(nl_sock_get_fd(uevent_netlink_sock), SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+		       sizeof(prog)) < 0) {
+		WARN_ERRNO("Could not attach socket filter to uevent socket");
+		return -1;
+	}
+
+	TRACE("Attached uevent socket filter, udev messages %s", udev_ret ? "accepted" : "dropped");
+	return 0;
 }
 
 static int
@@ -618,6 +1002,20 @@ uevent_init()
 		return -1;
 	}
 
+	// not fatal, without the filter udev messages are dropped in userspace
+	uevent_attach_filter();
+
+	// the counters are kept over a deinit once the last uev is removed
+	if (!uevent_metrics_kernel) {
+		uevent_metrics_kernel = metrics_counter_new(
+			"cml_uevents_total", "source=\"kernel\"", "Uevents received");
+		uevent_metrics_udev =
+			metrics_counter_new("cml_uevents_total", "source=\"udev\"", NULL);
+		uevent_metrics_overruns =
+			metrics_counter_new("cml_uevent_overruns_total", NULL,
+					    "Overruns of the uevent receive buffer");
+	}
+
 	uevent_io_event = event_io_new(nl_sock_get_fd(uevent_netlink_sock), EVENT_IO_READ,
 				       &uevent_handle, NULL);
 	event_add_io(uevent_io_event);
@@ -631,15 +1029,22 @@ uevent_deinit()
 	if (uevent_io_event) {
 		event_remove_io(uevent_io_event);
 		event_io_free(uevent_io_event);
+		uevent_io_event = NULL;
 	}
 	if (uevent_netlink_sock) {
 		nl_sock_free(uevent_netlink_sock);
+		uevent_netlink_sock = NULL;
 	}
+
+	// without the uevent stream, the index cannot be kept current
+	uevent_sysfs_dev_index_drop();
 }
 
 uevent_uev_t *
-uevent_uev_new(uevent_uev_type_t type, unsigned actions,
-	       void (*func)(unsigned actions, uevent_event_t *event, void *data), void *data)
+uevent_uev_new_filtered(uevent_uev_type_t type, unsigned actions, const char *subsystem,
+			const char *devtype, unsigned flags,
+			void (*func)(unsigned actions, uevent_event_t *event, void *data),
+			void *data)
 {
 	uevent_uev_t *uev;
 
@@ -649,41 +1054,106 @@ uevent_uev_new(uevent_uev_type_t type, unsigned actions,
 	uev = mem_new0(uevent_uev_t, 1);
 	uev->type = type;
 	uev->actions = actions;
+	uev->subsystem = subsystem ? mem_strdup(subsystem) : NULL;
+	uev->devtype = devtype ? mem_strdup(devtype) : NULL;
+	uev->flags = flags;
 	uev->func = func;
 	uev->data = data;
 
 	return uev;
 }
 
+uevent_uev_t *
+uevent_uev_new(uevent_uev_type_t type, unsigned actions,
+	       void (*func)(unsigned actions, uevent_event_t *event, void *data), void *data)
+{
+	return uevent_uev_new_filtered(type, actions, NULL, NULL, 0, func, data);
+}
+
 void
 uevent_uev_free(uevent_uev_t *uev)
 {
+	IF_NULL_RETURN(uev);
+
+	mem_free0(uev->subsystem);
+	mem_free0(uev->devtype);
 	mem_free0(uev);
 }
 
+static uevent_uev_registry_t *
+uevent_uev_get_registry(const uevent_uev_t *uev)
+{
+	if (uev->type == UEVENT_UEV_TYPE_KERNEL)
+		return &uevent_uev_kernel;
+	if (uev->type == UEVENT_UEV_TYPE_UDEV)
+		return &uevent_uev_udev;
+
+	ERROR("Unknown type %d for uev", uev->type);
+	return NULL;
+}
+
+/*
+ * Returns the list of reg uev belongs to. Lists of a subsystem are keyed by the
+ * subsystem of their first uev, which therefore has to be updated on changes.
+ */
+static list_t *
+uevent_uev_registry_get_list(uevent_uev_registry_t *reg, const uevent_uev_t *uev)
+{
+	if (!uev->subsystem)
+		return (uev->flags & UEVENT_UEV_FILTER_DEVNUM) ? reg->any_devnum : reg->any;
+
+	return reg->subsystems ? hashmap_get(reg->subsystems, uev->subsystem) : NULL;
+}
+
+static void
+uevent_uev_registry_set_list(uevent_uev_registry_t *reg, const uevent_uev_t *uev, list_t *list)
+{
+	if (!uev->subsystem) {
+		if (uev->flags & UEVENT_UEV_FILTER_DEVNUM)
+			reg->any_devnum = list;
+		else
+			reg->any = list;
+		return;
+	}
+
+	if (!reg->subsystems)
+		reg->subsystems = hashmap_new_str();
+
+	// the key may point into a removed uev, replace it by the one of the list head
+	hashmap_remove(reg->subsystems, uev->subsystem);
+	if (list)
+		hashmap_put(reg->subsystems, ((uevent_uev_t *)list->data)->subsystem, list);
+
+	if (0 == hashmap_size(reg->subsystems)) {
+		hashmap_free(reg->subsystems);
+		reg->subsystems = NULL;
+	}
+}
+
 int
 uevent_add_uev(uevent_uev_t *uev)
 {
 	IF_NULL_RETVAL(uev, -1);
 
-	if (uevent_io_event == NULL) {
+	uevent_uev_registry_t *reg = uevent_uev_get_registry(uev);
+	IF_NULL_RETVAL(reg, -1);
+
+	if (uevent_io_event == NULL && !uevent_replay_active) {
 		if (uevent_init()) {
 			ERROR("Low-level uevent handling not available!");
 			return -1;
 		}
 	}
 
-	if (uev->type == UEVENT_UEV_TYPE_KERNEL) {
-		uevent_uev_kernel_list = list_append(uevent_uev_kernel_list, uev);
-	} else if (uev->type == UEVENT_UEV_TYPE_UDEV) {
-		uevent_uev_udev_list = list_append(uevent_uev_udev_list, uev);
-	} else {
-		ERROR("Unknown type %d for uev", uev->type);
-		return -1;
-	}
+	uev->seq = uevent_uev_seq++;
+	uevent_uev_registry_set_list(reg, uev,
+				     list_append(uevent_uev_registry_get_list(reg, uev), uev));
+	if (0 == reg->count++ && reg == &uevent_uev_udev)
+		uevent_attach_filter();
 
-	TRACE("Added uev uevent %p (func=%p, data=%p, actions=0x%x)", (void *)uev,
-	      CAST_FUNCPTR_VOIDPTR uev->func, uev->data, uev->actions);
+	TRACE("Added uev uevent %p (func=%p, data=%p, actions=0x%x, subsystem=%s)", (void *)uev,
+	      CAST_FUNCPTR_VOIDPTR uev->func, uev->data, uev->actions,
+	      uev->subsystem ? uev->subsystem : "*");
 
 	return 0;
 }
@@ -694,21 +1164,23 @@ uevent_remove_uev(uevent_uev_t *uev)
 	IF_NULL_RETURN(uev);
 	TRACE("Removing uev uevent %p", (void *)uev);
 
-	if (uev->type == UEVENT_UEV_TYPE_KERNEL) {
-		uevent_uev_kernel_list = list_remove(uevent_uev_kernel_list, uev);
-	} else if (uev->type == UEVENT_UEV_TYPE_UDEV) {
-		uevent_uev_udev_list = list_remove(uevent_uev_udev_list, uev);
-	} else {
-		ERROR("Unknown type %d for uev", uev->type);
-		return;
-	}
+	uevent_uev_registry_t *reg = uevent_uev_get_registry(uev);
+	IF_NULL_RETURN(reg);
+
+	list_t *list = uevent_uev_registry_get_list(reg, uev);
+	IF_NULL_RETURN_TRACE(list_find(list, uev));
+
+	uevent_uev_registry_set_list(reg, uev, list_remove(list, uev));
+	reg->count--;
 
 	TRACE("Removed uev event %p (func=%p, data=%p, actions=0x%x)", (void *)uev,
 	      CAST_FUNCPTR_VOIDPTR uev->func, uev->data, uev->actions);
 
-	if (uevent_uev_udev_list == NULL && uevent_uev_kernel_list == NULL) {
+	if (uevent_uev_udev.count == 0 && uevent_uev_kernel.count == 0) {
 		TRACE("Last uevent handler removed, disconnect from low-level uevent handling");
 		uevent_deinit();
+	} else if (uevent_uev_udev.count == 0 && reg == &uevent_uev_udev) {
+		uevent_attach_filter();
 	}
 }
 
@@ -716,57 +1188,106 @@ struct uevent_udev_coldboot_data {
 	const uuid_t *synth_uuid;
 	bool (*filter)(int major, int minor, void *data);
 	void *data;
+	char *devpath;	  // of the directory which is walked, relative to /sys
+	hashmap_t *index; // filled with the found devices, if set
+	list_t *gone;	  // devices of the index which are gone from sysfs
 };
 
+static bool
+uevent_trigger_coldboot_filter(struct uevent_udev_coldboot_data *coldboot_data, int major,
+			       int minor)
+{
+	// only trigger for allowed devices
+	return !coldboot_data->filter || coldboot_data->filter(major, minor, coldboot_data->data);
+}
+
+static void
+uevent_trigger_coldboot_dev(struct uevent_udev_coldboot_data *coldboot_data, int dirfd,
+			    int major, int minor)
+{
+	char *trigger = mem_printf("add %s", uuid_string(coldboot_data->synth_uuid));
+	int fd = openat(dirfd, "uevent", O_WRONLY | O_CLOEXEC);
+	if (fd < 0 || fd_write(fd, trigger, strlen(trigger)) < 0) {
+		WARN("Could not trigger event for %d:%d <- %s", major, minor, trigger);
+	} else {
+		DEBUG("Trigger event for %d:%d <- %s", major, minor, trigger);
+	}
+	if (fd >= 0)
+		close(fd);
+	mem_free0(trigger);
+}
+
 static int
-uevent_trigger_coldboot_foreach_cb(const char *path, const char *name, void *data)
+uevent_trigger_coldboot_foreach_cb(int dirfd, const char *name, unsigned char type, void *data)
 {
 	int ret = 0;
-	char buf[256];
-	int major, minor;
+	char buf[256] = { 0 };
+	int major, minor, fd;
 
 	struct uevent_udev_coldboot_data *coldboot_data = data;
 	IF_NULL_RETVAL(coldboot_data, -1);
 
-	char *full_path = mem_printf("%s/%s", path, name);
-	char *dev_file = NULL;
+	type = dir_entry_type(dirfd, name, type);
+	if (type == DT_DIR) {
+		char *parent = coldboot_data->devpath;
+		coldboot_data->devpath = mem_printf("%s/%s", parent, name);
 
-	if (file_is_dir(full_path)) {
-		if (0 > dir_foreach(full_path, &uevent_trigger_coldboot_foreach_cb, data)) {
-			WARN("Could not trigger coldboot uevents! No '%s'!", full_path);
+		fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0 || 0 > dir_foreach_at(fd, &uevent_trigger_coldboot_foreach_cb, data)) {
+			WARN("Could not trigger coldboot uevents! No '%s'!", name);
 			ret--;
 		}
-	} else if (!strcmp(name, "uevent")) {
-		dev_file = mem_printf("%s/dev", path);
+		if (fd >= 0)
+			close(fd);
 
-		IF_FALSE_GOTO_TRACE(file_exists(dev_file), out);
+		mem_free0(coldboot_data->devpath);
+		coldboot_data->devpath = parent;
+	} else if (type == DT_REG && !strcmp(name, "uevent")) {
+		fd = openat(dirfd, "dev", O_RDONLY | O_CLOEXEC);
+		IF_TRUE_RETVAL_TRACE(fd < 0, 0);
 
 		major = minor = -1;
-		IF_TRUE_GOTO(-1 == file_read(dev_file, buf, sizeof(buf)), out);
-		IF_TRUE_GOTO((sscanf(buf, "%d:%d", &major, &minor) < 0), out);
-		IF_FALSE_GOTO((major > -1 && minor > -1), out);
-
-		// only trigger for allowed devices
-		if (coldboot_data->filter)
-			IF_FALSE_GOTO_TRACE(
-				coldboot_data->filter(major, minor, coldboot_data->data), out);
-
-		char *trigger = mem_printf("add %s", uuid_string(coldboot_data->synth_uuid));
-		if (-1 == file_printf(full_path, trigger)) {
-			WARN("Could not trigger event %s <- %s", full_path, trigger);
-			ret--;
-		} else {
-			DEBUG("Trigger event %s <- %s", full_path, trigger);
-		}
-		mem_free0(trigger);
+		int len = fd_read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		IF_TRUE_RETVAL(len < 0, 0);
+		IF_TRUE_RETVAL((sscanf(buf, "%d:%d", &major, &minor) < 0), 0);
+		IF_FALSE_RETVAL((major > -1 && minor > -1), 0);
+
+		if (coldboot_data->index)
+			uevent_sysfs_dev_index_put(coldboot_data->index, coldboot_data->devpath,
+						   major, minor);
+
+		// a failed trigger is logged, but does not abort the walk through sysfs
+		if (uevent_trigger_coldboot_filter(coldboot_data, major, minor))
+			uevent_trigger_coldboot_dev(coldboot_data, dirfd, major, minor);
 	}
-out:
-	mem_free0(full_path);
-	if (dev_file)
-		mem_free0(dev_file);
 	return ret;
 }
 
+static void
+uevent_trigger_coldboot_index_cb(UNUSED const void *key, void *value, void *data)
+{
+	uevent_sysfs_dev_t *dev = value;
+	struct uevent_udev_coldboot_data *coldboot_data = data;
+
+	if (!uevent_trigger_coldboot_filter(coldboot_data, dev->major, dev->minor))
+		return;
+
+	char *path = mem_printf("/sys%s", dev->devpath);
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	mem_free0(path);
+
+	if (fd < 0) {
+		TRACE_ERRNO("Indexed device %s (%d:%d) is gone", dev->devpath, dev->major,
+			    dev->minor);
+		coldboot_data->gone = list_append(coldboot_data->gone, dev->devpath);
+		return;
+	}
+
+	uevent_trigger_coldboot_dev(coldboot_data, fd, dev->major, dev->minor);
+	close(fd);
+}
+
 void
 uevent_udev_trigger_coldboot(const uuid_t *synth_uuid,
 			     bool (*filter)(int major, int minor, void *data), void *data)
@@ -774,9 +1295,48 @@ uevent_udev_trigger_coldboot(const uuid_t *synth_uuid,
 	const char *sysfs_devices = "/sys/devices";
 	struct uevent_udev_coldboot_data coldboot_data = { .synth_uuid = synth_uuid,
 							   .filter = filter,
-							   .data = data };
+							   .data = data,
+							   .devpath = NULL,
+							   .index = NULL,
+							   .gone = NULL };
+
+	if (uevent_sysfs_dev_index) {
+		TRACE("Triggering coldboot uevents of %zu indexed devices",
+		      hashmap_size(uevent_sysfs_dev_index));
+		hashmap_foreach(uevent_sysfs_dev_index, &uevent_trigger_coldboot_index_cb,
+				&coldboot_data);
+
+		// removing a device frees its devpath, which its list element points to
+		for (list_t *l = coldboot_data.gone; l; l = l->next)
+			uevent_sysfs_dev_index_remove(uevent_sysfs_dev_index, l->data);
+		list_delete(coldboot_data.gone);
+		return;
+	}
+
+	// build the index only if the uevent stream keeps it current afterwards
+	if (uevent_io_event)
+		coldboot_data.index = hashmap_new_str();
+
 	// for the first time iterate through sysfs to find device
-	if (0 > dir_foreach(sysfs_devices, &uevent_trigger_coldboot_foreach_cb, &coldboot_data)) {
+	coldboot_data.devpath = mem_strdup("/devices");
+	bool complete = true;
+	int fd = open(sysfs_devices, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 ||
+	    0 > dir_foreach_at(fd, &uevent_trigger_coldboot_foreach_cb, &coldboot_data)) {
 		WARN("Could not trigger coldboot uevents! No '%s'!", sysfs_devices);
+		complete = false;
+	}
+	if (fd >= 0)
+		close(fd);
+	mem_free0(coldboot_data.devpath);
+
+	if (coldboot_data.index && !complete) {
+		// an incomplete index would miss devices, walk sysfs again next time
+		hashmap_foreach(coldboot_data.index, &uevent_sysfs_dev_free_cb, NULL);
+		hashmap_free(coldboot_data.index);
+	} else if (coldboot_data.index) {
+		DEBUG("Indexed %zu sysfs devices for coldboot triggers",
+		      hashmap_size(coldboot_data.index));
+		uevent_sysfs_dev_index = coldboot_data.index;
 	}
 }
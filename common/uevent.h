@@ -79,6 +79,27 @@ uevent_udev_trigger_coldboot(const uuid_t *synth_uuid,
 uevent_uev_t *
 uevent_uev_new(uevent_uev_type_t type, unsigned actions,
 	       void (*func)(unsigned actions, uevent_event_t *event, void *data), void *data);
+
+/* only call the uev for events of devices with a MAJOR and MINOR number */
+#define UEVENT_UEV_FILTER_DEVNUM (1 << 0)
+
+/**
+ * Creates a new uev event which is only called for events of a given subsystem and
+ * devtype. Registered uevs are indexed by subsystem, so that an event does not visit
+ * the uevs of other subsystems at all.
+ *
+ * @param subsystem The SUBSYSTEM of matching events or NULL to match all.
+ * @param devtype The DEVTYPE of matching events or NULL to match all.
+ * @param flags Bitwise-or'd UEVENT_UEV_FILTER_* flags.
+ * @return The newly created uev event.
+ * @see uevent_uev_new() for the other parameters.
+ */
+uevent_uev_t *
+uevent_uev_new_filtered(uevent_uev_type_t type, unsigned actions, const char *subsystem,
+			const char *devtype, unsigned flags,
+			void (*func)(unsigned actions, uevent_event_t *event, void *data),
+			void *data);
+
 /**
  * Adds the uev event to the event loop.
  *
@@ -142,6 +163,15 @@ uevent_replace_member(const uevent_event_t *uevent, char *oldmember, char *newme
 uevent_event_t *
 uevent_event_copy_new(const uevent_event_t *event);
 
+/**
+ * Frees a uevent_event_t returned by one of the uevent_*_new() functions
+ * or by uevent_replace_member().
+ *
+ * @param event The event to be freed; may be NULL.
+ */
+void
+uevent_event_free(uevent_event_t *event);
+
 /**
  * This function forks a new child in the target netns (and userns) of netns_pid
  * in which the uevents should be injected. In the child the UEVENT netlink socket
@@ -151,6 +181,53 @@ uevent_event_copy_new(const uevent_event_t *event);
 int
 uevent_event_inject_into_netns(uevent_event_t *event, pid_t netns_pid, bool join_userns);
 
+typedef struct uevent_injector uevent_injector_t;
+
+/**
+ * Creates an injector for uevents into the netns of netns_pid. Once, a child joins the
+ * target netns (and userns) like uevent_event_inject_into_netns() and hands back a
+ * uevent netlink socket bound to that netns. Injecting an event with the injector does
+ * not fork, it costs a sendmsg and the receive of the ACK.
+ * The socket keeps the netns alive, thus the injector has to be freed with the
+ * process of netns_pid.
+ *
+ * @return The newly created injector or NULL on error.
+ */
+uevent_injector_t *
+uevent_injector_new(pid_t netns_pid, bool join_userns);
+
+void
+uevent_injector_free(uevent_injector_t *injector);
+
+pid_t
+uevent_injector_get_netns_pid(const uevent_injector_t *injector);
+
+/**
+ * Injects the uevent into the netns of the injector.
+ *
+ * @return 0 on success, -1 on error
+ */
+int
+uevent_injector_inject(uevent_injector_t *injector, uevent_event_t *event);
+
+/**
+ * Detaches the uevent handling from the netlink socket. Registered uevs are then only
+ * called for the events passed to uevent_replay(), e.g. to replay recorded uevents
+ * in-process. Has to be called before the first uev is added.
+ */
+void
+uevent_replay_enable(void);
+
+/**
+ * Handles a raw uevent in the format of the netlink socket, i.e. "<action>@<devpath>"
+ * followed by the NUL separated properties, as if it was received from the socket.
+ * @param msg The raw uevent.
+ * @param len The length of msg, less than UEVENT_BUF_LEN.
+ * @return 0 on success, -1 if the uevent is too long
+ */
+int
+uevent_replay(const char *msg, size_t len);
+
 /**
  * Parses string representation of a uevent and returns a pointer to a uevent_event_t.
  * Separation of fields via newlines as read from sysfs, for instance, is supported.
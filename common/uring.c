@@ -0,0 +1,227 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "uring.h"
+
+#include "mem.h"
+#include "macro.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+struct uring {
+	int fd;			 /**< the ring file descriptor */
+	void *ring_ptr;		 /**< mapping of the shared sq/cq rings */
+	size_t ring_size;	 /**< size of ring_ptr */
+	struct io_uring_sqe *sqes; /**< mapping of the sqe array */
+	size_t sqes_size;	 /**< size of sqes */
+
+	unsigned *sq_khead;
+	unsigned *sq_ktail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_tail; /**< local tail, published to sq_ktail on submit */
+
+	unsigned *cq_khead;
+	unsigned *cq_ktail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static void *
+uring_ptr(void *base, size_t off)
+{
+	return (char *)base + off;
+}
+
+uring_t *
+uring_new(unsigned entries)
+{
+	struct io_uring_params p;
+	unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+
+	memset(&p, 0, sizeof(p));
+
+	int fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0) {
+		DEBUG_ERRNO("io_uring_setup failed");
+		return NULL;
+	}
+	if ((p.features & needed) != needed) {
+		DEBUG("io_uring lacks required features (0x%x)", p.features);
+		close(fd);
+		return NULL;
+	}
+
+	uring_t *ring = mem_new0(uring_t, 1);
+	ring->fd = fd;
+
+	size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->ring_size = MAX(sq_size, cq_size);
+
+	ring->ring_ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->ring_ptr == MAP_FAILED) {
+		ERROR_ERRNO("Could not map io_uring rings");
+		goto err;
+	}
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ERROR_ERRNO("Could not map io_uring sqes");
+		munmap(ring->ring_ptr, ring->ring_size);
+		goto err;
+	}
+
+	ring->sq_khead = uring_ptr(ring->ring_ptr, p.sq_off.head);
+	ring->sq_ktail = uring_ptr(ring->ring_ptr, p.sq_off.tail);
+	ring->sq_mask = *(unsigned *)uring_ptr(ring->ring_ptr, p.sq_off.ring_mask);
+	ring->sq_entries = p.sq_entries;
+	ring->sq_tail = *ring->sq_ktail;
+
+	// sqes are always used in ring order, thus the index array is the identity
+	unsigned *array = uring_ptr(ring->ring_ptr, p.sq_off.array);
+	for (unsigned i = 0; i < p.sq_entries; i++)
+		array[i] = i;
+
+	ring->cq_khead = uring_ptr(ring->ring_ptr, p.cq_off.head);
+	ring->cq_ktail = uring_ptr(ring->ring_ptr, p.cq_off.tail);
+	ring->cq_mask = *(unsigned *)uring_ptr(ring->ring_ptr, p.cq_off.ring_mask);
+	ring->cqes = uring_ptr(ring->ring_ptr, p.cq_off.cqes);
+
+	DEBUG("Set up io_uring (fd=%d, sq_entries=%u, cq_entries=%u)", fd, p.sq_entries,
+	      p.cq_entries);
+
+	return ring;
+
+err:
+	close(fd);
+	mem_free0(ring);
+	return NULL;
+}
+
+void
+uring_free(uring_t *ring)
+{
+	IF_NULL_RETURN(ring);
+
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->ring_ptr, ring->ring_size);
+	close(ring->fd);
+	mem_free0(ring);
+}
+
+static int
+uring_enter(uring_t *ring, unsigned min_complete, unsigned flags, const void *arg, size_t argsz)
+{
+	// publish locally queued sqes to the kernel
+	__atomic_store_n(ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE);
+	unsigned to_submit = ring->sq_tail - __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE);
+
+	int ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, arg, argsz);
+
+	return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_sqe *
+uring_get_sqe(uring_t *ring)
+{
+	IF_NULL_RETVAL(ring, NULL);
+
+	if (ring->sq_tail - __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+		int ret = uring_enter(ring, 0, 0, NULL, 0);
+		if (ret < 0) {
+			errno = -ret;
+			WARN_ERRNO("Could not drain io_uring submission queue");
+			return NULL;
+		}
+		if (ring->sq_tail - __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE) >=
+		    ring->sq_entries) {
+			WARN("io_uring submission queue still full");
+			return NULL;
+		}
+	}
+
+	struct io_uring_sqe *sqe = &ring->sqes[ring->sq_tail & ring->sq_mask];
+	ring->sq_tail++;
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+int
+uring_submit(uring_t *ring)
+{
+	IF_NULL_RETVAL(ring, -EINVAL);
+
+	int ret = uring_enter(ring, 0, 0, NULL, 0);
+
+	return ret < 0 ? ret : 0;
+}
+
+int
+uring_submit_and_wait(uring_t *ring, int timeout)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+
+	IF_NULL_RETVAL(ring, -EINVAL);
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		arg.ts = (uintptr_t)&ts;
+	}
+
+	int ret = uring_enter(ring, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+			      sizeof(arg));
+
+	// completions may have been posted even if the wait itself failed
+	if (ret >= 0 || *ring->cq_khead != __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE))
+		return 0;
+
+	return ret;
+}
+
+bool
+uring_pop_cqe(uring_t *ring, struct io_uring_cqe *cqe)
+{
+	IF_NULL_RETVAL(ring, false);
+
+	unsigned head = *ring->cq_khead;
+	if (head == __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE))
+		return false;
+
+	*cqe = ring->cqes[head & ring->cq_mask];
+	__atomic_store_n(ring->cq_khead, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
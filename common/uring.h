@@ -0,0 +1,102 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/**
+ * @file uring.h
+ *
+ * Minimal io_uring wrapper on top of the raw system calls, used by the event
+ * loop as an alternative to epoll. Submission queue entries are only collected
+ * in user space and handed to the kernel together with the next wait, so that
+ * many requests cost a single io_uring_enter() call.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct uring uring_t;
+
+/**
+ * Sets up a new io_uring instance. Returns NULL if io_uring is not available
+ * or if the kernel lacks features needed by this wrapper (single mmap, no
+ * dropped completions and timeouts for waits via IORING_ENTER_EXT_ARG).
+ *
+ * @param entries The number of submission queue entries.
+ * @return The new ring or NULL on error.
+ */
+uring_t *
+uring_new(unsigned entries);
+
+/**
+ * Unmaps and closes the ring. Pending submissions which have not been
+ * handed to the kernel yet are dropped.
+ *
+ * @param ring The ring to be freed.
+ */
+void
+uring_free(uring_t *ring);
+
+/**
+ * Returns a zeroed submission queue entry. If the submission queue is full,
+ * the queued entries are submitted first.
+ *
+ * @param ring The ring to get the entry from.
+ * @return The entry or NULL if the queue could not be drained.
+ */
+struct io_uring_sqe *
+uring_get_sqe(uring_t *ring);
+
+/**
+ * Submits all queued entries without waiting for completions.
+ *
+ * @param ring The ring to submit to.
+ * @return 0 on success or a negative errno value on error.
+ */
+int
+uring_submit(uring_t *ring);
+
+/**
+ * Submits all queued entries and waits for at least one completion.
+ *
+ * @param ring The ring to submit to.
+ * @param timeout Timeout in milliseconds, -1 waits indefinitely.
+ * @return 0 if completions are available, -ETIME on timeout or another
+ *         negative errno value on error.
+ */
+int
+uring_submit_and_wait(uring_t *ring, int timeout);
+
+/**
+ * Takes the next completion from the completion queue.
+ *
+ * @param ring The ring to take the completion from.
+ * @param cqe Buffer for the completion entry.
+ * @return true if an entry was copied to cqe, false if the queue is empty.
+ */
+bool
+uring_pop_cqe(uring_t *ring, struct io_uring_cqe *cqe);
+
+#endif /* URING_H */
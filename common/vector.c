@@ -0,0 +1,125 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "vector.h"
+#include "macro.h"
+#include "mem.h"
+
+#include <string.h>
+
+#define VECTOR_MIN_SIZE 8
+
+struct vector {
+	char *data;
+	size_t elem_size;
+	size_t len;  /* number of stored elements */
+	size_t size; /* number of allocated elements */
+};
+
+vector_t *
+vector_new(size_t elem_size)
+{
+	ASSERT(elem_size > 0);
+
+	vector_t *vec = mem_new0(vector_t, 1);
+	vec->elem_size = elem_size;
+
+	return vec;
+}
+
+void
+vector_free(vector_t *vec)
+{
+	IF_NULL_RETURN(vec);
+
+	mem_free0(vec->data);
+	mem_free0(vec);
+}
+
+void *
+vector_append(vector_t *vec, const void *elem)
+{
+	ASSERT(vec);
+
+	if (vec->len == vec->size) {
+		size_t size = vec->size ? MUL_WITH_OVERFLOW_CHECK(vec->size, (size_t)2) :
+					  VECTOR_MIN_SIZE;
+		vec->data = mem_realloc(vec->data, MUL_WITH_OVERFLOW_CHECK(size, vec->elem_size));
+		vec->size = size;
+	}
+
+	void *slot = vec->data + vec->len * vec->elem_size;
+	if (elem)
+		memcpy(slot, elem, vec->elem_size);
+	else
+		memset(slot, 0, vec->elem_size);
+	vec->len++;
+
+	return slot;
+}
+
+void *
+vector_get(const vector_t *vec, size_t i)
+{
+	IF_NULL_RETVAL(vec, NULL);
+
+	if (i >= vec->len)
+		return NULL;
+
+	return vec->data + i * vec->elem_size;
+}
+
+void
+vector_remove(vector_t *vec, size_t i)
+{
+	IF_NULL_RETURN(vec);
+	IF_TRUE_RETURN(i >= vec->len);
+
+	char *slot = vec->data + i * vec->elem_size;
+	memmove(slot, slot + vec->elem_size, (vec->len - i - 1) * vec->elem_size);
+	vec->len--;
+}
+
+void
+vector_clear(vector_t *vec)
+{
+	IF_NULL_RETURN(vec);
+
+	vec->len = 0;
+}
+
+size_t
+vector_len(const vector_t *vec)
+{
+	IF_NULL_RETVAL(vec, 0);
+
+	return vec->len;
+}
+
+void *
+vector_data(const vector_t *vec)
+{
+	IF_NULL_RETVAL(vec, NULL);
+
+	return vec->data;
+}
@@ -0,0 +1,113 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/**
+ * @file vector.h
+ *
+ * Implements a growable array which stores its elements by value in one
+ * contiguous memory chunk. Pointers to elements returned by the API are
+ * only valid until the next call which adds elements to the vector, since
+ * this may move the underlying memory.
+ */
+
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <stddef.h>
+
+typedef struct vector vector_t;
+
+/**
+ * Creates a new, empty vector.
+ *
+ * @param elem_size The size of a single element in bytes.
+ * @return The newly created vector.
+ */
+vector_t *
+vector_new(size_t elem_size);
+
+/**
+ * Frees the vector including the memory of the stored elements.
+ *
+ * @param vec The vector to be freed.
+ */
+void
+vector_free(vector_t *vec);
+
+/**
+ * Copies the element to the end of the vector.
+ *
+ * @param vec The vector.
+ * @param elem Pointer to the element to be copied; if NULL, the new element is zeroed.
+ * @return Pointer to the new element inside the vector.
+ */
+void *
+vector_append(vector_t *vec, const void *elem);
+
+/**
+ * Returns the element with index i.
+ *
+ * @param vec The vector.
+ * @param i The index of the element, starting with 0.
+ * @return Pointer to the element or NULL if i is out of range.
+ */
+void *
+vector_get(const vector_t *vec, size_t i);
+
+/**
+ * Removes the element with index i. Following elements are moved up by one,
+ * so that the order of the elements is preserved.
+ *
+ * @param vec The vector.
+ * @param i The index of the element to be removed.
+ */
+void
+vector_remove(vector_t *vec, size_t i);
+
+/**
+ * Removes all elements but keeps the allocated memory for reuse.
+ *
+ * @param vec The vector.
+ */
+void
+vector_clear(vector_t *vec);
+
+/**
+ * Returns the number of elements contained in the vector.
+ *
+ * @param vec The vector.
+ * @return Number of elements contained in the vector.
+ */
+size_t
+vector_len(const vector_t *vec);
+
+/**
+ * Returns the underlying array of elements.
+ *
+ * @param vec The vector.
+ * @return Pointer to the first element or NULL if the vector has no memory allocated.
+ */
+void *
+vector_data(const vector_t *vec);
+
+#endif /* VECTOR_H */
@@ -0,0 +1,144 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "munit.h"
+
+#include "vector.h"
+#include "logf.h"
+#include "mem.h"
+#include "macro.h"
+
+struct elem_t {
+	int id;
+	char name[12];
+};
+
+static void *
+setup(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	// Before every test, register a logger so that the logging functionality can run.
+	logf_register(&logf_test_write, stderr);
+	return NULL;
+}
+
+static void
+tear_down(UNUSED void *fixture)
+{
+	// No clean-up needed for now
+}
+
+static MunitResult
+test_append_and_get(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	vector_t *vec = vector_new(sizeof(struct elem_t));
+
+	munit_assert_size(vector_len(vec), ==, 0);
+	munit_assert_null(vector_get(vec, 0));
+
+	// elements are copied and survive growing the vector
+	for (int i = 0; i < 1000; i++) {
+		struct elem_t e = { .id = i, .name = "elem" };
+		struct elem_t *slot = vector_append(vec, &e);
+		munit_assert_int(slot->id, ==, i);
+	}
+	munit_assert_size(vector_len(vec), ==, 1000);
+
+	struct elem_t *array = vector_data(vec);
+	for (int i = 0; i < 1000; i++) {
+		struct elem_t *e = vector_get(vec, i);
+		munit_assert_ptr_equal(e, &array[i]);
+		munit_assert_int(e->id, ==, i);
+		munit_assert_string_equal(e->name, "elem");
+	}
+	munit_assert_null(vector_get(vec, 1000));
+
+	// appending NULL adds a zeroed element
+	struct elem_t *zero = vector_append(vec, NULL);
+	munit_assert_int(zero->id, ==, 0);
+	munit_assert_char(zero->name[0], ==, '\0');
+
+	vector_free(vec);
+
+	return MUNIT_OK;
+}
+
+static MunitResult
+test_remove_preserves_order(UNUSED const MunitParameter params[], UNUSED void *data)
+{
+	vector_t *vec = vector_new(sizeof(int));
+
+	for (int i = 0; i < 10; i++)
+		vector_append(vec, &i);
+
+	// remove first, last and a middle element
+	vector_remove(vec, 0);
+	vector_remove(vec, 8);
+	vector_remove(vec, 4);
+	// out of range is ignored
+	vector_remove(vec, 7);
+
+	int expected[] = { 1, 2, 3, 4, 6, 7, 8 };
+	munit_assert_size(vector_len(vec), ==, 7);
+	for (size_t i = 0; i < 7; i++)
+		munit_assert_int(*(int *)vector_get(vec, i), ==, expected[i]);
+
+	// clear keeps the vector usable
+	vector_clear(vec);
+	munit_assert_size(vector_len(vec), ==, 0);
+	int v = 42;
+	vector_append(vec, &v);
+	munit_assert_int(*(int *)vector_get(vec, 0), ==, 42);
+
+	vector_free(vec);
+
+	return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+	{
+		"/append and get",	/* name */
+		test_append_and_get,	/* test */
+		setup,			/* setup */
+		tear_down,		/* tear_down */
+		MUNIT_TEST_OPTION_NONE, /* options */
+		NULL			/* parameters */
+	},
+	{
+		"/remove preserves order",   /* name */
+		test_remove_preserves_order, /* test */
+		setup,			     /* setup */
+		tear_down,		     /* tear_down */
+		MUNIT_TEST_OPTION_NONE,	     /* options */
+		NULL			     /* parameters */
+	},
+	// Mark the end of the array with an entry where the test function is NULL
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite vector_suite = {
+	"/vector",		/* name */
+	tests,			/* tests */
+	NULL,			/* suites */
+	1,			/* iterations */
+	MUNIT_SUITE_OPTION_NONE /* options */
+};
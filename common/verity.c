@@ -206,8 +206,7 @@ out:
 	mem_free0(uev_path);
 	if (buf)
 		mem_free0(buf);
-	if (uev)
-		mem_free0(uev);
+	uevent_event_free(uev);
 	if (targetpath)
 		mem_free0(targetpath);
 	if (linkpath)
@@ -321,11 +320,8 @@ verity_create_blk_dev(const char *name, const char *fs_img_name, const char *has
 	}
 	TRACE("Created loop device %s for %s", fs_dev, fs_img_name);
 
-	int fs_sector_size = dm_get_blkdev_sector_size(fs_fd);
-	if (!(fs_sector_size > 0)) {
-		goto out;
-	}
-	uint64_t fs_size = dm_get_blkdev_size64(fs_fd) / fs_sector_size;
+	// dm tables count 512 byte sectors, independent of the loop device's block size
+	uint64_t fs_size = dm_get_blkdev_size64(fs_fd) / 512;
 	if (fs_size == 0) {
 		goto out;
 	}
@@ -337,11 +333,7 @@ verity_create_blk_dev(const char *name, const char *fs_img_name, const char *has
 	}
 	TRACE("Created loop device %s for %s", hash_dev, hash_dev_name);
 
-	int hash_sector_size = dm_get_blkdev_sector_size(hash_fd);
-	if (!(hash_sector_size > 0)) {
-		goto out;
-	}
-	uint64_t hash_dev_size = dm_get_blkdev_size64(hash_fd) / hash_sector_size;
+	uint64_t hash_dev_size = dm_get_blkdev_size64(hash_fd) / 512;
 	if (hash_dev_size == 0) {
 		goto out;
 	}
@@ -0,0 +1,99 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "zram.h"
+
+#include "macro.h"
+#include "mem.h"
+#include "file.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ZRAM_CONTROL "/sys/class/zram-control"
+#define ZRAM_DEV_PREFIX "/dev/zram"
+
+static int
+zram_set_attr(unsigned int id, const char *attr, uint64_t value)
+{
+	char *path = mem_printf("/sys/block/zram%u/%s", id, attr);
+	int ret = file_printf(path, "%" PRIu64, value);
+	if (ret < 0)
+		ERROR_ERRNO("Could not set %s to %" PRIu64, path, value);
+	mem_free0(path);
+	return ret < 0 ? -1 : 0;
+}
+
+char *
+zram_create_new(uint64_t size)
+{
+	// reading hot_add allocates a new device and returns its id
+	char *id_str = file_read_new(ZRAM_CONTROL "/hot_add", 32);
+	if (!id_str) {
+		ERROR("Could not add zram device, is the zram module loaded?");
+		return NULL;
+	}
+
+	char *end = NULL;
+	unsigned long id = strtoul(id_str, &end, 10);
+	if (end == id_str) {
+		ERROR("Invalid zram device id '%s'", id_str);
+		mem_free0(id_str);
+		return NULL;
+	}
+	mem_free0(id_str);
+
+	char *dev = mem_printf("%s%lu", ZRAM_DEV_PREFIX, id);
+
+	// the limit has to be set before the disk size is set
+	if (zram_set_attr(id, "mem_limit", size) < 0 || zram_set_attr(id, "disksize", size) < 0) {
+		zram_free(dev);
+		mem_free0(dev);
+		return NULL;
+	}
+
+	DEBUG("Created zram device %s of %" PRIu64 " bytes", dev, size);
+	return dev;
+}
+
+int
+zram_free(const char *dev)
+{
+	IF_NULL_RETVAL(dev, -1);
+
+	IF_TRUE_RETVAL(strncmp(dev, ZRAM_DEV_PREFIX, strlen(ZRAM_DEV_PREFIX)), -1);
+	const char *id = dev + strlen(ZRAM_DEV_PREFIX);
+
+	char *reset = mem_printf("/sys/block/zram%s/reset", id);
+	int ret = file_printf(reset, "1");
+	if (ret < 0)
+		WARN_ERRNO("Could not reset zram device %s", dev);
+	mem_free0(reset);
+
+	if (file_printf(ZRAM_CONTROL "/hot_remove", "%s", id) < 0) {
+		WARN_ERRNO("Could not remove zram device %s", dev);
+		return -1;
+	}
+	return ret < 0 ? -1 : 0;
+}
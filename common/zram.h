@@ -0,0 +1,55 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/**
+  * @file zram.h
+  *
+  * Contains functions to create and remove compressed RAM block devices,
+  * e.g., for ephemeral container volumes which are discarded on stop.
+  */
+
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include <stdint.h>
+
+/**
+ * Adds a new zram device through the zram-control interface of the kernel.
+ * Its memory usage is limited to the given size.
+ *
+ * @param size The size of the device in bytes.
+ * @return The path of the device node, e.g. /dev/zram1, or NULL on error.
+ */
+char *
+zram_create_new(uint64_t size);
+
+/**
+ * Resets the given zram device, which frees its memory, and removes it.
+ *
+ * @param dev The path of the device node as returned by zram_create_new().
+ * @return -1 on error else 0.
+ */
+int
+zram_free(const char *dev);
+
+#endif /* ZRAM_H */
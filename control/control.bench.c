@@ -0,0 +1,554 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/*
+ * End-to-end benchmark of the container lifecycle of a running cmld, e.g. one in hosted
+ * mode on a CI VM. N containers are created from the same config, started, stopped and
+ * removed again through the control socket, with at most C operations of a phase in
+ * flight at once. Each operation uses its own connection, and the completion of starts
+ * and stops is taken from an event subscription, i.e. a start is complete once the
+ * container is running. Besides the latencies of the operations seen by the client, the
+ * per module hook durations which cmld reports for the last start of a container are
+ * collected, e.g. c_vol (volume setup), c_net (network), compartment/clone and
+ * compartment/start (until running). The distributions are printed as JSON lines.
+ */
+
+#include "control.pb-c.h"
+#include "container.pb-c.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/list.h"
+#include "common/logf.h"
+#include "common/protobuf.h"
+#include "common/sock.h"
+#include "common/file.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// clang-format off
+#define CONTROL_SOCKET SOCK_PATH(control)
+// clang-format on
+
+#define BENCH_TIMEOUT_DEFAULT 120 // seconds per operation
+
+typedef enum {
+	BENCH_OP_CREATE = 0,
+	BENCH_OP_START,
+	BENCH_OP_STOP,
+	BENCH_OP_REMOVE,
+	BENCH_OP_COUNT
+} bench_op_t;
+
+static const char *bench_op_names[BENCH_OP_COUNT] = {
+	[BENCH_OP_CREATE] = "create",
+	[BENCH_OP_START] = "start",
+	[BENCH_OP_STOP] = "stop",
+	[BENCH_OP_REMOVE] = "remove",
+};
+
+typedef struct {
+	char *uuid;	   // NULL until created
+	int sock;	   // connection of the pending operation, -1 if none
+	uint64_t start;	   // time in ns at which the pending operation was sent
+	bool replied;	   // the response to the pending operation was received
+	bool reached;	   // the state the pending operation leads to was reported
+	bool failed;	   // the last operation failed, skipped by the following phases
+} bench_container_t;
+
+/* samples of one operation or start phase */
+typedef struct {
+	char *name;
+	uint64_t *samples; // in ns
+	size_t n;
+	size_t cap;
+} bench_dist_t;
+
+typedef struct {
+	const char *socket_file;
+	int event_sock;
+	ControllerToDaemon create_msg;
+	char *key; // start and stop key, start params are omitted if NULL
+	size_t concurrency;
+	int timeout;
+	bench_container_t *containers;
+	size_t n_containers;
+	list_t *dists; // bench_dist_t in the order they were recorded first
+} bench_t;
+
+static uint64_t
+bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+bench_record(bench_t *bench, const char *name, uint64_t sample)
+{
+	bench_dist_t *dist = NULL;
+	for (list_t *l = bench->dists; l && !dist; l = l->next) {
+		if (!strcmp(((bench_dist_t *)l->data)->name, name))
+			dist = l->data;
+	}
+	if (!dist) {
+		dist = mem_new0(bench_dist_t, 1);
+		dist->name = mem_strdup(name);
+		bench->dists = list_append(bench->dists, dist);
+	}
+
+	if (dist->n == dist->cap) {
+		dist->cap = dist->cap ? dist->cap * 2 : 16;
+		dist->samples = mem_renew(uint64_t, dist->samples, dist->cap);
+	}
+	dist->samples[dist->n++] = sample;
+}
+
+static int
+bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+bench_print_dists(const bench_t *bench)
+{
+	for (list_t *l = bench->dists; l; l = l->next) {
+		bench_dist_t *dist = l->data;
+		qsort(dist->samples, dist->n, sizeof(uint64_t), bench_cmp_u64);
+
+		uint64_t sum = 0;
+		for (size_t i = 0; i < dist->n; i++)
+			sum += dist->samples[i];
+
+		// nearest rank percentiles
+#define PERCENTILE(p) dist->samples[(dist->n * (p) + 99) / 100 - 1]
+		printf("{\"phase\":\"%s\",\"count\":%zu,\"concurrency\":%zu,\"min_us\":%" PRIu64
+		       ",\"avg_us\":%" PRIu64 ",\"p50_us\":%" PRIu64 ",\"p90_us\":%" PRIu64
+		       ",\"p99_us\":%" PRIu64 ",\"max_us\":%" PRIu64 "}\n",
+		       dist->name, dist->n, bench->concurrency, dist->samples[0] / 1000,
+		       sum / dist->n / 1000, PERCENTILE(50) / 1000, PERCENTILE(90) / 1000,
+		       PERCENTILE(99) / 1000, dist->samples[dist->n - 1] / 1000);
+#undef PERCENTILE
+	}
+	fflush(stdout);
+}
+
+static bench_container_t *
+bench_container_get(bench_t *bench, const char *uuid)
+{
+	for (size_t i = 0; i < bench->n_containers; i++) {
+		if (bench->containers[i].uuid && !strcmp(bench->containers[i].uuid, uuid))
+			return &bench->containers[i];
+	}
+	return NULL;
+}
+
+static int
+bench_op_send(bench_t *bench, bench_container_t *c, bench_op_t op)
+{
+	ControllerToDaemon msg = CONTROLLER_TO_DAEMON__INIT;
+	ContainerStartParams start_params = CONTAINER_START_PARAMS__INIT;
+	char *uuids[1] = { c->uuid };
+
+	switch (op) {
+	case BENCH_OP_CREATE:
+		msg = bench->create_msg;
+		break;
+	case BENCH_OP_START:
+	case BENCH_OP_STOP:
+		msg.command = op == BENCH_OP_START ? CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_START :
+						     CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_STOP;
+		if (bench->key) {
+			start_params.key = bench->key;
+			msg.container_start_params = &start_params;
+		}
+		break;
+	case BENCH_OP_REMOVE:
+		msg.command = CONTROLLER_TO_DAEMON__COMMAND__REMOVE_CONTAINER;
+		break;
+	default:
+		return -1;
+	}
+	if (op != BENCH_OP_CREATE) {
+		msg.n_container_uuids = 1;
+		msg.container_uuids = uuids;
+	}
+
+	c->sock = sock_unix_create_and_connect(SOCK_STREAM, bench->socket_file);
+	if (c->sock < 0) {
+		ERROR("Failed to connect to %s", bench->socket_file);
+		return -1;
+	}
+
+	c->replied = false;
+	// create and remove are complete with their response
+	c->reached = op == BENCH_OP_CREATE || op == BENCH_OP_REMOVE;
+	c->start = bench_now_ns();
+	if (protobuf_send_message(c->sock, (ProtobufCMessage *)&msg) < 0) {
+		ERROR("Failed to send %s request", bench_op_names[op]);
+		close(c->sock);
+		c->sock = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Handles the response to the pending operation of c. Returns -1 if the operation failed.
+ */
+static int
+bench_op_handle_response(bench_container_t *c, bench_op_t op, const DaemonToController *resp)
+{
+	DaemonToController__Response expected;
+
+	switch (op) {
+	case BENCH_OP_CREATE:
+		if (resp->code != DAEMON_TO_CONTROLLER__CODE__CONTAINER_CONFIG ||
+		    resp->n_container_uuids != 1)
+			return -1;
+		c->uuid = mem_strdup(resp->container_uuids[0]);
+		return 0;
+	case BENCH_OP_START:
+		expected = DAEMON_TO_CONTROLLER__RESPONSE__CONTAINER_START_OK;
+		break;
+	case BENCH_OP_STOP:
+		expected = DAEMON_TO_CONTROLLER__RESPONSE__CONTAINER_STOP_OK;
+		break;
+	case BENCH_OP_REMOVE:
+		expected = DAEMON_TO_CONTROLLER__RESPONSE__CMD_OK;
+		break;
+	default:
+		return -1;
+	}
+	return resp->has_response && resp->response == expected ? 0 : -1;
+}
+
+static void
+bench_handle_status(bench_t *bench, bench_op_t op, const ContainerStatus *status)
+{
+	bench_container_t *c = bench_container_get(bench, status->uuid);
+	if (!c || c->sock < 0 || c->reached)
+		return;
+
+	if (op == BENCH_OP_START && status->state == CONTAINER_STATE__RUNNING) {
+		c->reached = true;
+		// the durations of the start which has just been completed
+		for (size_t i = 0; i < status->n_start_phases; i++) {
+			char *name = mem_printf("%s/%s", status->start_phases[i]->module,
+						status->start_phases[i]->hook);
+			bench_record(bench, name, status->start_phases[i]->duration_us * 1000);
+			mem_free0(name);
+		}
+	} else if (op == BENCH_OP_START && status->state == CONTAINER_STATE__STOPPED &&
+		   c->replied) {
+		WARN("Container %s stopped during its start", c->uuid);
+		c->failed = true;
+	} else if (op == BENCH_OP_STOP && status->state == CONTAINER_STATE__STOPPED) {
+		c->reached = true;
+	}
+}
+
+static int
+bench_handle_event(bench_t *bench, bench_op_t op)
+{
+	DaemonToController *resp = (DaemonToController *)protobuf_recv_message(
+		bench->event_sock, &daemon_to_controller__descriptor);
+	if (!resp) {
+		ERROR("Lost the event subscription");
+		return -1;
+	}
+
+	if (resp->code == DAEMON_TO_CONTROLLER__CODE__CONTAINER_EVENT) {
+		for (size_t i = 0; i < resp->n_container_status; i++)
+			bench_handle_status(bench, op, resp->container_status[i]);
+	}
+
+	protobuf_free_message((ProtobufCMessage *)resp);
+	return 0;
+}
+
+static void
+bench_op_finish(bench_t *bench, bench_container_t *c, bench_op_t op, bool failed)
+{
+	if (failed || c->failed) {
+		WARN("Failed to %s container %s", bench_op_names[op], c->uuid ? c->uuid : "");
+		c->failed = true;
+	} else {
+		bench_record(bench, bench_op_names[op], bench_now_ns() - c->start);
+	}
+	close(c->sock);
+	c->sock = -1;
+}
+
+/*
+ * Runs op for all containers which have not failed yet, with at most concurrency
+ * operations in flight. Returns the number of failed operations.
+ */
+static int
+bench_run_phase(bench_t *bench, bench_op_t op)
+{
+	size_t next = 0, pending = 0;
+	int failed = 0;
+	struct pollfd *pfds = mem_new0(struct pollfd, bench->n_containers + 1);
+	bench_container_t **polled = mem_new0(bench_container_t *, bench->n_containers);
+
+	for (;;) {
+		for (; pending < bench->concurrency && next < bench->n_containers; next++) {
+			bench_container_t *c = &bench->containers[next];
+			if (c->failed)
+				continue;
+			if (bench_op_send(bench, c, op) < 0) {
+				c->failed = true;
+				failed++;
+				continue;
+			}
+			pending++;
+		}
+		if (!pending)
+			break;
+
+		pfds[0] = (struct pollfd){ .fd = bench->event_sock, .events = POLLIN };
+		size_t n = 0;
+		uint64_t now = bench_now_ns();
+		uint64_t deadline = UINT64_MAX;
+		for (size_t i = 0; i < bench->n_containers; i++) {
+			bench_container_t *c = &bench->containers[i];
+			if (c->sock < 0)
+				continue;
+			// a container may fail or be complete without awaiting its response
+			if (c->failed || (c->replied && c->reached)) {
+				bench_op_finish(bench, c, op, false);
+				failed += c->failed ? 1 : 0;
+				pending--;
+				continue;
+			}
+			if (now - c->start >= (uint64_t)bench->timeout * 1000000000) {
+				WARN("Timeout on %s of container %s", bench_op_names[op],
+				     c->uuid ? c->uuid : "");
+				bench_op_finish(bench, c, op, true);
+				failed++;
+				pending--;
+				continue;
+			}
+			deadline = MIN(deadline, c->start + (uint64_t)bench->timeout * 1000000000);
+			if (!c->replied) {
+				polled[n] = c;
+				pfds[++n] = (struct pollfd){ .fd = c->sock, .events = POLLIN };
+			}
+		}
+		if (!pending)
+			continue;
+
+		int timeout_ms = (deadline - now) / 1000000 + 1;
+		int ret = poll(pfds, n + 1, timeout_ms);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			ERROR_ERRNO("poll failed");
+			failed += pending;
+			break;
+		}
+
+		if (pfds[0].revents && bench_handle_event(bench, op) < 0) {
+			failed += pending;
+			break;
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (!pfds[i + 1].revents)
+				continue;
+			bench_container_t *c = polled[i];
+			DaemonToController *resp = (DaemonToController *)protobuf_recv_message(
+				c->sock, &daemon_to_controller__descriptor);
+			c->replied = true;
+			if (!resp || bench_op_handle_response(c, op, resp) < 0)
+				c->failed = true;
+			if (resp)
+				protobuf_free_message((ProtobufCMessage *)resp);
+		}
+	}
+
+	mem_free0(polled);
+	mem_free0(pfds);
+	return failed;
+}
+
+static int
+bench_subscribe(bench_t *bench)
+{
+	bench->event_sock = sock_unix_create_and_connect(SOCK_STREAM, bench->socket_file);
+	if (bench->event_sock < 0) {
+		ERROR("Failed to connect to %s", bench->socket_file);
+		return -1;
+	}
+
+	// subscribe to the events of all containers, as the uuids are not known yet
+	ControllerToDaemon msg = CONTROLLER_TO_DAEMON__INIT;
+	msg.command = CONTROLLER_TO_DAEMON__COMMAND__SUBSCRIBE_EVENTS;
+	if (protobuf_send_message(bench->event_sock, (ProtobufCMessage *)&msg) < 0) {
+		ERROR("Failed to subscribe to container events");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+bench_read_file(const char *file, ProtobufCBinaryData *data)
+{
+	off_t len = file_size(file);
+	if (len < 0) {
+		ERROR("Could not access %s", file);
+		return -1;
+	}
+	data->len = len;
+	data->data = mem_alloc(len);
+	if (file_read(file, (char *)data->data, len) < 0) {
+		ERROR("Could not read %s", file);
+		mem_free0(data->data);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+print_usage(const char *cmd)
+{
+	fprintf(stderr,
+		"Usage: %s [-s <socket file>] [-n <containers>] [-c <concurrency>]\n"
+		"       [-i <iterations>] [-t <timeout in s>] [-k <key>]\n"
+		"       <container.conf> [<container.sig> <container.cert>]\n\n"
+		"Creates the given number of containers (default 10) from the config, starts and\n"
+		"stops each of them for the given number of iterations (default 1) and removes\n"
+		"them again, with at most <concurrency> (default 1) operations in flight.\n"
+		"The latency distributions of the operations and of the start phases reported\n"
+		"by cmld are printed as JSON lines.\n",
+		cmd);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	bench_t bench = { .socket_file = CONTROL_SOCKET,
+			  .event_sock = -1,
+			  .concurrency = 1,
+			  .timeout = BENCH_TIMEOUT_DEFAULT };
+	size_t n_containers = 10;
+	int iterations = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n:c:i:t:k:h")) != -1) {
+		switch (opt) {
+		case 's':
+			bench.socket_file = optarg;
+			break;
+		case 'n':
+			n_containers = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			bench.concurrency = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 't':
+			bench.timeout = atoi(optarg);
+			break;
+		case 'k':
+			bench.key = optarg;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (optind >= argc || n_containers == 0 || bench.concurrency == 0 || iterations <= 0 ||
+	    bench.timeout <= 0)
+		print_usage(argv[0]);
+
+	logf_handler_set_prio(logf_register(&logf_file_write, stderr), LOGF_PRIO_WARN);
+
+	ControllerToDaemon *create = &bench.create_msg;
+	controller_to_daemon__init(create);
+	create->command = CONTROLLER_TO_DAEMON__COMMAND__CREATE_CONTAINER;
+	if (bench_read_file(argv[optind], &create->container_config_file) < 0)
+		return 1;
+	create->has_container_config_file = true;
+	if (optind + 2 < argc) {
+		if (bench_read_file(argv[optind + 1], &create->container_config_signature) < 0 ||
+		    bench_read_file(argv[optind + 2], &create->container_config_certificate) < 0)
+			return 1;
+		create->has_container_config_signature = true;
+		create->has_container_config_certificate = true;
+	}
+
+	if (bench_subscribe(&bench) < 0)
+		return 1;
+
+	bench.n_containers = n_containers;
+	bench.containers = mem_new0(bench_container_t, n_containers);
+	for (size_t i = 0; i < n_containers; i++)
+		bench.containers[i].sock = -1;
+
+	int failed = bench_run_phase(&bench, BENCH_OP_CREATE);
+	for (int i = 0; i < iterations; i++) {
+		failed += bench_run_phase(&bench, BENCH_OP_START);
+		failed += bench_run_phase(&bench, BENCH_OP_STOP);
+	}
+
+	// clean up all created containers, even those which failed to start or stop
+	for (size_t i = 0; i < n_containers; i++)
+		bench.containers[i].failed = bench.containers[i].uuid == NULL;
+	failed += bench_run_phase(&bench, BENCH_OP_REMOVE);
+
+	bench_print_dists(&bench);
+	if (failed)
+		ERROR("%d operations failed", failed);
+
+	for (list_t *l = bench.dists; l; l = l->next) {
+		bench_dist_t *dist = l->data;
+		mem_free0(dist->name);
+		mem_free0(dist->samples);
+		mem_free0(dist);
+	}
+	list_delete(bench.dists);
+	for (size_t i = 0; i < n_containers; i++)
+		mem_free0(bench.containers[i].uuid);
+	mem_free0(bench.containers);
+	mem_free0(create->container_config_file.data);
+	mem_free0(create->container_config_signature.data);
+	mem_free0(create->container_config_certificate.data);
+	close(bench.event_sock);
+
+	return failed ? 1 : 0;
+}
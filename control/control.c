@@ -39,11 +39,19 @@
 #include "common/mem.h"
 #include "common/uuid.h"
 #include "common/str.h"
+#include "common/fd.h"
+#include "common/hex.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -78,6 +86,21 @@ print_usage(const char *cmd)
 	       "        Gets the device provisioned state.\n\n");
 	printf("   device_stats\n"
 	       "        Gets the device statistics about memory and disk usage.\n\n");
+	printf("   event_stats [on|off]\n"
+	       "        Gets the per handler statistics of the cmld event loop and optionally\n"
+	       "        starts (resetting all counters) or stops the accounting.\n\n");
+	printf("   mem_stats\n"
+	       "        Gets the per call site allocation statistics of cmld\n"
+	       "        (requires cmld to be built with MEM_STATS=y).\n\n");
+	printf("   telemetry [--follow] [<container-uuid> ...]\n"
+	       "        Gets the buffered resource usage samples of the given or all containers\n"
+	       "        and optionally keeps printing the samples of each sampling interval.\n\n");
+	printf("   events [<container-uuid> ...]\n"
+	       "        Prints the status of the given or all containers and keeps printing\n"
+	       "        it whenever a container is created, changes its state or is removed.\n\n");
+	printf("   syscall_stats [<container-uuid> ...]\n"
+	       "        Gets the statistics of the syscalls trapped and emulated for the given\n"
+	       "        or all containers.\n\n");
 	printf("   create <container.conf> [<container.sig> <container.cert>]\n"
 	       "        Creates a container from the given config file,\n"
 	       "        and optionally signature and certificate files\n\n");
@@ -101,6 +124,9 @@ print_usage(const char *cmd)
 	       "        Freeze the specified container.\n\n");
 	printf("   unfreeze <container-uuid>\n"
 	       "        Unfreeze the specified container.\n\n");
+	printf("   bulk <start|stop|freeze|unfreeze> <container-uuid> ...\n"
+	       "        Starts, stops, freezes or unfreezes all specified containers with\n"
+	       "        a single request. Containers which need a key are not supported.\n\n");
 	printf("   allow_audio <container-uuid>\n"
 	       "        Grant audio access to the specified container (cgroups).\n\n");
 	printf("   deny_audio <container-uuid>\n"
@@ -130,13 +156,81 @@ print_usage(const char *cmd)
 	       "        Prints the list of network interfaces assigned to the specified container.\n\n");
 	printf("   run <container-uuid> <command> [<arg_1> ... <arg_n>]\n"
 	       "        Runs the specified command with the given arguments inside the specified container.\n\n");
-	printf("   retrieve_logs [<path_to_logstore_dir>]\n"
+	printf("   batch [--json] [<file>]\n"
+	       "        Reads commands from the given file or stdin, one per line, and sends\n"
+	       "        them over one connection without waiting for each response. The\n"
+	       "        responses are printed in order as they arrive, with --json as one\n"
+	       "        JSON object per line. Supported are list, list_guestos and reload,\n"
+	       "        as well as state, config, ifaces, start, stop, freeze, unfreeze,\n"
+	       "        remove, wipe, snapshot, allow_audio and deny_audio followed by\n"
+	       "        <container-uuid|name>. Containers which need a password or pin to be\n"
+	       "        started or stopped are not supported.\n\n");
+	printf("   retrieve_logs [--resume] [<path_to_logstore_dir>]\n"
 	       "        Retrieves logs from the directory defined in LOGFILE_DIR and stores them in the given directory"
-	       " or in the current directory if no directory was given.\n\n");
+	       " or in the current directory if no directory was given.\n"
+	       "        With --resume, logs already in the directory are only completed.\n\n");
 	printf("\n");
 	exit(-1);
 }
 
+/*
+ * Copies size bytes of the passed log file to path. On resume, a shorter file at
+ * path is taken as already copied part and only completed.
+ */
+static int
+copy_log_file(int log_fd, const char *path, uint64_t size, bool resume)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0640);
+	if (fd < 0) {
+		ERROR_ERRNO("Could not open %s", path);
+		return -1;
+	}
+
+	off_t off = 0;
+	struct stat st;
+	if (resume && !fstat(fd, &st) && (uint64_t)st.st_size <= size)
+		off = st.st_size;
+
+	int ret = -1;
+	if (ftruncate(fd, off) < 0 || lseek(fd, off, SEEK_SET) < 0) {
+		ERROR_ERRNO("Could not prepare %s", path);
+		goto out;
+	}
+	if (off > 0)
+		INFO("Resuming logfile %s at %jd of %" PRIu64 " bytes", path, (intmax_t)off, size);
+
+	while ((uint64_t)off < size) {
+		ssize_t n = sendfile(fd, log_fd, &off, size - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			ERROR_ERRNO("Could not copy logfile to %s", path);
+			goto out;
+		}
+		// the logfile was truncated meanwhile
+		if (n == 0)
+			break;
+	}
+	INFO("Received logfile %s (%jd bytes)", path, (intmax_t)off);
+	ret = 0;
+out:
+	close(fd);
+	return ret;
+}
+
+/*
+ * Appends a fragment of a log file received by GET_LAST_LOG to path. Compressed log files
+ * are received in the data field of the LogMessage.
+ */
+static int
+control_write_log_message(const char *path, const LogMessage *message)
+{
+	if (message->has_data)
+		return file_write_append(path, (const char *)message->data.data,
+					 message->data.len);
+	return file_write_append(path, message->msg, -1);
+}
+
 static int
 sock_connect(const char *socket_file)
 {
@@ -164,6 +258,56 @@ recv_message(int sock)
 	return resp;
 }
 
+/*
+ * Relays stdin to the console of a command run in a container and its output to stdout,
+ * until the console reaches EOF on termination of the command. EOF on stdin is passed on to
+ * commands without pty. The console is non-blocking, as it is shared with cmld.
+ */
+static void
+run_relay_console(int console, bool pty)
+{
+	pid_t pid = fork();
+
+	if (pid == -1) {
+		ERROR_ERRNO("[CLIENT] Failed to fork()");
+		return;
+	} else if (pid == 0) {
+		char buf[4096];
+		ssize_t count;
+
+		while ((count = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+			if (fd_write(console, buf, count) != count)
+				_exit(EXIT_FAILURE);
+		}
+		if (count == 0 && !pty)
+			shutdown(console, SHUT_WR);
+		_exit(EXIT_SUCCESS);
+	}
+
+	char buf[65536];
+	struct pollfd pfd = { .fd = console, .events = POLLIN };
+
+	while (true) {
+		ssize_t count = read(console, buf, sizeof(buf));
+		if (count > 0) {
+			if (fd_write(STDOUT_FILENO, buf, count) != count)
+				break;
+		} else if (count < 0 && errno == EAGAIN) {
+			poll(&pfd, 1, -1);
+		} else if (count < 0 && errno != EINTR) {
+			ERROR_ERRNO("[CLIENT] Failed to read output of exec'ed process");
+			break;
+		} else if (count == 0) {
+			TRACE("[CLIENT] Console closed on command termination. Exiting...");
+			break;
+		}
+	}
+
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	close(console);
+}
+
 static bool
 get_container_usb_pin_entry(uuid_t *uuid, int sock)
 {
@@ -231,6 +375,34 @@ get_container_uuid_new(const char *identifier, int sock)
 	return valid_uuid;
 }
 
+/*
+ * Resolves the uuids or names of several containers with a single status request.
+ */
+static char **
+get_container_uuids_new(char *const *identifiers, size_t n, int sock)
+{
+	ControllerToDaemon msg = CONTROLLER_TO_DAEMON__INIT;
+	msg.command = CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_STATUS;
+	send_message(sock, &msg);
+
+	DaemonToController *resp = recv_message(sock);
+
+	char **uuids = mem_new0(char *, n);
+	for (size_t i = 0; i < n; i++) {
+		for (size_t j = 0; j < resp->n_container_status && !uuids[i]; j++) {
+			ContainerStatus *status = resp->container_status[j];
+			if (!strcmp(status->uuid, identifiers[i]) ||
+			    !strcmp(status->name, identifiers[i]))
+				uuids[i] = mem_strdup(status->uuid);
+		}
+		if (!uuids[i])
+			FATAL("Container %s does not exist!", identifiers[i]);
+	}
+
+	protobuf_free_message((ProtobufCMessage *)resp);
+	return uuids;
+}
+
 static const struct option global_options[] = { { "socket", required_argument, 0, 's' },
 						{ "help", no_argument, 0, 'h' },
 						{ 0, 0, 0, 0 } };
@@ -272,6 +444,347 @@ get_password_new(const char *prompt)
 	return mem_strdup(buf);
 }
 
+/*
+ * Prints a string as JSON string literal.
+ */
+static void
+json_print_string(const char *s)
+{
+	putchar('"');
+	for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			printf("\\%c", *p);
+		else if (*p == '\n')
+			printf("\\n");
+		else if (*p < 0x20)
+			printf("\\u%04x", *p);
+		else
+			putchar(*p);
+	}
+	putchar('"');
+}
+
+static void
+json_print_message(const ProtobufCMessage *message);
+
+/*
+ * Prints a single value of the given field, bytes are printed as hex string.
+ */
+static void
+json_print_value(const ProtobufCFieldDescriptor *field, const void *value)
+{
+	switch (field->type) {
+	case PROTOBUF_C_TYPE_INT32:
+	case PROTOBUF_C_TYPE_SINT32:
+	case PROTOBUF_C_TYPE_SFIXED32:
+		printf("%" PRId32, *(const int32_t *)value);
+		break;
+	case PROTOBUF_C_TYPE_UINT32:
+	case PROTOBUF_C_TYPE_FIXED32:
+		printf("%" PRIu32, *(const uint32_t *)value);
+		break;
+	case PROTOBUF_C_TYPE_INT64:
+	case PROTOBUF_C_TYPE_SINT64:
+	case PROTOBUF_C_TYPE_SFIXED64:
+		printf("%" PRId64, *(const int64_t *)value);
+		break;
+	case PROTOBUF_C_TYPE_UINT64:
+	case PROTOBUF_C_TYPE_FIXED64:
+		printf("%" PRIu64, *(const uint64_t *)value);
+		break;
+	case PROTOBUF_C_TYPE_FLOAT:
+		printf("%g", *(const float *)value);
+		break;
+	case PROTOBUF_C_TYPE_DOUBLE:
+		printf("%g", *(const double *)value);
+		break;
+	case PROTOBUF_C_TYPE_BOOL:
+		printf("%s", *(const protobuf_c_boolean *)value ? "true" : "false");
+		break;
+	case PROTOBUF_C_TYPE_ENUM: {
+		int v = *(const int *)value;
+		const ProtobufCEnumDescriptor *enum_desc = field->descriptor;
+		const ProtobufCEnumValue *ev = protobuf_c_enum_descriptor_get_value(enum_desc, v);
+		if (ev)
+			json_print_string(ev->name);
+		else
+			printf("%d", v);
+	} break;
+	case PROTOBUF_C_TYPE_STRING:
+		json_print_string(*(char *const *)value);
+		break;
+	case PROTOBUF_C_TYPE_BYTES: {
+		const ProtobufCBinaryData *bin = value;
+		char *hex = convert_bin_to_hex_new(bin->data, bin->len);
+		json_print_string(hex ? hex : "");
+		mem_free0(hex);
+	} break;
+	case PROTOBUF_C_TYPE_MESSAGE:
+		json_print_message(*(ProtobufCMessage *const *)value);
+		break;
+	}
+}
+
+static size_t
+json_value_size(ProtobufCType type)
+{
+	switch (type) {
+	case PROTOBUF_C_TYPE_INT64:
+	case PROTOBUF_C_TYPE_SINT64:
+	case PROTOBUF_C_TYPE_SFIXED64:
+	case PROTOBUF_C_TYPE_UINT64:
+	case PROTOBUF_C_TYPE_FIXED64:
+		return sizeof(uint64_t);
+	case PROTOBUF_C_TYPE_DOUBLE:
+		return sizeof(double);
+	case PROTOBUF_C_TYPE_BOOL:
+		return sizeof(protobuf_c_boolean);
+	case PROTOBUF_C_TYPE_STRING:
+		return sizeof(char *);
+	case PROTOBUF_C_TYPE_BYTES:
+		return sizeof(ProtobufCBinaryData);
+	case PROTOBUF_C_TYPE_MESSAGE:
+		return sizeof(ProtobufCMessage *);
+	default:
+		return sizeof(uint32_t);
+	}
+}
+
+/*
+ * Prints a protobuf message as JSON object on a single line, using the field names
+ * of the .proto file. Unset optional fields are omitted.
+ */
+static void
+json_print_message(const ProtobufCMessage *message)
+{
+	const ProtobufCMessageDescriptor *desc = message->descriptor;
+	const char *base = (const char *)message;
+	bool first = true;
+
+	putchar('{');
+	for (unsigned i = 0; i < desc->n_fields; i++) {
+		const ProtobufCFieldDescriptor *field = &desc->fields[i];
+		const void *value = base + field->offset;
+		bool is_pointer = field->type == PROTOBUF_C_TYPE_STRING ||
+				  field->type == PROTOBUF_C_TYPE_MESSAGE;
+		size_t n = 1;
+
+		if (field->label == PROTOBUF_C_LABEL_REPEATED) {
+			n = *(const size_t *)(base + field->quantifier_offset);
+			if (n == 0)
+				continue;
+			value = *(void *const *)value;
+		} else if (is_pointer) {
+			if (!*(void *const *)value)
+				continue;
+		} else if (field->label == PROTOBUF_C_LABEL_OPTIONAL) {
+			if (!*(const protobuf_c_boolean *)(base + field->quantifier_offset))
+				continue;
+		}
+
+		printf("%s", first ? "" : ",");
+		first = false;
+		json_print_string(field->name);
+		putchar(':');
+
+		if (field->label != PROTOBUF_C_LABEL_REPEATED) {
+			json_print_value(field, value);
+			continue;
+		}
+		putchar('[');
+		for (size_t j = 0; j < n; j++) {
+			printf("%s", j ? "," : "");
+			json_print_value(field,
+					 (const char *)value + j * json_value_size(field->type));
+		}
+		putchar(']');
+	}
+	putchar('}');
+}
+
+/*
+ * Commands of batch mode. All of them are answered by exactly one message in order,
+ * which allows to send them ahead of their responses.
+ */
+static const struct {
+	const char *name;
+	ControllerToDaemon__Command command;
+	bool container; // needs a container as argument
+} batch_commands[] = {
+	{ "list", CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_STATUS, false },
+	{ "list_guestos", CONTROLLER_TO_DAEMON__COMMAND__LIST_GUESTOS_CONFIGS, false },
+	{ "reload", CONTROLLER_TO_DAEMON__COMMAND__RELOAD_CONTAINERS, false },
+	{ "state", CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_STATUS, true },
+	{ "config", CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_CONFIG, true },
+	{ "ifaces", CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_LIST_IFACES, true },
+	{ "start", CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_START, true },
+	{ "stop", CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_STOP, true },
+	{ "freeze", CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_FREEZE, true },
+	{ "unfreeze", CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_UNFREEZE, true },
+	{ "remove", CONTROLLER_TO_DAEMON__COMMAND__REMOVE_CONTAINER, true },
+	{ "wipe", CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_WIPE, true },
+	{ "snapshot", CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_SNAPSHOT, true },
+	{ "allow_audio", CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_ALLOWAUDIO, true },
+	{ "deny_audio", CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_DENYAUDIO, true },
+};
+
+// maximum number of batch commands sent ahead of their responses
+#define BATCH_WINDOW 32
+// time in ms to wait for the response to a batch command
+#define BATCH_TIMEOUT 30000
+
+typedef struct {
+	unsigned lineno;
+	char *line;
+} batch_cmd_t;
+
+// commands which were sent and wait for their response, oldest first
+typedef struct {
+	batch_cmd_t cmds[BATCH_WINDOW];
+	size_t head;
+	size_t n;
+} batch_queue_t;
+
+static void
+batch_print_result(const batch_cmd_t *cmd, const DaemonToController *resp, const char *error,
+		   bool json)
+{
+	if (json) {
+		printf("{\"line\":%u,\"command\":", cmd->lineno);
+		json_print_string(cmd->line);
+		if (resp) {
+			printf(",\"response\":");
+			json_print_message((const ProtobufCMessage *)resp);
+		} else {
+			printf(",\"error\":");
+			json_print_string(error);
+		}
+		printf("}\n");
+	} else {
+		printf("# %u: %s\n", cmd->lineno, cmd->line);
+		if (resp)
+			protobuf_dump_message(STDOUT_FILENO, (const ProtobufCMessage *)resp);
+		else
+			printf("error: %s\n", error);
+	}
+	fflush(stdout);
+}
+
+/*
+ * Builds the request for one line of batch input. The container is looked up in the
+ * status of all containers retrieved when the batch started.
+ */
+static const char *
+batch_build_message(ControllerToDaemon *msg, char **uuid, char *line,
+		    const DaemonToController *status)
+{
+	char *saveptr = NULL;
+	const char *name = strtok_r(line, " \t", &saveptr);
+	const char *arg = strtok_r(NULL, " \t", &saveptr);
+
+	size_t i;
+	for (i = 0; i < sizeof(batch_commands) / sizeof(batch_commands[0]); i++)
+		if (!strcasecmp(name, batch_commands[i].name))
+			break;
+	if (i == sizeof(batch_commands) / sizeof(batch_commands[0]))
+		return "unsupported command";
+	if (strtok_r(NULL, " \t", &saveptr) || (batch_commands[i].container != (arg != NULL)))
+		return "wrong number of arguments";
+
+	msg->command = batch_commands[i].command;
+	if (!arg)
+		return NULL;
+
+	for (size_t j = 0; j < status->n_container_status; j++) {
+		if (!strcmp(status->container_status[j]->uuid, arg) ||
+		    !strcmp(status->container_status[j]->name, arg)) {
+			*uuid = status->container_status[j]->uuid;
+			msg->n_container_uuids = 1;
+			msg->container_uuids = uuid;
+			return NULL;
+		}
+	}
+	return "container does not exist";
+}
+
+/*
+ * Receives the response to the oldest pending batch command and prints it.
+ */
+static void
+batch_recv_result(int sock, batch_queue_t *queue, bool json)
+{
+	batch_cmd_t *cmd = &queue->cmds[queue->head];
+	struct pollfd pfd = { .fd = sock, .events = POLLIN };
+	int ret;
+
+	while ((ret = poll(&pfd, 1, BATCH_TIMEOUT)) < 0 && errno == EINTR)
+		;
+	if (ret == 0)
+		FATAL("Timeout waiting for the response to line %u", cmd->lineno);
+
+	DaemonToController *resp = recv_message(sock);
+	batch_print_result(cmd, resp, NULL, json);
+	protobuf_free_message((ProtobufCMessage *)resp);
+
+	mem_free0(cmd->line);
+	queue->head = (queue->head + 1) % BATCH_WINDOW;
+	queue->n--;
+}
+
+/*
+ * Reads commands line by line from in and sends them over one connection. Up to
+ * BATCH_WINDOW commands are sent ahead, the responses are printed as they arrive.
+ * Returns the number of lines which could not be sent.
+ */
+static int
+run_batch(int sock, FILE *in, bool json)
+{
+	batch_queue_t queue = { .head = 0, .n = 0 };
+	unsigned lineno = 0;
+	int failed = 0;
+	char *buf = NULL;
+	size_t buflen = 0;
+
+	ControllerToDaemon status_msg = CONTROLLER_TO_DAEMON__INIT;
+	status_msg.command = CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_STATUS;
+	send_message(sock, &status_msg);
+	DaemonToController *status = recv_message(sock);
+
+	while (getline(&buf, &buflen, in) >= 0) {
+		lineno++;
+		buf[strcspn(buf, "\r\n")] = '\0';
+		char *line = buf + strspn(buf, " \t");
+		if (!*line || *line == '#')
+			continue;
+
+		batch_cmd_t cmd = { .lineno = lineno, .line = mem_strdup(line) };
+		ControllerToDaemon msg = CONTROLLER_TO_DAEMON__INIT;
+		char *uuid = NULL;
+		const char *error = batch_build_message(&msg, &uuid, line, status);
+		if (error) {
+			// keep the output in order of the input
+			while (queue.n > 0)
+				batch_recv_result(sock, &queue, json);
+			batch_print_result(&cmd, NULL, error, json);
+			mem_free0(cmd.line);
+			failed++;
+			continue;
+		}
+
+		if (queue.n == BATCH_WINDOW)
+			batch_recv_result(sock, &queue, json);
+		send_message(sock, &msg);
+		queue.cmds[(queue.head + queue.n++) % BATCH_WINDOW] = cmd;
+	}
+
+	while (queue.n > 0)
+		batch_recv_result(sock, &queue, json);
+
+	free(buf);
+	protobuf_free_message((ProtobufCMessage *)status);
+	return failed;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -281,7 +794,9 @@ main(int argc, char *argv[])
 	uuid_t *uuid = NULL;
 	int sock = 0;
 	bool has_container_start_params_key = false;
+	size_t bulk_responses_pending = 0;
 	str_t *log_dir = NULL;
+	bool log_resume = false;
 	struct termios termios_before;
 	tcgetattr(STDIN_FILENO, &termios_before);
 
@@ -307,6 +822,27 @@ main(int argc, char *argv[])
 	ControllerToDaemon msg = CONTROLLER_TO_DAEMON__INIT;
 
 	const char *command = argv[optind++];
+	if (!strcasecmp(command, "batch")) {
+		bool json = false;
+		if (optind < argc && !strcmp(argv[optind], "--json")) {
+			json = true;
+			optind++;
+		}
+		// need at most one more argument (file with commands)
+		if (optind < argc - 1)
+			print_usage(argv[0]);
+
+		FILE *in = optind < argc ? fopen(argv[optind], "r") : stdin;
+		if (!in)
+			FATAL_ERRNO("Could not open %s", argv[optind]);
+
+		sock = sock_connect(socket_file);
+		int failed = run_batch(sock, in, json);
+		if (in != stdin)
+			fclose(in);
+		close(sock);
+		return failed ? 1 : 0;
+	}
 	/*
 	 * device global commands
 	 */
@@ -319,6 +855,10 @@ main(int argc, char *argv[])
 		goto send_message;
 	}
 	if (!strcasecmp(command, "retrieve_logs")) {
+		if (optind < argc && !strcmp(argv[optind], "--resume")) {
+			log_resume = true;
+			optind++;
+		}
 		// need at most one more argument (path to store logs)
 		if (optind < argc - 1)
 			print_usage(argv[0]);
@@ -335,7 +875,7 @@ main(int argc, char *argv[])
 		}
 
 		if (file_exists(str_buffer(log_dir)) && file_is_dir(str_buffer(log_dir))) {
-			msg.command = CONTROLLER_TO_DAEMON__COMMAND__GET_LAST_LOG;
+			msg.command = CONTROLLER_TO_DAEMON__COMMAND__GET_LOG_FILES;
 			goto send_message;
 		} else {
 			INFO("Directory does not exist. Please specify existing directory or no directory to copy into ./");
@@ -366,6 +906,53 @@ main(int argc, char *argv[])
 		msg.command = CONTROLLER_TO_DAEMON__COMMAND__GET_DEVICE_STATS;
 		goto send_message;
 	}
+	if (!strcasecmp(command, "event_stats")) {
+		msg.command = CONTROLLER_TO_DAEMON__COMMAND__GET_EVENT_STATS;
+		if (optind < argc) {
+			if (!strcasecmp(argv[optind], "on"))
+				msg.event_stats_enable = true;
+			else if (strcasecmp(argv[optind], "off"))
+				print_usage(argv[0]);
+			msg.has_event_stats_enable = true;
+		}
+		goto send_message;
+	}
+	if (!strcasecmp(command, "mem_stats")) {
+		msg.command = CONTROLLER_TO_DAEMON__COMMAND__GET_MEM_STATS;
+		goto send_message;
+	}
+	if (!strcasecmp(command, "telemetry")) {
+		msg.command = CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_TELEMETRY;
+		if (optind < argc && !strcmp(argv[optind], "--follow")) {
+			msg.has_telemetry_follow = true;
+			msg.telemetry_follow = true;
+			optind++;
+		}
+		// the uuids are only used as filter, unknown ones just match no samples
+		msg.n_container_uuids = argc - optind;
+		msg.container_uuids = mem_new0(char *, msg.n_container_uuids);
+		for (size_t i = 0; i < msg.n_container_uuids; i++)
+			msg.container_uuids[i] = mem_strdup(argv[optind++]);
+		goto send_message;
+	}
+	if (!strcasecmp(command, "events")) {
+		msg.command = CONTROLLER_TO_DAEMON__COMMAND__SUBSCRIBE_EVENTS;
+		// the uuids are only used as filter, unknown ones just match no events
+		msg.n_container_uuids = argc - optind;
+		msg.container_uuids = mem_new0(char *, msg.n_container_uuids);
+		for (size_t i = 0; i < msg.n_container_uuids; i++)
+			msg.container_uuids[i] = mem_strdup(argv[optind++]);
+		goto send_message;
+	}
+	if (!strcasecmp(command, "syscall_stats")) {
+		msg.command = CONTROLLER_TO_DAEMON__COMMAND__GET_SYSCALL_STATS;
+		// unknown uuids are skipped by cmld
+		msg.n_container_uuids = argc - optind;
+		msg.container_uuids = mem_new0(char *, msg.n_container_uuids);
+		for (size_t i = 0; i < msg.n_container_uuids; i++)
+			msg.container_uuids[i] = mem_strdup(argv[optind++]);
+		goto send_message;
+	}
 	if (!strcasecmp(command, "push_guestos_config")) {
 		if (optind + 2 >= argc)
 			print_usage(argv[0]);
@@ -522,6 +1109,30 @@ main(int argc, char *argv[])
 		goto send_message;
 	}
 
+	if (!strcasecmp(command, "bulk")) {
+		if (optind + 1 >= argc)
+			print_usage(argv[0]);
+		const char *op = argv[optind++];
+		if (!strcasecmp(op, "start"))
+			msg.command = CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_START;
+		else if (!strcasecmp(op, "stop"))
+			msg.command = CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_STOP;
+		else if (!strcasecmp(op, "freeze"))
+			msg.command = CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_FREEZE;
+		else if (!strcasecmp(op, "unfreeze"))
+			msg.command = CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_UNFREEZE;
+		else
+			print_usage(argv[0]);
+
+		sock = sock_connect(socket_file);
+		msg.n_container_uuids = argc - optind;
+		msg.container_uuids =
+			get_container_uuids_new(&argv[optind], msg.n_container_uuids, sock);
+		// cmld answers each container separately
+		bulk_responses_pending = msg.n_container_uuids;
+		goto send_message;
+	}
+
 	/*
 	 * container specific commands
 	 */
@@ -710,6 +1321,8 @@ main(int argc, char *argv[])
 			print_usage(argv[0]);
 
 		msg.command = CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_EXEC_CMD;
+		msg.has_exec_raw = true;
+		msg.exec_raw = true;
 
 		int argcount = 0;
 
@@ -788,6 +1401,20 @@ send_message:
 		mem_free_array((void **)msg.exec_args, msg.n_exec_args);
 		TRACE("[CLIENT] after free ");
 
+		// a local cmld passes the console of the command, else the output comes in messages
+		DaemonToController *resp = recv_message(sock);
+		if (resp->code == DAEMON_TO_CONTROLLER__CODE__EXEC_CHANNEL) {
+			protobuf_free_message((ProtobufCMessage *)resp);
+
+			int console = sock_unix_recv_fd(sock);
+			if (console < 0) {
+				ERROR("[CLIENT] Failed to receive console of exec'ed process");
+				goto exit;
+			}
+			run_relay_console(console, msg.exec_pty);
+			goto exit;
+		}
+
 		int pid = fork();
 
 		if (pid == -1) {
@@ -828,8 +1455,10 @@ send_message:
 			      getpid());
 
 			while (1) {
-				TRACE("[CLIENT] Waiting for command output message from cmld");
-				DaemonToController *resp = recv_message(sock);
+				if (!resp) {
+					TRACE("[CLIENT] Waiting for output message from cmld");
+					resp = recv_message(sock);
+				}
 
 				TRACE("[CLIENT] Got message from exec'ed process\n");
 
@@ -856,6 +1485,8 @@ send_message:
 					ERROR("Detected unexpected message from cmld. Exiting");
 					goto exit;
 				}
+				protobuf_free_message((ProtobufCMessage *)resp);
+				resp = NULL;
 			}
 		}
 		ERROR_ERRNO("[CLIENT] command \"run\" failed");
@@ -894,6 +1525,27 @@ handle_resp:
 			protobuf_dump_message(STDOUT_FILENO, (ProtobufCMessage *)resp);
 		}
 	} break;
+	case DAEMON_TO_CONTROLLER__CODE__LOG_FILE: {
+		// the fd of the file follows, receive it also if it is not used
+		int log_fd = sock_unix_recv_fd(sock);
+		if (log_fd < 0) {
+			ERROR("Failed to receive logfile");
+			break;
+		}
+		if (!log_dir || !resp->log_file) {
+			WARN("Did not expect to receive a LOG_FILE");
+		} else {
+			str_t *file_str = str_new(str_buffer(log_dir));
+			str_append(file_str, resp->log_file->name);
+			if (copy_log_file(log_fd, str_buffer(file_str), resp->log_file->size,
+					  log_resume) < 0)
+				ERROR("logfile %s could not be written.", resp->log_file->name);
+			str_free(file_str, true);
+		}
+		close(log_fd);
+		protobuf_free_message((ProtobufCMessage *)resp);
+		goto handle_resp;
+	} break;
 	case DAEMON_TO_CONTROLLER__CODE__LOG_MESSAGE_FRAGMENT: {
 		if (!log_dir) {
 			WARN("log_dir is null. Did not except to receive a LOG_MESSAGE");
@@ -911,7 +1563,7 @@ handle_resp:
 		str_t *file_str = str_new(str_buffer(log_dir));
 		str_append(file_str, resp->log_message->name);
 
-		if (file_write_append(str_buffer(file_str), resp->log_message->msg, -1) < 0) {
+		if (control_write_log_message(str_buffer(file_str), resp->log_message) < 0) {
 			INFO("logfile %s could not be written.", resp->log_message->name);
 		}
 		protobuf_free_message((ProtobufCMessage *)resp);
@@ -934,13 +1586,36 @@ handle_resp:
 		str_t *file_str = str_new(str_buffer(log_dir));
 		str_append(file_str, resp->log_message->name);
 
-		if (file_write_append(str_buffer(file_str), resp->log_message->msg, -1) < 0) {
+		if (control_write_log_message(str_buffer(file_str), resp->log_message) < 0) {
 			INFO("logfile %s could not be written.", resp->log_message->name);
 		}
 		protobuf_free_message((ProtobufCMessage *)resp);
 		goto handle_resp;
 	} break;
 
+	case DAEMON_TO_CONTROLLER__CODE__CONTAINER_TELEMETRY: {
+		protobuf_dump_message(STDOUT_FILENO, (ProtobufCMessage *)resp);
+		if (msg.telemetry_follow) {
+			protobuf_free_message((ProtobufCMessage *)resp);
+			goto handle_resp;
+		}
+	} break;
+
+	case DAEMON_TO_CONTROLLER__CODE__CONTAINER_RESPONSE: {
+		protobuf_dump_message(STDOUT_FILENO, (ProtobufCMessage *)resp);
+		if (bulk_responses_pending > 1) {
+			bulk_responses_pending--;
+			protobuf_free_message((ProtobufCMessage *)resp);
+			goto handle_resp;
+		}
+	} break;
+
+	case DAEMON_TO_CONTROLLER__CODE__CONTAINER_EVENT: {
+		protobuf_dump_message(STDOUT_FILENO, (ProtobufCMessage *)resp);
+		protobuf_free_message((ProtobufCMessage *)resp);
+		goto handle_resp;
+	} break;
+
 	default:
 		// TODO for now just dump the response in text format
 		protobuf_dump_message(STDOUT_FILENO, (ProtobufCMessage *)resp);
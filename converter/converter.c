@@ -37,10 +37,12 @@
 #include "common/mem.h"
 
 #include "docker.h"
+#include "tarmerge.h"
 #include "util.h"
 #include "control.h"
 
 #include <getopt.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
 #include <inttypes.h>
@@ -95,7 +97,8 @@ err:
 
 int
 write_guestos_config(docker_config_t *config, const char *root_image_file, const char *image_path,
-		     const char *image_name, const char *image_tag)
+		     const char *image_name, const char *image_tag,
+		     const util_image_opts_t *image_opts)
 {
 	int ret = -1;
 	char *out_file;
@@ -124,7 +127,13 @@ write_guestos_config(docker_config_t *config, const char *root_image_file, const
 	GuestOSMount mount_root = GUEST_OSMOUNT__INIT;
 	mount_root.image_file = strtok(mem_strdup(IMAGE_NAME_ROOT), ".");
 	mount_root.mount_point = mem_strdup("/");
-	mount_root.fs_type = mem_strdup("squashfs");
+	mount_root.fs_type = mem_strdup(util_image_fs_type(image_opts->fs));
+	// c_vol adapts the readahead of the device to the block size
+	mount_root.image_compression = mem_strdup(util_image_comp(image_opts));
+	mount_root.has_image_compression_level = image_opts->comp_level != 0;
+	mount_root.image_compression_level = image_opts->comp_level;
+	mount_root.has_image_block_size = true;
+	mount_root.image_block_size = util_image_block_size(image_opts);
 	mount_root.mount_type = GUEST_OSMOUNT__TYPE__SHARED_RW;
 
 	// add image_sha1 and image_sha256 values
@@ -242,6 +251,7 @@ free_stuff:
 		mem_free0(cfg.mounts[j]->image_file);
 		mem_free0(cfg.mounts[j]->mount_point);
 		mem_free0(cfg.mounts[j]->fs_type);
+		mem_free0(cfg.mounts[j]->image_compression);
 		mem_free0(cfg.mounts[j]->image_sha1);
 		mem_free0(cfg.mounts[j]->image_sha2_256);
 		if (j > 0) {
@@ -261,45 +271,241 @@ free_stuff:
 	return ret;
 }
 
-char *
-merge_layers_new(docker_manifest_t *manifest, char *in_path, char *out_path, char *image_name,
-		 char *image_tag)
+typedef struct {
+	char *extracted_image_path;
+	char *tree_cache_path; // NULL if extracted trees are not cached
+	int layers_size;
+	char **chain_ids;
+} merge_layers_t;
+
+static void
+merge_layers_free(merge_layers_t *merge)
 {
-	char *target_image_path = mem_printf("%s/%s_%s", out_path, image_name, image_tag);
-	char *extracted_image_path =
-		mem_printf("%s/%s_%s_extracted", out_path, image_name, image_tag);
-	char *image_file = NULL;
+	for (int i = 0; i < merge->layers_size; ++i)
+		mem_free0(merge->chain_ids[i]);
+	mem_free0(merge->chain_ids);
+	if (merge->tree_cache_path)
+		mem_free0(merge->tree_cache_path);
+	mem_free0(merge->extracted_image_path);
+	mem_free0(merge);
+}
 
-	if (dir_mkdir_p(extracted_image_path, 0755) < 0) {
-		ERROR_ERRNO("Can't create dir %s", extracted_image_path);
-		goto out;
+/**
+ * Restores the tree of the longest prefix of the layers which is available in the
+ * tree cache into the (empty) extraction directory.
+ *
+ * @return the number of layers restored from the cache
+ */
+static int
+merge_layers_restore(merge_layers_t *merge)
+{
+	for (int i = merge->layers_size - 1; i >= 0; --i) {
+		char *tree = mem_printf("%s/%s", merge->tree_cache_path, merge->chain_ids[i]);
+		bool cached = file_is_dir(tree);
+		if (cached) {
+			INFO("Restoring layers[0..%d] from cache %s", i, tree);
+			if (util_copy_tree(tree, merge->extracted_image_path) < 0) {
+				ERROR("Failed to restore cached layers from %s", tree);
+				cached = false;
+			}
+		}
+		mem_free0(tree);
+		if (cached)
+			return i + 1;
+	}
+	return 0;
+}
+
+/**
+ * Creates the directories the layers of image_name are extracted to and squashed from.
+ * If tree_cache_path is set, the extracted trees of the image without its top layer
+ * and of the complete image are cached there. *cached_layers is set to the number of
+ * layers which are already extracted from the cache.
+ */
+static merge_layers_t *
+merge_layers_prepare_new(char *out_path, const char *image_name, const char *image_tag,
+			 const docker_manifest_t *manifest, const char *tree_cache_path,
+			 int *cached_layers)
+{
+	merge_layers_t *merge = mem_new0(merge_layers_t, 1);
+
+	// replace the slashes in docker image name, see main()
+	char *name = mem_strdup(image_name);
+	for (char *strp = name; (strp = strchr(strp, '/')) != NULL;)
+		*strp++ = '_';
+
+	char *target_image_path = mem_printf("%s/%s_%s", out_path, name, image_tag);
+	char *extracted_dir = mem_printf("%s_%s_extracted", name, image_tag);
+	merge->extracted_image_path = mem_printf("%s/%s", out_path, extracted_dir);
+
+	// layer i is identified by the digests of layers 0..i, similar to OCI ChainIDs
+	merge->layers_size = manifest->layers_size;
+	merge->chain_ids = mem_new0(char *, manifest->layers_size);
+	for (int i = 0; i < manifest->layers_size; ++i) {
+		if (i == 0) {
+			merge->chain_ids[i] = mem_strdup(manifest->layers[i]->digest);
+			continue;
+		}
+		char *chain = mem_printf("%s %s", merge->chain_ids[i - 1],
+					 manifest->layers[i]->digest);
+		merge->chain_ids[i] = util_hash_sha256_string_new(chain);
+		mem_free0(chain);
+	}
+
+	*cached_layers = 0;
+
+	// start from an empty tree, the layers are extracted on top of each other
+	if (file_is_dir(merge->extracted_image_path) &&
+	    dir_delete_folder(out_path, extracted_dir) < 0) {
+		ERROR("Can't clean up dir %s", merge->extracted_image_path);
+		goto err;
+	}
+	if (dir_mkdir_p(merge->extracted_image_path, 0755) < 0) {
+		ERROR_ERRNO("Can't create dir %s", merge->extracted_image_path);
+		goto err;
 	}
 	if (dir_mkdir_p(target_image_path, 0755) < 0) {
 		ERROR_ERRNO("Can't create dir %s", target_image_path);
-		goto out;
+		goto err;
 	}
 
-	for (int i = 0; i < manifest->layers_size; ++i) {
-		char *layer_file_name = mem_printf("%s/%s%s", in_path, manifest->layers[i]->digest,
-						   manifest->layers[i]->suffix);
-		INFO("Extracting layer[%d]: %s", i, layer_file_name);
-		if (-1 == util_tar_extract(layer_file_name, extracted_image_path)) {
-			ERROR_ERRNO("Failed to extract %s", layer_file_name);
-			mem_free0(layer_file_name);
-			goto out;
+	if (tree_cache_path) {
+		if (dir_mkdir_p(tree_cache_path, 0755) < 0) {
+			ERROR_ERRNO("Can't create tree cache dir %s", tree_cache_path);
+			goto err;
 		}
-		mem_free0(layer_file_name);
+		merge->tree_cache_path = mem_strdup(tree_cache_path);
+		*cached_layers = merge_layers_restore(merge);
 	}
-	image_file = mem_printf("%s/%s", target_image_path, IMAGE_NAME_ROOT);
-	if (util_squash_image(extracted_image_path, image_file) < 0) {
-		mem_free0(image_file);
-		image_file = NULL;
+
+	mem_free0(extracted_dir);
+	mem_free0(target_image_path);
+	mem_free0(name);
+	return merge;
+
+err:
+	mem_free0(extracted_dir);
+	mem_free0(target_image_path);
+	mem_free0(name);
+	merge_layers_free(merge);
+	return NULL;
+}
+
+/**
+ * Stores the tree extracted up to layer index in the tree cache.
+ */
+static void
+merge_layers_cache_tree(const merge_layers_t *merge, int index)
+{
+	char *tree = mem_printf("%s/%s", merge->tree_cache_path, merge->chain_ids[index]);
+	char *tree_tmp = mem_printf("%s.tmp", tree);
+	char *tree_tmp_name = mem_printf("%s.tmp", merge->chain_ids[index]);
+
+	IF_TRUE_GOTO(file_is_dir(tree), out);
+
+	if (file_is_dir(tree_tmp))
+		dir_delete_folder(merge->tree_cache_path, tree_tmp_name);
+
+	// copy to a temporary dir first, so that only complete trees are ever restored
+	if (dir_mkdir_p(tree_tmp, 0755) < 0 ||
+	    util_copy_tree(merge->extracted_image_path, tree_tmp) < 0 ||
+	    rename(tree_tmp, tree) < 0) {
+		WARN("Failed to cache extracted layers[0..%d] in %s", index, tree);
+		if (file_is_dir(tree_tmp))
+			dir_delete_folder(merge->tree_cache_path, tree_tmp_name);
 		goto out;
 	}
+	INFO("Cached extracted layers[0..%d] in %s", index, tree);
+
 out:
-	mem_free0(extracted_image_path);
+	mem_free0(tree_tmp_name);
+	mem_free0(tree_tmp);
+	mem_free0(tree);
+}
+
+/**
+ * Extracts a layer as soon as it and all preceding layers are downloaded,
+ * see docker_download_image().
+ */
+static int
+merge_layers_extract_cb(const char *layer_file, int index, void *data)
+{
+	merge_layers_t *merge = data;
+
+	INFO("Extracting layer[%d]: %s", index, layer_file);
+	if (-1 == util_tar_extract(layer_file, merge->extracted_image_path)) {
+		ERROR_ERRNO("Failed to extract %s", layer_file);
+		return -1;
+	}
+
+	// an update of the image usually only changes the top layer
+	if (merge->tree_cache_path && index >= merge->layers_size - 2)
+		merge_layers_cache_tree(merge, index);
+
+	return 0;
+}
+
+char *
+merge_layers_new(const char *extracted_image_path, char *out_path, char *image_name,
+		 char *image_tag, const util_image_opts_t *image_opts)
+{
+	char *image_file =
+		mem_printf("%s/%s_%s/%s", out_path, image_name, image_tag, IMAGE_NAME_ROOT);
+	if (util_create_image(image_opts, extracted_image_path, image_file) < 0) {
+		mem_free0(image_file);
+		image_file = NULL;
+	}
+	return image_file;
+}
+
+/**
+ * Indexes a layer for the streamed merge as soon as it and all preceding layers are
+ * downloaded, see docker_download_image().
+ */
+static int
+merge_layers_stream_cb(const char *layer_file, int index, void *data)
+{
+	tarmerge_t *tarmerge = data;
+
+	INFO("Indexing layer[%d]: %s", index, layer_file);
+	if (tarmerge_add_layer(tarmerge, layer_file) < 0) {
+		ERROR("Failed to index %s", layer_file);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+merge_layers_stream_write_cb(int fd, void *data)
+{
+	return tarmerge_write(data, fd);
+}
+
+/**
+ * Creates the image from the merged tar stream of the layers directly, without
+ * extracting them.
+ */
+static char *
+merge_layers_stream_new(tarmerge_t *tarmerge, char *out_path, char *image_name,
+			char *image_tag, const util_image_opts_t *image_opts)
+{
+	char *target_image_path = mem_printf("%s/%s_%s", out_path, image_name, image_tag);
+	char *image_file = mem_printf("%s/%s", target_image_path, IMAGE_NAME_ROOT);
+
+	if (dir_mkdir_p(target_image_path, 0755) < 0) {
+		ERROR_ERRNO("Can't create dir %s", target_image_path);
+		goto err;
+	}
+	if (util_create_image_from_tar(image_opts, merge_layers_stream_write_cb, tarmerge,
+				       image_file) < 0)
+		goto err;
+
 	mem_free0(target_image_path);
 	return image_file;
+err:
+	mem_free0(target_image_path);
+	mem_free0(image_file);
+	return NULL;
 }
 
 void
@@ -309,14 +515,29 @@ print_usage(char *progname)
 	      " -r <hostname:port>",
 	      progname);
 	ERROR("Usage: %s pull [-r <hostname:port>] [-a <arch>]"
+	      " [-c <cache dir> [-x] | -s] [-e] [-z <algorithm> [-l <level>]] [-b <block size>]"
 	      " <imagename> [-t <imagetag>]",
 	      progname);
+	ERROR("  -c, --cache            keep downloaded layers in <cache dir> across runs");
+	ERROR("  -x, --cache-extracted  also cache the extracted layers in <cache dir>/trees");
+	ERROR("  -s, --stream           build the image from the layers without extracting them");
+	ERROR("  -e, --erofs            create an EROFS instead of a squashfs image");
+	ERROR("  -z, --compression      compression algorithm of the image, e.g. lz4 or zstd");
+	ERROR("  -l, --level            compression level, selects -Xhc for lz4 squashfs");
+	ERROR("  -b, --block-size       block size of the image in bytes, a power of 2 (4K - 1M)");
 	exit(-1);
 }
 
 static const struct option pull_options[] = { { "registry", optional_argument, 0, 'r' },
 					      { "arch", optional_argument, 0, 'a' },
 					      { "tag", optional_argument, 0, 't' },
+					      { "cache", required_argument, 0, 'c' },
+					      { "cache-extracted", no_argument, 0, 'x' },
+					      { "stream", no_argument, 0, 's' },
+					      { "erofs", no_argument, 0, 'e' },
+					      { "compression", required_argument, 0, 'z' },
+					      { "level", required_argument, 0, 'l' },
+					      { "block-size", required_argument, 0, 'b' },
 					      { "help", no_argument, 0, 'h' },
 					      { 0, 0, 0, 0 } };
 
@@ -341,6 +562,15 @@ main(UNUSED int argc, char **argv)
 	docker_config_t *config = NULL;
 	char *trustx_image_path = NULL;
 	char *trustx_image_file = NULL;
+	merge_layers_t *merge = NULL;
+	const char *cache_path = NULL;
+	bool cache_extracted = false;
+	bool stream = false;
+	util_image_opts_t image_opts = { .fs = UTIL_IMAGE_FS_SQUASHFS };
+	tarmerge_t *tarmerge = NULL;
+	int cached_layers = 0;
+	char *blob_path = NULL;
+	char *tree_cache_path = NULL;
 
 	docker_manifest_list_t *ml = NULL;
 	char *manifest_url_digest = NULL;
@@ -369,8 +599,8 @@ main(UNUSED int argc, char **argv)
 		image_arch = "amd64";
 		image_tag = "latest";
 		for (int c, option_index = 0;
-		     - 1 != (c = getopt_long(pull_argc, pull_argv, "t:r:a:", pull_options,
-					     &option_index));) {
+		     - 1 != (c = getopt_long(pull_argc, pull_argv, "t:r:a:c:xsez:l:b:",
+					     pull_options, &option_index));) {
 			switch (c) {
 			case 'r':
 				url = optarg ? optarg : "registry-1.docker.io";
@@ -381,6 +611,32 @@ main(UNUSED int argc, char **argv)
 			case 'a':
 				image_arch = optarg ? optarg : "amd64";
 				break;
+			case 'c':
+				cache_path = optarg;
+				break;
+			case 'x':
+				cache_extracted = true;
+				break;
+			case 's':
+				stream = true;
+				break;
+			case 'e':
+				image_opts.fs = UTIL_IMAGE_FS_EROFS;
+				break;
+			case 'z':
+				image_opts.comp = optarg;
+				break;
+			case 'l':
+				image_opts.comp_level = atoi(optarg);
+				break;
+			case 'b':
+				image_opts.block_size = strtoul(optarg, NULL, 0);
+				uint32_t bs = image_opts.block_size;
+				if (bs < 4096 || bs > 1048576 || (bs & (bs - 1))) {
+					ERROR("Invalid block size %s", optarg);
+					print_usage(argv[0]);
+				}
+				break;
 			default:
 				print_usage(argv[0]);
 			}
@@ -493,16 +749,50 @@ main(UNUSED int argc, char **argv)
 	mem_free0(buf);
 	buf = NULL;
 
-	if (docker_download_image(token, manifest, docker_image_path, image_name, image_tag) < 0) {
-		ERROR("Downloading image %s failed!", image_name);
+	trustx_image_path = mem_printf("%s/%s", WORK_PATH, "trustx_image");
+	if (dir_mkdir_p(trustx_image_path, 0755) < 0) {
+		ERROR_ERRNO("Can't create out dir %s", trustx_image_path);
 		goto err;
 	}
 
+	// blobs are cached by their digests, extracted trees by the digests of all layers
+	// up to the respective layer
+	blob_path = mem_strdup(cache_path ? cache_path : docker_image_path);
+	if (dir_mkdir_p(blob_path, 0755) < 0) {
+		ERROR_ERRNO("Can't create cache dir %s", blob_path);
+		goto err;
+	}
+	if (cache_extracted && stream)
+		WARN("Extracted layers are not cached when streaming the layers");
+	else if (cache_extracted)
+		tree_cache_path = mem_printf("%s/trees", blob_path);
+
+	if (stream) {
+		// the layers are indexed while the remaining ones are still being downloaded
+		tarmerge = tarmerge_new();
+		if (docker_download_image(token, manifest, blob_path, image_name, image_tag, 0,
+					  merge_layers_stream_cb, tarmerge) < 0) {
+			ERROR("Downloading image %s failed!", image_name);
+			goto err;
+		}
+	} else {
+		merge = merge_layers_prepare_new(trustx_image_path, image_name, image_tag,
+						 manifest, tree_cache_path, &cached_layers);
+		IF_NULL_GOTO_ERROR(merge, err);
+
+		// the layers are extracted while the remaining ones are still being downloaded
+		if (docker_download_image(token, manifest, blob_path, image_name, image_tag,
+					  cached_layers, merge_layers_extract_cb, merge) < 0) {
+			ERROR("Downloading image %s failed!", image_name);
+			goto err;
+		}
+	}
+
 	INFO("Cleaning up token_file: %s", token_file);
 	if (file_exists(token_file))
 		remove(token_file);
 
-	config_file_name = mem_printf("%s/%s%s", docker_image_path, manifest->config->digest,
+	config_file_name = mem_printf("%s/%s%s", blob_path, manifest->config->digest,
 				      manifest->config->suffix);
 	DEBUG("Trying to read config %s", config_file_name);
 	buf = file_read_new(config_file_name, BUF_SIZE);
@@ -518,26 +808,33 @@ main(UNUSED int argc, char **argv)
 	while ((strp = strchr(strp, '/')) != NULL)
 		*strp++ = '_';
 
-	trustx_image_path = mem_printf("%s/%s", WORK_PATH, "trustx_image");
-	if (dir_mkdir_p(trustx_image_path, 0755) < 0) {
-		ERROR_ERRNO("Can't create out dir %s", trustx_image_path);
-		goto err;
-	}
-
-	trustx_image_file = merge_layers_new(manifest, docker_image_path, trustx_image_path,
-					     image_name, image_tag);
+	if (stream)
+		trustx_image_file = merge_layers_stream_new(tarmerge, trustx_image_path,
+							    image_name, image_tag, &image_opts);
+	else
+		trustx_image_file = merge_layers_new(merge->extracted_image_path,
+						     trustx_image_path, image_name, image_tag,
+						     &image_opts);
 	if (NULL == trustx_image_file) {
 		ERROR("Failed to merge layers resulting image file is NULL!");
 		goto err;
 	}
 
-	write_guestos_config(config, trustx_image_file, trustx_image_path, image_name, image_tag);
+	write_guestos_config(config, trustx_image_file, trustx_image_path, image_name, image_tag,
+			     &image_opts);
 
 	mem_free0(manifest_list_file);
 	mem_free0(manifest_file);
 	mem_free0(docker_image_path);
 	mem_free0(trustx_image_path);
 	mem_free0(trustx_image_file);
+	mem_free0(blob_path);
+	if (tree_cache_path)
+		mem_free0(tree_cache_path);
+	if (merge)
+		merge_layers_free(merge);
+	if (tarmerge)
+		tarmerge_free(tarmerge);
 
 	docker_manifest_free(manifest);
 	docker_config_free(config);
@@ -566,6 +863,14 @@ err:
 		mem_free0(trustx_image_path);
 	if (trustx_image_file)
 		mem_free0(trustx_image_file);
+	if (blob_path)
+		mem_free0(blob_path);
+	if (tree_cache_path)
+		mem_free0(tree_cache_path);
+	if (merge)
+		merge_layers_free(merge);
+	if (tarmerge)
+		tarmerge_free(tarmerge);
 
 	if (manifest)
 		docker_manifest_free(manifest);
@@ -30,13 +30,22 @@
 #include "common/list.h"
 #include "common/mem.h"
 #include "common/proc.h"
+#include "common/fd.h"
+#include "common/hex.h"
 
 #include "cJSON/cJSON.h"
 #include "util.h"
 
 #include <unistd.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/wait.h>
 
+#include <curl/curl.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
 #define BUF_SIZE 10 * 4096
 #define CURL_PATH "curl"
 
@@ -44,6 +53,22 @@
 #define MEDIA_TYPE_MANIFEST_V2 "application/vnd.docker.distribution.manifest.v2+json"
 #define MEDIA_TYPE_MANIFEST_V1 "application/vnd.docker.distribution.manifest.v1+json"
 
+// maximum number of concurrent blob downloads
+#define DOCKER_DOWNLOAD_JOBS 4
+
+typedef struct {
+	const char *curl_token;
+	const char *out_path;
+	const char *image_name;
+	docker_remote_file_t **files;
+	int n;
+	pthread_mutex_t lock; // protects next, status and abort
+	pthread_cond_t cond;  // signalled on status changes
+	int next;
+	int *status; // 0 pending, 1 downloaded and verified, -1 failed
+	bool abort;
+} docker_download_job_t;
+
 static char *host_url = NULL;
 
 static void
@@ -490,8 +515,71 @@ docker_download_manifest(const char *curl_token, const char *out_file, const cha
 	return ret;
 }
 
+typedef struct {
+	int fd;
+	EVP_MD_CTX *ctx;
+} docker_blob_sink_t;
+
+static size_t
+docker_blob_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	docker_blob_sink_t *sink = userdata;
+	size_t len = size * nmemb;
+
+	// a short count makes curl abort the transfer
+	if (fd_write(sink->fd, ptr, len) < 0 || !EVP_DigestUpdate(sink->ctx, ptr, len))
+		return 0;
+	return len;
+}
+
+/**
+ * Downloads url to out_file using the connections cached in curl, hashing the blob
+ * while it streams in. This is the equivalent of 'curl -fsSL -H <auth> <url>'.
+ *
+ * @return the hex encoded SHA-256 digest of the blob, or NULL if the download failed
+ */
+static char *
+docker_curl_blob_sha256_new(CURL *curl, const char *url, const char *auth, const char *out_file)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	char *hash = NULL;
+
+	docker_blob_sink_t sink = { .fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					       0644) };
+	if (sink.fd < 0) {
+		ERROR_ERRNO("Could not open %s", out_file);
+		return NULL;
+	}
+	sink.ctx = EVP_MD_CTX_new();
+	EVP_DigestInit(sink.ctx, EVP_sha256());
+
+	struct curl_slist *headers = curl_slist_append(NULL, auth);
+
+	curl_easy_reset(curl);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, docker_blob_write_cb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+
+	CURLcode res = curl_easy_perform(curl);
+	if (res != CURLE_OK)
+		TRACE("Download of %s failed: %s", url, curl_easy_strerror(res));
+
+	EVP_DigestFinal(sink.ctx, digest, NULL);
+	if (res == CURLE_OK)
+		hash = convert_bin_to_hex_new(digest, SHA256_DIGEST_LENGTH);
+
+	EVP_MD_CTX_free(sink.ctx);
+	curl_slist_free_all(headers);
+	close(sink.fd);
+	return hash;
+}
+
 static int
-download_docker_remote_file(const char *curl_token, const docker_remote_file_t *rf,
+download_docker_remote_file(CURL *curl, const char *curl_token, const docker_remote_file_t *rf,
 			    const char *out_path, const char *image_name)
 {
 	int ret = 0;
@@ -501,9 +589,10 @@ download_docker_remote_file(const char *curl_token, const docker_remote_file_t *
 
 	if (file_exists(out_file) && file_size(out_file) == rf->size) {
 		image_hash = util_hash_sha256_image_file_new(out_file);
-		if (!strncmp(image_hash, rf->digest, strlen(image_hash))) {
+		if (image_hash && !strncmp(image_hash, rf->digest, strlen(image_hash))) {
 			INFO("File %s already downloaded!", rf->digest);
 			mem_free0(image_hash);
+			mem_free0(out_file);
 			return ret;
 		}
 		mem_free0(image_hash);
@@ -516,54 +605,149 @@ download_docker_remote_file(const char *curl_token, const docker_remote_file_t *
 
 	char *auth_basic = mem_printf("Authorization: Basic %s", curl_token);
 	char *auth_bearer = mem_printf("Authorization: Bearer %s", curl_token);
-	const char *const argv_bearer[] = { CURL_PATH, "-fSL", "--progress", "-H", auth_bearer,
-					    url,       "-o",   out_file,     NULL };
-	const char *const argv_basic[] = { CURL_PATH, "-fSL", "--progress", "-H", auth_basic,
-					   url,	      "-o",   out_file,	    NULL };
 
-	ret = proc_fork_and_execvp(argv_bearer);
-	if (ret != 0)
-		ret = proc_fork_and_execvp(argv_basic);
+	INFO("Downloading file %s (%d bytes)", rf->digest, rf->size);
+	image_hash = docker_curl_blob_sha256_new(curl, url, auth_bearer, out_file);
+	if (!image_hash)
+		image_hash = docker_curl_blob_sha256_new(curl, url, auth_basic, out_file);
 
 	mem_free0(url);
 	mem_free0(auth_basic);
 	mem_free0(auth_bearer);
 
-	if (ret < 0) {
-		ERROR("Download failed!");
-		return ret;
-	}
-
-	image_hash = util_hash_sha256_image_file_new(out_file);
-	if (strncmp(image_hash, rf->digest, strlen(image_hash))) {
-		ERROR("SHA256 sum missmatch!");
+	if (!image_hash) {
+		ERROR("Download of file %s failed!", rf->digest);
 		ret = -1;
+	} else if (strncmp(image_hash, rf->digest, strlen(image_hash))) {
+		ERROR("SHA256 sum missmatch for file %s!", rf->digest);
+		ret = -1;
+	} else {
+		INFO("Download of file %s completed!", rf->digest);
 	}
-	INFO("Download of file %s completed!", rf->digest);
 
 	if (image_hash)
 		mem_free0(image_hash);
+	mem_free0(out_file);
 
 	return ret;
 }
 
+static void *
+docker_download_worker(void *data)
+{
+	docker_download_job_t *job = data;
+
+	// the handle of each worker keeps its connections to the registry alive
+	CURL *curl = curl_easy_init();
+	if (!curl)
+		ERROR("Failed to initialize curl handle");
+
+	while (true) {
+		pthread_mutex_lock(&job->lock);
+		int i = job->next++;
+		bool abort = job->abort;
+		pthread_mutex_unlock(&job->lock);
+
+		if (abort || i >= job->n)
+			break;
+
+		// without handle, the taken file fails and thereby aborts the whole job
+		int ret = curl ? download_docker_remote_file(curl, job->curl_token, job->files[i],
+							     job->out_path, job->image_name) :
+				 -1;
+
+		pthread_mutex_lock(&job->lock);
+		job->status[i] = (ret < 0) ? -1 : 1;
+		if (ret < 0)
+			job->abort = true;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	if (curl)
+		curl_easy_cleanup(curl);
+	return NULL;
+}
+
 int
 docker_download_image(char *curl_token, const docker_manifest_t *manifest, const char *out_path,
-		      const char *image_name, const char *image_tag)
+		      const char *image_name, const char *image_tag, int skip_layers,
+		      int (*layer_cb)(const char *layer_file, int index, void *data), void *data)
 {
-	int ret = download_docker_remote_file(curl_token, manifest->config, out_path, image_name);
-	if (ret < 0) {
-		ERROR("Failed to download %s!", manifest->config->digest);
+	pthread_t threads[DOCKER_DOWNLOAD_JOBS];
+	int nthreads = 0;
+	int ret = -1;
+
+	skip_layers = MAX(0, MIN(skip_layers, manifest->layers_size));
+
+	// the config is downloaded first, followed by the layers in order
+	docker_download_job_t job = { .curl_token = curl_token,
+				      .out_path = out_path,
+				      .image_name = image_name,
+				      .n = manifest->layers_size - skip_layers + 1 };
+	job.files = mem_new0(docker_remote_file_t *, job.n);
+	job.status = mem_new0(int, job.n);
+	job.files[0] = manifest->config;
+	for (int i = skip_layers; i < manifest->layers_size; ++i)
+		job.files[i - skip_layers + 1] = manifest->layers[i];
+
+	// not thread-safe, thus initialized before the workers are started
+	if (curl_global_init(CURL_GLOBAL_DEFAULT)) {
+		ERROR("Failed to initialize curl");
+		mem_free0(job.files);
+		mem_free0(job.status);
 		return -1;
 	}
-	for (int i = 0; i < manifest->layers_size; ++i) {
-		ret = download_docker_remote_file(curl_token, manifest->layers[i], out_path,
-						  image_name);
-		if (ret < 0) {
-			ERROR("Failed to download %s!", manifest->config->digest);
-			return -1;
+
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	for (; nthreads < MIN(DOCKER_DOWNLOAD_JOBS, job.n); nthreads++) {
+		if (pthread_create(&threads[nthreads], NULL, docker_download_worker, &job)) {
+			ERROR("Failed to start download thread");
+			break;
 		}
 	}
+	IF_TRUE_GOTO_ERROR(nthreads == 0, out);
+
+	// hand out the layers in order as soon as they and all preceding ones are verified
+	for (int i = 0; i < job.n; ++i) {
+		pthread_mutex_lock(&job.lock);
+		while (job.status[i] == 0)
+			pthread_cond_wait(&job.cond, &job.lock);
+		int status = job.status[i];
+		pthread_mutex_unlock(&job.lock);
+
+		if (status < 0) {
+			ERROR("Failed to download %s!", job.files[i]->digest);
+			goto abort;
+		}
+
+		if (i > 0 && layer_cb) {
+			char *layer_file = mem_printf("%s/%s%s", out_path, job.files[i]->digest,
+						      job.files[i]->suffix);
+			int cb_ret = layer_cb(layer_file, skip_layers + i - 1, data);
+			mem_free0(layer_file);
+			if (cb_ret < 0)
+				goto abort;
+		}
+	}
+
 	INFO("Download image %s:%s completed!", image_name, image_tag);
-	return 0;
+	ret = 0;
+
+abort:
+	pthread_mutex_lock(&job.lock);
+	job.abort = true;
+	pthread_mutex_unlock(&job.lock);
+out:
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.lock);
+	curl_global_cleanup();
+	mem_free0(job.files);
+	mem_free0(job.status);
+	return ret;
 }
@@ -99,9 +99,20 @@ int
 docker_download_manifest(const char *curl_token, const char *out_file, const char *image_name,
 			 const char *image_tag);
 
+/**
+ * Downloads the config and the layers of the image described by manifest to out_path,
+ * with a bounded number of concurrent downloads. Each blob's digest is verified while
+ * it is downloaded. layer_cb, if set, is called for the layers in order, as soon as a
+ * layer and all preceding ones are available, e.g., to extract them while the
+ * remaining layers are still being downloaded. The first skip_layers layers are
+ * neither downloaded nor passed to layer_cb, e.g., if they are already extracted.
+ *
+ * @return 0 on success, -1 if a download or layer_cb failed
+ */
 int
 docker_download_image(char *curl_token, const docker_manifest_t *manifest, const char *out_path,
-		      const char *image_name, const char *image_tag);
+		      const char *image_name, const char *image_tag, int skip_layers,
+		      int (*layer_cb)(const char *layer_file, int index, void *data), void *data);
 
 /* functions for accessing docker registry */
 void
@@ -0,0 +1,642 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#define _GNU_SOURCE
+
+#include "tarmerge.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/list.h"
+#include "common/hashmap.h"
+#include "common/fd.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#define GZIP_PATH "gzip"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_PAD(len) (((len) + TAR_BLOCK_SIZE - 1) & ~((uint64_t)TAR_BLOCK_SIZE - 1))
+// upper bound for pax and GNU long name headers
+#define TAR_EXT_HDR_MAX (1024 * 1024)
+
+#define WHITEOUT_PREFIX ".wh."
+#define WHITEOUT_OPAQUE ".wh..wh..opq"
+
+typedef struct {
+	char *path; // normalized, i.e., without leading "./" and trailing "/"
+	int layer;
+	size_t seq; // position of the entry in its layer
+	bool is_dir;
+	uint8_t *raw; // headers of a directory, directories are written before all files
+	size_t raw_len;
+} tarmerge_entry_t;
+
+struct tarmerge {
+	hashmap_t *entries; // path -> tarmerge_entry_t of the merged image
+	list_t *layers;	    // layer files, bottom to top
+	int n_layers;
+};
+
+// an entry read from a layer, raw includes the preceding extended headers
+typedef struct {
+	uint8_t *raw;
+	size_t raw_len;
+	char *path;
+	char typeflag;
+	uint64_t data_len; // without padding
+} tarmerge_hdr_t;
+
+typedef struct {
+	int fd;
+	pid_t pid; // gzip decompressing the layer, or -1
+} tarmerge_layer_t;
+
+static void
+tarmerge_entry_free(tarmerge_entry_t *entry)
+{
+	if (entry->raw)
+		mem_free0(entry->raw);
+	mem_free0(entry->path);
+	mem_free0(entry);
+}
+
+static void
+tarmerge_hdr_clear(tarmerge_hdr_t *hdr)
+{
+	if (hdr->raw)
+		mem_free0(hdr->raw);
+	if (hdr->path)
+		mem_free0(hdr->path);
+	memset(hdr, 0, sizeof(*hdr));
+}
+
+static int
+tarmerge_layer_open(tarmerge_layer_t *layer, const char *file)
+{
+	uint8_t magic[2] = { 0 };
+	int pipefd[2];
+
+	layer->pid = -1;
+	layer->fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (layer->fd < 0) {
+		ERROR_ERRNO("Could not open layer %s", file);
+		return -1;
+	}
+
+	// uncompressed layers are read directly
+	if (fd_read(layer->fd, (char *)magic, sizeof(magic)) != sizeof(magic) ||
+	    magic[0] != 0x1f || magic[1] != 0x8b) {
+		if (lseek(layer->fd, 0, SEEK_SET) < 0) {
+			ERROR_ERRNO("Could not rewind layer %s", file);
+			close(layer->fd);
+			return -1;
+		}
+		return 0;
+	}
+	close(layer->fd);
+
+	// close-on-exec, as concurrently forked children must not inherit the write end
+	if (pipe2(pipefd, O_CLOEXEC) < 0) {
+		ERROR_ERRNO("Could not create pipe for %s", GZIP_PATH);
+		return -1;
+	}
+
+	layer->pid = fork();
+	if (layer->pid == -1) {
+		ERROR_ERRNO("Could not fork for %s", GZIP_PATH);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	} else if (layer->pid == 0) {
+		if (dup2(pipefd[1], STDOUT_FILENO) < 0)
+			_exit(127);
+		execlp(GZIP_PATH, GZIP_PATH, "-dc", file, (char *)NULL);
+		_exit(127);
+	}
+
+	close(pipefd[1]);
+	layer->fd = pipefd[0];
+	return 0;
+}
+
+static int
+tarmerge_layer_close(tarmerge_layer_t *layer)
+{
+	char buf[TAR_BLOCK_SIZE];
+	int status;
+
+	if (layer->pid < 0) {
+		close(layer->fd);
+		return 0;
+	}
+
+	// drain the stream behind the end of the archive, so that gzip terminates normally
+	while (fd_read(layer->fd, buf, sizeof(buf)) > 0)
+		;
+	close(layer->fd);
+
+	while (waitpid(layer->pid, &status, 0) != layer->pid) {
+		if (errno != EINTR) {
+			ERROR_ERRNO("Could not wait for %s", GZIP_PATH);
+			return -1;
+		}
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		ERROR("Failed to decompress layer");
+		return -1;
+	}
+	return 0;
+}
+
+static uint64_t
+tarmerge_parse_num(const uint8_t *field, size_t len)
+{
+	uint64_t val = 0;
+
+	// base-256 encoding of large values (GNU extension)
+	if (field[0] & 0x80) {
+		val = field[0] & 0x7f;
+		for (size_t i = 1; i < len; i++)
+			val = (val << 8) | field[i];
+		return val;
+	}
+
+	for (size_t i = 0; i < len && field[i]; i++) {
+		if (field[i] == ' ')
+			continue;
+		if (field[i] < '0' || field[i] > '7')
+			break;
+		val = (val << 3) | (field[i] - '0');
+	}
+	return val;
+}
+
+static bool
+tarmerge_block_is_valid(const uint8_t *block)
+{
+	uint64_t sum = 0;
+
+	// the checksum field itself is summed up as spaces
+	for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+		sum += (i >= 148 && i < 156) ? ' ' : block[i];
+
+	return sum == tarmerge_parse_num(block + 148, 8);
+}
+
+static bool
+tarmerge_block_is_zero(const uint8_t *block)
+{
+	for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+		if (block[i])
+			return false;
+	}
+	return true;
+}
+
+static void
+tarmerge_hdr_append_raw(tarmerge_hdr_t *hdr, const uint8_t *buf, size_t len)
+{
+	hdr->raw = mem_realloc(hdr->raw, hdr->raw_len + len);
+	memcpy(hdr->raw + hdr->raw_len, buf, len);
+	hdr->raw_len += len;
+}
+
+/**
+ * Extracts the path from the records "<len> <key>=<value>\n" of a pax header.
+ */
+static void
+tarmerge_pax_parse(const char *data, size_t len, char **path)
+{
+	size_t off = 0;
+
+	while (off < len) {
+		char *end = NULL;
+		unsigned long rec_len = strtoul(data + off, &end, 10);
+		if (end == data + off || *end != ' ' || rec_len == 0 || off + rec_len > len ||
+		    (size_t)(end + 1 - data) >= off + rec_len)
+			break;
+
+		const char *kv = end + 1;
+		size_t kv_len = data + off + rec_len - 1 - kv; // without trailing '\n'
+		if (kv_len > 5 && !strncmp(kv, "path=", 5)) {
+			if (*path)
+				mem_free0(*path);
+			*path = mem_strndup(kv + 5, kv_len - 5);
+		}
+		off += rec_len;
+	}
+}
+
+/**
+ * Reads the next entry header including its extended headers from fd.
+ *
+ * @return 1 if an entry was read, 0 at the end of the archive, -1 on error
+ */
+static int
+tarmerge_hdr_read(int fd, tarmerge_hdr_t *hdr)
+{
+	uint8_t block[TAR_BLOCK_SIZE];
+	char *long_name = NULL;
+	char *pax_path = NULL;
+	int ret = -1;
+
+	memset(hdr, 0, sizeof(*hdr));
+
+	while (true) {
+		int len = fd_read(fd, (char *)block, TAR_BLOCK_SIZE);
+		if (len == 0 || (len == TAR_BLOCK_SIZE && tarmerge_block_is_zero(block))) {
+			ret = 0;
+			goto out;
+		}
+		if (len != TAR_BLOCK_SIZE) {
+			ERROR("Truncated tar header");
+			goto out;
+		}
+		if (!tarmerge_block_is_valid(block)) {
+			ERROR("Invalid tar header checksum");
+			goto out;
+		}
+
+		char typeflag = block[156];
+		uint64_t size = tarmerge_parse_num(block + 124, 12);
+		tarmerge_hdr_append_raw(hdr, block, TAR_BLOCK_SIZE);
+
+		if (typeflag != 'x' && typeflag != 'g' && typeflag != 'L' && typeflag != 'K') {
+			if (pax_path) {
+				hdr->path = pax_path;
+				pax_path = NULL;
+			} else if (long_name) {
+				hdr->path = long_name;
+				long_name = NULL;
+			} else if (!memcmp(block + 257, "ustar", 5) && block[345]) {
+				hdr->path = mem_printf("%.155s/%.100s", block + 345, block);
+			} else {
+				hdr->path = mem_printf("%.100s", block);
+			}
+			hdr->typeflag = typeflag;
+			// links, devices, directories and fifos have no data
+			hdr->data_len = (typeflag && strchr("123456", typeflag)) ? 0 : size;
+			ret = 1;
+			goto out;
+		}
+
+		if (size > TAR_EXT_HDR_MAX) {
+			ERROR("Extended tar header too large (%" PRIu64 " bytes)", size);
+			goto out;
+		}
+
+		// zero terminated for parsing
+		size_t padded = TAR_PAD(size);
+		char *data = mem_alloc0(padded + 1);
+		if (fd_read(fd, data, padded) != (int)padded) {
+			ERROR("Truncated extended tar header");
+			mem_free0(data);
+			goto out;
+		}
+		tarmerge_hdr_append_raw(hdr, (uint8_t *)data, padded);
+
+		if (typeflag == 'x') {
+			tarmerge_pax_parse(data, size, &pax_path);
+		} else if (typeflag == 'L') {
+			if (long_name)
+				mem_free0(long_name);
+			long_name = mem_strdup(data);
+		}
+		mem_free0(data);
+	}
+
+out:
+	if (pax_path)
+		mem_free0(pax_path);
+	if (long_name)
+		mem_free0(long_name);
+	if (ret <= 0)
+		tarmerge_hdr_clear(hdr);
+	return ret;
+}
+
+/**
+ * Copies the padded data of an entry from fd to out_fd, or skips it if out_fd is -1.
+ */
+static int
+tarmerge_data_copy(int fd, uint64_t len, int out_fd)
+{
+	char buf[64 * TAR_BLOCK_SIZE];
+	uint64_t remain = TAR_PAD(len);
+
+	while (remain) {
+		size_t n = MIN(remain, sizeof(buf));
+		if (fd_read(fd, buf, n) != (int)n) {
+			ERROR("Truncated tar entry");
+			return -1;
+		}
+		if (out_fd >= 0 && fd_write(out_fd, buf, n) < 0)
+			return -1;
+		remain -= n;
+	}
+	return 0;
+}
+
+static char *
+tarmerge_path_normalize_new(const char *path)
+{
+	while (path[0] == '/' || !strncmp(path, "./", 2))
+		path += (path[0] == '/') ? 1 : 2;
+
+	char *normalized = mem_strdup(path);
+	size_t len = strlen(normalized);
+	while (len && normalized[len - 1] == '/')
+		normalized[--len] = '\0';
+
+	// the root directory is not part of the merged image
+	if (!strcmp(normalized, "."))
+		normalized[0] = '\0';
+
+	return normalized;
+}
+
+typedef struct {
+	const char *prefix;
+	size_t prefix_len;
+	int layer;
+	list_t *matches;
+} tarmerge_match_t;
+
+static void
+tarmerge_match_cb(const void *key, void *value, void *data)
+{
+	tarmerge_match_t *match = data;
+	tarmerge_entry_t *entry = value;
+
+	if (entry->layer < match->layer && !strncmp(key, match->prefix, match->prefix_len))
+		match->matches = list_prepend(match->matches, entry);
+}
+
+static void
+tarmerge_remove(tarmerge_t *merge, tarmerge_entry_t *entry)
+{
+	hashmap_remove(merge->entries, entry->path);
+	tarmerge_entry_free(entry);
+}
+
+/**
+ * Removes the entries of the layers below layer which are located below path, and
+ * path itself unless below_only is set. An empty path denotes the root directory.
+ */
+static void
+tarmerge_remove_lower(tarmerge_t *merge, const char *path, bool below_only, int layer)
+{
+	if (!below_only) {
+		tarmerge_entry_t *entry = hashmap_get(merge->entries, path);
+		if (entry && entry->layer < layer)
+			tarmerge_remove(merge, entry);
+	}
+
+	char *prefix = path[0] ? mem_printf("%s/", path) : mem_strdup("");
+	tarmerge_match_t match = { .prefix = prefix, .prefix_len = strlen(prefix), .layer = layer };
+	hashmap_foreach(merge->entries, tarmerge_match_cb, &match);
+
+	for (list_t *l = match.matches; l; l = l->next)
+		tarmerge_remove(merge, l->data);
+
+	list_delete(match.matches);
+	mem_free0(prefix);
+}
+
+static void
+tarmerge_index_entry(tarmerge_t *merge, tarmerge_hdr_t *hdr, int layer, size_t seq)
+{
+	char *path = tarmerge_path_normalize_new(hdr->path);
+	if (!path[0]) {
+		mem_free0(path);
+		return;
+	}
+
+	char *base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+
+	// whiteouts hide entries of the lower layers and are not part of the image
+	if (!strncmp(base, WHITEOUT_PREFIX, strlen(WHITEOUT_PREFIX))) {
+		char *target;
+		if (!strcmp(base, WHITEOUT_OPAQUE)) {
+			target = mem_strndup(path, (base > path) ? base - path - 1 : 0);
+			tarmerge_remove_lower(merge, target, true, layer);
+		} else {
+			target = mem_printf("%.*s%s", (int)(base - path), path,
+					    base + strlen(WHITEOUT_PREFIX));
+			tarmerge_remove_lower(merge, target, false, layer);
+		}
+		mem_free0(target);
+		mem_free0(path);
+		return;
+	}
+
+	bool is_dir = hdr->typeflag == '5';
+
+	// a non-directory replacing a directory hides its contents
+	tarmerge_entry_t *old = hashmap_get(merge->entries, path);
+	if (!is_dir && old && old->is_dir)
+		tarmerge_remove_lower(merge, path, true, layer);
+
+	// non-directories replaced by a directory in the path
+	for (char *s = strchr(path, '/'); s; s = strchr(s + 1, '/')) {
+		*s = '\0';
+		tarmerge_entry_t *parent = hashmap_get(merge->entries, path);
+		if (parent && !parent->is_dir)
+			tarmerge_remove(merge, parent);
+		*s = '/';
+	}
+
+	tarmerge_entry_t *entry = mem_new0(tarmerge_entry_t, 1);
+	entry->path = path;
+	entry->layer = layer;
+	entry->seq = seq;
+	entry->is_dir = is_dir;
+	if (is_dir) {
+		entry->raw = hdr->raw;
+		entry->raw_len = hdr->raw_len;
+		hdr->raw = NULL;
+	}
+
+	old = hashmap_put(merge->entries, entry->path, entry);
+	if (old)
+		tarmerge_entry_free(old);
+}
+
+tarmerge_t *
+tarmerge_new(void)
+{
+	tarmerge_t *merge = mem_new0(tarmerge_t, 1);
+	merge->entries = hashmap_new_str();
+	return merge;
+}
+
+static void
+tarmerge_free_cb(UNUSED const void *key, void *value, UNUSED void *data)
+{
+	tarmerge_entry_free(value);
+}
+
+void
+tarmerge_free(tarmerge_t *merge)
+{
+	IF_NULL_RETURN(merge);
+
+	hashmap_foreach(merge->entries, tarmerge_free_cb, NULL);
+	hashmap_free(merge->entries);
+	for (list_t *l = merge->layers; l; l = l->next)
+		mem_free0(l->data);
+	list_delete(merge->layers);
+	mem_free0(merge);
+}
+
+int
+tarmerge_add_layer(tarmerge_t *merge, const char *layer_file)
+{
+	tarmerge_layer_t layer;
+	tarmerge_hdr_t hdr;
+	size_t seq = 0;
+	int ret;
+
+	ASSERT(merge);
+	IF_TRUE_RETVAL(tarmerge_layer_open(&layer, layer_file) < 0, -1);
+
+	while ((ret = tarmerge_hdr_read(layer.fd, &hdr)) > 0) {
+		tarmerge_index_entry(merge, &hdr, merge->n_layers, seq++);
+		ret = tarmerge_data_copy(layer.fd, hdr.data_len, -1);
+		tarmerge_hdr_clear(&hdr);
+		if (ret < 0)
+			break;
+	}
+
+	if (tarmerge_layer_close(&layer) < 0)
+		ret = -1;
+
+	if (ret < 0) {
+		ERROR("Failed to index layer %s", layer_file);
+		return -1;
+	}
+
+	merge->layers = list_append(merge->layers, mem_strdup(layer_file));
+	merge->n_layers++;
+	return 0;
+}
+
+typedef struct {
+	tarmerge_entry_t **dirs;
+	size_t n_dirs;
+} tarmerge_dirs_t;
+
+static void
+tarmerge_dirs_cb(UNUSED const void *key, void *value, void *data)
+{
+	tarmerge_dirs_t *dirs = data;
+	tarmerge_entry_t *entry = value;
+
+	if (entry->is_dir)
+		dirs->dirs[dirs->n_dirs++] = entry;
+}
+
+static int
+tarmerge_dirs_cmp(const void *a, const void *b)
+{
+	return strcmp((*(tarmerge_entry_t *const *)a)->path, (*(tarmerge_entry_t *const *)b)->path);
+}
+
+static int
+tarmerge_write_layer(tarmerge_t *merge, const char *layer_file, int layer_index, int fd)
+{
+	tarmerge_layer_t layer;
+	tarmerge_hdr_t hdr;
+	size_t seq = 0;
+	int ret;
+
+	IF_TRUE_RETVAL(tarmerge_layer_open(&layer, layer_file) < 0, -1);
+
+	while ((ret = tarmerge_hdr_read(layer.fd, &hdr)) > 0) {
+		char *path = tarmerge_path_normalize_new(hdr.path);
+		tarmerge_entry_t *entry = hashmap_get(merge->entries, path);
+		bool visible = entry && !entry->is_dir && entry->layer == layer_index &&
+			       entry->seq == seq;
+		mem_free0(path);
+		seq++;
+
+		if (visible && fd_write(fd, (char *)hdr.raw, hdr.raw_len) < 0)
+			ret = -1;
+		else
+			ret = tarmerge_data_copy(layer.fd, hdr.data_len, visible ? fd : -1);
+		tarmerge_hdr_clear(&hdr);
+		if (ret < 0)
+			break;
+	}
+
+	if (tarmerge_layer_close(&layer) < 0)
+		ret = -1;
+
+	if (ret < 0)
+		ERROR("Failed to merge layer %s", layer_file);
+	return ret;
+}
+
+int
+tarmerge_write(tarmerge_t *merge, int fd)
+{
+	uint8_t end[2 * TAR_BLOCK_SIZE] = { 0 };
+	tarmerge_dirs_t dirs = { .dirs = mem_new0(tarmerge_entry_t *,
+						  hashmap_size(merge->entries) + 1) };
+	int ret = -1;
+
+	ASSERT(merge);
+
+	// directories first, as their headers may come from another layer than their
+	// contents; sorted by path, parents precede their children
+	hashmap_foreach(merge->entries, tarmerge_dirs_cb, &dirs);
+	qsort(dirs.dirs, dirs.n_dirs, sizeof(tarmerge_entry_t *), tarmerge_dirs_cmp);
+	for (size_t i = 0; i < dirs.n_dirs; i++) {
+		if (fd_write(fd, (char *)dirs.dirs[i]->raw, dirs.dirs[i]->raw_len) < 0)
+			goto out;
+	}
+
+	int layer_index = 0;
+	for (list_t *l = merge->layers; l; l = l->next, layer_index++) {
+		if (tarmerge_write_layer(merge, l->data, layer_index, fd) < 0)
+			goto out;
+	}
+
+	if (fd_write(fd, (char *)end, sizeof(end)) < 0)
+		goto out;
+
+	ret = 0;
+out:
+	mem_free0(dirs.dirs);
+	return ret;
+}
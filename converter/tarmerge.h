@@ -0,0 +1,60 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/*
+ * Merges the (optionally gzip compressed) tar layers of an image into a single tar
+ * stream without extracting them, applying the OCI whiteouts of upper layers.
+ * The layers are indexed in a first pass. The second pass streams only the visible
+ * entries, all directories first, followed by the files of the layers in order.
+ * Hard links have to refer to files which are visible in the merged image.
+ */
+
+#ifndef TARMERGE_H
+#define TARMERGE_H
+
+typedef struct tarmerge tarmerge_t;
+
+tarmerge_t *
+tarmerge_new(void);
+
+void
+tarmerge_free(tarmerge_t *merge);
+
+/**
+ * Indexes the next upper layer of the image. The layers have to be added in order,
+ * starting with the bottom layer.
+ *
+ * @return 0 on success, -1 if the layer could not be read
+ */
+int
+tarmerge_add_layer(tarmerge_t *merge, const char *layer_file);
+
+/**
+ * Writes the merged uncompressed tar stream of all added layers to fd.
+ *
+ * @return 0 on success, -1 on error
+ */
+int
+tarmerge_write(tarmerge_t *merge, int fd);
+
+#endif /* TARMERGE_H */
@@ -21,27 +21,43 @@
  * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
  */
 
+#define _GNU_SOURCE
+
 #include "util.h"
 
 #include "common/macro.h"
 #include "common/mem.h"
 #include "common/file.h"
 #include "common/proc.h"
+#include "common/fd.h"
+#include "common/hex.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
 
 #include <openssl/evp.h>
+#include <openssl/sha.h>
 
 #define OPENSSLBIN_PATH "openssl"
 #define TAR_PATH "tar"
+#define CP_PATH "cp"
 #define MKSQUASHFS_PATH "mksquashfs"
 #define MKSQUASHFS_COMP "gzip"
-#define MKSQUASHFS_BSIZE "131072"
+#define MKSQUASHFS_BSIZE 131072
+#define MKFSEROFS_PATH "mkfs.erofs"
+#define MKFSEROFS_COMP "lz4hc"
+// mkfs.erofs uses the page size by default, which is 4K on our platforms
+#define MKFSEROFS_BSIZE 4096
+// deduplicate compressed data, also across the files of the image
+#define MKFSEROFS_DEDUPE "-Ededupe"
 
 #define SIGN_HASH_BUFFER_SIZE 4096
 
@@ -84,19 +100,6 @@ util_tar_extract(const char *tar_filename, const char *out_dir)
 	return proc_fork_and_execvp(argv);
 }
 
-static char *
-convert_bin_to_hex_new(const uint8_t *bin, int length)
-{
-	char *hex = mem_alloc0(sizeof(char) * length * 2 + 1);
-
-	for (int i = 0; i < length; ++i) {
-		// remember snprintf additionally writs a '0' byte
-		snprintf(hex + i * 2, 3, "%.2x", bin[i]);
-	}
-
-	return hex;
-}
-
 static char *
 util_hash_image_file_new(const char *image_file, const EVP_MD *md)
 {
@@ -134,12 +137,173 @@ util_hash_sha256_image_file_new(const char *image_file)
 	return util_hash_image_file_new(image_file, EVP_sha256());
 }
 
+char *
+util_hash_sha256_string_new(const char *str)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	EVP_DigestInit(ctx, EVP_sha256());
+	EVP_DigestUpdate(ctx, str, strlen(str));
+	EVP_DigestFinal(ctx, digest, NULL);
+	EVP_MD_CTX_free(ctx);
+	return convert_bin_to_hex_new(digest, SHA256_DIGEST_LENGTH);
+}
+
 int
-util_squash_image(const char *dir, const char *image_file)
+util_copy_tree(const char *src_dir, const char *dst_dir)
 {
-	const char *const argv[] = { MKSQUASHFS_PATH, dir,  image_file,	      "-noappend", "-comp",
-				     MKSQUASHFS_COMP, "-b", MKSQUASHFS_BSIZE, NULL };
-	return proc_fork_and_execvp(argv);
+	// reflinks make the copy almost free on copy-on-write file systems
+	char *src = mem_printf("%s/.", src_dir);
+	const char *const argv[] = { CP_PATH, "-a", "--reflink=auto", src, dst_dir, NULL };
+	int ret = proc_fork_and_execvp(argv);
+	mem_free0(src);
+	return ret;
+}
+
+const char *
+util_image_fs_type(util_image_fs_t fs)
+{
+	return (fs == UTIL_IMAGE_FS_EROFS) ? "erofs" : "squashfs";
+}
+
+const char *
+util_image_comp(const util_image_opts_t *opts)
+{
+	if (opts->comp)
+		return opts->comp;
+	return (opts->fs == UTIL_IMAGE_FS_EROFS) ? MKFSEROFS_COMP : MKSQUASHFS_COMP;
+}
+
+uint32_t
+util_image_block_size(const util_image_opts_t *opts)
+{
+	if (opts->block_size)
+		return opts->block_size;
+	return (opts->fs == UTIL_IMAGE_FS_EROFS) ? MKFSEROFS_BSIZE : MKSQUASHFS_BSIZE;
+}
+
+/**
+ * Command line of the image tool, together with the storage of its formatted arguments
+ */
+typedef struct util_image_cmd {
+	const char *argv[16];
+	char comp[64];
+	char level[16];
+	char bsize[16];
+} util_image_cmd_t;
+
+/**
+ * Fills cmd with the command line creating image_file as configured by opts from the
+ * directory src or, if src is NULL, from the tar stream on stdin.
+ */
+static const char *const *
+util_image_cmd_init(util_image_cmd_t *cmd, const util_image_opts_t *opts, const char *src,
+		    const char *image_file)
+{
+	const char **argv = cmd->argv;
+	int n = 0;
+
+	snprintf(cmd->bsize, sizeof(cmd->bsize), "%" PRIu32, util_image_block_size(opts));
+
+	if (opts->fs == UTIL_IMAGE_FS_EROFS) {
+		if (opts->comp_level)
+			snprintf(cmd->comp, sizeof(cmd->comp), "-z%s,%d", util_image_comp(opts),
+				 opts->comp_level);
+		else
+			snprintf(cmd->comp, sizeof(cmd->comp), "-z%s", util_image_comp(opts));
+
+		argv[n++] = MKFSEROFS_PATH;
+		// without source directory, mkfs.erofs reads the tar stream from stdin
+		if (!src)
+			argv[n++] = "--tar=f";
+		argv[n++] = cmd->comp;
+		argv[n++] = "-b";
+		argv[n++] = cmd->bsize;
+		argv[n++] = MKFSEROFS_DEDUPE;
+		argv[n++] = image_file;
+		if (src)
+			argv[n++] = src;
+		argv[n] = NULL;
+		return argv;
+	}
+
+	argv[n++] = MKSQUASHFS_PATH;
+	argv[n++] = src ? src : "-";
+	argv[n++] = image_file;
+	if (!src)
+		argv[n++] = "-tar";
+	argv[n++] = "-noappend";
+	argv[n++] = "-comp";
+	argv[n++] = util_image_comp(opts);
+	argv[n++] = "-b";
+	argv[n++] = cmd->bsize;
+	if (opts->comp_level && !strcmp(util_image_comp(opts), "lz4")) {
+		// the lz4 compressor of mksquashfs only knows the high compression mode
+		argv[n++] = "-Xhc";
+	} else if (opts->comp_level) {
+		snprintf(cmd->level, sizeof(cmd->level), "%d", opts->comp_level);
+		argv[n++] = "-Xcompression-level";
+		argv[n++] = cmd->level;
+	}
+	argv[n] = NULL;
+	return argv;
+}
+
+int
+util_create_image(const util_image_opts_t *opts, const char *dir, const char *image_file)
+{
+	util_image_cmd_t cmd;
+	return proc_fork_and_execvp(util_image_cmd_init(&cmd, opts, dir, image_file));
+}
+
+int
+util_create_image_from_tar(const util_image_opts_t *opts, int (*write_tar)(int fd, void *data),
+			   void *data, const char *image_file)
+{
+	int pipefd[2];
+	int status;
+	int ret;
+
+	util_image_cmd_t cmd;
+	const char *const *argv = util_image_cmd_init(&cmd, opts, NULL, image_file);
+
+	if (pipe2(pipefd, O_CLOEXEC) < 0) {
+		ERROR_ERRNO("Could not create pipe for %s", argv[0]);
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		ERROR_ERRNO("Could not fork for %s", argv[0]);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	} else if (pid == 0) {
+		if (dup2(pipefd[0], STDIN_FILENO) < 0)
+			_exit(127);
+		execvp(argv[0], (char *const *)argv);
+		_exit(127);
+	}
+	close(pipefd[0]);
+
+	// fail with EPIPE instead of being killed if the image tool terminates early
+	void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+	ret = write_tar(pipefd[1], data);
+	close(pipefd[1]);
+	signal(SIGPIPE, sigpipe);
+
+	while (waitpid(pid, &status, 0) != pid) {
+		if (errno != EINTR) {
+			ERROR_ERRNO("Could not wait for child '%s'", argv[0]);
+			return -1;
+		}
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		ERROR("Child '%s' failed", argv[0]);
+		return -1;
+	}
+
+	return ret;
 }
 
 int
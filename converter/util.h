@@ -24,6 +24,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stdint.h>
 #include <unistd.h>
 
 #define b64_ntop __b64_ntop
@@ -42,11 +43,70 @@ util_hash_sha_image_file_new(const char *image_file);
 char *
 util_hash_sha256_image_file_new(const char *image_file);
 
+char *
+util_hash_sha256_string_new(const char *str);
+
 int
 util_tar_extract(const char *tar_filename, const char *out_dir);
 
+/**
+ * Copies the contents of src_dir to dst_dir preserving ownership, permissions and
+ * hard links.
+ */
+int
+util_copy_tree(const char *src_dir, const char *dst_dir);
+
+/**
+ * Read-only file systems of the images created by the converter
+ */
+typedef enum util_image_fs {
+	UTIL_IMAGE_FS_SQUASHFS,
+	// lower decompression latency and better random read performance than squashfs
+	UTIL_IMAGE_FS_EROFS,
+} util_image_fs_t;
+
+/**
+ * Options of the read-only images created by the converter
+ */
+typedef struct util_image_opts {
+	util_image_fs_t fs;
+	const char *comp;    // compression algorithm, e.g. "lz4" or "zstd", NULL for the default
+	int comp_level;	     // compression level, 0 for the default of the algorithm
+	uint32_t block_size; // block size (bytes) of the file system, 0 for the default
+} util_image_opts_t;
+
+/**
+ * Returns the file system type of fs as used in the mounts of the guestos config.
+ */
+const char *
+util_image_fs_type(util_image_fs_t fs);
+
+/**
+ * Returns the compression algorithm used for images created with opts.
+ */
+const char *
+util_image_comp(const util_image_opts_t *opts);
+
+/**
+ * Returns the block size (bytes) of the file system of images created with opts.
+ */
+uint32_t
+util_image_block_size(const util_image_opts_t *opts);
+
+/**
+ * Creates the read-only image image_file as configured by opts from the directory dir.
+ */
+int
+util_create_image(const util_image_opts_t *opts, const char *dir, const char *image_file);
+
+/**
+ * Creates the read-only image image_file as configured by opts from the tar stream
+ * written by write_tar() to fd, without a staging tree on disk. Requires mksquashfs with
+ * -tar support or mkfs.erofs with --tar support (erofs-utils 1.7).
+ */
 int
-util_squash_image(const char *dir, const char *image_file);
+util_create_image_from_tar(const util_image_opts_t *opts, int (*write_tar)(int fd, void *data),
+			   void *data, const char *image_file);
 
 int
 util_sign_guestos(const char *sig_file, const char *cfg_file, const char *key_file);
@@ -42,14 +42,20 @@
 #include "common/event.h"
 #include "common/fd.h"
 #include "common/nl.h"
+#include "common/hashmap.h"
 
+#include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
-#include <sys/file.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <time.h>
+#include <unistd.h>
 #include <linux/audit.h>
 #include <inttypes.h>
+#include <stddef.h>
+#include <linux/filter.h>
 #include <google/protobuf-c/protobuf-c-text.h>
 
 //TODO implement ACK mechanism fpr all service messages inside c-service.c?
@@ -74,6 +80,21 @@
 
 #define AUDIT_LOGDIR "/data/audit"
 
+#define AUDIT_SEGMENT_SIZE (256 * 1024)
+#define AUDIT_SEGMENT_SUFFIX ".seg"
+#define AUDIT_HEAD_FILE "head"
+
+/* records are committed together after this delay or once this many are buffered */
+#define AUDIT_COMMIT_DELAY 5
+#define AUDIT_COMMIT_RECORDS 64
+
+/* records kept in memory for delivery and records which may be unacknowledged at once */
+#define AUDIT_RING_SIZE 32
+#define AUDIT_WINDOW 8
+
+/* block size of the arena records read from the log are unpacked into */
+#define AUDIT_READ_ARENA_BLOCK_SIZE (8 * 1024)
+
 uint64_t AUDIT_STORAGE = 0;
 
 static AUDIT_MODE LOGMODE = CONTAINER;
@@ -124,471 +145,938 @@ audit_get_log_container(const uuid_t *uuid)
 	return c;
 }
 
+/*
+ * The stored records of a container are kept in an append-only log of segment files
+ * AUDIT_LOGDIR/<uuid>/<seq>.seg. Each record is a packed AuditRecord prefixed by its length
+ * as 32-bit big endian value. The position of the next record to be sent is persisted in
+ * AUDIT_LOGDIR/<uuid>/head, all records before it have been acknowledged. Fully acknowledged
+ * segments are removed and the tail segment is truncated once all of its records have been
+ * acknowledged, hence no record is ever rewritten.
+ * New records are buffered and committed as a group by one append and fdatasync on the held
+ * open tail segment, see audit_log_commit().
+ *
+ * Records are delivered to the container from a ring, which is filled from the log.
+ * While the service keeps up, new records of a running container are only kept in the ring
+ * and spilled to the log once the ring is full, see audit_record_log(). Up to a window of
+ * records is sent before the service acknowledges them, an ACK for a record also
+ * acknowledges all records sent before. If supported by the service, the records of the
+ * window are sent as batch in one AUDIT_RECORDS message, which is answered by a single ACK.
+ * The records of a batch are still hashed and acknowledged individually. The service drops
+ * the records following a record it failed to store, on such an ACK the window is sent
+ * again from its oldest record.
+ */
+typedef struct {
+	uint64_t seq;
+	uint8_t *msg; // packed CmldToServiceMessage
+	size_t msg_len;
+	uint8_t *record; // packed AuditRecord, if not stored in the log
+	size_t record_len;
+	char *hash;
+	bool hashing;
+} audit_ring_entry_t;
+
+typedef struct {
+	char *uuid;
+	char *dir;
+	uint32_t head_seg;
+	uint32_t tail_seg;
+	uint64_t head_off;
+	uint64_t tail_size;
+	uint64_t size; // bytes of all segments on disk
+	int tail_fd;
+	uint8_t *commit_buf;
+	size_t commit_len;
+	size_t commit_size;
+	unsigned commit_count;
+	event_timer_t *commit_timer;
+	uuid_t *container_uuid;
+	uint32_t read_seg;
+	uint64_t read_off; // position of the next record to be read into the ring
+	audit_ring_entry_t ring[AUDIT_RING_SIZE];
+	unsigned ring_head;
+	unsigned ring_count;
+	unsigned submitted; // records of the window being hashed or sent
+	unsigned sent;	    // records of the window sent to the container
+	unsigned window;
+	bool batch; // the service accepts AUDIT_RECORDS
+	uint64_t next_seq;
+	uint64_t resend_seq;
+	bool resending;
+} audit_log_t;
+
+typedef struct {
+	uint32_t seg;
+	uint32_t reserved;
+	uint64_t off;
+} audit_log_head_t;
+
+static hashmap_t *audit_logs = NULL;
+
 static char *
-audit_log_file_new(const char *uuid)
+audit_log_segment_file_new(const audit_log_t *log, uint32_t seg)
 {
-	if (C0 == LOGMODE)
-		return mem_printf("%s/%s.log", AUDIT_LOGDIR, AUDIT_DEFAULT_CONTAINER);
-	else
-		return mem_printf("%s/%s.log", AUDIT_LOGDIR, uuid);
+	return mem_printf("%s/%08" PRIu32 "%s", log->dir, seg, AUDIT_SEGMENT_SUFFIX);
 }
 
-static uint64_t
-audit_remaining_storage(const char *uuid)
+static void
+audit_log_persist_head(const audit_log_t *log)
 {
-	char *file = audit_log_file_new(uuid);
-	off_t size = file_size(file);
+	audit_log_head_t head = { .seg = log->head_seg, .off = log->head_off };
+	char *head_file = mem_printf("%s/%s", log->dir, AUDIT_HEAD_FILE);
 
-	if (!file_exists(file)) {
-		mem_free0(file);
-		return AUDIT_STORAGE;
-	}
-	mem_free0(file);
+	if (sizeof(head) != (size_t)file_write(head_file, (char *)&head, sizeof(head)))
+		ERROR("Failed to persist head of audit log %s", log->dir);
 
-	if (0 > size) {
-		ERROR_ERRNO("Failed to retrieve size of audit log file");
-		return 0;
-	}
+	mem_free0(head_file);
+}
 
-	if ((uint64_t)size > AUDIT_STORAGE) {
-		ERROR("Detected audit log overflow");
-		return 0;
+static uint64_t
+audit_log_pending(const audit_log_t *log)
+{
+	return log->size + log->commit_len - log->head_off;
+}
+
+static int
+audit_log_tail_open(audit_log_t *log)
+{
+	IF_TRUE_RETVAL(log->tail_fd >= 0, log->tail_fd);
+
+	char *seg_file = audit_log_segment_file_new(log, log->tail_seg);
+	bool created = !file_exists(seg_file);
+
+	log->tail_fd = open(seg_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 00600);
+	if (log->tail_fd < 0)
+		ERROR_ERRNO("Failed to open audit log segment %s", seg_file);
+	mem_free0(seg_file);
+
+	// make the directory entry of a new segment durable as well
+	int dirfd;
+	if (log->tail_fd >= 0 && created &&
+	    (dirfd = open(log->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+		if (fsync(dirfd))
+			WARN_ERRNO("Failed to sync audit log directory %s", log->dir);
+		close(dirfd);
 	}
 
-	return AUDIT_STORAGE - size;
+	return log->tail_fd;
 }
 
 static void
-audit_send_record_cb(const char *hash_string, const char *hash_file,
-		     UNUSED crypto_hashalgo_t hash_algo, void *data)
+audit_log_tail_close(audit_log_t *log)
 {
-	uint8_t *buf = NULL;
-	const container_t *c = (const container_t *)data;
-	ASSERT(c);
-
-	// callback is triggert twice for cleanup
-	IF_NULL_RETURN_TRACE(hash_string);
+	if (log->tail_fd >= 0)
+		close(log->tail_fd);
+	log->tail_fd = -1;
+}
 
-	if (!hash_file) {
-		ERROR("audit_send_record_cb: hash_file was empty");
-		return;
-	}
+/*
+ * Writes all buffered records to the tail segment at once and waits for them to be stored
+ * by a single fdatasync.
+ */
+static int
+audit_log_commit(audit_log_t *log)
+{
+	int ret = -1;
 
-	if (!data) {
-		ERROR("audit_send_record_cb: No container given");
-		return;
+	if (log->commit_timer) {
+		event_remove_timer(log->commit_timer);
+		event_timer_free(log->commit_timer);
+		log->commit_timer = NULL;
 	}
 
-	uint32_t buf_len = file_size(hash_file);
-	buf = mem_alloc0(buf_len);
+	IF_TRUE_RETVAL(log->commit_len == 0, 0);
 
-	int read = file_read(hash_file, (char *)buf, buf_len);
+	int fd = audit_log_tail_open(log);
+	IF_TRUE_GOTO(fd < 0, out);
 
-	if (read < 0 || buf_len != (unsigned int)read) {
-		ERROR("Processing SCD response: read %u bytes, expected %u", read, buf_len);
+	if (0 > fd_write(fd, (char *)log->commit_buf, log->commit_len)) {
+		ERROR("Failed to log %u audit records to log %s", log->commit_count, log->dir);
+		// drop partially written records
+		if (ftruncate(fd, log->tail_size))
+			ERROR_ERRNO("Failed to truncate audit log segment of %s", log->dir);
 		goto out;
 	}
 
-	TRACE("Got hash from SCD for file %s: %s", hash_file, hash_string);
+	log->tail_size += log->commit_len;
+	log->size += log->commit_len;
 
-	if (unlink(hash_file)) {
-		ERROR_ERRNO("Failed to unlink %s", hash_file);
-	}
-
-	char *old_acked = mem_strdup(container_audit_get_last_ack(c));
-	container_audit_set_last_ack(c, hash_string);
-
-	if (0 > container_audit_record_send(c, buf, buf_len)) {
-		ERROR("Failed to send audit record to container");
-		// rollback
-		container_audit_set_last_ack(c, old_acked);
-		mem_free0(old_acked);
+	// ensure audit log goes to disk
+	if (fdatasync(fd)) {
+		ERROR_ERRNO("Failed to sync audit log %s", log->dir);
 		goto out;
 	}
-	mem_free0(old_acked);
-
-	TRACE("Sent audit record with ID %s to container %s", container_audit_get_last_ack(c),
-	      uuid_string(container_get_uuid(c)));
 
+	TRACE("Committed %u audit records to log %s", log->commit_count, log->dir);
+	ret = 0;
 out:
-	container_audit_set_processing_ack(c, false);
-	mem_free0(buf);
+	log->commit_len = 0;
+	log->commit_count = 0;
+	return ret;
 }
 
-static AuditRecord *
-audit_record_from_textfile_new(const char *filename, bool purge)
+static void
+audit_log_commit_cb(UNUSED event_timer_t *timer, void *data)
 {
-	ASSERT(filename);
+	audit_log_t *log = data;
+	ASSERT(log);
 
-	TRACE("audit record from textfile using log '%s'", filename);
+	audit_log_commit(log);
+}
 
-	FILE *file = fopen(filename, purge ? "r+" : "r");
-	if (!file) {
-		WARN_ERRNO("Could not fopen file \"%s\" for reading.", filename);
-		return NULL;
+/*
+ * Reserves space for a packed record of the given length in the buffer of the next group
+ * commit and returns where to put the record.
+ */
+static uint8_t *
+audit_log_append_begin(audit_log_t *log, size_t packed_len)
+{
+	size_t len = sizeof(uint32_t) + packed_len;
+	uint32_t len_be = htonl(packed_len);
+
+	// rotate to a new segment instead of growing the tail without bound
+	if (log->tail_size + log->commit_len > 0 &&
+	    log->tail_size + log->commit_len + len > AUDIT_SEGMENT_SIZE) {
+		IF_TRUE_RETVAL(audit_log_commit(log), NULL);
+		audit_log_tail_close(log);
+		log->tail_seg++;
+		log->tail_size = 0;
 	}
 
-	int fd = fileno(file);
-	if (fd < 0) {
-		WARN_ERRNO("Could not get fd for \"%s\" for reading.", filename);
-		fclose(file);
-		return NULL;
+	if (log->commit_len + len > log->commit_size) {
+		log->commit_size = MAX(2 * log->commit_size, log->commit_len + len);
+		log->commit_buf = mem_realloc(log->commit_buf, log->commit_size);
 	}
 
-	int audit_file_lock = flock(fd, LOCK_EX);
-	if (audit_file_lock < 0) {
-		ERROR_ERRNO("Failed to get lock on audit log file: %s", filename);
-		fclose(file);
-		return NULL;
-	}
+	uint8_t *buf = log->commit_buf + log->commit_len;
+	memcpy(buf, &len_be, sizeof(uint32_t));
+	log->commit_len += len;
+	log->commit_count++;
 
-	struct stat s;
-	if (fstat(fd, &s) && 0 > s.st_size) {
-		ERROR("Failed to retrieve size of audit record log '%s'", filename);
-		fclose(file);
-		return NULL;
+	return buf + sizeof(uint32_t);
+}
+
+/*
+ * Completes an append. If sync is set, the record and all records buffered before are
+ * committed before returning.
+ */
+static int
+audit_log_append_end(audit_log_t *log, bool sync)
+{
+	if (sync || log->commit_count >= AUDIT_COMMIT_RECORDS)
+		return audit_log_commit(log);
+
+	if (!log->commit_timer) {
+		log->commit_timer =
+			event_timer_new(AUDIT_COMMIT_DELAY, 1, &audit_log_commit_cb, log);
+		event_add_timer(log->commit_timer);
 	}
 
-	AuditRecord *record = NULL;
-	ssize_t size = s.st_size;
-
-	// read file up to delimiter
-	char *buf = mem_alloc0(size + 1);
-	size_t read = 0;
-	bool delim_found = false;
-
-	while (!delim_found && read < (size_t)size) {
-		ssize_t current = 0;
-		size_t n = 0;
-		char *line = NULL;
-
-		if (0 > (current = getline(&line, &n, file))) {
-			ERROR_ERRNO("Failed to read line from file");
-			fclose(file);
-			mem_free0(line);
-			goto out;
+	return 0;
+}
+
+static int
+audit_log_append(audit_log_t *log, const AuditRecord *record, bool sync)
+{
+	uint8_t *buf = audit_log_append_begin(log, audit_record__get_packed_size(record));
+	IF_NULL_RETVAL(buf, -1);
+
+	audit_record__pack(record, buf);
+
+	return audit_log_append_end(log, sync);
+}
+
+static int
+audit_log_append_buf(audit_log_t *log, const uint8_t *record, size_t record_len, bool sync)
+{
+	uint8_t *buf = audit_log_append_begin(log, record_len);
+	IF_NULL_RETVAL(buf, -1);
+
+	memcpy(buf, record, record_len);
+
+	return audit_log_append_end(log, sync);
+}
+
+/*
+ * Empties the log once the head reached the end of the tail segment by truncating the tail
+ * segment, which keeps the sequence numbers of the segments.
+ */
+static void
+audit_log_reset(audit_log_t *log)
+{
+	char *seg_file = audit_log_segment_file_new(log, log->tail_seg);
+
+	TRACE("All records of audit log %s acknowledged, truncating %s", log->dir, seg_file);
+	if (truncate(seg_file, 0) && errno != ENOENT)
+		ERROR_ERRNO("Failed to truncate audit log segment %s", seg_file);
+	mem_free0(seg_file);
+
+	log->head_seg = log->tail_seg;
+	log->head_off = 0;
+	log->tail_size = 0;
+	log->size = 0;
+	log->read_seg = log->tail_seg;
+	log->read_off = 0;
+	audit_log_persist_head(log);
+}
+
+static void
+audit_log_drop_head_segment(audit_log_t *log, off_t seg_size)
+{
+	char *seg_file = audit_log_segment_file_new(log, log->head_seg);
+
+	TRACE("All records of audit log segment %s acknowledged, removing it", seg_file);
+	if (unlink(seg_file) && errno != ENOENT)
+		ERROR_ERRNO("Failed to remove audit log segment %s", seg_file);
+	mem_free0(seg_file);
+
+	log->size -= seg_size;
+	log->head_seg++;
+	log->head_off = 0;
+	audit_log_persist_head(log);
+}
+
+/*
+ * Opens the segment holding the next record to be sent and drops segments which have been
+ * acknowledged completely on the way. Returns -1 if the log is empty.
+ */
+static int
+audit_log_head_open(audit_log_t *log, off_t *seg_size)
+{
+	// records are sent only once they are stored
+	IF_TRUE_RETVAL(audit_log_commit(log), -1);
+
+	for (;;) {
+		struct stat s = { .st_size = 0 };
+		char *seg_file = audit_log_segment_file_new(log, log->head_seg);
+		int fd = open(seg_file, O_RDONLY | O_CLOEXEC);
+
+		if ((fd < 0 && errno != ENOENT) || (fd >= 0 && fstat(fd, &s))) {
+			ERROR_ERRNO("Failed to open audit log segment %s", seg_file);
+			if (fd >= 0)
+				close(fd);
+			mem_free0(seg_file);
+			return -1;
 		}
+		mem_free0(seg_file);
 
-		if (read + current > (size_t)size) {
-			ERROR("File was changed while reading");
-			fclose(file);
-			mem_free0(line);
-			goto out;
+		if (log->head_off + sizeof(uint32_t) <= (uint64_t)s.st_size) {
+			*seg_size = s.st_size;
+			return fd;
 		}
 
-		// if delimiter line was read, stop further processing
-		if (!strcmp(AUDIT_DELIMITER, line)) {
-			delim_found = true;
-			mem_free0(line);
-			continue;
+		if (fd >= 0)
+			close(fd);
+
+		if (log->head_seg == log->tail_seg) {
+			// also drops a trailing partial length prefix
+			if (audit_log_pending(log))
+				audit_log_reset(log);
+			return -1;
 		}
 
-		memcpy(buf + read, line, current);
-		read += current;
-		mem_free0(line);
+		audit_log_drop_head_segment(log, s.st_size);
 	}
+}
 
-	// parse record from file
-	if (0 == size) {
-		INFO("Read audit record with default values");
-		record = (AuditRecord *)mem_new0(AuditRecord, 1);
-		audit_record__init(record);
-		goto out;
-	} else {
-		record = (AuditRecord *)protobuf_message_new_from_buf((uint8_t *)buf, read,
-								      &audit_record__descriptor);
+static int
+audit_log_scan_cb(const char *path, const char *file, void *data)
+{
+	audit_log_t *log = data;
+	uint32_t seg;
+	int n = 0;
+
+	if (1 != sscanf(file, "%" SCNu32 AUDIT_SEGMENT_SUFFIX "%n", &seg, &n) || file[n] != '\0')
+		return 0;
+
+	char *seg_file = mem_printf("%s/%s", path, file);
+	off_t size = file_size(seg_file);
+	mem_free0(seg_file);
+
+	if (size < 0) {
+		WARN_ERRNO("Failed to retrieve size of audit log segment %s/%s", path, file);
+		return 0;
 	}
 
-	if (!record) {
-		WARN("Failed to parse text protobuf message (%s) from file \"%s\"."
-		     "Generating new record with corrupted data as raw_text",
-		     audit_record__descriptor.name ? audit_record__descriptor.name : "UNKNOWN",
-		     filename);
+	log->head_seg = MIN(log->head_seg, seg);
+	if (seg >= log->tail_seg) {
+		log->tail_seg = seg;
+		log->tail_size = size;
+	}
+	log->size += size;
 
-		AuditRecord__Meta **meta = mem_new0(AuditRecord__Meta *, 1);
-		meta[0] = mem_new0(AuditRecord__Meta, 1);
-		audit_record__meta__init(meta[0]);
+	return 1;
+}
 
-		// store corrput message as meta
-		meta[0]->key = mem_strdup("raw_text");
-		meta[0]->value = mem_strndup(buf, read);
+static AuditRecord *
+audit_record_corrupt_new(const char *raw_text)
+{
+	AuditRecord__Meta **meta = mem_new0(AuditRecord__Meta *, 1);
+	meta[0] = mem_new0(AuditRecord__Meta, 1);
+	audit_record__meta__init(meta[0]);
 
-		char *type = mem_printf("%s.%s.%s.%s", audit_category_to_string(FSA),
-					audit_component_to_string(CMLD),
-					audit_evclass_to_string(GENERIC), "corrupt-record");
+	// store corrupt message as meta
+	meta[0]->key = mem_strdup("raw_text");
+	meta[0]->value = mem_strdup(raw_text);
 
-		record = audit_record_new(type, NULL, 1, meta);
-		mem_free0(type);
-	}
+	char *type = mem_printf("%s.%s.%s.%s", audit_category_to_string(FSA),
+				audit_component_to_string(CMLD), audit_evclass_to_string(GENERIC),
+				"corrupt-record");
 
-	if (purge) {
-		// delete record from file
-		if (read + strlen(AUDIT_DELIMITER) == (size_t)size) {
-			TRACE("Audit log empty, removing file");
-			if (-1 == unlink(filename)) {
-				ERROR_ERRNO("Failed to remove audit log file");
-			}
-			goto out;
-		}
+	AuditRecord *record = audit_record_new(type, NULL, 1, meta);
+	mem_free0(type);
 
-		errno = 0;
-		rewind(file);
-		if (errno != 0) {
-			ERROR_ERRNO("Rewind for reading of file %s failed!", filename);
-			goto out;
-		}
-		size_t read_len;
-		if ((size_t)size != (read_len = fread(buf, sizeof(char), size, file))) {
-			ERROR("Failed to read audit log file into memory read %zu "
-			      "expected %zd, [eof: %d, ferror: %d]",
-			      read_len, size, feof(file), ferror(file));
-			goto out;
-		}
+	return record;
+}
 
-		errno = 0;
-		rewind(file);
-		if (errno != 0) {
-			ERROR_ERRNO("Rewind for writing of file %s failed!", filename);
-			goto out;
-		}
-		size_t offset = read + strlen(AUDIT_DELIMITER);
-		size_t write_len = read_len - offset;
-		if (-1 == fd_write(fd, buf + offset, write_len)) {
-			ERROR_ERRNO("Failed to remove message from file: %s", filename);
-			goto out;
-		}
-		if (ftruncate(fd, write_len)) {
-			ERROR_ERRNO("Failed to truncate size of file: %s", filename);
+/*
+ * Moves the records of the text log used by previous versions to the segmented log.
+ */
+static void
+audit_log_import_text(audit_log_t *log)
+{
+	char *file = mem_printf("%s/%s.log", AUDIT_LOGDIR, log->uuid);
+	char *text = NULL;
+	off_t size;
+
+	if (!file_exists(file) || 0 > (size = file_size(file)))
+		goto out;
+
+	INFO("Importing audit records from text log %s", file);
+
+	IF_NULL_GOTO_ERROR(text = file_read_new(file, size + 1), out);
+
+	for (char *rec = text, *delim; (delim = strstr(rec, AUDIT_DELIMITER));
+	     rec = delim + strlen(AUDIT_DELIMITER)) {
+		if (delim == rec)
+			continue;
+
+		*delim = '\0';
+		AuditRecord *record = (AuditRecord *)protobuf_message_new_from_buf(
+			(uint8_t *)rec, delim - rec, &audit_record__descriptor);
+		if (!record) {
+			WARN("Failed to parse text audit record from %s", file);
+			record = audit_record_corrupt_new(rec);
 		}
+
+		int ret = audit_log_append(log, record, false);
+		protobuf_free_message((ProtobufCMessage *)record);
+		IF_TRUE_GOTO_ERROR(ret, out);
 	}
+	IF_TRUE_GOTO_ERROR(audit_log_commit(log), out);
 
+	if (unlink(file))
+		ERROR_ERRNO("Failed to remove text audit log %s", file);
 out:
-	if (buf)
-		mem_free0(buf);
+	mem_free0(text);
+	mem_free0(file);
+}
 
-	if (audit_file_lock == 0 && flock(fd, LOCK_UN)) {
-		ERROR_ERRNO("Failed to release lock on audit log file: %s", filename);
+static audit_log_t *
+audit_log_new(const char *uuid)
+{
+	audit_log_t *log = mem_new0(audit_log_t, 1);
+	log->uuid = mem_strdup(uuid);
+	log->dir = mem_printf("%s/%s", AUDIT_LOGDIR, uuid);
+	log->head_seg = UINT32_MAX;
+	log->tail_fd = -1;
+
+	if (!file_is_dir(log->dir) && dir_mkdir_p(log->dir, 0700)) {
+		ERROR("Failed to create audit log directory %s", log->dir);
+		mem_free0(log->uuid);
+		mem_free0(log->dir);
+		mem_free0(log);
+		return NULL;
 	}
-	fclose(file);
 
-	return (AuditRecord *)record;
+	log->container_uuid = uuid_new(uuid);
+	log->window = 1;
+
+	if (0 >= dir_foreach(log->dir, &audit_log_scan_cb, log))
+		log->head_seg = log->tail_seg = 0;
+
+	audit_log_head_t head;
+	char *head_file = mem_printf("%s/%s", log->dir, AUDIT_HEAD_FILE);
+	if (file_exists(head_file) &&
+	    sizeof(head) == (size_t)file_read(head_file, (char *)&head, sizeof(head)) &&
+	    head.seg == log->head_seg) {
+		char *seg_file = audit_log_segment_file_new(log, log->head_seg);
+		off_t seg_size = file_size(seg_file);
+		mem_free0(seg_file);
+
+		log->head_off = MIN(head.off, (uint64_t)MAX(seg_size, 0));
+	}
+	mem_free0(head_file);
+
+	log->read_seg = log->head_seg;
+	log->read_off = log->head_off;
+
+	audit_log_import_text(log);
+
+	DEBUG("Opened audit log %s, segments %" PRIu32 "-%" PRIu32 ", %" PRIu64
+	      " bytes pending",
+	      log->dir, log->head_seg, log->tail_seg, audit_log_pending(log));
+
+	return log;
 }
 
-static bool
-audit_log_check_delimiter(int fd)
+static audit_log_t *
+audit_log_get(const char *uuid)
 {
-	char buf[sizeof(AUDIT_DELIMITER)];
-	bool ret = false;
+	if (C0 == LOGMODE)
+		uuid = AUDIT_DEFAULT_CONTAINER;
 
-	struct stat s;
-	IF_TRUE_RETVAL(fstat(fd, &s) != 0, true);
-	IF_TRUE_RETVAL(s.st_size <= 0, true);
+	if (!audit_logs)
+		audit_logs = hashmap_new_str();
 
-	off_t current = lseek(fd, 0, SEEK_CUR);
+	audit_log_t *log = hashmap_get(audit_logs, uuid);
+	if (log)
+		return log;
 
-	IF_TRUE_GOTO_WARN(-1 == lseek(fd, -strlen(AUDIT_DELIMITER), SEEK_END), out);
-	IF_TRUE_GOTO_WARN(-1 == fd_read(fd, buf, strlen(AUDIT_DELIMITER)), out);
+	IF_NULL_RETVAL(log = audit_log_new(uuid), NULL);
+	hashmap_put(audit_logs, log->uuid, log);
 
-	buf[sizeof(AUDIT_DELIMITER) - 1] = '\0';
+	return log;
+}
 
-	// if delimiter line was read, all is fine
-	if (!strcmp(AUDIT_DELIMITER, buf))
-		ret = true;
-out:
-	if (-1 == lseek(fd, current, SEEK_SET))
-		WARN_ERRNO("could not restore position!");
+typedef struct {
+	void (*func)(const char *uuid, uint64_t stored, unsigned queued, void *data);
+	void *data;
+} audit_foreach_queue_t;
 
-	return ret;
+static void
+audit_foreach_queue_cb(UNUSED const void *key, void *value, void *data)
+{
+	audit_log_t *log = value;
+	audit_foreach_queue_t *foreach = data;
+
+	foreach->func(log->uuid, audit_log_pending(log), log->ring_count, foreach->data);
 }
 
-static int
-audit_write_file(const uuid_t *uuid, const AuditRecord *msg)
+void
+audit_foreach_queue(void (*func)(const char *uuid, uint64_t stored, unsigned queued, void *data),
+		    void *data)
 {
-	int ret = -1;
-	int audit_file_lock = -1;
-	int fd = -1;
+	IF_NULL_RETURN(audit_logs);
 
-	if (!file_is_dir(AUDIT_LOGDIR) && dir_mkdir_p(AUDIT_LOGDIR, 0600)) {
-		ERROR("Failed to create logdir");
-		return -1;
+	audit_foreach_queue_t foreach = { .func = func, .data = data };
+	hashmap_foreach(audit_logs, audit_foreach_queue_cb, &foreach);
+}
+
+/*
+ * The pending bytes of the log are counted on append and commit, thus this neither looks up the
+ * log nor stats its segments.
+ */
+static uint64_t
+audit_remaining_storage(const audit_log_t *log)
+{
+	IF_NULL_RETVAL(log, 0);
+
+	uint64_t pending = audit_log_pending(log);
+
+	if (pending > AUDIT_STORAGE) {
+		ERROR("Detected audit log overflow");
+		return 0;
 	}
 
-	char *file = audit_log_file_new(uuid_string(uuid));
+	return AUDIT_STORAGE - pending;
+}
 
-	char *msg_text;
-	size_t msg_len = protobuf_string_from_message(&msg_text, (ProtobufCMessage *)msg, NULL);
+static audit_ring_entry_t *
+audit_ring_entry(audit_log_t *log, unsigned i)
+{
+	return &log->ring[(log->ring_head + i) % AUDIT_RING_SIZE];
+}
 
-	//TODO send error message
-	if (audit_remaining_storage(uuid_string(uuid)) < (msg_len + strlen(AUDIT_DELIMITER))) {
-		container_t *c = cmld_container_get_by_uuid(uuid);
+static audit_ring_entry_t *
+audit_ring_entry_by_seq(audit_log_t *log, uint64_t seq)
+{
+	IF_TRUE_RETVAL(log->ring_count == 0, NULL);
 
-		TRACE("Trying to notify container %s about stored audit events,"
-		      " remaining storage: %" PRIu64,
-		      uuid_string(uuid), audit_remaining_storage(uuid_string(uuid)));
-		if ((!c) || (-1 == container_audit_record_notify(
-					   c, audit_remaining_storage(uuid_string(uuid))))) {
-			ERROR("Failed to notify container about audit log overflow");
-		}
-		ERROR("Failed to store audit record: max. log size exceeded");
-		goto out;
-	}
+	uint64_t first = audit_ring_entry(log, 0)->seq;
+	IF_TRUE_RETVAL(seq < first || seq - first >= log->ring_count, NULL);
 
-	TRACE("Logging audit record to file: %s", file);
+	return audit_ring_entry(log, seq - first);
+}
 
-	int oflags = O_RDWR;
-	oflags |= file_exists(file) ? O_APPEND : (O_CREAT | O_TRUNC);
+/*
+ * Appends the record to the ring. If record_buf is given, the ring takes it over as the packed
+ * record, which is not stored in the log yet. Otherwise, the record was read from the log.
+ */
+static void
+audit_ring_push(audit_log_t *log, const AuditRecord *record, uint8_t *record_buf,
+		size_t record_len)
+{
+	ASSERT(log->ring_count < AUDIT_RING_SIZE);
+
+	audit_ring_entry_t *e = audit_ring_entry(log, log->ring_count);
+	memset(e, 0, sizeof(audit_ring_entry_t));
+	e->seq = log->next_seq++;
+	e->record = record_buf;
+	e->record_len = record_len;
+
+	CmldToServiceMessage message_proto = CMLD_TO_SERVICE_MESSAGE__INIT;
+	message_proto.code = CMLD_TO_SERVICE_MESSAGE__CODE__AUDIT_RECORD;
+	message_proto.audit_record = (AuditRecord *)record;
+	message_proto.has_audit_seq = true;
+	message_proto.audit_seq = e->seq;
+	e->msg_len = protobuf_pack_message_new((ProtobufCMessage *)&message_proto, &e->msg);
+
+	log->ring_count++;
+}
 
-	fd = open(file, oflags, 00600);
-	if (fd < 0) {
-		ERROR_ERRNO("Failed to open audit log file: %s", file);
-		goto out;
-	}
+static void
+audit_ring_pop(audit_log_t *log)
+{
+	audit_ring_entry_t *e = audit_ring_entry(log, 0);
 
-	audit_file_lock = flock(fd, LOCK_EX);
-	if (audit_file_lock < 0) {
-		ERROR_ERRNO("Failed to get lock on audit log file: %s", file);
-		goto out;
-	}
+	mem_free0(e->msg);
+	mem_free0(e->record);
+	mem_free0(e->hash);
 
-	if (!audit_log_check_delimiter(fd)) {
-		TRACE("Fixup audit delimiter to %s", file);
-		if (0 > fd_write(fd, AUDIT_DELIMITER, strlen(AUDIT_DELIMITER))) {
-			ERROR("Failed to fixup audit log file: %s", file);
-			goto out;
+	log->ring_head = (log->ring_head + 1) % AUDIT_RING_SIZE;
+	log->ring_count--;
+}
+
+/*
+ * Returns true if the log holds records which have not been read into the ring yet.
+ */
+static bool
+audit_log_unread(const audit_log_t *log)
+{
+	return log->read_seg < log->tail_seg || log->read_off < log->tail_size + log->commit_len;
+}
+
+/*
+ * Reads the record at the read position of the log and moves the read position behind it.
+ * The record is unpacked into the given arena and released with it.
+ */
+static AuditRecord *
+audit_log_read(audit_log_t *log, mem_arena_t *arena)
+{
+	AuditRecord *record = NULL;
+	uint8_t *buf = NULL;
+	uint32_t len_be;
+	struct stat s;
+	int fd;
+
+	IF_TRUE_RETVAL(audit_log_commit(log), NULL);
+
+	for (;;) {
+		s.st_size = 0;
+		char *seg_file = audit_log_segment_file_new(log, log->read_seg);
+		fd = open(seg_file, O_RDONLY | O_CLOEXEC);
+
+		if ((fd < 0 && errno != ENOENT) || (fd >= 0 && fstat(fd, &s))) {
+			ERROR_ERRNO("Failed to open audit log segment %s", seg_file);
+			if (fd >= 0)
+				close(fd);
+			mem_free0(seg_file);
+			return NULL;
 		}
+		mem_free0(seg_file);
+
+		if (log->read_off + sizeof(uint32_t) <= (uint64_t)s.st_size)
+			break;
+
+		if (fd >= 0)
+			close(fd);
+		IF_TRUE_RETVAL(log->read_seg >= log->tail_seg, NULL);
+
+		log->read_seg++;
+		log->read_off = 0;
 	}
 
-	if (0 > fd_write(fd, msg_text, msg_len)) {
-		ERROR("Failed to log audit message to file: %s", file);
+	if (sizeof(uint32_t) != pread(fd, &len_be, sizeof(uint32_t), log->read_off)) {
+		ERROR_ERRNO("Failed to read length of audit record from %s", log->dir);
 		goto out;
 	}
 
-	if (0 > fd_write(fd, AUDIT_DELIMITER, strlen(AUDIT_DELIMITER))) {
-		ERROR("Failed to log audit message %s to file: %s", msg_text, file);
+	// a length beyond the segment cannot be trusted, take the rest of the segment
+	uint64_t len = ntohl(len_be);
+	uint64_t off = log->read_off + sizeof(uint32_t);
+	bool truncated = off + len > (uint64_t)s.st_size;
+	if (truncated)
+		len = s.st_size - off;
+
+	buf = mem_alloc(MAX(len, 1));
+	if ((ssize_t)len != pread(fd, buf, len, off)) {
+		ERROR_ERRNO("Failed to read audit record from %s", log->dir);
 		goto out;
 	}
 
-	ret = 0;
+	if (!truncated)
+		record = (AuditRecord *)protobuf_unpack_message_arena(&audit_record__descriptor,
+								      buf, len, arena);
 
-out:
-	if (audit_file_lock == 0 && flock(fd, LOCK_UN)) {
-		ERROR_ERRNO("Failed to release lock on audit log file: %s", file);
+	if (!record) {
+		WARN("Failed to unpack audit record at %" PRIu32 ":%" PRIu64 " of log %s."
+		     "Generating new record with corrupted data as raw_text",
+		     log->read_seg, log->read_off, log->dir);
+
+		str_t *dump = str_hexdump_new(buf, len);
+		AuditRecord *corrupt = audit_record_corrupt_new(str_buffer(dump));
+		str_free(dump, true);
+
+		// move it to the arena as well, so that all records are released alike
+		uint8_t *packed = NULL;
+		uint32_t n = protobuf_pack_message_new((ProtobufCMessage *)corrupt, &packed);
+		record = (AuditRecord *)protobuf_unpack_message_arena(&audit_record__descriptor,
+								      packed, n, arena);
+		mem_free0(packed);
+		protobuf_free_message((ProtobufCMessage *)corrupt);
 	}
 
+	log->read_off = off + len;
+out:
 	close(fd);
+	mem_free0(buf);
 
-	// ensure audit log goes to disk
-	file_syncfs(file);
+	return record;
+}
 
-	mem_free0(file);
-	mem_free0(msg_text);
+/*
+ * Fills the ring with records read from the log.
+ */
+static void
+audit_ring_refill(audit_log_t *log)
+{
+	IF_FALSE_RETURN(log->ring_count < AUDIT_RING_SIZE && audit_log_unread(log));
 
-	return ret;
+	// the records are only needed until they are packed into the ring
+	mem_arena_t *arena = mem_arena_new(AUDIT_READ_ARENA_BLOCK_SIZE);
+	while (log->ring_count < AUDIT_RING_SIZE && audit_log_unread(log)) {
+		AuditRecord *record = audit_log_read(log, arena);
+		if (!record)
+			break;
+
+		audit_ring_push(log, record, NULL, 0);
+		mem_arena_reset(arena);
+	}
+	mem_arena_free(arena);
 }
 
-static AuditRecord *
-audit_next_record_new(const container_t *container, bool purge)
+/*
+ * Stores the records of the ring which are only held in memory to the log. As records are
+ * kept in memory only while all stored records have been read into the ring, they directly
+ * follow the records read last.
+ */
+static int
+audit_ring_spill(audit_log_t *log)
 {
-	AuditRecord *r;
+	bool spilled = false;
+	int ret = 0;
 
-	char *file = audit_log_file_new(uuid_string(container_get_uuid(container)));
-	TRACE("next record in log file '%s'", file);
+	for (unsigned i = 0; i < log->ring_count; i++) {
+		audit_ring_entry_t *e = audit_ring_entry(log, i);
+		if (!e->record)
+			continue;
 
-	if (!file_exists(file)) {
-		ERROR("Failed to read audit record: no file");
-		mem_free0(file);
-		return NULL;
+		if (audit_log_append_buf(log, e->record, e->record_len, false)) {
+			ret = -1;
+			break;
+		}
+		mem_free0(e->record);
+		spilled = true;
 	}
 
-	r = (AuditRecord *)audit_record_from_textfile_new(file, purge);
+	if (spilled) {
+		TRACE("Spilled audit records of ring to log %s", log->dir);
+		log->read_seg = log->tail_seg;
+		log->read_off = log->tail_size + log->commit_len;
+	}
 
-	mem_free0(file);
+	return ret;
+}
 
-	return r;
+static void
+audit_log_commit_foreach_cb(UNUSED const void *key, void *value, UNUSED void *data)
+{
+	audit_ring_spill(value);
+	audit_log_commit(value);
 }
 
 static int
-audit_do_send_record(const container_t *c)
+audit_write_file(audit_log_t *log, const AuditRecord *msg, bool sync)
 {
-	uint8_t *packed = NULL;
-	uint32_t packed_len = 0;
-	int ret = -1;
-	int fd = -1;
+	size_t msg_len = sizeof(uint32_t) + audit_record__get_packed_size(msg);
 
-	char tmpfile[strlen(AUDIT_LOGDIR) + 14];
-	if (0 >= sprintf(tmpfile, "%s/%s", AUDIT_LOGDIR, "audit_XXXXXX")) {
-		ERROR_ERRNO("Failed to prepare temporary filename");
+	//TODO send error message
+	uint64_t remaining = audit_remaining_storage(log);
+	if (remaining < msg_len) {
+		container_t *c = cmld_container_get_by_uuid(log->container_uuid);
+
+		TRACE("Trying to notify container %s about stored audit events,"
+		      " remaining storage: %" PRIu64,
+		      log->uuid, remaining);
+		if ((!c) || (-1 == container_audit_record_notify(c, remaining))) {
+			ERROR("Failed to notify container about audit log overflow");
+		}
+		ERROR("Failed to store audit record: max. log size exceeded");
 		return -1;
 	}
 
-	if (-1 == (fd = mkstemp(tmpfile))) {
-		ERROR_ERRNO("Failed to generate temporary filename");
+	TRACE("Logging audit record to log: %s", log->dir);
+
+	int ret = audit_log_append(log, msg, sync);
+
+	// complete the records buffered for other containers together with this one
+	if (sync)
+		hashmap_foreach(audit_logs, &audit_log_commit_foreach_cb, NULL);
+
+	return ret;
+}
+
+/*
+ * Drops the oldest record of the log by advancing its head.
+ */
+static int
+audit_log_ack(audit_log_t *log)
+{
+	uint32_t len_be;
+	off_t seg_size;
+
+	int fd = audit_log_head_open(log, &seg_size);
+	IF_TRUE_RETVAL(fd < 0, -1);
+
+	ssize_t read = pread(fd, &len_be, sizeof(uint32_t), log->head_off);
+	close(fd);
+
+	if (read != sizeof(uint32_t)) {
+		ERROR_ERRNO("Failed to read length of audit record from %s", log->dir);
 		return -1;
 	}
 
-	CmldToServiceMessage *message_proto = mem_new0(CmldToServiceMessage, 1);
-	cmld_to_service_message__init(message_proto);
-	message_proto->code = CMLD_TO_SERVICE_MESSAGE__CODE__AUDIT_RECORD;
+	log->head_off = MIN(log->head_off + sizeof(uint32_t) + ntohl(len_be), (uint64_t)seg_size);
 
-	if (!(message_proto->audit_record = audit_next_record_new(c, false))) {
-		ERROR("Could not read next audit record");
-		goto out;
-	}
-	TRACE("read next audit record sucessfully");
+	if (log->head_seg == log->tail_seg && log->head_off >= log->tail_size)
+		audit_log_reset(log);
+	else
+		audit_log_persist_head(log);
 
-	packed_len = protobuf_pack_message_new((ProtobufCMessage *)message_proto, &packed);
+	return 0;
+}
 
-	if (!packed) {
-		ERROR("Failed to pack protobuf message");
-		goto out;
+/*
+ * Sends count records of the window starting with the first unsent one in a single
+ * AUDIT_RECORDS message.
+ */
+static int
+audit_ring_send_batch(audit_log_t *log, container_t *c, unsigned count)
+{
+	ProtobufCBinaryData *records = mem_new0(ProtobufCBinaryData, count);
+	for (unsigned i = 0; i < count; i++) {
+		audit_ring_entry_t *e = audit_ring_entry(log, log->sent + i);
+		records[i].data = e->msg;
+		records[i].len = e->msg_len;
 	}
 
-	if (-1 == fd_write(fd, (char *)packed, packed_len)) {
-		ERROR("Failed to write packed message to file.");
-		goto out;
+	CmldToServiceMessage message_proto = CMLD_TO_SERVICE_MESSAGE__INIT;
+	message_proto.code = CMLD_TO_SERVICE_MESSAGE__CODE__AUDIT_RECORDS;
+	message_proto.n_audit_records = count;
+	message_proto.audit_records = records;
+
+	uint8_t *buf = NULL;
+	uint32_t buf_len = protobuf_pack_message_new((ProtobufCMessage *)&message_proto, &buf);
+	mem_free0(records);
+	IF_NULL_RETVAL(buf, -1);
+
+	int ret = container_audit_record_send(c, buf, buf_len);
+	mem_free0(buf);
+	return ret;
+}
+
+/*
+ * Sends the records of the window in order, as far as their hashes are known. Records for a
+ * service supporting batches are sent once all records of the window are hashed.
+ */
+static void
+audit_ring_transmit(audit_log_t *log)
+{
+	container_t *c = cmld_container_get_by_uuid(log->container_uuid);
+	IF_NULL_RETURN_TRACE(c);
+
+	unsigned count = 0;
+	while (log->sent + count < log->submitted && audit_ring_entry(log, log->sent + count)->hash)
+		count++;
+
+	if (log->batch && log->sent + count < log->submitted)
+		count = 0;
+
+	if (log->batch && count > 1) {
+		if (0 > audit_ring_send_batch(log, c, count)) {
+			ERROR("Failed to send batch of audit records to container");
+		} else {
+			TRACE("Sent audit records %" PRIu64 " to %" PRIu64 " to container %s",
+			      audit_ring_entry(log, log->sent)->seq,
+			      audit_ring_entry(log, log->sent + count - 1)->seq, log->uuid);
+			log->sent += count;
+		}
+		count = 0;
 	}
 
-	TRACE("Requesting scd to hash serialized protobuf message at %s", tmpfile);
+	for (; count; count--) {
+		audit_ring_entry_t *e = audit_ring_entry(log, log->sent);
 
-	// this state is needed s.t. additional ACKs from container arriving while scd is hashing the file
-	// do not lead to multiple transmissions of the same record
-	container_audit_set_processing_ack(c, true);
+		if (0 > container_audit_record_send(c, e->msg, e->msg_len)) {
+			ERROR("Failed to send audit record to container");
+			break;
+		}
 
-	if (crypto_hash_file(tmpfile, AUDIT_HASH_ALGO, audit_send_record_cb, (void *)c)) {
-		container_audit_set_processing_ack(c, false);
-		str_t *dump = str_hexdump_new((unsigned char *)packed, (int)packed_len);
-		ERROR("Failed to request hashing of record to be sent with length %u: %s.",
-		      packed_len, str_buffer(dump));
-		mem_free0(dump);
+		TRACE("Sent audit record %" PRIu64 " with ID %s to container %s", e->seq, e->hash,
+		      log->uuid);
+		log->sent++;
 	}
 
-	TRACE("sent next stored audit record sucessfully");
-	ret = 0;
-out:
-	if (ret < 0)
-		ERROR("Failed to send next stored audit record");
+	container_audit_set_processing_ack(c, log->submitted > 0);
+}
 
-	close(fd);
+typedef struct {
+	audit_log_t *log;
+	uint64_t seq;
+} audit_hash_ctx_t;
 
-	mem_free0(packed);
-	protobuf_free_message((ProtobufCMessage *)message_proto);
-	return ret;
+static void
+audit_ring_hash_cb(const char *hash_string, UNUSED const unsigned char *hash_buf,
+		   UNUSED size_t hash_buf_len, UNUSED crypto_hashalgo_t hash_algo, void *data)
+{
+	audit_hash_ctx_t *ctx = data;
+	ASSERT(ctx);
+
+	audit_log_t *log = ctx->log;
+	audit_ring_entry_t *e = audit_ring_entry_by_seq(log, ctx->seq);
+	uint64_t seq = ctx->seq;
+	mem_free0(ctx);
+
+	// record was acknowledged in the meantime
+	IF_NULL_RETURN_TRACE(e);
+
+	e->hashing = false;
+
+	if (!hash_string) {
+		ERROR("Failed to hash audit record %" PRIu64 " of log %s", seq, log->dir);
+		// the next ACK submits the record again
+		log->submitted = log->sent;
+	} else if (!e->hash) {
+		e->hash = mem_strdup(hash_string);
+	}
+
+	audit_ring_transmit(log);
 }
 
+/*
+ * Sends the next records of the log to the container, up to the window of records which may
+ * be unacknowledged at once.
+ */
 static int
-audit_send_next_stored(const container_t *c)
+audit_deliver(audit_log_t *log)
 {
-	if (!c)
-		return -1;
-
-	TRACE("send_next_stored");
-	char *file = audit_log_file_new(uuid_string(container_get_uuid(c)));
+	container_t *c = cmld_container_get_by_uuid(log->container_uuid);
+	IF_NULL_RETVAL(c, -1);
 
-	TRACE("send_next_stored log file: %s", file);
+	audit_ring_refill(log);
 
-	if (!file_exists(file)) {
+	if (!log->ring_count) {
 		TRACE("Sent all stored audit messages");
-		mem_free0(file);
 
 		if (0 > container_audit_notify_complete(c)) {
 			ERROR("Failed to notify container that all records were sent");
@@ -600,13 +1088,37 @@ audit_send_next_stored(const container_t *c)
 
 		return 0;
 	}
-	mem_free0(file);
 
-	return audit_do_send_record(c);
+	while (log->submitted < MIN(log->window, log->ring_count)) {
+		audit_ring_entry_t *e = audit_ring_entry(log, log->submitted);
+
+		if (!e->hash && !e->hashing) {
+			audit_hash_ctx_t *ctx = mem_new0(audit_hash_ctx_t, 1);
+			ctx->log = log;
+			ctx->seq = e->seq;
+
+			if (crypto_hash_buf(e->msg, e->msg_len, AUDIT_HASH_ALGO, audit_ring_hash_cb,
+					    ctx)) {
+				str_t *dump = str_hexdump_new(e->msg, e->msg_len);
+				ERROR("Failed to request hashing of record with length %zu: %s.",
+				      e->msg_len, str_buffer(dump));
+				str_free(dump, true);
+				mem_free0(ctx);
+				break;
+			}
+			e->hashing = true;
+		}
+		log->submitted++;
+	}
+
+	audit_ring_transmit(log);
+
+	return 0;
 }
 
 int
-audit_process_ack(const container_t *c, const char *ack)
+audit_process_ack(const container_t *c, const char *ack, bool has_seq, uint64_t seq,
+		  uint32_t window, bool batch)
 {
 	ASSERT(c);
 
@@ -626,75 +1138,128 @@ audit_process_ack(const container_t *c, const char *ack)
 		      uuid_string(container_get_uuid(c)));
 	}
 
-	if (container_audit_get_processing_ack(c)) {
-		TRACE("Already processing ACK for container %s, ignoring additional ACK",
-		      uuid_string(container_get_uuid(c)));
-		return 0;
-	}
+	audit_log_t *log = audit_log_get(uuid_string(container_get_uuid(c)));
+	IF_NULL_RETVAL(log, -1);
+
+	// services without support for a window only take one record at a time
+	log->window = window ? MIN(window, AUDIT_WINDOW) : 1;
+	log->batch = batch;
 
 	TRACE("Got audit record ACK from container %s: %s", uuid_string(container_get_uuid(c)),
 	      ack);
 
-	TRACE("Last ack for container %s: %s", uuid_string(container_get_uuid(c)),
-	      container_audit_get_last_ack(c));
-
-	if (crypto_match_hash(AUDIT_HASH_ALGO_LEN, container_audit_get_last_ack(c), ack)) {
-		TRACE("ACK hash matched last sent record %s", container_audit_get_last_ack(c));
-
-		AuditRecord *record = audit_next_record_new(c, true);
-
-		if (!record) {
-			ERROR("Failed to delete audit record %s", ack);
-			return -1;
+	// ACKs are cumulative, an ACK for a record also acknowledges all records sent before
+	unsigned acked = 0;
+	for (unsigned i = 0; ack && i < log->sent; i++) {
+		if (crypto_match_hash(AUDIT_HASH_ALGO_LEN, audit_ring_entry(log, i)->hash, ack)) {
+			acked = i + 1;
+			break;
 		}
+	}
 
-		protobuf_free_message((ProtobufCMessage *)record);
-		TRACE("Cleaned up ack'ed record");
+	if (acked) {
+		TRACE("ACK hash matched sent record %" PRIu64 ", %u records acknowledged",
+		      audit_ring_entry(log, acked - 1)->seq, acked);
 
-		container_audit_set_last_ack(c, "");
+		for (unsigned i = 0; i < acked; i++) {
+			if (!audit_ring_entry(log, 0)->record && audit_log_ack(log)) {
+				ERROR("Failed to delete audit record %s", ack);
+				return -1;
+			}
+			audit_ring_pop(log);
+		}
+		log->sent -= acked;
+		log->submitted -= acked;
+		log->resending = false;
+
+		container_audit_set_last_ack(c, ack);
+	} else if (has_seq && log->resending && seq != log->resend_seq) {
+		TRACE("ACK for record %" PRIu64 " sent before resending from %" PRIu64 ", ignoring",
+		      seq, log->resend_seq);
 	} else {
-		WARN("ACK from container %s did not match last sent audit record, try to send last stored record again",
+		// go back to the oldest unacknowledged record, the service dropped the records
+		// following a record it failed to process
+		WARN("ACK from container %s did not match sent audit records, sending again",
 		     uuid_string(container_get_uuid(c)));
+		log->sent = log->submitted = 0;
+		log->resending = log->ring_count > 0;
+		log->resend_seq = log->ring_count ? audit_ring_entry(log, 0)->seq : log->next_seq;
 	}
 
-	return audit_send_next_stored(c);
+	return audit_deliver(log);
+}
+
+void
+audit_stop_delivery(const container_t *c)
+{
+	ASSERT(c);
+
+	IF_TRUE_RETURN(!AUDIT_STORAGE);
+
+	audit_log_t *log = audit_log_get(uuid_string(container_get_uuid(c)));
+	IF_NULL_RETURN(log);
+
+	// records sent to the stopped service are sent again to its next instance
+	log->sent = log->submitted = 0;
+	log->resending = false;
+
+	if (audit_ring_spill(log) || audit_log_commit(log))
+		ERROR("Failed to store audit records of container %s",
+		      uuid_string(container_get_uuid(c)));
 }
 
 static int
-audit_record_log(container_t *c, AuditRecord *record)
+audit_record_log(container_t *c, AuditRecord *record, bool sync)
 {
 	int ret = 0;
 
 	IF_NULL_RETVAL(record, -1);
 
-	if (c) {
-		if (0 != (ret = audit_write_file(container_get_uuid(c), record))) {
-			ERROR("Failed to store audit log for container %s to file",
-			      uuid_string(container_get_uuid(c)));
-			goto out;
-		}
-	} else {
+	if (!c) {
 		TRACE("No audit logging container available, will log to file %s",
 		      AUDIT_DEFAULT_CONTAINER);
-		uuid_t *default_uuid = uuid_new(AUDIT_DEFAULT_CONTAINER);
-		if (0 != (ret = audit_write_file(default_uuid, record))) {
-			ERROR("Failed to store audit log to file");
-			uuid_free(default_uuid);
+	}
+
+	if (!file_is_dir(AUDIT_LOGDIR) && dir_mkdir_p(AUDIT_LOGDIR, 0600)) {
+		ERROR("Failed to create logdir");
+		return -1;
+	}
+
+	audit_log_t *log =
+		audit_log_get(c ? uuid_string(container_get_uuid(c)) : AUDIT_DEFAULT_CONTAINER);
+	IF_NULL_RETVAL(log, -1);
+
+	/*
+	 * Records for a running container are kept in memory as long as the service keeps up,
+	 * they are stored in the log only once the ring is full.
+	 */
+	if (c && COMPARTMENT_STATE_RUNNING == container_get_state(c) && !sync &&
+	    !audit_log_unread(log) && log->ring_count < AUDIT_RING_SIZE) {
+		size_t record_len = audit_record__get_packed_size(record);
+		uint8_t *record_buf = mem_alloc(MAX(record_len, 1));
+		audit_record__pack(record, record_buf);
+
+		audit_ring_push(log, record, record_buf, record_len);
+	} else {
+		if (audit_ring_spill(log))
+			ERROR("Failed to store audit records of ring to log %s", log->dir);
+
+		if (0 != (ret = audit_write_file(log, record, sync))) {
+			ERROR("Failed to store audit log for container %s to file", log->uuid);
 			goto out;
 		}
-		uuid_free(default_uuid);
 	}
 
 	if (c && (container_audit_get_processing_ack(c))) {
-		TRACE("Already processing ACK, do not notify container again");
+		TRACE("Already processing ACK, send record within window");
+		audit_deliver(log);
 		goto out;
 	}
 
 	if (c && (COMPARTMENT_STATE_RUNNING == container_get_state(c))) {
 		bool processing_ack = container_audit_get_processing_ack(c);
 		if (!processing_ack &&
-		    (-1 == container_audit_record_notify(c, audit_remaining_storage(uuid_string(
-								    container_get_uuid(c)))))) {
+		    (-1 == container_audit_record_notify(c, audit_remaining_storage(log)))) {
 			ERROR("Failed to notify container about new audit record");
 		}
 	}
@@ -702,10 +1267,10 @@ out:
 	return ret;
 }
 
-int
-audit_log_event(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT component,
-		AUDIT_EVENTCLASS evclass, const char *evtype, const char *subject_id,
-		int meta_count, ...)
+static int
+audit_log_event_va(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT component,
+		   AUDIT_EVENTCLASS evclass, const char *evtype, const char *subject_id, bool sync,
+		   int meta_count, va_list ap)
 {
 	AuditRecord *record = NULL;
 	AuditRecord__Meta **metas = NULL;
@@ -722,10 +1287,6 @@ audit_log_event(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT com
 			return -1;
 		}
 
-		va_list ap;
-
-		va_start(ap, meta_count);
-
 		metas = mem_alloc0((meta_count / 2) * sizeof(AuditRecord__Meta *));
 		for (int i = 0; i < meta_count / 2; i++) {
 			metas[i] = mem_alloc0(sizeof(AuditRecord__Meta));
@@ -736,7 +1297,6 @@ audit_log_event(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT com
 			metas[i]->value = mem_strdup(va_arg(ap, const char *));
 		}
 
-		va_end(ap);
 		meta_count /= 2;
 	}
 
@@ -753,7 +1313,7 @@ audit_log_event(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT com
 		goto out;
 	}
 
-	if (LOGF_PRIO_TRACE >= LOGF_LOG_MIN_PRIO) {
+	if (logf_prio_enabled(LOGF_PRIO_TRACE)) {
 		char *record_text;
 		size_t msg_len = protobuf_string_from_message(&record_text,
 							      (ProtobufCMessage *)record, NULL);
@@ -767,7 +1327,7 @@ audit_log_event(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT com
 		mem_free0(record_text);
 	}
 
-	ret = audit_record_log(audit_get_log_container(uuid), record);
+	ret = audit_record_log(audit_get_log_container(uuid), record, sync);
 
 out:
 	//if (record)
@@ -777,28 +1337,47 @@ out:
 	return ret;
 }
 
-static void
-audit_cb_kernel_handle_log(int fd, unsigned events, UNUSED event_io_t *io, void *data)
+int
+audit_log_event(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT component,
+		AUDIT_EVENTCLASS evclass, const char *evtype, const char *subject_id,
+		int meta_count, ...)
 {
-	nl_sock_t *audit_sock = data;
-	ASSERT(audit_sock);
-	ASSERT(fd == nl_sock_get_fd(audit_sock));
+	va_list ap;
 
-	char *buf = mem_new0(char, MAX_AUDIT_MESSAGE_LENGTH);
-	char *log_record = NULL;
+	va_start(ap, meta_count);
+	int ret = audit_log_event_va(uuid, category, component, evclass, evtype, subject_id,
+				     false, meta_count, ap);
+	va_end(ap);
 
-	if (events & EVENT_IO_EXCEPT) {
-		goto out;
-	}
+	return ret;
+}
 
-	int msg_len;
-	if ((msg_len = nl_msg_receive_kernel(audit_sock, buf, MAX_AUDIT_MESSAGE_LENGTH, false)) <=
-	    0) {
-		WARN("could not read audit meassge.");
-		goto out;
-	}
+int
+audit_log_event_sync(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT component,
+		     AUDIT_EVENTCLASS evclass, const char *evtype, const char *subject_id,
+		     int meta_count, ...)
+{
+	va_list ap;
+
+	va_start(ap, meta_count);
+	int ret = audit_log_event_va(uuid, category, component, evclass, evtype, subject_id,
+				     true, meta_count, ap);
+	va_end(ap);
 
-	struct nlmsghdr *nlmsg = (struct nlmsghdr *)buf;
+	return ret;
+}
+
+/*
+ * Kernel audit messages are received in batches into static buffers, which are reused
+ * for every batch instead of allocating a message buffer per read.
+ */
+#define AUDIT_KERNEL_RECV_BATCH NL_RECV_BATCH_MAX
+static char audit_kernel_bufs[AUDIT_KERNEL_RECV_BATCH][MAX_AUDIT_MESSAGE_LENGTH];
+
+static void
+audit_kernel_handle_msg(struct nlmsghdr *nlmsg)
+{
+	char *log_record = NULL;
 	uint16_t type = nlmsg->nlmsg_type;
 
 	if (type == AUDIT_TRUSTED_APP) {
@@ -808,13 +1387,13 @@ audit_cb_kernel_handle_log(int fd, unsigned events, UNUSED event_io_t *io, void
 		sscanf(log_record, "%*s pid=%d uid=%d %*8970c", &pid, &uid);
 		TRACE("scanned pid=%d, uid=%d", pid, uid);
 		char *record_text = strstr(log_record, "msg='");
-		IF_NULL_GOTO(record_text, out);
+		IF_NULL_RETURN(record_text);
 		record_text += 5;
 		// remove closing ' char from msg string
 		int record_text_len = strlen(record_text) - 1;
 		AuditRecord *record = (AuditRecord *)protobuf_message_new_from_buf(
 			(uint8_t *)record_text, record_text_len, &audit_record__descriptor);
-		audit_record_log(cmld_container_get_by_uid(uid), record);
+		audit_record_log(cmld_container_get_by_uid(uid), record, false);
 		protobuf_free_message((ProtobufCMessage *)record);
 		TRACE("audit: type=%d %s", type, log_record);
 	} else if (type == AUDIT_USER || type == AUDIT_LOGIN || type == AUDIT_DM_CTRL ||
@@ -845,11 +1424,11 @@ audit_cb_kernel_handle_log(int fd, unsigned events, UNUSED event_io_t *io, void
 		log_record = NLMSG_DATA(nlmsg);
 		uuid_t *uuid = NULL;
 		char *dev_file = NULL;
-		char *op_buf = mem_new0(char, MAX_AUDIT_MESSAGE_LENGTH);
+		char op_buf[64] = { 0 };
 		int dev_major, dev_minor, res;
 		unsigned long long sector;
 		int sscanf_ret =
-			sscanf(log_record, "%*s module=%*s op=%s dev=%d:%d sector=%llu res=%d",
+			sscanf(log_record, "%*s module=%*s op=%63s dev=%d:%d sector=%llu res=%d",
 			       op_buf, &dev_major, &dev_minor, &sector, &res);
 		TRACE("audit: sscanf_ret=%d", sscanf_ret);
 		if (sscanf_ret == 5) {
@@ -887,7 +1466,6 @@ audit_cb_kernel_handle_log(int fd, unsigned events, UNUSED event_io_t *io, void
 			mem_free0(sector_str);
 			mem_free0(dev_name);
 		}
-		mem_free0(op_buf);
 		mem_free0(dev_file);
 		if (uuid)
 			uuid_free(uuid);
@@ -897,8 +1475,86 @@ audit_cb_kernel_handle_log(int fd, unsigned events, UNUSED event_io_t *io, void
 		log_record = NLMSG_DATA(nlmsg);
 		TRACE("audit: type=%d %s", type, log_record);
 	}
-out:
-	mem_free0(buf);
+}
+
+/*
+ * Drains up to AUDIT_KERNEL_RECV_BATCH pending kernel audit messages with a single
+ * syscall. If more are pending, the level triggered io event fires again right away.
+ */
+static void
+audit_cb_kernel_handle_log(int fd, unsigned events, UNUSED event_io_t *io, void *data)
+{
+	nl_sock_t *audit_sock = data;
+	ASSERT(audit_sock);
+	ASSERT(fd == nl_sock_get_fd(audit_sock));
+
+	char *bufs[AUDIT_KERNEL_RECV_BATCH];
+	int lens[AUDIT_KERNEL_RECV_BATCH];
+
+	IF_TRUE_RETURN(events & EVENT_IO_EXCEPT);
+
+	for (int i = 0; i < AUDIT_KERNEL_RECV_BATCH; i++)
+		bufs[i] = audit_kernel_bufs[i];
+
+	// leave room for the terminating null byte of the record strings
+	int n = nl_msg_receive_kernel_batch(audit_sock, bufs, MAX_AUDIT_MESSAGE_LENGTH - 1, lens,
+					    AUDIT_KERNEL_RECV_BATCH);
+	if (n < 0 && errno != EAGAIN)
+		WARN_ERRNO_RATELIMIT("could not read audit messages");
+
+	for (int i = 0; i < n; i++) {
+		if (lens[i] < (int)NLMSG_HDRLEN)
+			continue;
+		bufs[i][lens[i]] = '\0';
+		audit_kernel_handle_msg((struct nlmsghdr *)bufs[i]);
+	}
+}
+
+/*
+ * Classic BPF socket filter, which drops kernel audit messages in the kernel unless
+ * they are of a type forwarded by cmld. Everything else, e.g., syscall records, is
+ * only traced in audit_kernel_handle_msg(), which is not worth a wakeup of cmld.
+ * As BPF loads are big endian, the host order nlmsg_type is loaded byte-wise.
+ */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define AUDIT_NLMSG_TYPE_LO (offsetof(struct nlmsghdr, nlmsg_type))
+#define AUDIT_NLMSG_TYPE_HI (offsetof(struct nlmsghdr, nlmsg_type) + 1)
+#else
+#define AUDIT_NLMSG_TYPE_LO (offsetof(struct nlmsghdr, nlmsg_type) + 1)
+#define AUDIT_NLMSG_TYPE_HI (offsetof(struct nlmsghdr, nlmsg_type))
+#endif
+
+static int
+audit_kernel_attach_filter(nl_sock_t *audit_sock)
+{
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, AUDIT_NLMSG_TYPE_HI),
+		BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, AUDIT_NLMSG_TYPE_LO),
+		BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_TRUSTED_APP, 9, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_USER, 8, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_LOGIN, 7, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_DM_CTRL, 6, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_DM_EVENT, 5, 0),
+		BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, AUDIT_FIRST_USER_MSG, 0, 1),
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, AUDIT_LAST_USER_MSG, 0, 3),
+		BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, AUDIT_FIRST_USER_MSG2, 0, 1),
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, AUDIT_LAST_USER_MSG2, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+	};
+	struct sock_fprog prog = { .len = ELEMENTSOF(filter), .filter = filter };
+
+	if (setsockopt(nl_sock_get_fd(audit_sock), SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+		       sizeof(prog)) < 0) {
+		WARN_ERRNO("Could not attach socket filter to audit socket");
+		return -1;
+	}
+
+	TRACE("Attached audit socket filter");
+	return 0;
 }
 
 int
@@ -922,6 +1578,8 @@ audit_init(uint32_t size)
 		return -1;
 	}
 
+	audit_kernel_attach_filter(audit_sock);
+
 	event_io_t *audit_io_event = event_io_new(nl_sock_get_fd(audit_sock), EVENT_IO_READ,
 						  &audit_cb_kernel_handle_log, audit_sock);
 	event_add_io(audit_io_event);
@@ -48,8 +48,42 @@ audit_log_event(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT com
 		AUDIT_EVENTCLASS evclass, const char *evtype, const char *subject_id,
 		int meta_count, ...);
 
+/**
+ * Like audit_log_event(), but returns only after the record has been stored. Records
+ * are usually buffered for a few milliseconds and stored in groups, this also stores all
+ * buffered records together with the new one. Used for records which have to survive the
+ * immediately following action, e.g., a device shutdown.
+ */
+int
+audit_log_event_sync(const uuid_t *uuid, AUDIT_CATEGORY category, AUDIT_COMPONENT component,
+		     AUDIT_EVENTCLASS evclass, const char *evtype, const char *subject_id,
+		     int meta_count, ...);
+
+/**
+ * Processes an ACK of the service of the container for the record with the hash ack.
+ *
+ * @param has_seq true if the ACK refers to the record with the sequence number seq
+ * @param window number of records the service accepts unacknowledged, 0 if unknown
+ * @param batch true if the service accepts several records in one message
+ */
 int
-audit_process_ack(const container_t *audit, const char *ack);
+audit_process_ack(const container_t *audit, const char *ack, bool has_seq, uint64_t seq,
+		  uint32_t window, bool batch);
+
+/**
+ * Stores the records for the container which are only held in memory to its log and
+ * restarts the delivery, as the service of the container stopped.
+ */
+void
+audit_stop_delivery(const container_t *c);
+
+/**
+ * Calls func for the log of each container with the bytes of the records stored in the log
+ * and the number of records queued in memory for delivery to the container.
+ */
+void
+audit_foreach_queue(void (*func)(const char *uuid, uint64_t stored, unsigned queued, void *data),
+		    void *data);
 
 int
 audit_init(uint32_t size);
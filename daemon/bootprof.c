@@ -0,0 +1,245 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#define _GNU_SOURCE
+
+#include "bootprof.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/event.h"
+#include "common/file.h"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BOOTPROF_MAGIC "CMLBPRF1"
+// size of the windows of the device which are mapped at once for mincore()
+#define BOOTPROF_WINDOW_SIZE (256 * 1024 * 1024)
+// maximum length of the header line including the id
+#define BOOTPROF_HEADER_MAX 256
+
+/**
+ * Opens profile_file and checks its header against id.
+ * @return the opened profile positioned after the header or NULL
+ */
+static FILE *
+bootprof_open(const char *profile_file, const char *id)
+{
+	char header[BOOTPROF_HEADER_MAX];
+	char *expected = mem_printf("%s %s\n", BOOTPROF_MAGIC, id);
+
+	FILE *f = fopen(profile_file, "re");
+	if (f && (!fgets(header, sizeof(header), f) || strcmp(header, expected))) {
+		fclose(f);
+		f = NULL;
+	}
+
+	mem_free0(expected);
+	return f;
+}
+
+bool
+bootprof_is_valid(const char *profile_file, const char *id)
+{
+	FILE *f = bootprof_open(profile_file, id);
+	if (f)
+		fclose(f);
+	return f != NULL;
+}
+
+static int
+bootprof_record_block(const char *dev, const char *id, const char *profile_file)
+{
+	int ret = -1;
+	uint64_t ranges = 0, resident = 0;
+	uint64_t start = 0, len = 0;
+	unsigned char *vec = NULL;
+	FILE *out = NULL;
+	char *tmp_file = mem_printf("%s.tmp", profile_file);
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	int fd = open(dev, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ERROR_ERRNO("Could not open %s", dev);
+		goto out;
+	}
+
+	off_t size = lseek(fd, 0, SEEK_END);
+	if (size <= 0) {
+		ERROR_ERRNO("Could not get size of %s", dev);
+		goto out;
+	}
+
+	if (!(out = fopen(tmp_file, "we"))) {
+		ERROR_ERRNO("Could not create %s", tmp_file);
+		goto out;
+	}
+	fprintf(out, "%s %s\n", BOOTPROF_MAGIC, id);
+
+	vec = mem_alloc(BOOTPROF_WINDOW_SIZE / page_size);
+	for (off_t off = 0; off < size; off += BOOTPROF_WINDOW_SIZE) {
+		size_t win = MIN(size - off, BOOTPROF_WINDOW_SIZE);
+		void *map = mmap(NULL, win, PROT_READ, MAP_SHARED, fd, off);
+		if (map == MAP_FAILED) {
+			ERROR_ERRNO("Could not map %s", dev);
+			goto out;
+		}
+		int r = mincore(map, win, vec);
+		munmap(map, win);
+		if (r < 0) {
+			ERROR_ERRNO("mincore failed for %s", dev);
+			goto out;
+		}
+
+		// merge resident pages to ranges
+		for (size_t i = 0; i < (win + page_size - 1) / page_size; i++) {
+			if (!(vec[i] & 1))
+				continue;
+			uint64_t page = off + i * page_size;
+			if (len && start + len == page) {
+				len += page_size;
+			} else {
+				if (len)
+					fprintf(out, "%" PRIu64 " %" PRIu64 "\n", start, len);
+				start = page;
+				len = page_size;
+				ranges++;
+			}
+			resident++;
+		}
+	}
+	if (len)
+		fprintf(out, "%" PRIu64 " %" PRIu64 "\n", start, len);
+
+	if (fclose(out) != 0) {
+		out = NULL;
+		ERROR_ERRNO("Could not write %s", tmp_file);
+		goto out;
+	}
+	out = NULL;
+
+	if (rename(tmp_file, profile_file) < 0) {
+		ERROR_ERRNO("Could not rename %s to %s", tmp_file, profile_file);
+		goto out;
+	}
+
+	INFO("Recorded boot profile %s of %s: %" PRIu64 " pages in %" PRIu64 " ranges",
+	     profile_file, dev, resident, ranges);
+	ret = 0;
+out:
+	if (out)
+		fclose(out);
+	if (ret < 0)
+		unlink(tmp_file);
+	if (fd >= 0)
+		close(fd);
+	if (vec)
+		mem_free0(vec);
+	mem_free0(tmp_file);
+	return ret;
+}
+
+static int
+bootprof_prewarm_block(const char *dev, const char *id, const char *profile_file)
+{
+	uint64_t start, len, total = 0;
+
+	FILE *f = bootprof_open(profile_file, id);
+	if (!f) {
+		DEBUG("Removing boot profile %s of another image version", profile_file);
+		unlink(profile_file);
+		return -1;
+	}
+
+	int fd = open(dev, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ERROR_ERRNO("Could not open %s", dev);
+		fclose(f);
+		return -1;
+	}
+
+	// the read ahead is submitted without waiting for the reads to complete
+	while (fscanf(f, "%" SCNu64 " %" SCNu64, &start, &len) == 2) {
+		int err = posix_fadvise(fd, start, len, POSIX_FADV_WILLNEED);
+		if (err) {
+			errno = err;
+			WARN_ERRNO("Read ahead of %s failed", dev);
+			break;
+		}
+		total += len;
+	}
+
+	DEBUG("Prewarmed %" PRIu64 " bytes of %s from %s", total, dev, profile_file);
+	close(fd);
+	fclose(f);
+	return 0;
+}
+
+static void
+bootprof_child_cb(pid_t pid, int status, event_child_t *child, UNUSED void *data)
+{
+	bool success = WIFEXITED(status) && !WEXITSTATUS(status);
+	TRACE("Boot profile child (PID=%d) %s", pid, success ? "succeeded" : "failed");
+	event_child_free(child);
+}
+
+static int
+bootprof_fork(int (*func)(const char *dev, const char *id, const char *profile_file),
+	      const char *dev, const char *id, const char *profile_file)
+{
+	ASSERT(dev && id && profile_file);
+
+	pid_t pid = fork();
+	switch (pid) {
+	case -1:
+		ERROR_ERRNO("Could not fork for boot profile %s", profile_file);
+		return -1;
+	case 0:
+		_exit(func(dev, id, profile_file) < 0 ? 1 : 0);
+	default: {
+		event_child_t *child = event_child_new(pid, bootprof_child_cb, NULL);
+		event_add_child(child);
+		return 0;
+	}
+	}
+}
+
+int
+bootprof_record(const char *dev, const char *id, const char *profile_file)
+{
+	return bootprof_fork(bootprof_record_block, dev, id, profile_file);
+}
+
+int
+bootprof_prewarm(const char *dev, const char *id, const char *profile_file)
+{
+	return bootprof_fork(bootprof_prewarm_block, dev, id, profile_file);
+}
@@ -0,0 +1,70 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#ifndef BOOTPROF_H
+#define BOOTPROF_H
+
+/**
+ * @file bootprof.h Records and replays the boot profiles of read-only images.
+ *
+ * A boot profile lists the ranges of an image's block device which were read
+ * during a container boot, taken as a snapshot of the device's page cache with
+ * mincore() once the container is running. On the next start, the ranges are
+ * read ahead with POSIX_FADV_WILLNEED right after the device is set up, so the
+ * random reads of init and the services mostly hit the page cache.
+ *
+ * The profile is a text file with the header line
+ *
+ *	CMLBPRF1 <id>
+ *
+ * followed by one "<offset> <length>" line per range in bytes. The id, e.g.
+ * the hash of the image, ties the profile to one version of the image.
+ */
+
+#include <stdbool.h>
+
+/**
+ * Checks if profile_file exists and was recorded for the image identified by id.
+ */
+bool
+bootprof_is_valid(const char *profile_file, const char *id);
+
+/**
+ * Records the page cache state of the block device dev to profile_file in a
+ * child process.
+ *
+ * @return 0 if the child was started, -1 otherwise
+ */
+int
+bootprof_record(const char *dev, const char *id, const char *profile_file);
+
+/**
+ * Reads ahead the ranges of profile_file on the block device dev in a child
+ * process. A profile recorded for another id is removed.
+ *
+ * @return 0 if the child was started, -1 otherwise
+ */
+int
+bootprof_prewarm(const char *dev, const char *id, const char *profile_file);
+
+#endif /* BOOTPROF_H */
@@ -0,0 +1,308 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "bootsched.h"
+
+#include "cmld.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/list.h"
+#include "common/uuid.h"
+#include "common/event.h"
+
+#include <string.h>
+
+typedef struct bootsched_entry {
+	uuid_t *uuid;
+	bootsched_start_cb_t func; // NULL for the autostart by cmld_container_start()
+	void *data;
+} bootsched_entry_t;
+
+// time in seconds a running container is waited for to reach a milestone
+#define BOOTSCHED_MILESTONE_TIMEOUT 60
+
+static list_t *bootsched_pending_list = NULL; // containers to be started (bootsched_entry_t)
+static unsigned int bootsched_starting = 0;
+static unsigned int bootsched_parallelism = 0;
+static event_timer_t *bootsched_milestone_timer = NULL;
+
+static bool
+bootsched_is_pending(const container_t *container)
+{
+	for (list_t *l = bootsched_pending_list; l; l = l->next) {
+		bootsched_entry_t *entry = l->data;
+		if (uuid_equals(entry->uuid, container_get_uuid(container)))
+			return true;
+	}
+	return false;
+}
+
+static void
+bootsched_entry_free(bootsched_entry_t *entry)
+{
+	uuid_free(entry->uuid);
+	mem_free0(entry);
+}
+
+static container_t *
+bootsched_get_by_name_or_uuid(const char *id)
+{
+	for (int i = 0; i < cmld_containers_get_count(); i++) {
+		container_t *container = cmld_container_get_by_index(i);
+		if (!strcmp(container_get_name(container), id) ||
+		    !strcmp(uuid_string(container_get_uuid(container)), id))
+			return container;
+	}
+	return NULL;
+}
+
+static bool
+bootsched_has_milestone(const container_t *container, const char *name)
+{
+	for (const list_t *l = container_get_milestones(container); l; l = l->next) {
+		const container_milestone_t *milestone = l->data;
+		if (!strcmp(milestone->name, name))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Returns true if the container waits for another one, i.e., one of its start_after
+ * containers is not running yet but is about to be started. For a start_after entry
+ * "<container>:<milestone>", the container waits until the milestone is reached instead,
+ * but at most BOOTSCHED_MILESTONE_TIMEOUT after the other container is running. Such a
+ * wait for a running container is reported in milestone_wait.
+ */
+static bool
+bootsched_is_waiting(const container_t *container, bool *milestone_wait)
+{
+	for (const list_t *l = container_get_start_after_list(container); l; l = l->next) {
+		const char *milestone = strchr(l->data, ':');
+		char *id = milestone ? mem_strndup(l->data, milestone - (char *)l->data) :
+				       mem_strdup(l->data);
+		container_t *dep = bootsched_get_by_name_or_uuid(id);
+		mem_free0(id);
+		if (!dep || dep == container)
+			continue;
+
+		if (milestone && bootsched_has_milestone(dep, milestone + 1))
+			continue;
+
+		compartment_state_t state = container_get_state(dep);
+		if (state == COMPARTMENT_STATE_RUNNING) {
+			if (milestone && container_get_uptime(dep) < BOOTSCHED_MILESTONE_TIMEOUT) {
+				*milestone_wait = true;
+				return true;
+			}
+			continue;
+		}
+		if (bootsched_is_pending(dep) || state == COMPARTMENT_STATE_STARTING ||
+		    state == COMPARTMENT_STATE_BOOTING || state == COMPARTMENT_STATE_SETUP ||
+		    state == COMPARTMENT_STATE_REBOOTING)
+			return true;
+	}
+	return false;
+}
+
+static void
+bootsched_run(void);
+
+static void
+bootsched_milestone_timeout_cb(event_timer_t *timer, UNUSED void *data)
+{
+	event_remove_timer(timer);
+	event_timer_free(timer);
+	bootsched_milestone_timer = NULL;
+
+	bootsched_run();
+}
+
+static void
+bootsched_observer_cb(container_t *container, container_callback_t *cb, UNUSED void *data)
+{
+	compartment_state_t state = container_get_state(container);
+	IF_FALSE_RETURN(state == COMPARTMENT_STATE_RUNNING || state == COMPARTMENT_STATE_STOPPED ||
+			state == COMPARTMENT_STATE_ZOMBIE);
+
+	DEBUG("Boot of container %s completed, releasing its start slot",
+	      container_get_description(container));
+	container_unregister_observer(container, cb);
+	bootsched_starting--;
+	bootsched_run();
+}
+
+static void
+bootsched_start_container(container_t *container, bootsched_entry_t *entry)
+{
+	if (entry->func) {
+		INFO("Starting scheduled container %s", container_get_name(container));
+		if (entry->func(container, entry->data) < 0) {
+			WARN("Scheduled start of container %s failed",
+			     container_get_description(container));
+			return;
+		}
+	} else {
+		INFO("Autostarting container %s in background", container_get_name(container));
+		if (cmld_container_start(container) < 0) {
+			WARN("Autostart of container %s failed",
+			     container_get_description(container));
+			return;
+		}
+	}
+
+	compartment_state_t state = container_get_state(container);
+	IF_TRUE_RETURN(state == COMPARTMENT_STATE_RUNNING || state == COMPARTMENT_STATE_STOPPED);
+
+	if (!container_register_observer(container, &bootsched_observer_cb, NULL)) {
+		WARN("Could not register boot scheduler observer for %s",
+		     container_get_description(container));
+		return;
+	}
+	bootsched_starting++;
+}
+
+/*
+ * Starts pending containers until all slots are taken. Of the containers which do not
+ * wait for others, the first one with the highest priority is started next.
+ */
+static void
+bootsched_run(void)
+{
+	while (bootsched_pending_list &&
+	       (!bootsched_parallelism || bootsched_starting < bootsched_parallelism)) {
+		list_t *next = NULL;
+		unsigned int next_prio = 0;
+		bool milestone_wait = false;
+
+		for (list_t *l = bootsched_pending_list; l;) {
+			list_t *elem = l;
+			l = l->next;
+
+			bootsched_entry_t *entry = elem->data;
+			container_t *container = cmld_container_get_by_uuid(entry->uuid);
+			if (!container) {
+				// container was removed in the meantime
+				bootsched_pending_list = list_unlink(bootsched_pending_list, elem);
+				if (entry->func)
+					entry->func(NULL, entry->data);
+				bootsched_entry_free(entry);
+				continue;
+			}
+			if (bootsched_is_waiting(container, &milestone_wait))
+				continue;
+
+			unsigned int prio = container_get_start_priority(container);
+			if (!next || prio > next_prio) {
+				next = elem;
+				next_prio = prio;
+			}
+		}
+
+		if (!next) {
+			// the dependencies may be satisfied by the containers still starting
+			IF_TRUE_RETURN(bootsched_starting > 0 || !bootsched_pending_list);
+
+			// or by running containers which did not reach a milestone yet
+			if (milestone_wait) {
+				if (!bootsched_milestone_timer) {
+					bootsched_milestone_timer = event_timer_new(
+						BOOTSCHED_MILESTONE_TIMEOUT * 1000, 1,
+						bootsched_milestone_timeout_cb, NULL);
+					event_add_timer(bootsched_milestone_timer);
+				}
+				return;
+			}
+
+			// nothing is starting anymore, break the dependency cycle
+			next = bootsched_pending_list;
+			WARN("Start dependencies cannot be satisfied, starting container %s anyway",
+			     uuid_string(((bootsched_entry_t *)next->data)->uuid));
+		}
+
+		bootsched_entry_t *entry = next->data;
+		bootsched_pending_list = list_unlink(bootsched_pending_list, next);
+
+		container_t *container = cmld_container_get_by_uuid(entry->uuid);
+		if (container)
+			bootsched_start_container(container, entry);
+		else if (entry->func)
+			entry->func(NULL, entry->data);
+		bootsched_entry_free(entry);
+	}
+}
+
+void
+bootsched_start(const list_t *container_list, unsigned int parallelism)
+{
+	bootsched_parallelism = parallelism;
+
+	for (const list_t *l = container_list; l; l = l->next) {
+		container_t *container = l->data;
+		if (!container_get_allow_autostart(container) ||
+		    container == cmld_containers_get_c0() || bootsched_is_pending(container))
+			continue;
+
+		for (const list_t *d = container_get_start_after_list(container); d; d = d->next) {
+			if (!bootsched_get_by_name_or_uuid(d->data))
+				WARN("Container %s should start after unknown container %s",
+				     container_get_name(container), (char *)d->data);
+		}
+
+		bootsched_entry_t *entry = mem_new0(bootsched_entry_t, 1);
+		entry->uuid = uuid_new(uuid_string(container_get_uuid(container)));
+		bootsched_pending_list = list_append(bootsched_pending_list, entry);
+	}
+
+	INFO("Scheduled %d containers for autostart with parallelism %u",
+	     list_length(bootsched_pending_list), parallelism);
+	bootsched_run();
+}
+
+void
+bootsched_update(void)
+{
+	IF_NULL_RETURN_TRACE(bootsched_pending_list);
+	bootsched_run();
+}
+
+void
+bootsched_schedule(container_t *container, unsigned int parallelism, bootsched_start_cb_t func,
+		   void *data)
+{
+	ASSERT(container);
+	ASSERT(func);
+
+	bootsched_parallelism = parallelism;
+
+	bootsched_entry_t *entry = mem_new0(bootsched_entry_t, 1);
+	entry->uuid = uuid_new(uuid_string(container_get_uuid(container)));
+	entry->func = func;
+	entry->data = data;
+	bootsched_pending_list = list_append(bootsched_pending_list, entry);
+
+	DEBUG("Scheduled start of container %s", container_get_description(container));
+	bootsched_run();
+}
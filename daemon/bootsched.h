@@ -0,0 +1,83 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#ifndef BOOTSCHED_H
+#define BOOTSCHED_H
+
+/**
+ * @file bootsched.h Schedules the autostart of the containers at boot.
+ *
+ * The containers are started in the background, at most a configured number
+ * at once, so that their boots do not contend for the storage and the CPUs.
+ * A container occupies its slot until it is running or stopped again. Of the
+ * pending containers, the one with the highest start priority whose start_after
+ * containers are running is started next. A start_after entry of the form
+ * "<container>:<milestone>" is only satisfied once the container reported the
+ * readiness milestone through cml-service, or did not report it for a while.
+ * Dependencies on unknown containers or on containers which are neither running
+ * nor about to start, e.g. because their start failed, are ignored.
+ *
+ * Besides the autostart at boot, single containers can be scheduled with their own
+ * start function, e.g. for the bulk start of containers requested by a controller.
+ */
+
+#include "container.h"
+
+#include <stdint.h>
+
+/**
+ * Schedules the start of all containers of the list which allow autostart.
+ * Containers which are already scheduled are not scheduled twice.
+ *
+ * @param parallelism maximum number of concurrently starting containers, 0 for no limit
+ */
+void
+bootsched_start(const list_t *container_list, unsigned int parallelism);
+
+/**
+ * Starts pending containers whose dependencies got satisfied by other means than a state
+ * change, i.e., if a container reached a milestone.
+ */
+void
+bootsched_update(void);
+
+/**
+ * Called to start a container scheduled by bootsched_schedule(), or with container
+ * set to NULL if it was removed before its turn. Takes the ownership of data.
+ *
+ * @return 0 if the start was initiated, -1 on error
+ */
+typedef int (*bootsched_start_cb_t)(container_t *container, void *data);
+
+/**
+ * Schedules the start of the given container with func instead of cmld_container_start().
+ * The container is scheduled even if it is already pending for autostart.
+ *
+ * @param parallelism maximum number of concurrently starting containers, 0 for no limit
+ */
+void
+bootsched_schedule(container_t *container, unsigned int parallelism, bootsched_start_cb_t func,
+		   void *data);
+
+#endif /* BOOTSCHED_H */
@@ -33,6 +33,7 @@
 #include "common/file.h"
 #include "common/audit.h"
 #include "container.h"
+#include "audit.h"
 
 #include <string.h>
 #include <unistd.h>
@@ -192,6 +193,16 @@ c_audit_get_loginuid(void *auditp)
 	return audit->loginuid;
 }
 
+static void
+c_audit_cleanup(void *auditp, UNUSED bool is_rebooting)
+{
+	c_audit_t *audit = auditp;
+	ASSERT(audit);
+
+	audit->processing_ack = false;
+	audit_stop_delivery(audit->container);
+}
+
 static compartment_module_t c_audit_module = {
 	.name = MOD_NAME,
 	.compartment_new = c_audit_new,
@@ -207,7 +218,7 @@ static compartment_module_t c_audit_module = {
 	.start_pre_exec_child_early = NULL,
 	.start_pre_exec_child = NULL,
 	.stop = NULL,
-	.cleanup = NULL,
+	.cleanup = c_audit_cleanup,
 	.join_ns = NULL,
 };
 
@@ -34,6 +34,8 @@
 
 #include "container.h"
 
+#include <limits.h>
+#include <string.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <sys/inotify.h>
@@ -47,24 +49,30 @@
 typedef struct c_automount {
 	container_t *container;
 	event_inotify_t *inotify_dev;
+	ns_helper_t *mountns_helper; // executes the mounts in the mntns of the container
 } c_automount_t;
 
 struct c_automount_mount_timer_data {
 	char *path;
-	container_t *container;
+	c_automount_t *automount;
 	int retry;
 };
 
+// request data of c_automount_mountns, copied to the mountns helper
+struct c_automount_mount_req {
+	char path[PATH_MAX];
+};
+
 static int
 c_automount_mountns(const void *data)
 {
 	ASSERT(data);
 
-	const struct c_automount_mount_timer_data *tdata = data;
+	const struct c_automount_mount_req *req = data;
 	int ret = 0;
 
 	char *fstypes[] = { "vfat", "ext4", "btrfs", "ext2", "ext3" };
-	char *basename_path = mem_strdup(tdata->path);
+	char *basename_path = mem_strdup(req->path);
 	char *devname = basename(basename_path);
 	char *mount_path = mem_printf("/media/external/%s", devname);
 
@@ -76,18 +84,16 @@ c_automount_mountns(const void *data)
 	for (int i = 0; i < 5; ++i) {
 		char *mount_data = NULL;
 
-		ret = mount(tdata->path, mount_path, fstypes[i], MS_RELATIME, mount_data);
+		ret = mount(req->path, mount_path, fstypes[i], MS_RELATIME, mount_data);
 
 		if (mount_data)
 			mem_free0(mount_data);
 
 		if (ret == 0) {
-			INFO("Mounting %s to %s fstype = %s in container %s!", tdata->path,
-			     mount_path, fstypes[i],
-			     uuid_string(container_get_uuid(tdata->container)));
+			INFO("Mounting %s to %s fstype = %s!", req->path, mount_path, fstypes[i]);
 			break;
 		} else {
-			DEBUG_ERRNO("Failed mounting %s to %s fstype = %s!", tdata->path,
+			DEBUG_ERRNO("Failed mounting %s to %s fstype = %s!", req->path,
 				    mount_path, fstypes[i]);
 		}
 	}
@@ -104,19 +110,30 @@ c_automount_mount_timer_cb(event_timer_t *timer, void *data)
 	ASSERT(data);
 
 	struct c_automount_mount_timer_data *tdata = data;
+	container_t *container = tdata->automount->container;
+
+	struct c_automount_mount_req req;
+	mem_memset0(&req, sizeof(req));
+	strncpy(req.path, tdata->path, sizeof(req.path) - 1);
+
 	/*
 	 * We change to the mapped root user in the container.
 	 * Otherwise, if we just use system root with uid 0, we cannot write
 	 * mounts mounted by the container itself, e.g. '/tmp'. This would
 	 * result in an "errno (75: Value too large for defined data type)".
-	 * To still allow mount, we need to preserve system-wide CAP_SYS_ADMIN'.
+	 * To still allow mount, we need to preserve system-wide CAP_SYS_ADMIN', which is
+	 * done by the mountns helper.
 	 */
-	int ret = namespace_exec(container_get_pid(tdata->container), CLONE_NEWNS,
-				 container_get_uid(tdata->container), CAP_SYS_ADMIN,
-				 c_automount_mountns, data);
+	int ret = ns_helper_exec(tdata->automount->mountns_helper, container_get_pid(container),
+				 container_get_uid(container), c_automount_mountns, &req,
+				 sizeof(req));
 
 	IF_TRUE_RETURN(ret && tdata->retry++ < C_AUTOMOUNT_MOUNT_RETRIES);
 
+	if (!ret)
+		INFO("Mounted %s in container %s", tdata->path,
+		     container_get_description(container));
+
 	mem_free0(tdata->path);
 	mem_free0(tdata);
 
@@ -168,7 +185,7 @@ c_automount_mount_watch_dev_dir_cb(const char *path, uint32_t mask, UNUSED event
 	struct c_automount_mount_timer_data *tdata =
 		mem_new0(struct c_automount_mount_timer_data, 1);
 	tdata->path = mem_strdup(path);
-	tdata->container = automount->container;
+	tdata->automount = automount;
 	tdata->retry = 0;
 	event_timer_t *e = event_timer_new(1000, EVENT_TIMER_REPEAT_FOREVER,
 					   c_automount_mount_timer_cb, tdata);
@@ -183,6 +200,7 @@ c_automount_new(compartment_t *compartment)
 
 	c_automount_t *automount = mem_new0(c_automount_t, 1);
 	automount->container = compartment_get_extension_data(compartment);
+	automount->mountns_helper = ns_helper_new(CLONE_NEWNS, CAP_SYS_ADMIN);
 
 	// watch /dev for device nodes to appear in filesystem
 	automount->inotify_dev = event_inotify_new("/dev", IN_CREATE,
@@ -199,6 +217,7 @@ c_automount_free(void *automountp)
 
 	event_inotify_free(automount->inotify_dev);
 	automount->inotify_dev = NULL;
+	ns_helper_free(automount->mountns_helper);
 
 	mem_free0(automount);
 }
@@ -249,6 +268,8 @@ c_automount_stop(void *automountp)
 	ASSERT(automount);
 
 	event_remove_inotify(automount->inotify_dev);
+	// do not keep the mntns of the stopped container busy
+	ns_helper_stop(automount->mountns_helper);
 
 	return 0;
 }
@@ -282,6 +303,7 @@ static compartment_module_t c_automount_module = {
 	.stop = c_automount_stop,
 	.cleanup = c_automount_cleanup,
 	.join_ns = NULL,
+	.flags = COMPARTMENT_MODULE_F_LAZY,
 };
 
 static void INIT
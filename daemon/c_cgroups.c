@@ -36,6 +36,7 @@
 #include <string.h>
 
 #include "cmld.h"
+#include "cpuset.h"
 #include "mount.h"
 
 #include "common/mem.h"
@@ -46,6 +47,7 @@
 
 #include <limits.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/mount.h>
@@ -796,7 +798,12 @@ c_cgroups_set_cpus_allowed(const c_cgroups_t *cgroups, char *path)
 		      cpuset_mems_path);
 		goto out;
 	}
-	if (file_printf(cpuset_mems_path, "0") == -1) {
+	// keep the memory local to the NUMA nodes of the cpus
+	char *mems = cpuset_mems_new(container_get_cpus_allowed(cgroups->container));
+	int written = file_printf(cpuset_mems_path, "%s", mems ? mems : "0");
+	if (mems)
+		mem_free0(mems);
+	if (written == -1) {
 		ERROR("Could not write to cgroups cpuset file in %s", cpuset_mems_path);
 		goto out;
 	}
@@ -1215,24 +1222,29 @@ c_cgroups_start_child(void *cgroupsp)
 }
 
 static int
-c_cgroups_cleanup_subsys_remove_cb(const char *path, const char *name, UNUSED void *data)
+c_cgroups_cleanup_subsys_remove_cb(int dirfd, const char *name, unsigned char type,
+				   UNUSED void *data)
 {
 	int ret = 0;
-	char *file_to_remove = mem_printf("%s/%s", path, name);
-	if (file_is_dir(file_to_remove)) {
-		TRACE("Removing cgroup subsys in %s is dir", file_to_remove);
-		if (dir_foreach(file_to_remove, &c_cgroups_cleanup_subsys_remove_cb, NULL) < 0) {
-			ERROR_ERRNO("Could not delete cgroup subsys contents in %s",
-				    file_to_remove);
-			ret--;
-		}
-		TRACE("Removing now empty subsys %s", file_to_remove);
-		if (rmdir(file_to_remove) < 0) {
-			ERROR_ERRNO("Could not delete cgroup subsys %s", file_to_remove);
-			ret--;
-		}
+
+	// only subfolders need to be removed, the control files vanish with them
+	if (dir_entry_type(dirfd, name, type) != DT_DIR)
+		return 0;
+
+	TRACE("Removing cgroup subsys in %s is dir", name);
+	int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 || dir_foreach_at(fd, &c_cgroups_cleanup_subsys_remove_cb, NULL) < 0) {
+		ERROR_ERRNO("Could not delete cgroup subsys contents in %s", name);
+		ret--;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	TRACE("Removing now empty subsys %s", name);
+	if (unlinkat(dirfd, name, AT_REMOVEDIR) < 0) {
+		ERROR_ERRNO("Could not delete cgroup subsys %s", name);
+		ret--;
 	}
-	mem_free0(file_to_remove);
 	return ret;
 }
 
@@ -1258,10 +1270,12 @@ c_cgroups_cleanup(void *cgroupsp, UNUSED bool is_rebooting)
 		char *subsys_path = mem_printf("%s/%s/%s", CGROUPS_FOLDER, subsys,
 					       uuid_string(container_get_uuid(cgroups->container)));
 
-		if (file_exists(subsys_path) && file_is_dir(subsys_path)) {
+		int fd = open(subsys_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd >= 0) {
 			/* recursively remove all subfolders which the container may have created */
-			if (dir_foreach(subsys_path, &c_cgroups_cleanup_subsys_remove_cb, NULL) <
-			    0) {
+			int ret = dir_foreach_at(fd, &c_cgroups_cleanup_subsys_remove_cb, NULL);
+			close(fd);
+			if (ret < 0) {
 				WARN_ERRNO("Could not remove cgroup %s for container %s", subsys,
 					   container_get_description(cgroups->container));
 			} else if (rmdir(subsys_path) < 0) {
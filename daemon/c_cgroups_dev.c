@@ -62,10 +62,28 @@ typedef struct c_cgroups_dev_item {
 	short access;
 } c_cgroups_dev_item_t;
 
+/*
+ * Key and value of the device map which is looked up by the bpf program. A wildcard in a rule
+ * is mapped to C_CGROUPS_DEV_ANY in the key. The value holds the access bits of the deny and
+ * allow rules for the key.
+ */
+typedef struct c_cgroups_dev_key {
+	__u32 type, major, minor;
+} c_cgroups_dev_key_t;
+
+typedef struct c_cgroups_dev_value {
+	__u32 deny;
+	__u32 allow;
+} c_cgroups_dev_value_t;
+
+#define C_CGROUPS_DEV_ANY 0xFFFFFFFF
+#define C_CGROUPS_DEV_MAP_MAX_ENTRIES 4096
+
 typedef struct c_cgroups_bpf_prog {
 	struct bpf_insn *insn;
 	int insn_n_structs;
 	int fd;
+	int map_fd; // device map used by the program
 	char *name;
 } c_cgroups_bpf_prog_t;
 
@@ -309,163 +327,170 @@ c_cgroups_dev_bpf_prog_free(c_cgroups_bpf_prog_t *prog)
 	mem_free0(prog);
 }
 
-#define INSNR_TYPE(di) ((di->type > 0) ? 1 : 0)
-#define INSNR_MAJOR(di) ((di->major >= 0) ? 1 : 0)
-#define INSNR_MINOR(di) ((di->minor >= 0) ? 1 : 0)
-#define INSNR_ACCESS(di) ((di->access != LEGACY_DEVCG_ACC_ALL) ? 3 : 0)
-
-/*
- * inspired by implementations of lxc, procd and systemd
- */
-static c_cgroups_bpf_prog_t *
-c_cgroups_dev_bpf_prog_generate(list_t *dev_items_denied, list_t *dev_items)
+static void
+c_cgroups_dev_key_from_item(c_cgroups_dev_key_t *key, const c_cgroups_dev_item_t *dev_item)
 {
-	const struct bpf_insn pre_insn[] = {
-		// load type to R2
-		BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_1, 0),
-		BPF_ALU32_IMM(BPF_AND, BPF_REG_2, 0xFFFF),
+	key->type = (dev_item->type > 0) ? (__u32)dev_item->type : C_CGROUPS_DEV_ANY;
+	key->major = (dev_item->major >= 0) ? (__u32)dev_item->major : C_CGROUPS_DEV_ANY;
+	key->minor = (dev_item->minor >= 0) ? (__u32)dev_item->minor : C_CGROUPS_DEV_ANY;
+}
 
-		// load access to > R3
-		BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_1, 0),
-		BPF_ALU32_IMM(BPF_RSH, BPF_REG_3, 16),
+static int
+c_cgroups_dev_bpf_map_create(void)
+{
+	union bpf_attr attr = {
+		.map_type = BPF_MAP_TYPE_HASH,
+		.key_size = sizeof(c_cgroups_dev_key_t),
+		.value_size = sizeof(c_cgroups_dev_value_t),
+		.max_entries = C_CGROUPS_DEV_MAP_MAX_ENTRIES,
+		.map_flags = BPF_F_NO_PREALLOC,
+	};
 
-		// load major to R4
-		BPF_LDX_MEM(BPF_W, BPF_REG_4, BPF_REG_1, 4),
+	strncpy(attr.map_name, "cml_devices", BPF_OBJ_NAME_LEN - 1);
 
-		// load iminor to R5
-		BPF_LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_1, 8),
-	};
+	int map_fd = bpf(BPF_MAP_CREATE, &attr, sizeof(attr));
+	if (map_fd < 0)
+		ERROR_ERRNO("Failed to create bpf device map!");
 
-	const struct bpf_insn deny_insn[] = {
-		// set deny and exit
-		BPF_MOV64_IMM(BPF_REG_0, 0),
-		BPF_EXIT_INSN(),
-	};
+	return map_fd;
+}
 
-	const struct bpf_insn allow_insn[] = {
-		// set allow and exit
-		BPF_MOV64_IMM(BPF_REG_0, 1),
-		BPF_EXIT_INSN(),
-	};
+/*
+ * Updates the entry of the device map which corresponds to the key of dev_item from the
+ * denied and allowed lists. The entry is removed if no rule for the key is left.
+ */
+static int
+c_cgroups_dev_bpf_map_update(int map_fd, const list_t *dev_items_denied, const list_t *dev_items,
+			     const c_cgroups_dev_item_t *dev_item)
+{
+	c_cgroups_dev_key_t key, item_key;
+	c_cgroups_dev_value_t value = { 0, 0 };
 
-	int total_insn_nr = (sizeof(pre_insn) / sizeof(struct bpf_insn));
-	c_cgroups_bpf_prog_t *prog = c_cgroups_dev_bpf_prog_append(NULL, pre_insn, total_insn_nr);
+	c_cgroups_dev_key_from_item(&key, dev_item);
 
-	for (list_t *l = dev_items_denied; l; l = l->next) {
-		c_cgroups_dev_item_t *dev_item = l->data;
-		// instructions for one rule including 2 byte for 'deny' end closing instruction
-		total_insn_nr += INSNR_TYPE(dev_item) + INSNR_ACCESS(dev_item) +
-				 INSNR_MAJOR(dev_item) + INSNR_MINOR(dev_item) + 2;
+	for (const list_t *l = dev_items_denied; l; l = l->next) {
+		c_cgroups_dev_key_from_item(&item_key, l->data);
+		if (!memcmp(&key, &item_key, sizeof(key)))
+			value.deny |= ((c_cgroups_dev_item_t *)l->data)->access;
 	}
-
-	for (list_t *l = dev_items; l; l = l->next) {
-		c_cgroups_dev_item_t *dev_item = l->data;
-		// instructions for one rule including 2 byte for 'allow' end closing instruction
-		total_insn_nr += INSNR_TYPE(dev_item) + INSNR_ACCESS(dev_item) +
-				 INSNR_MAJOR(dev_item) + INSNR_MINOR(dev_item) + 2;
+	for (const list_t *l = dev_items; l; l = l->next) {
+		c_cgroups_dev_key_from_item(&item_key, l->data);
+		if (!memcmp(&key, &item_key, sizeof(key)))
+			value.allow |= ((c_cgroups_dev_item_t *)l->data)->access;
 	}
 
-	// instructions for deny all as default behavior
-	total_insn_nr += 2;
-
-	DEBUG("Generate BPF prog with total_insn_nr ='%d'", total_insn_nr);
+	union bpf_attr attr = {
+		.map_fd = map_fd,
+		.key = ptr_to_u64(&key),
+	};
 
-	for (list_t *l = dev_items_denied; l; l = l->next) {
-		c_cgroups_dev_item_t *dev_item = l->data;
-		int next_ins = 1 + INSNR_TYPE(dev_item) + INSNR_ACCESS(dev_item) +
-			       INSNR_MAJOR(dev_item) + INSNR_MINOR(dev_item);
-
-		if (dev_item->type > 0) {
-			struct bpf_insn insn[] = {
-				// compare type (char/block)
-				BPF_JMP_IMM(BPF_JNE, BPF_REG_2, dev_item->type, next_ins),
-			};
-			c_cgroups_dev_bpf_prog_append(prog, insn, 1);
-			next_ins--;
+	if (value.deny || value.allow) {
+		attr.value = ptr_to_u64(&value);
+		attr.flags = BPF_ANY;
+		if (bpf(BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr))) {
+			ERROR_ERRNO("Failed to update bpf device map!");
+			return -1;
 		}
+	} else if (bpf(BPF_MAP_DELETE_ELEM, &attr, sizeof(attr)) && errno != ENOENT) {
+		ERROR_ERRNO("Failed to delete entry from bpf device map!");
+		return -1;
+	}
+	return 0;
+}
 
-		if (dev_item->access != LEGACY_DEVCG_ACC_ALL) {
-			struct bpf_insn insn[] = {
-				BPF_MOV32_REG(BPF_REG_1, BPF_REG_3),
-				BPF_ALU32_IMM(BPF_AND, BPF_REG_1, dev_item->access),
-				// compare access (rwm)
-				BPF_JMP_REG(BPF_JNE, BPF_REG_1, BPF_REG_3, next_ins - 2),
-			};
-			c_cgroups_dev_bpf_prog_append(prog, insn, 3);
-			next_ins -= 3;
-		}
+/*
+ * Updates the device map of the running program of a container, if any. Otherwise, the map is
+ * filled from the lists when the program is activated.
+ */
+static int
+c_cgroups_dev_sync(c_cgroups_dev_t *cgroups_dev, const c_cgroups_dev_item_t *dev_item)
+{
+	IF_NULL_RETVAL(cgroups_dev->bpf_prog, 0);
 
-		if (dev_item->major >= 0) {
-			struct bpf_insn insn[] = {
-				// compare major
-				BPF_JMP_IMM(BPF_JNE, BPF_REG_4, dev_item->major, next_ins),
-			};
-			c_cgroups_dev_bpf_prog_append(prog, insn, 1);
-			next_ins--;
-		}
+	return c_cgroups_dev_bpf_map_update(cgroups_dev->bpf_prog->map_fd, cgroups_dev->denied_devs,
+					    cgroups_dev->allowed_devs, dev_item);
+}
 
-		if (dev_item->minor >= 0) {
-			struct bpf_insn insn[] = {
-				// compare minor
-				BPF_JMP_IMM(BPF_JNE, BPF_REG_5, dev_item->minor, next_ins),
-			};
-			c_cgroups_dev_bpf_prog_append(prog, insn, 1);
-			next_ins--;
-		}
+/*
+ * Generates the bpf program which looks up the accessed device in the device map map_fd.
+ * All combinations of the type, major and minor of the device and the wildcard are looked
+ * up. The access is denied if it is covered by the deny bits of any entry, otherwise it is
+ * allowed if it is covered by the allow bits of any entry and denied by default. Thus, the
+ * program does not depend on the rules and is not regenerated if they change.
+ */
+static c_cgroups_bpf_prog_t *
+c_cgroups_dev_bpf_prog_generate(int map_fd)
+{
+	const struct bpf_insn pre_insn[] = {
+		// load type to R6
+		BPF_LDX_MEM(BPF_W, BPF_REG_6, BPF_REG_1, 0),
+		BPF_ALU32_IMM(BPF_AND, BPF_REG_6, 0xFFFF),
 
-		// set deny and exit
-		c_cgroups_dev_bpf_prog_append(prog, deny_insn, 2);
-	}
+		// load access to > R7
+		BPF_LDX_MEM(BPF_W, BPF_REG_7, BPF_REG_1, 0),
+		BPF_ALU32_IMM(BPF_RSH, BPF_REG_7, 16),
 
-	for (list_t *l = dev_items; l; l = l->next) {
-		c_cgroups_dev_item_t *dev_item = l->data;
-		int next_ins = 1 + INSNR_TYPE(dev_item) + INSNR_ACCESS(dev_item) +
-			       INSNR_MAJOR(dev_item) + INSNR_MINOR(dev_item);
-
-		if (dev_item->type > 0) {
-			struct bpf_insn insn[] = {
-				// compare type (char/block)
-				BPF_JMP_IMM(BPF_JNE, BPF_REG_2, dev_item->type, next_ins),
-			};
-			c_cgroups_dev_bpf_prog_append(prog, insn, 1);
-			next_ins--;
-		}
+		// load major to R8
+		BPF_LDX_MEM(BPF_W, BPF_REG_8, BPF_REG_1, 4),
 
-		if (dev_item->access != LEGACY_DEVCG_ACC_ALL) {
-			struct bpf_insn insn[] = {
-				BPF_MOV32_REG(BPF_REG_1, BPF_REG_3),
-				BPF_ALU32_IMM(BPF_AND, BPF_REG_1, dev_item->access),
-				// compare access (rwm)
-				BPF_JMP_REG(BPF_JNE, BPF_REG_1, BPF_REG_3, next_ins - 2),
-			};
-			c_cgroups_dev_bpf_prog_append(prog, insn, 3);
-			next_ins -= 3;
-		}
+		// load iminor to R9
+		BPF_LDX_MEM(BPF_W, BPF_REG_9, BPF_REG_1, 8),
 
-		if (dev_item->major >= 0) {
-			struct bpf_insn insn[] = {
-				// compare major
-				BPF_JMP_IMM(BPF_JNE, BPF_REG_4, dev_item->major, next_ins),
-			};
-			c_cgroups_dev_bpf_prog_append(prog, insn, 1);
-			next_ins--;
-		}
+		// clear allow flag on stack
+		BPF_ST_MEM(BPF_DW, BPF_REG_10, -24, 0),
+	};
 
-		if (dev_item->minor >= 0) {
-			struct bpf_insn insn[] = {
-				// compare minor
-				BPF_JMP_IMM(BPF_JNE, BPF_REG_5, dev_item->minor, next_ins),
-			};
-			c_cgroups_dev_bpf_prog_append(prog, insn, 1);
-			next_ins--;
-		}
+	const struct bpf_insn lookup_insn[] = {
+		// lookup key on stack
+		BPF_LD_MAP_FD(BPF_REG_1, map_fd),
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -16),
+		BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 11),
+
+		// set deny and exit if access is covered by deny bits
+		BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_0, 0),
+		BPF_ALU32_IMM(BPF_XOR, BPF_REG_1, -1),
+		BPF_ALU32_REG(BPF_AND, BPF_REG_1, BPF_REG_7),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_1, 0, 2),
+		BPF_MOV64_IMM(BPF_REG_0, 0),
+		BPF_EXIT_INSN(),
+
+		// set allow flag if access is covered by allow bits
+		BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_0, 4),
+		BPF_ALU32_IMM(BPF_XOR, BPF_REG_1, -1),
+		BPF_ALU32_REG(BPF_AND, BPF_REG_1, BPF_REG_7),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_1, 0, 1),
+		BPF_ST_MEM(BPF_W, BPF_REG_10, -24, 1),
+	};
+
+	const struct bpf_insn post_insn[] = {
+		// return allow flag
+		BPF_LDX_MEM(BPF_W, BPF_REG_0, BPF_REG_10, -24),
+		BPF_EXIT_INSN(),
+	};
 
-		// set allow and exit
-		c_cgroups_dev_bpf_prog_append(prog, allow_insn, 2);
+	c_cgroups_bpf_prog_t *prog =
+		c_cgroups_dev_bpf_prog_append(NULL, pre_insn, ELEMENTSOF(pre_insn));
+	prog->map_fd = map_fd;
+
+	for (int i = 0; i < 8; i++) {
+		// build key (type, major, minor) on stack, bit i set selects the wildcard
+		struct bpf_insn key_insn[] = {
+			(i & 1) ? BPF_ST_MEM(BPF_W, BPF_REG_10, -16, C_CGROUPS_DEV_ANY) :
+				  BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_6, -16),
+			(i & 2) ? BPF_ST_MEM(BPF_W, BPF_REG_10, -12, C_CGROUPS_DEV_ANY) :
+				  BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_8, -12),
+			(i & 4) ? BPF_ST_MEM(BPF_W, BPF_REG_10, -8, C_CGROUPS_DEV_ANY) :
+				  BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_9, -8),
+		};
+		c_cgroups_dev_bpf_prog_append(prog, key_insn, ELEMENTSOF(key_insn));
+		c_cgroups_dev_bpf_prog_append(prog, lookup_insn, ELEMENTSOF(lookup_insn));
 	}
 
-	// set deny for everything else and exit
-	c_cgroups_dev_bpf_prog_append(prog, deny_insn, 2);
+	c_cgroups_dev_bpf_prog_append(prog, post_insn, ELEMENTSOF(post_insn));
+
+	DEBUG("Generate BPF prog with total_insn_nr ='%d'", prog->insn_n_structs);
 
 	return prog;
 }
@@ -488,6 +513,7 @@ c_cgroups_dev_bpf_prog_deactivate(c_cgroups_dev_t *cgroups_dev)
 		WARN_ERRNO("Failed to detach bpf program!");
 
 	close(cgroups_dev->bpf_prog->fd);
+	close(cgroups_dev->bpf_prog->map_fd);
 	close(cgroup_fd);
 
 	c_cgroups_dev_bpf_prog_free(cgroups_dev->bpf_prog);
@@ -566,6 +592,7 @@ c_cgroups_dev_bpf_prog_activate(c_cgroups_dev_t *cgroups_dev, c_cgroups_bpf_prog
 error:
 
 	close(prog->fd);
+	close(prog->map_fd);
 	close(cgroup_fd);
 	c_cgroups_dev_bpf_prog_free(prog);
 	return -1;
@@ -655,26 +682,23 @@ c_cgroups_dev_allow(void *cgroups_devp, const char *rule)
 		return 0;
 	}
 
+	int ret = 0;
 	c_cgroups_dev_item_t *matched_dev;
 	// check if an explicit deny entry exists for dev_item and remove it
 	if ((matched_dev = c_cgroups_dev_list_match(cgroups_dev->denied_devs, dev_item))) {
 		cgroups_dev->denied_devs = list_remove(cgroups_dev->denied_devs, matched_dev);
+		ret = c_cgroups_dev_sync(cgroups_dev, matched_dev);
 		mem_free0(matched_dev);
 	}
 
 	c_cgroups_dev_add_allowed(cgroups_dev, dev_item);
-	mem_free0(dev_item);
 
-	// regenerate bpf prog and update for running containers only
-	compartment_state_t state = container_get_state(cgroups_dev->container);
-	if (state != COMPARTMENT_STATE_BOOTING && state != COMPARTMENT_STATE_RUNNING)
-		return 0;
+	// update device map of running program
+	if (c_cgroups_dev_sync(cgroups_dev, dev_item) < 0)
+		ret = -1;
 
-	c_cgroups_bpf_prog_t *prog = c_cgroups_dev_bpf_prog_generate(cgroups_dev->denied_devs,
-								     cgroups_dev->allowed_devs);
-	IF_NULL_RETVAL(prog, -1);
-
-	return c_cgroups_dev_bpf_prog_activate(cgroups_dev, prog);
+	mem_free0(dev_item);
+	return ret;
 }
 
 static int
@@ -694,18 +718,12 @@ c_cgroups_dev_assign(void *cgroups_devp, const char *rule)
 
 	c_cgroups_dev_add_allowed(cgroups_dev, dev_item);
 	c_cgroups_dev_add_assigned(cgroups_dev, dev_item);
-	mem_free0(dev_item);
-
-	// regenerate bpf prog and update for running containers only
-	compartment_state_t state = container_get_state(cgroups_dev->container);
-	if (state != COMPARTMENT_STATE_BOOTING && state != COMPARTMENT_STATE_RUNNING)
-		return 0;
 
-	c_cgroups_bpf_prog_t *prog = c_cgroups_dev_bpf_prog_generate(cgroups_dev->denied_devs,
-								     cgroups_dev->allowed_devs);
-	IF_NULL_RETVAL(prog, -1);
+	// update device map of running program
+	int ret = c_cgroups_dev_sync(cgroups_dev, dev_item);
 
-	return c_cgroups_dev_bpf_prog_activate(cgroups_dev, prog);
+	mem_free0(dev_item);
+	return ret;
 }
 
 static int
@@ -715,7 +733,7 @@ c_cgroups_dev_deny(void *cgroups_devp, const char *rule)
 	ASSERT(cgroups_dev);
 	ASSERT(rule);
 
-	compartment_state_t state;
+	int ret;
 
 	c_cgroups_dev_item_t *dev_item = c_cgroups_dev_from_rule_new(rule);
 	c_cgroups_dev_item_t *matched_dev;
@@ -730,10 +748,13 @@ c_cgroups_dev_deny(void *cgroups_devp, const char *rule)
 	// if a more generic wildcard rule is in the allow list, explicitly add to deny list
 	if (c_cgroups_dev_item_uses_wildcard(matched_dev)) {
 		cgroups_dev->denied_devs = list_append(cgroups_dev->denied_devs, dev_item);
-		goto generate;
+		// update device map of running program
+		return c_cgroups_dev_sync(cgroups_dev, dev_item);
 	}
 
 	cgroups_dev->allowed_devs = list_remove(cgroups_dev->allowed_devs, matched_dev);
+	// update device map of running program
+	ret = c_cgroups_dev_sync(cgroups_dev, matched_dev);
 	mem_free0(matched_dev);
 
 	// an entry for an assigned device should only be present once in the list
@@ -744,19 +765,7 @@ c_cgroups_dev_deny(void *cgroups_devp, const char *rule)
 	}
 
 	mem_free0(dev_item);
-
-generate:
-
-	// regenerate bpf prog and update for running containers only
-	state = container_get_state(cgroups_dev->container);
-	if (state != COMPARTMENT_STATE_BOOTING && state != COMPARTMENT_STATE_RUNNING)
-		return 0;
-
-	c_cgroups_bpf_prog_t *prog = c_cgroups_dev_bpf_prog_generate(cgroups_dev->denied_devs,
-								     cgroups_dev->allowed_devs);
-	IF_NULL_RETVAL(prog, -1);
-
-	return c_cgroups_dev_bpf_prog_activate(cgroups_dev, prog);
+	return ret;
 }
 
 static int
@@ -876,15 +885,34 @@ c_cgroups_dev_start_post_clone(void *cgroups_devp)
 		      (dl->access & BPF_DEVCG_ACC_MKNOD) ? "m" : "");
 	}
 
+	/* fill device map from rules */
+	int map_fd = c_cgroups_dev_bpf_map_create();
+	IF_TRUE_RETVAL(map_fd < 0, -COMPARTMENT_ERROR_CGROUPS);
+
+	for (list_t *l = cgroups_dev->denied_devs; l; l = l->next) {
+		if (c_cgroups_dev_bpf_map_update(map_fd, cgroups_dev->denied_devs,
+						 cgroups_dev->allowed_devs, l->data) < 0)
+			goto error;
+	}
+	for (list_t *l = cgroups_dev->allowed_devs; l; l = l->next) {
+		if (c_cgroups_dev_bpf_map_update(map_fd, cgroups_dev->denied_devs,
+						 cgroups_dev->allowed_devs, l->data) < 0)
+			goto error;
+	}
+
 	/* activate actual bpf program */
-	c_cgroups_bpf_prog_t *prog = c_cgroups_dev_bpf_prog_generate(cgroups_dev->denied_devs,
-								     cgroups_dev->allowed_devs);
-	IF_NULL_RETVAL(prog, -COMPARTMENT_ERROR_CGROUPS);
+	c_cgroups_bpf_prog_t *prog = c_cgroups_dev_bpf_prog_generate(map_fd);
+	IF_NULL_GOTO(prog, error);
 
+	// the program owns the map from now on, also on failure
 	IF_TRUE_RETVAL(-1 == c_cgroups_dev_bpf_prog_activate(cgroups_dev, prog),
 		       -COMPARTMENT_ERROR_CGROUPS);
 
 	return 0;
+
+error:
+	close(map_fd);
+	return -COMPARTMENT_ERROR_CGROUPS;
 }
 
 static void
@@ -324,6 +324,7 @@ static compartment_module_t c_cgroups_sockopt_module = {
 	.stop = NULL,
 	.cleanup = c_cgroups_sockopt_cleanup,
 	.join_ns = NULL,
+	.flags = COMPARTMENT_MODULE_F_LAZY,
 };
 
 static void INIT
@@ -34,19 +34,28 @@
 #define _GNU_SOURCE
 
 #include "container.h"
+#include "cmld.h"
+#include "cpuset.h"
+#include "ksm.h"
 
 #include "common/mem.h"
 #include "common/macro.h"
 #include "common/file.h"
+#include "common/fd.h"
 #include "common/dir.h"
 #include "common/event.h"
 #include "common/proc.h"
 #include "common/str.h"
 #include "common/uuid.h"
 
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
 #include <sched.h>
-#include <sys/inotify.h>
 #include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 
 #ifndef CLONE_NEWCGROUP
@@ -55,26 +64,74 @@
 
 #define CGROUPS_FOLDER "/sys/fs/cgroup"
 
+#ifndef PR_THP_DISABLE_EXCEPT_ADVISED
+#define PR_THP_DISABLE_EXCEPT_ADVISED (1 << 1)
+#endif
+
 /* Define timeout for freeze in milliseconds */
 #define CGROUPS_FREEZER_TIMEOUT 5000
-/* Define the time interval between status checks while freezing */
-#define CGROUPS_FREEZER_RETRY_INTERVAL 100
 
-#define CGROUPS_FREEZER_RETRIES CGROUPS_FREEZER_TIMEOUT / CGROUPS_FREEZER_RETRY_INTERVAL
+/* Define PSI triggers, i.e. some tasks of a container stalled for the threshold in the window */
+#define CGROUPS_PSI_STALL_US 100000
+#define CGROUPS_PSI_WINDOW_US 1000000
+/* Define time in milliseconds KSM is aggressive on memory pressure of a container */
+#define CGROUPS_PSI_KSM_AGGRESSIVE_TIME 10000
+/* Define time in milliseconds and weight of a cpu boost on cpu pressure of a container */
+#define CGROUPS_PSI_CPU_BOOST_TIME 5000
+#define CGROUPS_PSI_CPU_BOOST_WEIGHT 200
+#define CGROUPS_CPU_WEIGHT_DEFAULT 100
+
+/* Define cpu usage in per mille of the reclaim interval below which a container is idle */
+#define CGROUPS_RECLAIM_IDLE_CPU_PERMILLE 10
+/* Define the share of the reclaimable memory of an idle container reclaimed per interval */
+#define CGROUPS_RECLAIM_DIVISOR 4
+/* Define the minimum amount of memory in bytes a reclaim is triggered for */
+#define CGROUPS_RECLAIM_MIN_BYTES (1024 * 1024)
+
+typedef enum c_cgroups_psi_resource {
+	C_CGROUPS_PSI_MEMORY = 0,
+	C_CGROUPS_PSI_CPU,
+	C_CGROUPS_PSI_IO,
+	C_CGROUPS_PSI_COUNT
+} c_cgroups_psi_resource_t;
+
+static const char *c_cgroups_psi_resources[C_CGROUPS_PSI_COUNT] = { "memory", "cpu", "io" };
+
+typedef enum c_cgroups_stat_file {
+	C_CGROUPS_STAT_CPU = 0,
+	C_CGROUPS_STAT_MEMORY_CURRENT,
+	C_CGROUPS_STAT_MEMORY,
+	C_CGROUPS_STAT_IO,
+	C_CGROUPS_STAT_COUNT
+} c_cgroups_stat_file_t;
+
+static const char *c_cgroups_stat_files[C_CGROUPS_STAT_COUNT] = { "cpu.stat", "memory.current",
+								   "memory.stat", "io.stat" };
 
 char *c_cgroups_subtree = NULL; // in which containers are running in
 
 typedef struct c_cgroups {
-	container_t *container; // weak reference
+	compartment_t *compartment; // weak reference
+	container_t *container;	    // weak reference
 	bool ns_cgroup;
 	char *path;
+	int cgroup_fd;	     // fd of path, kept open for writing the attribute files
+	int child_cgroup_fd; // fd of the child cgroup, the container's init is cloned into
 
 	bool is_populated;
 	bool is_frozen;
-	event_inotify_t *inotify_cgroup_events;
+	int events_fd;		// fd of cgroup.events, kept open to be polled for changes
+	event_io_t *events_io;
 
 	event_timer_t *freeze_timer; /* timer to handle a container freeze timeout */
-	int freezer_retries;
+
+	event_io_t *psi_io[C_CGROUPS_PSI_COUNT]; // registered PSI triggers
+	event_timer_t *cpu_boost_timer;		 // resets the cpu weight after a boost
+
+	event_timer_t *reclaim_timer; // periodically reclaims memory of an idle container
+	uint64_t reclaim_cpu_usage;   // cpu usage in usec at the last reclaim interval
+
+	int stat_fd[C_CGROUPS_STAT_COUNT]; // usage files, kept open to be sampled cheaply
 } c_cgroups_t;
 
 static void *
@@ -84,18 +141,23 @@ c_cgroups_new(compartment_t *compartment)
 	IF_NULL_RETVAL(compartment_get_extension_data(compartment), NULL);
 
 	c_cgroups_t *cgroups = mem_new0(c_cgroups_t, 1);
+	cgroups->compartment = compartment;
 	cgroups->container = compartment_get_extension_data(compartment);
 
 	cgroups->ns_cgroup = file_exists("/proc/self/ns/cgroup");
 
 	cgroups->path = mem_printf("%s/%s", c_cgroups_subtree,
 				   uuid_string(container_get_uuid(cgroups->container)));
+	cgroups->cgroup_fd = -1;
+	cgroups->child_cgroup_fd = -1;
 
 	cgroups->is_populated = false;
 	cgroups->is_frozen = false;
-	cgroups->inotify_cgroup_events = NULL;
+	cgroups->events_fd = -1;
+	cgroups->events_io = NULL;
 	cgroups->freeze_timer = NULL;
-	cgroups->freezer_retries = 0;
+	for (int i = 0; i < C_CGROUPS_STAT_COUNT; i++)
+		cgroups->stat_fd[i] = -1;
 	return cgroups;
 }
 
@@ -105,20 +167,31 @@ c_cgroups_free(void *cgroupsp)
 	c_cgroups_t *cgroups = cgroupsp;
 	ASSERT(cgroups);
 
+	if (cgroups->cgroup_fd >= 0)
+		close(cgroups->cgroup_fd);
+	if (cgroups->child_cgroup_fd >= 0)
+		close(cgroups->child_cgroup_fd);
 	mem_free0(cgroups->path);
 	mem_free0(cgroups);
 }
 
 static int
-c_cgroups_activate_controllers(const char *path)
+c_cgroups_activate_controllers(int cgroup_fd, const char *path)
 {
 	int ret = 0;
+	char controllers[4096] = { 0 };
 
 	IF_NULL_RETVAL(path, -1);
 
 	// activate controllers
-	char *controllers_path = mem_printf("%s/cgroup.controllers", path);
-	char *controllers = file_read_new(controllers_path, 4096);
+	int fd = openat(cgroup_fd, "cgroup.controllers", O_RDONLY | O_CLOEXEC);
+	int len = fd < 0 ? -1 : fd_read(fd, controllers, sizeof(controllers) - 1);
+	if (fd >= 0)
+		close(fd);
+	if (len <= 0) {
+		ERROR("Could not read cgroup controllers of cgroup '%s'!", path);
+		return -1;
+	}
 
 	// remove possible newline
 	if (controllers[strlen(controllers) - 1] == '\n')
@@ -130,16 +203,12 @@ c_cgroups_activate_controllers(const char *path)
 		str_append_printf(activate, " +%s", controller);
 
 	INFO("activating controllers '%s'", str_buffer(activate));
-	char *subtree_control_path = mem_printf("%s/cgroup.subtree_control", path);
-	if (-1 == file_printf(subtree_control_path, str_buffer(activate))) {
+	if (-1 == file_write_at(cgroup_fd, "cgroup.subtree_control", str_buffer(activate), -1)) {
 		ERROR("Could not activate cgroup controllers for cgroup '%s'!", path);
 		ret = -1;
 	}
 
 	str_free(activate, true);
-	mem_free0(subtree_control_path);
-	mem_free0(controllers_path);
-	mem_free0(controllers);
 	return ret;
 }
 
@@ -227,27 +296,31 @@ c_cgroups_set_ram_limit(c_cgroups_t *cgroups)
 
 	int ret = -1;
 	char *memory_max_path = mem_printf("%s/memory.max", cgroups->path);
-	char *mem_max_string = NULL;
 	unsigned int mem_max;
+	char buf[64] = { 0 };
 
 	INFO("Trying to set RAM limit of container %s to %d MBytes",
 	     container_get_description(cgroups->container),
 	     container_get_ram_limit(cgroups->container));
 
-	if (!file_exists(memory_max_path)) {
-		ERROR("%s file not found (cgroups not mounted or cgroups memory controler not enabled?)",
-		      memory_max_path);
-		goto out;
-	}
-	if (file_printf(memory_max_path, "%uM", container_get_ram_limit(cgroups->container)) ==
-	    -1) {
-		ERROR("Could not write to cgroups RAM limit file in %s", memory_max_path);
+	if (file_printf_at(cgroups->cgroup_fd, "memory.max", "%uM",
+			   container_get_ram_limit(cgroups->container)) == -1) {
+		if (errno == ENOENT)
+			ERROR("%s file not found (cgroups not mounted or cgroups memory "
+			      "controler not enabled?)",
+			      memory_max_path);
+		else
+			ERROR("Could not write to cgroups RAM limit file in %s", memory_max_path);
 		goto out;
 	}
 
-	IF_NULL_GOTO((mem_max_string = file_read_new(memory_max_path, 1024)), out);
+	int fd = openat(cgroups->cgroup_fd, "memory.max", O_RDONLY | O_CLOEXEC);
+	IF_TRUE_GOTO(fd < 0, out);
+	int len = fd_read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	IF_TRUE_GOTO(len < 0, out);
 
-	if (sscanf(mem_max_string, "%u", &mem_max) != 1) {
+	if (sscanf(buf, "%u", &mem_max) != 1) {
 		ERROR("Could not parse cgroups RAM limit file '%s'", memory_max_path);
 		goto out;
 	}
@@ -264,11 +337,34 @@ c_cgroups_set_ram_limit(c_cgroups_t *cgroups)
 	ret = 0;
 out:
 	mem_free0(memory_max_path);
-	if (mem_max_string)
-		mem_free0(mem_max_string);
 	return ret;
 }
 
+static int
+c_cgroups_set_ram_soft_limits(c_cgroups_t *cgroups)
+{
+	ASSERT(cgroups);
+
+	unsigned int ram_high = container_get_ram_high(cgroups->container);
+	unsigned int ram_low = container_get_ram_low(cgroups->container);
+
+	if (ram_high && file_printf_at(cgroups->cgroup_fd, "memory.high", "%uM", ram_high) == -1) {
+		ERROR_ERRNO("Could not set soft RAM limit of container %s to %u MBytes",
+			    container_get_description(cgroups->container), ram_high);
+		return -1;
+	}
+	if (ram_low && file_printf_at(cgroups->cgroup_fd, "memory.low", "%uM", ram_low) == -1) {
+		ERROR_ERRNO("Could not set protected RAM of container %s to %u MBytes",
+			    container_get_description(cgroups->container), ram_low);
+		return -1;
+	}
+
+	if (ram_high || ram_low)
+		INFO("Set soft RAM limits of container %s to high=%u low=%u MBytes",
+		     container_get_description(cgroups->container), ram_high, ram_low);
+	return 0;
+}
+
 /**
  * This functions gets the allowed cpus for the container from its associated container
  * object and configures the cgroups cpuset subsystem to restrict access to that cpus.
@@ -287,40 +383,136 @@ c_cgroups_set_cpus_allowed(const c_cgroups_t *cgroups)
 	int ret = -1;
 	char *cpuset_cpus_path = mem_printf("%s/cpuset.cpus", cgroups->path);
 	char *cpuset_mems_path = mem_printf("%s/cpuset.mems", cgroups->path);
-
-	if (!file_exists(cpuset_cpus_path)) {
-		ERROR("%s file not found (cgroups or cgroups cpuset subsystem not mounted?)",
-		      cpuset_cpus_path);
-		goto out;
-	}
-	if (file_printf(cpuset_cpus_path, "%s", container_get_cpus_allowed(cgroups->container)) ==
-	    -1) {
-		ERROR("Could not write to cgroups cpuset file in %s", cpuset_cpus_path);
+	// keep the memory local to the NUMA nodes of the cpus
+	char *mems = cpuset_mems_new(container_get_cpus_allowed(cgroups->container));
+
+	if (file_write_at(cgroups->cgroup_fd, "cpuset.cpus",
+			  container_get_cpus_allowed(cgroups->container), -1) == -1) {
+		if (errno == ENOENT)
+			ERROR("%s file not found (cgroups or cgroups cpuset subsystem not "
+			      "mounted?)",
+			      cpuset_cpus_path);
+		else
+			ERROR("Could not write to cgroups cpuset file in %s", cpuset_cpus_path);
 		goto out;
 	}
 
-	if (!file_exists(cpuset_mems_path)) {
-		ERROR("%s file not found (cgroups or cgroups cpuset subsystem not mounted?)",
-		      cpuset_mems_path);
-		goto out;
-	}
-	if (file_printf(cpuset_mems_path, "0") == -1) {
-		ERROR("Could not write to cgroups cpuset file in %s", cpuset_mems_path);
+	if (file_write_at(cgroups->cgroup_fd, "cpuset.mems", mems ? mems : "0", -1) == -1) {
+		if (errno == ENOENT)
+			ERROR("%s file not found (cgroups or cgroups cpuset subsystem not "
+			      "mounted?)",
+			      cpuset_mems_path);
+		else
+			ERROR("Could not write to cgroups cpuset file in %s", cpuset_mems_path);
 		goto out;
 	}
 
-	INFO("Successfully set CPU restriction of container %s to cores %s",
+	INFO("Successfully set CPU restriction of container %s to cores %s, memory nodes %s",
 	     container_get_description(cgroups->container),
-	     container_get_cpus_allowed(cgroups->container));
+	     container_get_cpus_allowed(cgroups->container), mems ? mems : "0");
 
 	ret = 0;
 out:
 	mem_free0(cpuset_cpus_path);
 	mem_free0(cpuset_mems_path);
+	if (mems)
+		mem_free0(mems);
 
 	return ret;
 }
 
+static int
+c_cgroups_set_hugetlb_limits(const c_cgroups_t *cgroups)
+{
+	ASSERT(cgroups);
+
+	for (const list_t *l = container_get_hugetlb_limits(cgroups->container); l; l = l->next) {
+		const container_hugetlb_limit_t *limit = l->data;
+		char *file = mem_printf("hugetlb.%s.max", limit->page_size);
+		int ret = file_printf_at(cgroups->cgroup_fd, file, "%" PRIu64,
+					 (uint64_t)limit->max * 1024 * 1024);
+		if (ret == -1) {
+			if (errno == ENOENT)
+				ERROR("%s/%s file not found (hugetlb controller not enabled or "
+				      "page size not supported?)",
+				      cgroups->path, file);
+			else
+				ERROR_ERRNO("Could not set hugetlb limit of container %s in %s",
+					    container_get_description(cgroups->container), file);
+			mem_free0(file);
+			return -1;
+		}
+		INFO("Set hugetlb limit of container %s for %s pages to %u MBytes",
+		     container_get_description(cgroups->container), limit->page_size, limit->max);
+		mem_free0(file);
+	}
+	return 0;
+}
+
+/*
+ * Applies the transparent hugepage policy to the init of the container, which is
+ * inherited by all its children.
+ */
+static int
+c_cgroups_set_thp_mode(const c_cgroups_t *cgroups)
+{
+	ASSERT(cgroups);
+
+	const char *policy;
+	switch (container_get_thp_mode(cgroups->container)) {
+	case CONTAINER_THP_NEVER:
+		if (prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0) == -1) {
+			ERROR_ERRNO("Could not disable transparent hugepages");
+			return -1;
+		}
+		policy = "never";
+		break;
+	case CONTAINER_THP_ADVISED:
+		if (prctl(PR_SET_THP_DISABLE, 1, PR_THP_DISABLE_EXCEPT_ADVISED, 0, 0) == -1) {
+			// older kernels only support disabling them completely
+			WARN_ERRNO("Could not restrict transparent hugepages to advised memory");
+			return 0;
+		}
+		policy = "advised";
+		break;
+	default:
+		return 0;
+	}
+
+	INFO("Set transparent hugepage policy of container %s to %s",
+	     container_get_name(cgroups->container), policy);
+	return 0;
+}
+
+/*
+ * Moves the running container to the given cpus and memory nodes, used by the cpuset
+ * manager to rebalance the cpus at runtime.
+ */
+static int
+c_cgroups_set_cpuset(void *cgroupsp, const char *cpus, const char *mems)
+{
+	c_cgroups_t *cgroups = cgroupsp;
+	ASSERT(cgroups);
+	ASSERT(cpus && mems);
+
+	IF_TRUE_RETVAL_TRACE(cgroups->cgroup_fd < 0, -1);
+
+	if (file_write_at(cgroups->cgroup_fd, "cpuset.cpus", cpus, -1) == -1) {
+		ERROR_ERRNO("Could not set cpus of container %s to %s",
+			    container_get_description(cgroups->container), cpus);
+		return -1;
+	}
+	if (file_write_at(cgroups->cgroup_fd, "cpuset.mems", mems, -1) == -1) {
+		ERROR_ERRNO("Could not set memory nodes of container %s to %s",
+			    container_get_description(cgroups->container), mems);
+		return -1;
+	}
+
+	DEBUG("Set cpus of container %s to %s, memory nodes to %s",
+	      container_get_description(cgroups->container), cpus, mems);
+	return 0;
+}
+
 static void
 c_cgroups_event_populated(c_cgroups_t *cgroups, bool is_populated)
 {
@@ -344,7 +536,6 @@ c_cgroups_cleanup_freeze_timer(c_cgroups_t *cgroups)
 		event_timer_free(cgroups->freeze_timer);
 		cgroups->freeze_timer = NULL;
 	}
-	cgroups->freezer_retries = 0;
 }
 
 static void
@@ -372,34 +563,108 @@ c_cgroups_event_freezer(c_cgroups_t *cgroups, bool is_frozen)
 	}
 }
 
+/*
+ * Parsed content of cgroup.events
+ */
+typedef struct c_cgroups_events {
+	int populated;
+	int frozen;
+} c_cgroups_events_t;
+
+/*
+ * Reads the flat keyed cgroup.events through the kept open fd, which also rearms the
+ * notification of the fd. Keys which are not present keep their value in events.
+ */
+static int
+c_cgroups_events_read(const c_cgroups_t *cgroups, c_cgroups_events_t *events)
+{
+	char buf[256];
+	const struct {
+		const char *key;
+		int *value;
+	} keys[] = {
+		{ "populated", &events->populated },
+		{ "frozen", &events->frozen },
+	};
+
+	ssize_t len = pread(cgroups->events_fd, buf, sizeof(buf) - 1, 0);
+	IF_TRUE_RETVAL_TRACE(len < 0, -1);
+	buf[len] = '\0';
+
+	char *next;
+	for (char *line = buf; line && *line; line = next) {
+		if ((next = strchr(line, '\n')))
+			*next++ = '\0';
+
+		char *value = strchr(line, ' ');
+		if (!value)
+			continue;
+		*value++ = '\0';
+
+		for (size_t i = 0; i < ELEMENTSOF(keys); i++) {
+			if (!strcmp(line, keys[i].key))
+				*keys[i].value = (int)strtol(value, NULL, 10);
+		}
+	}
+	return 0;
+}
+
 static void
-c_cgroups_events_cb(UNUSED const char *path, UNUSED uint32_t mask, UNUSED event_inotify_t *inotify,
-		    void *data)
+c_cgroups_events_unregister(c_cgroups_t *cgroups)
+{
+	if (cgroups->events_io) {
+		event_remove_io(cgroups->events_io);
+		event_io_free(cgroups->events_io);
+		cgroups->events_io = NULL;
+	}
+	if (cgroups->events_fd >= 0) {
+		close(cgroups->events_fd);
+		cgroups->events_fd = -1;
+	}
+}
+
+static void
+c_cgroups_events_cb(UNUSED int fd, UNUSED unsigned events, UNUSED event_io_t *io, void *data)
 {
 	c_cgroups_t *cgroups = data;
 
 	ASSERT(cgroups);
 
-	char *cgroup_events_path = mem_printf("%s/cgroup.events", cgroups->path);
-	char *state_str = file_read_new(cgroup_events_path, 1024);
-	mem_free0(cgroup_events_path);
-
-	int frozen = 0, populated = 0;
-	char *event_line = strtok(state_str, "\n");
-	while (event_line) {
-		if (sscanf(event_line, "populated %d", &populated) == 1) {
-			bool is_populated = populated ? true : false;
-			if (is_populated != cgroups->is_populated)
-				c_cgroups_event_populated(cgroups, is_populated);
-		}
-		if (sscanf(event_line, "frozen %d", &frozen) == 1) {
-			bool is_frozen = frozen ? true : false;
-			if (is_frozen != cgroups->is_frozen)
-				c_cgroups_event_freezer(cgroups, is_frozen);
-		}
-		event_line = strtok(NULL, "\n");
+	c_cgroups_events_t cgroup_events = { cgroups->is_populated, cgroups->is_frozen };
+	if (c_cgroups_events_read(cgroups, &cgroup_events) < 0) {
+		// the cgroup is gone, stop polling the fd which would signal forever
+		WARN_ERRNO("Could not read %s/cgroup.events", cgroups->path);
+		c_cgroups_events_unregister(cgroups);
+		return;
 	}
-	mem_free0(state_str);
+
+	if ((cgroup_events.populated != 0) != cgroups->is_populated)
+		c_cgroups_event_populated(cgroups, cgroup_events.populated != 0);
+	if ((cgroup_events.frozen != 0) != cgroups->is_frozen)
+		c_cgroups_event_freezer(cgroups, cgroup_events.frozen != 0);
+}
+
+/*
+ * Polls cgroup.events for changes, the kernel signals them with EPOLLPRI.
+ */
+static int
+c_cgroups_events_register(c_cgroups_t *cgroups)
+{
+	c_cgroups_events_unregister(cgroups);
+
+	cgroups->events_fd = openat(cgroups->cgroup_fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+	IF_TRUE_RETVAL_ERROR_ERRNO(cgroups->events_fd < 0, -1);
+
+	c_cgroups_events_t cgroup_events = { 0, 0 };
+	if (c_cgroups_events_read(cgroups, &cgroup_events) == 0) {
+		cgroups->is_populated = cgroup_events.populated != 0;
+		cgroups->is_frozen = cgroup_events.frozen != 0;
+	}
+
+	cgroups->events_io =
+		event_io_new(cgroups->events_fd, EVENT_IO_PRI, &c_cgroups_events_cb, cgroups);
+	event_add_io(cgroups->events_io);
+	return 0;
 }
 
 static int
@@ -408,13 +673,15 @@ c_cgroups_unfreeze(void *cgroupsp)
 	c_cgroups_t *cgroups = cgroupsp;
 	ASSERT(cgroups);
 
-	char *freezer_state_path = mem_printf("%s/cgroup.freeze", cgroups->path);
-	if (file_write(freezer_state_path, "0", -1) == -1) {
-		ERROR_ERRNO("Failed to write to freezer file %s", freezer_state_path);
-		mem_free0(freezer_state_path);
+	if (file_write_at(cgroups->cgroup_fd, "cgroup.freeze", "0", -1) == -1) {
+		ERROR_ERRNO("Failed to write to freezer file %s/cgroup.freeze", cgroups->path);
 		return -1;
 	}
-	mem_free0(freezer_state_path);
+
+	// an incomplete freeze is aborted without a change of cgroup.events
+	if (!cgroups->is_frozen)
+		c_cgroups_event_freezer(cgroups, false);
+
 	return 0;
 }
 
@@ -425,15 +692,6 @@ c_cgroups_freeze_timeout_cb(UNUSED event_timer_t *timer, void *data)
 
 	c_cgroups_t *cgroups = data;
 
-	DEBUG("Checking state of the freezing process (try no. %d)", cgroups->freezer_retries + 1);
-
-	if (cgroups->freezer_retries < CGROUPS_FREEZER_RETRIES) {
-		cgroups->freezer_retries++;
-		// trigger state update of container
-		c_cgroups_event_freezer(cgroups, cgroups->is_frozen);
-		return;
-	}
-
 	compartment_state_t compartment_state = container_get_state(cgroups->container);
 	if (compartment_state == COMPARTMENT_STATE_FREEZING) {
 		WARN("Hit timeout for freezing container %s, aborting freeze...",
@@ -471,26 +729,393 @@ c_cgroups_freeze(void *cgroupsp)
 		return -1;
 	}
 
-	char *freezer_state_path = mem_printf("%s/cgroup.freeze", cgroups->path);
-	if (file_write(freezer_state_path, "1", -1) == -1) {
-		ERROR_ERRNO("Failed to write to freezer file %s", freezer_state_path);
-		mem_free0(freezer_state_path);
+	if (file_write_at(cgroups->cgroup_fd, "cgroup.freeze", "1", -1) == -1) {
+		ERROR_ERRNO("Failed to write to freezer file %s/cgroup.freeze", cgroups->path);
 		return -1;
 	}
 
-	/* register a timer to stop the freeze if it does not complete in time */
-	cgroups->freeze_timer = event_timer_new(CGROUPS_FREEZER_RETRY_INTERVAL, -1,
-						&c_cgroups_freeze_timeout_cb, cgroups);
+	/* the completion is signaled through cgroup.events, stop the freeze if it takes too long */
+	c_cgroups_cleanup_freeze_timer(cgroups);
+	cgroups->freeze_timer =
+		event_timer_new(CGROUPS_FREEZER_TIMEOUT, 1, &c_cgroups_freeze_timeout_cb, cgroups);
 	event_add_timer(cgroups->freeze_timer);
 
 	container_set_state(cgroups->container, COMPARTMENT_STATE_FREEZING);
 
-	mem_free0(freezer_state_path);
 	return 0;
 }
 
+/**
+ * Returns the share of time some tasks of the container stalled on the given resource
+ * ("memory", "cpu" or "io") in the last 10 seconds, in hundredths of a percent.
+ */
 static int
-c_cgroups_start_post_clone(void *cgroupsp)
+c_cgroups_get_pressure(void *cgroupsp, const char *resource)
+{
+	c_cgroups_t *cgroups = cgroupsp;
+	ASSERT(cgroups);
+	ASSERT(resource);
+
+	char buf[256] = { 0 };
+	unsigned int avg10_int, avg10_frac;
+
+	IF_TRUE_RETVAL_TRACE(cgroups->cgroup_fd < 0, -1);
+
+	char *file = mem_printf("%s.pressure", resource);
+	int fd = openat(cgroups->cgroup_fd, file, O_RDONLY | O_CLOEXEC);
+	mem_free0(file);
+	IF_TRUE_RETVAL_TRACE(fd < 0, -1);
+
+	int len = fd_read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	IF_TRUE_RETVAL_TRACE(len < 0, -1);
+
+	if (sscanf(buf, "some avg10=%u.%2u", &avg10_int, &avg10_frac) != 2) {
+		WARN("Could not parse %s pressure of container %s", resource,
+		     container_get_description(cgroups->container));
+		return -1;
+	}
+	return avg10_int * 100 + avg10_frac;
+}
+
+static void
+c_cgroups_set_cpu_weight(c_cgroups_t *cgroups, int weight)
+{
+	if (file_printf_at(cgroups->cgroup_fd, "cpu.weight", "%d", weight) == -1)
+		WARN_ERRNO("Could not set cpu weight of container %s to %d",
+			   container_get_description(cgroups->container), weight);
+}
+
+static void
+c_cgroups_cpu_boost_timeout_cb(event_timer_t *timer, void *data)
+{
+	c_cgroups_t *cgroups = data;
+	ASSERT(cgroups);
+
+	DEBUG("Resetting cpu weight of container %s",
+	      container_get_description(cgroups->container));
+	c_cgroups_set_cpu_weight(cgroups, CGROUPS_CPU_WEIGHT_DEFAULT);
+
+	event_timer_free(timer);
+	cgroups->cpu_boost_timer = NULL;
+}
+
+static void
+c_cgroups_psi_cb(int fd, unsigned events, event_io_t *io, void *data)
+{
+	c_cgroups_t *cgroups = data;
+	ASSERT(cgroups);
+
+	c_cgroups_psi_resource_t resource;
+	for (resource = 0; resource < C_CGROUPS_PSI_COUNT; resource++)
+		if (cgroups->psi_io[resource] == io)
+			break;
+	IF_TRUE_RETURN(resource == C_CGROUPS_PSI_COUNT);
+
+	// the trigger is gone with the cgroup
+	if (events & EVENT_IO_EXCEPT) {
+		TRACE("PSI trigger for %s of container %s removed",
+		      c_cgroups_psi_resources[resource],
+		      container_get_description(cgroups->container));
+		event_remove_io(io);
+		event_io_free(io);
+		close(fd);
+		cgroups->psi_io[resource] = NULL;
+		return;
+	}
+
+	int pressure = c_cgroups_get_pressure(cgroups, c_cgroups_psi_resources[resource]);
+	DEBUG("Container %s is under %s pressure (avg10=%d.%02d%%)",
+	      container_get_description(cgroups->container), c_cgroups_psi_resources[resource],
+	      pressure / 100, pressure % 100);
+
+	switch (resource) {
+	case C_CGROUPS_PSI_MEMORY:
+		// reclaim shared pages before the container runs into its limit
+		ksm_set_aggressive_for(CGROUPS_PSI_KSM_AGGRESSIVE_TIME);
+		break;
+	case C_CGROUPS_PSI_CPU:
+		if (cgroups->cpu_boost_timer) {
+			// still boosted, only extend the boost
+			event_remove_timer(cgroups->cpu_boost_timer);
+			event_timer_free(cgroups->cpu_boost_timer);
+		} else {
+			DEBUG("Boosting cpu weight of container %s to %d",
+			      container_get_description(cgroups->container),
+			      CGROUPS_PSI_CPU_BOOST_WEIGHT);
+			c_cgroups_set_cpu_weight(cgroups, CGROUPS_PSI_CPU_BOOST_WEIGHT);
+		}
+		cgroups->cpu_boost_timer = event_timer_new(
+			CGROUPS_PSI_CPU_BOOST_TIME, 1, &c_cgroups_cpu_boost_timeout_cb, cgroups);
+		event_add_timer(cgroups->cpu_boost_timer);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Registers a PSI trigger for each resource of the cgroup with the event loop. The kernel
+ * signals the trigger with EPOLLPRI at most once per window.
+ */
+static void
+c_cgroups_psi_register(c_cgroups_t *cgroups)
+{
+	for (int i = 0; i < C_CGROUPS_PSI_COUNT; i++) {
+		char *file = mem_printf("%s.pressure", c_cgroups_psi_resources[i]);
+		int fd = openat(cgroups->cgroup_fd, file, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		mem_free0(file);
+		if (fd < 0) {
+			TRACE_ERRNO("No %s pressure information (kernel without PSI?)",
+				    c_cgroups_psi_resources[i]);
+			continue;
+		}
+
+		int len = dprintf(fd, "some %d %d", CGROUPS_PSI_STALL_US, CGROUPS_PSI_WINDOW_US);
+		if (len < 0) {
+			WARN_ERRNO("Could not register %s pressure trigger for container %s",
+				   c_cgroups_psi_resources[i],
+				   container_get_description(cgroups->container));
+			close(fd);
+			continue;
+		}
+
+		cgroups->psi_io[i] = event_io_new(fd, EVENT_IO_PRI, &c_cgroups_psi_cb, cgroups);
+		event_add_io(cgroups->psi_io[i]);
+	}
+}
+
+static void
+c_cgroups_psi_unregister(c_cgroups_t *cgroups)
+{
+	for (int i = 0; i < C_CGROUPS_PSI_COUNT; i++) {
+		if (!cgroups->psi_io[i])
+			continue;
+
+		int fd = event_io_get_fd(cgroups->psi_io[i]);
+		event_remove_io(cgroups->psi_io[i]);
+		event_io_free(cgroups->psi_io[i]);
+		close(fd);
+		cgroups->psi_io[i] = NULL;
+	}
+
+	if (cgroups->cpu_boost_timer) {
+		event_remove_timer(cgroups->cpu_boost_timer);
+		event_timer_free(cgroups->cpu_boost_timer);
+		cgroups->cpu_boost_timer = NULL;
+	}
+}
+
+/*
+ * Reads the value of the given key from a flat keyed cgroup file, e.g. cpu.stat, or the
+ * single value of the file if key is NULL.
+ */
+static int
+c_cgroups_read_value(const c_cgroups_t *cgroups, const char *file, const char *key,
+		     uint64_t *value)
+{
+	char buf[512] = { 0 };
+
+	int fd = openat(cgroups->cgroup_fd, file, O_RDONLY | O_CLOEXEC);
+	IF_TRUE_RETVAL_TRACE(fd < 0, -1);
+	int len = fd_read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	IF_TRUE_RETVAL_TRACE(len < 0, -1);
+
+	char *val = buf;
+	if (key) {
+		val = strstr(buf, key);
+		IF_NULL_RETVAL_TRACE(val, -1);
+		val += strlen(key);
+	}
+	IF_TRUE_RETVAL_TRACE(sscanf(val, "%" SCNu64, value) != 1, -1);
+
+	return 0;
+}
+
+static void
+c_cgroups_reclaim_stop(c_cgroups_t *cgroups)
+{
+	IF_NULL_RETURN(cgroups->reclaim_timer);
+
+	event_remove_timer(cgroups->reclaim_timer);
+	event_timer_free(cgroups->reclaim_timer);
+	cgroups->reclaim_timer = NULL;
+}
+
+/*
+ * Reclaims a share of the memory of the container above its ram_low, if the container
+ * hardly used the cpu since the last interval. The reclaim is repeated each interval while
+ * the container stays idle, so that its memory shrinks gradually to the pages it touches.
+ */
+static void
+c_cgroups_reclaim_cb(UNUSED event_timer_t *timer, void *data)
+{
+	c_cgroups_t *cgroups = data;
+	ASSERT(cgroups);
+
+	uint64_t usage, current;
+	uint64_t interval_usec = (uint64_t)cmld_get_memory_reclaim_idle_time() * 1000000;
+	uint64_t low = (uint64_t)container_get_ram_low(cgroups->container) * 1024 * 1024;
+
+	IF_TRUE_RETURN_TRACE(c_cgroups_read_value(cgroups, "cpu.stat", "usage_usec", &usage));
+	uint64_t busy_usec = usage - cgroups->reclaim_cpu_usage;
+	cgroups->reclaim_cpu_usage = usage;
+
+	// container is still active
+	IF_TRUE_RETURN(busy_usec * 1000 > interval_usec * CGROUPS_RECLAIM_IDLE_CPU_PERMILLE);
+
+	IF_TRUE_RETURN_TRACE(c_cgroups_read_value(cgroups, "memory.current", NULL, &current));
+	IF_TRUE_RETURN(current <= low);
+
+	uint64_t amount = (current - low) / CGROUPS_RECLAIM_DIVISOR;
+	IF_TRUE_RETURN(amount < CGROUPS_RECLAIM_MIN_BYTES);
+
+	DEBUG("Reclaiming %" PRIu64 " bytes of idle container %s", amount,
+	      container_get_description(cgroups->container));
+
+	if (file_printf_at(cgroups->cgroup_fd, "memory.reclaim", "%" PRIu64, amount) == -1) {
+		// EAGAIN if less than the amount could be reclaimed
+		if (errno == EAGAIN)
+			return;
+		WARN_ERRNO("Could not reclaim memory of container %s, stopping reclaim",
+			   container_get_description(cgroups->container));
+		c_cgroups_reclaim_stop(cgroups);
+	}
+}
+
+static void
+c_cgroups_reclaim_start(c_cgroups_t *cgroups)
+{
+	unsigned int idle_time = cmld_get_memory_reclaim_idle_time();
+	IF_TRUE_RETURN(idle_time == 0 || cgroups->reclaim_timer);
+
+	cgroups->reclaim_cpu_usage = 0;
+	cgroups->reclaim_timer = event_timer_new(idle_time * 1000, EVENT_TIMER_REPEAT_FOREVER,
+						 &c_cgroups_reclaim_cb, cgroups);
+	event_add_timer(cgroups->reclaim_timer);
+}
+
+static void
+c_cgroups_stat_close(c_cgroups_t *cgroups)
+{
+	for (int i = 0; i < C_CGROUPS_STAT_COUNT; i++) {
+		if (cgroups->stat_fd[i] >= 0) {
+			close(cgroups->stat_fd[i]);
+			cgroups->stat_fd[i] = -1;
+		}
+	}
+}
+
+/*
+ * Opens the usage files of the cgroup once, so that sampling them is a pread() each.
+ * A controller which is not available just leaves its fields of the usage at 0.
+ */
+static void
+c_cgroups_stat_open(c_cgroups_t *cgroups)
+{
+	c_cgroups_stat_close(cgroups);
+
+	for (int i = 0; i < C_CGROUPS_STAT_COUNT; i++) {
+		cgroups->stat_fd[i] =
+			openat(cgroups->cgroup_fd, c_cgroups_stat_files[i], O_RDONLY | O_CLOEXEC);
+		if (cgroups->stat_fd[i] < 0)
+			TRACE_ERRNO("Could not open %s/%s", cgroups->path, c_cgroups_stat_files[i]);
+	}
+}
+
+/*
+ * Reads a usage file through its kept open fd into buf.
+ */
+static int
+c_cgroups_stat_pread(const c_cgroups_t *cgroups, c_cgroups_stat_file_t file, char *buf,
+		     size_t size)
+{
+	IF_TRUE_RETVAL(cgroups->stat_fd[file] < 0, -1);
+
+	ssize_t len = pread(cgroups->stat_fd[file], buf, size - 1, 0);
+	IF_TRUE_RETVAL_TRACE(len < 0, -1);
+	buf[len] = '\0';
+
+	return 0;
+}
+
+/*
+ * Adds the values of the given keys in buf to the corresponding values. The keys and
+ * values are separated by sep, i.e. ' ' for flat keyed files or '=' for the nested keyed
+ * io.stat, in which each line lists the keys for another device.
+ */
+static void
+c_cgroups_stat_parse(char *buf, char sep, const char *const *keys, uint64_t *const *values,
+		     size_t n)
+{
+	const char *delim = sep == ' ' ? "\n" : " \n";
+	char *saveptr = NULL;
+
+	for (char *tok = strtok_r(buf, delim, &saveptr); tok;
+	     tok = strtok_r(NULL, delim, &saveptr)) {
+		char *val = strchr(tok, sep);
+		if (!val)
+			continue;
+		*val++ = '\0';
+
+		for (size_t i = 0; i < n; i++) {
+			if (!strcmp(tok, keys[i]))
+				*values[i] += strtoull(val, NULL, 10);
+		}
+	}
+}
+
+static int
+c_cgroups_get_usage(void *cgroupsp, container_usage_t *usage)
+{
+	c_cgroups_t *cgroups = cgroupsp;
+	ASSERT(cgroups);
+	ASSERT(usage);
+
+	char buf[4096];
+
+	IF_TRUE_RETVAL_TRACE(cgroups->stat_fd[C_CGROUPS_STAT_CPU] < 0, -1);
+
+	usage->cpu_usage_us = usage->cpu_user_us = usage->cpu_system_us = 0;
+	usage->cpu_throttled_us = 0;
+	if (!c_cgroups_stat_pread(cgroups, C_CGROUPS_STAT_CPU, buf, sizeof(buf))) {
+		const char *const keys[] = { "usage_usec", "user_usec", "system_usec",
+					     "throttled_usec" };
+		uint64_t *const values[] = { &usage->cpu_usage_us, &usage->cpu_user_us,
+					     &usage->cpu_system_us, &usage->cpu_throttled_us };
+		c_cgroups_stat_parse(buf, ' ', keys, values, ELEMENTSOF(keys));
+	}
+
+	usage->memory_current = 0;
+	if (!c_cgroups_stat_pread(cgroups, C_CGROUPS_STAT_MEMORY_CURRENT, buf, sizeof(buf)))
+		usage->memory_current = strtoull(buf, NULL, 10);
+
+	usage->memory_anon = usage->memory_file = 0;
+	if (!c_cgroups_stat_pread(cgroups, C_CGROUPS_STAT_MEMORY, buf, sizeof(buf))) {
+		const char *const keys[] = { "anon", "file" };
+		uint64_t *const values[] = { &usage->memory_anon, &usage->memory_file };
+		c_cgroups_stat_parse(buf, ' ', keys, values, ELEMENTSOF(keys));
+	}
+
+	usage->io_read_bytes = usage->io_write_bytes = 0;
+	usage->io_read_ios = usage->io_write_ios = 0;
+	if (!c_cgroups_stat_pread(cgroups, C_CGROUPS_STAT_IO, buf, sizeof(buf))) {
+		const char *const keys[] = { "rbytes", "wbytes", "rios", "wios" };
+		uint64_t *const values[] = { &usage->io_read_bytes, &usage->io_write_bytes,
+					     &usage->io_read_ios, &usage->io_write_ios };
+		c_cgroups_stat_parse(buf, '=', keys, values, ELEMENTSOF(keys));
+	}
+
+	return 0;
+}
+
+/*
+ * Sets up the cgroup of the container before the clone, so that its init can be cloned
+ * directly into the child cgroup, see compartment_set_clone_cgroup_fd().
+ */
+static int
+c_cgroups_start_pre_clone(void *cgroupsp)
 {
 	c_cgroups_t *cgroups = cgroupsp;
 	ASSERT(cgroups);
@@ -507,6 +1132,15 @@ c_cgroups_start_post_clone(void *cgroupsp)
 		goto out;
 	}
 
+	if (cgroups->cgroup_fd >= 0)
+		close(cgroups->cgroup_fd);
+	cgroups->cgroup_fd = open(cgroups->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cgroups->cgroup_fd < 0) {
+		ERROR_ERRNO("Could not open cgroup %s for container %s", cgroups->path,
+			    container_get_description(cgroups->container));
+		goto out;
+	}
+
 	/* initialize memory subsystem to limit ram to cgroups->ram_limit */
 	if (c_cgroups_set_ram_limit(cgroups) < 0) {
 		ERROR("Could not configure cgroup maximum ram for container %s",
@@ -514,6 +1148,12 @@ c_cgroups_start_post_clone(void *cgroupsp)
 		goto out;
 	}
 
+	if (c_cgroups_set_ram_soft_limits(cgroups) < 0) {
+		ERROR("Could not configure cgroup soft ram limits for container %s",
+		      container_get_description(cgroups->container));
+		goto out;
+	}
+
 	/* initialize cpuset child subsystem to limit access to allowed cpus */
 	if (c_cgroups_set_cpus_allowed(cgroups) < 0) {
 		ERROR("Could not configure cgroup to restrict cpus of container %s",
@@ -521,20 +1161,30 @@ c_cgroups_start_post_clone(void *cgroupsp)
 		goto out;
 	}
 
+	if (c_cgroups_set_hugetlb_limits(cgroups) < 0) {
+		ERROR("Could not configure cgroup hugetlb limits for container %s",
+		      container_get_description(cgroups->container));
+		goto out;
+	}
+
 	/* initialize events handling, e.g., for freezer subsystem */
-	char *events_path = mem_printf("%s/cgroup.events", cgroups->path);
-	cgroups->inotify_cgroup_events =
-		event_inotify_new(events_path, IN_MODIFY, &c_cgroups_events_cb, cgroups);
-	int error = event_add_inotify(cgroups->inotify_cgroup_events);
-	if (error && error != -EEXIST) {
-		ERROR("Could not register inotify event for cgroups events!");
+	if (c_cgroups_events_register(cgroups) < 0) {
+		ERROR("Could not register cgroups events for container %s",
+		      container_get_description(cgroups->container));
 		goto out;
 	}
 
-	mem_free0(events_path);
+	/* monitor pressure of the container to react on contention */
+	c_cgroups_psi_register(cgroups);
+
+	/* keep the usage files open for the telemetry sampling */
+	c_cgroups_stat_open(cgroups);
+
+	/* reclaim memory of the container if it becomes idle */
+	c_cgroups_reclaim_start(cgroups);
 
 	// activate controllers
-	if (c_cgroups_activate_controllers(cgroups->path)) {
+	if (c_cgroups_activate_controllers(cgroups->cgroup_fd, cgroups->path)) {
 		ERROR("Could not activate cgroup controllers for intermediate cgroup!");
 		goto out;
 	}
@@ -551,14 +1201,169 @@ c_cgroups_start_post_clone(void *cgroupsp)
 	 */
 	cgroups_child_path = mem_printf("%s/child", cgroups->path);
 
-	if (mkdir(cgroups_child_path, 0755) && errno != EEXIST) {
+	if (mkdirat(cgroups->cgroup_fd, "child", 0755) && errno != EEXIST) {
 		ERROR_ERRNO("Could not create cgroup %s for container %s", cgroups_child_path,
 			    container_get_description(cgroups->container));
 		goto out;
 	}
 
-	if (c_cgroups_add_pid_by_path(cgroups_child_path, container_get_pid(cgroups->container))) {
-		ERROR("Could not join container to child cgroup!");
+	if (cgroups->child_cgroup_fd >= 0)
+		close(cgroups->child_cgroup_fd);
+	cgroups->child_cgroup_fd =
+		openat(cgroups->cgroup_fd, "child", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cgroups->child_cgroup_fd < 0) {
+		ERROR_ERRNO("Could not open cgroup %s for container %s", cgroups_child_path,
+			    container_get_description(cgroups->container));
+		goto out;
+	}
+	compartment_set_clone_cgroup_fd(cgroups->compartment, cgroups->child_cgroup_fd);
+
+	ret = 0;
+out:
+	if (cgroups_child_path)
+		mem_free0(cgroups_child_path);
+	return ret;
+}
+
+static void
+c_cgroups_close_child_cgroup(c_cgroups_t *cgroups)
+{
+	compartment_set_clone_cgroup_fd(cgroups->compartment, -1);
+	if (cgroups->child_cgroup_fd >= 0) {
+		close(cgroups->child_cgroup_fd);
+		cgroups->child_cgroup_fd = -1;
+	}
+}
+
+/*
+ * Resolves the disk which stores the images of the container. The io controller only accepts
+ * whole disks, so a partition is resolved to its disk. Loop devices charge their I/O on the
+ * image files to the cgroup of the container, thus the limits on that disk also apply to the
+ * loop and dm devices of the container volumes.
+ */
+static int
+c_cgroups_get_storage_disk(const c_cgroups_t *cgroups, unsigned int *maj, unsigned int *min)
+{
+	struct stat st;
+	char *dir = mem_strdup(container_get_images_dir(cgroups->container));
+
+	// the images directory may not exist yet on the first start
+	if (stat(dir, &st) < 0 && stat(dirname(dir), &st) < 0) {
+		ERROR_ERRNO("Could not stat storage of container %s",
+			    container_get_description(cgroups->container));
+		mem_free0(dir);
+		return -1;
+	}
+	mem_free0(dir);
+
+	*maj = major(st.st_dev);
+	*min = minor(st.st_dev);
+
+	char *sys_dev = mem_printf("/sys/dev/block/%u:%u", *maj, *min);
+	char *partition = mem_printf("%s/partition", sys_dev);
+	char *disk_dev = mem_printf("%s/../dev", sys_dev);
+	int ret = 0;
+
+	if (!file_exists(sys_dev)) {
+		ERROR("Storage of container %s is not on a block device",
+		      container_get_description(cgroups->container));
+		ret = -1;
+	} else if (file_exists(partition)) {
+		char *disk = file_read_new(disk_dev, 32);
+		if (!disk || sscanf(disk, "%u:%u", maj, min) != 2) {
+			ERROR("Could not resolve disk of partition %s", sys_dev);
+			ret = -1;
+		}
+		mem_free0(disk);
+	}
+
+	mem_free0(sys_dev);
+	mem_free0(partition);
+	mem_free0(disk_dev);
+	return ret;
+}
+
+static int
+c_cgroups_set_io_limits(c_cgroups_t *cgroups)
+{
+	ASSERT(cgroups);
+
+	const container_io_limits_t *io = container_get_io_limits(cgroups->container);
+	unsigned int maj, min;
+
+	if (io->weight &&
+	    file_printf_at(cgroups->cgroup_fd, "io.weight", "default %u", io->weight) == -1) {
+		ERROR_ERRNO("Could not set io weight of container %s to %u",
+			    container_get_description(cgroups->container), io->weight);
+		return -1;
+	}
+
+	bool has_max = io->read_bps || io->write_bps || io->read_iops || io->write_iops;
+
+	// the other limits apply to the disk of the container storage
+	IF_FALSE_RETVAL(has_max || io->latency_target, 0);
+	IF_TRUE_RETVAL(c_cgroups_get_storage_disk(cgroups, &maj, &min) < 0, -1);
+
+	if (has_max) {
+		str_t *max = str_new(NULL);
+		str_append_printf(max, "%u:%u", maj, min);
+		if (io->read_bps)
+			str_append_printf(max, " rbps=%" PRIu64, io->read_bps);
+		if (io->write_bps)
+			str_append_printf(max, " wbps=%" PRIu64, io->write_bps);
+		if (io->read_iops)
+			str_append_printf(max, " riops=%u", io->read_iops);
+		if (io->write_iops)
+			str_append_printf(max, " wiops=%u", io->write_iops);
+
+		int ret = file_write_at(cgroups->cgroup_fd, "io.max", str_buffer(max), -1);
+		if (ret == -1)
+			ERROR_ERRNO("Could not set io limits '%s' of container %s", str_buffer(max),
+				    container_get_description(cgroups->container));
+		str_free(max, true);
+		IF_TRUE_RETVAL(ret == -1, -1);
+	}
+
+	if (io->latency_target && file_printf_at(cgroups->cgroup_fd, "io.latency",
+						 "%u:%u target=%u", maj, min,
+						 io->latency_target) == -1) {
+		ERROR_ERRNO("Could not set io latency target of container %s to %u us",
+			    container_get_description(cgroups->container), io->latency_target);
+		return -1;
+	}
+
+	INFO("Set io limits of container %s on disk %u:%u",
+	     container_get_description(cgroups->container), maj, min);
+	return 0;
+}
+
+static int
+c_cgroups_start_post_clone(void *cgroupsp)
+{
+	c_cgroups_t *cgroups = cgroupsp;
+	ASSERT(cgroups);
+
+	int ret = -COMPARTMENT_ERROR_CGROUPS;
+	pid_t pid = container_get_pid(cgroups->container);
+	char *cgroups_child_path = mem_printf("%s/child", cgroups->path);
+
+	c_cgroups_close_child_cgroup(cgroups);
+
+	if (c_cgroups_set_io_limits(cgroups) < 0) {
+		ERROR("Could not configure cgroup io limits for container %s",
+		      container_get_description(cgroups->container));
+		goto out;
+	}
+
+	// the init is usually cloned into the child cgroup, else move it there now
+	char *cgroup = proc_get_cgroups_path_new(pid);
+	bool cloned_into_cgroup =
+		cgroup && !strcmp(cgroups_child_path + strlen(CGROUPS_FOLDER), cgroup);
+	mem_free0(cgroup);
+
+	if (!cloned_into_cgroup &&
+	    file_printf_at(cgroups->cgroup_fd, "child/cgroup.procs", "%d", pid) == -1) {
+		ERROR_ERRNO("Could not join container to child cgroup!");
 		goto out;
 	}
 
@@ -569,8 +1374,7 @@ c_cgroups_start_post_clone(void *cgroupsp)
 
 	ret = 0;
 out:
-	if (cgroups_child_path)
-		mem_free0(cgroups_child_path);
+	mem_free0(cgroups_child_path);
 	return ret;
 }
 
@@ -580,6 +1384,9 @@ c_cgroups_start_pre_exec_child(void *cgroupsp)
 	c_cgroups_t *cgroups = cgroupsp;
 	ASSERT(cgroups);
 
+	if (c_cgroups_set_thp_mode(cgroups) < 0)
+		return -COMPARTMENT_ERROR_CGROUPS;
+
 	/* check if cgroupns is supported else do nothing */
 	IF_FALSE_RETVAL_TRACE(cgroups->ns_cgroup, 0);
 
@@ -595,24 +1402,29 @@ c_cgroups_start_pre_exec_child(void *cgroupsp)
 }
 
 static int
-c_cgroups_cleanup_subtree_remove_cb(const char *path, const char *name, UNUSED void *data)
+c_cgroups_cleanup_subtree_remove_cb(int dirfd, const char *name, unsigned char type,
+				    UNUSED void *data)
 {
 	int ret = 0;
-	char *file_to_remove = mem_printf("%s/%s", path, name);
-	if (file_is_dir(file_to_remove)) {
-		TRACE("Removing cgroup subtree in %s is dir", file_to_remove);
-		if (dir_foreach(file_to_remove, &c_cgroups_cleanup_subtree_remove_cb, NULL) < 0) {
-			ERROR_ERRNO("Could not delete cgroup subtree contents in %s",
-				    file_to_remove);
-			ret--;
-		}
-		TRACE("Removing now empty subtree %s", file_to_remove);
-		if (rmdir(file_to_remove) < 0) {
-			ERROR_ERRNO("Could not delete cgroup subtree %s", file_to_remove);
-			ret--;
-		}
+
+	// only subfolders need to be removed, the control files vanish with them
+	if (dir_entry_type(dirfd, name, type) != DT_DIR)
+		return 0;
+
+	TRACE("Removing cgroup subtree in %s is dir", name);
+	int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 || dir_foreach_at(fd, &c_cgroups_cleanup_subtree_remove_cb, NULL) < 0) {
+		ERROR_ERRNO("Could not delete cgroup subtree contents in %s", name);
+		ret--;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	TRACE("Removing now empty subtree %s", name);
+	if (unlinkat(dirfd, name, AT_REMOVEDIR) < 0) {
+		ERROR_ERRNO("Could not delete cgroup subtree %s", name);
+		ret--;
 	}
-	mem_free0(file_to_remove);
 	return ret;
 }
 
@@ -622,9 +1434,19 @@ c_cgroups_cleanup(void *cgroupsp, UNUSED bool is_rebooting)
 	c_cgroups_t *cgroups = cgroupsp;
 	ASSERT(cgroups);
 
-	if (file_exists(cgroups->path) && file_is_dir(cgroups->path)) {
+	/* stop events handling, pressure monitoring, reclaim and sampling of the cgroup */
+	c_cgroups_events_unregister(cgroups);
+	c_cgroups_psi_unregister(cgroups);
+	c_cgroups_reclaim_stop(cgroups);
+	c_cgroups_cleanup_freeze_timer(cgroups);
+	c_cgroups_stat_close(cgroups);
+
+	int fd = open(cgroups->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd >= 0) {
 		/* recursively remove all subfolders which the container may have created */
-		if (dir_foreach(cgroups->path, &c_cgroups_cleanup_subtree_remove_cb, NULL) < 0) {
+		int ret = dir_foreach_at(fd, &c_cgroups_cleanup_subtree_remove_cb, NULL);
+		close(fd);
+		if (ret < 0) {
 			WARN_ERRNO("Could not remove cgroup v2 for container %s",
 				   container_get_description(cgroups->container));
 		} else if (rmdir(cgroups->path) < 0) {
@@ -635,12 +1457,12 @@ c_cgroups_cleanup(void *cgroupsp, UNUSED bool is_rebooting)
 		}
 	}
 
-	/* remove inotify events handling */
-	if (cgroups->inotify_cgroup_events) {
-		event_remove_inotify(cgroups->inotify_cgroup_events);
-		event_inotify_free(cgroups->inotify_cgroup_events);
-		cgroups->inotify_cgroup_events = NULL;
+	if (cgroups->cgroup_fd >= 0) {
+		close(cgroups->cgroup_fd);
+		cgroups->cgroup_fd = -1;
 	}
+
+	c_cgroups_close_child_cgroup(cgroups);
 }
 
 static compartment_module_t c_cgroups_module = {
@@ -650,7 +1472,7 @@ static compartment_module_t c_cgroups_module = {
 	.compartment_destroy = NULL,
 	.start_post_clone_early = NULL,
 	.start_child_early = NULL,
-	.start_pre_clone = NULL,
+	.start_pre_clone = c_cgroups_start_pre_clone,
 	.start_post_clone = c_cgroups_start_post_clone,
 	.start_pre_exec = NULL,
 	.start_post_exec = NULL,
@@ -679,6 +1501,9 @@ c_cgroups_init(void)
 	container_register_add_pid_to_cgroups_handler(MOD_NAME, c_cgroups_add_pid);
 	container_register_freeze_handler(MOD_NAME, c_cgroups_freeze);
 	container_register_unfreeze_handler(MOD_NAME, c_cgroups_unfreeze);
+	container_register_get_pressure_handler(MOD_NAME, c_cgroups_get_pressure);
+	container_register_get_usage_handler(MOD_NAME, c_cgroups_get_usage);
+	container_register_set_cpuset_handler(MOD_NAME, c_cgroups_set_cpuset);
 
 	// register cleanup on exit handler
 	if (atexit(&c_cgroups_deinit))
@@ -709,8 +1534,10 @@ c_cgroups_init(void)
 		FATAL("Could not move cmld to leaf cgroup '%s'", cgroup_cmld);
 
 	// activate controllers
-	if (c_cgroups_activate_controllers(c_cgroups_subtree))
+	int subtree_fd = open(c_cgroups_subtree, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (subtree_fd < 0 || c_cgroups_activate_controllers(subtree_fd, c_cgroups_subtree))
 		FATAL("Could not activate cgroup controllers for cmld!");
+	close(subtree_fd);
 
 	mem_free0(cgroup_cmld);
 }
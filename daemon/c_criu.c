@@ -0,0 +1,477 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2021 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * @file c_criu.c
+ *
+ * This module checkpoints the processes of a running container to its images
+ * directory with CRIU and resumes them on the next start of the container
+ * instead of booting its init again.
+ *
+ * A checkpoint stops the container. The image is only written completely if
+ * CRIU was able to dump all processes; otherwise CRIU lets them continue and
+ * the partial image is removed. On the next start, the compartment is prepared
+ * as for a regular boot (images, cgroups, network). Then, before c_vol switches
+ * to the rootfs of the container, the child restores the process tree on top
+ * of the rootfs and stays as init of the container's pid namespace, which just
+ * waits for the restored tree. The network namespace is handed over to CRIU
+ * from the child, all other namespaces of the container are recreated by CRIU.
+ * A checkpoint is consumed by the start which resumes it, if this fails, the
+ * container boots regularly on its next start.
+ */
+
+#define _GNU_SOURCE
+
+#define MOD_NAME "c_criu"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/dir.h"
+#include "common/fd.h"
+#include "common/file.h"
+#include "common/event.h"
+#include "common/proc.h"
+#include "container.h"
+#include "guestos.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define C_CRIU_BINARY "criu"
+#define C_CRIU_DIR "checkpoint"
+// written after a successful dump, identifies the guestos the processes were dumped on
+#define C_CRIU_MARKER "cml-checkpoint"
+#define C_CRIU_PIDFILE "restore.pid"
+#define C_CRIU_NETNS_KEY "cml-netns"
+
+typedef struct c_criu {
+	container_t *container;
+	compartment_t *compartment;
+	char *dir;		   //!< checkpoint directory in the images dir of the container
+	event_child_t *dump_child; //!< running criu dump
+	bool restore;		   //!< the current start resumes the checkpoint
+	pid_t root_pid;		   //!< root of the restored process tree, only set in the child
+} c_criu_t;
+
+// root of the restored process tree for the signal handler of the waiting init
+static volatile pid_t c_criu_root_pid = 0;
+
+static void *
+c_criu_new(compartment_t *compartment)
+{
+	ASSERT(compartment);
+	IF_NULL_RETVAL(compartment_get_extension_data(compartment), NULL);
+
+	c_criu_t *criu = mem_new0(c_criu_t, 1);
+	criu->compartment = compartment;
+	criu->container = compartment_get_extension_data(compartment);
+	criu->dir = mem_printf("%s/%s", container_get_images_dir(criu->container), C_CRIU_DIR);
+
+	return criu;
+}
+
+static void
+c_criu_free(void *criup)
+{
+	c_criu_t *criu = criup;
+	ASSERT(criu);
+
+	if (criu->dump_child) {
+		event_remove_child(criu->dump_child);
+		event_child_free(criu->dump_child);
+	}
+	mem_free0(criu->dir);
+	mem_free0(criu);
+}
+
+static char *
+c_criu_marker_new(c_criu_t *criu)
+{
+	const guestos_t *os = container_get_guestos(criu->container);
+	IF_NULL_RETVAL(os, NULL);
+
+	return mem_printf("%s %" PRIu64 "\n", guestos_get_name(os), guestos_get_version(os));
+}
+
+static void
+c_criu_remove_checkpoint(c_criu_t *criu)
+{
+	if (file_is_dir(criu->dir) && dir_delete_folder(container_get_images_dir(criu->container),
+							C_CRIU_DIR))
+		WARN("Could not remove checkpoint %s", criu->dir);
+}
+
+/*
+ * A checkpoint can only be resumed on the guestos it was dumped on.
+ */
+static bool
+c_criu_checkpoint_is_valid(c_criu_t *criu)
+{
+	char *marker_file = mem_printf("%s/%s", criu->dir, C_CRIU_MARKER);
+	char *marker = file_exists(marker_file) ? file_read_new(marker_file, 4096) : NULL;
+	char *expected = c_criu_marker_new(criu);
+
+	bool valid = marker && expected && !strcmp(marker, expected);
+	if (marker && !valid)
+		WARN("Discarding checkpoint of container %s dumped on guestos '%s'",
+		     container_get_name(criu->container), marker);
+
+	mem_free0(marker_file);
+	mem_free0(marker);
+	mem_free0(expected);
+	return valid;
+}
+
+static void
+c_criu_dump_cb(pid_t pid, int status, event_child_t *child, void *data)
+{
+	c_criu_t *criu = data;
+	ASSERT(criu);
+
+	event_child_free(child);
+	criu->dump_child = NULL;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		ERROR("Checkpoint of container %s failed (pid=%d, status=%d), see %s/dump.log",
+		      container_get_name(criu->container), pid, status, criu->dir);
+		// the processes were resumed by criu
+		c_criu_remove_checkpoint(criu);
+		return;
+	}
+
+	char *marker_file = mem_printf("%s/%s", criu->dir, C_CRIU_MARKER);
+	char *marker = c_criu_marker_new(criu);
+	if (!marker || file_write(marker_file, marker, -1) < 0) {
+		ERROR("Could not complete checkpoint of container %s",
+		      container_get_name(criu->container));
+		c_criu_remove_checkpoint(criu);
+	} else {
+		INFO("Checkpointed container %s to %s", container_get_name(criu->container),
+		     criu->dir);
+	}
+	mem_free0(marker_file);
+	mem_free0(marker);
+}
+
+/*
+ * Dumps the process tree of the container, which is killed by criu afterwards.
+ * The container then stops as if its init exited.
+ */
+static int
+c_criu_checkpoint(void *criup)
+{
+	c_criu_t *criu = criup;
+	ASSERT(criu);
+
+	if (container_get_state(criu->container) != COMPARTMENT_STATE_RUNNING) {
+		ERROR("Container %s is not running, cannot checkpoint it",
+		      container_get_name(criu->container));
+		return -1;
+	}
+	IF_TRUE_RETVAL_ERROR(criu->dump_child, -1);
+
+	// the user namespace and the vm of KVM containers are not supported
+	if (container_get_type(criu->container) == CONTAINER_TYPE_KVM ||
+	    compartment_has_userns(criu->compartment)) {
+		ERROR("Checkpoints of container %s are not supported",
+		      container_get_name(criu->container));
+		return -1;
+	}
+
+	pid_t init_pid = container_get_pid(criu->container);
+	char *external = NULL;
+	if (compartment_has_netns(criu->compartment)) {
+		// the network namespace is provided by c_net on restore
+		char *netns = mem_printf("/proc/%d/ns/net", init_pid);
+		struct stat s;
+		int ret = stat(netns, &s);
+		mem_free0(netns);
+		if (ret < 0) {
+			ERROR_ERRNO("Could not get network namespace of container %s",
+				    container_get_name(criu->container));
+			return -1;
+		}
+		external = mem_printf("net[%lu]:%s", (unsigned long)s.st_ino, C_CRIU_NETNS_KEY);
+	}
+
+	c_criu_remove_checkpoint(criu);
+	if (dir_mkdir_p(criu->dir, 0700) < 0) {
+		ERROR_ERRNO("Could not create checkpoint dir %s", criu->dir);
+		mem_free0(external);
+		return -1;
+	}
+
+	char *pid = mem_printf("%d", init_pid);
+	const char *const argv[] = { C_CRIU_BINARY,
+				     "dump",
+				     "--tree",
+				     pid,
+				     "--images-dir",
+				     criu->dir,
+				     "--log-file",
+				     "dump.log",
+				     "--tcp-established",
+				     "--ext-unix-sk",
+				     "--file-locks",
+				     "--link-remap",
+				     "--manage-cgroups=ignore",
+				     external ? "--external" : NULL,
+				     external,
+				     NULL };
+
+	INFO("Checkpointing container %s to %s", container_get_name(criu->container), criu->dir);
+	pid_t dump_pid = fork();
+	if (dump_pid == 0) {
+		execvp(argv[0], (char *const *)argv);
+		ERROR_ERRNO("Could not exec %s", C_CRIU_BINARY);
+		_exit(EXIT_FAILURE);
+	}
+	mem_free0(pid);
+	mem_free0(external);
+
+	if (dump_pid < 0) {
+		ERROR_ERRNO("Could not fork for checkpoint");
+		c_criu_remove_checkpoint(criu);
+		return -1;
+	}
+
+	criu->dump_child = event_child_new(dump_pid, c_criu_dump_cb, criu);
+	event_add_child(criu->dump_child);
+
+	return 0;
+}
+
+static int
+c_criu_start_pre_clone(void *criup)
+{
+	c_criu_t *criu = criup;
+	ASSERT(criu);
+
+	criu->restore = c_criu_checkpoint_is_valid(criu);
+	if (!criu->restore) {
+		c_criu_remove_checkpoint(criu);
+		return 0;
+	}
+
+	// consume the checkpoint, if the restore fails the next start boots regularly
+	char *marker_file = mem_printf("%s/%s", criu->dir, C_CRIU_MARKER);
+	if (unlink(marker_file) < 0)
+		WARN_ERRNO("Could not remove %s", marker_file);
+	mem_free0(marker_file);
+
+	INFO("Resuming container %s from checkpoint %s", container_get_name(criu->container),
+	     criu->dir);
+	return 0;
+}
+
+static int
+c_criu_start_post_exec(void *criup)
+{
+	c_criu_t *criu = criup;
+	ASSERT(criu);
+
+	IF_FALSE_RETVAL(criu->restore, 0);
+
+	// the restored processes do not boot, so there is no boot completion to wait for
+	container_set_state(criu->container, COMPARTMENT_STATE_RUNNING);
+	return 0;
+}
+
+static void
+c_criu_restore_exec(c_criu_t *criu, int netns_fd)
+{
+	// criu needs a proc of the pid namespace it restores in
+	if (unshare(CLONE_NEWNS) < 0 || mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0 ||
+	    mount("proc", "/proc", "proc", MS_NOSUID | MS_NODEV | MS_NOEXEC, NULL) < 0) {
+		ERROR_ERRNO("Could not mount /proc for restore");
+		_exit(EXIT_FAILURE);
+	}
+
+	char *pidfile = mem_printf("%s/%s", criu->dir, C_CRIU_PIDFILE);
+	char *inherit = netns_fd < 0 ? NULL : mem_printf("fd[%d]:%s", netns_fd, C_CRIU_NETNS_KEY);
+	const char *const argv[] = { C_CRIU_BINARY,
+				     "restore",
+				     "--images-dir",
+				     criu->dir,
+				     "--log-file",
+				     "restore.log",
+				     "--root",
+				     container_get_rootdir(criu->container),
+				     "--pidfile",
+				     pidfile,
+				     "--restore-detached",
+				     "--tcp-established",
+				     "--ext-unix-sk",
+				     "--file-locks",
+				     "--manage-cgroups=ignore",
+				     inherit ? "--inherit-fd" : NULL,
+				     inherit,
+				     NULL };
+
+	execvp(argv[0], (char *const *)argv);
+	ERROR_ERRNO("Could not exec %s", C_CRIU_BINARY);
+	_exit(EXIT_FAILURE);
+}
+
+/*
+ * Restores the checkpoint in the child, which is pid 1 of the new pid namespace of the
+ * container. This has to happen before c_vol switches to the rootfs, which criu uses
+ * as root of the restored mount namespace.
+ */
+static int
+c_criu_start_child(void *criup)
+{
+	c_criu_t *criu = criup;
+	ASSERT(criu);
+
+	IF_FALSE_RETVAL(criu->restore, 0);
+
+	int netns_fd = -1;
+	if (compartment_has_netns(criu->compartment) &&
+	    (netns_fd = open("/proc/self/ns/net", O_RDONLY)) < 0) {
+		ERROR_ERRNO("Could not open network namespace for restore");
+		return -COMPARTMENT_ERROR;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		ERROR_ERRNO("Could not fork for restore");
+		goto error;
+	}
+	if (pid == 0)
+		c_criu_restore_exec(criu, netns_fd);
+
+	int status;
+	if (proc_waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status)) {
+		ERROR("Restore of container %s failed, see %s/restore.log",
+		      container_get_name(criu->container), criu->dir);
+		goto error;
+	}
+
+	char *pidfile = mem_printf("%s/%s", criu->dir, C_CRIU_PIDFILE);
+	char *root_pid = file_read_new(pidfile, 32);
+	criu->root_pid = root_pid ? atoi(root_pid) : 0;
+	mem_free0(pidfile);
+	mem_free0(root_pid);
+	IF_TRUE_GOTO_ERROR(criu->root_pid <= 0, error);
+
+	INFO("Restored container %s (root pid=%d)", container_get_name(criu->container),
+	     criu->root_pid);
+	if (netns_fd >= 0)
+		close(netns_fd);
+	return 0;
+
+error:
+	if (netns_fd >= 0)
+		close(netns_fd);
+	return -COMPARTMENT_ERROR;
+}
+
+static void
+c_criu_forward_signal(int sig)
+{
+	if (c_criu_root_pid > 0)
+		kill(c_criu_root_pid, sig);
+}
+
+/*
+ * Instead of executing the init of the container, the child stays as init of the pid
+ * namespace of the container and exits with the restored process tree, which was
+ * reparented to it.
+ */
+static int
+c_criu_start_pre_exec_child(void *criup)
+{
+	c_criu_t *criu = criup;
+	ASSERT(criu);
+
+	IF_FALSE_RETVAL(criu->restore, 0);
+
+	c_criu_root_pid = criu->root_pid;
+	struct sigaction sa = { .sa_handler = c_criu_forward_signal };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGPWR, &sa, NULL);
+
+	DEBUG("Waiting for restored processes, no further debugging info can be printed");
+	fd_close_all(0, NULL, 0);
+
+	// also reap orphans of the restored tree until its root exits
+	int status = 0;
+	for (pid_t pid = 0; pid != criu->root_pid;) {
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0 && errno != EINTR)
+			_exit(EXIT_FAILURE);
+	}
+	_exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+}
+
+static void
+c_criu_cleanup(void *criup, UNUSED bool is_rebooting)
+{
+	c_criu_t *criu = criup;
+	ASSERT(criu);
+
+	// a resumed checkpoint is outdated as soon as the processes run again
+	if (criu->restore)
+		c_criu_remove_checkpoint(criu);
+	criu->restore = false;
+}
+
+static compartment_module_t c_criu_module = {
+	.name = MOD_NAME,
+	.compartment_new = c_criu_new,
+	.compartment_free = c_criu_free,
+	.compartment_destroy = NULL,
+	.start_post_clone_early = NULL,
+	.start_child_early = NULL,
+	.start_pre_clone = c_criu_start_pre_clone,
+	.start_post_clone = NULL,
+	.start_pre_exec = NULL,
+	.start_post_exec = c_criu_start_post_exec,
+	.start_child = c_criu_start_child,
+	.start_pre_exec_child_early = NULL,
+	.start_pre_exec_child = c_criu_start_pre_exec_child,
+	.stop = NULL,
+	.cleanup = c_criu_cleanup,
+	.join_ns = NULL,
+};
+
+static void INIT
+c_criu_init(void)
+{
+	// register this module in compartment.c
+	compartment_register_module(&c_criu_module);
+
+	// register relevant handlers implemented by this module
+	container_register_checkpoint_handler(MOD_NAME, c_criu_checkpoint);
+}
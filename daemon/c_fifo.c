@@ -28,6 +28,7 @@
 #include "cmld.h"
 #include "container.h"
 #include "audit.h"
+#include "idlefreeze.h"
 
 #include "common/macro.h"
 #include "common/mem.h"
@@ -35,29 +36,302 @@
 #include "common/ns.h"
 #include "common/uuid.h"
 #include "common/str.h"
-#include "common/fd.h"
 #include "common/event.h"
 #include "common/file.h"
-#include "common/proc.h"
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sched.h>
-#include <signal.h>
+#include <sys/ioctl.h>
 
 #define FIFO_PATH "/dev/fifos"
 
+/* Size of the pipe buffers of forwarded FIFOs */
+#define C_FIFO_PIPE_SIZE (1024 * 1024)
+/* Delay in ms between attempts to open the container end of a FIFO without reader */
+#define C_FIFO_REOPEN_INTERVAL 100
+
+typedef struct c_fifo_forwarder {
+	container_t *container; //!< the container behind path_container
+	char *path_c0;	      //!< FIFO in c0 which is read
+	char *path_container; //!< FIFO in the container which is written
+	int fromfd;
+	int tofd;
+	event_io_t *from_io;  //!< waits for data in the c0 FIFO
+	bool from_paused;     //!< from_io is removed while the data cannot be forwarded
+	event_io_t *to_io;    //!< waits for space in the container FIFO
+	event_timer_t *timer; //!< retries to open the container FIFO until it has a reader
+} c_fifo_forwarder_t;
+
 typedef struct c_fifo {
 	container_t *container;
 	list_t *fifo_list;
-	list_t *forwarder_list;
+	list_t *forwarder_list; //!< list of c_fifo_forwarder_t
 } c_fifo_t;
 
 // all fifos which needs to be recreated after a reboot of c0
 list_t *c0_fifo_list = NULL;
 
+/*
+ * Forwarding is driven by the event loop of cmld. The c0 end of a FIFO is kept open for
+ * reading, so that writers in c0 do not block, and its data is spliced into the container
+ * end without copying it to user space. The container end is opened once there is data to
+ * forward and closed if the writer in c0 closes the FIFO, which passes the EOF on to the
+ * reader in the container. Data of the c0 end is kept in its pipe buffer while the
+ * container FIFO has no reader or is full.
+ */
+static void
+c_fifo_forwarder_forward(c_fifo_forwarder_t *fw, bool hup);
+
+static void
+c_fifo_set_pipe_size(int fd)
+{
+	if (fcntl(fd, F_SETPIPE_SZ, C_FIFO_PIPE_SIZE) < 0)
+		TRACE_ERRNO("Failed to set pipe size of fd %d", fd);
+}
+
+static void
+c_fifo_forwarder_pause(c_fifo_forwarder_t *fw, bool pause)
+{
+	IF_TRUE_RETURN(!fw->from_io || fw->from_paused == pause);
+
+	if (pause)
+		event_remove_io(fw->from_io);
+	else
+		event_add_io(fw->from_io);
+	fw->from_paused = pause;
+}
+
+static void
+c_fifo_forwarder_close_to(c_fifo_forwarder_t *fw)
+{
+	if (fw->to_io) {
+		event_remove_io(fw->to_io);
+		event_io_free(fw->to_io);
+		fw->to_io = NULL;
+	}
+	if (fw->timer) {
+		event_remove_timer(fw->timer);
+		event_timer_free(fw->timer);
+		fw->timer = NULL;
+	}
+	if (fw->tofd >= 0) {
+		close(fw->tofd);
+		fw->tofd = -1;
+	}
+	c_fifo_forwarder_pause(fw, false);
+}
+
+static void
+c_fifo_forwarder_close(c_fifo_forwarder_t *fw)
+{
+	c_fifo_forwarder_close_to(fw);
+
+	if (fw->from_io) {
+		event_remove_io(fw->from_io);
+		event_io_free(fw->from_io);
+		fw->from_io = NULL;
+	}
+	if (fw->fromfd >= 0) {
+		close(fw->fromfd);
+		fw->fromfd = -1;
+	}
+}
+
+static void
+c_fifo_forwarder_free(c_fifo_forwarder_t *fw)
+{
+	IF_NULL_RETURN(fw);
+
+	c_fifo_forwarder_close(fw);
+	mem_free0(fw->path_c0);
+	mem_free0(fw->path_container);
+	mem_free0(fw);
+}
+
+static void
+c_fifo_forwarder_from_cb(UNUSED int fd, unsigned events, UNUSED event_io_t *io, void *data)
+{
+	c_fifo_forwarder_t *fw = data;
+
+	// the reader in an idle container has to be running to take the data
+	if (events & EVENT_IO_READ)
+		idlefreeze_wake(fw->container, "FIFO data");
+
+	c_fifo_forwarder_forward(fw, events & EVENT_IO_EXCEPT);
+}
+
+static void
+c_fifo_forwarder_to_cb(UNUSED int fd, UNUSED unsigned events, UNUSED event_io_t *io, void *data)
+{
+	c_fifo_forwarder_t *fw = data;
+
+	// the container FIFO has space again or lost its reader
+	event_remove_io(fw->to_io);
+	event_io_free(fw->to_io);
+	fw->to_io = NULL;
+	c_fifo_forwarder_pause(fw, false);
+
+	c_fifo_forwarder_forward(fw, false);
+}
+
+static void
+c_fifo_forwarder_timer_cb(UNUSED event_timer_t *timer, void *data)
+{
+	c_fifo_forwarder_t *fw = data;
+
+	event_remove_timer(fw->timer);
+	event_timer_free(fw->timer);
+	fw->timer = NULL;
+	c_fifo_forwarder_pause(fw, false);
+
+	c_fifo_forwarder_forward(fw, false);
+}
+
+/*
+ * (Re)opens the c0 end of the FIFO, which discards the container end.
+ */
+static int
+c_fifo_forwarder_open_from(c_fifo_forwarder_t *fw)
+{
+	c_fifo_forwarder_close(fw);
+
+	if (!file_is_fifo(fw->path_c0)) {
+		ERROR("Could not open FIFO at %s, stopping forwarder", fw->path_c0);
+		return -1;
+	}
+
+	if (-1 == (fw->fromfd = open(fw->path_c0, O_RDONLY | O_NONBLOCK | O_CLOEXEC))) {
+		ERROR_ERRNO("Failed to open fromfd at %s, stopping forwarder", fw->path_c0);
+		return -1;
+	}
+	c_fifo_set_pipe_size(fw->fromfd);
+	TRACE("Opened reading end for %s", fw->path_c0);
+
+	fw->from_io = event_io_new(fw->fromfd, EVENT_IO_READ, c_fifo_forwarder_from_cb, fw);
+	event_add_io(fw->from_io);
+	fw->from_paused = false;
+
+	return 0;
+}
+
+/*
+ * Opens the container end of the FIFO.
+ * @return 0 on success, 1 if the FIFO has no reader yet, -1 on error
+ */
+static int
+c_fifo_forwarder_open_to(c_fifo_forwarder_t *fw)
+{
+	if (!file_is_fifo(fw->path_container)) {
+		ERROR("Could not open FIFO at %s, stopping forwarder", fw->path_container);
+		return -1;
+	}
+
+	if (-1 == (fw->tofd = open(fw->path_container, O_WRONLY | O_NONBLOCK | O_CLOEXEC))) {
+		IF_TRUE_RETVAL(errno == ENXIO, 1);
+		ERROR_ERRNO("Failed to open tofd at %s, stopping forwarder", fw->path_container);
+		return -1;
+	}
+	c_fifo_set_pipe_size(fw->tofd);
+	TRACE("Opened writing end for %s", fw->path_container);
+
+	return 0;
+}
+
+static void
+c_fifo_forwarder_forward(c_fifo_forwarder_t *fw, bool hup)
+{
+	while (true) {
+		int pending = 0;
+		if (ioctl(fw->fromfd, FIONREAD, &pending)) {
+			WARN_ERRNO("Failed to get pending bytes of %s", fw->path_c0);
+			goto reopen;
+		}
+
+		// all data is forwarded, pass EOF of the c0 end on to the container end
+		if (pending == 0) {
+			if (hup) {
+				TRACE("FIFO %s closed by writer, reopening", fw->path_c0);
+				goto reopen;
+			}
+			return;
+		}
+
+		if (fw->tofd < 0) {
+			int ret = c_fifo_forwarder_open_to(fw);
+			IF_TRUE_GOTO(ret < 0, stop);
+			if (ret > 0) {
+				// retry while the data stays in the c0 FIFO
+				c_fifo_forwarder_pause(fw, true);
+				fw->timer = event_timer_new(C_FIFO_REOPEN_INTERVAL, 1,
+							    c_fifo_forwarder_timer_cb, fw);
+				event_add_timer(fw->timer);
+				return;
+			}
+		}
+
+		ssize_t count = splice(fw->fromfd, NULL, fw->tofd, NULL, pending,
+				       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (count > 0) {
+			TRACE("Forwarded %zd bytes from %s", count, fw->path_c0);
+			continue;
+		}
+
+		if (count < 0 && errno == EAGAIN) {
+			// the container FIFO is full
+			c_fifo_forwarder_pause(fw, true);
+			fw->to_io =
+				event_io_new(fw->tofd, EVENT_IO_WRITE, c_fifo_forwarder_to_cb, fw);
+			event_add_io(fw->to_io);
+			return;
+		}
+
+		if (count < 0 && errno == EPIPE) {
+			TRACE("FIFO %s closed by reader", fw->path_container);
+			c_fifo_forwarder_close_to(fw);
+			continue;
+		}
+
+		WARN_ERRNO("Failed to forward data from %s", fw->path_c0);
+		goto reopen;
+	}
+
+reopen:
+	if (!c_fifo_forwarder_open_from(fw))
+		return;
+stop:
+	c_fifo_forwarder_close(fw);
+}
+
+static c_fifo_forwarder_t *
+c_fifo_forwarder_new(container_t *container, const char *path_c0, const char *path_container)
+{
+	c_fifo_forwarder_t *fw = mem_new0(c_fifo_forwarder_t, 1);
+	fw->container = container;
+	fw->path_c0 = mem_strdup(path_c0);
+	fw->path_container = mem_strdup(path_container);
+	fw->fromfd = -1;
+	fw->tofd = -1;
+
+	if (c_fifo_forwarder_open_from(fw)) {
+		c_fifo_forwarder_free(fw);
+		return NULL;
+	}
+
+	return fw;
+}
+
+static void
+c_fifo_forwarders_free(c_fifo_t *fifo)
+{
+	for (list_t *l = fifo->forwarder_list; l; l = l->next)
+		c_fifo_forwarder_free(l->data);
+	list_delete(fifo->forwarder_list);
+	fifo->forwarder_list = NULL;
+}
+
 void *
 c_fifo_new(compartment_t *compartment)
 {
@@ -126,19 +400,9 @@ c_fifo_cleanup(void *fifop, bool is_rebooting)
 	char *fifo_path_c0 = c_fifo_get_c0_path_new(fifo);
 	IF_NULL_RETURN_DEBUG(fifo_path_c0);
 
-	while (fifo->forwarder_list) {
-		pid_t *pid = fifo->forwarder_list->data;
-		if (pid) {
-			// stop hooks are not called if compartment is killed;
-			// thus, kill forwarders here.
-			if (*pid > 0) {
-				DEBUG("Kill still running forwarder %d", *pid);
-				kill(*pid, SIGKILL);
-			}
-			mem_free(pid);
-		}
-		fifo->forwarder_list = list_unlink(fifo->forwarder_list, fifo->forwarder_list);
-	}
+	// stop hooks are not called if compartment is killed;
+	// thus, stop forwarders here.
+	c_fifo_forwarders_free(fifo);
 
 	// clean up FIFOs in c0
 	// FIFOs in container are removed during c_vol cleanup
@@ -230,66 +494,6 @@ error:
 	return -1;
 }
 
-static int
-c_fifo_loop(char *fifo_path_c0, char *fifo_path_container)
-{
-	int fromfd = -1, tofd = -1;
-
-	//keep repopening c0 FIFO when closed
-	while (1) {
-		if (fromfd != -1 && close(fromfd)) {
-			TRACE_ERRNO("Failed to close old reading fd");
-		}
-
-		if (tofd != -1 && close(tofd)) {
-			TRACE_ERRNO("Failed to close old reading fd");
-		}
-
-		if (!file_is_fifo(fifo_path_c0)) {
-			ERROR("Could not open FIFO at %s, stopping forwarder", fifo_path_c0);
-			_exit(0);
-		}
-
-		if (-1 == (fromfd = open(fifo_path_c0, O_RDONLY))) {
-			ERROR_ERRNO("Failed to open fromfd at %s, exiting...", fifo_path_c0);
-			_exit(-1);
-		}
-		TRACE("Opened reading end for %s", fifo_path_c0);
-
-		if (!file_is_fifo(fifo_path_container)) {
-			ERROR("Could not open FIFO at %s, stopping forwarder", fifo_path_container);
-			_exit(0);
-		}
-
-		if (-1 == (tofd = open(fifo_path_container, O_WRONLY))) {
-			ERROR_ERRNO("Failed to open tofd at %s, exiting ...", fifo_path_container);
-			_exit(-1);
-		}
-		TRACE("Opened writing end for %s", fifo_path_container);
-
-		TRACE("Entering readloop with fromfd %d and tofd %d", fromfd, tofd);
-
-		int count = 0;
-		char buf[1024];
-
-		while (0 < (count = read(fromfd, &buf, sizeof(buf) - 1))) {
-			TRACE("[READLOOP] Read returned %d, writing to target FIFO", count);
-
-			buf[count] = 0;
-			TRACE("[READLOOP] Read %d bytes from fd: %d: %s", count, fromfd, buf);
-
-			if (count != fd_write(tofd, buf, count)) {
-				ERROR("Could not write all bytes to container FIFO end.");
-				break;
-			}
-		}
-
-		TRACE("[READLOOP] Read returned %d, try to reopen fds", count);
-	}
-
-	_exit(0);
-}
-
 static int
 c_fifo_start_post_clone(void *fifop)
 {
@@ -350,49 +554,26 @@ c_fifo_start_post_clone(void *fifop)
 		goto error;
 	}
 
-	// fork FIFO forwarding children
+	// set up FIFO forwarding
 	for (list_t *elem = fifo->fifo_list; elem != NULL; elem = elem->next) {
 		char *current_fifo = elem->data;
 		char *current_fifo_c0 = mem_printf("%s/%s", fifo_path_c0, current_fifo);
 		char *current_fifo_container =
 			mem_printf("%s/%s", fifo_path_container, current_fifo);
 
-		int pid = fork();
+		DEBUG("Forwarding from %s to %s", current_fifo_c0, current_fifo_container);
+		c_fifo_forwarder_t *fw = c_fifo_forwarder_new(fifo->container, current_fifo_c0,
+							       current_fifo_container);
 
-		if (-1 == pid) {
-			ERROR("Failed to clone forwarding child");
-			mem_free(current_fifo_c0);
-			mem_free(current_fifo_container);
+		mem_free(current_fifo_c0);
+		mem_free(current_fifo_container);
 
+		if (!fw) {
+			ERROR("Failed to set up forwarding for FIFO \'%s\'", current_fifo);
 			ret = -COMPARTMENT_ERROR_FIFO;
-
 			goto error;
-
-		} else if (pid == 0) {
-			DEBUG("Preparing forwarding for FIFO \'%s\'", current_fifo);
-			DEBUG("Forwarding from %s to %s", current_fifo_c0, current_fifo_container);
-
-			event_reset();
-
-			c_fifo_loop(current_fifo_c0, current_fifo_container);
-
-			_exit(EXIT_FAILURE);
 		}
-
-		mem_free(current_fifo_c0);
-		mem_free(current_fifo_container);
-
-		pid_t *mpid = mem_alloc(sizeof(pid_t));
-		*mpid = pid;
-		DEBUG("Appending %d to forwarder list", *mpid);
-		fifo->forwarder_list = list_append(fifo->forwarder_list, mpid);
-
-		// register at sigchild handler for helper forwarding clone
-		char *forwarder_name = mem_printf("%s-forwarder", current_fifo);
-		container_wait_for_child(fifo->container, forwarder_name, *mpid);
-		mem_free0(forwarder_name);
-
-		DEBUG("Forked FIFO forwarding child %d for %s", pid, current_fifo);
+		fifo->forwarder_list = list_append(fifo->forwarder_list, fw);
 	}
 out:
 	ret = 0;
@@ -412,15 +593,8 @@ c_fifo_stop(void *fifop)
 	c_fifo_t *fifo = fifop;
 	ASSERT(fifo);
 
-	for (list_t *l = fifo->forwarder_list; l; l = l->next) {
-		pid_t *pid = l->data;
-		if (0 >= *pid)
-			continue;
-
-		DEBUG("Stopping forwarder %d", *pid);
-		kill(*pid, SIGKILL);
-		*pid = -1;
-	}
+	DEBUG("Stopping FIFO forwarders");
+	c_fifo_forwarders_free(fifo);
 
 	return 0;
 }
@@ -442,6 +616,7 @@ static compartment_module_t c_fifo_module = {
 	.stop = c_fifo_stop,
 	.cleanup = c_fifo_cleanup,
 	.join_ns = NULL,
+	.flags = COMPARTMENT_MODULE_F_LAZY,
 };
 
 static void INIT
@@ -35,23 +35,24 @@
 #include "common/macro.h"
 #include "common/mem.h"
 #include "common/dir.h"
-#include "common/event.h"
 #include "common/file.h"
 #include "common/uuid.h"
 #include "common/uevent.h"
 
 #include "container.h"
+#include "idlefreeze.h"
 
 #include <libgen.h>
 #include <sys/sysmacros.h>
 #include <unistd.h>
 
-#define C_HOTPLUG_USB_TOKEN_DEV_RETRIES 10
-
 typedef struct c_hotplug {
 	container_t *container; // weak reference
-	uevent_uev_t *uev;
+	uevent_uev_t *uev;	      // events of device nodes
+	uevent_uev_t *uev_usbif;      // usb_interface events, which have no device node
+	uevent_injector_t *injector;  // injects forwarded uevents into the netns of the container
 	list_t *allow_on_unplug_list; // usb devices, i.e., TOKENs which were denied on plug event
+	list_t *token_pending_list;   // plugged tokens waiting for their device node
 } c_hotplug_t;
 
 // list which contains usbdev_t items which are used as TOKEN by any container
@@ -190,33 +191,55 @@ c_hotplug_usbdev_set_sysfs_props(container_usbdev_t *usbdev)
 }
 
 struct c_hotplug_token_data {
-	container_t *container;
 	char *devname;
-	int retry;
+	int major;
+	int minor;
 };
 
 static void
-c_hotplug_token_timer_cb(event_timer_t *timer, void *data)
+c_hotplug_token_data_free(struct c_hotplug_token_data *token_data)
 {
-	ASSERT(data);
-	struct c_hotplug_token_data *token_data = data;
-
-	DEBUG("devname: %s", token_data->devname);
-
-	IF_TRUE_GOTO(token_data->retry++ > C_HOTPLUG_USB_TOKEN_DEV_RETRIES, out);
+	mem_free0(token_data->devname);
+	mem_free0(token_data);
+}
 
-	// wait for device node to become available
-	IF_TRUE_RETURN(!file_exists(token_data->devname));
+/*
+ * Attaches the token as soon as devfs has created its device node. Until then, the token
+ * is kept pending and checked again on the following uevents of the device, e.g., the
+ * bind event after the usb driver has been bound.
+ * Returns true if the token is attached.
+ */
+static bool
+c_hotplug_token_try_attach(c_hotplug_t *hotplug, struct c_hotplug_token_data *token_data)
+{
+	IF_FALSE_RETVAL_TRACE(file_exists(token_data->devname), false);
 
-	container_token_attach(token_data->container);
+	container_token_attach(hotplug->container);
 	INFO("Processed token attachment of token %s for container %s", token_data->devname,
-	     container_get_name(token_data->container));
+	     container_get_name(hotplug->container));
+	return true;
+}
 
-out:
-	mem_free0(token_data->devname);
-	mem_free0(token_data);
-	event_remove_timer(timer);
-	event_timer_free(timer);
+/*
+ * Handles a uevent of the usb device with the given device number for a pending token.
+ * On removal, the pending token is dropped.
+ */
+static void
+c_hotplug_token_pending_handle(c_hotplug_t *hotplug, unsigned actions, int major, int minor)
+{
+	for (list_t *l = hotplug->token_pending_list; l;) {
+		list_t *next = l->next;
+		struct c_hotplug_token_data *token_data = l->data;
+
+		if (token_data->major == major && token_data->minor == minor &&
+		    ((actions & UEVENT_ACTION_REMOVE) ||
+		     c_hotplug_token_try_attach(hotplug, token_data))) {
+			hotplug->token_pending_list =
+				list_unlink(hotplug->token_pending_list, l);
+			c_hotplug_token_data_free(token_data);
+		}
+		l = next;
+	}
 }
 
 /*
@@ -234,6 +257,9 @@ c_hotplug_handle_usb_hotplug(unsigned actions, uevent_event_t *event, c_hotplug_
 				     strncmp(uevent_event_get_devtype(event), "usb_device", 10),
 			     false);
 
+	c_hotplug_token_pending_handle(hotplug, actions, uevent_event_get_major(event),
+				       uevent_event_get_minor(event));
+
 	if (actions & UEVENT_ACTION_REMOVE) {
 		for (list_t *l = container_get_usbdev_list(hotplug->container); l; l = l->next) {
 			container_usbdev_t *ud = l->data;
@@ -345,7 +371,8 @@ c_hotplug_handle_usb_hotplug(unsigned actions, uevent_event_t *event, c_hotplug_
 
 					struct c_hotplug_token_data *token_data =
 						mem_new0(struct c_hotplug_token_data, 1);
-					token_data->container = hotplug->container;
+					token_data->major = major;
+					token_data->minor = minor;
 					token_data->devname = mem_printf(
 						"%s%s",
 						strncmp("/dev/", uevent_event_get_devname(event),
@@ -353,14 +380,12 @@ c_hotplug_handle_usb_hotplug(unsigned actions, uevent_event_t *event, c_hotplug_
 							"/dev/" :
 							"/",
 						uevent_event_get_devname(event));
-					token_data->retry = 0;
-
-					// give devfs some time to create device node for token
-					event_timer_t *e =
-						event_timer_new(100, EVENT_TIMER_REPEAT_FOREVER,
-								c_hotplug_token_timer_cb,
-								token_data);
-					event_add_timer(e);
+
+					if (c_hotplug_token_try_attach(hotplug, token_data))
+						c_hotplug_token_data_free(token_data);
+					else
+						hotplug->token_pending_list = list_append(
+							hotplug->token_pending_list, token_data);
 				} else {
 					INFO("%s bound device node %d:%d -> container %s",
 					     (container_usbdev_is_assigned(ud)) ? "assign" :
@@ -369,6 +394,7 @@ c_hotplug_handle_usb_hotplug(unsigned actions, uevent_event_t *event, c_hotplug_
 					container_device_allow(hotplug->container, 'c', major,
 							       minor,
 							       container_usbdev_is_assigned(ud));
+					idlefreeze_wake(hotplug->container, "usb device");
 				}
 			}
 		}
@@ -377,6 +403,31 @@ c_hotplug_handle_usb_hotplug(unsigned actions, uevent_event_t *event, c_hotplug_
 	return ret;
 }
 
+/*
+ * Forwards the uevent into the netns of the container. The injector is created with the
+ * first event and kept until the container is cleaned up, which saves a fork per event.
+ */
+static int
+c_hotplug_inject_event(c_hotplug_t *hotplug, uevent_event_t *event)
+{
+	pid_t pid = container_get_pid(hotplug->container);
+
+	if (hotplug->injector && uevent_injector_get_netns_pid(hotplug->injector) != pid) {
+		uevent_injector_free(hotplug->injector);
+		hotplug->injector = NULL;
+	}
+	if (!hotplug->injector)
+		hotplug->injector =
+			uevent_injector_new(pid, container_has_userns(hotplug->container));
+
+	if (hotplug->injector)
+		return uevent_injector_inject(hotplug->injector, event);
+
+	// fall back to a child per event
+	return uevent_event_inject_into_netns(event, pid,
+					      container_has_userns(hotplug->container));
+}
+
 static void
 c_hotplug_handle_event_cb(unsigned actions, uevent_event_t *event, void *data)
 {
@@ -466,8 +517,7 @@ c_hotplug_handle_event_cb(unsigned actions, uevent_event_t *event, void *data)
 	}
 
 send:
-	if (uevent_event_inject_into_netns(event, container_get_pid(hotplug->container),
-					   container_has_userns(hotplug->container)) < 0) {
+	if (c_hotplug_inject_event(hotplug, event) < 0) {
 		WARN("Could not inject uevent into netns of container %s!",
 		     container_get_name(hotplug->container));
 	} else {
@@ -479,8 +529,7 @@ err:
 		uuid_free(synth_uuid);
 	if (devname)
 		mem_free0(devname);
-	if (event_coldboot)
-		mem_free0(event_coldboot);
+	uevent_event_free(event_coldboot);
 }
 
 static void *
@@ -492,15 +541,32 @@ c_hotplug_new(compartment_t *compartment)
 	c_hotplug_t *hotplug = mem_new0(c_hotplug_t, 1);
 	hotplug->container = compartment_get_extension_data(compartment);
 
-	hotplug->uev =
-		uevent_uev_new(UEVENT_UEV_TYPE_KERNEL,
-			       UEVENT_ACTION_ADD | UEVENT_ACTION_CHANGE | UEVENT_ACTION_REMOVE |
-				       UEVENT_ACTION_BIND | UEVENT_ACTION_UNBIND,
-			       c_hotplug_handle_event_cb, hotplug);
+	/*
+	 * Events without device number are only forwarded for usb interfaces, all
+	 * others are dropped by the device allow check of c_hotplug_handle_event_cb().
+	 * Registering both cases separately keeps the other events from visiting the
+	 * handlers of every container.
+	 */
+	unsigned actions = UEVENT_ACTION_ADD | UEVENT_ACTION_CHANGE | UEVENT_ACTION_REMOVE |
+			   UEVENT_ACTION_BIND | UEVENT_ACTION_UNBIND;
+	hotplug->uev = uevent_uev_new_filtered(UEVENT_UEV_TYPE_KERNEL, actions, NULL, NULL,
+					       UEVENT_UEV_FILTER_DEVNUM, c_hotplug_handle_event_cb,
+					       hotplug);
+	hotplug->uev_usbif = uevent_uev_new_filtered(UEVENT_UEV_TYPE_KERNEL, actions, "usb",
+						     "usb_interface", 0,
+						     c_hotplug_handle_event_cb, hotplug);
 
 	// register hotplug handling for this c_hotplug container submodule
 	if (uevent_add_uev(hotplug->uev)) {
 		uevent_uev_free(hotplug->uev);
+		uevent_uev_free(hotplug->uev_usbif);
+		mem_free0(hotplug);
+		return NULL;
+	}
+	if (uevent_add_uev(hotplug->uev_usbif)) {
+		uevent_remove_uev(hotplug->uev);
+		uevent_uev_free(hotplug->uev);
+		uevent_uev_free(hotplug->uev_usbif);
 		mem_free0(hotplug);
 		return NULL;
 	}
@@ -524,6 +590,9 @@ c_hotplug_free(void *hotplugp)
 
 	uevent_remove_uev(hotplug->uev);
 	uevent_uev_free(hotplug->uev);
+	uevent_remove_uev(hotplug->uev_usbif);
+	uevent_uev_free(hotplug->uev_usbif);
+	uevent_injector_free(hotplug->injector);
 
 	// remove used tokens by this compartment from global list
 	for (list_t *l = container_get_usbdev_list(hotplug->container); l; l = l->next) {
@@ -540,6 +609,10 @@ c_hotplug_free(void *hotplugp)
 	}
 	list_delete(hotplug->allow_on_unplug_list);
 
+	for (list_t *l = hotplug->token_pending_list; l; l = l->next)
+		c_hotplug_token_data_free(l->data);
+	list_delete(hotplug->token_pending_list);
+
 	mem_free0(hotplug);
 }
 
@@ -683,6 +756,17 @@ c_hotplug_coldplug_usbdevs(void *hotplugp)
 	return 0;
 }
 
+static void
+c_hotplug_cleanup(void *hotplugp, UNUSED bool is_rebooting)
+{
+	c_hotplug_t *hotplug = hotplugp;
+	ASSERT(hotplug);
+
+	// the socket of the injector keeps the netns of the container alive
+	uevent_injector_free(hotplug->injector);
+	hotplug->injector = NULL;
+}
+
 static compartment_module_t c_hotplug_module = {
 	.name = MOD_NAME,
 	.compartment_new = c_hotplug_new,
@@ -702,7 +786,7 @@ static compartment_module_t c_hotplug_module = {
 	.start_child = NULL,
 	.start_pre_exec_child = NULL,
 	.stop = NULL,
-	.cleanup = NULL,
+	.cleanup = c_hotplug_cleanup,
 	.join_ns = NULL,
 };
 
@@ -40,9 +40,9 @@
 #include "common/dir.h"
 #include "common/kernel.h"
 #include "container.h"
+#include "idshift.h"
 
 #define IDMAPPED_SRC_DIR "/tmp/idmapped_mnts"
-#define UID_RANGE 100000
 
 /**************************/
 #ifndef MOUNT_ATTR_RDONLY
@@ -231,11 +231,6 @@ typedef struct c_idmapped {
 	bool is_dev_mounted; // checks if the bind mount for dev is already performed
 } c_idmapped_t;
 
-struct c_idmapped_chown_dir_cbdata {
-	int uid;
-	int gid;
-};
-
 static void
 c_idmapped_mnt_free(struct c_idmapped_mnt *mnt)
 {
@@ -277,52 +272,6 @@ c_idmapped_free(void *idmappedp)
 	mem_free0(idmapped);
 }
 
-static int
-c_idmapped_chown_dir_cb(const char *path, const char *file, void *data)
-{
-	struct stat s;
-	int ret = 0;
-	struct c_idmapped_chown_dir_cbdata *cbdata = data;
-	ASSERT(cbdata);
-
-	char *file_to_chown = mem_printf("%s/%s", path, file);
-	if (lstat(file_to_chown, &s) == -1) {
-		mem_free0(file_to_chown);
-		return -1;
-	}
-
-	// modulo operation avoids shifting twice
-	uid_t uid = s.st_uid % UID_RANGE + cbdata->uid;
-	gid_t gid = s.st_gid % UID_RANGE + cbdata->gid;
-
-	if (file_is_dir(file_to_chown)) {
-		TRACE("Path %s is dir", file_to_chown);
-		if (dir_foreach(file_to_chown, &c_idmapped_chown_dir_cb, cbdata) < 0) {
-			ERROR_ERRNO("Could not chown all dir contents in '%s'", file_to_chown);
-			ret--;
-		}
-		if (chown(file_to_chown, uid, gid) < 0) {
-			ERROR_ERRNO("Could not chown dir '%s' to (%d:%d)", file_to_chown, uid, gid);
-			ret--;
-		}
-	} else {
-		if (lchown(file_to_chown, uid, gid) < 0) {
-			ERROR_ERRNO("Could not chown file '%s' to (%d:%d)", file_to_chown, uid,
-				    gid);
-			ret--;
-		}
-	}
-	TRACE("Chown file '%s' to (%d:%d) (uid_start %d)", file_to_chown, uid, gid, cbdata->uid);
-
-	// chown .
-	if (chown(path, uid, gid) < 0) {
-		ERROR_ERRNO("Could not chown dir '%s' to (%d:%d)", path, uid, gid);
-		ret--;
-	}
-	mem_free0(file_to_chown);
-	return ret;
-}
-
 static int
 c_idmapped_mnt_apply_mapping(struct c_idmapped_mnt *mnt, int userns_fd)
 {
@@ -337,14 +286,13 @@ c_idmapped_mnt_apply_mapping(struct c_idmapped_mnt *mnt, int userns_fd)
 		return -1;
 	}
 	if (s.st_uid != 0) {
-		struct c_idmapped_chown_dir_cbdata cbdata = { .uid = 0, .gid = 0 };
-		if (dir_foreach(mnt->src, &c_idmapped_chown_dir_cb, &cbdata) < 0) {
-			ERROR("Could not revert mapping done by chown %s to target uid:gid (%d:%d)",
-			      mnt->src, cbdata.uid, cbdata.gid);
+		if (idshift_tree(mnt->src, 0, true) < 0) {
+			ERROR("Could not revert mapping done by chown %s to target uid:gid (0:0)",
+			      mnt->src);
 			return -1;
 		}
-		DEBUG("Reverted mapping done by chown %s from %d to target uid:gid (%d:%d)",
-		      mnt->src, s.st_uid, cbdata.uid, cbdata.gid);
+		DEBUG("Reverted mapping done by chown %s from %d to target uid:gid (0:0)",
+		      mnt->src, s.st_uid);
 	}
 
 	struct mount_attr attr = { 0 };
@@ -456,10 +404,94 @@ error:
 	return -1;
 }
 
+#define C_IDMAPPED_FS_MAX 16
+
+/* idmapped mount support of the file system types, probed on first use */
+static struct {
+	long f_type;
+	bool supported;
+} c_idmapped_fs[C_IDMAPPED_FS_MAX];
+static int c_idmapped_fs_count = 0;
+
+/**
+ * Probes if dir can be idmapped to the user namespace of the container by applying
+ * the mapping to a detached clone of its mount, which is dropped afterwards.
+ */
+static bool
+c_idmapped_probe_dir(c_idmapped_t *idmapped, const char *dir)
+{
+	bool supported = false;
+
+	int userns_fd = container_open_userns(idmapped->container);
+	if (userns_fd < 0) {
+		WARN_ERRNO("Could not open userns of container to probe idmapped mounts");
+		return false;
+	}
+
+	int tree_fd = open_tree(-1, dir, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+	if (tree_fd >= 0) {
+		struct mount_attr attr = { 0 };
+		attr.userns_fd = userns_fd;
+		attr.attr_set = MOUNT_ATTR_IDMAP;
+		supported = !mount_setattr(tree_fd, "", AT_EMPTY_PATH, &attr,
+					   sizeof(struct mount_attr));
+		if (!supported)
+			DEBUG_ERRNO("Could not idmap clone of '%s'", dir);
+		close(tree_fd);
+	} else {
+		DEBUG_ERRNO("Could not open_tree dir '%s'", dir);
+	}
+
+	close(userns_fd);
+	return supported;
+}
+
+/**
+ * Returns true if the file system of dir supports idmapped mounts. The result is
+ * recorded per file system type, thus only the first dir of each type is probed.
+ */
+static bool
+c_idmapped_is_supported(c_idmapped_t *idmapped, const char *dir)
+{
+	struct statfs dir_statfs;
+
+	// mount_setattr() is available since 5.12
+	if (!kernel_version_check("5.12"))
+		return false;
+
+	if (statfs(dir, &dir_statfs) < 0) {
+		WARN_ERRNO("Could not statfs '%s'", dir);
+		return false;
+	}
+
+	for (int i = 0; i < c_idmapped_fs_count; i++) {
+		if (c_idmapped_fs[i].f_type == (long)dir_statfs.f_type)
+			return c_idmapped_fs[i].supported;
+	}
+
+	bool supported = c_idmapped_probe_dir(idmapped, dir);
+	INFO("idmapped mounts are %ssupported on file system type 0x%lx", supported ? "" : "not ",
+	     (long)dir_statfs.f_type);
+
+	if (c_idmapped_fs_count < C_IDMAPPED_FS_MAX) {
+		c_idmapped_fs[c_idmapped_fs_count].f_type = dir_statfs.f_type;
+		c_idmapped_fs[c_idmapped_fs_count].supported = supported;
+		c_idmapped_fs_count++;
+	}
+	return supported;
+}
+
+/**
+ * Returns true if an overlayfs can be mounted in the user namespace of the container
+ * on top of idmapped mounts of its upper and lower dir, otherwise the overlayfs is
+ * mounted in the root namespace and shifted as a whole.
+ */
 static bool
-is_idmapping_supported()
+c_idmapped_is_ovl_supported(c_idmapped_t *idmapped, const char *upper, const char *lower)
 {
-	return kernel_version_check("6.3");
+	// overlayfs supports idmapped layers since 5.19
+	return kernel_version_check("5.19") && c_idmapped_is_supported(idmapped, upper) &&
+	       c_idmapped_is_supported(idmapped, lower);
 }
 
 static int
@@ -472,8 +504,9 @@ c_idmapped_prepare_dir(c_idmapped_t *idmapped, struct c_idmapped_mnt *mnt, const
 	int container_uid = container_get_uid(idmapped->container);
 	struct statfs dir_statfs;
 	statfs(dir, &dir_statfs);
+	bool idmap = c_idmapped_is_supported(idmapped, dir);
 
-	if (!is_idmapping_supported()) {
+	if (!idmap) {
 		if (dir_statfs.f_flags & MS_RDONLY) {
 			char *tmpfs_dir =
 				mem_printf("%s/%s/tmp%d", IDMAPPED_SRC_DIR,
@@ -502,11 +535,9 @@ c_idmapped_prepare_dir(c_idmapped_t *idmapped, struct c_idmapped_mnt *mnt, const
 				    container_uid);
 			return -1;
 		}
-		struct c_idmapped_chown_dir_cbdata cbdata = { .uid = container_uid,
-							      .gid = container_uid };
-		if (dir_foreach(dir, &c_idmapped_chown_dir_cb, &cbdata) < 0) {
-			ERROR("Could not chown %s to target uid:gid (%d:%d)", dir, cbdata.uid,
-			      cbdata.gid);
+		if (idshift_tree(dir, container_uid, true) < 0) {
+			ERROR("Could not chown %s to target uid:gid (%d:%d)", dir, container_uid,
+			      container_uid);
 			return -1;
 		}
 
@@ -532,8 +563,12 @@ c_idmapped_prepare_dir(c_idmapped_t *idmapped, struct c_idmapped_mnt *mnt, const
 		return -1;
 	}
 
-	if (!is_idmapping_supported())
+	// already shifted in init userns, bind mount in child
+	if (!idmap) {
+		mnt->mapped_tree_fd = -1;
+		mnt->bind_in_child = true;
 		return 0;
+	}
 
 	/*
 	 * In case of dev, we cannot use user namespace mounts since the kernel
@@ -594,8 +629,8 @@ c_idmapped_mount_idmapped(c_idmapped_t *idmapped, const char *src, const char *d
 	mnt->target = mem_strdup(dst);
 
 	if (ovl_lower) {
-		// mount ovl in rootns if kernel is to old
-		if (!is_idmapping_supported()) {
+		// mount ovl in rootns if its layers cannot be idmapped
+		if (!c_idmapped_is_ovl_supported(idmapped, src, ovl_lower)) {
 			if (c_idmapped_mount_ovl(src, src, ovl_lower, false)) {
 				ERROR("Failed to mount ovl '%s' (lower='%s') in rootns on '%s'",
 				      src, ovl_lower, dst);
@@ -701,10 +736,8 @@ c_idmapped_shift_ids(void *idmappedp, const char *src, const char *dst, const ch
 
 	// if cgroup subsys or dev just chown the files
 	if (is_dev || is_cgroup) {
-		struct c_idmapped_chown_dir_cbdata cbdata = { .uid = uid, .gid = uid };
-		if (dir_foreach(src, &c_idmapped_chown_dir_cb, &cbdata) < 0) {
-			ERROR("Could not chown %s to target uid:gid (%d:%d)", src, cbdata.uid,
-			      cbdata.gid);
+		if (idshift_tree(src, uid, false) < 0) {
+			ERROR("Could not chown %s to target uid:gid (%d:%d)", src, uid, uid);
 			return -1;
 		}
 		if ((is_dev && idmapped->is_dev_mounted) || is_cgroup)
@@ -748,8 +781,8 @@ c_idmapped_start_child(void *idmappedp)
 		     mnt->ovl_upper ? mnt->ovl_upper : "-");
 
 		// if explictly set to bind inchild (e.g. /dev on tmpfs) or
-		// kernel does not support idmapped mounts just do bind mount
-		if (mnt->bind_in_child || (!is_idmapping_supported())) {
+		// the file system does not support idmapped mounts just do bind mount
+		if (mnt->bind_in_child) {
 			if (!file_exists(mnt->target))
 				dir_mkdir_p(mnt->target, 0755);
 
@@ -47,6 +47,7 @@
 #include <inttypes.h>
 #include <signal.h>
 
+#include "common/bitmap.h"
 #include "common/macro.h"
 #include "common/mem.h"
 #include "common/sock.h"
@@ -62,6 +63,7 @@
 #include "container.h"
 #include "cmld.h"
 #include "hotplug.h"
+#include "xdp.h"
 
 /* Offset for ipv4/mac address allocation, e.g. 127.1.(IPV4_SUBNET_OFFS+x).2
  * Defines the start value for address allocation */
@@ -126,14 +128,33 @@ typedef struct c_net {
 } c_net_t;
 
 /**
- * bool array, which globally holds assigend offsets in order to
+ * Bitmap, which globally holds assigend offsets in order to
  * determine a new offset for a starting container.
- * address_offsets[i]==true means that a container holds this offset to get its specific ip address
+ * A set bit i means that a container holds this offset to get its specific ip address
  */
-static bool *address_offsets = NULL;
+static bitmap_t *address_offsets = NULL;
+
+/* Number of veth pairs which are kept pre-created for starting containers */
+#define C_NET_VETH_POOL_SIZE 2
+/* Delay between the creation of two veth pairs of the pool in ms */
+#define C_NET_VETH_POOL_REFILL_INTERVAL 100
+
+/* Pre-created veth pair c_<offset>/r_<offset> in the root ns */
+typedef struct {
+	int offset;	     //!< reserved address offset of the pair
+	uint8_t veth_mac[6]; //!< mac of the container endpoint
+	int veth_cmld_idx;   //!< Index of veth endpoint in rootns
+} c_net_veth_pool_entry_t;
+
+/**
+ * Pool of pre-created veth pairs, which is refilled by the main event loop, so that the
+ * pre clone hook of a starting container does not have to create the pair.
+ */
+static list_t *c_net_veth_pool = NULL;
+static event_timer_t *c_net_veth_pool_timer = NULL;
 
 /**
- * sets the offset at the specified position to false.
+ * clears the offset at the specified position.
  * indicates that a container releases its addresses.
  */
 static void
@@ -142,33 +163,27 @@ c_net_unset_offset(int offset)
 	ASSERT(offset >= 0 && offset < MAX_NUM_DEVICES);
 	TRACE("Offset %d released by a container", offset);
 
-	address_offsets[offset] = false;
+	bitmap_clear(address_offsets, offset);
 }
 
 /**
- * determines first free slot and occupies it. Also responsible for allocating the offsets array.
+ * determines first free slot and occupies it. Also responsible for allocating the offsets bitmap.
  * @return failure, return -1, else return first free offset
  */
 static int
 c_net_set_next_offset(void)
 {
-	if (!address_offsets) {
-		address_offsets = mem_new0(bool, MAX_NUM_DEVICES);
-		address_offsets[0] = true;
-		TRACE("Offset 0 ocupied by a container");
-		return 0;
-	}
+	if (!address_offsets)
+		address_offsets = bitmap_new(MAX_NUM_DEVICES);
 
-	for (int i = 0; i < MAX_NUM_DEVICES; i++) {
-		if (!address_offsets[i]) {
-			TRACE("Offset %d occupied by a container", i);
-			address_offsets[i] = true;
-			return i;
-		}
+	int offset = bitmap_set_next(address_offsets);
+	if (offset < 0) {
+		DEBUG("Unable to provide a valid ip address for c_net");
+		return -1;
 	}
 
-	DEBUG("Unable to provide a valid ip address for c_net");
-	return -1;
+	TRACE("Offset %d occupied by a container", offset);
+	return offset;
 }
 
 /**
@@ -313,10 +328,12 @@ c_net_remove_ifi(const char *ifi_name, const pid_t pid)
 
 /**
  * This function creates a veth pair veth1/veth2 (in the root namespace)
- * with a netlink message using the netlink socket
+ * with a netlink message using the netlink socket. Both endpoints get the
+ * given number of tx and rx queues, 0 for the kernel default.
  */
 static int
-c_net_create_veth_pair(const char *veth1, const char *veth2, uint8_t veth1_mac[6])
+c_net_create_veth_pair(const char *veth1, const char *veth2, uint8_t veth1_mac[6],
+		       unsigned int queues)
 {
 	ASSERT(veth1 && veth2);
 
@@ -380,6 +397,11 @@ c_net_create_veth_pair(const char *veth1, const char *veth2, uint8_t veth1_mac[6
 	if (nl_msg_add_string(req, IFLA_IFNAME, veth2))
 		goto msg_err;
 
+	/* Set veth2 queues */
+	if (queues && (nl_msg_add_u32(req, IFLA_NUM_TX_QUEUES, queues) ||
+		       nl_msg_add_u32(req, IFLA_NUM_RX_QUEUES, queues)))
+		goto msg_err;
+
 	/* Close nested attributes */
 	if (nl_msg_end_nested_attr(req, attr3))
 		goto msg_err;
@@ -396,6 +418,11 @@ c_net_create_veth_pair(const char *veth1, const char *veth2, uint8_t veth1_mac[6
 	if (nl_msg_add_buffer(req, IFLA_ADDRESS, (char *)veth1_mac, 6))
 		goto msg_err;
 
+	/* Set veth1 queues */
+	if (queues && (nl_msg_add_u32(req, IFLA_NUM_TX_QUEUES, queues) ||
+		       nl_msg_add_u32(req, IFLA_NUM_RX_QUEUES, queues)))
+		goto msg_err;
+
 	/* Send request message and wait for the response message */
 	if (nl_msg_send_kernel_verify(nl_sock, req))
 		goto msg_err;
@@ -413,41 +440,340 @@ msg_err:
 }
 
 /**
- * This function sets an ipv4 address (and the broadcast addr) for a given veth
- * with a netlink message using the netlink socket.
- * We use this in the root namespace and in the container's namespace.
+ * This function creates a macvlan in bridge mode or an ipvlan in l2 mode with the name
+ * vlan on top of the interface lower (in the root namespace) with a netlink message.
+ * The kernel assigns a random mac address to a macvlan, an ipvlan shares the one of lower.
  */
 static int
-c_net_set_ipv4(const char *ifi_name, const struct in_addr *ipv4_addr,
-	       const struct in_addr *ipv4_bcaddr)
+c_net_create_vlan(const char *vlan, const char *lower, container_pnet_mode_t mode)
 {
-	ASSERT(ifi_name);
+	ASSERT(vlan && lower);
+	ASSERT(mode == CONTAINER_PNET_MODE_MACVLAN || mode == CONTAINER_PNET_MODE_IPVLAN);
 
 	nl_sock_t *nl_sock = NULL;
-	unsigned int ifi_index;
 	nl_msg_t *req = NULL;
+	unsigned int lower_index;
+	bool macvlan = (mode == CONTAINER_PNET_MODE_MACVLAN);
 
-	DEBUG("Set ipv4 addr %s for %s", inet_ntoa(*ipv4_addr), ifi_name);
+	if (!(lower_index = if_nametoindex(lower))) {
+		ERROR_ERRNO("net interface name '%s' could not be resolved", lower);
+		return -1;
+	}
 
-	/* Get the interface index of the interface name */
-	if (!(ifi_index = if_nametoindex(ifi_name))) {
+	/* Open netlink socket */
+	if (!(nl_sock = nl_sock_routing_new())) {
+		ERROR("failed to allocate netlink socket");
+		return -1;
+	}
+
+	/* Create request netlink message */
+	if (!(req = nl_msg_new())) {
+		ERROR("failed to allocate netlink message");
+		nl_sock_free(nl_sock);
+		return -1;
+	}
+
+	/* Prepare request message */
+	struct ifinfomsg link_req = { .ifi_family = AF_UNSPEC };
+
+	struct nlattr *attr1, *attr2;
+
+	if (nl_msg_set_type(req, RTM_NEWLINK))
+		goto msg_err;
+
+	if (nl_msg_set_flags(req, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK))
+		goto msg_err;
+
+	if (nl_msg_set_link_req(req, &link_req) != 0)
+		goto msg_err;
+
+	/* Set name and lower device */
+	if (nl_msg_add_string(req, IFLA_IFNAME, vlan))
+		goto msg_err;
+
+	if (nl_msg_add_u32(req, IFLA_LINK, lower_index))
+		goto msg_err;
+
+	/* Set link type and mode */
+	if (!(attr1 = nl_msg_start_nested_attr(req, IFLA_LINKINFO)))
+		goto msg_err;
+
+	if (nl_msg_add_string(req, IFLA_INFO_KIND, macvlan ? "macvlan" : "ipvlan"))
+		goto msg_err;
+
+	if (!(attr2 = nl_msg_start_nested_attr(req, IFLA_INFO_DATA)))
+		goto msg_err;
+
+	if (macvlan) {
+		if (nl_msg_add_u32(req, IFLA_MACVLAN_MODE, MACVLAN_MODE_BRIDGE))
+			goto msg_err;
+	} else {
+		uint16_t ipvlan_mode = IPVLAN_MODE_L2;
+		if (nl_msg_add_buffer(req, IFLA_IPVLAN_MODE, (char *)&ipvlan_mode,
+				      sizeof(ipvlan_mode)))
+			goto msg_err;
+	}
+
+	if (nl_msg_end_nested_attr(req, attr2))
+		goto msg_err;
+	if (nl_msg_end_nested_attr(req, attr1))
+		goto msg_err;
+
+	/* Send request message and wait for the response message */
+	if (nl_msg_send_kernel_verify(nl_sock, req))
+		goto msg_err;
+
+	nl_msg_free(req);
+	nl_sock_free(nl_sock);
+
+	return 0;
+
+msg_err:
+	ERROR("failed to create/send netlink message");
+	nl_msg_free(req);
+	nl_sock_free(nl_sock);
+	return -1;
+}
+
+/**
+ * This function sets the mac address of a veth with a netlink message using the netlink socket.
+ */
+static int
+c_net_set_veth_mac(const char *veth, uint8_t mac[6])
+{
+	ASSERT(veth);
+
+	nl_sock_t *nl_sock = NULL;
+	nl_msg_t *req = NULL;
+	unsigned int ifi_index;
+
+	if (!(ifi_index = if_nametoindex(veth))) {
 		ERROR("veth interface name could not be resolved");
 		return -1;
 	}
 
-	/* Open netlink socket */
 	if (!(nl_sock = nl_sock_routing_new())) {
 		ERROR("failed to allocate netlink socket");
 		return -1;
 	}
 
-	/* Create netlink message */
 	if (!(req = nl_msg_new())) {
 		ERROR("failed to allocate netlink message");
 		nl_sock_free(nl_sock);
 		return -1;
 	}
 
+	struct ifinfomsg link_req = { .ifi_family = AF_INET, .ifi_index = ifi_index };
+
+	if (nl_msg_set_type(req, RTM_NEWLINK))
+		goto msg_err;
+
+	if (nl_msg_set_flags(req, NLM_F_REQUEST | NLM_F_ACK))
+		goto msg_err;
+
+	if (nl_msg_set_link_req(req, &link_req))
+		goto msg_err;
+
+	if (nl_msg_add_buffer(req, IFLA_ADDRESS, (char *)mac, 6))
+		goto msg_err;
+
+	if (nl_msg_send_kernel_verify(nl_sock, req))
+		goto msg_err;
+
+	nl_msg_free(req);
+	nl_sock_free(nl_sock);
+
+	return 0;
+
+msg_err:
+	ERROR("failed to create/send netlink message");
+	nl_msg_free(req);
+	nl_sock_free(nl_sock);
+	return -1;
+}
+
+/**
+ * Creates a veth pair c_<offset>/r_<offset> for the next free offset and appends it to the
+ * pool. The offset stays reserved until the pair is taken by a starting container.
+ */
+static int
+c_net_veth_pool_add(void)
+{
+	int offset = c_net_set_next_offset();
+	IF_TRUE_RETVAL(offset < 0, -1);
+
+	c_net_veth_pool_entry_t *entry = NULL;
+	char *veth_cmld_name = mem_printf("r_%d", offset);
+	char *veth_cont_name = mem_printf("c_%d", offset);
+
+	if (c_net_is_veth_used(veth_cmld_name) || c_net_is_veth_used(veth_cont_name)) {
+		DEBUG("veth pair %s/%s already in use, not adding it to pool", veth_cont_name,
+		      veth_cmld_name);
+		goto err;
+	}
+
+	/* the container endpoint gets its configured mac when taken from the pool */
+	uint8_t veth_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 };
+	if (file_read("/dev/urandom", (char *)&veth_mac[1], 5) < 0)
+		WARN_ERRNO("Failed to read from /dev/urandom");
+
+	if (c_net_create_veth_pair(veth_cont_name, veth_cmld_name, veth_mac, 0))
+		goto err;
+
+	entry = mem_new0(c_net_veth_pool_entry_t, 1);
+	entry->offset = offset;
+	memcpy(entry->veth_mac, veth_mac, 6);
+	if (!(entry->veth_cmld_idx = if_nametoindex(veth_cmld_name))) {
+		ERROR("veth interface name could not be resolved");
+		network_delete_link(veth_cmld_name);
+		goto err;
+	}
+
+	c_net_veth_pool = list_append(c_net_veth_pool, entry);
+	TRACE("Added veth pair %s/%s to pool", veth_cont_name, veth_cmld_name);
+
+	mem_free0(veth_cmld_name);
+	mem_free0(veth_cont_name);
+	return 0;
+
+err:
+	c_net_unset_offset(offset);
+	mem_free0(entry);
+	mem_free0(veth_cmld_name);
+	mem_free0(veth_cont_name);
+	return -1;
+}
+
+static void
+c_net_veth_pool_cleanup(void)
+{
+	if (c_net_veth_pool_timer) {
+		event_remove_timer(c_net_veth_pool_timer);
+		event_timer_free(c_net_veth_pool_timer);
+		c_net_veth_pool_timer = NULL;
+	}
+
+	for (list_t *l = c_net_veth_pool; l; l = l->next) {
+		c_net_veth_pool_entry_t *entry = l->data;
+		char *veth_cmld_name = mem_printf("r_%d", entry->offset);
+		if (network_delete_link(veth_cmld_name))
+			WARN("network interface %s could not be destroyed", veth_cmld_name);
+		c_net_unset_offset(entry->offset);
+		mem_free0(veth_cmld_name);
+		mem_free0(entry);
+	}
+	list_delete(c_net_veth_pool);
+	c_net_veth_pool = NULL;
+}
+
+/**
+ * Creates one veth pair per timer event, to keep the event loop responsive, until the pool
+ * is filled up. On errors, the pool is not refilled until the next container is started.
+ */
+static void
+c_net_veth_pool_refill_cb(event_timer_t *timer, UNUSED void *data)
+{
+	ASSERT(timer == c_net_veth_pool_timer);
+
+	if (list_length(c_net_veth_pool) < C_NET_VETH_POOL_SIZE && !c_net_veth_pool_add() &&
+	    list_length(c_net_veth_pool) < C_NET_VETH_POOL_SIZE)
+		return;
+
+	event_remove_timer(timer);
+	event_timer_free(timer);
+	c_net_veth_pool_timer = NULL;
+}
+
+/**
+ * Schedules the refill of the veth pool in the main event loop.
+ * This must not be called from the async pre clone hook.
+ */
+static void
+c_net_veth_pool_refill(void)
+{
+	static bool cleanup_registered = false;
+
+	if (c_net_veth_pool_timer || list_length(c_net_veth_pool) >= C_NET_VETH_POOL_SIZE)
+		return;
+
+	if (!cleanup_registered) {
+		if (atexit(&c_net_veth_pool_cleanup))
+			WARN("Could not register on exit cleanup method "
+			     "'c_net_veth_pool_cleanup()'");
+		cleanup_registered = true;
+	}
+
+	c_net_veth_pool_timer = event_timer_new(C_NET_VETH_POOL_REFILL_INTERVAL,
+						EVENT_TIMER_REPEAT_FOREVER,
+						&c_net_veth_pool_refill_cb, NULL);
+	event_add_timer(c_net_veth_pool_timer);
+}
+
+/**
+ * Takes a pre-created veth pair from the pool for the interface and sets the configured mac
+ * of the container endpoint. The pool is only modified by the main event loop while no
+ * container start is in progress, thus this is safe to be called from the async pre clone hook.
+ *
+ * @return 0 if the interface got a veth pair from the pool, -1 if the pool is empty
+ */
+static int
+c_net_veth_pool_take(c_net_interface_t *ni)
+{
+	IF_NULL_RETVAL(c_net_veth_pool, -1);
+
+	c_net_veth_pool_entry_t *entry = c_net_veth_pool->data;
+	c_net_veth_pool = list_unlink(c_net_veth_pool, c_net_veth_pool);
+
+	ni->cont_offset = entry->offset;
+	ni->veth_cmld_idx = entry->veth_cmld_idx;
+	ni->veth_cmld_name = mem_printf("r_%d", entry->offset);
+	ni->veth_cont_name = mem_printf("c_%d", entry->offset);
+
+	if (memcmp(entry->veth_mac, ni->veth_mac, 6) &&
+	    c_net_set_veth_mac(ni->veth_cont_name, ni->veth_mac)) {
+		ERROR("Failed to set mac of pooled veth %s", ni->veth_cont_name);
+		network_delete_link(ni->veth_cmld_name);
+		c_net_unset_offset(ni->cont_offset);
+		ni->cont_offset = -1;
+		mem_free0(ni->veth_cmld_name);
+		mem_free0(ni->veth_cont_name);
+		mem_free0(entry);
+		return -1;
+	}
+
+	DEBUG("Took veth pair %s/%s from pool", ni->veth_cont_name, ni->veth_cmld_name);
+	mem_free0(entry);
+	return 0;
+}
+
+/**
+ * This function creates the netlink request, which sets an ipv4 address (and the
+ * broadcast addr) for a given veth.
+ * @return the request message or NULL on failure
+ */
+static nl_msg_t *
+c_net_set_ipv4_msg_new(const char *ifi_name, const struct in_addr *ipv4_addr,
+		       const struct in_addr *ipv4_bcaddr)
+{
+	ASSERT(ifi_name);
+
+	unsigned int ifi_index;
+	nl_msg_t *req = NULL;
+
+	DEBUG("Set ipv4 addr %s for %s", inet_ntoa(*ipv4_addr), ifi_name);
+
+	/* Get the interface index of the interface name */
+	if (!(ifi_index = if_nametoindex(ifi_name))) {
+		ERROR("veth interface name could not be resolved");
+		return NULL;
+	}
+
+	/* Create netlink message */
+	if (!(req = nl_msg_new())) {
+		ERROR("failed to allocate netlink message");
+		return NULL;
+	}
+
 	/* Prepare the request message */
 	struct ifaddrmsg ip_req = { .ifa_family = AF_INET,
 				    .ifa_prefixlen = IPV4_PREFIX,
@@ -479,20 +805,48 @@ c_net_set_ipv4(const char *ifi_name, const struct in_addr *ipv4_addr,
 	if (nl_msg_add_buffer(req, IFA_BROADCAST, (void *)ipv4_bcaddr, sizeof(struct in_addr)))
 		goto msg_err;
 
-	/* Send request message and wait for the response message */
-	if (nl_msg_send_kernel_verify(nl_sock, req))
-		goto msg_err;
+	return req;
 
+msg_err:
+	ERROR("failed to create netlink message");
 	nl_msg_free(req);
-	nl_sock_free(nl_sock);
+	return NULL;
+}
 
-	return 0;
+/**
+ * This function sets an ipv4 address (and the broadcast addr) for a given veth
+ * with a netlink message using the netlink socket.
+ * We use this in the root namespace and in the container's namespace.
+ */
+static int
+c_net_set_ipv4(const char *ifi_name, const struct in_addr *ipv4_addr,
+	       const struct in_addr *ipv4_bcaddr)
+{
+	nl_sock_t *nl_sock = NULL;
+	nl_msg_t *req = NULL;
+
+	if (!(req = c_net_set_ipv4_msg_new(ifi_name, ipv4_addr, ipv4_bcaddr)))
+		return -1;
+
+	/* Open netlink socket */
+	if (!(nl_sock = nl_sock_routing_new())) {
+		ERROR("failed to allocate netlink socket");
+		nl_msg_free(req);
+		return -1;
+	}
+
+	/* Send request message and wait for the response message */
+	if (nl_msg_send_kernel_verify(nl_sock, req)) {
+		ERROR("failed to send netlink message");
+		nl_msg_free(req);
+		nl_sock_free(nl_sock);
+		return -1;
+	}
 
-msg_err:
-	ERROR("failed to create/send netlink message");
 	nl_msg_free(req);
 	nl_sock_free(nl_sock);
-	return -1;
+
+	return 0;
 }
 
 static c_net_interface_t *
@@ -511,33 +865,6 @@ c_net_interface_new(const char *if_name, const char *root_if_name, uint8_t if_ma
 	return ni;
 }
 
-/*
- * This funtion enables or disables the mac_filter according to param apply
- */
-static int
-c_net_mac_filter(const char *if_name, list_t *mac_whitelist, bool apply)
-{
-	int ret;
-	ret = network_iptables_phys_deny("INPUT", if_name, apply);
-	ret |= network_iptables_phys_deny("FORWARD", if_name, apply);
-	if (ret) {
-		ERROR("Failed to %s deny all on %s", apply ? "apply" : "reset", if_name);
-		return -1;
-	}
-	for (list_t *l = mac_whitelist; l; l = l->next) {
-		uint8_t *mac = l->data;
-		ret = network_phys_allow_mac("INPUT", if_name, mac, apply);
-		ret |= network_phys_allow_mac("FORWARD", if_name, mac, apply);
-		if (ret) {
-			char *mac_str = network_mac_addr_to_str_new(mac);
-			ERROR("Failed to allow %s on %s", mac_str, if_name);
-			mem_free0(mac_str);
-			return -1;
-		}
-	}
-	return 0;
-}
-
 static int
 c_net_bridge_ifi(const char *if_name, list_t *mac_whitelist, const pid_t pid)
 {
@@ -565,7 +892,7 @@ c_net_bridge_ifi(const char *if_name, list_t *mac_whitelist, const pid_t pid)
 	veth_mac[0] &= 0xfe; /* clear multicast bit */
 	veth_mac[0] |= 0x02; /* set local assignment bit (IEEE802) */
 
-	if (c_net_create_veth_pair(veth_cont_name, veth_cmld_name, veth_mac))
+	if (c_net_create_veth_pair(veth_cont_name, veth_cmld_name, veth_mac, 0))
 		goto err;
 
 	/* Bring up ports */
@@ -598,7 +925,7 @@ c_net_bridge_ifi(const char *if_name, list_t *mac_whitelist, const pid_t pid)
 	}
 
 	/* apply MAC filtering rules */
-	if (c_net_mac_filter(if_name, mac_whitelist, true)) {
+	if (xdp_setup_mac_filter(if_name, mac_whitelist, true)) {
 		ERROR("Failed apply mac_filter to %s", if_name);
 		goto err_port;
 	}
@@ -664,7 +991,7 @@ c_net_unbridge_ifi(const char *if_name, list_t *mac_whitelist, const pid_t pid)
 		WARN("Failed to delete bridge %s", br_cmld_name);
 
 	/* clean out MAC filtering rules */
-	if (-1 == c_net_mac_filter(if_name, mac_whitelist, false))
+	if (-1 == xdp_setup_mac_filter(if_name, mac_whitelist, false))
 		WARN("Failed apply mac_filter to %s", if_name);
 
 	mem_free0(br_cmld_name);
@@ -674,6 +1001,92 @@ c_net_unbridge_ifi(const char *if_name, list_t *mac_whitelist, const pid_t pid)
 	return 0;
 }
 
+/**
+ * Provides the physical interface if_name to the container by a macvlan or ipvlan, which is
+ * created on top of it in the root namespace and moved to the net namespace of the container.
+ * In contrast to the bridge, frames do not traverse a veth pair and the bridge firewall. Thus,
+ * the mac filter is only available as XDP program on if_name.
+ */
+static int
+c_net_vlan_ifi(const char *if_name, container_pnet_mode_t mode, list_t *mac_whitelist,
+	       const pid_t pid)
+{
+	ASSERT(if_name);
+
+	char *vlan_cont_name = mem_printf("c_%s", if_name);
+
+	if (mac_whitelist && !xdp_get_mac_filter()) {
+		ERROR("mac_filter of %s requires the XDP mac filter for macvlan/ipvlan", if_name);
+		goto err;
+	}
+
+	if (c_net_is_veth_used(vlan_cont_name)) {
+		ERROR("container vlan %s already in use", vlan_cont_name);
+		goto err;
+	}
+
+	/* Bring up lower device */
+	if (network_set_flag(if_name, IFF_UP)) {
+		WARN_ERRNO("Could not set lower device %s up!", if_name);
+		goto err;
+	}
+
+	if (c_net_create_vlan(vlan_cont_name, if_name, mode)) {
+		ERROR("Failed to create %s on %s", vlan_cont_name, if_name);
+		goto err_lower;
+	}
+
+	/* apply MAC filtering rules */
+	if (mac_whitelist && xdp_setup_mac_filter(if_name, mac_whitelist, true)) {
+		ERROR("Failed apply mac_filter to %s", if_name);
+		goto err_vlan;
+	}
+
+	/* Move vlan to Container */
+	if (c_net_move_ifi(vlan_cont_name, pid)) {
+		ERROR("Failed to move %s to container with pid %d", vlan_cont_name, pid);
+		if (mac_whitelist)
+			xdp_setup_mac_filter(if_name, mac_whitelist, false);
+		goto err_vlan;
+	}
+
+	mem_free0(vlan_cont_name);
+	return 0;
+
+err_vlan:
+	network_delete_link(vlan_cont_name);
+err_lower:
+	network_set_flag(if_name, IFF_DOWN);
+err:
+	mem_free0(vlan_cont_name);
+	return -1;
+}
+
+static int
+c_net_unvlan_ifi(const char *if_name, list_t *mac_whitelist, const pid_t pid)
+{
+	ASSERT(if_name);
+
+	char *vlan_cont_name = mem_printf("c_%s", if_name);
+
+	/* the vlan is destroyed along with the netns, otherwise grab it for deletion */
+	if (pid > 0 && c_net_remove_ifi(vlan_cont_name, pid) < 0)
+		WARN("container's network interface could not be grabbed");
+
+	if (c_net_is_veth_used(vlan_cont_name) && network_delete_link(vlan_cont_name))
+		WARN("network interface %s could not be destroyed", vlan_cont_name);
+
+	if (0 != network_set_flag(if_name, IFF_DOWN))
+		WARN("Failed to set lower device %s down", if_name);
+
+	/* clean out MAC filtering rules */
+	if (mac_whitelist && -1 == xdp_setup_mac_filter(if_name, mac_whitelist, false))
+		WARN("Failed apply mac_filter to %s", if_name);
+
+	mem_free0(vlan_cont_name);
+	return 0;
+}
+
 /**
  * This function moves/bridges the network interface to the corresponding net
  * namespace of a container.
@@ -711,7 +1124,12 @@ c_net_add_interface(void *netp, container_pnet_cfg_t *pnet_cfg)
 		}
 	}
 
-	if (!pnet_cfg->mac_filter) { // directly map phys. IF into container
+	if (pnet_cfg->mode != CONTAINER_PNET_MODE_MOVE) { // pIF stays in rootns below a vlan
+		DEBUG("vlan phys %s to the ns of this pid: %d", pnet_cfg->pnet_name, pid);
+		IF_TRUE_GOTO_ERROR(-1 == c_net_vlan_ifi(if_name, pnet_cfg->mode,
+							pnet_cfg->mac_whitelist, pid),
+				   err);
+	} else if (!pnet_cfg->mac_filter) { // directly map phys. IF into container
 		DEBUG("move phys %s to the ns of this pid: %d", pnet_cfg->pnet_name, pid);
 		IF_TRUE_GOTO_ERROR(-1 == c_net_move_ifi(if_name, pid), err);
 	} else { // pIF should be bridged and MAC filtering applied
@@ -773,7 +1191,10 @@ c_net_remove_interface(void *netp, const char *if_name_mac)
 		return 0;
 	}
 
-	if (!cfg->mac_filter) { // remove directly mapped ifi
+	if (cfg->mode != CONTAINER_PNET_MODE_MOVE) { // remove vlan of pIF
+		DEBUG("remove vlan phys %s to the ns of this pid: %d", cfg->pnet_name, pid);
+		IF_TRUE_GOTO_ERROR(-1 == c_net_unvlan_ifi(if_name, cfg->mac_whitelist, pid), err);
+	} else if (!cfg->mac_filter) { // remove directly mapped ifi
 		DEBUG("remove phys %s to the ns of this pid: %d", cfg->pnet_name, pid);
 		IF_TRUE_GOTO_ERROR(-1 == c_net_remove_ifi(if_name, pid), err);
 	} else { // pIF remove bridged and MAC filtering rules
@@ -844,6 +1265,7 @@ c_net_new(compartment_t *compartment)
 		// deep copy for internal list and hotplugging
 		container_pnet_cfg_t *pnet_cfg_mv = container_pnet_cfg_new(
 			pnet_cfg->pnet_name, pnet_cfg->mac_filter, pnet_cfg->mac_whitelist);
+		container_pnet_cfg_set_mode(pnet_cfg_mv, pnet_cfg->mode);
 		char *if_name_macstr = pnet_cfg->pnet_name;
 		char *if_name = NULL;
 		TRACE("mv_name_list add ifname %s", if_name_macstr);
@@ -888,24 +1310,35 @@ c_net_new(compartment_t *compartment)
 	net->ns_path =
 		mem_printf("/var/run/netns/%s", uuid_string(container_get_uuid(net->container)));
 
+	// pre-create veth pairs for the next container starts
+	if (net->interface_list)
+		c_net_veth_pool_refill();
+
 	TRACE("new c_net struct was allocated");
 
 	return net;
 }
 
 static int
-c_net_start_pre_clone_interface(c_net_interface_t *ni)
+c_net_start_pre_clone_interface(c_net_interface_t *ni, const container_net_tuning_t *tuning)
 {
 	ASSERT(ni);
 
+	unsigned int queues = tuning ? tuning->veth_queues : 0;
+
+	/* Prefer a pre-created veth pair, which already reserved its offset */
+	bool pooled = !queues && !c_net_veth_pool_take(ni);
+
 	/* Get container offset based on currently started containers */
-	if ((ni->cont_offset = c_net_set_next_offset()) == -1) {
+	if (!pooled && (ni->cont_offset = c_net_set_next_offset()) == -1) {
 		WARN_ERRNO("Maximum offset for Network interfaces reached!");
 		goto err;
 	}
 
-	ni->veth_cmld_name = mem_printf("r_%d", ni->cont_offset);
-	ni->veth_cont_name = mem_printf("c_%d", ni->cont_offset);
+	if (!pooled) {
+		ni->veth_cmld_name = mem_printf("r_%d", ni->cont_offset);
+		ni->veth_cont_name = mem_printf("c_%d", ni->cont_offset);
+	}
 
 	if (ni->configure) {
 		/* Get root ns ipv4 address */
@@ -931,6 +1364,9 @@ c_net_start_pre_clone_interface(c_net_interface_t *ni)
 		}
 	}
 
+	if (pooled)
+		goto out;
+
 	/* Create free veth pair from container name, check if the interfaces are free */
 	if (c_net_is_veth_used(ni->veth_cmld_name)) {
 		ERROR("root ns veth %s already in use", ni->veth_cmld_name);
@@ -947,7 +1383,7 @@ c_net_start_pre_clone_interface(c_net_interface_t *ni)
 	DEBUG("Create veth pair %s/%s", ni->veth_cont_name, ni->veth_cmld_name);
 
 	/* Create veth pair */
-	if (c_net_create_veth_pair(ni->veth_cont_name, ni->veth_cmld_name, ni->veth_mac))
+	if (c_net_create_veth_pair(ni->veth_cont_name, ni->veth_cmld_name, ni->veth_mac, queues))
 		goto err;
 
 	/* Get the interface index of the interface name */
@@ -956,6 +1392,11 @@ c_net_start_pre_clone_interface(c_net_interface_t *ni)
 		goto err;
 	}
 
+out:
+	/* the container endpoint is set up when it is renamed in c_net_start_child() */
+	if (tuning && tuning->veth_gro && network_set_gro(ni->veth_cmld_name, true))
+		WARN("Could not enable GRO on %s", ni->veth_cmld_name);
+
 	return 0;
 
 	/* In case of an error, release the current offset */
@@ -1009,7 +1450,8 @@ c_net_start_pre_clone(void *netp)
 	for (list_t *l = net->interface_list; l; l = l->next) {
 		c_net_interface_t *ni = l->data;
 
-		if (c_net_start_pre_clone_interface(ni) == -1)
+		if (c_net_start_pre_clone_interface(ni, container_get_net_tuning(net->container)) ==
+		    -1)
 			return -COMPARTMENT_ERROR_NET;
 		if (!ni->configure)
 			continue;
@@ -1091,6 +1533,9 @@ c_net_start_post_clone(void *netp)
 	    (container_get_prev_state(net->container) == COMPARTMENT_STATE_REBOOTING))
 		return 0;
 
+	/* replace the veth pairs taken from the pool in the pre clone hook */
+	c_net_veth_pool_refill();
+
 	/* Get container's pid */
 	pid_t pid = container_get_pid(net->container);
 	pid_t pid_c0 = cmld_containers_get_c0() ? container_get_pid(cmld_containers_get_c0()) : 0;
@@ -1157,6 +1602,12 @@ c_net_start_post_clone(void *netp)
 		// enable forwarding for container conectivity
 		network_enable_ip_forwarding();
 
+		/* the address and link state of all veths are set with one batch of requests,
+		 * each requests[i] belongs to the interface configured[i] */
+		nl_batch_t *requests = nl_batch_new();
+		c_net_interface_t **configured =
+			mem_new0(c_net_interface_t *, 2 * list_length(net->interface_list));
+
 		for (list_t *l = net->interface_list; l; l = l->next) {
 			c_net_interface_t *ni = l->data;
 			if (!ni->configure)
@@ -1179,25 +1630,40 @@ c_net_start_post_clone(void *netp)
 				continue;
 			}
 
-			/* Set IPv4 address */
-			if (c_net_set_ipv4(ni->veth_cmld_name, &ni->ipv4_cmld_addr,
-					   &ni->ipv4_bc_addr))
-				FATAL_ERRNO("Cannot set ip for '%s' in %s!", ni->veth_cmld_name,
-					    hostns);
-
-			/* Bring veth up */
-			if (network_set_flag(ni->veth_cmld_name, IFF_UP))
-				FATAL_ERRNO("Could not configure %s in %s!", ni->veth_cmld_name,
-					    hostns);
+			/* Set IPv4 address and bring veth up */
+			nl_msg_t *ip_req = c_net_set_ipv4_msg_new(
+				ni->veth_cmld_name, &ni->ipv4_cmld_addr, &ni->ipv4_bc_addr);
+			nl_msg_t *up_req = network_set_flag_msg_new(ni->veth_cmld_name, IFF_UP);
+			if (!ip_req || !up_req)
+				FATAL("Could not create requests to configure %s in %s!",
+				      ni->veth_cmld_name, hostns);
+			configured[nl_batch_add(requests, ip_req)] = ni;
+			configured[nl_batch_add(requests, up_req)] = ni;
+			nl_msg_free(ip_req);
+			nl_msg_free(up_req);
 
 			/* Setup firewall for container connectivity */
 			if (network_setup_masquerading(ni->subnet, true))
 				FATAL_ERRNO("Could not setup masquerading for %s!",
 					    ni->veth_cmld_name);
+		}
 
-			DEBUG("Successfully configured %s in %s, wait for child to exit.",
-			      ni->veth_cmld_name, hostns);
+		nl_sock_t *nl_sock = nl_sock_routing_new();
+		if (!nl_sock)
+			FATAL("failed to allocate netlink socket");
+		if (nl_batch_send_kernel_verify(nl_sock, requests)) {
+			for (int i = 0; i < nl_batch_get_len(requests); i++) {
+				if ((errno = nl_batch_get_error(requests, i)))
+					FATAL_ERRNO("Could not configure %s in %s!",
+						    configured[i]->veth_cmld_name, hostns);
+			}
 		}
+		for (int i = 0; i < nl_batch_get_len(requests); i += 2)
+			DEBUG("Successfully configured %s in %s, wait for child to exit.",
+			      configured[i]->veth_cmld_name, hostns);
+		nl_sock_free(nl_sock);
+		nl_batch_free(requests);
+		mem_free0(configured);
 		DEBUG("Setup of net ifs in netns of %s done, exiting netns child!", hostns);
 		_exit(0); // don't call atexit registered cleanup of main process
 	} else {
@@ -1234,7 +1700,7 @@ c_net_start_post_clone(void *netp)
 }
 
 static int
-c_net_start_child_interface(c_net_interface_t *ni)
+c_net_start_child_interface(c_net_interface_t *ni, const container_net_tuning_t *tuning)
 {
 	ASSERT(ni);
 
@@ -1244,6 +1710,9 @@ c_net_start_child_interface(c_net_interface_t *ni)
 	if (network_rename_ifi(ni->veth_cont_name, ni->nw_name))
 		return -1;
 
+	if (tuning && tuning->veth_gro && network_set_gro(ni->nw_name, true))
+		WARN("Could not enable GRO on %s", ni->nw_name);
+
 	/* Skip IPv4 setup if interface has no config */
 	if (!ni->configure) {
 		DEBUG("Leave %s interface unconfigured. (Manual configuration detected)",
@@ -1266,6 +1735,40 @@ c_net_start_child_interface(c_net_interface_t *ni)
 	return 0;
 }
 
+/**
+ * Sets the sysctls of the tuning profile, which resolve to the netns of the calling
+ * process below /proc/sys/net. Sysctls which are not per netns do not exist there.
+ */
+static void
+c_net_apply_sysctls(const container_net_tuning_t *tuning)
+{
+	ASSERT(tuning);
+
+	for (list_t *l = tuning->sysctls; l; l = l->next) {
+		const char *sysctl = l->data;
+		const char *value = strchr(sysctl, '=');
+
+		if (!value || value == sysctl || strchr(sysctl, '/')) {
+			WARN("Skipping invalid sysctl '%s' of net tuning profile %s", sysctl,
+			     tuning->name);
+			continue;
+		}
+
+		char *path = mem_printf("/proc/sys/net/%.*s", (int)(value - sysctl), sysctl);
+		for (char *c = path + strlen("/proc/sys/net/"); *c; c++)
+			if (*c == '.')
+				*c = '/';
+
+		if (file_printf(path, "%s", value + 1) < 0)
+			WARN("Could not set sysctl %s of net tuning profile %s", path,
+			     tuning->name);
+		else
+			DEBUG("Set sysctl %s to '%s'", path, value + 1);
+
+		mem_free0(path);
+	}
+}
+
 /**
  * In the container's namespace, the container veth is configured
  * This Function is part of TSF.CML.CompartmentIsolation.
@@ -1282,7 +1785,7 @@ c_net_start_child(void *netp)
 	ASSERT(net);
 
 	/* Skip this, if the container doesn't have a network namespace */
-	if (!container_has_netns(net->container) || !(list_length(net->interface_list) > 0))
+	if (!container_has_netns(net->container))
 		return 0;
 
 	/* skip on reboots of c0 */
@@ -1290,6 +1793,13 @@ c_net_start_child(void *netp)
 	    (container_get_prev_state(net->container) == COMPARTMENT_STATE_REBOOTING))
 		return 0;
 
+	const container_net_tuning_t *tuning = container_get_net_tuning(net->container);
+	if (tuning)
+		c_net_apply_sysctls(tuning);
+
+	if (!(list_length(net->interface_list) > 0))
+		return 0;
+
 	// shrink subnet reserverd for loopback device
 	if (network_setup_loopback())
 		return -COMPARTMENT_ERROR_NET;
@@ -1297,7 +1807,7 @@ c_net_start_child(void *netp)
 	for (list_t *l = net->interface_list; l; l = l->next) {
 		c_net_interface_t *ni = l->data;
 
-		if (c_net_start_child_interface(ni) == -1)
+		if (c_net_start_child_interface(ni, tuning) == -1)
 			return -COMPARTMENT_ERROR_NET;
 	}
 	/* default inet uplink through first configured iif */
@@ -1511,16 +2021,22 @@ c_net_cleanup(void *netp, bool is_rebooting)
 	uint8_t if_mac[6];
 	for (list_t *l = net->pnet_mv_list; l; l = l->next) {
 		container_pnet_cfg_t *cfg = l->data;
-		if (!cfg->mac_filter) { // skip directly moved if will fallback to rootns
+		if (cfg->mode == CONTAINER_PNET_MODE_MOVE && !cfg->mac_filter) {
+			// skip directly moved if will fallback to rootns
 			continue;
-		} else { // pIF remove bridged and MAC filtering rules
+		} else { // pIF remove bridged or vlan and MAC filtering rules
 			char *if_name = (network_str_to_mac_addr(cfg->pnet_name, if_mac) != -1) ?
 						network_get_ifname_by_addr_new(if_mac) :
 						mem_strdup(cfg->pnet_name);
-			DEBUG("remove bridged phys %s of %s", cfg->pnet_name,
-			      container_get_name(net->container));
-			if (-1 == c_net_unbridge_ifi(if_name, cfg->mac_whitelist, -1))
+			DEBUG("remove %s phys %s of %s",
+			      (cfg->mode == CONTAINER_PNET_MODE_MOVE) ? "bridged" : "vlan",
+			      cfg->pnet_name, container_get_name(net->container));
+			if (cfg->mode == CONTAINER_PNET_MODE_MOVE) {
+				if (-1 == c_net_unbridge_ifi(if_name, cfg->mac_whitelist, -1))
+					WARN("Failed to remove phys if %s", if_name);
+			} else if (-1 == c_net_unvlan_ifi(if_name, cfg->mac_whitelist, -1)) {
 				WARN("Failed to remove phys if %s", if_name);
+			}
 			mem_free0(if_name);
 		}
 	}
@@ -1639,6 +2155,7 @@ static compartment_module_t c_net_module = {
 	.stop = NULL,
 	.cleanup = c_net_cleanup,
 	.join_ns = c_net_join_netns,
+	.flags = COMPARTMENT_MODULE_F_ASYNC_PRE_CLONE,
 };
 
 static void INIT
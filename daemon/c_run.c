@@ -53,6 +53,9 @@
 //TODO define in container.h?
 #define CLONE_STACK_SIZE 8192
 
+/* Size of the buffer relaying the data between pty and console socket */
+#define C_RUN_RELAY_BUF_SIZE (16 * 1024)
+
 typedef struct c_run {
 	container_t *container;
 	list_t *sessions;
@@ -62,6 +65,7 @@ typedef struct c_run_session {
 	c_run_t *run;
 	int fd;
 	pid_t active_exec_pid;
+	event_child_t *child;
 	int console_sock_cmld;
 	int console_sock_container;
 	int pty_master;
@@ -138,10 +142,22 @@ c_run_session_new(c_run_t *run, int create_pty, char *cmd, ssize_t argc, char **
 	return session;
 }
 
+static void
+c_run_reap_cb(pid_t pid, UNUSED int status, event_child_t *child, UNUSED void *data)
+{
+	TRACE("Reaped process with PID %d of already closed c_run session", pid);
+	event_child_free(child);
+}
+
 static void
 c_run_session_free(c_run_session_t *session)
 {
 	ASSERT(session);
+	if (session->child) {
+		// the session is gone, but its (killed) process still needs to be reaped
+		event_child_free(session->child);
+		event_add_child(event_child_new(session->active_exec_pid, c_run_reap_cb, NULL));
+	}
 	if (session->cmd)
 		mem_free0(session->cmd);
 	if (session->pty_slave_name)
@@ -275,61 +291,36 @@ c_run_write_exec_input(void *runp, char *exec_input, int session_fd)
 }
 
 static void
-c_run_sigchld_cb(UNUSED int signum, event_signal_t *sig, void *data)
+c_run_child_cb(pid_t pid, int status, event_child_t *child, void *data)
 {
 	c_run_session_t *session = data;
+	ASSERT(session);
 
 	c_run_t *run = session->run;
-	if (NULL == run) {
-		// cleanup of c_run subsystem already done just remove signal handler
-		TRACE("SIGCHLD handler called for already dead c_run session");
-		event_remove_signal(sig);
-		event_signal_free(sig);
-		return;
-	}
 
-	TRACE("SIGCHLD handler called for c_run injected process in container %s with PID %d",
-	      container_get_description(run->container), container_get_pid(run->container));
-	/* The exec loop is started in a new session having it's PID as PGID.
-	 * Therefore wait for this PGID. If a descendant process call setsid it doesn't
-	 * get reaped by this handler. This enables the user to inject processes who
-	 * continue running after the command injected by control exits */
-	pid_t exec_pid = session->active_exec_pid;
-	pid_t pid = 0;
-	int status = 0;
-	while ((pid = waitpid(session->active_exec_pid, &status, WNOHANG))) {
-		TRACE("Got exited child with PID: %d, exec pid: %d", pid, exec_pid);
-
-		//if (pid == exec_pid || pid == run->pty_master_read_pid || run->pty_master_write_pid) {
-		if (pid == exec_pid) {
-			TRACE("Injected process exited. Cleaning up.");
-			if (WIFEXITED(status)) {
-				INFO("Exec'ed process in container %s terminated (status=%d)",
-				     container_get_description(run->container),
-				     WEXITSTATUS(status));
-			} else if (WIFSIGNALED(status)) {
-				INFO("Injected process in container %s killed by signal %d",
-				     container_get_description(run->container), WTERMSIG(status));
-			} else {
-				continue;
-			}
-
-			/* remove the sigchld callback for this container from the event loop */
-			event_remove_signal(sig);
-			event_signal_free(sig);
-
-			/* Close sockets of the session */
-			run->sessions = list_remove(run->sessions, session);
-			c_run_session_cleanup(session);
-			c_run_session_free(session);
-			break;
-		} else {
-			DEBUG("Reaped a descendant process with PID %d of injected process in container %s",
-			      pid, container_get_description(run->container));
-		}
+	TRACE("Child event called for c_run injected process in container %s with PID %d",
+	      container_get_description(run->container), pid);
+
+	if (WIFEXITED(status)) {
+		INFO("Exec'ed process in container %s terminated (status=%d)",
+		     container_get_description(run->container), WEXITSTATUS(status));
+	} else if (WIFSIGNALED(status)) {
+		INFO("Injected process in container %s killed by signal %d",
+		     container_get_description(run->container), WTERMSIG(status));
+	} else {
+		WARN("Could not get exit status of injected process in container %s",
+		     container_get_description(run->container));
 	}
 
-	TRACE("No more childs to reap. Exiting handler.");
+	event_child_free(child);
+	session->child = NULL;
+	// already reaped, prevent c_run_session_cleanup() from killing a reused pid
+	session->active_exec_pid = -1;
+
+	TRACE("Injected process exited. Cleaning up.");
+	run->sessions = list_remove(run->sessions, session);
+	c_run_session_cleanup(session);
+	c_run_session_free(session);
 }
 
 static int
@@ -451,13 +442,12 @@ readloop(int from_fd, int to_fd)
 	TRACE("[EXEC] Starting read loop in process %d; from fd %d, to fd %d, PPID: %d", getpid(),
 	      from_fd, to_fd, getppid());
 
-	int count = 0;
-	char buf[1024];
+	ssize_t count = 0;
+	char buf[C_RUN_RELAY_BUF_SIZE];
 
-	while (0 < (count = read(from_fd, &buf, sizeof(buf) - 1))) {
-		buf[count] = 0;
-		TRACE("[READLOOP] Read %d bytes from fd: %d: %s", count, from_fd, buf);
-		if (write(to_fd, buf, count + 1) < 0) {
+	while (0 < (count = read(from_fd, buf, sizeof(buf)))) {
+		TRACE("[READLOOP] Read %zd bytes from fd: %d", count, from_fd);
+		if (fd_write(to_fd, buf, count) != count) {
 			TRACE_ERRNO("[READLOOP] write failed.");
 			return -1;
 		}
@@ -623,9 +613,9 @@ c_run_exec_process(void *runp, int create_pty, char *cmd, ssize_t argc, char **a
 
 	IF_TRUE_GOTO(c_run_prepare_exec(session) < 0, error);
 
-	TRACE("Registering SIGCHLD handler for injected processes");
-	event_signal_t *sig = event_signal_new(SIGCHLD, c_run_sigchld_cb, session);
-	event_add_signal(sig);
+	TRACE("Registering child event for injected process");
+	session->child = event_child_new(session->active_exec_pid, c_run_child_cb, session);
+	event_add_child(session->child);
 
 	return 0;
 
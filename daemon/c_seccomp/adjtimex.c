@@ -54,7 +54,7 @@ c_seccomp_emulate_adjtime(c_seccomp_t *seccomp, struct seccomp_notif *req,
 			  struct seccomp_notif_resp *resp)
 {
 	int ret_adjtime = 0;
-	struct timex *timex = NULL;
+	struct timex timex = { 0 };
 
 	if (!(COMPARTMENT_FLAG_SYSTEM_TIME & compartment_get_flags(seccomp->compartment))) {
 		DEBUG("Blocking call to SYS_clock_adjtime by PID %d", req->pid);
@@ -76,15 +76,14 @@ c_seccomp_emulate_adjtime(c_seccomp_t *seccomp, struct seccomp_notif *req,
 		goto out;
 	}
 
-	if (!(timex = (struct timex *)c_seccomp_fetch_vm_new(seccomp, req->pid,
-							     CAST_UINT_VOIDPTR req->data.args[1],
-							     sizeof(struct timex)))) {
+	if (c_seccomp_fetch_vm(seccomp, req->pid, &timex, CAST_UINT_VOIDPTR req->data.args[1],
+			       sizeof(struct timex))) {
 		ERROR_ERRNO("Failed to fetch struct timex");
 		goto out;
 	}
 
 	DEBUG("Executing clock_adjtime on behalf of container");
-	if (-1 == (ret_adjtime = clock_adjtime(CLOCK_REALTIME, timex))) {
+	if (-1 == (ret_adjtime = clock_adjtime(CLOCK_REALTIME, &timex))) {
 		ERROR_ERRNO("Failed to execute clock_adjtime");
 		goto out;
 	}
@@ -97,9 +96,6 @@ c_seccomp_emulate_adjtime(c_seccomp_t *seccomp, struct seccomp_notif *req,
 	resp->val = ret_adjtime;
 
 out:
-	if (timex)
-		mem_free(timex);
-
 	return ret_adjtime;
 }
 
@@ -108,7 +104,7 @@ c_seccomp_emulate_adjtimex(c_seccomp_t *seccomp, struct seccomp_notif *req,
 			   struct seccomp_notif_resp *resp)
 {
 	int ret_adjtimex = 0;
-	struct timex *timex = NULL;
+	struct timex timex = { 0 };
 
 	if (!(COMPARTMENT_FLAG_SYSTEM_TIME & compartment_get_flags(seccomp->compartment))) {
 		DEBUG("Blocking call to SYS_adjtimex by PID %d", req->pid);
@@ -123,15 +119,14 @@ c_seccomp_emulate_adjtimex(c_seccomp_t *seccomp, struct seccomp_notif *req,
 		goto out;
 	}
 
-	if (!(timex = (struct timex *)c_seccomp_fetch_vm_new(seccomp, req->pid,
-							     CAST_UINT_VOIDPTR req->data.args[0],
-							     sizeof(struct timex)))) {
+	if (c_seccomp_fetch_vm(seccomp, req->pid, &timex, CAST_UINT_VOIDPTR req->data.args[0],
+			       sizeof(struct timex))) {
 		ERROR_ERRNO("Failed to fetch struct timex");
 		goto out;
 	}
 
 	DEBUG("Executing adjtimex on behalf of container");
-	if (-1 == (ret_adjtimex = adjtimex(timex))) {
+	if (-1 == (ret_adjtimex = adjtimex(&timex))) {
 		ERROR_ERRNO("Failed to execute adjtimex");
 		goto out;
 	}
@@ -144,9 +139,6 @@ c_seccomp_emulate_adjtimex(c_seccomp_t *seccomp, struct seccomp_notif *req,
 	resp->val = ret_adjtimex;
 
 out:
-	if (timex)
-		mem_free(timex);
-
 	return ret_adjtimex;
 }
 
@@ -155,7 +147,7 @@ c_seccomp_emulate_settime(c_seccomp_t *seccomp, struct seccomp_notif *req,
 			  struct seccomp_notif_resp *resp)
 {
 	int ret_settime = 0;
-	struct timespec *timespec = NULL;
+	struct timespec timespec = { 0 };
 
 	if (!(COMPARTMENT_FLAG_SYSTEM_TIME & compartment_get_flags(seccomp->compartment))) {
 		DEBUG("Blocking call to SYS_clock_settime by PID %d", req->pid);
@@ -177,15 +169,14 @@ c_seccomp_emulate_settime(c_seccomp_t *seccomp, struct seccomp_notif *req,
 		goto out;
 	}
 
-	if (!(timespec = (struct timespec *)c_seccomp_fetch_vm_new(
-		      seccomp, req->pid, CAST_UINT_VOIDPTR req->data.args[1],
-		      sizeof(struct timespec)))) {
+	if (c_seccomp_fetch_vm(seccomp, req->pid, &timespec, CAST_UINT_VOIDPTR req->data.args[1],
+			       sizeof(struct timespec))) {
 		ERROR_ERRNO("Failed to fetch struct timespec");
 		goto out;
 	}
 
 	DEBUG("Executing clock_settime on behalf of container");
-	if (-1 == (ret_settime = clock_settime(CLOCK_REALTIME, timespec))) {
+	if (-1 == (ret_settime = clock_settime(CLOCK_REALTIME, &timespec))) {
 		ERROR_ERRNO("Failed to execute clock_settime");
 		goto out;
 	}
@@ -198,8 +189,5 @@ c_seccomp_emulate_settime(c_seccomp_t *seccomp, struct seccomp_notif *req,
 	resp->val = ret_settime;
 
 out:
-	if (timespec)
-		mem_free(timespec);
-
 	return ret_settime;
 }
@@ -50,16 +50,24 @@
 
 #include "seccomp.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sched.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
+#include <sys/sysinfo.h>
 #include <sys/sysmacros.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -228,30 +236,43 @@ c_seccomp_install_filter(c_seccomp_t *_seccomp)
 		 * for mknod(): load args[1] (mode_t mode) from seccomp_data,
 		 * check if mode is blk or char dev -> SECCOMP_RET_NOTIFY
 		 * otherwise skip emulation. -> SECCOMP_RET_ALLOW
+		 * Overlayfs whiteouts, i.e. char devs 0:0 in args[2], are
+		 * permitted by the kernel itself and thus are skipped as well.
 		 *
 		 * The mknod system call is not defined for the arm64 architecture,
 		 * therefore disable this check on arm64 as SYS_mknod is not defined
 		 * there.
 		 */
-		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_mknod, 0, 3),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_mknod, 0, 8),
 		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, args[1]))),
-		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, S_IFCHR, 12, 0),
-		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, S_IFBLK, 11, 0),
+		BPF_STMT(BPF_ALU | BPF_AND | BPF_K, S_IFMT),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, S_IFBLK, 4, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, S_IFCHR, 0, 2),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, args[2]))),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
 #endif
 
 		/*
 		 * for mknodat(): load args[2] (mode_t mode) from seccomp_data,
 		 * check if mode is blk or char dev -> SECCOMP_RET_NOTIFY
 		 * otherwise skip emulation. -> SECCOMP_RET_ALLOW
+		 * Whiteouts (char dev 0:0 in args[3]) are skipped as for mknod().
 		 */
-		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_mknodat, 0, 3),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_mknodat, 0, 8),
 		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, args[2]))),
-		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, S_IFCHR, 8, 0),
-		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, S_IFBLK, 7, 0),
+		BPF_STMT(BPF_ALU | BPF_AND | BPF_K, S_IFMT),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, S_IFBLK, 4, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, S_IFCHR, 0, 2),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, args[3]))),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
 
 		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_mount, 6, 0),
 
-		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_sysinfo, 4, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_sysinfo, 5, 0),
 
 		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_finit_module, 4, 0),
 
@@ -263,6 +284,18 @@ c_seccomp_install_filter(c_seccomp_t *_seccomp)
 		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
 	};
 
+	/*
+	 * Without access to the system time, the time syscalls are denied by the
+	 * filter itself instead of trapping to the notify thread, which would only
+	 * answer EPERM anyway.
+	 */
+	struct sock_filter filter_time[] = {
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_clock_settime, 2, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_clock_adjtime, 1, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_adjtimex, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | (EPERM & SECCOMP_RET_DATA)),
+	};
+
 	int filter_ioctl_size = 0;
 	struct sock_filter *filter_ioctl = c_seccomp_ioctl_get_filter(_seccomp, &filter_ioctl_size);
 
@@ -270,16 +303,24 @@ c_seccomp_install_filter(c_seccomp_t *_seccomp)
 	size_t filter_tail_len = sizeof(filter_tail) / sizeof(struct sock_filter);
 	size_t filter_ioctl_len =
 		filter_ioctl_size > 0 ? filter_ioctl_size / sizeof(struct sock_filter) : 0;
+	size_t filter_time_len =
+		(COMPARTMENT_FLAG_SYSTEM_TIME & compartment_get_flags(_seccomp->compartment)) ?
+			0 :
+			sizeof(filter_time) / sizeof(struct sock_filter);
 
-	size_t filter_len = filter_head_len + filter_ioctl_len + filter_tail_len;
+	size_t filter_len = filter_head_len + filter_ioctl_len + filter_time_len + filter_tail_len;
 
 	struct sock_filter *filter = mem_new0(struct sock_filter, filter_len);
 
 	memcpy(filter, &filter_head[0], sizeof(filter_head));
 	if (filter_ioctl && filter_ioctl_size > 0)
 		memcpy(&filter[filter_head_len], filter_ioctl, filter_ioctl_size);
+	if (filter_time_len)
+		memcpy(&filter[filter_head_len + filter_ioctl_len], filter_time,
+		       sizeof(filter_time));
 
-	memcpy(&filter[filter_head_len + filter_ioctl_len], filter_tail, sizeof(filter_tail));
+	memcpy(&filter[filter_head_len + filter_ioctl_len + filter_time_len], filter_tail,
+	       sizeof(filter_tail));
 
 	struct sock_fprog prog = { .len = filter_len, .filter = filter };
 
@@ -316,13 +357,13 @@ c_seccomp_capable(pid_t pid, uint64_t cap)
 	return cap_data[CAP_TO_INDEX(cap)].effective & CAP_TO_MASK(cap);
 }
 
-void *
-c_seccomp_fetch_vm_new(c_seccomp_t *seccomp, int pid, void *rbuf, uint64_t size)
+int
+c_seccomp_fetch_vm(c_seccomp_t *seccomp, int pid, void *lbuf, void *rbuf, uint64_t size)
 {
-	IF_NULL_RETVAL(rbuf, NULL);
-	IF_TRUE_RETVAL(pid < 0, NULL);
+	IF_NULL_RETVAL(lbuf, -1);
+	IF_NULL_RETVAL(rbuf, -1);
+	IF_TRUE_RETVAL(pid < 0, -1);
 
-	void *lbuf = mem_alloc0(size);
 	struct iovec local_iov[1];
 	struct iovec remote_iov[1];
 
@@ -334,13 +375,27 @@ c_seccomp_fetch_vm_new(c_seccomp_t *seccomp, int pid, void *rbuf, uint64_t size)
 
 	ssize_t bytes_read = syscall(SYS_process_vm_readv, pid, local_iov, 1, remote_iov, 1, 0);
 	if (bytes_read < 0) {
-		char *pid_str = mem_printf("%d", pid);
-		audit_log_event(NULL, FSA, CMLD, CONTAINER_ISOLATION, "seccomp-vm-access-failed",
-				compartment_get_name(seccomp->compartment), 2, "pid", pid_str);
+		char pid_str[16];
+		snprintf(pid_str, sizeof(pid_str), "%d", pid);
+		c_seccomp_audit(seccomp, "seccomp-vm-access-failed", "pid", pid_str);
 
 		ERROR_ERRNO("Failed to access memory of remote process, bytes read: %zd",
 			    bytes_read);
-		mem_free(pid_str);
+		return -1;
+	}
+
+	return 0;
+}
+
+void *
+c_seccomp_fetch_vm_new(c_seccomp_t *seccomp, int pid, void *rbuf, uint64_t size)
+{
+	IF_NULL_RETVAL(rbuf, NULL);
+	IF_TRUE_RETVAL(pid < 0, NULL);
+
+	void *lbuf = mem_alloc0(size);
+
+	if (c_seccomp_fetch_vm(seccomp, pid, lbuf, rbuf, size)) {
 		mem_free(lbuf);
 		return NULL;
 	}
@@ -366,145 +421,482 @@ c_seccomp_send_vm(c_seccomp_t *seccomp, int pid, void *lbuf, void *rbuf, uint64_
 
 	ssize_t bytes_written = syscall(SYS_process_vm_writev, pid, local_iov, 1, remote_iov, 1, 0);
 	if (bytes_written < 0) {
-		char *pid_str = mem_printf("%d", pid);
-		audit_log_event(NULL, FSA, CMLD, CONTAINER_ISOLATION, "seccomp-vm-access-failed",
-				compartment_get_name(seccomp->compartment), 2, "pid", pid_str);
+		char pid_str[16];
+		snprintf(pid_str, sizeof(pid_str), "%d", pid);
+		c_seccomp_audit(seccomp, "seccomp-vm-access-failed", "pid", pid_str);
 
 		ERROR_ERRNO("Failed to access memory of remote process, bytes written: %zd",
 			    bytes_written);
-		mem_free(pid_str);
 		return -1;
 	}
 
 	return 0;
 }
 
+typedef struct c_seccomp_audit_event {
+	char *evtype;
+	char *key;
+	char *value;
+} c_seccomp_audit_event_t;
+
+// set on the notify threads, whose audit events are deferred to the main loop
+static __thread bool c_seccomp_on_notify_thread = false;
+
 static void
-c_seccomp_handle_notify(int fd, unsigned events, UNUSED event_io_t *io, void *data)
+c_seccomp_audit_log(c_seccomp_t *seccomp, const char *evtype, const char *key, const char *value)
 {
-	TRACE("Callback c_service_cb_receive_message has been invoked");
-	ASSERT(data);
-
-	c_seccomp_t *seccomp = data;
-	if (events & EVENT_IO_EXCEPT) {
-		audit_log_event(NULL, FSA, CMLD, CONTAINER_ISOLATION,
-				"seccomp-exception-on-notify-fd",
+	if (key)
+		audit_log_event(NULL, FSA, CMLD, CONTAINER_ISOLATION, evtype,
+				compartment_get_name(seccomp->compartment), 2, key, value);
+	else
+		audit_log_event(NULL, FSA, CMLD, CONTAINER_ISOLATION, evtype,
 				compartment_get_name(seccomp->compartment), 0);
-		ERROR("Got exception on notify fd, unregistering handler");
+}
 
-		event_remove_io(seccomp->event);
-		event_io_free(seccomp->event);
-		close(seccomp->notify_fd);
+static void
+c_seccomp_wake_main(c_seccomp_t *seccomp)
+{
+	while (eventfd_write(seccomp->main_fd, 1) < 0 && errno == EINTR)
+		;
+}
 
-		seccomp->event = NULL;
-		seccomp->notify_fd = -1;
+void
+c_seccomp_audit(c_seccomp_t *seccomp, const char *evtype, const char *key, const char *value)
+{
+	ASSERT(seccomp);
 
+	if (!c_seccomp_on_notify_thread) {
+		c_seccomp_audit_log(seccomp, evtype, key, value);
 		return;
 	}
 
-	IF_FALSE_RETURN(events & EVENT_IO_READ);
+	c_seccomp_audit_event_t *event = mem_new0(c_seccomp_audit_event_t, 1);
+	event->evtype = mem_strdup(evtype);
+	event->key = key ? mem_strdup(key) : NULL;
+	event->value = value ? mem_strdup(value) : NULL;
 
-	struct seccomp_notif *req = mem_alloc0(seccomp->notif_sizes->seccomp_notif);
-	struct seccomp_notif_resp *resp = mem_alloc0(seccomp->notif_sizes->seccomp_notif);
+	pthread_mutex_lock(&seccomp->lock);
+	seccomp->audit_list = list_append(seccomp->audit_list, event);
+	pthread_mutex_unlock(&seccomp->lock);
 
-	TRACE("Attempting to retrieve seccomp notification on fd %d", fd);
+	c_seccomp_wake_main(seccomp);
+}
 
-	if (seccomp_ioctl(fd, SECCOMP_IOCTL_NOTIF_RECV, req)) {
-		ERROR("SECCOMP_IOCTL_NOTIF_RECV interrupted by %s",
-		      EINTR == errno ? "SIGCHLD" : "unexpected event");
-
-		audit_log_event(NULL, FSA, CMLD, CONTAINER_ISOLATION, "seccomp-rcv-next",
-				compartment_get_name(seccomp->compartment), 2, "errno",
-				strerror(errno));
-		mem_free0(req);
-		mem_free0(resp);
-		return;
+static void
+c_seccomp_audit_list_flush(c_seccomp_t *seccomp, list_t *audit_list)
+{
+	for (list_t *l = audit_list; l; l = l->next) {
+		c_seccomp_audit_event_t *event = l->data;
+		c_seccomp_audit_log(seccomp, event->evtype, event->key, event->value);
+		mem_free0(event->evtype);
+		mem_free0(event->key);
+		mem_free0(event->value);
+		mem_free0(event);
+	}
+	list_delete(audit_list);
+}
+
+/*
+ * The emulation of these syscalls checks the device allow lists of the container,
+ * which are only consistent on the main loop.
+ */
+static bool
+c_seccomp_emulate_on_main_loop(int nr)
+{
+	switch (nr) {
+	case SYS_ioctl:
+#if (C_SECCOMP_AUDIT_ARCH != AUDIT_ARCH_AARCH64)
+	case SYS_mknod:
+#endif
+	case SYS_mknodat:
+		return true;
+	default:
+		return false;
 	}
+}
 
-	// default answer
-	resp->id = req->id;
-	resp->error = -EPERM;
+static const char *const c_seccomp_syscall_names[C_SECCOMP_SYSCALL_NUM] = {
+	[C_SECCOMP_SYSCALL_CLOCK_ADJTIME] = "SYS_clock_adjtime",
+	[C_SECCOMP_SYSCALL_ADJTIMEX] = "SYS_adjtimex",
+	[C_SECCOMP_SYSCALL_CLOCK_SETTIME] = "SYS_clock_settime",
+	[C_SECCOMP_SYSCALL_IOCTL] = "SYS_ioctl",
+	[C_SECCOMP_SYSCALL_FINIT_MODULE] = "SYS_finit_module",
+	[C_SECCOMP_SYSCALL_MKNODAT] = "SYS_mknodat",
+	[C_SECCOMP_SYSCALL_SYSINFO] = "SYS_sysinfo",
+	[C_SECCOMP_SYSCALL_MOUNT] = "SYS_mount",
+	[C_SECCOMP_SYSCALL_OTHER] = "other",
+};
 
-	TRACE("[%llu] Got syscall no. %d by PID %u", req->id, req->data.nr, req->pid);
+static uint64_t
+c_seccomp_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-	/*
-	 * Emulation helpers set return value to value of the syscall executed by cmld
-	 * on behalf of the container. If early errors occure emulation returns 0.
-	 * If the excuted system call exits with an error (-1) we log the emulation error
-	 * to the audit subsystem.
-	 */
-	int ret_syscall = 0;
-	char *syscall_str = NULL;
+/*
+ * Accounts a handled notification, called on the notify thread after the response
+ * has been sent.
+ */
+static void
+c_seccomp_stats_account(c_seccomp_t *seccomp, c_seccomp_syscall_t syscall, bool failed,
+			uint64_t time_ns)
+{
+	container_syscall_stats_t *stats = &seccomp->stats[syscall];
+	uint64_t us = time_ns / 1000;
+	int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+	if (bucket >= CONTAINER_SYSCALL_LATENCY_BUCKETS)
+		bucket = CONTAINER_SYSCALL_LATENCY_BUCKETS - 1;
+
+	pthread_mutex_lock(&seccomp->lock);
+	stats->count++;
+	if (failed)
+		stats->failed++;
+	stats->time_total_ns += time_ns;
+	if (time_ns > stats->time_max_ns)
+		stats->time_max_ns = time_ns;
+	stats->latency_hist[bucket]++;
+	pthread_mutex_unlock(&seccomp->lock);
+}
+
+static container_syscall_stats_t *
+c_seccomp_get_syscall_stats_new(void *seccompp, size_t *n)
+{
+	c_seccomp_t *seccomp = seccompp;
+	ASSERT(seccomp);
+	ASSERT(n);
+
+	container_syscall_stats_t *result = NULL;
+	*n = 0;
+
+	pthread_mutex_lock(&seccomp->lock);
+	for (int i = 0; i < C_SECCOMP_SYSCALL_NUM; i++) {
+		if (!seccomp->stats[i].count)
+			continue;
+		if (!result)
+			result = mem_new0(container_syscall_stats_t, C_SECCOMP_SYSCALL_NUM);
+		result[*n] = seccomp->stats[i];
+		result[*n].syscall = c_seccomp_syscall_names[i];
+		(*n)++;
+	}
+	pthread_mutex_unlock(&seccomp->lock);
+
+	return result;
+}
+
+/*
+ * Emulation helpers set return value to value of the syscall executed by cmld
+ * on behalf of the container. If early errors occure emulation returns 0.
+ * If the excuted system call exits with an error (-1) we log the emulation error
+ * to the audit subsystem.
+ */
+static int
+c_seccomp_emulate(c_seccomp_t *seccomp, c_seccomp_syscall_t *syscall)
+{
+	struct seccomp_notif *req = seccomp->req;
+	struct seccomp_notif_resp *resp = seccomp->resp;
 
 	switch (req->data.nr) {
 	case SYS_clock_adjtime:
-		syscall_str = mem_strdup("SYS_clock_adjtime");
-		ret_syscall = c_seccomp_emulate_adjtime(seccomp, req, resp);
-		break;
+		*syscall = C_SECCOMP_SYSCALL_CLOCK_ADJTIME;
+		return c_seccomp_emulate_adjtime(seccomp, req, resp);
 	case SYS_adjtimex:
-		syscall_str = mem_strdup("SYS_adjtimex");
-		ret_syscall = c_seccomp_emulate_adjtimex(seccomp, req, resp);
-		break;
+		*syscall = C_SECCOMP_SYSCALL_ADJTIMEX;
+		return c_seccomp_emulate_adjtimex(seccomp, req, resp);
 	case SYS_clock_settime:
-		syscall_str = mem_strdup("SYS_clock_settime");
-		ret_syscall = c_seccomp_emulate_settime(seccomp, req, resp);
-		break;
+		*syscall = C_SECCOMP_SYSCALL_CLOCK_SETTIME;
+		return c_seccomp_emulate_settime(seccomp, req, resp);
 	case SYS_ioctl:
-		syscall_str = mem_strdup("SYS_ioctl");
-		ret_syscall = c_seccomp_emulate_ioctl(seccomp, req, resp);
-		break;
+		*syscall = C_SECCOMP_SYSCALL_IOCTL;
+		return c_seccomp_emulate_ioctl(seccomp, req, resp);
 	case SYS_finit_module:
-		syscall_str = mem_strdup("SYS_finit_module");
-		ret_syscall = c_seccomp_emulate_finit_module(seccomp, req, resp);
-		break;
+		*syscall = C_SECCOMP_SYSCALL_FINIT_MODULE;
+		return c_seccomp_emulate_finit_module(seccomp, req, resp);
 #if (C_SECCOMP_AUDIT_ARCH != AUDIT_ARCH_AARCH64)
 	// SYS_mknod not defined on arm64
 	case SYS_mknod:
 #endif
 	case SYS_mknodat:
-		syscall_str = mem_strdup("SYS_mknodat");
-		ret_syscall = c_seccomp_emulate_mknodat(seccomp, req, resp);
-		break;
+		*syscall = C_SECCOMP_SYSCALL_MKNODAT;
+		return c_seccomp_emulate_mknodat(seccomp, req, resp);
 	case SYS_sysinfo:
-		syscall_str = mem_strdup("SYS_sysinfo");
-		ret_syscall = c_seccomp_emulate_sysinfo(seccomp, req, resp);
-		break;
+		*syscall = C_SECCOMP_SYSCALL_SYSINFO;
+		return c_seccomp_emulate_sysinfo(seccomp, req, resp);
 	case SYS_mount:
-		syscall_str = mem_strdup("SYS_mount");
-		ret_syscall = c_seccomp_emulate_mount(seccomp, req, resp);
-		break;
+		*syscall = C_SECCOMP_SYSCALL_MOUNT;
+		return c_seccomp_emulate_mount(seccomp, req, resp);
 	default:
-		ret_syscall = 0;
-		syscall_str = mem_printf("_NR: %d", req->data.nr);
-		audit_log_event(NULL, FSA, CMLD, CONTAINER_ISOLATION, "seccomp-unexpected-syscall",
-				compartment_get_name(seccomp->compartment), 2, "syscall",
-				syscall_str);
+		snprintf(seccomp->nr_str, sizeof(seccomp->nr_str), "_NR: %d", req->data.nr);
+		*syscall = C_SECCOMP_SYSCALL_OTHER;
+		c_seccomp_audit(seccomp, "seccomp-unexpected-syscall", "syscall", seccomp->nr_str);
 
 		ERROR("Got syscall not handled by us: %d", req->data.nr);
 
 		resp->error = 0;
 		resp->val = 0;
 		resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+		return 0;
 	}
+}
+
+/*
+ * Hands the current notification over to the main loop and waits until it has
+ * been emulated there. The preallocated buffers are not touched by the notify
+ * thread in the meantime.
+ */
+static int
+c_seccomp_emulate_main(c_seccomp_t *seccomp, c_seccomp_syscall_t *syscall)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&seccomp->lock);
+	if (!seccomp->stopping) {
+		seccomp->main_pending = true;
+		c_seccomp_wake_main(seccomp);
+		while (seccomp->main_pending && !seccomp->stopping)
+			pthread_cond_wait(&seccomp->cond, &seccomp->lock);
+		ret = seccomp->main_pending ? 0 : seccomp->main_ret;
+		*syscall = seccomp->main_syscall;
+		seccomp->main_pending = false;
+	}
+	pthread_mutex_unlock(&seccomp->lock);
+
+	return ret;
+}
+
+static void
+c_seccomp_handle_main(int fd, unsigned events, UNUSED event_io_t *io, void *data)
+{
+	c_seccomp_t *seccomp = data;
+	ASSERT(seccomp);
+
+	eventfd_t val;
+
+	IF_FALSE_RETURN(events & EVENT_IO_READ);
+	if (eventfd_read(fd, &val) < 0) {
+		TRACE_ERRNO("eventfd_read failed");
+		return;
+	}
+
+	pthread_mutex_lock(&seccomp->lock);
+	list_t *audit_list = seccomp->audit_list;
+	seccomp->audit_list = NULL;
+	bool main_pending = seccomp->main_pending;
+	pthread_mutex_unlock(&seccomp->lock);
+
+	c_seccomp_audit_list_flush(seccomp, audit_list);
+	IF_FALSE_RETURN(main_pending);
+
+	c_seccomp_syscall_t syscall = C_SECCOMP_SYSCALL_OTHER;
+	int ret = c_seccomp_emulate(seccomp, &syscall);
+
+	pthread_mutex_lock(&seccomp->lock);
+	seccomp->main_ret = ret;
+	seccomp->main_syscall = syscall;
+	seccomp->main_pending = false;
+	pthread_cond_signal(&seccomp->cond);
+	pthread_mutex_unlock(&seccomp->lock);
+}
+
+static void
+c_seccomp_notify_unregister(c_seccomp_t *seccomp)
+{
+	event_remove_io(seccomp->event);
+	event_io_free(seccomp->event);
+	seccomp->event = NULL;
+
+	event_remove_io(seccomp->stop_event);
+	event_io_free(seccomp->stop_event);
+	seccomp->stop_event = NULL;
+
+	c_seccomp_sysinfo_reset(seccomp);
+}
+
+static void
+c_seccomp_handle_notify(int fd, unsigned events, UNUSED event_io_t *io, void *data)
+{
+	TRACE("Callback c_seccomp_handle_notify has been invoked");
+	ASSERT(data);
+
+	c_seccomp_t *seccomp = data;
+	if (events & EVENT_IO_EXCEPT) {
+		c_seccomp_audit(seccomp, "seccomp-exception-on-notify-fd", NULL, NULL);
+		ERROR("Got exception on notify fd, unregistering handler");
+
+		// this ends the event loop of the notify thread
+		c_seccomp_notify_unregister(seccomp);
+		return;
+	}
+
+	IF_FALSE_RETURN(events & EVENT_IO_READ);
+
+	struct seccomp_notif *req = seccomp->req;
+	struct seccomp_notif_resp *resp = seccomp->resp;
+
+	// the kernel expects a zeroed request buffer
+	mem_memset0(req, seccomp->notif_sizes->seccomp_notif);
+	mem_memset0(resp, seccomp->notif_sizes->seccomp_notif_resp);
+
+	TRACE("Attempting to retrieve seccomp notification on fd %d", fd);
+
+	if (seccomp_ioctl(fd, SECCOMP_IOCTL_NOTIF_RECV, req)) {
+		// the target has been killed before we have received the notification
+		IF_TRUE_RETURN_TRACE(ENOENT == errno);
+
+		ERROR_RATELIMIT("SECCOMP_IOCTL_NOTIF_RECV interrupted by %s",
+				EINTR == errno ? "SIGCHLD" : "unexpected event");
+
+		c_seccomp_audit(seccomp, "seccomp-rcv-next", "errno", strerror(errno));
+		return;
+	}
+
+	// default answer
+	resp->id = req->id;
+	resp->error = -EPERM;
+
+	TRACE("[%llu] Got syscall no. %d by PID %u", req->id, req->data.nr, req->pid);
+
+	uint64_t start_ns = c_seccomp_now_ns();
+	c_seccomp_syscall_t syscall = C_SECCOMP_SYSCALL_OTHER;
+	int ret_syscall;
+
+	if (c_seccomp_emulate_on_main_loop(req->data.nr))
+		ret_syscall = c_seccomp_emulate_main(seccomp, &syscall);
+	else
+		ret_syscall = c_seccomp_emulate(seccomp, &syscall);
 
 	if (-1 == ret_syscall) {
-		audit_log_event(NULL, FSA, CMLD, CONTAINER_ISOLATION, "seccomp-emulation-failed",
-				compartment_get_name(seccomp->compartment), 2, "syscall",
-				syscall_str);
+		const char *syscall_str = syscall == C_SECCOMP_SYSCALL_OTHER ?
+						  seccomp->nr_str :
+						  c_seccomp_syscall_names[syscall];
+		c_seccomp_audit(seccomp, "seccomp-emulation-failed", "syscall", syscall_str);
 	}
 
 	if (-1 == seccomp_ioctl(fd, SECCOMP_IOCTL_NOTIF_SEND, resp)) {
-		audit_log_event(NULL, FSA, CMLD, CONTAINER_ISOLATION, "seccomp-send-response",
-				compartment_get_name(seccomp->compartment), 2, "errno",
-				strerror(errno));
-		ERROR_ERRNO("Failed to send seccomp notify response");
+		c_seccomp_audit(seccomp, "seccomp-send-response", "errno", strerror(errno));
+		ERROR_ERRNO_RATELIMIT("Failed to send seccomp notify response");
 	} else {
 		TRACE("Successfully handled seccomp notification");
 	}
 
-	mem_free(syscall_str);
-	mem_free(req);
-	mem_free(resp);
+	c_seccomp_stats_account(seccomp, syscall, -1 == ret_syscall, c_seccomp_now_ns() - start_ns);
+}
+
+static void
+c_seccomp_handle_stop(int fd, unsigned events, UNUSED event_io_t *io, void *data)
+{
+	c_seccomp_t *seccomp = data;
+	ASSERT(seccomp);
+
+	eventfd_t val;
+
+	IF_FALSE_RETURN(events & EVENT_IO_READ);
+	if (eventfd_read(fd, &val) < 0) {
+		TRACE_ERRNO("eventfd_read failed");
+		return;
+	}
+
+	DEBUG("Stopping seccomp notify thread");
+	c_seccomp_notify_unregister(seccomp);
+}
+
+static void *
+c_seccomp_notify_thread(void *data)
+{
+	c_seccomp_t *seccomp = data;
+	ASSERT(seccomp);
+
+	c_seccomp_on_notify_thread = true;
+	event_base_set_current(seccomp->base);
+
+	seccomp->event =
+		event_io_new(seccomp->notify_fd, EVENT_IO_READ, &c_seccomp_handle_notify, seccomp);
+	event_add_io(seccomp->event);
+	seccomp->stop_event =
+		event_io_new(seccomp->stop_fd, EVENT_IO_READ, &c_seccomp_handle_stop, seccomp);
+	event_add_io(seccomp->stop_event);
+
+	// returns after both events have been unregistered
+	event_loop();
+
+	event_base_set_current(NULL);
+	return NULL;
+}
+
+static int
+c_seccomp_notify_thread_start(c_seccomp_t *seccomp)
+{
+	sigset_t all, old;
+	int err;
+
+	seccomp->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	seccomp->main_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (seccomp->stop_fd < 0 || seccomp->main_fd < 0) {
+		ERROR_ERRNO("Could not create eventfds for seccomp notify thread");
+		return -1;
+	}
+
+	seccomp->main_event =
+		event_io_new(seccomp->main_fd, EVENT_IO_READ, &c_seccomp_handle_main, seccomp);
+	event_add_io(seccomp->main_event);
+
+	seccomp->base = event_base_new();
+	seccomp->stopping = false;
+	mem_memset0(seccomp->stats, sizeof(seccomp->stats));
+
+	// signals must still be delivered to the main loop
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&seccomp->thread, NULL, c_seccomp_notify_thread, seccomp);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err) {
+		ERROR("Could not create seccomp notify thread: %s", strerror(err));
+		return -1;
+	}
+	seccomp->thread_running = true;
+
+	return 0;
+}
+
+static void
+c_seccomp_notify_thread_stop(c_seccomp_t *seccomp)
+{
+	if (seccomp->thread_running) {
+		pthread_mutex_lock(&seccomp->lock);
+		seccomp->stopping = true;
+		pthread_cond_signal(&seccomp->cond);
+		pthread_mutex_unlock(&seccomp->lock);
+
+		while (eventfd_write(seccomp->stop_fd, 1) < 0 && errno == EINTR)
+			;
+		pthread_join(seccomp->thread, NULL);
+		seccomp->thread_running = false;
+	}
+
+	if (seccomp->base) {
+		event_base_free(seccomp->base);
+		seccomp->base = NULL;
+	}
+
+	if (seccomp->main_event) {
+		event_remove_io(seccomp->main_event);
+		event_io_free(seccomp->main_event);
+		seccomp->main_event = NULL;
+	}
+
+	if (-1 != seccomp->stop_fd)
+		close(seccomp->stop_fd);
+	if (-1 != seccomp->main_fd)
+		close(seccomp->main_fd);
+	seccomp->stop_fd = -1;
+	seccomp->main_fd = -1;
+
+	c_seccomp_audit_list_flush(seccomp, seccomp->audit_list);
+	seccomp->audit_list = NULL;
+	seccomp->main_pending = false;
 }
 
 static int
@@ -580,11 +972,12 @@ c_seccomp_start_pre_exec(void *seccompp)
 
 	seccomp->notify_fd = notify_fd;
 
-	DEBUG("Register event handler on notify fd %d", seccomp->notify_fd);
+	DEBUG("Starting notify thread on notify fd %d", seccomp->notify_fd);
 
-	seccomp->event =
-		event_io_new(seccomp->notify_fd, EVENT_IO_READ, &c_seccomp_handle_notify, seccomp);
-	event_add_io(seccomp->event);
+	if (c_seccomp_notify_thread_start(seccomp)) {
+		c_seccomp_notify_thread_stop(seccomp);
+		goto out;
+	}
 
 	return 0;
 
@@ -605,10 +998,28 @@ c_seccomp_new(compartment_t *compartment)
 		return NULL;
 	}
 
+	// written by the sysinfo helper process
+	struct sysinfo *sysinfo_shared = mmap(NULL, sizeof(struct sysinfo), PROT_READ | PROT_WRITE,
+					      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == sysinfo_shared) {
+		ERROR_ERRNO("Failed to map sysinfo buffer");
+		mem_free0(sizes);
+		return NULL;
+	}
+
 	c_seccomp_t *seccomp = mem_new0(c_seccomp_t, 1);
 
 	seccomp->notif_sizes = sizes;
+	seccomp->req = mem_alloc0(sizes->seccomp_notif);
+	seccomp->resp = mem_alloc0(sizes->seccomp_notif_resp);
+	seccomp->sysinfo_cache = mem_new0(c_seccomp_sysinfo_cache_t, C_SECCOMP_SYSINFO_CACHE_SLOTS);
+	seccomp->sysinfo_shared = sysinfo_shared;
+	seccomp->sysinfo_events_fd = -1;
 	seccomp->notify_fd = -1;
+	seccomp->stop_fd = -1;
+	seccomp->main_fd = -1;
+	pthread_mutex_init(&seccomp->lock, NULL);
+	pthread_cond_init(&seccomp->cond, NULL);
 	seccomp->compartment = compartment;
 	seccomp->container = compartment_get_extension_data(compartment);
 
@@ -630,6 +1041,12 @@ c_seccomp_free(void *seccompp)
 	ASSERT(seccomp);
 	if (seccomp->notif_sizes)
 		mem_free0(seccomp->notif_sizes);
+	mem_free0(seccomp->req);
+	mem_free0(seccomp->resp);
+	mem_free0(seccomp->sysinfo_cache);
+	munmap(seccomp->sysinfo_shared, sizeof(struct sysinfo));
+	pthread_mutex_destroy(&seccomp->lock);
+	pthread_cond_destroy(&seccomp->cond);
 
 	for (list_t *l = seccomp->module_list; l; l = l->next) {
 		mem_free0(l->data);
@@ -645,11 +1062,7 @@ c_seccomp_cleanup(void *seccompp, UNUSED bool is_rebooting)
 	c_seccomp_t *seccomp = (c_seccomp_t *)seccompp;
 	ASSERT(seccomp);
 
-	if (seccomp->event) {
-		event_remove_io(seccomp->event);
-		event_io_free(seccomp->event);
-		seccomp->event = NULL;
-	}
+	c_seccomp_notify_thread_stop(seccomp);
 
 	if (-1 != seccomp->notify_fd)
 		close(seccomp->notify_fd);
@@ -674,6 +1087,7 @@ static compartment_module_t c_seccomp_module = {
 	.stop = NULL,
 	.cleanup = c_seccomp_cleanup,
 	.join_ns = NULL,
+	.flags = COMPARTMENT_MODULE_F_LAZY,
 };
 
 static void INIT
@@ -681,4 +1095,7 @@ c_seccomp_init(void)
 {
 	// register this module in compartment.c
 	compartment_register_module(&c_seccomp_module);
+
+	// syscall statistics for control
+	container_register_get_syscall_stats_new_handler(MOD_NAME, c_seccomp_get_syscall_stats_new);
 }
@@ -34,12 +34,68 @@
 
 #include <common/event.h>
 #include <linux/seccomp.h>
+#include <linux/sysinfo.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* number of mount namespaces of a compartment the emulated sysinfo is cached for */
+#define C_SECCOMP_SYSINFO_CACHE_SLOTS 4
+
+/* emulated sysinfo of a mount namespace, reused by the notify thread */
+typedef struct c_seccomp_sysinfo_cache {
+	struct sysinfo info;
+	ino_t mntns;	  /* mount namespace of info, 0 if the slot is unused */
+	uint64_t time_ns; /* CLOCK_MONOTONIC time info was emulated at */
+} c_seccomp_sysinfo_cache_t;
+
+/* syscalls emulated by this module, used to index the statistics */
+typedef enum c_seccomp_syscall {
+	C_SECCOMP_SYSCALL_CLOCK_ADJTIME,
+	C_SECCOMP_SYSCALL_ADJTIMEX,
+	C_SECCOMP_SYSCALL_CLOCK_SETTIME,
+	C_SECCOMP_SYSCALL_IOCTL,
+	C_SECCOMP_SYSCALL_FINIT_MODULE,
+	C_SECCOMP_SYSCALL_MKNODAT,
+	C_SECCOMP_SYSCALL_SYSINFO,
+	C_SECCOMP_SYSCALL_MOUNT,
+	C_SECCOMP_SYSCALL_OTHER,
+	C_SECCOMP_SYSCALL_NUM,
+} c_seccomp_syscall_t;
 
+/*
+ * Notifications of a compartment are received and emulated by a dedicated notify
+ * thread running its own event base. Emulations which need the state of cmld are
+ * handed over to the main loop, as are audit events of the notify thread.
+ */
 typedef struct c_seccomp {
 	compartment_t *compartment;
 	struct seccomp_notif_sizes *notif_sizes;
+	struct seccomp_notif *req;	 /* preallocated notification buffer */
+	struct seccomp_notif_resp *resp; /* preallocated response buffer */
+	char nr_str[32];		 /* name of unexpected syscalls for auditing */
 	int notify_fd;
 	event_io_t *event;
+	event_base_t *base; /* event base of the notify thread */
+	pthread_t thread;
+	bool thread_running;
+	int stop_fd; /* eventfd to stop the notify thread */
+	event_io_t *stop_event;
+	int main_fd; /* eventfd to wake the main loop for deferred work */
+	event_io_t *main_event;
+	struct sysinfo *sysinfo_shared; /* shared mapping filled by the sysinfo helper */
+	c_seccomp_sysinfo_cache_t *sysinfo_cache; /* C_SECCOMP_SYSINFO_CACHE_SLOTS entries */
+	int sysinfo_events_fd;	/* memory.events of the compartment, invalidates the cache */
+	event_io_t *sysinfo_events_io;
+	pthread_mutex_t lock; /* protects the members below */
+	pthread_cond_t cond;
+	bool main_pending; /* req has to be emulated by the main loop */
+	bool stopping;
+	int main_ret;
+	c_seccomp_syscall_t main_syscall;
+	container_syscall_stats_t stats[C_SECCOMP_SYSCALL_NUM];
+	list_t *audit_list; /* audit events deferred to the main loop */
+	/* end of members protected by lock */
 	unsigned int enabled_features;
 	container_t *container;
 	list_t *module_list; /* names of modules loaded by this compartment */
@@ -54,6 +110,16 @@ pidfd_open(pid_t pid, unsigned int flags);
 int
 pidfd_getfd(int pidfd, int targetfd, unsigned int flags);
 
+/**
+ * Logs a failed seccomp audit event of the compartment with an optional key value
+ * pair. On the notify thread, the event is queued for the main loop.
+ */
+void
+c_seccomp_audit(c_seccomp_t *seccomp, const char *evtype, const char *key, const char *value);
+
+int
+c_seccomp_fetch_vm(c_seccomp_t *seccomp, int pid, void *lbuf, void *rbuf, uint64_t size);
+
 void *
 c_seccomp_fetch_vm_new(c_seccomp_t *seccomp, int pid, void *rbuf, uint64_t size);
 
@@ -90,6 +156,13 @@ int
 c_seccomp_emulate_ioctl(c_seccomp_t *seccomp, struct seccomp_notif *req,
 			struct seccomp_notif_resp *resp);
 
+/**
+ * Drops the cached sysinfo values and stops watching the memory events of the
+ * compartment. Has to be called on the notify thread.
+ */
+void
+c_seccomp_sysinfo_reset(c_seccomp_t *seccomp);
+
 int
 c_seccomp_emulate_sysinfo(c_seccomp_t *seccomp, struct seccomp_notif *req,
 			  struct seccomp_notif_resp *resp);
@@ -39,16 +39,29 @@
 #include <common/macro.h>
 #include <common/mem.h>
 #include <common/ns.h>
+#include <common/uuid.h>
 
 #include "seccomp.h"
 
 #include <linux/sysinfo.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
 #define CGROUPS_FOLDER "/sys/fs/cgroup"
 
+/*
+ * Emulated sysinfo values are reused for this long by callers in the same mount
+ * namespace, so that polling sysinfo does not fork a helper each time. The cache
+ * is dropped earlier if the memory.events of the compartment change.
+ */
+#define C_SECCOMP_SYSINFO_CACHE_MS 100
+
 //#undef LOGF_LOG_MIN_PRIO
 //#define LOGF_LOG_MIN_PRIO LOGF_PRIO_TRACE
 
@@ -247,10 +260,7 @@ c_seccomp_print_sysinfo(struct sysinfo *info)
 }
 
 struct sysinfo_fork_data {
-	c_seccomp_t *seccomp;
 	struct sysinfo *info;
-	pid_t target_pid;
-	void *target_datap;
 };
 
 static int
@@ -361,14 +371,141 @@ c_seccomp_do_sysinfo_fork(const void *data)
 	TRACE("sysinfo struct emulated!");
 	c_seccomp_print_sysinfo(sysinfo_params->info);
 
-	if (-1 == c_seccomp_send_vm(sysinfo_params->seccomp, sysinfo_params->target_pid,
-				    (void *)sysinfo_params->info, sysinfo_params->target_datap,
-				    sizeof(struct sysinfo))) {
-		ERROR_ERRNO("Failed to send struct sysinfo");
-		return -1;
+	return 0;
+}
+
+/*
+ * Returns the inode of the mount namespace of pid, which identifies the view on
+ * cgroups and procfs the emulated values are taken from, or 0 on error.
+ */
+static ino_t
+c_seccomp_sysinfo_get_mntns(pid_t pid)
+{
+	char path[64];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "/proc/%d/ns/mnt", pid);
+	return stat(path, &st) ? 0 : st.st_ino;
+}
+
+static uint64_t
+c_seccomp_sysinfo_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+c_seccomp_sysinfo_cache_clear(c_seccomp_t *seccomp)
+{
+	mem_memset0(seccomp->sysinfo_cache,
+		    C_SECCOMP_SYSINFO_CACHE_SLOTS * sizeof(c_seccomp_sysinfo_cache_t));
+}
+
+void
+c_seccomp_sysinfo_reset(c_seccomp_t *seccomp)
+{
+	ASSERT(seccomp);
+
+	if (seccomp->sysinfo_events_io) {
+		event_remove_io(seccomp->sysinfo_events_io);
+		event_io_free(seccomp->sysinfo_events_io);
+		seccomp->sysinfo_events_io = NULL;
+	}
+	if (seccomp->sysinfo_events_fd >= 0) {
+		close(seccomp->sysinfo_events_fd);
+		seccomp->sysinfo_events_fd = -1;
 	}
 
-	return 0;
+	c_seccomp_sysinfo_cache_clear(seccomp);
+}
+
+#ifndef CGROUPS_LEGACY
+extern char *c_cgroups_subtree;
+
+/*
+ * A changed memory.events means the compartment hit its memory limits, thus freeram
+ * and freeswap are likely to be outdated.
+ */
+static void
+c_seccomp_sysinfo_events_cb(int fd, UNUSED unsigned events, UNUSED event_io_t *io, void *data)
+{
+	c_seccomp_t *seccomp = data;
+	char buf[256];
+
+	ASSERT(seccomp);
+
+	// reading rearms the notification
+	if (pread(fd, buf, sizeof(buf), 0) < 0) {
+		// the cgroup is gone, stop polling the fd which would signal forever
+		TRACE_ERRNO("Could not read memory.events");
+		c_seccomp_sysinfo_reset(seccomp);
+		return;
+	}
+
+	TRACE("memory.events changed, dropping cached sysinfo");
+	c_seccomp_sysinfo_cache_clear(seccomp);
+}
+
+/*
+ * Polls memory.events of the compartment's cgroup on the notify thread, the kernel
+ * signals changes with EPOLLPRI.
+ */
+static void
+c_seccomp_sysinfo_events_register(c_seccomp_t *seccomp)
+{
+	char buf[256];
+
+	IF_TRUE_RETURN(seccomp->sysinfo_events_io || !c_cgroups_subtree);
+
+	char *path = mem_printf("%s/%s/memory.events", c_cgroups_subtree,
+				uuid_string(container_get_uuid(seccomp->container)));
+	seccomp->sysinfo_events_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (seccomp->sysinfo_events_fd < 0 ||
+	    pread(seccomp->sysinfo_events_fd, buf, sizeof(buf), 0) < 0) {
+		TRACE_ERRNO("Could not open %s, caching sysinfo by time only", path);
+		mem_free0(path);
+		c_seccomp_sysinfo_reset(seccomp);
+		return;
+	}
+	mem_free0(path);
+
+	seccomp->sysinfo_events_io = event_io_new(seccomp->sysinfo_events_fd, EVENT_IO_PRI,
+						  &c_seccomp_sysinfo_events_cb, seccomp);
+	event_add_io(seccomp->sysinfo_events_io);
+}
+#else
+static void
+c_seccomp_sysinfo_events_register(UNUSED c_seccomp_t *seccomp)
+{
+}
+#endif
+
+/*
+ * Returns the cache slot of mntns if it is still valid at now_ns. Otherwise, the
+ * unused or oldest slot is returned with mntns set to 0, to be filled by the caller.
+ */
+static c_seccomp_sysinfo_cache_t *
+c_seccomp_sysinfo_cache_get(c_seccomp_t *seccomp, ino_t mntns, uint64_t now_ns)
+{
+	c_seccomp_sysinfo_cache_t *oldest = &seccomp->sysinfo_cache[0];
+
+	for (int i = 0; i < C_SECCOMP_SYSINFO_CACHE_SLOTS; i++) {
+		c_seccomp_sysinfo_cache_t *slot = &seccomp->sysinfo_cache[i];
+
+		if (mntns && slot->mntns == mntns) {
+			if (now_ns - slot->time_ns < C_SECCOMP_SYSINFO_CACHE_MS * 1000000ULL)
+				return slot;
+			oldest = slot;
+			break;
+		}
+		if (!slot->mntns || (oldest->mntns && slot->time_ns < oldest->time_ns))
+			oldest = slot;
+	}
+
+	oldest->mntns = 0;
+	return oldest;
 }
 
 int
@@ -376,26 +513,44 @@ c_seccomp_emulate_sysinfo(c_seccomp_t *seccomp, struct seccomp_notif *req,
 			  struct seccomp_notif_resp *resp)
 {
 	int ret_sysinfo = 0;
-	struct sysinfo *info;
 
 	TRACE("Got sysinfo, struct sysinfo *: %p", CAST_UINT_VOIDPTR req->data.args[0]);
-	info = mem_new0(struct sysinfo, 1);
-
-	TRACE("Executing sysinfo on behalf of container");
-	// Join all namespaces but pidns; thus, the helper process won't show up inside the container
-	// Uptime will then already be correctly handled by time namespace
-	struct sysinfo_fork_data sysinfo_params = { .seccomp = seccomp,
-						    .info = info,
-						    .target_pid = req->pid,
-						    .target_datap =
-							    CAST_UINT_VOIDPTR req->data.args[0] };
-	if (-1 == (ret_sysinfo = namespace_exec(req->pid, CLONE_NEWALL & (~CLONE_NEWPID), 0, 0,
-						c_seccomp_do_sysinfo_fork, &sysinfo_params))) {
-		ERROR_ERRNO("Failed to execute sysinfo");
-		goto out;
+
+	uint64_t now_ns = c_seccomp_sysinfo_now_ns();
+	ino_t mntns = c_seccomp_sysinfo_get_mntns(req->pid);
+	c_seccomp_sysinfo_cache_t *slot = c_seccomp_sysinfo_cache_get(seccomp, mntns, now_ns);
+
+	if (slot->mntns) {
+		TRACE("Reusing sysinfo emulated %" PRIu64 " ns ago", now_ns - slot->time_ns);
+	} else {
+		TRACE("Executing sysinfo on behalf of container");
+		// retried on misses only, which fork a helper anyway
+		c_seccomp_sysinfo_events_register(seccomp);
+
+		// Join all namespaces but pidns; thus, the helper process won't show up inside
+		// the container. Uptime will then already be correctly handled by time namespace.
+		// The helper fills the shared buffer, which is copied to the cache afterwards.
+		struct sysinfo_fork_data sysinfo_params = { .info = seccomp->sysinfo_shared };
+		if (-1 == (ret_sysinfo = namespace_exec(req->pid, CLONE_NEWALL & (~CLONE_NEWPID),
+							0, 0, c_seccomp_do_sysinfo_fork,
+							&sysinfo_params))) {
+			ERROR_ERRNO("Failed to execute sysinfo");
+			goto out;
+		}
+
+		TRACE("sysinfo returned %d", ret_sysinfo);
+
+		slot->info = *seccomp->sysinfo_shared;
+		slot->mntns = mntns;
+		slot->time_ns = now_ns;
 	}
 
-	TRACE("sysinfo returned %d", ret_sysinfo);
+	if (-1 == c_seccomp_send_vm(seccomp, req->pid, &slot->info,
+				    CAST_UINT_VOIDPTR req->data.args[0], sizeof(struct sysinfo))) {
+		ERROR_ERRNO("Failed to send struct sysinfo");
+		ret_sysinfo = -1;
+		goto out;
+	}
 
 	// prepare answer
 	resp->id = req->id;
@@ -403,8 +558,5 @@ c_seccomp_emulate_sysinfo(c_seccomp_t *seccomp, struct seccomp_notif *req,
 	resp->val = ret_sysinfo;
 
 out:
-	if (info)
-		mem_free(info);
-
 	return ret_sysinfo;
 }
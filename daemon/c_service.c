@@ -36,6 +36,8 @@
 
 #include "container.h"
 #include "audit.h"
+#include "bootsched.h"
+#include "starttrace.h"
 
 #include "common/event.h"
 #include "common/fd.h"
@@ -45,8 +47,10 @@
 #include "common/sock.h"
 
 #include <inttypes.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 // clang-format off
@@ -58,6 +62,10 @@
 
 #define C_SERVICE_MAX_CLIENTS 8
 
+// limits of the milestones a container may report per start
+#define C_SERVICE_MAX_MILESTONES 32
+#define C_SERVICE_MILESTONE_NAME_MAX 64
+
 typedef struct c_service {
 	container_t *container; // weak reference
 	int sock;
@@ -65,8 +73,99 @@ typedef struct c_service {
 	event_io_t *event_io_sock;
 	list_t *event_io_sock_connected_list; // list of clients
 	int clients;
+	uint64_t start_time; // CLOCK_REALTIME in ns of the current start
+	list_t *milestone_list; // reached milestones (container_milestone_t), in order
 } c_service_t;
 
+static uint64_t
+c_service_realtime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+c_service_clear_milestones(c_service_t *service)
+{
+	for (list_t *l = service->milestone_list; l; l = l->next) {
+		container_milestone_t *milestone = l->data;
+		mem_free0(milestone->name);
+		mem_free0(milestone);
+	}
+	list_delete(service->milestone_list);
+	service->milestone_list = NULL;
+}
+
+static bool
+c_service_milestone_name_is_valid(const char *name)
+{
+	size_t len = strlen(name);
+	IF_TRUE_RETVAL(len == 0 || len > C_SERVICE_MILESTONE_NAME_MAX, false);
+
+	return strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-") ==
+	       len;
+}
+
+/**
+ * Records a readiness milestone reported by a service of the container. Only the first
+ * report of a milestone per start is recorded.
+ */
+static void
+c_service_add_milestone(c_service_t *service, const ServiceToCmldMessage *message)
+{
+	if (!message->milestone || !c_service_milestone_name_is_valid(message->milestone)) {
+		WARN("Ignoring invalid milestone from container %s",
+		     container_get_description(service->container));
+		return;
+	}
+
+	for (list_t *l = service->milestone_list; l; l = l->next) {
+		container_milestone_t *milestone = l->data;
+		if (!strcmp(milestone->name, message->milestone)) {
+			TRACE("Milestone %s was already reached", message->milestone);
+			return;
+		}
+	}
+
+	if (list_length(service->milestone_list) >= C_SERVICE_MAX_MILESTONES) {
+		WARN("Too many milestones from container %s, ignoring %s",
+		     container_get_description(service->container), message->milestone);
+		return;
+	}
+
+	// the time reported by the service must lie between the start and now
+	uint64_t time = c_service_realtime_ns();
+	if (message->has_milestone_time && message->milestone_time >= service->start_time &&
+	    message->milestone_time <= time)
+		time = message->milestone_time;
+
+	container_milestone_t *milestone = mem_new0(container_milestone_t, 1);
+	milestone->name = mem_strdup(message->milestone);
+	milestone->time = time;
+	milestone->since_start = milestone->time - service->start_time;
+	service->milestone_list = list_append(service->milestone_list, milestone);
+
+	INFO("Container %s reached milestone %s after %" PRIu64 " ms",
+	     container_get_description(service->container), milestone->name,
+	     milestone->since_start / 1000000);
+
+	starttrace_add_milestone(container_get_starttrace(service->container), milestone->name,
+				 milestone->since_start);
+
+	// containers may wait for the milestone to be started
+	bootsched_update();
+}
+
+static const list_t *
+c_service_get_milestones(void *servicep)
+{
+	c_service_t *service = servicep;
+	ASSERT(service);
+
+	return service->milestone_list;
+}
+
 static int
 c_service_send_container_cfg_name_proto(c_service_t *service, int sock_client)
 {
@@ -129,6 +228,10 @@ c_service_handle_received_message(c_service_t *service, int sock_client,
 		container_set_state(service->container, COMPARTMENT_STATE_RUNNING);
 		break;
 
+	case SERVICE_TO_CMLD_MESSAGE__CODE__MILESTONE:
+		c_service_add_milestone(service, message);
+		break;
+
 	case SERVICE_TO_CMLD_MESSAGE__CODE__CONTAINER_CFG_NAME_REQ:
 		INFO("Received a request for the container name from container %s",
 		     container_get_description(service->container));
@@ -147,7 +250,10 @@ c_service_handle_received_message(c_service_t *service, int sock_client,
 		TRACE("Got ACK from Container %s",
 		      uuid_string(container_get_uuid(service->container)));
 
-		if (0 > audit_process_ack(service->container, message->audit_ack)) {
+		if (0 > audit_process_ack(service->container, message->audit_ack,
+					  message->has_audit_seq, message->audit_seq,
+					  message->has_audit_window ? message->audit_window : 0,
+					  message->has_audit_batch && message->audit_batch)) {
 			ERROR("Failed to process audit ACK from container %s",
 			      uuid_string(container_get_uuid(service->container)));
 		}
@@ -322,6 +428,8 @@ c_service_cleanup(void *servicep, UNUSED bool is_rebooting)
 	}
 
 	service->clients = 0;
+
+	c_service_clear_milestones(service);
 }
 
 /**
@@ -362,6 +470,7 @@ c_service_free(void *servicep)
 	c_service_t *service = servicep;
 	ASSERT(service);
 
+	c_service_clear_milestones(service);
 	mem_free0(service);
 }
 
@@ -382,6 +491,9 @@ c_service_start_pre_clone(void *servicep)
 	if (service->sock < 0)
 		return COMPARTMENT_ERROR_SERVICE;
 
+	c_service_clear_milestones(service);
+	service->start_time = c_service_realtime_ns();
+
 	return 0;
 }
 
@@ -521,4 +633,5 @@ c_service_init(void)
 	container_register_audit_record_send_handler(MOD_NAME, c_service_audit_send_record);
 	container_register_audit_record_notify_handler(MOD_NAME, c_service_audit_notify);
 	container_register_audit_notify_complete_handler(MOD_NAME, c_service_audit_notify_complete);
+	container_register_get_milestones_handler(MOD_NAME, c_service_get_milestones);
 }
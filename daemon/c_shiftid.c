@@ -25,6 +25,7 @@
 
 #define MOD_NAME "c_shiftid"
 
+#include <fcntl.h>
 #include <linux/magic.h>
 #include <sys/mount.h>
 #include <sys/vfs.h>
@@ -37,9 +38,9 @@
 #include "common/dir.h"
 #include "cmld.h"
 #include "container.h"
+#include "idshift.h"
 
 #define SHIFTFS_DIR "/tmp/shiftfs"
-#define UID_RANGE 100000
 
 struct c_shiftid_mnt {
 	char *target;
@@ -155,54 +156,6 @@ c_shiftid_free(void *shiftidp)
 	mem_free0(shiftid);
 }
 
-static int
-c_shiftid_chown_dir_cb(const char *path, const char *file, void *data)
-{
-	struct stat s;
-	int ret = 0;
-	c_shiftid_t *shiftid = data;
-	ASSERT(shiftid);
-
-	char *file_to_chown = mem_printf("%s/%s", path, file);
-	if (lstat(file_to_chown, &s) == -1) {
-		mem_free0(file_to_chown);
-		return -1;
-	}
-
-	int container_uid = container_get_uid(shiftid->container);
-
-	// modulo operation avoids shifting twice
-	uid_t uid = s.st_uid % UID_RANGE + container_uid;
-	gid_t gid = s.st_gid % UID_RANGE + container_uid;
-
-	if (file_is_dir(file_to_chown)) {
-		TRACE("Path %s is dir", file_to_chown);
-		if (dir_foreach(file_to_chown, &c_shiftid_chown_dir_cb, shiftid) < 0) {
-			ERROR_ERRNO("Could not chown all dir contents in '%s'", file_to_chown);
-			ret--;
-		}
-		if (chown(file_to_chown, uid, gid) < 0) {
-			ERROR_ERRNO("Could not chown dir '%s' to (%d:%d)", file_to_chown, uid, gid);
-			ret--;
-		}
-	} else {
-		if (lchown(file_to_chown, uid, gid) < 0) {
-			ERROR_ERRNO("Could not chown file '%s' to (%d:%d)", file_to_chown, uid,
-				    gid);
-			ret--;
-		}
-	}
-	TRACE("Chown file '%s' to (%d:%d) (uid_start %d)", file_to_chown, uid, gid, container_uid);
-
-	// chown .
-	if (chown(path, uid, gid) < 0) {
-		ERROR_ERRNO("Could not chown dir '%s' to (%d:%d)", path, uid, gid);
-		ret--;
-	}
-	mem_free0(file_to_chown);
-	return ret;
-}
-
 static int
 c_shiftid_mount_ovl(const char *overlayfs_mount_dir, const char *target_dir, const char *ovl_lower)
 {
@@ -330,7 +283,7 @@ c_shiftid_prepare_dir(c_shiftid_t *shiftid, struct c_shiftid_mnt *mnt, const cha
 				    container_uid);
 			return -1;
 		}
-		if (dir_foreach(dir, &c_shiftid_chown_dir_cb, shiftid) < 0) {
+		if (idshift_tree(dir, container_uid, true) < 0) {
 			ERROR("Could not chown %s to target uid:gid (%d:%d)", dir, container_uid,
 			      container_uid);
 			return -1;
@@ -459,7 +412,7 @@ c_shiftid_shift_ids(void *shiftidp, const char *src, const char *dst, const char
 
 	// if cgroup subsys or dev just chown the files
 	if (is_dev || is_cgroup) {
-		if (dir_foreach(src, &c_shiftid_chown_dir_cb, shiftid) < 0) {
+		if (idshift_tree(src, container_uid, false) < 0) {
 			ERROR("Could not chown %s to target uid:gid (%d:%d)", src, container_uid,
 			      container_uid);
 			goto error;
@@ -41,8 +41,10 @@
 #include "common/sock.h"
 #include "common/mem.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/protobuf-text.h"
 #include "common/proc.h"
+#include "common/list.h"
 
 #include <google/protobuf-c/protobuf-c-text.h>
 #include <libgen.h>
@@ -71,10 +73,31 @@
 
 #define USB_TOKEN_ATTACH_TIMEOUT 500
 
+// time in ms after which a request is failed if scd did not reply
+#define SCD_REQUEST_TIMEOUT 30000
+
 extern char *scd_sock_path; // defined in scd.c
 
-typedef struct c_smartcard {
-	int sock;
+typedef struct c_smartcard c_smartcard_t;
+
+/*
+ * A request which is in flight on the connection of a smartcard. scd echoes the request id
+ * in its reply, which is then passed to cb, or NULL if the connection was closed meanwhile
+ * or scd did not reply within SCD_REQUEST_TIMEOUT.
+ */
+typedef struct c_smartcard_request {
+	uint32_t id;
+	void (*cb)(c_smartcard_t *smartcard, TokenToDaemon *msg);
+	c_smartcard_t *smartcard;
+	event_timer_t *timer;
+} c_smartcard_request_t;
+
+struct c_smartcard {
+	// non-blocking connection to scd, NULL if not connected
+	protobuf_conn_t *conn;
+	// requests which wait for a reply of scd
+	list_t *requests;
+	uint32_t request_id;
 	const char *path;
 	container_t *container;
 
@@ -87,13 +110,15 @@ typedef struct c_smartcard {
 
 	// indicates whether the scd has succesfully initialized the token structure
 	bool is_init;
+	// indicates whether a request to initialize the token structure is in flight
+	bool is_adding;
 	// indicates whether the token has already been provisioned with a platform-bound authentication code
 	bool is_paired_with_device;
 
 	void (*err_cb)(int error_code, void *data);
 	void *err_cbdata;
 	int (*success_cb)(container_t *container);
-} c_smartcard_t;
+};
 
 static TokenType
 c_smartcard_tokentype_to_proto(container_token_type_t tokentype)
@@ -182,6 +207,178 @@ c_smartcard_send_recv_block(const DaemonToToken *out)
 	return msg;
 }
 
+static c_smartcard_request_t *
+c_smartcard_request_get(c_smartcard_t *smartcard, uint32_t id)
+{
+	for (list_t *l = smartcard->requests; l; l = l->next) {
+		c_smartcard_request_t *req = l->data;
+		if (req->id == id)
+			return req;
+	}
+	return NULL;
+}
+
+static void
+c_smartcard_request_free(c_smartcard_request_t *req)
+{
+	if (req->timer) {
+		event_remove_timer(req->timer);
+		event_timer_free(req->timer);
+	}
+	mem_free0(req);
+}
+
+static void
+c_smartcard_request_timeout_cb(UNUSED event_timer_t *timer, void *data)
+{
+	c_smartcard_request_t *req = data;
+	ASSERT(req);
+	c_smartcard_t *smartcard = req->smartcard;
+
+	ERROR("scd did not reply to request %u for container %s in time", req->id,
+	      container_get_name(smartcard->container));
+
+	// a late reply is dropped as reply to an unknown request
+	smartcard->requests = list_remove(smartcard->requests, req);
+
+	if (req->cb)
+		req->cb(smartcard, NULL);
+	c_smartcard_request_free(req);
+}
+
+static void
+c_smartcard_conn_cb_message(UNUSED protobuf_conn_t *conn, ProtobufCMessage *message, void *data)
+{
+	c_smartcard_t *smartcard = data;
+	ASSERT(smartcard);
+
+	TokenToDaemon *msg = (TokenToDaemon *)message;
+
+	if (!msg->has_request_id) {
+		WARN("Received token reply without request id from scd, dropping it");
+		return;
+	}
+
+	c_smartcard_request_t *req = c_smartcard_request_get(smartcard, msg->request_id);
+	if (!req) {
+		WARN("Received token reply for unknown request %u", msg->request_id);
+		return;
+	}
+	smartcard->requests = list_remove(smartcard->requests, req);
+
+	if (req->cb)
+		req->cb(smartcard, msg);
+	c_smartcard_request_free(req);
+}
+
+static void
+c_smartcard_conn_cb_close(protobuf_conn_t *conn, void *data)
+{
+	c_smartcard_t *smartcard = data;
+	ASSERT(smartcard);
+
+	int fd = protobuf_conn_get_fd(conn);
+
+	WARN("Connection to scd for container %s closed",
+	     container_get_name(smartcard->container));
+	protobuf_conn_free(conn);
+	close(fd);
+	smartcard->conn = NULL;
+
+	// fail all pending requests, the callbacks may already issue new ones
+	list_t *requests = smartcard->requests;
+	smartcard->requests = NULL;
+
+	for (list_t *l = requests; l; l = l->next) {
+		c_smartcard_request_t *req = l->data;
+		if (req->cb)
+			req->cb(smartcard, NULL);
+		c_smartcard_request_free(req);
+	}
+	list_delete(requests);
+}
+
+static protobuf_conn_t *
+c_smartcard_conn_get(c_smartcard_t *smartcard)
+{
+	IF_TRUE_RETVAL(smartcard->conn, smartcard->conn);
+
+	int sock = sock_unix_create_and_connect(SOCK_SEQPACKET | SOCK_NONBLOCK, scd_sock_path);
+	if (sock < 0) {
+		ERROR_ERRNO("Failed to connect to scd control socket %s", scd_sock_path);
+		return NULL;
+	}
+
+	smartcard->conn = protobuf_conn_new(sock, &token_to_daemon__descriptor,
+					    c_smartcard_conn_cb_message, c_smartcard_conn_cb_close,
+					    smartcard);
+	if (!smartcard->conn)
+		close(sock);
+
+	return smartcard->conn;
+}
+
+/**
+ * Closes the connection to scd. Replies to pending requests are dropped.
+ */
+static void
+c_smartcard_conn_free(c_smartcard_t *smartcard)
+{
+	if (smartcard->conn) {
+		int fd = protobuf_conn_get_fd(smartcard->conn);
+		protobuf_conn_free(smartcard->conn);
+		close(fd);
+		smartcard->conn = NULL;
+	}
+
+	for (list_t *l = smartcard->requests; l; l = l->next)
+		c_smartcard_request_free(l->data);
+	list_delete(smartcard->requests);
+	smartcard->requests = NULL;
+}
+
+/**
+ * Sends a request to scd without waiting for its reply. Once the reply arrives, it is
+ * passed to cb from the event loop, thus requests of different containers never block
+ * each other. If scd does not reply within SCD_REQUEST_TIMEOUT, cb is called with NULL.
+ * Replies to requests with a NULL cb are dropped.
+ */
+static int
+c_smartcard_send(c_smartcard_t *smartcard, DaemonToToken *out,
+		 void (*cb)(c_smartcard_t *smartcard, TokenToDaemon *msg))
+{
+	ASSERT(smartcard);
+	ASSERT(out);
+
+	protobuf_conn_t *conn = c_smartcard_conn_get(smartcard);
+	IF_NULL_RETVAL(conn, -1);
+
+	// 0 is skipped on wrap around, ids of long pending requests are not reused
+	do {
+		smartcard->request_id++;
+	} while (smartcard->request_id == 0 ||
+		 c_smartcard_request_get(smartcard, smartcard->request_id));
+
+	out->has_request_id = true;
+	out->request_id = smartcard->request_id;
+
+	if (protobuf_conn_send_message(conn, (ProtobufCMessage *)out) < 0) {
+		ERROR("Failed to send message to scd for container %s",
+		      container_get_name(smartcard->container));
+		return -1;
+	}
+
+	c_smartcard_request_t *req = mem_new0(c_smartcard_request_t, 1);
+	req->id = smartcard->request_id;
+	req->cb = cb;
+	req->smartcard = smartcard;
+	req->timer = event_timer_new(SCD_REQUEST_TIMEOUT, 1, c_smartcard_request_timeout_cb, req);
+	event_add_timer(req->timer);
+	smartcard->requests = list_append(smartcard->requests, req);
+
+	return 0;
+}
+
 /**
  * Returns the path to a container specific flag file, that indicates, that the
  * token has been provisioned with a platform bound authentication code
@@ -234,8 +431,12 @@ c_smartcard_error(c_smartcard_t *smartcard, int error_code)
 	smartcard->err_cb(error_code, smartcard->err_cbdata);
 }
 
-void
-c_smartcard_send_token_lock_cmd(c_smartcard_t *smartcard)
+/**
+ * Locks the token, the reply is passed to cb.
+ */
+static void
+c_smartcard_send_token_lock_cmd(c_smartcard_t *smartcard,
+				void (*cb)(c_smartcard_t *smartcard, TokenToDaemon *msg))
 {
 	ASSERT(smartcard);
 
@@ -247,64 +448,57 @@ c_smartcard_send_token_lock_cmd(c_smartcard_t *smartcard)
 
 	out.token_uuid = mem_strdup(uuid_string(container_get_uuid(smartcard->container)));
 
-	protobuf_send_message(smartcard->sock, (ProtobufCMessage *)&out);
+	if (c_smartcard_send(smartcard, &out, cb) < 0)
+		WARN("Could not request scd to lock the token");
 	mem_free0(out.token_uuid);
 }
 
 static void
-c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *data)
+c_smartcard_lock_reply(c_smartcard_t *smartcard, TokenToDaemon *msg)
 {
-	c_smartcard_t *smartcard = data;
 	ASSERT(smartcard);
 
-	bool done = false;
+	if (msg && msg->code == TOKEN_TO_DAEMON__CODE__LOCK_SUCCESSFUL) {
+		TRACE("Locked token of container %s", container_get_name(smartcard->container));
+		return;
+	}
 
-	if (events & EVENT_IO_EXCEPT) {
-		ERROR("Container start failed");
+	audit_log_event(container_get_uuid(smartcard->container), FSA, CMLD, TOKEN_MGMT, "lock",
+			uuid_string(container_get_uuid(smartcard->container)), 0);
+	WARN("Locking the token failed.");
+}
 
-		event_remove_io(io);
-		event_io_free(io);
-		return;
-	} else if (events & EVENT_IO_READ) {
-		// use protobuf for communication with scd
-		TokenToDaemon *msg =
-			(TokenToDaemon *)protobuf_recv_message(fd, &token_to_daemon__descriptor);
+/*
+ * Executes the corresponding start, stop function as soon as the container key is
+ * available. The token is locked concurrently, thus the lock round trip to scd does not
+ * delay the container start.
+ */
+static void
+c_smartcard_ctrl_success(c_smartcard_t *smartcard)
+{
+	IF_NULL_RETURN(smartcard->success_cb);
 
-		if (!msg) {
-			ERROR("Failed to receive message although EVENT_IO_READ was set. Aborting container start.");
+	if (-1 == smartcard->success_cb(smartcard->container))
+		c_smartcard_error(smartcard, CONTAINER_SMARTCARD_CB_FAILED);
+	else
+		c_smartcard_error(smartcard, CONTAINER_SMARTCARD_CB_OK);
+}
 
-			event_remove_io(io);
-			event_io_free(io);
-			return;
-		}
+static void
+c_smartcard_ctrl_reply(c_smartcard_t *smartcard, TokenToDaemon *msg)
+{
+	ASSERT(smartcard);
 
+	if (!msg) {
+		ERROR("Failed to receive message from scd. Aborting container start.");
+	} else {
 		switch (msg->code) {
-		case TOKEN_TO_DAEMON__CODE__LOCK_FAILED: {
-			audit_log_event(container_get_uuid(smartcard->container), FSA, CMLD,
-					TOKEN_MGMT, "lock",
-					uuid_string(container_get_uuid(smartcard->container)), 0);
-			WARN("Locking the token failed.");
-			c_smartcard_error(smartcard, CONTAINER_SMARTCARD_LOCK_FAILED);
-			done = true;
-		} break;
-		case TOKEN_TO_DAEMON__CODE__LOCK_SUCCESSFUL: {
-			/* after token has sucesfully locked again we can execute the corresponding
-			 * start, stop function */
-			if (smartcard->success_cb) {
-				if (-1 == smartcard->success_cb(smartcard->container))
-					c_smartcard_error(smartcard, CONTAINER_SMARTCARD_CB_FAILED);
-				else
-					c_smartcard_error(smartcard, CONTAINER_SMARTCARD_CB_OK);
-			}
-			done = true;
-		} break;
 		case TOKEN_TO_DAEMON__CODE__UNLOCK_FAILED: {
 			audit_log_event(container_get_uuid(smartcard->container), FSA, CMLD,
 					TOKEN_MGMT, "unlock",
 					uuid_string(container_get_uuid(smartcard->container)), 0);
 			WARN("Unlocking the token failed.");
 			c_smartcard_error(smartcard, CONTAINER_SMARTCARD_UNLOCK_FAILED);
-			done = true;
 		} break;
 		case TOKEN_TO_DAEMON__CODE__PASSWD_WRONG: {
 			WARN("Unlocking the token failed (wrong PIN/passphrase).");
@@ -312,7 +506,6 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 					TOKEN_MGMT, "unlock-wrong-pin",
 					uuid_string(container_get_uuid(smartcard->container)), 0);
 			c_smartcard_error(smartcard, CONTAINER_SMARTCARD_PASSWD_WRONG);
-			done = true;
 		} break;
 		case TOKEN_TO_DAEMON__CODE__LOCKED_TILL_REBOOT: {
 			WARN("Unlocking the token failed (locked till reboot).");
@@ -320,7 +513,6 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 					TOKEN_MGMT, "locked-until-reboot",
 					uuid_string(container_get_uuid(smartcard->container)), 0);
 			c_smartcard_error(smartcard, CONTAINER_SMARTCARD_LOCKED_TILL_REBOOT);
-			done = true;
 		} break;
 
 		/*
@@ -334,8 +526,9 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 			if (container_get_state(smartcard->container) ==
 			    COMPARTMENT_STATE_RUNNING) {
 				/* in this case the token was checked to authorize container stop */
-				// just lock token again which triggers success_cb
-				c_smartcard_send_token_lock_cmd(smartcard);
+				// just lock token again and execute success_cb
+				c_smartcard_send_token_lock_cmd(smartcard, c_smartcard_lock_reply);
+				c_smartcard_ctrl_success(smartcard);
 				break;
 			}
 
@@ -378,7 +571,8 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 				out.token_uuid = mem_strdup(
 					uuid_string(container_get_uuid(smartcard->container)));
 
-				protobuf_send_message(smartcard->sock, (ProtobufCMessage *)&out);
+				if (c_smartcard_send(smartcard, &out, c_smartcard_ctrl_reply) < 0)
+					ERROR("Failed to request scd to unwrap the key");
 
 				//delete wrapped key from RAM
 				mem_memset0(key, sizeof(key));
@@ -390,7 +584,6 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 				if (!file_is_dir(smartcard->path) &&
 				    mkdir(smartcard->path, 00755) < 0) {
 					DEBUG_ERRNO("Could not mkdir %s", smartcard->path);
-					done = true;
 					break;
 				}
 				unsigned char key[TOKEN_KEY_LEN];
@@ -432,7 +625,8 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 				out.token_uuid = mem_strdup(
 					uuid_string(container_get_uuid(smartcard->container)));
 
-				protobuf_send_message(smartcard->sock, (ProtobufCMessage *)&out);
+				if (c_smartcard_send(smartcard, &out, c_smartcard_ctrl_reply) < 0)
+					ERROR("Failed to request scd to wrap the key");
 
 				// delete key from RAM
 				mem_memset0(key, sizeof(key));
@@ -452,9 +646,8 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 					TOKEN_MGMT, "unwrap-container-key",
 					uuid_string(container_get_uuid(smartcard->container)), 0);
 				c_smartcard_error(smartcard, CONTAINER_SMARTCARD_WRAPPING_ERROR);
-				// lock token via scd and unregister io callback to avoid to trigger success_cb
-				c_smartcard_send_token_lock_cmd(smartcard);
-				done = true;
+				// lock token via scd without triggering success_cb
+				c_smartcard_send_token_lock_cmd(smartcard, c_smartcard_lock_reply);
 				break;
 			}
 			// set the key
@@ -470,22 +663,13 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 			mem_memset0(msg->unwrapped_key.data, msg->unwrapped_key.len);
 			mem_free0(ascii_key);
 
-			// lock token via scd which will trigger success_cb
-			c_smartcard_send_token_lock_cmd(smartcard);
+			// lock token via scd and start with the key meanwhile
+			c_smartcard_send_token_lock_cmd(smartcard, c_smartcard_lock_reply);
+			c_smartcard_ctrl_success(smartcard);
 		} break;
 		case TOKEN_TO_DAEMON__CODE__WRAPPED_KEY: {
 			// lock token via scd
-			DaemonToToken out = DAEMON_TO_TOKEN__INIT;
-			out.code = DAEMON_TO_TOKEN__CODE__LOCK;
-
-			out.has_token_type = true;
-			out.token_type = c_smartcard_tokentype_to_proto(smartcard->token_type);
-
-			out.token_uuid =
-				mem_strdup(uuid_string(container_get_uuid(smartcard->container)));
-
-			protobuf_send_message(smartcard->sock, (ProtobufCMessage *)&out);
-			mem_free0(out.token_uuid);
+			c_smartcard_send_token_lock_cmd(smartcard, c_smartcard_lock_reply);
 			// save wrapped key
 			if (!msg->has_wrapped_key) {
 				audit_log_event(
@@ -494,7 +678,6 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 					uuid_string(container_get_uuid(smartcard->container)), 0);
 				ERROR("Expected wrapped key, but none was returned!");
 				c_smartcard_error(smartcard, CONTAINER_SMARTCARD_WRAPPING_ERROR);
-				done = true;
 				break;
 			}
 			ASSERT(msg->wrapped_key.len < TOKEN_MAX_WRAPPED_KEY_LEN);
@@ -522,31 +705,27 @@ c_smartcard_cb_ctrl_container(int fd, unsigned events, event_io_t *io, void *dat
 			// delete wrapped key from RAM
 			mem_memset0(msg->wrapped_key.data, msg->wrapped_key.len);
 			mem_free0(keyfile);
+
+			c_smartcard_ctrl_success(smartcard);
 		} break;
 		default:
 			ERROR("TokenToDaemon command %d unknown or not implemented yet", msg->code);
-			done = true;
 			break;
 		}
-		protobuf_free_message((ProtobufCMessage *)msg);
-
-		if (done) {
-			event_remove_io(io);
-			event_io_free(io);
-		}
 	}
 }
 
 static int
 c_smartcard_token_unlock_handler(c_smartcard_t *smartcard, const char *passwd,
-				 void (*cb)(int fd, unsigned events, event_io_t *io, void *data))
+				 void (*cb)(c_smartcard_t *smartcard, TokenToDaemon *msg))
 {
 	ASSERT(smartcard);
 	ASSERT(passwd);
 
 	int pair_sec_len;
 
-	if (!smartcard->is_init) {
+	// scd handles requests in order, thus a pending token add completes first
+	if (!smartcard->is_init && !smartcard->is_adding) {
 		audit_log_event(container_get_uuid(smartcard->container), FSA, CMLD, TOKEN_MGMT,
 				"token-uninitialized",
 				uuid_string(container_get_uuid(smartcard->container)), 0);
@@ -578,11 +757,6 @@ c_smartcard_token_unlock_handler(c_smartcard_t *smartcard, const char *passwd,
 			"read-pairing-secret",
 			uuid_string(container_get_uuid(smartcard->container)), 0);
 
-	// TODO register timer if socket does not respond
-	event_io_t *event = event_io_new(smartcard->sock, EVENT_IO_READ, cb, smartcard);
-
-	event_add_io(event);
-	DEBUG("SCD: Registered control container callback for key from scd");
 	// unlock token
 	DaemonToToken out = DAEMON_TO_TOKEN__INIT;
 	out.code = DAEMON_TO_TOKEN__CODE__UNLOCK;
@@ -595,7 +769,7 @@ c_smartcard_token_unlock_handler(c_smartcard_t *smartcard, const char *passwd,
 
 	out.token_uuid = mem_strdup(uuid_string(container_get_uuid(smartcard->container)));
 
-	if (LOGF_PRIO_TRACE >= LOGF_LOG_MIN_PRIO) {
+	if (logf_prio_enabled(LOGF_PRIO_TRACE)) {
 		char *msg_text;
 
 		size_t msg_len =
@@ -606,37 +780,27 @@ c_smartcard_token_unlock_handler(c_smartcard_t *smartcard, const char *passwd,
 			free(msg_text);
 	}
 
-	protobuf_send_message(smartcard->sock, (ProtobufCMessage *)&out);
+	int ret = c_smartcard_send(smartcard, &out, cb);
 	mem_memset0(out.token_pin, strlen(out.token_pin));
+	mem_memset0(out.pairing_secret.data, out.pairing_secret.len);
 	mem_free0(out.token_pin);
 	mem_free0(out.pairing_secret.data);
 	mem_free0(out.token_uuid);
 
-	return 0;
+	return ret;
 }
 
 static void
-c_smartcard_cb_container_change_pin(int fd, unsigned events, event_io_t *io, void *data)
+c_smartcard_change_pin_reply(c_smartcard_t *smartcard, TokenToDaemon *msg)
 {
-	c_smartcard_t *smartcard = data;
 	ASSERT(smartcard);
 
 	int rc = -1;
 	bool command_state = false;
 
-	if (events & EVENT_IO_READ) {
-		TokenToDaemon *msg =
-			(TokenToDaemon *)protobuf_recv_message(fd, &token_to_daemon__descriptor);
-		if (!msg) {
-			ERROR("Failed to receive message although EVENT_IO_READ was set. Aborting smartcard change_pin callback.");
-			event_remove_io(io);
-			event_io_free(io);
-			audit_log_event(container_get_uuid(smartcard->container), FSA, CMLD,
-					CONTAINER_MGMT, "container-change-pin",
-					uuid_string(container_get_uuid(smartcard->container)), 0);
-			c_smartcard_error(smartcard, CONTAINER_SMARTCARD_CHANGE_PIN_FAILED);
-			return;
-		}
+	if (!msg) {
+		ERROR("Failed to receive message from scd. Aborting smartcard change_pin.");
+	} else {
 		switch (msg->code) {
 		case TOKEN_TO_DAEMON__CODE__CHANGE_PIN_SUCCESSFUL: {
 			command_state = true;
@@ -668,22 +832,13 @@ c_smartcard_cb_container_change_pin(int fd, unsigned events, event_io_t *io, voi
 			      msg->code);
 			command_state = false;
 		}
+	}
 
-		audit_log_event(container_get_uuid(smartcard->container), command_state ? SSA : FSA,
-				CMLD, CONTAINER_MGMT, "container-change-pin",
-				uuid_string(container_get_uuid(smartcard->container)), 0);
-		c_smartcard_error(smartcard, command_state ?
-						     CONTAINER_SMARTCARD_CHANGE_PIN_SUCCESSFUL :
+	audit_log_event(container_get_uuid(smartcard->container), command_state ? SSA : FSA, CMLD,
+			CONTAINER_MGMT, "container-change-pin",
+			uuid_string(container_get_uuid(smartcard->container)), 0);
+	c_smartcard_error(smartcard, command_state ? CONTAINER_SMARTCARD_CHANGE_PIN_SUCCESSFUL :
 						     CONTAINER_SMARTCARD_CHANGE_PIN_FAILED);
-
-		protobuf_free_message((ProtobufCMessage *)msg);
-		event_remove_io(io);
-		event_io_free(io);
-	} else {
-		ERROR("Failed to receive message: EVENT_IO_EXCEPT. Aborting smartcard change_pin.");
-		event_remove_io(io);
-		event_io_free(io);
-	}
 }
 
 static int
@@ -712,11 +867,6 @@ c_smartcard_change_pin(void *smartcardp, const char *passwd, const char *newpass
 
 	is_provisioning = !c_smartcard_container_token_is_provisioned(smartcard);
 
-	event_io_t *event = event_io_new(smartcard->sock, EVENT_IO_READ,
-					 c_smartcard_cb_container_change_pin, smartcard);
-	event_add_io(event);
-	DEBUG("SCD: Registered smartcard_cb_container_change_pin container callback for scd");
-
 	DaemonToToken out = DAEMON_TO_TOKEN__INIT;
 	out.code = is_provisioning ? DAEMON_TO_TOKEN__CODE__PROVISION_PIN :
 				     DAEMON_TO_TOKEN__CODE__CHANGE_PIN;
@@ -733,7 +883,7 @@ c_smartcard_change_pin(void *smartcardp, const char *passwd, const char *newpass
 	out.pairing_secret.len = sizeof(pair_sec);
 	out.pairing_secret.data = mem_memcpy(pair_sec, sizeof(pair_sec));
 
-	ret = protobuf_send_message(smartcard->sock, (ProtobufCMessage *)&out);
+	ret = c_smartcard_send(smartcard, &out, c_smartcard_change_pin_reply);
 	mem_memset0(out.token_pin, strlen(out.token_pin));
 	mem_memset0(out.token_newpin, strlen(out.token_newpin));
 	mem_memset0(pair_sec, sizeof(pair_sec));
@@ -742,7 +892,7 @@ c_smartcard_change_pin(void *smartcardp, const char *passwd, const char *newpass
 	mem_free0(out.pairing_secret.data);
 	mem_free0(out.token_uuid);
 
-	return (ret > 0) ? 0 : -1;
+	return ret;
 }
 
 static int
@@ -762,12 +912,41 @@ c_smartcard_update_token_state(c_smartcard_t *smartcard)
 	return 0;
 }
 
+static void
+c_smartcard_scd_token_add_reply(c_smartcard_t *smartcard, TokenToDaemon *msg)
+{
+	ASSERT(smartcard);
+
+	smartcard->is_adding = false;
+	smartcard->is_init = false;
+
+	if (!msg) {
+		ERROR("Failed to receive reply of scd. Aborting token init for container %s",
+		      container_get_name(smartcard->container));
+		return;
+	}
+
+	switch (msg->code) {
+	case TOKEN_TO_DAEMON__CODE__TOKEN_ADD_SUCCESSFUL: {
+		TRACE("CMLD: smartcard_scd_token_add: token in scd created successfully");
+		DEBUG("Initialized token for container %s",
+		      container_get_name(smartcard->container));
+		smartcard->is_init = true;
+	} break;
+	case TOKEN_TO_DAEMON__CODE__TOKEN_ADD_FAILED: {
+		ERROR("Creating scd token structure failed");
+	} break;
+	default:
+		ERROR("TokenToDaemon command %d not expected as answer to token_add", msg->code);
+	}
+}
+
 /**
- * we cannot queue several events with the same fd.
- * therefore, we use a blocking method to query the scd to initialize a token.
+ * Requests the scd to add the token associated to the container to its list. The reply is
+ * handled asynchronously, until then, smartcard->is_adding is set.
  */
 static int
-c_smartcard_scd_token_add_block(c_smartcard_t *smartcard)
+c_smartcard_scd_token_add(c_smartcard_t *smartcard)
 {
 	ASSERT(smartcard);
 	container_t *container = smartcard->container;
@@ -794,36 +973,46 @@ c_smartcard_scd_token_add_block(c_smartcard_t *smartcard)
 		out.usbtoken_serial = smartcard->token_serial;
 	}
 
-	TokenToDaemon *msg = c_smartcard_send_recv_block(&out);
+	rc = c_smartcard_send(smartcard, &out, c_smartcard_scd_token_add_reply);
+	if (!rc)
+		smartcard->is_adding = true;
+
+err:
+	mem_free0(out.token_uuid);
+	return rc;
+}
+
+static void
+c_smartcard_scd_token_remove_reply(c_smartcard_t *smartcard, TokenToDaemon *msg)
+{
+	ASSERT(smartcard);
+
 	if (!msg) {
-		ERROR("Failed to receive message although EVENT_IO_READ was set. Aborting smartcard_scd_token_block_new.");
-		goto err;
+		ERROR("Failed to receive reply of scd to remove the token of container %s",
+		      container_get_name(smartcard->container));
+		return;
 	}
 
 	switch (msg->code) {
-	case TOKEN_TO_DAEMON__CODE__TOKEN_ADD_SUCCESSFUL: {
-		TRACE("CMLD: smartcard_scd_token_block_new: token in scd created successfully");
-		smartcard->is_init = true;
-		rc = 0;
-	} break;
-	case TOKEN_TO_DAEMON__CODE__TOKEN_ADD_FAILED: {
+	case TOKEN_TO_DAEMON__CODE__TOKEN_REMOVE_SUCCESSFUL: {
+		TRACE("CMLD: smartcard_scd_token_remove: token in scd removed successfully");
 		smartcard->is_init = false;
-		ERROR("Creating scd token structure failed");
+	} break;
+	case TOKEN_TO_DAEMON__CODE__TOKEN_REMOVE_FAILED: {
+		ERROR("Removing scd token structure failed");
 	} break;
 	default:
-		smartcard->is_init = false;
-		ERROR("TokenToDaemon command %d not expected as answer to change_pin", msg->code);
+		ERROR("TokenToDaemon command %d not expected as answer to token_remove", msg->code);
 	}
-
-	protobuf_free_message((ProtobufCMessage *)msg);
-
-err:
-	mem_free0(out.token_uuid);
-	return rc;
 }
 
+/**
+ * Requests the scd to remove the token associated to the container from its list.
+ * If block is set, this waits for the reply of scd. This is only used on teardown of
+ * the smartcard, when the event loop might no longer dispatch the reply.
+ */
 static int
-c_smartcard_scd_token_remove_block(c_smartcard_t *smartcard)
+c_smartcard_scd_token_remove(c_smartcard_t *smartcard, bool block)
 {
 	ASSERT(smartcard);
 	container_t *container = smartcard->container;
@@ -832,6 +1021,8 @@ c_smartcard_scd_token_remove_block(c_smartcard_t *smartcard)
 	      uuid_string(container_get_uuid(container)));
 	ASSERT(container);
 
+	int rc = 0;
+
 	DaemonToToken out = DAEMON_TO_TOKEN__INIT;
 	out.code = DAEMON_TO_TOKEN__CODE__TOKEN_REMOVE;
 
@@ -840,28 +1031,21 @@ c_smartcard_scd_token_remove_block(c_smartcard_t *smartcard)
 	out.has_token_type = true;
 	out.token_type = c_smartcard_tokentype_to_proto(smartcard->token_type);
 
-	TokenToDaemon *msg = c_smartcard_send_recv_block(&out);
-	if (!msg) {
-		ERROR("Failed to receive message although EVENT_IO_READ was set. Aborting smartcard_scd_token_block_new.");
-		mem_free0(out.token_uuid);
-		return -1;
-	}
-
-	switch (msg->code) {
-	case TOKEN_TO_DAEMON__CODE__TOKEN_REMOVE_SUCCESSFUL: {
-		TRACE("CMLD: smartcard_scd_token_block_remove: token in scd removed successfully");
-		smartcard->is_init = false;
-	} break;
-	case TOKEN_TO_DAEMON__CODE__TOKEN_REMOVE_FAILED: {
-		ERROR("Removing scd token structure failed");
-	} break;
-	default:
-		ERROR("TokenToDaemon command %d not expected as answer to change_pin", msg->code);
+	if (block) {
+		TokenToDaemon *msg = c_smartcard_send_recv_block(&out);
+		if (msg) {
+			c_smartcard_scd_token_remove_reply(smartcard, msg);
+			protobuf_free_message((ProtobufCMessage *)msg);
+		} else {
+			ERROR("Failed to receive reply of scd to token_remove");
+			rc = -1;
+		}
+	} else {
+		rc = c_smartcard_send(smartcard, &out, c_smartcard_scd_token_remove_reply);
 	}
 
 	mem_free0(out.token_uuid);
-	protobuf_free_message((ProtobufCMessage *)msg);
-	return 0;
+	return rc;
 }
 
 /**
@@ -881,15 +1065,13 @@ c_smartcard_token_init(c_smartcard_t *smartcard)
 		return 0;
 	}
 
-	DEBUG("Invoking container_scd_token_add_block() for container %s",
+	DEBUG("Invoking container_scd_token_add() for container %s",
 	      container_get_name(smartcard->container));
-	if (c_smartcard_scd_token_add_block(smartcard) != 0) {
+	if (c_smartcard_scd_token_add(smartcard) != 0) {
 		ERROR("Requesting SCD to init token failed");
 		return -1;
 	}
 
-	DEBUG("Initialized token for container %s", container_get_name(smartcard->container));
-
 	c_smartcard_update_token_state(smartcard);
 
 	return 0;
@@ -940,7 +1122,7 @@ c_smartcard_token_detach(void *smartcardp)
 		ERROR("Could not stop container after token detachment.");
 	}
 
-	if (c_smartcard_scd_token_remove_block(smartcard)) {
+	if (c_smartcard_scd_token_remove(smartcard, false)) {
 		ERROR("Failed to notify scd about token detachment");
 	}
 
@@ -1021,7 +1203,7 @@ c_smartcard_container_ctrl(void *smartcardp, int (*success_cb)(container_t *cont
 	ASSERT(smartcard);
 
 	smartcard->success_cb = success_cb;
-	return c_smartcard_token_unlock_handler(smartcard, passwd, c_smartcard_cb_ctrl_container);
+	return c_smartcard_token_unlock_handler(smartcard, passwd, c_smartcard_ctrl_reply);
 }
 
 static int
@@ -1079,8 +1261,8 @@ c_smartcard_new(compartment_t *compartment)
 	smartcard->err_cb = NULL;
 	smartcard->err_cbdata = NULL;
 
-	smartcard->sock = sock_unix_create_and_connect(SOCK_SEQPACKET, scd_sock_path);
-	if (smartcard->sock < 0) {
+	if (!c_smartcard_conn_get(smartcard)) {
+		mem_free0(smartcard->token_serial);
 		mem_free0(smartcard);
 		ERROR("Failed to connect to scd");
 		return NULL;
@@ -1107,14 +1289,14 @@ c_smartcard_free(void *smartcardp)
 	IF_NULL_RETURN(smartcard);
 
 	if (smartcard->token_type == CONTAINER_TOKEN_TYPE_USB) {
-		if (c_smartcard_scd_token_remove_block(smartcard)) {
+		if (c_smartcard_scd_token_remove(smartcard, true)) {
 			WARN("Cannot remove USB token for container %s",
 			     container_get_name(smartcard->container));
 		}
 	}
 
 	/* release scd connection */
-	close(smartcard->sock);
+	c_smartcard_conn_free(smartcard);
 
 	if (smartcard->token_serial)
 		mem_free0(smartcard->token_serial);
@@ -1147,7 +1329,7 @@ c_smartcard_destroy(void *smartcardp)
 	}
 
 	if (smartcard->is_init) {
-		if (c_smartcard_scd_token_remove_block(smartcard))
+		if (c_smartcard_scd_token_remove(smartcard, false))
 			WARN("Cannot remove token for container %s",
 			     container_get_name(smartcard->container));
 	}
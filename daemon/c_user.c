@@ -37,6 +37,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "common/bitmap.h"
 #include "common/macro.h"
 #include "common/mem.h"
 #include "common/file.h"
@@ -50,6 +51,8 @@
 #define UID_MAX 65535
 #define MAX_UID_RANGES ((int)((UINT_MAX - UID_RANGES_START) / UID_RANGE))
 
+#define C_USER_UID_OFFSETS_FILE "uid_offsets"
+
 /* Paths for controling mappings */
 #define C_USER_UID_MAP_PATH "/proc/%d/uid_map"
 #define C_USER_GID_MAP_PATH "/proc/%d/gid_map"
@@ -67,15 +70,54 @@ typedef struct c_user {
 } c_user_t;
 
 /**
- * bool array, which globally holds assigend ranges in order to
+ * Bitmap, which globally holds assigend ranges in order to
  * determine a new offset for a starting container.
- * uid_offsets[i]==true means that a container holds this offset to get its
+ * A set bit i means that a running container holds this offset to get its
  * specific uid range
  */
-static bool *uid_offsets = NULL;
+static bitmap_t *uid_offsets = NULL;
+
+/**
+ * Bitmap of the offsets stored in the uid files of all containers, running or not,
+ * which is persisted in C_USER_UID_OFFSETS_FILE. New containers get offsets which are
+ * not stored for any other container. Thus, a container does not lose its offset
+ * to another one while it is stopped, which would shift its files to the new range
+ * on its next start, and the uid files of the containers need not be read at startup.
+ */
+static bitmap_t *uid_offsets_stored = NULL;
+
+static char *
+c_user_offsets_file_new(void)
+{
+	return mem_printf("%s/%s", cmld_get_cmld_dir(), C_USER_UID_OFFSETS_FILE);
+}
+
+static void
+c_user_offsets_init(void)
+{
+	IF_TRUE_RETURN(uid_offsets);
+
+	uid_offsets = bitmap_new(MAX_UID_RANGES);
+
+	char *file = c_user_offsets_file_new();
+	if (file_exists(file) && !(uid_offsets_stored = bitmap_new_from_file(file, MAX_UID_RANGES)))
+		WARN("Failed to restore stored uid offsets from %s", file);
+	if (!uid_offsets_stored)
+		uid_offsets_stored = bitmap_new(MAX_UID_RANGES);
+	mem_free0(file);
+}
+
+static void
+c_user_offsets_store(void)
+{
+	char *file = c_user_offsets_file_new();
+	if (bitmap_write(uid_offsets_stored, file))
+		WARN("Failed to store uid offsets to %s", file);
+	mem_free0(file);
+}
 
 /**
- * sets the offset at the specified position to false.
+ * clears the offset at the specified position.
  * indicates that a container releases its addresses.
  */
 static void
@@ -85,52 +127,53 @@ c_user_unset_offset(int offset)
 	TRACE("UID offset %d released by a container", offset);
 	IF_TRUE_RETURN(offset == -1);
 
-	uid_offsets[offset] = false;
+	bitmap_clear(uid_offsets, offset);
 }
 
 /**
- * determines first free slot and occupies it. Also responsible for allocating the offsets array.
+ * determines first free slot, which is not stored for any other container, and occupies it.
+ * Also responsible for allocating the offsets bitmaps.
  * @return failure, return -1, else return first free offset
  */
 static int
 c_user_set_next_offset(void)
 {
-	if (!uid_offsets) {
-		uid_offsets = mem_new0(bool, MAX_UID_RANGES);
-		uid_offsets[0] = true;
-		TRACE("UID offset 0 ocupied by a container");
-		return 0;
-	}
+	c_user_offsets_init();
 
-	for (int i = 0; i < MAX_UID_RANGES; i++) {
-		if (!uid_offsets[i]) {
-			TRACE("UID offset %d occupied by a container", i);
-			uid_offsets[i] = true;
-			return i;
-		}
+	int offset = bitmap_set_next(uid_offsets_stored);
+	// skip offsets which are held but not stored, e.g., if the stored offsets were lost
+	while (offset >= 0 && bitmap_set(uid_offsets, offset))
+		offset = bitmap_set_next(uid_offsets_stored);
+
+	if (offset < 0) {
+		DEBUG("Unable to provide a valid uid/gid range for c_user");
+		return -1;
 	}
 
-	DEBUG("Unable to provide a valid uid/gid range for c_user");
-	return -1;
+	c_user_offsets_store();
+	TRACE("UID offset %d occupied by a container", offset);
+	return offset;
 }
 
 /**
- * determines first free slot and occupies it. Also responsible for allocating the offsets array.
+ * occupies the requested offset. Also responsible for allocating the offsets bitmaps.
  * @return failure, return -1, else return the requested offest if its free
  */
 static int
 c_user_set_offset(int offset)
 {
-	if (!uid_offsets)
-		uid_offsets = mem_new0(bool, MAX_UID_RANGES);
+	c_user_offsets_init();
 
-	if (uid_offsets[offset]) {
-		ERROR("UID offset %d allready taken by a container", offset);
+	if (bitmap_set(uid_offsets, offset)) {
+		ERROR("UID offset %d allready taken by a container or invalid", offset);
 		return -1;
 	}
 
+	// uid files which were written before the offsets were stored
+	if (!bitmap_set(uid_offsets_stored, offset))
+		c_user_offsets_store();
+
 	TRACE("UID offset %d now occupied by a container", offset);
-	uid_offsets[offset] = true;
 	return offset;
 }
 
@@ -211,26 +254,32 @@ c_user_setup_mapping(pid_t pid, int uid_start, int uid_range)
 
 	char *uid_map_path = mem_printf(C_USER_UID_MAP_PATH, pid);
 	char *gid_map_path = mem_printf(C_USER_GID_MAP_PATH, pid);
-
-	// write mapping to proc
-	if (file_printf(uid_map_path, "%s", uid_mapping) == -1) {
+	char *proc_pid_path = mem_printf("/proc/%d", pid);
+	int ret = -1;
+
+	// write mapping to proc, each map has to be written with a single write
+	int proc_fd = open(proc_pid_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (proc_fd < 0) {
+		ERROR_ERRNO("Failed to open %s", proc_pid_path);
+		goto out;
+	}
+	if (file_write_at(proc_fd, "uid_map", uid_mapping, -1) == -1) {
 		ERROR_ERRNO("Failed to write to %s", uid_map_path);
-		goto error;
+		goto out;
 	}
-	if (file_printf(gid_map_path, "%s", uid_mapping) == -1) {
+	if (file_write_at(proc_fd, "gid_map", uid_mapping, -1) == -1) {
 		ERROR_ERRNO("Failed to write to %s", gid_map_path);
-		goto error;
+		goto out;
 	}
-
-	mem_free0(uid_mapping);
-	mem_free0(uid_map_path);
-	mem_free0(gid_map_path);
-	return 0;
-error:
+	ret = 0;
+out:
+	if (proc_fd >= 0)
+		close(proc_fd);
 	mem_free0(uid_mapping);
 	mem_free0(uid_map_path);
 	mem_free0(gid_map_path);
-	return -1;
+	mem_free0(proc_pid_path);
+	return ret;
 }
 
 /**
@@ -271,6 +320,16 @@ c_user_destroy(void *usr)
 	ASSERT(user);
 
 	char *file_name_uid = c_user_uid_file_new(user);
+	int offset = -1;
+	if (file_exists(file_name_uid) &&
+	    file_read(file_name_uid, (char *)&offset, sizeof(offset)) == sizeof(offset)) {
+		// release the stored offset unless it is held by another container
+		c_user_offsets_init();
+		if (offset >= 0 && !bitmap_test(uid_offsets, offset)) {
+			bitmap_clear(uid_offsets_stored, offset);
+			c_user_offsets_store();
+		}
+	}
 	if (file_exists(file_name_uid))
 		if (0 != unlink(file_name_uid)) {
 			ERROR_ERRNO("Can't delete %s file!", file_name_uid);
@@ -476,6 +535,7 @@ static compartment_module_t c_user_module = {
 	.stop = c_user_stop,
 	.cleanup = c_user_cleanup,
 	.join_ns = c_user_join_userns,
+	.flags = COMPARTMENT_MODULE_F_ASYNC_POST_CLONE,
 };
 
 static void INIT
@@ -51,6 +51,11 @@
 #include "common/str.h"
 #include "common/dm.h"
 #include "common/event.h"
+#include "common/probe.h"
+#include "common/hashmap.h"
+#include "common/list.h"
+#include "common/hex.h"
+#include "common/zram.h"
 
 #include "cmld.h"
 #include "guestos.h"
@@ -58,18 +63,25 @@
 #include "lxcfs.h"
 #include "audit.h"
 #include "verity.h"
+#include "bootprof.h"
+#include "tss.h"
 
 #include <unistd.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/sysmacros.h>
+#include <sys/random.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <linux/fs.h>
 
 #define MAKE_EXT4FS "mkfs.ext4"
 #define BTRFSTUNE "btrfstune"
@@ -79,6 +91,9 @@
 #define SHARED_FILES_PATH DEFAULT_BASE_PATH "/files_shared"
 #define SHARED_FILES_STORE_SIZE 100
 
+// number of threads setting up the block devices of the mount entries
+#define C_VOL_SETUP_JOBS 4
+
 #define BUSYBOX_PATH "/bin/busybox"
 
 #ifndef FALLOC_FL_ZERO_RANGE
@@ -92,10 +107,101 @@ typedef struct c_vol {
 	const guestos_t *os;
 	mount_t *mnt;
 	mount_t *mnt_setup;
+	event_timer_t *keep_timer; // removes the block devices kept after a stop
+	lxcfs_proc_overlay_t *lxcfs_overlay; // prepared before the clone, attached in child
+	list_t *verity_refs; // labels of the referenced shared dm-verity devices
+	list_t *shared_mounts; // directories of the referenced host mounts of shared images
+	pthread_t teardown_thread; // removes the dm devices after a stop in background
+	bool teardown_joinable;
+	list_t *zram_devs; // c_vol_zram_t of the ephemeral volumes, see c_vol_zram_get()
 } c_vol_t;
 
+/*
+ * The zram devices of the ephemeral volumes are created by cmld before the clone and
+ * removed after the stop, thus the early child only formats them.
+ */
+typedef struct c_vol_zram {
+	char *img; // image name of the mount entry
+	char *dev;
+} c_vol_zram_t;
+
+/*
+ * The dm-verity devices are shared by all containers using the same image with the same
+ * root hash. Since the devices are set up in the early child, their references are
+ * counted in cmld by c_vol_verity_refs_get() and c_vol_verity_refs_put(). Maps the
+ * labels of the devices to their c_vol_verity_ref_t.
+ */
+static hashmap_t *c_vol_verity_refs = NULL;
+
+typedef struct c_vol_verity_ref {
+	char *label;
+	unsigned int count;
+} c_vol_verity_ref_t;
+
+/*
+ * The shared images without dm-verity are mounted once read-only by cmld below
+ * C_VOL_SHARED_MOUNT_PATH and bind mounted into all containers using them, thus all
+ * containers share the superblock and the page cache of the image instead of reading
+ * it through their own loop devices. Maps the mount directories to their references.
+ */
+#define C_VOL_SHARED_MOUNT_PATH "/tmp/cml-shared"
+
+static hashmap_t *c_vol_shared_mounts = NULL;
+
+typedef struct c_vol_shared_mount {
+	char *dir;
+	unsigned int count;
+} c_vol_shared_mount_t;
+
+/**
+ * A mount entry of the container together with its block device stack, which is
+ * set up concurrently for all entries before they are mounted in order.
+ */
+typedef struct c_vol_image_dev {
+	const mount_entry_t *mntent;
+	const char *root; // directory where the root file system is mounted
+	char *dev;	  // top device of the stack
+	int fd;		  // keeps the autoclear loop device attached until mounted
+	bool new_image;
+	bool host_shared; // dev is the directory of the host mount of a shared image
+} c_vol_image_dev_t;
+
+typedef struct c_vol_setup_job {
+	c_vol_t *vol;
+	c_vol_image_dev_t *devs;
+	size_t n;
+	pthread_mutex_t lock; // protects next and abort
+	size_t next;
+	bool abort;
+} c_vol_setup_job_t;
+
 /******************************************************************************/
 
+static bool
+c_vol_mount_entry_is_zram(const mount_entry_t *mntent)
+{
+	return mount_entry_get_type(mntent) == MOUNT_TYPE_EPHEMERAL &&
+	       strcmp(mount_entry_get_fs(mntent), "tmpfs") != 0;
+}
+
+/**
+ * Returns the device of an ephemeral volume, i.e., "tmpfs" or its zram device.
+ */
+static char *
+c_vol_ephemeral_path_new(c_vol_t *vol, const mount_entry_t *mntent)
+{
+	if (!c_vol_mount_entry_is_zram(mntent))
+		return mem_strdup("tmpfs");
+
+	for (list_t *l = vol->zram_devs; l; l = l->next) {
+		c_vol_zram_t *zram = l->data;
+		if (!strcmp(zram->img, mount_entry_get_img(mntent)))
+			return mem_strdup(zram->dev);
+	}
+	ERROR("No zram device for ephemeral volume %s", mount_entry_get_img(mntent));
+	return NULL;
+}
+
 /**
  * Allocate a new string with the full image path for one mount point.
  * TODO store img_path in mount_entry_t instances themselves?
@@ -130,6 +236,9 @@ c_vol_image_path_new(c_vol_t *vol, const mount_entry_t *mntent)
 	case MOUNT_TYPE_BIND_DIR:
 		// Note: We just bind mount any absolut path of the host
 		return mem_strdup(mount_entry_get_img(mntent));
+	case MOUNT_TYPE_EPHEMERAL:
+		// there is no image file, but a tmpfs or a zram device
+		return c_vol_ephemeral_path_new(vol, mntent);
 	default:
 		ERROR("Unsupported operating system mount type %d for %s",
 		      mount_entry_get_type(mntent), mount_entry_get_img(mntent));
@@ -223,30 +332,23 @@ c_vol_create_sparse_file(const char *img, off64_t storage_size)
 		return -1;
 	}
 
-	// create a sparse file without writing any data
-	if (ftruncate64(fd, storage_size) < 0) {
-		ERROR_ERRNO("Could not ftruncate image file %s", img);
-		close(fd);
-		return -1;
-	}
-
-	if (lseek64(fd, storage_size - 1, SEEK_SET) < 0) {
-		ERROR_ERRNO("Could not lseek image file %s", img);
-		close(fd);
-		return -1;
-	}
-
-	if (write(fd, "\0", 1) < 1) {
-		ERROR_ERRNO("Could not write to image file %s", img);
-		close(fd);
-		return -1;
-	}
-
-	// also allocate with  zeros for dm-integrity
-	if (fallocate(fd, FALLOC_FL_ZERO_RANGE, 0, storage_size)) {
-		ERROR_ERRNO("Could not write to image file %s", img);
-		close(fd);
-		return -1;
+	/*
+	 * Reserve the blocks as unwritten extents, which read as zeros without being
+	 * written, thus the file takes no time to be created, but later writes to it do not
+	 * fail for lack of space. On file systems without fallocate, fall back to a sparse file.
+	 */
+	if (fallocate(fd, 0, 0, storage_size) < 0) {
+		if (errno != EOPNOTSUPP) {
+			ERROR_ERRNO("Could not allocate image file %s", img);
+			close(fd);
+			return -1;
+		}
+		DEBUG("fallocate not supported for %s, creating a sparse file", img);
+		if (ftruncate64(fd, storage_size) < 0) {
+			ERROR_ERRNO("Could not ftruncate image file %s", img);
+			close(fd);
+			return -1;
+		}
 	}
 
 	close(fd);
@@ -489,19 +591,28 @@ c_vol_mount_overlay(c_vol_t *vol, const char *target_dir, const char *upper_fsty
 			goto error;
 		}
 		TRACE("Mounting dev %s type %s to dir %s", lower_dev, lower_dir, lowerfs_type);
-		// mount ro image lower
 
-		while (access(lower_dev, F_OK) < 0) {
-			NANOSLEEP(0, 100000000);
-			DEBUG("Waiting for %s", lower_dev);
-		}
+		if (file_is_dir(lower_dev)) {
+			// shared image mounted by cmld, see c_vol_shared_mounts_get()
+			if (mount(lower_dev, lower_dir, NULL, MS_BIND, NULL) < 0) {
+				ERROR_ERRNO("Could not bind mount %s to %s", lower_dev, lower_dir);
+				goto error;
+			}
+			DEBUG("Successfully bind mounted %s to %s", lower_dev, lower_dir);
+		} else {
+			// mount ro image lower
+			while (access(lower_dev, F_OK) < 0) {
+				NANOSLEEP(0, 100000000);
+				DEBUG("Waiting for %s", lower_dev);
+			}
 
-		if (mount(lower_dev, lower_dir, lowerfs_type, mount_flags | MS_RDONLY, mount_data) <
-		    0) {
-			ERROR_ERRNO("Could not mount %s to %s", lower_dev, lower_dir);
-			goto error;
+			if (mount(lower_dev, lower_dir, lowerfs_type, mount_flags | MS_RDONLY,
+				  mount_data) < 0) {
+				ERROR_ERRNO("Could not mount %s to %s", lower_dev, lower_dir);
+				goto error;
+			}
+			DEBUG("Successfully mounted %s to %s", lower_dev, lower_dir);
 		}
-		DEBUG("Successfully mounted %s to %s", lower_dev, lower_dir);
 	} else {
 		lower_dir = mem_strdup(target_dir);
 	}
@@ -619,39 +730,48 @@ c_vol_mount_dir_bind(const char *src, const char *dst, unsigned long flags)
 }
 
 /*
- * Copy busybox binary to target_base directory.
- * Remeber, this will only succeed if targetfs is writable.
+ * Bind mounts the helper binary host_bin of the host read-only to target_bin. All containers
+ * share the same inode and thus its page cache, and nothing is written to their rootfs.
+ * Remember, if target_bin does not exist, this will only succeed if targetfs is writable.
+ */
+static int
+c_vol_bind_helper(const char *host_bin, const char *target_bin)
+{
+	IF_FALSE_RETVAL_TRACE(file_exists(host_bin), -1);
+
+	if (c_vol_mount_file_bind(host_bin, target_bin,
+				  MS_BIND | MS_RDONLY | MS_NOSUID | MS_NODEV) < 0) {
+		WARN("Could not bind mount %s to container", target_bin);
+		return -1;
+	}
+	INFO("Bind mounted %s to container", target_bin);
+	return 0;
+}
+
+/*
+ * Provide the busybox binary of the host in target_base directory.
  */
 static int
-c_vol_setup_busybox_copy(const char *target_base)
+c_vol_setup_busybox_bind(const char *target_base)
 {
 	int ret = 0;
 	char *target_bin = mem_printf("%s%s", target_base, BUSYBOX_PATH);
-	char *target_dir = mem_strdup(target_bin);
-	char *target_dir_p = dirname(target_dir);
-	if ((ret = dir_mkdir_p(target_dir_p, 0755)) < 0) {
-		WARN_ERRNO("Could not mkdir '%s' dir", target_dir_p);
-	} else if (file_exists("/bin/busybox")) {
-		file_copy("/bin/busybox", target_bin, -1, 512, 0);
-		INFO("Copied %s to container", target_bin);
-		if (chmod(target_bin, 0755)) {
-			WARN_ERRNO("Could not set %s executable", target_bin);
-			ret = -1;
-		}
-	} else {
-		WARN_ERRNO("Could not copy %s to container", target_bin);
+
+	if (!file_exists(BUSYBOX_PATH)) {
+		WARN("Could not provide %s to container, not found on host", target_bin);
 		ret = -1;
+	} else {
+		ret = c_vol_bind_helper(BUSYBOX_PATH, target_bin);
 	}
 
 	mem_free0(target_bin);
-	mem_free0(target_dir);
 	return ret;
 }
 
 static int
 c_vol_setup_busybox_install(void)
 {
-	// skip if busybox was not coppied
+	// skip if busybox was not provided
 	IF_FALSE_RETVAL_TRACE(file_exists("/bin/busybox"), 0);
 
 	IF_TRUE_RETVAL(dir_mkdir_p("/bin", 0755) < 0, -1);
@@ -662,118 +782,410 @@ c_vol_setup_busybox_install(void)
 }
 
 /**
- * Mount an image file. This function will take some time. So call it in a
- * thread or child process.
- * @param vol The vol struct for the container.
- * @param root The directory where the root file system should be mounted.
- * @param mntent The information for this mount.
- * @return -1 on error else 0.
+ * Returns true if the image of a mount entry is mounted through a block device stack
+ * which has to be set up by c_vol_setup_image_dev() before mounting.
  */
-static int
-c_vol_mount_image(c_vol_t *vol, const char *root, const mount_entry_t *mntent)
+static bool
+c_vol_mount_entry_needs_dev(const mount_entry_t *mntent)
 {
-	char *img, *dev, *img_meta, *dev_meta, *dir, *img_hash;
-	int fd = 0, fd_meta = 0;
-	bool new_image = false;
-	bool encrypted = mount_entry_is_encrypted(mntent);
-	bool overlay = false;
-	bool shiftids = false;
-	bool verity = mount_entry_get_verity_sha256(mntent) != NULL;
-	bool is_root = strcmp(mount_entry_get_dir(mntent), "/") == 0;
-	bool setup_mode = container_has_setup_mode(vol->container);
+	switch (mount_entry_get_type(mntent)) {
+	case MOUNT_TYPE_SHARED:
+	case MOUNT_TYPE_DEVICE:
+	case MOUNT_TYPE_OVERLAY_RO:
+	case MOUNT_TYPE_SHARED_RW:
+	case MOUNT_TYPE_OVERLAY_RW:
+	case MOUNT_TYPE_DEVICE_RW:
+	case MOUNT_TYPE_EMPTY:
+	case MOUNT_TYPE_COPY:
+	case MOUNT_TYPE_EPHEMERAL:
+		return strcmp(mount_entry_get_fs(mntent), "tmpfs") != 0;
+	default:
+		return false;
+	}
+}
 
-	// default mountflags for most image types
-	unsigned long mountflags = setup_mode ? MS_NOATIME : MS_NOATIME | MS_NODEV;
+/**
+ * Returns the label of the shared dm-verity device of a mount entry, which does not
+ * contain the container's uuid unlike the labels of the other devices.
+ */
+static char *
+c_vol_verity_label_new(const mount_entry_t *mntent)
+{
+	return mem_printf("%s-%s", mount_entry_get_img(mntent),
+			  mount_entry_get_verity_sha256(mntent));
+}
 
-	img = dev = img_meta = dev_meta = dir = img_hash = NULL;
+static void
+c_vol_verity_refs_get_mount(c_vol_t *vol, const mount_t *mnt)
+{
+	for (size_t i = 0; i < mount_get_count(mnt); i++) {
+		const mount_entry_t *mntent = mount_get_entry(mnt, i);
+		if (!mount_entry_get_verity_sha256(mntent))
+			continue;
 
-	if (mount_entry_get_dir(mntent)[0] == '/')
-		dir = mem_printf("%s%s", root, mount_entry_get_dir(mntent));
-	else
-		dir = mem_printf("%s/%s", root, mount_entry_get_dir(mntent));
+		char *label = c_vol_verity_label_new(mntent);
+		c_vol_verity_ref_t *ref = hashmap_get(c_vol_verity_refs, label);
+		if (!ref) {
+			ref = mem_new0(c_vol_verity_ref_t, 1);
+			ref->label = mem_strdup(label);
+			hashmap_put(c_vol_verity_refs, ref->label, ref);
+		}
+		ref->count++;
+		TRACE("Shared dm-verity device %s has %u reference(s)", label, ref->count);
+		vol->verity_refs = list_append(vol->verity_refs, label);
+	}
+}
 
-	img = c_vol_image_path_new(vol, mntent);
-	if (!img)
-		goto error;
+/*
+ * Takes the references of the container to the shared dm-verity devices of its images,
+ * unless they are still held from the last run.
+ */
+static void
+c_vol_verity_refs_get(c_vol_t *vol)
+{
+	IF_TRUE_RETURN(vol->verity_refs);
 
-	TRACE("Mount entry type: %d", mount_entry_get_type(mntent));
+	if (!c_vol_verity_refs)
+		c_vol_verity_refs = hashmap_new_str();
 
+	if (container_has_setup_mode(vol->container))
+		c_vol_verity_refs_get_mount(vol, vol->mnt_setup);
+	c_vol_verity_refs_get_mount(vol, vol->mnt);
+}
+
+/*
+ * Drops the references of the container to the shared dm-verity devices and removes
+ * the devices which are not used by any other container anymore.
+ */
+static void
+c_vol_verity_refs_put(c_vol_t *vol)
+{
+	for (list_t *l = vol->verity_refs; l; l = l->next) {
+		char *label = l->data;
+		c_vol_verity_ref_t *ref = hashmap_get(c_vol_verity_refs, label);
+		if (ref && --ref->count > 0) {
+			DEBUG("Shared dm-verity device %s still used by %u container(s)", label,
+			      ref->count);
+			mem_free0(label);
+			continue;
+		}
+		if (ref) {
+			hashmap_remove(c_vol_verity_refs, label);
+			mem_free0(ref->label);
+			mem_free0(ref);
+		}
+
+		char *dev = verity_get_device_path_new(label);
+		if (file_is_blk(dev) || file_links_to_blk(dev)) {
+			DEBUG("Removing shared dm-verity device %s", label);
+			if (verity_delete_blk_dev(label) < 0)
+				WARN("Could not delete dm-verity dev %s", label);
+		}
+		mem_free0(dev);
+		mem_free0(label);
+	}
+	list_delete(vol->verity_refs);
+	vol->verity_refs = NULL;
+}
+
+/*
+ * Raises the readahead of the device of a compressed read-only image to the block size
+ * of its file system, if known, so that a compressed block is read in one request.
+ */
+static void
+c_vol_set_readahead(const char *dev, const mount_entry_t *mntent)
+{
+	unsigned long sectors = mount_entry_get_block_size(mntent) / 512;
+	long readahead = 0;
+	int fd;
+
+	IF_TRUE_RETURN(sectors == 0);
+
+	if ((fd = open(dev, O_RDONLY | O_CLOEXEC)) < 0) {
+		WARN_ERRNO("Could not open %s to set its readahead", dev);
+		return;
+	}
+	if (ioctl(fd, BLKRAGET, &readahead) < 0) {
+		WARN_ERRNO("Could not get the readahead of %s", dev);
+	} else if ((unsigned long)readahead < sectors) {
+		if (ioctl(fd, BLKRASET, sectors) < 0)
+			WARN_ERRNO("Could not set the readahead of %s", dev);
+		else
+			DEBUG("Set the readahead of %s to %lu sectors", dev, sectors);
+	}
+	close(fd);
+}
+
+/*
+ * Returns true if the image of the mount entry is mounted once on the host and
+ * shared by bind mounts, see C_VOL_SHARED_MOUNT_PATH.
+ */
+static bool
+c_vol_mount_entry_is_host_shared(const mount_entry_t *mntent)
+{
 	switch (mount_entry_get_type(mntent)) {
 	case MOUNT_TYPE_SHARED:
-		shiftids = true; // Fallthrough
-	case MOUNT_TYPE_DEVICE:
-		mountflags |= MS_RDONLY; // add read-only flag for shared or device images types
-		break;
-	case MOUNT_TYPE_OVERLAY_RO:
-		mountflags |= MS_RDONLY; // add read-only flag for upper image
-		overlay = true;
-		break;
 	case MOUNT_TYPE_SHARED_RW:
-	case MOUNT_TYPE_OVERLAY_RW:
-		overlay = true;
-		shiftids = true;
 		break;
-	case MOUNT_TYPE_DEVICE_RW:
-	case MOUNT_TYPE_EMPTY:
-		shiftids = true;
-		break; // stick to defaults
-	case MOUNT_TYPE_BIND_FILE:
-		mountflags |= MS_RDONLY; // Fallthrough
-	case MOUNT_TYPE_BIND_FILE_RW:
-		if (container_has_userns(vol->container)) // skip
-			goto final;
-		mountflags |= MS_BIND; // use bind mount
-		IF_TRUE_GOTO(-1 == c_vol_mount_file_bind(img, dir, mountflags), error);
-		goto final;
-	case MOUNT_TYPE_COPY: // deprecated
-		//WARN("Found deprecated MOUNT_TYPE_COPY");
-		shiftids = true;
-		break;
-	case MOUNT_TYPE_FLASH:
-		DEBUG("Skipping mounting of FLASH type image %s", mount_entry_get_img(mntent));
-		goto final;
-	case MOUNT_TYPE_BIND_DIR:
-		mountflags |= MS_RDONLY; // Fallthrough
-	case MOUNT_TYPE_BIND_DIR_RW:
-		mountflags |= MS_BIND; // use bind mount
-		shiftids = true;
-		IF_TRUE_GOTO(-1 == c_vol_mount_dir_bind(img, dir, mountflags), error);
-		goto final;
 	default:
-		ERROR("Unsupported operating system mount type %d for %s",
-		      mount_entry_get_type(mntent), mount_entry_get_img(mntent));
+		return false;
+	}
+
+	// images with dm-verity already share their device, see c_vol_verity_refs_get()
+	return !mount_entry_get_verity_sha256(mntent) && !mount_entry_is_encrypted(mntent) &&
+	       strcmp(mount_entry_get_fs(mntent), "tmpfs");
+}
+
+static char *
+c_vol_shared_mount_dir_new(c_vol_t *vol, const mount_entry_t *mntent)
+{
+	char *img = c_vol_image_path_new(vol, mntent);
+	IF_NULL_RETVAL(img, NULL);
+
+	char *dir = mem_printf("%s%s", C_VOL_SHARED_MOUNT_PATH, img);
+	mem_free0(img);
+	return dir;
+}
+
+static int
+c_vol_shared_mount_create(c_vol_t *vol, const mount_entry_t *mntent, const char *dir)
+{
+	const char *fs = mount_entry_get_fs(mntent);
+	unsigned long mountflags = MS_RDONLY | MS_NOATIME | MS_NODEV | MS_NOSUID;
+	char *img, *dev = NULL;
+	int fd = 0;
+
+	img = c_vol_image_path_new(vol, mntent);
+	IF_NULL_RETVAL(img, -1);
+
+	if (dir_mkdir_p(dir, 0755) < 0) {
+		ERROR_ERRNO("Could not mkdir shared mount dir %s", dir);
 		goto error;
 	}
 
-	// try to create mount point before mount, usually not necessary...
-	if (dir_mkdir_p(dir, 0777) < 0)
-		DEBUG_ERRNO("Could not mkdir %s", dir);
+	PROBE1(c_vol_loop, img);
+	dev = loopdev_create_new(&fd, img, 1, 0);
+	PROBE2(c_vol_loop_done, img, dev);
+	IF_NULL_GOTO(dev, error);
+	c_vol_set_readahead(dev, mntent);
 
-	if (strcmp(mount_entry_get_fs(mntent), "tmpfs") == 0) {
-		const char *mount_data = mount_entry_get_mount_data(mntent);
-		if (mount(mount_entry_get_fs(mntent), dir, mount_entry_get_fs(mntent), mountflags,
-			  mount_data) >= 0) {
-			DEBUG("Sucessfully mounted %s to %s", mount_entry_get_fs(mntent), dir);
+	if (mount(dev, dir, fs, mountflags, mount_entry_get_mount_data(mntent)) < 0 &&
+	    mount(dev, dir, fs, mountflags, NULL) < 0) {
+		ERROR_ERRNO("Could not mount shared image %s using %s to %s", img, dev, dir);
+		goto error;
+	}
 
-			if (chmod(dir, 0755) < 0) {
-				ERROR_ERRNO(
-					"Could not set permissions of overlayfs mount point at %s",
-					dir);
-				goto error;
+	// the containers get their own copies of the mount in their mount namespaces
+	if (mount(NULL, dir, NULL, MS_PRIVATE, NULL) < 0)
+		WARN_ERRNO("Could not mount '%s' MS_PRIVATE", dir);
+
+	// the autoclear loop device stays attached as long as the image is mounted
+	close(fd);
+	loopdev_free(dev);
+	DEBUG("Mounted shared image %s to %s", img, dir);
+	mem_free0(img);
+	return 0;
+
+error:
+	if (fd)
+		close(fd);
+	if (dev)
+		loopdev_free(dev);
+	if (rmdir(dir) < 0)
+		TRACE_ERRNO("Could not remove shared mount dir %s", dir);
+	mem_free0(img);
+	return -1;
+}
+
+static void
+c_vol_shared_mounts_get_mount(c_vol_t *vol, const mount_t *mnt)
+{
+	for (size_t i = 0; i < mount_get_count(mnt); i++) {
+		const mount_entry_t *mntent = mount_get_entry(mnt, i);
+		if (!c_vol_mount_entry_is_host_shared(mntent))
+			continue;
+
+		char *dir = c_vol_shared_mount_dir_new(vol, mntent);
+		if (!dir)
+			continue;
+
+		c_vol_shared_mount_t *sm = hashmap_get(c_vol_shared_mounts, dir);
+		if (!sm) {
+			// left over by a previous cmld instance or created now
+			if (!file_is_mountpoint(dir) &&
+			    c_vol_shared_mount_create(vol, mntent, dir) < 0) {
+				WARN("Falling back to a loop device per container for %s",
+				     mount_entry_get_img(mntent));
+				mem_free0(dir);
+				continue;
 			}
-			DEBUG("Changed permissions of %s to 0755", dir);
+			sm = mem_new0(c_vol_shared_mount_t, 1);
+			sm->dir = mem_strdup(dir);
+			hashmap_put(c_vol_shared_mounts, sm->dir, sm);
+		}
+		sm->count++;
+		TRACE("Shared mount %s has %u reference(s)", dir, sm->count);
+		vol->shared_mounts = list_append(vol->shared_mounts, dir);
+	}
+}
 
-			if (is_root && setup_mode && c_vol_setup_busybox_copy(dir) < 0)
-				WARN("Cannot copy busybox for setup mode!");
-			goto final;
-		} else {
-			ERROR_ERRNO("Cannot mount %s to %s", mount_entry_get_fs(mntent), dir);
-			goto error;
+/*
+ * Takes the references of the container to the host mounts of its shared images and
+ * mounts the images which are not mounted yet, unless the references are still held
+ * from the last run.
+ */
+static void
+c_vol_shared_mounts_get(c_vol_t *vol)
+{
+	IF_TRUE_RETURN(vol->shared_mounts);
+
+	if (!c_vol_shared_mounts)
+		c_vol_shared_mounts = hashmap_new_str();
+
+	if (container_has_setup_mode(vol->container))
+		c_vol_shared_mounts_get_mount(vol, vol->mnt_setup);
+	c_vol_shared_mounts_get_mount(vol, vol->mnt);
+}
+
+/*
+ * Drops the references of the container to the host mounts of its shared images and
+ * unmounts the images which are not used by any other container anymore.
+ */
+static void
+c_vol_shared_mounts_put(c_vol_t *vol)
+{
+	for (list_t *l = vol->shared_mounts; l; l = l->next) {
+		char *dir = l->data;
+		c_vol_shared_mount_t *sm = hashmap_get(c_vol_shared_mounts, dir);
+		if (sm && --sm->count > 0) {
+			DEBUG("Shared mount %s still used by %u container(s)", dir, sm->count);
+			mem_free0(dir);
+			continue;
+		}
+		if (sm) {
+			hashmap_remove(c_vol_shared_mounts, dir);
+			mem_free0(sm->dir);
+			mem_free0(sm);
+		}
+
+		DEBUG("Unmounting shared image from %s", dir);
+		if (umount2(dir, MNT_DETACH) < 0)
+			WARN_ERRNO("Could not umount shared mount %s", dir);
+		else if (rmdir(dir) < 0)
+			WARN_ERRNO("Could not remove shared mount dir %s", dir);
+		mem_free0(dir);
+	}
+	list_delete(vol->shared_mounts);
+	vol->shared_mounts = NULL;
+}
+
+/*
+ * Returns the directory of the host mount of the image of the mount entry, if the
+ * container holds a reference to it, or NULL if the image has to be set up by the
+ * container itself.
+ */
+static char *
+c_vol_shared_mount_find_new(c_vol_t *vol, const mount_entry_t *mntent)
+{
+	if (!c_vol_mount_entry_is_host_shared(mntent))
+		return NULL;
+
+	char *dir = c_vol_shared_mount_dir_new(vol, mntent);
+	IF_NULL_RETVAL(dir, NULL);
+
+	for (list_t *l = vol->shared_mounts; l; l = l->next) {
+		if (!strcmp(l->data, dir))
+			return dir;
+	}
+	mem_free0(dir);
+	return NULL;
+}
+
+/**
+ * Sets up the block device stack of one mount entry, i.e., a loop device or a
+ * dm-verity device for the image and, if encrypted, a dm-crypt device on top.
+ * This does not touch the mount tree, thus it is run concurrently for all entries.
+ * @param vol The vol struct for the container.
+ * @param imgdev The mount entry, which receives the top device of the stack.
+ * @return -1 on error else 0.
+ */
+/**
+ * Sets up the zram device of an ephemeral volume, which is formatted before mounting.
+ * If the container has encrypted volumes, the device is encrypted as well, with a
+ * random key of this run, as its content is never read again after the stop.
+ */
+static int
+c_vol_setup_ephemeral_dev(c_vol_t *vol, c_vol_image_dev_t *imgdev)
+{
+	const mount_entry_t *mntent = imgdev->mntent;
+	char *dev = c_vol_image_path_new(vol, mntent);
+	IF_NULL_RETVAL(dev, -1);
+
+	if (container_get_key(vol->container)) {
+		uint8_t key[CRYPTFS_FDE_KEY_LEN / 2];
+		if (getrandom(key, sizeof(key), 0) != sizeof(key)) {
+			ERROR_ERRNO("Could not generate key for ephemeral volume %s",
+				    mount_entry_get_img(mntent));
+			mem_free0(dev);
+			return -1;
 		}
+		char *ascii_key = convert_bin_to_hex_new(key, sizeof(key));
+		mem_memset0(key, sizeof(key));
+
+		char *label = mem_printf("%s-%s", uuid_string(container_get_uuid(vol->container)),
+					 mount_entry_get_img(mntent));
+		DEBUG("Setting up cryptfs volume %s for %s", label, dev);
+		char *crypt = cryptfs_setup_volume_new(label, dev, ascii_key, NULL, NULL);
+		mem_memset0(ascii_key, strlen(ascii_key));
+		mem_free0(ascii_key);
+		mem_free0(dev);
+		if (!crypt) {
+			ERROR("Setting up cryptfs volume %s failed", label);
+			mem_free0(label);
+			return -1;
+		}
+		mem_free0(label);
+		dev = crypt;
+
+		while (access(dev, F_OK) < 0) {
+			NANOSLEEP(0, 10000000)
+			DEBUG("Waiting for %s", dev);
+		}
+	}
+
+	imgdev->dev = dev;
+	imgdev->fd = 0;
+	imgdev->new_image = true;
+	return 0;
+}
+
+static int
+c_vol_setup_image_dev(c_vol_t *vol, c_vol_image_dev_t *imgdev)
+{
+	const mount_entry_t *mntent = imgdev->mntent;
+	char *img, *dev, *img_meta, *dev_meta, *img_hash;
+	int fd = 0, fd_meta = 0;
+	bool encrypted = mount_entry_is_encrypted(mntent);
+	bool verity = mount_entry_get_verity_sha256(mntent) != NULL;
+
+	dev = img_meta = dev_meta = img_hash = NULL;
+
+	if (mount_entry_get_type(mntent) == MOUNT_TYPE_EPHEMERAL)
+		return c_vol_setup_ephemeral_dev(vol, imgdev);
+
+	// mounted by cmld already, see c_vol_shared_mounts_get()
+	imgdev->dev = c_vol_shared_mount_find_new(vol, mntent);
+	if (imgdev->dev) {
+		imgdev->host_shared = true;
+		imgdev->fd = 0;
+		return 0;
 	}
 
+	img = c_vol_image_path_new(vol, mntent);
+	IF_NULL_RETVAL(img, -1);
+
 	if (c_vol_check_image(vol, img) < 0) {
-		new_image = true;
+		imgdev->new_image = true;
 		if (c_vol_create_image(vol, img, mntent) < 0) {
 			goto error;
 		}
@@ -781,8 +1193,8 @@ c_vol_mount_image(c_vol_t *vol, const char *root, const mount_entry_t *mntent)
 
 	if (verity) {
 		TRACE("Creating dm-verity device");
-		char *label = mem_printf("%s-%s", uuid_string(container_get_uuid(vol->container)),
-					 mount_entry_get_img(mntent));
+		// shared with other containers using the same image, see c_vol_verity_refs_get()
+		char *label = c_vol_verity_label_new(mntent);
 		char *verity_dev = verity_get_device_path_new(label);
 		if (file_is_blk(verity_dev) || file_links_to_blk(verity_dev)) {
 			INFO("Using existing mapper device: %s", verity_dev);
@@ -791,8 +1203,16 @@ c_vol_mount_image(c_vol_t *vol, const char *root, const mount_entry_t *mntent)
 			img_hash = c_vol_hash_image_path_new(vol, mntent);
 			IF_NULL_GOTO(img_hash, error);
 
-			if (verity_create_blk_dev(label, img, img_hash, root_hash,
-						  !cmld_is_hostedmode_active())) {
+			PROBE2(c_vol_verity, label, img);
+			int ret = verity_create_blk_dev(label, img, img_hash, root_hash,
+							!cmld_is_hostedmode_active());
+			PROBE2(c_vol_verity_done, label, ret);
+			// another container may have created the shared device concurrently
+			if (ret && (file_is_blk(verity_dev) || file_links_to_blk(verity_dev))) {
+				INFO("Using concurrently created mapper device: %s", verity_dev);
+				ret = 0;
+			}
+			if (ret) {
 				ERROR("Failed to open %s from %s as dm-verity device with hash-dev %s and hash %s",
 				      label, img, img_hash, root_hash);
 				mem_free0(label);
@@ -833,7 +1253,9 @@ c_vol_mount_image(c_vol_t *vol, const char *root, const mount_entry_t *mntent)
 
 	} else {
 		TRACE("Creating loopdev");
+		PROBE1(c_vol_loop, img);
 		dev = loopdev_create_new(&fd, img, 0, 0);
+		PROBE2(c_vol_loop_done, img, dev);
 		IF_NULL_GOTO(dev, error);
 	}
 
@@ -861,13 +1283,18 @@ c_vol_mount_image(c_vol_t *vol, const char *root, const mount_entry_t *mntent)
 			DEBUG("Setting up cryptfs volume %s for %s", label, dev);
 
 			img_meta = c_vol_meta_image_path_new(vol, mntent);
+			PROBE1(c_vol_loop, img_meta);
 			dev_meta = loopdev_create_new(&fd_meta, img_meta, 0, 0);
+			PROBE2(c_vol_loop_done, img_meta, dev_meta);
 
 			IF_NULL_GOTO(dev_meta, error);
 
 			mem_free0(crypt);
-			crypt = cryptfs_setup_volume_new(
-				label, dev, container_get_key(vol->container), dev_meta);
+			PROBE2(c_vol_crypt, label, dev);
+			crypt = cryptfs_setup_volume_new(label, dev,
+							 container_get_key(vol->container),
+							 dev_meta, cmld_get_crypt_opts());
+			PROBE2(c_vol_crypt_done, label, crypt);
 
 			// release loopdev fd (crypt device should keep it open now)
 			close(fd_meta);
@@ -899,6 +1326,247 @@ c_vol_mount_image(c_vol_t *vol, const char *root, const mount_entry_t *mntent)
 		}
 	}
 
+	if (!encrypted)
+		c_vol_set_readahead(dev, mntent);
+
+	imgdev->dev = dev;
+	imgdev->fd = fd;
+	mem_free0(img);
+	if (img_hash)
+		mem_free0(img_hash);
+	return 0;
+
+error:
+	if (dev)
+		loopdev_free(dev);
+	if (dev_meta)
+		loopdev_free(dev_meta);
+	if (img_meta)
+		mem_free0(img_meta);
+	if (fd)
+		close(fd);
+	if (fd_meta)
+		close(fd_meta);
+	if (img_hash)
+		mem_free0(img_hash);
+	mem_free0(img);
+	return -1;
+}
+
+static void *
+c_vol_setup_image_devs_worker(void *data)
+{
+	c_vol_setup_job_t *job = data;
+
+	while (true) {
+		pthread_mutex_lock(&job->lock);
+		size_t i = job->next++;
+		bool abort = job->abort;
+		pthread_mutex_unlock(&job->lock);
+
+		if (abort || i >= job->n)
+			break;
+
+		c_vol_image_dev_t *imgdev = &job->devs[i];
+		if (!c_vol_mount_entry_needs_dev(imgdev->mntent))
+			continue;
+
+		if (c_vol_setup_image_dev(job->vol, imgdev) < 0) {
+			ERROR("Failed to set up block device for image %s",
+			      mount_entry_get_img(imgdev->mntent));
+			pthread_mutex_lock(&job->lock);
+			job->abort = true;
+			pthread_mutex_unlock(&job->lock);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Sets up the block device stacks of all mount entries using a pool of
+ * C_VOL_SETUP_JOBS threads. The stacks of different entries are independent from
+ * each other, the only ordering dependency of the mount entries is the nesting of
+ * their mount points, which is kept by mounting them afterwards in order.
+ * @return -1 if any stack could not be set up else 0.
+ */
+static int
+c_vol_setup_image_devs(c_vol_t *vol, c_vol_image_dev_t *devs, size_t n)
+{
+	pthread_t threads[C_VOL_SETUP_JOBS];
+	size_t nthreads = 0;
+
+	c_vol_setup_job_t job = { .vol = vol, .devs = devs, .n = n };
+	pthread_mutex_init(&job.lock, NULL);
+
+	for (; nthreads < MIN(C_VOL_SETUP_JOBS, n); nthreads++) {
+		if (pthread_create(&threads[nthreads], NULL, c_vol_setup_image_devs_worker,
+				   &job)) {
+			ERROR("Failed to start block device setup thread");
+			break;
+		}
+	}
+
+	// without any thread, at least set up the devices sequentially
+	if (nthreads == 0)
+		c_vol_setup_image_devs_worker(&job);
+
+	for (size_t i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&job.lock);
+	return job.abort ? -1 : 0;
+}
+
+/**
+ * Releases the devices of all mount entries which have not been mounted.
+ */
+static void
+c_vol_image_devs_free(c_vol_image_dev_t *devs, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (devs[i].dev)
+			loopdev_free(devs[i].dev);
+		if (devs[i].fd)
+			close(devs[i].fd);
+	}
+	mem_free0(devs);
+}
+
+/**
+ * Mount an image file. This function will take some time. So call it in a
+ * thread or child process.
+ * @param vol The vol struct for the container.
+ * @param root The directory where the root file system should be mounted.
+ * @param imgdev The information for this mount and its block device stack.
+ * @return -1 on error else 0.
+ */
+static int
+c_vol_mount_image(c_vol_t *vol, const char *root, c_vol_image_dev_t *imgdev)
+{
+	const mount_entry_t *mntent = imgdev->mntent;
+	char *img, *dev, *dir;
+	int fd = 0;
+	bool new_image = false;
+	bool host_shared = false;
+	bool encrypted = mount_entry_is_encrypted(mntent);
+	bool overlay = false;
+	bool shiftids = false;
+	bool is_root = strcmp(mount_entry_get_dir(mntent), "/") == 0;
+	bool setup_mode = container_has_setup_mode(vol->container);
+
+	// default mountflags for most image types
+	unsigned long mountflags = setup_mode ? MS_NOATIME : MS_NOATIME | MS_NODEV;
+
+	img = dev = dir = NULL;
+
+	if (mount_entry_get_dir(mntent)[0] == '/')
+		dir = mem_printf("%s%s", root, mount_entry_get_dir(mntent));
+	else
+		dir = mem_printf("%s/%s", root, mount_entry_get_dir(mntent));
+
+	img = c_vol_image_path_new(vol, mntent);
+	if (!img)
+		goto error;
+
+	TRACE("Mount entry type: %d", mount_entry_get_type(mntent));
+
+	switch (mount_entry_get_type(mntent)) {
+	case MOUNT_TYPE_SHARED:
+		shiftids = true; // Fallthrough
+	case MOUNT_TYPE_DEVICE:
+		mountflags |= MS_RDONLY; // add read-only flag for shared or device images types
+		break;
+	case MOUNT_TYPE_OVERLAY_RO:
+		mountflags |= MS_RDONLY; // add read-only flag for upper image
+		overlay = true;
+		break;
+	case MOUNT_TYPE_SHARED_RW:
+	case MOUNT_TYPE_OVERLAY_RW:
+		overlay = true;
+		shiftids = true;
+		break;
+	case MOUNT_TYPE_DEVICE_RW:
+	case MOUNT_TYPE_EMPTY:
+	case MOUNT_TYPE_EPHEMERAL:
+		shiftids = true;
+		break; // stick to defaults
+	case MOUNT_TYPE_BIND_FILE:
+		mountflags |= MS_RDONLY; // Fallthrough
+	case MOUNT_TYPE_BIND_FILE_RW:
+		if (container_has_userns(vol->container)) // skip
+			goto final;
+		mountflags |= MS_BIND; // use bind mount
+		IF_TRUE_GOTO(-1 == c_vol_mount_file_bind(img, dir, mountflags), error);
+		goto final;
+	case MOUNT_TYPE_COPY: // deprecated
+		//WARN("Found deprecated MOUNT_TYPE_COPY");
+		shiftids = true;
+		break;
+	case MOUNT_TYPE_FLASH:
+		DEBUG("Skipping mounting of FLASH type image %s", mount_entry_get_img(mntent));
+		goto final;
+	case MOUNT_TYPE_BIND_DIR:
+		mountflags |= MS_RDONLY; // Fallthrough
+	case MOUNT_TYPE_BIND_DIR_RW:
+		mountflags |= MS_BIND; // use bind mount
+		shiftids = true;
+		IF_TRUE_GOTO(-1 == c_vol_mount_dir_bind(img, dir, mountflags), error);
+		goto final;
+	default:
+		ERROR("Unsupported operating system mount type %d for %s",
+		      mount_entry_get_type(mntent), mount_entry_get_img(mntent));
+		goto error;
+	}
+
+	// try to create mount point before mount, usually not necessary...
+	if (dir_mkdir_p(dir, 0777) < 0)
+		DEBUG_ERRNO("Could not mkdir %s", dir);
+
+	if (strcmp(mount_entry_get_fs(mntent), "tmpfs") == 0) {
+		const char *mount_data = mount_entry_get_mount_data(mntent);
+		// the pages of the tmpfs are charged to the memory cgroup of the writer
+		char *size_data = NULL;
+		if (mount_entry_get_type(mntent) == MOUNT_TYPE_EPHEMERAL) {
+			uint64_t size = mount_entry_get_size(mntent);
+			if (mount_data)
+				size_data = mem_printf("size=%" PRIu64 "m,%s", size, mount_data);
+			else
+				size_data = mem_printf("size=%" PRIu64 "m", size);
+			mount_data = size_data;
+		}
+		int ret = mount(mount_entry_get_fs(mntent), dir, mount_entry_get_fs(mntent),
+				mountflags, mount_data);
+		if (size_data)
+			mem_free0(size_data);
+		if (ret >= 0) {
+			DEBUG("Sucessfully mounted %s to %s", mount_entry_get_fs(mntent), dir);
+
+			if (chmod(dir, 0755) < 0) {
+				ERROR_ERRNO(
+					"Could not set permissions of overlayfs mount point at %s",
+					dir);
+				goto error;
+			}
+			DEBUG("Changed permissions of %s to 0755", dir);
+
+			if (is_root && setup_mode && c_vol_setup_busybox_bind(dir) < 0)
+				WARN("Cannot provide busybox for setup mode!");
+			goto final;
+		} else {
+			ERROR_ERRNO("Cannot mount %s to %s", mount_entry_get_fs(mntent), dir);
+			goto error;
+		}
+	}
+
+	// the block device stack has been set up before by c_vol_setup_image_devs()
+	IF_NULL_GOTO(imgdev->dev, error);
+	dev = imgdev->dev;
+	fd = imgdev->fd;
+	new_image = imgdev->new_image;
+	host_shared = imgdev->host_shared;
+	imgdev->dev = NULL;
+	imgdev->fd = 0;
+
 	if (overlay) {
 		TRACE("Device to be mounted is an overlay device\n");
 		const char *upper_fstype = NULL;
@@ -964,6 +1632,19 @@ c_vol_mount_image(c_vol_t *vol, const char *root, const mount_entry_t *mntent)
 		goto final_noshift;
 	}
 
+	if (host_shared) {
+		// bind mount of the image mounted by cmld, idmapped after the final mount
+		IF_TRUE_GOTO(-1 == c_vol_mount_dir_bind(dev, dir, mountflags | MS_BIND), error);
+		goto final;
+	}
+
+	// ephemeral volumes start empty on each run
+	if (mount_entry_get_type(mntent) == MOUNT_TYPE_EPHEMERAL &&
+	    c_vol_format_image(dev, mount_entry_get_fs(mntent)) < 0) {
+		ERROR("Could not format ephemeral volume %s using %s", img, dev);
+		goto error;
+	}
+
 	DEBUG("Mounting image %s %s using %s to %s", img, mountflags & MS_RDONLY ? "ro" : "rw", dev,
 	      dir);
 
@@ -1032,57 +1713,67 @@ final_noshift:
 
 	if (dev)
 		loopdev_free(dev);
-	if (dev_meta)
-		loopdev_free(dev_meta);
 	if (img)
 		mem_free0(img);
-	if (img_meta)
-		mem_free0(img_meta);
 	if (dir)
 		mem_free0(dir);
-	if (fd)
-		close(fd);
-	if (fd_meta)
-		close(fd_meta);
-	if (img_hash)
-		mem_free0(img_hash);
+	if (fd)
+		close(fd);
 	return 0;
 
 error:
 	if (dev)
 		loopdev_free(dev);
-	if (dev_meta)
-		loopdev_free(dev_meta);
 	if (img)
 		mem_free0(img);
-	if (img_meta)
-		mem_free0(img_meta);
 	if (dir)
 		mem_free0(dir);
 	if (fd)
 		close(fd);
-	if (fd_meta)
-		close(fd_meta);
 	return -1;
 }
 
-static int
-c_vol_cleanup_dm(c_vol_t *vol)
+/*
+ * Returns the list of the labels of the dm devices of the container in reverse mount order.
+ */
+static list_t *
+c_vol_dm_labels_new(c_vol_t *vol)
 {
-	ssize_t i, n;
-	int fd;
+	list_t *labels = NULL;
 
-	IF_TRUE_RETVAL(((fd = dm_open_control()) < 0), -1);
+	for (size_t i = 0; i < mount_get_count(vol->mnt); i++) {
+		const mount_entry_t *mntent = mount_get_entry(vol->mnt, i);
+		char *label = mem_printf("%s-%s", uuid_string(container_get_uuid(vol->container)),
+					 mount_entry_get_img(mntent));
+		labels = list_prepend(labels, label);
+	}
+	return labels;
+}
 
-	n = mount_get_count(vol->mnt);
-	for (i = n - 1; i >= 0; i--) {
-		const mount_entry_t *mntent;
-		char *label;
+static void
+c_vol_dm_labels_free(list_t *labels)
+{
+	for (list_t *l = labels; l; l = l->next)
+		mem_free0(l->data);
+	list_delete(labels);
+}
 
-		mntent = mount_get_entry(vol->mnt, i);
+/*
+ * Removes the dm devices with the given labels and frees the list, does not access the
+ * c_vol_t and thus may run in a thread.
+ */
+static int
+c_vol_cleanup_dm_labels(list_t *labels)
+{
+	int fd;
 
-		label = mem_printf("%s-%s", uuid_string(container_get_uuid(vol->container)),
-				   mount_entry_get_img(mntent));
+	if ((fd = dm_open_control()) < 0) {
+		c_vol_dm_labels_free(labels);
+		return -1;
+	}
+
+	for (list_t *l = labels; l; l = l->next) {
+		char *label = l->data;
 
 		DEBUG("Cleanup: Checking target type of %s\n", label);
 
@@ -1094,21 +1785,185 @@ c_vol_cleanup_dm(c_vol_t *vol)
 
 		DEBUG("Cleanup: removing block device %s of type %s\n", label, type);
 
-		if (!strcmp(type, "crypt")) {
+		if (!strcmp(type, "crypt") || !strcmp(type, "default-key")) {
 			if (cryptfs_delete_blk_dev(fd, label) < 0)
 				DEBUG("Could not delete dm-crypt dev %s", label);
 		} else if (!strcmp(type, "verity")) {
 			if (verity_delete_blk_dev(label) < 0)
 				DEBUG("Could not delete dm-verity dev %s", label);
 		}
-		mem_free0(label);
 		mem_free0(type);
 	}
 	dm_close_control(fd);
+	c_vol_dm_labels_free(labels);
+
+	return 0;
+}
+
+/*
+ * Waits for the removal of the dm devices of the last run, if still in progress.
+ */
+static void
+c_vol_teardown_join(c_vol_t *vol)
+{
+	IF_FALSE_RETURN(vol->teardown_joinable);
+
+	DEBUG("Waiting for the removal of the block devices of container %s",
+	      container_get_description(vol->container));
+	pthread_join(vol->teardown_thread, NULL);
+	vol->teardown_joinable = false;
+}
+
+static int
+c_vol_cleanup_dm(c_vol_t *vol)
+{
+	c_vol_teardown_join(vol);
+	return c_vol_cleanup_dm_labels(c_vol_dm_labels_new(vol));
+}
+
+static void *
+c_vol_cleanup_dm_thread(void *data)
+{
+	if (c_vol_cleanup_dm_labels(data) < 0)
+		WARN("Could not remove block devices properly");
+	return NULL;
+}
+
+/*
+ * Removes the dm devices of the container in background, so that a stopped container
+ * does not wait for the slow removal of dm-crypt and dm-integrity devices. The next
+ * start, which may need the same devices, waits for the removal to complete.
+ */
+static void
+c_vol_cleanup_dm_async(c_vol_t *vol)
+{
+	c_vol_teardown_join(vol);
+
+	list_t *labels = c_vol_dm_labels_new(vol);
+	IF_NULL_RETURN(labels);
+
+	if (pthread_create(&vol->teardown_thread, NULL, c_vol_cleanup_dm_thread, labels)) {
+		WARN("Could not create teardown thread, removing block devices directly");
+		if (c_vol_cleanup_dm_labels(labels) < 0)
+			WARN("Could not remove block devices properly");
+		return;
+	}
+	vol->teardown_joinable = true;
+}
+
+/*
+ * Removes the zram devices of the ephemeral volumes together with the dm-crypt devices
+ * on top of them, which frees their memory. Unlike the other block devices, they are
+ * not kept after a stop, as they are formatted on each start anyway.
+ */
+static void
+c_vol_zram_put(c_vol_t *vol)
+{
+	IF_NULL_RETURN(vol->zram_devs);
+
+	list_t *labels = NULL;
+	for (list_t *l = vol->zram_devs; l; l = l->next) {
+		c_vol_zram_t *zram = l->data;
+		char *label = mem_printf("%s-%s", uuid_string(container_get_uuid(vol->container)),
+					 zram->img);
+		char *crypt = cryptfs_get_device_path_new(label);
+		if (file_is_blk(crypt) || file_links_to_blk(crypt))
+			labels = list_prepend(labels, label);
+		else
+			mem_free0(label);
+		mem_free0(crypt);
+	}
+	if (labels && c_vol_cleanup_dm_labels(labels) < 0)
+		WARN("Could not remove dm-crypt devices of ephemeral volumes");
+
+	for (list_t *l = vol->zram_devs; l; l = l->next) {
+		c_vol_zram_t *zram = l->data;
+		DEBUG("Removing zram device %s of ephemeral volume %s", zram->dev, zram->img);
+		if (zram_free(zram->dev) < 0)
+			WARN("Could not remove zram device %s", zram->dev);
+		mem_free0(zram->dev);
+		mem_free0(zram->img);
+		mem_free0(zram);
+	}
+	list_delete(vol->zram_devs);
+	vol->zram_devs = NULL;
+}
 
+/*
+ * Creates the zram devices of the ephemeral volumes, which are not backed by a tmpfs.
+ * Their size is the size of the mount entry and also limits their memory usage.
+ */
+static int
+c_vol_zram_get_mount(c_vol_t *vol, const mount_t *mnt)
+{
+	for (size_t i = 0; i < mount_get_count(mnt); i++) {
+		const mount_entry_t *mntent = mount_get_entry(mnt, i);
+		if (!c_vol_mount_entry_is_zram(mntent))
+			continue;
+
+		char *dev = zram_create_new(mount_entry_get_size(mntent) * 1024 * 1024);
+		if (!dev) {
+			ERROR("Could not create zram device for ephemeral volume %s",
+			      mount_entry_get_img(mntent));
+			c_vol_zram_put(vol);
+			return -1;
+		}
+		c_vol_zram_t *zram = mem_new0(c_vol_zram_t, 1);
+		zram->img = mem_strdup(mount_entry_get_img(mntent));
+		zram->dev = dev;
+		vol->zram_devs = list_append(vol->zram_devs, zram);
+	}
 	return 0;
 }
 
+static int
+c_vol_zram_get(c_vol_t *vol)
+{
+	if (container_has_setup_mode(vol->container) &&
+	    c_vol_zram_get_mount(vol, vol->mnt_setup) < 0)
+		return -1;
+	return c_vol_zram_get_mount(vol, vol->mnt);
+}
+
+static int
+c_vol_release_volumes(void *volp)
+{
+	c_vol_t *vol = volp;
+	ASSERT(vol);
+
+	// the images may be removed afterwards, thus wait for the background removal
+	c_vol_teardown_join(vol);
+
+	IF_NULL_RETVAL(vol->keep_timer, 0);
+
+	event_remove_timer(vol->keep_timer);
+	event_timer_free(vol->keep_timer);
+	vol->keep_timer = NULL;
+
+	INFO("Removing kept block devices of container %s",
+	     container_get_description(vol->container));
+	c_vol_verity_refs_put(vol);
+	c_vol_shared_mounts_put(vol);
+	return c_vol_cleanup_dm(vol);
+}
+
+static void
+c_vol_keep_timeout_cb(event_timer_t *timer, void *data)
+{
+	c_vol_t *vol = data;
+	ASSERT(vol);
+
+	// the timer is removed from the event loop after its only run
+	event_timer_free(timer);
+	vol->keep_timer = NULL;
+
+	INFO("Keep time of the block devices of container %s expired",
+	     container_get_description(vol->container));
+	c_vol_verity_refs_put(vol);
+	c_vol_shared_mounts_put(vol);
+	c_vol_cleanup_dm_async(vol);
+}
+
 static int
 c_vol_umount_dir(const char *mount_dir)
 {
@@ -1208,7 +2063,7 @@ error:
 static int
 c_vol_mount_images(c_vol_t *vol)
 {
-	size_t i, n;
+	size_t i, n, n_setup = 0;
 
 	ASSERT(vol);
 
@@ -1217,36 +2072,43 @@ c_vol_mount_images(c_vol_t *vol)
 	// in setup mode mount container images under {root}/setup subfolder
 	char *c_root = mem_printf("%s%s", vol->root, (setup_mode) ? "/setup" : "");
 
-	if (setup_mode) {
-		n = mount_get_count(vol->mnt_setup);
-		for (i = 0; i < n; i++) {
-			const mount_entry_t *mntent;
-
-			mntent = mount_get_entry(vol->mnt_setup, i);
+	if (setup_mode)
+		n_setup = mount_get_count(vol->mnt_setup);
+	n = n_setup + mount_get_count(vol->mnt);
 
-			if (c_vol_mount_image(vol, vol->root, mntent) < 0) {
-				goto err;
-			}
+	c_vol_image_dev_t *devs = mem_new0(c_vol_image_dev_t, n);
+	for (i = 0; i < n; i++) {
+		if (i < n_setup) {
+			devs[i].mntent = mount_get_entry(vol->mnt_setup, i);
+			devs[i].root = vol->root;
+		} else {
+			devs[i].mntent = mount_get_entry(vol->mnt, i - n_setup);
+			devs[i].root = c_root;
 		}
-
-		// create mount point for setup
-		if (dir_mkdir_p(c_root, 0755) < 0)
-			DEBUG_ERRNO("Could not mkdir %s", c_root);
 	}
 
-	n = mount_get_count(vol->mnt);
-	for (i = 0; i < n; i++) {
-		const mount_entry_t *mntent;
+	if (c_vol_setup_image_devs(vol, devs, n) < 0)
+		goto err;
 
-		mntent = mount_get_entry(vol->mnt, i);
+	// mount in order, as the mount points of later entries may be nested in earlier ones
+	for (i = 0; i < n_setup; i++) {
+		if (c_vol_mount_image(vol, devs[i].root, &devs[i]) < 0)
+			goto err;
+	}
+
+	// create mount point for setup
+	if (setup_mode && dir_mkdir_p(c_root, 0755) < 0)
+		DEBUG_ERRNO("Could not mkdir %s", c_root);
 
-		if (c_vol_mount_image(vol, c_root, mntent) < 0) {
+	for (; i < n; i++) {
+		if (c_vol_mount_image(vol, devs[i].root, &devs[i]) < 0)
 			goto err;
-		}
 	}
+	c_vol_image_devs_free(devs, n);
 	mem_free0(c_root);
 	return 0;
 err:
+	c_vol_image_devs_free(devs, n);
 	c_vol_umount_all(vol);
 	c_vol_cleanup_dm(vol);
 	mem_free0(c_root);
@@ -1368,9 +2230,31 @@ c_vol_verify_mount_entries(const c_vol_t *vol)
 	return true;
 }
 
+static void
+c_vol_verify_mount_entry_bg_cb(guestos_check_mount_image_result_t res, const char *img_name,
+			       void *data)
+{
+	// the container may be gone by now, only its uuid is kept
+	uuid_t *uuid = data;
+	ASSERT(uuid);
+
+	bool good = res == CHECK_IMAGE_GOOD;
+	if (!good)
+		ERROR("Cannot verify image %s: image file is corrupted", img_name);
+	else
+		INFO("Background check of image %s succeeded", img_name);
+
+	audit_log_event(uuid, good ? SSA : FSA, CMLD, CONTAINER_MGMT, "verify-image",
+			uuid_string(uuid), 2, "name", img_name);
+	uuid_free(uuid);
+}
+
 /**
  * This Function verifies integrity of base images in background as part of
  * TSF.CML.SecureCompartmentInit.
+ * The checks are shared with all other containers using the same GuestOS, thus
+ * concurrently started containers hash each base image only once. Images with
+ * fs-verity are not hashed at all, their check completes with the kernel's digest.
  */
 static bool
 c_vol_verify_mount_entries_bg(const c_vol_t *vol)
@@ -1389,41 +2273,14 @@ c_vol_verify_mount_entries_bg(const c_vol_t *vol)
 			         * block access, and check the whole image in
 				 * background
 				 */
-				pid_t pid = fork();
-				if (pid < 0) {
-					ERROR_ERRNO("Can not fork child for integrity check!");
-					return false;
-				} else if (pid == 0) { // child do check
-					event_reset();
-					if (guestos_check_mount_image_block(
-						    vol->os, mntent, true) != CHECK_IMAGE_GOOD) {
-						ERROR("Cannot verify image %s: "
-						      "image file is corrupted",
-						      mount_entry_get_img(mntent));
-
-						audit_log_event(
-							container_get_uuid(vol->container), FSA,
-							CMLD, CONTAINER_MGMT, "verify-image",
-							uuid_string(
-								container_get_uuid(vol->container)),
-							2, "name", mount_entry_get_img(mntent));
-						_exit(-1);
-					}
-					audit_log_event(
-						container_get_uuid(vol->container), SSA, CMLD,
-						CONTAINER_MGMT, "verify-image",
-						uuid_string(container_get_uuid(vol->container)), 2,
-						"name", mount_entry_get_img(mntent));
-					_exit(0);
-				} else { // parent
-					INFO("dm-verity active for image %s, "
-					     "start thorough image check in "
-					     "background.",
-					     mount_entry_get_img(mntent));
-					container_wait_for_child(vol->container, "vol-bg-check",
-								 pid);
-					continue;
-				}
+				INFO("dm-verity active for image %s, "
+				     "start thorough image check in "
+				     "background.",
+				     mount_entry_get_img(mntent));
+				uuid_t *uuid =
+					uuid_new(uuid_string(container_get_uuid(vol->container)));
+				guestos_verify_mount_image(vol->os, mount_entry_get_img(mntent),
+							   c_vol_verify_mount_entry_bg_cb, uuid);
 			}
 		}
 	}
@@ -1432,6 +2289,183 @@ c_vol_verify_mount_entries_bg(const c_vol_t *vol)
 
 /******************************************************************************/
 
+#define C_VOL_BOOTPROF_MOUNTINFO_MAX (256 * 1024)
+
+/**
+ * Returns true if the boot profile of a mount entry is recorded, i.e., for the
+ * read-only images of the guestos, whose hash identifies the profiled image version.
+ */
+static bool
+c_vol_mount_entry_has_bootprof(const mount_entry_t *mntent)
+{
+	switch (mount_entry_get_type(mntent)) {
+	case MOUNT_TYPE_SHARED:
+	case MOUNT_TYPE_SHARED_RW:
+	case MOUNT_TYPE_OVERLAY_RO:
+		return mount_entry_get_sha256(mntent) && !mount_entry_is_encrypted(mntent) &&
+		       strcmp(mount_entry_get_fs(mntent), "tmpfs") != 0;
+	default:
+		return false;
+	}
+}
+
+static char *
+c_vol_bootprof_path_new(c_vol_t *vol, const mount_entry_t *mntent)
+{
+	return mem_printf("%s/%s.bootprof", container_get_images_dir(vol->container),
+			  mount_entry_get_img(mntent));
+}
+
+struct c_vol_loop_lookup {
+	const char *img;
+	const char *mountinfo;
+	char *dev;
+};
+
+static int
+c_vol_bootprof_loop_cb(const char *path, const char *file, void *data)
+{
+	struct c_vol_loop_lookup *lookup = data;
+	char *backing_file_path, *backing_file, *devnum_path, *devnum;
+	int ret = 0;
+
+	if (strncmp(file, "loop", 4))
+		return 0;
+
+	backing_file_path = mem_printf("%s/%s/loop/backing_file", path, file);
+	devnum_path = mem_printf("%s/%s/dev", path, file);
+	backing_file = file_read_new(backing_file_path, PATH_MAX);
+	devnum = file_read_new(devnum_path, 32);
+	if (!backing_file || !devnum)
+		goto out;
+
+	backing_file[strcspn(backing_file, "\n")] = '\0';
+	devnum[strcspn(devnum, "\n")] = '\0';
+	if (strcmp(backing_file, lookup->img))
+		goto out;
+
+	// other containers may have a loop device of the same shared image
+	char *field = mem_printf(" %s ", devnum);
+	if (strstr(lookup->mountinfo, field)) {
+		lookup->dev = mem_printf("/dev/%s", file);
+		ret = -1;
+	}
+	mem_free0(field);
+out:
+	mem_free0(backing_file_path);
+	mem_free0(devnum_path);
+	if (backing_file)
+		mem_free0(backing_file);
+	if (devnum)
+		mem_free0(devnum);
+	return ret;
+}
+
+/**
+ * Finds the block device from which the container reads the image of a mount entry,
+ * i.e., its dm-verity device or the loop device mounted in the container.
+ * @return A newly allocated string with the device path or NULL if not found.
+ */
+static char *
+c_vol_bootprof_dev_new(c_vol_t *vol, const mount_entry_t *mntent)
+{
+	if (mount_entry_get_verity_sha256(mntent)) {
+		char *label = c_vol_verity_label_new(mntent);
+		char *dev = verity_get_device_path_new(label);
+		mem_free0(label);
+		if (file_is_blk(dev) || file_links_to_blk(dev))
+			return dev;
+		mem_free0(dev);
+		return NULL;
+	}
+
+	char *mountinfo_path = mem_printf("/proc/%d/mountinfo", container_get_pid(vol->container));
+	char *mountinfo = file_read_new(mountinfo_path, C_VOL_BOOTPROF_MOUNTINFO_MAX);
+	mem_free0(mountinfo_path);
+	IF_NULL_RETVAL(mountinfo, NULL);
+
+	char *img = c_vol_image_path_new(vol, mntent);
+	struct c_vol_loop_lookup lookup = { .img = img, .mountinfo = mountinfo, .dev = NULL };
+	if (img) {
+		dir_foreach("/sys/block", c_vol_bootprof_loop_cb, &lookup);
+		mem_free0(img);
+	}
+	mem_free0(mountinfo);
+	return lookup.dev;
+}
+
+static void
+c_vol_bootprof_record_cb(container_t *container, container_callback_t *cb, void *data)
+{
+	c_vol_t *vol = data;
+	ASSERT(vol);
+
+	compartment_state_t state = container_get_state(container);
+	if (state == COMPARTMENT_STATE_RUNNING) {
+		int n = mount_get_count(vol->mnt);
+		for (int i = 0; i < n; i++) {
+			const mount_entry_t *mntent = mount_get_entry(vol->mnt, i);
+			if (!c_vol_mount_entry_has_bootprof(mntent))
+				continue;
+
+			char *profile = c_vol_bootprof_path_new(vol, mntent);
+			const char *id = mount_entry_get_sha256(mntent);
+			if (!bootprof_is_valid(profile, id)) {
+				char *dev = c_vol_bootprof_dev_new(vol, mntent);
+				if (!dev || bootprof_record(dev, id, profile))
+					WARN("Could not record boot profile of image %s",
+					     mount_entry_get_img(mntent));
+				if (dev)
+					mem_free0(dev);
+			}
+			mem_free0(profile);
+		}
+		container_unregister_observer(container, cb);
+	} else if (state == COMPARTMENT_STATE_STOPPED) {
+		container_unregister_observer(container, cb);
+	}
+}
+
+/**
+ * Reads ahead the parts of the guestos images which were read during the last boot
+ * of the container and records the boot profiles of images without a valid one
+ * once the container is running.
+ */
+static void
+c_vol_bootprof_prewarm(c_vol_t *vol)
+{
+	ASSERT(vol);
+	bool record = false;
+
+	int n = mount_get_count(vol->mnt);
+	for (int i = 0; i < n; i++) {
+		const mount_entry_t *mntent = mount_get_entry(vol->mnt, i);
+		if (!c_vol_mount_entry_has_bootprof(mntent))
+			continue;
+
+		char *profile = c_vol_bootprof_path_new(vol, mntent);
+		const char *id = mount_entry_get_sha256(mntent);
+		if (bootprof_is_valid(profile, id)) {
+			char *dev = c_vol_bootprof_dev_new(vol, mntent);
+			if (!dev || bootprof_prewarm(dev, id, profile))
+				WARN("Could not prewarm image %s", mount_entry_get_img(mntent));
+			if (dev)
+				mem_free0(dev);
+		} else {
+			record = true;
+		}
+		mem_free0(profile);
+	}
+
+	if (record &&
+	    !container_register_observer(vol->container, &c_vol_bootprof_record_cb, vol)) {
+		WARN("Could not register boot profile observer callback for %s",
+		     container_get_description(vol->container));
+	}
+}
+
+/******************************************************************************/
+
 static void *
 c_vol_new(compartment_t *compartment)
 {
@@ -1472,6 +2506,12 @@ c_vol_free(void *volp)
 	c_vol_t *vol = volp;
 	ASSERT(vol);
 
+	if (c_vol_release_volumes(vol))
+		WARN("Could not remove kept block devices properly");
+	c_vol_verity_refs_put(vol);
+	c_vol_shared_mounts_put(vol);
+	c_vol_zram_put(vol);
+
 	if (vol->mnt)
 		mount_free(vol->mnt);
 	if (vol->mnt_setup)
@@ -1480,6 +2520,7 @@ c_vol_free(void *volp)
 	if (vol->root)
 		mem_free0(vol->root);
 
+	lxcfs_proc_overlay_free(vol->lxcfs_overlay);
 	mem_free0(vol);
 }
 
@@ -1597,8 +2638,12 @@ c_vol_start_child_early(void *volp)
 	DEBUG("Mounting /dev");
 	IF_TRUE_GOTO_ERROR(c_vol_mount_dev(vol) < 0, error);
 
+	// the images were measured while verifying them, tpm2d extended them meanwhile
+	tss_ml_flush();
+
 	return 0;
 error:
+	tss_ml_flush();
 	ERROR("Failed to execute start child early hook for c_vol");
 	return -COMPARTMENT_ERROR_VOL;
 }
@@ -1610,9 +2655,18 @@ c_vol_start_post_clone(void *volp)
 	ASSERT(vol);
 
 	// check image integrity lazy in background for verity enabled images
-	if (c_vol_verify_mount_entries_bg(vol))
-		return 0;
+	if (!c_vol_verify_mount_entries_bg(vol))
+		goto error;
+
+	if (cmld_is_boot_profile_enabled())
+		c_vol_bootprof_prewarm(vol);
 
+	// the child got its copies of the detached trees
+	lxcfs_proc_overlay_free(vol->lxcfs_overlay);
+	vol->lxcfs_overlay = NULL;
+
+	return 0;
+error:
 	ERROR("Failed to execute post clone hook for c_vol");
 	return -COMPARTMENT_ERROR_VOL;
 }
@@ -1682,7 +2736,13 @@ c_vol_mount_proc_and_sys(const c_vol_t *vol, const char *dir)
 		goto error;
 	}
 
-	if (lxcfs_is_supported()) {
+	if (vol->lxcfs_overlay) {
+		if (lxcfs_proc_overlay_mount(vol->lxcfs_overlay, mnt_proc) == -1) {
+			ERROR_ERRNO("Could not apply lxcfs overlay on mount %s", mnt_proc);
+			goto error;
+		}
+		INFO("lxcfs overlay mounted successfully.");
+	} else if (lxcfs_is_supported()) {
 		if (lxcfs_mount_proc_overlay(mnt_proc) == -1) {
 			ERROR_ERRNO("Could not apply lxcfs overlay on mount %s", mnt_proc);
 			goto error;
@@ -1835,29 +2895,13 @@ c_vol_start_child(void *volp)
 	}
 
 	/*
-	 * copy cml-service-container binary to target as defined in CSERVICE_TARGET
-	 * Remeber, This will only succeed if targetfs is writable
+	 * provide cml-service-container binary at target as defined in CSERVICE_TARGET
 	 */
 	char *cservice_bin = mem_printf("%s/%s", vol->root, CSERVICE_TARGET);
-	char *cservice_dir = mem_strdup(cservice_bin);
-	char *cservice_dir_p = dirname(cservice_dir);
-	if (dir_mkdir_p(cservice_dir_p, 0755) < 0) {
-		WARN_ERRNO("Could not mkdir '%s' dir", cservice_dir_p);
-	} else if (file_exists("/sbin/cml-service-container-static")) {
-		file_copy("/sbin/cml-service-container-static", cservice_bin, -1, 512, 0);
-		INFO("Copied %s to container", cservice_bin);
-	} else if (file_exists("/usr/sbin/cml-service-container-static")) {
-		file_copy("/usr/sbin/cml-service-container-static", cservice_bin, -1, 512, 0);
-		INFO("Copied %s to container", cservice_bin);
-	} else {
-		WARN_ERRNO("Could not copy %s to container", cservice_bin);
-	}
-
-	if (chmod(cservice_bin, 0755))
-		WARN_ERRNO("Could not set %s executable", cservice_bin);
-
+	if (c_vol_bind_helper("/sbin/cml-service-container-static", cservice_bin) < 0 &&
+	    c_vol_bind_helper("/usr/sbin/cml-service-container-static", cservice_bin) < 0)
+		WARN("Could not provide %s to container", cservice_bin);
 	mem_free0(cservice_bin);
-	mem_free0(cservice_dir);
 
 	if (cmld_is_hostedmode_active())
 		IF_TRUE_GOTO(c_vol_pivot_root(vol) < 0, error);
@@ -1963,28 +3007,95 @@ c_vol_is_encrypted(void *volp)
 	return false;
 }
 
+/*
+ * Stops the removal of the block devices kept from the last run, the device setup in the
+ * early child reuses the existing dm-verity and dm-crypt devices.
+ */
+static int
+c_vol_start_pre_clone(void *volp)
+{
+	c_vol_t *vol = volp;
+	ASSERT(vol);
+
+	// the devices of the last run are recreated by the early child
+	c_vol_teardown_join(vol);
+
+	if (vol->keep_timer) {
+		DEBUG("Reusing kept block devices of container %s",
+		      container_get_description(vol->container));
+		event_remove_timer(vol->keep_timer);
+		event_timer_free(vol->keep_timer);
+		vol->keep_timer = NULL;
+	}
+	c_vol_verity_refs_get(vol);
+	c_vol_shared_mounts_get(vol);
+
+	// left over by a start which failed before the cleanup
+	c_vol_zram_put(vol);
+	if (c_vol_zram_get(vol) < 0)
+		return -COMPARTMENT_ERROR_VOL;
+
+	// the overlay is attached in the latency critical child, open the lxcfs files here
+	if (container_get_type(vol->container) != CONTAINER_TYPE_KVM) {
+		lxcfs_proc_overlay_free(vol->lxcfs_overlay);
+		vol->lxcfs_overlay = lxcfs_proc_overlay_new();
+	}
+	return 0;
+}
+
 static void
 c_vol_cleanup(void *volp, bool is_rebooting)
 {
 	c_vol_t *vol = volp;
 	ASSERT(vol);
 
+	// in case the start failed before the child was cloned
+	lxcfs_proc_overlay_free(vol->lxcfs_overlay);
+	vol->lxcfs_overlay = NULL;
+
 	if (c_vol_umount_all(vol))
 		WARN("Could not umount all images properly");
 
+	// the content of ephemeral volumes is discarded on each stop, also for reboot
+	c_vol_zram_put(vol);
+
 	// keep dm crypt/integrity device up for reboot
-	if (!is_rebooting && c_vol_cleanup_dm(vol))
-		WARN("Could not remove mounts properly");
+	if (is_rebooting)
+		return;
+
+	// keep them for a while for a quick restart, if configured
+	unsigned int keep_time = cmld_get_volume_keep_time();
+	if (keep_time > 0) {
+		if (!vol->keep_timer) {
+			vol->keep_timer =
+				event_timer_new(keep_time * 1000, 1, &c_vol_keep_timeout_cb, vol);
+			event_add_timer(vol->keep_timer);
+		}
+		DEBUG("Keeping block devices of container %s for %us",
+		      container_get_description(vol->container), keep_time);
+		return;
+	}
+
+	c_vol_verity_refs_put(vol);
+	c_vol_shared_mounts_put(vol);
+	c_vol_cleanup_dm_async(vol);
+}
+
+static void
+c_vol_destroy(void *volp)
+{
+	if (c_vol_release_volumes(volp))
+		WARN("Could not remove kept block devices properly");
 }
 
 static compartment_module_t c_vol_module = {
 	.name = MOD_NAME,
 	.compartment_new = c_vol_new,
 	.compartment_free = c_vol_free,
-	.compartment_destroy = NULL,
+	.compartment_destroy = c_vol_destroy,
 	.start_post_clone_early = NULL,
 	.start_child_early = c_vol_start_child_early,
-	.start_pre_clone = NULL,
+	.start_pre_clone = c_vol_start_pre_clone,
 	.start_post_clone = c_vol_start_post_clone,
 	.start_pre_exec = c_vol_start_pre_exec,
 	.start_post_exec = NULL,
@@ -2006,4 +3117,5 @@ c_vol_init(void)
 	container_register_get_rootdir_handler(MOD_NAME, c_vol_get_rootdir);
 	container_register_get_mnt_handler(MOD_NAME, c_vol_get_mnt);
 	container_register_is_encrypted_handler(MOD_NAME, c_vol_is_encrypted);
+	container_register_release_volumes_handler(MOD_NAME, c_vol_release_volumes);
 }
@@ -155,7 +155,7 @@ static compartment_module_t c_xorg_compat_module = {
 	.stop = NULL,
 	.cleanup = c_xorg_compat_cleanup,
 	.join_ns = NULL,
-	.flags = 0,
+	.flags = COMPARTMENT_MODULE_F_LAZY,
 };
 
 static void INIT
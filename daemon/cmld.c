@@ -35,6 +35,7 @@
 #include "common/macro.h"
 #include "common/event.h"
 #include "common/logf.h"
+#include "common/logrotate.h"
 #include "common/list.h"
 #include "common/file.h"
 #include "common/sock.h"
@@ -42,6 +43,9 @@
 #include "common/dir.h"
 #include "common/network.h"
 #include "common/reboot.h"
+#include "common/loopdev.h"
+#include "common/proc.h"
+#include "common/hashmap.h"
 #include "mount.h"
 #include "device_config.h"
 #include "device_id.h"
@@ -51,6 +55,12 @@
 #include "scd.h"
 #include "tss.h"
 #include "ksm.h"
+#include "telemetry.h"
+#include "idlefreeze.h"
+#include "devstats.h"
+#include "exporter.h"
+#include "cpuset.h"
+#include "xdp.h"
 #include "hotplug.h"
 #include "time.h"
 #include "lxcfs.h"
@@ -58,15 +68,20 @@
 #include "time.h"
 #include "container_config.h"
 #include "container.h"
+#include "bootsched.h"
+#include "shutdownsched.h"
 #include "input.h"
 #include "oci.h"
+#include "purge.h"
 
 #include <inttypes.h>
 #include <stdio.h>
 #include <dirent.h>
 #include <errno.h>
+#include <sys/inotify.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <stdbool.h>
@@ -75,17 +90,22 @@
 // clang-format off
 #ifndef CMLD_CONTROL_SOCKET
 #define CMLD_CONTROL_SOCKET SOCK_PATH(control)
+#define CMLD_METRICS_SOCKET SOCK_PATH(metrics)
 #endif // CMLD_CONTROL_SOCKET
 #define CMLD_CONTROL_CONTAINER_SOCKET SOCK_PATH(control)
 // clang-format on
 
 #define CMLD_SUSPEND_TIMEOUT 5000
 
+// time in ms all containers get to stop at cmld exit or device shutdown before being killed
+#define CMLD_SHUTDOWN_DEADLINE 30000
+
 // files and directories in cmld's home path /data/cml
 #define CMLD_PATH_DEVICE_CONF "device.conf"
 #define CMLD_PATH_DEVICE_ID "device_id.conf"
 #define CMLD_PATH_USERS_DIR "users"
 #define CMLD_PATH_GUESTOS_DIR "operatingsystems"
+#define CMLD_PATH_PURGE_DIR "purge"
 #define CMLD_PATH_CONTAINERS_DIR "containers"
 #define CMLD_PATH_CONTAINER_KEYS_DIR "keys"
 #define CMLD_PATH_CONTAINER_TOKENS_DIR "tokens"
@@ -95,6 +115,9 @@
 
 #define CMLD_KSM_AGGRESSIVE_TIME_AFTER_CONTAINER_BOOT 70000
 
+// number of loop devices pre-allocated for the images of the containers
+#define CMLD_LOOPDEV_POOL_SIZE 32
+
 /*
  * dummy key used for unecnrypted c0 and for reboots where the real key
  * is already in kernel
@@ -110,12 +133,44 @@ static const char *cmld_wrapped_keys_path = NULL;
 
 static list_t *cmld_containers_list = NULL; // usually first element is c0
 
+/*
+ * The stat of the config files the containers were loaded from, so that a reload of the
+ * containers only processes added, removed or modified configs. Maps the uuid strings to
+ * their cmld_config_stamp_t. The directory is watched for changes since the last reload.
+ */
+static hashmap_t *cmld_config_stamps = NULL;
+static event_inotify_t *cmld_containers_dir_inotify = NULL;
+static bool cmld_containers_dir_changed = true;
+
+// network tuning profiles of the device config, referenced by the containers
+static list_t *cmld_net_tuning_list = NULL;
+
+typedef struct cmld_config_stamp {
+	char *uuid;
+	struct timespec mtime;
+	off_t size;
+	ino_t ino;
+} cmld_config_stamp_t;
+
+struct cmld_container_event_subscriber {
+	cmld_container_event_cb_t func;
+	void *data;
+};
+
+static list_t *cmld_container_event_subscriber_list = NULL;
+
 static control_t *cmld_control_gui = NULL;
 static control_t *cmld_control_cml = NULL;
 
 static char *cmld_device_uuid = NULL;
 static char *cmld_device_update_base_url = NULL;
 static char *cmld_device_host_dns = NULL;
+static unsigned int cmld_guestos_download_jobs = 1;
+static cryptfs_opts_t cmld_crypt_opts = CRYPTFS_OPTS_DEFAULT;
+static bool cmld_boot_profile = false;
+static unsigned int cmld_boot_parallelism = 0;
+static unsigned int cmld_volume_keep_time = 0;
+static unsigned int cmld_memory_reclaim_idle_time = 0;
 static char *cmld_c0os_name = NULL;
 
 static char *cmld_shared_data_dir = NULL;
@@ -208,85 +263,67 @@ cmld_container_get_by_pid(int pid)
 	return NULL;
 }
 
-static bool
-cmld_containers_are_all_stopped(void)
+int
+cmld_containers_stop(void (*on_all_stopped)(int), int value)
 {
-	for (list_t *l = cmld_containers_list; l; l = l->next) {
-		container_t *c = l->data;
-		if (container_get_state(c) != COMPARTMENT_STATE_STOPPED)
-			return false;
-		else
-			continue;
-	}
-	return true;
+	shutdownsched_stop(CMLD_SHUTDOWN_DEADLINE, on_all_stopped, value);
+	return 0;
 }
 
-typedef struct cmld_container_stop_data {
-	void (*on_all_stopped)(int);
-	int value;
-} cmld_container_stop_data_t;
-
-static void
-cmld_container_stop_cb(container_t *container, container_callback_t *cb, void *data)
+int
+cmld_containers_get_count(void)
 {
-	cmld_container_stop_data_t *stop_data = data;
-
-	ASSERT(container);
-	ASSERT(cb);
-	ASSERT(stop_data);
+	return list_length(cmld_containers_list);
+}
 
-	/* skip if the container is not stopped */
-	IF_FALSE_RETURN_TRACE(container_get_state(container) == COMPARTMENT_STATE_STOPPED);
+container_t *
+cmld_container_get_by_index(int index)
+{
+	return list_nth_data(cmld_containers_list, index);
+}
 
-	/* unregister observer */
-	container_unregister_observer(container, cb);
+void
+cmld_containers_foreach(void (*func)(container_t *container, void *data), void *data)
+{
+	ASSERT(func);
 
-	/* execute on_all_stopped, if all containers are stopped now */
-	if (cmld_containers_are_all_stopped()) {
-		INFO("all containers are stopped now, execution of on_all_stopped()");
-		stop_data->on_all_stopped(stop_data->value);
-		mem_free0(stop_data);
-	}
+	for (list_t *l = cmld_containers_list; l; l = l->next)
+		func(l->data, data);
 }
 
-int
-cmld_containers_stop(void (*on_all_stopped)(int), int value)
+cmld_container_event_subscriber_t *
+cmld_container_events_subscribe(cmld_container_event_cb_t func, void *data)
 {
-	/* execute on_all_stopped, if all containers are stopped now */
-	if (cmld_containers_are_all_stopped()) {
-		INFO("all containers are stopped now, execution of on_all_stopped()");
-		on_all_stopped(value);
-		return 0;
-	}
+	ASSERT(func);
 
-	cmld_container_stop_data_t *stop_data = mem_new0(cmld_container_stop_data_t, 1);
-	stop_data->on_all_stopped = on_all_stopped;
-	stop_data->value = value;
-
-	for (list_t *l = cmld_containers_list; l; l = l->next) {
-		container_t *container = l->data;
-		if (cmld_container_stop(container) == 0) {
-			/* Register observer to wait for completed container_stop */
-			if (!container_register_observer(container, &cmld_container_stop_cb,
-							 stop_data)) {
-				DEBUG("Could not register stop callback");
-				return -1;
-			}
-		}
-	}
-	return 0;
+	cmld_container_event_subscriber_t *subscriber =
+		mem_new0(cmld_container_event_subscriber_t, 1);
+	subscriber->func = func;
+	subscriber->data = data;
+	cmld_container_event_subscriber_list =
+		list_append(cmld_container_event_subscriber_list, subscriber);
+	return subscriber;
 }
 
-int
-cmld_containers_get_count(void)
+void
+cmld_container_events_unsubscribe(cmld_container_event_subscriber_t *subscriber)
 {
-	return list_length(cmld_containers_list);
+	IF_NULL_RETURN(subscriber);
+
+	cmld_container_event_subscriber_list =
+		list_remove(cmld_container_event_subscriber_list, subscriber);
+	mem_free0(subscriber);
 }
 
-container_t *
-cmld_container_get_by_index(int index)
+static void
+cmld_container_events_notify(const container_t *container, bool removed)
 {
-	return list_nth_data(cmld_containers_list, index);
+	for (list_t *l = cmld_container_event_subscriber_list; l;) {
+		cmld_container_event_subscriber_t *subscriber = l->data;
+		// the subscriber may unsubscribe in its callback
+		l = l->next;
+		subscriber->func(container, removed, subscriber->data);
+	}
 }
 
 const char *
@@ -301,6 +338,42 @@ cmld_get_device_update_base_url(void)
 	return cmld_device_update_base_url;
 }
 
+unsigned int
+cmld_get_guestos_download_jobs(void)
+{
+	return cmld_guestos_download_jobs;
+}
+
+const cryptfs_opts_t *
+cmld_get_crypt_opts(void)
+{
+	return &cmld_crypt_opts;
+}
+
+bool
+cmld_is_boot_profile_enabled(void)
+{
+	return cmld_boot_profile;
+}
+
+unsigned int
+cmld_get_boot_parallelism(void)
+{
+	return cmld_boot_parallelism;
+}
+
+unsigned int
+cmld_get_volume_keep_time(void)
+{
+	return cmld_volume_keep_time;
+}
+
+unsigned int
+cmld_get_memory_reclaim_idle_time(void)
+{
+	return cmld_memory_reclaim_idle_time;
+}
+
 const char *
 cmld_get_device_host_dns(void)
 {
@@ -360,6 +433,21 @@ cmld_set_device_provisioned(void)
 	return 0;
 }
 
+static const container_net_tuning_t *
+cmld_net_tuning_get(const char *name)
+{
+	IF_NULL_RETVAL(name, NULL);
+
+	for (list_t *l = cmld_net_tuning_list; l; l = l->next) {
+		container_net_tuning_t *tuning = l->data;
+		if (!strcmp(tuning->name, name))
+			return tuning;
+	}
+
+	WARN("Network tuning profile '%s' not found in device config", name);
+	return NULL;
+}
+
 /**
  * Creates a new container container object. There are three different cases
  * depending on the combination of the given parameters:
@@ -538,6 +626,22 @@ cmld_container_new(const char *store_path, const uuid_t *existing_uuid, const ui
 		// overwrite image sizes of mount table
 		container_config_fill_mount(conf, container_get_mnt(c));
 		container_config_write(conf);
+		container_set_start_order(c, container_config_get_start_priority(conf),
+					  container_config_get_start_after_list_new(conf));
+		container_set_prestart(c, container_config_get_prestart(conf));
+		container_set_ram_soft_limits(c, container_config_get_ram_high(conf),
+					      container_config_get_ram_low(conf));
+		container_io_limits_t io_limits;
+		container_config_get_io_limits(conf, &io_limits);
+		container_set_io_limits(c, &io_limits);
+		container_set_cpu_placement(c, container_config_get_dedicated_cpus(conf),
+					    container_config_get_cpu_priority(conf));
+		container_set_idle_freeze_timeout(c,
+						  container_config_get_idle_freeze_timeout(conf));
+		container_set_net_tuning(
+			c, cmld_net_tuning_get(container_config_get_net_tuning_profile(conf)));
+		container_set_hugepages(c, container_config_get_thp_mode(conf),
+					container_config_get_hugetlb_limits_new(conf));
 	}
 
 out_config:
@@ -586,6 +690,74 @@ cmld_container_config_sync_cb(container_t *container, container_callback_t *cb,
 	mem_free0(c_uuid);
 }
 
+static char *
+cmld_config_file_new(const uuid_t *uuid, const char *path)
+{
+	return mem_printf("%s/%s.conf", path, uuid_string(uuid));
+}
+
+/*
+ * Returns true if the config file of the container is unchanged since it was loaded.
+ */
+static bool
+cmld_config_stamp_matches(const uuid_t *uuid, const char *path)
+{
+	struct stat st;
+	cmld_config_stamp_t *stamp = NULL;
+
+	if (cmld_config_stamps)
+		stamp = hashmap_get(cmld_config_stamps, uuid_string(uuid));
+	IF_NULL_RETVAL(stamp, false);
+
+	char *file = cmld_config_file_new(uuid, path);
+	int ret = stat(file, &st);
+	mem_free0(file);
+	IF_TRUE_RETVAL(ret < 0, false);
+
+	return st.st_ino == stamp->ino && st.st_size == stamp->size &&
+	       st.st_mtim.tv_sec == stamp->mtime.tv_sec &&
+	       st.st_mtim.tv_nsec == stamp->mtime.tv_nsec;
+}
+
+static void
+cmld_config_stamp_drop(const uuid_t *uuid)
+{
+	IF_NULL_RETURN(cmld_config_stamps);
+
+	cmld_config_stamp_t *stamp = hashmap_get(cmld_config_stamps, uuid_string(uuid));
+	IF_NULL_RETURN(stamp);
+
+	hashmap_remove(cmld_config_stamps, stamp->uuid);
+	mem_free0(stamp->uuid);
+	mem_free0(stamp);
+}
+
+/*
+ * Remembers the stat of the config file the container was loaded from.
+ */
+static void
+cmld_config_stamp_update(const uuid_t *uuid, const char *path)
+{
+	struct stat st;
+
+	cmld_config_stamp_drop(uuid);
+
+	char *file = cmld_config_file_new(uuid, path);
+	int ret = stat(file, &st);
+	mem_free0(file);
+	IF_TRUE_RETURN_TRACE(ret < 0);
+
+	if (!cmld_config_stamps)
+		cmld_config_stamps = hashmap_new_str();
+
+	cmld_config_stamp_t *stamp = mem_new0(cmld_config_stamp_t, 1);
+	stamp->uuid = mem_strdup(uuid_string(uuid));
+	stamp->mtime = st.st_mtim;
+	stamp->size = st.st_size;
+	stamp->ino = st.st_ino;
+	hashmap_put(cmld_config_stamps, stamp->uuid, stamp);
+}
+
 container_t *
 cmld_reload_container(const uuid_t *uuid, const char *path)
 {
@@ -638,6 +810,8 @@ cmld_reload_container(const uuid_t *uuid, const char *path)
 	}
 
 	container_set_sync_state(c, true);
+	// after cmld_container_new(), which writes the config back
+	cmld_config_stamp_update(container_get_uuid(c), path);
 
 cleanup:
 	mem_free0(uuid_tmp);
@@ -675,6 +849,12 @@ cmld_load_containers_cb(const char *path, const char *name, UNUSED void *data)
 		goto cleanup;
 	}
 
+	if (cmld_container_get_by_uuid(uuid) && cmld_config_stamp_matches(uuid, path)) {
+		TRACE("Config of container %s is unchanged", prefix);
+		res = 1;
+		goto cleanup;
+	}
+
 	if (cmld_reload_container((const uuid_t *)uuid, path) == NULL) {
 		WARN("Failed to reload container");
 		goto cleanup;
@@ -690,9 +870,49 @@ cleanup:
 	return res;
 }
 
+static int
+cmld_collect_container_configs_cb(const char *path, const char *name, void *data)
+{
+	list_t **files = data;
+
+	size_t len = strlen(name);
+	if (len >= 5 && !strcmp(name + len - 5, ".conf"))
+		*files = list_append(*files, mem_printf("%s/%s", path, name));
+	return 0;
+}
+
+/*
+ * Verifies the signatures of all stored container configs in one batch, so scd checks
+ * them concurrently instead of one after another while the containers are loaded.
+ */
+static void
+cmld_verify_container_configs(const char *path)
+{
+	list_t *files = NULL;
+	IF_FALSE_RETURN(cmld_uses_signed_configs());
+	// a missing directory is reported by cmld_load_containers()
+	if (dir_foreach(path, &cmld_collect_container_configs_cb, &files) < 0 || !files)
+		return;
+
+	size_t n = list_length(files);
+	const char **file_array = mem_new0(const char *, n);
+	size_t i = 0;
+	for (list_t *l = files; l; l = l->next)
+		file_array[i++] = l->data;
+
+	container_config_verify_prefetch(file_array, n);
+
+	mem_free0(file_array);
+	for (list_t *l = files; l; l = l->next)
+		mem_free0(l->data);
+	list_delete(files);
+}
+
 static int
 cmld_load_containers(const char *path)
 {
+	cmld_verify_container_configs(path);
+
 	if (dir_foreach(path, &cmld_load_containers_cb, NULL) < 0) {
 		WARN("Could not open %s to load containers", path);
 		return -1;
@@ -705,12 +925,69 @@ cmld_load_containers(const char *path)
 	return 0;
 }
 
+/*
+ * Removes the stopped containers whose config file was removed from storage.
+ */
+static void
+cmld_remove_stale_containers(void)
+{
+	for (list_t *l = cmld_containers_list; l;) {
+		container_t *container = l->data;
+		l = l->next;
+
+		if (container == cmld_containers_get_c0() ||
+		    container_get_state(container) != COMPARTMENT_STATE_STOPPED ||
+		    file_exists(container_get_config_filename(container)))
+			continue;
+
+		INFO("Config of container %s was removed, removing container",
+		     container_get_description(container));
+		cmld_config_stamp_drop(container_get_uuid(container));
+		cmld_containers_list = list_remove(cmld_containers_list, container);
+		cmld_container_events_notify(container, true);
+		container_free(container);
+	}
+}
+
+static void
+cmld_containers_dir_changed_cb(UNUSED const char *path, UNUSED uint32_t mask,
+			       UNUSED event_inotify_t *inotify, UNUSED void *data)
+{
+	cmld_containers_dir_changed = true;
+}
+
+/*
+ * Watches the containers directory, so that a reload can be skipped if nothing changed.
+ */
+static void
+cmld_containers_dir_watch(const char *path)
+{
+	cmld_containers_dir_inotify =
+		event_inotify_new(path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE,
+				  &cmld_containers_dir_changed_cb, NULL);
+	if (!cmld_containers_dir_inotify || event_add_inotify(cmld_containers_dir_inotify) < 0) {
+		WARN("Could not watch %s, reloading all configs on each reload", path);
+		if (cmld_containers_dir_inotify)
+			event_inotify_free(cmld_containers_dir_inotify);
+		cmld_containers_dir_inotify = NULL;
+	}
+}
+
 int
 cmld_reload_containers(void)
 {
 	int ret = -1;
+
+	if (cmld_containers_dir_inotify && !cmld_containers_dir_changed) {
+		INFO("Container configs unchanged since the last reload");
+		return 0;
+	}
+	cmld_containers_dir_changed = false;
+
 	char *path = mem_printf("%s/%s", cmld_path, CMLD_PATH_CONTAINERS_DIR);
 	ret = cmld_load_containers(path);
+	if (ret == 0)
+		cmld_remove_stale_containers();
 
 	mem_free0(path);
 	return ret;
@@ -718,7 +995,8 @@ cmld_reload_containers(void)
 
 /**
  * Checks if a filename in the /data/logs directory contains
- * "1970" and renames the found files with a new timestamp
+ * "1970" and renames the found files with a new timestamp.
+ * The suffix of compressed log files is kept.
  */
 void
 cmld_rename_logfiles()
@@ -737,8 +1015,12 @@ cmld_rename_logfiles()
 					ERROR("Could not tokenize logfile name %s", entry->d_name);
 					continue;
 				}
+				bool compressed = strstr(entry->d_name, LOGROTATE_SUFFIX);
+				char *filename_with_new_timestamp = logf_file_new_name(filename);
 				char *filename_with_correct_timestamp =
-					logf_file_new_name(filename);
+					mem_printf("%s%s", filename_with_new_timestamp,
+						   compressed ? LOGROTATE_SUFFIX : "");
+				mem_free0(filename_with_new_timestamp);
 				char *old_filename_with_path =
 					mem_printf("%s/%s", LOGFILE_DIR, entry->d_name);
 				char *new_filename_with_path = mem_printf(
@@ -868,6 +1150,42 @@ cmld_audit_compartment_state_cb(container_t *container, container_callback_t *cb
 	}
 }
 
+/*
+ * This callback passes state changes of a container to the container event subscribers.
+ * Observers are also notified if the key of a container is set, so the last notified
+ * state is kept in data.
+ */
+static void
+cmld_container_events_state_cb(container_t *container, container_callback_t *cb, void *data)
+{
+	compartment_state_t *notified_state = data;
+	compartment_state_t state = container_get_state(container);
+
+	if (state != *notified_state) {
+		*notified_state = state;
+		cmld_container_events_notify(container, false);
+	}
+
+	if (state == COMPARTMENT_STATE_STOPPED || state == COMPARTMENT_STATE_REBOOTING) {
+		container_unregister_observer(container, cb);
+		mem_free0(notified_state);
+	}
+}
+
+static bool
+cmld_container_events_register_observer(container_t *container)
+{
+	compartment_state_t *notified_state = mem_new0(compartment_state_t, 1);
+	*notified_state = container_get_state(container);
+
+	if (!container_register_observer(container, &cmld_container_events_state_cb,
+					 notified_state)) {
+		mem_free0(notified_state);
+		return false;
+	}
+	return true;
+}
+
 static void
 cmld_container_register_observers(container_t *container)
 {
@@ -908,6 +1226,11 @@ cmld_container_register_observers(container_t *container)
 		WARN("Could not register container reboot observer callback for %s",
 		     container_get_description(container));
 	}
+	/* register an observer for streaming state changes to the control clients */
+	if (!cmld_container_events_register_observer(container)) {
+		WARN("Could not register container event observer callback for %s",
+		     container_get_description(container));
+	}
 }
 
 int
@@ -1087,6 +1410,29 @@ cmld_init_c0_cb(container_t *container, container_callback_t *cb, void *data)
 	// TODO think about if this is unregistered correctly in corner cases...
 }
 
+/*
+ * Prepares the start of a container which requests it in its config and is not started
+ * automatically anyway. The volumes of encrypted containers cannot be set up before the
+ * user provides the key on start.
+ */
+static void
+cmld_container_prestart(container_t *container)
+{
+	IF_FALSE_RETURN(container_get_prestart(container) &&
+			!container_get_allow_autostart(container));
+
+	if (container_is_encrypted(container)) {
+		WARN("Cannot prepare start of encrypted container %s",
+		     container_get_description(container));
+		return;
+	}
+
+	INFO("Preparing start of container %s", container_get_description(container));
+	if (container_prestart(container) < 0)
+		WARN("Could not prepare start of container %s",
+		     container_get_description(container));
+}
+
 static void
 cmld_c0_boot_complete_cb(container_t *container, container_callback_t *cb, UNUSED void *data)
 {
@@ -1097,14 +1443,10 @@ cmld_c0_boot_complete_cb(container_t *container, container_callback_t *cb, UNUSE
 		cmld_rename_logfiles();
 		container_unregister_observer(container, cb);
 
-		for (list_t *l = cmld_containers_list; l; l = l->next) {
-			container_t *container = l->data;
-			if (container_get_allow_autostart(container)) {
-				INFO("Autostarting container %s in background",
-				     container_get_name(container));
-				cmld_container_start(container);
-			}
-		}
+		bootsched_start(cmld_containers_list, cmld_boot_parallelism);
+
+		for (list_t *l = cmld_containers_list; l; l = l->next)
+			cmld_container_prestart(l->data);
 	}
 }
 
@@ -1124,38 +1466,20 @@ cmld_handle_device_shutdown(void)
 }
 
 /**
- * This observer callback is attached to each container in order to check for other running containers.
- * It ensures that as soon as the last container went down, the device is shut down.
+ * Shuts the device down as soon as all containers went down, see cmld_shutdown_c0_cb().
  */
 static void
-cmld_shutdown_container_cb(container_t *container, container_callback_t *cb, UNUSED void *data)
+cmld_device_shutdown_cb(UNUSED int value)
 {
-	compartment_state_t state = container_get_state(container);
-
-	if (!(state == COMPARTMENT_STATE_STOPPED || state == COMPARTMENT_STATE_ZOMBIE)) {
-		return;
-	}
-
-	container_unregister_observer(container, cb);
-
-	DEBUG("Device shutdown: container %s went down, checking others before shutdown",
-	      container_get_description(container));
-
-	for (list_t *l = cmld_containers_list; l; l = l->next) {
-		if (!(container_get_state(l->data) == COMPARTMENT_STATE_STOPPED ||
-		      container_get_state(l->data) == COMPARTMENT_STATE_ZOMBIE)) {
-			DEBUG("Device shutdown: There are still running containers, can't shut down");
-			return;
-		}
-	}
-
 	IF_TRUE_RETURN_TRACE(cmld_hostedmode);
 
 	/* all containers are down, so shut down */
 	DEBUG("Device shutdown: last container down; shutdown now");
 
-	audit_log_event(container_get_uuid(container), SSA, CMLD, CONTAINER_MGMT, "shutdown",
-			uuid_string(container_get_uuid(container)), 0);
+	container_t *c0 = cmld_containers_get_c0();
+	if (c0)
+		audit_log_event_sync(container_get_uuid(c0), SSA, CMLD, CONTAINER_MGMT, "shutdown",
+				     uuid_string(container_get_uuid(c0)), 0);
 
 	cmld_handle_device_shutdown();
 }
@@ -1168,7 +1492,6 @@ static void
 cmld_shutdown_c0_cb(container_t *c0, container_callback_t *cb, UNUSED void *data)
 {
 	compartment_state_t c0_state = container_get_state(c0);
-	bool shutdown_now = true;
 
 	/* only execute the callback if c0 goes down */
 	if (!(c0_state == COMPARTMENT_STATE_SHUTTING_DOWN ||
@@ -1178,42 +1501,12 @@ cmld_shutdown_c0_cb(container_t *c0, container_callback_t *cb, UNUSED void *data
 	audit_log_event(container_get_uuid(c0), SSA, CMLD, CONTAINER_MGMT, "shutdown-c0-start",
 			uuid_string(container_get_uuid(c0)), 0);
 
-	DEBUG("Device shutdown: c0 went down or shutting down, checking others before shutdown");
-
-	/* iterate over containers and check their status:
-	 * - every container, which is not yet down gets an observer to inspect global containers' statuses
-	 * - every container, which is furthermore not yet shutting down, is sent the shutdown command, which
-	 *   needs not to be done for c0, as this observer callback call tells that it is either already
-	 *   dead or in shutting down state
-	 */
-	for (list_t *l = cmld_containers_list; l; l = l->next) {
-		if (!(container_get_state(l->data) == COMPARTMENT_STATE_STOPPED ||
-		      container_get_state(l->data) == COMPARTMENT_STATE_ZOMBIE)) {
-			shutdown_now = false;
-			if (!container_register_observer(l->data, &cmld_shutdown_container_cb,
-							 NULL)) {
-				ERROR("Could not register observer shutdown callback for %s",
-				      container_get_description(l->data));
-			}
-			if (l->data != c0 &&
-			    !(container_get_state(l->data) == COMPARTMENT_STATE_SHUTTING_DOWN)) {
-				DEBUG("Device shutdown: There is another running container:%s. Shut it down first",
-				      container_get_description(l->data));
-				cmld_container_stop(l->data);
-			}
-		}
-	}
+	DEBUG("Device shutdown: c0 went down or shutting down, stopping the other containers");
 
 	container_unregister_observer(c0, cb);
 
-	if (shutdown_now && !cmld_hostedmode) {
-		/* all containers are down, so shut down */
-		DEBUG("Device shutdown: all containers already down; shutdown now");
-		audit_log_event(container_get_uuid(c0), SSA, CMLD, CONTAINER_MGMT, "shutdown",
-				uuid_string(container_get_uuid(c0)), 0);
-
-		cmld_handle_device_shutdown();
-	}
+	/* c0 is already going down, the others are stopped concurrently with one deadline */
+	shutdownsched_stop(CMLD_SHUTDOWN_DEADLINE, &cmld_device_shutdown_cb, 0);
 }
 
 /*
@@ -1298,6 +1591,11 @@ cmld_start_c0(container_t *new_c0)
 		WARN("Could not register observer boot complete callback on c0");
 		return -1;
 	}
+	/* register an observer for streaming state changes to the control clients */
+	if (!cmld_container_events_register_observer(new_c0)) {
+		WARN("Could not register container event observer callback for %s",
+		     container_get_description(new_c0));
+	}
 
 	container_set_key(new_c0, DUMMY_KEY);
 	if (container_start(new_c0)) {
@@ -1412,6 +1710,28 @@ cmld_init(const char *path)
 
 	const char *update_base_url = device_config_get_update_base_url(device_config);
 	cmld_device_update_base_url = update_base_url ? mem_strdup(update_base_url) : NULL;
+	cmld_guestos_download_jobs = MAX(device_config_get_guestos_download_jobs(device_config), 1);
+	cmld_net_tuning_list = device_config_get_net_tuning_list_new(device_config);
+	cmld_crypt_opts.integrity_mode = device_config_get_integrity_journal(device_config) ?
+						 CRYPTFS_INTEGRITY_JOURNAL :
+						 CRYPTFS_INTEGRITY_DIRECT;
+	if (device_config_get_crypt_no_read_workqueue(device_config))
+		cmld_crypt_opts.flags |= CRYPTFS_FLAG_NO_READ_WORKQUEUE;
+	if (device_config_get_crypt_no_write_workqueue(device_config))
+		cmld_crypt_opts.flags |= CRYPTFS_FLAG_NO_WRITE_WORKQUEUE;
+	if (device_config_get_crypt_same_cpu_crypt(device_config))
+		cmld_crypt_opts.flags |= CRYPTFS_FLAG_SAME_CPU_CRYPT;
+	if (device_config_get_crypt_submit_from_crypt_cpus(device_config))
+		cmld_crypt_opts.flags |= CRYPTFS_FLAG_SUBMIT_FROM_CRYPT_CPUS;
+	cmld_crypt_opts.sector_size = device_config_get_crypt_sector_size(device_config);
+	if (device_config_get_integrity_lazy_init(device_config))
+		cmld_crypt_opts.flags |= CRYPTFS_FLAG_LAZY_INIT;
+	if (device_config_get_crypt_inline_encryption(device_config))
+		cmld_crypt_opts.flags |= CRYPTFS_FLAG_INLINE_CRYPT;
+	cmld_boot_profile = device_config_get_boot_profile(device_config);
+	cmld_boot_parallelism = device_config_get_boot_parallelism(device_config);
+	cmld_volume_keep_time = device_config_get_volume_keep_time(device_config);
+	cmld_memory_reclaim_idle_time = device_config_get_memory_reclaim_idle_time(device_config);
 
 	const char *host_dns = device_config_get_host_dns(device_config);
 	cmld_device_host_dns = host_dns ? mem_strdup(host_dns) : NULL;
@@ -1464,6 +1784,47 @@ cmld_init(const char *path)
 	else
 		INFO("ksm initialized.");
 
+	if (telemetry_init(device_config_get_telemetry_interval(device_config)) < 0) {
+		WARN("Could not init telemetry module");
+	} else {
+		INFO("telemetry initialized.");
+		if (atexit(&telemetry_cleanup))
+			WARN("Could not register on exit cleanup method 'telemetry_cleanup()'");
+	}
+
+	if (idlefreeze_init() < 0) {
+		WARN("Could not init idle freeze module");
+	} else {
+		INFO("idle freeze initialized.");
+		if (atexit(&idlefreeze_cleanup))
+			WARN("Could not register on exit cleanup method 'idlefreeze_cleanup()'");
+	}
+
+	if (devstats_init(device_config_get_device_stats_interval(device_config)) < 0) {
+		WARN("Could not init device stats module");
+	} else {
+		INFO("device stats initialized.");
+		if (atexit(&devstats_cleanup))
+			WARN("Could not register on exit cleanup method 'devstats_cleanup()'");
+	}
+
+	if (cpuset_init(device_config_get_cpuset_rebalance_interval(device_config)) < 0) {
+		WARN("Could not init cpuset manager");
+	} else {
+		INFO("cpuset manager initialized.");
+		if (atexit(&cpuset_cleanup))
+			WARN("Could not register on exit cleanup method 'cpuset_cleanup()'");
+	}
+
+	network_set_nftables(device_config_get_firewall_nftables(device_config));
+	xdp_set_mac_filter(device_config_get_mac_filter_xdp(device_config));
+
+	loopdev_set_direct_io(device_config_get_loop_direct_io(device_config));
+	if (loopdev_pool_init(CMLD_LOOPDEV_POOL_SIZE) < 0)
+		WARN("Could not pre-allocate loop devices");
+	else
+		INFO("loop device pool initialized.");
+
 	if (device_config_get_tpm_enabled(device_config)) {
 		if (tss_init(!cmld_is_hostedmode_active()) < 0) {
 			FATAL("Failed to initialize TSS / TPM 2.0 and tpm2d");
@@ -1505,6 +1866,17 @@ cmld_init(const char *path)
 	}
 	INFO("created control socket.");
 
+	if (exporter_init(device_config_get_metrics_socket(device_config) ? CMLD_METRICS_SOCKET :
+									    NULL,
+			  device_config_get_metrics_file(device_config),
+			  device_config_get_metrics_interval(device_config)) < 0) {
+		WARN("Could not init metrics exporter");
+	} else {
+		INFO("metrics exporter initialized.");
+		if (atexit(&exporter_cleanup))
+			WARN("Could not register on exit cleanup method 'exporter_cleanup()'");
+	}
+
 #ifdef OCI
 	cmld_oci_control_cml = oci_control_local_new(CMLD_OCI_CONTROL_SOCKET);
 	if (!cmld_oci_control_cml) {
@@ -1513,6 +1885,12 @@ cmld_init(const char *path)
 	INFO("created oci control socket.");
 #endif
 
+	// obsolete guestos images are deleted in the background, see guestos_purge()
+	char *purge_path = mem_printf("%s/%s", path, CMLD_PATH_PURGE_DIR);
+	if (purge_init(purge_path) < 0)
+		WARN("Could not init purging, files will be deleted immediately");
+	mem_free0(purge_path);
+
 	char *guestos_path = mem_printf("%s/%s", path, CMLD_PATH_GUESTOS_DIR);
 	bool allow_locally_signed = device_config_get_locally_signed_images(device_config);
 	if (guestos_mgr_init(guestos_path, allow_locally_signed) < 0 && !cmld_hostedmode)
@@ -1532,6 +1910,7 @@ cmld_init(const char *path)
 	if (cmld_init_c0(containers_path, device_config_get_c0os(device_config)) < 0)
 		FATAL("Could not init c0");
 
+	cmld_containers_dir_watch(containers_path);
 	if (cmld_load_containers(containers_path) < 0)
 		FATAL("Could not load containers");
 
@@ -1548,12 +1927,132 @@ cmld_init(const char *path)
 	return 0;
 }
 
+static const char *const cmld_container_config_suffixes[] = { ".conf", ".sig", ".cert" };
+
+/*
+ * Copies the config files of a container to the ones of a new container with the given
+ * prefix, i.e. its store path followed by its uuid.
+ */
+static int
+cmld_container_clone_config(const container_t *container, const char *prefix)
+{
+	const char *conf = container_get_config_filename(container);
+	char *src_prefix = mem_strndup(conf, strlen(conf) - strlen(".conf"));
+	int ret = 0;
+
+	for (size_t i = 0; i < ELEMENTSOF(cmld_container_config_suffixes) && ret == 0; i++) {
+		char *src = mem_printf("%s%s", src_prefix, cmld_container_config_suffixes[i]);
+		char *dst = mem_printf("%s%s", prefix, cmld_container_config_suffixes[i]);
+		// signature and certificate only exist for signed configs
+		if (i == 0 || file_exists(src))
+			ret = file_copy(src, dst, -1, 512, 0);
+		mem_free0(src);
+		mem_free0(dst);
+	}
+
+	mem_free0(src_prefix);
+	return ret;
+}
+
+/*
+ * Copies the images of a container to the images directory of a new container. Regular
+ * files are cloned by file_copy() on file systems like btrfs and xfs, so the images of the
+ * clone share their storage with the source until they diverge.
+ */
+static int
+cmld_container_clone_images(const container_t *container, const char *images_dir)
+{
+	const mount_t *mnt = container_get_mnt(container);
+	int ret = 0;
+
+	if (mkdir(images_dir, 0700) < 0) {
+		ERROR_ERRNO("Could not create images directory %s", images_dir);
+		return -1;
+	}
+
+	for (size_t i = 0; i < mount_get_count(mnt) && ret == 0; i++) {
+		const mount_entry_t *mntent = mount_get_entry(mnt, i);
+		char *src = mem_printf("%s/%s.img", container_get_images_dir(container),
+				       mount_entry_get_img(mntent));
+		char *dst = mem_printf("%s/%s.img", images_dir, mount_entry_get_img(mntent));
+
+		// images which are not created yet or are shared with the guestos are skipped
+		if (file_exists(src) && !file_exists(dst)) {
+			DEBUG("Cloning image %s to %s", src, dst);
+			ret = file_copy(src, dst, -1, 512, 0);
+			// the kernel refuses to mount two btrfs file systems with the same uuid
+			if (ret == 0 && !strcmp(mount_entry_get_fs(mntent), "btrfs")) {
+				const char *const argv[] = { "btrfstune", "-f", "-u", dst, NULL };
+				ret = proc_fork_and_execvp(argv);
+			}
+			if (ret < 0)
+				ERROR("Could not clone image %s to %s", src, dst);
+		}
+		mem_free0(src);
+		mem_free0(dst);
+	}
+	return ret;
+}
+
 container_t *
 cmld_container_create_clone(container_t *container)
 {
 	ASSERT(container);
-	ASSERT(0); // TODO
-	return NULL;
+
+	container_t *c = NULL;
+	char *path = mem_printf("%s/%s", cmld_path, CMLD_PATH_CONTAINERS_DIR);
+	uuid_t *uuid = uuid_new(NULL);
+	char *prefix = mem_printf("%s/%s", path, uuid_string(uuid));
+
+	if (container_get_state(container) != COMPARTMENT_STATE_STOPPED) {
+		WARN("Only stopped containers can be cloned, %s is running",
+		     container_get_description(container));
+		goto out;
+	}
+	// the volume keys are bound to the source container
+	if (container_is_encrypted(container)) {
+		WARN("Cannot clone encrypted container %s", container_get_description(container));
+		goto out;
+	}
+
+	INFO("Cloning container %s to %s", container_get_description(container),
+	     uuid_string(uuid));
+	if (cmld_container_clone_config(container, prefix) < 0 ||
+	    cmld_container_clone_images(container, prefix) < 0) {
+		ERROR("Could not clone container %s", container_get_description(container));
+		goto err;
+	}
+
+	c = cmld_container_new(path, uuid, NULL, 0, NULL, 0, NULL, 0);
+	IF_NULL_GOTO_ERROR(c, err);
+
+	cmld_containers_list = list_append(cmld_containers_list, c);
+	if (!container_register_observer(c, &cmld_container_config_sync_cb, NULL)) {
+		WARN("Could not register container config sync observer callback for %s",
+		     container_get_description(c));
+	}
+
+	audit_log_event(container_get_uuid(c), SSA, CMLD, CONTAINER_MGMT, "container-clone",
+			uuid_string(container_get_uuid(c)), 0);
+	cmld_container_events_notify(c, false);
+	INFO("Created container %s as clone of %s", container_get_description(c),
+	     container_get_description(container));
+	goto out;
+
+err:
+	audit_log_event(container_get_uuid(container), FSA, CMLD, CONTAINER_MGMT,
+			"container-clone", uuid_string(container_get_uuid(container)), 0);
+	dir_delete_folder(path, uuid_string(uuid));
+	for (size_t i = 0; i < ELEMENTSOF(cmld_container_config_suffixes); i++) {
+		char *file = mem_printf("%s%s", prefix, cmld_container_config_suffixes[i]);
+		unlink(file);
+		mem_free0(file);
+	}
+out:
+	mem_free0(prefix);
+	uuid_free(uuid);
+	mem_free0(path);
+	return c;
 }
 
 container_t *
@@ -1591,6 +2090,7 @@ cmld_container_create_from_config(const uint8_t *config, size_t config_len, uint
 
 		audit_log_event(container_get_uuid(c), SSA, CMLD, CONTAINER_MGMT,
 				"container-create", uuid_string(container_get_uuid(c)), 0);
+		cmld_container_events_notify(c, false);
 		INFO("Created container %s (uuid=%s).", container_get_name(c),
 		     uuid_string(container_get_uuid(c)));
 	} else {
@@ -1627,9 +2127,11 @@ cmld_container_destroy_cb(container_t *container, container_callback_t *cb, UNUS
 	}
 
 	/* cleanup container */
+	cmld_config_stamp_drop(container_get_uuid(container));
 	cmld_containers_list = list_remove(cmld_containers_list, container);
 	audit_log_event(container_get_uuid(container), SSA, CMLD, CONTAINER_MGMT,
 			"container-remove", uuid_string(container_get_uuid(container)), 0);
+	cmld_container_events_notify(container, true);
 	container_free(container);
 }
 
@@ -1717,6 +2219,44 @@ cmld_container_unfreeze(container_t *container)
 	return container_unfreeze(container);
 }
 
+int
+cmld_containers_freeze_all(void)
+{
+	int ret = 0;
+
+	// only request the freeze of all containers, the completion is signaled per container
+	for (list_t *l = cmld_containers_list; l; l = l->next) {
+		container_t *container = l->data;
+		if (container == cmld_containers_get_c0() ||
+		    container_get_state(container) != COMPARTMENT_STATE_RUNNING)
+			continue;
+		if (container_freeze(container) < 0) {
+			WARN("Could not freeze container %s", container_get_description(container));
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+int
+cmld_containers_unfreeze_all(void)
+{
+	int ret = 0;
+
+	for (list_t *l = cmld_containers_list; l; l = l->next) {
+		container_t *container = l->data;
+		compartment_state_t state = container_get_state(container);
+		if (state != COMPARTMENT_STATE_FROZEN && state != COMPARTMENT_STATE_FREEZING)
+			continue;
+		if (container_unfreeze(container) < 0) {
+			WARN("Could not unfreeze container %s",
+			     container_get_description(container));
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
 int
 cmld_container_allow_audio(container_t *container)
 {
@@ -1737,8 +2277,8 @@ int
 cmld_container_snapshot(container_t *container)
 {
 	ASSERT(container);
-	WARN("Container snapshot is not implemented, yet");
-	return 0;
+
+	return container_checkpoint(container);
 }
 
 int
@@ -1746,24 +2286,102 @@ cmld_container_wipe(container_t *container)
 {
 	ASSERT(container);
 
-	/* remove wrapped key */
+	/*
+	 * Crypto-erase: without the wrapped key, the encrypted images are unreadable,
+	 * so the key is destroyed before the images are discarded.
+	 */
 	char *key_file = mem_printf("%s/%s.key", cmld_get_wrapped_keys_dir(),
 				    uuid_string(container_get_uuid(container)));
-	if (file_exists(key_file))
-		unlink(key_file);
+	if (file_exists(key_file) && file_shred(key_file) < 0 && unlink(key_file) < 0)
+		WARN_ERRNO("Could not delete wrapped key %s", key_file);
 
 	mem_free0(key_file);
 	return container_wipe(container);
 }
 
-void
-cmld_wipe_device()
+static int
+cmld_wipe_shred_cb(const char *path, const char *file, UNUSED void *data)
+{
+	char *file_path = mem_printf("%s/%s", path, file);
+	if (file_is_dir(file_path))
+		dir_foreach(file_path, &cmld_wipe_shred_cb, NULL);
+	else if (file_shred(file_path) < 0)
+		WARN("Could not shred %s", file_path);
+	mem_free0(file_path);
+	return 0;
+}
+
+static int
+cmld_wipe_discard_cb(const char *path, const char *file, UNUSED void *data)
+{
+	char *file_path = mem_printf("%s/%s", path, file);
+	int len = strlen(file);
+	if (file_is_dir(file_path))
+		dir_foreach(file_path, &cmld_wipe_discard_cb, NULL);
+	else if (len >= 4 && !strcmp(file + len - 4, ".img") && file_discard(file_path) < 0)
+		DEBUG("Could not discard %s, only deleting it", file_path);
+	mem_free0(file_path);
+	return 0;
+}
+
+static void
+cmld_wipe_device_images(void)
 {
+	char *path = mem_printf("%s/%s", cmld_path, CMLD_PATH_CONTAINERS_DIR);
+	dir_foreach(path, &cmld_wipe_discard_cb, NULL);
+	mem_free0(path);
+
 	dir_delete_folder(cmld_path, CMLD_PATH_GUESTOS_DIR);
+	dir_delete_folder(cmld_path, CMLD_PATH_PURGE_DIR);
 	dir_delete_folder(cmld_path, CMLD_PATH_CONTAINERS_DIR);
+	dir_delete_folder(LOGFILE_DIR, "");
+}
+
+static void
+cmld_wipe_device_child_cb(pid_t pid, int status, event_child_t *child, UNUSED void *data)
+{
+	bool success = WIFEXITED(status) && !WEXITSTATUS(status);
+	INFO("Wiping images (PID=%d) %s", pid, success ? "finished" : "failed");
+
+	event_child_free(child);
+	if (!cmld_hostedmode)
+		reboot_reboot(POWER_OFF);
+}
+
+void
+cmld_wipe_device()
+{
+	/*
+	 * Crypto-erase: the container data is encrypted, so destroying the wrapped
+	 * keys and the tokens they are wrapped with renders it unreadable. The
+	 * images are discarded and deleted afterwards in the background.
+	 */
+	char *path = mem_printf("%s/%s", cmld_path, CMLD_PATH_CONTAINER_KEYS_DIR);
+	dir_foreach(path, &cmld_wipe_shred_cb, NULL);
+	mem_free0(path);
+	path = mem_printf("%s/%s", cmld_path, CMLD_PATH_CONTAINER_TOKENS_DIR);
+	dir_foreach(path, &cmld_wipe_shred_cb, NULL);
+	mem_free0(path);
 	dir_delete_folder(cmld_path, CMLD_PATH_CONTAINER_KEYS_DIR);
 	dir_delete_folder(cmld_path, CMLD_PATH_CONTAINER_TOKENS_DIR);
-	dir_delete_folder(LOGFILE_DIR, "");
+	INFO("Destroyed container keys and tokens");
+
+	pid_t pid = fork();
+	switch (pid) {
+	case -1:
+		WARN_ERRNO("Could not fork to wipe images, wiping synchronously");
+		break;
+	case 0:
+		cmld_wipe_device_images();
+		_exit(0);
+	default: {
+		event_child_t *child = event_child_new(pid, cmld_wipe_device_child_cb, NULL);
+		event_add_child(child);
+		return;
+	}
+	}
+
+	cmld_wipe_device_images();
 	if (!cmld_hostedmode)
 		reboot_reboot(POWER_OFF);
 }
@@ -1827,12 +2445,19 @@ cmld_netif_phys_add_by_name(const char *if_name)
 void
 cmld_cleanup(void)
 {
+	purge_cleanup();
+
 	for (list_t *l = cmld_containers_list; l; l = l->next) {
 		container_t *container = l->data;
 		container_free(container);
 	}
 	list_delete(cmld_containers_list);
 
+	if (cmld_containers_dir_inotify) {
+		event_remove_inotify(cmld_containers_dir_inotify);
+		event_inotify_free(cmld_containers_dir_inotify);
+	}
+
 	if (cmld_control_gui)
 		control_free(cmld_control_gui);
 	if (cmld_control_cml)
@@ -1854,6 +2479,10 @@ cmld_cleanup(void)
 		mem_free0(name);
 	}
 	list_delete(cmld_netif_phys_list);
+
+	for (list_t *l = cmld_net_tuning_list; l; l = l->next)
+		container_net_tuning_free(l->data);
+	list_delete(cmld_net_tuning_list);
 }
 
 void
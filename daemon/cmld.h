@@ -36,6 +36,7 @@
 #define CMLD_H
 
 #include "container.h"
+#include "common/cryptfs.h"
 #include "control.h"
 
 #ifndef DEFAULT_BASE_PATH
@@ -47,6 +48,15 @@
 #ifndef LOGFILE_DIR
 #define LOGFILE_DIR "/data/logs"
 #endif
+#ifndef LOGFILE_MAX_SIZE
+#define LOGFILE_MAX_SIZE (8 * 1024 * 1024) // rotate log files after 8 MiB
+#endif
+#ifndef LOGFILE_MAX_AGE
+#define LOGFILE_MAX_AGE (24 * 60 * 60) // or after one day
+#endif
+#ifndef LOGFILE_KEEP
+#define LOGFILE_KEEP 16 // number of rotated log files kept per daemon
+#endif
 
 #define PROVISIONED_FILE_NAME "_cml_provisioned_"
 
@@ -165,6 +175,21 @@ cmld_container_freeze(container_t *container);
 int
 cmld_container_unfreeze(container_t *container);
 
+/**
+ * Freezes all running containers except c0 in one pass, e.g. before a suspend. The freeze
+ * is only requested, the containers switch to FROZEN asynchronously.
+ *
+ * @return 0 if the freeze was requested for all containers, -1 otherwise
+ */
+int
+cmld_containers_freeze_all(void);
+
+/**
+ * Unfreezes all frozen or freezing containers in one pass.
+ */
+int
+cmld_containers_unfreeze_all(void);
+
 int
 cmld_container_allow_audio(container_t *container);
 
@@ -177,12 +202,26 @@ cmld_container_deny_audio(container_t *container);
 //const char *
 //cmld_container_getstate(container_t *container);
 
+/**
+ * Checkpoints the running container, which is resumed on its next start.
+ * Requires cmld to be built with CRIU support.
+ */
 int
 cmld_container_snapshot(container_t *container);
 
+/**
+ * Wipes the container by destroying its wrapped key first (crypto-erase) and
+ * discarding and deleting its images afterwards.
+ */
 int
 cmld_container_wipe(container_t *container);
 
+/**
+ * Wipes the device by destroying all wrapped keys and tokens, which renders the
+ * encrypted container data unreadable before this function returns. The images
+ * and logs are discarded and deleted in the background, then the device is
+ * powered off unless in hosted mode.
+ */
 void
 cmld_wipe_device();
 
@@ -198,9 +237,29 @@ cmld_container_get_by_pid(int pid);
 int
 cmld_containers_stop(void (*on_all_stopped)(int), int value);
 
-/* state as parameter? */
-//void
-//cmld_containers_foreach(/*function, params*/);
+/**
+ * Calls func for each container, in one walk over the list of containers.
+ */
+void
+cmld_containers_foreach(void (*func)(container_t *container, void *data), void *data);
+
+typedef struct cmld_container_event_subscriber cmld_container_event_subscriber_t;
+
+/**
+ * Called if a container was added, changed its state or, with removed set, is about
+ * to be freed after it was removed.
+ */
+typedef void (*cmld_container_event_cb_t)(const container_t *container, bool removed,
+					  void *data);
+
+/**
+ * Registers func to be called on each following container event.
+ */
+cmld_container_event_subscriber_t *
+cmld_container_events_subscribe(cmld_container_event_cb_t func, void *data);
+
+void
+cmld_container_events_unsubscribe(cmld_container_event_subscriber_t *subscriber);
 
 //void
 //cmld_containers_foreach_running();
@@ -226,6 +285,43 @@ cmld_get_device_uuid(void);
 const char *
 cmld_get_device_update_base_url(void);
 
+/**
+ * Get the number of guestos images which are downloaded concurrently.
+ */
+unsigned int
+cmld_get_guestos_download_jobs(void);
+
+/**
+ * Get the dm-crypt options of encrypted container volumes configured in device.conf.
+ */
+const cryptfs_opts_t *
+cmld_get_crypt_opts(void);
+
+/**
+ * Returns true if the boot profiles of container images are recorded and replayed.
+ */
+bool
+cmld_is_boot_profile_enabled(void);
+
+/**
+ * Returns the maximum number of concurrently starting containers, 0 for no limit.
+ */
+unsigned int
+cmld_get_boot_parallelism(void);
+
+/**
+ * Returns the time in seconds the block devices of a stopped container are kept set up.
+ */
+unsigned int
+cmld_get_volume_keep_time(void);
+
+/**
+ * Returns the time in seconds after which the memory of an idle container is reclaimed,
+ * 0 if disabled.
+ */
+unsigned int
+cmld_get_memory_reclaim_idle_time(void);
+
 /**
  * Get the path where images that can be shared between containers are stored.
  */
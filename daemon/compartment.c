@@ -25,6 +25,7 @@
 #include <sched.h>
 
 #include "compartment.h"
+#include "starttrace.h"
 
 //#define LOGF_LOG_MIN_PRIO LOGF_PRIO_TRACE
 #include "common/macro.h"
@@ -35,9 +36,10 @@
 #include "common/sock.h"
 #include "common/event.h"
 #include "common/file.h"
-#include "common/dir.h"
+#include "common/fd.h"
 #include "common/proc.h"
 #include "common/ns.h"
+#include "common/probe.h"
 
 #include <inttypes.h>
 #include <stdint.h>
@@ -51,6 +53,8 @@
 #include <sys/wait.h>
 #include <pty.h>
 #include <sys/mman.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #define CLONE_STACK_SIZE 8 * 1024 * 1024
 /* Define some missing clone flags in BIONIC */
@@ -72,6 +76,44 @@
 #ifndef CLONE_NEWNET
 #define CLONE_NEWNET 0x40000000
 #endif
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+// clang-format off
+#ifndef __NR_clone3
+	#if defined _MIPS_SIM
+		#if _MIPS_SIM == _MIPS_SIM_ABI32        /* o32 */
+			#define __NR_clone3 (435 + 4000)
+		#endif
+		#if _MIPS_SIM == _MIPS_SIM_NABI32       /* n32 */
+			#define __NR_clone3 (435 + 6000)
+		#endif
+		#if _MIPS_SIM == _MIPS_SIM_ABI64        /* n64 */
+			#define __NR_clone3 (435 + 5000)
+		#endif
+	#elif defined __ia64__
+		#define __NR_clone3 (435 + 1024)
+	#else
+		#define __NR_clone3 435
+	#endif
+#endif
+// clang-format on
+
+/* layout of struct clone_args of linux/sched.h including the cgroup field (CLONE_ARGS_SIZE_VER2) */
+struct compartment_clone_args {
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+	uint64_t set_tid;
+	uint64_t set_tid_size;
+	uint64_t cgroup;
+};
 
 extern logf_handler_t *cml_daemon_logfile_handler;
 
@@ -113,9 +155,12 @@ struct compartment {
 	 * the FD to the child via clone */
 	int sync_sock_parent; /* parent sock for start synchronization */
 	int sync_sock_child;  /* child sock for start synchronization */
+	int clone_cgroup_fd;  /* cgroup to clone the init into, set by the cgroups module */
 
 	// Submodules
 	list_t *module_instance_list;
+	void **module_instances;     // instances indexed by module slot
+	size_t module_instances_len; // number of registered modules at creation time
 
 	bool setup_mode;
 
@@ -123,8 +168,14 @@ struct compartment {
 	bool is_synced;
 
 	list_t *helper_child_list; // helper children spawned during startup
+	starttrace_t *starttrace;  // trace of the module hooks of the current start
+	starttrace_phase_t *start_phases; // hook durations of the last completed start
+	size_t start_phases_len;
+	event_signal_t *sigchld;   // SIGCHLD handler reaping the compartment's processes
 	bool is_doing_cleanup;
 	bool is_rebooting;
+	bool park_start; // prepare the next start only, see compartment_prestart()
+	bool is_parked;	 // the child of a prepared start waits for the go message
 };
 
 struct compartment_callback {
@@ -146,6 +197,8 @@ typedef struct {
 typedef struct {
 	pid_t pid;
 	char *name;
+	event_child_t *event;	    /* reaps the helper once it exited */
+	compartment_t *compartment; /* the compartment the helper belongs to */
 } compartment_helper_child_t;
 /**
  * These are used for synchronizing the compartment start between parent
@@ -165,7 +218,7 @@ compartment_is_stoppable(compartment_t *compartment)
 {
 	compartment_state_t state = compartment_get_state(compartment);
 	if (state == COMPARTMENT_STATE_RUNNING || state == COMPARTMENT_STATE_BOOTING ||
-	    state == COMPARTMENT_STATE_SETUP) {
+	    state == COMPARTMENT_STATE_SETUP || compartment->is_parked) {
 		DEBUG("Compartment can be stopped.");
 		return true;
 	}
@@ -176,6 +229,11 @@ compartment_is_stoppable(compartment_t *compartment)
 bool
 compartment_is_startable(compartment_t *compartment)
 {
+	if (compartment->is_parked) {
+		DEBUG("Compartment start is prepared, compartment can be started.");
+		return true;
+	}
+
 	if ((compartment_get_state(compartment) == COMPARTMENT_STATE_STOPPED) ||
 	    (compartment_get_state(compartment) == COMPARTMENT_STATE_REBOOTING)) {
 		if (compartment->helper_child_list) {
@@ -201,11 +259,150 @@ compartment_register_module(compartment_module_t *mod)
 	      list_length(compartment_module_list));
 }
 
+int
+compartment_module_get_slot(const char *mod_name)
+{
+	ASSERT(mod_name);
+
+	int slot = 0;
+	for (list_t *l = compartment_module_list; l; l = l->next, slot++) {
+		compartment_module_t *module = l->data;
+		if (!strcmp(module->name, mod_name))
+			return slot;
+	}
+	return -1;
+}
+
 typedef struct {
 	compartment_module_t *module;
 	void *instance;
 } compartment_module_instance_t;
 
+/**
+ * Calls a start hook of a module instance and records its duration in the start trace.
+ */
+static int
+compartment_run_hook(compartment_t *compartment, starttrace_hook_t hook,
+		     compartment_module_instance_t *c_mod, int (*func)(void *data))
+{
+	PROBE2(compartment_hook_enter, starttrace_hook_get_name(hook), c_mod->module->name);
+	uint64_t start = starttrace_now();
+	int ret = func(c_mod->instance);
+	starttrace_add(compartment->starttrace, hook, c_mod->module->name, start);
+	PROBE3(compartment_hook_exit, starttrace_hook_get_name(hook), c_mod->module->name, ret);
+	return ret;
+}
+
+typedef struct {
+	compartment_t *compartment;
+	compartment_module_instance_t *c_mod;
+	starttrace_hook_t hook;
+	int (*func)(void *data);
+	pthread_t thread;
+	bool running;
+	int ret;
+} compartment_hook_job_t;
+
+static void *
+compartment_hook_job_run(void *data)
+{
+	compartment_hook_job_t *job = data;
+	job->ret = compartment_run_hook(job->compartment, job->hook, job->c_mod, job->func);
+	return NULL;
+}
+
+static int
+compartment_hook_job_join(compartment_hook_job_t *job)
+{
+	if (job->running) {
+		pthread_join(job->thread, NULL);
+		job->running = false;
+	}
+	return job->ret;
+}
+
+/**
+ * Runs the pre_clone or post_clone hooks of all modules in order. Hooks of modules
+ * flagged with async_flag are started in a thread and run concurrently to the following
+ * hooks. All threads are joined before this function returns.
+ *
+ * @return 0 on success, the return value of the first failed hook otherwise
+ */
+static int
+compartment_run_hooks(compartment_t *compartment, starttrace_hook_t hook, int async_flag)
+{
+	int ret = 0;
+	int n = list_length(compartment->module_instance_list);
+	compartment_hook_job_t *jobs = mem_new0(compartment_hook_job_t, n);
+
+	int i = 0;
+	for (list_t *l = compartment->module_instance_list; l && ret >= 0; l = l->next, i++) {
+		compartment_module_instance_t *c_mod = l->data;
+		compartment_module_t *module = c_mod->module;
+		int (*func)(void *data) = (hook == STARTTRACE_PRE_CLONE) ? module->start_pre_clone :
+									   module->start_post_clone;
+		if (NULL == func)
+			continue;
+
+		// wait for the hooks this one depends on
+		for (const char *const *dep = module->after; dep && *dep && ret >= 0; dep++) {
+			for (int j = 0; j < i; j++) {
+				if (jobs[j].c_mod && !strcmp(jobs[j].c_mod->module->name, *dep))
+					ret = compartment_hook_job_join(&jobs[j]);
+			}
+		}
+		if (ret < 0)
+			break;
+
+		compartment_hook_job_t *job = &jobs[i];
+		job->compartment = compartment;
+		job->c_mod = c_mod;
+		job->hook = hook;
+		job->func = func;
+
+		if (module->flags & async_flag) {
+			int err = pthread_create(&job->thread, NULL, compartment_hook_job_run, job);
+			if (!err) {
+				job->running = true;
+				continue;
+			}
+			WARN("Could not start thread for hook of module %s: %s", module->name,
+			     strerror(err));
+		}
+		ret = compartment_run_hook(compartment, hook, c_mod, func);
+		job->ret = ret;
+	}
+
+	for (i = 0; i < n; i++) {
+		int job_ret = compartment_hook_job_join(&jobs[i]);
+		if (ret >= 0 && job_ret < 0)
+			ret = job_ret;
+	}
+
+	mem_free0(jobs);
+	return ret;
+}
+
+static void
+compartment_finish_starttrace(compartment_t *compartment)
+{
+	// the trace is stored next to the debug log of the compartment
+	char *file = compartment->debug_log_dir ?
+			     mem_printf("%s.starttrace.json", compartment->debug_log_dir) :
+			     NULL;
+
+	if (starttrace_finish(compartment->starttrace, compartment->name, file) < 0)
+		WARN("Could not complete start trace of %s", compartment->name);
+
+	if (compartment->start_phases)
+		mem_free0(compartment->start_phases);
+	compartment->start_phases =
+		starttrace_get_phases_new(compartment->starttrace, &compartment->start_phases_len);
+
+	if (file)
+		mem_free0(file);
+}
+
 static compartment_module_instance_t *
 compartment_module_instance_new(compartment_t *compartment, compartment_module_t *module)
 {
@@ -234,6 +431,66 @@ compartment_module_instance_free(compartment_module_instance_t *c_mod)
 	mem_free0(c_mod);
 }
 
+static bool
+compartment_module_is_lazy(const compartment_module_t *module)
+{
+	return (module->flags & COMPARTMENT_MODULE_F_LAZY) && !module->compartment_destroy;
+}
+
+/**
+ * Instantiates the lazy modules which are not instantiated yet, see
+ * COMPARTMENT_MODULE_F_LAZY. The list of instances is kept in the order of the
+ * registered modules, as their hooks are run in that order.
+ */
+static int
+compartment_module_instantiate_lazy(compartment_t *compartment)
+{
+	list_t *instances = NULL;
+	int ret = 0;
+
+	int slot = 0;
+	for (list_t *l = compartment_module_list; l; l = l->next, slot++) {
+		compartment_module_t *module = l->data;
+		if ((size_t)slot >= compartment->module_instances_len)
+			break;
+
+		list_t *elem = compartment->module_instance_list;
+		for (; elem; elem = elem->next) {
+			if (((compartment_module_instance_t *)elem->data)->module == module)
+				break;
+		}
+		if (elem) {
+			instances = list_append(instances, elem->data);
+			compartment->module_instance_list =
+				list_unlink(compartment->module_instance_list, elem);
+			continue;
+		}
+		if (!compartment_module_is_lazy(module) || !module->compartment_new || ret < 0)
+			continue;
+
+		compartment_module_instance_t *c_mod =
+			compartment_module_instance_new(compartment, module);
+		if (!c_mod) {
+			WARN("Could not initialize %s subsystem for compartment %s (UUID: %s)",
+			     module->name, compartment->name, uuid_string(compartment->uuid));
+			ret = -1;
+			continue;
+		}
+		instances = list_append(instances, c_mod);
+		compartment->module_instances[slot] = c_mod->instance;
+
+		INFO("Initialized %s subsystem for compartment %s (UUID: %s)", module->name,
+		     compartment->name, uuid_string(compartment->uuid));
+	}
+	// instances of modules registered after the creation of the compartment, if any
+	for (list_t *l = compartment->module_instance_list; l; l = l->next)
+		instances = list_append(instances, l->data);
+	list_delete(compartment->module_instance_list);
+	compartment->module_instance_list = instances;
+
+	return ret;
+}
+
 static compartment_module_instance_t *
 compartment_module_get_mod_instance_by_name(const compartment_t *compartment, const char *mod_name)
 {
@@ -259,11 +516,21 @@ compartment_helper_child_new(char *name, pid_t pid)
 	return child;
 }
 
+static void
+compartment_helper_child_reap_cb(pid_t pid, UNUSED int status, event_child_t *event,
+				 UNUSED void *data)
+{
+	TRACE("Reaped helper child (pid=%d) of already freed compartment", pid);
+	event_child_free(event);
+}
+
 static void
 compartment_helper_child_free(compartment_helper_child_t *child)
 {
 	IF_NULL_RETURN(child);
 
+	if (child->event)
+		event_child_free(child->event);
 	if (child->name)
 		mem_free0(child->name);
 	mem_free0(child);
@@ -281,6 +548,17 @@ compartment_module_get_instance_by_name(const compartment_t *compartment, const
 	return c_mod ? c_mod->instance : NULL;
 }
 
+void *
+compartment_module_get_instance_by_slot(const compartment_t *compartment, int slot)
+{
+	ASSERT(compartment);
+
+	if (slot < 0 || (size_t)slot >= compartment->module_instances_len)
+		return NULL;
+
+	return compartment->module_instances[slot];
+}
+
 void
 compartment_free_key(compartment_t *compartment)
 {
@@ -359,6 +637,7 @@ compartment_new(const uuid_t *uuid, const char *name, uint64_t flags, const char
 	/* initialize pid to a value indicating it is invalid */
 	compartment->pid = -1;
 	compartment->pid_early = -1;
+	compartment->clone_cgroup_fd = -1;
 
 	/* initialize exit_status to 0 */
 	compartment->exit_status = 0;
@@ -388,8 +667,17 @@ compartment_new(const uuid_t *uuid, const char *name, uint64_t flags, const char
 	compartment->helper_child_list = NULL;
 
 	/* Create submodules */
-	for (list_t *l = compartment_module_list; l; l = l->next) {
+	compartment->module_instances_len = list_length(compartment_module_list);
+	compartment->module_instances = mem_new0(void *, compartment->module_instances_len);
+
+	int slot = 0;
+	for (list_t *l = compartment_module_list; l; l = l->next, slot++) {
 		compartment_module_t *module = l->data;
+		if (compartment_module_is_lazy(module)) {
+			TRACE("Deferring %s subsystem for compartment %s to its first start",
+			      module->name, compartment->name);
+			continue;
+		}
 		if (module->compartment_new) {
 			compartment_module_instance_t *c_mod =
 				compartment_module_instance_new(compartment, module);
@@ -401,6 +689,7 @@ compartment_new(const uuid_t *uuid, const char *name, uint64_t flags, const char
 			}
 			compartment->module_instance_list =
 				list_append(compartment->module_instance_list, c_mod);
+			compartment->module_instances[slot] = c_mod->instance;
 
 			INFO("Initialized %s subsystem for compartment %s (UUID: %s)", module->name,
 			     compartment->name, uuid_string(compartment->uuid));
@@ -425,6 +714,7 @@ compartment_free(compartment_t *compartment)
 		compartment_module_instance_free(c_mod);
 	}
 	list_delete(compartment->module_instance_list);
+	mem_free0(compartment->module_instances);
 
 	compartment_free_key(compartment);
 
@@ -455,6 +745,20 @@ compartment_free(compartment_t *compartment)
 	if (compartment->debug_log_dir)
 		mem_free0(compartment->debug_log_dir);
 
+	starttrace_free(compartment->starttrace);
+	if (compartment->start_phases)
+		mem_free0(compartment->start_phases);
+
+	for (list_t *l = compartment->helper_child_list; l; l = l->next) {
+		compartment_helper_child_t *child = l->data;
+		// the helper still needs to be reaped after the compartment is gone
+		event_child_t *reaper =
+			event_child_new(child->pid, compartment_helper_child_reap_cb, NULL);
+		event_add_child(reaper);
+		compartment_helper_child_free(child);
+	}
+	list_delete(compartment->helper_child_list);
+
 	mem_free0(compartment);
 }
 
@@ -608,6 +912,22 @@ compartment_get_exit_status(const compartment_t *compartment)
 	return compartment->exit_status;
 }
 
+const starttrace_phase_t *
+compartment_get_start_phases(const compartment_t *compartment, size_t *len)
+{
+	ASSERT(compartment);
+	ASSERT(len);
+	*len = compartment->start_phases_len;
+	return compartment->start_phases;
+}
+
+starttrace_t *
+compartment_get_starttrace(const compartment_t *compartment)
+{
+	ASSERT(compartment);
+	return compartment->starttrace;
+}
+
 bool
 compartment_is_privileged(const compartment_t *compartment)
 {
@@ -624,6 +944,9 @@ compartment_is_privileged(const compartment_t *compartment)
 static void
 compartment_cleanup(compartment_t *compartment, bool is_rebooting)
 {
+	compartment->park_start = false;
+	compartment->is_parked = false;
+
 	/* timer can be removed here, because compartment is on the transition to the stopped state */
 	if (compartment->stop_timer) {
 		DEBUG("Remove compartment stop timer for %s",
@@ -653,7 +976,9 @@ compartment_cleanup(compartment_t *compartment, bool is_rebooting)
 			continue;
 		}
 
+		PROBE2(compartment_hook_enter, "cleanup", module->name);
 		module->cleanup(c_mod->instance, is_rebooting);
+		PROBE3(compartment_hook_exit, "cleanup", module->name, 0);
 	}
 
 	/* cleanup modules with flag COMPARTMENT_MODULE_F_CLEANUP_LATE set.
@@ -661,7 +986,9 @@ compartment_cleanup(compartment_t *compartment, bool is_rebooting)
 	for (list_t *l = do_late_list; l; l = l->next) {
 		compartment_module_instance_t *c_mod = l->data;
 		compartment_module_t *module = c_mod->module;
+		PROBE2(compartment_hook_enter, "cleanup", module->name);
 		module->cleanup(c_mod->instance, is_rebooting);
+		PROBE3(compartment_hook_exit, "cleanup", module->name, 0);
 	}
 
 	list_delete(do_late_list);
@@ -670,29 +997,22 @@ compartment_cleanup(compartment_t *compartment, bool is_rebooting)
 	compartment->pid_early = -1;
 }
 
-void
-compartment_sigchld_handle_helpers(compartment_t *compartment, event_signal_t *sig)
+/*
+ * Helper children are reaped by their own child events, see compartment_wait_for_child().
+ * Once the last one is gone and the compartment itself has been cleaned up, the
+ * stop is completed here.
+ */
+static void
+compartment_sigchld_handle_helpers(compartment_t *compartment)
 {
-	int status = 0;
-
-	for (list_t *l = compartment->helper_child_list; l;) {
-		list_t *next = l->next;
-		compartment_helper_child_t *child = l->data;
-		if (proc_waitpid(child->pid, &status, WNOHANG) == child->pid) {
-			DEBUG("Reaped helper child %s (pid=%d) for compartment %s", child->name,
-			      child->pid, compartment_get_description(compartment));
-			compartment->helper_child_list =
-				list_unlink(compartment->helper_child_list, l);
-			compartment_helper_child_free(child);
-		}
-		l = next;
-	}
-
 	if (!compartment->helper_child_list && compartment->is_doing_cleanup) {
 		DEBUG("CLEANUP DONE, all pending helpers reaped!");
 		/* remove the sigchld callback for this compartment from the event loop */
-		event_remove_signal(sig);
-		event_signal_free(sig);
+		if (compartment->sigchld) {
+			event_remove_signal(compartment->sigchld);
+			event_signal_free(compartment->sigchld);
+			compartment->sigchld = NULL;
+		}
 		compartment->is_doing_cleanup = false;
 		compartment_state_t state = compartment->is_rebooting ?
 						    COMPARTMENT_STATE_REBOOTING :
@@ -703,7 +1023,7 @@ compartment_sigchld_handle_helpers(compartment_t *compartment, event_signal_t *s
 }
 
 void
-compartment_sigchld_cb(UNUSED int signum, event_signal_t *sig, void *data)
+compartment_sigchld_cb(UNUSED int signum, UNUSED event_signal_t *sig, void *data)
 {
 	ASSERT(data);
 
@@ -716,7 +1036,7 @@ compartment_sigchld_cb(UNUSED int signum, event_signal_t *sig, void *data)
 		TRACE("All processes of container %s already reaped, check for remaining helpers.",
 		      compartment_get_description(compartment));
 
-		compartment_sigchld_handle_helpers(compartment, sig);
+		compartment_sigchld_handle_helpers(compartment);
 		return;
 	}
 
@@ -779,8 +1099,8 @@ compartment_sigchld_cb(UNUSED int signum, event_signal_t *sig, void *data)
 		compartment->is_doing_cleanup = true;
 	}
 
-	// reap any open helper child and set state accordingly
-	compartment_sigchld_handle_helpers(compartment, sig);
+	// set state accordingly if no helper child is left
+	compartment_sigchld_handle_helpers(compartment);
 
 	TRACE("No more children to reap. Callback exiting...");
 }
@@ -812,19 +1132,6 @@ compartment_sigchld_early_cb(UNUSED int signum, event_signal_t *sig, void *data)
 		}
 		compartment->pid_early = -1;
 	}
-
-	// reap any open helper child and set state accordingly
-	compartment_sigchld_handle_helpers(compartment, sig);
-}
-
-static int
-compartment_close_all_fds_cb(UNUSED const char *path, const char *file, UNUSED void *data)
-{
-	int fd = atoi(file);
-
-	close(fd);
-
-	return 0;
 }
 
 static int
@@ -833,11 +1140,7 @@ compartment_close_all_fds()
 	DEBUG("Closing all fds");
 	logf_unregister(cml_daemon_logfile_handler);
 
-	if (dir_foreach("/proc/self/fd", &compartment_close_all_fds_cb, NULL) < 0) {
-		return -1;
-	}
-
-	return 0;
+	return fd_close_all(0, NULL, 0);
 }
 
 static int
@@ -883,7 +1186,9 @@ compartment_start_child(void *data)
 		if (NULL == module->start_child)
 			continue;
 
-		if ((ret = module->start_child(c_mod->instance)) < 0) {
+		ret = compartment_run_hook(compartment, STARTTRACE_CHILD, c_mod,
+					   module->start_child);
+		if (ret < 0) {
 			goto error;
 		}
 	}
@@ -917,7 +1222,9 @@ compartment_start_child(void *data)
 		if (NULL == module->start_pre_exec_child_early)
 			continue;
 
-		if ((ret = module->start_pre_exec_child_early(c_mod->instance)) < 0) {
+		ret = compartment_run_hook(compartment, STARTTRACE_PRE_EXEC_CHILD_EARLY, c_mod,
+					   module->start_pre_exec_child_early);
+		if (ret < 0) {
 			goto error;
 		}
 	}
@@ -941,7 +1248,9 @@ compartment_start_child(void *data)
 		if (NULL == module->start_pre_exec_child)
 			continue;
 
-		if ((ret = module->start_pre_exec_child(c_mod->instance)) < 0) {
+		ret = compartment_run_hook(compartment, STARTTRACE_PRE_EXEC_CHILD, c_mod,
+					   module->start_pre_exec_child);
+		if (ret < 0) {
 			goto error;
 		}
 	}
@@ -1025,6 +1334,44 @@ error:
 	return ret; // exit the child process
 }
 
+/*
+ * Clones the compartment's init. If the cgroups module provided a cgroup, the child is
+ * created directly in it with clone3(CLONE_INTO_CGROUP), which saves the migration of
+ * the running child to its cgroup. Without support by the kernel, clone() is used on a
+ * stack of our own and the cgroups module moves the child after the clone.
+ */
+static pid_t
+compartment_clone_child(compartment_t *compartment, unsigned long clone_flags)
+{
+	if (compartment->clone_cgroup_fd >= 0) {
+		struct compartment_clone_args args = {
+			.flags = (clone_flags & ~CSIGNAL) | CLONE_INTO_CGROUP,
+			.exit_signal = clone_flags & CSIGNAL,
+			.cgroup = compartment->clone_cgroup_fd,
+		};
+		// without CLONE_VM, the child runs on a copy of our stack as after fork()
+		pid_t pid = syscall(__NR_clone3, &args, sizeof(args));
+		if (pid == 0)
+			_exit(compartment_start_child(compartment));
+		if (pid > 0)
+			return pid;
+		DEBUG_ERRNO("clone3 into cgroup not supported, falling back to clone");
+	}
+
+	void *compartment_stack = NULL;
+	/* Allocate node stack */
+
+	if (MAP_FAILED ==
+	    (compartment_stack = mmap(NULL, CLONE_STACK_SIZE, PROT_READ | PROT_WRITE,
+				      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0))) {
+		WARN_ERRNO("Not enough memory for allocating compartment stack");
+		return -1;
+	}
+	void *compartment_stack_high = (void *)((const char *)compartment_stack + CLONE_STACK_SIZE);
+
+	return clone(compartment_start_child, compartment_stack_high, clone_flags, compartment);
+}
+
 static int
 compartment_start_child_early(void *data)
 {
@@ -1049,21 +1396,13 @@ compartment_start_child_early(void *data)
 		if (NULL == module->start_child_early)
 			continue;
 
-		if ((ret = module->start_child_early(c_mod->instance)) < 0) {
+		ret = compartment_run_hook(compartment, STARTTRACE_CHILD_EARLY, c_mod,
+					   module->start_child_early);
+		if (ret < 0) {
 			goto error;
 		}
 	}
 
-	void *compartment_stack = NULL;
-	/* Allocate node stack */
-
-	if (MAP_FAILED ==
-	    (compartment_stack = mmap(NULL, CLONE_STACK_SIZE, PROT_READ | PROT_WRITE,
-				      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0))) {
-		WARN_ERRNO("Not enough memory for allocating compartment stack");
-		goto error;
-	}
-	void *compartment_stack_high = (void *)((const char *)compartment_stack + CLONE_STACK_SIZE);
 	/* Set namespaces for node */
 	/* set some basic and non-configurable namespaces */
 	unsigned long clone_flags = 0;
@@ -1092,8 +1431,7 @@ compartment_start_child_early(void *data)
 			clone_flags |= CLONE_NEWNET;
 	}
 
-	compartment->pid =
-		clone(compartment_start_child, compartment_stack_high, clone_flags, compartment);
+	compartment->pid = compartment_clone_child(compartment, clone_flags);
 	if (compartment->pid < 0) {
 		ERROR_ERRNO("Double clone compartment failed");
 		goto error;
@@ -1201,7 +1539,9 @@ compartment_start_post_clone_cb(int fd, unsigned events, event_io_t *io, void *d
 		if (NULL == module->start_pre_exec)
 			continue;
 
-		IF_TRUE_GOTO_WARN((module->start_pre_exec(c_mod->instance) < 0), error_pre_exec);
+		int ret = compartment_run_hook(compartment, STARTTRACE_PRE_EXEC, c_mod,
+					       module->start_pre_exec);
+		IF_TRUE_GOTO_WARN(ret < 0, error_pre_exec);
 	}
 
 	// skip setup of start timer and maintain SETUP state if in SETUP mode
@@ -1232,7 +1572,9 @@ compartment_start_post_clone_cb(int fd, unsigned events, event_io_t *io, void *d
 		if (NULL == module->start_post_exec)
 			continue;
 
-		IF_TRUE_GOTO_WARN(module->start_post_exec(c_mod->instance) < 0, error);
+		int ret = compartment_run_hook(compartment, STARTTRACE_POST_EXEC, c_mod,
+					       module->start_post_exec);
+		IF_TRUE_GOTO_WARN(ret < 0, error);
 	}
 
 	// if no service module is registered diretcly switch to state running
@@ -1325,23 +1667,25 @@ compartment_start_post_clone_early_cb(int fd, unsigned events, event_io_t *io, v
 	/* register SIGCHILD handler which sets the state and
 	 * calls the appropriate cleanup functions if the child
 	 * dies */
-	event_signal_t *sig = event_signal_new(SIGCHLD, compartment_sigchld_cb, compartment);
-	event_add_signal(sig);
+	compartment->sigchld = event_signal_new(SIGCHLD, compartment_sigchld_cb, compartment);
+	event_add_signal(compartment->sigchld);
 
 	/*********************************************************/
 	/* POST CLONE HOOKS */
 	// execute all necessary c_<module>_start_post_clone hooks
 	// goto error_post_clone on an error
 
-	for (list_t *l = compartment->module_instance_list; l; l = l->next) {
-		compartment_module_instance_t *c_mod = l->data;
-		compartment_module_t *module = c_mod->module;
-		if (NULL == module->start_post_clone)
-			continue;
+	ret = compartment_run_hooks(compartment, STARTTRACE_POST_CLONE,
+				    COMPARTMENT_MODULE_F_ASYNC_POST_CLONE);
+	if (ret < 0)
+		goto error_post_clone;
 
-		if ((ret = module->start_post_clone(c_mod->instance)) < 0) {
-			goto error_post_clone;
-		}
+	/* on a prepared start, the child is released by compartment_start() */
+	if (compartment->park_start) {
+		compartment->park_start = false;
+		compartment->is_parked = true;
+		INFO("Start of compartment %s prepared", compartment_get_description(compartment));
+		return;
 	}
 
 	/*********************************************************/
@@ -1372,6 +1716,38 @@ error_post_clone:
 	return;
 }
 
+/*
+ * Releases the waiting child of a prepared start.
+ */
+static int
+compartment_start_parked(compartment_t *compartment)
+{
+	compartment->is_parked = false;
+
+	INFO("Starting prepared compartment %s", compartment_get_description(compartment));
+	char msg_go = COMPARTMENT_START_SYNC_MSG_GO;
+	if (write(compartment->sync_sock_parent, &msg_go, 1) < 0) {
+		WARN_ERRNO("write to sync socket failed");
+		compartment_kill(compartment);
+		return -COMPARTMENT_ERROR;
+	}
+	return 0;
+}
+
+int
+compartment_prestart(compartment_t *compartment)
+{
+	ASSERT(compartment);
+
+	IF_FALSE_RETVAL(compartment_get_state(compartment) == COMPARTMENT_STATE_STOPPED, -1);
+
+	compartment->park_start = true;
+	int ret = compartment_start(compartment);
+	if (ret < 0)
+		compartment->park_start = false;
+	return ret;
+}
+
 int
 compartment_start(compartment_t *compartment)
 {
@@ -1380,21 +1756,26 @@ compartment_start(compartment_t *compartment)
 	int ret = 0;
 	void *compartment_stack = NULL;
 
+	if (compartment->is_parked)
+		return compartment_start_parked(compartment);
+
 	compartment_set_state(compartment, COMPARTMENT_STATE_STARTING);
 
+	starttrace_free(compartment->starttrace);
+	compartment->starttrace = starttrace_new();
+
+	if (compartment_module_instantiate_lazy(compartment) < 0) {
+		ret = -COMPARTMENT_ERROR;
+		goto error_pre_clone;
+	}
+
 	/*********************************************************/
 	/* PRE CLONE HOOKS */
 
-	for (list_t *l = compartment->module_instance_list; l; l = l->next) {
-		compartment_module_instance_t *c_mod = l->data;
-		compartment_module_t *module = c_mod->module;
-		if (NULL == module->start_pre_clone)
-			continue;
-
-		if ((ret = module->start_pre_clone(c_mod->instance)) < 0) {
-			goto error_pre_clone;
-		}
-	}
+	ret = compartment_run_hooks(compartment, STARTTRACE_PRE_CLONE,
+				    COMPARTMENT_MODULE_F_ASYNC_PRE_CLONE);
+	if (ret < 0)
+		goto error_pre_clone;
 
 	/*********************************************************/
 	/* PREPARE CLONE */
@@ -1431,8 +1812,10 @@ compartment_start(compartment_t *compartment)
 	}
 
 	/* TODO find out if stack is only necessary with CLONE_VM */
+	uint64_t clone_start = starttrace_now();
 	pid_t compartment_pid = clone(compartment_start_child_early, compartment_stack_high,
 				      clone_flags, compartment);
+	starttrace_add(compartment->starttrace, STARTTRACE_CLONE, "compartment", clone_start);
 	if (compartment_pid < 0) {
 		WARN_ERRNO("Clone compartment failed");
 		goto error_pre_clone;
@@ -1459,7 +1842,9 @@ compartment_start(compartment_t *compartment)
 		if (NULL == module->start_post_clone_early)
 			continue;
 
-		if ((ret = module->start_post_clone_early(c_mod->instance)) < 0) {
+		ret = compartment_run_hook(compartment, STARTTRACE_POST_CLONE_EARLY, c_mod,
+					   module->start_post_clone_early);
+		if (ret < 0) {
 			goto error_post_clone;
 		}
 	}
@@ -1544,6 +1929,17 @@ compartment_stop(compartment_t *compartment)
 
 	int ret = 0;
 
+	/* the child of a prepared start did not run anything yet, just let it exit */
+	if (compartment->is_parked) {
+		compartment->is_parked = false;
+		char msg_stop = COMPARTMENT_START_SYNC_MSG_STOP;
+		if (write(compartment->sync_sock_parent, &msg_stop, 1) < 0) {
+			WARN_ERRNO("write to sync socket failed");
+			compartment_kill(compartment);
+		}
+		return 0;
+	}
+
 	/* register timer with callback doing the kill, if stop fails */
 	event_timer_t *compartment_stop_timer = event_timer_new(
 		COMPARTMENT_STOP_TIMEOUT, 1, &compartment_stop_timeout_cb, compartment);
@@ -1566,7 +1962,10 @@ compartment_stop(compartment_t *compartment)
 		if (NULL == module->stop)
 			continue;
 
-		if (module->stop(c_mod->instance) < 0) {
+		PROBE2(compartment_hook_enter, "stop", module->name);
+		int r = module->stop(c_mod->instance);
+		PROBE3(compartment_hook_exit, "stop", module->name, r);
+		if (r < 0) {
 			DEBUG("Module '%s' could not be stopped successfully", module->name);
 			ret = -1;
 		}
@@ -1709,6 +2108,14 @@ compartment_set_state(compartment_t *compartment, compartment_state_t state)
 	DEBUG("Setting compartment state: %d", state);
 	compartment->state = state;
 
+	if (compartment->starttrace &&
+	    (state == COMPARTMENT_STATE_RUNNING || state == COMPARTMENT_STATE_STOPPED)) {
+		if (state == COMPARTMENT_STATE_RUNNING)
+			compartment_finish_starttrace(compartment);
+		starttrace_free(compartment->starttrace);
+		compartment->starttrace = NULL;
+	}
+
 	compartment_notify_observers(compartment);
 }
 
@@ -1832,6 +2239,13 @@ compartment_set_debug_log_dir(compartment_t *compartment, const char *dir)
 	compartment->debug_log_dir = mem_strdup(dir);
 }
 
+void
+compartment_set_clone_cgroup_fd(compartment_t *compartment, int fd)
+{
+	ASSERT(compartment);
+	compartment->clone_cgroup_fd = fd;
+}
+
 bool
 compartment_contains_pid(const compartment_t *compartment, pid_t pid)
 {
@@ -1860,12 +2274,31 @@ compartment_get_sync_sock_child(compartment_t *compartment)
 	return compartment->sync_sock_child;
 }
 
+static void
+compartment_helper_child_cb(pid_t pid, int status, UNUSED event_child_t *event, void *data)
+{
+	compartment_helper_child_t *child = data;
+	compartment_t *compartment = child->compartment;
+	ASSERT(compartment);
+
+	DEBUG("Reaped helper child %s (pid=%d, status=%d) for compartment %s", child->name, pid,
+	      status, compartment_get_description(compartment));
+
+	compartment->helper_child_list = list_remove(compartment->helper_child_list, child);
+	compartment_helper_child_free(child);
+
+	compartment_sigchld_handle_helpers(compartment);
+}
+
 void
 compartment_wait_for_child(compartment_t *compartment, char *name, pid_t pid)
 {
 	ASSERT(compartment);
 
 	compartment_helper_child_t *child = compartment_helper_child_new(name, pid);
+	child->compartment = compartment;
+	child->event = event_child_new(pid, compartment_helper_child_cb, child);
+	event_add_child(child->event);
 	compartment->helper_child_list = list_append(compartment->helper_child_list, child);
 
 	DEBUG("Helpers registered:");
@@ -36,6 +36,8 @@
 #ifndef COMPARTMENT_H
 #define COMPARTMENT_H
 
+#include "starttrace.h"
+
 #include "common/uuid.h"
 #include "common/list.h"
 
@@ -126,6 +128,7 @@ typedef struct compartment_module {
 	void (*cleanup)(void *data, bool rebooting);
 	int (*join_ns)(void *data);
 	int flags;
+	const char *const *after; //!< NULL terminated names of modules to wait for in async phases
 } compartment_module_t;
 
 /* If COMPARTMENT_MODULE_F_CLEANUP_LATE is used, the call to
@@ -136,12 +139,56 @@ typedef struct compartment_module {
  */
 #define COMPARTMENT_MODULE_F_CLEANUP_LATE (1U << 0)
 
+/* If COMPARTMENT_MODULE_F_ASYNC_PRE_CLONE (_POST_CLONE) is used, the
+ * start_pre_clone() (start_post_clone()) hook of the module is run in its
+ * own thread, concurrently to the following hooks of that phase. All hooks
+ * of a phase are joined before the next phase begins. Such a hook must not
+ * use the event loop, must not change compartment properties which notify
+ * the compartment's observers (e.g. the key or the state), and must not
+ * depend on the hooks of other modules,
+ * except for the hooks of preceding modules listed in 'after'. Any hook
+ * waits for the async hooks of the modules listed in its 'after' array
+ * before it is run.
+ */
+#define COMPARTMENT_MODULE_F_ASYNC_PRE_CLONE (1U << 1)
+#define COMPARTMENT_MODULE_F_ASYNC_POST_CLONE (1U << 2)
+
+/* If COMPARTMENT_MODULE_F_LAZY is used, the module is instantiated at the
+ * first start of the compartment instead of at its creation, so that the
+ * compartments which are never started do not hold the module's state.
+ * Until then, none of the module's hooks is called and its instance is not
+ * available, e.g., to the handlers registered by the module. Modules with a
+ * compartment_destroy() hook are always instantiated at creation.
+ */
+#define COMPARTMENT_MODULE_F_LAZY (1U << 3)
+
 void
 compartment_register_module(compartment_module_t *mod);
 
 void *
 compartment_module_get_instance_by_name(const compartment_t *compartment, const char *mod_name);
 
+/**
+ * Returns the slot of a registered module, i.e., its position in the order of
+ * registration. The slot allows to look up the module's instance of a compartment
+ * by compartment_module_get_instance_by_slot() without comparing module names.
+ *
+ * @param mod_name The name of the module.
+ * @return The slot of the module or -1 if no module with this name is registered.
+ */
+int
+compartment_module_get_slot(const char *mod_name);
+
+/**
+ * Returns the module instance of the compartment for the given module slot.
+ *
+ * @param compartment The compartment.
+ * @param slot The module slot as returned by compartment_module_get_slot().
+ * @return The module instance or NULL if the module has no instance in this compartment.
+ */
+void *
+compartment_module_get_instance_by_slot(const compartment_t *compartment, int slot);
+
 /**
  * Low-level constructor that creates a new compartment instance
  * with the given parameters.
@@ -233,6 +280,22 @@ compartment_oom_protect_service(const compartment_t *compartment);
 int
 compartment_get_exit_status(const compartment_t *compartment);
 
+/**
+ * Gets the trace of the current start of the compartment, which is shared with
+ * the child processes of the start. NULL if the compartment is not starting.
+ */
+starttrace_t *
+compartment_get_starttrace(const compartment_t *compartment);
+
+/**
+ * Gets the hook durations of the last completed start of the compartment,
+ * NULL if the compartment has not been started successfully yet.
+ *
+ * @param len set to the number of returned phases
+ */
+const starttrace_phase_t *
+compartment_get_start_phases(const compartment_t *compartment, size_t *len);
+
 /**
  * Call destroy hooks of modules in case a compartment should persistently be removed from disk
  * This does not free the compartment object, this must be done
@@ -283,6 +346,17 @@ compartment_resume(compartment_t *compartment);
 int
 compartment_start(compartment_t *compartment); //, const char *key);
 
+/**
+ * Prepares the start of a stopped compartment. All hooks up to the post_clone hooks are
+ * run, i.e., the namespaces, mounts, network and cgroups are set up, and the child waits
+ * in state CONTAINER_STATE_STARTING until compartment_start() releases it, which makes
+ * the start itself almost instant. compartment_stop() discards the prepared start.
+ *
+ * @return 0 if the preparation of the start was begun successfully, see compartment_start()
+ */
+int
+compartment_prestart(compartment_t *compartment);
+
 /**
  * Gracefully terminate the execution of a compartment. Gives the compartment the
  * chance to do a normal shutdown. May take some time to complete and sets the
@@ -456,6 +530,14 @@ compartment_uuid_is_c0id(const uuid_t *uuid);
 void
 compartment_set_debug_log_dir(compartment_t *compartment, const char *dir);
 
+/**
+ * Sets the cgroup into which the init of the compartment is cloned on start.
+ * The fd stays owned by the caller and has to be valid until the clone is done,
+ * i.e., during the post_clone hooks, -1 resets it.
+ */
+void
+compartment_set_clone_cgroup_fd(compartment_t *compartment, int fd);
+
 /**
  * Check if a specific pid is part of the compartment
  *
@@ -29,8 +29,10 @@
 #include "common/file.h"
 #include "common/dir.h"
 #include "common/uuid.h"
+#include "common/protobuf-text.h"
 #include "compartment.h"
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -70,6 +72,20 @@ struct container {
 	list_t *pnet_cfg_list;
 
 	list_t *fifo_list;
+
+	// autostart order at boot
+	unsigned int start_priority;
+	list_t *start_after_list;
+	bool prestart;
+	unsigned int ram_high; /* soft limit of RAM usage of the container in MBytes */
+	unsigned int ram_low;  /* RAM of the container protected from reclaim in MBytes */
+	container_io_limits_t io_limits;
+	const container_net_tuning_t *net_tuning; // weak reference
+	unsigned int dedicated_cpus; /* cpus dedicated to the container by the cpuset manager */
+	unsigned int cpu_priority;
+	unsigned int idle_freeze_timeout;
+	container_thp_mode_t thp_mode;
+	list_t *hugetlb_limits; // container_hugetlb_limit_t
 };
 
 struct container_callback {
@@ -162,6 +178,8 @@ container_new(const uuid_t *uuid, const char *name, container_type_t type, bool
 
 	container->usb_pin_entry = usb_pin_entry;
 
+	container->thp_mode = CONTAINER_THP_INHERIT;
+
 	// set type specific flags for compartment
 	uint64_t flags = 0;
 	if (type == CONTAINER_TYPE_KVM)
@@ -262,6 +280,14 @@ container_free(container_t *container)
 	}
 	list_delete(container->fifo_list);
 
+	for (list_t *l = container->start_after_list; l; l = l->next)
+		mem_free0(l->data);
+	list_delete(container->start_after_list);
+
+	for (list_t *l = container->hugetlb_limits; l; l = l->next)
+		container_hugetlb_limit_free(l->data);
+	list_delete(container->hugetlb_limits);
+
 	mem_free0(container);
 }
 
@@ -362,6 +388,20 @@ container_get_service_pid(const container_t *container)
 	return compartment_get_service_pid(container->compartment);
 }
 
+starttrace_t *
+container_get_starttrace(const container_t *container)
+{
+	ASSERT(container);
+	return compartment_get_starttrace(container->compartment);
+}
+
+const starttrace_phase_t *
+container_get_start_phases(const container_t *container, size_t *len)
+{
+	ASSERT(container);
+	return compartment_get_start_phases(container->compartment, len);
+}
+
 void
 container_oom_protect_service(const container_t *container)
 {
@@ -397,6 +437,13 @@ container_start(container_t *container)
 	return compartment_start(container->compartment);
 }
 
+int
+container_prestart(container_t *container)
+{
+	ASSERT(container);
+	return compartment_prestart(container->compartment);
+}
+
 int
 container_stop(container_t *container)
 {
@@ -550,6 +597,9 @@ container_wipe_image_cb(const char *path, const char *name, UNUSED void *data)
 		char *image_path = mem_printf("%s/%s", path, name);
 		DEBUG("Deleting image of container %s: %s", container_get_description(container),
 		      image_path);
+		// pass the blocks to the storage as unused before the file is gone
+		if (file_discard(image_path) < 0)
+			DEBUG("Could not discard image %s", image_path);
 		if (unlink(image_path) == -1) {
 			ERROR_ERRNO("Could not delete image %s", image_path);
 		}
@@ -563,6 +613,11 @@ container_wipe_finish(container_t *container)
 {
 	ASSERT(container);
 
+	// the block devices may still be kept on top of the images
+	if (container_release_volumes(container) < 0)
+		WARN("Could not release volumes of container %s",
+		     container_get_description(container));
+
 	/* remove all images of the compartment */
 	if (dir_foreach(container->images_dir, &container_wipe_image_cb, container) < 0) {
 		WARN("Could not open %s images path for wiping container",
@@ -638,6 +693,12 @@ container_destroy(container_t *container)
 	if (unlink(container_get_config_filename(container)))
 		WARN_ERRNO("Can't delete config file!");
 
+	const char *config_file = container_get_config_filename(container);
+	char *cache_file = protobuf_message_cache_file_new(config_file);
+	if (unlink(cache_file) && errno != ENOENT)
+		WARN_ERRNO("Can't delete config cache file!");
+	mem_free0(cache_file);
+
 	return ret;
 }
 
@@ -832,6 +893,7 @@ container_pnet_cfg_new(const char *if_name_mac, bool mac_filter, list_t *mac_whi
 	pnet_cfg->pnet_name = mem_strdup(if_name_mac);
 	pnet_cfg->mac_filter = mac_filter;
 	pnet_cfg->mac_whitelist = NULL;
+	pnet_cfg->mode = CONTAINER_PNET_MODE_MOVE;
 
 	if (!mac_filter)
 		return pnet_cfg;
@@ -871,6 +933,36 @@ container_pnet_cfg_set_pnet_name(container_pnet_cfg_t *pnet_cfg, const char *pne
 	pnet_cfg->pnet_name = mem_strdup(pnet_name);
 }
 
+void
+container_pnet_cfg_set_mode(container_pnet_cfg_t *pnet_cfg, container_pnet_mode_t mode)
+{
+	IF_NULL_RETURN(pnet_cfg);
+
+	pnet_cfg->mode = mode;
+}
+
+void
+container_net_tuning_free(container_net_tuning_t *tuning)
+{
+	IF_NULL_RETURN(tuning);
+
+	for (list_t *l = tuning->sysctls; l; l = l->next)
+		mem_free0(l->data);
+	list_delete(tuning->sysctls);
+
+	mem_free0(tuning->name);
+	mem_free0(tuning);
+}
+
+void
+container_hugetlb_limit_free(container_hugetlb_limit_t *limit)
+{
+	IF_NULL_RETURN(limit);
+
+	mem_free0(limit->page_size);
+	mem_free0(limit);
+}
+
 void
 container_vnet_cfg_free(container_vnet_cfg_t *vnet_cfg)
 {
@@ -917,6 +1009,163 @@ container_get_usb_pin_entry(const container_t *container)
 	return container->usb_pin_entry;
 }
 
+void
+container_set_start_order(container_t *container, unsigned int priority, list_t *after_list)
+{
+	ASSERT(container);
+
+	for (list_t *l = container->start_after_list; l; l = l->next)
+		mem_free0(l->data);
+	list_delete(container->start_after_list);
+
+	container->start_priority = priority;
+	container->start_after_list = after_list;
+}
+
+unsigned int
+container_get_start_priority(const container_t *container)
+{
+	ASSERT(container);
+	return container->start_priority;
+}
+
+const list_t *
+container_get_start_after_list(const container_t *container)
+{
+	ASSERT(container);
+	return container->start_after_list;
+}
+
+void
+container_set_prestart(container_t *container, bool prestart)
+{
+	ASSERT(container);
+	container->prestart = prestart;
+}
+
+bool
+container_get_prestart(const container_t *container)
+{
+	ASSERT(container);
+	return container->prestart;
+}
+
+void
+container_set_ram_soft_limits(container_t *container, unsigned int ram_high, unsigned int ram_low)
+{
+	ASSERT(container);
+	container->ram_high = ram_high;
+	container->ram_low = ram_low;
+}
+
+unsigned int
+container_get_ram_high(const container_t *container)
+{
+	ASSERT(container);
+	return container->ram_high;
+}
+
+unsigned int
+container_get_ram_low(const container_t *container)
+{
+	ASSERT(container);
+	return container->ram_low;
+}
+
+void
+container_set_io_limits(container_t *container, const container_io_limits_t *io_limits)
+{
+	ASSERT(container);
+	ASSERT(io_limits);
+	container->io_limits = *io_limits;
+}
+
+const container_io_limits_t *
+container_get_io_limits(const container_t *container)
+{
+	ASSERT(container);
+	return &container->io_limits;
+}
+
+void
+container_set_net_tuning(container_t *container, const container_net_tuning_t *tuning)
+{
+	ASSERT(container);
+	container->net_tuning = tuning;
+}
+
+const container_net_tuning_t *
+container_get_net_tuning(const container_t *container)
+{
+	ASSERT(container);
+	return container->net_tuning;
+}
+
+void
+container_set_cpu_placement(container_t *container, unsigned int dedicated_cpus,
+			    unsigned int cpu_priority)
+{
+	ASSERT(container);
+	container->dedicated_cpus = dedicated_cpus;
+	container->cpu_priority = cpu_priority;
+}
+
+unsigned int
+container_get_dedicated_cpus(const container_t *container)
+{
+	ASSERT(container);
+	return container->dedicated_cpus;
+}
+
+unsigned int
+container_get_cpu_priority(const container_t *container)
+{
+	ASSERT(container);
+	return container->cpu_priority;
+}
+
+void
+container_set_idle_freeze_timeout(container_t *container, unsigned int timeout)
+{
+	ASSERT(container);
+	container->idle_freeze_timeout = timeout;
+}
+
+unsigned int
+container_get_idle_freeze_timeout(const container_t *container)
+{
+	ASSERT(container);
+	return container->idle_freeze_timeout;
+}
+
+void
+container_set_hugepages(container_t *container, container_thp_mode_t thp_mode,
+			list_t *hugetlb_limits)
+{
+	ASSERT(container);
+
+	for (list_t *l = container->hugetlb_limits; l; l = l->next)
+		container_hugetlb_limit_free(l->data);
+	list_delete(container->hugetlb_limits);
+
+	container->thp_mode = thp_mode;
+	container->hugetlb_limits = hugetlb_limits;
+}
+
+container_thp_mode_t
+container_get_thp_mode(const container_t *container)
+{
+	ASSERT(container);
+	return container->thp_mode;
+}
+
+const list_t *
+container_get_hugetlb_limits(const container_t *container)
+{
+	ASSERT(container);
+	return container->hugetlb_limits;
+}
+
 /* Functions usually implemented and registered by c_user module */
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(setuid0, int, void *)
 CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(setuid0, int, 0)
@@ -953,6 +1202,12 @@ CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(is_device_allowed, bool, void *, char, in
 CONTAINER_MODULE_FUNCTION_WRAPPER4_IMPL(is_device_allowed, bool, true, char, int, int)
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(add_pid_to_cgroups, int, void *, pid_t)
 CONTAINER_MODULE_FUNCTION_WRAPPER2_IMPL(add_pid_to_cgroups, int, 0, pid_t)
+CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(get_pressure, int, void *, const char *)
+CONTAINER_MODULE_FUNCTION_WRAPPER2_IMPL(get_pressure, int, -1, const char *)
+CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(get_usage, int, void *, container_usage_t *)
+CONTAINER_MODULE_FUNCTION_WRAPPER2_IMPL(get_usage, int, -1, container_usage_t *)
+CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(set_cpuset, int, void *, const char *, const char *)
+CONTAINER_MODULE_FUNCTION_WRAPPER3_IMPL(set_cpuset, int, -1, const char *, const char *)
 
 /* Functions usually implemented and registered by c_vol module */
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(get_rootdir, char *, void *)
@@ -961,6 +1216,8 @@ CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(get_mnt, void *, void *)
 CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(get_mnt, void *, NULL)
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(is_encrypted, bool, void *)
 CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(is_encrypted, bool, false)
+CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(release_volumes, int, void *)
+CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(release_volumes, int, 0)
 
 /* Functions usually implemented and registered by c_service module */
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(audit_record_send, int, void *, const uint8_t *, uint32_t)
@@ -969,10 +1226,14 @@ CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(audit_record_notify, int, void *, uint64_
 CONTAINER_MODULE_FUNCTION_WRAPPER2_IMPL(audit_record_notify, int, 0, uint64_t)
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(audit_notify_complete, int, void *)
 CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(audit_notify_complete, int, 0)
+CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(get_milestones, const list_t *, void *)
+CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(get_milestones, const list_t *, NULL)
 
 /* Functions usually implemented and registered by c_time module */
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(get_creation_time, time_t, void *)
 CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(get_creation_time, time_t, 0)
+CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(checkpoint, int, void *)
+CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(checkpoint, int, -1)
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(get_uptime, time_t, void *)
 CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(get_uptime, time_t, 0)
 
@@ -980,6 +1241,12 @@ CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(get_uptime, time_t, 0)
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(set_cap_current_process, int, void *)
 CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(set_cap_current_process, int, 0)
 
+/* Functions usually implemented and registered by c_seccomp module */
+CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(get_syscall_stats_new, container_syscall_stats_t *, void *,
+				       size_t *)
+CONTAINER_MODULE_FUNCTION_WRAPPER2_IMPL(get_syscall_stats_new, container_syscall_stats_t *, NULL,
+					size_t *)
+
 /* Functions usually implemented and registered by c_run module */
 CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(run, int, void *, int, char *, ssize_t, char **, int)
 CONTAINER_MODULE_FUNCTION_WRAPPER6_IMPL(run, int, -1, int, char *, ssize_t, char **, int)
@@ -115,12 +115,109 @@ typedef struct container_vnet_cfg {
  * The CML bridges or moves the physical IF into the container and enforces
  * filtering of layer 2 frames based on MAC adresses
  */
+typedef enum container_pnet_mode {
+	CONTAINER_PNET_MODE_MOVE = 1,
+	CONTAINER_PNET_MODE_MACVLAN,
+	CONTAINER_PNET_MODE_IPVLAN
+} container_pnet_mode_t;
+
 typedef struct container_pnet_cfg {
 	char *pnet_name;
 	bool mac_filter;
 	list_t *mac_whitelist;
+	container_pnet_mode_t mode;
 } container_pnet_cfg_t;
 
+/**
+ * Named tuning of the network stack in the netns of a container, see NetTuningProfile
+ * of the device config.
+ */
+typedef struct container_net_tuning {
+	char *name;
+	list_t *sysctls;	  // "<key>=<value>" with the key relative to /proc/sys/net
+	unsigned int veth_queues; // tx and rx queues of the veths, 0 for the kernel default
+	bool veth_gro;		  // enable generic receive offload on the veths
+} container_net_tuning_t;
+
+/**
+ * Structure to define the I/O limits of a container on the storage backing its volumes.
+ * A value of 0 means no limit.
+ */
+typedef struct container_io_limits {
+	unsigned int weight; // proportional weight, 1 - 10000
+	uint64_t read_bps;
+	uint64_t write_bps;
+	unsigned int read_iops;
+	unsigned int write_iops;
+	unsigned int latency_target; // in microseconds
+} container_io_limits_t;
+
+/**
+ * Transparent hugepage policy of the processes of a container, see ContainerThpMode.
+ */
+typedef enum container_thp_mode {
+	CONTAINER_THP_INHERIT = 1,
+	CONTAINER_THP_NEVER,
+	CONTAINER_THP_ADVISED
+} container_thp_mode_t;
+
+/**
+ * Limit of the hugetlb pages of one size a container may use.
+ */
+typedef struct container_hugetlb_limit {
+	char *page_size;  // as in the names of the hugetlb cgroup files, e.g. "2MB"
+	unsigned int max; // in MBytes
+} container_hugetlb_limit_t;
+
+/**
+ * Structure to hold the cumulative resource usage of a container since its start,
+ * apart from memory_*, which is the current usage. Network counters are seen from
+ * the container, i.e. rx is what the container received on all its veths.
+ */
+typedef struct container_usage {
+	uint64_t cpu_usage_us;
+	uint64_t cpu_user_us;
+	uint64_t cpu_system_us;
+	uint64_t cpu_throttled_us;
+	uint64_t memory_current;
+	uint64_t memory_anon;
+	uint64_t memory_file;
+	uint64_t io_read_bytes;
+	uint64_t io_write_bytes;
+	uint64_t io_read_ios;
+	uint64_t io_write_ios;
+	uint64_t net_rx_bytes;
+	uint64_t net_tx_bytes;
+	uint64_t net_rx_packets;
+	uint64_t net_tx_packets;
+} container_usage_t;
+
+#define CONTAINER_SYSCALL_LATENCY_BUCKETS 16
+
+/**
+ * Statistics of the seccomp notifications of one syscall handled on behalf of a
+ * container since its start. Latencies are measured from receiving the notification
+ * to sending the response. Bucket 0 counts latencies below 1us, bucket i those below
+ * 2^i us and the last bucket all others.
+ */
+typedef struct container_syscall_stats {
+	const char *syscall;
+	uint64_t count;
+	uint64_t failed; // emulated syscalls which failed
+	uint64_t time_total_ns;
+	uint64_t time_max_ns;
+	uint64_t latency_hist[CONTAINER_SYSCALL_LATENCY_BUCKETS];
+} container_syscall_stats_t;
+
+/**
+ * A readiness milestone reported by a service in the container since its start.
+ */
+typedef struct container_milestone {
+	char *name;
+	uint64_t time;	      // CLOCK_REALTIME in ns at which the milestone was reached
+	uint64_t since_start; // ns since the start of the container
+} container_milestone_t;
+
 /**
  * Represents an error that happened during smartcard handling of a container.
  */
@@ -264,6 +361,104 @@ container_get_token_type(const container_t *container);
 bool
 container_get_usb_pin_entry(const container_t *container);
 
+/**
+ * Sets the autostart order of the container at boot. Takes ownership of after_list,
+ * a list of the names or uuids of the containers which have to be running first.
+ */
+void
+container_set_start_order(container_t *container, unsigned int priority, list_t *after_list);
+
+/**
+ * Returns the priority of the container in the autostart order, higher ones start first.
+ */
+unsigned int
+container_get_start_priority(const container_t *container);
+
+/**
+ * Returns the names or uuids of the containers which have to be running before the
+ * container is autostarted.
+ */
+const list_t *
+container_get_start_after_list(const container_t *container);
+
+/**
+ * Sets whether the start of the container is prepared at boot, see container_prestart().
+ */
+void
+container_set_prestart(container_t *container, bool prestart);
+
+bool
+container_get_prestart(const container_t *container);
+
+/**
+ * Sets the soft memory limits of the container in MBytes, 0 for none. The usage above
+ * ram_high is throttled and reclaimed, the usage below ram_low is protected from reclaim.
+ */
+void
+container_set_ram_soft_limits(container_t *container, unsigned int ram_high, unsigned int ram_low);
+
+unsigned int
+container_get_ram_high(const container_t *container);
+
+unsigned int
+container_get_ram_low(const container_t *container);
+
+/**
+ * Sets the I/O limits of the container on the storage backing its volumes.
+ */
+void
+container_set_io_limits(container_t *container, const container_io_limits_t *io_limits);
+
+const container_io_limits_t *
+container_get_io_limits(const container_t *container);
+
+/**
+ * Sets the network tuning profile of the container, NULL for none. The profile is not
+ * copied and has to outlive the container.
+ */
+void
+container_set_net_tuning(container_t *container, const container_net_tuning_t *tuning);
+
+const container_net_tuning_t *
+container_get_net_tuning(const container_t *container);
+
+/**
+ * Sets the number of cpus the cpuset manager dedicates to the container, 0 to share the
+ * remaining cpus, and its priority in the assignment of the dedicated cpus.
+ */
+void
+container_set_cpu_placement(container_t *container, unsigned int dedicated_cpus,
+			    unsigned int cpu_priority);
+
+unsigned int
+container_get_dedicated_cpus(const container_t *container);
+
+unsigned int
+container_get_cpu_priority(const container_t *container);
+
+/**
+ * Sets the time in seconds after which the idle container is frozen, 0 to never freeze it.
+ */
+void
+container_set_idle_freeze_timeout(container_t *container, unsigned int timeout);
+
+unsigned int
+container_get_idle_freeze_timeout(const container_t *container);
+
+/**
+ * Sets the transparent hugepage policy and the hugetlb limits of the container. The
+ * container takes ownership of the list of container_hugetlb_limit_t elements.
+ */
+void
+container_set_hugepages(container_t *container, container_thp_mode_t thp_mode,
+			list_t *hugetlb_limits);
+
+container_thp_mode_t
+container_get_thp_mode(const container_t *container);
+
+const list_t *
+container_get_hugetlb_limits(const container_t *container);
+
 list_t *
 container_get_pnet_cfg_list(const container_t *container);
 
@@ -359,6 +554,24 @@ container_pnet_cfg_free(container_pnet_cfg_t *pnet_cfg);
 void
 container_pnet_cfg_set_pnet_name(container_pnet_cfg_t *pnet_cfg, const char *pnet_name);
 
+/**
+ * Update mode attribute of pnet_cfg data structure, which defaults to CONTAINER_PNET_MODE_MOVE
+ */
+void
+container_pnet_cfg_set_mode(container_pnet_cfg_t *pnet_cfg, container_pnet_mode_t mode);
+
+/**
+ * Free all memory used by a container_net_tuning_t data structure.
+ */
+void
+container_net_tuning_free(container_net_tuning_t *tuning);
+
+/**
+ * Free all memory used by a container_hugetlb_limit_t data structure.
+ */
+void
+container_hugetlb_limit_free(container_hugetlb_limit_t *limit);
+
 /**
  * Get the list of usb devices which are set in container config.
  */
@@ -414,6 +627,16 @@ container_get_pid(const container_t *container);
 pid_t
 container_get_service_pid(const container_t *container);
 
+starttrace_t *
+container_get_starttrace(const container_t *container);
+
+/**
+ * Gets the hook durations of the last completed start of the container, see
+ * compartment_get_start_phases().
+ */
+const starttrace_phase_t *
+container_get_start_phases(const container_t *container, size_t *len);
+
 void
 container_oom_protect_service(const container_t *container);
 
@@ -429,6 +652,12 @@ container_is_privileged(const container_t *container);
 int
 container_start(container_t *container);
 
+/**
+ * Prepares the start of the container, see compartment_prestart().
+ */
+int
+container_prestart(container_t *container);
+
 int
 container_stop(container_t *container);
 
@@ -484,11 +713,42 @@ container_wait_for_child(container_t *container, char *name, pid_t pid);
  */
 CONTAINER_MODULE_WRAPPER_DECLARE(add_pid_to_cgroups, int, pid_t pid)
 
+/*
+ * Get the share of time some tasks of the container stalled on the given resource, i.e.
+ * "memory", "cpu" or "io", in the last 10 seconds in hundredths of a percent.
+ *
+ * @return the pressure, -1 if not available
+ */
+CONTAINER_MODULE_WRAPPER_DECLARE(get_pressure, int, const char *resource)
+
+/*
+ * Fill the cpu, memory and io fields of usage with the usage of the container read
+ * from its cgroup. The network fields are left untouched.
+ *
+ * @return 0 on success, -1 if not available
+ */
+CONTAINER_MODULE_WRAPPER_DECLARE(get_usage, int, container_usage_t *usage)
+
+/*
+ * Restrict the container to the given cpus and memory nodes, both in cpuset list format,
+ * while it is running.
+ */
+CONTAINER_MODULE_WRAPPER_DECLARE(set_cpuset, int, const char *cpus, const char *mems)
+
 /*
  * Set capapilites for calling process as for given container's init
  */
 CONTAINER_MODULE_WRAPPER_DECLARE(set_cap_current_process, int)
 
+/**
+ * Get a copy of the statistics of the syscalls emulated for the container, one entry
+ * per syscall which has been trapped at least once.
+ *
+ * @param n set to the number of entries
+ * @return array of n entries to be freed by the caller, NULL if there are none
+ */
+CONTAINER_MODULE_WRAPPER_DECLARE(get_syscall_stats_new, container_syscall_stats_t *, size_t *n)
+
 /**
  * Get socket fd used to communicate with process executed in container context
  * by using the control run interface
@@ -500,6 +760,12 @@ CONTAINER_MODULE_WRAPPER_DECLARE(get_console_sock_cmld, int, int session_fd)
  */
 CONTAINER_MODULE_WRAPPER_DECLARE(is_encrypted, bool)
 
+/**
+ * Removes the block devices of the volumes which are kept set up after a stop of the
+ * container, e.g., before its images are wiped.
+ */
+CONTAINER_MODULE_WRAPPER_DECLARE(release_volumes, int)
+
 /**
  * Run a given command inside a container
  *
@@ -638,6 +904,12 @@ CONTAINER_MODULE_WRAPPER_DECLARE(audit_record_send, int, const uint8_t *buf, uin
  */
 CONTAINER_MODULE_WRAPPER_DECLARE(audit_notify_complete, int)
 
+/**
+ * Returns the list of milestones (container_milestone_t) reported by the services of the
+ * container since its start, in the order they were reached.
+ */
+CONTAINER_MODULE_WRAPPER_DECLARE(get_milestones, const list_t *)
+
 /**
  * Declares the corresponding handler for container_audit_set_loginuid
  */
@@ -687,4 +959,13 @@ CONTAINER_MODULE_WRAPPER_DECLARE(get_uptime, time_t)
  */
 CONTAINER_MODULE_WRAPPER_DECLARE(get_creation_time, time_t)
 
+/**
+ * Checkpoints the processes of the running container to its images dir, which stops
+ * the container. The next start of the container resumes the checkpoint.
+ * The checkpoint is written asynchronously.
+ *
+ * @return 0 if the checkpoint was started, -1 on error
+ */
+CONTAINER_MODULE_WRAPPER_DECLARE(checkpoint, int)
+
 #endif /* CONTAINER_H */
@@ -33,9 +33,12 @@
 #include "common/list.h"
 #include "common/protobuf.h"
 #include "common/protobuf-text.h"
+#include "common/hashmap.h"
 
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "cmld.h"
 #include "crypto.h"
@@ -49,6 +52,21 @@ struct container_config {
 	ContainerConfig *cfg;
 };
 
+/*
+ * Parsed config files, see container_config_get_cached(). An entry is dropped if its
+ * file is written by container_config_write() and reparsed if the file changed on disk.
+ */
+typedef struct container_config_cached {
+	char *file;
+	ContainerConfig *cfg;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+} container_config_cached_t;
+
+static hashmap_t *container_config_cache = NULL;
+
 #define C_CONFIG_VERIFY_HASH_ALGO SHA512
 
 #define C_CONFIG_MAX_RAM_LIMIT (1 << 30) // TODO 1GB? (< 4GB due to uint32)
@@ -107,6 +125,36 @@ container_config_proto_to_usb_type(ContainerUsbType type)
 	}
 }
 
+static container_pnet_mode_t
+container_config_proto_to_pnet_mode(ContainerPnetMode mode)
+{
+	switch (mode) {
+	case CONTAINER_PNET_MODE__MOVE:
+		return CONTAINER_PNET_MODE_MOVE;
+	case CONTAINER_PNET_MODE__MACVLAN:
+		return CONTAINER_PNET_MODE_MACVLAN;
+	case CONTAINER_PNET_MODE__IPVLAN:
+		return CONTAINER_PNET_MODE_IPVLAN;
+	default:
+		FATAL("Unhandled value for ContainerPnetMode: %d", mode);
+	}
+}
+
+static container_thp_mode_t
+container_config_proto_to_thp_mode(ContainerThpMode mode)
+{
+	switch (mode) {
+	case CONTAINER_THP_MODE__THP_INHERIT:
+		return CONTAINER_THP_INHERIT;
+	case CONTAINER_THP_MODE__THP_NEVER:
+		return CONTAINER_THP_NEVER;
+	case CONTAINER_THP_MODE__THP_ADVISED:
+		return CONTAINER_THP_ADVISED;
+	default:
+		FATAL("Unhandled value for ContainerThpMode: %d", mode);
+	}
+}
+
 /******************************************************************************/
 
 /**
@@ -178,6 +226,71 @@ out:
 	return ret;
 }
 
+/*
+ * Reads the config file, or its .sig or .cert companion if suffix is given.
+ */
+static uint8_t *
+container_config_read_file_new(const char *file, const char *suffix, size_t *len)
+{
+	char *path = suffix ? mem_printf("%.*s%s", (int)(strlen(file) - 5), file, suffix) :
+			      mem_strdup(file);
+	uint8_t *buf = NULL;
+
+	off_t size = file_size(path);
+	if (size > 0) {
+		buf = mem_alloc(size);
+		if (-1 == file_read(path, (char *)buf, size))
+			mem_free0(buf);
+		*len = size;
+	}
+	mem_free0(path);
+	return buf;
+}
+
+void
+container_config_verify_prefetch(const char *const *files, size_t n)
+{
+	IF_FALSE_RETURN(cmld_uses_signed_configs());
+	IF_TRUE_RETURN(n == 0);
+
+	crypto_verify_buf_req_t *reqs = mem_new0(crypto_verify_buf_req_t, n);
+	size_t m = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		size_t len = strlen(files[i]);
+		if (len < 5 || strcmp(files[i] + len - 5, ".conf"))
+			continue;
+
+		const char *file = files[i];
+		crypto_verify_buf_req_t *req = &reqs[m];
+		req->data_buf = container_config_read_file_new(file, NULL, &req->data_buf_len);
+		req->sig_buf = container_config_read_file_new(file, ".sig", &req->sig_buf_len);
+		req->cert_buf = container_config_read_file_new(file, ".cert", &req->cert_buf_len);
+		req->hashalgo = C_CONFIG_VERIFY_HASH_ALGO;
+		if (req->data_buf && req->sig_buf && req->cert_buf) {
+			m++;
+			continue;
+		}
+		// left to container_config_new() to report
+		mem_free0(req->data_buf);
+		mem_free0(req->sig_buf);
+		mem_free0(req->cert_buf);
+	}
+
+	crypto_verify_result_t *results = mem_new0(crypto_verify_result_t, n);
+	DEBUG("Verifying %zu container configs in a batch", m);
+	if (crypto_verify_bufs_block(reqs, results, m) < 0)
+		WARN("Batch verification of container configs failed");
+
+	for (size_t i = 0; i < m; i++) {
+		mem_free0(reqs[i].data_buf);
+		mem_free0(reqs[i].sig_buf);
+		mem_free0(reqs[i].cert_buf);
+	}
+	mem_free0(results);
+	mem_free0(reqs);
+}
+
 container_config_t *
 container_config_new(const char *file, const uint8_t *buf, size_t len, uint8_t *sig_buf,
 		     size_t sig_len, uint8_t *cert_buf, size_t cert_len)
@@ -185,6 +298,7 @@ container_config_new(const char *file, const uint8_t *buf, size_t len, uint8_t *
 	ContainerConfig *ccfg = NULL;
 	uint8_t *buf_internal = NULL;
 	container_config_t *config = NULL;
+	char *cache_file = NULL;
 
 	ASSERT(file);
 	off_t conf_len = len;
@@ -219,8 +333,11 @@ container_config_new(const char *file, const uint8_t *buf, size_t len, uint8_t *
 		goto out;
 	}
 
-	ccfg = (ContainerConfig *)protobuf_message_new_from_buf(buf_internal, conf_len,
-								&container_config__descriptor);
+	// the signature has been verified against the text above, validating the text suffices
+	cache_file = protobuf_message_cache_file_new(file);
+	ccfg = (ContainerConfig *)protobuf_message_new_from_buf_cached(
+		buf_internal, conf_len, NULL, 0, cache_file, &container_config__descriptor);
+	mem_free0(cache_file);
 	if (!ccfg) {
 		WARN("Failed loading container config from buf");
 		goto out;
@@ -259,6 +376,63 @@ container_config_free(container_config_t *config)
 	mem_free0(config);
 }
 
+static void
+container_config_cached_free(container_config_cached_t *cached)
+{
+	protobuf_free_message((ProtobufCMessage *)cached->cfg);
+	mem_free0(cached->file);
+	mem_free0(cached);
+}
+
+static void
+container_config_cache_drop(const char *file)
+{
+	IF_NULL_RETURN(container_config_cache);
+
+	container_config_cached_t *cached = hashmap_remove(container_config_cache, file);
+	if (cached)
+		container_config_cached_free(cached);
+}
+
+const ContainerConfig *
+container_config_get_cached(const char *file)
+{
+	ASSERT(file);
+
+	struct stat st;
+	if (stat(file, &st) < 0) {
+		container_config_cache_drop(file);
+		return NULL;
+	}
+
+	if (!container_config_cache)
+		container_config_cache = hashmap_new_str();
+
+	container_config_cached_t *cached = hashmap_get(container_config_cache, file);
+	if (cached && cached->dev == st.st_dev && cached->ino == st.st_ino &&
+	    cached->size == st.st_size && cached->mtime.tv_sec == st.st_mtim.tv_sec &&
+	    cached->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return cached->cfg;
+
+	container_config_cache_drop(file);
+
+	ContainerConfig *cfg = (ContainerConfig *)protobuf_message_new_from_textfile(
+		file, &container_config__descriptor);
+	IF_NULL_RETVAL(cfg, NULL);
+
+	cached = mem_new0(container_config_cached_t, 1);
+	cached->file = mem_strdup(file);
+	cached->cfg = cfg;
+	cached->dev = st.st_dev;
+	cached->ino = st.st_ino;
+	cached->size = st.st_size;
+	cached->mtime = st.st_mtim;
+	hashmap_put(container_config_cache, cached->file, cached);
+
+	TRACE("Cached parsed config %s", file);
+	return cfg;
+}
+
 int
 container_config_write(const container_config_t *config)
 {
@@ -266,6 +440,8 @@ container_config_write(const container_config_t *config)
 	ASSERT(config->cfg);
 	ASSERT(config->file);
 
+	container_config_cache_drop(config->file);
+
 	if (cmld_uses_signed_configs()) {
 		INFO("Signed configuration is enabled, skip writing in memory structure to disk!");
 		return 0;
@@ -361,7 +537,8 @@ container_config_fill_mount(const container_config_t *config, mount_t *mnt)
 		mount_entry_set_img(mntent, file);
 
 		if ((mount_entry_get_type(mntent) == MOUNT_TYPE_EMPTY) ||
-		    (mount_entry_get_type(mntent) == MOUNT_TYPE_OVERLAY_RW)) {
+		    (mount_entry_get_type(mntent) == MOUNT_TYPE_OVERLAY_RW) ||
+		    (mount_entry_get_type(mntent) == MOUNT_TYPE_EPHEMERAL)) {
 			uint64_t size = cfg->image_sizes[i]->image_size;
 			mount_entry_set_size(mntent, size);
 		} else {
@@ -427,6 +604,9 @@ container_config_get_net_ifaces_list_new(const container_config_t *config)
 			      config->cfg->net_ifaces[i]->netif);
 			continue;
 		}
+		container_pnet_mode_t mode =
+			container_config_proto_to_pnet_mode(config->cfg->net_ifaces[i]->mode);
+		container_pnet_cfg_set_mode(pnet_cfg, mode);
 
 		// append to net_ifaces_list
 		net_ifaces_list =
@@ -501,6 +681,8 @@ container_config_append_net_ifaces(const container_config_t *config, const char
 		ContainerPnetConfig *pnet_iface = mem_new(ContainerPnetConfig, 1);
 		container_pnet_config__init(pnet_iface);
 		pnet_iface->netif = mem_strdup(old_net_ifaces[i]->netif);
+		pnet_iface->has_mode = old_net_ifaces[i]->has_mode;
+		pnet_iface->mode = old_net_ifaces[i]->mode;
 		pnet_iface->n_mac_filter = old_net_ifaces[i]->n_mac_filter;
 		for (size_t j = 0; j < pnet_iface->n_mac_filter; j++) {
 			pnet_iface->mac_filter[j] = mem_strdup(old_net_ifaces[i]->mac_filter[j]);
@@ -543,6 +725,8 @@ container_config_remove_net_ifaces(const container_config_t *config, const char
 			ContainerPnetConfig *pnet_iface = mem_new(ContainerPnetConfig, 1);
 			container_pnet_config__init(pnet_iface);
 			pnet_iface->netif = mem_strdup(old_net_ifaces[i]->netif);
+			pnet_iface->has_mode = old_net_ifaces[i]->has_mode;
+			pnet_iface->mode = old_net_ifaces[i]->mode;
 			pnet_iface->n_mac_filter = old_net_ifaces[i]->n_mac_filter;
 			for (size_t k = 0; k < pnet_iface->n_mac_filter; k++) {
 				pnet_iface->mac_filter[k] =
@@ -722,6 +906,146 @@ container_config_get_enable_xorg_compat(const container_config_t *config)
 	return config->cfg->enable_xorg_compat;
 }
 
+uint32_t
+container_config_get_start_priority(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->start_priority;
+}
+
+list_t *
+container_config_get_start_after_list_new(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	list_t *after_list = NULL;
+	for (size_t i = 0; i < config->cfg->n_start_after; i++)
+		after_list = list_append(after_list, mem_strdup(config->cfg->start_after[i]));
+
+	return after_list;
+}
+
+bool
+container_config_get_prestart(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->prestart;
+}
+
+uint32_t
+container_config_get_ram_high(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->ram_high;
+}
+
+uint32_t
+container_config_get_ram_low(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->ram_low;
+}
+
+void
+container_config_get_io_limits(const container_config_t *config, container_io_limits_t *io_limits)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+	ASSERT(io_limits);
+
+	const ContainerIoConfig *io = config->cfg->io;
+
+	*io_limits = (container_io_limits_t){ 0 };
+	IF_NULL_RETURN(io);
+
+	io_limits->weight = io->weight;
+	io_limits->read_bps = io->read_bps;
+	io_limits->write_bps = io->write_bps;
+	io_limits->read_iops = io->read_iops;
+	io_limits->write_iops = io->write_iops;
+	io_limits->latency_target = io->latency_target;
+}
+
+uint32_t
+container_config_get_dedicated_cpus(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->dedicated_cpus;
+}
+
+uint32_t
+container_config_get_cpu_priority(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->cpu_priority;
+}
+
+uint32_t
+container_config_get_idle_freeze_timeout(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->idle_freeze_timeout;
+}
+
+const char *
+container_config_get_net_tuning_profile(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->net_tuning_profile;
+}
+
+container_thp_mode_t
+container_config_get_thp_mode(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return container_config_proto_to_thp_mode(config->cfg->thp_mode);
+}
+
+list_t *
+container_config_get_hugetlb_limits_new(const container_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	list_t *limits = NULL;
+	for (size_t i = 0; i < config->cfg->n_hugetlb_limits; i++) {
+		const ContainerHugetlbLimit *cfg_limit = config->cfg->hugetlb_limits[i];
+
+		// the page size ends up in a file name below the cgroup of the container
+		if (strchr(cfg_limit->page_size, '/') || strstr(cfg_limit->page_size, "..")) {
+			WARN("Skipping hugetlb limit for invalid page size '%s'",
+			     cfg_limit->page_size);
+			continue;
+		}
+
+		container_hugetlb_limit_t *limit = mem_new0(container_hugetlb_limit_t, 1);
+		limit->page_size = mem_strdup(cfg_limit->page_size);
+		limit->max = cfg_limit->max;
+		limits = list_append(limits, limit);
+	}
+
+	return limits;
+}
+
 // hardcode some restricted config otpions in CC Mode
 #ifdef CC_MODE
 uint32_t
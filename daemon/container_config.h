@@ -37,6 +37,7 @@
 
 #include "container.h"
 #include "mount.h"
+#include "container.pb-c.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -65,6 +66,18 @@ container_config_t *
 container_config_new(const char *file, const uint8_t *buf, size_t len, uint8_t *sig_buf,
 		     size_t sig_len, uint8_t *cert_buf, size_t cert_len);
 
+/**
+ * Verifies the signatures of the given stored config files as a batch, so scd checks
+ * them concurrently. The results are cached by crypto_verify_bufs_block(), thus a
+ * following container_config_new() on an unchanged file does not wait for scd.
+ * Does nothing if signed configs are not enforced.
+ *
+ * @param files The paths of the config files, ending in ".conf".
+ * @param n The number of files.
+ */
+void
+container_config_verify_prefetch(const char *const *files, size_t n);
+
 /**
  * Release the container_config_t object.
  */
@@ -74,6 +87,18 @@ container_config_free(container_config_t *config);
 int
 container_config_write(const container_config_t *config);
 
+/**
+ * Returns the parsed config stored in the given config file. The config is cached
+ * until the file is written by container_config_write or changed on disk, so that
+ * polling the configs of all containers does not parse them again on every request.
+ *
+ * @param file The config file of a container.
+ * @return The cached config, which is owned by the cache and stays valid until the next
+ * call for this file or container_config_write, or NULL if the file cannot be parsed.
+ */
+const ContainerConfig *
+container_config_get_cached(const char *file);
+
 /*************************/
 /* GETTER + SETTER       */
 /*************************/
@@ -253,4 +278,79 @@ container_config_get_usb_pin_entry(const container_config_t *config);
 bool
 container_config_get_enable_xorg_compat(const container_config_t *config);
 
+/**
+ * Returns the priority of the container in the autostart order at boot.
+ */
+uint32_t
+container_config_get_start_priority(const container_config_t *config);
+
+/**
+ * Returns a new list of the names or uuids of the containers which have to be running
+ * before the container is autostarted. The list and its elements have to be freed.
+ */
+list_t *
+container_config_get_start_after_list_new(const container_config_t *config);
+
+/**
+ * Returns true if the start of the container should be prepared at boot.
+ */
+bool
+container_config_get_prestart(const container_config_t *config);
+
+/**
+ * Returns the soft memory limit in MBytes above which the usage of the container is
+ * throttled, 0 for none.
+ */
+uint32_t
+container_config_get_ram_high(const container_config_t *config);
+
+/**
+ * Returns the memory in MBytes of the container which is protected from reclaim.
+ */
+uint32_t
+container_config_get_ram_low(const container_config_t *config);
+
+/**
+ * Fills the I/O limits of the container, which are all 0 if none are configured.
+ */
+void
+container_config_get_io_limits(const container_config_t *config, container_io_limits_t *io_limits);
+
+/**
+ * Returns the number of cpus the cpuset manager dedicates to the container, 0 for none.
+ */
+uint32_t
+container_config_get_dedicated_cpus(const container_config_t *config);
+
+/**
+ * Returns the priority of the container in the assignment of dedicated cpus.
+ */
+uint32_t
+container_config_get_cpu_priority(const container_config_t *config);
+
+/**
+ * Returns the time in seconds after which the container is frozen if idle, 0 for never.
+ */
+uint32_t
+container_config_get_idle_freeze_timeout(const container_config_t *config);
+
+/**
+ * Returns the name of the network tuning profile of the container, NULL if none is selected.
+ */
+const char *
+container_config_get_net_tuning_profile(const container_config_t *config);
+
+/**
+ * Returns the transparent hugepage policy of the container.
+ */
+container_thp_mode_t
+container_config_get_thp_mode(const container_config_t *config);
+
+/**
+ * Returns a new list of the container_hugetlb_limit_t limits of the container, which
+ * has to be freed with its elements by container_hugetlb_limit_free().
+ */
+list_t *
+container_config_get_hugetlb_limits_new(const container_config_t *config);
+
 #endif /* C_CONFIG_H */
@@ -42,6 +42,7 @@
 #define CONTAINER_MODULE_REGISTER_WRAPPER_IMPL(name, type, ...) \
 	typedef struct { \
 		const char *mod_name; \
+		int mod_slot; \
 		type (*handler_func)(__VA_ARGS__); \
 	} container_## name ##_handler_t; \
 	static container_## name ##_handler_t *container_## name ##_handler = NULL; \
@@ -53,18 +54,29 @@
 		} \
 		container_## name ##_handler = mem_new0(container_## name ##_handler_t, 1); \
 		container_## name ##_handler->mod_name = mod_name; \
+		container_## name ##_handler->mod_slot = compartment_module_get_slot(mod_name); \
 		container_## name ##_handler->handler_func = h; \
 		INFO("%s_handler registerd by module '%s'.", #name, mod_name); \
 	}
 
+/*
+ * The module slot is resolved once at handler registration; the lookup by name
+ * is only a fallback for handlers registered before their module.
+ */
+#define CONTAINER_MODULE_GET_INSTANCE(name, container) \
+	(container_## name ##_handler->mod_slot >= 0 ? \
+		compartment_module_get_instance_by_slot((container)->compartment, \
+			container_## name ##_handler->mod_slot) : \
+		compartment_module_get_instance_by_name((container)->compartment, \
+			container_## name ##_handler->mod_name))
+
 #define CONTAINER_MODULE_FUNCTION_WRAPPER_IMPL(name, type, unimpl) \
 	type container_## name(const container_t *container) \
 	{ \
 		ASSERT(container); \
 		if (!container_## name ##_handler) \
 			return unimpl; \
-		void *instance = compartment_module_get_instance_by_name( \
-			container->compartment, container_## name ##_handler->mod_name); \
+		void *instance = CONTAINER_MODULE_GET_INSTANCE(name, container); \
 		/* no corresponding module registered and instantiated */ \
 		if (!instance) \
 			return unimpl; \
@@ -77,8 +89,7 @@
 		ASSERT(container); \
 		if (!container_## name ##_handler) \
 			return unimpl; \
-		void *instance = compartment_module_get_instance_by_name( \
-			container->compartment, container_## name ##_handler->mod_name); \
+		void *instance = CONTAINER_MODULE_GET_INSTANCE(name, container); \
 		/* no corresponding module registered and instantiated */ \
 		if (!instance) \
 			return unimpl; \
@@ -91,8 +102,7 @@
 		ASSERT(container); \
 		if (!container_## name ##_handler) \
 			return unimpl; \
-		void *instance = compartment_module_get_instance_by_name( \
-			container->compartment, container_## name ##_handler->mod_name); \
+		void *instance = CONTAINER_MODULE_GET_INSTANCE(name, container); \
 		/* no corresponding module registered and instantiated */ \
 		if (!instance) \
 			return unimpl; \
@@ -105,8 +115,7 @@
 		ASSERT(container); \
 		if (!container_## name ##_handler) \
 			return unimpl; \
-		void *instance = compartment_module_get_instance_by_name( \
-			container->compartment, container_## name ##_handler->mod_name); \
+		void *instance = CONTAINER_MODULE_GET_INSTANCE(name, container); \
 		/* no corresponding module registered and instantiated */ \
 		if (!instance) \
 			return unimpl; \
@@ -119,8 +128,7 @@
 		ASSERT(container); \
 		if (!container_## name ##_handler) \
 			return unimpl; \
-		void *instance = compartment_module_get_instance_by_name( \
-			container->compartment, container_## name ##_handler->mod_name); \
+		void *instance = CONTAINER_MODULE_GET_INSTANCE(name, container); \
 		/* no corresponding module registered and instantiated */ \
 		if (!instance) \
 			return unimpl; \
@@ -133,8 +141,7 @@
 		ASSERT(container); \
 		if (!container_## name ##_handler) \
 			return unimpl; \
-		void *instance = compartment_module_get_instance_by_name( \
-			container->compartment, container_## name ##_handler->mod_name); \
+		void *instance = CONTAINER_MODULE_GET_INSTANCE(name, container); \
 		/* no corresponding module registered and instantiated */ \
 		if (!instance) \
 			return unimpl; \
@@ -147,8 +154,7 @@
 		ASSERT(container); \
 		if (!container_## name ##_handler) \
 			return unimpl; \
-		void *instance = compartment_module_get_instance_by_name( \
-			container->compartment, container_## name ##_handler->mod_name); \
+		void *instance = CONTAINER_MODULE_GET_INSTANCE(name, container); \
 		/* no corresponding module registered and instantiated */ \
 		if (!instance) \
 			return unimpl; \
@@ -21,39 +21,56 @@
  * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
  */
 
+#define _GNU_SOURCE
+
 #include "control.h"
 
 #include "control.pb-c.h"
 #include "container.pb-c.h"
 
 #include "container.h"
+#include "container_config.h"
 #include "guestos_mgr.h"
 #include "guestos.h"
 #include "cmld.h"
+#include "bootsched.h"
 #include "crypto.h"
 #include "audit.h"
+#include "telemetry.h"
+#include "devstats.h"
+#include "idlefreeze.h"
 
 //#define LOGF_LOG_MIN_PRIO LOGF_PRIO_TRACE
 #include "common/macro.h"
 #include "common/mem.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/protobuf-text.h"
 #include "common/sock.h"
 #include "common/uuid.h"
 #include "common/event.h"
 #include "common/fd.h"
 #include "common/logf.h"
+#include "common/logrotate.h"
 #include "common/list.h"
 #include "common/network.h"
 #include "common/reboot.h"
 #include "common/file.h"
 #include "common/dir.h"
 #include "common/str.h"
-#include "common/proc.h"
 #include "common/sock-sd.h"
 
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 
 #include <google/protobuf-c/protobuf-c-text.h>
 
@@ -65,14 +82,129 @@
 
 #define LOGGER_ENTRY_MAX_LEN (5 * 1024)
 
+// age in seconds of the snapshot after which a query makes the main loop update it
+#define CONTROL_SNAPSHOT_MAX_AGE 1
+
+// block size of the arena the queued messages of one batch are unpacked into
+#define CONTROL_JOB_ARENA_BLOCK_SIZE (16 * 1024)
+
 struct control {
 	int sock; // listen socket fd
 	bool privileged;
-	list_t *event_io_sock_connected_list; // list of clients
+	event_io_t *accept_io; // of the listen socket, owned by the control thread
+	list_t *conn_list;     // list of connected clients (control_client_t)
+	list_t *telemetry_streams; // clients following the telemetry (control_telemetry_stream_t)
+	list_t *event_streams; // clients following the container events (control_event_stream_t)
+	list_t *bulk_starts;   // queued starts of bulk commands (control_bulk_start_t)
 };
 
+/* a client which follows the telemetry samples of some or all containers */
+typedef struct control_telemetry_stream {
+	int fd;
+	char **uuids; // containers to stream the samples of, all if empty
+	size_t n_uuids;
+	telemetry_subscriber_t *subscriber;
+} control_telemetry_stream_t;
+
+/* a container start of a bulk command queued in the boot scheduler */
+typedef struct control_bulk_start {
+	control_t *control; // NULL if the control was freed in the meantime
+	int fd;		    // -1 if the connection was closed in the meantime
+	char *uuid;
+	ContainerStartParams *start_params;
+} control_bulk_start_t;
+
+/* a client which follows the events of some or all containers */
+typedef struct control_event_stream {
+	int fd;
+	char **uuids; // containers to stream the events of, all if empty
+	size_t n_uuids;
+	cmld_container_event_subscriber_t *subscriber;
+} control_event_stream_t;
+
 static list_t *control_list = NULL;
 
+/* a client connected to a listening control socket */
+typedef struct control_client {
+	control_t *control;
+	protobuf_conn_t *conn; // owned by the control thread, NULL once closed
+	int fd;		       // closed by the main loop
+	int queued;	       // messages queued to the main loop and not yet handled
+} control_client_t;
+
+typedef enum {
+	CONTROL_JOB_MESSAGE, // a message of the client to be handled
+	CONTROL_JOB_CLOSE,   // the client closed its connection
+	CONTROL_JOB_SNAPSHOT // a query found the snapshot outdated
+} control_job_type_t;
+
+/* work of the control thread which has to be done by the main loop */
+typedef struct control_job {
+	control_job_type_t type;
+	control_client_t *client;
+	uint8_t *buf; // the packed message
+	size_t buflen;
+} control_job_t;
+
+/* a function which the main loop runs on the control thread */
+typedef struct control_thread_call {
+	void (*func)(void *data);
+	void *data;
+	bool done;
+} control_thread_call_t;
+
+/* the status of all containers at the time of the last update, shared by both threads */
+typedef struct control_snapshot {
+	int refs; // protected by control_snapshot_lock
+	time_t time;
+	ContainerStatus **status;
+	size_t n;
+} control_snapshot_t;
+
+/*
+ * The connections of all listening control sockets are read by the control thread,
+ * so a long running command in the main loop does not delay the status queries of
+ * other clients. Everything else is done by the main loop.
+ */
+static pthread_t control_thread;
+static bool control_thread_running = false;
+static unsigned int control_thread_users = 0; // controls served by the thread
+static event_base_t *control_thread_base = NULL;
+static int control_thread_call_fd = -1; // wakes up the control thread
+static event_io_t *control_thread_call_io = NULL;
+static int control_thread_main_fd = -1; // wakes up the main loop
+static event_io_t *control_thread_main_io = NULL;
+
+static pthread_mutex_t control_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t control_thread_cond = PTHREAD_COND_INITIALIZER;
+static list_t *control_thread_calls = NULL; // control_thread_call_t
+static list_t *control_thread_jobs = NULL;  // control_job_t
+
+static pthread_mutex_t control_snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static control_snapshot_t *control_snapshot = NULL;
+static bool control_snapshot_requested = false; // a CONTROL_JOB_SNAPSHOT is queued
+static event_timer_t *control_snapshot_timer = NULL;
+static cmld_container_event_subscriber_t *control_snapshot_subscriber = NULL;
+
+static void
+control_thread_stop(void);
+
+/**
+ * Sets the content of a LogMessage fragment, as bytes for compressed log files.
+ */
+static void
+control_log_message_set(LogMessage *message, const char *buf, size_t len, bool compressed)
+{
+	if (compressed) {
+		message->msg = mem_strdup("");
+		message->has_data = true;
+		message->data.data = mem_memcpy((const unsigned char *)buf, len);
+		message->data.len = len;
+	} else {
+		message->msg = mem_strndup(buf, len);
+	}
+}
+
 /**
  * @brief callback for the dir_foreach function sending a file as LogMessage to the Controller
  * @path: Expects path string without trailing "/" at the end
@@ -101,13 +233,25 @@ control_send_file_as_log_message_cb(const char *path, const char *file, void UNU
 
 	DEBUG("Opening and sending %s", str_buffer(path_str));
 
-	char *file_buf =
-		file_read_new(str_buffer(path_str), (size_t)file_size(str_buffer(path_str)));
+	// compressed log files are sent as they are, in the data field
+	bool compressed = strstr(file, LOGROTATE_SUFFIX) != NULL;
+	off_t fsize = file_size(str_buffer(path_str));
+	char *file_buf = NULL;
+	int size = 0;
+
+	if (compressed && fsize > 0) {
+		file_buf = mem_alloc(fsize);
+		size = file_read(str_buffer(path_str), file_buf, fsize);
+		if (size != fsize)
+			mem_free0(file_buf);
+	} else if (!compressed) {
+		file_buf = file_read_new(str_buffer(path_str), (size_t)fsize);
+		size = file_buf ? (int)strlen(file_buf) : 0;
+	}
 
 	if (file_buf) {
 		int max_fragment_size = PROTOBUF_MAX_MESSAGE_SIZE - PROTOBUF_MAX_OVERHEAD;
 		int sent = 0;
-		int size = strlen(file_buf);
 
 		while (0 < size - sent) {
 			fflush(stdout);
@@ -117,8 +261,8 @@ control_send_file_as_log_message_cb(const char *path, const char *file, void UNU
 			int tosend = size - sent;
 			if (tosend > max_fragment_size) {
 				out.code = DAEMON_TO_CONTROLLER__CODE__LOG_MESSAGE_FRAGMENT;
-				message.msg =
-					(char *)mem_strndup(file_buf + sent, max_fragment_size);
+				control_log_message_set(&message, file_buf + sent,
+							max_fragment_size, compressed);
 
 				DEBUG("Sending fragment of logfile %s, sent: %d, remaining: %d",
 				      str_buffer(path_str), sent, size - sent);
@@ -133,11 +277,13 @@ control_send_file_as_log_message_cb(const char *path, const char *file, void UNU
 
 				sent += max_fragment_size;
 				mem_free0(message.msg);
+				mem_free0(message.data.data);
 			} else {
 				DEBUG("Sending final fragment of logfile %s, sent: %d, remaining: %d",
 				      str_buffer(path_str), sent, size - sent);
 				out.code = DAEMON_TO_CONTROLLER__CODE__LOG_MESSAGE_FINAL;
-				message.msg = (char *)mem_strndup(file_buf + sent, size - sent);
+				control_log_message_set(&message, file_buf + sent, size - sent,
+							compressed);
 
 				out.log_message = &message;
 				if (protobuf_send_message(*fd, (ProtobufCMessage *)&out) < 0) {
@@ -147,8 +293,9 @@ control_send_file_as_log_message_cb(const char *path, const char *file, void UNU
 					break;
 				}
 
-				sent += strlen(message.msg);
+				sent = size;
 				mem_free0(message.msg);
+				mem_free0(message.data.data);
 			}
 		}
 		mem_free0(file_buf);
@@ -166,6 +313,87 @@ control_send_file_as_log_message_cb(const char *path, const char *file, void UNU
 	return ret;
 }
 
+/**
+ * @brief callback for the dir_foreach function passing a log file read-only to the
+ * Controller, announced by a LOG_FILE message with its current size
+ * @return 1 on error, 0 else
+ */
+static int
+control_send_log_file_cb(const char *path, const char *file, void *data)
+{
+	IF_NULL_RETVAL(path, 1);
+	IF_NULL_RETVAL(file, 1);
+
+	int *fd = (int *)data;
+	int ret = 0;
+	char *file_path = mem_printf("%s/%s", path, file);
+
+	int log_fd = open(file_path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+	if (log_fd < 0) {
+		WARN_ERRNO("Could not open logfile %s", file_path);
+		mem_free0(file_path);
+		return 1;
+	}
+
+	struct stat st;
+	if (fstat(log_fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		DEBUG("Skipping %s, not a regular file", file_path);
+		goto out;
+	}
+
+	LogFile log_file = LOG_FILE__INIT;
+	log_file.name = (char *)file;
+	log_file.size = st.st_size;
+
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__LOG_FILE;
+	out.log_file = &log_file;
+
+	DEBUG("Passing logfile %s (%" PRIu64 " bytes)", file_path, log_file.size);
+
+	if (protobuf_send_message(*fd, (ProtobufCMessage *)&out) < 0 ||
+	    protobuf_conn_send_fd(*fd, log_fd) < 0) {
+		ERROR("Could not pass logfile %s", file_path);
+		ret = 1;
+	}
+
+out:
+	close(log_fd);
+	mem_free0(file_path);
+	return ret;
+}
+
+/**
+ * Passes the files in LOGFILE_DIR to a local control client, which copies them
+ * itself, instead of sending their content in LOG_MESSAGE fragments.
+ */
+static void
+control_handle_cmd_get_log_files(int fd)
+{
+	int domain;
+	socklen_t len = sizeof(domain);
+
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__RESPONSE;
+	out.has_response = true;
+	out.response = DAEMON_TO_CONTROLLER__RESPONSE__CMD_FAILED;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) || domain != AF_UNIX) {
+		WARN("Control client is not local, log files cannot be passed");
+	} else {
+		int dir_ret = dir_foreach(LOGFILE_DIR, &control_send_log_file_cb, (void *)&fd);
+		if (dir_ret < 0)
+			WARN("Something went wrong during traversal of LOGFILE_DIR");
+		else if (dir_ret > 0)
+			WARN("%d logs could not be passed.", dir_ret);
+		else
+			out.response = DAEMON_TO_CONTROLLER__RESPONSE__CMD_OK;
+	}
+
+	if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0)
+		WARN("Could not send response to GET_LOG_FILES");
+}
+
 /**
  * The usual identity map between two corresponding C and protobuf enums.
  */
@@ -251,6 +479,47 @@ control_container_status_new(const container_t *container)
 		}
 	}
 
+	int pressure;
+	if ((pressure = container_get_pressure(container, "memory")) >= 0) {
+		c_status->has_memory_pressure = true;
+		c_status->memory_pressure = pressure / 100.0f;
+	}
+	if ((pressure = container_get_pressure(container, "cpu")) >= 0) {
+		c_status->has_cpu_pressure = true;
+		c_status->cpu_pressure = pressure / 100.0f;
+	}
+	if ((pressure = container_get_pressure(container, "io")) >= 0) {
+		c_status->has_io_pressure = true;
+		c_status->io_pressure = pressure / 100.0f;
+	}
+
+	const list_t *milestones = container_get_milestones(container);
+	c_status->n_milestones = list_length((list_t *)milestones);
+	if (c_status->n_milestones)
+		c_status->milestones = mem_new0(ContainerMilestone *, c_status->n_milestones);
+	for (size_t i = 0; milestones; milestones = milestones->next, i++) {
+		const container_milestone_t *milestone = milestones->data;
+		c_status->milestones[i] = mem_new(ContainerMilestone, 1);
+		container_milestone__init(c_status->milestones[i]);
+		c_status->milestones[i]->name = mem_strdup(milestone->name);
+		c_status->milestones[i]->time = milestone->time / 1000000;
+		c_status->milestones[i]->since_start = milestone->since_start / 1000000;
+	}
+
+	size_t n_phases;
+	const starttrace_phase_t *phases = container_get_start_phases(container, &n_phases);
+	c_status->n_start_phases = n_phases;
+	if (n_phases)
+		c_status->start_phases = mem_new0(ContainerStartPhase *, n_phases);
+	for (size_t i = 0; i < n_phases; i++) {
+		c_status->start_phases[i] = mem_new(ContainerStartPhase, 1);
+		container_start_phase__init(c_status->start_phases[i]);
+		// module and hook names are static
+		c_status->start_phases[i]->module = (char *)phases[i].module;
+		c_status->start_phases[i]->hook = (char *)phases[i].hook;
+		c_status->start_phases[i]->duration_us = phases[i].duration / 1000;
+	}
+
 	return c_status;
 }
 
@@ -267,6 +536,16 @@ control_container_status_free(ContainerStatus *c_status)
 	mem_free0(c_status->name);
 	mem_free0(c_status->uuid);
 	mem_free0(c_status->guestos);
+	for (size_t i = 0; i < c_status->n_milestones; i++) {
+		mem_free0(c_status->milestones[i]->name);
+		mem_free0(c_status->milestones[i]);
+	}
+	if (c_status->milestones)
+		mem_free0(c_status->milestones);
+	for (size_t i = 0; i < c_status->n_start_phases; i++)
+		mem_free0(c_status->start_phases[i]);
+	if (c_status->start_phases)
+		mem_free0(c_status->start_phases);
 	mem_free0(c_status);
 }
 
@@ -340,6 +619,35 @@ control_cb_read_console(int fd, unsigned events, event_io_t *io, void *data)
 	}
 }
 
+/*
+ * Passes the console socket of an exec'ed command to a local control client, which then reads
+ * the output and writes the input of the command directly instead of exchanging protobuf
+ * messages. The client sees EOF on the console once the command has terminated.
+ */
+static int
+control_send_exec_channel(int fd, const container_t *container)
+{
+	int domain;
+	socklen_t len = sizeof(domain);
+
+	int console_fd = container_get_console_sock_cmld(container, fd);
+	IF_TRUE_RETVAL(console_fd < 0, -1);
+	if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) || domain != AF_UNIX) {
+		DEBUG("Control client is not local, falling back to exec output messages");
+		return -1;
+	}
+
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__EXEC_CHANNEL;
+
+	if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0) {
+		WARN("Could not send exec channel to control client");
+		return -1;
+	}
+
+	return protobuf_conn_send_fd(fd, console_fd);
+}
+
 static container_t *
 control_get_container_by_uuid_string(const char *uuid_str)
 {
@@ -362,32 +670,48 @@ control_get_container_by_uuid_string(const char *uuid_str)
  * Returns a list of containers for all given UUIDs, or a list with all
  * available containers if the given UUID list is empty.
  */
+static void
+control_container_list_append_cb(container_t *container, void *data)
+{
+	list_t **list = data; // head and tail of the list
+
+	list_t *elem = list_append(list[1], container);
+	list[0] = list[0] ? list[0] : elem;
+	list[1] = list[1] ? list[1]->next : elem;
+}
+
 static list_t *
 control_build_container_list_from_uuids(size_t n_uuids, char **uuids)
 {
-	list_t *containers = NULL;
+	list_t *containers[2] = { NULL, NULL };
 	if (n_uuids > 0) { // uuid list given in incoming message
 		for (size_t i = 0; i < n_uuids; i++) {
 			container_t *container = control_get_container_by_uuid_string(uuids[i]);
 			if (container != NULL)
-				containers = list_append(containers, container);
+				control_container_list_append_cb(container, containers);
 		}
 	} else { // empty uuid list, return status for all containers
-		n_uuids = cmld_containers_get_count();
-		for (size_t i = 0; i < n_uuids; i++) {
-			container_t *container = cmld_container_get_by_index(i);
-			containers = list_append(containers, container);
-		}
+		cmld_containers_foreach(&control_container_list_append_cb, containers);
 	}
-	return containers;
+	return containers[0];
 }
 
-int
-control_send_message(control_message_t message, int fd)
+/**
+ * Sends the response for the given message, as CONTAINER_RESPONSE tagged with the uuid
+ * of the container for bulk commands or as a plain RESPONSE if uuid is NULL.
+ */
+static int
+control_send_response(control_message_t message, const char *uuid, int fd)
 {
+	char *uuids[1] = { (char *)uuid };
 	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
 	out.code = DAEMON_TO_CONTROLLER__CODE__RESPONSE;
 	out.has_response = true;
+	if (uuid) {
+		out.code = DAEMON_TO_CONTROLLER__CODE__CONTAINER_RESPONSE;
+		out.n_container_uuids = 1;
+		out.container_uuids = uuids;
+	}
 	switch (message) {
 	case CONTROL_RESPONSE_CONTAINER_START_OK:
 		out.response = DAEMON_TO_CONTROLLER__RESPONSE__CONTAINER_START_OK;
@@ -517,6 +841,12 @@ control_send_message(control_message_t message, int fd)
 	return protobuf_send_message(fd, (ProtobufCMessage *)&out);
 }
 
+int
+control_send_message(control_message_t message, int fd)
+{
+	return control_send_response(message, NULL, fd);
+}
+
 /**
  * Handles list_guestos_configs cmd.
  * Used in both priv and unpriv control handlers.
@@ -547,6 +877,459 @@ control_handle_cmd_list_guestos_configs(UNUSED const ControllerToDaemon *msg, in
 	mem_free0(results);
 }
 
+/**
+ * Returns a printable name for an event handler, i.e., its symbol if
+ * exported or otherwise the object file and offset for addr2line.
+ */
+static char *
+control_event_handler_name(const void *func)
+{
+	Dl_info info;
+
+	if (!dladdr(func, &info) || !info.dli_fname)
+		return mem_printf("%p", func);
+	if (info.dli_sname)
+		return mem_strdup(info.dli_sname);
+
+	return mem_printf("%s+0x%" PRIxPTR, info.dli_fname,
+			  (uintptr_t)func - (uintptr_t)info.dli_fbase);
+}
+
+/**
+ * Handles get_event_stats cmd.
+ */
+static void
+control_handle_cmd_get_event_stats(const ControllerToDaemon *msg, int fd)
+{
+	size_t n = 0;
+	event_stats_t *stats = event_stats_get(&n);
+	EventHandlerStats **results = mem_new0(EventHandlerStats *, n);
+
+	for (size_t i = 0; i < n; i++) {
+		results[i] = mem_new(EventHandlerStats, 1);
+		event_handler_stats__init(results[i]);
+		results[i]->handler = control_event_handler_name(stats[i].func);
+		results[i]->type = mem_strdup(stats[i].type);
+		results[i]->count = stats[i].count;
+		results[i]->time_total_ns = stats[i].time_total;
+		results[i]->time_max_ns = stats[i].time_max;
+		if (!strcmp(stats[i].type, "timer")) {
+			results[i]->has_lag_total_ns = true;
+			results[i]->lag_total_ns = stats[i].lag_total;
+			results[i]->has_lag_max_ns = true;
+			results[i]->lag_max_ns = stats[i].lag_max;
+		}
+	}
+
+	if (msg->has_event_stats_enable) {
+		INFO("%s event loop accounting",
+		     msg->event_stats_enable ? "Enabling" : "Disabling");
+		event_stats_enable(msg->event_stats_enable);
+	}
+
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__EVENT_STATS;
+	out.n_event_stats = n;
+	out.event_stats = results;
+	out.has_event_stats_enabled = true;
+	out.event_stats_enabled = event_stats_is_enabled();
+	if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0) {
+		WARN("Could not send event stats");
+	}
+
+	for (size_t i = 0; i < n; i++)
+		protobuf_free_message((ProtobufCMessage *)results[i]);
+	mem_free0(results);
+	mem_free0(stats);
+}
+
+/**
+ * Handles get_mem_stats cmd.
+ */
+static void
+control_handle_cmd_get_mem_stats(int fd)
+{
+	size_t n = 0;
+	uint64_t live = 0, peak = 0;
+	mem_stats_site_t *sites = mem_stats_get(&n, &live, &peak);
+
+	MemStats stats = MEM_STATS__INIT;
+	stats.enabled = mem_stats_is_enabled();
+	if (stats.enabled) {
+		stats.has_live_bytes = true;
+		stats.live_bytes = live;
+		stats.has_peak_bytes = true;
+		stats.peak_bytes = peak;
+	}
+
+	MemAllocSite *results = mem_new0(MemAllocSite, n);
+	MemAllocSite **result_ptrs = mem_new0(MemAllocSite *, n);
+	for (size_t i = 0; i < n; i++) {
+		mem_alloc_site__init(&results[i]);
+		results[i].file = (char *)sites[i].file;
+		results[i].line = sites[i].line;
+		results[i].live_bytes = sites[i].live_bytes;
+		results[i].live_count = sites[i].live_count;
+		results[i].peak_bytes = sites[i].peak_bytes;
+		results[i].alloc_count = sites[i].alloc_count;
+		results[i].free_count = sites[i].free_count;
+		result_ptrs[i] = &results[i];
+	}
+	stats.n_sites = n;
+	stats.sites = result_ptrs;
+
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__MEM_STATS;
+	out.mem_stats = &stats;
+	if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0) {
+		WARN("Could not send mem stats");
+	}
+
+	mem_free0(result_ptrs);
+	mem_free0(results);
+	mem_free0(sites);
+}
+
+/**
+ * Handles get_device_stats cmd.
+ */
+static void
+control_handle_cmd_get_device_stats(int fd)
+{
+	const devstats_t *stats = devstats_get();
+
+	DeviceStats device_stats = DEVICE_STATS__INIT;
+	device_stats.disk_system = stats->disk_system;
+	device_stats.disk_system_free = stats->disk_system_free;
+	device_stats.disk_system_used = stats->disk_system_used;
+
+	if (stats->has_disk_containers) {
+		device_stats.has_disk_containers = true;
+		device_stats.has_disk_containers_free = true;
+		device_stats.has_disk_containers_used = true;
+		device_stats.disk_containers = stats->disk_containers;
+		device_stats.disk_containers_free = stats->disk_containers_free;
+		device_stats.disk_containers_used = stats->disk_containers_used;
+	}
+
+	if (stats->has_mem) {
+		device_stats.has_mem_total = true;
+		device_stats.has_mem_free = true;
+		device_stats.has_mem_available = true;
+		device_stats.mem_total = stats->mem_total;
+		device_stats.mem_free = stats->mem_free;
+		device_stats.mem_available = stats->mem_available;
+	}
+
+	ContainerDiskUsage *usages = mem_new0(ContainerDiskUsage, stats->containers_n);
+	ContainerDiskUsage **usage_ptrs = mem_new0(ContainerDiskUsage *, stats->containers_n);
+	for (size_t i = 0; i < stats->containers_n; i++) {
+		// skip containers whose mount table could not be summed up
+		if (stats->containers[i].disk_usage < 0)
+			continue;
+
+		ContainerDiskUsage *usage = &usages[device_stats.n_container_disk_usage];
+		container_disk_usage__init(usage);
+		usage->uuid = (char *)stats->containers[i].uuid;
+		usage->disk_usage = stats->containers[i].disk_usage;
+		usage_ptrs[device_stats.n_container_disk_usage++] = usage;
+	}
+	device_stats.container_disk_usage = usage_ptrs;
+
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__DEVICE_STATS;
+	out.device_stats = &device_stats;
+	if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0)
+		WARN("Could not send device stats");
+
+	mem_free0(usage_ptrs);
+	mem_free0(usages);
+}
+
+static bool
+control_uuid_matches(const char *uuid, char *const *uuids, size_t n_uuids)
+{
+	IF_TRUE_RETVAL(n_uuids == 0, true);
+
+	for (size_t i = 0; i < n_uuids; i++) {
+		if (!strcmp(uuid, uuids[i]))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Sends the samples of the containers in uuids, or of all containers if empty, as a
+ * single CONTAINER_TELEMETRY message.
+ */
+static int
+control_send_telemetry(int fd, const telemetry_sample_t *samples, size_t n, char *const *uuids,
+		       size_t n_uuids)
+{
+	size_t n_results = 0;
+	ContainerTelemetry *results = mem_new0(ContainerTelemetry, n);
+	ContainerTelemetry **result_ptrs = mem_new0(ContainerTelemetry *, n);
+
+	for (size_t i = 0; i < n; i++) {
+		const container_usage_t *usage = &samples[i].usage;
+		if (!control_uuid_matches(samples[i].uuid, uuids, n_uuids))
+			continue;
+
+		ContainerTelemetry *t = &results[n_results];
+		container_telemetry__init(t);
+		t->uuid = (char *)samples[i].uuid;
+		t->timestamp_ms = samples[i].timestamp_ms;
+		t->cpu_usage_us = usage->cpu_usage_us;
+		t->cpu_user_us = usage->cpu_user_us;
+		t->cpu_system_us = usage->cpu_system_us;
+		t->cpu_throttled_us = usage->cpu_throttled_us;
+		t->memory_current = usage->memory_current;
+		t->memory_anon = usage->memory_anon;
+		t->memory_file = usage->memory_file;
+		t->io_read_bytes = usage->io_read_bytes;
+		t->io_write_bytes = usage->io_write_bytes;
+		t->io_read_ios = usage->io_read_ios;
+		t->io_write_ios = usage->io_write_ios;
+		t->net_rx_bytes = usage->net_rx_bytes;
+		t->net_tx_bytes = usage->net_tx_bytes;
+		t->net_rx_packets = usage->net_rx_packets;
+		t->net_tx_packets = usage->net_tx_packets;
+		result_ptrs[n_results++] = t;
+	}
+
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__CONTAINER_TELEMETRY;
+	out.n_container_telemetry = n_results;
+	out.container_telemetry = result_ptrs;
+	int ret = protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0 ? -1 : 0;
+
+	mem_free0(result_ptrs);
+	mem_free0(results);
+	return ret;
+}
+
+static void
+control_telemetry_stream_cb(const telemetry_sample_t *samples, size_t n, void *data)
+{
+	control_telemetry_stream_t *stream = data;
+	ASSERT(stream);
+
+	// the stream is removed, when the connection is closed
+	if (control_send_telemetry(stream->fd, samples, n, stream->uuids, stream->n_uuids) < 0)
+		WARN("Could not stream telemetry to fd=%d", stream->fd);
+}
+
+static void
+control_telemetry_stream_free(control_telemetry_stream_t *stream)
+{
+	telemetry_unsubscribe(stream->subscriber);
+	for (size_t i = 0; i < stream->n_uuids; i++)
+		mem_free0(stream->uuids[i]);
+	mem_free0(stream->uuids);
+	mem_free0(stream);
+}
+
+/**
+ * Removes the telemetry streams of a client connection.
+ */
+static void
+control_telemetry_streams_remove(control_t *control, int fd)
+{
+	for (list_t *l = control->telemetry_streams; l;) {
+		control_telemetry_stream_t *stream = l->data;
+		l = l->next;
+		if (stream->fd != fd)
+			continue;
+		control->telemetry_streams = list_remove(control->telemetry_streams, stream);
+		control_telemetry_stream_free(stream);
+	}
+}
+
+/**
+ * Handles get_container_telemetry cmd.
+ */
+static void
+control_handle_cmd_get_container_telemetry(control_t *control, const ControllerToDaemon *msg,
+					   int fd)
+{
+	size_t n = 0;
+	telemetry_sample_t *samples = telemetry_get_samples_new(&n);
+
+	if (control_send_telemetry(fd, samples, n, msg->container_uuids, msg->n_container_uuids))
+		WARN("Could not send container telemetry");
+	if (samples)
+		mem_free0(samples);
+
+	IF_FALSE_RETURN(msg->has_telemetry_follow && msg->telemetry_follow);
+
+	control_telemetry_stream_t *stream = mem_new0(control_telemetry_stream_t, 1);
+	stream->fd = fd;
+	stream->n_uuids = msg->n_container_uuids;
+	stream->uuids = mem_new0(char *, stream->n_uuids);
+	for (size_t i = 0; i < stream->n_uuids; i++)
+		stream->uuids[i] = mem_strdup(msg->container_uuids[i]);
+	stream->subscriber = telemetry_subscribe(&control_telemetry_stream_cb, stream);
+	control->telemetry_streams = list_append(control->telemetry_streams, stream);
+
+	DEBUG("Streaming container telemetry to fd=%d", fd);
+}
+
+static void
+control_event_stream_cb(const container_t *container, bool removed, void *data)
+{
+	control_event_stream_t *stream = data;
+	ASSERT(stream);
+
+	char *uuid = (char *)uuid_string(container_get_uuid(container));
+	IF_FALSE_RETURN(control_uuid_matches(uuid, stream->uuids, stream->n_uuids));
+
+	// removed containers are only referred to by their uuid
+	ContainerStatus *c_status = NULL;
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__CONTAINER_EVENT;
+	if (removed) {
+		out.n_container_uuids = 1;
+		out.container_uuids = &uuid;
+	} else {
+		c_status = control_container_status_new(container);
+		out.n_container_status = 1;
+		out.container_status = &c_status;
+	}
+
+	// the stream is removed, when the connection is closed
+	if (protobuf_send_message(stream->fd, (ProtobufCMessage *)&out) < 0)
+		WARN("Could not stream container event to fd=%d", stream->fd);
+
+	control_container_status_free(c_status);
+}
+
+static void
+control_event_stream_free(control_event_stream_t *stream)
+{
+	cmld_container_events_unsubscribe(stream->subscriber);
+	for (size_t i = 0; i < stream->n_uuids; i++)
+		mem_free0(stream->uuids[i]);
+	mem_free0(stream->uuids);
+	mem_free0(stream);
+}
+
+/**
+ * Removes the event streams of a client connection.
+ */
+static void
+control_event_streams_remove(control_t *control, int fd)
+{
+	for (list_t *l = control->event_streams; l;) {
+		control_event_stream_t *stream = l->data;
+		l = l->next;
+		if (stream->fd != fd)
+			continue;
+		control->event_streams = list_remove(control->event_streams, stream);
+		control_event_stream_free(stream);
+	}
+}
+
+/**
+ * Handles subscribe_events cmd.
+ */
+static void
+control_handle_cmd_subscribe_events(control_t *control, const ControllerToDaemon *msg, int fd)
+{
+	list_t *containers = control_build_container_list_from_uuids(msg->n_container_uuids,
+								     msg->container_uuids);
+	size_t n = list_length(containers);
+	ContainerStatus **results = mem_new(ContainerStatus *, n);
+
+	size_t i = 0;
+	for (list_t *l = containers; l; l = l->next)
+		results[i++] = control_container_status_new(l->data);
+
+	// the current status is the base which the following events are applied to
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__CONTAINER_EVENT;
+	out.n_container_status = n;
+	out.container_status = results;
+	if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0)
+		WARN("Could not send container status");
+
+	list_delete(containers);
+	for (i = 0; i < n; i++)
+		control_container_status_free(results[i]);
+	mem_free0(results);
+
+	control_event_stream_t *stream = mem_new0(control_event_stream_t, 1);
+	stream->fd = fd;
+	stream->n_uuids = msg->n_container_uuids;
+	stream->uuids = mem_new0(char *, stream->n_uuids);
+	for (i = 0; i < stream->n_uuids; i++)
+		stream->uuids[i] = mem_strdup(msg->container_uuids[i]);
+	stream->subscriber = cmld_container_events_subscribe(&control_event_stream_cb, stream);
+	control->event_streams = list_append(control->event_streams, stream);
+
+	DEBUG("Streaming container events to fd=%d", fd);
+}
+
+/**
+ * Handles get_syscall_stats cmd.
+ */
+static void
+control_handle_cmd_get_syscall_stats(const ControllerToDaemon *msg, int fd)
+{
+	list_t *containers = control_build_container_list_from_uuids(msg->n_container_uuids,
+								     msg->container_uuids);
+	size_t n_containers = list_length(containers);
+	ContainerSyscallStats *results = mem_new0(ContainerSyscallStats, n_containers);
+	ContainerSyscallStats **result_ptrs = mem_new0(ContainerSyscallStats *, n_containers);
+	container_syscall_stats_t **stats = mem_new0(container_syscall_stats_t *, n_containers);
+
+	size_t i = 0;
+	for (list_t *l = containers; l; l = l->next, i++) {
+		container_t *container = l->data;
+		size_t n = 0;
+
+		container_syscall_stats__init(&results[i]);
+		results[i].uuid = (char *)uuid_string(container_get_uuid(container));
+		result_ptrs[i] = &results[i];
+
+		stats[i] = container_get_syscall_stats_new(container, &n);
+		if (!stats[i])
+			continue;
+
+		results[i].n_syscalls = n;
+		results[i].syscalls = mem_new0(SyscallStats *, n);
+		for (size_t j = 0; j < n; j++) {
+			SyscallStats *s = mem_new0(SyscallStats, 1);
+			syscall_stats__init(s);
+			s->syscall = (char *)stats[i][j].syscall;
+			s->count = stats[i][j].count;
+			s->failed = stats[i][j].failed;
+			s->time_total_ns = stats[i][j].time_total_ns;
+			s->time_max_ns = stats[i][j].time_max_ns;
+			s->n_latency_hist = CONTAINER_SYSCALL_LATENCY_BUCKETS;
+			s->latency_hist = stats[i][j].latency_hist;
+			results[i].syscalls[j] = s;
+		}
+	}
+
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	out.code = DAEMON_TO_CONTROLLER__CODE__SYSCALL_STATS;
+	out.n_container_syscall_stats = n_containers;
+	out.container_syscall_stats = result_ptrs;
+	if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0)
+		WARN("Could not send syscall stats");
+
+	for (i = 0; i < n_containers; i++) {
+		for (size_t j = 0; j < results[i].n_syscalls; j++)
+			mem_free0(results[i].syscalls[j]);
+		mem_free0(results[i].syscalls);
+		mem_free0(stats[i]);
+	}
+	mem_free0(stats);
+	mem_free0(result_ptrs);
+	mem_free0(results);
+	list_delete(containers);
+}
+
 /**
  * Handles push_guestos_configs cmd
  * Used in both priv and unpriv control handlers.
@@ -590,6 +1373,7 @@ control_handle_cmd_register_localca(const ControllerToDaemon *msg, UNUSED int fd
 typedef struct {
 	cmld_container_ctrl_t container_ctrl;
 	int resp_fd;
+	char *uuid; // tags the responses of bulk commands, NULL otherwise
 } control_csmartcard_resp_data_t;
 
 static void
@@ -600,60 +1384,68 @@ control_csmartcard_handle_error_cb(int err_code, void *data)
 
 	cmld_container_ctrl_t container_ctrl = cbdata->container_ctrl;
 	int fd = cbdata->resp_fd;
+	const char *uuid = cbdata->uuid;
 
 	switch (err_code) {
 	case CONTAINER_SMARTCARD_LOCK_FAILED:
 		if (container_ctrl == CMLD_CONTAINER_CTRL_START)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_START_LOCK_FAILED, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_LOCK_FAILED, uuid,
+					      fd);
 		else if (container_ctrl == CMLD_CONTAINER_CTRL_STOP)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_STOP_LOCK_FAILED, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_STOP_LOCK_FAILED, uuid,
+					      fd);
 		break;
 	case CONTAINER_SMARTCARD_UNLOCK_FAILED:
 		if (container_ctrl == CMLD_CONTAINER_CTRL_START)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_START_UNLOCK_FAILED, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_UNLOCK_FAILED, uuid,
+					      fd);
 		else if (container_ctrl == CMLD_CONTAINER_CTRL_STOP)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_STOP_UNLOCK_FAILED, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_STOP_UNLOCK_FAILED, uuid,
+					      fd);
 		break;
 	case CONTAINER_SMARTCARD_PASSWD_WRONG:
 		if (container_ctrl == CMLD_CONTAINER_CTRL_START)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_START_PASSWD_WRONG, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_PASSWD_WRONG, uuid,
+					      fd);
 		else if (container_ctrl == CMLD_CONTAINER_CTRL_STOP)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_STOP_PASSWD_WRONG, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_STOP_PASSWD_WRONG, uuid,
+					      fd);
 		break;
 	case CONTAINER_SMARTCARD_TOKEN_UNINITIALIZED:
-		control_send_message(CONTROL_RESPONSE_CONTAINER_TOKEN_UNINITIALIZED, fd);
+		control_send_response(CONTROL_RESPONSE_CONTAINER_TOKEN_UNINITIALIZED, uuid, fd);
 		break;
 	case CONTAINER_SMARTCARD_TOKEN_UNPAIRED:
-		control_send_message(CONTROL_RESPONSE_CONTAINER_TOKEN_UNPAIRED, fd);
+		control_send_response(CONTROL_RESPONSE_CONTAINER_TOKEN_UNPAIRED, uuid, fd);
 		break;
 	case CONTAINER_SMARTCARD_PAIRING_SECRET_FAILED:
 	case CONTAINER_SMARTCARD_WRAPPING_ERROR:
-		control_send_message(CONTROL_RESPONSE_CONTAINER_START_EINTERNAL, fd);
+		control_send_response(CONTROL_RESPONSE_CONTAINER_START_EINTERNAL, uuid, fd);
 		break;
 	case CONTAINER_SMARTCARD_CHANGE_PIN_FAILED:
-		control_send_message(CONTROL_RESPONSE_CONTAINER_CHANGE_PIN_FAILED, fd);
+		control_send_response(CONTROL_RESPONSE_CONTAINER_CHANGE_PIN_FAILED, uuid, fd);
 		break;
 	case CONTAINER_SMARTCARD_CHANGE_PIN_SUCCESSFUL:
-		control_send_message(CONTROL_RESPONSE_CONTAINER_CHANGE_PIN_SUCCESSFUL, fd);
+		control_send_response(CONTROL_RESPONSE_CONTAINER_CHANGE_PIN_SUCCESSFUL, uuid, fd);
 		break;
 	case CONTAINER_SMARTCARD_LOCKED_TILL_REBOOT:
-		control_send_message(CONTROL_RESPONSE_CONTAINER_LOCKED_TILL_REBOOT, fd);
+		control_send_response(CONTROL_RESPONSE_CONTAINER_LOCKED_TILL_REBOOT, uuid, fd);
 		break;
 	case CONTAINER_SMARTCARD_CB_OK:
 		if (container_ctrl == CMLD_CONTAINER_CTRL_START)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_START_OK, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_OK, uuid, fd);
 		else if (container_ctrl == CMLD_CONTAINER_CTRL_STOP)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_STOP_OK, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_STOP_OK, uuid, fd);
 		break;
 	case CONTAINER_SMARTCARD_CB_FAILED:
 		if (container_ctrl == CMLD_CONTAINER_CTRL_START)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_START_EINTERNAL, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_EINTERNAL, uuid, fd);
 		else if (container_ctrl == CMLD_CONTAINER_CTRL_STOP)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_STOP_FAILED_NOT_RUNNING,
-					     fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_STOP_FAILED_NOT_RUNNING,
+					      uuid, fd);
 		break;
 	}
 
+	mem_free0(cbdata->uuid);
 	mem_free0(cbdata);
 }
 
@@ -680,7 +1472,8 @@ control_input_handle_error_cb(int err_code, void *data)
  * Starts a container with pre-specified keys or user supplied keys
  */
 static int
-control_handle_container_start(container_t *container, ContainerStartParams *start_params, int fd)
+control_handle_container_start(container_t *container, ContainerStartParams *start_params,
+			       const char *uuid, int fd)
 {
 	TRACE("Starting container");
 	int res = -1;
@@ -696,10 +1489,13 @@ control_handle_container_start(container_t *container, ContainerStartParams *sta
 			mem_new0(control_csmartcard_resp_data_t, 1);
 		cbdata->container_ctrl = CMLD_CONTAINER_CTRL_START;
 		cbdata->resp_fd = fd;
+		cbdata->uuid = uuid ? mem_strdup(uuid) : NULL;
 
 		if (container_set_smartcard_error_cb(container, control_csmartcard_handle_error_cb,
-						     cbdata))
+						     cbdata)) {
+			mem_free0(cbdata->uuid);
 			mem_free(cbdata);
+		}
 	}
 
 	// Check if pin should be interactively requested via pin pad reader
@@ -710,7 +1506,8 @@ control_handle_container_start(container_t *container, ContainerStartParams *sta
 		res = cmld_container_ctrl_with_input(container, CMLD_CONTAINER_CTRL_START,
 						     control_input_handle_error_cb, resp_fd);
 		if (res != 0) {
-			control_send_message(CONTROL_RESPONSE_CONTAINER_USB_PIN_ENTRY_FAIL, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_USB_PIN_ENTRY_FAIL, uuid,
+					      fd);
 		}
 	} else if (start_params) {
 		char *key = start_params->key;
@@ -720,25 +1517,26 @@ control_handle_container_start(container_t *container, ContainerStartParams *sta
 			ERROR("Failed to start container %s", container_get_name(container));
 		}
 		if (res == -2)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_CTRL_EINTERNAL, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_CTRL_EINTERNAL, uuid, fd);
 
 		mem_memset0(key, strlen(key));
 	} else if (container_is_encrypted(container)) {
 		res = -1;
-		control_send_message(CONTROL_RESPONSE_CONTAINER_START_PASSWD_WRONG, fd);
+		control_send_response(CONTROL_RESPONSE_CONTAINER_START_PASSWD_WRONG, uuid, fd);
 	} else {
 		res = cmld_container_start(container);
 		if (res < 0) {
-			control_send_message(CONTROL_RESPONSE_CONTAINER_START_EEXIST, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_EEXIST, uuid, fd);
 		} else {
-			control_send_message(CONTROL_RESPONSE_CONTAINER_START_OK, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_OK, uuid, fd);
 		}
 	}
 	return res;
 }
 
 static int
-control_handle_container_stop(container_t *container, ContainerStartParams *start_params, int fd)
+control_handle_container_stop(container_t *container, ContainerStartParams *start_params,
+			      const char *uuid, int fd)
 {
 	int res = -1;
 
@@ -748,10 +1546,13 @@ control_handle_container_stop(container_t *container, ContainerStartParams *star
 			mem_new0(control_csmartcard_resp_data_t, 1);
 		cbdata->container_ctrl = CMLD_CONTAINER_CTRL_STOP;
 		cbdata->resp_fd = fd;
+		cbdata->uuid = uuid ? mem_strdup(uuid) : NULL;
 
 		if (container_set_smartcard_error_cb(container, control_csmartcard_handle_error_cb,
-						     cbdata))
+						     cbdata)) {
+			mem_free0(cbdata->uuid);
 			mem_free(cbdata);
+		}
 	}
 
 	// Check if pin should be interactively requested via pin pad reader
@@ -762,7 +1563,8 @@ control_handle_container_stop(container_t *container, ContainerStartParams *star
 		res = cmld_container_ctrl_with_input(container, CMLD_CONTAINER_CTRL_STOP,
 						     control_input_handle_error_cb, resp_fd);
 		if (res != 0) {
-			control_send_message(CONTROL_RESPONSE_CONTAINER_USB_PIN_ENTRY_FAIL, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_USB_PIN_ENTRY_FAIL, uuid,
+					      fd);
 		}
 	} else if (start_params) {
 		char *key = start_params->key;
@@ -772,24 +1574,204 @@ control_handle_container_stop(container_t *container, ContainerStartParams *star
 			ERROR("Failed to stop container %s", container_get_name(container));
 		}
 		if (res == -2)
-			control_send_message(CONTROL_RESPONSE_CONTAINER_CTRL_EINTERNAL, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_CTRL_EINTERNAL, uuid, fd);
 
 		mem_memset0(key, strlen(key));
 	} else if (container_is_encrypted(container)) {
 		res = -1;
-		control_send_message(CONTROL_RESPONSE_CONTAINER_STOP_PASSWD_WRONG, fd);
+		control_send_response(CONTROL_RESPONSE_CONTAINER_STOP_PASSWD_WRONG, uuid, fd);
 	} else {
 		res = cmld_container_stop(container);
 		if (res == -1) {
-			control_send_message(CONTROL_RESPONSE_CONTAINER_STOP_FAILED_NOT_RUNNING,
-					     fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_STOP_FAILED_NOT_RUNNING,
+					      uuid, fd);
 		} else {
-			control_send_message(CONTROL_RESPONSE_CONTAINER_STOP_OK, fd);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_STOP_OK, uuid, fd);
 		}
 	}
 	return res;
 }
 
+/**
+ * Returns true if the container is running or in the process of starting up.
+ */
+static bool
+control_container_is_started(container_t *container)
+{
+	compartment_state_t state = container_get_state(container);
+
+	return state == COMPARTMENT_STATE_RUNNING || state == COMPARTMENT_STATE_BOOTING ||
+	       state == COMPARTMENT_STATE_SETUP || state == COMPARTMENT_STATE_REBOOTING ||
+	       // a container with a prepared start is waiting in state starting
+	       (state == COMPARTMENT_STATE_STARTING && !container_is_startable(container));
+}
+
+static void
+control_bulk_start_free(control_bulk_start_t *start)
+{
+	if (start->start_params) {
+		if (start->start_params->key) {
+			mem_memset0(start->start_params->key, strlen(start->start_params->key));
+			mem_free0(start->start_params->key);
+		}
+		mem_free0(start->start_params);
+	}
+	mem_free0(start->uuid);
+	mem_free0(start);
+}
+
+/**
+ * Starts a container of a bulk start once it is its turn in the boot scheduler.
+ */
+static int
+control_bulk_start_cb(container_t *container, void *data)
+{
+	control_bulk_start_t *start = data;
+	ASSERT(start);
+
+	int res = -1;
+
+	if (start->control)
+		start->control->bulk_starts = list_remove(start->control->bulk_starts, start);
+
+	// the start is carried out even if the client is gone, only its response is dropped
+	if (!container) {
+		WARN("Container %s was removed before its start", start->uuid);
+		if (start->fd >= 0)
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_EEXIST, start->uuid,
+					      start->fd);
+	} else if (control_container_is_started(container)) {
+		WARN("Container %s is already running or in the process of starting up!",
+		     container_get_description(container));
+		if (start->fd >= 0)
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_EEXIST, start->uuid,
+					      start->fd);
+	} else {
+		res = control_handle_container_start(container, start->start_params, start->uuid,
+						     start->fd);
+	}
+
+	control_bulk_start_free(start);
+	return res;
+}
+
+/**
+ * Detaches the queued bulk starts from the client connection fd, or from all connections
+ * of the control if fd is -1.
+ */
+static void
+control_bulk_starts_detach(control_t *control, int fd)
+{
+	for (list_t *l = control->bulk_starts; l;) {
+		control_bulk_start_t *start = l->data;
+		l = l->next;
+		if (fd >= 0 && start->fd != fd)
+			continue;
+		start->control = NULL;
+		start->fd = -1;
+		control->bulk_starts = list_remove(control->bulk_starts, start);
+	}
+}
+
+/**
+ * Handles containers_start cmd. The containers are queued in the boot scheduler,
+ * which sends the response for each container once its start was carried out.
+ */
+static void
+control_handle_cmd_containers_start(control_t *control, const ControllerToDaemon *msg, int fd)
+{
+	for (size_t i = 0; i < msg->n_container_uuids; i++) {
+		const char *uuid = msg->container_uuids[i];
+		container_t *container = control_get_container_by_uuid_string(uuid);
+
+		if (!container) {
+			WARN("Container %s does not exist!", uuid);
+			control_send_response(CONTROL_RESPONSE_CONTAINER_START_EEXIST, uuid, fd);
+			continue;
+		}
+		if (container == cmld_containers_get_c0()) {
+			control_send_response(CONTROL_RESPONSE_CMD_UNSUPPORTED, uuid, fd);
+			continue;
+		}
+		if (container_get_usb_pin_entry(container)) {
+			// the pins of several containers cannot be entered at once
+			control_send_response(CONTROL_RESPONSE_CONTAINER_USB_PIN_ENTRY_FAIL, uuid,
+					      fd);
+			continue;
+		}
+
+		control_bulk_start_t *start = mem_new0(control_bulk_start_t, 1);
+		start->control = control;
+		start->fd = fd;
+		start->uuid = mem_strdup(uuid);
+		if (i < msg->n_containers_start_params) {
+			ContainerStartParams *params = msg->containers_start_params[i];
+			start->start_params = mem_new0(ContainerStartParams, 1);
+			container_start_params__init(start->start_params);
+			start->start_params->key = params->key ? mem_strdup(params->key) : NULL;
+			start->start_params->has_no_switch = params->has_no_switch;
+			start->start_params->no_switch = params->no_switch;
+			start->start_params->has_setup = params->has_setup;
+			start->start_params->setup = params->setup;
+		}
+
+		// the start may be carried out right away, which removes it from the list again
+		control->bulk_starts = list_append(control->bulk_starts, start);
+		bootsched_schedule(container, cmld_get_boot_parallelism(), &control_bulk_start_cb,
+				   start);
+	}
+}
+
+/**
+ * Handles containers_stop, containers_freeze and containers_unfreeze cmds.
+ */
+static void
+control_handle_cmd_containers_ctrl(const ControllerToDaemon *msg, int fd)
+{
+	for (size_t i = 0; i < msg->n_container_uuids; i++) {
+		const char *uuid = msg->container_uuids[i];
+		container_t *container = control_get_container_by_uuid_string(uuid);
+		int res = -1;
+
+		if (!container) {
+			WARN("Container %s does not exist!", uuid);
+			control_send_response(CONTROL_RESPONSE_CMD_FAILED, uuid, fd);
+			continue;
+		}
+
+		switch (msg->command) {
+		case CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_STOP:
+			if (container == cmld_containers_get_c0()) {
+				control_send_response(CONTROL_RESPONSE_CMD_UNSUPPORTED, uuid, fd);
+			} else if (container_get_usb_pin_entry(container)) {
+				control_send_response(CONTROL_RESPONSE_CONTAINER_USB_PIN_ENTRY_FAIL,
+						      uuid, fd);
+			} else {
+				ContainerStartParams *params =
+					i < msg->n_containers_start_params ?
+						msg->containers_start_params[i] :
+						NULL;
+				control_handle_container_stop(container, params, uuid, fd);
+			}
+			break;
+		case CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_FREEZE:
+			res = cmld_container_freeze(container);
+			control_send_response(res ? CONTROL_RESPONSE_CMD_FAILED :
+						    CONTROL_RESPONSE_CMD_OK,
+					      uuid, fd);
+			break;
+		case CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_UNFREEZE:
+			res = cmld_container_unfreeze(container);
+			control_send_response(res ? CONTROL_RESPONSE_CMD_FAILED :
+						    CONTROL_RESPONSE_CMD_OK,
+					      uuid, fd);
+			break;
+		default:
+			ASSERT(false);
+		}
+	}
+}
+
 static bool
 control_check_command(control_t *control, const ControllerToDaemon *msg)
 {
@@ -806,6 +1788,7 @@ control_check_command(control_t *control, const ControllerToDaemon *msg)
 	       * yet implemented!
 	       */
 	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_LAST_LOG) ||
+	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_LOG_FILES) ||
 #endif
 	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_DEVICE_STATS) ||
 	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__PUSH_GUESTOS_CONFIG) ||
@@ -819,6 +1802,8 @@ control_check_command(control_t *control, const ControllerToDaemon *msg)
 	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__PUSH_DEVICE_CERT) ||
 	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_START) ||
 	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_STOP) ||
+	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_START) ||
+	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_STOP) ||
 	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_LIST_IFACES) ||
 	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_UPDATE_CONFIG) ||
 	      (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_CHANGE_TOKEN_PIN) ||
@@ -854,18 +1839,26 @@ control_check_command(control_t *control, const ControllerToDaemon *msg)
 	     * yet implemented!
 	     */
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_LAST_LOG) ||
+	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_LOG_FILES) ||
 #endif
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_DEVICE_STATS) ||
+	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_EVENT_STATS) ||
+	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_MEM_STATS) ||
+	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_TELEMETRY) ||
+	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_SYSCALL_STATS) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_CHANGE_TOKEN_PIN) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CREATE_CONTAINER) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__REBOOT_DEVICE) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_PROVISIONED) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_START) ||
+	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_START) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_UPDATE_CONFIG) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_STATUS) ||
+	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__SUBSCRIBE_EVENTS) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_CONFIG) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_CMLD_HANDLES_PIN) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_STOP) ||
+	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_STOP) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_LIST_IFACES) ||
 	    (msg->command == CONTROLLER_TO_DAEMON__COMMAND__PUSH_GUESTOS_CONFIG)) {
 		TRACE("Received command %d is valid in provisioned mode", msg->command);
@@ -1001,8 +1994,8 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 
 		size_t number_of_configs = 0;
 		// fill result with data from container
-		for (size_t i = 0; i < n; i++) {
-			container_t *container = list_nth_data(containers, i);
+		for (list_t *l = containers; l; l = l->next) {
+			container_t *container = l->data;
 			if (!container) {
 				FATAL("Got NULL container pointer!");
 			}
@@ -1012,62 +2005,56 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 			if (!config_filename) {
 				WARN("Container %s has no config file set. Skipping.",
 				     container_get_name(container));
-			} else {
-				TRACE("Container %s has config file; appending to list...",
-				      container_get_name(container));
-				results[number_of_configs] =
-					(ContainerConfig *)protobuf_message_new_from_textfile(
-						config_filename, &container_config__descriptor);
-				if (results[number_of_configs] == NULL) {
-					WARN("The config file of container %s is missing. Skipping.",
-					     container_get_name(container));
-					continue;
-				}
-				// overwrite vnet config with runtime configuration
-				size_t n_vnet_configs = results[number_of_configs]->n_vnet_configs;
-				for (size_t i = 0; i < n_vnet_configs; ++i) {
-					protobuf_free_message(
-						(ProtobufCMessage *)results[number_of_configs]
-							->vnet_configs[i]);
-					TRACE("freed config time results[%zu]->vnet_configs[%zu]",
-					      number_of_configs, i);
-				}
-				mem_free0(results[number_of_configs]->vnet_configs);
-				list_t *vnet_runtime_cfg_list =
-					container_get_vnet_runtime_cfg_new(container);
-				int vnet_config_len = list_length(vnet_runtime_cfg_list);
-				ContainerVnetConfig **vnet_configs =
-					mem_new0(ContainerVnetConfig *, vnet_config_len);
-				for (int i = 0; i < vnet_config_len; ++i) {
-					container_vnet_cfg_t *vnet_cfg =
-						list_nth_data(vnet_runtime_cfg_list, i);
-					vnet_configs[i] = mem_new0(ContainerVnetConfig, 1);
-					container_vnet_config__init(vnet_configs[i]);
-					vnet_configs[i]->if_name = mem_strdup(vnet_cfg->vnet_name);
-					if (vnet_cfg->rootns_name)
-						vnet_configs[i]->if_rootns_name =
-							mem_strdup(vnet_cfg->rootns_name);
-					vnet_configs[i]->if_mac = mem_printf(
-						"%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8
-						":%02" PRIx8 ":%02" PRIx8,
-						vnet_cfg->vnet_mac[0], vnet_cfg->vnet_mac[1],
-						vnet_cfg->vnet_mac[2], vnet_cfg->vnet_mac[3],
-						vnet_cfg->vnet_mac[4], vnet_cfg->vnet_mac[5]);
-					vnet_configs[i]->configure = vnet_cfg->configure;
-					TRACE("setup runtime vnet_configs[%d] vnetc: %s, vnetr: %s (%s)",
-					      i, vnet_configs[i]->if_name,
-					      vnet_configs[i]->if_rootns_name,
-					      vnet_configs[i]->configure ? "configured" : "manual");
-					mem_free0(vnet_cfg);
-				}
-				list_delete(vnet_runtime_cfg_list);
-				results[number_of_configs]->n_vnet_configs = vnet_config_len;
-				results[number_of_configs]->vnet_configs = vnet_configs;
-
-				const char *uuid = uuid_string(container_get_uuid(container));
-				result_uuids[number_of_configs] = mem_strdup(uuid);
-				number_of_configs++;
+				continue;
+			}
+			const ContainerConfig *cached =
+				container_config_get_cached(config_filename);
+			if (cached == NULL) {
+				WARN("The config file of container %s is missing. Skipping.",
+				     container_get_name(container));
+				continue;
 			}
+			/*
+			 * shallow copy of the cached config, only the vnet configs are
+			 * overwritten with the runtime configuration
+			 */
+			ContainerConfig *result = mem_new(ContainerConfig, 1);
+			*result = *cached;
+
+			list_t *vnet_runtime_cfg_list =
+				container_get_vnet_runtime_cfg_new(container);
+			int vnet_config_len = list_length(vnet_runtime_cfg_list);
+			ContainerVnetConfig **vnet_configs =
+				mem_new0(ContainerVnetConfig *, vnet_config_len);
+			int i = 0;
+			for (list_t *v = vnet_runtime_cfg_list; v; v = v->next, ++i) {
+				container_vnet_cfg_t *vnet_cfg = v->data;
+				vnet_configs[i] = mem_new0(ContainerVnetConfig, 1);
+				container_vnet_config__init(vnet_configs[i]);
+				vnet_configs[i]->if_name = mem_strdup(vnet_cfg->vnet_name);
+				if (vnet_cfg->rootns_name)
+					vnet_configs[i]->if_rootns_name =
+						mem_strdup(vnet_cfg->rootns_name);
+				vnet_configs[i]->if_mac = mem_printf(
+					"%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8
+					":%02" PRIx8 ":%02" PRIx8,
+					vnet_cfg->vnet_mac[0], vnet_cfg->vnet_mac[1],
+					vnet_cfg->vnet_mac[2], vnet_cfg->vnet_mac[3],
+					vnet_cfg->vnet_mac[4], vnet_cfg->vnet_mac[5]);
+				vnet_configs[i]->configure = vnet_cfg->configure;
+				TRACE("setup runtime vnet_configs[%d] vnetc: %s, vnetr: %s (%s)", i,
+				      vnet_configs[i]->if_name, vnet_configs[i]->if_rootns_name,
+				      vnet_configs[i]->configure ? "configured" : "manual");
+				mem_free0(vnet_cfg);
+			}
+			list_delete(vnet_runtime_cfg_list);
+			result->n_vnet_configs = vnet_config_len;
+			result->vnet_configs = vnet_configs;
+
+			results[number_of_configs] = result;
+			const char *uuid = uuid_string(container_get_uuid(container));
+			result_uuids[number_of_configs] = mem_strdup(uuid);
+			number_of_configs++;
 		}
 		// build and send response message to controller
 		DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
@@ -1087,12 +2074,15 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 			WARN("Could not send container configs to MDM");
 		}
 
-		// collect garbage
+		// collect garbage, the rest of the results is owned by the config cache
 		list_delete(containers);
 		for (size_t i = 0; i < number_of_configs; i++) {
 			mem_free0(result_uuids[i]);
-			if (results[i] != NULL)
-				protobuf_free_message((ProtobufCMessage *)results[i]);
+			ContainerConfig *result = results[i];
+			for (size_t j = 0; j < result->n_vnet_configs; j++)
+				protobuf_free_message((ProtobufCMessage *)result->vnet_configs[j]);
+			mem_free0(result->vnet_configs);
+			mem_free0(results[i]);
 		}
 		mem_free0(result_uuids);
 		mem_free0(results);
@@ -1120,6 +2110,10 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 		}
 	} break;
 
+	case CONTROLLER_TO_DAEMON__COMMAND__GET_LOG_FILES: {
+		control_handle_cmd_get_log_files(fd);
+	} break;
+
 	case CONTROLLER_TO_DAEMON__COMMAND__PUSH_GUESTOS_CONFIG: {
 		control_handle_cmd_push_guestos_configs(msg, fd);
 	} break;
@@ -1275,46 +2269,39 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 		mem_free0(ccfg);
 	} break;
 
-	case CONTROLLER_TO_DAEMON__COMMAND__GET_DEVICE_STATS: {
-		DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
-		out.code = DAEMON_TO_CONTROLLER__CODE__DEVICE_STATS;
+	case CONTROLLER_TO_DAEMON__COMMAND__GET_DEVICE_STATS:
+		control_handle_cmd_get_device_stats(fd);
+		break;
 
-		DeviceStats *device_stats = mem_new(DeviceStats, 1);
-		device_stats__init(device_stats);
+	case CONTROLLER_TO_DAEMON__COMMAND__GET_EVENT_STATS:
+		control_handle_cmd_get_event_stats(msg, fd);
+		break;
 
-		device_stats->disk_system = file_disk_space(cmld_get_cmld_dir());
-		device_stats->disk_system_free = file_disk_space_free(cmld_get_cmld_dir());
-		device_stats->disk_system_used = file_disk_space_used(cmld_get_cmld_dir());
+	case CONTROLLER_TO_DAEMON__COMMAND__GET_MEM_STATS:
+		control_handle_cmd_get_mem_stats(fd);
+		break;
 
-		if (!file_on_same_fs(cmld_get_cmld_dir(), cmld_get_containers_dir())) {
-			device_stats->has_disk_containers = true;
-			device_stats->has_disk_containers_free = true;
-			device_stats->has_disk_containers_used = true;
-			device_stats->disk_containers = file_disk_space(cmld_get_containers_dir());
-			device_stats->disk_containers_free =
-				file_disk_space_free(cmld_get_containers_dir());
-			device_stats->disk_containers_used =
-				file_disk_space_used(cmld_get_containers_dir());
-		}
+	case CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_TELEMETRY:
+		control_handle_cmd_get_container_telemetry(control, msg, fd);
+		break;
 
-		proc_meminfo_t *meminfo = proc_meminfo_new();
-		if (meminfo) {
-			device_stats->has_mem_total = true;
-			device_stats->has_mem_free = true;
-			device_stats->has_mem_available = true;
-			device_stats->mem_total = proc_get_mem_total(meminfo);
-			device_stats->mem_free = proc_get_mem_free(meminfo);
-			device_stats->mem_available = proc_get_mem_available(meminfo);
-		}
+	case CONTROLLER_TO_DAEMON__COMMAND__GET_SYSCALL_STATS:
+		control_handle_cmd_get_syscall_stats(msg, fd);
+		break;
 
-		out.device_stats = device_stats;
+	case CONTROLLER_TO_DAEMON__COMMAND__SUBSCRIBE_EVENTS:
+		control_handle_cmd_subscribe_events(control, msg, fd);
+		break;
 
-		if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0)
-			WARN("Could not send provisioned state");
+	case CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_START:
+		control_handle_cmd_containers_start(control, msg, fd);
+		break;
 
-		proc_meminfo_free(meminfo);
-		protobuf_free_message((ProtobufCMessage *)device_stats);
-	} break;
+	case CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_STOP:
+	case CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_FREEZE:
+	case CONTROLLER_TO_DAEMON__COMMAND__CONTAINERS_UNFREEZE:
+		control_handle_cmd_containers_ctrl(msg, fd);
+		break;
 
 	// Container-specific commands:
 	case CONTROLLER_TO_DAEMON__COMMAND__REMOVE_CONTAINER:
@@ -1421,12 +2408,7 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 			control_send_message(CONTROL_RESPONSE_CMD_UNSUPPORTED, fd);
 			break;
 		}
-		compartment_state_t compartment_state = container_get_state(container);
-		if ((compartment_state == COMPARTMENT_STATE_RUNNING) ||
-		    (compartment_state == COMPARTMENT_STATE_BOOTING) ||
-		    (compartment_state == COMPARTMENT_STATE_SETUP) ||
-		    (compartment_state == COMPARTMENT_STATE_REBOOTING) ||
-		    (compartment_state == COMPARTMENT_STATE_STARTING)) {
+		if (control_container_is_started(container)) {
 			WARN("Container is already running or in the process of starting up!");
 			audit_log_event(container_get_uuid(container), FSA, CMLD, CONTAINER_MGMT,
 					"container-start-already-running",
@@ -1435,7 +2417,7 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 			break;
 		}
 		ContainerStartParams *start_params = msg->container_start_params;
-		res = control_handle_container_start(container, start_params, fd);
+		res = control_handle_container_start(container, start_params, NULL, fd);
 		if (res) {
 			WARN("Starting container failed!");
 		}
@@ -1451,7 +2433,7 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 		}
 
 		ContainerStartParams *start_params = msg->container_start_params;
-		res = control_handle_container_stop(container, start_params, fd);
+		res = control_handle_container_stop(container, start_params, NULL, fd);
 		if (res) {
 			WARN("Stoping container failed!");
 		}
@@ -1569,6 +2551,7 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 			ERROR("Missing command or exec_pty info");
 			break;
 		}
+		idlefreeze_wake(container, "exec command");
 		if (container_run(container, msg->exec_pty, msg->exec_command, msg->n_exec_args,
 				  msg->exec_args, fd) < 0) {
 			ERROR("Failed to exec");
@@ -1583,6 +2566,8 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 			TRACE("Sent notification of command termination to control client");
 			break;
 
+		} else if (msg->exec_raw && !control_send_exec_channel(fd, container)) {
+			DEBUG("Passed console of exec'ed command to control client");
 		} else {
 			DEBUG("Registering read callback for cmld console socket");
 			int *cfd = mem_new(int, 1);
@@ -1598,6 +2583,7 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 	case CONTROLLER_TO_DAEMON__COMMAND__CONTAINER_EXEC_INPUT: {
 		IF_NULL_RETURN(container);
 		TRACE("Got input for exec'ed process. Sending message on fd");
+		idlefreeze_wake(container, "exec input");
 
 		int ret = container_write_exec_input(container, msg->exec_input, fd);
 		if (ret < 0) {
@@ -1652,50 +2638,423 @@ control_handle_message(control_t *control, const ControllerToDaemon *msg, int fd
 }
 
 /**
- * Event callback for incoming data that receives a ControllerToDaemon message (local)
+ * Takes a reference of the current snapshot, which has to be released by
+ * control_snapshot_unref(). Called by the control thread.
+ */
+static control_snapshot_t *
+control_snapshot_ref(void)
+{
+	pthread_mutex_lock(&control_snapshot_lock);
+	control_snapshot_t *snapshot = control_snapshot;
+	if (snapshot)
+		snapshot->refs++;
+	pthread_mutex_unlock(&control_snapshot_lock);
+
+	return snapshot;
+}
+
+static void
+control_snapshot_unref(control_snapshot_t *snapshot)
+{
+	IF_NULL_RETURN(snapshot);
+
+	pthread_mutex_lock(&control_snapshot_lock);
+	bool last = --snapshot->refs == 0;
+	pthread_mutex_unlock(&control_snapshot_lock);
+	IF_FALSE_RETURN(last);
+
+	for (size_t i = 0; i < snapshot->n; i++)
+		control_container_status_free(snapshot->status[i]);
+	mem_free0(snapshot->status);
+	mem_free0(snapshot);
+}
+
+static void
+control_snapshot_add_cb(container_t *container, void *data)
+{
+	control_snapshot_t *snapshot = data;
+	snapshot->status[snapshot->n++] = control_container_status_new(container);
+}
+
+/**
+ * Replaces the snapshot by the current status of all containers.
+ */
+static void
+control_snapshot_update(void)
+{
+	int count = cmld_containers_get_count();
+
+	control_snapshot_t *snapshot = mem_new0(control_snapshot_t, 1);
+	snapshot->refs = 1;
+	snapshot->time = time(NULL);
+	snapshot->status = mem_new0(ContainerStatus *, count > 0 ? count : 0);
+	cmld_containers_foreach(&control_snapshot_add_cb, snapshot);
+
+	pthread_mutex_lock(&control_snapshot_lock);
+	control_snapshot_t *old = control_snapshot;
+	control_snapshot = snapshot;
+	control_snapshot_requested = false;
+	pthread_mutex_unlock(&control_snapshot_lock);
+
+	control_snapshot_unref(old);
+	TRACE("Updated control snapshot of %zu containers", snapshot->n);
+}
+
+static void
+control_snapshot_update_cb(event_timer_t *timer, UNUSED void *data)
+{
+	event_remove_timer(timer);
+	event_timer_free(timer);
+	control_snapshot_timer = NULL;
+
+	control_snapshot_update();
+}
+
+/**
+ * Updates the snapshot once the main loop is done with the current event, thus a
+ * burst of changes results in a single update.
+ */
+static void
+control_snapshot_schedule_update(void)
+{
+	IF_TRUE_RETURN(control_snapshot_timer);
+
+	control_snapshot_timer = event_timer_new(0, 1, &control_snapshot_update_cb, NULL);
+	event_add_timer(control_snapshot_timer);
+}
+
+static void
+control_snapshot_event_cb(UNUSED const container_t *container, UNUSED bool removed,
+			  UNUSED void *data)
+{
+	control_snapshot_schedule_update();
+}
+
+/**
+ * Returns true for the commands which are answered by the control thread from the
+ * snapshot. These only read the status of the containers and are accepted on
+ * privileged control sockets in all modes, see control_check_command().
+ */
+static bool
+control_is_snapshot_query(const control_t *control, const ControllerToDaemon *msg)
+{
+	IF_FALSE_RETVAL(control->privileged, false);
+
+	return msg->command == CONTROLLER_TO_DAEMON__COMMAND__LIST_CONTAINERS ||
+	       msg->command == CONTROLLER_TO_DAEMON__COMMAND__GET_CONTAINER_STATUS;
+}
+
+static ContainerStatus *
+control_snapshot_find(const control_snapshot_t *snapshot, const char *uuid_str)
+{
+	uuid_t *uuid = uuid_new(uuid_str);
+	IF_NULL_RETVAL(uuid, NULL);
+
+	ContainerStatus *c_status = NULL;
+	for (size_t i = 0; i < snapshot->n && !c_status; i++) {
+		if (!strcmp(snapshot->status[i]->uuid, uuid_string(uuid)))
+			c_status = snapshot->status[i];
+	}
+
+	uuid_free(uuid);
+	return c_status;
+}
+
+/**
+ * Answers a query of control_is_snapshot_query() from the snapshot on the control thread.
+ * The uptime of started containers is advanced to the current time, everything else is
+ * as recent as the last update of the snapshot.
+ */
+static void
+control_handle_snapshot_query(control_snapshot_t *snapshot, const ControllerToDaemon *msg,
+			      int fd)
+{
+	DaemonToController out = DAEMON_TO_CONTROLLER__INIT;
+	time_t elapsed = time(NULL) - snapshot->time;
+
+	if (msg->command == CONTROLLER_TO_DAEMON__COMMAND__LIST_CONTAINERS) {
+		char **uuids = mem_new(char *, snapshot->n);
+		for (size_t i = 0; i < snapshot->n; i++)
+			uuids[i] = snapshot->status[i]->uuid;
+
+		out.code = DAEMON_TO_CONTROLLER__CODE__CONTAINERS_LIST;
+		out.n_container_uuids = snapshot->n;
+		out.container_uuids = uuids;
+		if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0)
+			WARN("Could not send list of containers to MDM");
+
+		mem_free0(uuids);
+		return;
+	}
+
+	// shallow copies, thus the uptime can be advanced without touching the snapshot
+	size_t n = msg->n_container_uuids > 0 ? msg->n_container_uuids : snapshot->n;
+	ContainerStatus *results = mem_new(ContainerStatus, n);
+	ContainerStatus **result_ptrs = mem_new(ContainerStatus *, n);
+	size_t n_results = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		ContainerStatus *c_status = msg->n_container_uuids > 0 ?
+						    control_snapshot_find(snapshot,
+									  msg->container_uuids[i]) :
+						    snapshot->status[i];
+		if (!c_status)
+			continue;
+
+		results[n_results] = *c_status;
+		if (c_status->state != CONTAINER_STATE__STOPPED && elapsed > 0)
+			results[n_results].uptime += elapsed;
+		result_ptrs[n_results] = &results[n_results];
+		n_results++;
+	}
+
+	out.code = DAEMON_TO_CONTROLLER__CODE__CONTAINER_STATUS;
+	out.n_container_status = n_results;
+	out.container_status = result_ptrs;
+	if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0)
+		WARN("Could not send container status to MDM");
+
+	mem_free0(result_ptrs);
+	mem_free0(results);
+}
+
+/**
+ * Runs func on the control thread and waits until it returned. If the control thread
+ * is not running, func is called right away.
+ */
+static void
+control_thread_call(void (*func)(void *data), void *data)
+{
+	if (!control_thread_running) {
+		func(data);
+		return;
+	}
+
+	control_thread_call_t call = { .func = func, .data = data, .done = false };
+
+	pthread_mutex_lock(&control_thread_lock);
+	control_thread_calls = list_append(control_thread_calls, &call);
+	pthread_mutex_unlock(&control_thread_lock);
+
+	while (eventfd_write(control_thread_call_fd, 1) < 0 && errno == EINTR)
+		;
+
+	pthread_mutex_lock(&control_thread_lock);
+	while (!call.done)
+		pthread_cond_wait(&control_thread_cond, &control_thread_lock);
+	pthread_mutex_unlock(&control_thread_lock);
+}
+
+static void
+control_thread_call_cb(int fd, unsigned events, UNUSED event_io_t *io, UNUSED void *data)
+{
+	eventfd_t val;
+
+	IF_FALSE_RETURN(events & EVENT_IO_READ);
+	if (eventfd_read(fd, &val) < 0) {
+		TRACE_ERRNO("eventfd_read failed");
+		return;
+	}
+
+	pthread_mutex_lock(&control_thread_lock);
+	list_t *calls = control_thread_calls;
+	control_thread_calls = NULL;
+	pthread_mutex_unlock(&control_thread_lock);
+
+	for (list_t *l = calls; l; l = l->next) {
+		control_thread_call_t *call = l->data;
+		call->func(call->data);
+	}
+
+	pthread_mutex_lock(&control_thread_lock);
+	for (list_t *l = calls; l; l = l->next) {
+		control_thread_call_t *call = l->data;
+		call->done = true;
+	}
+	pthread_cond_broadcast(&control_thread_cond);
+	pthread_mutex_unlock(&control_thread_lock);
+
+	list_delete(calls);
+}
+
+/**
+ * Queues a job of the control thread to be run by the main loop.
+ */
+static void
+control_thread_post(control_job_type_t type, control_client_t *client, uint8_t *buf,
+		    size_t buflen)
+{
+	control_job_t *job = mem_new0(control_job_t, 1);
+	job->type = type;
+	job->client = client;
+	job->buf = buf;
+	job->buflen = buflen;
+
+	pthread_mutex_lock(&control_thread_lock);
+	control_thread_jobs = list_append(control_thread_jobs, job);
+	pthread_mutex_unlock(&control_thread_lock);
+
+	while (eventfd_write(control_thread_main_fd, 1) < 0 && errno == EINTR)
+		;
+}
+
+static void
+control_job_free(control_job_t *job)
+{
+	IF_NULL_RETURN(job);
+	mem_free0(job->buf);
+	mem_free0(job);
+}
+
+/**
+ * Cleans up after a client which closed its connection, on the main loop.
+ */
+static void
+control_client_closed(control_client_t *client)
+{
+	control_t *control = client->control;
+
+	cmld_container_ctrl_with_input_abort();
+	control_telemetry_streams_remove(control, client->fd);
+	control_event_streams_remove(control, client->fd);
+	control_bulk_starts_detach(control, client->fd);
+	// not before, the main loop may still have replied on the fd
+	if (close(client->fd) < 0)
+		WARN_ERRNO("Failed to close connected control socket");
+	mem_free0(client);
+}
+
+static void
+control_job_run(control_job_t *job, mem_arena_t *arena)
+{
+	control_client_t *client = job->client;
+
+	switch (job->type) {
+	case CONTROL_JOB_MESSAGE: {
+		ControllerToDaemon *msg = (ControllerToDaemon *)protobuf_unpack_message_arena(
+			&controller_to_daemon__descriptor, job->buf, job->buflen, arena);
+		if (msg) {
+			control_handle_message(client->control, msg, client->fd);
+			mem_arena_reset(arena);
+		} else {
+			WARN("Could not unpack queued message of fd %d", client->fd);
+		}
+		// the replies have been posted, queries are answered directly again
+		__atomic_sub_fetch(&client->queued, 1, __ATOMIC_SEQ_CST);
+		control_snapshot_schedule_update();
+	} break;
+	case CONTROL_JOB_CLOSE:
+		control_client_closed(client);
+		break;
+	case CONTROL_JOB_SNAPSHOT:
+		control_snapshot_schedule_update();
+		break;
+	}
+}
+
+static void
+control_thread_main_cb(int fd, unsigned events, UNUSED event_io_t *io, UNUSED void *data)
+{
+	eventfd_t val;
+
+	IF_FALSE_RETURN(events & EVENT_IO_READ);
+	if (eventfd_read(fd, &val) < 0) {
+		TRACE_ERRNO("eventfd_read failed");
+		return;
+	}
+
+	pthread_mutex_lock(&control_thread_lock);
+	list_t *jobs = control_thread_jobs;
+	control_thread_jobs = NULL;
+	pthread_mutex_unlock(&control_thread_lock);
+
+	// the messages are released at once after handling, without freeing each field
+	mem_arena_t *arena = mem_arena_new(CONTROL_JOB_ARENA_BLOCK_SIZE);
+	for (list_t *l = jobs; l; l = l->next) {
+		control_job_run(l->data, arena);
+		control_job_free(l->data);
+	}
+	mem_arena_free(arena);
+	list_delete(jobs);
+}
+
+/**
+ * Callback for a ControllerToDaemon message received on a local connection.
  *
- * The handle_message function will be called to handle the received message.
+ * Status queries are answered right away from the snapshot. All other messages are
+ * queued to the main loop and handled there by control_handle_message(). Once a
+ * message of a client is queued, its following queries are queued as well until the
+ * main loop caught up, so the client sees the replies in order.
  *
- * @param fd	    file descriptor of the client connection
- *		    from which the incoming message is read
- * @param events    event flags
- * @param io	    pointer to associated event_io_t struct
- * @param data	    pointer to this control_t struct
+ * @param conn	    the client connection from which the message was received
+ * @param msg	    the received ControllerToDaemon message
+ * @param data	    pointer to the control_client_t struct
  */
 static void
-control_cb_recv_message_local(int fd, unsigned events, event_io_t *io, void *data)
+control_cb_recv_message_local(protobuf_conn_t *conn, ProtobufCMessage *msg, void *data)
 {
-	control_t *control = data;
-	/*
-	 * always check READ flag first, since also if the peer called close()
-	 * and there is pending data on the socet the READ and EXCEPT flags are set.
-	 * Thus, we have to read pending date before handling the EXCEPT event.
-	 */
-	if (events & EVENT_IO_READ) {
-		ControllerToDaemon *msg = (ControllerToDaemon *)protobuf_recv_message(
-			fd, &controller_to_daemon__descriptor);
-		// close connection if client EOF, or protocol parse error
-		IF_NULL_GOTO_TRACE(msg, connection_err);
-		control_handle_message(control, msg, fd);
+	control_client_t *client = data;
+	const ControllerToDaemon *cmsg = (const ControllerToDaemon *)msg;
+	int fd = protobuf_conn_get_fd(conn);
+
+	if (!control_thread_running) {
+		control_handle_message(client->control, cmsg, fd);
 		TRACE("Handled control connection %d", fd);
-		protobuf_free_message((ProtobufCMessage *)msg);
+		return;
 	}
-	// also check EXCEPT flag
-	if (events & EVENT_IO_EXCEPT) {
-		INFO("Control client closed connection; disconnecting control socket.");
-		goto connection_err;
+
+	if (control_is_snapshot_query(client->control, cmsg) &&
+	    __atomic_load_n(&client->queued, __ATOMIC_SEQ_CST) == 0) {
+		control_snapshot_t *snapshot = control_snapshot_ref();
+		if (snapshot) {
+			control_handle_snapshot_query(snapshot, cmsg, fd);
+			TRACE("Answered query of control connection %d from snapshot", fd);
+
+			// let the main loop refresh the pressures and the like
+			pthread_mutex_lock(&control_snapshot_lock);
+			bool request = !control_snapshot_requested &&
+				       time(NULL) - snapshot->time >= CONTROL_SNAPSHOT_MAX_AGE;
+			if (request)
+				control_snapshot_requested = true;
+			pthread_mutex_unlock(&control_snapshot_lock);
+			if (request)
+				control_thread_post(CONTROL_JOB_SNAPSHOT, NULL, NULL, 0);
+
+			control_snapshot_unref(snapshot);
+			return;
+		}
 	}
-	return;
 
-connection_err:
-	cmld_container_ctrl_with_input_abort();
-	event_remove_io(io);
-	event_io_free(io);
-	if (close(fd) < 0)
-		WARN_ERRNO("Failed to close connected control socket");
-	control->event_io_sock_connected_list =
-		list_remove(control->event_io_sock_connected_list, io);
-	return;
+	uint8_t *buf = NULL;
+	size_t buflen = protobuf_pack_message_new(msg, &buf);
+	__atomic_add_fetch(&client->queued, 1, __ATOMIC_SEQ_CST);
+	control_thread_post(CONTROL_JOB_MESSAGE, client, buf, buflen);
+	TRACE("Queued message of control connection %d to the main loop", fd);
+}
+
+/**
+ * Callback for a local connection which was closed by the client or
+ * which had to be closed due to an I/O or protocol parse error.
+ *
+ * @param conn	    the client connection to be closed
+ * @param data	    pointer to the control_client_t struct
+ */
+static void
+control_cb_close_local(protobuf_conn_t *conn, void *data)
+{
+	control_client_t *client = data;
+	control_t *control = client->control;
+
+	INFO("Control client closed connection; disconnecting control socket.");
+	control->conn_list = list_remove(control->conn_list, client);
+	protobuf_conn_free(conn);
+	client->conn = NULL;
+
+	// the fd is closed by the main loop after the queued messages of the client
+	if (control_thread_running)
+		control_thread_post(CONTROL_JOB_CLOSE, client, NULL, 0);
+	else
+		control_client_closed(client);
 }
 
 /**
@@ -1718,6 +3077,7 @@ control_cb_accept(int fd, unsigned events, event_io_t *io, void *data)
 		TRACE("EVENT_IO_EXCEPT on socket %d, closing...", fd);
 		event_remove_io(io);
 		event_io_free(io);
+		control->accept_io = NULL;
 		close(fd);
 		return;
 	}
@@ -1731,13 +3091,176 @@ control_cb_accept(int fd, unsigned events, event_io_t *io, void *data)
 	}
 	TRACE("Accepted control connection %d", cfd);
 
-	fd_make_non_blocking(cfd);
-
-	event_io_t *event =
-		event_io_new(cfd, EVENT_IO_READ, control_cb_recv_message_local, control);
+	control_client_t *client = mem_new0(control_client_t, 1);
+	client->control = control;
+	client->fd = cfd;
+	client->conn =
+		protobuf_conn_new(cfd, &controller_to_daemon__descriptor,
+				  control_cb_recv_message_local, control_cb_close_local, client);
+	if (!client->conn) {
+		WARN("Could not set up control connection %d", cfd);
+		mem_free0(client);
+		close(cfd);
+		return;
+	}
+	// replies of the main loop are sent through the connection of this thread
+	if (control_thread_running && protobuf_conn_set_shared(client->conn) < 0) {
+		WARN("Could not share control connection %d with the main loop", cfd);
+		protobuf_conn_free(client->conn);
+		mem_free0(client);
+		close(cfd);
+		return;
+	}
+	control->conn_list = list_append(control->conn_list, client);
 	TRACE("local control client connected on fd=%d", cfd);
+}
+
+static void *
+control_thread_run(UNUSED void *data)
+{
+	event_base_set_current(control_thread_base);
+
+	control_thread_call_io =
+		event_io_new(control_thread_call_fd, EVENT_IO_READ, &control_thread_call_cb, NULL);
+	event_add_io(control_thread_call_io);
+
+	// returns after the last event has been removed by control_thread_stop_cb()
+	event_loop();
+
+	event_base_set_current(NULL);
+	return NULL;
+}
+
+static void
+control_thread_stop_cb(UNUSED void *data)
+{
+	event_remove_io(control_thread_call_io);
+	event_io_free(control_thread_call_io);
+	control_thread_call_io = NULL;
+}
+
+/**
+ * Starts the control thread which serves the connections of all listening control
+ * sockets. If it cannot be started, the connections are served by the main loop.
+ */
+static void
+control_thread_start(void)
+{
+	sigset_t all, old;
+	int err;
+
+	control_thread_call_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	control_thread_main_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (control_thread_call_fd < 0 || control_thread_main_fd < 0) {
+		WARN_ERRNO("Could not create eventfds for control thread");
+		goto error;
+	}
+
+	control_thread_main_io =
+		event_io_new(control_thread_main_fd, EVENT_IO_READ, &control_thread_main_cb, NULL);
+	event_add_io(control_thread_main_io);
+
+	// until the first update, e.g. while the containers are loaded, queries are queued
+	control_snapshot_schedule_update();
+	control_snapshot_subscriber = cmld_container_events_subscribe(&control_snapshot_event_cb,
+								      NULL);
+	control_thread_base = event_base_new();
+
+	// signals must still be delivered to the main loop
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&control_thread, NULL, &control_thread_run, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		WARN("Could not create control thread: %s", strerror(err));
+		goto error;
+	}
 
-	event_add_io(event);
+	control_thread_running = true;
+	INFO("Control connections are served by the control thread");
+	return;
+
+error:
+	WARN("Control connections are served by the main loop");
+	control_thread_stop();
+}
+
+/**
+ * Stops the control thread. All controls and thus their clients are gone already.
+ */
+static void
+control_thread_stop(void)
+{
+	if (control_thread_running) {
+		control_thread_call(&control_thread_stop_cb, NULL);
+		pthread_join(control_thread, NULL);
+		control_thread_running = false;
+	}
+
+	if (control_thread_base) {
+		event_base_free(control_thread_base);
+		control_thread_base = NULL;
+	}
+
+	pthread_mutex_lock(&control_thread_lock);
+	for (list_t *l = control_thread_jobs; l; l = l->next)
+		control_job_free(l->data);
+	list_delete(control_thread_jobs);
+	control_thread_jobs = NULL;
+	pthread_mutex_unlock(&control_thread_lock);
+
+	if (control_thread_main_io) {
+		event_remove_io(control_thread_main_io);
+		event_io_free(control_thread_main_io);
+		control_thread_main_io = NULL;
+	}
+
+	if (control_snapshot_subscriber) {
+		cmld_container_events_unsubscribe(control_snapshot_subscriber);
+		control_snapshot_subscriber = NULL;
+	}
+	if (control_snapshot_timer) {
+		event_remove_timer(control_snapshot_timer);
+		event_timer_free(control_snapshot_timer);
+		control_snapshot_timer = NULL;
+	}
+	control_snapshot_unref(control_snapshot);
+	control_snapshot = NULL;
+
+	if (control_thread_call_fd >= 0)
+		close(control_thread_call_fd);
+	if (control_thread_main_fd >= 0)
+		close(control_thread_main_fd);
+	control_thread_call_fd = -1;
+	control_thread_main_fd = -1;
+}
+
+static void
+control_listen_cb(void *data)
+{
+	control_t *control = data;
+
+	control->accept_io = event_io_new(control->sock, EVENT_IO_READ, control_cb_accept, control);
+	event_add_io(control->accept_io);
+}
+
+static void
+control_release_cb(void *data)
+{
+	control_t *control = data;
+
+	if (control->accept_io) {
+		event_remove_io(control->accept_io);
+		event_io_free(control->accept_io);
+		control->accept_io = NULL;
+	}
+
+	for (list_t *l = control->conn_list; l; l = l->next) {
+		control_client_t *client = l->data;
+		protobuf_conn_free(client->conn);
+		client->conn = NULL;
+		shutdown(client->fd, SHUT_RDWR);
+	}
 }
 
 control_t *
@@ -1748,12 +3271,14 @@ control_new(int sock, bool privileged)
 		return NULL;
 	}
 
+	if (control_thread_users++ == 0)
+		control_thread_start();
+
 	control_t *control = mem_new0(control_t, 1);
 	control->sock = sock;
 	control->privileged = privileged;
 
-	event_io_t *event = event_io_new(sock, EVENT_IO_READ, control_cb_accept, control);
-	event_add_io(event);
+	control_thread_call(&control_listen_cb, control);
 
 	return control;
 }
@@ -1776,20 +3301,58 @@ void
 control_free(control_t *control)
 {
 	ASSERT(control);
-	for (list_t *l = control->event_io_sock_connected_list; l; l = l->next) {
-		event_io_t *event_io_sock_connected = l->data;
-		event_remove_io(event_io_sock_connected);
-		shutdown(event_io_get_fd(event_io_sock_connected), SHUT_RDWR);
-		if (close(event_io_get_fd(event_io_sock_connected) < 0)) {
+
+	// afterwards the control thread does not touch the control anymore
+	control_thread_call(&control_release_cb, control);
+
+	// queued messages of the clients are dropped, closed clients are cleaned up
+	list_t *dropped = NULL;
+	pthread_mutex_lock(&control_thread_lock);
+	for (list_t *l = control_thread_jobs; l;) {
+		list_t *next = l->next;
+		control_job_t *job = l->data;
+		if (job->client && job->client->control == control) {
+			dropped = list_append(dropped, job);
+			control_thread_jobs = list_unlink(control_thread_jobs, l);
+		}
+		l = next;
+	}
+	pthread_mutex_unlock(&control_thread_lock);
+	for (list_t *l = dropped; l; l = l->next) {
+		control_job_t *job = l->data;
+		if (job->type == CONTROL_JOB_CLOSE)
+			control_client_closed(job->client);
+		control_job_free(job);
+	}
+	list_delete(dropped);
+
+	for (list_t *l = control->conn_list; l; l = l->next) {
+		control_client_t *client = l->data;
+		if (close(client->fd) < 0) {
 			WARN_ERRNO("Failed to close connected control socket");
 		}
-		event_io_free(event_io_sock_connected);
+		mem_free0(client);
 	}
-	list_delete(control->event_io_sock_connected_list);
-	control->event_io_sock_connected_list = NULL;
+	list_delete(control->conn_list);
+	control->conn_list = NULL;
+
+	for (list_t *l = control->telemetry_streams; l; l = l->next)
+		control_telemetry_stream_free(l->data);
+	list_delete(control->telemetry_streams);
+	control->telemetry_streams = NULL;
+
+	for (list_t *l = control->event_streams; l; l = l->next)
+		control_event_stream_free(l->data);
+	list_delete(control->event_streams);
+	control->event_streams = NULL;
+
+	control_bulk_starts_detach(control, -1);
 
 	control_list = list_remove(control_list, control);
 
+	if (--control_thread_users == 0)
+		control_thread_stop();
+
 	mem_free0(control);
 	return;
 }
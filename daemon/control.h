@@ -30,6 +30,11 @@
  * Incoming messages (Protocol Buffers format) are decoded and various actions
  * are performed depending on the command contained in each message, such as
  * listing all containers, starting or stopping individual containers, etc.
+ *
+ * The client connections of listening control sockets are served by a thread of their
+ * own. It answers the container status queries from a snapshot which the main loop
+ * keeps up to date and queues all other messages to the main loop, where they are
+ * handled in order. Thus, status queries are answered while the main loop is busy.
  */
 
 #ifndef CONTROL_H
@@ -0,0 +1,621 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * Containers which request dedicated cpus get whole cores, i.e. all SMT siblings, served in
+ * the order of their cpu priority and, for equal priorities, of their cpu usage since the
+ * last rebalance. The cores of a container are taken from a single last level cache if
+ * possible, else from caches of the same NUMA node, so that latency-sensitive containers
+ * neither share cores nor caches with others. A container keeps its cores as long as they
+ * are not needed by a container of a higher priority. All other containers share the cpus
+ * which are not dedicated, restricted to their cpus_allowed if it intersects them. The
+ * memory nodes of a container follow the NUMA nodes of its cpus.
+ */
+
+#define _GNU_SOURCE
+
+#include "cpuset.h"
+
+#include "cmld.h"
+#include "container.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/event.h"
+#include "common/file.h"
+#include "common/dir.h"
+#include "common/hashmap.h"
+#include "common/list.h"
+#include "common/str.h"
+#include "common/uuid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+
+#define CPUSET_SYSFS_CPU "/sys/devices/system/cpu"
+#define CPUSET_SYSFS_NODE "/sys/devices/system/node"
+
+/* upper bound of the NUMA node ids, the MAX_NUMNODES of the kernel */
+#define CPUSET_MAX_NODES 1024
+/* number of cores which are never dedicated, e.g., to keep a cpu for cmld and c0 */
+#define CPUSET_SHARED_MIN_CORES 1
+
+typedef struct cpuset_cpu {
+	bool online;
+	int core; // lowest cpu of the SMT siblings
+	int llc;  // id of the last level cache, the package if not available
+	int node; // NUMA node
+} cpuset_cpu_t;
+
+typedef struct cpuset_container {
+	char *uuid;
+	container_t *container; // weak reference, only valid during a rebalance
+	unsigned int generation;
+	uint64_t cpu_usage_us; // at the last rebalance
+	uint64_t cpu_busy_us;  // since the last rebalance
+	bool *dedicated;       // cpus dedicated at the last rebalance, NULL if shared
+	unsigned int dedicated_want;
+	char *cpus; // cpus assigned at the last rebalance
+} cpuset_container_t;
+
+static event_timer_t *cpuset_timer = NULL;
+
+static cpuset_cpu_t *cpuset_cpus = NULL; // topology, indexed by cpu id
+static int cpuset_n_cpus = 0;
+static bool cpuset_mem_nodes[CPUSET_MAX_NODES]; // nodes with memory
+
+static hashmap_t *cpuset_containers = NULL; // cpuset_container_t by uuid
+static unsigned int cpuset_generation = 0;
+
+/*
+ * Parses a list in the cpuset list format, e.g. "0-3,8", into mask.
+ * Ids beyond size are ignored.
+ */
+static int
+cpuset_mask_parse(const char *list, bool *mask, int size)
+{
+	const char *p = list;
+
+	memset(mask, 0, size * sizeof(bool));
+	while (*p && *p != '\n') {
+		char *end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+		IF_TRUE_RETVAL(end == p || first < 0, -1);
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			IF_TRUE_RETVAL(end == p || last < first, -1);
+		}
+		for (long i = first; i <= last && i < size; i++)
+			mask[i] = true;
+
+		p = end;
+		if (*p == ',')
+			p++;
+	}
+	return 0;
+}
+
+static char *
+cpuset_mask_to_list_new(const bool *mask, int size)
+{
+	str_t *list = str_new(NULL);
+
+	for (int i = 0; i < size; i++) {
+		if (!mask[i])
+			continue;
+		int last = i;
+		while (last + 1 < size && mask[last + 1])
+			last++;
+		str_append_printf(list, "%s%d", str_length(list) ? "," : "", i);
+		if (last > i)
+			str_append_printf(list, "-%d", last);
+		i = last;
+	}
+	return str_free(list, false);
+}
+
+static int
+cpuset_mask_count(const bool *mask, int size)
+{
+	int count = 0;
+	for (int i = 0; i < size; i++)
+		count += mask[i];
+	return count;
+}
+
+static int
+cpuset_read_int(const char *fmt, int cpu, int *value)
+{
+	char *path = mem_printf(fmt, cpu);
+	char *buf = file_read_new(path, 64);
+	mem_free0(path);
+	IF_NULL_RETVAL(buf, -1);
+
+	// for lists, e.g. of the siblings, this is the lowest id
+	int ret = sscanf(buf, "%d", value) == 1 ? 0 : -1;
+	mem_free0(buf);
+	return ret;
+}
+
+static int
+cpuset_find_node_cb(UNUSED const char *path, const char *file, void *data)
+{
+	int *node = data;
+	return sscanf(file, "node%d", node) == 1 ? -1 : 0;
+}
+
+static int
+cpuset_read_topology(void)
+{
+	char *buf = NULL;
+	bool *online = NULL;
+	int ret = -1;
+
+	cpuset_n_cpus = get_nprocs_conf();
+	cpuset_cpus = mem_new0(cpuset_cpu_t, cpuset_n_cpus);
+	online = mem_new0(bool, cpuset_n_cpus);
+
+	buf = file_read_new(CPUSET_SYSFS_CPU "/online", 4096);
+	IF_NULL_GOTO_ERROR(buf, out);
+	IF_TRUE_GOTO_ERROR(cpuset_mask_parse(buf, online, cpuset_n_cpus) < 0, out);
+	mem_free0(buf);
+
+	for (int cpu = 0; cpu < cpuset_n_cpus; cpu++) {
+		cpuset_cpu_t *c = &cpuset_cpus[cpu];
+		if (!online[cpu])
+			continue;
+
+		c->online = true;
+		if (cpuset_read_int(CPUSET_SYSFS_CPU "/cpu%d/topology/thread_siblings_list", cpu,
+				    &c->core) < 0)
+			c->core = cpu;
+		if (cpuset_read_int(CPUSET_SYSFS_CPU "/cpu%d/cache/index3/id", cpu, &c->llc) < 0 &&
+		    cpuset_read_int(CPUSET_SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu,
+				    &c->llc) < 0)
+			c->llc = 0;
+
+		char *path = mem_printf(CPUSET_SYSFS_CPU "/cpu%d", cpu);
+		c->node = 0;
+		dir_foreach(path, &cpuset_find_node_cb, &c->node);
+		mem_free0(path);
+		if (c->node < 0 || c->node >= CPUSET_MAX_NODES)
+			c->node = 0;
+	}
+
+	// without NUMA support, all memory is on node 0
+	memset(cpuset_mem_nodes, 0, sizeof(cpuset_mem_nodes));
+	buf = file_read_new(CPUSET_SYSFS_NODE "/has_memory", 4096);
+	if (!buf || cpuset_mask_parse(buf, cpuset_mem_nodes, CPUSET_MAX_NODES) < 0 ||
+	    cpuset_mask_count(cpuset_mem_nodes, CPUSET_MAX_NODES) == 0)
+		cpuset_mem_nodes[0] = true;
+
+	ret = 0;
+out:
+	if (buf)
+		mem_free0(buf);
+	mem_free0(online);
+	return ret;
+}
+
+/*
+ * Sets the memory nodes in mems which are local to the cpus in mask, all nodes with
+ * memory if none of them is.
+ */
+static void
+cpuset_mems_of_mask(const bool *mask, bool *mems)
+{
+	memset(mems, 0, CPUSET_MAX_NODES * sizeof(bool));
+	for (int cpu = 0; cpu < cpuset_n_cpus; cpu++) {
+		if (mask[cpu] && cpuset_mem_nodes[cpuset_cpus[cpu].node])
+			mems[cpuset_cpus[cpu].node] = true;
+	}
+	if (cpuset_mask_count(mems, CPUSET_MAX_NODES) == 0)
+		memcpy(mems, cpuset_mem_nodes, CPUSET_MAX_NODES * sizeof(bool));
+}
+
+/*
+ * Returns the last level cache on the given node (any if -1) with free cpus from which
+ * want cpus are best taken, i.e. the smallest one which fits, else the largest one.
+ */
+static int
+cpuset_pick_llc(const bool *spare, int want, int node)
+{
+	int fit = -1, fit_count = 0, largest = -1, largest_count = 0;
+
+	for (int cpu = 0; cpu < cpuset_n_cpus; cpu++) {
+		if (!spare[cpu])
+			continue;
+		if (node >= 0 && cpuset_cpus[cpu].node != node)
+			continue;
+
+		int count = 0;
+		for (int c = 0; c < cpuset_n_cpus; c++)
+			count += spare[c] && cpuset_cpus[c].llc == cpuset_cpus[cpu].llc &&
+				 cpuset_cpus[c].node == cpuset_cpus[cpu].node;
+		if (count >= want && (fit < 0 || count < fit_count)) {
+			fit = cpu;
+			fit_count = count;
+		}
+		if (count > largest_count) {
+			largest = cpu;
+			largest_count = count;
+		}
+	}
+	return fit >= 0 ? fit : largest;
+}
+
+/*
+ * Takes whole cores with at least want cpus out of the cpus in avail.
+ *
+ * @return the mask of the taken cpus, NULL if not enough cores are available
+ */
+static bool *
+cpuset_alloc(bool *avail, int want)
+{
+	bool *spare = mem_new0(bool, cpuset_n_cpus);
+	bool *mask = mem_new0(bool, cpuset_n_cpus);
+	int got = 0, node = -1;
+
+	// only cores of which all siblings are available can be taken
+	for (int cpu = 0; cpu < cpuset_n_cpus; cpu++) {
+		spare[cpu] = avail[cpu];
+		for (int c = 0; c < cpuset_n_cpus && spare[cpu]; c++) {
+			if (cpuset_cpus[c].online && cpuset_cpus[c].core == cpuset_cpus[cpu].core)
+				spare[cpu] = avail[c];
+		}
+	}
+
+	while (got < want) {
+		int first = cpuset_pick_llc(spare, want - got, node);
+		if (first < 0 && node >= 0)
+			first = cpuset_pick_llc(spare, want - got, -1);
+		if (first < 0)
+			break;
+		node = cpuset_cpus[first].node;
+
+		int llc = cpuset_cpus[first].llc;
+		for (int cpu = 0; cpu < cpuset_n_cpus && got < want; cpu++) {
+			if (!spare[cpu] || cpuset_cpus[cpu].llc != llc || cpuset_cpus[cpu].node != node)
+				continue;
+			for (int c = 0; c < cpuset_n_cpus; c++) {
+				if (spare[c] && cpuset_cpus[c].core == cpuset_cpus[cpu].core) {
+					mask[c] = true;
+					spare[c] = false;
+					got++;
+				}
+			}
+		}
+	}
+	mem_free0(spare);
+
+	if (got < want) {
+		mem_free0(mask);
+		return NULL;
+	}
+	for (int cpu = 0; cpu < cpuset_n_cpus; cpu++)
+		avail[cpu] = avail[cpu] && !mask[cpu];
+	return mask;
+}
+
+static void
+cpuset_container_free(cpuset_container_t *entry)
+{
+	if (entry->dedicated)
+		mem_free0(entry->dedicated);
+	if (entry->cpus)
+		mem_free0(entry->cpus);
+	mem_free0(entry->uuid);
+	mem_free0(entry);
+}
+
+static void
+cpuset_collect_cb(container_t *container, void *data)
+{
+	list_t **entries = data;
+	container_usage_t usage;
+
+	// only started containers have a cgroup to be placed
+	IF_TRUE_RETURN(container_get_usage(container, &usage) < 0);
+
+	const char *uuid = uuid_string(container_get_uuid(container));
+	cpuset_container_t *entry = hashmap_get(cpuset_containers, uuid);
+	if (!entry) {
+		entry = mem_new0(cpuset_container_t, 1);
+		entry->uuid = mem_strdup(uuid);
+		hashmap_put(cpuset_containers, entry->uuid, entry);
+	}
+
+	// the usage restarts with the container
+	entry->cpu_busy_us = usage.cpu_usage_us >= entry->cpu_usage_us ?
+				     usage.cpu_usage_us - entry->cpu_usage_us :
+				     usage.cpu_usage_us;
+	entry->cpu_usage_us = usage.cpu_usage_us;
+	entry->container = container;
+	entry->generation = cpuset_generation;
+	*entries = list_append(*entries, entry);
+}
+
+static void
+cpuset_collect_stale_cb(UNUSED const void *key, void *value, void *data)
+{
+	cpuset_container_t *entry = value;
+	list_t **stale = data;
+
+	if (entry->generation != cpuset_generation)
+		*stale = list_append(*stale, entry);
+}
+
+static int
+cpuset_container_cmp(const void *a, const void *b)
+{
+	const cpuset_container_t *ea = *(cpuset_container_t *const *)a;
+	const cpuset_container_t *eb = *(cpuset_container_t *const *)b;
+	unsigned int pa = container_get_cpu_priority(ea->container);
+	unsigned int pb = container_get_cpu_priority(eb->container);
+
+	if (pa != pb)
+		return pa > pb ? -1 : 1;
+	if (ea->cpu_busy_us != eb->cpu_busy_us)
+		return ea->cpu_busy_us > eb->cpu_busy_us ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Dedicates cores to the container of entry, keeping its previous cores if they are still
+ * available. New cores are preferably taken from those not held by any container.
+ */
+static void
+cpuset_dedicate(cpuset_container_t *entry, bool *avail, const bool *held)
+{
+	int want = container_get_dedicated_cpus(entry->container);
+
+	if (entry->dedicated && entry->dedicated_want == (unsigned int)want) {
+		bool kept = true;
+		for (int cpu = 0; cpu < cpuset_n_cpus && kept; cpu++)
+			kept = !entry->dedicated[cpu] || avail[cpu];
+		if (kept) {
+			for (int cpu = 0; cpu < cpuset_n_cpus; cpu++)
+				avail[cpu] = avail[cpu] && !entry->dedicated[cpu];
+			return;
+		}
+	}
+	if (entry->dedicated)
+		mem_free0(entry->dedicated);
+
+	bool *unheld = mem_new0(bool, cpuset_n_cpus);
+	for (int cpu = 0; cpu < cpuset_n_cpus; cpu++)
+		unheld[cpu] = avail[cpu] && !held[cpu];
+
+	entry->dedicated = cpuset_alloc(unheld, want);
+	if (entry->dedicated) {
+		for (int cpu = 0; cpu < cpuset_n_cpus; cpu++)
+			avail[cpu] = avail[cpu] && !entry->dedicated[cpu];
+	} else {
+		entry->dedicated = cpuset_alloc(avail, want);
+	}
+	mem_free0(unheld);
+
+	if (!entry->dedicated && entry->dedicated_want != (unsigned int)want)
+		WARN("Not enough free cores to dedicate %d cpus to container %s, sharing cpus",
+		     want, container_get_description(entry->container));
+	entry->dedicated_want = want;
+}
+
+static void
+cpuset_apply(cpuset_container_t *entry, const bool *shared)
+{
+	bool *mask = mem_new0(bool, cpuset_n_cpus);
+	bool mems[CPUSET_MAX_NODES];
+
+	if (entry->dedicated) {
+		memcpy(mask, entry->dedicated, cpuset_n_cpus * sizeof(bool));
+	} else {
+		memcpy(mask, shared, cpuset_n_cpus * sizeof(bool));
+
+		const char *allowed = container_get_cpus_allowed(entry->container);
+		bool *restricted = mem_new0(bool, cpuset_n_cpus);
+		if (allowed && cpuset_mask_parse(allowed, restricted, cpuset_n_cpus) == 0) {
+			for (int cpu = 0; cpu < cpuset_n_cpus; cpu++)
+				restricted[cpu] = restricted[cpu] && shared[cpu];
+			if (cpuset_mask_count(restricted, cpuset_n_cpus) > 0)
+				memcpy(mask, restricted, cpuset_n_cpus * sizeof(bool));
+		}
+		mem_free0(restricted);
+	}
+
+	cpuset_mems_of_mask(mask, mems);
+
+	char *cpus_list = cpuset_mask_to_list_new(mask, cpuset_n_cpus);
+	char *mems_list = cpuset_mask_to_list_new(mems, CPUSET_MAX_NODES);
+
+	// an unchanged cpuset is not rebuilt by the kernel, rewriting it also covers restarts
+	if (container_set_cpuset(entry->container, cpus_list, mems_list) == 0 &&
+	    (!entry->cpus || strcmp(entry->cpus, cpus_list))) {
+		INFO("Assigned %s cpus %s to container %s", entry->dedicated ? "dedicated" : "shared",
+		     cpus_list, container_get_description(entry->container));
+	}
+
+	if (entry->cpus)
+		mem_free0(entry->cpus);
+	entry->cpus = cpus_list;
+	mem_free0(mems_list);
+	mem_free0(mask);
+}
+
+static void
+cpuset_rebalance_cb(UNUSED event_timer_t *timer, UNUSED void *data)
+{
+	list_t *entries = NULL, *stale = NULL;
+
+	cpuset_generation++;
+	cmld_containers_foreach(&cpuset_collect_cb, &entries);
+
+	// forget stopped containers
+	hashmap_foreach(cpuset_containers, &cpuset_collect_stale_cb, &stale);
+	for (list_t *l = stale; l; l = l->next) {
+		cpuset_container_t *entry = l->data;
+		hashmap_remove(cpuset_containers, entry->uuid);
+		cpuset_container_free(entry);
+	}
+	list_delete(stale);
+
+	size_t n = list_length(entries);
+	cpuset_container_t **sorted = mem_new0(cpuset_container_t *, n);
+	bool *avail = mem_new0(bool, cpuset_n_cpus);
+	bool *held = mem_new0(bool, cpuset_n_cpus);
+	bool *reserved = mem_new0(bool, cpuset_n_cpus);
+
+	size_t i = 0;
+	for (list_t *l = entries; l; l = l->next)
+		sorted[i++] = l->data;
+	qsort(sorted, n, sizeof(cpuset_container_t *), &cpuset_container_cmp);
+
+	for (int cpu = 0; cpu < cpuset_n_cpus; cpu++)
+		avail[cpu] = cpuset_cpus[cpu].online;
+
+	// keep the first cores for the shared cpus
+	for (int cpu = 0, cores = 0; cpu < cpuset_n_cpus && cores < CPUSET_SHARED_MIN_CORES;
+	     cpu++) {
+		if (!avail[cpu] || cpuset_cpus[cpu].core != cpu)
+			continue;
+		for (int c = cpu; c < cpuset_n_cpus; c++) {
+			if (cpuset_cpus[c].online && cpuset_cpus[c].core == cpu) {
+				avail[c] = false;
+				reserved[c] = true;
+			}
+		}
+		cores++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!sorted[i]->dedicated)
+			continue;
+		for (int cpu = 0; cpu < cpuset_n_cpus; cpu++)
+			held[cpu] = held[cpu] || sorted[i]->dedicated[cpu];
+	}
+
+	for (i = 0; i < n; i++) {
+		if (container_get_dedicated_cpus(sorted[i]->container) > 0) {
+			cpuset_dedicate(sorted[i], avail, held);
+		} else if (sorted[i]->dedicated) {
+			mem_free0(sorted[i]->dedicated);
+			sorted[i]->dedicated_want = 0;
+		}
+	}
+
+	// the cpus which are not dedicated are shared
+	for (int cpu = 0; cpu < cpuset_n_cpus; cpu++)
+		avail[cpu] = avail[cpu] || reserved[cpu];
+
+	for (i = 0; i < n; i++)
+		cpuset_apply(sorted[i], avail);
+
+	mem_free0(reserved);
+	mem_free0(held);
+	mem_free0(avail);
+	mem_free0(sorted);
+	list_delete(entries);
+}
+
+/*
+ * Reads the topology once, it is kept until cpuset_cleanup().
+ */
+static int
+cpuset_topology_get(void)
+{
+	IF_TRUE_RETVAL(cpuset_cpus, 0);
+
+	if (cpuset_read_topology() < 0) {
+		ERROR("Could not read cpu topology");
+		mem_free0(cpuset_cpus);
+		cpuset_n_cpus = 0;
+		return -1;
+	}
+	return 0;
+}
+
+char *
+cpuset_mems_new(const char *cpus)
+{
+	IF_NULL_RETVAL(cpus, NULL);
+	IF_TRUE_RETVAL(cpuset_topology_get() < 0, NULL);
+
+	bool *mask = mem_new0(bool, cpuset_n_cpus);
+	bool mems[CPUSET_MAX_NODES];
+	char *mems_list = NULL;
+
+	if (cpuset_mask_parse(cpus, mask, cpuset_n_cpus) < 0) {
+		ERROR("Could not parse cpu list '%s'", cpus);
+		goto out;
+	}
+
+	cpuset_mems_of_mask(mask, mems);
+	mems_list = cpuset_mask_to_list_new(mems, CPUSET_MAX_NODES);
+out:
+	mem_free0(mask);
+	return mems_list;
+}
+
+int
+cpuset_init(unsigned int interval)
+{
+	IF_TRUE_RETVAL(interval == 0, 0);
+	IF_TRUE_RETVAL(cpuset_topology_get() < 0, -1);
+
+	cpuset_containers = hashmap_new_str();
+	cpuset_timer = event_timer_new(interval * 1000, EVENT_TIMER_REPEAT_FOREVER,
+				       &cpuset_rebalance_cb, NULL);
+	event_add_timer(cpuset_timer);
+
+	INFO("Rebalancing the cpus of the containers every %u seconds", interval);
+	return 0;
+}
+
+static void
+cpuset_free_container_cb(UNUSED const void *key, void *value, UNUSED void *data)
+{
+	cpuset_container_free(value);
+}
+
+void
+cpuset_cleanup(void)
+{
+	if (cpuset_timer) {
+		event_remove_timer(cpuset_timer);
+		event_timer_free(cpuset_timer);
+		cpuset_timer = NULL;
+	}
+	if (cpuset_containers) {
+		hashmap_foreach(cpuset_containers, &cpuset_free_container_cb, NULL);
+		hashmap_free(cpuset_containers);
+		cpuset_containers = NULL;
+	}
+	if (cpuset_cpus)
+		mem_free0(cpuset_cpus);
+	cpuset_n_cpus = 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * Cpuset manager, which assigns the cpus to the running containers at runtime. Containers
+ * which request dedicated cpus get whole cores for themselves, all others share the rest.
+ */
+
+#ifndef CPUSET_H
+#define CPUSET_H
+
+/**
+ * Starts rebalancing the cpus of the containers each interval seconds.
+ *
+ * @return 0 on success or if the manager is disabled by an interval of 0, -1 on error
+ */
+int
+cpuset_init(unsigned int interval);
+
+void
+cpuset_cleanup(void);
+
+/**
+ * Returns the memory nodes local to the given cpus as a new list in the cpuset list
+ * format, e.g. "0-1", for the cpuset.mems of a container. If none of the cpus is local
+ * to a node with memory, all nodes with memory are returned. Works regardless of
+ * whether the rebalancing is enabled.
+ *
+ * @param cpus list of cpus in the cpuset list format
+ * @return the newly allocated list of memory nodes, NULL on error
+ */
+char *
+cpuset_mems_new(const char *cpus);
+
+#endif /* CPUSET_H */
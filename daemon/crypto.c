@@ -27,14 +27,29 @@
 #include "cmld.h"
 
 #include "common/event.h"
+#include "common/event_work.h"
+#include "common/fd.h"
 #include "common/file.h"
+#include "common/digest.h"
+#include "common/hashmap.h"
 #include "common/hex.h"
+#include "common/list.h"
 #include "common/macro.h"
 #include "common/mem.h"
+#include "common/metrics.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/sock.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/if_alg.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 // clang-format off
 #ifndef CRYPTO_HWRNG_PATH
@@ -46,13 +61,51 @@
 #endif
 
 // clang-format on
+
+// number of requests kept in flight by crypto_hash_files_block() and crypto_verify_bufs_block()
+#define CRYPTO_HASH_BLOCK_INFLIGHT 4
+
+// time in seconds for which successful buffer verifications are reused
+#define CRYPTO_VERIFY_CACHE_TTL 300
+// maximum number of cached buffer verification results
+#define CRYPTO_VERIFY_CACHE_MAX 64
+
+// size of the chunks in which files are passed to the kernel for hashing
+#define CRYPTO_LOCAL_BUF_SIZE (256 * 1024)
+// size of the largest supported digest (SHA512)
+#define CRYPTO_LOCAL_DIGEST_MAX 64
+
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+
 extern char *scd_sock_path; // defined in scd.c
 
+/*
+ * Returns the histogram of the round trip times of the blocking or the asynchronous
+ * requests to scd.
+ */
+static metrics_t *
+crypto_scd_metrics(bool block)
+{
+	static metrics_t *metrics[2] = { NULL, NULL };
+
+	if (!metrics[block])
+		metrics[block] = metrics_histogram_new(
+			"cml_scd_request_seconds", block ? "mode=\"block\"" : "mode=\"async\"",
+			"Round trip time of the requests to scd", metrics_latency_buckets,
+			metrics_latency_buckets_len);
+	return metrics[block];
+}
+
 static TokenToDaemon *
 crypto_send_recv_block(const DaemonToToken *out)
 {
 	ASSERT(out);
 
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	int sock = sock_unix_create_and_connect(SOCK_SEQPACKET, scd_sock_path);
 	if (sock < 0) {
 		ERROR_ERRNO("Failed to connect to scd control socket %s", scd_sock_path);
@@ -70,6 +123,8 @@ crypto_send_recv_block(const DaemonToToken *out)
 	TokenToDaemon *msg = NULL;
 	msg = (TokenToDaemon *)protobuf_recv_message(sock, &token_to_daemon__descriptor);
 	close(sock);
+	if (msg)
+		metrics_histogram_observe_since(crypto_scd_metrics(true), &start);
 	return msg;
 }
 
@@ -154,6 +209,9 @@ typedef struct crypto_callback_task {
 	size_t verify_data_buf_len;
 	size_t verify_sig_buf_len;
 	size_t verify_cert_buf_len;
+	int local_ret;					 // result of hashing in cmld itself
+	uint8_t local_digest[CRYPTO_LOCAL_DIGEST_MAX]; // digest if hashed in cmld itself
+	struct timespec sent;				 // time the request was sent to scd
 } crypto_callback_task_t;
 
 static crypto_callback_task_t *
@@ -244,78 +302,164 @@ crypto_callback_task_free(crypto_callback_task_t *task)
 	mem_free0(task);
 }
 
+/*
+ * Delivers the reply msg to the callback of the task. A NULL msg reports a failure,
+ * e.g., if the connection to scd was lost before the reply arrived.
+ */
 static void
-crypto_cb(int fd, unsigned events, event_io_t *io, void *data)
+crypto_callback_task_complete(crypto_callback_task_t *task, const TokenToDaemon *msg)
 {
-	crypto_callback_task_t *task = data;
 	ASSERT(task);
 
-	TRACE("Received message crypto msg from SCD");
+	TokenToDaemon__Code code;
+	if (msg)
+		code = msg->code;
+	else if (task->hash_complete || task->hash_buf_complete)
+		code = TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_ERROR;
+	else
+		code = TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_ERROR;
 
-	// TODO outsource socket/fd/events handling
-	if (events & EVENT_IO_READ) {
-		// use protobuf for communication with scd
-		TokenToDaemon *msg =
-			(TokenToDaemon *)protobuf_recv_message(fd, &token_to_daemon__descriptor);
-		if (!msg) {
-			ERROR("Failed to receive message although EVENT_IO_READ was set. Aborting crypto_cb.");
-			goto cleanup;
-		}
-		switch (msg->code) {
-		// deal with CRYPTO_HASH_* cases
-		case TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_OK:
-			TRACE("Received HASH_OK message, ");
-			if (msg->has_hash_value) {
-				char *hash = convert_bin_to_hex_new(msg->hash_value.data,
-								    msg->hash_value.len);
+	switch (code) {
+	// deal with CRYPTO_HASH_* cases
+	case TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_OK:
+		TRACE("Received HASH_OK message, ");
+		if (msg->has_hash_value) {
+			char *hash =
+				convert_bin_to_hex_new(msg->hash_value.data, msg->hash_value.len);
 
-				TRACE("Received hash for file %s: %s",
-				      task->hash_file ? task->hash_file : "<empty>", hash);
+			TRACE("Received hash for file %s: %s",
+			      task->hash_file ? task->hash_file : "<empty>", hash);
+			if (task->hash_complete)
 				task->hash_complete(hash, task->hash_file, task->hash_algo,
 						    task->data);
-				if (hash != NULL) {
-					mem_free0(hash);
-				}
-				break;
+			else if (task->hash_buf_complete)
+				task->hash_buf_complete(hash, task->hash_buf, task->hash_buf_len,
+							task->hash_algo, task->data);
+			if (hash != NULL) {
+				mem_free0(hash);
 			}
-			ERROR("Missing hash_value in CRYPTO_HASH_OK response!"); // fallthrough
-		case TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_ERROR:
-			task->hash_complete(NULL, task->hash_file, task->hash_algo, task->data);
 			break;
+		}
+		ERROR("Missing hash_value in CRYPTO_HASH_OK response!"); // fallthrough
+	case TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_ERROR:
+		if (task->hash_complete)
+			task->hash_complete(NULL, task->hash_file, task->hash_algo, task->data);
+		else if (task->hash_buf_complete)
+			task->hash_buf_complete(NULL, task->hash_buf, task->hash_buf_len,
+						task->hash_algo, task->data);
+		break;
 
-		// deal with CRYPTO_VERIFY_* cases
-		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_GOOD:
-		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_ERROR:
-		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_BAD_SIGNATURE:
-		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_BAD_CERTIFICATE:
-		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_LOCALLY_SIGNED:
-			if (task->verify_complete) {
-				task->verify_complete(crypto_verify_result_from_proto(msg->code),
-						      task->verify_data_file, task->verify_sig_file,
-						      task->verify_cert_file, task->hash_algo,
-						      task->data);
-			} else if (task->verify_buf_complete) {
-				task->verify_buf_complete(
-					crypto_verify_result_from_proto(msg->code),
-					task->verify_data_buf, task->verify_data_buf_len,
-					task->verify_sig_buf, task->verify_sig_buf_len,
-					task->verify_cert_buf, task->verify_cert_buf_len,
-					task->hash_algo, task->data);
-			}
-			break;
-		default:
-			ERROR("TokenToDaemon command %d unknown or not implemented yet", msg->code);
-			break;
+	// deal with CRYPTO_VERIFY_* cases
+	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_GOOD:
+	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_ERROR:
+	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_BAD_SIGNATURE:
+	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_BAD_CERTIFICATE:
+	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_LOCALLY_SIGNED:
+		if (task->verify_complete) {
+			task->verify_complete(crypto_verify_result_from_proto(code),
+					      task->verify_data_file, task->verify_sig_file,
+					      task->verify_cert_file, task->hash_algo, task->data);
+		} else if (task->verify_buf_complete) {
+			task->verify_buf_complete(crypto_verify_result_from_proto(code),
+						  task->verify_data_buf, task->verify_data_buf_len,
+						  task->verify_sig_buf, task->verify_sig_buf_len,
+						  task->verify_cert_buf, task->verify_cert_buf_len,
+						  task->hash_algo, task->data);
 		}
-		protobuf_free_message((ProtobufCMessage *)msg);
-	} else {
-		ERROR("Failed to receive message: EVENT_IO_EXCEPT. Aborting crypto_cb");
+		break;
+	default:
+		ERROR("TokenToDaemon command %d unknown or not implemented yet", code);
+		break;
 	}
-cleanup:
-	event_remove_io(io);
-	event_io_free(io);
+}
+
+/*
+ * All asynchronous crypto requests share one connection to scd. Each request is tagged
+ * with a request id which scd echoes in its reply, thus many requests can be in flight
+ * and replies may arrive in any order.
+ */
+static protobuf_conn_t *crypto_conn = NULL;
+static hashmap_t *crypto_conn_tasks = NULL; // request id -> crypto_callback_task_t
+static uint32_t crypto_conn_request_id = 0;
+
+static void
+crypto_conn_cb_message(UNUSED protobuf_conn_t *conn, ProtobufCMessage *message,
+		       UNUSED void *data)
+{
+	TokenToDaemon *msg = (TokenToDaemon *)message;
+
+	TRACE("Received message crypto msg from SCD");
+
+	if (!msg->has_request_id) {
+		ERROR("Received crypto reply without request id from scd, dropping it");
+		return;
+	}
+
+	crypto_callback_task_t *task =
+		hashmap_remove(crypto_conn_tasks, HASHMAP_INT_KEY(msg->request_id));
+	if (!task) {
+		WARN("Received crypto reply for unknown request %u", msg->request_id);
+		return;
+	}
+	metrics_histogram_observe_since(crypto_scd_metrics(false), &task->sent);
+
+	crypto_callback_task_complete(task, msg);
 	crypto_callback_task_free(task);
+}
+
+static void
+crypto_conn_collect_task_cb(UNUSED const void *key, void *value, void *data)
+{
+	list_t **tasks = data;
+	*tasks = list_append(*tasks, value);
+}
+
+static void
+crypto_conn_cb_close(protobuf_conn_t *conn, UNUSED void *data)
+{
+	int fd = protobuf_conn_get_fd(conn);
+
+	WARN("Connection to scd for crypto requests closed");
+	protobuf_conn_free(conn);
 	close(fd);
+	crypto_conn = NULL;
+
+	// fail all pending requests, the callbacks may already issue new ones
+	list_t *tasks = NULL;
+	hashmap_foreach(crypto_conn_tasks, crypto_conn_collect_task_cb, &tasks);
+	hashmap_free(crypto_conn_tasks);
+	crypto_conn_tasks = NULL;
+
+	for (list_t *l = tasks; l; l = l->next) {
+		crypto_callback_task_t *task = l->data;
+		crypto_callback_task_complete(task, NULL);
+		crypto_callback_task_free(task);
+	}
+	list_delete(tasks);
+}
+
+static protobuf_conn_t *
+crypto_conn_get(void)
+{
+	IF_TRUE_RETVAL(crypto_conn, crypto_conn);
+
+	int sock = sock_unix_create_and_connect(SOCK_SEQPACKET | SOCK_NONBLOCK, scd_sock_path);
+	if (sock < 0) {
+		ERROR_ERRNO("Failed to connect to scd control socket %s", scd_sock_path);
+		return NULL;
+	}
+
+	TRACE("crypto_conn_get: connected to sock %d", sock);
+	crypto_conn = protobuf_conn_new(sock, &token_to_daemon__descriptor, crypto_conn_cb_message,
+					crypto_conn_cb_close, NULL);
+	if (!crypto_conn) {
+		close(sock);
+		return NULL;
+	}
+	if (!crypto_conn_tasks)
+		crypto_conn_tasks = hashmap_new_int();
+
+	return crypto_conn;
 }
 
 static void
@@ -361,21 +505,44 @@ cleanup:
 	close(fd);
 }
 
+/*
+ * Passes each buffer of bufs in a sealed memfd on sock ahead of the next message, which
+ * is one of the CRYPTO_*_MEMFD requests. Thus, scd maps the buffers instead of receiving
+ * them as part of the message, which is not bound by PROTOBUF_MAX_MESSAGE_SIZE.
+ */
 static int
-crypto_send_msg(const DaemonToToken *out, crypto_callback_task_t *task)
+crypto_send_memfds(int sock, const struct iovec *bufs, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		int fd = fd_memfd_sealed_new("cml-crypto", bufs[i].iov_base, bufs[i].iov_len);
+		IF_TRUE_RETVAL(fd < 0, -1);
+
+		int ret = protobuf_conn_send_fd(sock, fd);
+		close(fd);
+		IF_TRUE_RETVAL(ret < 0, -1);
+	}
+	return 0;
+}
+
+static int
+crypto_send_msg(const DaemonToToken *out, crypto_callback_task_t *task,
+		const struct iovec *memfd_bufs, size_t memfd_bufs_len)
 {
 	ASSERT(out);
 	ASSERT(task);
 
-	int sock = sock_unix_create_and_connect(SOCK_SEQPACKET | SOCK_NONBLOCK, scd_sock_path);
-	if (sock < 0) {
-		ERROR_ERRNO("Failed to connect to scd control socket %s", scd_sock_path);
-		return -1;
-	}
+	protobuf_conn_t *conn = crypto_conn_get();
+	IF_NULL_RETVAL(conn, -1);
 
-	TRACE("crypto_send_msg: connected to sock %d", sock);
-	event_io_t *event = event_io_new(sock, EVENT_IO_READ, crypto_cb, task);
-	event_add_io(event);
+	// 0 is skipped on wrap around, ids of long pending requests are not reused
+	do {
+		crypto_conn_request_id++;
+	} while (crypto_conn_request_id == 0 ||
+		 hashmap_contains(crypto_conn_tasks, HASHMAP_INT_KEY(crypto_conn_request_id)));
+
+	DaemonToToken msg = *out;
+	msg.has_request_id = true;
+	msg.request_id = crypto_conn_request_id;
 
 	/*
 	char *string = protobuf_c_text_to_string((ProtobufCMessage *) out, NULL);
@@ -385,11 +552,17 @@ crypto_send_msg(const DaemonToToken *out, crypto_callback_task_t *task)
 	mem_free0(string);
 	*/
 
-	if (protobuf_send_message(sock, (ProtobufCMessage *)out) < 0) {
-		event_remove_io(event);
-		event_io_free(event);
+	clock_gettime(CLOCK_MONOTONIC, &task->sent);
+	if (crypto_send_memfds(protobuf_conn_get_fd(conn), memfd_bufs, memfd_bufs_len) < 0 ||
+	    protobuf_conn_send_message(conn, (ProtobufCMessage *)&msg) < 0) {
+		ERROR("Failed to send crypto request %u to scd", msg.request_id);
+		// scd would hand memfds which were already passed to the next request
+		if (memfd_bufs_len)
+			crypto_conn_cb_close(conn, NULL);
 		return -1;
 	}
+	hashmap_put(crypto_conn_tasks, HASHMAP_INT_KEY(msg.request_id), task);
+
 	return 0;
 }
 
@@ -421,6 +594,276 @@ crypto_generic_send_msg(const DaemonToToken *out, int resp_fd)
 	return 0;
 }
 
+static int
+crypto_hash_send_scd(crypto_callback_task_t *task)
+{
+	ASSERT(task);
+
+	DaemonToToken out = DAEMON_TO_TOKEN__INIT;
+	out.has_hash_algo = true;
+	out.hash_algo = crypto_hashalgo_to_proto(task->hash_algo);
+	if (task->hash_file) {
+		out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_FILE;
+		out.hash_file = task->hash_file;
+		TRACE("Requesting scd to hash file at %s", task->hash_file);
+		return crypto_send_msg(&out, task, NULL, 0);
+	}
+
+	out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_MEMFD;
+	struct iovec buf = { .iov_base = task->hash_buf, .iov_len = task->hash_buf_len };
+	TRACE("Requesting scd to hash buffer of %zu bytes", task->hash_buf_len);
+
+	return crypto_send_msg(&out, task, &buf, 1);
+}
+
+/*
+ * Digests need no secrets, thus files and buffers are hashed by cmld itself using the
+ * kernel crypto API (AF_ALG), which avoids the round trip to scd. The hashing runs on
+ * the event_work pool and must not log. If the kernel lacks AF_ALG or the algorithm,
+ * the request is passed to scd instead.
+ */
+
+// returned by the local hash functions if the kernel cannot compute the digest
+#define CRYPTO_LOCAL_UNAVAILABLE (-EAFNOSUPPORT)
+
+static const char *
+crypto_hashalgo_to_kernel(crypto_hashalgo_t hashalgo)
+{
+	switch (hashalgo) {
+	case SHA1:
+		return "sha1";
+	case SHA256:
+		return "sha256";
+	case SHA512:
+		return "sha512";
+	default:
+		return NULL;
+	}
+}
+
+static size_t
+crypto_hashalgo_digest_len(crypto_hashalgo_t hashalgo)
+{
+	switch (hashalgo) {
+	case SHA1:
+		return 20;
+	case SHA256:
+		return 32;
+	case SHA512:
+		return 64;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Returns an AF_ALG operation socket for the algorithm or CRYPTO_LOCAL_UNAVAILABLE.
+ */
+static int
+crypto_local_open(crypto_hashalgo_t hashalgo)
+{
+	const char *name = crypto_hashalgo_to_kernel(hashalgo);
+	IF_NULL_RETVAL(name, CRYPTO_LOCAL_UNAVAILABLE);
+
+	struct sockaddr_alg sa = { .salg_family = AF_ALG };
+	strncpy((char *)sa.salg_type, "hash", sizeof(sa.salg_type));
+	strncpy((char *)sa.salg_name, name, sizeof(sa.salg_name) - 1);
+
+	int tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	IF_TRUE_RETVAL(tfm < 0, CRYPTO_LOCAL_UNAVAILABLE);
+
+	int op = -1;
+	if (bind(tfm, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+		op = accept(tfm, NULL, 0);
+	close(tfm);
+
+	if (op >= 0 && fcntl(op, F_SETFD, FD_CLOEXEC) < 0) {
+		close(op);
+		op = -1;
+	}
+
+	return op < 0 ? CRYPTO_LOCAL_UNAVAILABLE : op;
+}
+
+/*
+ * Passes len bytes of buf to the operation socket. Without MSG_MORE in flags, the
+ * digest is finalized after the data, which may be empty.
+ */
+static int
+crypto_local_send(int op, const void *buf, size_t len, int flags)
+{
+	do {
+		ssize_t n = send(op, buf, len, flags);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf = (const uint8_t *)buf + n;
+		len -= n;
+	} while (len > 0);
+
+	return 0;
+}
+
+static int
+crypto_local_finish(int op, crypto_hashalgo_t hashalgo, uint8_t *digest)
+{
+	int ret = crypto_local_send(op, NULL, 0, 0);
+	IF_TRUE_RETVAL(ret < 0, ret);
+
+	size_t len = crypto_hashalgo_digest_len(hashalgo);
+	ssize_t n;
+	do {
+		n = read(op, digest, len);
+	} while (n < 0 && errno == EINTR);
+
+	IF_TRUE_RETVAL(n < 0, -errno);
+	return (size_t)n == len ? 0 : -EIO;
+}
+
+/*
+ * Hashes the first len bytes of the file, or the whole file if len is negative, into
+ * digest. Runs on worker threads, thus does not log.
+ */
+static int
+crypto_local_hash_file(const char *file, off_t len, crypto_hashalgo_t hashalgo, uint8_t *digest)
+{
+	int op = crypto_local_open(hashalgo);
+	IF_TRUE_RETVAL(op < 0, op);
+
+	int ret = 0;
+	uint8_t *buf = NULL;
+	int fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ret = -errno;
+		goto out;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	buf = mem_alloc(CRYPTO_LOCAL_BUF_SIZE);
+	ssize_t n;
+	while (len != 0) {
+		size_t chunk = len < 0 ? CRYPTO_LOCAL_BUF_SIZE :
+					 (size_t)MIN(len, (off_t)CRYPTO_LOCAL_BUF_SIZE);
+		if ((n = read(fd, buf, chunk)) == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			goto out;
+		}
+		if ((ret = crypto_local_send(op, buf, n, MSG_MORE)) < 0)
+			goto out;
+		if (len > 0)
+			len -= n;
+	}
+	// the file is shorter than the requested length
+	if (len > 0) {
+		ret = -EIO;
+		goto out;
+	}
+
+	ret = crypto_local_finish(op, hashalgo, digest);
+out:
+	mem_free0(buf);
+	if (fd >= 0)
+		close(fd);
+	close(op);
+	return ret;
+}
+
+static int
+crypto_local_hash_buf(const uint8_t *buf, size_t len, crypto_hashalgo_t hashalgo,
+		      uint8_t *digest)
+{
+	int op = crypto_local_open(hashalgo);
+	IF_TRUE_RETVAL(op < 0, op);
+
+	int ret = len ? crypto_local_send(op, buf, len, MSG_MORE) : 0;
+	if (ret == 0)
+		ret = crypto_local_finish(op, hashalgo, digest);
+
+	close(op);
+	return ret;
+}
+
+/*
+ * Returns true if the kernel crypto API can be used, i.e., AF_ALG is available.
+ */
+static bool
+crypto_local_available(void)
+{
+	static int available = -1;
+
+	if (available < 0) {
+		int op = crypto_local_open(SHA256);
+		available = op >= 0;
+		if (available)
+			close(op);
+		else
+			INFO("Kernel crypto API not available, hashing is done by scd");
+	}
+	return available;
+}
+
+static int
+crypto_local_work(void *data)
+{
+	crypto_callback_task_t *task = data;
+
+	if (task->hash_file)
+		task->local_ret = crypto_local_hash_file(task->hash_file, -1, task->hash_algo,
+							 task->local_digest);
+	else
+		task->local_ret = crypto_local_hash_buf(task->hash_buf, task->hash_buf_len,
+							task->hash_algo, task->local_digest);
+	return task->local_ret;
+}
+
+static void
+crypto_local_done(int ret, void *data)
+{
+	crypto_callback_task_t *task = data;
+	ASSERT(task);
+
+	if (ret == CRYPTO_LOCAL_UNAVAILABLE) {
+		DEBUG("Kernel crypto API failed for algorithm %s, falling back to scd",
+		      crypto_hashalgo_to_kernel(task->hash_algo));
+		if (crypto_hash_send_scd(task) == 0)
+			return;
+	}
+
+	TokenToDaemon msg = TOKEN_TO_DAEMON__INIT;
+	if (ret == 0) {
+		msg.code = TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_OK;
+		msg.has_hash_value = true;
+		msg.hash_value.data = task->local_digest;
+		msg.hash_value.len = crypto_hashalgo_digest_len(task->hash_algo);
+	} else {
+		msg.code = TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_ERROR;
+		ERROR("Hashing %s failed: %s", task->hash_file ? task->hash_file : "buffer",
+		      strerror(-ret));
+	}
+
+	crypto_callback_task_complete(task, &msg);
+	crypto_callback_task_free(task);
+}
+
+/*
+ * Hashes the task in cmld if possible, otherwise by scd.
+ */
+static int
+crypto_hash_submit(crypto_callback_task_t *task)
+{
+	if (crypto_local_available() &&
+	    event_submit_work(crypto_local_work, crypto_local_done, task) == 0)
+		return 0;
+
+	return crypto_hash_send_scd(task);
+}
+
 int
 crypto_hash_file(const char *file, crypto_hashalgo_t hashalgo, crypto_hash_callback_t cb,
 		 void *data)
@@ -430,15 +873,7 @@ crypto_hash_file(const char *file, crypto_hashalgo_t hashalgo, crypto_hash_callb
 
 	crypto_callback_task_t *task = crypto_callback_hash_task_new(cb, data, file, hashalgo);
 
-	DaemonToToken out = DAEMON_TO_TOKEN__INIT;
-	out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_FILE;
-	out.has_hash_algo = true;
-	out.hash_algo = crypto_hashalgo_to_proto(hashalgo);
-	out.hash_file = task->hash_file;
-
-	TRACE("Requesting scd to hash file at %s", task->hash_file);
-
-	if (crypto_send_msg(&out, task) < 0) {
+	if (crypto_hash_submit(task) < 0) {
 		crypto_callback_task_free(task);
 		return -1;
 	}
@@ -455,16 +890,7 @@ crypto_hash_buf(const unsigned char *buf, size_t buf_len, crypto_hashalgo_t hash
 	crypto_callback_task_t *task =
 		crypto_callback_hash_buf_task_new(cb, data, buf, buf_len, hashalgo);
 
-	DaemonToToken out = DAEMON_TO_TOKEN__INIT;
-	out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_BUF;
-	out.has_hash_algo = true;
-	out.hash_algo = crypto_hashalgo_to_proto(hashalgo);
-	out.hash_buf.data = task->hash_buf;
-	out.hash_buf.len = task->hash_buf_len;
-
-	TRACE("Requesting scd to hash file at %s", task->hash_file);
-
-	if (crypto_send_msg(&out, task) < 0) {
+	if (crypto_hash_submit(task) < 0) {
 		crypto_callback_task_free(task);
 		return -1;
 	}
@@ -495,7 +921,7 @@ crypto_verify_file(const char *datafile, const char *sigfile, const char *certfi
 	out.has_verify_ignore_time = true;
 	out.verify_ignore_time = !cmld_is_device_provisioned() && !cmld_is_hostedmode_active();
 
-	if (crypto_send_msg(&out, task) < 0) {
+	if (crypto_send_msg(&out, task, NULL, 0) < 0) {
 		crypto_callback_task_free(task);
 		return -1;
 	}
@@ -517,16 +943,7 @@ crypto_verify_buf(unsigned char *data_buf, size_t data_buf_len, unsigned char *s
 						    sig_buf_len, cert_buf, cert_buf_len, hashalgo);
 
 	DaemonToToken out = DAEMON_TO_TOKEN__INIT;
-	out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_BUF;
-	out.has_verify_data_buf = true;
-	out.verify_data_buf.data = data_buf;
-	out.verify_data_buf.len = data_buf_len;
-	out.has_verify_sig_buf = true;
-	out.verify_sig_buf.data = sig_buf;
-	out.verify_sig_buf.len = sig_buf_len;
-	out.has_verify_cert_buf = true;
-	out.verify_cert_buf.data = cert_buf;
-	out.verify_cert_buf.len = cert_buf_len;
+	out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_MEMFD;
 	out.has_hash_algo = true;
 	out.hash_algo = crypto_hashalgo_to_proto(hashalgo);
 
@@ -534,49 +951,231 @@ crypto_verify_buf(unsigned char *data_buf, size_t data_buf_len, unsigned char *s
 	out.has_verify_ignore_time = true;
 	out.verify_ignore_time = !cmld_is_device_provisioned() && !cmld_is_hostedmode_active();
 
-	if (crypto_send_msg(&out, task) < 0) {
+	// in the order scd takes them: data, signature and certificate
+	struct iovec bufs[3] = {
+		{ .iov_base = task->verify_data_buf, .iov_len = data_buf_len },
+		{ .iov_base = task->verify_sig_buf, .iov_len = sig_buf_len },
+		{ .iov_base = task->verify_cert_buf, .iov_len = cert_buf_len },
+	};
+
+	if (crypto_send_msg(&out, task, bufs, 3) < 0) {
 		crypto_callback_task_free(task);
 		return -1;
 	}
 	return 0;
 }
 
-char *
-crypto_hash_file_block_new(const char *file, crypto_hashalgo_t hashalgo)
+static int
+crypto_hash_files_block_scd(const char *const *files, const off_t *lens,
+			    const crypto_hashalgo_t *hashalgos, digest_t *digests, size_t n)
 {
-	ASSERT(file);
-	char *ret = NULL;
+	for (size_t i = 0; i < n; i++)
+		digests[i].len = 0;
+	IF_TRUE_RETVAL(n == 0, 0);
 
-	DaemonToToken out = DAEMON_TO_TOKEN__INIT;
-	out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_FILE;
-	out.has_hash_algo = true;
-	out.hash_algo = crypto_hashalgo_to_proto(hashalgo);
-	out.hash_file = mem_strdup(file);
+	int sock = sock_unix_create_and_connect(SOCK_SEQPACKET, scd_sock_path);
+	if (sock < 0) {
+		ERROR_ERRNO("Failed to connect to scd control socket %s", scd_sock_path);
+		return -1;
+	}
 
-	TokenToDaemon *msg = crypto_send_recv_block(&out);
-	mem_free0(out.hash_file);
+	TRACE("crypto_hash_files_block: connected to sock %d, hashing %zu files", sock, n);
+
+	// scd hashes each request in its own worker, keep a few of them busy at once
+	size_t sent = 0, received = 0;
+	int ret = 0;
+	while (received < n) {
+		for (; sent < n && sent - received < CRYPTO_HASH_BLOCK_INFLIGHT; sent++) {
+			DaemonToToken out = DAEMON_TO_TOKEN__INIT;
+			out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_FILE;
+			out.has_hash_algo = true;
+			out.hash_algo = crypto_hashalgo_to_proto(hashalgos[sent]);
+			out.hash_file = (char *)files[sent];
+			if (lens && lens[sent] >= 0) {
+				out.has_hash_file_len = true;
+				out.hash_file_len = lens[sent];
+			}
+			out.has_request_id = true;
+			out.request_id = sent;
 
-	IF_NULL_RETVAL(msg, NULL);
+			if (protobuf_send_message(sock, (ProtobufCMessage *)&out) < 0) {
+				ERROR("Failed to send message to scd on sock %d", sock);
+				ret = -1;
+				goto out;
+			}
+		}
 
-	switch (msg->code) {
-	// deal with CRYPTO_HASH_* cases
-	case TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_OK:
-		if (msg->has_hash_value) {
-			ret = convert_bin_to_hex_new(msg->hash_value.data, msg->hash_value.len);
+		TokenToDaemon *msg =
+			(TokenToDaemon *)protobuf_recv_message(sock, &token_to_daemon__descriptor);
+		if (!msg) {
+			ERROR("Failed to receive hash from scd on sock %d", sock);
+			ret = -1;
+			goto out;
+		}
+		received++;
+
+		if (!msg->has_request_id || msg->request_id >= sent ||
+		    digest_is_set(&digests[msg->request_id])) {
+			ERROR("Invalid request id in reply of scd on sock %d", sock);
+			protobuf_free_message((ProtobufCMessage *)msg);
+			ret = -1;
+			goto out;
+		}
+
+		const char *file = files[msg->request_id];
+		switch (msg->code) {
+		case TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_OK:
+			if (!msg->has_hash_value) {
+				ERROR("Missing hash_value in CRYPTO_HASH_OK response for file %s",
+				      file);
+			} else if (digest_set(&digests[msg->request_id], msg->hash_value.data,
+					      msg->hash_value.len) < 0) {
+				ERROR("Invalid hash_value in CRYPTO_HASH_OK response for file %s",
+				      file);
+			}
+			break;
+		case TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_ERROR:
+			ERROR("Hashing file %s failed!", file);
+			break;
+		default:
+			ERROR("Invalid TokenToDaemon command %d when hashing file %s", msg->code,
+			      file);
+		}
+		protobuf_free_message((ProtobufCMessage *)msg);
+	}
+
+out:
+	close(sock);
+	return ret;
+}
+
+typedef struct crypto_local_batch {
+	const char *const *files;
+	const crypto_hashalgo_t *hashalgos;
+	digest_t *digests;
+	int *rets;
+	size_t n;
+	size_t next; // index of the next file to be hashed, taken atomically
+} crypto_local_batch_t;
+
+static void *
+crypto_local_batch_thread(void *data)
+{
+	crypto_local_batch_t *batch = data;
+
+	for (size_t i; (i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->n;)
+		batch->rets[i] = crypto_local_hash_file(batch->files[i], -1, batch->hashalgos[i],
+							batch->digests[i].data);
+
+	return NULL;
+}
+
+int
+crypto_hash_files_block(const char *const *files, const crypto_hashalgo_t *hashalgos,
+			digest_t *digests, size_t n)
+{
+	ASSERT(files);
+	ASSERT(hashalgos);
+	ASSERT(digests);
+
+	IF_TRUE_RETVAL(n == 0, 0);
+	if (!crypto_local_available())
+		return crypto_hash_files_block_scd(files, NULL, hashalgos, digests, n);
+
+	crypto_local_batch_t batch = {
+		.files = files,
+		.hashalgos = hashalgos,
+		.digests = digests,
+		.rets = mem_new0(int, n),
+		.n = n,
+		.next = 0,
+	};
+
+	// the calling thread hashes as well
+	pthread_t threads[CRYPTO_HASH_BLOCK_INFLIGHT - 1];
+	size_t nthreads = 0;
+	for (; nthreads < MIN(n, (size_t)CRYPTO_HASH_BLOCK_INFLIGHT) - 1; nthreads++) {
+		if (pthread_create(&threads[nthreads], NULL, crypto_local_batch_thread, &batch))
+			break;
+	}
+	crypto_local_batch_thread(&batch);
+	for (size_t t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	// files the kernel could not hash are passed to scd
+	const char **scd_files = mem_new0(const char *, n);
+	crypto_hashalgo_t *scd_hashalgos = mem_new0(crypto_hashalgo_t, n);
+	digest_t *scd_digests = mem_new0(digest_t, n);
+	size_t *scd_index = mem_new0(size_t, n);
+	size_t m = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		digests[i].len = 0;
+		if (batch.rets[i] == 0) {
+			digests[i].len = crypto_hashalgo_digest_len(hashalgos[i]);
+		} else if (batch.rets[i] == CRYPTO_LOCAL_UNAVAILABLE) {
+			scd_files[m] = files[i];
+			scd_hashalgos[m] = hashalgos[i];
+			scd_index[m++] = i;
 		} else {
-			ERROR("Missing hash_value in CRYPTO_HASH_OK response for file %s", file);
+			ERROR("Hashing file %s failed: %s", files[i], strerror(-batch.rets[i]));
 		}
-		break;
-	case TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_ERROR:
-		ERROR("Hashing file %s failed!", file);
-		break;
-	default:
-		ERROR("Invalid TokenToDaemon command %d when hashing file %s", msg->code, file);
 	}
-	protobuf_free_message((ProtobufCMessage *)msg);
+
+	int ret = crypto_hash_files_block_scd(scd_files, NULL, scd_hashalgos, scd_digests, m);
+	for (size_t j = 0; j < m; j++)
+		digests[scd_index[j]] = scd_digests[j];
+
+	mem_free0(scd_index);
+	mem_free0(scd_digests);
+	mem_free0(scd_hashalgos);
+	mem_free0(scd_files);
+	mem_free0(batch.rets);
 	return ret;
 }
 
+int
+crypto_hash_file_block(const char *file, crypto_hashalgo_t hashalgo, digest_t *digest)
+{
+	ASSERT(file);
+	ASSERT(digest);
+
+	crypto_hash_files_block(&file, &hashalgo, digest, 1);
+	return digest_is_set(digest) ? 0 : -1;
+}
+
+int
+crypto_hash_file_len_block(const char *file, off_t len, crypto_hashalgo_t hashalgo,
+			   digest_t *digest)
+{
+	ASSERT(file);
+	ASSERT(digest);
+
+	digest->len = 0;
+	if (crypto_local_available()) {
+		int ret = crypto_local_hash_file(file, len, hashalgo, digest->data);
+		if (ret == 0) {
+			digest->len = crypto_hashalgo_digest_len(hashalgo);
+			return 0;
+		}
+		if (ret != CRYPTO_LOCAL_UNAVAILABLE) {
+			ERROR("Hashing file %s failed: %s", file, strerror(-ret));
+			return -1;
+		}
+	}
+
+	crypto_hash_files_block_scd(&file, &len, &hashalgo, digest, 1);
+	return digest_is_set(digest) ? 0 : -1;
+}
+
+char *
+crypto_hash_file_block_new(const char *file, crypto_hashalgo_t hashalgo)
+{
+	digest_t digest;
+	IF_TRUE_RETVAL(crypto_hash_file_block(file, hashalgo, &digest) < 0, NULL);
+	return digest_to_hex_new(&digest);
+}
+
 crypto_verify_result_t
 crypto_verify_file_block(const char *datafile, const char *sigfile, const char *certfile,
 			 crypto_hashalgo_t hashalgo)
@@ -623,54 +1222,249 @@ crypto_verify_file_block(const char *datafile, const char *sigfile, const char *
 	return ret;
 }
 
-crypto_verify_result_t
-crypto_verify_buf_block(unsigned char *data_buf, size_t data_buf_len, unsigned char *sig_buf,
-			size_t sig_buf_len, unsigned char *cert_buf, size_t cert_buf_len,
-			crypto_hashalgo_t hashalgo)
+/*
+ * Successful verifications of buffers are cached by a SHA-256 over the lengths and the
+ * contents of data, signature and certificate, the hash algorithm and the time check
+ * mode. Thus, an identical config signed by the same certificate is verified by scd
+ * only once within CRYPTO_VERIFY_CACHE_TTL, which matches the caching in scd. Failures
+ * are never cached. Used by the main thread only.
+ */
+typedef struct crypto_verify_cache_entry {
+	uint8_t key[CRYPTO_LOCAL_DIGEST_MAX];
+	crypto_verify_result_t result;
+	time_t expires; // CLOCK_MONOTONIC
+} crypto_verify_cache_entry_t;
+
+static crypto_verify_cache_entry_t crypto_verify_cache[CRYPTO_VERIFY_CACHE_MAX];
+static size_t crypto_verify_cache_len = 0;
+static size_t crypto_verify_cache_next = 0; // entry to be replaced next if full
+
+static time_t
+crypto_verify_cache_now(void)
 {
-	ASSERT(data_buf);
-	ASSERT(sig_buf);
-	ASSERT(cert_buf);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
 
-	crypto_verify_result_t ret = VERIFY_ERROR;
+/*
+ * Computes the cache key of the request in cmld. Returns 0 on success, a negative
+ * value if the kernel crypto API is not available.
+ */
+static int
+crypto_verify_cache_key(const crypto_verify_buf_req_t *req, bool ignore_time, uint8_t *key)
+{
+	IF_FALSE_RETVAL(crypto_local_available(), CRYPTO_LOCAL_UNAVAILABLE);
+
+	int op = crypto_local_open(SHA256);
+	IF_TRUE_RETVAL(op < 0, op);
+
+	uint64_t hdr[5] = { req->data_buf_len, req->sig_buf_len, req->cert_buf_len,
+			    req->hashalgo, ignore_time };
+	int ret = crypto_local_send(op, hdr, sizeof(hdr), MSG_MORE);
+	if (ret == 0 && req->data_buf_len)
+		ret = crypto_local_send(op, req->data_buf, req->data_buf_len, MSG_MORE);
+	if (ret == 0 && req->sig_buf_len)
+		ret = crypto_local_send(op, req->sig_buf, req->sig_buf_len, MSG_MORE);
+	if (ret == 0 && req->cert_buf_len)
+		ret = crypto_local_send(op, req->cert_buf, req->cert_buf_len, MSG_MORE);
+	if (ret == 0)
+		ret = crypto_local_finish(op, SHA256, key);
+
+	close(op);
+	return ret;
+}
 
-	DaemonToToken out = DAEMON_TO_TOKEN__INIT;
-	out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_BUF;
-	out.has_verify_data_buf = true;
-	out.verify_data_buf.data = data_buf;
-	out.verify_data_buf.len = data_buf_len;
-	out.has_verify_sig_buf = true;
-	out.verify_sig_buf.data = sig_buf;
-	out.verify_sig_buf.len = sig_buf_len;
-	out.has_verify_cert_buf = true;
-	out.verify_cert_buf.data = cert_buf;
-	out.verify_cert_buf.len = cert_buf_len;
-	out.has_hash_algo = true;
-	out.hash_algo = crypto_hashalgo_to_proto(hashalgo);
+static bool
+crypto_verify_cache_lookup(const uint8_t *key, crypto_verify_result_t *result)
+{
+	size_t len = crypto_hashalgo_digest_len(SHA256);
+	time_t now = crypto_verify_cache_now();
+
+	for (size_t i = 0; i < crypto_verify_cache_len; i++) {
+		crypto_verify_cache_entry_t *entry = &crypto_verify_cache[i];
+		if (entry->expires > now && !memcmp(entry->key, key, len)) {
+			*result = entry->result;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+crypto_verify_cache_store(const uint8_t *key, crypto_verify_result_t result)
+{
+	IF_FALSE_RETURN(result == VERIFY_GOOD || result == VERIFY_LOCALLY_SIGNED);
+
+	crypto_verify_cache_entry_t *entry;
+	if (crypto_verify_cache_len < CRYPTO_VERIFY_CACHE_MAX) {
+		entry = &crypto_verify_cache[crypto_verify_cache_len++];
+	} else {
+		entry = &crypto_verify_cache[crypto_verify_cache_next];
+		crypto_verify_cache_next = (crypto_verify_cache_next + 1) % CRYPTO_VERIFY_CACHE_MAX;
+	}
+	memcpy(entry->key, key, crypto_hashalgo_digest_len(SHA256));
+	entry->result = result;
+	entry->expires = crypto_verify_cache_now() + CRYPTO_VERIFY_CACHE_TTL;
+}
+
+void
+crypto_verify_cache_flush(void)
+{
+	TRACE("Dropping %zu cached verification results", crypto_verify_cache_len);
+	crypto_verify_cache_len = 0;
+	crypto_verify_cache_next = 0;
+}
+
+/*
+ * Verifies the requests listed in index by scd over one connection, keeping a few
+ * of them in flight, so scd verifies them concurrently.
+ */
+static int
+crypto_verify_bufs_block_scd(const crypto_verify_buf_req_t *reqs, const size_t *index, size_t n,
+			     bool ignore_time, crypto_verify_result_t *results)
+{
+	IF_TRUE_RETVAL(n == 0, 0);
+
+	int sock = sock_unix_create_and_connect(SOCK_SEQPACKET, scd_sock_path);
+	if (sock < 0) {
+		ERROR_ERRNO("Failed to connect to scd control socket %s", scd_sock_path);
+		return -1;
+	}
+
+	TRACE("crypto_verify_bufs_block: connected to sock %d, verifying %zu buffers", sock, n);
+
+	bool *done = mem_new0(bool, n);
+	size_t sent = 0, received = 0;
+	int ret = 0;
+	while (received < n) {
+		for (; sent < n && sent - received < CRYPTO_HASH_BLOCK_INFLIGHT; sent++) {
+			const crypto_verify_buf_req_t *req = &reqs[index[sent]];
+			DaemonToToken out = DAEMON_TO_TOKEN__INIT;
+			out.code = DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_MEMFD;
+			out.has_hash_algo = true;
+			out.hash_algo = crypto_hashalgo_to_proto(req->hashalgo);
+			out.has_verify_ignore_time = true;
+			out.verify_ignore_time = ignore_time;
+			out.has_request_id = true;
+			out.request_id = sent;
+
+			struct iovec bufs[3] = {
+				{ .iov_base = req->data_buf, .iov_len = req->data_buf_len },
+				{ .iov_base = req->sig_buf, .iov_len = req->sig_buf_len },
+				{ .iov_base = req->cert_buf, .iov_len = req->cert_buf_len },
+			};
+			if (crypto_send_memfds(sock, bufs, 3) < 0 ||
+			    protobuf_send_message(sock, (ProtobufCMessage *)&out) < 0) {
+				ERROR("Failed to send message to scd on sock %d", sock);
+				ret = -1;
+				goto out;
+			}
+		}
+
+		TokenToDaemon *msg =
+			(TokenToDaemon *)protobuf_recv_message(sock, &token_to_daemon__descriptor);
+		if (!msg) {
+			ERROR("Failed to receive verify result from scd on sock %d", sock);
+			ret = -1;
+			goto out;
+		}
+		received++;
+
+		if (!msg->has_request_id || msg->request_id >= sent || done[msg->request_id]) {
+			ERROR("Invalid request id in reply of scd on sock %d", sock);
+			protobuf_free_message((ProtobufCMessage *)msg);
+			ret = -1;
+			goto out;
+		}
+		done[msg->request_id] = true;
+
+		switch (msg->code) {
+		// deal with CRYPTO_VERIFY_* cases
+		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_GOOD:
+		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_ERROR:
+		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_BAD_SIGNATURE:
+		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_BAD_CERTIFICATE:
+		case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_LOCALLY_SIGNED:
+			results[index[msg->request_id]] =
+				crypto_verify_result_from_proto(msg->code);
+			break;
+		default:
+			ERROR("Invalid TokenToDaemon command %d when verifying buffer", msg->code);
+		}
+		protobuf_free_message((ProtobufCMessage *)msg);
+	}
+
+out:
+	mem_free0(done);
+	close(sock);
+	return ret;
+}
+
+int
+crypto_verify_bufs_block(const crypto_verify_buf_req_t *reqs, crypto_verify_result_t *results,
+			 size_t n)
+{
+	ASSERT(reqs);
+	ASSERT(results);
+
+	IF_TRUE_RETVAL(n == 0, 0);
 
 	// disable certificate time check if not yet provisioned
-	out.has_verify_ignore_time = true;
-	out.verify_ignore_time = !cmld_is_device_provisioned() && !cmld_is_hostedmode_active();
+	bool ignore_time = !cmld_is_device_provisioned() && !cmld_is_hostedmode_active();
+
+	uint8_t (*keys)[CRYPTO_LOCAL_DIGEST_MAX] = mem_alloc0(n * CRYPTO_LOCAL_DIGEST_MAX);
+	bool *has_key = mem_new0(bool, n);
+	size_t *index = mem_new0(size_t, n);
+	size_t m = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		ASSERT(reqs[i].data_buf);
+		ASSERT(reqs[i].sig_buf);
+		ASSERT(reqs[i].cert_buf);
+
+		results[i] = VERIFY_ERROR;
+		has_key[i] = crypto_verify_cache_key(&reqs[i], ignore_time, keys[i]) == 0;
+		if (has_key[i] && crypto_verify_cache_lookup(keys[i], &results[i])) {
+			TRACE("Reusing cached verification result %d of buffer", results[i]);
+			continue;
+		}
+		index[m++] = i;
+	}
 
-	TokenToDaemon *msg = crypto_send_recv_block(&out);
-	IF_NULL_RETVAL(msg, VERIFY_ERROR);
+	int ret = crypto_verify_bufs_block_scd(reqs, index, m, ignore_time, results);
 
-	switch (msg->code) {
-	// deal with CRYPTO_VERIFY_* cases
-	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_GOOD:
-	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_ERROR:
-	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_BAD_SIGNATURE:
-	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_BAD_CERTIFICATE:
-	case TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_LOCALLY_SIGNED:
-		ret = crypto_verify_result_from_proto(msg->code);
-		break;
-	default:
-		ERROR("Invalid TokenToDaemon command %d when verifying buffer", msg->code);
+	for (size_t j = 0; j < m; j++) {
+		if (has_key[index[j]])
+			crypto_verify_cache_store(keys[index[j]], results[index[j]]);
 	}
-	protobuf_free_message((ProtobufCMessage *)msg);
+
+	mem_free0(index);
+	mem_free0(has_key);
+	mem_free0(keys);
 	return ret;
 }
 
+crypto_verify_result_t
+crypto_verify_buf_block(unsigned char *data_buf, size_t data_buf_len, unsigned char *sig_buf,
+			size_t sig_buf_len, unsigned char *cert_buf, size_t cert_buf_len,
+			crypto_hashalgo_t hashalgo)
+{
+	crypto_verify_buf_req_t req = {
+		.data_buf = data_buf,
+		.data_buf_len = data_buf_len,
+		.sig_buf = sig_buf,
+		.sig_buf_len = sig_buf_len,
+		.cert_buf = cert_buf,
+		.cert_buf_len = cert_buf_len,
+		.hashalgo = hashalgo,
+	};
+	crypto_verify_result_t result = VERIFY_ERROR;
+
+	crypto_verify_bufs_block(&req, &result, 1);
+	return result;
+}
+
 bool
 crypto_match_hash(size_t hash_len, const char *expected_hash, const char *hash)
 {
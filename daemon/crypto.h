@@ -26,6 +26,10 @@
 
 #include "stdbool.h"
 
+#include "common/digest.h"
+
+#include <sys/types.h>
+
 /**
  * Choice of supported hash algorithms.
  */
@@ -75,11 +79,52 @@ crypto_hash_buf(const unsigned char *buf, size_t buf_len, crypto_hashalgo_t hash
  *
  * @param file the file to hash
  * @param hashalgo the hash algorithm to use
+ * @param digest receives the hash value, unset on error
+ * @return 0 on success, -1 on error
+ */
+int
+crypto_hash_file_block(const char *file, crypto_hashalgo_t hashalgo, digest_t *digest);
+
+/**
+ * Like crypto_hash_file_block(), but only hashes the first len bytes of the file, e.g.,
+ * of a partition which is larger than the image flashed to it. A file shorter than len
+ * fails to hash.
+ *
+ * @param file the file to hash
+ * @param len the number of bytes to hash, or -1 to hash the whole file
+ * @param hashalgo the hash algorithm to use
+ * @param digest receives the hash value, unset on error
+ * @return 0 on success, -1 on error
+ */
+int
+crypto_hash_file_len_block(const char *file, off_t len, crypto_hashalgo_t hashalgo,
+			   digest_t *digest);
+
+/**
+ * Like crypto_hash_file_block(), but returns the hash as hex string, e.g. to be used
+ * as file name.
+ *
  * @return pointer to a newly allocated string with the hash value, or NULL on error
  */
 char *
 crypto_hash_file_block_new(const char *file, crypto_hashalgo_t hashalgo);
 
+/**
+ * Requests the scd to hash all given files and waits for the results. The files are
+ * hashed concurrently by scd, thus this is faster than hashing them one after another.
+ * On error, digests already computed are kept in the digests array.
+ *
+ * @param files the files to hash
+ * @param hashalgos the hash algorithm to use for each file
+ * @param digests array which receives the hash value of each file, left unset if
+ *	  hashing the file failed
+ * @param n the number of files
+ * @return 0 if a reply was received for each file, -1 otherwise
+ */
+int
+crypto_hash_files_block(const char *const *files, const crypto_hashalgo_t *hashalgos,
+			digest_t *digests, size_t n);
+
 /**
  * Result of a signature verification.
  */
@@ -174,6 +219,42 @@ crypto_verify_result_t
 crypto_verify_buf_block(unsigned char *data_buf, size_t data_buf_len, unsigned char *sig_buf,
 			size_t sig_buf_len, unsigned char *cert_buf, size_t cert_buf_len,
 			crypto_hashalgo_t hashalgo);
+
+/**
+ * A signed buffer to be verified by crypto_verify_bufs_block().
+ */
+typedef struct crypto_verify_buf_req {
+	unsigned char *data_buf;
+	size_t data_buf_len;
+	unsigned char *sig_buf;
+	size_t sig_buf_len;
+	unsigned char *cert_buf;
+	size_t cert_buf_len;
+	crypto_hashalgo_t hashalgo;
+} crypto_verify_buf_req_t;
+
+/**
+ * Verifies the signatures of a batch of buffers like crypto_verify_buf_block(), but
+ * lets scd verify several of them concurrently. Waits for all results.
+ *
+ * Successful results are cached for a few minutes by the contents of the buffers,
+ * so an identical buffer signed by the same certificate is not verified by scd
+ * again. crypto_verify_buf_block() shares this cache.
+ *
+ * @param reqs the buffers to be verified
+ * @param results array of n entries which receives the result of each request
+ * @param n the number of requests
+ * @return 0 if all requests were handled, -1 if the communication with scd failed
+ */
+int
+crypto_verify_bufs_block(const crypto_verify_buf_req_t *reqs, crypto_verify_result_t *results,
+			 size_t n);
+
+/**
+ * Drops all cached verification results, e.g., after the trusted CAs changed.
+ */
+void
+crypto_verify_cache_flush(void);
 /**
  * Checks whether the certificate is not null, of sufficient length and
  * of correct PEM format.
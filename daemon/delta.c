@@ -0,0 +1,222 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "delta.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/event.h"
+#include "common/fd.h"
+
+#include <sys/wait.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DELTA_MAGIC "CMLDELT1"
+#define DELTA_HEADER_SIZE 24
+#define DELTA_RECORD_SIZE 16
+#define DELTA_COPY_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef struct {
+	char *out_file;
+	delta_callback_t on_complete;
+	void *data;
+} delta_t;
+
+static uint32_t
+delta_get_be32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return be32toh(v);
+}
+
+static uint64_t
+delta_get_be64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return be64toh(v);
+}
+
+/**
+ * Copies len bytes from the current offset or, if in_off is not NULL, from *in_off
+ * of in_fd to offset out_off of out_fd.
+ */
+static int
+delta_copy(int in_fd, off_t *in_off, int out_fd, off_t out_off, uint64_t len)
+{
+	if (lseek(out_fd, out_off, SEEK_SET) < 0)
+		return -1;
+
+	while (len > 0) {
+		ssize_t n = sendfile(out_fd, in_fd, in_off, MIN(len, DELTA_COPY_CHUNK_SIZE));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n == 0)
+			errno = ENODATA; // premature end of input
+		if (n <= 0)
+			return -1;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Applies the delta in a blocking manner, see delta.h for the format.
+ */
+static int
+delta_apply_block(const char *base_file, const char *delta_file, const char *out_file)
+{
+	uint8_t buf[DELTA_HEADER_SIZE];
+	struct stat base_st;
+	int ret = -1;
+	int out_fd = -1;
+
+	int base_fd = open(base_file, O_RDONLY | O_CLOEXEC);
+	int delta_fd = open(delta_file, O_RDONLY | O_CLOEXEC);
+	if (base_fd < 0 || delta_fd < 0 || fstat(base_fd, &base_st) < 0) {
+		ERROR_ERRNO("Could not open %s or %s", base_file, delta_file);
+		goto out;
+	}
+
+	if (fd_read(delta_fd, (char *)buf, DELTA_HEADER_SIZE) != DELTA_HEADER_SIZE ||
+	    memcmp(buf, DELTA_MAGIC, strlen(DELTA_MAGIC))) {
+		ERROR("Invalid delta header in %s", delta_file);
+		goto out;
+	}
+	uint64_t bs = delta_get_be32(buf + 8);
+	uint64_t target_size = delta_get_be64(buf + 16);
+	if (bs == 0) {
+		ERROR("Invalid block size in %s", delta_file);
+		goto out;
+	}
+
+	out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	// blocks of zeroes remain holes and are not written
+	if (out_fd < 0 || ftruncate(out_fd, target_size) < 0) {
+		ERROR_ERRNO("Could not create %s", out_file);
+		goto out;
+	}
+
+	for (uint64_t off = 0; off < target_size;) {
+		if (fd_read(delta_fd, (char *)buf, DELTA_RECORD_SIZE) != DELTA_RECORD_SIZE) {
+			ERROR("Truncated delta %s", delta_file);
+			goto out;
+		}
+		uint8_t op = buf[0];
+		uint64_t count = delta_get_be32(buf + 4);
+		uint64_t base_block = delta_get_be64(buf + 8);
+		if (count == 0 || count > (target_size - off + bs - 1) / bs) {
+			ERROR("Invalid delta record at offset %" PRIu64, off);
+			goto out;
+		}
+		uint64_t len = MIN(count * bs, target_size - off);
+
+		if (op == 'C') {
+			off_t base_off = base_block * bs;
+			if (base_block > (uint64_t)base_st.st_size / bs ||
+			    (uint64_t)base_off + len > (uint64_t)base_st.st_size) {
+				ERROR("Delta refers to blocks outside of %s", base_file);
+				goto out;
+			}
+			if (delta_copy(base_fd, &base_off, out_fd, off, len) < 0) {
+				ERROR_ERRNO("Could not copy blocks from %s", base_file);
+				goto out;
+			}
+		} else if (op == 'D') {
+			if (delta_copy(delta_fd, NULL, out_fd, off, len) < 0) {
+				ERROR_ERRNO("Could not copy data blocks from %s", delta_file);
+				goto out;
+			}
+		} else if (op != 'Z') {
+			ERROR("Invalid delta record type 0x%02x", op);
+			goto out;
+		}
+		off += len;
+	}
+
+	ret = 0;
+out:
+	if (out_fd >= 0)
+		close(out_fd);
+	if (delta_fd >= 0)
+		close(delta_fd);
+	if (base_fd >= 0)
+		close(base_fd);
+	if (ret < 0)
+		unlink(out_file);
+	return ret;
+}
+
+static void
+delta_child_cb(pid_t pid, int status, event_child_t *child, void *data)
+{
+	delta_t *delta = data;
+	ASSERT(delta);
+
+	bool success = WIFEXITED(status) && !WEXITSTATUS(status);
+	DEBUG("Delta child (PID=%d) %s", pid, success ? "succeeded" : "failed");
+
+	event_child_free(child);
+	if (!success)
+		unlink(delta->out_file);
+
+	delta->on_complete(success, delta->data);
+	mem_free0(delta->out_file);
+	mem_free0(delta);
+}
+
+int
+delta_apply(const char *base_file, const char *delta_file, const char *out_file,
+	    delta_callback_t on_complete, void *data)
+{
+	ASSERT(base_file && delta_file && out_file && on_complete);
+
+	pid_t pid = fork();
+	switch (pid) {
+	case -1:
+		ERROR_ERRNO("Could not fork to apply delta %s", delta_file);
+		return -1;
+	case 0:
+		INFO("Applying delta %s to %s -> %s", delta_file, base_file, out_file);
+		_exit(delta_apply_block(base_file, delta_file, out_file) < 0 ? 1 : 0);
+	default: {
+		delta_t *delta = mem_new0(delta_t, 1);
+		delta->out_file = mem_strdup(out_file);
+		delta->on_complete = on_complete;
+		delta->data = data;
+		event_child_t *child = event_child_new(pid, delta_child_cb, delta);
+		event_add_child(child);
+		return 0;
+	}
+	}
+}
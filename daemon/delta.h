@@ -0,0 +1,70 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#ifndef DELTA_H
+#define DELTA_H
+
+/**
+ * @file delta.h Applies block-level deltas of guestos images.
+ *
+ * A delta describes the new version of an image in terms of an installed base
+ * version of it, so that only the changed blocks need to be downloaded.
+ * All numbers are big endian. The delta consists of the header
+ *
+ *	char magic[8] = "CMLDELT1";
+ *	uint32_t block_size;
+ *	uint32_t reserved;
+ *	uint64_t target_size;
+ *
+ * followed by records which describe the blocks of the target image in order
+ *
+ *	uint8_t op;		// 'C' copy from base, 'D' data follows, 'Z' zeroes
+ *	uint8_t reserved[3];
+ *	uint32_t count;		// number of blocks
+ *	uint64_t base_block;	// first block in the base image, only for 'C'
+ *
+ * A 'D' record is followed by count blocks of data, the last block of the target
+ * may be truncated to target_size. The delta is not trusted; the resulting image
+ * has to be verified by the caller, e.g. against the signed guestos config.
+ * Deltas are generated by scripts/mkdelta.py.
+ */
+
+#include <stdbool.h>
+
+/**
+ * Callback type for functions called after a delta has been applied.
+ */
+typedef void (*delta_callback_t)(bool success, void *data);
+
+/**
+ * Creates out_file from base_file and delta_file in a child process and calls the
+ * given callback once it completed, passing the data parameter.
+ * out_file is removed if the delta could not be applied.
+ * @return 0 if the child has been started sucessfully, -1 otherwise
+ */
+int
+delta_apply(const char *base_file, const char *delta_file, const char *out_file,
+	    delta_callback_t on_complete, void *data);
+
+#endif // DELTA_H
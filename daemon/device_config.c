@@ -24,6 +24,8 @@
 #include "device_config.h"
 #include "device.pb-c.h"
 
+#include "container.h"
+
 #include "common/macro.h"
 #include "common/file.h"
 #include "common/mem.h"
@@ -50,8 +52,8 @@ device_config_new(const char *path)
 		file = mem_strdup(path);
 		DEBUG("Loading device config from \"%s\".", file);
 
-		cfg = (DeviceConfig *)protobuf_message_new_from_textfile(
-			file, &device_config__descriptor);
+		cfg = (DeviceConfig *)protobuf_message_new_from_textfile_cached(
+			file, NULL, &device_config__descriptor);
 		if (!cfg) {
 #ifdef CC_MODE
 			FATAL("Failed loading device config from file \"%s\" in CC Mode.", file);
@@ -188,6 +190,228 @@ device_config_get_update_base_url(const device_config_t *config)
 	return config->cfg->update_base_url;
 }
 
+uint32_t
+device_config_get_guestos_download_jobs(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->guestos_download_jobs;
+}
+
+bool
+device_config_get_loop_direct_io(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->loop_direct_io;
+}
+
+bool
+device_config_get_integrity_journal(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->integrity_journal;
+}
+
+bool
+device_config_get_crypt_no_read_workqueue(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->crypt_no_read_workqueue;
+}
+
+bool
+device_config_get_crypt_no_write_workqueue(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->crypt_no_write_workqueue;
+}
+
+bool
+device_config_get_crypt_same_cpu_crypt(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->crypt_same_cpu_crypt;
+}
+
+bool
+device_config_get_crypt_submit_from_crypt_cpus(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->crypt_submit_from_crypt_cpus;
+}
+
+uint32_t
+device_config_get_crypt_sector_size(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->crypt_sector_size;
+}
+
+bool
+device_config_get_integrity_lazy_init(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->integrity_lazy_init;
+}
+
+bool
+device_config_get_crypt_inline_encryption(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->crypt_inline_encryption;
+}
+
+bool
+device_config_get_boot_profile(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->boot_profile;
+}
+
+uint32_t
+device_config_get_boot_parallelism(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->boot_parallelism;
+}
+
+uint32_t
+device_config_get_volume_keep_time(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->volume_keep_time;
+}
+
+uint32_t
+device_config_get_memory_reclaim_idle_time(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->memory_reclaim_idle_time;
+}
+
+uint32_t
+device_config_get_telemetry_interval(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->telemetry_interval;
+}
+
+uint32_t
+device_config_get_cpuset_rebalance_interval(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->cpuset_rebalance_interval;
+}
+
+bool
+device_config_get_firewall_nftables(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->firewall_nftables;
+}
+
+bool
+device_config_get_mac_filter_xdp(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->mac_filter_xdp;
+}
+
+uint32_t
+device_config_get_device_stats_interval(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->device_stats_interval;
+}
+
+bool
+device_config_get_metrics_socket(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->metrics_socket;
+}
+
+const char *
+device_config_get_metrics_file(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->metrics_file;
+}
+
+list_t *
+device_config_get_net_tuning_list_new(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	list_t *tuning_list = NULL;
+	for (size_t i = 0; i < config->cfg->n_net_tuning_profiles; i++) {
+		const NetTuningProfile *profile = config->cfg->net_tuning_profiles[i];
+		container_net_tuning_t *tuning = mem_new0(container_net_tuning_t, 1);
+
+		tuning->name = mem_strdup(profile->name);
+		for (size_t j = 0; j < profile->n_sysctl; j++) {
+			char *sysctl = mem_strdup(profile->sysctl[j]);
+			tuning->sysctls = list_append(tuning->sysctls, sysctl);
+		}
+		tuning->veth_queues = profile->veth_queues;
+		tuning->veth_gro = profile->veth_gro;
+
+		tuning_list = list_append(tuning_list, tuning);
+	}
+	return tuning_list;
+}
+
+uint32_t
+device_config_get_metrics_interval(const device_config_t *config)
+{
+	ASSERT(config);
+	ASSERT(config->cfg);
+
+	return config->cfg->metrics_interval;
+}
+
 const char *
 device_config_get_host_addr(const device_config_t *config)
 {
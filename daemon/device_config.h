@@ -31,6 +31,8 @@
 #ifndef DEVICE_H
 #define DEVICE_H
 
+#include "common/list.h"
+
 #include <sys/types.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -62,6 +64,79 @@ device_config_get_update_base_url(const device_config_t *config);
 const char *
 device_config_get_c0os(const device_config_t *config);
 
+uint32_t
+device_config_get_guestos_download_jobs(const device_config_t *config);
+
+bool
+device_config_get_loop_direct_io(const device_config_t *config);
+
+bool
+device_config_get_integrity_journal(const device_config_t *config);
+
+bool
+device_config_get_crypt_no_read_workqueue(const device_config_t *config);
+
+bool
+device_config_get_crypt_no_write_workqueue(const device_config_t *config);
+
+bool
+device_config_get_crypt_same_cpu_crypt(const device_config_t *config);
+
+bool
+device_config_get_crypt_submit_from_crypt_cpus(const device_config_t *config);
+
+uint32_t
+device_config_get_crypt_sector_size(const device_config_t *config);
+
+bool
+device_config_get_integrity_lazy_init(const device_config_t *config);
+
+bool
+device_config_get_crypt_inline_encryption(const device_config_t *config);
+
+bool
+device_config_get_boot_profile(const device_config_t *config);
+
+uint32_t
+device_config_get_boot_parallelism(const device_config_t *config);
+
+uint32_t
+device_config_get_volume_keep_time(const device_config_t *config);
+
+uint32_t
+device_config_get_memory_reclaim_idle_time(const device_config_t *config);
+
+uint32_t
+device_config_get_telemetry_interval(const device_config_t *config);
+
+uint32_t
+device_config_get_cpuset_rebalance_interval(const device_config_t *config);
+
+bool
+device_config_get_firewall_nftables(const device_config_t *config);
+
+bool
+device_config_get_mac_filter_xdp(const device_config_t *config);
+
+uint32_t
+device_config_get_device_stats_interval(const device_config_t *config);
+
+bool
+device_config_get_metrics_socket(const device_config_t *config);
+
+const char *
+device_config_get_metrics_file(const device_config_t *config);
+
+/**
+ * Returns a newly allocated list of the net tuning profiles as container_net_tuning_t,
+ * which are freed by container_net_tuning_free().
+ */
+list_t *
+device_config_get_net_tuning_list_new(const device_config_t *config);
+
+uint32_t
+device_config_get_metrics_interval(const device_config_t *config);
+
 const char *
 device_config_get_host_addr(const device_config_t *config);
 
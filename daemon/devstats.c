@@ -0,0 +1,144 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#define _GNU_SOURCE
+
+#include "devstats.h"
+
+#include "cmld.h"
+#include "container.h"
+#include "mount.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/file.h"
+#include "common/proc.h"
+#include "common/uuid.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static devstats_t devstats = { 0 };
+static bool devstats_valid = false;
+static uint64_t devstats_interval_ms = 0;
+static int devstats_meminfo_fd = -1;
+
+static uint64_t
+devstats_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+devstats_sample_container(container_t *container, void *data)
+{
+	size_t *max = data;
+	IF_TRUE_RETURN(devstats.containers_n >= *max);
+
+	devstats_container_t *c = &devstats.containers[devstats.containers_n++];
+	strncpy(c->uuid, uuid_string(container_get_uuid(container)), DEVSTATS_UUID_STRLEN - 1);
+	c->uuid[DEVSTATS_UUID_STRLEN - 1] = '\0';
+
+	const mount_t *mnt = container_get_mnt(container);
+	c->disk_usage = mnt ? mount_get_disk_usage_container(mnt) : -1;
+}
+
+static void
+devstats_refresh(void)
+{
+	const char *cmld_dir = cmld_get_cmld_dir();
+	const char *containers_dir = cmld_get_containers_dir();
+
+	devstats.timestamp_ms = devstats_now_ms();
+
+	if (file_disk_space_stat(cmld_dir, &devstats.disk_system, &devstats.disk_system_free,
+				 &devstats.disk_system_used) < 0) {
+		WARN_ERRNO("Could not get disk space of %s", cmld_dir);
+		devstats.disk_system = devstats.disk_system_free = devstats.disk_system_used = -1;
+	}
+
+	devstats.has_disk_containers = !file_on_same_fs(cmld_dir, containers_dir);
+	if (devstats.has_disk_containers &&
+	    file_disk_space_stat(containers_dir, &devstats.disk_containers,
+				 &devstats.disk_containers_free, &devstats.disk_containers_used) < 0) {
+		WARN_ERRNO("Could not get disk space of %s", containers_dir);
+		devstats.disk_containers = devstats.disk_containers_free =
+			devstats.disk_containers_used = -1;
+	}
+
+	proc_meminfo_t *meminfo = proc_meminfo_new_from_fd(devstats_meminfo_fd);
+	devstats.has_mem = meminfo != NULL;
+	if (meminfo) {
+		devstats.mem_total = proc_get_mem_total(meminfo);
+		devstats.mem_free = proc_get_mem_free(meminfo);
+		devstats.mem_available = proc_get_mem_available(meminfo);
+		proc_meminfo_free(meminfo);
+	}
+
+	int count = cmld_containers_get_count();
+	size_t max = count > 0 ? (size_t)count : 0;
+	mem_free0(devstats.containers);
+	devstats.containers = max ? mem_new0(devstats_container_t, max) : NULL;
+	devstats.containers_n = 0;
+	cmld_containers_foreach(&devstats_sample_container, &max);
+
+	devstats_valid = true;
+}
+
+int
+devstats_init(unsigned int interval)
+{
+	devstats_meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+	IF_TRUE_RETVAL_ERROR_ERRNO(devstats_meminfo_fd < 0, -1);
+
+	devstats_interval_ms = (uint64_t)interval * 1000;
+	devstats_valid = false;
+
+	return 0;
+}
+
+void
+devstats_cleanup(void)
+{
+	if (devstats_meminfo_fd >= 0)
+		close(devstats_meminfo_fd);
+	devstats_meminfo_fd = -1;
+
+	mem_free0(devstats.containers);
+	devstats.containers_n = 0;
+	devstats_valid = false;
+}
+
+const devstats_t *
+devstats_get(void)
+{
+	if (!devstats_valid || devstats_now_ms() - devstats.timestamp_ms >= devstats_interval_ms)
+		devstats_refresh();
+
+	return &devstats;
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * Cached snapshot of the device statistics served by GET_DEVICE_STATS. Each refresh does
+ * one statvfs() per file system, a pread() of /proc/meminfo through a kept open file
+ * descriptor and sums up the disk usage of the images of each container. The snapshot is
+ * refreshed on access once it is older than the configured interval.
+ */
+
+#ifndef DEVSTATS_H
+#define DEVSTATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* length of the string representation of a uuid, including the terminating null */
+#define DEVSTATS_UUID_STRLEN 37
+
+typedef struct devstats_container {
+	char uuid[DEVSTATS_UUID_STRLEN];
+	off_t disk_usage; // maximum disk usage of the images, -1 if unknown
+} devstats_container_t;
+
+typedef struct devstats {
+	uint64_t timestamp_ms; // monotonic time of the refresh
+
+	off_t disk_system;
+	off_t disk_system_free;
+	off_t disk_system_used;
+
+	// set if the containers are stored on a file system of their own
+	bool has_disk_containers;
+	off_t disk_containers;
+	off_t disk_containers_free;
+	off_t disk_containers_used;
+
+	bool has_mem;
+	ssize_t mem_total;
+	ssize_t mem_free;
+	ssize_t mem_available;
+
+	devstats_container_t *containers;
+	size_t containers_n;
+} devstats_t;
+
+/**
+ * Sets up the snapshot to be refreshed at most each interval seconds, an interval of 0
+ * refreshes it on each access.
+ *
+ * @return 0 on success, -1 on error
+ */
+int
+devstats_init(unsigned int interval);
+
+void
+devstats_cleanup(void);
+
+/**
+ * Returns the current snapshot, refreshing it first if it is older than the interval.
+ * The snapshot stays valid until the next call.
+ */
+const devstats_t *
+devstats_get(void);
+
+#endif /* DEVSTATS_H */
@@ -29,17 +29,22 @@
 #include "common/file.h"
 
 #include <sys/wait.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
 
 #define WGET_PATH "wget"
-#define DL_COPY_BUF_SIZE sysconf(_SC_PAGESIZE)
+// partially downloaded data is kept across attempts, its size is the resume offset
+#define DL_PARTIAL_SUFFIX ".part"
+#define DL_COPY_CHUNK_SIZE (4 * 1024 * 1024)
 
 struct download {
 	char *url;
 	char *file;
+	char *part_file;
 	download_callback_t on_complete;
 	void *data;
 	pid_t wget_pid;
@@ -51,6 +56,7 @@ download_new(const char *url, const char *file, download_callback_t on_complete,
 	download_t *dl = mem_new(download_t, 1);
 	dl->url = mem_strdup(url);
 	dl->file = mem_strdup(file);
+	dl->part_file = mem_printf("%s%s", file, DL_PARTIAL_SUFFIX);
 	dl->on_complete = on_complete;
 	dl->data = data;
 	return dl;
@@ -62,54 +68,93 @@ download_free(download_t *dl)
 	IF_NULL_RETURN(dl);
 	mem_free0(dl->url);
 	mem_free0(dl->file);
+	mem_free0(dl->part_file);
 	mem_free0(dl);
 }
 
 static void
-download_sigchld_cb(UNUSED int signum, event_signal_t *sig, void *data)
+download_child_cb(pid_t pid, int status, event_child_t *child, void *data)
 {
 	download_t *dl = data;
 	ASSERT(dl);
-	pid_t wget_pid = dl->wget_pid;
-	pid_t pid = 0;
-	int status = 0;
-	DEBUG("SIGCHLD handler called for wget (PID=%d)", wget_pid);
-	if (wget_pid <= 0) {
-		DEBUG("wget PID not yet set; returning");
-		return;
+	bool success = false;
+
+	DEBUG("Child event called for wget (PID=%d)", pid);
+	if (WIFEXITED(status)) {
+		DEBUG("wget terminated with status=%d", WEXITSTATUS(status));
+		success = !WEXITSTATUS(status);
+	} else if (WIFSIGNALED(status)) {
+		DEBUG("wget killed by signal %d", WTERMSIG(status));
+	} else {
+		WARN("Could not get exit status of wget (PID=%d)", pid);
 	}
-	bool remove = false;
-	while ((pid = waitpid(wget_pid, &status, WNOHANG))) {
-		if (pid == wget_pid) {
-			bool success = false;
-			if (WIFEXITED(status)) {
-				DEBUG("wget terminated with status=%d", WEXITSTATUS(status));
-				success = !WEXITSTATUS(status);
-			} else if (WIFSIGNALED(status)) {
-				DEBUG("wget killed by signal %d", WTERMSIG(status));
-			} else {
-				continue;
-			}
-			remove = true;
-			dl->on_complete(dl, success, dl->data);
-		} else if (pid == 0) {
-			DEBUG("waitpid child(ren) (PID %d) exist without state change", wget_pid);
-			break;
-		} else if (pid == -1) {
-			if (errno == ECHILD)
-				DEBUG("Process group of wget terminated completely");
-			else
-				WARN_ERRNO("waitpid failed for wget");
-			remove = true;
-			break;
-		} else {
-			DEBUG("Reaped a child with PID %d for wget", pid);
+
+	event_child_free(child);
+
+	if (success && rename(dl->part_file, dl->file) < 0) {
+		ERROR_ERRNO("Could not move %s to %s", dl->part_file, dl->file);
+		success = false;
+	}
+	if (!success && file_exists(dl->part_file))
+		INFO("Keeping %zd bytes of %s to resume the download", file_size(dl->part_file),
+		     dl->url);
+
+	dl->on_complete(dl, success, dl->data);
+}
+
+/**
+ * Appends the part of src which is missing in dst, i.e., resumes a previously
+ * interrupted copy of src to dst. Runs in the download child.
+ */
+static int
+download_copy_resume(const char *src, const char *dst)
+{
+	int ret = -1;
+	struct stat st;
+
+	int in_fd = open(src, O_RDONLY | O_CLOEXEC);
+	if (in_fd < 0) {
+		ERROR_ERRNO("Could not open %s", src);
+		return -1;
+	}
+	int out_fd = open(dst, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+	if (out_fd < 0) {
+		ERROR_ERRNO("Could not open %s", dst);
+		close(in_fd);
+		return -1;
+	}
+	if (fstat(in_fd, &st) < 0) {
+		ERROR_ERRNO("Could not stat %s", src);
+		goto out;
+	}
+
+	off_t off = lseek(out_fd, 0, SEEK_END);
+	if (off < 0 || off > st.st_size) {
+		// does not belong to src, start over
+		if (ftruncate(out_fd, 0) < 0 || lseek(out_fd, 0, SEEK_SET) < 0) {
+			ERROR_ERRNO("Could not truncate %s", dst);
+			goto out;
 		}
+		off = 0;
+	} else if (off > 0) {
+		INFO("Resuming copy of %s at offset %lld", src, (long long)off);
 	}
-	if (remove) {
-		event_remove_signal(sig);
-		event_signal_free(sig);
+
+	while (off < st.st_size) {
+		size_t len = MIN(st.st_size - off, DL_COPY_CHUNK_SIZE);
+		ssize_t n = sendfile(out_fd, in_fd, &off, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			ERROR_ERRNO("Could not copy %s to %s", src, dst);
+			goto out;
+		}
 	}
+	ret = 0;
+out:
+	close(out_fd);
+	close(in_fd);
+	return ret;
 }
 
 int
@@ -118,7 +163,8 @@ download_start(download_t *dl)
 	ASSERT(dl);
 	pid_t pid = fork();
 
-	char *const argv[] = { WGET_PATH, "-O", dl->file, dl->url, NULL };
+	// continue a partial download with an HTTP range request
+	char *const argv[] = { WGET_PATH, "-c", "-O", dl->part_file, dl->url, NULL };
 	bool do_file_copy = strlen(dl->url) > 7 && !strncmp(dl->url, "file://", 7);
 
 	switch (pid) {
@@ -129,8 +175,8 @@ download_start(download_t *dl)
 	case 0: {
 		if (do_file_copy) {
 			char *local_dl_src = dl->url + 7;
-			INFO("Copying file from %s -> %s", local_dl_src, dl->file);
-			int ret = file_copy(local_dl_src, dl->file, -1, DL_COPY_BUF_SIZE, 0);
+			INFO("Copying file from %s -> %s", local_dl_src, dl->part_file);
+			int ret = download_copy_resume(local_dl_src, dl->part_file);
 			if (ret < 0)
 				ERROR("Failed retrieving '%s'!", dl->url);
 			_exit(ret);
@@ -144,8 +190,8 @@ download_start(download_t *dl)
 		DEBUG("Started download helper (%s) with PID %d",
 		      do_file_copy ? "file_copy" : "wget", pid);
 		dl->wget_pid = pid;
-		event_signal_t *sig = event_signal_new(SIGCHLD, download_sigchld_cb, dl);
-		event_add_signal(sig);
+		event_child_t *child = event_child_new(pid, download_child_cb, dl);
+		event_add_child(child);
 		return 0;
 	}
 }
@@ -27,6 +27,8 @@
 /**
  * @file downloader.h Defines an API to download files.
  * Uses 'wget' for now to do the actual work.
+ * Data is downloaded to '<file>.part' first, which is kept if a download fails, so
+ * that the next attempt resumes at its end instead of starting over.
  */
 
 #include <stdbool.h>
@@ -0,0 +1,357 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "exporter.h"
+
+#include "audit.h"
+#include "cmld.h"
+#include "container.h"
+#include "devstats.h"
+#include "telemetry.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/metrics.h"
+#include "common/event.h"
+#include "common/uuid.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+// interval in ms of the timer which measures the lag of the event loop
+#define EXPORTER_LAG_INTERVAL 1000
+
+static metrics_server_t *exporter_server = NULL;
+static char *exporter_file = NULL;
+static event_timer_t *exporter_file_timer = NULL;
+
+static event_timer_t *exporter_lag_timer = NULL;
+static struct timespec exporter_lag_expected;
+static metrics_t *exporter_lag_metrics = NULL;
+
+static metrics_collector_t *exporter_collector = NULL;
+static telemetry_subscriber_t *exporter_subscriber = NULL;
+static telemetry_sample_t *exporter_samples = NULL; // latest sample of each container
+static size_t exporter_samples_n = 0;
+
+static const double exporter_lag_buckets[] = { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5 };
+
+static const char *exporter_state_names[] = {
+	[COMPARTMENT_STATE_STOPPED] = "stopped",
+	[COMPARTMENT_STATE_STARTING] = "starting",
+	[COMPARTMENT_STATE_BOOTING] = "booting",
+	[COMPARTMENT_STATE_RUNNING] = "running",
+	[COMPARTMENT_STATE_FREEZING] = "freezing",
+	[COMPARTMENT_STATE_FROZEN] = "frozen",
+	[COMPARTMENT_STATE_ZOMBIE] = "zombie",
+	[COMPARTMENT_STATE_SHUTTING_DOWN] = "shutting_down",
+	[COMPARTMENT_STATE_SETUP] = "setup",
+	[COMPARTMENT_STATE_REBOOTING] = "rebooting",
+};
+
+static void
+exporter_timespec_add_ms(struct timespec *ts, long ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+/*
+ * The lag of the loop is the delay of the expiry of a timer against its due time,
+ * i.e., the time for which other callbacks kept the loop busy.
+ */
+static void
+exporter_lag_cb(UNUSED event_timer_t *timer, UNUSED void *data)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	double lag = (now.tv_sec - exporter_lag_expected.tv_sec) +
+		     (now.tv_nsec - exporter_lag_expected.tv_nsec) / 1e9;
+	metrics_histogram_observe(exporter_lag_metrics, lag > 0 ? lag : 0);
+
+	exporter_lag_expected = now;
+	exporter_timespec_add_ms(&exporter_lag_expected, EXPORTER_LAG_INTERVAL);
+}
+
+static void
+exporter_telemetry_cb(const telemetry_sample_t *samples, size_t n, UNUSED void *data)
+{
+	if (exporter_samples)
+		mem_free0(exporter_samples);
+	exporter_samples = n ? mem_new0(telemetry_sample_t, n) : NULL;
+	if (n)
+		memcpy(exporter_samples, samples, n * sizeof(telemetry_sample_t));
+	exporter_samples_n = n;
+}
+
+static void
+exporter_collect_container_state(container_t *container, void *data)
+{
+	unsigned *count = data;
+	compartment_state_t state = container_get_state(container);
+
+	if ((size_t)state < ELEMENTSOF(exporter_state_names))
+		count[state]++;
+}
+
+static void
+exporter_collect_containers(str_t *out)
+{
+	unsigned count[ELEMENTSOF(exporter_state_names)] = { 0 };
+	cmld_containers_foreach(exporter_collect_container_state, count);
+
+	metrics_format_header(out, "cml_containers", METRICS_GAUGE, "Containers per state");
+	for (size_t i = 0; i < ELEMENTSOF(exporter_state_names); i++) {
+		if (!exporter_state_names[i])
+			continue;
+		char *labels = mem_printf("state=\"%s\"", exporter_state_names[i]);
+		metrics_format_value(out, "cml_containers", labels, count[i]);
+		mem_free0(labels);
+	}
+}
+
+typedef struct {
+	const char *name;
+	const char *help;
+	metrics_type_t type;
+	const char *labels; // additional labels of the series
+	size_t offset;	    // of the value in container_usage_t
+	double scale;
+} exporter_usage_t;
+
+// clang-format off
+static const exporter_usage_t exporter_usage[] = {
+	{ "cml_container_cpu_seconds_total", "Cpu time used by the container", METRICS_COUNTER,
+	  NULL, offsetof(container_usage_t, cpu_usage_us), 1e-6 },
+	{ "cml_container_cpu_throttled_seconds_total", "Time the container was throttled",
+	  METRICS_COUNTER, NULL, offsetof(container_usage_t, cpu_throttled_us), 1e-6 },
+	{ "cml_container_memory_bytes", "Memory used by the container", METRICS_GAUGE,
+	  NULL, offsetof(container_usage_t, memory_current), 1 },
+	{ "cml_container_io_bytes_total", "Bytes read and written by the container",
+	  METRICS_COUNTER, "op=\"read\"", offsetof(container_usage_t, io_read_bytes), 1 },
+	{ "cml_container_io_bytes_total", NULL, METRICS_COUNTER, "op=\"write\"",
+	  offsetof(container_usage_t, io_write_bytes), 1 },
+	{ "cml_container_network_bytes_total", "Bytes received and sent by the container",
+	  METRICS_COUNTER, "direction=\"rx\"", offsetof(container_usage_t, net_rx_bytes), 1 },
+	{ "cml_container_network_bytes_total", NULL, METRICS_COUNTER, "direction=\"tx\"",
+	  offsetof(container_usage_t, net_tx_bytes), 1 },
+};
+// clang-format on
+
+static void
+exporter_collect_usage(str_t *out)
+{
+	for (size_t u = 0; u < ELEMENTSOF(exporter_usage); u++) {
+		const exporter_usage_t *usage = &exporter_usage[u];
+		// series of the same family follow their first entry
+		if (usage->help)
+			metrics_format_header(out, usage->name, usage->type, usage->help);
+
+		for (size_t i = 0; i < exporter_samples_n; i++) {
+			const telemetry_sample_t *s = &exporter_samples[i];
+			uint64_t value;
+			memcpy(&value, (const uint8_t *)&s->usage + usage->offset, sizeof(value));
+
+			char *labels = usage->labels ?
+					       mem_printf("container=\"%s\",%s", s->uuid,
+							  usage->labels) :
+					       mem_printf("container=\"%s\"", s->uuid);
+			metrics_format_value(out, usage->name, labels, value * usage->scale);
+			mem_free0(labels);
+		}
+	}
+}
+
+typedef struct {
+	str_t *out;
+	bool stored; // write the stored bytes, otherwise the queued records
+} exporter_audit_t;
+
+static void
+exporter_collect_audit_cb(const char *uuid, uint64_t stored, unsigned queued, void *data)
+{
+	exporter_audit_t *audit = data;
+
+	char *labels = mem_printf("container=\"%s\"", uuid);
+	if (audit->stored)
+		metrics_format_value(audit->out, "cml_audit_stored_bytes", labels, stored);
+	else
+		metrics_format_value(audit->out, "cml_audit_queued_records", labels, queued);
+	mem_free0(labels);
+}
+
+static void
+exporter_collect_audit(str_t *out)
+{
+	exporter_audit_t audit = { .out = out, .stored = true };
+
+	metrics_format_header(out, "cml_audit_stored_bytes", METRICS_GAUGE,
+			      "Audit records stored until acknowledged by the container");
+	audit_foreach_queue(exporter_collect_audit_cb, &audit);
+
+	audit.stored = false;
+	metrics_format_header(out, "cml_audit_queued_records", METRICS_GAUGE,
+			      "Audit records queued in memory for delivery to the container");
+	audit_foreach_queue(exporter_collect_audit_cb, &audit);
+}
+
+static void
+exporter_collect_mem(str_t *out)
+{
+	IF_FALSE_RETURN_TRACE(mem_stats_is_enabled());
+
+	size_t len = 0;
+	uint64_t live = 0, peak = 0, allocs = 0;
+	mem_stats_site_t *sites = mem_stats_get(&len, &live, &peak);
+	for (size_t i = 0; i < len; i++)
+		allocs += sites[i].alloc_count;
+	if (sites)
+		mem_free0(sites);
+
+	metrics_format_header(out, "cml_mem_live_bytes", METRICS_GAUGE, "Bytes allocated by cmld");
+	metrics_format_value(out, "cml_mem_live_bytes", NULL, live);
+	metrics_format_header(out, "cml_mem_peak_bytes", METRICS_GAUGE,
+			      "High-water mark of the bytes allocated by cmld");
+	metrics_format_value(out, "cml_mem_peak_bytes", NULL, peak);
+	metrics_format_header(out, "cml_mem_allocations_total", METRICS_COUNTER,
+			      "Allocations of cmld");
+	metrics_format_value(out, "cml_mem_allocations_total", NULL, allocs);
+}
+
+static void
+exporter_collect_disk(str_t *out)
+{
+	const devstats_t *stats = devstats_get();
+
+	metrics_format_header(out, "cml_disk_free_bytes", METRICS_GAUGE,
+			      "Free space of the file systems of cmld");
+	metrics_format_value(out, "cml_disk_free_bytes", "fs=\"system\"", stats->disk_system_free);
+	if (stats->has_disk_containers)
+		metrics_format_value(out, "cml_disk_free_bytes", "fs=\"containers\"",
+				     stats->disk_containers_free);
+
+	if (stats->has_mem) {
+		metrics_format_header(out, "cml_mem_available_bytes", METRICS_GAUGE,
+				      "Memory available on the device");
+		metrics_format_value(out, "cml_mem_available_bytes", NULL, stats->mem_available);
+	}
+}
+
+static void
+exporter_collect(str_t *out, UNUSED void *data)
+{
+	exporter_collect_containers(out);
+	exporter_collect_usage(out);
+	exporter_collect_audit(out);
+	exporter_collect_mem(out);
+	exporter_collect_disk(out);
+}
+
+static void
+exporter_file_cb(UNUSED event_timer_t *timer, UNUSED void *data)
+{
+	metrics_export_file(exporter_file);
+}
+
+int
+exporter_init(const char *socket, const char *file, unsigned int interval)
+{
+	if (!socket && !(file && *file)) {
+		INFO("Neither a metrics socket nor a file is configured, metrics are not exported");
+		return 0;
+	}
+
+	if (socket) {
+		exporter_server = metrics_server_new(socket);
+		IF_NULL_RETVAL_ERROR(exporter_server, -1);
+	}
+
+	exporter_lag_metrics = metrics_histogram_new("cml_event_loop_lag_seconds", NULL,
+						     "Delay of the timers of the event loop of cmld",
+						     exporter_lag_buckets,
+						     ELEMENTSOF(exporter_lag_buckets));
+	clock_gettime(CLOCK_MONOTONIC, &exporter_lag_expected);
+	exporter_timespec_add_ms(&exporter_lag_expected, EXPORTER_LAG_INTERVAL);
+	exporter_lag_timer = event_timer_new(EXPORTER_LAG_INTERVAL, EVENT_TIMER_REPEAT_FOREVER,
+					     exporter_lag_cb, NULL);
+	event_add_timer(exporter_lag_timer);
+
+	exporter_collector = metrics_collector_new(exporter_collect, NULL);
+	if (telemetry_is_active())
+		exporter_subscriber = telemetry_subscribe(exporter_telemetry_cb, NULL);
+	else
+		INFO("Telemetry is disabled, the resource usage of the containers is not exported");
+
+	if (file && *file) {
+		exporter_file = mem_strdup(file);
+		exporter_file_timer = event_timer_new(MAX(interval, 1u) * 1000,
+						      EVENT_TIMER_REPEAT_FOREVER, exporter_file_cb,
+						      NULL);
+		event_add_timer(exporter_file_timer);
+	}
+
+	return 0;
+}
+
+void
+exporter_cleanup(void)
+{
+	if (exporter_file_timer) {
+		event_remove_timer(exporter_file_timer);
+		event_timer_free(exporter_file_timer);
+		exporter_file_timer = NULL;
+	}
+	if (exporter_file)
+		mem_free0(exporter_file);
+	if (exporter_server) {
+		metrics_server_free(exporter_server);
+		exporter_server = NULL;
+	}
+	if (exporter_subscriber) {
+		telemetry_unsubscribe(exporter_subscriber);
+		exporter_subscriber = NULL;
+	}
+	if (exporter_samples)
+		mem_free0(exporter_samples);
+	exporter_samples_n = 0;
+	if (exporter_collector) {
+		metrics_collector_free(exporter_collector);
+		exporter_collector = NULL;
+	}
+	if (exporter_lag_timer) {
+		event_remove_timer(exporter_lag_timer);
+		event_timer_free(exporter_lag_timer);
+		exporter_lag_timer = NULL;
+	}
+	if (exporter_lag_metrics) {
+		metrics_free(exporter_lag_metrics);
+		exporter_lag_metrics = NULL;
+	}
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * Exports the metrics of cmld in the Prometheus text format, see common/metrics.h, on a
+ * unix socket and/or to a file which is rewritten each interval. Besides the metrics
+ * registered by the modules, e.g., the start times of the containers or the round trip
+ * times of scd and tpm2d, the exporter collects the containers per state, the lag of the
+ * event loop, the depth of the audit queues, the allocation statistics, the disk usage
+ * and the latest resource usage of each container sampled by the telemetry module.
+ */
+
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+/**
+ * Starts the export.
+ *
+ * @param socket path of the unix socket to be served, NULL for no socket
+ * @param file path of the file to be written, NULL or "" for no file
+ * @param interval interval in seconds in which the file is written
+ * @return 0 on success or if neither a socket nor a file is given, -1 on error
+ */
+int
+exporter_init(const char *socket, const char *file, unsigned int interval);
+
+void
+exporter_cleanup(void);
+
+#endif /* EXPORTER_H */
@@ -25,6 +25,9 @@
 #include "guestos_config.h"
 
 #include "download.h"
+#include "delta.h"
+#include "purge.h"
+#include "guestos_mgr.h"
 #include "cmld.h"
 #include "crypto.h"
 #include "tss.h"
@@ -33,14 +36,18 @@
 #include "common/mem.h"
 #include "common/dir.h"
 #include "common/file.h"
+#include "common/hashmap.h"
 #include "common/sock.h"
+#include "common/fsverity.h"
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <time.h>
 
 struct guestos {
 	char *dir;			       ///< directory where the guest OS'es files are stored
@@ -55,12 +62,14 @@ struct guestos {
 
 	char *rollback_dir;    ///< directory where flashed image locations are backuped
 	bool partialy_flashed; ///< indicates that at least one image of type flash made it to disk
+
+	hashmap_t *image_checks; ///< in-flight checks by image name, see guestos_verify_mount_image
 };
 
 #define GUESTOS_MAX_DOWNLOAD_ATTEMPTS 3
+#define GUESTOS_DELTA_PATCH_SUFFIX ".patch" // image being created from a delta
 #define GUESTOS_FLASHED_FILE "flash_complete" // TODO check contents of partitions instead!
-#define GUESTOS_FLASH_BLOCKSIZE 512	      // blocksize in bytes for flashing partitions
-#define GUESTOS_VERIFY_BLOCKSIZE 4096	      // blocksize in bytes for verifying partitions
+#define GUESTOS_FLASH_BLOCKSIZE 512	      // blocksize in bytes for partition backups
 
 #define GUESTOS_FLASH_BACKUP_DIR "os_update_bak"
 
@@ -137,6 +146,7 @@ guestos_new_internal(guestos_config_t *cfg, const char *basepath)
 	os->downloading = false;
 	os->partialy_flashed = false;
 	os->complete = false;
+	os->image_checks = hashmap_new_str();
 	return os;
 }
 
@@ -184,11 +194,249 @@ guestos_free(guestos_t *os)
 	mem_free0(os->cfg_file);
 	mem_free0(os->dir);
 	guestos_config_free(os->cfg);
+	hashmap_free(os->image_checks);
 	mem_free0(os);
 }
 
 /******************************************************************************/
 
+/*
+ * Image hashes which have been computed by scd, keyed by image path. An entry is only
+ * used as long as the file still has the same identity, size and modification and
+ * change time as when it was hashed, so unchanged images are not read again on each
+ * thorough check. The ctime cannot be set from user space, thus rewriting an image and
+ * restoring its mtime still invalidates the entry.
+ */
+typedef struct guestos_hash_cache_entry {
+	char *img_path;
+	struct stat st; ///< state of the image file before it was hashed
+	digest_t sha1;
+	digest_t sha256;
+} guestos_hash_cache_entry_t;
+
+static hashmap_t *guestos_hash_cache = NULL;
+
+static bool
+guestos_hash_cache_stat_equal(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+	       a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+	       a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+	       a->st_ctim.tv_sec == b->st_ctim.tv_sec && a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+static void
+guestos_hash_cache_remove(const char *img_path)
+{
+	IF_NULL_RETURN(guestos_hash_cache);
+
+	guestos_hash_cache_entry_t *entry = hashmap_remove(guestos_hash_cache, img_path);
+	IF_NULL_RETURN(entry);
+
+	mem_free0(entry->img_path);
+	mem_free0(entry);
+}
+
+/*
+ * Copies the cached hash of the image to digest. Returns false if there is none or if
+ * the image was modified since it was hashed. st is the current state of the image.
+ */
+static bool
+guestos_hash_cache_get(const char *img_path, const struct stat *st, crypto_hashalgo_t algo,
+		       digest_t *digest)
+{
+	digest->len = 0;
+	IF_NULL_RETVAL(guestos_hash_cache, false);
+
+	guestos_hash_cache_entry_t *entry = hashmap_get(guestos_hash_cache, img_path);
+	IF_NULL_RETVAL(entry, false);
+
+	if (!guestos_hash_cache_stat_equal(&entry->st, st)) {
+		DEBUG("Image %s changed since it was hashed, dropping cached hashes", img_path);
+		guestos_hash_cache_remove(img_path);
+		return false;
+	}
+
+	if (algo == SHA1)
+		*digest = entry->sha1;
+	else if (algo == SHA256)
+		*digest = entry->sha256;
+	return digest_is_set(digest);
+}
+
+/*
+ * Stores the hash of the image which was computed from the state st.
+ */
+static void
+guestos_hash_cache_put(const char *img_path, const struct stat *st, crypto_hashalgo_t algo,
+		       const digest_t *digest)
+{
+	IF_FALSE_RETURN(digest_is_set(digest));
+	IF_TRUE_RETURN(algo != SHA1 && algo != SHA256);
+
+	/*
+	 * Timestamps have a coarse granularity, a write directly after the stat may leave
+	 * them unchanged. Images which were just modified are therefore not cached.
+	 */
+	struct timespec now;
+	if (clock_gettime(CLOCK_REALTIME, &now) < 0 || now.tv_sec <= st->st_ctim.tv_sec + 1) {
+		TRACE("Image %s was modified recently, not caching its hash", img_path);
+		return;
+	}
+
+	if (!guestos_hash_cache)
+		guestos_hash_cache = hashmap_new_str();
+
+	guestos_hash_cache_entry_t *entry = hashmap_get(guestos_hash_cache, img_path);
+	if (entry && !guestos_hash_cache_stat_equal(&entry->st, st)) {
+		guestos_hash_cache_remove(img_path);
+		entry = NULL;
+	}
+	if (!entry) {
+		entry = mem_new0(guestos_hash_cache_entry_t, 1);
+		entry->img_path = mem_strdup(img_path);
+		entry->st = *st;
+		hashmap_put(guestos_hash_cache, entry->img_path, entry);
+	}
+
+	if (algo == SHA1)
+		entry->sha1 = *digest;
+	else
+		entry->sha256 = *digest;
+}
+
+/*
+ * Hashes the image by scd in a blocking manner unless a valid cached hash exists.
+ */
+static void
+guestos_hash_image_block(const char *img_path, crypto_hashalgo_t algo, digest_t *digest)
+{
+	struct stat st;
+	if (stat(img_path, &st) < 0) {
+		guestos_hash_cache_remove(img_path);
+		crypto_hash_file_block(img_path, algo, digest);
+		return;
+	}
+
+	if (guestos_hash_cache_get(img_path, &st, algo, digest)) {
+		DEBUG("Using cached hash of unchanged image %s", img_path);
+		return;
+	}
+
+	crypto_hash_file_block(img_path, algo, digest);
+	guestos_hash_cache_put(img_path, &st, algo, digest);
+}
+
+/*
+ * Hashes all images, which have no valid cached hash, concurrently by scd and waits for
+ * the results. digests[i] is left unset on error.
+ */
+static void
+guestos_hash_images_block(const char *const *img_paths, const crypto_hashalgo_t *algos,
+			  digest_t *digests, size_t n)
+{
+	struct stat *st = mem_new0(struct stat, n);
+	bool *valid_st = mem_new0(bool, n);
+	const char **files = mem_new0(const char *, n);
+	crypto_hashalgo_t *file_algos = mem_new0(crypto_hashalgo_t, n);
+	size_t *index = mem_new0(size_t, n);
+	digest_t *file_digests = mem_new0(digest_t, n);
+	size_t m = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		digests[i].len = 0;
+		valid_st[i] = stat(img_paths[i], &st[i]) == 0;
+		if (!valid_st[i])
+			guestos_hash_cache_remove(img_paths[i]);
+		else if (guestos_hash_cache_get(img_paths[i], &st[i], algos[i], &digests[i])) {
+			DEBUG("Using cached hash of unchanged image %s", img_paths[i]);
+			continue;
+		}
+		files[m] = img_paths[i];
+		file_algos[m] = algos[i];
+		index[m++] = i;
+	}
+
+	crypto_hash_files_block(files, file_algos, file_digests, m);
+
+	for (size_t j = 0; j < m; j++) {
+		size_t i = index[j];
+		digests[i] = file_digests[j];
+		if (valid_st[i])
+			guestos_hash_cache_put(img_paths[i], &st[i], algos[i], &digests[i]);
+	}
+
+	mem_free0(file_digests);
+	mem_free0(index);
+	mem_free0(file_algos);
+	mem_free0(files);
+	mem_free0(valid_st);
+	mem_free0(st);
+}
+
+/******************************************************************************/
+
+/*
+ * Checks the image by its fs-verity digest, which the kernel provides without reading
+ * the image. Matching digests are appended to the measurement log.
+ *
+ * @return true if the check was possible, i.e., the signed config provides the fs-verity
+ *	   digest of the image and fs-verity is enabled for it, with the result in match
+ */
+static bool
+guestos_mount_image_check_fsverity(const mount_entry_t *e, char *img_path, bool *match)
+{
+	digest_t digest;
+
+	IF_NULL_RETVAL(mount_entry_get_fsverity_sha256(e), false);
+	IF_TRUE_RETVAL(fsverity_measure(img_path, &digest) < 0, false);
+
+	DEBUG("Checking image %s by its fs-verity digest", img_path);
+	*match = mount_entry_match_fsverity_sha256(e, &digest);
+	if (*match)
+		tss_ml_append(img_path, digest.data, digest.len, TSS_SHA256, NULL, NULL);
+	return true;
+}
+
+static void *
+guestos_mount_image_enable_fsverity_main(void *data)
+{
+	char *img_path = data;
+
+	if (fsverity_enable(img_path) < 0)
+		DEBUG("fs-verity not available for image %s", img_path);
+	else
+		INFO("Enabled fs-verity for image %s", img_path);
+
+	mem_free0(img_path);
+	return NULL;
+}
+
+/*
+ * Enables fs-verity for an image whose hash matched the signed config, if the config
+ * provides its fs-verity digest, so that subsequent checks need not hash the image.
+ * Building the Merkle tree reads the whole image, thus this is done in a detached thread.
+ */
+static void
+guestos_mount_image_enable_fsverity(const mount_entry_t *e, const char *img_path)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	digest_t digest;
+
+	IF_NULL_RETURN(mount_entry_get_fsverity_sha256(e));
+	IF_TRUE_RETURN(fsverity_measure(img_path, &digest) == 0);
+
+	char *path = mem_strdup(img_path);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, guestos_mount_image_enable_fsverity_main, path)) {
+		WARN("Could not start thread to enable fs-verity for image %s", img_path);
+		mem_free0(path);
+	}
+	pthread_attr_destroy(&attr);
+}
+
 typedef void (*check_mount_image_complete_cb)(guestos_check_mount_image_result_t res, guestos_t *os,
 					      mount_entry_t *e, void *data);
 
@@ -196,12 +444,13 @@ typedef struct check_mount_image {
 	guestos_t *os;
 	mount_entry_t *e;
 	char *img_path; // free me after use
+	struct stat st; // state of the image before hashing, for the hash cache
 	check_mount_image_complete_cb cb;
 	void *data;
 } check_mount_image_t;
 
 static check_mount_image_t *
-check_mount_image_new(guestos_t *os, mount_entry_t *e, char *img_path,
+check_mount_image_new(guestos_t *os, mount_entry_t *e, char *img_path, const struct stat *st,
 		      check_mount_image_complete_cb cb, void *data)
 {
 	check_mount_image_t *task = mem_new(check_mount_image_t, 1);
@@ -209,6 +458,7 @@ check_mount_image_new(guestos_t *os, mount_entry_t *e, char *img_path,
 	task->e = e;
 	task->cb = cb;
 	task->img_path = mem_strdup(img_path);
+	task->st = *st;
 	task->data = data;
 	return task;
 }
@@ -222,13 +472,13 @@ check_mount_image_free(check_mount_image_t *task)
 }
 
 static void
-check_mount_image_cb_sha256(const char *hash_string, UNUSED const char *hash_file,
-			    UNUSED crypto_hashalgo_t hash_algo, void *data)
+check_mount_image_sha256(check_mount_image_t *task, const digest_t *sha256)
 {
-	check_mount_image_t *task = data;
-	ASSERT(task);
+	guestos_hash_cache_put(task->img_path, &task->st, SHA256, sha256);
 
-	bool match = mount_entry_match_sha256(task->e, hash_string);
+	bool match = mount_entry_match_sha256(task->e, sha256);
+	if (match)
+		guestos_mount_image_enable_fsverity(task->e, task->img_path);
 	task->cb(match ? CHECK_IMAGE_GOOD : CHECK_IMAGE_HASH_MISMATCH, task->os, task->e,
 		 task->data);
 
@@ -236,15 +486,30 @@ check_mount_image_cb_sha256(const char *hash_string, UNUSED const char *hash_fil
 }
 
 static void
-check_mount_image_cb_sha1(const char *hash_string, UNUSED const char *hash_file,
-			  UNUSED crypto_hashalgo_t hash_algo, void *data)
+check_mount_image_cb_sha256(const char *hash_string, UNUSED const char *hash_file,
+			    UNUSED crypto_hashalgo_t hash_algo, void *data)
 {
 	check_mount_image_t *task = data;
 	ASSERT(task);
 
-	bool match = mount_entry_match_sha1(task->e, hash_string);
+	digest_t sha256;
+	digest_from_hex(&sha256, hash_string);
+	check_mount_image_sha256(task, &sha256);
+}
+
+static void
+check_mount_image_sha1(check_mount_image_t *task, const digest_t *sha1)
+{
+	guestos_hash_cache_put(task->img_path, &task->st, SHA1, sha1);
+
+	bool match = mount_entry_match_sha1(task->e, sha1);
 	if (match) {
-		// compute next hash
+		// compute next hash, unless it is known for the unchanged image
+		digest_t sha256;
+		if (guestos_hash_cache_get(task->img_path, &task->st, SHA256, &sha256)) {
+			check_mount_image_sha256(task, &sha256);
+			return;
+		}
 		crypto_hash_file(task->img_path, SHA256, check_mount_image_cb_sha256, task);
 		return;
 	}
@@ -253,30 +518,45 @@ check_mount_image_cb_sha1(const char *hash_string, UNUSED const char *hash_file,
 	check_mount_image_free(task);
 }
 
-static uint8_t *
-convert_hex_to_bin_new(const char *hex_str, int *out_length)
+static void
+check_mount_image_cb_sha1(const char *hash_string, UNUSED const char *hash_file,
+			  UNUSED crypto_hashalgo_t hash_algo, void *data)
 {
-	int len = strlen(hex_str);
-	int i = 0, j = 0;
-	*out_length = (len + 1) / 2;
+	check_mount_image_t *task = data;
+	ASSERT(task);
 
-	uint8_t *bin = mem_alloc0(*out_length);
+	digest_t sha1;
+	digest_from_hex(&sha1, hash_string);
+	check_mount_image_sha1(task, &sha1);
+}
 
-	if (len % 2 == 1) {
-		// odd length -> we need to pad
-		IF_FALSE_GOTO(sscanf(&(hex_str[0]), "%1hhx", &(bin[0])) == 1, err);
-		i = j = 1;
-	}
+/*
+ * Returns the hash algorithm used to check the image of the mount entry. SHA256 is
+ * preferred, SHA1 is the fallback for configs which do not provide it.
+ */
+static crypto_hashalgo_t
+guestos_mount_image_hashalgo(const mount_entry_t *e)
+{
+	return mount_entry_get_sha256(e) == NULL ? SHA1 : SHA256;
+}
 
-	for (; i < len; i += 2, j++) {
-		IF_FALSE_GOTO(sscanf(&(hex_str[i]), "%2hhx", &(bin[j])) == 1, err);
+/*
+ * Compares the hash of the image, computed with guestos_mount_image_hashalgo(), to
+ * the signed config. Matching SHA256 hashes are appended to the measurement log.
+ */
+static bool
+guestos_mount_image_match_hash(const mount_entry_t *e, char *img_path, const digest_t *digest)
+{
+	if (guestos_mount_image_hashalgo(e) == SHA1)
+		return mount_entry_match_sha1(e, digest);
+
+	bool match = mount_entry_match_sha256(e, digest);
+	if (match) { // will only be executed if hash matches to signed config
+		tss_ml_append(img_path, (uint8_t *)digest->data, digest->len, TSS_SHA256, NULL,
+			      NULL);
+		guestos_mount_image_enable_fsverity(e, img_path);
 	}
-
-	return bin;
-err:
-	ERROR("Converstion of hex string to bin failed!");
-	mem_free0(bin);
-	return NULL;
+	return match;
 }
 
 guestos_check_mount_image_result_t
@@ -325,24 +605,16 @@ guestos_check_mount_image_block(const guestos_t *os, const mount_entry_t *e, boo
 	}
 
 	if (thorough) {
-		bool match = false;
-		if (mount_entry_get_sha256(e) == NULL) { // fallback to sha1
-			char *sha1 = crypto_hash_file_block_new(img_path, SHA1);
-			match = mount_entry_match_sha1(e, sha1);
-			mem_free0(sha1);
-		} else {
-			char *sha256 = crypto_hash_file_block_new(img_path, SHA256);
-			match = mount_entry_match_sha256(e, sha256);
-			if (match) { // will only be executed if hash matches to signed config
-				int sha256_bin_len;
-				uint8_t *sha256_bin =
-					convert_hex_to_bin_new(sha256, &sha256_bin_len);
-				tss_ml_append(img_path, sha256_bin, sha256_bin_len, TSS_SHA256);
-				mem_free0(sha256_bin);
-			}
-			mem_free0(sha256);
+		crypto_hashalgo_t algo = guestos_mount_image_hashalgo(e);
+		digest_t digest;
+		bool match;
+		if (guestos_mount_image_check_fsverity(e, img_path, &match)) {
+			if (!match)
+				res = CHECK_IMAGE_HASH_MISMATCH;
+			goto cleanup;
 		}
-		if (!match)
+		guestos_hash_image_block(img_path, algo, &digest);
+		if (!guestos_mount_image_match_hash(e, img_path, &digest))
 			res = CHECK_IMAGE_HASH_MISMATCH;
 	}
 
@@ -368,21 +640,79 @@ guestos_images_are_complete(guestos_t *os, bool thorough)
 	guestos_fill_mount(os, mnt);	   // append mounts to be checked
 	guestos_fill_mount_setup(os, mnt); // append setup mode mounts to be check
 	size_t n = mount_get_count(mnt);
+
+	// images which passed the quick check, to be hashed all at once if thorough
+	mount_entry_t **entries = mem_new0(mount_entry_t *, n);
+	char **img_paths = mem_new0(char *, n);
+	crypto_hashalgo_t *algos = mem_new0(crypto_hashalgo_t, n);
+	digest_t *digests = mem_new0(digest_t, n);
+	size_t m = 0;
+
 	for (size_t i = 0; i < n; i++) {
 		mount_entry_t *e = mount_get_entry(mnt, i);
 		enum mount_type t = mount_entry_get_type(e);
 		if (t != MOUNT_TYPE_SHARED && t != MOUNT_TYPE_FLASH && t != MOUNT_TYPE_OVERLAY_RO &&
 		    t != MOUNT_TYPE_SHARED_RW)
 			continue;
-		if (guestos_check_mount_image_block(os, e, thorough) != CHECK_IMAGE_GOOD) {
+		if (guestos_check_mount_image_block(os, e, false) != CHECK_IMAGE_GOOD) {
 			res = false;
-			break;
+			goto out;
 		}
+		char *img_path =
+			mem_printf("%s/%s.img", guestos_get_dir(os), mount_entry_get_img(e));
+		// images with fs-verity need no hashing
+		bool match;
+		if (thorough && guestos_mount_image_check_fsverity(e, img_path, &match)) {
+			mem_free0(img_path);
+			if (!match) {
+				res = false;
+				goto out;
+			}
+			continue;
+		}
+		entries[m] = e;
+		img_paths[m] = img_path;
+		algos[m++] = guestos_mount_image_hashalgo(e);
+	}
+
+	if (thorough) {
+		// matching SHA256 hashes are appended to the measurement log at once
+		uint8_t **ml_hashes = mem_new0(uint8_t *, m);
+		int *ml_hash_lens = mem_new0(int, m);
+		char **ml_paths = mem_new0(char *, m);
+		size_t ml_n = 0;
+
+		guestos_hash_images_block((const char *const *)img_paths, algos, digests, m);
+		for (size_t j = 0; j < m && res; j++) {
+			if (algos[j] == SHA1) {
+				res = mount_entry_match_sha1(entries[j], &digests[j]);
+			} else if ((res = mount_entry_match_sha256(entries[j], &digests[j]))) {
+				ml_hashes[ml_n] = digests[j].data;
+				ml_paths[ml_n] = img_paths[j];
+				ml_hash_lens[ml_n++] = digests[j].len;
+				guestos_mount_image_enable_fsverity(entries[j], img_paths[j]);
+			}
+			if (!res)
+				DEBUG("Checking image %s: hash mismatch", img_paths[j]);
+		}
+
+		tss_ml_append_batch(ml_paths, ml_hashes, ml_hash_lens, ml_n, TSS_SHA256, NULL,
+				    NULL);
+		mem_free0(ml_paths);
+		mem_free0(ml_hash_lens);
+		mem_free0(ml_hashes);
 	}
 
+out:
 	// cache result
 	os->complete = res;
 
+	for (size_t j = 0; j < m; j++)
+		mem_free0(img_paths[j]);
+	mem_free0(digests);
+	mem_free0(algos);
+	mem_free0(img_paths);
+	mem_free0(entries);
 	mount_free(mnt);
 	return res;
 }
@@ -415,19 +745,123 @@ guestos_check_mount_image(guestos_t *os, mount_entry_t *e, check_mount_image_com
 	char *img_path = mem_printf("%s/%s.img", guestos_get_dir(os), img_name);
 	DEBUG("Checking image %s (thorough, non-blocking)", img_path);
 
-	check_mount_image_t *task = check_mount_image_new(os, e, img_path, cb, data);
-	crypto_hash_file(img_path, SHA1, check_mount_image_cb_sha1, task);
+	struct stat st;
+	if (stat(img_path, &st) < 0) {
+		ERROR_ERRNO("Could not stat image %s", img_path);
+		mem_free0(img_path);
+		cb(CHECK_IMAGE_ACCESS_FAILED, os, e, data);
+		return;
+	}
+
+	bool match;
+	if (guestos_mount_image_check_fsverity(e, img_path, &match)) {
+		mem_free0(img_path);
+		cb(match ? CHECK_IMAGE_GOOD : CHECK_IMAGE_HASH_MISMATCH, os, e, data);
+		return;
+	}
+
+	check_mount_image_t *task = check_mount_image_new(os, e, img_path, &st, cb, data);
+	digest_t sha1;
+	if (guestos_hash_cache_get(img_path, &st, SHA1, &sha1)) {
+		DEBUG("Using cached hashes of unchanged image %s", img_path);
+		check_mount_image_sha1(task, &sha1);
+	} else {
+		crypto_hash_file(img_path, SHA1, check_mount_image_cb_sha1, task);
+	}
 
 	mem_free0(img_path);
 }
 
+// SHARED IMAGE CHECKS
+
+typedef struct {
+	guestos_verify_mount_image_cb_t cb;
+	void *data;
+} guestos_image_check_subscriber_t;
+
+typedef struct {
+	char *img_name;
+	mount_t *mnt; // owns the mount entry of the image being checked
+	list_t *subscribers;
+} guestos_image_check_t;
+
+static void
+guestos_verify_mount_image_cb(guestos_check_mount_image_result_t res, guestos_t *os,
+			      UNUSED mount_entry_t *e, void *data)
+{
+	guestos_image_check_t *check = data;
+	ASSERT(check);
+
+	hashmap_remove(os->image_checks, check->img_name);
+
+	DEBUG("Shared check of image %s.img completed, notifying %u subscriber(s)",
+	      check->img_name, list_length(check->subscribers));
+	for (list_t *l = check->subscribers; l; l = l->next) {
+		guestos_image_check_subscriber_t *sub = l->data;
+		sub->cb(res, check->img_name, sub->data);
+		mem_free0(sub);
+	}
+
+	list_delete(check->subscribers);
+	mount_free(check->mnt);
+	mem_free0(check->img_name);
+	mem_free0(check);
+}
+
+void
+guestos_verify_mount_image(const guestos_t *os, const char *img_name,
+			   guestos_verify_mount_image_cb_t cb, void *data)
+{
+	ASSERT(os);
+	ASSERT(img_name);
+	ASSERT(cb);
+
+	guestos_image_check_subscriber_t *sub = mem_new0(guestos_image_check_subscriber_t, 1);
+	sub->cb = cb;
+	sub->data = data;
+
+	guestos_image_check_t *check = hashmap_get(os->image_checks, img_name);
+	if (check) {
+		DEBUG("Joining in-flight check of image %s.img", img_name);
+		check->subscribers = list_append(check->subscribers, sub);
+		return;
+	}
+
+	check = mem_new0(guestos_image_check_t, 1);
+	check->img_name = mem_strdup(img_name);
+	check->mnt = mount_new();
+	guestos_fill_mount(os, check->mnt);
+	guestos_fill_mount_setup(os, check->mnt);
+	check->subscribers = list_append(NULL, sub);
+
+	mount_entry_t *e = mount_get_entry_by_img(check->mnt, img_name);
+	if (!e) {
+		ERROR("GuestOS %s has no image %s", guestos_get_name(os), img_name);
+		sub->cb(CHECK_IMAGE_ERROR, img_name, sub->data);
+		mem_free0(sub);
+		list_delete(check->subscribers);
+		mount_free(check->mnt);
+		mem_free0(check->img_name);
+		mem_free0(check);
+		return;
+	}
+
+	// registered first, the check may complete synchronously on cached hashes
+	hashmap_put(os->image_checks, check->img_name, check);
+	// the image checks are the only mutable state of os used by the check
+	guestos_check_mount_image((guestos_t *)os, e, guestos_verify_mount_image_cb, check);
+}
+
 // ITERATE IMAGES
 
 // internal task callback types
 typedef struct iterate_images iterate_images_t;
+typedef struct iterate_images_item iterate_images_item_t;
 
-typedef void (*iterate_images_callback_t)(iterate_images_t *task,
-					  guestos_check_mount_image_result_t res, mount_entry_t *e);
+typedef void (*iterate_images_callback_t)(iterate_images_item_t *item,
+					  guestos_check_mount_image_result_t res);
+
+typedef void (*iterate_images_done_callback_t)(iterate_images_t *task, bool good);
 
 typedef union {
 	guestos_images_check_complete_cb_t check_complete;
@@ -438,33 +872,60 @@ struct iterate_images {
 	// locals
 	guestos_t *os;
 	mount_t *mnt;
-	size_t n, i;
+	size_t n, i;	     // i is the next image to be started
+	unsigned int jobs;   // maximum number of images processed concurrently
+	unsigned int active; // number of images currently processed
+	bool starting;	     // set while images are started, see iterate_images_continue()
+	bool failed;
 	// iterator callback
 	iterate_images_callback_t iter_cb;
+	// called after the last image, reports back the final result and frees the task
+	iterate_images_done_callback_t done_cb;
 	// callbacks to report back final result to caller
 	iterate_images_on_complete_cb_t on_complete;
 	void *complete_data;
 	// download
-	unsigned int dl_attempts;
 	unsigned int dl_count;
+};
+
+// a single image of the task which is checked and, if required, downloaded
+struct iterate_images_item {
+	iterate_images_t *task;
+	mount_entry_t *e;
+	// download
+	unsigned int dl_attempts;
 	bool dl_started;
+	bool delta_tried; // a delta is only tried once, the full image is the fallback
+	char *delta_base_file;
+	char *delta_file;
 };
 
+static void
+iterate_images_item_free(iterate_images_item_t *item)
+{
+	if (item->delta_base_file)
+		mem_free0(item->delta_base_file);
+	if (item->delta_file)
+		mem_free0(item->delta_file);
+	mem_free0(item);
+}
+
 static iterate_images_t *
-iterate_images_new(guestos_t *os, mount_t *mnt, size_t n, iterate_images_callback_t iter_cb,
+iterate_images_new(guestos_t *os, mount_t *mnt, size_t n, unsigned int jobs,
+		   iterate_images_callback_t iter_cb, iterate_images_done_callback_t done_cb,
 		   iterate_images_on_complete_cb_t complete_cb, void *complete_data)
 {
-	iterate_images_t *task = mem_new(iterate_images_t, 1);
+	iterate_images_t *task = mem_new0(iterate_images_t, 1);
 	task->os = os;
 	task->mnt = mnt;
 	task->n = n;
 	task->i = 0;
+	task->jobs = MAX(jobs, 1);
 	task->iter_cb = iter_cb;
+	task->done_cb = done_cb;
 	task->on_complete = complete_cb;
 	task->complete_data = complete_data;
-	task->dl_attempts = 0;
 	task->dl_count = 0;
-	task->dl_started = false;
 	return task;
 }
 
@@ -481,55 +942,104 @@ iterate_images_cb_check_image(guestos_check_mount_image_result_t res,
 			      UNUSED guestos_t *os /*already in task*/, mount_entry_t *e,
 			      void *data)
 {
-	iterate_images_t *task = data;
-	ASSERT(task);
-	ASSERT(task->os == os);
+	iterate_images_item_t *item = data;
+	ASSERT(item);
+	ASSERT(item->task->os == os);
+	ASSERT(item->e == e);
 
-	task->iter_cb(task, res, e);
+	item->task->iter_cb(item, res);
 }
 
 /**
- * Trigger image check for the next relevant (i.e. for SHARED or FLASH type) GuestOS image.
- *
- * @return true if next image was found and check for it was triggered, false otherwise.
+ * Returns the next relevant (i.e. for SHARED or FLASH type) GuestOS image, starting
+ * from task->i, or NULL if there are no more images.
  */
-static bool
-iterate_images_trigger_check(iterate_images_t *task)
+static mount_entry_t *
+iterate_images_get_next(iterate_images_t *task)
 {
 	// look for next SHARED or FLASH type image
-	while (task->i < task->n) {
+	for (; task->i < task->n; ++task->i) {
 		mount_entry_t *e = mount_get_entry(task->mnt, task->i);
 		enum mount_type t = mount_entry_get_type(e);
 		if (t == MOUNT_TYPE_SHARED || t == MOUNT_TYPE_FLASH || t == MOUNT_TYPE_OVERLAY_RO ||
-		    t == MOUNT_TYPE_SHARED_RW) {
-			DEBUG("Found next image %s.img for GuestOS %s v%" PRIu64
-			      ", triggering check.",
-			      mount_entry_get_img(e), guestos_get_name(task->os),
-			      guestos_get_version(task->os));
-			guestos_check_mount_image(task->os, e, iterate_images_cb_check_image, task);
-			return true;
-		}
-		++task->i;
+		    t == MOUNT_TYPE_SHARED_RW)
+			return e;
 	}
+	return NULL;
+}
+
+/**
+ * Triggers the check of the next images until task->jobs images are processed
+ * concurrently. Once no image is processed anymore, the final result is reported
+ * through done_cb, which frees the task.
+ * Checks may complete synchronously, thus iterate_images_item_done() only continues
+ * here if no images are being started.
+ */
+static void
+iterate_images_continue(iterate_images_t *task)
+{
+	task->starting = true;
+	while (!task->failed && task->active < task->jobs) {
+		mount_entry_t *e = iterate_images_get_next(task);
+		if (!e)
+			break;
+		task->i++;
+
+		DEBUG("Found next image %s.img for GuestOS %s v%" PRIu64 ", triggering check.",
+		      mount_entry_get_img(e), guestos_get_name(task->os),
+		      guestos_get_version(task->os));
+
+		iterate_images_item_t *item = mem_new0(iterate_images_item_t, 1);
+		item->task = task;
+		item->e = e;
+		task->active++;
+		guestos_check_mount_image(task->os, e, iterate_images_cb_check_image, item);
+	}
+	task->starting = false;
+
+	if (task->active > 0)
+		return;
+
 	DEBUG("No more images to check for GuestOS %s v%" PRIu64 ", stopping iteration.",
 	      guestos_get_name(task->os), guestos_get_version(task->os));
-	return false;
+	task->done_cb(task, !task->failed);
+}
+
+/**
+ * Finishes the processing of a single image; a bad image stops the iteration.
+ */
+static void
+iterate_images_item_done(iterate_images_item_t *item, bool good)
+{
+	iterate_images_t *task = item->task;
+	iterate_images_item_free(item);
+
+	task->active--;
+	if (!good)
+		task->failed = true;
+
+	if (!task->starting)
+		iterate_images_continue(task);
 }
 
 /**
  * Iterate over all (SHARED and FLASH type) images that are provided by the GuestOS
- * and call the given iter_cb callback for each of them.
- * The final result of the operation is returned via the complete_cb, if given.
+ * and call the given iter_cb callback for each of them, for up to jobs images
+ * concurrently.
+ * The final result of the operation is reported via done_cb.
  *
  * @param   os the GuestOS
+ * @param   jobs the maximum number of images processed concurrently
  * @param   iter_cb the callback called for each GuestOS image
- * @param   complete_cb the callback to report the final result
+ * @param   done_cb the callback called with the final result, which frees the task
+ * @param   on_complete the callback to report the final result to the caller
  * @param   complete_data data parameter passed to the final result callback
  * @return  true if iteration was started (iter_cb should be called at least once),
  *	    false otherwise (e.g. when there are no images to iterate over)
  */
 static bool
-iterate_images_start(guestos_t *os, iterate_images_callback_t iter_cb,
+iterate_images_start(guestos_t *os, unsigned int jobs, iterate_images_callback_t iter_cb,
+		     iterate_images_done_callback_t done_cb,
 		     iterate_images_on_complete_cb_t on_complete, void *complete_data)
 {
 	ASSERT(os);
@@ -548,40 +1058,41 @@ iterate_images_start(guestos_t *os, iterate_images_callback_t iter_cb,
 	}
 
 	iterate_images_t *task =
-		iterate_images_new(os, mnt, n, iter_cb, on_complete, complete_data);
-	if (iterate_images_trigger_check(task))
-		return true;
+		iterate_images_new(os, mnt, n, jobs, iter_cb, done_cb, on_complete, complete_data);
+	if (!iterate_images_get_next(task)) {
+		DEBUG("No images to check for GuestOS %s v%" PRIu64 ", stopping iteration.",
+		      guestos_get_name(os), guestos_get_version(os));
+		iterate_images_free(task);
+		return false;
+	}
 
-	mount_free(mnt);
-	iterate_images_free(task);
-	return false;
+	iterate_images_continue(task);
+	return true;
 }
 
 // CHECK IMAGES
 
 static void
-iterate_images_cb_check(iterate_images_t *task, guestos_check_mount_image_result_t res,
-			mount_entry_t *e)
+iterate_images_cb_check(iterate_images_item_t *item, guestos_check_mount_image_result_t res)
 {
-	ASSERT(task);
+	ASSERT(item);
 
 	bool good = (res == CHECK_IMAGE_GOOD);
-	if (good) {
-		DEBUG("GuestOS %s v%" PRIu64 " image %s.img is GOOD, proceeding ...",
-		      guestos_get_name(task->os), guestos_get_version(task->os),
-		      mount_entry_get_img(e));
-		task->i++;
-		if (iterate_images_trigger_check(task))
-			return;
+	DEBUG("GuestOS %s v%" PRIu64 " image %s.img is %s", guestos_get_name(item->task->os),
+	      guestos_get_version(item->task->os), mount_entry_get_img(item->e),
+	      good ? "GOOD, proceeding ..." : "BAD, stopping ...");
+
+	iterate_images_item_done(item, good);
+}
+
+static void
+iterate_images_cb_check_done(iterate_images_t *task, bool good)
+{
+	if (good)
 		INFO("GuestOS %s v%" PRIu64 " is complete, all images are good.",
 		     guestos_get_name(task->os), guestos_get_version(task->os));
-	} else {
-		DEBUG("GuestOS %s v%" PRIu64 " image %s.img is BAD, stopping ...",
-		      guestos_get_name(task->os), guestos_get_version(task->os),
-		      mount_entry_get_img(e));
-	}
 
-	// bad or last image: notify caller
+	// notify caller
 	if (task->on_complete.check_complete)
 		task->on_complete.check_complete(good, task->os, task->complete_data);
 
@@ -596,8 +1107,8 @@ guestos_images_check(guestos_t *os, guestos_images_check_complete_cb_t cb, void
 	ASSERT(cb);
 	INFO("Checking images of GuestOS %s v%" PRIu64 " (thorough)", guestos_get_name(os),
 	     guestos_get_version(os));
-	// prepare image iteration
-	if (!iterate_images_start(os, iterate_images_cb_check,
+	// prepare image iteration, one image after the other
+	if (!iterate_images_start(os, 1, iterate_images_cb_check, iterate_images_cb_check_done,
 				  (iterate_images_on_complete_cb_t){ .check_complete = cb },
 				  data)) {
 		DEBUG("No images to check for GuestOS %s v%" PRIu64, guestos_get_name(os),
@@ -630,9 +1141,14 @@ static void
 iterate_images_cb_download_hash_complete(download_t *dl, bool success, void *data);
 
 static bool
-iterate_image_do_trigger_download(const char *img_name, iterate_images_t *task,
+iterate_images_trigger_image_download(iterate_images_item_t *item);
+
+static bool
+iterate_image_do_trigger_download(const char *img_name, iterate_images_item_t *item,
 				  download_callback_t dl_cb)
 {
+	iterate_images_t *task = item->task;
+
 	const char *hardware_name = guestos_hardware_get_name();
 	if (!hardware_name) {
 		return false;
@@ -679,8 +1195,8 @@ iterate_image_do_trigger_download(const char *img_name, iterate_images_t *task,
 				   hardware_name, guestos_get_name(task->os),
 				   guestos_get_version(task->os), img_name);
 	// invoke downloader
-	DEBUG("Downloading %s to %s (attempt=%u).", img_url, img_path, task->dl_attempts);
-	download_t *dl = download_new(img_url, img_path, dl_cb, task);
+	DEBUG("Downloading %s to %s (attempt=%u).", img_url, img_path, item->dl_attempts);
+	download_t *dl = download_new(img_url, img_path, dl_cb, item);
 	mem_free0(img_url);
 	mem_free0(img_path);
 	mem_free0(update_base_url_pp);
@@ -693,43 +1209,161 @@ iterate_image_do_trigger_download(const char *img_name, iterate_images_t *task,
 }
 
 static bool
-iterate_images_trigger_download(iterate_images_t *task)
+iterate_images_trigger_download(iterate_images_item_t *item)
 {
-	ASSERT(task);
+	ASSERT(item);
 
 	bool res = false;
 	char *img_name = NULL;
 	download_callback_t cb = NULL;
-	mount_entry_t *e = mount_get_entry(task->mnt, task->i);
+	mount_entry_t *e = item->e;
 
-	TRACE("dl_attempt = %u for %s", task->dl_attempts, mount_entry_get_img(e));
-	if (task->dl_attempts >= GUESTOS_MAX_DOWNLOAD_ATTEMPTS) {
+	TRACE("dl_attempt = %u for %s", item->dl_attempts, mount_entry_get_img(e));
+	if (item->dl_attempts >= GUESTOS_MAX_DOWNLOAD_ATTEMPTS) {
 		WARN("Maximum download attempts (%d) exceeded for %s. Aborting image downloads.",
 		     GUESTOS_MAX_DOWNLOAD_ATTEMPTS, mount_entry_get_img(e));
 		return false;
 	}
-	task->dl_attempts++; // increase dl_attempt counter
+	item->dl_attempts++; // increase dl_attempt counter
 
 	if (mount_entry_get_verity_sha256(e) && strcmp(mount_entry_get_verity_sha256(e), "")) {
 		img_name = mem_printf("%s.hash.img", mount_entry_get_img(e));
 		// if no meta image download_complete handeler is trigger by download_hash_complete
 		cb = iterate_images_cb_download_hash_complete;
+		res = iterate_image_do_trigger_download(img_name, item, cb);
 	} else {
-		img_name = mem_printf("%s.img", mount_entry_get_img(e));
-		// if no meta image is set directly trigger download_complete handeler
-		cb = iterate_images_cb_download_complete;
+		// if no meta image is set directly trigger image download
+		res = iterate_images_trigger_image_download(item);
 	}
-	res = iterate_image_do_trigger_download(img_name, task, cb);
 
 	mem_free0(img_name);
 	return res;
 }
 
+/*
+ * Returns the latest complete version of the GuestOS older than os, which is the
+ * base for delta updates of its images, or NULL if there is none.
+ */
+static guestos_t *
+guestos_get_delta_base(const guestos_t *os)
+{
+	guestos_t *base = NULL;
+
+	for (size_t i = 0; i < guestos_mgr_get_guestos_count(); i++) {
+		guestos_t *o = guestos_mgr_get_guestos_by_index(i);
+		if (strcmp(guestos_get_name(o), guestos_get_name(os)) ||
+		    guestos_get_version(o) >= guestos_get_version(os))
+			continue;
+		if (!base || guestos_get_version(o) > guestos_get_version(base))
+			base = o;
+	}
+
+	return (base && guestos_images_are_complete(base, false)) ? base : NULL;
+}
+
+static void
+iterate_images_cb_delta_applied(bool success, void *data)
+{
+	iterate_images_item_t *item = data;
+	ASSERT(item);
+
+	char *img_path = mem_printf("%s/%s.img", guestos_get_dir(item->task->os),
+				    mount_entry_get_img(item->e));
+	char *patch_path = mem_printf("%s" GUESTOS_DELTA_PATCH_SUFFIX, img_path);
+
+	unlink(item->delta_file);
+	if (success && rename(patch_path, img_path) < 0) {
+		ERROR_ERRNO("Could not move %s to %s", patch_path, img_path);
+		unlink(patch_path);
+		success = false;
+	}
+	mem_free0(patch_path);
+	mem_free0(img_path);
+
+	if (success) {
+		INFO("Applied delta %s", item->delta_file);
+		// a bad result falls back to the full image, see iterate_images_cb_download_check()
+		guestos_check_mount_image(item->task->os, item->e, iterate_images_cb_check_image,
+					  item);
+		return;
+	}
+
+	WARN("Failed to apply delta %s, downloading full image", item->delta_file);
+	if (!iterate_images_trigger_image_download(item))
+		iterate_images_item_done(item, false);
+}
+
+static void
+iterate_images_cb_download_delta_complete(download_t *dl, bool success, void *data)
+{
+	iterate_images_item_t *item = data;
+	ASSERT(item);
+
+	if (success) {
+		INFO("Download of %s succeeded!", download_get_url(dl));
+		char *patch_path = mem_printf("%s/%s.img" GUESTOS_DELTA_PATCH_SUFFIX,
+					      guestos_get_dir(item->task->os),
+					      mount_entry_get_img(item->e));
+		int ret = delta_apply(item->delta_base_file, item->delta_file, patch_path,
+				      iterate_images_cb_delta_applied, item);
+		mem_free0(patch_path);
+		if (ret == 0) {
+			download_free(dl);
+			return;
+		}
+	} else {
+		DEBUG("No delta available at %s, downloading full image", download_get_url(dl));
+	}
+
+	unlink(item->delta_file);
+	if (!iterate_images_trigger_image_download(item))
+		iterate_images_item_done(item, false);
+	download_free(dl);
+}
+
+/**
+ * Triggers the download of the actual image, as a delta to the installed image of
+ * an older GuestOS version if possible.
+ */
+static bool
+iterate_images_trigger_image_download(iterate_images_item_t *item)
+{
+	if (!item->delta_tried) {
+		item->delta_tried = true;
+
+		guestos_t *base = guestos_get_delta_base(item->task->os);
+		char *base_file = base ? mem_printf("%s/%s.img", guestos_get_dir(base),
+						    mount_entry_get_img(item->e)) :
+					 NULL;
+		if (base_file && file_exists(base_file)) {
+			char *delta_name = mem_printf("%s.img.delta-%" PRIu64,
+						      mount_entry_get_img(item->e),
+						      guestos_get_version(base));
+			item->delta_base_file = base_file;
+			item->delta_file =
+				mem_printf("%s/%s", guestos_get_dir(item->task->os), delta_name);
+			bool res = iterate_image_do_trigger_download(
+				delta_name, item, iterate_images_cb_download_delta_complete);
+			mem_free0(delta_name);
+			if (res)
+				return true;
+		} else if (base_file) {
+			mem_free0(base_file);
+		}
+	}
+
+	char *img_name = mem_printf("%s.img", mount_entry_get_img(item->e));
+	bool res = iterate_image_do_trigger_download(img_name, item,
+						     iterate_images_cb_download_complete);
+	mem_free0(img_name);
+	return res;
+}
+
 static void
 iterate_images_cb_download_hash_complete(download_t *dl, bool success, void *data)
 {
-	iterate_images_t *task = data;
-	ASSERT(task);
+	iterate_images_item_t *item = data;
+	ASSERT(item);
 
 	bool res = true;
 
@@ -737,11 +1371,7 @@ iterate_images_cb_download_hash_complete(download_t *dl, bool success, void *dat
 		INFO("Download of %s succeeded!", download_get_url(dl));
 
 		// do trigger download of real image
-		mount_entry_t *e = mount_get_entry(task->mnt, task->i);
-		char *img_name = mem_printf("%s.img", mount_entry_get_img(e));
-		res = iterate_image_do_trigger_download(img_name, task,
-							iterate_images_cb_download_complete);
-		mem_free0(img_name);
+		res = iterate_images_trigger_image_download(item);
 		IF_FALSE_GOTO_WARN(res, err);
 	} else {
 		WARN("Download of %s failed!", download_get_url(dl));
@@ -752,76 +1382,64 @@ iterate_images_cb_download_hash_complete(download_t *dl, bool success, void *dat
 	return;
 
 err:
-	if (!iterate_images_trigger_download(task)) {
-		task->os->downloading = false;
-
-		// notify caller
-		if (task->on_complete.download_complete)
-			task->on_complete.download_complete(false, task->dl_count, task->os,
-							    task->complete_data);
-		// cleanup
-		iterate_images_free(task);
-	}
+	if (!iterate_images_trigger_download(item))
+		iterate_images_item_done(item, false);
 	download_free(dl);
 }
 
 static void
 iterate_images_cb_download_complete(download_t *dl, bool success, void *data)
 {
-	iterate_images_t *task = data;
-	ASSERT(task);
+	iterate_images_item_t *item = data;
+	ASSERT(item);
 
 	if (success) {
 		INFO("Download of %s succeeded!", download_get_url(dl));
-		bool res = iterate_images_trigger_check(task);
-		ASSERT(res);
+		// the image is hashed while the other images are still being downloaded
+		guestos_check_mount_image(item->task->os, item->e, iterate_images_cb_check_image,
+					  item);
 	} else {
 		WARN("Download of %s failed!", download_get_url(dl));
-		if (!iterate_images_trigger_download(task)) {
-			task->os->downloading = false;
-
-			// notify caller
-			if (task->on_complete.download_complete)
-				task->on_complete.download_complete(false, task->dl_count, task->os,
-								    task->complete_data);
-			// cleanup
-			iterate_images_free(task);
-		}
+		if (!iterate_images_trigger_download(item))
+			iterate_images_item_done(item, false);
 	}
 	download_free(dl);
 }
 
 static void
-iterate_images_cb_download_check(iterate_images_t *task, guestos_check_mount_image_result_t res,
-				 mount_entry_t *e)
+iterate_images_cb_download_check(iterate_images_item_t *item,
+				 guestos_check_mount_image_result_t res)
 {
-	ASSERT(task);
+	ASSERT(item);
 
+	iterate_images_t *task = item->task;
 	bool good = (res == CHECK_IMAGE_GOOD);
 	if (good) {
 		DEBUG("GuestOS %s v%" PRIu64 " image %s.img is GOOD, proceeding ...",
 		      guestos_get_name(task->os), guestos_get_version(task->os),
-		      mount_entry_get_img(e));
-		task->dl_attempts = 0; // reset dl_attempt counter
-		if (task->dl_started) {
+		      mount_entry_get_img(item->e));
+		if (item->dl_started)
 			task->dl_count++;
-			task->dl_started = false;
-		}
-		task->i++;
-		if (iterate_images_trigger_check(task))
-			return;
-		INFO("GuestOS %s v%" PRIu64 " is now complete, all images have been downloaded.",
-		     guestos_get_name(task->os), guestos_get_version(task->os));
 	} else {
 		// bad image: trigger actual download
 		DEBUG("GuestOS %s v%" PRIu64 " image %s.img is BAD, triggering download ...",
 		      guestos_get_name(task->os), guestos_get_version(task->os),
-		      mount_entry_get_img(e));
-		task->dl_started = true;
-		if (iterate_images_trigger_download(task))
+		      mount_entry_get_img(item->e));
+		item->dl_started = true;
+		if (iterate_images_trigger_download(item))
 			return;
 	}
 
+	iterate_images_item_done(item, good);
+}
+
+static void
+iterate_images_cb_download_done(iterate_images_t *task, bool good)
+{
+	if (good)
+		INFO("GuestOS %s v%" PRIu64 " is now complete, all images have been downloaded.",
+		     guestos_get_name(task->os), guestos_get_version(task->os));
+
 	task->os->downloading = false;
 
 	// notify caller
@@ -850,9 +1468,10 @@ guestos_images_download(guestos_t *os, guestos_images_download_complete_cb_t cb,
 	 */
 	IF_TRUE_RETVAL(os->downloading, false);
 
-	// prepare image iteration
+	// prepare image iteration, multiple images are downloaded concurrently
 	os->downloading = true;
-	if (!iterate_images_start(os, iterate_images_cb_download_check,
+	if (!iterate_images_start(os, cmld_get_guestos_download_jobs(),
+				  iterate_images_cb_download_check, iterate_images_cb_download_done,
 				  (iterate_images_on_complete_cb_t){ .download_complete = cb },
 				  data)) {
 		DEBUG("No images to download for GuestOS %s v%" PRIu64, guestos_get_name(os),
@@ -876,69 +1495,57 @@ typedef enum {
 } verify_partition_result_t;
 
 /**
- * Verifies if the contents of the partition and image match.
+ * Verifies if the partition contains the image of the mount entry. Instead of reading
+ * the image a second time, the partition is hashed over the size of the image and
+ * compared to the signed hash of the image, which the image was already checked
+ * against by guestos_images_are_complete().
  *
- * @param img_path path to the image file
+ * @param e the mount entry of the image
  * @param part_path full path to the partition
  * @return whether the contents MATCH or MISMATCH, or ERROR if something goes wrong
  */
 static verify_partition_result_t
-verify_partition(const char *img_path, const char *part_path)
+verify_partition(const mount_entry_t *e, const char *part_path)
 {
-	ASSERT(img_path);
+	ASSERT(e);
 	ASSERT(part_path);
 
-	verify_partition_result_t res = VERIFY_PARTITION_ERROR;
-	int img = open(img_path, O_RDONLY);
-	int part = open(part_path, O_RDONLY);
-	if (img == -1) {
-		WARN_ERRNO("Verifying partition %s: Cannot open image %s for reading.", part_path,
-			   img_path);
-		goto cleanup_files;
-	}
+	off_t img_size = mount_entry_get_size(e);
+	int part = open(part_path, O_RDONLY | O_CLOEXEC);
 	if (part == -1) {
 		WARN_ERRNO("Verifying partition %s: Cannot open partition for reading.", part_path);
-		goto cleanup_files;
+		return VERIFY_PARTITION_ERROR;
+	}
+	off_t part_size = lseek(part, 0, SEEK_END);
+	close(part);
+	if (part_size < 0) {
+		WARN_ERRNO("Verifying partition %s: Cannot get size of partition.", part_path);
+		return VERIFY_PARTITION_ERROR;
+	}
+	if (part_size < img_size) {
+		DEBUG("Verifying partition %s: Failed. Partition is smaller than image %s.",
+		      part_path, mount_entry_get_img(e));
+		return VERIFY_PARTITION_MISMATCH;
 	}
 
-	char *img_buf = mem_alloc(GUESTOS_VERIFY_BLOCKSIZE);
-	char *part_buf = mem_alloc(GUESTOS_VERIFY_BLOCKSIZE);
-	ssize_t img_bytes, part_bytes;
-	do {
-		img_bytes = read(img, img_buf, GUESTOS_VERIFY_BLOCKSIZE);
-		if (img_bytes < 0) {
-			ERROR_ERRNO("Verifying partition %s: Cannot read from image %s.", part_path,
-				    img_path);
-			goto cleanup;
-		}
-		if (img_bytes == 0) {
-			DEBUG("Verifying partition %s: Success. Content matches with image %s.",
-			      part_path, img_path);
-			res = VERIFY_PARTITION_MATCH;
-			goto cleanup;
-		}
-		ASSERT(img_bytes <= GUESTOS_VERIFY_BLOCKSIZE);
-		part_bytes = read(part, part_buf, img_bytes);
-		if (part_bytes < 0) {
-			ERROR_ERRNO("Verifying partition %s: Cannot read from partition.",
-				    part_path);
-			goto cleanup;
-		}
-	} while (img_bytes == part_bytes && !memcmp(img_buf, part_buf, img_bytes));
+	digest_t digest;
+	crypto_hashalgo_t algo = guestos_mount_image_hashalgo(e);
+	if (crypto_hash_file_len_block(part_path, img_size, algo, &digest) < 0) {
+		ERROR("Verifying partition %s: Cannot hash partition.", part_path);
+		return VERIFY_PARTITION_ERROR;
+	}
 
-	DEBUG("Verifying partition %s: Failed. Content differs from image %s.", part_path,
-	      img_path);
-	res = VERIFY_PARTITION_MISMATCH;
+	bool match = (algo == SHA1) ? mount_entry_match_sha1(e, &digest) :
+				      mount_entry_match_sha256(e, &digest);
+	if (!match) {
+		DEBUG("Verifying partition %s: Failed. Content differs from image %s.", part_path,
+		      mount_entry_get_img(e));
+		return VERIFY_PARTITION_MISMATCH;
+	}
 
-cleanup:
-	mem_free0(part_buf);
-	mem_free0(img_buf);
-cleanup_files:
-	if (img != -1)
-		close(img);
-	if (part != -1)
-		close(part);
-	return res;
+	DEBUG("Verifying partition %s: Success. Content matches with image %s.", part_path,
+	      mount_entry_get_img(e));
+	return VERIFY_PARTITION_MATCH;
 }
 
 /**
@@ -975,7 +1582,7 @@ verify_flash_mount_entry(guestos_t *os, mount_entry_t *e)
 	char *flash_path = mem_strdup(flash_partition);
 	DEBUG("Flashing image %s to partition %s", img_path, flash_path);
 
-	switch (verify_partition(img_path, flash_path)) {
+	switch (verify_partition(e, flash_path)) {
 	case VERIFY_PARTITION_MATCH:
 		DEBUG("Skipping flashing of partition %s: Already up to date with image %s.",
 		      flash_path, img_path);
@@ -1005,12 +1612,13 @@ verify_flash_mount_entry(guestos_t *os, mount_entry_t *e)
 		}
 
 		DEBUG("Flashing partition %s with image %s.", flash_path, img_path);
-		file_copy(img_path, flash_path, -1, GUESTOS_FLASH_BLOCKSIZE, 0);
+		if (file_copy_direct(img_path, flash_path) < 0)
+			WARN("Failed to write image %s to partition %s", img_path, flash_path);
 
 		mem_free0(flash_bak);
 		os->partialy_flashed = true;
 
-		switch (verify_partition(img_path, flash_path)) {
+		switch (verify_partition(e, flash_path)) {
 		case VERIFY_PARTITION_MATCH:
 			DEBUG("Successfully flashed image %s to %s", img_path, flash_path);
 			res = 1;
@@ -1109,25 +1717,23 @@ guestos_purge(guestos_t *os)
 		char *img_path = mem_printf("%s/%s.img", dir, img_name);
 		char *img_hash_path = mem_printf("%s/%s.hash.img", dir, img_name);
 
-		if (file_exists(img_path) && unlink(img_path) < 0) {
-			WARN_ERRNO("Failed to erase file %s", img_path);
-		}
-		if (file_exists(img_hash_path) && unlink(img_hash_path) < 0) {
-			WARN_ERRNO("Failed to erase file %s", img_hash_path);
-		}
+		// large images are deleted in the background, the directory is left empty
+		guestos_hash_cache_remove(img_path);
+		if (file_exists(img_path))
+			purge_file(img_path);
+		if (file_exists(img_hash_path))
+			purge_file(img_hash_path);
 		if (os->partialy_flashed && mount_entry_get_type(e) == MOUNT_TYPE_FLASH) {
 			char *flash_path = mem_strdup(dir);
 			char *flash_bak = mem_printf("%s/%s", os->rollback_dir, img_name);
 			DEBUG("Rollback flashed partition %s to %s.", flash_bak, flash_path);
 
-			if (-1 ==
-			    file_copy(flash_bak, flash_path, -1, GUESTOS_FLASH_BLOCKSIZE, 0)) {
+			if (-1 == file_copy_direct(flash_bak, flash_path)) {
 				ERROR("Failed to rollback backup file %s to partition %s",
 				      flash_bak, flash_path);
 			}
 			// restored sucessfully unlink backup file
-			if (unlink(flash_bak) < 0)
-				WARN_ERRNO("Failed to erase file %s", flash_bak);
+			purge_file(flash_bak);
 			mem_free0(flash_path);
 			mem_free0(flash_bak);
 		}
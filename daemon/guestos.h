@@ -129,6 +129,27 @@ typedef enum guestos_check_mount_image_result {
 guestos_check_mount_image_result_t
 guestos_check_mount_image_block(const guestos_t *os, const mount_entry_t *e, bool thorough);
 
+/**
+ * Callback type for guestos_verify_mount_image().
+ */
+typedef void (*guestos_verify_mount_image_cb_t)(guestos_check_mount_image_result_t res,
+						const char *img_name, void *data);
+
+/**
+ * Perform a thorough check of a mount image without blocking and deliver the result via
+ * the given callback. Concurrent requests for the same image, e.g., by several containers
+ * using the GuestOS, share a single check. Hashes of unchanged images are cached, thus
+ * later requests complete immediately.
+ *
+ * @param os the guestos to which the image belongs to
+ * @param img_name the name of the image, without '.img'
+ * @param cb callback to deliver the result back to the caller
+ * @param data data parameter passed to the callback
+ */
+void
+guestos_verify_mount_image(const guestos_t *os, const char *img_name,
+			   guestos_verify_mount_image_cb_t cb, void *data);
+
 /**
  * Check the required image files for the given GuestOS and return the result (blocking).
  * The image files exists and have correct size, and for a thorough check their hashes
@@ -198,7 +219,8 @@ guestos_images_flash(guestos_t *os);
 /******************************************************************************/
 
 /**
- * Removes the files associated with the given GuestOS.
+ * Removes the files associated with the given GuestOS. The images are handed to
+ * purge_file() and thus deleted in the background.
  * @param os the GuestOS instance whose files to delete
  */
 void
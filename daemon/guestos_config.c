@@ -31,6 +31,8 @@
 #include "common/protobuf.h"
 #include "common/protobuf-text.h"
 
+#include <string.h>
+
 /******************************************************************************/
 guestos_config_t *
 guestos_config_new_from_file(const char *file)
@@ -38,8 +40,15 @@ guestos_config_new_from_file(const char *file)
 	ASSERT(file);
 	DEBUG("Loading GuestOS config from \"%s\".", file);
 
-	GuestOSConfig *cfg = (GuestOSConfig *)protobuf_message_new_from_textfile(
-		file, &guest_osconfig__descriptor);
+	// the signature is stored next to the config as <prefix>.sig instead of <prefix>.conf
+	size_t len = strlen(file);
+	char *sig_file = (len > 5 && !strcmp(file + len - 5, ".conf")) ?
+				 mem_printf("%.*s.sig", (int)(len - 5), file) :
+				 NULL;
+
+	GuestOSConfig *cfg = (GuestOSConfig *)protobuf_message_new_from_textfile_cached(
+		file, sig_file, &guest_osconfig__descriptor);
+	mem_free0(sig_file);
 	if (!cfg) {
 		ERROR("Failed loading GuestOS config from file \"%s\".", file);
 	}
@@ -97,6 +106,8 @@ guestos_config_mount_type_from_protobuf(GuestOSMount__Type mt)
 		return MOUNT_TYPE_SHARED_RW;
 	case GUEST_OSMOUNT__TYPE__OVERLAY_RW:
 		return MOUNT_TYPE_OVERLAY_RW;
+	case GUEST_OSMOUNT__TYPE__EPHEMERAL:
+		return MOUNT_TYPE_EPHEMERAL;
 	default:
 		FATAL("Invalid protobuf mount type %d in CC Mode.", mt);
 	}
@@ -129,6 +140,8 @@ guestos_config_mount_type_from_protobuf(GuestOSMount__Type mt)
 		return MOUNT_TYPE_BIND_FILE;
 	case GUEST_OSMOUNT__TYPE__BIND_FILE_RW:
 		return MOUNT_TYPE_BIND_FILE_RW;
+	case GUEST_OSMOUNT__TYPE__EPHEMERAL:
+		return MOUNT_TYPE_EPHEMERAL;
 	default:
 		FATAL("Invalid protobuf mount type %d.", mt);
 	}
@@ -179,6 +192,10 @@ guestos_config_fill_mount_internal(GuestOSMount **mounts, size_t n_mounts, mount
 			mount_entry_set_mount_data(e, m->mount_data);
 		if (m->image_verity_sha256)
 			mount_entry_set_verity_sha256(e, m->image_verity_sha256);
+		if (m->image_fsverity_sha256)
+			mount_entry_set_fsverity_sha256(e, m->image_fsverity_sha256);
+		if (m->has_image_block_size)
+			mount_entry_set_block_size(e, m->image_block_size);
 	}
 }
 
@@ -37,6 +37,7 @@
 #include "common/fd.h"
 #include "common/dir.h"
 #include "common/event.h"
+#include "common/hashmap.h"
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -61,12 +62,75 @@
 #define TRUSTED_CA_STORE SCD_TOKEN_DIR "/ca"
 
 static list_t *guestos_list = NULL;
+// guestos name -> list of its guestos_t by descending version
+static hashmap_t *guestos_index = NULL;
 
 static const char *guestos_basepath = NULL;
 static bool guestos_mgr_allow_locally_signed = false;
 
 /******************************************************************************/
 
+/**
+ * Registers os in guestos_list and in the version list of its name in guestos_index.
+ * The index is keyed by the name of the list head, which is replaced if os becomes
+ * the new head, as hashmap keys are not copied.
+ */
+static void
+guestos_mgr_list_add(guestos_t *os)
+{
+	const char *name = guestos_get_name(os);
+	uint64_t version = guestos_get_version(os);
+
+	guestos_list = list_append(guestos_list, os);
+
+	if (!guestos_index)
+		guestos_index = hashmap_new_str();
+
+	// versions of equal value keep their order of registration
+	list_t *old = hashmap_remove(guestos_index, name);
+	list_t *versions = NULL;
+	for (list_t *l = old; l; l = l->next) {
+		if (os && guestos_get_version(l->data) < version) {
+			versions = list_append(versions, os);
+			os = NULL;
+		}
+		versions = list_append(versions, l->data);
+	}
+	if (os)
+		versions = list_append(versions, os);
+	list_delete(old);
+
+	hashmap_put(guestos_index, guestos_get_name(versions->data), versions);
+}
+
+/**
+ * Unregisters os from guestos_list and guestos_index, os itself is not freed.
+ */
+static void
+guestos_mgr_list_remove(guestos_t *os)
+{
+	const char *name = guestos_get_name(os);
+
+	guestos_list = list_remove(guestos_list, os);
+
+	IF_NULL_RETURN(guestos_index);
+	list_t *versions = hashmap_remove(guestos_index, name);
+	versions = list_remove(versions, os);
+	if (versions)
+		hashmap_put(guestos_index, guestos_get_name(versions->data), versions);
+}
+
+/**
+ * Returns the version list of the guestos with the given name, latest version first.
+ */
+static list_t *
+guestos_mgr_get_versions(const char *name)
+{
+	return guestos_index ? hashmap_get(guestos_index, name) : NULL;
+}
+
+/******************************************************************************/
+
 /**
  * This function verifies the guestos configuration file at load time
  * as part of TSF.CML.SecureCompartmentInit
@@ -207,7 +271,7 @@ guestos_mgr_add_from_file(const char *file, guestos_verify_result_t verify_resul
 	}
 
 	guestos_set_verify_result(os, verify_result);
-	guestos_list = list_append(guestos_list, os);
+	guestos_mgr_list_add(os);
 
 	return 0;
 }
@@ -226,7 +290,7 @@ guestos_mgr_delete(guestos_t *os)
 	INFO("Deleting GuestOS: %s", os_name);
 
 	guestos_purge(os);
-	guestos_list = list_remove(guestos_list, os);
+	guestos_mgr_list_remove(os);
 	guestos_free(os);
 
 	return 0;
@@ -242,7 +306,7 @@ guestos_mgr_purge_obsolete(void)
 		guestos_t *latest = guestos_mgr_get_latest_by_name(guestos_get_name(os), true);
 		if (latest && guestos_get_version(os) < guestos_get_version(latest) &&
 		    !guestos_mgr_is_this_guestos_used_by_containers(os)) {
-			guestos_list = list_unlink(guestos_list, l);
+			guestos_mgr_list_remove(os);
 			guestos_purge(os);
 			guestos_free(os);
 		}
@@ -516,7 +580,7 @@ push_config_verify_buf_cb(crypto_verify_result_t verify_result, unsigned char *c
 	}
 
 	// 3. register new os instance
-	guestos_list = list_append(guestos_list, os);
+	guestos_mgr_list_add(os);
 
 	audit_log_event(NULL, SSA, CMLD, GUESTOS_MGMT, "push-os", guestos_basepath, 0);
 
@@ -593,6 +657,7 @@ guestos_mgr_register_localca(unsigned char *cacert, size_t cacertlen)
 	} else {
 		INFO("Successfully installed localca root certificate %s to %s", tmp_cacert_file,
 		     LOCALCA_ROOT_CERT);
+		crypto_verify_cache_flush();
 	}
 	mem_free0(tmp_cacert_file);
 	return ret;
@@ -629,6 +694,7 @@ guestos_mgr_register_newca(unsigned char *cacert, size_t cacertlen)
 	} else {
 		INFO("Successfully installed new ca certificate %s to %s", tmp_cacert_file,
 		     cacert_file);
+		crypto_verify_cache_flush();
 	}
 out:
 	mem_free0(cacert_file);
@@ -644,33 +710,30 @@ guestos_mgr_get_by_version(const char *name, uint64_t version, bool complete)
 {
 	IF_NULL_RETVAL(name, NULL);
 
-	guestos_t *latest_os = NULL;
-	for (list_t *l = guestos_list; l; l = l->next) {
-		if (!strcmp(name, guestos_get_name(l->data))) {
-			guestos_t *os = l->data;
-			uint64_t v = guestos_get_version(os);
-
-			if (v != version) {
-				TRACE("Found correct os name, but with wrong version. Continuing!");
-				continue;
-			}
-
-			// TODO cache image complete result in guestos instance and get rid of check here?
-			if (complete && !guestos_images_are_complete(os, false)) {
-				audit_log_event(NULL, FSA, CMLD, GUESTOS_MGMT, "broken-update",
-						guestos_get_name(os), 0);
-				DEBUG("GuestOS %s v%" PRIu64
-				      " is incomplete (missing images) or broken, skipping.",
-				      guestos_get_name(os), v);
-				continue;
-			}
+	for (list_t *l = guestos_mgr_get_versions(name); l; l = l->next) {
+		guestos_t *os = l->data;
+		uint64_t v = guestos_get_version(os);
 
-			latest_os = os;
+		if (v > version) {
+			TRACE("Found correct os name, but with wrong version. Continuing!");
+			continue;
+		}
+		if (v < version)
 			break;
+
+		if (complete && !guestos_images_are_complete(os, false)) {
+			audit_log_event(NULL, FSA, CMLD, GUESTOS_MGMT, "broken-update",
+					guestos_get_name(os), 0);
+			DEBUG("GuestOS %s v%" PRIu64
+			      " is incomplete (missing images) or broken, skipping.",
+			      guestos_get_name(os), v);
+			continue;
 		}
+
+		return os;
 	}
 
-	return latest_os;
+	return NULL;
 }
 
 guestos_t *
@@ -678,28 +741,26 @@ guestos_mgr_get_latest_by_name(const char *name, bool complete)
 {
 	IF_NULL_RETVAL(name, NULL);
 
-	uint64_t latest_version = 0;
-	guestos_t *latest_os = NULL;
-	for (list_t *l = guestos_list; l; l = l->next) {
-		if (!strcmp(name, guestos_get_name(l->data))) {
-			guestos_t *os = l->data;
-			uint64_t version = guestos_get_version(os);
-			// TODO cache image complete result in guestos instance and get rid of check here?
-			if (complete && !guestos_images_are_complete(os, false)) {
-				audit_log_event(NULL, FSA, CMLD, GUESTOS_MGMT, "broken-update",
-						guestos_get_name(os), 0);
-				DEBUG("GuestOS %s v%" PRIu64
-				      " is incomplete (missing images) or broken, skipping.",
-				      guestos_get_name(os), version);
-				continue;
-			}
-			if (version > latest_version) {
-				latest_version = version;
-				latest_os = os;
-			}
+	// older versions are only checked if all newer ones are incomplete
+	for (list_t *l = guestos_mgr_get_versions(name); l; l = l->next) {
+		guestos_t *os = l->data;
+		uint64_t version = guestos_get_version(os);
+
+		if (version == 0)
+			break;
+
+		if (complete && !guestos_images_are_complete(os, false)) {
+			audit_log_event(NULL, FSA, CMLD, GUESTOS_MGMT, "broken-update",
+					guestos_get_name(os), 0);
+			DEBUG("GuestOS %s v%" PRIu64
+			      " is incomplete (missing images) or broken, skipping.",
+			      guestos_get_name(os), version);
+			continue;
 		}
+
+		return os;
 	}
-	return latest_os;
+	return NULL;
 }
 
 size_t
@@ -27,6 +27,7 @@
 
 #include "hotplug.h"
 
+#include <errno.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -40,9 +41,12 @@
 #include "common/macro.h"
 #include "common/mem.h"
 #include "common/network.h"
+#include "common/nl.h"
 #include "common/str.h"
 #include "common/uevent.h"
 
+#define HOTPLUG_LINK_MSG_LEN 8192
+
 typedef struct hotplug_net_dev_mapping {
 	container_t *container;
 	container_pnet_cfg_t *pnet_cfg;
@@ -51,6 +55,14 @@ typedef struct hotplug_net_dev_mapping {
 
 static uevent_uev_t *uevent_uev = NULL;
 
+// RTM_NEWLINK events signal the readiness of pending net devices
+static nl_sock_t *hotplug_link_sock = NULL;
+static event_io_t *hotplug_link_io = NULL;
+static char hotplug_link_bufs[NL_RECV_BATCH_MAX][HOTPLUG_LINK_MSG_LEN];
+
+// add uevents of net devices which are not ready to be moved yet
+static list_t *hotplug_netif_pending_list = NULL;
+
 // track net devices mapped to containers
 static list_t *hotplug_container_netdev_mapping_list = NULL;
 
@@ -194,7 +206,7 @@ hotplug_rename_interface(const uevent_event_t *event)
 
 	mem_free0(new_ifname);
 	mem_free0(new_devpath);
-	mem_free0(uev_chname);
+	uevent_event_free(uev_chname);
 
 	return uev_chdevpath;
 
@@ -203,8 +215,7 @@ err:
 		mem_free0(new_ifname);
 	if (new_devpath)
 		mem_free0(new_devpath);
-	if (uev_chname)
-		mem_free0(uev_chname);
+	uevent_event_free(uev_chname);
 
 	return NULL;
 }
@@ -277,9 +288,9 @@ hotplug_netdev_move(uevent_event_t *event)
 		     container_get_name(container));
 	}
 
-	// if mac_filter is applied we have a bridge interface and do not
-	// need to send the uevent about the physical if
-	if (pnet_cfg->mac_filter) {
+	// if mac_filter is applied we have a bridge interface, as for macvlan/ipvlan modes we
+	// have a virtual interface, and do not need to send the uevent about the physical if
+	if (pnet_cfg->mac_filter || pnet_cfg->mode != CONTAINER_PNET_MODE_MOVE) {
 		goto out;
 	}
 
@@ -293,55 +304,132 @@ hotplug_netdev_move(uevent_event_t *event)
 		      container_get_name(container));
 	}
 out:
-	if (newevent)
-		mem_free0(newevent);
+	uevent_event_free(newevent);
 	mem_free0(macstr);
 	return 0;
 error:
-	if (newevent)
-		mem_free0(newevent);
+	uevent_event_free(newevent);
 	if (pnet_cfg_c0)
 		mem_free0(pnet_cfg_c0);
 	mem_free0(macstr);
 	return -1;
 }
 
-static void
-hotplug_sysfs_netif_timer_cb(event_timer_t *timer, void *data)
+/*
+ * The add uevent of a wifi interface is sent before cfg80211 has linked its phy in sysfs.
+ * The link exists as soon as the kernel announces the interface by RTM_NEWLINK.
+ */
+static bool
+hotplug_netif_is_ready(const uevent_event_t *event)
 {
-	ASSERT(data);
-	uevent_event_t *event = data;
-
-	// if sysfs is not ready in case of wifi just return and retry.
-	IF_TRUE_RETURN(!strcmp(uevent_event_get_devtype(event), "wlan") &&
-		       !network_interface_is_wifi(uevent_event_get_interface(event)));
+	return strcmp(uevent_event_get_devtype(event), "wlan") ||
+	       network_interface_is_wifi(uevent_event_get_interface(event));
+}
 
+static void
+hotplug_netif_move(uevent_event_t *event)
+{
 	if (hotplug_netdev_move(event) == -1)
 		WARN("Did not move net interface!");
 	else
 		INFO("Moved net interface to target.");
+}
 
-	mem_free0(event);
-	event_remove_timer(timer);
-	event_timer_free(timer);
+/*
+ * Moves the pending net device with the given name if it became ready, or drops it
+ * if it has been removed.
+ */
+static void
+hotplug_netif_pending_handle(const char *ifname, bool removed)
+{
+	for (list_t *l = hotplug_netif_pending_list; l;) {
+		list_t *next = l->next;
+		uevent_event_t *event = l->data;
+
+		if (!strcmp(uevent_event_get_interface(event), ifname) &&
+		    (removed || hotplug_netif_is_ready(event))) {
+			TRACE("%s pending net interface %s", removed ? "Dropping" : "Moving",
+			      ifname);
+			if (!removed)
+				hotplug_netif_move(event);
+			hotplug_netif_pending_list = list_unlink(hotplug_netif_pending_list, l);
+			uevent_event_free(event);
+		}
+		l = next;
+	}
+}
+
+static void
+hotplug_link_nlmsg_handle(struct nlmsghdr *nlh, int len)
+{
+	for (; NLMSG_OK(nlh, (unsigned)len); nlh = NLMSG_NEXT(nlh, len)) {
+		if (nlh->nlmsg_type != RTM_NEWLINK)
+			continue;
+
+		struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+		int attrlen = IFLA_PAYLOAD(nlh);
+		for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, attrlen);
+		     rta = RTA_NEXT(rta, attrlen)) {
+			if (rta->rta_type == IFLA_IFNAME) {
+				hotplug_netif_pending_handle(RTA_DATA(rta), false);
+				break;
+			}
+		}
+	}
+}
+
+static void
+hotplug_link_cb(int fd, unsigned events, UNUSED event_io_t *io, UNUSED void *data)
+{
+	ASSERT(fd == nl_sock_get_fd(hotplug_link_sock));
+
+	char *bufs[NL_RECV_BATCH_MAX];
+	int lens[NL_RECV_BATCH_MAX];
+
+	IF_TRUE_RETURN(events & EVENT_IO_EXCEPT);
+
+	for (int i = 0; i < NL_RECV_BATCH_MAX; i++)
+		bufs[i] = hotplug_link_bufs[i];
+
+	int n = nl_msg_receive_kernel_batch(hotplug_link_sock, bufs, HOTPLUG_LINK_MSG_LEN, lens,
+					    NL_RECV_BATCH_MAX);
+	if (n < 0 && errno != EAGAIN)
+		WARN_ERRNO("Could not receive link events");
+
+	for (int i = 0; i < n; i++) {
+		if (lens[i] < (int)NLMSG_HDRLEN)
+			continue;
+		hotplug_link_nlmsg_handle((struct nlmsghdr *)bufs[i], lens[i]);
+	}
 }
 
 static void
 hotplug_handle_uevent_cb(unsigned actions, uevent_event_t *event, UNUSED void *data)
 {
-	TRACE("Got new add/remove/change uevent");
+	TRACE("Got new net add or remove uevent");
+
+	IF_TRUE_RETURN(strstr(uevent_event_get_devpath(event), "virtual"));
+
+	if (actions & UEVENT_ACTION_REMOVE) {
+		hotplug_netif_pending_handle(uevent_event_get_interface(event), true);
+		return;
+	}
 
 	/* move network ifaces to containers */
-	if (actions & UEVENT_ACTION_ADD && !strcmp(uevent_event_get_subsystem(event), "net") &&
-	    !strstr(uevent_event_get_devpath(event), "virtual")) {
+	if (actions & UEVENT_ACTION_ADD) {
 		// got new physical interface, initially add to cmld tracking list
 		cmld_netif_phys_add_by_name(uevent_event_get_interface(event));
 
-		// give sysfs some time to settle if iface is wifi
-		event_timer_t *e =
-			event_timer_new(100, EVENT_TIMER_REPEAT_FOREVER,
-					hotplug_sysfs_netif_timer_cb, uevent_event_copy_new(event));
-		event_add_timer(e);
+		if (hotplug_netif_is_ready(event)) {
+			hotplug_netif_move(event);
+			return;
+		}
+
+		// the move is completed by the RTM_NEWLINK event of the interface
+		TRACE("Net interface %s not ready, waiting for link event",
+		      uevent_event_get_interface(event));
+		hotplug_netif_pending_list =
+			list_append(hotplug_netif_pending_list, uevent_event_copy_new(event));
 	}
 }
 
@@ -391,10 +479,18 @@ hotplug_init()
 		}
 	}
 
-	// Register uevent handler for kernel events
-	uevent_uev = uevent_uev_new(UEVENT_UEV_TYPE_KERNEL,
-				    UEVENT_ACTION_ADD | UEVENT_ACTION_CHANGE | UEVENT_ACTION_REMOVE,
-				    hotplug_handle_uevent_cb, NULL);
+	// Register handler for link events before uevents, to not miss the readiness of an iface
+	hotplug_link_sock = nl_sock_link_new();
+	IF_NULL_RETVAL_ERROR(hotplug_link_sock, -1);
+
+	hotplug_link_io = event_io_new(nl_sock_get_fd(hotplug_link_sock), EVENT_IO_READ,
+				       hotplug_link_cb, NULL);
+	event_add_io(hotplug_link_io);
+
+	// Register uevent handler for kernel events of new and removed network interfaces
+	uevent_uev = uevent_uev_new_filtered(UEVENT_UEV_TYPE_KERNEL,
+					     UEVENT_ACTION_ADD | UEVENT_ACTION_REMOVE, "net", NULL,
+					     0, hotplug_handle_uevent_cb, NULL);
 
 	IF_TRUE_RETVAL(uevent_add_uev(uevent_uev), -1);
 
@@ -412,6 +508,21 @@ hotplug_init()
 void
 hotplug_cleanup()
 {
+	if (hotplug_link_io) {
+		event_remove_io(hotplug_link_io);
+		event_io_free(hotplug_link_io);
+		hotplug_link_io = NULL;
+	}
+	if (hotplug_link_sock) {
+		nl_sock_free(hotplug_link_sock);
+		hotplug_link_sock = NULL;
+	}
+
+	for (list_t *l = hotplug_netif_pending_list; l; l = l->next)
+		uevent_event_free(l->data);
+	list_delete(hotplug_netif_pending_list);
+	hotplug_netif_pending_list = NULL;
+
 	IF_NULL_RETURN(uevent_uev);
 
 	uevent_remove_uev(uevent_uev);
@@ -0,0 +1,219 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#define _GNU_SOURCE
+
+#include "idlefreeze.h"
+
+#include "cmld.h"
+#include "telemetry.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/list.h"
+#include "common/uuid.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+/* Define cpu usage in per mille of the sampling interval below which a container is idle */
+#define IDLEFREEZE_IDLE_CPU_PERMILLE 10
+
+typedef struct idlefreeze_entry {
+	char uuid[TELEMETRY_UUID_STRLEN];
+	uint64_t sample_ms; // time of the last sample
+	uint64_t cpu_usage_us;
+	uint64_t net_rx_packets;
+	uint64_t idle_since_ms; // time of the last activity
+	bool frozen;		// the container was frozen by us
+	bool seen;		// sampled in the current tick
+} idlefreeze_entry_t;
+
+static telemetry_subscriber_t *idlefreeze_subscriber = NULL;
+static list_t *idlefreeze_entry_list = NULL;
+
+static uint64_t
+idlefreeze_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static idlefreeze_entry_t *
+idlefreeze_entry_get(const char *uuid)
+{
+	for (list_t *l = idlefreeze_entry_list; l; l = l->next) {
+		idlefreeze_entry_t *entry = l->data;
+		if (!strcmp(entry->uuid, uuid))
+			return entry;
+	}
+	return NULL;
+}
+
+static bool
+idlefreeze_is_frozen(container_t *container, idlefreeze_entry_t *entry)
+{
+	compartment_state_t state = container_get_state(container);
+	return entry->frozen &&
+	       (state == COMPARTMENT_STATE_FROZEN || state == COMPARTMENT_STATE_FREEZING);
+}
+
+static void
+idlefreeze_unfreeze(container_t *container, idlefreeze_entry_t *entry, const char *reason)
+{
+	entry->frozen = false;
+	entry->idle_since_ms = idlefreeze_now_ms();
+
+	INFO("Waking up idle container %s on %s", container_get_description(container), reason);
+	if (container_unfreeze(container) < 0)
+		WARN("Could not unfreeze idle container %s", container_get_description(container));
+}
+
+static void
+idlefreeze_sample(container_t *container, idlefreeze_entry_t *entry,
+		  const telemetry_sample_t *sample, uint64_t now)
+{
+	const container_usage_t *usage = &sample->usage;
+
+	uint64_t elapsed_us = (now - entry->sample_ms) * 1000;
+	uint64_t busy_us = usage->cpu_usage_us - entry->cpu_usage_us;
+	bool traffic = usage->net_rx_packets != entry->net_rx_packets;
+
+	entry->sample_ms = now;
+	entry->cpu_usage_us = usage->cpu_usage_us;
+	entry->net_rx_packets = usage->net_rx_packets;
+
+	if (idlefreeze_is_frozen(container, entry)) {
+		// packets queued for the container are counted on the root namespace end
+		if (traffic)
+			idlefreeze_unfreeze(container, entry, "network traffic");
+		return;
+	}
+
+	// unfrozen by someone else in the meantime or not running at all
+	entry->frozen = false;
+	if (container_get_state(container) != COMPARTMENT_STATE_RUNNING ||
+	    busy_us * 1000 > elapsed_us * IDLEFREEZE_IDLE_CPU_PERMILLE || traffic) {
+		entry->idle_since_ms = now;
+		return;
+	}
+
+	uint64_t timeout_ms = (uint64_t)container_get_idle_freeze_timeout(container) * 1000;
+	IF_TRUE_RETURN(now - entry->idle_since_ms < timeout_ms);
+
+	INFO("Freezing container %s, which was idle for %" PRIu64 " seconds",
+	     container_get_description(container), (now - entry->idle_since_ms) / 1000);
+	if (container_freeze(container) < 0) {
+		WARN("Could not freeze idle container %s", container_get_description(container));
+		entry->idle_since_ms = now;
+		return;
+	}
+	entry->frozen = true;
+}
+
+static void
+idlefreeze_telemetry_cb(const telemetry_sample_t *samples, size_t n, UNUSED void *data)
+{
+	uint64_t now = idlefreeze_now_ms();
+
+	for (size_t i = 0; i < n; i++) {
+		uuid_t *uuid = uuid_new(samples[i].uuid);
+		container_t *container = uuid ? cmld_container_get_by_uuid(uuid) : NULL;
+		uuid_free(uuid);
+		if (!container || container_get_idle_freeze_timeout(container) == 0)
+			continue;
+
+		idlefreeze_entry_t *entry = idlefreeze_entry_get(samples[i].uuid);
+		if (!entry) {
+			// the first sample only provides the counters to compare with
+			entry = mem_new0(idlefreeze_entry_t, 1);
+			strcpy(entry->uuid, samples[i].uuid);
+			entry->sample_ms = entry->idle_since_ms = now;
+			entry->cpu_usage_us = samples[i].usage.cpu_usage_us;
+			entry->net_rx_packets = samples[i].usage.net_rx_packets;
+			entry->seen = true;
+			idlefreeze_entry_list = list_append(idlefreeze_entry_list, entry);
+			continue;
+		}
+
+		entry->seen = true;
+		idlefreeze_sample(container, entry, &samples[i], now);
+	}
+
+	// drop the entries of stopped, removed or no longer configured containers
+	for (list_t *l = idlefreeze_entry_list; l;) {
+		idlefreeze_entry_t *entry = l->data;
+		l = l->next;
+		if (!entry->seen) {
+			idlefreeze_entry_list = list_remove(idlefreeze_entry_list, entry);
+			mem_free0(entry);
+		} else {
+			entry->seen = false;
+		}
+	}
+}
+
+void
+idlefreeze_wake(container_t *container, const char *reason)
+{
+	ASSERT(container);
+
+	idlefreeze_entry_t *entry = idlefreeze_entry_get(uuid_string(container_get_uuid(container)));
+	IF_NULL_RETURN(entry);
+
+	if (idlefreeze_is_frozen(container, entry))
+		idlefreeze_unfreeze(container, entry, reason);
+	else
+		entry->idle_since_ms = idlefreeze_now_ms();
+}
+
+int
+idlefreeze_init(void)
+{
+	IF_TRUE_RETVAL(idlefreeze_subscriber, 0);
+
+	if (!telemetry_is_active()) {
+		INFO("Telemetry is disabled, idle containers are not frozen");
+		return 0;
+	}
+
+	idlefreeze_subscriber = telemetry_subscribe(&idlefreeze_telemetry_cb, NULL);
+	return 0;
+}
+
+void
+idlefreeze_cleanup(void)
+{
+	if (idlefreeze_subscriber) {
+		telemetry_unsubscribe(idlefreeze_subscriber);
+		idlefreeze_subscriber = NULL;
+	}
+
+	for (list_t *l = idlefreeze_entry_list; l; l = l->next)
+		mem_free0(l->data);
+	list_delete(idlefreeze_entry_list);
+	idlefreeze_entry_list = NULL;
+}
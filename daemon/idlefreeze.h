@@ -0,0 +1,59 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * Freezes containers which were idle for their configured idle_freeze_timeout. A
+ * container is idle if it hardly used the cpu and did not receive network traffic on
+ * its veths, as sampled by the telemetry module. Frozen containers are woken up again
+ * by traffic for them, which is counted on the veths in the root namespace but not
+ * received as long as the container is frozen, or by activity reported through
+ * idlefreeze_wake(), e.g., exec commands, data for its FIFOs or plugged usb devices.
+ */
+
+#ifndef IDLEFREEZE_H
+#define IDLEFREEZE_H
+
+#include "container.h"
+
+/**
+ * Starts the idle detection on the samples of the telemetry module.
+ *
+ * @return 0 on success, -1 on error
+ */
+int
+idlefreeze_init(void);
+
+void
+idlefreeze_cleanup(void);
+
+/**
+ * Reports activity for the container. Unfreezes the container if it was frozen for
+ * being idle and restarts its idle timeout otherwise.
+ *
+ * @param reason describes the activity for the log
+ */
+void
+idlefreeze_wake(container_t *container, const char *reason);
+
+#endif /* IDLEFREEZE_H */
@@ -0,0 +1,298 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#define _GNU_SOURCE
+
+#include "idshift.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/dir.h"
+
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// number of threads shifting the ownership of a directory tree
+#define IDSHIFT_JOBS 4
+
+#define IDSHIFT_MARKER_MAX 64
+
+typedef struct idshift_dir {
+	int fd;
+	bool changed; // shift the entries of the directory, not only its subdirectories
+} idshift_dir_t;
+
+/* state of a directory tree walk shared by the threads of idshift_tree() */
+typedef struct idshift {
+	int uid_start;
+	time_t since; // directories changed before are unchanged, 0 for a full shift
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	idshift_dir_t queue[IDSHIFT_JOBS]; // directories to be walked by an idle thread
+	int queued;
+	int idle; // threads waiting for a queued directory
+	int busy; // threads walking a directory
+	int errors;
+} idshift_t;
+
+struct idshift_walk {
+	idshift_t *tree;
+	bool changed;
+};
+
+static void
+idshift_error(idshift_t *tree)
+{
+	pthread_mutex_lock(&tree->lock);
+	tree->errors++;
+	pthread_mutex_unlock(&tree->lock);
+}
+
+/**
+ * Shifts the ownership of the entry name in dirfd, or of dirfd itself if name is empty.
+ * Owners which are already shifted are left unchanged.
+ */
+static int
+idshift_entry(idshift_t *tree, int dirfd, const char *name, const struct stat *s)
+{
+	// modulo operation avoids shifting twice
+	uid_t uid = s->st_uid % IDSHIFT_UID_RANGE + tree->uid_start;
+	gid_t gid = s->st_gid % IDSHIFT_UID_RANGE + tree->uid_start;
+
+	if (uid == s->st_uid && gid == s->st_gid)
+		return 0;
+
+	int flags = AT_SYMLINK_NOFOLLOW | (*name ? 0 : AT_EMPTY_PATH);
+	if (fchownat(dirfd, name, uid, gid, flags) < 0) {
+		ERROR_ERRNO("Could not chown '%s' to (%d:%d)", name, uid, gid);
+		return -1;
+	}
+	TRACE("Chown file '%s' to (%d:%d) (uid_start %d)", name, uid, gid, tree->uid_start);
+	return 0;
+}
+
+static void
+idshift_walk(idshift_t *tree, int dirfd, bool changed);
+
+static int
+idshift_dir_cb(int dirfd, const char *name, unsigned char type, void *data)
+{
+	struct stat s;
+	struct idshift_walk *walk = data;
+	idshift_t *tree = walk->tree;
+	ASSERT(tree);
+
+	// entries of unchanged directories are only looked at for walking subdirectories
+	if (!walk->changed && dir_entry_type(dirfd, name, type) != DT_DIR)
+		return 0;
+
+	if (fstatat(dirfd, name, &s, AT_SYMLINK_NOFOLLOW) == -1) {
+		ERROR_ERRNO("Could not stat '%s'", name);
+		idshift_error(tree);
+		return 0;
+	}
+
+	if (idshift_entry(tree, dirfd, name, &s) < 0)
+		idshift_error(tree);
+
+	if (!S_ISDIR(s.st_mode))
+		return 0;
+
+	TRACE("Path %s is dir", name);
+	int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		ERROR_ERRNO("Could not open dir '%s'", name);
+		idshift_error(tree);
+		return 0;
+	}
+	bool changed = !tree->since || s.st_ctime >= tree->since;
+
+	// hand the subtree over to an idle thread, otherwise walk it in this thread
+	bool queued = false;
+	pthread_mutex_lock(&tree->lock);
+	if (tree->idle > tree->queued && tree->queued < IDSHIFT_JOBS) {
+		tree->queue[tree->queued++] = (idshift_dir_t){ .fd = fd, .changed = changed };
+		pthread_cond_signal(&tree->cond);
+		queued = true;
+	}
+	pthread_mutex_unlock(&tree->lock);
+
+	if (!queued) {
+		idshift_walk(tree, fd, changed);
+		close(fd);
+	}
+	return 0;
+}
+
+static void
+idshift_walk(idshift_t *tree, int dirfd, bool changed)
+{
+	struct idshift_walk walk = { .tree = tree, .changed = changed };
+
+	if (dir_foreach_at(dirfd, &idshift_dir_cb, &walk) < 0) {
+		ERROR_ERRNO("Could not read dir contents");
+		idshift_error(tree);
+	}
+}
+
+static void *
+idshift_worker(void *data)
+{
+	idshift_t *tree = data;
+
+	pthread_mutex_lock(&tree->lock);
+	for (;;) {
+		while (tree->queued == 0 && tree->busy > 0) {
+			tree->idle++;
+			pthread_cond_wait(&tree->cond, &tree->lock);
+			tree->idle--;
+		}
+		// no queued directories and no thread left which could queue one
+		if (tree->queued == 0)
+			break;
+
+		idshift_dir_t dir = tree->queue[--tree->queued];
+		tree->busy++;
+		pthread_mutex_unlock(&tree->lock);
+
+		idshift_walk(tree, dir.fd, dir.changed);
+		close(dir.fd);
+
+		pthread_mutex_lock(&tree->lock);
+		if (--tree->busy == 0 && tree->queued == 0)
+			pthread_cond_broadcast(&tree->cond);
+	}
+	pthread_mutex_unlock(&tree->lock);
+	return NULL;
+}
+
+/**
+ * Reads the shift marker of the tree opened as fd.
+ * @return the time of the last shift to uid_start, 0 if there is no matching marker
+ */
+static time_t
+idshift_marker_get(int fd, int uid_start)
+{
+	char marker[IDSHIFT_MARKER_MAX];
+	int uid;
+	long long since;
+
+	ssize_t len = fgetxattr(fd, IDSHIFT_XATTR, marker, sizeof(marker) - 1);
+	if (len < 0)
+		return 0;
+	marker[len] = '\0';
+
+	if (sscanf(marker, "%d %lld", &uid, &since) != 2 || uid != uid_start)
+		return 0;
+	return since;
+}
+
+static void
+idshift_marker_set(int fd, int uid_start, time_t since)
+{
+	char *marker = mem_printf("%d %lld", uid_start, (long long)since);
+	if (fsetxattr(fd, IDSHIFT_XATTR, marker, strlen(marker), 0) < 0)
+		DEBUG_ERRNO("Could not set shift marker, tree will be shifted completely again");
+	mem_free0(marker);
+}
+
+int
+idshift_tree(const char *path, int uid_start, bool persistent)
+{
+	struct stat s;
+	pthread_t threads[IDSHIFT_JOBS - 1];
+	int nthreads = 0;
+
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		ERROR_ERRNO("Could not open dir '%s'", path);
+		return -1;
+	}
+
+	idshift_t tree = { .uid_start = uid_start,
+			   .lock = PTHREAD_MUTEX_INITIALIZER,
+			   .cond = PTHREAD_COND_INITIALIZER };
+
+	if (persistent) {
+		tree.since = idshift_marker_get(fd, uid_start);
+		// an interrupted shift must not leave a valid marker behind
+		if (fremovexattr(fd, IDSHIFT_XATTR) < 0 && errno != ENODATA)
+			TRACE_ERRNO("Could not remove shift marker of '%s'", path);
+	}
+	DEBUG("Shifting %s '%s' to uid_start %d", tree.since ? "changes of" : "all of", path,
+	      uid_start);
+
+	if (fstat(fd, &s) < 0 || idshift_entry(&tree, fd, "", &s) < 0) {
+		ERROR_ERRNO("Could not chown dir '%s'", path);
+		close(fd);
+		return -1;
+	}
+
+	// the queued fd is closed by the walk, keep fd for the marker
+	int walk_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (walk_fd < 0) {
+		ERROR_ERRNO("Could not dup fd of dir '%s'", path);
+		close(fd);
+		return -1;
+	}
+	tree.queue[tree.queued++] = (idshift_dir_t){
+		.fd = walk_fd, .changed = !tree.since || s.st_ctime >= tree.since
+	};
+
+	// the calling thread walks the tree as well
+	for (int i = 0; i < IDSHIFT_JOBS - 1; i++) {
+		if (pthread_create(&threads[nthreads], NULL, idshift_worker, &tree)) {
+			WARN("Could not create chown thread, continuing with %d", nthreads + 1);
+			break;
+		}
+		nthreads++;
+	}
+	idshift_worker(&tree);
+
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&tree.lock);
+	pthread_cond_destroy(&tree.cond);
+
+	if (tree.errors) {
+		ERROR("Could not chown %d entries below '%s'", tree.errors, path);
+		close(fd);
+		return -1;
+	}
+
+	// directories changed from now on are shifted again, including those of this second
+	if (persistent)
+		idshift_marker_set(fd, uid_start, time(NULL));
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#ifndef IDSHIFT_H
+#define IDSHIFT_H
+
+/**
+ * @file idshift.h Shifts the ownership of directory trees to the uid range of a container.
+ *
+ * This is used by c_shiftid and c_idmapped if the kernel cannot map the ids of a mount.
+ *
+ * Each inode gets the uid (gid) (uid % IDSHIFT_UID_RANGE) + uid_start, so trees which
+ * are already shifted to a range are not shifted twice. Persistent shifts store a
+ * marker with uid_start and the time of the shift in the xattr IDSHIFT_XATTR of the
+ * top directory. If the marker matches on the next shift, only the entries of the
+ * directories which were changed since then are shifted, which covers files created
+ * from the host with the ids of the root user namespace. Ownership changes of
+ * existing files below unchanged directories are not detected.
+ */
+
+#include <stdbool.h>
+
+#define IDSHIFT_UID_RANGE 100000
+
+#define IDSHIFT_XATTR "trusted.cml.idshift"
+
+/**
+ * Shifts the ownership of the directory path and all entries below to the uid range
+ * starting at uid_start. Symbolic links are not followed.
+ *
+ * @param path The top directory of the tree.
+ * @param uid_start The first uid of the range, 0 reverts a shift.
+ * @param persistent Use and update the shift marker of the tree.
+ * @return 0 on success, -1 if any entry could not be shifted
+ */
+int
+idshift_tree(const char *path, int uid_start, bool persistent);
+
+#endif /* IDSHIFT_H */
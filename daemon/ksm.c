@@ -21,11 +21,28 @@
  * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
  */
 
+/*
+ * Adaptive KSM controller. Merging pages costs ksmd cpu time, which is wasted if the
+ * scanned pages are unique. Thus, the scan rate is adapted periodically to the number of
+ * pages merged per cpu second of ksmd. The rate is raised while merging pays off and lowered
+ * step by step after full scans which merged hardly anything.
+ */
+
+#define _GNU_SOURCE
+
 #include "ksm.h"
 
 #include "common/macro.h"
+#include "common/mem.h"
 #include "common/event.h"
 #include "common/file.h"
+#include "common/proc.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #define KSM_PATH "/sys/kernel/mm/ksm/"
 
@@ -35,7 +52,30 @@
 #define KSM_AGGRESSIVE_SLEEP_MILLISECS 100
 #define KSM_AGGRESSIVE_PAGES_TO_SCAN 500
 
+/* bounds of the scan rate set by the controller */
+#define KSM_MIN_SLEEP_MILLISECS 20
+#define KSM_MAX_SLEEP_MILLISECS 10000
+#define KSM_MIN_PAGES_TO_SCAN 100
+#define KSM_MAX_PAGES_TO_SCAN 4000
+
+/* interval of the controller in milliseconds */
+#define KSM_CONTROL_INTERVAL 5000
+
+/* merged pages per cpu second of ksmd above which the scan rate is raised */
+#define KSM_EFFICIENT_PAGES_PER_CPU_SEC 10000
+/* merged pages per cpu second of ksmd below which the scan rate is lowered */
+#define KSM_INEFFICIENT_PAGES_PER_CPU_SEC 1000
+
 static event_timer_t *ksm_timer;
+static event_timer_t *ksm_control_timer;
+
+static int ksm_sleep_millisecs = KSM_RELAXED_SLEEP_MILLISECS;
+static int ksm_pages_to_scan = KSM_RELAXED_PAGES_TO_SCAN;
+
+static pid_t ksm_ksmd_pid;
+static uint64_t ksm_last_pages_sharing;
+static uint64_t ksm_last_full_scans;
+static uint64_t ksm_last_cpu_ticks;
 
 static void
 ksm_set(int sleep_millisecs, int pages_to_scan)
@@ -46,7 +86,10 @@ ksm_set(int sleep_millisecs, int pages_to_scan)
 	}
 	if (file_printf(KSM_PATH "pages_to_scan", "%d", pages_to_scan) < 0) {
 		WARN("Could not configure KSM; no kernel support?");
+		return;
 	}
+	ksm_sleep_millisecs = sleep_millisecs;
+	ksm_pages_to_scan = pages_to_scan;
 }
 
 static void
@@ -57,18 +100,105 @@ ksm_set_aggressive()
 	ksm_set(KSM_AGGRESSIVE_SLEEP_MILLISECS, KSM_AGGRESSIVE_PAGES_TO_SCAN);
 }
 
+static int
+ksm_read_counter(const char *name, int64_t *value)
+{
+	char *path = mem_printf("%s%s", KSM_PATH, name);
+	char *buf = file_read_new(path, 64);
+	mem_free0(path);
+	IF_NULL_RETVAL_TRACE(buf, -1);
+
+	int ret = sscanf(buf, "%" SCNd64, value) == 1 ? 0 : -1;
+	mem_free0(buf);
+	return ret;
+}
+
+/*
+ * Returns the cpu time consumed by ksmd in clock ticks.
+ */
+static int
+ksm_read_cpu_ticks(uint64_t *ticks)
+{
+	unsigned long utime, stime;
+
+	IF_TRUE_RETVAL_TRACE(ksm_ksmd_pid <= 0, -1);
+
+	char *path = mem_printf("/proc/%d/stat", ksm_ksmd_pid);
+	char *buf = file_read_new(path, 1024);
+	mem_free0(path);
+	IF_NULL_RETVAL_TRACE(buf, -1);
+
+	// skip pid and comm, utime and stime are the 14th and 15th field
+	char *fields = strrchr(buf, ')');
+	int ret = -1;
+	if (fields && sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+			     &utime, &stime) == 2) {
+		*ticks = utime + stime;
+		ret = 0;
+	}
+	mem_free0(buf);
+	return ret;
+}
+
 static void
-ksm_set_relaxed()
+ksm_control_cb(UNUSED event_timer_t *timer, UNUSED void *data)
 {
-	DEBUG("Setting KSM relaxed settings (sleep_millisecs=%d, pages_to_scan=%d",
-	      KSM_RELAXED_SLEEP_MILLISECS, KSM_RELAXED_PAGES_TO_SCAN);
-	ksm_set(KSM_RELAXED_SLEEP_MILLISECS, KSM_RELAXED_PAGES_TO_SCAN);
+	int64_t pages_sharing, pages_unshared, full_scans, general_profit;
+	uint64_t cpu_ticks;
+
+	if (ksm_read_counter("pages_sharing", &pages_sharing) < 0 ||
+	    ksm_read_counter("pages_unshared", &pages_unshared) < 0 ||
+	    ksm_read_counter("full_scans", &full_scans) < 0 || ksm_read_cpu_ticks(&cpu_ticks) < 0) {
+		TRACE("Could not read KSM counters");
+		return;
+	}
+	bool has_profit = ksm_read_counter("general_profit", &general_profit) == 0;
+
+	int64_t merged = pages_sharing - (int64_t)ksm_last_pages_sharing;
+	uint64_t cpu_ms = (cpu_ticks - ksm_last_cpu_ticks) * 1000 / sysconf(_SC_CLK_TCK);
+	bool full_scan_done = (uint64_t)full_scans != ksm_last_full_scans;
+
+	ksm_last_pages_sharing = pages_sharing;
+	ksm_last_full_scans = full_scans;
+	ksm_last_cpu_ticks = cpu_ticks;
+
+	// keep the scan rate requested by ksm_set_aggressive_for()
+	IF_TRUE_RETURN(ksm_timer);
+
+	int64_t efficiency = merged * 1000 / (int64_t)MAX(cpu_ms, 1);
+
+	TRACE("KSM: sharing=%" PRId64 " unshared=%" PRId64 " merged=%" PRId64
+	      " cpu=%" PRIu64 "ms efficiency=%" PRId64 " pages/cpu-s",
+	      pages_sharing, pages_unshared, merged, cpu_ms, efficiency);
+
+	int sleep_millisecs = ksm_sleep_millisecs;
+	int pages_to_scan = ksm_pages_to_scan;
+
+	if (efficiency >= KSM_EFFICIENT_PAGES_PER_CPU_SEC && (!has_profit || general_profit > 0)) {
+		// merging pays off, scan faster
+		pages_to_scan = MIN(pages_to_scan * 2, KSM_MAX_PAGES_TO_SCAN);
+		sleep_millisecs = MAX(sleep_millisecs / 2, KSM_MIN_SLEEP_MILLISECS);
+	} else if ((full_scan_done && efficiency < KSM_INEFFICIENT_PAGES_PER_CPU_SEC) ||
+		   (has_profit && general_profit < 0)) {
+		// a full scan hardly merged anything or KSM costs more than it saves, back off
+		pages_to_scan = MAX(pages_to_scan / 2, KSM_MIN_PAGES_TO_SCAN);
+		sleep_millisecs = MIN(sleep_millisecs * 2, KSM_MAX_SLEEP_MILLISECS);
+	}
+
+	IF_TRUE_RETURN(sleep_millisecs == ksm_sleep_millisecs &&
+		       pages_to_scan == ksm_pages_to_scan);
+
+	DEBUG("Adapting KSM to %" PRId64 " merged pages per cpu second "
+	      "(sleep_millisecs=%d, pages_to_scan=%d)",
+	      efficiency, sleep_millisecs, pages_to_scan);
+	ksm_set(sleep_millisecs, pages_to_scan);
 }
 
 static void
 ksm_set_aggressive_timeout_cb(UNUSED event_timer_t *timer, UNUSED void *data)
 {
-	ksm_set_relaxed();
+	// the controller adapts the scan rate again from the aggressive settings
+	DEBUG("KSM aggressive period finished");
 
 	event_remove_timer(ksm_timer);
 	event_timer_free(ksm_timer);
@@ -87,7 +217,7 @@ ksm_set_aggressive_for(int millisecs)
 		ksm_timer = NULL;
 	}
 
-	/* register timer to relax KSM after millisecs time */
+	/* register timer to hand KSM back to the controller after millisecs time */
 	ksm_timer = event_timer_new(millisecs, 1, &ksm_set_aggressive_timeout_cb, NULL);
 	event_add_timer(ksm_timer);
 }
@@ -107,5 +237,25 @@ ksm_init()
 		WARN("Could not configure KSM; no kernel support?");
 		return -1;
 	}
+
+	// ksmd is a kernel thread, i.e. a child of kthreadd
+	ksm_ksmd_pid = proc_find(2, "ksmd");
+	if (ksm_ksmd_pid <= 0) {
+		WARN("Could not find ksmd, using fixed KSM settings");
+		return 0;
+	}
+
+	int64_t value;
+	if (ksm_read_counter("pages_sharing", &value) == 0)
+		ksm_last_pages_sharing = value;
+	if (ksm_read_counter("full_scans", &value) == 0)
+		ksm_last_full_scans = value;
+	if (ksm_read_cpu_ticks(&ksm_last_cpu_ticks) < 0)
+		ksm_last_cpu_ticks = 0;
+
+	ksm_control_timer = event_timer_new(KSM_CONTROL_INTERVAL, EVENT_TIMER_REPEAT_FOREVER,
+					    &ksm_control_cb, NULL);
+	event_add_timer(ksm_control_timer);
+
 	return 0;
 }
@@ -28,13 +28,74 @@
 #include "common/dir.h"
 #include "common/event.h"
 #include "common/file.h"
+#include "common/list.h"
 
 #include <sys/mount.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE 1
+#endif
+
+#ifndef OPEN_TREE_CLOEXEC
+#define OPEN_TREE_CLOEXEC O_CLOEXEC
+#endif
+
+#ifndef AT_RECURSIVE
+#define AT_RECURSIVE 0x8000
+#endif
+
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+
+// clang-format off
+#ifndef __NR_open_tree
+	#if defined __alpha__
+		#define __NR_open_tree 538
+	#elif defined _MIPS_SIM
+		#if _MIPS_SIM == _MIPS_SIM_ABI32        /* o32 */
+			#define __NR_open_tree 4428
+		#endif
+		#if _MIPS_SIM == _MIPS_SIM_NABI32       /* n32 */
+			#define __NR_open_tree 6428
+		#endif
+		#if _MIPS_SIM == _MIPS_SIM_ABI64        /* n64 */
+			#define __NR_open_tree 5428
+		#endif
+	#elif defined __ia64__
+		#define __NR_open_tree (428 + 1024)
+	#else
+		#define __NR_open_tree 428
+	#endif
+#endif
+
+#ifndef __NR_move_mount
+	#if defined __alpha__
+		#define __NR_move_mount 539
+	#elif defined _MIPS_SIM
+		#if _MIPS_SIM == _MIPS_SIM_ABI32
+			#define __NR_move_mount 4429
+		#endif
+		#if _MIPS_SIM == _MIPS_SIM_NABI32
+			#define __NR_move_mount 6429
+		#endif
+		#if _MIPS_SIM == _MIPS_SIM_ABI64
+			#define __NR_move_mount 5429
+		#endif
+	#elif defined __ia64__
+		#define __NR_move_mount (428 + 1024)
+	#else
+		#define __NR_move_mount 429
+	#endif
+#endif
+// clang-format on
+
 #define LXCFS_RT_PATH "/var/lib/lxcfs"
 #define LXCFS_PID_FILE "/run/lxcfs.cmld.pid"
 
@@ -42,6 +103,9 @@ static const char *lxcfs_bin_path = NULL;
 static const char *lxcfs_rt_path = NULL;
 static pid_t lxcfs_daemon_pid = 0;
 
+// detached trees of the lxcfs proc files, cloned for the overlay of each container
+static lxcfs_proc_overlay_t *lxcfs_proc_template = NULL;
+
 #define PROC_FSES "/proc/filesystems"
 static const char *
 lxcfs_get_bin_path_if_supported(void)
@@ -66,21 +130,16 @@ lxcfs_get_bin_path_if_supported(void)
 }
 
 static void
-lxcfs_daemon_sigchld_cb(UNUSED int signum, event_signal_t *sig, void *data)
+lxcfs_daemon_child_cb(pid_t pid, UNUSED int status, event_child_t *child, UNUSED void *data)
 {
-	pid_t *lxcfs_pid = data;
-	pid_t pid;
-	int status = 0;
-
-	TRACE("lxcfs SIGCHLD handler called for PID %d", *lxcfs_pid);
-	if ((pid = waitpid(*lxcfs_pid, &status, WNOHANG)) > 0) {
-		TRACE("Reaped lxcfs process: %d", pid);
-		/* remove the sigchld callback for the lxcfs daemon from the event loop */
-		event_remove_signal(sig);
-		event_signal_free(sig);
-	} else {
-		TRACE("Failed to reap lxcfs process");
+	TRACE("Reaped lxcfs process: %d", pid);
+	if (lxcfs_daemon_pid == pid) {
+		lxcfs_daemon_pid = 0;
+		// the trees refer to the fuse mount of the exited daemon
+		lxcfs_proc_overlay_free(lxcfs_proc_template);
+		lxcfs_proc_template = NULL;
 	}
+	event_child_free(child);
 }
 
 static void
@@ -123,9 +182,9 @@ lxcfs_daemon_start(const char *rt_path)
 		_exit(-1);
 	} else {
 		INFO("lxcfs daemon start done");
-		event_signal_t *sigchld =
-			event_signal_new(SIGCHLD, lxcfs_daemon_sigchld_cb, &lxcfs_daemon_pid);
-		event_add_signal(sigchld);
+		event_child_t *child =
+			event_child_new(lxcfs_daemon_pid, lxcfs_daemon_child_cb, NULL);
+		event_add_child(child);
 	}
 
 	return 0;
@@ -137,23 +196,40 @@ lxcfs_is_supported(void)
 	return (lxcfs_bin_path) ? true : false;
 }
 
-static int
-lxcfs_proc_dir_foreach_cb(const char *path, const char *file, void *data)
-{
-	char *target_path = data;
-	ASSERT(target_path);
+typedef struct lxcfs_proc_overlay_file {
+	char *name; // name of the overlaid file in proc
+	int fd;	    // detached bind mount tree of the file
+} lxcfs_proc_overlay_file_t;
+
+struct lxcfs_proc_overlay {
+	list_t *files; // lxcfs_proc_overlay_file_t
+};
 
+static bool
+lxcfs_proc_file_is_skipped(const char *file)
+{
 	if (0 == strcmp(file, "mounts")) {
 		TRACE("Skipping 'mounts'");
-		return 0;
+		return true;
 	}
 
 	// seems to be to unstable if frequently accessed
 	if (0 == strcmp(file, "stat")) {
 		TRACE("Skipping 'stat'");
-		return 0;
+		return true;
 	}
 
+	return false;
+}
+
+static int
+lxcfs_proc_dir_foreach_cb(const char *path, const char *file, void *data)
+{
+	char *target_path = data;
+	ASSERT(target_path);
+
+	IF_TRUE_RETVAL(lxcfs_proc_file_is_skipped(file), 0);
+
 	char *dst = mem_printf("%s/%s", target_path, file);
 	char *src = mem_printf("%s/%s", path, file);
 
@@ -184,6 +260,125 @@ lxcfs_mount_proc_overlay(char *target)
 	return ret;
 }
 
+static int
+lxcfs_proc_overlay_open_cb(const char *path, const char *file, void *data)
+{
+	lxcfs_proc_overlay_t *overlay = data;
+	ASSERT(overlay);
+
+	IF_TRUE_RETVAL(lxcfs_proc_file_is_skipped(file), 0);
+
+	char *src = mem_printf("%s/%s", path, file);
+	int fd = syscall(__NR_open_tree, -1, src, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+	if (fd < 0) {
+		// not supported by the kernel or the overlay (fuse)
+		DEBUG_ERRNO("Could not open_tree %s from lxcfs", src);
+		mem_free0(src);
+		return -1;
+	}
+
+	TRACE("Opened detached tree %d of %s from lxcfs", fd, src);
+	lxcfs_proc_overlay_file_t *f = mem_new0(lxcfs_proc_overlay_file_t, 1);
+	f->name = mem_strdup(file);
+	f->fd = fd;
+	overlay->files = list_append(overlay->files, f);
+
+	mem_free0(src);
+	return 0;
+}
+
+static lxcfs_proc_overlay_t *
+lxcfs_proc_template_get(void)
+{
+	IF_TRUE_RETVAL(lxcfs_proc_template, lxcfs_proc_template);
+
+	lxcfs_proc_overlay_t *template = mem_new0(lxcfs_proc_overlay_t, 1);
+
+	char *lxcfs_proc = mem_printf("%s/proc", lxcfs_rt_path);
+	if (dir_foreach(lxcfs_proc, &lxcfs_proc_overlay_open_cb, template) < 0) {
+		DEBUG("Could not prepare proc overlay of %s, bind mounting in child", lxcfs_proc);
+		lxcfs_proc_overlay_free(template);
+		template = NULL;
+	} else {
+		DEBUG("Prepared proc overlay of %s", lxcfs_proc);
+	}
+
+	mem_free0(lxcfs_proc);
+	lxcfs_proc_template = template;
+	return template;
+}
+
+lxcfs_proc_overlay_t *
+lxcfs_proc_overlay_new(void)
+{
+	IF_FALSE_RETVAL(lxcfs_is_supported(), NULL);
+
+	lxcfs_proc_overlay_t *template = lxcfs_proc_template_get();
+	IF_NULL_RETVAL(template, NULL);
+
+	// clone the detached trees of the template, which saves the lookups through fuse
+	lxcfs_proc_overlay_t *overlay = mem_new0(lxcfs_proc_overlay_t, 1);
+	for (list_t *l = template->files; l; l = l->next) {
+		lxcfs_proc_overlay_file_t *t = l->data;
+		unsigned int flags =
+			OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_EMPTY_PATH | AT_RECURSIVE;
+		int fd = syscall(__NR_open_tree, t->fd, "", flags);
+		if (fd < 0) {
+			DEBUG_ERRNO("Could not clone detached tree of %s from lxcfs", t->name);
+			lxcfs_proc_overlay_free(overlay);
+			// rebuild the template on the next start
+			lxcfs_proc_overlay_free(lxcfs_proc_template);
+			lxcfs_proc_template = NULL;
+			return NULL;
+		}
+
+		lxcfs_proc_overlay_file_t *f = mem_new0(lxcfs_proc_overlay_file_t, 1);
+		f->name = mem_strdup(t->name);
+		f->fd = fd;
+		overlay->files = list_append(overlay->files, f);
+	}
+
+	return overlay;
+}
+
+int
+lxcfs_proc_overlay_mount(lxcfs_proc_overlay_t *overlay, const char *target)
+{
+	ASSERT(overlay);
+	ASSERT(target);
+
+	int ret = 0;
+	for (list_t *l = overlay->files; l; l = l->next) {
+		lxcfs_proc_overlay_file_t *f = l->data;
+		char *dst = mem_printf("%s/%s", target, f->name);
+
+		if (syscall(__NR_move_mount, f->fd, "", -1, dst, MOVE_MOUNT_F_EMPTY_PATH) < 0) {
+			ERROR_ERRNO("failed to overlay %s with %s from lxcfs!", dst, f->name);
+			ret = -1;
+		} else {
+			TRACE("Applied overlay on %s with %s from lxcfs!", dst, f->name);
+		}
+
+		mem_free0(dst);
+	}
+	return ret;
+}
+
+void
+lxcfs_proc_overlay_free(lxcfs_proc_overlay_t *overlay)
+{
+	IF_NULL_RETURN(overlay);
+
+	for (list_t *l = overlay->files; l; l = l->next) {
+		lxcfs_proc_overlay_file_t *f = l->data;
+		close(f->fd);
+		mem_free0(f->name);
+		mem_free0(f);
+	}
+	list_delete(overlay->files);
+	mem_free0(overlay);
+}
+
 int
 lxcfs_init(void)
 {
@@ -199,5 +394,7 @@ lxcfs_init(void)
 void
 lxcfs_cleanup(void)
 {
+	lxcfs_proc_overlay_free(lxcfs_proc_template);
+	lxcfs_proc_template = NULL;
 	lxcfs_daemon_stop();
 }
@@ -53,3 +53,36 @@ lxcfs_is_supported(void);
  */
 int
 lxcfs_mount_proc_overlay(char *target);
+
+typedef struct lxcfs_proc_overlay lxcfs_proc_overlay_t;
+
+/**
+ * Prepares the lxcfs provided virtualization of proc files ahead of a container start.
+ * For each proc file, a detached bind mount tree is cloned with open_tree() from the
+ * trees opened once from the lxcfs mount in cmld, so that the child only has to attach
+ * them with lxcfs_proc_overlay_mount().
+ *
+ * @return the prepared overlay, NULL if lxcfs is not supported or the kernel does not
+ *         support open_tree; use lxcfs_mount_proc_overlay() in that case
+ */
+lxcfs_proc_overlay_t *
+lxcfs_proc_overlay_new(void);
+
+/**
+ * Attaches the detached trees of a prepared overlay to the proc files in target.
+ * Each tree can only be attached once.
+ *
+ * @param overlay the prepared overlay
+ * @param target Target proc directory
+ * @return 0 on success, -1 otherwise
+ */
+int
+lxcfs_proc_overlay_mount(lxcfs_proc_overlay_t *overlay, const char *target);
+
+/**
+ * Closes the detached trees of a prepared overlay and frees it.
+ *
+ * @param overlay the prepared overlay
+ */
+void
+lxcfs_proc_overlay_free(lxcfs_proc_overlay_t *overlay);
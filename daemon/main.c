@@ -32,6 +32,8 @@
 #include "common/event.h"
 #include "common/file.h"
 #include "common/logf.h"
+#include "common/logrotate.h"
+#include "common/mem.h"
 
 #include "cmld.h"
 #include "lxcfs.h"
@@ -47,7 +49,11 @@
 #include <string.h>
 
 logf_handler_t *cml_daemon_logfile_handler = NULL;
+#define MAIN_MEM_STATS_DUMP_SITES 20
+
 static void *main_logfile_p = NULL;
+// the log file is written asynchronously, since it gets all messages down to TRACE
+static void *main_logfile_async = NULL;
 static bool is_handling_sigint = false;
 
 /******************************************************************************/
@@ -86,25 +92,43 @@ main_sigterm_cb(UNUSED int signum, UNUSED event_signal_t *sig, UNUSED void *data
 }
 
 static void
-main_logfile_rename_cb(UNUSED event_timer_t *timer, UNUSED void *data)
+main_sigusr2_cb(UNUSED int signum, UNUSED event_signal_t *sig, UNUSED void *data)
+{
+	INFO("Received SIGUSR2, dumping allocation statistics..");
+	mem_stats_dump(MAIN_MEM_STATS_DUMP_SITES);
+}
+
+static void
+main_logfile_rotate_cb(FILE *file, UNUSED void *data)
 {
 	DEBUG("Logfile will be closed and a new file opened");
 	logf_unregister(cml_daemon_logfile_handler);
+	logf_async_free(main_logfile_async);
 	logf_file_close(main_logfile_p);
 
-	main_logfile_p = logf_file_new(LOGFILE_DIR "/cml-daemon");
-	cml_daemon_logfile_handler = logf_register(&logf_file_write, main_logfile_p);
+	main_logfile_p = file;
+	main_logfile_async = logf_async_new(&logf_file_write, main_logfile_p);
+	cml_daemon_logfile_handler = logf_register(&logf_async_write, main_logfile_async);
 	logf_handler_set_prio(cml_daemon_logfile_handler, LOGF_PRIO_TRACE);
 }
 
+static void
+main_logfile_flush(void)
+{
+	logf_async_flush(main_logfile_async);
+}
+
 static void INIT
 main_init(void)
 {
 	logf_register(&logf_file_write, stdout);
 
 	main_logfile_p = logf_file_new(LOGFILE_DIR "/cml-daemon");
-	cml_daemon_logfile_handler = logf_register(&logf_file_write, main_logfile_p);
+	main_logfile_async = logf_async_new(&logf_file_write, main_logfile_p);
+	cml_daemon_logfile_handler = logf_register(&logf_async_write, main_logfile_async);
 	logf_handler_set_prio(cml_daemon_logfile_handler, LOGF_PRIO_TRACE);
+	if (atexit(&main_logfile_flush))
+		WARN("Could not register flush of the log file at exit");
 
 	main_core_dump_enable();
 }
@@ -131,11 +155,13 @@ main(int argc, char **argv)
 	event_signal_t *sig_term = event_signal_new(SIGTERM, &main_sigterm_cb, NULL);
 	event_add_signal(sig_term);
 
+	event_signal_t *sig_usr2 = event_signal_new(SIGUSR2, &main_sigusr2_cb, NULL);
+	event_add_signal(sig_usr2);
+
 	DEBUG("Initializing cmld...");
-	event_timer_t *logfile_timer =
-		event_timer_new(HOURS_TO_MILLISECONDS(24), EVENT_TIMER_REPEAT_FOREVER,
-				main_logfile_rename_cb, NULL);
-	event_add_timer(logfile_timer);
+	if (!logrotate_new(LOGFILE_DIR "/cml-daemon", main_logfile_p, LOGFILE_MAX_SIZE,
+			   LOGFILE_MAX_AGE, LOGFILE_KEEP, &main_logfile_rotate_cb, NULL))
+		WARN("Could not rotate the log file");
 
 	if (cmld_init(path) < 0)
 		FATAL("Could not init cmld");
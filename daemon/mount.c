@@ -25,7 +25,6 @@
 #include <sched.h>
 
 #include "mount.h"
-#include "crypto.h"
 
 #include "common/macro.h"
 #include "common/mem.h"
@@ -39,23 +38,34 @@
 #include <sys/types.h>
 
 struct mount {
-	list_t *list; /**< list of mount entries */
+	list_t *list;		    /**< list of mount entries */
+	off_t disk_usage_container; /**< max disk usage of the entries as container images */
+	off_t disk_usage_guestos;   /**< max disk usage of the entries as guestos images */
 };
 
 struct mount_entry {
+	mount_t *mnt;	      /**< mount table of the entry */
 	enum mount_type type; /**< type of the image file */
 	char *image_file;     /**< image name without suffix, e.g. "system" */
 	char *mount_point; /**< directory where to mount the image inside the container, e.g. /system */
 	char *fs_type;	   /**< file system type of the mount, e.g. ext4 */
 	uint64_t default_size; /**< default size for EMPTY images */
 	uint64_t image_size;   /**< size overwriting default_size */
+	uint32_t block_size; /**< block size of a compressed read-only image, 0 if unknown */
 	// TODO: add list of hash, min/max size for EMPTY images, etc.
 	char *sha1;
 	char *sha256;
+	digest_t sha1_digest;	/**< sha1 parsed once for comparisons, unset if invalid */
+	digest_t sha256_digest; /**< sha256 parsed once for comparisons, unset if invalid */
 	char *mount_data; /**< mount_data to use for mount syscall e.g. "uid=1000,gid=1000,dmask=227,fmask=337,context=u:object_r:firmware_file:s0" */
 	char *verity_sha256;
+	char *fsverity_sha256;
+	digest_t fsverity_digest; /**< fs-verity digest parsed once, unset if invalid */
 };
 
+static void
+mount_update_disk_usage(mount_t *mnt);
+
 mount_t *
 mount_new(void)
 {
@@ -70,6 +80,7 @@ mount_add_entry(mount_t *mnt, enum mount_type type, const char *image_file, cons
 
 	mount_entry_t *mntent = mem_new(mount_entry_t, 1);
 
+	mntent->mnt = mnt;
 	mntent->type = type;
 	mntent->image_file = mem_strdup(image_file);
 	mntent->mount_point = mem_strdup(mount_point);
@@ -78,10 +89,16 @@ mount_add_entry(mount_t *mnt, enum mount_type type, const char *image_file, cons
 	mntent->image_size = 0;
 	mntent->sha1 = NULL;
 	mntent->sha256 = NULL;
+	mntent->sha1_digest.len = 0;
+	mntent->sha256_digest.len = 0;
 	mntent->mount_data = NULL;
 	mntent->verity_sha256 = NULL;
+	mntent->fsverity_sha256 = NULL;
+	mntent->fsverity_digest.len = 0;
+	mntent->block_size = 0;
 
 	mnt->list = list_append(mnt->list, mntent);
+	mount_update_disk_usage(mnt);
 	return mntent;
 }
 
@@ -104,6 +121,10 @@ mount_free(mount_t *mnt)
 			mem_free0(mntent->sha256);
 		if (mntent->mount_data)
 			mem_free0(mntent->mount_data);
+		if (mntent->verity_sha256)
+			mem_free0(mntent->verity_sha256);
+		if (mntent->fsverity_sha256)
+			mem_free0(mntent->fsverity_sha256);
 		mem_free0(mntent);
 		mnt->list = list_unlink(mnt->list, mnt->list);
 	}
@@ -142,44 +163,58 @@ mount_get_entry_by_img(const mount_t *mnt, const char *img)
 	return NULL;
 }
 
-off_t
-mount_get_disk_usage_container(const mount_t *mnt)
+/*
+ * Sums up the max disk usage of the entries of the given types. A mount table contains either the
+ * images of a container or those of a guestos, thus MOUNT_TYPE_COPY is counted in both.
+ */
+static off_t
+mount_disk_usage(const mount_t *mnt, bool guestos)
 {
-	ASSERT(mnt);
-	size_t count = mount_get_count(mnt);
 	uint64_t disk_usage = 0;
 
-	for (size_t i = 0; i < count; i++) {
-		mount_entry_t *entry = mount_get_entry(mnt, i);
+	for (list_t *l = mnt->list; l; l = l->next) {
+		mount_entry_t *entry = l->data;
 		ASSERT(entry);
 		uint64_t image_size = mount_entry_get_size(entry); // MB
 		image_size *= 1024 * 1024;			   // Byte
-		ASSERT(entry);
+		uint64_t entry_usage = 0;
+
 		switch (entry->type) {
 		case MOUNT_TYPE_OVERLAY_RW:
-		case MOUNT_TYPE_EMPTY: {
+		case MOUNT_TYPE_EMPTY:
+			if (guestos)
+				continue;
 			// meta.img
-			if (disk_usage <=
-			    (UINT64_MAX - image_size * MOUNT_DM_INTEGRITY_META_FACTOR)) {
-				disk_usage += image_size * MOUNT_DM_INTEGRITY_META_FACTOR;
-			} else {
+			entry_usage = image_size * MOUNT_DM_INTEGRITY_META_FACTOR;
+			if (entry_usage > UINT64_MAX - image_size) {
 				ERROR("Overflow detected");
 				return -1;
 			}
-		} // fallthrough
+			entry_usage += image_size;
+			break;
 		case MOUNT_TYPE_DEVICE:
 		case MOUNT_TYPE_DEVICE_RW:
-		case MOUNT_TYPE_COPY: {
-			if (disk_usage <= (UINT64_MAX - image_size)) {
-				disk_usage += image_size;
-			} else {
-				ERROR("Overflow detected");
-				return -1;
-			}
-		} break;
+			if (guestos)
+				continue;
+			entry_usage = image_size;
+			break;
+		case MOUNT_TYPE_SHARED:
+			if (!guestos)
+				continue;
+			entry_usage = image_size;
+			break;
+		case MOUNT_TYPE_COPY:
+			entry_usage = image_size;
+			break;
 		default:
 			continue;
 		}
+
+		if (disk_usage > UINT64_MAX - entry_usage) {
+			ERROR("Overflow detected");
+			return -1;
+		}
+		disk_usage += entry_usage;
 	}
 
 	off_t retval = (off_t)disk_usage;
@@ -191,41 +226,29 @@ mount_get_disk_usage_container(const mount_t *mnt)
 	return retval;
 }
 
+/*
+ * Updates the disk usage cached in the mount table, which is done on each change of the entries
+ * instead of each query, e.g., for admission checks of new containers or for the device stats.
+ */
+static void
+mount_update_disk_usage(mount_t *mnt)
+{
+	mnt->disk_usage_container = mount_disk_usage(mnt, false);
+	mnt->disk_usage_guestos = mount_disk_usage(mnt, true);
+}
+
 off_t
-mount_get_disk_usage_guestos(const mount_t *mnt)
+mount_get_disk_usage_container(const mount_t *mnt)
 {
 	ASSERT(mnt);
-	size_t count = mount_get_count(mnt);
-	uint64_t disk_usage = 0;
-
-	for (size_t i = 0; i < count; i++) {
-		mount_entry_t *entry = mount_get_entry(mnt, i);
-		ASSERT(entry);
-		uint64_t image_size = mount_entry_get_size(entry); // MB
-		image_size *= 1024 * 1024;			   // Byte
-		ASSERT(entry);
-		switch (entry->type) {
-		case MOUNT_TYPE_SHARED:
-		case MOUNT_TYPE_COPY: {
-			if (disk_usage <= (UINT64_MAX - image_size)) {
-				disk_usage += image_size;
-			} else {
-				ERROR("Overflow detected");
-				return -1;
-			}
-		} break;
-		default:
-			continue;
-		}
-	}
-
-	off_t retval = (off_t)disk_usage;
-	if (retval < 0 || disk_usage != (uint64_t)retval) {
-		ERROR("off_t is not sufficient for required disk space");
-		return -1;
-	}
+	return mnt->disk_usage_container;
+}
 
-	return retval;
+off_t
+mount_get_disk_usage_guestos(const mount_t *mnt)
+{
+	ASSERT(mnt);
+	return mnt->disk_usage_guestos;
 }
 
 /******************************************************************************/
@@ -280,6 +303,21 @@ mount_entry_set_size(mount_entry_t *mntent, uint64_t size)
 {
 	ASSERT(mntent);
 	mntent->image_size = size;
+	mount_update_disk_usage(mntent->mnt);
+}
+
+uint32_t
+mount_entry_get_block_size(const mount_entry_t *mntent)
+{
+	ASSERT(mntent);
+	return mntent->block_size;
+}
+
+void
+mount_entry_set_block_size(mount_entry_t *mntent, uint32_t block_size)
+{
+	ASSERT(mntent);
+	mntent->block_size = block_size;
 }
 
 char *
@@ -302,6 +340,8 @@ mount_entry_set_sha1(mount_entry_t *mntent, char *sha1)
 	ASSERT(mntent);
 	IF_NULL_RETURN(sha1);
 	mntent->sha1 = mem_strdup(sha1);
+	if (digest_from_hex(&mntent->sha1_digest, sha1) < 0 || mntent->sha1_digest.len != 20)
+		WARN("Invalid SHA1 hash %s for image %s", sha1, mntent->image_file);
 }
 
 void
@@ -310,6 +350,9 @@ mount_entry_set_sha256(mount_entry_t *mntent, char *sha256)
 	ASSERT(mntent);
 	IF_NULL_RETURN(sha256);
 	mntent->sha256 = mem_strdup(sha256);
+	if (digest_from_hex(&mntent->sha256_digest, sha256) < 0 ||
+	    mntent->sha256_digest.len != 32)
+		WARN("Invalid SHA256 hash %s for image %s", sha256, mntent->image_file);
 }
 
 void
@@ -342,29 +385,71 @@ mount_entry_set_verity_sha256(mount_entry_t *mntent, char *sha256)
 	mntent->verity_sha256 = mem_strdup(sha256);
 }
 
-bool
-mount_entry_match_sha1(const mount_entry_t *e, const char *hash)
+char *
+mount_entry_get_fsverity_sha256(const mount_entry_t *mntent)
 {
-	ASSERT(e);
+	ASSERT(mntent);
+	return mntent->fsverity_sha256;
+}
 
-	const char *img_name = mount_entry_get_img(e);
-	const char *expected = mount_entry_get_sha1(e);
+void
+mount_entry_set_fsverity_sha256(mount_entry_t *mntent, char *sha256)
+{
+	ASSERT(mntent);
+	IF_NULL_RETURN(sha256);
+	mntent->fsverity_sha256 = mem_strdup(sha256);
+	if (digest_from_hex(&mntent->fsverity_digest, sha256) < 0 ||
+	    mntent->fsverity_digest.len != 32)
+		WARN("Invalid fs-verity SHA256 digest %s for image %s", sha256, mntent->image_file);
+}
+
+/*
+ * Compares the digest to the expected one, both have to be set and of hash_len bytes.
+ */
+static bool
+mount_entry_match_digest(const mount_entry_t *e, const char *hash_name, size_t hash_len,
+			 const digest_t *expected, const digest_t *digest)
+{
+	if (!digest_is_set(digest)) {
+		ERROR("Empty hash value");
+		return false;
+	}
+	if (!digest_is_set(expected) || expected->len != hash_len) {
+		ERROR("Reference %s hash value for image %s.img is missing", hash_name,
+		      e->image_file);
+		return false;
+	}
 
-	DEBUG("Checking image %s.img with expected SHA1 hash %s, actual hash: %s", img_name,
-	      expected, hash);
-	return crypto_match_hash(20, expected, hash);
+	char expected_hex[DIGEST_HEX_SIZE], hex[DIGEST_HEX_SIZE];
+	DEBUG("Checking image %s.img with expected %s hash %s, actual hash: %s", e->image_file,
+	      hash_name, digest_to_hex(expected, expected_hex), digest_to_hex(digest, hex));
+	if (!digest_equal(expected, digest)) {
+		DEBUG("Hash mismatch");
+		return false;
+	}
+	TRACE("Hashes match");
+	return true;
 }
 
 bool
-mount_entry_match_sha256(const mount_entry_t *e, const char *hash)
+mount_entry_match_sha1(const mount_entry_t *e, const digest_t *digest)
 {
 	ASSERT(e);
+	return mount_entry_match_digest(e, "SHA1", 20, &e->sha1_digest, digest);
+}
 
-	const char *img_name = mount_entry_get_img(e);
-	const char *expected = mount_entry_get_sha256(e);
-	DEBUG("Checking image %s.img with expected SHA256 hash %s, actual hash: %s", img_name,
-	      expected, hash);
-	return crypto_match_hash(32, expected, hash);
+bool
+mount_entry_match_sha256(const mount_entry_t *e, const digest_t *digest)
+{
+	ASSERT(e);
+	return mount_entry_match_digest(e, "SHA256", 32, &e->sha256_digest, digest);
+}
+
+bool
+mount_entry_match_fsverity_sha256(const mount_entry_t *e, const digest_t *digest)
+{
+	ASSERT(e);
+	return mount_entry_match_digest(e, "fs-verity SHA256", 32, &e->fsverity_digest, digest);
 }
 
 bool
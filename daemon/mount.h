@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include "common/digest.h"
 #include "common/list.h"
 
 #define MOUNT_CGROUPS_FOLDER "/sys/fs/cgroup"
@@ -68,6 +69,8 @@ enum mount_type {
 	MOUNT_TYPE_BIND_FILE_RW = 11, /**< file is bind mounted to container (RW) */
 	MOUNT_TYPE_BIND_DIR = 12,     /**< dir is bind mounted to container (RO) */
 	MOUNT_TYPE_BIND_DIR_RW = 13,  /**< dir is bind mounted to container (RW) */
+	MOUNT_TYPE_EPHEMERAL = 14,    /**< size limited tmpfs or zram device of the container,
+				      which is recreated empty on each start */
 };
 
 mount_t *
@@ -112,8 +115,9 @@ mount_entry_t *
 mount_get_entry_by_img(const mount_t *mnt, const char *img);
 
 /**
- * Calculate the max disk usage of a given container mount table
- * 
+ * Returns the max disk usage of a given container mount table. It is kept up to date
+ * on each change of the mount entries, their number or sizes.
+ *
  * @param mnt the mount table
  * @return Success: required disk space, Error: -1
 */
@@ -121,8 +125,9 @@ off_t
 mount_get_disk_usage_container(const mount_t *mnt);
 
 /**
- * Calculate the max disk usage of a given guestos mount table
- * 
+ * Returns the max disk usage of a given guestos mount table, like
+ * mount_get_disk_usage_container().
+ *
  * @param mnt the mount table
  * @return Success: required disk space, Error: -1
 */
@@ -135,6 +140,19 @@ mount_get_disk_usage_guestos(const mount_t *mnt);
 void
 mount_entry_set_size(mount_entry_t *mntent, uint64_t size);
 
+/**
+ * Returns the block size of the compressed read-only file system of the mount entry's
+ * image or 0 if unknown.
+ */
+uint32_t
+mount_entry_get_block_size(const mount_entry_t *mntent);
+
+/**
+ * Sets the block size of the compressed read-only file system of the mount entry's image.
+ */
+void
+mount_entry_set_block_size(mount_entry_t *mntent, uint32_t block_size);
+
 /**
  * Returns a string with the SHA1 hash of the mount entry.
  */
@@ -165,17 +183,35 @@ mount_entry_set_sha256(mount_entry_t *mntent, char *sha256);
 void
 mount_entry_set_verity_sha256(mount_entry_t *mntent, char *sha256);
 
+/**
+ * Returns a string with the fs-verity SHA256 digest of the mount entry's image file.
+ */
+char *
+mount_entry_get_fsverity_sha256(const mount_entry_t *mntent);
+
+/**
+ * Sets the fs-verity SHA256 digest of the mount entry's image file.
+ */
+void
+mount_entry_set_fsverity_sha256(mount_entry_t *mntent, char *sha256);
+
 /**
  * Checks if the given SHA1 hash matches with the one stored in the mount entry.
  */
 bool
-mount_entry_match_sha1(const mount_entry_t *e, const char *hash);
+mount_entry_match_sha1(const mount_entry_t *e, const digest_t *digest);
 
 /**
  * Checks if the given SHA256 hash matches with the one stored in the mount entry.
  */
 bool
-mount_entry_match_sha256(const mount_entry_t *e, const char *hash);
+mount_entry_match_sha256(const mount_entry_t *e, const digest_t *digest);
+
+/**
+ * Checks if the given fs-verity digest matches with the one stored in the mount entry.
+ */
+bool
+mount_entry_match_fsverity_sha256(const mount_entry_t *e, const digest_t *digest);
 
 /**
  * Returns the type of the mount entry.
@@ -30,6 +30,7 @@
 #include "crypto.h"
 #include "audit.h"
 #include "mount.h"
+#include "starttrace.h"
 
 #include "oci_control.pb-c.h"
 
@@ -37,6 +38,7 @@
 #include "common/macro.h"
 #include "common/mem.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/sock.h"
 #include "common/uuid.h"
 #include "common/event.h"
@@ -50,8 +52,11 @@
 #include "common/event.h"
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/syscall.h>
 #include <sys/inotify.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -68,9 +73,14 @@
 // time between reconnection attempts of a remote client socket
 #define OCI_CONTROL_REMOTE_RECONNECT_INTERVAL 10000
 
+// timeout in seconds of hooks which do not specify one
+#define OCI_HOOK_TIMEOUT_DEFAULT 60
+// interval in ms to poll for the exit of a hook if pidfds are not supported
+#define OCI_HOOK_POLL_INTERVAL 10
+
 struct oci_control {
 	int sock;			      // listen socket fd
-	list_t *event_io_sock_connected_list; // list of clients
+	list_t *conn_list; // list of connected clients (protobuf_conn_t)
 };
 
 struct oci_container {
@@ -78,6 +88,9 @@ struct oci_container {
 	char *id;
 	char *bundle;
 	bool deleted; // we do not delete oci containers directly
+	char *state_json; // cached oci state, generated for state_state and state_pid
+	compartment_state_t state_state;
+	pid_t state_pid;
 	list_t *hook_prestart_list;
 	list_t *hook_create_runtime_list;
 	list_t *hook_create_container_list;
@@ -90,6 +103,7 @@ typedef struct oci_hook {
 	char *path;
 	char **argv;
 	char **envp;
+	int timeout; // in seconds
 } oci_hook_t;
 
 static list_t *oci_containers_list = NULL;
@@ -171,25 +185,56 @@ oci_container_state_free(runtime_spec_schema_state_schema *oci_state)
 	mem_free0(oci_state);
 }
 
-static int
-oci_control_dump_state(const container_t *container, int fd)
+/**
+ * Returns the oci state of the given container as json string. The state is only generated
+ * again if the state or pid of the container changed since the last call, as orchestrators
+ * poll the state frequently.
+ *
+ * @return the cached state, valid until the next call or until the container is freed;
+ *         NULL if container is not an oci container
+ */
+static const char *
+oci_container_get_state_json(const container_t *container)
 {
-	runtime_spec_schema_state_schema *state = NULL;
-	char *json_buf = NULL;
-	parser_error err;
+	oci_container_t *oci_container = oci_get_oci_container_by_container(container);
+	IF_NULL_RETVAL(oci_container, NULL);
+
+	compartment_state_t state = container_get_state(container);
+	pid_t pid = container_get_pid(container);
+	if (oci_container->state_json && oci_container->state_state == state &&
+	    oci_container->state_pid == pid)
+		return oci_container->state_json;
+
+	runtime_spec_schema_state_schema *oci_state = oci_container_state_new(container);
+	parser_error err = NULL;
+
+	mem_free0(oci_container->state_json);
+	oci_container->state_json =
+		runtime_spec_schema_state_schema_generate_json(oci_state, NULL, &err);
+	if (!oci_container->state_json) {
+		WARN("Could not generate oci state of %s: %s", oci_container->id,
+		     err ? err : "unknown error");
+	} else {
+		oci_container->state_state = state;
+		oci_container->state_pid = pid;
+	}
 
-	state = oci_container_state_new(container);
-	json_buf = runtime_spec_schema_state_schema_generate_json(state, NULL, &err);
+	oci_container_state_free(oci_state);
+	mem_free(err);
+	return oci_container->state_json;
+}
 
-	int ret = fd_write(fd, json_buf, strlen(json_buf));
+static int
+oci_control_dump_state(const container_t *container, int fd)
+{
+	const char *json_buf = oci_container_get_state_json(container);
+	IF_NULL_RETVAL(json_buf, -1);
 
-	oci_container_state_free(state);
-	mem_free(json_buf);
-	return ret;
+	return fd_write(fd, json_buf, strlen(json_buf));
 }
 
 static oci_hook_t *
-oci_hook_new(char *path, char **args, size_t args_len, char **env, size_t env_len)
+oci_hook_new(char *path, char **args, size_t args_len, char **env, size_t env_len, int timeout)
 {
 	ASSERT(path);
 
@@ -205,9 +250,45 @@ oci_hook_new(char *path, char **args, size_t args_len, char **env, size_t env_le
 	for (size_t i = 0; i < env_len; i++)
 		hook->envp[i] = mem_strdup(env[i]);
 
+	hook->timeout = timeout > 0 ? timeout : OCI_HOOK_TIMEOUT_DEFAULT;
+
 	return hook;
 }
 
+static oci_hook_t *
+oci_hook_new_from_spec(const runtime_spec_schema_defs_hook *hook)
+{
+	return oci_hook_new(hook->path, hook->args, hook->args_len, hook->env, hook->env_len,
+			    hook->timeout_present ? hook->timeout : 0);
+}
+
+/**
+ * Creates the list of hooks of a stage in the order of the spec.
+ */
+static list_t *
+oci_hook_list_new(runtime_spec_schema_defs_hook **hooks, size_t hooks_len)
+{
+	list_t *list = NULL;
+
+	for (size_t i = 0; i < hooks_len; i++)
+		list = list_append(list, oci_hook_new_from_spec(hooks[i]));
+
+	return list;
+}
+
+static oci_hook_t *
+oci_hook_copy(const oci_hook_t *hook)
+{
+	size_t args_len = 0, env_len = 0;
+
+	while (hook->argv[args_len])
+		args_len++;
+	while (hook->envp[env_len])
+		env_len++;
+
+	return oci_hook_new(hook->path, hook->argv, args_len, hook->envp, env_len, hook->timeout);
+}
+
 static void
 oci_hook_free(oci_hook_t *hook)
 {
@@ -226,8 +307,13 @@ oci_hook_free(oci_hook_t *hook)
 	mem_free0(hook);
 }
 
-static int
-oci_do_hook(oci_hook_t *hook, const container_t *container)
+/**
+ * Forks and executes the hook with the oci state on its stdin.
+ *
+ * @return the pid of the hook process, -1 on error
+ */
+static pid_t
+oci_hook_spawn(const oci_hook_t *hook, const char *state_json)
 {
 	INFO("Executing hook: %s", hook->path);
 	for (char **arg = hook->argv; *arg; arg++)
@@ -235,19 +321,19 @@ oci_do_hook(oci_hook_t *hook, const container_t *container)
 	for (char **env = hook->envp; *env; env++)
 		INFO("\t %s", *env);
 
-	// TODO timer based abortion
-
-	int status;
 	int stdin_pipe[2];
 
-	// oci container state needs to be provided through stdin
-	IF_TRUE_RETVAL(-1 == pipe(stdin_pipe), -1);
+	// oci container state needs to be provided through stdin, the pipe must not
+	// leak into concurrently running hooks which would keep it from being closed
+	IF_TRUE_RETVAL(-1 == pipe2(stdin_pipe, O_CLOEXEC), -1);
 
 	pid_t pid = fork();
 
 	switch (pid) {
 	case -1:
 		ERROR_ERRNO("Could not fork for %s", hook->path);
+		close(stdin_pipe[0]);
+		close(stdin_pipe[1]);
 		return -1;
 	case 0:
 		close(STDIN_FILENO);
@@ -256,9 +342,6 @@ oci_do_hook(oci_hook_t *hook, const container_t *container)
 		if (-1 == dup2(stdin_pipe[0], STDIN_FILENO))
 			FATAL_ERRNO("Could not dup2 stdin!");
 
-		close(stdin_pipe[0]); // close read end of pipe
-		close(stdin_pipe[1]); // close write end of pipe
-
 		execvpe(hook->path, hook->argv, hook->envp);
 		FATAL_ERRNO("Could not execvpe %s", hook->path);
 		return -1;
@@ -266,22 +349,239 @@ oci_do_hook(oci_hook_t *hook, const container_t *container)
 		close(stdin_pipe[0]); // close read end of pipe
 
 		// forward oci container state to forked child!
-		if (oci_control_dump_state(container, stdin_pipe[1]) < 0)
-			return -1;
+		int ret = fd_write(stdin_pipe[1], state_json, strlen(state_json));
 
 		// done sending output (flush buffer)
 		close(stdin_pipe[1]);
 
-		if (waitpid(pid, &status, 0) != pid) {
-			ERROR_ERRNO("Could not waitpid for '%s'", hook->path);
-		} else if (!WIFEXITED(status)) {
-			ERROR("Child '%s' terminated abnormally", hook->path);
-		} else {
-			TRACE("%s terminated normally", hook->path);
-			return WEXITSTATUS(status) ? -1 : 0;
+		if (ret < 0) {
+			ERROR("Could not pass oci state to '%s'", hook->path);
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+			return -1;
 		}
+		return pid;
+	}
+}
+
+static int
+oci_hook_check_status(const oci_hook_t *hook, int status, uint64_t start)
+{
+	uint64_t ms = (starttrace_now() - start) / 1000000;
+
+	if (!WIFEXITED(status)) {
+		ERROR("Child '%s' terminated abnormally after %" PRIu64 " ms", hook->path, ms);
+		return -1;
 	}
+
+	DEBUG("%s terminated normally after %" PRIu64 " ms", hook->path, ms);
+	return WEXITSTATUS(status) ? -1 : 0;
+}
+
+static int
+oci_pidfd_open(pid_t pid)
+{
+#ifdef __NR_pidfd_open
+	return syscall(__NR_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
 	return -1;
+#endif
+}
+
+/**
+ * Waits for the hook process pid, which is killed if the timeout of the hook expires.
+ *
+ * @return 0 if the hook succeeded, -1 otherwise
+ */
+static int
+oci_hook_wait(const oci_hook_t *hook, pid_t pid, uint64_t start)
+{
+	uint64_t deadline = start + (uint64_t)hook->timeout * 1000000000;
+	bool timed_out = false;
+	int status = 0;
+	pid_t ret;
+
+	// without pidfd support, the hook is polled every OCI_HOOK_POLL_INTERVAL ms
+	struct pollfd pfd = { .fd = oci_pidfd_open(pid), .events = POLLIN };
+
+	while ((ret = waitpid(pid, &status, WNOHANG)) <= 0) {
+		if (ret < 0 && errno != EINTR)
+			break;
+
+		uint64_t now = starttrace_now();
+		if (now >= deadline) {
+			WARN("Hook %s timed out after %d s, killing it", hook->path, hook->timeout);
+			kill(pid, SIGKILL);
+			ret = waitpid(pid, &status, 0);
+			timed_out = true;
+			break;
+		}
+
+		int remaining = (deadline - now + 999999) / 1000000;
+		if (pfd.fd >= 0)
+			poll(&pfd, 1, remaining);
+		else
+			poll(NULL, 0, MIN(remaining, OCI_HOOK_POLL_INTERVAL));
+	}
+
+	if (pfd.fd >= 0)
+		close(pfd.fd);
+
+	if (ret != pid) {
+		ERROR_ERRNO("Could not waitpid for '%s'", hook->path);
+		return -1;
+	}
+	return timed_out ? -1 : oci_hook_check_status(hook, status, start);
+}
+
+/**
+ * Runs the hooks of a stage one after another, as required by the runtime spec.
+ * Each hook is recorded as stage in the start trace of the container.
+ */
+static int
+oci_do_hooks(const container_t *container, list_t *hooks, const char *stage,
+	     starttrace_hook_t trace_hook)
+{
+	starttrace_t *trace = container_get_starttrace(container);
+
+	for (list_t *l = hooks; l; l = l->next) {
+		oci_hook_t *hook = l->data;
+		const char *state_json = oci_container_get_state_json(container);
+		uint64_t start = starttrace_now();
+
+		pid_t pid = state_json ? oci_hook_spawn(hook, state_json) : -1;
+		if (pid < 0 || oci_hook_wait(hook, pid, start) < 0)
+			WARN("Failed to execute %s hook %s!", stage, hook->path);
+
+		starttrace_add(trace, trace_hook, stage, start);
+	}
+	return 0;
+}
+
+/*
+ * Hooks of a stage which do not gate the container, i.e., poststart and poststop,
+ * are run as job on the event loop. The job owns copies of the hooks and the
+ * state, thus it may outlive the container.
+ */
+typedef struct oci_hook_job {
+	char *name; // name of the container for logging
+	const char *stage;
+	char *state_json;
+	list_t *hooks; // hooks not yet completed, the first one is running
+	pid_t pid;
+	uint64_t start;
+	bool timed_out;
+	event_child_t *child;
+	event_timer_t *timer;
+} oci_hook_job_t;
+
+static void
+oci_hook_job_free(oci_hook_job_t *job)
+{
+	for (list_t *l = job->hooks; l; l = l->next)
+		oci_hook_free(l->data);
+	list_delete(job->hooks);
+
+	mem_free0(job->name);
+	mem_free0(job->state_json);
+	mem_free0(job);
+}
+
+static void
+oci_hook_job_timeout_cb(event_timer_t *timer, void *data)
+{
+	oci_hook_job_t *job = data;
+	ASSERT(job);
+
+	oci_hook_t *hook = job->hooks->data;
+	WARN("%s hook %s of %s timed out after %d s, killing it", job->stage, hook->path,
+	     job->name, hook->timeout);
+
+	if (kill(job->pid, SIGKILL) < 0)
+		WARN_ERRNO("Could not kill hook %s", hook->path);
+	job->timed_out = true;
+
+	event_remove_timer(timer);
+	event_timer_free(timer);
+	job->timer = NULL;
+}
+
+static void
+oci_hook_job_next(oci_hook_job_t *job);
+
+static void
+oci_hook_job_child_cb(UNUSED pid_t pid, int status, event_child_t *child, void *data)
+{
+	oci_hook_job_t *job = data;
+	ASSERT(job);
+
+	oci_hook_t *hook = job->hooks->data;
+
+	if (job->timer) {
+		event_remove_timer(job->timer);
+		event_timer_free(job->timer);
+		job->timer = NULL;
+	}
+	event_child_free(child);
+	job->child = NULL;
+
+	if (job->timed_out || oci_hook_check_status(hook, status, job->start) < 0)
+		WARN("Failed to execute %s hook %s of %s!", job->stage, hook->path, job->name);
+
+	job->hooks = list_unlink(job->hooks, job->hooks);
+	oci_hook_free(hook);
+
+	oci_hook_job_next(job);
+}
+
+/**
+ * Starts the next hook of the job, or frees the job if all hooks completed.
+ */
+static void
+oci_hook_job_next(oci_hook_job_t *job)
+{
+	while (job->hooks) {
+		oci_hook_t *hook = job->hooks->data;
+
+		job->start = starttrace_now();
+		job->timed_out = false;
+		job->pid = oci_hook_spawn(hook, job->state_json);
+		if (job->pid > 0) {
+			job->child = event_child_new(job->pid, oci_hook_job_child_cb, job);
+			event_add_child(job->child);
+			job->timer = event_timer_new(hook->timeout * 1000, 1,
+						     oci_hook_job_timeout_cb, job);
+			event_add_timer(job->timer);
+			return;
+		}
+
+		WARN("Failed to execute %s hook %s of %s!", job->stage, hook->path, job->name);
+		job->hooks = list_unlink(job->hooks, job->hooks);
+		oci_hook_free(hook);
+	}
+
+	DEBUG("Completed %s hooks of %s", job->stage, job->name);
+	oci_hook_job_free(job);
+}
+
+static int
+oci_do_hooks_async(const container_t *container, list_t *hooks, const char *stage)
+{
+	IF_NULL_RETVAL(hooks, 0);
+
+	const char *state_json = oci_container_get_state_json(container);
+	IF_NULL_RETVAL(state_json, -1);
+
+	oci_hook_job_t *job = mem_new0(oci_hook_job_t, 1);
+	job->name = mem_strdup(container_get_name(container));
+	job->stage = stage;
+	job->state_json = mem_strdup(state_json);
+	for (list_t *l = hooks; l; l = l->next)
+		job->hooks = list_append(job->hooks, oci_hook_copy(l->data));
+
+	oci_hook_job_next(job);
+	return 0;
 }
 
 int
@@ -289,12 +589,8 @@ oci_do_hooks_prestart(const container_t *container)
 {
 	oci_container_t *oci_container = oci_get_oci_container_by_container(container);
 
-	for (list_t *l = oci_container->hook_prestart_list; l; l = l->next) {
-		oci_hook_t *prestart_hook = l->data;
-		if (-1 == oci_do_hook(prestart_hook, container))
-			WARN("Failed to execute PRESTART hook!");
-	}
-	return 0;
+	return oci_do_hooks(container, oci_container->hook_prestart_list, "oci:prestart",
+			    STARTTRACE_POST_EXEC);
 }
 
 int
@@ -302,12 +598,8 @@ oci_do_hooks_create_runtime(const container_t *container)
 {
 	oci_container_t *oci_container = oci_get_oci_container_by_container(container);
 
-	for (list_t *l = oci_container->hook_create_runtime_list; l; l = l->next) {
-		oci_hook_t *hook_create_runtime = l->data;
-		if (-1 == oci_do_hook(hook_create_runtime, container))
-			WARN("Failed to execute CREATE_RUNTIME hook!");
-	}
-	return 0;
+	return oci_do_hooks(container, oci_container->hook_create_runtime_list,
+			    "oci:createRuntime", STARTTRACE_POST_CLONE);
 }
 
 int
@@ -315,12 +607,8 @@ oci_do_hooks_create_container(const container_t *container)
 {
 	oci_container_t *oci_container = oci_get_oci_container_by_container(container);
 
-	for (list_t *l = oci_container->hook_create_container_list; l; l = l->next) {
-		oci_hook_t *hook_create_container = l->data;
-		if (-1 == oci_do_hook(hook_create_container, container))
-			WARN("Failed to execute CREATE_CONTAINER hook!");
-	}
-	return 0;
+	return oci_do_hooks(container, oci_container->hook_create_container_list,
+			    "oci:createContainer", STARTTRACE_CHILD);
 }
 
 int
@@ -328,12 +616,8 @@ oci_do_hooks_start_container(const container_t *container)
 {
 	oci_container_t *oci_container = oci_get_oci_container_by_container(container);
 
-	for (list_t *l = oci_container->hook_start_container_list; l; l = l->next) {
-		oci_hook_t *hook_start_container = l->data;
-		if (-1 == oci_do_hook(hook_start_container, container))
-			WARN("Failed to execute START_CONTAINER hook!");
-	}
-	return 0;
+	return oci_do_hooks(container, oci_container->hook_start_container_list,
+			    "oci:startContainer", STARTTRACE_PRE_EXEC_CHILD);
 }
 
 int
@@ -341,12 +625,7 @@ oci_do_hooks_poststart(const container_t *container)
 {
 	oci_container_t *oci_container = oci_get_oci_container_by_container(container);
 
-	for (list_t *l = oci_container->hook_poststart_list; l; l = l->next) {
-		oci_hook_t *hook_poststart = l->data;
-		if (-1 == oci_do_hook(hook_poststart, container))
-			WARN("Failed to execute POSTSTART hook!");
-	}
-	return 0;
+	return oci_do_hooks_async(container, oci_container->hook_poststart_list, "oci:poststart");
 }
 
 int
@@ -354,12 +633,7 @@ oci_do_hooks_poststop(const container_t *container)
 {
 	oci_container_t *oci_container = oci_get_oci_container_by_container(container);
 
-	for (list_t *l = oci_container->hook_poststop_list; l; l = l->next) {
-		oci_hook_t *hook_poststop = l->data;
-		if (-1 == oci_do_hook(hook_poststop, container))
-			WARN("Failed to execute POSTSTOP hook!");
-	}
-	return 0;
+	return oci_do_hooks_async(container, oci_container->hook_poststop_list, "oci:poststop");
 }
 
 oci_container_t *
@@ -402,6 +676,7 @@ oci_container_free(oci_container_t *oci_container)
 
 	mem_free0(oci_container->id);
 	mem_free0(oci_container->bundle);
+	mem_free0(oci_container->state_json);
 
 	for (list_t *l = oci_container->hook_prestart_list; l; l = l->next)
 		oci_hook_free(l->data);
@@ -552,78 +827,20 @@ oci_container_new(const char *store_path, const char *peer_path, const char *bun
 	oci_container->deleted = false;
 
 	if (config_schema->hooks) {
-		if (config_schema->hooks->prestart_len) {
-			for (size_t i = 0; i < config_schema->hooks->prestart_len; i++) {
-				runtime_spec_schema_defs_hook *hook =
-					(runtime_spec_schema_defs_hook *)
-						config_schema->hooks->prestart[i];
-
-				oci_container->hook_prestart_list = list_append(
-					oci_container->hook_prestart_list,
-					oci_hook_new(hook->path, hook->args, hook->args_len,
-						     hook->env, hook->env_len));
-			}
-		}
-		if (config_schema->hooks->create_runtime_len) {
-			for (size_t i = 0; i < config_schema->hooks->create_runtime_len; i++) {
-				runtime_spec_schema_defs_hook *hook =
-					(runtime_spec_schema_defs_hook *)
-						config_schema->hooks->create_runtime[i];
-
-				oci_container->hook_create_runtime_list = list_append(
-					oci_container->hook_create_runtime_list,
-					oci_hook_new(hook->path, hook->args, hook->args_len,
-						     hook->env, hook->env_len));
-			}
-		}
-		if (config_schema->hooks->create_container_len) {
-			for (size_t i = 0; i < config_schema->hooks->create_container_len; i++) {
-				runtime_spec_schema_defs_hook *hook =
-					(runtime_spec_schema_defs_hook *)
-						config_schema->hooks->create_container[i];
-
-				oci_container->hook_create_container_list = list_append(
-					oci_container->hook_create_container_list,
-					oci_hook_new(hook->path, hook->args, hook->args_len,
-						     hook->env, hook->env_len));
-			}
-		}
-		if (config_schema->hooks->start_container_len) {
-			for (size_t i = 0; i < config_schema->hooks->start_container_len; i++) {
-				runtime_spec_schema_defs_hook *hook =
-					(runtime_spec_schema_defs_hook *)
-						config_schema->hooks->start_container[i];
-
-				oci_container->hook_start_container_list = list_append(
-					oci_container->hook_start_container_list,
-					oci_hook_new(hook->path, hook->args, hook->args_len,
-						     hook->env, hook->env_len));
-			}
-		}
-		if (config_schema->hooks->poststart_len) {
-			for (size_t i = 0; i < config_schema->hooks->poststart_len; i++) {
-				runtime_spec_schema_defs_hook *hook =
-					(runtime_spec_schema_defs_hook *)
-						config_schema->hooks->poststart[i];
-
-				oci_container->hook_poststart_list = list_append(
-					oci_container->hook_poststart_list,
-					oci_hook_new(hook->path, hook->args, hook->args_len,
-						     hook->env, hook->env_len));
-			}
-		}
-		if (config_schema->hooks->poststop_len) {
-			for (size_t i = 0; i < config_schema->hooks->poststop_len; i++) {
-				runtime_spec_schema_defs_hook *hook =
-					(runtime_spec_schema_defs_hook *)
-						config_schema->hooks->poststop[i];
-
-				oci_container->hook_poststop_list = list_append(
-					oci_container->hook_poststop_list,
-					oci_hook_new(hook->path, hook->args, hook->args_len,
-						     hook->env, hook->env_len));
-			}
-		}
+		runtime_spec_schema_config_schema_hooks *hooks = config_schema->hooks;
+
+		oci_container->hook_prestart_list =
+			oci_hook_list_new(hooks->prestart, hooks->prestart_len);
+		oci_container->hook_create_runtime_list =
+			oci_hook_list_new(hooks->create_runtime, hooks->create_runtime_len);
+		oci_container->hook_create_container_list =
+			oci_hook_list_new(hooks->create_container, hooks->create_container_len);
+		oci_container->hook_start_container_list =
+			oci_hook_list_new(hooks->start_container, hooks->start_container_len);
+		oci_container->hook_poststart_list =
+			oci_hook_list_new(hooks->poststart, hooks->poststart_len);
+		oci_container->hook_poststop_list =
+			oci_hook_list_new(hooks->poststop, hooks->poststop_len);
 	}
 
 	oci_containers_list = list_append(oci_containers_list, oci_container);
@@ -639,16 +856,20 @@ out:
 static void
 oci_control_send_state(container_t *container, int fd)
 {
-	runtime_spec_schema_state_schema *state = NULL;
-	char *json_buf = NULL;
-	parser_error err;
+	OciResponse out = OCI_RESPONSE__INIT;
 
-	state = oci_container_state_new(container);
-	json_buf = runtime_spec_schema_state_schema_generate_json(state, NULL, &err);
+	const char *json_buf = container ? oci_container_get_state_json(container) : NULL;
+	if (!json_buf) {
+		out.code = OCI_RESPONSE__CODE__RESPONSE;
+		out.has_response = true;
+		out.response = OCI_RESPONSE__RESPONSE__CMD_FAILED;
+		if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0)
+			WARN("Failed to send response to '%d'", fd);
+		return;
+	}
 
-	OciResponse out = OCI_RESPONSE__INIT;
 	out.code = OCI_RESPONSE__CODE__STATE;
-	out.state = json_buf;
+	out.state = (char *)json_buf;
 	if (container_get_pid(container) > 0) {
 		out.has_pid = true;
 		out.pid = container_get_pid(container);
@@ -659,14 +880,12 @@ oci_control_send_state(container_t *container, int fd)
 
 	if (protobuf_send_message(fd, (ProtobufCMessage *)&out) < 0)
 		WARN("Failed to send response to '%d'", fd);
-
-	oci_container_state_free(state);
-	mem_free(json_buf);
 }
 
 struct container_state_cb_data {
 	compartment_state_t state;
 	int fd;
+	bool start; // continue the start once the container is created (state BOOTING)
 };
 
 static void
@@ -681,9 +900,32 @@ oci_container_state_cb(container_t *container, container_callback_t *cb, void *d
 	int fd = cb_data->fd;
 	compartment_state_t state = cb_data->state;
 
+	/* a failed start does not reach the awaited state, report it instead of waiting */
+	if (container_get_state(container) == COMPARTMENT_STATE_STOPPED &&
+	    state != COMPARTMENT_STATE_STOPPED) {
+		DEBUG("Container %s stopped while waiting for state %d",
+		      container_get_name(container), state);
+		container_unregister_observer(container, cb);
+		oci_control_send_state(container, fd);
+		mem_free(cb_data);
+		return;
+	}
+
 	/* skip if the container was not started */
 	IF_FALSE_RETURN_TRACE(container_get_state(container) == state);
 
+	/* a start requested before the asynchronous create completed */
+	if (cb_data->start) {
+		pid_t container_pid = container_get_pid(container);
+		DEBUG("continue deferred start of container with pid %d", container_pid);
+		cb_data->start = false;
+		cb_data->state = COMPARTMENT_STATE_RUNNING;
+		if (container_pid > 0 && kill(container_pid, SIGINT) == 0)
+			return;
+		WARN_ERRNO("Could not continue start of container %s",
+			   container_get_name(container));
+	}
+
 	/* unregister observer */
 	container_unregister_observer(container, cb);
 
@@ -834,6 +1076,17 @@ oci_control_handle_message(UNUSED oci_control_t *oci_control, const OciCommand *
 				oci_container->deleted = false;
 			}
 
+			if (msg->has_create_async && msg->create_async) {
+				// the start is deferred by the START command if still creating
+				mem_free0(cb_data);
+				res = cmld_container_start(oci_container->container);
+				out.code = OCI_RESPONSE__CODE__RESPONSE;
+				out.has_response = true;
+				out.response = res ? OCI_RESPONSE__RESPONSE__CMD_FAILED :
+						     OCI_RESPONSE__RESPONSE__CMD_OK;
+				break;
+			}
+
 			cb_data->fd = fd;
 			cb_data->state = COMPARTMENT_STATE_BOOTING;
 			container_register_observer(oci_container->container,
@@ -862,6 +1115,16 @@ oci_control_handle_message(UNUSED oci_control_t *oci_control, const OciCommand *
 			mem_new0(struct container_state_cb_data, 1);
 
 		cb_data->fd = fd;
+
+		// an asynchronous create is still setting up the container
+		if (container_get_state(container) == COMPARTMENT_STATE_STARTING) {
+			DEBUG("container still starting, deferring start until created");
+			cb_data->state = COMPARTMENT_STATE_BOOTING;
+			cb_data->start = true;
+			container_register_observer(container, oci_container_state_cb, cb_data);
+			return;
+		}
+
 		cb_data->state = COMPARTMENT_STATE_RUNNING;
 		container_register_observer(container, oci_container_state_cb, cb_data);
 		pid_t container_pid = container_get_pid(container);
@@ -917,49 +1180,43 @@ oci_control_handle_message(UNUSED oci_control_t *oci_control, const OciCommand *
 }
 
 /**
- * Event callback for incoming data that receives a oci runtime command message (local)
+ * Callback for an OciCommand message received on a local connection.
  *
  * The handle_message function will be called to handle the received message.
  *
- * @param fd	    file descriptor of the client connection
- *		    from which the incoming message is read
- * @param events    event flags
- * @param io	    pointer to associated event_io_t struct
- * @param data	    pointer to this control_t struct
+ * @param conn	    the client connection from which the message was received
+ * @param msg	    the received OciCommand message
+ * @param data	    pointer to this oci_control_t struct
  */
 static void
-oci_control_cb_recv_message(int fd, unsigned events, event_io_t *io, void *data)
+oci_control_cb_recv_message(protobuf_conn_t *conn, ProtobufCMessage *msg, void *data)
 {
 	oci_control_t *oci_control = data;
-	/*
-	 * always check READ flag first, since also if the peer called close()
-	 * and there is pending data on the socet the READ and EXCEPT flags are set.
-	 * Thus, we have to read pending date before handling the EXCEPT event.
-	 */
-	if (events & EVENT_IO_READ) {
-		// TODO handle incomming json stream
-		OciCommand *msg = (OciCommand *)protobuf_recv_message(fd, &oci_command__descriptor);
-		// close connection if client EOF, or protocol parse error
-		IF_NULL_GOTO_TRACE(msg, connection_err);
-		oci_control_handle_message(oci_control, msg, fd);
-		TRACE("Handled control connection %d", fd);
-		protobuf_free_message((ProtobufCMessage *)msg);
-	}
-	// also check EXCEPT flag
-	if (events & EVENT_IO_EXCEPT) {
-		INFO("OCI Control client closed connection; disconnecting oci control socket.");
-		goto connection_err;
-	}
-	return;
+	int fd = protobuf_conn_get_fd(conn);
 
-connection_err:
-	event_remove_io(io);
-	event_io_free(io);
+	// TODO handle incomming json stream
+	oci_control_handle_message(oci_control, (OciCommand *)msg, fd);
+	TRACE("Handled control connection %d", fd);
+}
+
+/**
+ * Callback for a local connection which was closed by the client or
+ * which had to be closed due to an I/O or protocol parse error.
+ *
+ * @param conn	    the client connection to be closed
+ * @param data	    pointer to this oci_control_t struct
+ */
+static void
+oci_control_cb_close(protobuf_conn_t *conn, void *data)
+{
+	oci_control_t *oci_control = data;
+	int fd = protobuf_conn_get_fd(conn);
+
+	INFO("OCI Control client closed connection; disconnecting oci control socket.");
+	oci_control->conn_list = list_remove(oci_control->conn_list, conn);
+	protobuf_conn_free(conn);
 	if (close(fd) < 0)
 		WARN_ERRNO("Failed to close connected oci control socket");
-	oci_control->event_io_sock_connected_list =
-		list_remove(oci_control->event_io_sock_connected_list, io);
-	return;
 }
 
 /**
@@ -995,13 +1252,16 @@ oci_control_cb_accept(int fd, unsigned events, event_io_t *io, void *data)
 	}
 	DEBUG("Accepted control connection %d", cfd);
 
-	fd_make_non_blocking(cfd);
-
-	event_io_t *event =
-		event_io_new(cfd, EVENT_IO_READ, oci_control_cb_recv_message, oci_control);
+	protobuf_conn_t *conn = protobuf_conn_new(cfd, &oci_command__descriptor,
+						  oci_control_cb_recv_message, oci_control_cb_close,
+						  oci_control);
+	if (!conn) {
+		WARN("Could not set up oci control connection %d", cfd);
+		close(cfd);
+		return;
+	}
+	oci_control->conn_list = list_append(oci_control->conn_list, conn);
 	DEBUG("local oci control client connected on fd=%d", cfd);
-
-	event_add_io(event);
 }
 
 oci_control_t *
@@ -1047,17 +1307,17 @@ void
 oci_control_free(oci_control_t *oci_control)
 {
 	ASSERT(oci_control);
-	for (list_t *l = oci_control->event_io_sock_connected_list; l; l = l->next) {
-		event_io_t *event_io_sock_connected = l->data;
-		event_remove_io(event_io_sock_connected);
-		shutdown(event_io_get_fd(event_io_sock_connected), SHUT_RDWR);
-		if (close(event_io_get_fd(event_io_sock_connected) < 0)) {
+	for (list_t *l = oci_control->conn_list; l; l = l->next) {
+		protobuf_conn_t *conn = l->data;
+		int fd = protobuf_conn_get_fd(conn);
+		protobuf_conn_free(conn);
+		shutdown(fd, SHUT_RDWR);
+		if (close(fd) < 0) {
 			WARN_ERRNO("Failed to close connected control socket");
 		}
-		event_io_free(event_io_sock_connected);
 	}
-	list_delete(oci_control->event_io_sock_connected_list);
-	oci_control->event_io_sock_connected_list = NULL;
+	list_delete(oci_control->conn_list);
+	oci_control->conn_list = NULL;
 
 	oci_control_list = list_remove(oci_control_list, oci_control);
 
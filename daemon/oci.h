@@ -83,7 +83,8 @@ oci_do_hooks_start_container(const container_t *container);
 /**
  * Run poststart hooks
  *
- * Call this function in host after exec of container init
+ * Call this function in host after exec of container init. The hooks are run
+ * asynchronously on the event loop.
  */
 int
 oci_do_hooks_poststart(const container_t *container);
@@ -91,7 +92,8 @@ oci_do_hooks_poststart(const container_t *container);
 /**
  * Run poststop hooks
  *
- * Call this function in host after stop during OCI DELETE
+ * Call this function in host after stop during OCI DELETE. The hooks are run
+ * asynchronously on the event loop.
  */
 int
 oci_do_hooks_poststop(const container_t *container);
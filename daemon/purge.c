@@ -0,0 +1,232 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include "purge.h"
+
+#include "cmld.h"
+#include "container.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/list.h"
+#include "common/dir.h"
+#include "common/event.h"
+#include "common/event_work.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static char *purge_dir = NULL;
+static list_t *purge_queue = NULL; // files in purge_dir to be deleted (char *)
+static char *purge_busy = NULL;	   // file of the step running on the worker thread
+static event_timer_t *purge_timer = NULL;
+static unsigned int purge_count = 0;
+
+static void
+purge_next(int delay);
+
+/*
+ * Starting containers are not slowed down by purging, i.e., by the journal commits and
+ * discards of the freed extents.
+ */
+static bool
+purge_containers_starting(void)
+{
+	for (int i = 0; i < cmld_containers_get_count(); i++) {
+		compartment_state_t state = container_get_state(cmld_container_get_by_index(i));
+		if (state == COMPARTMENT_STATE_STARTING || state == COMPARTMENT_STATE_BOOTING ||
+		    state == COMPARTMENT_STATE_SETUP || state == COMPARTMENT_STATE_REBOOTING)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Runs on a worker thread. Truncates the file by one chunk or unlinks it once it is small
+ * enough. Returns 1 if the file was truncated, 0 if it was unlinked and -errno on error.
+ */
+static int
+purge_work(void *data)
+{
+	const char *file = data;
+	struct stat st;
+
+	int fd = open(file, O_WRONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+	if (fd >= 0 && !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > PURGE_CHUNK_SIZE) {
+		int ret = ftruncate(fd, st.st_size - PURGE_CHUNK_SIZE) < 0 ? -errno : 1;
+		close(fd);
+		return ret;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	if (unlink(file) < 0 && (errno != EISDIR || rmdir(file) < 0))
+		return -errno;
+	return 0;
+}
+
+static void
+purge_done_cb(int ret, void *data)
+{
+	char *file = data;
+	purge_busy = NULL;
+
+	// purging was cancelled meanwhile
+	if (!purge_dir) {
+		mem_free0(file);
+		return;
+	}
+
+	if (ret > 0) {
+		purge_next(PURGE_CHUNK_SIZE / (PURGE_BYTES_PER_SEC / 1000));
+		return;
+	}
+
+	if (ret < 0)
+		WARN("Could not purge %s: %s", file, strerror(-ret));
+	else
+		TRACE("Purged %s", file);
+
+	purge_queue = list_remove(purge_queue, file);
+	mem_free0(file);
+	purge_next(1000 / PURGE_UNLINKS_PER_SEC);
+}
+
+static void
+purge_timer_cb(event_timer_t *timer, UNUSED void *data)
+{
+	event_timer_free(timer);
+	purge_timer = NULL;
+
+	IF_TRUE_RETURN(purge_busy || !purge_queue);
+
+	if (purge_containers_starting()) {
+		TRACE("Containers are starting, deferring purge");
+		purge_next(PURGE_DEFER_INTERVAL);
+		return;
+	}
+
+	purge_busy = purge_queue->data;
+	if (event_submit_work(&purge_work, &purge_done_cb, purge_busy) < 0) {
+		WARN("Could not submit purge of %s, purging it on the event loop", purge_busy);
+		purge_done_cb(purge_work(purge_busy), purge_busy);
+	}
+}
+
+/*
+ * Schedules the next step for the head of the queue, after the given delay in ms.
+ */
+static void
+purge_next(int delay)
+{
+	IF_TRUE_RETURN(purge_timer || purge_busy || !purge_queue);
+
+	purge_timer = event_timer_new(MAX(delay, 1), 1, &purge_timer_cb, NULL);
+	event_add_timer(purge_timer);
+}
+
+static int
+purge_init_cb(const char *path, const char *file, UNUSED void *data)
+{
+	purge_queue = list_append(purge_queue, mem_printf("%s/%s", path, file));
+	return 0;
+}
+
+int
+purge_init(const char *dir)
+{
+	ASSERT(dir);
+	IF_TRUE_RETVAL(purge_dir, 0);
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		ERROR_ERRNO("Could not create purge directory %s", dir);
+		return -1;
+	}
+
+	purge_dir = mem_strdup(dir);
+	if (dir_foreach(purge_dir, &purge_init_cb, NULL) < 0)
+		WARN("Could not list files left over in %s", purge_dir);
+	else if (purge_queue)
+		INFO("Purging %u files left over in %s", list_length(purge_queue), purge_dir);
+
+	purge_next(PURGE_DEFER_INTERVAL);
+	return 0;
+}
+
+int
+purge_file(const char *file)
+{
+	ASSERT(file);
+
+	if (purge_dir) {
+		char *base = mem_strdup(file);
+		char *dest = mem_printf("%s/%" PRIx64 "-%u-%s", purge_dir, (uint64_t)time(NULL),
+					purge_count++, basename(base));
+		mem_free0(base);
+
+		if (!rename(file, dest)) {
+			DEBUG("Purging %s in the background", file);
+			purge_queue = list_append(purge_queue, dest);
+			purge_next(0);
+			return 0;
+		}
+		if (errno == ENOENT) {
+			mem_free0(dest);
+			return 0;
+		}
+		WARN_ERRNO("Could not move %s to %s, unlinking it", file, dest);
+		mem_free0(dest);
+	}
+
+	if (unlink(file) < 0 && errno != ENOENT) {
+		WARN_ERRNO("Failed to erase file %s", file);
+		return -1;
+	}
+	return 0;
+}
+
+void
+purge_cleanup(void)
+{
+	if (purge_timer) {
+		event_remove_timer(purge_timer);
+		event_timer_free(purge_timer);
+		purge_timer = NULL;
+	}
+
+	// the file of a running step is freed by purge_done_cb()
+	for (list_t *l = purge_queue; l; l = l->next) {
+		if (l->data != purge_busy)
+			mem_free0(l->data);
+	}
+	list_delete(purge_queue);
+	purge_queue = NULL;
+	mem_free0(purge_dir);
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#ifndef PURGE_H
+#define PURGE_H
+
+/**
+ * @file purge.h Deletes large files, e.g., obsolete guestos images, in the background.
+ *
+ * Purged files are moved to a purge directory at once, thus their paths may be reused right
+ * away. A worker thread then truncates them chunk by chunk and unlinks them, limited in bytes
+ * and unlinks per second, so that the freed extents do not compete with the I/O of running
+ * containers. While containers are starting, purging is deferred. Files left over in the purge
+ * directory, e.g., after a reboot, are purged on init.
+ */
+
+// number of bytes a file is truncated by at once
+#define PURGE_CHUNK_SIZE (8 * 1024 * 1024)
+// maximum number of bytes purged per second
+#define PURGE_BYTES_PER_SEC (32 * 1024 * 1024)
+// maximum number of files unlinked per second
+#define PURGE_UNLINKS_PER_SEC 4
+// time in ms purging is deferred for while containers are starting
+#define PURGE_DEFER_INTERVAL 1000
+
+/**
+ * Initializes purging and queues the files left over in the purge directory.
+ *
+ * @param dir The purge directory, which must be on the file system of the purged files.
+ * @return -1 on error else 0.
+ */
+int
+purge_init(const char *dir);
+
+/**
+ * Moves the given file to the purge directory and deletes it in the background. If purging
+ * is not initialized or the file cannot be moved, it is unlinked immediately.
+ *
+ * @param file The file to be deleted.
+ * @return -1 on error else 0.
+ */
+int
+purge_file(const char *file);
+
+/**
+ * Cancels purging, the files not purged yet are left in the purge directory.
+ */
+void
+purge_cleanup(void);
+
+#endif /* PURGE_H */
@@ -0,0 +1,225 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "shutdownsched.h"
+
+#include "cmld.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/list.h"
+#include "common/uuid.h"
+#include "common/event.h"
+
+#include <string.h>
+
+static void (*shutdownsched_on_all_stopped)(int) = NULL;
+static int shutdownsched_value = 0;
+static bool shutdownsched_active = false;
+static bool shutdownsched_ignore_deps = false; // set after half of the deadline
+static event_timer_t *shutdownsched_timer = NULL;
+static list_t *shutdownsched_requested_list = NULL; // uuids of containers asked to stop
+
+static bool
+shutdownsched_is_down(const container_t *container)
+{
+	compartment_state_t state = container_get_state(container);
+	return state == COMPARTMENT_STATE_STOPPED || state == COMPARTMENT_STATE_ZOMBIE;
+}
+
+static bool
+shutdownsched_is_requested(const container_t *container)
+{
+	for (list_t *l = shutdownsched_requested_list; l; l = l->next) {
+		if (uuid_equals(l->data, container_get_uuid(container)))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Returns true if the start_after entry dep, "<container>[:<milestone>]", refers to
+ * the container.
+ */
+static bool
+shutdownsched_dep_matches(const char *dep, const container_t *container)
+{
+	const char *milestone = strchr(dep, ':');
+	size_t len = milestone ? (size_t)(milestone - dep) : strlen(dep);
+	const char *name = container_get_name(container);
+	const char *uuid = uuid_string(container_get_uuid(container));
+
+	return (strlen(name) == len && !strncmp(name, dep, len)) ||
+	       (strlen(uuid) == len && !strncmp(uuid, dep, len));
+}
+
+/*
+ * Returns true if another container which is not down yet depends on the container,
+ * i.e., started after it. All containers depend on c0.
+ */
+static bool
+shutdownsched_has_dependents(const container_t *container)
+{
+	bool is_c0 = container == cmld_containers_get_c0();
+
+	for (int i = 0; i < cmld_containers_get_count(); i++) {
+		container_t *other = cmld_container_get_by_index(i);
+		if (other == container || shutdownsched_is_down(other))
+			continue;
+		if (is_c0)
+			return true;
+
+		for (const list_t *l = container_get_start_after_list(other); l; l = l->next) {
+			if (shutdownsched_dep_matches(l->data, container))
+				return true;
+		}
+	}
+	return false;
+}
+
+static void
+shutdownsched_finish(void)
+{
+	if (shutdownsched_timer) {
+		event_remove_timer(shutdownsched_timer);
+		event_timer_free(shutdownsched_timer);
+		shutdownsched_timer = NULL;
+	}
+	for (list_t *l = shutdownsched_requested_list; l; l = l->next)
+		uuid_free(l->data);
+	list_delete(shutdownsched_requested_list);
+	shutdownsched_requested_list = NULL;
+	shutdownsched_active = false;
+
+	INFO("all containers are stopped now, execution of on_all_stopped()");
+	shutdownsched_on_all_stopped(shutdownsched_value);
+}
+
+/*
+ * Sends the stop request to all containers which are not down yet and are not needed
+ * by other containers anymore, and finishes the shutdown once all containers are down.
+ */
+static void
+shutdownsched_run(void)
+{
+	bool all_down = true;
+
+	for (int i = 0; i < cmld_containers_get_count(); i++) {
+		container_t *container = cmld_container_get_by_index(i);
+		if (shutdownsched_is_down(container))
+			continue;
+
+		all_down = false;
+		if (shutdownsched_is_requested(container) ||
+		    container_get_state(container) == COMPARTMENT_STATE_SHUTTING_DOWN)
+			continue;
+		if (!shutdownsched_ignore_deps && shutdownsched_has_dependents(container)) {
+			TRACE("Container %s is stopped after its dependents",
+			      container_get_description(container));
+			continue;
+		}
+
+		INFO("Stopping container %s", container_get_description(container));
+		shutdownsched_requested_list =
+			list_append(shutdownsched_requested_list,
+				    uuid_new(uuid_string(container_get_uuid(container))));
+		if (cmld_container_stop(container) < 0)
+			WARN("Could not stop container %s, killing it at the deadline",
+			     container_get_description(container));
+	}
+
+	if (all_down)
+		shutdownsched_finish();
+}
+
+static void
+shutdownsched_observer_cb(container_t *container, container_callback_t *cb, UNUSED void *data)
+{
+	IF_FALSE_RETURN(shutdownsched_is_down(container));
+
+	container_unregister_observer(container, cb);
+	IF_FALSE_RETURN(shutdownsched_active);
+
+	DEBUG("Container %s went down, checking the others",
+	      container_get_description(container));
+	shutdownsched_run();
+}
+
+static void
+shutdownsched_deadline_cb(event_timer_t *timer, UNUSED void *data)
+{
+	if (!shutdownsched_ignore_deps) {
+		// second half of the deadline, stop the remaining containers at once
+		WARN("Half of the shutdown deadline passed, stopping all containers now");
+		shutdownsched_ignore_deps = true;
+		shutdownsched_run();
+		return;
+	}
+
+	// the timer is removed from the event loop after its last run
+	event_timer_free(timer);
+	shutdownsched_timer = NULL;
+
+	for (int i = 0; i < cmld_containers_get_count(); i++) {
+		container_t *container = cmld_container_get_by_index(i);
+		if (shutdownsched_is_down(container))
+			continue;
+		WARN("Shutdown deadline reached, killing container %s",
+		     container_get_description(container));
+		container_kill(container);
+	}
+}
+
+void
+shutdownsched_stop(unsigned int deadline, void (*on_all_stopped)(int), int value)
+{
+	ASSERT(on_all_stopped);
+
+	if (shutdownsched_active) {
+		INFO("Shutdown already in progress");
+		shutdownsched_run();
+		return;
+	}
+
+	shutdownsched_on_all_stopped = on_all_stopped;
+	shutdownsched_value = value;
+	shutdownsched_active = true;
+	shutdownsched_ignore_deps = false;
+
+	for (int i = 0; i < cmld_containers_get_count(); i++) {
+		container_t *container = cmld_container_get_by_index(i);
+		if (shutdownsched_is_down(container))
+			continue;
+		if (!container_register_observer(container, &shutdownsched_observer_cb, NULL))
+			WARN("Could not register shutdown observer for %s",
+			     container_get_description(container));
+	}
+
+	// fires after half of the deadline and at the deadline
+	shutdownsched_timer = event_timer_new(deadline / 2, 2, &shutdownsched_deadline_cb, NULL);
+	event_add_timer(shutdownsched_timer);
+
+	INFO("Stopping all containers within %u ms", deadline);
+	shutdownsched_run();
+}
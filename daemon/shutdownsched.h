@@ -0,0 +1,51 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#ifndef SHUTDOWNSCHED_H
+#define SHUTDOWNSCHED_H
+
+/**
+ * @file shutdownsched.h Orchestrates the stop of all containers at cmld exit and at
+ * device shutdown or reboot.
+ *
+ * The stop requests are sent to all containers at once, except for containers other
+ * running containers depend on by their start_after entries. Those are stopped after
+ * their dependents went down, and c0 is stopped after all other containers. All
+ * containers share one deadline: After half of it, the remaining containers are stopped
+ * regardless of their dependents, and once it expired, the containers still running
+ * are killed. The block devices of the stopped containers are removed in background
+ * meanwhile, see c_vol.
+ */
+
+/**
+ * Stops all containers and calls on_all_stopped(value) once all of them are down, i.e.,
+ * stopped or zombie. If a shutdown is already in progress, only its stop requests are
+ * resent and on_all_stopped is not called.
+ *
+ * @param deadline time in milliseconds until the remaining containers are killed
+ */
+void
+shutdownsched_stop(unsigned int deadline, void (*on_all_stopped)(int), int value);
+
+#endif /* SHUTDOWNSCHED_H */
@@ -0,0 +1,342 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#define _GNU_SOURCE
+
+#include "starttrace.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/list.h"
+#include "common/metrics.h"
+
+#include <sys/mman.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STARTTRACE_EVENTS_MAX 512
+// distinct milestone names kept for the statistics
+#define STARTTRACE_MILESTONES_MAX 64
+
+typedef struct {
+	const char *module; // static module name, valid in all processes of the start
+	starttrace_hook_t hook;
+	pid_t pid;
+	uint64_t start;
+	uint64_t duration;
+} starttrace_event_t;
+
+struct starttrace {
+	uint64_t start;
+	unsigned count;
+	starttrace_event_t events[STARTTRACE_EVENTS_MAX];
+};
+
+/* durations of one hook of one module over the last starts */
+typedef struct {
+	const char *module;
+	starttrace_hook_t hook;
+	uint64_t samples[STARTTRACE_SAMPLES];
+	unsigned n;
+	unsigned next;
+	uint64_t current; // sum of the durations of the start which is being finished
+	bool recorded;
+} starttrace_stats_t;
+
+static list_t *starttrace_stats_list = NULL;
+static list_t *starttrace_milestone_list = NULL; // names of the milestones, never freed
+static metrics_t *starttrace_metrics = NULL;
+static const double starttrace_metrics_buckets[] = { 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120 };
+
+static const char *starttrace_hook_names[STARTTRACE_HOOK_COUNT] = {
+	[STARTTRACE_PRE_CLONE] = "start_pre_clone",
+	[STARTTRACE_CLONE] = "clone",
+	[STARTTRACE_POST_CLONE_EARLY] = "start_post_clone_early",
+	[STARTTRACE_CHILD_EARLY] = "start_child_early",
+	[STARTTRACE_POST_CLONE] = "start_post_clone",
+	[STARTTRACE_PRE_EXEC] = "start_pre_exec",
+	[STARTTRACE_CHILD] = "start_child",
+	[STARTTRACE_PRE_EXEC_CHILD_EARLY] = "start_pre_exec_child_early",
+	[STARTTRACE_PRE_EXEC_CHILD] = "start_pre_exec_child",
+	[STARTTRACE_POST_EXEC] = "start_post_exec",
+	[STARTTRACE_TOTAL] = "start",
+	[STARTTRACE_MILESTONE] = "milestone",
+};
+
+const char *
+starttrace_hook_get_name(starttrace_hook_t hook)
+{
+	IF_TRUE_RETVAL((unsigned)hook >= STARTTRACE_HOOK_COUNT, "unknown");
+	return starttrace_hook_names[hook];
+}
+
+uint64_t
+starttrace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+starttrace_t *
+starttrace_new(void)
+{
+	starttrace_t *trace = mmap(NULL, sizeof(starttrace_t), PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (trace == MAP_FAILED) {
+		WARN_ERRNO("Could not map start trace");
+		return NULL;
+	}
+
+	trace->start = starttrace_now();
+	trace->count = 0;
+	return trace;
+}
+
+void
+starttrace_free(starttrace_t *trace)
+{
+	IF_NULL_RETURN(trace);
+	munmap(trace, sizeof(starttrace_t));
+}
+
+void
+starttrace_add(starttrace_t *trace, starttrace_hook_t hook, const char *module, uint64_t start)
+{
+	IF_NULL_RETURN(trace);
+
+	uint64_t end = starttrace_now();
+	unsigned i = __atomic_fetch_add(&trace->count, 1, __ATOMIC_RELAXED);
+	if (i >= STARTTRACE_EVENTS_MAX)
+		return;
+
+	trace->events[i] = (starttrace_event_t){
+		.module = module, .hook = hook, .pid = getpid(), .start = start, .duration = end - start
+	};
+}
+
+static starttrace_stats_t *
+starttrace_stats_get(const char *module, starttrace_hook_t hook)
+{
+	for (list_t *l = starttrace_stats_list; l; l = l->next) {
+		starttrace_stats_t *stats = l->data;
+		if (stats->hook == hook && !strcmp(stats->module, module))
+			return stats;
+	}
+
+	starttrace_stats_t *stats = mem_new0(starttrace_stats_t, 1);
+	stats->module = module;
+	stats->hook = hook;
+	starttrace_stats_list = list_append(starttrace_stats_list, stats);
+	return stats;
+}
+
+static int
+starttrace_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+starttrace_stats_log(const starttrace_stats_t *stats, bool info)
+{
+	uint64_t sorted[STARTTRACE_SAMPLES], sum = 0;
+
+	memcpy(sorted, stats->samples, stats->n * sizeof(uint64_t));
+	qsort(sorted, stats->n, sizeof(uint64_t), starttrace_cmp_u64);
+	for (unsigned i = 0; i < stats->n; i++)
+		sum += sorted[i];
+
+	// nearest rank percentile
+	unsigned p99 = (stats->n * 99 + 99) / 100 - 1;
+	unsigned last = (stats->next + STARTTRACE_SAMPLES - 1) % STARTTRACE_SAMPLES;
+
+#define NS_TO_MS(ns) ((ns) / 1000000.0)
+	char *msg = mem_printf("%s %s: last %.2f ms, min %.2f ms, avg %.2f ms, p99 %.2f ms "
+			       "over %u starts",
+			       stats->module, starttrace_hook_names[stats->hook],
+			       NS_TO_MS(stats->samples[last]), NS_TO_MS(sorted[0]),
+			       NS_TO_MS(sum / stats->n), NS_TO_MS(sorted[p99]), stats->n);
+#undef NS_TO_MS
+	if (info)
+		INFO("%s", msg);
+	else
+		DEBUG("%s", msg);
+	mem_free0(msg);
+}
+
+static void
+starttrace_stats_push(starttrace_stats_t *stats, uint64_t sample)
+{
+	stats->samples[stats->next] = sample;
+	stats->next = (stats->next + 1) % STARTTRACE_SAMPLES;
+	stats->n = MIN(stats->n + 1, STARTTRACE_SAMPLES);
+	bool info = stats->hook == STARTTRACE_TOTAL || stats->hook == STARTTRACE_MILESTONE;
+	starttrace_stats_log(stats, info);
+}
+
+static int
+starttrace_write(const starttrace_t *trace, unsigned count, const char *name, const char *file)
+{
+	char *tmp_file = mem_printf("%s.tmp", file);
+	FILE *f = fopen(tmp_file, "we");
+	if (!f) {
+		WARN_ERRNO("Could not create start trace %s", tmp_file);
+		mem_free0(tmp_file);
+		return -1;
+	}
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (unsigned i = 0; i < count; i++) {
+		const starttrace_event_t *e = &trace->events[i];
+		// timestamps and durations are given in us
+		fprintf(f,
+			"{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+			"\"pid\":%d,\"tid\":%d,\"args\":{\"compartment\":\"%s\"}}%s\n",
+			e->module, starttrace_hook_names[e->hook], (e->start - trace->start) / 1000.0,
+			e->duration / 1000.0, e->pid, e->pid, name, i + 1 < count ? "," : "");
+	}
+	fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+
+	if (fclose(f) != 0 || rename(tmp_file, file) < 0) {
+		WARN_ERRNO("Could not write start trace %s", file);
+		unlink(tmp_file);
+		mem_free0(tmp_file);
+		return -1;
+	}
+
+	mem_free0(tmp_file);
+	return 0;
+}
+
+void
+starttrace_add_milestone(starttrace_t *trace, const char *name, uint64_t since_start)
+{
+	const char *module = NULL;
+	for (list_t *l = starttrace_milestone_list; l && !module; l = l->next) {
+		if (!strcmp(l->data, name))
+			module = l->data;
+	}
+	if (!module) {
+		if (list_length(starttrace_milestone_list) >= STARTTRACE_MILESTONES_MAX) {
+			WARN("Too many distinct milestones, not tracing milestone %s", name);
+			return;
+		}
+		module = mem_strdup(name);
+		starttrace_milestone_list = list_append(starttrace_milestone_list, (char *)module);
+	}
+
+	if (!trace) {
+		starttrace_stats_t *stats = starttrace_stats_get(module, STARTTRACE_MILESTONE);
+		starttrace_stats_push(stats, since_start);
+		return;
+	}
+
+	unsigned i = __atomic_fetch_add(&trace->count, 1, __ATOMIC_RELAXED);
+	if (i >= STARTTRACE_EVENTS_MAX)
+		return;
+
+	trace->events[i] = (starttrace_event_t){ .module = module,
+						 .hook = STARTTRACE_MILESTONE,
+						 .pid = getpid(),
+						 .start = trace->start,
+						 .duration = since_start };
+}
+
+int
+starttrace_finish(starttrace_t *trace, const char *name, const char *file)
+{
+	IF_NULL_RETVAL(trace, -1);
+
+	starttrace_add(trace, STARTTRACE_TOTAL, "compartment", trace->start);
+
+	if (!starttrace_metrics)
+		starttrace_metrics = metrics_histogram_new(
+			"cml_container_start_seconds", NULL,
+			"Time from the start of a container until it is running",
+			starttrace_metrics_buckets, ELEMENTSOF(starttrace_metrics_buckets));
+	metrics_histogram_observe(starttrace_metrics, (starttrace_now() - trace->start) / 1e9);
+
+	unsigned count = MIN(__atomic_load_n(&trace->count, __ATOMIC_RELAXED),
+			     (unsigned)STARTTRACE_EVENTS_MAX);
+	if (count == STARTTRACE_EVENTS_MAX)
+		WARN("Start trace of %s is truncated to %d events", name, STARTTRACE_EVENTS_MAX);
+
+	// a hook of a module may be recorded by several processes, sum them up per start
+	for (unsigned i = 0; i < count; i++) {
+		const starttrace_event_t *e = &trace->events[i];
+		starttrace_stats_t *stats = starttrace_stats_get(e->module, e->hook);
+		stats->current += e->duration;
+		stats->recorded = true;
+	}
+
+	for (list_t *l = starttrace_stats_list; l; l = l->next) {
+		starttrace_stats_t *stats = l->data;
+		if (!stats->recorded)
+			continue;
+
+		starttrace_stats_push(stats, stats->current);
+		stats->current = 0;
+		stats->recorded = false;
+	}
+
+	return file ? starttrace_write(trace, count, name, file) : 0;
+}
+
+starttrace_phase_t *
+starttrace_get_phases_new(const starttrace_t *trace, size_t *len)
+{
+	ASSERT(len);
+	*len = 0;
+	IF_NULL_RETVAL(trace, NULL);
+
+	unsigned count = MIN(__atomic_load_n(&trace->count, __ATOMIC_RELAXED),
+			     (unsigned)STARTTRACE_EVENTS_MAX);
+	if (count == 0)
+		return NULL;
+
+	starttrace_phase_t *phases = mem_new0(starttrace_phase_t, count);
+	for (unsigned i = 0; i < count; i++) {
+		const starttrace_event_t *e = &trace->events[i];
+		const char *hook = starttrace_hook_names[e->hook];
+		size_t j;
+		for (j = 0; j < *len; j++) {
+			if (phases[j].hook == hook && !strcmp(phases[j].module, e->module))
+				break;
+		}
+		if (j == *len) {
+			phases[j].module = e->module;
+			phases[j].hook = hook;
+			(*len)++;
+		}
+		phases[j].duration += e->duration;
+	}
+
+	return phases;
+}
@@ -0,0 +1,122 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#ifndef STARTTRACE_H
+#define STARTTRACE_H
+
+/**
+ * @file starttrace.h Records the duration of the module hooks during compartment starts.
+ *
+ * The trace is kept in shared memory which is inherited by the cloned and forked
+ * processes of a start, thus the hooks running in the compartment's child processes
+ * are recorded as well. Once a start is complete, the trace is written in the Chrome
+ * trace event format (chrome://tracing, Perfetto) and the durations are aggregated
+ * per module and hook over the last STARTTRACE_SAMPLES starts of all compartments.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STARTTRACE_SAMPLES 100
+
+typedef enum {
+	STARTTRACE_PRE_CLONE = 0,
+	STARTTRACE_CLONE, // the clone of the compartment's child itself
+	STARTTRACE_POST_CLONE_EARLY,
+	STARTTRACE_CHILD_EARLY,
+	STARTTRACE_POST_CLONE,
+	STARTTRACE_PRE_EXEC,
+	STARTTRACE_CHILD,
+	STARTTRACE_PRE_EXEC_CHILD_EARLY,
+	STARTTRACE_PRE_EXEC_CHILD,
+	STARTTRACE_POST_EXEC,
+	STARTTRACE_TOTAL, // the whole start until the compartment is running
+	STARTTRACE_MILESTONE, // from the start until a service reached a readiness milestone
+	STARTTRACE_HOOK_COUNT
+} starttrace_hook_t;
+
+typedef struct starttrace starttrace_t;
+
+/* duration of one hook of one module during a single start */
+typedef struct starttrace_phase {
+	const char *module;
+	const char *hook;
+	uint64_t duration; // in ns, summed up over all processes of the start
+} starttrace_phase_t;
+
+/**
+ * Allocates a new shared trace, the start time of the trace is the current time.
+ */
+starttrace_t *
+starttrace_new(void);
+
+void
+starttrace_free(starttrace_t *trace);
+
+/**
+ * Returns the name of a hook as it appears in the trace and statistics, e.g., "start_child".
+ */
+const char *
+starttrace_hook_get_name(starttrace_hook_t hook);
+
+/**
+ * Returns the current time in ns to be passed as start to starttrace_add().
+ */
+uint64_t
+starttrace_now(void);
+
+/**
+ * Records a hook of a module which started at start and ends now. May be called
+ * concurrently by the processes of the compartment.
+ */
+void
+starttrace_add(starttrace_t *trace, starttrace_hook_t hook, const char *module, uint64_t start);
+
+/**
+ * Records that a service of the compartment reached the milestone name since_start ns
+ * after the start. The milestone is added to trace, or, if the start was completed
+ * already and trace is NULL, directly to the statistics of the milestone.
+ */
+void
+starttrace_add_milestone(starttrace_t *trace, const char *name, uint64_t since_start);
+
+/**
+ * Completes the trace of a start. The trace is aggregated with the previous starts,
+ * and written to file if file is not NULL.
+ *
+ * @return 0 on success, -1 if the trace could not be written
+ */
+int
+starttrace_finish(starttrace_t *trace, const char *name, const char *file);
+
+/**
+ * Returns the durations of the hooks recorded in a finished trace, summed up per module
+ * and hook, in the order in which they were recorded first. The strings are static.
+ *
+ * @param len set to the number of returned phases
+ * @return the phases which have to be freed by the caller, NULL if there are none
+ */
+starttrace_phase_t *
+starttrace_get_phases_new(const starttrace_t *trace, size_t *len);
+
+#endif /* STARTTRACE_H */
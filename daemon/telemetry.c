@@ -0,0 +1,251 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#define _GNU_SOURCE
+
+#include "telemetry.h"
+
+#include "cmld.h"
+#include "container.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/event.h"
+#include "common/hashmap.h"
+#include "common/list.h"
+#include "common/nl.h"
+#include "common/uuid.h"
+
+#include <string.h>
+#include <time.h>
+
+/* number of samples kept, shared by all containers */
+#define TELEMETRY_RING_SIZE 1024
+
+struct telemetry_subscriber {
+	telemetry_cb_t func;
+	void *data;
+};
+
+static event_timer_t *telemetry_timer = NULL;
+static nl_sock_t *telemetry_nl_sock = NULL;
+
+static telemetry_sample_t *telemetry_ring = NULL;
+static size_t telemetry_ring_head = 0; // index of the next sample to be written
+static size_t telemetry_ring_count = 0;
+
+static list_t *telemetry_subscriber_list = NULL;
+
+static uint64_t
+telemetry_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Adds the counters of a veth in the root namespace to the usage of the container it
+ * belongs to. What the root namespace end transmits, the container receives.
+ */
+static void
+telemetry_link_stats_cb(const char *ifname, const struct rtnl_link_stats64 *stats, void *data)
+{
+	hashmap_t *links = data;
+
+	container_usage_t *usage = hashmap_get(links, ifname);
+	IF_NULL_RETURN(usage);
+
+	usage->net_rx_bytes += stats->tx_bytes;
+	usage->net_tx_bytes += stats->rx_bytes;
+	usage->net_rx_packets += stats->tx_packets;
+	usage->net_tx_packets += stats->rx_packets;
+}
+
+static void
+telemetry_ring_push(const telemetry_sample_t *samples, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		telemetry_ring[telemetry_ring_head] = samples[i];
+		telemetry_ring_head = (telemetry_ring_head + 1) % TELEMETRY_RING_SIZE;
+		if (telemetry_ring_count < TELEMETRY_RING_SIZE)
+			telemetry_ring_count++;
+	}
+}
+
+typedef struct telemetry_tick {
+	uint64_t timestamp_ms;
+	telemetry_sample_t *samples;
+	size_t n;
+	hashmap_t *links;   // names of the veths in the root namespace to the usage to add to
+	list_t *vnet_lists; // keep the names of the links until the dump is done
+} telemetry_tick_t;
+
+static void
+telemetry_sample_container(container_t *container, void *data)
+{
+	telemetry_tick_t *tick = data;
+	telemetry_sample_t *sample = &tick->samples[tick->n];
+
+	// not started containers have no cgroup to be sampled
+	IF_TRUE_RETURN(container_get_usage(container, &sample->usage) < 0);
+
+	strncpy(sample->uuid, uuid_string(container_get_uuid(container)),
+		TELEMETRY_UUID_STRLEN - 1);
+	sample->timestamp_ms = tick->timestamp_ms;
+
+	list_t *vnet_list = container_get_vnet_runtime_cfg_new(container);
+	for (list_t *l = vnet_list; l; l = l->next) {
+		container_vnet_cfg_t *vnet_cfg = l->data;
+		if (vnet_cfg->rootns_name)
+			hashmap_put(tick->links, vnet_cfg->rootns_name, &sample->usage);
+	}
+	tick->vnet_lists = list_append(tick->vnet_lists, vnet_list);
+	tick->n++;
+}
+
+static void
+telemetry_sample_cb(UNUSED event_timer_t *timer, UNUSED void *data)
+{
+	int count = cmld_containers_get_count();
+	IF_TRUE_RETURN(count <= 0);
+
+	telemetry_tick_t tick = {
+		.timestamp_ms = telemetry_now_ms(),
+		.samples = mem_new0(telemetry_sample_t, count),
+		.n = 0,
+		.links = hashmap_new_str(),
+		.vnet_lists = NULL,
+	};
+
+	cmld_containers_foreach(&telemetry_sample_container, &tick);
+
+	if (hashmap_size(tick.links) > 0 &&
+	    nl_link_stats_dump(telemetry_nl_sock, &telemetry_link_stats_cb, tick.links) < 0)
+		WARN("Could not dump network counters of containers");
+
+	telemetry_ring_push(tick.samples, tick.n);
+
+	for (list_t *l = telemetry_subscriber_list; l;) {
+		telemetry_subscriber_t *subscriber = l->data;
+		// the subscriber may unsubscribe in its callback
+		l = l->next;
+		subscriber->func(tick.samples, tick.n, subscriber->data);
+	}
+
+	for (list_t *l = tick.vnet_lists; l; l = l->next) {
+		for (list_t *v = l->data; v; v = v->next)
+			container_vnet_cfg_free(v->data);
+		list_delete(l->data);
+	}
+	list_delete(tick.vnet_lists);
+	hashmap_free(tick.links);
+	mem_free0(tick.samples);
+}
+
+telemetry_sample_t *
+telemetry_get_samples_new(size_t *n)
+{
+	ASSERT(n);
+
+	*n = telemetry_ring_count;
+	IF_TRUE_RETVAL(telemetry_ring_count == 0, NULL);
+
+	telemetry_sample_t *samples = mem_new(telemetry_sample_t, telemetry_ring_count);
+	size_t oldest = (telemetry_ring_head + TELEMETRY_RING_SIZE - telemetry_ring_count) %
+			TELEMETRY_RING_SIZE;
+	for (size_t i = 0; i < telemetry_ring_count; i++)
+		samples[i] = telemetry_ring[(oldest + i) % TELEMETRY_RING_SIZE];
+
+	return samples;
+}
+
+telemetry_subscriber_t *
+telemetry_subscribe(telemetry_cb_t func, void *data)
+{
+	ASSERT(func);
+
+	telemetry_subscriber_t *subscriber = mem_new0(telemetry_subscriber_t, 1);
+	subscriber->func = func;
+	subscriber->data = data;
+	telemetry_subscriber_list = list_append(telemetry_subscriber_list, subscriber);
+
+	return subscriber;
+}
+
+void
+telemetry_unsubscribe(telemetry_subscriber_t *subscriber)
+{
+	IF_NULL_RETURN(subscriber);
+
+	telemetry_subscriber_list = list_remove(telemetry_subscriber_list, subscriber);
+	mem_free0(subscriber);
+}
+
+int
+telemetry_init(unsigned int interval)
+{
+	IF_TRUE_RETVAL(interval == 0, 0);
+
+	telemetry_nl_sock = nl_sock_routing_new();
+	IF_NULL_RETVAL_ERROR(telemetry_nl_sock, -1);
+
+	telemetry_ring = mem_new0(telemetry_sample_t, TELEMETRY_RING_SIZE);
+
+	telemetry_timer = event_timer_new(interval * 1000, EVENT_TIMER_REPEAT_FOREVER,
+					  &telemetry_sample_cb, NULL);
+	event_add_timer(telemetry_timer);
+
+	INFO("Sampling resource usage of containers every %u seconds", interval);
+	return 0;
+}
+
+bool
+telemetry_is_active(void)
+{
+	return telemetry_timer != NULL;
+}
+
+void
+telemetry_cleanup(void)
+{
+	if (telemetry_timer) {
+		event_remove_timer(telemetry_timer);
+		event_timer_free(telemetry_timer);
+		telemetry_timer = NULL;
+	}
+	if (telemetry_nl_sock) {
+		nl_sock_free(telemetry_nl_sock);
+		telemetry_nl_sock = NULL;
+	}
+
+	for (list_t *l = telemetry_subscriber_list; l; l = l->next)
+		mem_free0(l->data);
+	list_delete(telemetry_subscriber_list);
+	telemetry_subscriber_list = NULL;
+
+	if (telemetry_ring)
+		mem_free0(telemetry_ring);
+	telemetry_ring_head = telemetry_ring_count = 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * Periodic sampling of the resource usage of all containers. All started containers
+ * are sampled in one batch per tick, i.e. a pread() of the kept open cgroup files of
+ * each container and a single netlink dump for the counters of all veths. The samples
+ * are kept in a ring buffer and passed to the registered subscribers.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "container.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* length of the string representation of a uuid, including the terminating null */
+#define TELEMETRY_UUID_STRLEN 37
+
+typedef struct telemetry_sample {
+	char uuid[TELEMETRY_UUID_STRLEN];
+	uint64_t timestamp_ms; // wall clock time of the tick
+	container_usage_t usage;
+} telemetry_sample_t;
+
+typedef struct telemetry_subscriber telemetry_subscriber_t;
+
+/**
+ * Called with the samples of all containers taken in one tick.
+ */
+typedef void (*telemetry_cb_t)(const telemetry_sample_t *samples, size_t n, void *data);
+
+/**
+ * Starts sampling all containers each interval seconds.
+ *
+ * @return 0 on success or if sampling is disabled by an interval of 0, -1 on error
+ */
+int
+telemetry_init(unsigned int interval);
+
+void
+telemetry_cleanup(void);
+
+/**
+ * Returns true if the containers are sampled, i.e., the subscribers are called.
+ */
+bool
+telemetry_is_active(void);
+
+/**
+ * Returns a copy of the samples in the ring buffer, oldest first, which has to be freed
+ * by the caller.
+ *
+ * @param n is set to the number of returned samples
+ */
+telemetry_sample_t *
+telemetry_get_samples_new(size_t *n);
+
+/**
+ * Registers func to be called with the samples of each following tick.
+ */
+telemetry_subscriber_t *
+telemetry_subscribe(telemetry_cb_t func, void *data);
+
+void
+telemetry_unsubscribe(telemetry_subscriber_t *subscriber);
+
+#endif /* TELEMETRY_H */
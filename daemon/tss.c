@@ -28,13 +28,17 @@
 
 #include "common/macro.h"
 #include "common/mem.h"
+#include "common/list.h"
+#include "common/metrics.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/proc.h"
 #include "common/file.h"
 
 #include <google/protobuf-c/protobuf-c-text.h>
 #include <stdbool.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifndef TPM2D_BINARY_NAME
@@ -44,6 +48,27 @@
 static int tss_sock = -1;
 static pid_t tss_tpm2d_pid = -1;
 
+// connection of cmld to tpm2d, whose replies are handled by the event loop
+static protobuf_conn_t *tss_conn = NULL;
+static pid_t tss_owner_pid = -1;
+
+// connection of a process forked from cmld, whose replies are read by tss_ml_flush()
+static int tss_child_sock = -1;
+
+/*
+ * A measurement sent to tpm2d which awaits its reply
+ */
+typedef struct tss_ml_req {
+	char *filename;
+	tss_ml_append_cb_t cb;
+	void *data;
+	struct timespec start;
+} tss_ml_req_t;
+
+// tss_ml_req_t in the order they were sent by process tss_pending_pid
+static list_t *tss_pending = NULL;
+static pid_t tss_pending_pid = -1;
+
 /**
  * Returns the HashAlgLen (proto) for the given tss_hash_algo_t algo.
  */
@@ -108,6 +133,120 @@ fork_and_exec_tpm2d(void)
 	return -1;
 }
 
+static void
+tss_ml_req_free(tss_ml_req_t *req)
+{
+	mem_free0(req->filename);
+	mem_free0(req);
+}
+
+/**
+ * Reports the result of a measurement and frees the request.
+ *
+ * @param resp The reply of tpm2d or NULL if the measurement could not be appended.
+ */
+static void
+tss_ml_req_complete(tss_ml_req_t *req, const TpmToController *resp)
+{
+	static metrics_t *metrics = NULL;
+	if (!metrics)
+		metrics = metrics_histogram_new("cml_tpm2d_request_seconds", NULL,
+						"Round trip time of the requests to tpm2d",
+						metrics_latency_buckets,
+						metrics_latency_buckets_len);
+
+	bool success = resp && resp->code == TPM_TO_CONTROLLER__CODE__GENERIC_RESPONSE &&
+		       resp->response == TPM_TO_CONTROLLER__GENERIC_RESPONSE__CMD_OK;
+	if (resp) {
+		// the requests are queued in tpm2d, so this includes the wait
+		metrics_histogram_observe_since(metrics, &req->start);
+		if (success)
+			INFO("Sucessfully appended measurement to ML: file %s", req->filename);
+		else
+			ERROR("tpmd failed to append measurement to ML");
+	}
+
+	if (req->cb)
+		req->cb(req->filename, success, req->data);
+	tss_ml_req_free(req);
+}
+
+/**
+ * Completes the oldest pending measurement with the reply resp.
+ */
+static void
+tss_ml_complete_next(const TpmToController *resp)
+{
+	if (!tss_pending) {
+		WARN("Received unexpected reply from tpm2d");
+		return;
+	}
+
+	tss_ml_req_t *req = tss_pending->data;
+	tss_pending = list_unlink(tss_pending, tss_pending);
+	tss_ml_req_complete(req, resp);
+}
+
+static void
+tss_ml_fail_pending(void)
+{
+	// the callbacks may already append new measurements
+	list_t *pending = tss_pending;
+	tss_pending = NULL;
+
+	for (list_t *l = pending; l; l = l->next)
+		tss_ml_req_complete(l->data, NULL);
+	list_delete(pending);
+}
+
+static void
+tss_conn_cb_message(UNUSED protobuf_conn_t *conn, ProtobufCMessage *msg, UNUSED void *data)
+{
+	tss_ml_complete_next((TpmToController *)msg);
+}
+
+static void
+tss_conn_cb_close(protobuf_conn_t *conn, UNUSED void *data)
+{
+	WARN("Connection to tpm2d closed");
+	protobuf_conn_free(conn);
+	close(tss_sock);
+	tss_sock = -1;
+	tss_conn = NULL;
+
+	tss_ml_fail_pending();
+}
+
+/**
+ * Returns the socket to send measurements on, or -1 if tpm2d is not available.
+ * The connection of cmld is shared with forked processes, e.g., the early child of a
+ * container, but its replies are read by the event loop of cmld. Thus, such processes
+ * connect to tpm2d on their own and drop the pending requests which they inherited.
+ */
+static int
+tss_sock_get(void)
+{
+	IF_TRUE_RETVAL(tss_owner_pid == -1, -1);
+	if (getpid() == tss_owner_pid)
+		return tss_sock;
+
+	if (tss_pending_pid != getpid()) {
+		for (list_t *l = tss_pending; l; l = l->next)
+			tss_ml_req_free(l->data);
+		list_delete(tss_pending);
+		tss_pending = NULL;
+		tss_pending_pid = getpid();
+
+		if (tss_child_sock >= 0)
+			close(tss_child_sock);
+		tss_child_sock = sock_unix_create_and_connect(SOCK_STREAM | SOCK_CLOEXEC,
+							      TPM2D_SOCKET);
+		if (tss_child_sock < 0)
+			WARN("Failed to connect to tpm2d from process %d", getpid());
+	}
+	return tss_child_sock;
+}
+
 int
 tss_init(bool start_daemon)
 {
@@ -137,7 +276,17 @@ tss_init(bool start_daemon)
 		fflush(stdout);
 	} while (tss_sock < 0);
 
-	return (tss_sock < 0) ? -1 : 0;
+	tss_conn = protobuf_conn_new(tss_sock, &tpm_to_controller__descriptor, tss_conn_cb_message,
+				     tss_conn_cb_close, NULL);
+	if (!tss_conn) {
+		ERROR("Failed to set up connection to tpm2d");
+		close(tss_sock);
+		tss_sock = -1;
+		return -1;
+	}
+	tss_owner_pid = tss_pending_pid = getpid();
+
+	return 0;
 }
 
 static void
@@ -154,45 +303,73 @@ tss_cleanup(void)
 	tss_tpm2d_stop();
 }
 
+/**
+ * Sends the measurements without waiting for the replies of tpm2d, which are matched to the
+ * queued requests in order, as tpm2d handles the requests of a connection one by one.
+ */
 void
-tss_ml_append(char *filename, uint8_t *filehash, int filehash_len, tss_hash_algo_t hashalgo)
+tss_ml_append_batch(char *const *filenames, uint8_t *const *filehashes, const int *filehash_lens,
+		    size_t n, tss_hash_algo_t hashalgo, tss_ml_append_cb_t cb, void *data)
 {
-	/*
-	 * check if tpm2d socket is connected otherwise silently return,
-	 * since platform may not support tss/tpm2 functionality
-	 */
-	IF_TRUE_RETURN(tss_sock < 0);
+	HashAlgLen hash_len = tss_hash_algo_get_len_proto(hashalgo);
+	int sock = tss_sock_get();
 
-	ControllerToTpm msg = CONTROLLER_TO_TPM__INIT;
+	for (size_t i = 0; i < n; i++) {
+		tss_ml_req_t *req = mem_new0(tss_ml_req_t, 1);
+		req->filename = mem_strdup(filenames[i]);
+		req->cb = cb;
+		req->data = data;
+		clock_gettime(CLOCK_MONOTONIC, &req->start);
 
-	msg.code = CONTROLLER_TO_TPM__CODE__ML_APPEND;
-	msg.ml_filename = filename;
-	msg.has_ml_datahash = true;
-	msg.ml_datahash.len = filehash_len;
-	msg.ml_datahash.data = filehash;
-	msg.has_ml_hashalg = true;
+		if (sock < 0 || hash_len == 0) {
+			// silently, since the platform may not support tss/tpm2 functionality
+			tss_ml_req_complete(req, NULL);
+			continue;
+		}
 
-	HashAlgLen hash_len = tss_hash_algo_get_len_proto(hashalgo);
-	IF_TRUE_RETURN(hash_len == 0);
-	msg.ml_hashalg = hash_len;
+		ControllerToTpm msg = CONTROLLER_TO_TPM__INIT;
 
-	if (protobuf_send_message(tss_sock, (ProtobufCMessage *)&msg) < 0) {
-		WARN("Failed to send measurement to tpm2d");
-	}
+		msg.code = CONTROLLER_TO_TPM__CODE__ML_APPEND;
+		msg.ml_filename = filenames[i];
+		msg.has_ml_datahash = true;
+		msg.ml_datahash.len = filehash_lens[i];
+		msg.ml_datahash.data = filehashes[i];
+		msg.has_ml_hashalg = true;
+		msg.ml_hashalg = hash_len;
 
-	TpmToController *resp =
-		(TpmToController *)protobuf_recv_message(tss_sock, &tpm_to_controller__descriptor);
-	if (!resp) {
-		WARN("Failed to receive and decode TpmToController protobuf message!");
-		return;
+		if (protobuf_send_message(sock, (ProtobufCMessage *)&msg) < 0) {
+			WARN("Failed to send measurement to tpm2d");
+			tss_ml_req_complete(req, NULL);
+			continue;
+		}
+		tss_pending = list_append(tss_pending, req);
 	}
+}
 
-	if (resp->code != TPM_TO_CONTROLLER__CODE__GENERIC_RESPONSE ||
-	    resp->response != TPM_TO_CONTROLLER__GENERIC_RESPONSE__CMD_OK) {
-		ERROR("tpmd failed to append measurement to ML");
-	} else {
-		INFO("Sucessfully appended measurement to ML: file %s", filename);
-	}
+void
+tss_ml_append(char *filename, uint8_t *filehash, int filehash_len, tss_hash_algo_t hashalgo,
+	      tss_ml_append_cb_t cb, void *data)
+{
+	tss_ml_append_batch(&filename, &filehash, &filehash_len, 1, hashalgo, cb, data);
+}
 
-	protobuf_free_message((ProtobufCMessage *)resp);
+void
+tss_ml_flush(void)
+{
+	// in cmld itself, the replies are handled by the event loop
+	IF_TRUE_RETURN(tss_pending_pid != getpid() || tss_child_sock < 0);
+
+	while (tss_pending) {
+		TpmToController *resp = (TpmToController *)protobuf_recv_message(
+			tss_child_sock, &tpm_to_controller__descriptor);
+		if (!resp) {
+			WARN("Failed to receive and decode TpmToController protobuf message!");
+			tss_ml_fail_pending();
+			close(tss_child_sock);
+			tss_child_sock = -1;
+			return;
+		}
+		tss_ml_complete_next(resp);
+		protobuf_free_message((ProtobufCMessage *)resp);
+	}
 }
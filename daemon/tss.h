@@ -26,6 +26,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /*
  * type of supported hashes
@@ -46,7 +47,49 @@ tss_init(bool start_daemon);
 void
 tss_cleanup(void);
 
+/**
+ * Callback which reports whether a measurement was appended to the measurement list.
+ * @param filename name of the measured file
+ * @param success true if tpm2d extended the measurement, false on error or if the
+ *		  platform has no TPM
+ * @param data data passed to tss_ml_append()
+ */
+typedef void (*tss_ml_append_cb_t)(const char *filename, bool success, void *data);
+
+/**
+ * Appends a measurement to the container measurement list of tpm2d, see
+ * tss_ml_append_batch().
+ */
+void
+tss_ml_append(char *filename, uint8_t *filehash, int filehash_len, tss_hash_algo_t hashalgo,
+	      tss_ml_append_cb_t cb, void *data);
+
+/**
+ * Appends several measurements to the container measurement list of tpm2d.
+ * The measurements are sent without waiting for tpm2d to extend them. They are
+ * extended in the order of the calls, which all use the same connection of the
+ * calling process. Once tpm2d replied, cb is called for each measurement. In cmld,
+ * this happens from the event loop. Processes forked from cmld use a connection of
+ * their own, whose replies are collected by tss_ml_flush().
+ * @param filenames names of the measured files
+ * @param filehashes digests of the files computed with hashalgo
+ * @param filehash_lens lengths of the digests
+ * @param n number of measurements
+ * @param hashalgo hash algorithm used for all digests
+ * @param cb callback for the result of each measurement, may be NULL
+ * @param data data passed to cb
+ */
+void
+tss_ml_append_batch(char *const *filenames, uint8_t *const *filehashes, const int *filehash_lens,
+		    size_t n, tss_hash_algo_t hashalgo, tss_ml_append_cb_t cb, void *data);
+
+/**
+ * Waits for the replies to the measurements a process forked from cmld has sent.
+ * Such a process must call this before it exits or execs, since tpm2d drops the
+ * remaining measurements of a connection once it cannot reply anymore. Has no effect
+ * in cmld itself.
+ */
 void
-tss_ml_append(char *filename, uint8_t *filehash, int filehash_len, tss_hash_algo_t hashalgo);
+tss_ml_flush(void);
 
 #endif /* TSS_H */
@@ -0,0 +1,274 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * The program and the map of a filter are not kept by cmld. Once attached to the interface,
+ * the program holds the only reference to its map. A new filter is generated and atomically
+ * replaces the attached one if the filter of an interface is set up again, and the filter is
+ * freed by the kernel on detach or if the interface is removed.
+ */
+
+#define _GNU_SOURCE
+
+#include "xdp.h"
+
+#include "bpf_insn.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/network.h"
+#include "common/nl.h"
+
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define XDP_MAC_MAP_MAX_ENTRIES 1024
+#define XDP_PROG_LOAD_RETRIES 10
+#define XDP_LOG_SIZE 64 * 1024
+
+static bool xdp_mac_filter = false;
+
+static __u64
+ptr_to_u64(const void *ptr)
+{
+	return (__u64)(unsigned long)ptr;
+}
+
+static int
+bpf(enum bpf_cmd cmd, union bpf_attr *attr, unsigned int size)
+{
+	return syscall(SYS_bpf, cmd, attr, size);
+}
+
+void
+xdp_set_mac_filter(bool enable)
+{
+	xdp_mac_filter = enable;
+}
+
+bool
+xdp_get_mac_filter(void)
+{
+	return xdp_mac_filter;
+}
+
+static int
+xdp_mac_map_new(const list_t *mac_whitelist)
+{
+	union bpf_attr attr = {
+		.map_type = BPF_MAP_TYPE_HASH,
+		.key_size = ETH_ALEN,
+		.value_size = sizeof(__u8),
+		.max_entries = XDP_MAC_MAP_MAX_ENTRIES,
+		.map_flags = BPF_F_NO_PREALLOC,
+	};
+
+	strncpy(attr.map_name, "cml_macs", BPF_OBJ_NAME_LEN - 1);
+
+	int map_fd = bpf(BPF_MAP_CREATE, &attr, sizeof(attr));
+	if (map_fd < 0) {
+		ERROR_ERRNO("Failed to create bpf mac map!");
+		return -1;
+	}
+
+	__u8 value = 1;
+	for (const list_t *l = mac_whitelist; l; l = l->next) {
+		union bpf_attr update_attr = {
+			.map_fd = map_fd,
+			.key = ptr_to_u64(l->data),
+			.value = ptr_to_u64(&value),
+			.flags = BPF_ANY,
+		};
+		if (bpf(BPF_MAP_UPDATE_ELEM, &update_attr, sizeof(update_attr))) {
+			ERROR_ERRNO("Failed to update bpf mac map!");
+			close(map_fd);
+			return -1;
+		}
+	}
+
+	return map_fd;
+}
+
+/*
+ * Loads the program which looks up the source mac address of a frame in the map map_fd.
+ * Frames from whitelisted macs are passed to the stack, all others and frames shorter than
+ * an ethernet header are dropped.
+ */
+static int
+xdp_mac_prog_load(int map_fd)
+{
+	const struct bpf_insn insn[] = {
+		// load data to R2 and data_end to R3, drop if there is no ethernet header
+		BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data)),
+		BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end)),
+		BPF_MOV64_REG(BPF_REG_4, BPF_REG_2),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_4, ETH_HLEN),
+		BPF_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 12),
+
+		// copy source mac to key on stack
+		BPF_LDX_MEM(BPF_W, BPF_REG_4, BPF_REG_2, ETH_ALEN),
+		BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_4, -8),
+		BPF_LDX_MEM(BPF_H, BPF_REG_4, BPF_REG_2, ETH_ALEN + 4),
+		BPF_STX_MEM(BPF_H, BPF_REG_10, BPF_REG_4, -4),
+
+		// lookup key on stack, pass if found
+		BPF_LD_MAP_FD(BPF_REG_1, map_fd),
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -8),
+		BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 2),
+		BPF_MOV64_IMM(BPF_REG_0, XDP_PASS),
+		BPF_EXIT_INSN(),
+
+		BPF_MOV64_IMM(BPF_REG_0, XDP_DROP),
+		BPF_EXIT_INSN(),
+	};
+
+	union bpf_attr load_attr = {
+		.prog_type = BPF_PROG_TYPE_XDP,
+		.insns = ptr_to_u64(insn),
+		.insn_cnt = ELEMENTSOF(insn),
+		.license = ptr_to_u64("GPL"),
+	};
+
+	strncpy(load_attr.prog_name, "cml_mac_filter", BPF_OBJ_NAME_LEN - 1);
+
+	int prog_fd = bpf(BPF_PROG_LOAD, &load_attr, sizeof(load_attr));
+	for (int retry = 1; prog_fd < 0 && errno == EAGAIN && retry <= XDP_PROG_LOAD_RETRIES;
+	     retry++) {
+		TRACE_ERRNO("Failed to load xdp program retrying (retry %d)!", retry);
+		prog_fd = bpf(BPF_PROG_LOAD, &load_attr, sizeof(load_attr));
+	}
+
+	if (prog_fd < 0) {
+		WARN_ERRNO("Failed to load xdp program retrying with logbuffer!");
+		char *bpf_log = mem_new0(char, XDP_LOG_SIZE);
+		load_attr.log_buf = ptr_to_u64(bpf_log);
+		load_attr.log_size = XDP_LOG_SIZE;
+		load_attr.log_level = 1;
+		prog_fd = bpf(BPF_PROG_LOAD, &load_attr, sizeof(load_attr));
+		if (prog_fd < 0)
+			ERROR_ERRNO("Failed to load xdp program '%s'!", bpf_log);
+		mem_free0(bpf_log);
+	}
+
+	return prog_fd;
+}
+
+/*
+ * Attaches the program prog_fd to the interface ifi_index, replacing the attached one, if
+ * any. A prog_fd of -1 detaches the attached program.
+ */
+static int
+xdp_attach(unsigned int ifi_index, int prog_fd)
+{
+	nl_sock_t *nl_sock = NULL;
+	nl_msg_t *req = NULL;
+	struct nlattr *attr;
+	int ret = -1;
+
+	if (!(nl_sock = nl_sock_routing_new())) {
+		ERROR("failed to allocate netlink socket");
+		return -1;
+	}
+
+	if (!(req = nl_msg_new())) {
+		ERROR("failed to allocate netlink message");
+		nl_sock_free(nl_sock);
+		return -1;
+	}
+
+	struct ifinfomsg link_req = { .ifi_family = AF_UNSPEC, .ifi_index = ifi_index };
+
+	if (nl_msg_set_type(req, RTM_SETLINK))
+		goto out;
+
+	if (nl_msg_set_flags(req, NLM_F_REQUEST | NLM_F_ACK))
+		goto out;
+
+	if (nl_msg_set_link_req(req, &link_req))
+		goto out;
+
+	if (!(attr = nl_msg_start_nested_attr(req, IFLA_XDP)))
+		goto out;
+
+	if (nl_msg_add_u32(req, IFLA_XDP_FD, (uint32_t)prog_fd))
+		goto out;
+
+	if (nl_msg_end_nested_attr(req, attr))
+		goto out;
+
+	ret = nl_msg_send_kernel_verify(nl_sock, req);
+out:
+	nl_msg_free(req);
+	nl_sock_free(nl_sock);
+	return ret;
+}
+
+int
+xdp_setup_mac_filter(const char *netif, const list_t *mac_whitelist, bool add)
+{
+	ASSERT(netif);
+
+	if (!xdp_mac_filter)
+		return network_setup_mac_filter(netif, mac_whitelist, add);
+
+	unsigned int ifi_index = if_nametoindex(netif);
+	if (!ifi_index) {
+		ERROR_ERRNO("Failed to resolve interface %s", netif);
+		return -1;
+	}
+
+	if (!add) {
+		if (xdp_attach(ifi_index, -1)) {
+			ERROR_ERRNO("Failed to detach xdp mac filter from %s", netif);
+			return -1;
+		}
+		return 0;
+	}
+
+	int map_fd = xdp_mac_map_new(mac_whitelist);
+	IF_TRUE_RETVAL(map_fd < 0, -1);
+
+	int prog_fd = xdp_mac_prog_load(map_fd);
+	close(map_fd);
+	IF_TRUE_RETVAL(prog_fd < 0, -1);
+
+	int ret = xdp_attach(ifi_index, prog_fd);
+	if (ret)
+		ERROR_ERRNO("Failed to attach xdp mac filter to %s", netif);
+	else
+		DEBUG("Attached xdp mac filter to %s", netif);
+
+	close(prog_fd);
+	return ret;
+}
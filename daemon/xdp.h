@@ -0,0 +1,63 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/*
+ * Mac filters of physical interfaces implemented by an XDP program. Frames received on the
+ * interface are dropped by the driver, before an skb is allocated or the bridge and the
+ * firewall are traversed, unless their source mac address is found in the whitelist map of
+ * the program.
+ */
+
+#ifndef XDP_H
+#define XDP_H
+
+#include "common/list.h"
+
+#include <stdbool.h>
+
+/**
+ * Selects the XDP program instead of the firewall rules of network_setup_mac_filter()
+ * for the mac filters set up by xdp_setup_mac_filter().
+ */
+void
+xdp_set_mac_filter(bool enable);
+
+/**
+ * Returns true if the XDP program is selected for the mac filters.
+ */
+bool
+xdp_get_mac_filter(void);
+
+/**
+ * Adds/Removes the mac filter of the physical (bridge-port) interface netif, which drops
+ * all frames received on netif, except for the ones of the clients with the mac addresses
+ * (uint8_t[6]) in mac_whitelist. Falls back to network_setup_mac_filter() if the XDP
+ * program is not selected by xdp_set_mac_filter().
+ *
+ * @return 0 on success, -1 on error
+ */
+int
+xdp_setup_mac_filter(const char *netif, const list_t *mac_whitelist, bool add);
+
+#endif /* XDP_H */
@@ -23,7 +23,10 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/random.h>
 #include "ibmtss/Unmarshal_fp.h"
@@ -31,9 +34,11 @@
 #include "common/macro.h"
 #include "common/mem.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/event.h"
 #include "common/sock.h"
 #include "common/fd.h"
+#include "common/file.h"
 #include "common/ssl_util.h"
 #include "common/hex.h"
 
@@ -47,19 +52,150 @@
 #include "container_verify.h"
 
 #define TPM2D_SERVICE_PORT "9505"
+#define ATTESTATION_NONCE_LEN 8
 
-struct attestation_resp_cb_data {
-	void (*resp_verified_cb)(bool);
-	size_t nonce_len;
-	uint8_t *nonce;
+struct attestation_ctx {
 	RAttestationConfig *config;
+	uint8_t *pcrs; // the configured PCR values, config->halg bytes each
 };
 
+typedef struct attestation_req {
+	attestation_ctx_t *ctx;
+	char *host;
+	unsigned int timeout_ms;
+	attestation_result_cb_t cb;
+	void *data;
+
+	uint8_t nonce[ATTESTATION_NONCE_LEN];
+	RAttestationCheckpoint *checkpoint;
+	int sock;
+	event_io_t *connect_io; // watches the socket until the connection is established
+	protobuf_conn_t *conn;
+	event_timer_t *timer;
+} attestation_req_t;
+
+typedef struct attestation_single {
+	attestation_ctx_t *ctx;
+	void (*resp_verified_cb)(bool);
+} attestation_single_t;
+
+/**
+ * Checks that the root of the nonce Merkle tree, recomputed from the nonce and the
+ * inclusion proof of a batched response, matches the quoted root.
+ * See Tpm2dToRemote.nonce_batch_index in attestation.proto for the tree layout.
+ */
+static bool
+attestation_verify_nonce_batch(const Tpm2dToRemote *resp, const uint8_t *nonce,
+			       size_t nonce_len, const uint8_t *root, size_t root_len)
+{
+	uint8_t hash[SHA256_DIGEST_LENGTH];
+	uint8_t node[1 + 2 * SHA256_DIGEST_LENGTH];
+	uint32_t index = resp->nonce_batch_index;
+
+	IF_FALSE_RETVAL(root_len == SHA256_DIGEST_LENGTH, false);
+
+	uint8_t *leaf = mem_new0(uint8_t, nonce_len + 1);
+	leaf[0] = 0x00;
+	memcpy(leaf + 1, nonce, nonce_len);
+	hash_sha256(hash, leaf, nonce_len + 1);
+	mem_free0(leaf);
+
+	for (size_t i = 0; i < resp->n_nonce_batch_proof; i++) {
+		ProtobufCBinaryData *sibling = &resp->nonce_batch_proof[i];
+		IF_FALSE_RETVAL(sibling->len == SHA256_DIGEST_LENGTH, false);
+
+		node[0] = 0x01;
+		if (index & 1) {
+			memcpy(node + 1, sibling->data, SHA256_DIGEST_LENGTH);
+			memcpy(node + 1 + SHA256_DIGEST_LENGTH, hash, SHA256_DIGEST_LENGTH);
+		} else {
+			memcpy(node + 1, hash, SHA256_DIGEST_LENGTH);
+			memcpy(node + 1 + SHA256_DIGEST_LENGTH, sibling->data,
+			       SHA256_DIGEST_LENGTH);
+		}
+		hash_sha256(hash, node, sizeof(node));
+		index >>= 1;
+	}
+	// the leaf index must not point beyond the tree
+	IF_FALSE_RETVAL(index == 0, false);
+
+	return !memcmp(hash, root, SHA256_DIGEST_LENGTH);
+}
+
+/**
+ * Checks that the checkpoint the incremental request was based on still describes the
+ * attested system, i.e., it did not reboot and presents the same attestation certificate.
+ */
+static bool
+attestation_checkpoint_is_valid(const RAttestationCheckpoint *checkpoint,
+				const Tpm2dToRemote *resp, const TPMS_ATTEST *tpms_attest)
+{
+	uint8_t cert_hash[SHA256_DIGEST_LENGTH];
+
+	IF_NULL_RETVAL(checkpoint, false);
+
+	if (checkpoint->reset_count != tpms_attest->clockInfo.resetCount) {
+		INFO("Attested system was reset since the last attestation");
+		return false;
+	}
+
+	hash_sha256(cert_hash, resp->certificate.data, resp->certificate.len);
+	if (checkpoint->cert_hash.len != SHA256_DIGEST_LENGTH ||
+	    memcmp(checkpoint->cert_hash.data, cert_hash, SHA256_DIGEST_LENGTH)) {
+		INFO("Attestation certificate changed since the last attestation");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Stores the verified lengths of the measurement lists together with the quoted PCR
+ * values, so that the next attestation of host only has to verify the appended entries.
+ */
+static void
+attestation_checkpoint_store(const char *dir, const char *host, const Tpm2dToRemote *resp,
+			     const TPMS_ATTEST *tpms_attest, const Pcr *ima_pcr,
+			     const Pcr *container_pcr)
+{
+	RAttestationCheckpoint checkpoint = RATTESTATION_CHECKPOINT__INIT;
+	uint8_t cert_hash[SHA256_DIGEST_LENGTH];
+
+	hash_sha256(cert_hash, resp->certificate.data, resp->certificate.len);
+	checkpoint.reset_count = tpms_attest->clockInfo.resetCount;
+	checkpoint.cert_hash.data = cert_hash;
+	checkpoint.cert_hash.len = SHA256_DIGEST_LENGTH;
+
+	if (ima_pcr) {
+		checkpoint.has_ml_ima_offset = true;
+		checkpoint.ml_ima_offset = resp->ml_ima_offset + resp->ml_ima_entry.len;
+		checkpoint.has_ima_pcr_value = true;
+		checkpoint.ima_pcr_value = ima_pcr->value;
+	}
+
+	if (container_pcr) {
+		checkpoint.has_ml_container_offset = true;
+		checkpoint.ml_container_offset =
+			resp->ml_container_offset + resp->n_ml_container_entry;
+		checkpoint.has_container_pcr_value = true;
+		checkpoint.container_pcr_value = container_pcr->value;
+	}
+
+	rattestation_write_checkpoint(dir, host, &checkpoint);
+}
+
+/**
+ * Verifies the response resp. If the response only contains the measurement list entries
+ * appended since checkpoint, but checkpoint turns out to be stale, *retry is set to
+ * signal that the attestation has to be repeated with the complete measurement lists.
+ */
 static bool
-attestation_verify_resp(Tpm2dToRemote *resp, RAttestationConfig *config, uint8_t *nonce,
-			size_t nonce_len)
+attestation_verify_resp(Tpm2dToRemote *resp, const attestation_ctx_t *ctx, const char *host,
+			uint8_t *nonce, size_t nonce_len, const RAttestationCheckpoint *checkpoint,
+			bool *retry)
 {
-	ASSERT(config);
+	ASSERT(ctx);
+	RAttestationConfig *config = ctx->config;
 	ASSERT(nonce);
 	ASSERT(resp);
 	ASSERT(resp->n_pcr_values < 24);
@@ -72,7 +208,6 @@ attestation_verify_resp(Tpm2dToRemote *resp, RAttestationConfig *config, uint8_t
 	uint8_t *s = sig;   // Required as TSS functions manipulate pointer
 	uint32_t quote_len = resp->quoted.len;
 	uint32_t sig_len = resp->signature.len;
-	uint8_t pcr[resp->n_pcr_values][config->halg];
 
 	if (resp->has_quoted) {
 		INFO("Response contains quote (Length %zu)", resp->quoted.len);
@@ -108,14 +243,7 @@ attestation_verify_resp(Tpm2dToRemote *resp, RAttestationConfig *config, uint8_t
 
 	bool ret_pcr = true;
 	for (size_t i = 0; i < config->n_pcr_values; i++) {
-		if (convert_hex_to_bin(config->pcr_values[i]->value,
-				       strlen(config->pcr_values[i]->value), pcr[i],
-				       config->halg)) {
-			ERROR("Failed to convert configured PCR value %s: Invalid hex string",
-			      config->pcr_values[i]->value);
-			ret_pcr = false;
-			continue;
-		}
+		const uint8_t *pcr = ctx->pcrs + i * config->halg;
 		if (resp->pcr_values[i]->value.len != config->halg) {
 			ERROR("Length of configured PCR value %zu invalid (%zu,	must be %u)", i,
 			      resp->pcr_values[i]->value.len, config->halg);
@@ -133,7 +261,7 @@ attestation_verify_resp(Tpm2dToRemote *resp, RAttestationConfig *config, uint8_t
 			ret_pcr = false;
 			continue;
 		}
-		if (memcmp(pcr[i], resp->pcr_values[i]->value.data, config->halg)) {
+		if (memcmp(pcr, resp->pcr_values[i]->value.data, config->halg)) {
 			ERROR_HEXDUMP(resp->pcr_values[i]->value.data,
 				      resp->pcr_values[i]->value.len, "PCR_%d VERIFICATION FAILED",
 				      resp->pcr_values[i]->number);
@@ -161,9 +289,23 @@ attestation_verify_resp(Tpm2dToRemote *resp, RAttestationConfig *config, uint8_t
 	}
 
 	// Nonce verification
-	int ret_nonce = memcmp(tpms_attest.extraData.t.buffer, nonce, nonce_len);
+	int ret_nonce;
 	DEBUG_HEXDUMP(nonce, nonce_len, "Nonce sent");
 	DEBUG_HEXDUMP(tpms_attest.extraData.t.buffer, tpms_attest.extraData.t.size, "Nonce rcvd");
+	if (resp->has_nonce_batch_index) {
+		if (!config->allow_nonce_batching) {
+			ERROR("Received batched quote, but nonce batching is not allowed");
+			ret = false;
+			goto err;
+		}
+		DEBUG("Verifying nonce of batched quote with leaf index %u",
+		      resp->nonce_batch_index);
+		ret_nonce = !attestation_verify_nonce_batch(resp, nonce, nonce_len,
+							    tpms_attest.extraData.t.buffer,
+							    tpms_attest.extraData.t.size);
+	} else {
+		ret_nonce = memcmp(tpms_attest.extraData.t.buffer, nonce, nonce_len);
+	}
 	if (ret_nonce) {
 		ERROR("Nonce VERIFICATION FAILED");
 		ret = false;
@@ -195,17 +337,37 @@ attestation_verify_resp(Tpm2dToRemote *resp, RAttestationConfig *config, uint8_t
 		INFO("VERIFY QUOTE SIGNATURE SUCCESSFUL");
 	}
 
+	// Incremental attestation: the measurement lists only contain the entries appended
+	// since the checkpoint, which the replay starts from
+	bool incremental = (resp->has_ml_ima_offset && resp->ml_ima_offset) ||
+			   (resp->has_ml_container_offset && resp->ml_container_offset);
+	if (incremental) {
+		if (!attestation_checkpoint_is_valid(checkpoint, resp, &tpms_attest)) {
+			WARN("Stale attestation checkpoint, complete measurement lists required");
+			*retry = true;
+			ret = false;
+			goto err;
+		}
+		if ((resp->ml_ima_offset && resp->ml_ima_offset != checkpoint->ml_ima_offset) ||
+		    (resp->ml_container_offset &&
+		     resp->ml_container_offset != checkpoint->ml_container_offset)) {
+			ERROR("Measurement list offsets do not match the attestation checkpoint");
+			ret = false;
+			goto err;
+		}
+	}
+
 	// Verify aggregated PCR value
 	DEBUG_HEXDUMP(tpms_attest.attested.quote.pcrDigest.t.buffer,
 		      tpms_attest.attested.quote.pcrDigest.t.size, "Quote PCR Digest");
-	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
-	EVP_DigestInit(ctx, EVP_sha256());
+	EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+	EVP_DigestInit(md_ctx, EVP_sha256());
 	uint8_t pcr_calc[SHA256_DIGEST_LENGTH] = { 0 };
 	for (size_t i = 0; i < resp->n_pcr_values; i++) {
-		EVP_DigestUpdate(ctx, resp->pcr_values[i]->value.data, SHA256_DIGEST_LENGTH);
+		EVP_DigestUpdate(md_ctx, resp->pcr_values[i]->value.data, SHA256_DIGEST_LENGTH);
 	}
-	EVP_DigestFinal(ctx, pcr_calc, NULL);
-	EVP_MD_CTX_free(ctx);
+	EVP_DigestFinal(md_ctx, pcr_calc, NULL);
+	EVP_MD_CTX_free(md_ctx);
 	if (memcmp(tpms_attest.attested.quote.pcrDigest.t.buffer, pcr_calc, SHA256_DIGEST_LENGTH)) {
 		ERROR("VERIFY AGGREGATED PCR FAILED");
 		ret = false;
@@ -215,6 +377,8 @@ attestation_verify_resp(Tpm2dToRemote *resp, RAttestationConfig *config, uint8_t
 
 	// PCR10 kernel module verification (from /sys/kernel/security/ima/binary_runtime_measuremts)
 	hash_algo_t hash_algo = size_to_hash_algo((int)resp->halg);
+	Pcr *ima_pcr = NULL;
+	Pcr *container_pcr = NULL;
 
 	if (config->verify_ima) {
 		// Check if response has IMA entries
@@ -239,20 +403,34 @@ attestation_verify_resp(Tpm2dToRemote *resp, RAttestationConfig *config, uint8_t
 			goto err;
 		}
 
+		uint8_t *ima_pcr_init = NULL;
+		if (resp->ml_ima_offset) {
+			if (checkpoint->ima_pcr_value.len !=
+			    resp->pcr_values[ima_index]->value.len) {
+				ERROR("Invalid IMA PCR value in attestation checkpoint");
+				ret = false;
+				goto err;
+			}
+			ima_pcr_init = checkpoint->ima_pcr_value.data;
+			DEBUG("Verifying IMA measurement list from offset %" PRIu64,
+			      resp->ml_ima_offset);
+		}
+
 		int ret_ima = ima_verify_binary_runtime_measurements(
 			resp->ml_ima_entry.data, resp->ml_ima_entry.len, config->kmod_sign_cert,
-			hash_algo, resp->pcr_values[ima_index]->value.data);
+			hash_algo, ima_pcr_init, resp->pcr_values[ima_index]->value.data);
 		if (ret_ima != 0) {
 			ERROR("Failed to verify measurement list");
 			ret = false;
 			goto err;
 		}
+		ima_pcr = resp->pcr_values[ima_index];
 	}
 
 	// PCR11 container verification
 	if (config->verify_containers) {
-		// Check if response has container entries
-		if (resp->n_ml_container_entry == 0) {
+		// Check if response has container entries, unless resuming from a checkpoint
+		if (resp->n_ml_container_entry == 0 && !resp->ml_container_offset) {
 			ERROR("Response does not contain container entries");
 			ret = false;
 			goto err;
@@ -272,16 +450,34 @@ attestation_verify_resp(Tpm2dToRemote *resp, RAttestationConfig *config, uint8_t
 			ret = false;
 			goto err;
 		}
+		uint8_t *container_pcr_init = NULL;
+		if (resp->ml_container_offset) {
+			if (checkpoint->container_pcr_value.len !=
+			    resp->pcr_values[container_index]->value.len) {
+				ERROR("Invalid container PCR value in attestation checkpoint");
+				ret = false;
+				goto err;
+			}
+			container_pcr_init = checkpoint->container_pcr_value.data;
+			DEBUG("Verifying container measurement list from entry %u",
+			      resp->ml_container_offset);
+		}
+
 		int ret_container = container_verify_runtime_measurements(
 			resp->ml_container_entry, resp->n_ml_container_entry, hash_algo,
-			resp->pcr_values[container_index]->value.data);
+			container_pcr_init, resp->pcr_values[container_index]->value.data);
 		if (ret_container != 0) {
 			ERROR("Failed to verify container measurement list");
 			ret = false;
 			goto err;
 		}
+		container_pcr = resp->pcr_values[container_index];
 	}
 
+	if (config->checkpoint_dir && (ima_pcr || container_pcr))
+		attestation_checkpoint_store(config->checkpoint_dir, host, resp, &tpms_attest,
+					     ima_pcr, container_pcr);
+
 	ret = true;
 
 err:
@@ -296,106 +492,294 @@ err:
 }
 
 static void
-attestation_response_recv_cb(int fd, unsigned events, event_io_t *io, void *data)
+attestation_record_resp(const char *file, const Tpm2dToRemote *resp)
 {
-	bool verified = false;
-	struct attestation_resp_cb_data *resp_cb_data = data;
-
-	if (events & EVENT_IO_EXCEPT) {
-		WARN("Exception on connected socket to control client; closing socket");
-		goto cleanup;
-	}
-
-	IF_FALSE_RETURN(events & EVENT_IO_READ);
-
-	Tpm2dToRemote *resp =
-		(Tpm2dToRemote *)protobuf_recv_message(fd, &tpm2d_to_remote__descriptor);
-	IF_NULL_GOTO_ERROR(resp, cleanup);
-
-	verified = attestation_verify_resp(resp, resp_cb_data->config, resp_cb_data->nonce,
-					   resp_cb_data->nonce_len);
+	uint8_t *buf = NULL;
+	uint32_t len = protobuf_pack_message_new((ProtobufCMessage *)resp, &buf);
 
-	protobuf_free_message((ProtobufCMessage *)resp);
-	INFO("Handled response on connection %d", fd);
+	if (file_write(file, (char *)buf, len) < 0)
+		WARN("Failed to record response in %s", file);
+	else
+		INFO("Recorded response in %s", file);
 
-cleanup:
-	event_remove_io(io);
-	event_io_free(io);
-	if (close(fd) < 0)
-		WARN_ERRNO("Failed to close connected tpm2d socket");
-	// call registerd handler with verification result
-	if (resp_cb_data->resp_verified_cb)
-		(resp_cb_data->resp_verified_cb)(verified);
-	if (resp_cb_data->nonce)
-		mem_free0(resp_cb_data->nonce);
-	protobuf_free_message((ProtobufCMessage *)resp_cb_data->config);
-	mem_free0(resp_cb_data);
+	mem_free0(buf);
 }
 
-int
-attestation_do_request(const char *host, char *config_file, void (*resp_verified_cb)(bool))
+attestation_ctx_t *
+attestation_ctx_new(const char *config_file)
 {
-	// Set nonce
-	size_t nonce_len = 8;
-	uint8_t nonce[nonce_len];
-	if (getrandom(nonce, nonce_len, (unsigned int)0) != (ssize_t)nonce_len) {
-		ERROR("Failed to create attestation request: Failed to retrieve random nonce from /dev/urandom");
-		return -1;
-	}
-
 	// Read the configuration which contains information about the remote attestation request
 	// as well as the expected values for the PCRs
 	RAttestationConfig *config = rattestation_read_config_new(config_file);
 	if (!config) {
 		ERROR("Failed to read config file %s. The file has to be provided as a command line argument",
 		      config_file);
-		return -1;
+		return NULL;
+	}
+
+	if (config->atype == IDS_ATTESTATION_TYPE__ADVANCED && !config->has_pcrs) {
+		ERROR("Missing PCR bitmap configuration for attestation type advanced");
+		protobuf_free_message((ProtobufCMessage *)config);
+		return NULL;
+	}
+
+	attestation_ctx_t *ctx = mem_new0(attestation_ctx_t, 1);
+	ctx->config = config;
+
+	// convert the expected PCR values once for all attestations
+	ctx->pcrs = mem_new0(uint8_t, config->n_pcr_values * config->halg);
+	for (size_t i = 0; i < config->n_pcr_values; i++) {
+		if (convert_hex_to_bin(config->pcr_values[i]->value,
+				       strlen(config->pcr_values[i]->value),
+				       ctx->pcrs + i * config->halg, config->halg)) {
+			ERROR("Failed to convert configured PCR value %s: Invalid hex string",
+			      config->pcr_values[i]->value);
+			attestation_ctx_free(ctx);
+			return NULL;
+		}
 	}
 
+	return ctx;
+}
+
+void
+attestation_ctx_free(attestation_ctx_t *ctx)
+{
+	IF_NULL_RETURN(ctx);
+
+	protobuf_free_message((ProtobufCMessage *)ctx->config);
+	mem_free0(ctx->pcrs);
+	mem_free0(ctx);
+}
+
+/**
+ * Releases the connection of req, repeats the attestation if retry is set and
+ * otherwise reports the result. req is freed afterwards.
+ */
+static void
+attestation_req_finish(attestation_req_t *req, bool verified, bool retry)
+{
+	if (req->connect_io) {
+		event_remove_io(req->connect_io);
+		event_io_free(req->connect_io);
+	}
+	if (req->conn)
+		protobuf_conn_free(req->conn);
+	if (close(req->sock) < 0)
+		WARN_ERRNO("Failed to close connected tpm2d socket");
+	if (req->timer) {
+		event_remove_timer(req->timer);
+		event_timer_free(req->timer);
+	}
+	if (req->checkpoint)
+		protobuf_free_message((ProtobufCMessage *)req->checkpoint);
+
+	// drop a stale checkpoint and repeat the attestation with the complete measurement lists
+	if (retry) {
+		rattestation_remove_checkpoint(req->ctx->config->checkpoint_dir, req->host);
+		if (attestation_start(req->ctx, req->host, req->timeout_ms, req->cb, req->data) <
+		    0) {
+			ERROR("Failed to repeat attestation request to %s", req->host);
+			retry = false;
+		}
+	}
+	// call registered handler with verification result
+	if (!retry && req->cb)
+		req->cb(req->host, verified, req->data);
+
+	mem_free0(req->host);
+	mem_free0(req);
+}
+
+static void
+attestation_response_cb(UNUSED protobuf_conn_t *conn, ProtobufCMessage *msg, void *data)
+{
+	attestation_req_t *req = data;
+	Tpm2dToRemote *resp = (Tpm2dToRemote *)msg;
+	bool retry = false;
+
+	if (req->ctx->config->record_file)
+		attestation_record_resp(req->ctx->config->record_file, resp);
+
+	bool verified = attestation_verify_resp(resp, req->ctx, req->host, req->nonce,
+						sizeof(req->nonce), req->checkpoint, &retry);
+
+	INFO("Handled response of %s on connection %d", req->host, req->sock);
+	attestation_req_finish(req, verified, retry);
+}
+
+static void
+attestation_close_cb(UNUSED protobuf_conn_t *conn, void *data)
+{
+	attestation_req_t *req = data;
+
+	WARN("Connection to %s closed without a valid response", req->host);
+	attestation_req_finish(req, false, false);
+}
+
+static void
+attestation_timeout_cb(event_timer_t *timer, void *data)
+{
+	attestation_req_t *req = data;
+	ASSERT(req->timer == timer);
+
+	// the one-shot timer was already removed from the event loop
+	event_timer_free(timer);
+	req->timer = NULL;
+
+	WARN("Attestation of %s timed out after %u ms", req->host, req->timeout_ms);
+	attestation_req_finish(req, false, false);
+}
+
+static int
+attestation_send_request(attestation_req_t *req)
+{
+	RAttestationConfig *config = req->ctx->config;
+
 	// build RemoteToTpm2d message
 	RemoteToTpm2d msg = REMOTE_TO_TPM2D__INIT;
 
 	msg.code = REMOTE_TO_TPM2D__CODE__ATTESTATION_REQ;
 	msg.has_qualifyingdata = true;
-	msg.qualifyingdata.data = nonce;
-	msg.qualifyingdata.len = nonce_len;
+	msg.qualifyingdata.data = req->nonce;
+	msg.qualifyingdata.len = sizeof(req->nonce);
 	msg.has_atype = true;
 	msg.atype = config->atype;
 	if (config->atype == IDS_ATTESTATION_TYPE__ADVANCED) {
-		if (!config->has_pcrs) {
-			ERROR("Missing PCR bitmap configuration for attestation type advanced");
-			return -1;
-		}
 		msg.has_pcrs = true;
 		msg.pcrs = config->pcrs;
 	}
 	msg.attest_ima = config->verify_ima;
 	msg.attest_containers = config->verify_containers;
+	msg.has_allow_nonce_batching = true;
+	msg.allow_nonce_batching = config->allow_nonce_batching;
+
+	// only request the measurement list entries appended since the last attestation
+	RAttestationCheckpoint *checkpoint = req->checkpoint;
+	if (checkpoint) {
+		DEBUG("Requesting measurement lists from checkpoint (IMA offset %" PRIu64
+		      ", container offset %u)",
+		      checkpoint->ml_ima_offset, checkpoint->ml_container_offset);
+		msg.has_ml_ima_offset = checkpoint->has_ml_ima_offset;
+		msg.ml_ima_offset = checkpoint->ml_ima_offset;
+		msg.has_ml_container_offset = checkpoint->has_ml_container_offset;
+		msg.ml_container_offset = checkpoint->ml_container_offset;
+	}
+
+	DEBUG("Sending attestation request to TPM2D on %s:%s", req->host, TPM2D_SERVICE_PORT);
+
+	req->conn = protobuf_conn_new(req->sock, &tpm2d_to_remote__descriptor,
+				      attestation_response_cb, attestation_close_cb, req);
+	IF_NULL_RETVAL(req->conn, -1);
+
+	IF_TRUE_RETVAL(protobuf_conn_send_message(req->conn, (ProtobufCMessage *)&msg) < 0, -1);
 
-	int sock = sock_inet_create_and_connect(SOCK_STREAM, host, TPM2D_SERVICE_PORT);
-	IF_TRUE_RETVAL(sock < 0, -1);
+	DEBUG_HEXDUMP(req->nonce, sizeof(req->nonce), "Request with Nonce");
+	return 0;
+}
+
+static void
+attestation_connect_cb(int fd, unsigned events, event_io_t *io, void *data)
+{
+	attestation_req_t *req = data;
+	int error = 0;
+	socklen_t len = sizeof(error);
+
+	ASSERT(req->connect_io == io);
+
+	event_remove_io(io);
+	event_io_free(io);
+	req->connect_io = NULL;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+		error = errno;
+	if (error || (events & EVENT_IO_EXCEPT)) {
+		errno = error ? error : EIO;
+		WARN_ERRNO("Failed to connect to %s", req->host);
+		attestation_req_finish(req, false, false);
+		return;
+	}
+
+	if (attestation_send_request(req) < 0) {
+		ERROR("Failed to send attestation request to %s", req->host);
+		attestation_req_finish(req, false, false);
+	}
+}
+
+int
+attestation_start(attestation_ctx_t *ctx, const char *host, unsigned int timeout_ms,
+		  attestation_result_cb_t cb, void *data)
+{
+	ASSERT(ctx);
+	ASSERT(host);
+
+	attestation_req_t *req = mem_new0(attestation_req_t, 1);
+
+	// Set nonce
+	if (getrandom(req->nonce, sizeof(req->nonce), (unsigned int)0) !=
+	    (ssize_t)sizeof(req->nonce)) {
+		ERROR("Failed to create attestation request: Failed to retrieve random nonce from /dev/urandom");
+		mem_free0(req);
+		return -1;
+	}
+
+	req->sock = sock_inet_create_and_connect(SOCK_STREAM | SOCK_NONBLOCK, host,
+						 TPM2D_SERVICE_PORT);
+	if (req->sock < 0) {
+		mem_free0(req);
+		return -1;
+	}
+
+	req->ctx = ctx;
+	req->host = mem_strdup(host);
+	req->timeout_ms = timeout_ms;
+	req->cb = cb;
+	req->data = data;
 
-	DEBUG("Sending attestation request to TPM2D on %s:%s", host, TPM2D_SERVICE_PORT);
+	if (ctx->config->checkpoint_dir)
+		req->checkpoint =
+			rattestation_read_checkpoint_new(ctx->config->checkpoint_dir, host);
 
-	ssize_t msg_size = protobuf_send_message(sock, (ProtobufCMessage *)&msg);
-	IF_TRUE_RETVAL(msg_size < 0, -1);
+	DEBUG("Register connect handler on sockfd=%d", req->sock);
+	req->connect_io = event_io_new(req->sock, EVENT_IO_WRITE, attestation_connect_cb, req);
+	event_add_io(req->connect_io);
 
-	INFO("Send message with size %zd", msg_size);
-	DEBUG_HEXDUMP(nonce, nonce_len, "Request with Nonce");
+	if (timeout_ms) {
+		req->timer = event_timer_new(timeout_ms, 1, attestation_timeout_cb, req);
+		event_add_timer(req->timer);
+	}
 
-	struct attestation_resp_cb_data *resp_cb_data =
-		mem_new0(struct attestation_resp_cb_data, 1);
-	resp_cb_data->resp_verified_cb = resp_verified_cb;
-	resp_cb_data->nonce = mem_new0(uint8_t, nonce_len);
-	memcpy(resp_cb_data->nonce, nonce, nonce_len);
-	resp_cb_data->nonce_len = nonce_len;
-	resp_cb_data->config = config;
+	return 0;
+}
+
+static void
+attestation_single_cb(UNUSED const char *host, bool verified, void *data)
+{
+	attestation_single_t *single = data;
+	void (*resp_verified_cb)(bool) = single->resp_verified_cb;
 
-	DEBUG("Register Response handler on sockfd=%d", sock);
-	fd_make_non_blocking(sock);
-	event_io_t *event =
-		event_io_new(sock, EVENT_IO_READ, attestation_response_recv_cb, resp_cb_data);
-	event_add_io(event);
+	attestation_ctx_free(single->ctx);
+	mem_free0(single);
+
+	if (resp_verified_cb)
+		resp_verified_cb(verified);
+}
+
+int
+attestation_do_request(const char *host, char *config_file, void (*resp_verified_cb)(bool))
+{
+	attestation_ctx_t *ctx = attestation_ctx_new(config_file);
+	IF_NULL_RETVAL(ctx, -1);
+
+	attestation_single_t *single = mem_new0(attestation_single_t, 1);
+	single->ctx = ctx;
+	single->resp_verified_cb = resp_verified_cb;
+
+	if (attestation_start(ctx, host, 0, attestation_single_cb, single) < 0) {
+		attestation_ctx_free(ctx);
+		mem_free0(single);
+		return -1;
+	}
 
 	return 0;
 }
@@ -1,5 +1,48 @@
 #ifndef IP_AGENT_ATTESTATION_H
 #define IP_AGENT_ATTESTATION_H
+
+#include <stdbool.h>
+
+/*
+ * State shared by all attestations with the same configuration, i.e., the parsed
+ * configuration including the trusted certificates and the expected PCR values.
+ */
+typedef struct attestation_ctx attestation_ctx_t;
+
+/*
+ * Called with the verification result of an attestation of host.
+ */
+typedef void (*attestation_result_cb_t)(const char *host, bool verified, void *data);
+
+/*
+ * Reads the configuration in config_file and prepares it for attestations.
+ *
+ * @return the new context or NULL on error
+ */
+attestation_ctx_t *
+attestation_ctx_new(const char *config_file);
+
+/*
+ * Frees a context. It must no longer be used by pending attestations.
+ */
+void
+attestation_ctx_free(attestation_ctx_t *ctx);
+
+/*
+ * Starts an attestation of host without blocking the event loop
+ *
+ * The connection is established in the background and the response is collected
+ * incrementally, so many hosts can be attested concurrently. Once the response has
+ * been validated, or the attestation failed or did not finish within timeout_ms
+ * (0 waits forever), cb is called with the result. cb is not called if -1 is returned.
+ * Only resolving host may block.
+ *
+ * @return 0 if the attestation was started, -1 on error
+ */
+int
+attestation_start(attestation_ctx_t *ctx, const char *host, unsigned int timeout_ms,
+		  attestation_result_cb_t cb, void *data);
+
 /*
  * Do the attestation request
  *
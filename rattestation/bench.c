@@ -0,0 +1,235 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+/*
+ * rattestation-bench replays recorded Tpm2dToRemote responses (see
+ * RAttestationConfig.record_file) through the measurement list verification and
+ * reports the throughput of its individual steps, split by the PCR bank hash algorithm.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/file.h"
+#include "common/logf.h"
+#include "common/protobuf.h"
+
+#include "attestation.pb-c.h"
+#include "config.pb-c.h"
+#include "config.h"
+#include "hash.h"
+#include "ima_verify.h"
+#include "container_verify.h"
+
+typedef struct {
+	ima_verify_stats_t ima;
+	uint64_t ima_ns; // wall-clock time of the complete IMA verification
+	uint64_t n_container_entries;
+	uint64_t container_ns;
+	uint64_t n_responses;
+} bench_result_t;
+
+static uint64_t
+bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint8_t *
+bench_get_pcr(Tpm2dToRemote *resp, int32_t number)
+{
+	for (size_t i = 0; i < resp->n_pcr_values; i++) {
+		if (resp->pcr_values[i]->number == number)
+			return resp->pcr_values[i]->value.data;
+	}
+	return NULL;
+}
+
+static Tpm2dToRemote *
+bench_read_response_new(const char *file)
+{
+	off_t len = file_size(file);
+	IF_TRUE_RETVAL_ERROR(len <= 0, NULL);
+
+	uint8_t *buf = mem_alloc(len);
+	if (file_read(file, (char *)buf, len) < 0) {
+		ERROR("Failed to read response %s", file);
+		mem_free0(buf);
+		return NULL;
+	}
+
+	Tpm2dToRemote *resp =
+		(Tpm2dToRemote *)protobuf_unpack_message(&tpm2d_to_remote__descriptor, buf, len);
+	mem_free0(buf);
+
+	if (resp && (resp->ml_ima_offset || resp->ml_container_offset)) {
+		ERROR("Response %s only contains part of the measurement lists", file);
+		protobuf_free_message((ProtobufCMessage *)resp);
+		return NULL;
+	}
+
+	return resp;
+}
+
+static int
+bench_run(Tpm2dToRemote *resp, RAttestationConfig *config, bench_result_t *result)
+{
+	hash_algo_t hash_algo = size_to_hash_algo((int)resp->halg);
+	uint64_t t;
+
+	if (config->verify_ima && resp->has_ml_ima_entry && hash_algo != HASH_ALGO_SHA256) {
+		WARN("IMA verification only supports SHA-256 PCR banks, skipping");
+	} else if (config->verify_ima && resp->has_ml_ima_entry) {
+		uint8_t *pcr = bench_get_pcr(resp, config->ima_pcr);
+		IF_NULL_RETVAL_ERROR(pcr, -1);
+
+		ima_verify_stats_enable(&result->ima);
+		t = bench_now_ns();
+		int ret = ima_verify_binary_runtime_measurements(
+			resp->ml_ima_entry.data, resp->ml_ima_entry.len, config->kmod_sign_cert,
+			hash_algo, NULL, pcr);
+		result->ima_ns += bench_now_ns() - t;
+		ima_verify_stats_enable(NULL);
+		IF_TRUE_RETVAL_ERROR(ret < 0, -1);
+	}
+
+	if (config->verify_containers && resp->n_ml_container_entry) {
+		uint8_t *pcr = bench_get_pcr(resp, config->container_pcr);
+		IF_NULL_RETVAL_ERROR(pcr, -1);
+
+		t = bench_now_ns();
+		int ret = container_verify_runtime_measurements(resp->ml_container_entry,
+								resp->n_ml_container_entry,
+								hash_algo, NULL, pcr);
+		result->container_ns += bench_now_ns() - t;
+		IF_TRUE_RETVAL_ERROR(ret < 0, -1);
+		result->n_container_entries += resp->n_ml_container_entry;
+	}
+
+	result->n_responses++;
+	return 0;
+}
+
+static void
+bench_print_rate(const char *algo, const char *step, uint64_t n, uint64_t ns)
+{
+	printf("%-8s %-32s %12" PRIu64 " %14.0f\n", algo, step, n, ns ? n * 1e9 / ns : 0.0);
+}
+
+static void
+bench_print_result(hash_algo_t hash_algo, const bench_result_t *r)
+{
+	const char *algo = hash_algo_to_string(hash_algo);
+
+	// template hashing and signature verification are summed over all verification
+	// threads, i.e., they are given per CPU second
+	bench_print_rate(algo, "IMA template hashing (SHA-1)", r->ima.n_entries,
+			 r->ima.template_sha1_ns);
+	bench_print_rate(algo, "IMA template hashing (SHA-256)", r->ima.n_entries,
+			 r->ima.template_sha256_ns);
+	bench_print_rate(algo, "IMA signature verification", r->ima.n_signatures,
+			 r->ima.signature_ns);
+	bench_print_rate(algo, "IMA PCR replay", r->ima.n_entries, r->ima.pcr_replay_ns);
+	bench_print_rate(algo, "IMA total (wall-clock)", r->ima.n_entries, r->ima_ns);
+	bench_print_rate(algo, "container PCR replay", r->n_container_entries, r->container_ns);
+}
+
+static void
+bench_print_usage(const char *cmd)
+{
+	printf("Usage: %s [-n iterations] <config_file> <response_file>...\n", cmd);
+	printf("\nReplays responses recorded by rattestation (see record_file in the config)\n"
+	       "through the measurement list verification configured in config_file.\n");
+	exit(-1);
+}
+
+int
+main(int argc, char **argv)
+{
+	// keep the per-entry logging of the verification out of the measurements
+	logf_handler_t *h = logf_register(&logf_file_write, stderr);
+	logf_handler_set_prio(h, LOGF_PRIO_WARN);
+
+	long iterations = 1;
+	int c;
+	while ((c = getopt(argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = strtol(optarg, NULL, 10);
+			break;
+		default:
+			bench_print_usage(argv[0]);
+		}
+	}
+
+	if (iterations < 1 || argc - optind < 2)
+		bench_print_usage(argv[0]);
+
+	RAttestationConfig *config = rattestation_read_config_new(argv[optind]);
+	if (!config)
+		FATAL("Failed to read config file %s", argv[optind]);
+
+	size_t n_resps = argc - optind - 1;
+	Tpm2dToRemote **resps = mem_new0(Tpm2dToRemote *, n_resps);
+	for (size_t i = 0; i < n_resps; i++) {
+		resps[i] = bench_read_response_new(argv[optind + 1 + i]);
+		if (!resps[i])
+			FATAL("Failed to load response %s", argv[optind + 1 + i]);
+	}
+
+	bench_result_t result[HASH_ALGO__LAST] = { 0 };
+	for (long it = 0; it < iterations; it++) {
+		for (size_t i = 0; i < n_resps; i++) {
+			hash_algo_t hash_algo = size_to_hash_algo((int)resps[i]->halg);
+			IF_FALSE_GOTO_ERROR(hash_algo < HASH_ALGO__LAST, err);
+			if (bench_run(resps[i], config, &result[hash_algo]) < 0) {
+				ERROR("Verification of response %s failed", argv[optind + 1 + i]);
+				goto err;
+			}
+		}
+	}
+
+	printf("%-8s %-32s %12s %14s\n", "PCR bank", "step", "entries", "entries/s");
+	for (int i = 0; i < HASH_ALGO__LAST; i++) {
+		if (result[i].n_responses)
+			bench_print_result(i, &result[i]);
+	}
+
+	for (size_t i = 0; i < n_resps; i++)
+		protobuf_free_message((ProtobufCMessage *)resps[i]);
+	mem_free0(resps);
+	protobuf_free_message((ProtobufCMessage *)config);
+	return 0;
+
+err:
+	return -1;
+}
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <stddef.h>
+#include <unistd.h>
 
 #include "config.pb-c.h"
 #include "common/macro.h"
@@ -74,3 +75,59 @@ err:
 	mem_free0(buf);
 	return config;
 }
+
+static char *
+rattestation_checkpoint_file_new(const char *dir, const char *host)
+{
+	return mem_printf("%s/%s.checkpoint", dir, host);
+}
+
+RAttestationCheckpoint *
+rattestation_read_checkpoint_new(const char *dir, const char *host)
+{
+	ASSERT(dir);
+	ASSERT(host);
+
+	RAttestationCheckpoint *checkpoint = NULL;
+	char *file = rattestation_checkpoint_file_new(dir, host);
+
+	if (file_exists(file)) {
+		checkpoint = (RAttestationCheckpoint *)protobuf_message_new_from_textfile(
+			file, &rattestation_checkpoint__descriptor);
+		if (!checkpoint)
+			WARN("Failed to load attestation checkpoint %s", file);
+	}
+
+	mem_free0(file);
+	return checkpoint;
+}
+
+int
+rattestation_write_checkpoint(const char *dir, const char *host,
+			      const RAttestationCheckpoint *checkpoint)
+{
+	ASSERT(dir);
+	ASSERT(host);
+	ASSERT(checkpoint);
+
+	char *file = rattestation_checkpoint_file_new(dir, host);
+	int ret = protobuf_message_write_to_file(file, (ProtobufCMessage *)checkpoint);
+	if (ret < 0)
+		WARN("Failed to store attestation checkpoint %s", file);
+
+	mem_free0(file);
+	return ret < 0 ? -1 : 0;
+}
+
+void
+rattestation_remove_checkpoint(const char *dir, const char *host)
+{
+	ASSERT(dir);
+	ASSERT(host);
+
+	char *file = rattestation_checkpoint_file_new(dir, host);
+	if (file_exists(file) && unlink(file) < 0)
+		WARN_ERRNO("Failed to remove attestation checkpoint %s", file);
+
+	mem_free0(file);
+}
@@ -27,4 +27,27 @@
 RAttestationConfig *
 rattestation_read_config_new(const char *file);
 
+/**
+ * Reads the checkpoint of the last successful attestation of host from dir.
+ *
+ * @return the checkpoint or NULL if there is none for host
+ */
+RAttestationCheckpoint *
+rattestation_read_checkpoint_new(const char *dir, const char *host);
+
+/**
+ * Stores the checkpoint of a successful attestation of host in dir.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int
+rattestation_write_checkpoint(const char *dir, const char *host,
+			      const RAttestationCheckpoint *checkpoint);
+
+/**
+ * Removes the checkpoint of host from dir, e.g., after the attested system rebooted.
+ */
+void
+rattestation_remove_checkpoint(const char *dir, const char *host);
+
 #endif /* RATTESTATION_CONFIG_H_ */
\ No newline at end of file
@@ -38,15 +38,19 @@
 
 int
 container_verify_runtime_measurements(MlContainerEntry **entries, size_t len,
-				      hash_algo_t pcr_hash_algo, uint8_t *pcr_tpm)
+				      hash_algo_t pcr_hash_algo, const uint8_t *pcr_init,
+				      uint8_t *pcr_tpm)
 {
 	int hash_size = hash_algo_to_size(pcr_hash_algo);
 	IF_FALSE_RETVAL_ERROR(hash_size > 0, -1);
 
 	uint8_t pcr_calculated[hash_size];
 
-	// Static PCRs are initialized with zero's
-	mem_memset(pcr_calculated, 0, hash_size);
+	// Static PCRs are initialized with zero's, unless continuing from a verified checkpoint
+	if (pcr_init)
+		memcpy(pcr_calculated, pcr_init, hash_size);
+	else
+		mem_memset(pcr_calculated, 0, hash_size);
 
 	for (size_t i = 0; i < len; i++) {
 		if (strcmp(entries[i]->template_hash_alg, hash_algo_to_string(pcr_hash_algo))) {
@@ -24,8 +24,13 @@
 #ifndef CONTAINER_VERIFY_H_
 #define CONTAINER_VERIFY_H_
 
+/**
+ * Replays the container measurement list entries against pcr_tpm, starting from
+ * pcr_init, or from the zero-initialized PCR if pcr_init is NULL.
+ */
 int
 container_verify_runtime_measurements(MlContainerEntry **entries, size_t len,
-				      hash_algo_t pcr_hash_algo, uint8_t *pcr_tpm);
+				      hash_algo_t pcr_hash_algo, const uint8_t *pcr_init,
+				      uint8_t *pcr_tpm);
 
 #endif // CONTAINER_VERIFY_H_
\ No newline at end of file
@@ -0,0 +1,177 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/file.h"
+
+#include "fleet.h"
+
+// upper bound for the size of the device list
+#define FLEET_LIST_MAXLEN (64 * 1024 * 1024)
+
+typedef struct fleet {
+	attestation_ctx_t *ctx;
+	unsigned int concurrency;
+	unsigned int timeout_ms;
+	FILE *out;
+	void (*done_cb)(size_t n_failed, void *data);
+	void *data;
+
+	char *list; // content of the device list, hosts point into it
+	char **hosts;
+	size_t n_hosts;
+	size_t next;	 // index of the next host to be attested
+	size_t n_active; // number of running attestations
+	size_t n_failed;
+} fleet_t;
+
+static void
+fleet_report(fleet_t *fleet, const char *host, bool verified)
+{
+	if (!verified)
+		fleet->n_failed++;
+
+	fprintf(fleet->out, "%s %s\n", host, verified ? "OK" : "FAILED");
+	fflush(fleet->out);
+}
+
+static void
+fleet_free(fleet_t *fleet)
+{
+	mem_free0(fleet->hosts);
+	mem_free0(fleet->list);
+	mem_free0(fleet);
+}
+
+static void
+fleet_result_cb(const char *host, bool verified, void *data);
+
+/**
+ * Starts attestations until the concurrency limit is reached and calls the done
+ * callback once no host is left. Hosts which cannot be contacted at all are reported
+ * right away, without recursing through the result callback.
+ */
+static void
+fleet_fill(fleet_t *fleet)
+{
+	while (fleet->n_active < fleet->concurrency && fleet->next < fleet->n_hosts) {
+		char *host = fleet->hosts[fleet->next++];
+
+		if (attestation_start(fleet->ctx, host, fleet->timeout_ms, fleet_result_cb,
+				      fleet) < 0) {
+			WARN("Failed to start attestation of %s", host);
+			fleet_report(fleet, host, false);
+			continue;
+		}
+		fleet->n_active++;
+	}
+
+	if (fleet->n_active == 0 && fleet->next == fleet->n_hosts) {
+		void (*done_cb)(size_t n_failed, void *data) = fleet->done_cb;
+		size_t n_failed = fleet->n_failed;
+		void *data = fleet->data;
+
+		INFO("Attested %zu hosts, %zu failed", fleet->n_hosts, n_failed);
+		fleet_free(fleet);
+		if (done_cb)
+			done_cb(n_failed, data);
+	}
+}
+
+static void
+fleet_result_cb(const char *host, bool verified, void *data)
+{
+	fleet_t *fleet = data;
+
+	ASSERT(fleet->n_active > 0);
+	fleet->n_active--;
+
+	fleet_report(fleet, host, verified);
+	fleet_fill(fleet);
+}
+
+/**
+ * Splits the device list into the hosts, which are trimmed in place.
+ */
+static void
+fleet_parse_list(fleet_t *fleet)
+{
+	size_t max_hosts = 1;
+	for (char *p = fleet->list; *p; p++) {
+		if (*p == '\n')
+			max_hosts++;
+	}
+	fleet->hosts = mem_new0(char *, max_hosts);
+
+	char *saveptr = NULL;
+	for (char *line = strtok_r(fleet->list, "\n", &saveptr); line;
+	     line = strtok_r(NULL, "\n", &saveptr)) {
+		while (isspace((unsigned char)*line))
+			line++;
+		char *end = line + strlen(line);
+		while (end > line && isspace((unsigned char)end[-1]))
+			*--end = '\0';
+
+		if (*line == '\0' || *line == '#')
+			continue;
+		fleet->hosts[fleet->n_hosts++] = line;
+	}
+}
+
+int
+fleet_attest(attestation_ctx_t *ctx, const char *list_file, unsigned int concurrency,
+	     unsigned int timeout_ms, FILE *out, void (*done_cb)(size_t n_failed, void *data),
+	     void *data)
+{
+	ASSERT(ctx);
+	ASSERT(list_file);
+	ASSERT(out);
+	IF_TRUE_RETVAL(concurrency == 0, -1);
+
+	char *list = file_read_new(list_file, FLEET_LIST_MAXLEN);
+	if (!list) {
+		ERROR("Failed to read device list %s", list_file);
+		return -1;
+	}
+
+	fleet_t *fleet = mem_new0(fleet_t, 1);
+	fleet->ctx = ctx;
+	fleet->concurrency = concurrency;
+	fleet->timeout_ms = timeout_ms;
+	fleet->out = out;
+	fleet->done_cb = done_cb;
+	fleet->data = data;
+	fleet->list = list;
+
+	fleet_parse_list(fleet);
+	INFO("Attesting %zu hosts from %s, %u at a time", fleet->n_hosts, list_file,
+	     concurrency);
+
+	fleet_fill(fleet);
+	return 0;
+}
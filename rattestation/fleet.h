@@ -0,0 +1,48 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+#ifndef RATTESTATION_FLEET_H_
+#define RATTESTATION_FLEET_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "attestation.h"
+
+/**
+ * Attests all hosts listed in list_file, one per line, with the shared context ctx.
+ * Empty lines and lines starting with '#' are ignored. At most concurrency hosts are
+ * attested at the same time, each one has to finish within timeout_ms (0 waits forever).
+ *
+ * The result of each host is written to out as soon as it is known, as a line
+ * "<host> OK" or "<host> FAILED", in the order the attestations finish. Once all
+ * hosts are done, done_cb is called with the number of failed attestations.
+ *
+ * @return 0 if the attestations were started, -1 on error
+ */
+int
+fleet_attest(attestation_ctx_t *ctx, const char *list_file, unsigned int concurrency,
+	     unsigned int timeout_ms, FILE *out, void (*done_cb)(size_t n_failed, void *data),
+	     void *data);
+
+#endif /* RATTESTATION_FLEET_H_ */
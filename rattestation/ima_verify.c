@@ -35,6 +35,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <openssl/pkcs7.h>
 #include <openssl/ssl.h>
@@ -91,8 +93,29 @@ struct event {
 	ima_template_desc_t *ima_template_desc;
 	uint32_t template_data_len;
 	uint8_t *template_data;
+	uint8_t template_hash[SHA256_DIGEST_LENGTH]; // extended into the simulated PCR
 };
 
+/*
+ * Entries are parsed in chunks. The template hashes and signatures of a chunk are
+ * verified in parallel, the PCR is then replayed sequentially over the precomputed
+ * template hashes.
+ */
+#define IMA_VERIFY_CHUNK 1024
+#define IMA_VERIFY_THREADS_MAX 8
+
+typedef struct {
+	struct event *events;
+	size_t n;
+	const char *cert;
+	pthread_mutex_t lock; // protects next, failed and stats
+	size_t next;
+	bool failed;
+	ima_verify_stats_t *stats;
+} ima_verify_job_t;
+
+static ima_verify_stats_t *ima_verify_stats = NULL;
+
 // Known IMA template descriptors
 static ima_template_desc_t ima_template_desc[] = { { .name = "ima", .fmt = "d|n" },
 						   { .name = "ima-ng", .fmt = "d-ng|n-ng" },
@@ -125,15 +148,22 @@ buf_read(void *dest, uint8_t **ptr, size_t size, size_t *remain)
 	return 0;
 }
 
+/**
+ * Verifies the signatures of a measurement entry.
+ *
+ * @return the number of verified signatures or -1 on failure
+ */
 static int
 verify_template_data(struct event *template, const char *cert)
 {
 	int offset = 0;
 	size_t i;
 	int is_ima_template;
+	const char *fmt;
 	char *template_fmt, *template_fmt_ptr, *f;
 	uint32_t digest_len = 0;
 	uint8_t *digest = NULL;
+	int n_sigs = 0;
 	int ret = 0;
 
 	is_ima_template = strcmp(template->name, "ima") == 0 ? 1 : 0;
@@ -147,12 +177,16 @@ verify_template_data(struct event *template, const char *cert)
 	}
 
 	if (template->ima_template_desc == NULL) {
+		// unknown templates are named by their format, do not modify the shared
+		// descriptor as entries are verified concurrently
 		i = ARRAY_SIZE(ima_template_desc) - 1;
 		template->ima_template_desc = ima_template_desc + i;
-		template->ima_template_desc->fmt = template->name;
+		fmt = template->name;
+	} else {
+		fmt = template->ima_template_desc->fmt;
 	}
 
-	template_fmt = strdup(template->ima_template_desc->fmt);
+	template_fmt = strdup(fmt);
 	IF_NULL_RETVAL_ERROR(template_fmt, -1);
 
 	template_fmt_ptr = template_fmt;
@@ -210,6 +244,7 @@ verify_template_data(struct event *template, const char *cert)
 					goto out;
 				} else {
 					INFO("Signature verification SUCCESSFUL for %s", f);
+					n_sigs++;
 				}
 
 			} else if (strncmp(f, "n-ng", 4) == 0) {
@@ -253,6 +288,7 @@ verify_template_data(struct event *template, const char *cert)
 					goto out;
 				} else {
 					INFO("Signature verification SUCCESSFUL for %s", f);
+					n_sigs++;
 				}
 
 				modsig_free(sig_info);
@@ -265,13 +301,21 @@ verify_template_data(struct event *template, const char *cert)
 		offset += field_len;
 	}
 
-	ret = 0;
+	ret = n_sigs;
 
 out:
 	mem_free0(template_fmt);
 	return ret;
 }
 
+static uint64_t
+ima_verify_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static int
 read_template_data(struct event *template, uint8_t **buf, size_t *remain)
 {
@@ -315,83 +359,229 @@ verify_template_hash(struct event *template)
 	return -1;
 }
 
+/**
+ * Verifies the template hash and the signature of a single entry and computes the
+ * template hash which is extended into the simulated PCR. If stats is set, the time
+ * spent in the individual steps is added to it.
+ */
+static int
+ima_verify_event(struct event *template, const char *cert, ima_verify_stats_t *stats)
+{
+	uint64_t t = stats ? ima_verify_now_ns() : 0;
+
+	if (verify_template_hash(template) != 0) {
+		ERROR("Failed to verify template hash for %s", template->name);
+		return -1;
+	}
+
+	if (stats) {
+		uint64_t now = ima_verify_now_ns();
+		stats->template_sha1_ns += now - t;
+		t = now;
+	}
+
+	int n_sigs = verify_template_data(template, cert);
+	if (n_sigs < 0) {
+		ERROR("Failed to verify measurement entry %s", template->name);
+		return -1;
+	}
+
+	if (stats) {
+		uint64_t now = ima_verify_now_ns();
+		stats->signature_ns += now - t;
+		stats->n_signatures += n_sigs;
+		t = now;
+	}
+
+	// Even in case of SHA256 PCRs, the template hash is a SHA1 hash and cannot be used,
+	// instead, the SHA256 hash of the template must be manually calculated to
+	// extend the simulated PCR
+	hash_sha256(template->template_hash, template->template_data,
+		    template->template_data_len);
+
+	if (stats) {
+		stats->template_sha256_ns += ima_verify_now_ns() - t;
+		stats->n_entries++;
+	}
+
+	return 0;
+}
+
+static void *
+ima_verify_worker(void *data)
+{
+	ima_verify_job_t *job = data;
+	ima_verify_stats_t stats = { 0 };
+
+	while (true) {
+		pthread_mutex_lock(&job->lock);
+		size_t i = job->next++;
+		bool failed = job->failed;
+		pthread_mutex_unlock(&job->lock);
+
+		if (failed || i >= job->n)
+			break;
+
+		if (ima_verify_event(&job->events[i], job->cert, job->stats ? &stats : NULL) < 0) {
+			pthread_mutex_lock(&job->lock);
+			job->failed = true;
+			pthread_mutex_unlock(&job->lock);
+		}
+	}
+
+	if (job->stats) {
+		pthread_mutex_lock(&job->lock);
+		job->stats->n_entries += stats.n_entries;
+		job->stats->n_signatures += stats.n_signatures;
+		job->stats->template_sha1_ns += stats.template_sha1_ns;
+		job->stats->template_sha256_ns += stats.template_sha256_ns;
+		job->stats->signature_ns += stats.signature_ns;
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Verifies the n entries in events on up to IMA_VERIFY_THREADS_MAX threads, including
+ * the calling one.
+ */
+static int
+ima_verify_events(struct event *events, size_t n, const char *cert)
+{
+	pthread_t threads[IMA_VERIFY_THREADS_MAX - 1];
+	size_t nthreads = 0;
+	ima_verify_job_t job = {
+		.events = events, .n = n, .cert = cert, .stats = ima_verify_stats
+	};
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t workers = (cpus > 1) ? MIN((size_t)cpus, (size_t)IMA_VERIFY_THREADS_MAX) : 1;
+	workers = MIN(workers, n);
+
+	pthread_mutex_init(&job.lock, NULL);
+
+	for (; nthreads + 1 < workers; nthreads++) {
+		if (pthread_create(&threads[nthreads], NULL, ima_verify_worker, &job)) {
+			WARN("Failed to start IMA verification thread, continuing with %zu",
+			     nthreads + 1);
+			break;
+		}
+	}
+
+	ima_verify_worker(&job);
+
+	for (size_t i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&job.lock);
+
+	return job.failed ? -1 : 0;
+}
+
+static void
+ima_verify_events_free(struct event *events, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		mem_free0(events[i].template_data);
+}
+
+void
+ima_verify_stats_enable(ima_verify_stats_t *stats)
+{
+	ima_verify_stats = stats;
+}
+
 int
 ima_verify_binary_runtime_measurements(uint8_t *buf, size_t size, const char *cert,
-				       hash_algo_t template_hash_algo, uint8_t *pcr_tpm)
+				       hash_algo_t template_hash_algo, const uint8_t *pcr_init,
+				       uint8_t *pcr_tpm)
 {
-	ASSERT(buf);
+	ASSERT(buf || size == 0);
 	ASSERT(cert);
 	ASSERT(pcr_tpm);
 
-	struct event template;
 	uint8_t *ptr = buf;
 	size_t remain = size;
+	bool eof = false;
+	int ret = -1;
 
 	int hash_size = hash_algo_to_size(template_hash_algo);
 	IF_FALSE_RETVAL_ERROR(hash_size > 0, -1);
 
+	if (template_hash_algo != HASH_ALGO_SHA256) {
+		ERROR("Hash algorithm not supported");
+		return -1;
+	}
+
 	uint8_t pcr[hash_size];
 
-	// PCRs are initialized with zero's
-	mem_memset(pcr, 0, hash_size);
+	// PCRs are initialized with zero's, unless continuing from a verified checkpoint
+	if (pcr_init)
+		memcpy(pcr, pcr_init, hash_size);
+	else
+		mem_memset(pcr, 0, hash_size);
 
-	while (!buf_read(&template.header, &ptr, sizeof(template.header), &remain)) {
-		TRACE("PCR %02d Measurement:", template.header.pcr);
+	struct event *events = mem_new0(struct event, IMA_VERIFY_CHUNK);
 
-		IF_TRUE_RETVAL(template.header.name_len > TCG_EVENT_NAME_LEN_MAX, -1);
+	while (!eof) {
+		size_t n = 0;
 
-		mem_memset(template.name, 0, sizeof template.name);
-		buf_read(template.name, &ptr, template.header.name_len, &remain);
-		TRACE("Template: %s", template.name);
+		for (; n < IMA_VERIFY_CHUNK; n++) {
+			struct event *template = &events[n];
 
-		if (read_template_data(&template, &ptr, &remain) < 0) {
-			ERROR("Failed to read measurement entry %s", template.name);
-			mem_free0(template.template_data);
-			return -1;
-		}
+			if (buf_read(&template->header, &ptr, sizeof(template->header), &remain)) {
+				eof = true;
+				break;
+			}
+			TRACE("PCR %02d Measurement:", template->header.pcr);
 
-		if (verify_template_hash(&template) != 0) {
-			ERROR("Failed to verify template hash for %s", template.name);
-			mem_free0(template.template_data);
-			return -1;
-		}
+			if (template->header.name_len > TCG_EVENT_NAME_LEN_MAX) {
+				ERROR("Invalid template name length %u", template->header.name_len);
+				ima_verify_events_free(events, n);
+				goto out;
+			}
 
-		if (verify_template_data(&template, cert) != 0) {
-			ERROR("Failed to verify measurement entry %s", template.name);
-			mem_free0(template.template_data);
-			return -1;
+			mem_memset(template->name, 0, sizeof template->name);
+			buf_read(template->name, &ptr, template->header.name_len, &remain);
+			TRACE("Template: %s", template->name);
+
+			if (read_template_data(template, &ptr, &remain) < 0) {
+				ERROR("Failed to read measurement entry %s", template->name);
+				ima_verify_events_free(events, n + 1);
+				goto out;
+			}
 		}
 
-		if (template_hash_algo == HASH_ALGO_SHA256) {
-			// Even in case of SHA256 PCRs, the template hash is a SHA1 hash and cannot be used,
-			// instead, the SHA256 hash of the template must be manually calculated to
-			// extend the simulated PCR
-			uint8_t template_hash[SHA256_DIGEST_LENGTH];
-			hash_sha256(template_hash, template.template_data,
-				    template.template_data_len);
+		if (ima_verify_events(events, n, cert) < 0) {
+			ima_verify_events_free(events, n);
+			goto out;
+		}
 
+		uint64_t t = ima_verify_stats ? ima_verify_now_ns() : 0;
+		for (size_t i = 0; i < n; i++) {
 			EVP_MD_CTX *c_256 = EVP_MD_CTX_new();
 			EVP_DigestInit(c_256, EVP_sha256());
 			EVP_DigestUpdate(c_256, pcr, SHA256_DIGEST_LENGTH);
-			EVP_DigestUpdate(c_256, template_hash, SHA256_DIGEST_LENGTH);
+			EVP_DigestUpdate(c_256, events[i].template_hash, SHA256_DIGEST_LENGTH);
 			EVP_DigestFinal(c_256, pcr, NULL);
 			EVP_MD_CTX_free(c_256);
-
-		} else {
-			ERROR("Hash algorithm not supported");
-			mem_free0(template.template_data);
-			return -1;
 		}
+		if (ima_verify_stats)
+			ima_verify_stats->pcr_replay_ns += ima_verify_now_ns() - t;
 
-		mem_free0(template.template_data);
+		ima_verify_events_free(events, n);
 	}
 
 	if (memcmp(pcr, pcr_tpm, hash_size) != 0) {
 		ERROR("Failed to verify IMA TPM PCR");
-		return -1;
+		goto out;
 	}
 
 	INFO("Verify IMA TPM PCR SUCCESSFUL");
+	ret = 0;
 
-	return 0;
+out:
+	mem_free0(events);
+	return ret;
 }
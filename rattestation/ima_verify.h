@@ -24,8 +24,35 @@
 #ifndef IMA_VERIFY_H_
 #define IMA_VERIFY_H_
 
+/**
+ * Per-phase CPU time spent in ima_verify_binary_runtime_measurements(), summed over all
+ * verification threads. Only collected if enabled by ima_verify_stats_enable().
+ */
+typedef struct {
+	uint64_t n_entries;
+	uint64_t n_signatures;
+	uint64_t template_sha1_ns;   // checking the SHA-1 template hash of the entries
+	uint64_t template_sha256_ns; // calculating the SHA-256 template hash for the PCR
+	uint64_t signature_ns;	     // parsing the entries and verifying their signatures
+	uint64_t pcr_replay_ns;	     // replaying the template hashes into the PCR
+} ima_verify_stats_t;
+
+/**
+ * Accumulates the statistics of subsequent verifications in stats, NULL disables
+ * collecting them. Intended for benchmarking, not to be used concurrently.
+ */
+void
+ima_verify_stats_enable(ima_verify_stats_t *stats);
+
+/**
+ * Verifies the IMA measurement list in buf and replays it against pcr_tpm, starting
+ * from pcr_init, or from the zero-initialized PCR if pcr_init is NULL. A non-NULL
+ * pcr_init allows to verify only the entries appended after an already verified part
+ * of the list.
+ */
 int
 ima_verify_binary_runtime_measurements(uint8_t *buf, size_t size, const char *cert,
-				       hash_algo_t template_hash_algo, uint8_t *pcr_tpm);
+				       hash_algo_t template_hash_algo, const uint8_t *pcr_init,
+				       uint8_t *pcr_tpm);
 
 #endif // IMA_VERIFY_H_
\ No newline at end of file
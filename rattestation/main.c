@@ -28,10 +28,13 @@
 #include "common/event.h"
 
 #include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
 #include <sys/types.h>
 #include <signal.h>
 
 #include "attestation.h"
+#include "fleet.h"
 
 #include <openssl/err.h>
 #include <openssl/sha.h>
@@ -48,6 +51,9 @@
 #define LOGFILE_DIR "/data/logs"
 #define LOGFILE_PATH LOGFILE_DIR "/rattestation"
 
+#define MAIN_DEFAULT_CONCURRENCY 64
+#define MAIN_DEFAULT_TIMEOUT_S 30
+
 static logf_handler_t *logfile_handler = NULL;
 static logf_handler_t *logfile_handler_stdout = NULL;
 
@@ -65,20 +71,81 @@ main_return_result_and_exit(bool validated)
 	exit(validated ? 0 : -1);
 }
 
+static void
+main_fleet_done_cb(size_t n_failed, UNUSED void *data)
+{
+	main_return_result_and_exit(n_failed == 0);
+}
+
+static void
+main_print_usage(const char *cmd)
+{
+	printf("Usage: %s [remote_host [config_file]]\n", cmd);
+	printf("       %s -l <device_list> [-j concurrency] [-t timeout] [config_file]\n", cmd);
+	printf("\nWith -l, all hosts in device_list (one per line) are attested, at most\n"
+	       "concurrency (default %d) at a time, each within timeout seconds (default %d).\n"
+	       "One line \"<host> OK|FAILED\" is printed per host as soon as it is done.\n",
+	       MAIN_DEFAULT_CONCURRENCY, MAIN_DEFAULT_TIMEOUT_S);
+	exit(-1);
+}
+
 int
 main(int argc, char **argv)
 {
-	logfile_handler = logf_register(&logf_file_write, logf_file_new(LOGFILE_PATH));
-	logfile_handler_stdout = logf_register(&logf_file_write, stdout);
+	const char *list_file = NULL;
+	long concurrency = MAIN_DEFAULT_CONCURRENCY;
+	long timeout = MAIN_DEFAULT_TIMEOUT_S;
+	int c;
+	while ((c = getopt(argc, argv, "l:j:t:h")) != -1) {
+		switch (c) {
+		case 'l':
+			list_file = optarg;
+			break;
+		case 'j':
+			concurrency = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			timeout = strtol(optarg, NULL, 10);
+			break;
+		default:
+			main_print_usage(argv[0]);
+		}
+	}
+	if (concurrency < 1 || timeout < 0)
+		main_print_usage(argv[0]);
 
+	logfile_handler = logf_register(&logf_file_write, logf_file_new(LOGFILE_PATH));
 	logf_handler_set_prio(logfile_handler, LOGF_PRIO_TRACE);
-	logf_handler_set_prio(logfile_handler_stdout, LOGF_PRIO_TRACE);
 
-	char *rhost = (argc < 2) ? "127.0.0.1" : argv[1];
-	char *config_file = (argc < 3) ? "rattestation.conf" : argv[2];
+	// stdout carries the results in list mode, keep the log of many hosts out of it
+	if (list_file) {
+		logfile_handler_stdout = logf_register(&logf_file_write, stderr);
+		logf_handler_set_prio(logfile_handler_stdout, LOGF_PRIO_WARN);
+	} else {
+		logfile_handler_stdout = logf_register(&logf_file_write, stdout);
+		logf_handler_set_prio(logfile_handler_stdout, LOGF_PRIO_TRACE);
+	}
 
 	event_init();
 
+	if (list_file) {
+		char *config_file = (argc > optind) ? argv[optind] : "rattestation.conf";
+		attestation_ctx_t *ctx = attestation_ctx_new(config_file);
+		if (!ctx)
+			main_return_result_and_exit(false);
+
+		// the context is shared by all attestations and lives until exit
+		if (fleet_attest(ctx, list_file, concurrency, timeout * 1000, stdout,
+				 main_fleet_done_cb, NULL) < 0)
+			main_return_result_and_exit(false);
+
+		event_loop();
+		return 0;
+	}
+
+	char *rhost = (argc > optind) ? argv[optind] : "127.0.0.1";
+	char *config_file = (argc > optind + 1) ? argv[optind + 1] : "rattestation.conf";
+
 	/* register keyboard sigint */
 	event_signal_t *sig = event_signal_new(SIGINT, &main_sigint_cb, NULL);
 	event_add_signal(sig);
@@ -68,6 +68,13 @@ print_usage(const char *cmd)
 	       "        Stops/Kills the specified container.\n\n");
 	printf("   state <container-id>\n"
 	       "        Prints the OCI-compatible state of the specified container.\n\n");
+	printf("   session\n"
+	       "        Reads commands from stdin, one per line, and sends them over a single\n"
+	       "        connection. Supported are 'state <id>', 'create <id> <bundle> [async]',\n"
+	       "        'start <id>', 'kill <id> <signal>' and 'delete <id>'. For each command,\n"
+	       "        the state or 'ok'/'failed' is printed on a line of its own. With async,\n"
+	       "        create returns once the creation is initiated and a following start\n"
+	       "        waits for its completion.\n\n");
 	exit(-1);
 }
 
@@ -103,6 +110,121 @@ recv_message(int sock)
 	return resp;
 }
 
+/*
+ * Fills msg with a CREATE command for the bundle in bundle_path; the config buffer
+ * and the bundle path have to be freed by the caller.
+ */
+static int
+create_message_init(OciCommand *msg, const char *bundle_path)
+{
+	char *cfgfile = mem_printf("%s/config.json", bundle_path);
+	off_t cfglen = file_size(cfgfile);
+	if (cfglen < 0) {
+		ERROR("Error accessing config file %s.", cfgfile);
+		mem_free0(cfgfile);
+		return -1;
+	}
+
+	unsigned char *cfg = mem_alloc(cfglen);
+	if (file_read(cfgfile, (char *)cfg, cfglen) < 0) {
+		ERROR("Error reading %s.", cfgfile);
+		mem_free0(cfg);
+		mem_free0(cfgfile);
+		return -1;
+	}
+	mem_free0(cfgfile);
+
+	msg->operation = OCI_COMMAND__OPERATION__CREATE;
+	msg->has_oci_config_file = true;
+	msg->oci_config_file.len = cfglen;
+	msg->oci_config_file.data = cfg;
+	msg->bundle_path = mem_strdup(bundle_path);
+
+	DEBUG("config: %s", (char *)msg->oci_config_file.data);
+	return 0;
+}
+
+/*
+ * Runs the commands read line by line from stdin over the connection sock, each waiting for
+ * its response before the next one is sent.
+ *
+ * @return 0 if all commands succeeded, -1 otherwise
+ */
+static int
+run_session(int sock)
+{
+	char *line = NULL;
+	size_t line_size = 0;
+	int ret = 0;
+
+	while (getline(&line, &line_size, stdin) != -1) {
+		char *saveptr = NULL;
+		char *command = strtok_r(line, " \t\n", &saveptr);
+		char *id = command ? strtok_r(NULL, " \t\n", &saveptr) : NULL;
+		char *arg = id ? strtok_r(NULL, " \t\n", &saveptr) : NULL;
+		char *opt = arg ? strtok_r(NULL, " \t\n", &saveptr) : NULL;
+
+		// skip empty lines and comments
+		if (!command || command[0] == '#')
+			continue;
+
+		OciCommand msg = OCI_COMMAND__INIT;
+		msg.container_id = id;
+
+		bool valid = true;
+		if (!id) {
+			valid = false;
+		} else if (!strcasecmp(command, "state")) {
+			msg.operation = OCI_COMMAND__OPERATION__STATE;
+		} else if (!strcasecmp(command, "start")) {
+			msg.operation = OCI_COMMAND__OPERATION__START;
+		} else if (!strcasecmp(command, "delete")) {
+			msg.operation = OCI_COMMAND__OPERATION__DELETE;
+		} else if (!strcasecmp(command, "kill") && arg) {
+			msg.operation = OCI_COMMAND__OPERATION__KILL;
+			msg.has_signal = true;
+			msg.signal = atoi(arg);
+		} else if (!strcasecmp(command, "create") && arg) {
+			valid = create_message_init(&msg, arg) == 0;
+			if (opt && !strcasecmp(opt, "async")) {
+				msg.has_create_async = true;
+				msg.create_async = true;
+			}
+		} else {
+			valid = false;
+		}
+
+		if (!valid) {
+			ERROR("Invalid command '%s'", command);
+			printf("failed\n");
+			fflush(stdout);
+			ret = -1;
+			continue;
+		}
+
+		send_message(sock, &msg);
+		OciResponse *resp = recv_message(sock);
+
+		if (resp->code == OCI_RESPONSE__CODE__STATE) {
+			printf("%s\n", resp->state);
+		} else if (resp->has_response && resp->response == OCI_RESPONSE__RESPONSE__CMD_OK) {
+			printf("ok\n");
+		} else {
+			printf("failed\n");
+			ret = -1;
+		}
+		fflush(stdout);
+
+		protobuf_free_message((ProtobufCMessage *)resp);
+		if (msg.has_oci_config_file)
+			mem_free0(msg.oci_config_file.data);
+		mem_free0(msg.bundle_path);
+	}
+
+	free(line);
+	return ret;
+}
+
 static const struct option global_options[] = {
 	{ "socket", required_argument, 0, 's' }, { "root", required_argument, 0, 'r' },
 	{ "log", required_argument, 0, 'l' },	 { "log-format", required_argument, 0, 'f' },
@@ -156,6 +278,17 @@ main(int argc, char *argv[])
 
 	const char *command = argv[optind++];
 
+	if (!strcasecmp(command, "session")) {
+		if (!file_exists(socket_file)) {
+			ERROR("Could not find socket file %s. Aborting.\n", socket_file);
+			return -1;
+		}
+		sock = sock_connect(socket_file);
+		ret = run_session(sock);
+		close(sock);
+		return ret;
+	}
+
 	if (!strcasecmp(command, "create")) {
 		fprintf(stderr, "OCI_CREATE");
 
@@ -243,22 +376,8 @@ main(int argc, char *argv[])
 	if (!strcasecmp(command, "create")) {
 		fprintf(stderr, "OCI_CREATE");
 
-		const char *cfgfile = mem_printf("%s/config.json", bundle_path);
-		off_t cfglen = file_size(cfgfile);
-		if (cfglen < 0)
-			FATAL("Error accessing config file %s.", cfgfile);
-
-		unsigned char *cfg = mem_alloc(cfglen);
-		if (file_read(cfgfile, (char *)cfg, cfglen) < 0)
-			FATAL("Error reading %s. Aborting.", cfgfile);
-
-		msg.operation = OCI_COMMAND__OPERATION__CREATE;
-		msg.has_oci_config_file = true;
-		msg.oci_config_file.len = cfglen;
-		msg.oci_config_file.data = cfg;
-		msg.bundle_path = mem_strdup(bundle_path);
-
-		DEBUG("config: %s", (char *)msg.oci_config_file.data);
+		if (create_message_init(&msg, bundle_path) < 0)
+			FATAL("Could not read bundle %s. Aborting.", bundle_path);
 
 		DEBUG("console_sock :%s", console_sock);
 
@@ -21,6 +21,8 @@
  * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
  */
 
+#define _GNU_SOURCE
+
 #include "control.h"
 #ifdef ANDROID
 #include "device/fraunhofer/common/cml/scd/scd.pb-c.h"
@@ -37,17 +39,24 @@
 #include "common/sock.h"
 #include "common/fd.h"
 #include "common/event.h"
+#include "common/event_work.h"
 #include "common/list.h"
 #include "common/dir.h"
 #include "common/file.h"
 #include "common/proc.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/protobuf-text.h"
 #include "common/ssl_util.h"
 #include "common/sock-sd.h"
+#include "common/probe.h"
 
+#include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <google/protobuf-c/protobuf-c-text.h>
 
@@ -117,6 +126,40 @@ write_to_tmpfile_new(unsigned char *buf, size_t buflen)
 	return NULL;
 }
 
+/*
+ * Maps the sealed memfd passed by cmld, the seals guarantee that its size and contents
+ * do not change while it is mapped. Returns NULL on error.
+ */
+static void *
+scd_control_memfd_map(int fd, size_t *len)
+{
+	static const uint8_t empty[1];
+	const int required = F_SEAL_SHRINK | F_SEAL_WRITE;
+	struct stat st;
+
+	IF_TRUE_RETVAL_ERROR_ERRNO(fstat(fd, &st) < 0, NULL);
+	int seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || (seals & required) != required) {
+		ERROR("Passed fd %d is not a sealed memfd", fd);
+		return NULL;
+	}
+
+	*len = st.st_size;
+	// mmap() rejects empty mappings
+	IF_TRUE_RETVAL(*len == 0, (void *)empty);
+
+	void *map = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+	IF_TRUE_RETVAL_ERROR_ERRNO(map == MAP_FAILED, NULL);
+	return map;
+}
+
+static void
+scd_control_memfd_unmap(void *map, size_t len)
+{
+	if (map && len > 0)
+		munmap(map, len);
+}
+
 struct verify_cert_ca_cb_data {
 	const char *cert_file;
 	bool ignore_time;
@@ -144,6 +187,32 @@ scd_control_verify_cert_ca_cb(const char *path, const char *file, void *data)
 	return ret;
 }
 
+static int
+scd_control_preload_ca_cb(const char *path, const char *file, UNUSED void *data)
+{
+	char *ca_file = mem_printf("%s/%s", path, file);
+	if (ssl_preload_root_cert(ca_file) < 0)
+		WARN("Could not preload ca %s", ca_file);
+	mem_free0(ca_file);
+	return 0;
+}
+
+/*
+ * Loads (or refreshes) the trust stores used by scd_control_handle_verify() in the
+ * long-lived scd process. Verifications run in forked crypto worker children, which
+ * inherit the loaded stores instead of parsing the root CAs again on every request.
+ */
+static void
+scd_control_preload_root_certs(void)
+{
+	if (file_exists(SSIG_ROOT_CERT) && ssl_preload_root_cert(SSIG_ROOT_CERT) < 0)
+		WARN("Could not preload %s", SSIG_ROOT_CERT);
+	if (file_exists(LOCALCA_ROOT_CERT) && ssl_preload_root_cert(LOCALCA_ROOT_CERT) < 0)
+		WARN("Could not preload %s", LOCALCA_ROOT_CERT);
+	if (file_is_dir(TRUSTED_CA_STORE))
+		dir_foreach(TRUSTED_CA_STORE, scd_control_preload_ca_cb, NULL);
+}
+
 /*
  * This function mainly handles verify request as part of
  * TSF.CML.SecureCompartmentInit and TSF.CML.Updates.
@@ -209,107 +278,83 @@ do_signature:
 	return out_code;
 }
 
+/*
+ * Wipes the secrets contained in a DaemonToToken message.
+ */
 static void
-scd_control_handle_message(const DaemonToToken *msg, int fd)
+scd_control_msg_wipe(DaemonToToken *msg)
 {
-	if (NULL == msg) {
-		WARN("msg=NULL, returning");
-		return;
-	}
-
-	if (LOGF_PRIO_TRACE >= LOGF_LOG_MIN_PRIO) {
-		char *msg_text;
-		size_t msg_len =
-			protobuf_string_from_message(&msg_text, (ProtobufCMessage *)msg, NULL);
-		TRACE("Handling DaemonToToken message:\n%s", msg_len > 0 ? msg_text : "NULL");
-		if (msg_text)
-			free(msg_text);
-	}
+	if (msg->token_pin)
+		mem_memset0(msg->token_pin, strlen(msg->token_pin));
+	if (msg->token_newpin)
+		mem_memset0(msg->token_newpin, strlen(msg->token_newpin));
+	if (msg->has_pairing_secret)
+		mem_memset0(msg->pairing_secret.data, msg->pairing_secret.len);
+	if (msg->has_unwrapped_key)
+		mem_memset0(msg->unwrapped_key.data, msg->unwrapped_key.len);
+	if (msg->has_wrapped_key)
+		mem_memset0(msg->wrapped_key.data, msg->wrapped_key.len);
+}
 
+/*
+ * Handles a request which operates on a single token and fills the reply into out.
+ * Key material allocated for the reply is released by scd_control_token_reply_free().
+ * Apart from TOKEN_REMOVE, this is run on a worker thread.
+ */
+static void
+scd_control_handle_token_message(scd_token_t *token, const DaemonToToken *msg, TokenToDaemon *out)
+{
 	switch (msg->code) {
-	case DAEMON_TO_TOKEN__CODE__TOKEN_ADD: {
-		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
-		out.code = TOKEN_TO_DAEMON__CODE__TOKEN_ADD_FAILED;
-
-		scd_token_t *token = scd_get_token_from_msg(msg);
-
-		if (token != NULL) {
-			INFO("Token already exists.");
-			out.code = TOKEN_TO_DAEMON__CODE__TOKEN_ADD_SUCCESSFUL;
-		} else if (scd_token_new(msg) == 0) {
-			out.code = TOKEN_TO_DAEMON__CODE__TOKEN_ADD_SUCCESSFUL;
-		} else {
-			ERROR("Could not create new token");
-		}
-
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
-	} break;
 	case DAEMON_TO_TOKEN__CODE__TOKEN_REMOVE: {
-		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
-		out.code = TOKEN_TO_DAEMON__CODE__TOKEN_REMOVE_FAILED;
-
-		scd_token_t *token = scd_get_token_from_msg(msg);
+		out->code = TOKEN_TO_DAEMON__CODE__TOKEN_REMOVE_FAILED;
 
 		if (token == NULL) {
 			ERROR("Token not found");
 		} else {
 			scd_token_free(token);
-			out.code = TOKEN_TO_DAEMON__CODE__TOKEN_REMOVE_SUCCESSFUL;
+			out->code = TOKEN_TO_DAEMON__CODE__TOKEN_REMOVE_SUCCESSFUL;
 		}
-
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
 	} break;
 	case DAEMON_TO_TOKEN__CODE__UNLOCK: {
 		TRACE("SCD: Handle messsage UNLOCK");
-		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
-		out.code = TOKEN_TO_DAEMON__CODE__UNLOCK_FAILED;
-
-		scd_token_t *token = scd_get_token_from_msg(msg);
+		out->code = TOKEN_TO_DAEMON__CODE__UNLOCK_FAILED;
 
 		if (!token) {
 			ERROR("No token loaded, unlock failed");
 		} else if (!msg->token_pin) {
 			ERROR("Token passphrase not specified");
 		} else if (token->is_locked_till_reboot(token)) {
-			out.code = TOKEN_TO_DAEMON__CODE__LOCKED_TILL_REBOOT;
+			out->code = TOKEN_TO_DAEMON__CODE__LOCKED_TILL_REBOOT;
 		} else {
 			int ret = token->unlock(token, msg->token_pin, msg->pairing_secret.data,
 						msg->pairing_secret.len);
 			if (ret == 0)
-				out.code = TOKEN_TO_DAEMON__CODE__UNLOCK_SUCCESSFUL;
+				out->code = TOKEN_TO_DAEMON__CODE__UNLOCK_SUCCESSFUL;
 			else if (ret == -2) {
 				if (token->is_locked_till_reboot(token))
-					out.code = TOKEN_TO_DAEMON__CODE__LOCKED_TILL_REBOOT;
+					out->code = TOKEN_TO_DAEMON__CODE__LOCKED_TILL_REBOOT;
 				else
-					out.code = TOKEN_TO_DAEMON__CODE__PASSWD_WRONG;
+					out->code = TOKEN_TO_DAEMON__CODE__PASSWD_WRONG;
 			} else
-				out.code = TOKEN_TO_DAEMON__CODE__UNLOCK_FAILED;
+				out->code = TOKEN_TO_DAEMON__CODE__UNLOCK_FAILED;
 		}
-
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
 	} break;
 	case DAEMON_TO_TOKEN__CODE__LOCK: {
 		TRACE("SCD: Handle messsage LOCK");
-		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
-		out.code = TOKEN_TO_DAEMON__CODE__LOCK_FAILED;
+		out->code = TOKEN_TO_DAEMON__CODE__LOCK_FAILED;
 
-		scd_token_t *token = scd_get_token_from_msg(msg);
 		if (!token) {
 			ERROR("No token loaded, lock failed");
 		} else if (token->lock(token) == 0) {
-			out.code = TOKEN_TO_DAEMON__CODE__LOCK_SUCCESSFUL;
+			out->code = TOKEN_TO_DAEMON__CODE__LOCK_SUCCESSFUL;
 		}
-
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
 	} break;
 	case DAEMON_TO_TOKEN__CODE__WRAP_KEY: {
 		TRACE("SCD: Handle messsage WRAP_KEY");
 		int wrapped_key_len;
 		unsigned char *wrapped_key;
-		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
-		out.code = TOKEN_TO_DAEMON__CODE__WRAPPED_KEY;
+		out->code = TOKEN_TO_DAEMON__CODE__WRAPPED_KEY;
 
-		scd_token_t *token = scd_get_token_from_msg(msg);
 		if (!token) {
 			ERROR("No token loaded, wrap failed");
 		} else if (token->is_locked(token)) {
@@ -319,30 +364,19 @@ scd_control_handle_message(const DaemonToToken *msg, int fd)
 		} else if (token->wrap_key(token, msg->container_uuid, msg->unwrapped_key.data,
 					   msg->unwrapped_key.len, &wrapped_key,
 					   &wrapped_key_len) == 0) {
-			out.has_wrapped_key = true;
-			out.wrapped_key.len = wrapped_key_len;
-			out.wrapped_key.data = wrapped_key;
+			out->has_wrapped_key = true;
+			out->wrapped_key.len = wrapped_key_len;
+			out->wrapped_key.data = wrapped_key;
 		} else {
 			ERROR("Key wrapping failed");
 		}
-
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
-		if (out.has_wrapped_key) {
-			mem_memset0(wrapped_key, wrapped_key_len);
-			mem_free0(wrapped_key);
-		}
-		if (msg->has_unwrapped_key) {
-			mem_memset0(msg->unwrapped_key.data, msg->unwrapped_key.len);
-		}
 	} break;
 	case DAEMON_TO_TOKEN__CODE__UNWRAP_KEY: {
 		TRACE("SCD: Handle messsage UNWRAP_KEY");
 		int unwrapped_key_len;
 		unsigned char *unwrapped_key;
-		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
-		out.code = TOKEN_TO_DAEMON__CODE__UNWRAPPED_KEY;
+		out->code = TOKEN_TO_DAEMON__CODE__UNWRAPPED_KEY;
 
-		scd_token_t *token = scd_get_token_from_msg(msg);
 		if (!token) {
 			ERROR("No token loaded, unwrap failed");
 		} else if (token->is_locked(token)) {
@@ -352,28 +386,17 @@ scd_control_handle_message(const DaemonToToken *msg, int fd)
 		} else if (token->unwrap_key(token, msg->container_uuid, msg->wrapped_key.data,
 					     msg->wrapped_key.len, &unwrapped_key,
 					     &unwrapped_key_len) == 0) {
-			out.has_unwrapped_key = true;
-			out.unwrapped_key.len = unwrapped_key_len;
-			out.unwrapped_key.data = unwrapped_key;
+			out->has_unwrapped_key = true;
+			out->unwrapped_key.len = unwrapped_key_len;
+			out->unwrapped_key.data = unwrapped_key;
 		} else {
 			ERROR("Key unwrapping failed");
 		}
-
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
-		if (out.has_unwrapped_key) {
-			mem_memset0(unwrapped_key, unwrapped_key_len);
-			mem_free0(unwrapped_key);
-		}
-		if (msg->has_wrapped_key) {
-			mem_memset0(msg->wrapped_key.data, msg->wrapped_key.len);
-		}
 	} break;
 	case DAEMON_TO_TOKEN__CODE__CHANGE_PIN: {
 		TRACE("SCD: Handle messsage CHANGE_PIN");
-		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
-		out.code = TOKEN_TO_DAEMON__CODE__CHANGE_PIN_FAILED;
+		out->code = TOKEN_TO_DAEMON__CODE__CHANGE_PIN_FAILED;
 
-		scd_token_t *token = scd_get_token_from_msg(msg);
 		if (!token) {
 			ERROR("No token loaded, change pass failed");
 		} else if (!msg->token_pin) {
@@ -383,64 +406,263 @@ scd_control_handle_message(const DaemonToToken *msg, int fd)
 		} else if (!msg->has_pairing_secret) {
 			ERROR("Pairing secret not specified");
 		} else if (token->is_locked_till_reboot(token)) {
-			out.code = TOKEN_TO_DAEMON__CODE__LOCKED_TILL_REBOOT;
+			out->code = TOKEN_TO_DAEMON__CODE__LOCKED_TILL_REBOOT;
 		} else {
 			int ret = token->change_passphrase(token, msg->token_pin, msg->token_newpin,
 							   msg->pairing_secret.data,
 							   msg->pairing_secret.len, false);
 			if (ret == 0) {
-				out.code = TOKEN_TO_DAEMON__CODE__CHANGE_PIN_SUCCESSFUL;
+				out->code = TOKEN_TO_DAEMON__CODE__CHANGE_PIN_SUCCESSFUL;
 			} else {
 				ERROR("Token change passphrase failed");
 			}
 		}
-
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
-		if (msg->token_pin) {
-			mem_memset0(msg->token_pin, strlen(msg->token_pin));
-		}
-		if (msg->token_newpin) {
-			mem_memset0(msg->token_newpin, strlen(msg->token_newpin));
-		}
-		if (msg->has_pairing_secret) {
-			mem_memset0(msg->pairing_secret.data, msg->pairing_secret.len);
-		}
 	} break;
 	case DAEMON_TO_TOKEN__CODE__PROVISION_PIN: {
 		TRACE("SCD: Handle messsage PROVISION_PIN");
-		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
-		out.code = TOKEN_TO_DAEMON__CODE__CHANGE_PIN_FAILED;
+		out->code = TOKEN_TO_DAEMON__CODE__CHANGE_PIN_FAILED;
 
-		scd_token_t *token = scd_get_token_from_msg(msg);
 		if (!token) {
 			ERROR("No token loaded, change pass failed");
 		} else if (!msg->token_pin) {
 			ERROR("Token passphrase not specified");
 		} else if (token->is_locked_till_reboot(token)) {
-			out.code = TOKEN_TO_DAEMON__CODE__LOCKED_TILL_REBOOT;
+			out->code = TOKEN_TO_DAEMON__CODE__LOCKED_TILL_REBOOT;
 		} else {
 			int ret = token->change_passphrase(token, msg->token_pin, msg->token_newpin,
 							   msg->pairing_secret.data,
 							   msg->pairing_secret.len, true);
 			if (ret == 0) {
 				TRACE("SCD: change_passphrase successful");
-				out.code = TOKEN_TO_DAEMON__CODE__PROVISION_PIN_SUCCESSFUL;
+				out->code = TOKEN_TO_DAEMON__CODE__PROVISION_PIN_SUCCESSFUL;
 			} else {
 				TRACE("SCD: change_passphrase failed");
-				out.code = TOKEN_TO_DAEMON__CODE__PROVISION_PIN_FAILED;
+				out->code = TOKEN_TO_DAEMON__CODE__PROVISION_PIN_FAILED;
 			}
 		}
+	} break;
+	default:
+		WARN("DaemonToToken command %d is no token request", msg->code);
+		out->code = TOKEN_TO_DAEMON__CODE__CMD_UNKNOWN;
+		break;
+	}
+}
 
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
-		if (msg->token_pin) {
-			mem_memset0(msg->token_pin, strlen(msg->token_pin));
-		}
-		if (msg->token_newpin) {
-			mem_memset0(msg->token_newpin, strlen(msg->token_newpin));
+static void
+scd_control_token_reply_free(TokenToDaemon *out)
+{
+	if (out->has_wrapped_key) {
+		mem_memset0(out->wrapped_key.data, out->wrapped_key.len);
+		mem_free0(out->wrapped_key.data);
+	}
+	if (out->has_unwrapped_key) {
+		mem_memset0(out->unwrapped_key.data, out->unwrapped_key.len);
+		mem_free0(out->unwrapped_key.data);
+	}
+}
+
+/*
+ * Requests operating on a token, e.g. unlocks involving slow KDFs or APDU exchanges
+ * with a usb token, are run on the event_work pool. They are serialized by a queue
+ * per token, thus independent tokens are handled concurrently while each token is
+ * only accessed by a single request at a time.
+ */
+typedef struct scd_token_queue scd_token_queue_t;
+
+typedef struct scd_token_request {
+	scd_token_queue_t *queue;
+	protobuf_conn_t *conn; // NULL if the connection was closed meanwhile
+	DaemonToToken *msg;    // private copy of the received request
+	scd_token_t *token;    // looked up on the event loop right before running
+	TokenToDaemon out;     // reply filled by the handler
+} scd_token_request_t;
+
+struct scd_token_queue {
+	scd_token_t *token;
+	list_t *requests; // pending requests, the first one is running if busy
+	bool busy;
+};
+
+static list_t *scd_token_queue_list = NULL;
+
+static bool
+scd_control_is_token_message(const DaemonToToken *msg)
+{
+	switch (msg->code) {
+	case DAEMON_TO_TOKEN__CODE__TOKEN_REMOVE:
+	case DAEMON_TO_TOKEN__CODE__UNLOCK:
+	case DAEMON_TO_TOKEN__CODE__LOCK:
+	case DAEMON_TO_TOKEN__CODE__WRAP_KEY:
+	case DAEMON_TO_TOKEN__CODE__UNWRAP_KEY:
+	case DAEMON_TO_TOKEN__CODE__CHANGE_PIN:
+	case DAEMON_TO_TOKEN__CODE__PROVISION_PIN:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void
+scd_token_request_free(scd_token_request_t *req)
+{
+	scd_control_token_reply_free(&req->out);
+	scd_control_msg_wipe(req->msg);
+	protobuf_free_message((ProtobufCMessage *)req->msg);
+	mem_free0(req);
+}
+
+static int
+scd_token_request_work(void *data)
+{
+	scd_token_request_t *req = data;
+
+	PROBE1(scd_token_request, req->msg->code);
+	scd_control_handle_token_message(req->token, req->msg, &req->out);
+	PROBE2(scd_token_request_done, req->msg->code, req->out.code);
+	return 0;
+}
+
+static void
+scd_token_queue_run(scd_token_queue_t *queue);
+
+static void
+scd_token_request_done(UNUSED int ret, void *data)
+{
+	scd_token_request_t *req = data;
+	scd_token_queue_t *queue = req->queue;
+
+	if (req->conn) {
+		req->out.has_request_id = req->msg->has_request_id;
+		req->out.request_id = req->msg->request_id;
+		protobuf_conn_send_message(req->conn, (ProtobufCMessage *)&req->out);
+	}
+
+	queue->requests = list_remove(queue->requests, req);
+	queue->busy = false;
+	scd_token_request_free(req);
+
+	scd_token_queue_run(queue);
+}
+
+/*
+ * Starts the next request of the queue if none is running. An empty queue is freed.
+ */
+static void
+scd_token_queue_run(scd_token_queue_t *queue)
+{
+	IF_TRUE_RETURN(queue->busy);
+
+	if (!queue->requests) {
+		scd_token_queue_list = list_remove(scd_token_queue_list, queue);
+		mem_free0(queue);
+		return;
+	}
+
+	scd_token_request_t *req = queue->requests->data;
+	queue->busy = true;
+
+	// the token may have been removed by a preceding request
+	req->token = scd_get_token_from_msg(req->msg);
+
+	// the token list and the event loop must only be touched by the main thread
+	if (req->msg->code == DAEMON_TO_TOKEN__CODE__TOKEN_REMOVE) {
+		scd_token_request_work(req);
+		scd_token_request_done(0, req);
+		return;
+	}
+
+	if (event_submit_work(scd_token_request_work, scd_token_request_done, req) < 0) {
+		WARN("Could not offload token request, handling it synchronously");
+		scd_token_request_work(req);
+		scd_token_request_done(0, req);
+	}
+}
+
+static void
+scd_control_queue_token_message(DaemonToToken *msg, protobuf_conn_t *conn)
+{
+	scd_token_t *token = scd_get_token_from_msg(msg);
+	scd_token_queue_t *queue = NULL;
+
+	if (!token) {
+		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
+		scd_control_handle_token_message(NULL, msg, &out);
+		out.has_request_id = msg->has_request_id;
+		out.request_id = msg->request_id;
+		protobuf_conn_send_message(conn, (ProtobufCMessage *)&out);
+		scd_control_msg_wipe(msg);
+		return;
+	}
+
+	uint8_t *buf = NULL;
+	uint32_t buf_len = protobuf_pack_message_new((ProtobufCMessage *)msg, &buf);
+	DaemonToToken *copy = (DaemonToToken *)protobuf_unpack_message(
+		&daemon_to_token__descriptor, buf, buf_len);
+	mem_memset0(buf, buf_len);
+	mem_free0(buf);
+	scd_control_msg_wipe(msg);
+	IF_NULL_RETURN_ERROR(copy);
+
+	for (list_t *l = scd_token_queue_list; l; l = l->next) {
+		scd_token_queue_t *q = l->data;
+		if (q->token == token) {
+			queue = q;
+			break;
 		}
-		if (msg->has_pairing_secret) {
-			mem_memset0(msg->pairing_secret.data, msg->pairing_secret.len);
+	}
+	if (!queue) {
+		queue = mem_new0(scd_token_queue_t, 1);
+		queue->token = token;
+		scd_token_queue_list = list_append(scd_token_queue_list, queue);
+	}
+
+	scd_token_request_t *req = mem_new0(scd_token_request_t, 1);
+	TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
+	req->queue = queue;
+	req->conn = conn;
+	req->msg = copy;
+	req->out = out;
+	queue->requests = list_append(queue->requests, req);
+
+	TRACE("Queued token request %d, %u pending for token", msg->code,
+	      list_length(queue->requests));
+	scd_token_queue_run(queue);
+}
+
+static void
+scd_control_handle_message(const DaemonToToken *msg, int fd)
+{
+	if (NULL == msg) {
+		WARN("msg=NULL, returning");
+		return;
+	}
+
+	if (LOGF_PRIO_TRACE >= LOGF_LOG_MIN_PRIO) {
+		char *msg_text;
+		size_t msg_len =
+			protobuf_string_from_message(&msg_text, (ProtobufCMessage *)msg, NULL);
+		TRACE("Handling DaemonToToken message:\n%s", msg_len > 0 ? msg_text : "NULL");
+		if (msg_text)
+			free(msg_text);
+	}
+
+	switch (msg->code) {
+	case DAEMON_TO_TOKEN__CODE__TOKEN_ADD: {
+		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
+		out.code = TOKEN_TO_DAEMON__CODE__TOKEN_ADD_FAILED;
+
+		scd_token_t *token = scd_get_token_from_msg(msg);
+
+		if (token != NULL) {
+			INFO("Token already exists.");
+			out.code = TOKEN_TO_DAEMON__CODE__TOKEN_ADD_SUCCESSFUL;
+		} else if (scd_token_new(msg) == 0) {
+			out.code = TOKEN_TO_DAEMON__CODE__TOKEN_ADD_SUCCESSFUL;
+		} else {
+			ERROR("Could not create new token");
 		}
+
+		protobuf_send_message(fd, (ProtobufCMessage *)&out);
 	} break;
 	case DAEMON_TO_TOKEN__CODE__PULL_DEVICE_CSR: {
 		TRACE("SCD: Handle messsage PULL_DEV_CSR");
@@ -506,48 +728,115 @@ scd_control_handle_message(const DaemonToToken *msg, int fd)
 	}
 }
 
+/*
+ * A crypto request which is handled by a forked worker child. The child writes its
+ * reply to a pipe and the main process forwards it to the connection, tagged with the
+ * request id. Thus, replies of concurrently running children are never interleaved
+ * on a connection and a crashed child still produces an error reply.
+ */
+typedef struct scd_crypto_request {
+	protobuf_conn_t *conn; // NULL if the connection was closed meanwhile
+	int pipe_fd;	       // read end of the pipe to the worker child
+	bool has_request_id;
+	uint32_t request_id;
+	TokenToDaemon__Code error_code; // reply if the child did not answer
+} scd_crypto_request_t;
+
+// crypto requests which are in flight
+static list_t *scd_crypto_request_list = NULL;
+
 static void
-scd_crypto_sigchld_cb(UNUSED int signum, event_signal_t *sig, void *data)
+scd_crypto_child_cb(pid_t pid, int status, event_child_t *child, void *data)
 {
-	pid_t *pid = data;
-	ASSERT(pid);
+	scd_crypto_request_t *req = data;
+	ASSERT(req);
+
+	TRACE("Reaped child process: %d", pid);
+	event_child_free(child);
+	scd_crypto_request_list = list_remove(scd_crypto_request_list, req);
 
-	int status = 0;
+	if ((WIFEXITED(status) && WEXITSTATUS(status)) || WIFSIGNALED(status)) {
+		WARN("asyn crypto handler reurned with error");
+	}
 
-	if (proc_waitpid(*pid, &status, WNOHANG) == *pid) {
-		TRACE("Reaped child process: %d", *pid);
-		/* remove the sigchld callback for this pid from the event loop */
-		event_remove_signal(sig);
-		event_signal_free(sig);
+	// the child has exited, thus its reply is completely buffered in the pipe
+	TokenToDaemon *reply = NULL;
+	if (fd_make_non_blocking(req->pipe_fd) == 0)
+		reply = (TokenToDaemon *)protobuf_recv_message(req->pipe_fd,
+							       &token_to_daemon__descriptor);
+	close(req->pipe_fd);
 
-		if ((WIFEXITED(status) && WEXITSTATUS(status)) || WIFSIGNALED(status)) {
-			WARN("asyn crypto handler reurned with error");
+	if (req->conn) {
+		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
+		if (reply) {
+			out = *reply;
+		} else {
+			WARN("Crypto worker child %d did not reply, sending error", pid);
+			out.code = req->error_code;
 		}
-		mem_free0(pid);
+		out.has_request_id = req->has_request_id;
+		out.request_id = req->request_id;
+		protobuf_conn_send_message(req->conn, (ProtobufCMessage *)&out);
 	}
+
+	if (reply)
+		protobuf_free_message((ProtobufCMessage *)reply);
+	mem_free0(req);
 }
 
 static void
-scd_control_handle_crypto_message(const DaemonToToken *msg, int fd)
+scd_control_handle_crypto_message(const DaemonToToken *msg, protobuf_conn_t *conn)
 {
 	pid_t pid;
+	int pipe_fd[2];
 
 	if (NULL == msg) {
 		WARN("msg=NULL, returning");
 		return;
 	}
 
-	IF_TRUE_RETURN((pid = fork()) < 0);
+	if (msg->code == DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_FILE ||
+	    msg->code == DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_BUF ||
+	    msg->code == DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_MEMFD)
+		scd_control_preload_root_certs();
+
+	if (pipe(pipe_fd) < 0) {
+		ERROR_ERRNO("Could not create pipe for crypto worker child");
+		return;
+	}
+
+	if ((pid = fork()) < 0) {
+		ERROR_ERRNO("Could not fork crypto worker child");
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+		return;
+	}
 
 	if (pid > 0) {
 		/* parent (main scd process) */
-		pid_t *_pid = mem_new0(pid_t, 1);
-		*_pid = pid;
-		event_signal_t *sig = event_signal_new(SIGCHLD, scd_crypto_sigchld_cb, _pid);
-		event_add_signal(sig);
+		close(pipe_fd[1]);
+
+		scd_crypto_request_t *req = mem_new0(scd_crypto_request_t, 1);
+		req->conn = conn;
+		req->pipe_fd = pipe_fd[0];
+		req->has_request_id = msg->has_request_id;
+		req->request_id = msg->request_id;
+		req->error_code = (msg->code == DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_FILE ||
+				   msg->code == DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_BUF ||
+				   msg->code == DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_MEMFD) ?
+					  TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_ERROR :
+					  TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_ERROR;
+		scd_crypto_request_list = list_append(scd_crypto_request_list, req);
+
+		event_child_t *child = event_child_new(pid, scd_crypto_child_cb, req);
+		event_add_child(child);
 		return;
 	}
 
+	close(pipe_fd[0]);
+	// the reply is written to the pipe, the main process forwards it
+	int fd = pipe_fd[1];
+
 	/* here we are in the worker child */
 	event_reset();
 
@@ -578,7 +867,9 @@ scd_control_handle_crypto_message(const DaemonToToken *msg, int fd)
 		hash_algo = switch_proto_hash_algo(msg->hash_algo);
 
 		if (hash_algo) {
-			if ((hash = ssl_hash_file(msg->hash_file, &hash_len, hash_algo)) == NULL) {
+			off_t len = msg->has_hash_file_len ? (off_t)msg->hash_file_len : -1;
+			if ((hash = ssl_hash_file_len(msg->hash_file, len, &hash_len, hash_algo)) ==
+			    NULL) {
 				ERROR("Hashing file failed");
 			} else {
 				out.has_hash_value = true;
@@ -618,6 +909,41 @@ scd_control_handle_crypto_message(const DaemonToToken *msg, int fd)
 		if (hash)
 			mem_free0(hash);
 	} break;
+	/*
+	 * The worker takes the passed memfd from its copy of the connection, the copy of
+	 * the main process is closed once the message is handled.
+	 */
+	case DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_MEMFD: {
+		TRACE("SCD: Handle messsage CRYPTO_HASH_MEMFD");
+		unsigned int hash_len;
+		const char *hash_algo;
+		unsigned char *hash = NULL;
+		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
+		out.code = TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_ERROR;
+
+		hash_algo = switch_proto_hash_algo(msg->hash_algo);
+
+		int memfd = protobuf_conn_take_fd(conn);
+		size_t len = 0;
+		void *map = memfd < 0 ? NULL : scd_control_memfd_map(memfd, &len);
+		if (!map) {
+			ERROR("No memfd to hash passed");
+		} else if (hash_algo && len <= UINT_MAX) {
+			if ((hash = ssl_hash_buf(map, len, &hash_len, hash_algo)) == NULL) {
+				ERROR("Hashing memfd failed");
+			} else {
+				out.has_hash_value = true;
+				out.hash_value.len = hash_len;
+				out.hash_value.data = hash;
+				out.code = TOKEN_TO_DAEMON__CODE__CRYPTO_HASH_OK;
+			}
+		}
+
+		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		scd_control_memfd_unmap(map, len);
+		if (hash)
+			mem_free0(hash);
+	} break;
 	/*
 	 * This case handles verify requests as part of TSF.CML.Updates
 	 */
@@ -655,6 +981,42 @@ scd_control_handle_crypto_message(const DaemonToToken *msg, int fd)
 		}
 
 	} break;
+	/*
+	 * Like CRYPTO_VERIFY_BUF, but OpenSSL reads the passed memfds through their
+	 * /proc/self/fd links, so no temp files are needed.
+	 */
+	case DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_MEMFD: {
+		TRACE("SCD: Handle messsage CRYPTO_VERIFY_MEMFD");
+		TokenToDaemon out = TOKEN_TO_DAEMON__INIT;
+		out.code = TOKEN_TO_DAEMON__CODE__CRYPTO_VERIFY_ERROR;
+		bool ignore_time = msg->has_verify_ignore_time && msg->verify_ignore_time;
+		const char *hash_algo = switch_proto_hash_algo(msg->hash_algo);
+
+		// data, signature and certificate in the order they were passed
+		char *files[3] = { NULL };
+		bool complete = true;
+		for (int i = 0; i < 3; i++) {
+			int memfd = protobuf_conn_take_fd(conn);
+			size_t len;
+			void *map = memfd < 0 ? NULL : scd_control_memfd_map(memfd, &len);
+			if (!map) {
+				complete = false;
+				break;
+			}
+			scd_control_memfd_unmap(map, len);
+			files[i] = mem_printf("/proc/self/fd/%d", memfd);
+		}
+
+		if (complete) {
+			out.code = scd_control_handle_verify(files[0], files[1], files[2],
+							     ignore_time, hash_algo);
+		} else {
+			ERROR("Missing or invalid memfds to verify passed");
+		}
+		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		for (int i = 0; i < 3; i++)
+			mem_free0(files[i]);
+	} break;
 	/*
 	 * This case handles verify requests as part of TSF.CML.SecureCompartmentInit
 	 */
@@ -682,53 +1044,77 @@ scd_control_handle_crypto_message(const DaemonToToken *msg, int fd)
 }
 
 /**
- * Event callback for incoming data that a ControllerToDaemon message.
+ * Callback for a DaemonToToken message received on a control connection.
  *
  * The handle_message function will be called to handle the received message.
  *
- * @param fd	    file descriptor of the client connection
- *		    from which the incoming message is read
- * @param events    event flags
- * @param io	    pointer to associated event_io_t struct
+ * @param conn	    the client connection from which the message was received
+ * @param msg	    the received DaemonToToken message
  * @param data	    pointer to this scd_control_t struct
  */
 static void
-scd_control_cb_recv_message(int fd, unsigned events, event_io_t *io, UNUSED void *data)
+scd_control_cb_recv_message(protobuf_conn_t *conn, ProtobufCMessage *msg, UNUSED void *data)
 {
-	if (events & EVENT_IO_READ) {
-		DaemonToToken *msg =
-			(DaemonToToken *)protobuf_recv_message(fd, &daemon_to_token__descriptor);
-		// close connection if client EOF, or protocol parse error
-		IF_NULL_GOTO_TRACE(msg, connection_err);
-
-		switch (msg->code) {
-		case DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_FILE:
-		case DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_BUF:
-		case DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_FILE:
-		case DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_BUF:
-			scd_control_handle_crypto_message(msg, fd);
-			break;
-		default:
-			scd_control_handle_message(msg, fd);
-		}
-		protobuf_free_message((ProtobufCMessage *)msg);
-		DEBUG("Handled control connection %d", fd);
+	DaemonToToken *token_msg = (DaemonToToken *)msg;
+	int fd = protobuf_conn_get_fd(conn);
+
+	PROBE2(scd_request, token_msg->code, fd);
+	switch (token_msg->code) {
+	case DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_FILE:
+	case DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_BUF:
+	case DAEMON_TO_TOKEN__CODE__CRYPTO_HASH_MEMFD:
+	case DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_FILE:
+	case DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_BUF:
+	case DAEMON_TO_TOKEN__CODE__CRYPTO_VERIFY_MEMFD:
+		scd_control_handle_crypto_message(token_msg, conn);
+		break;
+	default:
+		if (scd_control_is_token_message(token_msg))
+			scd_control_queue_token_message(token_msg, conn);
+		else
+			scd_control_handle_message(token_msg, fd);
 	}
-	if (events & EVENT_IO_EXCEPT) {
-		INFO("Control client closed connection; disconnecting control socket.");
-		goto connection_err;
+	PROBE2(scd_request_done, token_msg->code, fd);
+	DEBUG("Handled control connection %d", fd);
+}
+
+/**
+ * Callback for a control connection which was closed by the client or
+ * which had to be closed due to an I/O or protocol parse error.
+ *
+ * @param conn	    the client connection to be closed
+ * @param data	    pointer to this scd_control_t struct
+ */
+static void
+scd_control_cb_close(protobuf_conn_t *conn, UNUSED void *data)
+{
+	int fd = protobuf_conn_get_fd(conn);
+
+	INFO("Control client closed connection; disconnecting control socket.");
+
+	// replies of crypto requests still in flight are dropped
+	for (list_t *l = scd_crypto_request_list; l; l = l->next) {
+		scd_crypto_request_t *req = l->data;
+		if (req->conn == conn)
+			req->conn = NULL;
+	}
+	// as well as replies of queued token requests
+	for (list_t *l = scd_token_queue_list; l; l = l->next) {
+		scd_token_queue_t *queue = l->data;
+		for (list_t *r = queue->requests; r; r = r->next) {
+			scd_token_request_t *req = r->data;
+			if (req->conn == conn)
+				req->conn = NULL;
+		}
 	}
-	return;
 
-connection_err:
-	event_remove_io(io);
-	event_io_free(io);
+	protobuf_conn_free(conn);
 	if (close(fd) < 0)
 		WARN_ERRNO("Failed to close connected control socket");
 	if (fd == event_fd)
 		event_fd = -1;
-	return;
 }
+
 /**
  * Event callback for accepting incoming connections on the listening socket.
  *
@@ -761,10 +1147,11 @@ scd_control_cb_accept(int fd, unsigned events, event_io_t *io, void *data)
 	}
 	DEBUG("Accepted control connection %d", cfd);
 
-	fd_make_non_blocking(cfd);
-
-	event_io_t *event = event_io_new(cfd, EVENT_IO_READ, scd_control_cb_recv_message, control);
-	event_add_io(event);
+	if (!protobuf_conn_new(cfd, &daemon_to_token__descriptor, scd_control_cb_recv_message,
+			       scd_control_cb_close, control)) {
+		WARN("Could not set up control connection %d", cfd);
+		close(cfd);
+	}
 }
 
 ssize_t
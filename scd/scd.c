@@ -36,6 +36,7 @@
 #include "common/mem.h"
 #include "common/event.h"
 #include "common/logf.h"
+#include "common/logrotate.h"
 #include "common/sock.h"
 #include "common/dir.h"
 #include "common/file.h"
@@ -293,13 +294,13 @@ provisioning_mode()
 }
 
 static void
-scd_logfile_rename_cb(UNUSED event_timer_t *timer, UNUSED void *data)
+scd_logfile_rotate_cb(FILE *file, UNUSED void *data)
 {
 	INFO("Logfile must be closed and a new file opened");
 	logf_unregister(scd_logfile_handler);
 	logf_file_close(scd_logfile_p);
 
-	scd_logfile_p = logf_file_new(LOGFILE_DIR "/cml-scd");
+	scd_logfile_p = file;
 	scd_logfile_handler = logf_register(&logf_file_write, scd_logfile_p);
 	logf_handler_set_prio(scd_logfile_handler, LOGF_PRIO_TRACE);
 }
@@ -319,9 +320,9 @@ main(int argc, char **argv)
 	scd_logfile_handler = logf_register(&logf_file_write, scd_logfile_p);
 	logf_handler_set_prio(scd_logfile_handler, LOGF_PRIO_TRACE);
 
-	event_timer_t *logfile_timer = event_timer_new(
-		HOURS_TO_MILLISECONDS(24), EVENT_TIMER_REPEAT_FOREVER, scd_logfile_rename_cb, NULL);
-	event_add_timer(logfile_timer);
+	if (!logrotate_new(LOGFILE_DIR "/cml-scd", scd_logfile_p, LOGFILE_MAX_SIZE, LOGFILE_MAX_AGE,
+			   LOGFILE_KEEP, &scd_logfile_rotate_cb, NULL))
+		WARN("Could not rotate the log file");
 
 	event_signal_t *sig_term = event_signal_new(SIGTERM, &scd_sigterm_cb, NULL);
 	event_add_signal(sig_term);
@@ -35,6 +35,15 @@
 #ifndef LOGFILE_DIR
 #define LOGFILE_DIR "/data/logs"
 #endif
+#ifndef LOGFILE_MAX_SIZE
+#define LOGFILE_MAX_SIZE (8 * 1024 * 1024) // rotate log files after 8 MiB
+#endif
+#ifndef LOGFILE_MAX_AGE
+#define LOGFILE_MAX_AGE (24 * 60 * 60) // or after one day
+#endif
+#ifndef LOGFILE_KEEP
+#define LOGFILE_KEEP 16 // number of rotated log files kept per daemon
+#endif
 
 // Do not edit! The provisioning script requires this path (also trustme-main.mk and its dummy provsg folder)
 #define SCD_TOKEN_DIR DEFAULT_BASE_PATH "/tokens"
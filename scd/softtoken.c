@@ -29,9 +29,31 @@
 #include "common/file.h"
 
 #include <string.h>
+#include <time.h>
+
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
 
 #define SOFTTOKEN_MAX_WRONG_UNLOCK_ATTEMPTS 3
 
+/*
+ * Keys wrapped with a symmetric KEK are prefixed with this magic, keys without it are
+ * wrapped with the RSA key of the token.
+ */
+#define SOFTTOKEN_KEK_MAGIC "CMLSKEK1"
+#define SOFTTOKEN_KEK_MAGIC_LEN (sizeof(SOFTTOKEN_KEK_MAGIC) - 1)
+#define SOFTTOKEN_KEK_SALT "gyroidos softtoken kek"
+#define SOFTTOKEN_KEK_LEN SHA256_DIGEST_LENGTH
+
+/*
+ * With SOFTTOKEN_KEK, the parsed key material of a locked token is kept for this many
+ * seconds, so that unlocking it again with the same passphrase does not parse the PKCS#12
+ * file. Set to 0 to release the key material on lock.
+ */
+#ifndef SOFTTOKEN_UNLOCK_CACHE_TTL
+#define SOFTTOKEN_UNLOCK_CACHE_TTL 600
+#endif
+
 struct softtoken {
 	char *token_file;		// absolute path to softtoken w. filename
 	bool locked;			// whether the token is locked or not
@@ -39,6 +61,10 @@ struct softtoken {
 	EVP_PKEY *pkey;			// holds the token public key pair when unlocked
 	X509 *cert;			// holds the token's certificate, if available
 	STACK_OF(X509) * ca;		// holds the token's certificate chain, if available
+	bool has_kek_prk;		// whether kek_prk is derived from pkey
+	unsigned char kek_prk[SOFTTOKEN_KEK_LEN]; // secret from which KEKs are derived
+	unsigned char unlock_mac[SOFTTOKEN_KEK_LEN]; // verifies the passphrase of cached secrets
+	time_t cache_until; // secrets of the locked token are kept until then, CLOCK_BOOTTIME
 };
 
 /**
@@ -95,13 +121,6 @@ softtoken_new_from_p12(const char *filename)
 	return token;
 }
 
-int
-softtoken_change_passphrase(softtoken_t *token, const char *oldpass, const char *newpass)
-{
-	ASSERT(token);
-	return ssl_newpass_pkcs12_token(token->token_file, oldpass, newpass);
-}
-
 /**
  * Free key and certificate data.
  * TODO distinguish private/secret data (which must be removed when locking)
@@ -124,6 +143,112 @@ softtoken_free_secrets(softtoken_t *token)
 		sk_X509_pop_free(token->ca, X509_free);
 		token->ca = NULL;
 	}
+	OPENSSL_cleanse(token->kek_prk, sizeof(token->kek_prk));
+	OPENSSL_cleanse(token->unlock_mac, sizeof(token->unlock_mac));
+	token->has_kek_prk = false;
+	token->cache_until = 0;
+}
+
+static bool
+softtoken_now(time_t *now)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_BOOTTIME, &ts) < 0) {
+		WARN_ERRNO("Unable to read CLOCK_BOOTTIME");
+		return false;
+	}
+	*now = ts.tv_sec;
+	return true;
+}
+
+/*
+ * Extracts the secret from which the symmetric KEKs are derived from the private key, like
+ * HKDF-Extract with SHA-256. Thus, the KEKs stay the same as long as the token's key does,
+ * e.g., across passphrase changes.
+ */
+static int
+softtoken_derive_kek_prk(softtoken_t *token)
+{
+	ASSERT(token->pkey);
+
+	int ret = -1;
+	unsigned char *der = NULL;
+	unsigned int len = sizeof(token->kek_prk);
+
+	int der_len = i2d_PrivateKey(token->pkey, &der);
+	if (der_len <= 0) {
+		ERROR("Failed to encode private key of softtoken");
+		return -1;
+	}
+
+	if (HMAC(EVP_sha256(), SOFTTOKEN_KEK_SALT, strlen(SOFTTOKEN_KEK_SALT), der, der_len,
+		 token->kek_prk, &len)) {
+		token->has_kek_prk = true;
+		ret = 0;
+	} else {
+		ERROR("Failed to derive KEK secret of softtoken");
+	}
+
+	OPENSSL_clear_free(der, der_len);
+	return ret;
+}
+
+/*
+ * Derives the KEK for keys with the given label, like HKDF-Expand with SHA-256 for a
+ * single block.
+ */
+static int
+softtoken_derive_kek(softtoken_t *token, const char *label, unsigned char *kek)
+{
+	IF_FALSE_RETVAL(token->has_kek_prk, -1);
+
+	const char *info = label ? label : "";
+	size_t info_len = strlen(info);
+	unsigned int len = SOFTTOKEN_KEK_LEN;
+
+	unsigned char *data = mem_alloc0(info_len + 1);
+	memcpy(data, info, info_len);
+	data[info_len] = 0x01;
+
+	unsigned char *res = HMAC(EVP_sha256(), token->kek_prk, sizeof(token->kek_prk), data,
+				  info_len + 1, kek, &len);
+	mem_free0(data);
+
+	return res ? 0 : -1;
+}
+
+/*
+ * Computes the MAC of passphrase, which verifies it for an unlock from the cached secrets.
+ */
+static int
+softtoken_unlock_mac(softtoken_t *token, const char *passphrase, unsigned char *mac)
+{
+	IF_FALSE_RETVAL(token->has_kek_prk, -1);
+
+	unsigned int len = SOFTTOKEN_KEK_LEN;
+	unsigned char *res = HMAC(EVP_sha256(), token->kek_prk, sizeof(token->kek_prk),
+				  (const unsigned char *)passphrase, strlen(passphrase), mac, &len);
+
+	return res ? 0 : -1;
+}
+
+int
+softtoken_change_passphrase(softtoken_t *token, const char *oldpass, const char *newpass)
+{
+	ASSERT(token);
+
+	int ret = ssl_newpass_pkcs12_token(token->token_file, oldpass, newpass);
+
+	// the cached secrets must not be unlocked with the old passphrase anymore
+	if (ret == 0) {
+		if (softtoken_is_locked(token))
+			softtoken_free_secrets(token);
+		else if (newpass)
+			softtoken_unlock_mac(token, newpass, token->unlock_mac);
+	}
+
+	return ret;
 }
 
 void
@@ -140,8 +265,8 @@ softtoken_free(softtoken_t *token)
 }
 
 int
-softtoken_wrap_key(softtoken_t *token, const unsigned char *plain_key, size_t plain_key_len,
-		   unsigned char **wrapped_key, int *wrapped_key_len)
+softtoken_wrap_key(softtoken_t *token, const char *label, const unsigned char *plain_key,
+		   size_t plain_key_len, unsigned char **wrapped_key, int *wrapped_key_len)
 {
 	ASSERT(token);
 	// TODO allow wrapping (encryption with public key) even with locked token?
@@ -149,18 +274,57 @@ softtoken_wrap_key(softtoken_t *token, const unsigned char *plain_key, size_t pl
 		WARN("Trying to wrap key with locked token.");
 		return -1;
 	}
+
+#ifdef SOFTTOKEN_KEK
+	unsigned char kek[SOFTTOKEN_KEK_LEN];
+	unsigned char *sym_key = NULL;
+	int sym_key_len = 0;
+
+	if (softtoken_derive_kek(token, label, kek) < 0) {
+		ERROR("Failed to derive KEK of softtoken");
+		return -1;
+	}
+	int ret = ssl_wrap_key_sym(kek, plain_key, plain_key_len, &sym_key, &sym_key_len);
+	OPENSSL_cleanse(kek, sizeof(kek));
+	IF_TRUE_RETVAL(ret != 0, -1);
+
+	*wrapped_key_len = SOFTTOKEN_KEK_MAGIC_LEN + sym_key_len;
+	*wrapped_key = mem_alloc0(*wrapped_key_len);
+	memcpy(*wrapped_key, SOFTTOKEN_KEK_MAGIC, SOFTTOKEN_KEK_MAGIC_LEN);
+	memcpy(*wrapped_key + SOFTTOKEN_KEK_MAGIC_LEN, sym_key, sym_key_len);
+	mem_free0(sym_key);
+	return 0;
+#else
+	(void)label;
 	return ssl_wrap_key(token->pkey, plain_key, plain_key_len, wrapped_key, wrapped_key_len);
+#endif
 }
 
 int
-softtoken_unwrap_key(softtoken_t *token, const unsigned char *wrapped_key, size_t wrapped_key_len,
-		     unsigned char **plain_key, int *plain_key_len)
+softtoken_unwrap_key(softtoken_t *token, const char *label, const unsigned char *wrapped_key,
+		     size_t wrapped_key_len, unsigned char **plain_key, int *plain_key_len)
 {
 	ASSERT(token);
 	if (softtoken_is_locked(token)) {
 		WARN("Trying to unwrap key with locked token.");
 		return -1;
 	}
+
+	// keys wrapped with a KEK are unwrapped regardless of SOFTTOKEN_KEK
+	if (wrapped_key_len > SOFTTOKEN_KEK_MAGIC_LEN &&
+	    !memcmp(wrapped_key, SOFTTOKEN_KEK_MAGIC, SOFTTOKEN_KEK_MAGIC_LEN)) {
+		unsigned char kek[SOFTTOKEN_KEK_LEN];
+		if (softtoken_derive_kek(token, label, kek) < 0) {
+			ERROR("Failed to derive KEK of softtoken");
+			return -1;
+		}
+		int ret = ssl_unwrap_key_sym(kek, wrapped_key + SOFTTOKEN_KEK_MAGIC_LEN,
+					     wrapped_key_len - SOFTTOKEN_KEK_MAGIC_LEN, plain_key,
+					     plain_key_len);
+		OPENSSL_cleanse(kek, sizeof(kek));
+		return ret;
+	}
+
 	return ssl_unwrap_key(token->pkey, wrapped_key, wrapped_key_len, plain_key, plain_key_len);
 }
 
@@ -197,6 +361,26 @@ softtoken_unlock(softtoken_t *token, char *passphrase)
 		ERROR("No token present");
 		return -1;
 	}
+
+	if (token->cache_until) {
+		unsigned char mac[SOFTTOKEN_KEK_LEN];
+		time_t now;
+
+		if (passphrase && softtoken_now(&now) && now < token->cache_until &&
+		    !softtoken_unlock_mac(token, passphrase, mac) &&
+		    !CRYPTO_memcmp(mac, token->unlock_mac, sizeof(mac))) {
+			TRACE("Unlocking softtoken from cached secrets");
+			token->locked = false;
+			token->wrong_unlock_attempts = 0;
+			token->cache_until = 0;
+			OPENSSL_cleanse(mac, sizeof(mac));
+			return 0;
+		}
+		// expired or other passphrase, parse the token again
+		OPENSSL_cleanse(mac, sizeof(mac));
+		softtoken_free_secrets(token);
+	}
+
 	int res = ssl_read_pkcs12_token(token->token_file, passphrase, &token->pkey, &token->cert,
 					&token->ca);
 	if (res == -1) // wrong password
@@ -204,6 +388,8 @@ softtoken_unlock(softtoken_t *token, char *passphrase)
 	else if (res == 0) {
 		token->locked = false;
 		token->wrong_unlock_attempts = 0;
+		if (softtoken_derive_kek_prk(token) == 0 && passphrase)
+			softtoken_unlock_mac(token, passphrase, token->unlock_mac);
 	}
 	// TODO what to do with wrong_unlock_attempts if unlock failed for some other reason?
 
@@ -223,7 +409,15 @@ softtoken_lock(softtoken_t *token)
 		return 0;
 	}
 
-	softtoken_free_secrets(token);
 	token->locked = true;
+
+#ifdef SOFTTOKEN_KEK
+	time_t now;
+	if (SOFTTOKEN_UNLOCK_CACHE_TTL > 0 && token->has_kek_prk && softtoken_now(&now)) {
+		token->cache_until = now + SOFTTOKEN_UNLOCK_CACHE_TTL;
+		return 0;
+	}
+#endif
+	softtoken_free_secrets(token);
 	return 0;
 }
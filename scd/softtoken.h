@@ -68,7 +68,9 @@ softtoken_unlock(softtoken_t *token, char *passphrase);
 
 /**
  * locks a softtoken by freeing the private key
- * reference in the softtoken
+ * reference in the softtoken. With SOFTTOKEN_KEK, the parsed key material is kept for
+ * SOFTTOKEN_UNLOCK_CACHE_TTL seconds, so that unlocking it again with the same passphrase
+ * needs no PKCS#12 parsing.
  */
 int
 softtoken_lock(softtoken_t *token);
@@ -93,18 +95,21 @@ softtoken_free(softtoken_t *token);
 
 /**
  * wraps a symmetric container key plain_key of length plain_key_len with a
- * user public key pubkey into a wrapped key wrapped_key of length wrapped_key_len
+ * user public key pubkey into a wrapped key wrapped_key of length wrapped_key_len.
+ * With SOFTTOKEN_KEK, the key is wrapped with a symmetric KEK instead, which is derived
+ * for label from the token's private key on unlock.
  */
 int
-softtoken_wrap_key(softtoken_t *token, const unsigned char *plain_key, size_t plain_key_len,
-		   unsigned char **wrapped_key, int *wrapped_key_len);
+softtoken_wrap_key(softtoken_t *token, const char *label, const unsigned char *plain_key,
+		   size_t plain_key_len, unsigned char **wrapped_key, int *wrapped_key_len);
 
 /**
  * unwraps a symmetric container key wrapped_key of length wrapped_key_len with a
- * user's private key into the plain key plain_key of length plain_key_len
+ * user's private key, or the KEK for label if it was wrapped with one, into the plain
+ * key plain_key of length plain_key_len
  */
 int
-softtoken_unwrap_key(softtoken_t *token, const unsigned char *wrapped_key, size_t wrapped_key_len,
-		     unsigned char **plain_key, int *plain_key_len);
+softtoken_unwrap_key(softtoken_t *token, const char *label, const unsigned char *wrapped_key,
+		     size_t wrapped_key_len, unsigned char **plain_key, int *plain_key_len);
 
 #endif /* SOFTTOKEN_H */
@@ -31,19 +31,32 @@
 #include "common/event.h"
 #include "common/uuid.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/list.h"
 #include "common/str.h"
-#include "common/fd.h"
 #include "file.h"
 #include "unistd.h"
 
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
 #define SCD_TOKENCONTROL_SOCK_LISTEN_BACKLOG 1
 
+/*
+ * Lifetime in seconds of an unwrapped key in the key cache of an unlocked token.
+ * Set to 0 to disable the cache, i.e., to unwrap keys on each request.
+ */
+#ifndef TOKEN_KEY_CACHE_TTL
+#define TOKEN_KEY_CACHE_TTL 600
+#endif
+
 //#undef LOGF_LOG_MIN_PRIO
 //#define LOGF_LOG_MIN_PRIO LOGF_PRIO_TRACE
 
 typedef struct scd_tokencontrol {
 	int cfd;
+	protobuf_conn_t *conn;
 	int lsock;
 	char *lsock_path;
 	list_t *events;
@@ -57,6 +70,18 @@ struct scd_token_data {
 
 	scd_tokentype_t type;
 	uuid_t *token_uuid;
+
+	// unwrapped keys of the unlocked token, wiped on lock
+	list_t *key_cache;
+
+	// backend functions of the internal token wrapped by the key cache
+	int (*int_lock)(scd_token_t *token);
+	int (*int_wrap_key)(scd_token_t *token, char *label, unsigned char *plain_key,
+			    size_t plain_key_len, unsigned char **wrapped_key,
+			    int *wrapped_key_len);
+	int (*int_unwrap_key)(scd_token_t *token, char *label, unsigned char *wrapped_key,
+			      size_t wrapped_key_len, unsigned char **plain_key,
+			      int *plain_key_len);
 	tctrl_t *tctrl;
 };
 
@@ -74,6 +99,29 @@ wrapped_remove_event_io(void *elem)
 static void
 scd_tokencontrol_cb_accept(int fd, unsigned events, UNUSED event_io_t *io, void *data);
 
+/**
+ * Closes the accepted tokencontrol connection of the given token and
+ * starts accepting a new connection on the listening socket.
+ */
+static void
+scd_tokencontrol_disconnect(scd_token_t *token)
+{
+	tctrl_t *tctrl = token->token_data->tctrl;
+
+	protobuf_conn_free(tctrl->conn);
+	tctrl->conn = NULL;
+
+	if (close(tctrl->cfd) < 0)
+		WARN_ERRNO("Failed to close connected control socket");
+	tctrl->cfd = -1;
+
+	// accept new connection for respective token
+	event_io_t *event = event_io_new(tctrl->lsock, EVENT_IO_READ, scd_tokencontrol_cb_accept,
+					 token);
+	tctrl->events = list_append(tctrl->events, event);
+	event_add_io(event);
+}
+
 static void
 scd_tokencontrol_handle_message(const ContainerToToken *msg, int fd, void *data)
 {
@@ -143,8 +191,7 @@ err:
 
 close_fd:
 	mem_free0(brsp);
-	if (close(fd) < 0)
-		WARN_ERRNO("Failed to close connected control socket");
+	scd_tokencontrol_disconnect(t);
 	return;
 
 out:
@@ -166,58 +213,37 @@ out:
 }
 
 /**
- * Event callback for incoming data that a ContainerToToken message.
+ * Callback for a ContainerToToken message received on the tokencontrol connection.
  *
  * The handle_message function will be called to handle the received message.
  *
- * @param fd	    file descriptor of the client connection
- *		    from which the incoming message is read
- * @param events    event flags
- * @param io	    pointer to associated event_io_t struct
- * @param data	    pointer to this scd_control_t struct
+ * @param conn	    the client connection from which the message was received
+ * @param msg	    the received ContainerToToken message
+ * @param data	    pointer to the scd_token_t struct
  */
 static void
-scd_tokencontrol_cb_recv_message(int fd, unsigned events, event_io_t *io, void *data)
+scd_tokencontrol_cb_recv_message(protobuf_conn_t *conn, ProtobufCMessage *msg, void *data)
 {
-	scd_token_t *token = (scd_token_t *)(data);
+	int fd = protobuf_conn_get_fd(conn);
 
 	DEBUG("scd_tokencontrol_cb_recv_message");
 
-	if (events & EVENT_IO_READ) {
-		ContainerToToken *msg = (ContainerToToken *)protobuf_recv_message(
-			fd, &container_to_token__descriptor);
-		// close connection if client EOF, or protocol parse error
-		IF_NULL_GOTO_TRACE(msg, connection_err);
-
-		scd_tokencontrol_handle_message(msg, fd, data);
-		protobuf_free_message((ProtobufCMessage *)msg);
-		DEBUG("Handled control connection %d", fd);
-	} else if (events & EVENT_IO_EXCEPT) {
-		INFO("TokenControl client closed connection; disconnecting socket.");
-		goto connection_err;
-	} else {
-		ERROR("Unexpected event");
-		goto connection_err;
-	}
-
-	return;
-
-connection_err:
-	token->token_data->tctrl->events = list_remove(token->token_data->tctrl->events, io);
-	event_remove_io(io);
-	event_io_free(io);
-
-	token->token_data->tctrl->cfd = -1;
-	if (close(fd) < 0)
-		WARN_ERRNO("Failed to close connected control socket");
-
-	// accept new connection for respective token
-	event_io_t *event = event_io_new(token->token_data->tctrl->lsock, EVENT_IO_READ,
-					 scd_tokencontrol_cb_accept, token);
-	token->token_data->tctrl->events = list_append(token->token_data->tctrl->events, event);
-	event_add_io(event);
+	scd_tokencontrol_handle_message((ContainerToToken *)msg, fd, data);
+	DEBUG("Handled control connection %d", fd);
+}
 
-	return;
+/**
+ * Callback for the tokencontrol connection which was closed by the client or
+ * which had to be closed due to an I/O or protocol parse error.
+ *
+ * @param conn	    the client connection to be closed
+ * @param data	    pointer to the scd_token_t struct
+ */
+static void
+scd_tokencontrol_cb_close(UNUSED protobuf_conn_t *conn, void *data)
+{
+	INFO("TokenControl client closed connection; disconnecting socket.");
+	scd_tokencontrol_disconnect(data);
 }
 
 /**
@@ -242,23 +268,21 @@ scd_tokencontrol_cb_accept(int fd, unsigned events, UNUSED event_io_t *io, void
 		}
 		DEBUG("Accepted tokencontrol connection %d", token->token_data->tctrl->cfd);
 
-		fd_make_non_blocking(token->token_data->tctrl->cfd);
-
-		DEBUG("Made tokenctrl_cfd non-blocking");
+		token->token_data->tctrl->conn = protobuf_conn_new(
+			token->token_data->tctrl->cfd, &container_to_token__descriptor,
+			scd_tokencontrol_cb_recv_message, scd_tokencontrol_cb_close, data);
+		if (!token->token_data->tctrl->conn) {
+			WARN("Could not set up tokencontrol connection");
+			close(token->token_data->tctrl->cfd);
+			token->token_data->tctrl->cfd = -1;
+			return;
+		}
 
 		// only accept one connection per socket at a time
 		token->token_data->tctrl->events =
 			list_remove(token->token_data->tctrl->events, io);
 
 		wrapped_remove_event_io(io);
-
-		event_io_t *event = event_io_new(token->token_data->tctrl->cfd, EVENT_IO_READ,
-						 scd_tokencontrol_cb_recv_message, data);
-
-		token->token_data->tctrl->events =
-			list_append(token->token_data->tctrl->events, event);
-
-		event_add_io(event);
 	} else if (events & EVENT_IO_EXCEPT) {
 		TRACE("EVENT_IO_EXCEPT on socket %d, closing...", fd);
 	} else {
@@ -314,6 +338,7 @@ scd_tokencontrol_free(scd_token_t *token)
 
 	list_foreach(token->token_data->tctrl->events, wrapped_remove_event_io);
 
+	protobuf_conn_free(token->token_data->tctrl->conn);
 	if (token->token_data->tctrl->cfd != -1) {
 		TRACE("Closing accepted tokencontrol socket for token %s",
 		      uuid_string(token->token_data->token_uuid));
@@ -362,18 +387,18 @@ int_is_locked_till_reboot_st(scd_token_t *token)
 }
 
 int
-int_wrap_st(scd_token_t *token, UNUSED char *label, unsigned char *plain_key, size_t plain_key_len,
+int_wrap_st(scd_token_t *token, char *label, unsigned char *plain_key, size_t plain_key_len,
 	    unsigned char **wrapped_key, int *wrapped_key_len)
 {
-	return softtoken_wrap_key(token->token_data->int_token.softtoken, plain_key, plain_key_len,
-				  wrapped_key, wrapped_key_len);
+	return softtoken_wrap_key(token->token_data->int_token.softtoken, label, plain_key,
+				  plain_key_len, wrapped_key, wrapped_key_len);
 }
 
 int
-int_unwrap_st(scd_token_t *token, UNUSED char *label, unsigned char *wrapped_key,
-	      size_t wrapped_key_len, unsigned char **plain_key, int *plain_key_len)
+int_unwrap_st(scd_token_t *token, char *label, unsigned char *wrapped_key, size_t wrapped_key_len,
+	      unsigned char **plain_key, int *plain_key_len)
 {
-	return softtoken_unwrap_key(token->token_data->int_token.softtoken, wrapped_key,
+	return softtoken_unwrap_key(token->token_data->int_token.softtoken, label, wrapped_key,
 				    wrapped_key_len, plain_key, plain_key_len);
 }
 
@@ -421,8 +446,13 @@ int_unlock_usb(scd_token_t *token, char *passwd, unsigned char *pairing_secret,
 	       size_t pairing_sec_len)
 {
 	TRACE("SCD: int_usb_unlock");
-	return usbtoken_unlock(token->token_data->int_token.usbtoken, passwd, pairing_secret,
-			       pairing_sec_len);
+	usbtoken_t *usbtoken = token->token_data->int_token.usbtoken;
+
+	usbtoken_se_acquire(usbtoken);
+	int ret = usbtoken_unlock(usbtoken, passwd, pairing_secret, pairing_sec_len);
+	usbtoken_se_release(usbtoken);
+
+	return ret;
 }
 
 bool
@@ -441,49 +471,258 @@ int
 int_wrap_usb(scd_token_t *token, char *label, unsigned char *plain_key, size_t plain_key_len,
 	     unsigned char **wrapped_key, int *wrapped_key_len)
 {
-	return usbtoken_wrap_key(token->token_data->int_token.usbtoken, (unsigned char *)label,
-				 strlen(label), plain_key, plain_key_len, wrapped_key,
-				 wrapped_key_len);
+	usbtoken_t *usbtoken = token->token_data->int_token.usbtoken;
+
+	usbtoken_se_acquire(usbtoken);
+	int ret = usbtoken_wrap_key(usbtoken, (unsigned char *)label, strlen(label), plain_key,
+				    plain_key_len, wrapped_key, wrapped_key_len);
+	usbtoken_se_release(usbtoken);
+
+	return ret;
 }
 
 int
 int_unwrap_usb(scd_token_t *token, char *label, unsigned char *wrapped_key, size_t wrapped_key_len,
 	       unsigned char **plain_key, int *plain_key_len)
 {
-	return usbtoken_unwrap_key(token->token_data->int_token.usbtoken, (unsigned char *)label,
-				   strlen(label), wrapped_key, wrapped_key_len, plain_key,
-				   plain_key_len);
+	usbtoken_t *usbtoken = token->token_data->int_token.usbtoken;
+
+	usbtoken_se_acquire(usbtoken);
+	int ret = usbtoken_unwrap_key(usbtoken, (unsigned char *)label, strlen(label),
+				      wrapped_key, wrapped_key_len, plain_key, plain_key_len);
+	usbtoken_se_release(usbtoken);
+
+	return ret;
 }
 
 int
 int_change_pw_usb(scd_token_t *token, const char *oldpass, const char *newpass,
 		  unsigned char *pairing_secret, size_t pairing_sec_len, bool is_provisioning)
 {
-	return usbtoken_change_passphrase(token->token_data->int_token.usbtoken, oldpass, newpass,
-					  pairing_secret, pairing_sec_len, is_provisioning);
+	usbtoken_t *usbtoken = token->token_data->int_token.usbtoken;
+
+	usbtoken_se_acquire(usbtoken);
+	int ret = usbtoken_change_passphrase(usbtoken, oldpass, newpass, pairing_secret,
+					     pairing_sec_len, is_provisioning);
+	usbtoken_se_release(usbtoken);
+
+	return ret;
 }
 
 int
 int_send_apdu_usb(scd_token_t *token, unsigned char *apdu, size_t apdu_len, unsigned char *brsp,
 		  size_t brsp_len)
 {
-	return usbtoken_send_apdu(token->token_data->int_token.usbtoken, apdu, apdu_len, brsp,
-				  brsp_len);
+	usbtoken_t *usbtoken = token->token_data->int_token.usbtoken;
+
+	usbtoken_se_acquire(usbtoken);
+	int ret = usbtoken_send_apdu(usbtoken, apdu, apdu_len, brsp, brsp_len);
+	usbtoken_se_release(usbtoken);
+
+	return ret;
 }
 
 int
 int_reset_auth_usb(scd_token_t *token, unsigned char *brsp, size_t brsp_len)
 {
-	return usbtoken_reset_auth(token->token_data->int_token.usbtoken, brsp, brsp_len);
+	usbtoken_t *usbtoken = token->token_data->int_token.usbtoken;
+
+	usbtoken_se_acquire(usbtoken);
+	int ret = usbtoken_reset_auth(usbtoken, brsp, brsp_len);
+	usbtoken_se_release(usbtoken);
+
+	return ret;
 }
 
 int
 int_get_atr_usb(scd_token_t *token, unsigned char *brsp, size_t brsp_len)
 {
-	return usbtoken_get_atr(token->token_data->int_token.usbtoken, brsp, brsp_len);
+	usbtoken_t *usbtoken = token->token_data->int_token.usbtoken;
+
+	usbtoken_se_acquire(usbtoken);
+	int ret = usbtoken_get_atr(usbtoken, brsp, brsp_len);
+	usbtoken_se_release(usbtoken);
+
+	return ret;
 }
 #endif // ENABLESCHSM
 
+/*** key cache ***/
+
+/*
+ * Unwrapped keys are kept in mlock'ed anonymous mappings, thus they are neither
+ * swapped out nor included in core dumps. Requests to a token are serialized by
+ * scd's control layer, thus the cache of a token needs no locking of its own.
+ */
+typedef struct token_key_cache_entry {
+	char *label;
+	unsigned char *wrapped_key;
+	size_t wrapped_key_len;
+	unsigned char *plain_key; // mlock'ed mapping of plain_key_map_len bytes
+	size_t plain_key_len;
+	size_t plain_key_map_len;
+	time_t until; // expiry, seconds of CLOCK_BOOTTIME
+} token_key_cache_entry_t;
+
+static bool
+token_key_cache_now(time_t *now)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_BOOTTIME, &ts) < 0) {
+		WARN_ERRNO("Unable to read CLOCK_BOOTTIME");
+		return false;
+	}
+	*now = ts.tv_sec;
+	return true;
+}
+
+static void
+token_key_cache_entry_free(token_key_cache_entry_t *entry)
+{
+	mem_memset0(entry->plain_key, entry->plain_key_map_len);
+	munlock(entry->plain_key, entry->plain_key_map_len);
+	munmap(entry->plain_key, entry->plain_key_map_len);
+	mem_free0(entry->wrapped_key);
+	mem_free0(entry->label);
+	mem_free0(entry);
+}
+
+static void
+token_key_cache_remove(scd_token_t *token, token_key_cache_entry_t *entry)
+{
+	token->token_data->key_cache = list_remove(token->token_data->key_cache, entry);
+	token_key_cache_entry_free(entry);
+}
+
+static void
+token_key_cache_clear(scd_token_t *token)
+{
+	for (list_t *l = token->token_data->key_cache; l; l = l->next)
+		token_key_cache_entry_free(l->data);
+	list_delete(token->token_data->key_cache);
+	token->token_data->key_cache = NULL;
+}
+
+static token_key_cache_entry_t *
+token_key_cache_find(scd_token_t *token, const char *label)
+{
+	for (list_t *l = token->token_data->key_cache; l; l = l->next) {
+		token_key_cache_entry_t *entry = l->data;
+		if (!strcmp(entry->label, label))
+			return entry;
+	}
+	return NULL;
+}
+
+static void
+token_key_cache_put(scd_token_t *token, const char *label, const unsigned char *wrapped_key,
+		    size_t wrapped_key_len, const unsigned char *plain_key, size_t plain_key_len)
+{
+	time_t now;
+
+	IF_TRUE_RETURN(TOKEN_KEY_CACHE_TTL <= 0 || !label || plain_key_len == 0);
+	IF_FALSE_RETURN(token_key_cache_now(&now));
+
+	token_key_cache_entry_t *old = token_key_cache_find(token, label);
+	if (old)
+		token_key_cache_remove(token, old);
+
+	long page_size = sysconf(_SC_PAGESIZE);
+	IF_TRUE_RETURN(page_size <= 0);
+	size_t map_len = (plain_key_len + page_size - 1) / page_size * page_size;
+
+	void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+			 0);
+	if (map == MAP_FAILED) {
+		WARN_ERRNO("Could not allocate key cache memory");
+		return;
+	}
+	if (mlock(map, map_len) < 0) {
+		WARN_ERRNO("Could not lock key cache memory, not caching key");
+		munmap(map, map_len);
+		return;
+	}
+	if (madvise(map, map_len, MADV_DONTDUMP) < 0)
+		WARN_ERRNO("Could not exclude key cache memory from core dumps");
+
+	token_key_cache_entry_t *entry = mem_new0(token_key_cache_entry_t, 1);
+	entry->label = mem_strdup(label);
+	entry->wrapped_key = mem_memcpy(wrapped_key, wrapped_key_len);
+	entry->wrapped_key_len = wrapped_key_len;
+	entry->plain_key = map;
+	entry->plain_key_len = plain_key_len;
+	entry->plain_key_map_len = map_len;
+	entry->until = now + TOKEN_KEY_CACHE_TTL;
+	memcpy(entry->plain_key, plain_key, plain_key_len);
+
+	token->token_data->key_cache = list_append(token->token_data->key_cache, entry);
+}
+
+/*
+ * Returns 0 and a copy of the cached plain key if a key for label which was
+ * unwrapped from the same wrapped key is cached and not expired, -1 otherwise.
+ */
+static int
+token_key_cache_get(scd_token_t *token, const char *label, const unsigned char *wrapped_key,
+		    size_t wrapped_key_len, unsigned char **plain_key, int *plain_key_len)
+{
+	time_t now;
+
+	IF_TRUE_RETVAL(!label || token->is_locked(token), -1);
+
+	token_key_cache_entry_t *entry = token_key_cache_find(token, label);
+	IF_NULL_RETVAL(entry, -1);
+
+	if (!token_key_cache_now(&now) || now >= entry->until ||
+	    entry->wrapped_key_len != wrapped_key_len ||
+	    memcmp(entry->wrapped_key, wrapped_key, wrapped_key_len)) {
+		token_key_cache_remove(token, entry);
+		return -1;
+	}
+
+	*plain_key = mem_memcpy(entry->plain_key, entry->plain_key_len);
+	*plain_key_len = entry->plain_key_len;
+	return 0;
+}
+
+static int
+token_lock_cached(scd_token_t *token)
+{
+	token_key_cache_clear(token);
+	return token->token_data->int_lock(token);
+}
+
+static int
+token_wrap_key_cached(scd_token_t *token, char *label, unsigned char *plain_key,
+		      size_t plain_key_len, unsigned char **wrapped_key, int *wrapped_key_len)
+{
+	int ret = token->token_data->int_wrap_key(token, label, plain_key, plain_key_len,
+						  wrapped_key, wrapped_key_len);
+	if (ret == 0)
+		token_key_cache_put(token, label, *wrapped_key, *wrapped_key_len, plain_key,
+				    plain_key_len);
+	return ret;
+}
+
+static int
+token_unwrap_key_cached(scd_token_t *token, char *label, unsigned char *wrapped_key,
+			size_t wrapped_key_len, unsigned char **plain_key, int *plain_key_len)
+{
+	if (token_key_cache_get(token, label, wrapped_key, wrapped_key_len, plain_key,
+				plain_key_len) == 0) {
+		TRACE("Using cached key for label %s", label);
+		return 0;
+	}
+
+	int ret = token->token_data->int_unwrap_key(token, label, wrapped_key, wrapped_key_len,
+						    plain_key, plain_key_len);
+	if (ret == 0)
+		token_key_cache_put(token, label, wrapped_key, wrapped_key_len, *plain_key,
+				    *plain_key_len);
+	return ret;
+}
+
 scd_token_t *
 token_new(const token_constr_data_t *constr_data)
 {
@@ -498,7 +737,7 @@ token_new(const token_constr_data_t *constr_data)
 		return NULL;
 	}
 
-	new_token->token_data = mem_new(scd_token_data_t, 1);
+	new_token->token_data = mem_new0(scd_token_data_t, 1);
 	if (!new_token->token_data) {
 		ERROR("Could not allocate memory for token_data_t");
 		goto err;
@@ -590,6 +829,14 @@ token_new(const token_constr_data_t *constr_data)
 		goto err;
 	}
 
+	// route key handling through the key cache
+	new_token->token_data->int_lock = new_token->lock;
+	new_token->token_data->int_wrap_key = new_token->wrap_key;
+	new_token->token_data->int_unwrap_key = new_token->unwrap_key;
+	new_token->lock = token_lock_cached;
+	new_token->wrap_key = token_wrap_key_cached;
+	new_token->unwrap_key = token_unwrap_key_cached;
+
 	return new_token;
 
 err:
@@ -659,6 +906,7 @@ token_free(scd_token_t *token)
 			return;
 		}
 
+		token_key_cache_clear(token);
 		if (token->token_data->token_uuid)
 			uuid_free(token->token_data->token_uuid);
 		mem_free0(token->token_data);
@@ -36,10 +36,12 @@
 #include "common/ssl_util.h"
 #include "common/event.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
 
 #define TOKEN_MAX_AUTH_CODE_LEN 16
 #define TOKEN_KEY_LEN 32 /* must be coordinated with ssl_util.c */
@@ -50,9 +52,12 @@
 #define USBTOKEN_MAX_WRONG_UNLOCK_ATTEMPTS 3
 
 #define USBTOKEN_SE_COMM_MAX_RETRIES 5
-#define USBTOKEN_SE_COMM_TIMEOUT 10000 // check if card is still present every 10 sec
+#define USBTOKEN_SE_COMM_TIMEOUT 10000		// check if card is still present every 10 sec
+#define USBTOKEN_SE_COMM_TIMEOUT_IDLE_MAX 60000 // back off up to 60 sec while the SE is idle
+#define USBTOKEN_SE_COMM_TIMEOUT_RECONNECT 1000 // retry every sec after a communication error
 
 #define USBTOKEN_SUCCESS 0x9000
+#define USBTOKEN_SECURITY_STATUS_NOT_SATISFIED 0x6982
 #define USBTOKEN_FUNCTION_NOT_SUPPORTED 0x6A81
 
 //#undef LOGF_LOG_MIN_PRIO
@@ -70,6 +75,7 @@ struct usbtoken {
 	unsigned short port; // usb port of token reader
 
 	bool locked;			// whether the token is locked or not
+	bool authenticated;		// whether the user is verified in the current SE session
 	unsigned wrong_unlock_attempts; // wrong consecutive password attempts
 
 	// the authentication code is cached as long as the token remains unlocked
@@ -81,9 +87,14 @@ struct usbtoken {
 
 	bool se_comm;	     // state to show if communication to SE (card) is available
 	int se_comm_retries; // retry attempt after card removal (handle power glitches)
-	bool timer_fast;     // switch to fast timer for reconnect
+	int timer_timeout;   // current period of the watchdog timer in ms
+	time_t se_comm_last; // time of the last successful exchange with the SE
+	bool se_comm_watchdog; // whether the watchdog timer checks for card removal
 	event_timer_t *se_comm_watchdog_timer; // timer to check if card is removed
 
+	// serializes SE access of token operations running on scd worker threads
+	pthread_mutex_t se_mutex;
+
 	struct cardService *cs; // API of underlying SE
 };
 
@@ -202,6 +213,9 @@ usbtoken_reset_schsm_sess(usbtoken_t *token, unsigned char *brsp, size_t brsp_le
 		      token->port);
 		goto err;
 	}
+	// a new session requires the user to be verified again
+	token->authenticated = false;
+
 	if (NULL != token->latr)
 		mem_free0(token->latr);
 	token->latr = mem_memcpy(brsp, lr);
@@ -246,61 +260,99 @@ usbtoken_se_reconnect(usbtoken_t *token)
 
 	token->se_comm = (ret < 0) ? false : true;
 
-	if (token->se_comm && token->se_comm_watchdog_timer == NULL) {
-		token->se_comm_watchdog_timer =
-			event_timer_new(USBTOKEN_SE_COMM_TIMEOUT, EVENT_TIMER_REPEAT_FOREVER,
-					usbtoken_se_comm_watchdog_cb, token);
-		event_add_timer(token->se_comm_watchdog_timer);
-	}
+	/*
+	 * This may run on a worker thread, thus only (re)arm the watchdog
+	 * and leave the timer itself to the event loop.
+	 */
+	if (token->se_comm)
+		token->se_comm_watchdog = true;
 
 	return token->se_comm;
 }
 
+static time_t
+usbtoken_now(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+	return ts.tv_sec;
+}
+
+/*
+ * Records a successful exchange with the SE, which spares the next presence check
+ * of the watchdog. Must be called with se_mutex held.
+ */
+static void
+usbtoken_se_comm_touch(usbtoken_t *token)
+{
+	token->se_comm_last = usbtoken_now();
+}
+
 static void
-usbtoken_se_comm_switch_timer(usbtoken_t *token, bool fast)
+usbtoken_se_comm_set_timer(usbtoken_t *token, int timeout)
 {
-	if (token->timer_fast == fast)
+	if (token->timer_timeout == timeout)
 		return;
 
 	// remove current timer
 	event_remove_timer(token->se_comm_watchdog_timer);
 	event_timer_free(token->se_comm_watchdog_timer);
 
-	int new_timeout = fast ? 1000 : USBTOKEN_SE_COMM_TIMEOUT;
-
-	/*
-	 * add timer with new timeout:
-	 * fast timer for reconnecting, coarse timer during connection
-	 */
-	token->timer_fast = fast;
-	token->se_comm_watchdog_timer = event_timer_new(new_timeout, EVENT_TIMER_REPEAT_FOREVER,
+	token->timer_timeout = timeout;
+	token->se_comm_watchdog_timer = event_timer_new(timeout, EVENT_TIMER_REPEAT_FOREVER,
 							usbtoken_se_comm_watchdog_cb, token);
 	event_add_timer(token->se_comm_watchdog_timer);
+
+	TRACE("SE watchdog period set to %d ms", timeout);
 }
 
+/*
+ * Checks whether the SE is still present. The period adapts to the activity:
+ * an exchange by a token operation since the last tick already proved that the SE is
+ * present, thus no probe is sent. While the SE is idle, the period is doubled up to
+ * USBTOKEN_SE_COMM_TIMEOUT_IDLE_MAX to reduce wakeups, and it is reset on activity.
+ * After communication errors, reconnecting is retried with a short period.
+ */
 static void
 usbtoken_se_comm_watchdog_cb(UNUSED event_timer_t *timer, void *data)
 {
 	usbtoken_t *token = data;
 	ASSERT(data);
 
-	if (token->se_comm && usbtoken_is_card_present(token))
+	// a token operation currently uses the SE, check again on next tick
+	if (pthread_mutex_trylock(&token->se_mutex) != 0)
 		return;
 
+	IF_FALSE_GOTO(token->se_comm_watchdog, out);
+
+	if (token->se_comm) {
+		time_t now = usbtoken_now();
+
+		if ((now - token->se_comm_last) * 1000 < token->timer_timeout) {
+			usbtoken_se_comm_set_timer(token, USBTOKEN_SE_COMM_TIMEOUT);
+			goto out;
+		}
+		if (usbtoken_is_card_present(token)) {
+			token->se_comm_last = now;
+			usbtoken_se_comm_set_timer(token, MIN(token->timer_timeout * 2,
+							      USBTOKEN_SE_COMM_TIMEOUT_IDLE_MAX));
+			goto out;
+		}
+	}
+
 	token->se_comm_retries++;
 	TRACE("Card error retries: %d", token->se_comm_retries);
 
 	if (usbtoken_se_reconnect(token)) {
 		INFO("Successfully reconnected to SE after temporary communication error.");
 		token->se_comm_retries = 0;
-
-		// set coarse timeout, since we are connected again
-		usbtoken_se_comm_switch_timer(token, false);
-		return;
+		usbtoken_se_comm_touch(token);
+		usbtoken_se_comm_set_timer(token, USBTOKEN_SE_COMM_TIMEOUT);
+		goto out;
 	}
 
-	// set fast timer for reconnecting
-	usbtoken_se_comm_switch_timer(token, true);
+	usbtoken_se_comm_set_timer(token, USBTOKEN_SE_COMM_TIMEOUT_RECONNECT);
 
 	if (token->se_comm_retries >= USBTOKEN_SE_COMM_MAX_RETRIES) {
 		DEBUG("Notify cmld about removal of SE.");
@@ -310,10 +362,13 @@ usbtoken_se_comm_watchdog_cb(UNUSED event_timer_t *timer, void *data)
 		if (scd_control_send_event(SCD_EVENT_SE_REMOVED, uuid) < 0)
 			WARN("No listener connected, notification not send");
 
-		event_remove_timer(token->se_comm_watchdog_timer);
-		event_timer_free(token->se_comm_watchdog_timer);
-		token->se_comm_watchdog_timer = NULL;
+		// disarm until the SE is reconnected by a token operation
+		token->se_comm_watchdog = false;
+		token->se_comm_retries = 0;
+		usbtoken_se_comm_set_timer(token, USBTOKEN_SE_COMM_TIMEOUT);
 	}
+out:
+	pthread_mutex_unlock(&token->se_mutex);
 }
 
 /**
@@ -342,9 +397,12 @@ retry:
 
 	if (rc != USBTOKEN_SUCCESS) {
 		ERROR("Could not authenticate user to usb token, token rc: 0x%04x", rc);
+		token->authenticated = false;
 		return -2;
 	}
 
+	token->authenticated = true;
+	usbtoken_se_comm_touch(token);
 	return 0;
 }
 
@@ -360,24 +418,45 @@ produceKey(usbtoken_t *token, unsigned char *label, size_t label_len, unsigned c
 	   size_t key_len)
 {
 	int rc;
-
-	if ((rc = authenticateUser(token)) < 0) {
-		ERROR("Failed to authenticate to token");
-		return rc;
-	}
+	bool reauthenticated = false;
 
 	if ((NULL == label) || (0 == label_len)) {
 		ERROR("No label was provided for key derivation");
 		return -1;
-	} else {
-		rc = token->cs->deriveKey(token->ctn, label, label_len, key, key_len);
+	}
+
+	/*
+	 * The user stays verified for the whole SE session, thus the PIN verification
+	 * is only sent if the session was reset since the last successful one. Should
+	 * the SE nevertheless reject the derivation, verify and retry once.
+	 */
+retry:
+	if (!token->authenticated) {
+		if ((rc = authenticateUser(token)) < 0) {
+			ERROR("Failed to authenticate to token");
+			return rc;
+		}
+		reauthenticated = true;
+	}
+
+	rc = token->cs->deriveKey(token->ctn, label, label_len, key, key_len);
+	if (rc == USBTOKEN_SECURITY_STATUS_NOT_SATISFIED && !reauthenticated) {
+		DEBUG("USBTOKEN: SE session not authenticated anymore, verifying again");
+		token->authenticated = false;
+		goto retry;
 	}
 
 	if (rc < 0) {
 		ERROR("USBTOKEN: deriveKey failed");
 		return -1;
 	}
+	if (rc != USBTOKEN_SUCCESS) {
+		ERROR("USBTOKEN: deriveKey failed, token rc: 0x%04x", rc);
+		mem_memset0(key, key_len);
+		return -1;
+	}
 
+	usbtoken_se_comm_touch(token);
 	return 0;
 }
 
@@ -500,11 +579,13 @@ usbtoken_init_ctapi_int(usbtoken_t *token, unsigned char *brsp, size_t brsp_len)
 	if (0 > usbtoken_reset_schsm_sess(token, brsp, brsp_len)) {
 		WARN("Could not initiate schsm session, SE not yet present.");
 	} else {
-		token->se_comm_watchdog_timer =
-			event_timer_new(USBTOKEN_SE_COMM_TIMEOUT, EVENT_TIMER_REPEAT_FOREVER,
-					usbtoken_se_comm_watchdog_cb, token);
-		event_add_timer(token->se_comm_watchdog_timer);
+		token->se_comm_watchdog = true;
 	}
+	token->timer_timeout = USBTOKEN_SE_COMM_TIMEOUT;
+	token->se_comm_watchdog_timer =
+		event_timer_new(USBTOKEN_SE_COMM_TIMEOUT, EVENT_TIMER_REPEAT_FOREVER,
+				usbtoken_se_comm_watchdog_cb, token);
+	event_add_timer(token->se_comm_watchdog_timer);
 
 	DEBUG("Successfully initialized CTAPI session for reader with serial  %s", token->serial);
 
@@ -535,6 +616,7 @@ usbtoken_new(const char *serial)
 
 	token->locked = true;
 	token->se_comm = false;
+	pthread_mutex_init(&token->se_mutex, NULL);
 	token->ctn = ctn_get_unused();
 	token->serial = mem_strdup(serial);
 	IF_NULL_GOTO_ERROR(token->serial, err);
@@ -553,6 +635,7 @@ usbtoken_new(const char *serial)
 	return token;
 
 err:
+	pthread_mutex_destroy(&token->se_mutex);
 	mem_free0(token->serial);
 	mem_free0(token);
 	return NULL;
@@ -691,6 +774,9 @@ usbtoken_change_passphrase(usbtoken_t *token, const char *oldpass, const char *n
 		return -1;
 	}
 
+	// changing the PIN resets the verification of the user
+	token->authenticated = false;
+
 	return (is_provisioning ?
 			provision_auth_code(token, oldpass, newpass, pairing_secret,
 					    pairing_sec_len) :
@@ -734,9 +820,24 @@ usbtoken_free(usbtoken_t *token)
 	mem_free0(token->serial);
 	usbtoken_free_secrets(token);
 
+	pthread_mutex_destroy(&token->se_mutex);
 	mem_free0(token);
 }
 
+void
+usbtoken_se_acquire(usbtoken_t *token)
+{
+	ASSERT(token);
+	pthread_mutex_lock(&token->se_mutex);
+}
+
+void
+usbtoken_se_release(usbtoken_t *token)
+{
+	ASSERT(token);
+	pthread_mutex_unlock(&token->se_mutex);
+}
+
 /**
  * Wraps the plain key.
  */
@@ -1008,6 +1109,10 @@ retry:
 		return -1;
 	}
 
+	// the APDU may have changed the authentication state of the SE session
+	token->authenticated = false;
+	usbtoken_se_comm_touch(token);
+
 #ifdef DEBUG_BUILD
 	dump = str_hexdump_new(brsp, lr);
 	TRACE("Received APDU from USB token: len: %d, apdu: %s", lr, str_buffer(dump));
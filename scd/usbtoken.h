@@ -86,6 +86,22 @@ usbtoken_is_locked_till_reboot(usbtoken_t *token);
 void
 usbtoken_free(usbtoken_t *token);
 
+/**
+ * Acquires exclusive access to the SE of the usbtoken. Token operations which may
+ * run on a worker thread must hold it, the card removal watchdog skips its check
+ * while it is held.
+ * @param token the usbtoken to operate on
+ */
+void
+usbtoken_se_acquire(usbtoken_t *token);
+
+/**
+ * Releases the SE access acquired by usbtoken_se_acquire().
+ * @param token the usbtoken to operate on
+ */
+void
+usbtoken_se_release(usbtoken_t *token);
+
 /**
  * wraps a symmetric container key plain_key of length plain_key_len with a
  * symmetric key provided by the token into a wrapped key wrapped_key of
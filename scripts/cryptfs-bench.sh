@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+# This file is part of GyroidOS
+# Copyright(c) 2013 - 2024 Fraunhofer AISEC
+# Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU General Public License,
+# version 2 (GPL 2), as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, see <http://www.gnu.org/licenses/>
+#
+# The full GNU General Public License is included in this distribution in
+# the file called "COPYING".
+#
+# Contact Information:
+# Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+#
+
+# Usage
+#
+# cryptfs-bench.sh <block device>
+#
+# Measures the 4k random read and write latency of dm-crypt on top of the given
+# (scratch!) block device for the crypt_* options of device.conf, using the
+# same cipher as plain volumes set up by common/cryptfs.c. On fast storage such
+# as NVMe, skipping the kcryptd workqueues (no_read_workqueue and
+# no_write_workqueue) usually lowers the latency at queue depth 1, while 4096
+# byte sectors reduce the crypto overhead per request. The sector size is part
+# of the on-disk format, changing it requires recreating the volumes.
+#
+# ALL DATA ON THE DEVICE IS DESTROYED. Requires root, dmsetup and fio.
+
+set -e
+
+DEV=${1:?usage: $0 <block device>}
+NAME=cryptfs-bench
+KEY=$(head -c 64 /dev/urandom | od -An -tx1 | tr -d ' \n')
+SECTORS=$(blockdev --getsz "${DEV}")
+
+run() {
+	local label=$1
+	shift
+	local opts=("$@")
+	local sectors=$((SECTORS - SECTORS % 8))
+
+	echo "0 ${sectors} crypt aes-xts-plain64 ${KEY} 0 ${DEV} 0 ${#opts[@]} ${opts[*]}" |
+		dmsetup create "${NAME}"
+
+	for rw in randread randwrite; do
+		lat=$(fio --name=bench --filename=/dev/mapper/${NAME} --direct=1 --rw=${rw} \
+			--bs=4k --iodepth=1 --runtime=10 --time_based --output-format=terse \
+			--terse-version=3 | awk -F';' -v rw=${rw} \
+			'{ print (rw == "randread") ? $40 : $81 }')
+		printf "%-32s %-10s %10s us\n" "${label}" "${rw}" "${lat}"
+	done
+
+	dmsetup remove "${NAME}"
+}
+
+printf "%-32s %-10s %13s\n" "options" "workload" "mean latency"
+run "default" allow_discards
+run "no_read/write_workqueue" allow_discards no_read_workqueue no_write_workqueue
+run "same_cpu_crypt" allow_discards same_cpu_crypt
+run "submit_from_crypt_cpus" allow_discards submit_from_crypt_cpus
+run "sector_size:4096" allow_discards sector_size:4096
+run "no_workqueue + sector_size:4096" allow_discards no_read_workqueue no_write_workqueue \
+	sector_size:4096
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+#
+# This file is part of GyroidOS
+# Copyright(c) 2013 - 2024 Fraunhofer AISEC
+# Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU General Public License,
+# version 2 (GPL 2), as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, see <http://www.gnu.org/licenses/>
+#
+# The full GNU General Public License is included in this distribution in
+# the file called "COPYING".
+#
+# Contact Information:
+# Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+#
+
+
+# Usage
+#
+# logf-decode.py [--json] <binary log>...
+#
+# Decodes binary logs written by logf_binary_write, i.e., LogRecords of
+# common/logf.proto, each preceded by its length as varint. By default, the
+# records are printed like the text logs of logf_file_write. With --json, one
+# JSON object per record is printed. The wall clock time of a record is derived
+# from its monotonic timestamp and the last realtime anchor before it.
+
+import argparse
+import datetime
+import json
+import sys
+
+PRIOS = {
+    1: "<TRACE>",
+    2: "<DEBUG>",
+    3: "<INFO> ",
+    4: "<WARN> ",
+    5: "<ERROR>",
+    6: "<FATAL>",
+}
+FIELDS = {
+    1: "prio",
+    2: "file",
+    3: "line",
+    4: "pid",
+    5: "monotonic_ns",
+    6: "msg",
+    7: "realtime_ns",
+}
+
+
+def varint(buf, pos):
+    v = shift = 0
+    while True:
+        if pos >= len(buf):
+            raise ValueError("truncated varint")
+        b = buf[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return v, pos
+
+
+def decode_record(buf):
+    rec = {}
+    pos = 0
+    while pos < len(buf):
+        key, pos = varint(buf, pos)
+        field, wire = key >> 3, key & 7
+        if wire == 0:
+            v, pos = varint(buf, pos)
+        elif wire == 2:
+            n, pos = varint(buf, pos)
+            v = buf[pos : pos + n].decode("utf-8", "replace")
+            pos += n
+        else:
+            raise ValueError("unsupported wire type %d" % wire)
+        if field in FIELDS:
+            rec[FIELDS[field]] = v
+    return rec
+
+
+def records(f):
+    buf = f.read()
+    pos = 0
+    while pos < len(buf):
+        n, pos = varint(buf, pos)
+        if pos + n > len(buf):
+            sys.stderr.write("truncated record at offset %d\n" % pos)
+            return
+        yield decode_record(buf[pos : pos + n])
+        pos += n
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode binary logf logs")
+    parser.add_argument("--json", action="store_true", help="print records as JSON")
+    parser.add_argument("logs", nargs="+")
+    args = parser.parse_args()
+
+    for log in args.logs:
+        anchor = None  # (monotonic_ns, realtime_ns)
+        with open(log, "rb") as f:
+            for rec in records(f):
+                if "realtime_ns" in rec:
+                    anchor = (rec["monotonic_ns"], rec["realtime_ns"])
+                if anchor:
+                    rec["time_ns"] = anchor[1] + rec["monotonic_ns"] - anchor[0]
+                if args.json:
+                    print(json.dumps(rec, sort_keys=True))
+                    continue
+
+                time = ""
+                if "time_ns" in rec:
+                    t = datetime.datetime.fromtimestamp(rec["time_ns"] / 1e9)
+                    t = t.astimezone()
+                    time = t.isoformat(timespec="microseconds") + " "
+                site = ""
+                if "file" in rec:
+                    site = "%s+%d: " % (rec["file"], rec.get("line", 0))
+                prio = PRIOS.get(rec.get("prio"), "<???>")
+                msg = rec.get("msg", "")
+                print("%s[%d] %s %s%s" % (time, rec.get("pid", 0), prio, site, msg))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+#
+# This file is part of GyroidOS
+# Copyright(c) 2013 - 2024 Fraunhofer AISEC
+# Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU General Public License,
+# version 2 (GPL 2), as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, see <http://www.gnu.org/licenses/>
+#
+# The full GNU General Public License is included in this distribution in
+# the file called "COPYING".
+#
+# Contact Information:
+# Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+#
+
+# Usage
+#
+# mkdelta.py [-b <block size>] <base image> <target image> <delta>
+#
+# Generates a block-level delta of a guestos image, see daemon/delta.h for the
+# format. For an update of guestos <name> from version <base> to <version>, the
+# delta of <img>.img is published on the update server next to the image as
+#
+#   operatingsystems/<hw>/<name>-<version>/<img>.img.delta-<base>
+
+import argparse
+import hashlib
+import os
+import struct
+
+MAGIC = b"CMLDELT1"
+
+
+def blocks(f, bs):
+    while True:
+        b = f.read(bs)
+        if not b:
+            return
+        yield b
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a guestos image delta")
+    parser.add_argument("-b", "--block-size", type=int, default=4096)
+    parser.add_argument("base")
+    parser.add_argument("target")
+    parser.add_argument("delta")
+    args = parser.parse_args()
+    bs = args.block_size
+
+    # index the base image by block digest, the first occurrence wins
+    index = {}
+    with open(args.base, "rb") as f:
+        for i, b in enumerate(blocks(f, bs)):
+            index.setdefault(hashlib.sha256(b).digest(), i)
+
+    zero = bytes(bs)
+    records = []  # [op, count, base_block, data]
+    with open(args.base, "rb") as base, open(args.target, "rb") as f:
+        for b in blocks(f, bs):
+            if b == zero[: len(b)]:
+                op, blk = b"Z", 0
+            else:
+                blk = index.get(hashlib.sha256(b).digest())
+                if blk is not None:
+                    base.seek(blk * bs)
+                    if base.read(len(b)) != b:
+                        blk = None
+                op = b"D" if blk is None else b"C"
+                blk = blk or 0
+
+            last = records[-1] if records else None
+            if last and last[0] == op and (op != b"C" or last[2] + last[1] == blk):
+                last[1] += 1
+                if op == b"D":
+                    last[3].append(b)
+            else:
+                records.append([op, 1, blk, [b] if op == b"D" else []])
+
+    size = os.path.getsize(args.target)
+    stats = {b"C": 0, b"D": 0, b"Z": 0}
+    with open(args.delta, "wb") as out:
+        out.write(MAGIC + struct.pack(">IIQ", bs, 0, size))
+        for op, count, blk, data in records:
+            out.write(op + bytes(3) + struct.pack(">IQ", count, blk))
+            out.writelines(data)
+            stats[op] += count
+
+    print(
+        "%s: %d blocks copied, %d blocks of data, %d blocks of zeroes"
+        % (args.delta, stats[b"C"], stats[b"D"], stats[b"Z"])
+    )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,59 @@
+#!/bin/bash
+#
+# This file is part of GyroidOS
+# Copyright(c) 2013 - 2024 Fraunhofer AISEC
+# Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU General Public License,
+# version 2 (GPL 2), as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, see <http://www.gnu.org/licenses/>
+#
+# The full GNU General Public License is included in this distribution in
+# the file called "COPYING".
+#
+# Contact Information:
+# Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+#
+
+# Usage
+#
+# pgo-train.sh <container.conf> [<control.bench options>]
+#
+# Training run for the profile guided build of cmld, see the cmld-pgo-gen and
+# cmld-pgo-use targets of daemon/Makefile. Runs on the target, e.g. a CI VM with
+# cmld in hosted mode, while the instrumented cmld of cmld-pgo-gen is running.
+# The container lifecycle benchmark of control/control.bench.c is run with the
+# given container config, by default for 10 containers with a concurrency of 4.
+# Afterwards, cmld is terminated, as it only writes its profile on exit, to the
+# PGO_DIR it was built with. Copy that directory back to PGO_DIR on the build
+# host and run "make cmld-pgo-use".
+#
+# Requires root.
+
+set -e
+
+CONF=${1:?usage: $0 <container.conf> [<control.bench options>]}
+shift
+BENCH=${BENCH:-control.bench}
+
+if [ $# -eq 0 ]; then
+	set -- -n 10 -c 4 -i 2
+fi
+
+PID=$(pidof cmld) || { echo "cmld is not running" >&2; exit 1; }
+
+"${BENCH}" "$@" "${CONF}"
+
+# cmld stops all containers and exits on SIGTERM, which writes the profile
+kill -TERM "${PID}"
+while kill -0 "${PID}" 2>/dev/null; do
+	sleep 1
+done
+echo "cmld exited, the profile is complete"
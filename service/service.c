@@ -40,12 +40,14 @@
 #include "common/dir.h"
 #include "common/str.h"
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "dumb_init.h"
 
@@ -56,11 +58,21 @@
 #define LOGFILE_DIR "/tmp/log/"
 #define AUDIT_LOGDIR "/var/log/cmld_audit/"
 
+/* number of audit records cmld may send before they are acknowledged */
+#define AUDIT_WINDOW 8
+
 //#undef LOGF_LOG_MIN_PRIO
 //#define LOGF_LOG_MIN_PRIO LOGF_PRIO_TRACE
 
 char *LAST_AUDIT_HASH;
 
+/*
+ * After failing to store a record, the following records already sent by cmld are dropped
+ * until cmld sends the failed record again.
+ */
+static bool audit_resync = false;
+static uint64_t audit_resync_seq = 0;
+
 static logf_handler_t *service_logfile_handler = NULL;
 static FILE *service_logfile = NULL;
 
@@ -172,69 +184,103 @@ service_fork_execvp(char *prog, char **argv)
 	return 0;
 }
 
-static int
-process_audit_record(CmldToServiceMessage *msg, uint8_t *buf, uint32_t buf_len)
+/*
+ * Stores the records in order. All records are hashed by a single run of sha512sum, the
+ * hash of the last stored record is acknowledged to cmld.
+ *
+ * @return the number of records stored before the first failure
+ */
+static size_t
+audit_store_records(CmldToServiceMessage **msgs, const ProtobufCBinaryData *bufs, size_t n)
 {
-	ASSERT(msg);
+	char **tmpfiles = mem_new0(char *, n);
+	str_t *cmd = str_new("sha512sum");
+	size_t written = 0, stored = 0;
+
+	for (; written < n; written++) {
+		char *tmpfile = mem_strdup("/tmp/audit_XXXXXX");
+		int fd = mkstemp(tmpfile);
+		if (-1 == fd) {
+			ERROR_ERRNO("Failed to generate temporary filename");
+			mem_free0(tmpfile);
+			break;
+		}
 
-	int ret = -1;
+		//TODO find reason why received buffer contains trailing null byte
+		int ret = fd_write(fd, (char *)bufs[written].data, bufs[written].len);
+		close(fd);
+		if (0 > ret) {
+			ERROR("Failed to write file");
+			if (unlink(tmpfile))
+				ERROR_ERRNO("Failed to unlink %s", tmpfile);
+			mem_free0(tmpfile);
+			break;
+		}
 
-	char tmpfile[] = "/tmp/audit_XXXXXX";
-	if (-1 == mkstemp(tmpfile)) {
-		ERROR_ERRNO("Failed to generate temporary filename");
-		return -1;
+		tmpfiles[written] = tmpfile;
+		str_append_printf(cmd, " %s", tmpfile);
 	}
 
-	//TODO find reason why received buffer contains trailing null byte
-	if (0 > file_write(tmpfile, (char *)buf, buf_len)) {
-		ERROR("Failed to write file");
-
-		if (unlink(tmpfile))
-			ERROR_ERRNO("Failed to unlink %s", tmpfile);
+	FILE *hash_file = written ? popen(str_buffer(cmd), "r") : NULL;
+	char *line = NULL;
+	size_t line_size = 0;
 
-		return ret;
-	}
+	for (; hash_file && stored < written; stored++) {
+		// each line of the output is the hash followed by the file name
+		if (-1 == getline(&line, &line_size, hash_file) || strlen(line) < 128) {
+			ERROR("Hash length was smaller than 64 bytes");
+			break;
+		}
 
-	char *cmd = mem_printf("sha512sum /%s", tmpfile);
-	FILE *hash_file = popen(cmd, "r");
-	char *hash_buf = mem_alloc0(129);
+		if (!file_is_dir(AUDIT_LOGDIR) && dir_mkdir_p(AUDIT_LOGDIR, 0600)) {
+			ERROR("Failed to create audit log directory");
+			break;
+		}
 
-	if (!fgets(hash_buf, 129, hash_file)) {
-		ERROR("Hash length was smaller than 64 bytes");
-		pclose(hash_file);
-		mem_free0(hash_buf);
-		goto out;
-	}
-	pclose(hash_file);
+		if (!msgs[stored]->audit_record) {
+			WARN("Got empty audit message from cmld");
+			break;
+		}
 
-	if (!file_is_dir(AUDIT_LOGDIR) && dir_mkdir_p(AUDIT_LOGDIR, 0600)) {
-		ERROR("Failed to create audit log directory");
-	} else if (msg->audit_record) {
 		char *record;
 		size_t msg_len = protobuf_string_from_message(
-			&record, (ProtobufCMessage *)msg->audit_record, NULL);
+			&record, (ProtobufCMessage *)msgs[stored]->audit_record, NULL);
 		TRACE("Storing audit record %s", record);
 		file_write_append(AUDIT_LOGDIR "/audit.log", record, msg_len);
 
 		mem_free0(LAST_AUDIT_HASH);
-		LAST_AUDIT_HASH = hash_buf;
-		ret = 0;
-	} else {
-		WARN("Got empty audit message from cmld");
+		LAST_AUDIT_HASH = mem_strndup(line, 128);
 	}
 
-out:
-	if (unlink(tmpfile))
-		ERROR_ERRNO("Failed to unlink %s", tmpfile);
+	if (hash_file)
+		pclose(hash_file);
+	free(line);
 
-	return ret;
+	for (size_t i = 0; i < written; i++) {
+		if (unlink(tmpfiles[i]))
+			ERROR_ERRNO("Failed to unlink %s", tmpfiles[i]);
+		mem_free0(tmpfiles[i]);
+	}
+	mem_free0(tmpfiles);
+	str_free(cmd, true);
+
+	return stored;
 }
 
 static int
-audit_send_ack(int sock, const char *hash)
+audit_send_ack(int sock, const char *hash, const CmldToServiceMessage *record_msg)
 {
 	ServiceToCmldMessage auditmsg = SERVICE_TO_CMLD_MESSAGE__INIT;
 	auditmsg.code = SERVICE_TO_CMLD_MESSAGE__CODE__AUDIT_ACK;
+	auditmsg.has_audit_window = true;
+	auditmsg.audit_window = AUDIT_WINDOW;
+	auditmsg.has_audit_batch = true;
+	auditmsg.audit_batch = true;
+
+	if (record_msg && record_msg->has_audit_seq) {
+		auditmsg.has_audit_seq = true;
+		auditmsg.audit_seq = record_msg->audit_seq;
+	}
 
 	if (hash) {
 		auditmsg.audit_ack = mem_strdup((char *)hash);
@@ -249,6 +295,43 @@ audit_send_ack(int sock, const char *hash)
 	return 0;
 }
 
+/*
+ * Stores the records of an AUDIT_RECORD or AUDIT_RECORDS message and answers them by a
+ * single cumulative ACK. If storing a record failed, the ACK with the hash of the last
+ * stored record triggers the delivery of the failed record again.
+ */
+static int
+audit_process_records(int fd, CmldToServiceMessage **msgs, const ProtobufCBinaryData *bufs,
+		      size_t n)
+{
+	size_t i = 0;
+
+	for (; i < n && audit_resync && msgs[i]->has_audit_seq &&
+	       msgs[i]->audit_seq > audit_resync_seq;
+	     i++) {
+		TRACE("Dropping audit record %" PRIu64 " until record %" PRIu64 " is sent again",
+		      msgs[i]->audit_seq, audit_resync_seq);
+	}
+
+	if (i < n) {
+		size_t stored = audit_store_records(&msgs[i], &bufs[i], n - i);
+		if (stored < n - i) {
+			ERROR("Failed to process audit record");
+			audit_resync = msgs[i + stored]->has_audit_seq;
+			audit_resync_seq = msgs[i + stored]->audit_seq;
+		} else {
+			audit_resync = false;
+		}
+	}
+
+	// the ACK refers to the first record, which is the resent one after a failure
+	if (0 != audit_send_ack(fd, LAST_AUDIT_HASH, msgs[0])) {
+		ERROR("Failed to send ack to cmld");
+		return -1;
+	}
+	return 0;
+}
+
 static void
 service_cb_recv_message(int fd, unsigned events, event_io_t *io, UNUSED void *data)
 {
@@ -283,7 +366,8 @@ service_cb_recv_message(int fd, unsigned events, event_io_t *io, UNUSED void *da
 				      ", start fetching...",
 				      msg->audit_remaining_storage);
 
-				if (0 != audit_send_ack(fd, LAST_AUDIT_HASH)) {
+				audit_resync = false;
+				if (0 != audit_send_ack(fd, LAST_AUDIT_HASH, NULL)) {
 					ERROR("Failed to send ack to cmld");
 				} else {
 					awaiting_record = true;
@@ -292,19 +376,33 @@ service_cb_recv_message(int fd, unsigned events, event_io_t *io, UNUSED void *da
 		} else if (CMLD_TO_SERVICE_MESSAGE__CODE__AUDIT_RECORD == msg->code) {
 			TRACE("Got audit record from cmld");
 
-			awaiting_record = false;
-			if (0 != process_audit_record(msg, buf, buf_len)) {
-				ERROR("Failed to process audit record");
-			}
+			ProtobufCBinaryData record_buf = { .len = buf_len, .data = buf };
+			awaiting_record = 0 == audit_process_records(fd, &msg, &record_buf, 1);
 
-			// if processing of the last record failed,
-			// send ACK with old hash to trigger delivery again
-			if (0 != audit_send_ack(fd, LAST_AUDIT_HASH)) {
-				ERROR("Failed to send ack to cmld");
-			} else {
-				awaiting_record = true;
+			goto out;
+		} else if (CMLD_TO_SERVICE_MESSAGE__CODE__AUDIT_RECORDS == msg->code) {
+			TRACE("Got %zu audit records from cmld", msg->n_audit_records);
+
+			size_t n = msg->n_audit_records;
+			CmldToServiceMessage **records =
+				mem_new0(CmldToServiceMessage *, MAX(n, 1));
+			for (size_t i = 0; i < n; i++) {
+				records[i] = (CmldToServiceMessage *)protobuf_unpack_message(
+					&cmld_to_service_message__descriptor,
+					msg->audit_records[i].data, msg->audit_records[i].len);
+				if (!records[i]) {
+					ERROR("Failed to decode audit record %zu of batch", i);
+					n = i;
+				}
 			}
 
+			awaiting_record = n && 0 == audit_process_records(fd, records,
+									  msg->audit_records, n);
+
+			for (size_t i = 0; i < msg->n_audit_records && records[i]; i++)
+				protobuf_free_message((ProtobufCMessage *)records[i]);
+			mem_free0(records);
+
 			goto out;
 		} else if (CMLD_TO_SERVICE_MESSAGE__CODE__AUDIT_COMPLETE == msg->code) {
 			TRACE("Fetched all available audit records");
@@ -352,28 +450,10 @@ open_service_socket()
 	return sock;
 }
 
-static int
-container_close_all_fds_cb(UNUSED const char *path, const char *file, UNUSED void *data)
-{
-	int fd = atoi(file);
-
-	DEBUG("Closing file descriptor %d", fd);
-
-	if (close(fd) < 0)
-		WARN_ERRNO("Could not close file descriptor %d", fd);
-
-	return 0;
-}
-
 static int
 service_close_all_fds()
 {
-	if (dir_foreach("/proc/self/fd", &container_close_all_fds_cb, NULL) < 0) {
-		WARN("Could not open /proc/self/fd directory, /proc not mounted?");
-		return -1;
-	}
-
-	return 0;
+	return fd_close_all(0, NULL, 0);
 }
 
 static void
@@ -417,7 +497,7 @@ fork_service_message_handler()
 			event_io_new(*sock_ptr, EVENT_IO_READ, service_cb_recv_message, NULL);
 		event_add_io(event);
 
-		if (0 != audit_send_ack(*sock_ptr, LAST_AUDIT_HASH)) {
+		if (0 != audit_send_ack(*sock_ptr, LAST_AUDIT_HASH, NULL)) {
 			ERROR("Failed to send ack to cmld");
 		}
 
@@ -429,6 +509,36 @@ fork_service_message_handler()
 	}
 }
 
+/*
+ * Reports the given readiness milestones to cmld, like sd_notify() reports the readiness
+ * of a service to systemd, e.g. by "cml-service-container notify network-online".
+ */
+static int
+service_notify_milestones(int sock, int argc, char **argv)
+{
+	int ret = 0;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	for (int i = 0; i < argc; i++) {
+		ServiceToCmldMessage msg = SERVICE_TO_CMLD_MESSAGE__INIT;
+		msg.code = SERVICE_TO_CMLD_MESSAGE__CODE__MILESTONE;
+		msg.milestone = argv[i];
+		msg.has_milestone_time = true;
+		msg.milestone_time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+		if (protobuf_send_message(sock, (ProtobufCMessage *)&msg) < 0) {
+			ERROR("Could not send milestone %s", argv[i]);
+			ret = -1;
+		} else {
+			INFO("Reported milestone %s", argv[i]);
+		}
+	}
+
+	return ret;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -450,6 +560,12 @@ main(int argc, char **argv)
 		FATAL("Failed to open service socket. Aborting...");
 	}
 
+	if (argc >= 2 && !strcmp(argv[1], "notify")) {
+		int ret = service_notify_milestones(sock, argc - 2, &argv[2]);
+		close(sock);
+		return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 #ifndef BOOT_COMPLETE_ONLY
 	// set hostname received from cmld
 	if (service_set_hostname(sock) < 0)
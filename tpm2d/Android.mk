@@ -48,6 +48,7 @@ LOCAL_SRC_FILES := \
 	tpm2d.proto \
 	control.c \
 	rcontrol.c \
+	tpm2d_sched.c \
 	tpm2_commands.c \
 	nvmcrypt.c \
 	ml.c \
@@ -29,6 +29,7 @@
 #endif
 
 #include "tpm2d.h"
+#include "tpm2d_sched.h"
 #include "nvmcrypt.h"
 #include "ml.h"
 #include "ek.h"
@@ -40,7 +41,9 @@
 #include "common/event.h"
 #include "common/list.h"
 #include "common/file.h"
+#include "common/hex.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/protobuf-text.h"
 
 #include <google/protobuf-c/protobuf-c-text.h>
@@ -114,12 +117,31 @@ tpm2d_control_get_algid_from_proto(HashAlgLen hash_alg_len)
 	}
 }
 
+/**
+ * Sends the reply of a command, unless the client disconnected while it was queued.
+ */
 static void
-tpm2d_control_handle_message(const ControllerToTpm *msg, int fd, tpm2d_control_t *control)
+tpm2d_control_reply(protobuf_conn_t *conn, const TpmToController *out)
 {
-	ASSERT(control);
+	IF_NULL_RETURN_TRACE(conn);
+	protobuf_send_message(protobuf_conn_get_fd(conn), (ProtobufCMessage *)out);
+}
 
-	TRACE("Handle message from client fd=%d", fd);
+/**
+ * Returns the priority class of a command, measurements are on the start path of
+ * containers, the other commands are interactive or needed to unlock storage.
+ */
+static tpm2d_sched_class_t
+tpm2d_control_sched_class(ControllerToTpm__Code code)
+{
+	return (code == CONTROLLER_TO_TPM__CODE__ML_APPEND) ? TPM2D_SCHED_EXTEND :
+							      TPM2D_SCHED_KEY;
+}
+
+static void
+tpm2d_control_handle_message(const ControllerToTpm *msg, protobuf_conn_t *conn)
+{
+	TRACE("Handle message from client fd=%d", conn ? protobuf_conn_get_fd(conn) : -1);
 
 	if (NULL == msg) {
 		WARN("msg=NULL, returning");
@@ -135,8 +157,6 @@ tpm2d_control_handle_message(const ControllerToTpm *msg, int fd, tpm2d_control_t
 			free(msg_text);
 	}
 
-	tss2_init();
-
 	switch (msg->code) {
 	case CONTROLLER_TO_TPM__CODE__DMCRYPT_SETUP: {
 		TpmToController out = TPM_TO_CONTROLLER__INIT;
@@ -144,7 +164,7 @@ tpm2d_control_handle_message(const ControllerToTpm *msg, int fd, tpm2d_control_t
 		out.has_fde_response = true;
 		nvmcrypt_fde_state_t state = nvmcrypt_dm_setup(msg->dmcrypt_device, msg->password);
 		out.fde_response = tpm2d_control_fdestate_to_proto(state);
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		tpm2d_control_reply(conn, &out);
 	} break;
 	case CONTROLLER_TO_TPM__CODE__EXIT: {
 		INFO("Received EXIT command!");
@@ -156,7 +176,7 @@ tpm2d_control_handle_message(const ControllerToTpm *msg, int fd, tpm2d_control_t
 		uint8_t *rand = tpm2_getrandom_new(msg->rand_size);
 		char *rand_hex = convert_bin_to_hex_new(rand, msg->rand_size);
 		out.rand_data = rand_hex;
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		tpm2d_control_reply(conn, &out);
 		if (rand)
 			mem_free0(rand);
 		if (rand_hex)
@@ -170,7 +190,7 @@ tpm2d_control_handle_message(const ControllerToTpm *msg, int fd, tpm2d_control_t
 		int ret = tpm2_clear(msg->password);
 		ret |= tpm2_dictionaryattacklockreset(msg->password);
 		out.response = tpm2d_control_resp_to_proto(ret ? CMD_FAILED : CMD_OK);
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		tpm2d_control_reply(conn, &out);
 	} break;
 	case CONTROLLER_TO_TPM__CODE__DMCRYPT_LOCK: {
 		TpmToController out = TPM_TO_CONTROLLER__INIT;
@@ -178,7 +198,7 @@ tpm2d_control_handle_message(const ControllerToTpm *msg, int fd, tpm2d_control_t
 		out.has_fde_response = true;
 		nvmcrypt_fde_state_t state = nvmcrypt_dm_lock(msg->password);
 		out.fde_response = tpm2d_control_fdestate_to_proto(state);
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		tpm2d_control_reply(conn, &out);
 	} break;
 	case CONTROLLER_TO_TPM__CODE__CHANGE_OWNER_PWD: {
 		TpmToController out = TPM_TO_CONTROLLER__INIT;
@@ -186,7 +206,7 @@ tpm2d_control_handle_message(const ControllerToTpm *msg, int fd, tpm2d_control_t
 		out.has_response = true;
 		int ret = tpm2_hierarchychangeauth(TPM_RH_OWNER, msg->password, msg->password_new);
 		out.response = tpm2d_control_resp_to_proto(ret ? CMD_FAILED : CMD_OK);
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		tpm2d_control_reply(conn, &out);
 	} break;
 	case CONTROLLER_TO_TPM__CODE__DMCRYPT_RESET: {
 		TpmToController out = TPM_TO_CONTROLLER__INIT;
@@ -194,7 +214,7 @@ tpm2d_control_handle_message(const ControllerToTpm *msg, int fd, tpm2d_control_t
 		out.has_fde_response = true;
 		nvmcrypt_fde_state_t state = nvmcrypt_dm_reset(msg->password);
 		out.fde_response = tpm2d_control_fdestate_to_proto(state);
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		tpm2d_control_reply(conn, &out);
 	} break;
 	case CONTROLLER_TO_TPM__CODE__ML_APPEND: {
 		TpmToController out = TPM_TO_CONTROLLER__INIT;
@@ -204,55 +224,71 @@ tpm2d_control_handle_message(const ControllerToTpm *msg, int fd, tpm2d_control_t
 			msg->ml_filename, tpm2d_control_get_algid_from_proto(msg->ml_hashalg),
 			msg->ml_datahash.data, msg->ml_datahash.len);
 		out.response = tpm2d_control_resp_to_proto(ret ? CMD_FAILED : CMD_OK);
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		tpm2d_control_reply(conn, &out);
 	} break;
 	default:
 		WARN("ControllerToTpm command %d unknown or not implemented yet", msg->code);
 		break;
 	}
-	tss2_destroy();
+}
+
+static void
+tpm2d_control_run_job(protobuf_conn_t *conn, void *data)
+{
+	tpm2d_control_handle_message(data, conn);
+}
+
+static void
+tpm2d_control_free_job(void *data)
+{
+	protobuf_free_message(data);
 }
 
 /**
- * Event callback for incoming data that a ControllerToTpm message.
+ * Callback for a ControllerToTpm message received on a control connection.
  *
- * The handle_message function will be called to handle the received message.
+ * The command is queued in its priority class and handled by tpm2d_control_handle_message().
  *
- * @param fd	    file descriptor of the client connection
- *		    from which the incoming message is read
- * @param events    event flags
- * @param io	    pointer to associated event_io_t struct
+ * @param conn	    the client connection from which the message was received
+ * @param msg	    the received ControllerToTpm message
  * @param data	    pointer to this tpm2d_control_t struct
  */
 static void
-tpm2d_control_cb_recv_message(int fd, unsigned events, event_io_t *io, void *data)
+tpm2d_control_cb_recv_message(protobuf_conn_t *conn, ProtobufCMessage *msg, void *data)
 {
 	tpm2d_control_t *control = data;
 	ASSERT(control);
+	int fd = protobuf_conn_get_fd(conn);
 
-	if (events & EVENT_IO_READ) {
-		ControllerToTpm *msg = (ControllerToTpm *)protobuf_recv_message(
-			fd, &controller_to_tpm__descriptor);
-		// close connection if client EOF, or protocol parse error
-		IF_NULL_GOTO_TRACE(msg, connection_err);
+	// the message is freed after the callback, the command is executed later from the queue
+	ControllerToTpm *copy = (ControllerToTpm *)protobuf_dup_message(msg);
+	IF_NULL_RETURN_ERROR(copy);
 
-		tpm2d_control_handle_message(msg, fd, control);
-		protobuf_free_message((ProtobufCMessage *)msg);
-		DEBUG("Handled control connection %d", fd);
-	}
-	if (events & EVENT_IO_EXCEPT) {
-		INFO("Client closed connection; disconnecting control socket.");
-		goto connection_err;
-	}
-	return;
+	tpm2d_sched_submit(tpm2d_control_sched_class(copy->code), conn, tpm2d_control_run_job,
+			   tpm2d_control_free_job, copy);
+	DEBUG("Queued command %d of control connection %d", copy->code, fd);
+}
+
+/**
+ * Callback for a control connection which was closed by the client or
+ * which had to be closed due to an I/O or protocol parse error.
+ *
+ * @param conn	    the client connection to be closed
+ * @param data	    pointer to this tpm2d_control_t struct
+ */
+static void
+tpm2d_control_cb_close(protobuf_conn_t *conn, UNUSED void *data)
+{
+	int fd = protobuf_conn_get_fd(conn);
 
-connection_err:
-	event_remove_io(io);
-	event_io_free(io);
+	INFO("Client closed connection; disconnecting control socket.");
+	// queued commands are still executed, e.g., measurements are still extended
+	tpm2d_sched_detach_conn(conn);
+	protobuf_conn_free(conn);
 	if (close(fd) < 0)
 		WARN_ERRNO("Failed to close connected control socket");
-	return;
 }
+
 /**
  * Event callback for accepting incoming connections on the listening socket.
  *
@@ -285,11 +321,11 @@ tpm2d_control_cb_accept(int fd, unsigned events, event_io_t *io, void *data)
 	}
 	DEBUG("Accepted control connection %d", cfd);
 
-	fd_make_non_blocking(cfd);
-
-	event_io_t *event =
-		event_io_new(cfd, EVENT_IO_READ, tpm2d_control_cb_recv_message, control);
-	event_add_io(event);
+	if (!protobuf_conn_new(cfd, &controller_to_tpm__descriptor, tpm2d_control_cb_recv_message,
+			       tpm2d_control_cb_close, control)) {
+		WARN("Could not set up control connection %d", cfd);
+		close(cfd);
+	}
 }
 
 static event_io_t *event;
@@ -26,8 +26,10 @@
 
 #include "common/macro.h"
 #include "common/mem.h"
-#include "common/list.h"
 #include "common/file.h"
+#include "common/hashmap.h"
+
+#include <openssl/evp.h>
 
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -45,11 +47,47 @@ typedef struct ml_elem {
 	TPM_ALG_ID algid;
 	int hash_len;
 	uint8_t *datahash;
-	tpm2d_pcr_t *template;
+	tpm2d_pcr_t *template; // PCR value after the extend, NULL until resolved
+	MlContainerEntry entry; // protobuf entry referencing the fields above once resolved
 } ml_elem_t;
 
-static list_t *measurement_list = NULL;
+/*
+ * The container measurement list only grows, thus it is stored in an array. The protobuf
+ * entries of the elements are built once after their templates are resolved and the
+ * first measurement_list_n_entries of them are kept in measurement_list_entries to hand
+ * them out without copying.
+ */
+static ml_elem_t **measurement_list = NULL;
+static MlContainerEntry **measurement_list_entries = NULL;
 static size_t measurement_list_len = 0;
+static size_t measurement_list_size = 0;
+static size_t measurement_list_resolved = 0;
+static size_t measurement_list_n_entries = 0;
+
+// set of all elements of measurement_list to detect duplicates
+static hashmap_t *measurement_set = NULL;
+
+static size_t
+ml_elem_hash(const void *key)
+{
+	const ml_elem_t *ml_elem = key;
+	size_t hash = hashmap_str_hash(ml_elem->filename);
+
+	for (int i = 0; i < ml_elem->hash_len; i++)
+		hash = hash * 31 + ml_elem->datahash[i];
+
+	return hash;
+}
+
+static bool
+ml_elem_equal(const void *a, const void *b)
+{
+	const ml_elem_t *ml_a = a;
+	const ml_elem_t *ml_b = b;
+
+	return ml_a->hash_len == ml_b->hash_len && !strcmp(ml_a->filename, ml_b->filename) &&
+	       !memcmp(ml_a->datahash, ml_b->datahash, ml_a->hash_len);
+}
 
 int
 ml_measurement_list_append(const char *filename, TPM_ALG_ID algid, const uint8_t *datahash,
@@ -60,16 +98,16 @@ ml_measurement_list_append(const char *filename, TPM_ALG_ID algid, const uint8_t
 	IF_NULL_RETVAL(datahash, -1);
 	IF_FALSE_RETVAL((datahash_len > 0), -1);
 
+	if (!measurement_set)
+		measurement_set = hashmap_new(ml_elem_hash, ml_elem_equal);
+
 	// check if filehash is in list
-	for (list_t *l = measurement_list; l; l = l->next) {
-		ml_elem_t *ml_elem = l->data;
-		if (NULL == ml_elem)
-			continue;
-		if ((0 == memcmp(ml_elem->datahash, datahash, datahash_len)) &&
-		    (0 == memcmp(ml_elem->filename, filename, strlen(filename)))) {
-			return 0; // container image with that name alread in list
-		}
-	}
+	ml_elem_t key = { .filename = (char *)filename,
+			  .hash_len = datahash_len,
+			  .datahash = (uint8_t *)datahash };
+	if (hashmap_contains(measurement_set, &key))
+		return 0; // container image with that name alread in list
+
 	INFO("Appending new hash for %s len=%zu", filename, datahash_len);
 	// new hash to be added
 	ml_elem_t *new_ml_elem = mem_new0(ml_elem_t, 1);
@@ -80,16 +118,97 @@ ml_measurement_list_append(const char *filename, TPM_ALG_ID algid, const uint8_t
 
 	new_ml_elem->algid = algid;
 
-	// extend to TPM
+	// extend to TPM, the template is resolved lazily by ml_get_container_list()
 	int ret = tpm2_pcrextend(CONTAINER_PCR_INDEX, TPM2D_HASH_ALGORITHM, datahash, datahash_len);
 	if (ret) {
 		ERROR("tpm extend failed");
 	}
-	// store the template as in the ML elem
-	new_ml_elem->template = tpm2_pcrread_new(CONTAINER_PCR_INDEX, TPM2D_HASH_ALGORITHM);
 
-	measurement_list = list_append(measurement_list, new_ml_elem);
-	measurement_list_len++;
+	if (measurement_list_len == measurement_list_size) {
+		measurement_list_size = MAX(2 * measurement_list_size, (size_t)16);
+		measurement_list = mem_renew(ml_elem_t *, measurement_list, measurement_list_size);
+		measurement_list_entries = mem_renew(MlContainerEntry *, measurement_list_entries,
+						     measurement_list_size);
+	}
+	measurement_list[measurement_list_len++] = new_ml_elem;
+	hashmap_put(measurement_set, new_ml_elem, new_ml_elem);
+
+	return 0;
+}
+
+/*
+ * Resolves the templates, i.e., the PCR values after each extend, of the elements
+ * appended since the last call. Instead of reading the PCR after each extend, the
+ * extends are replayed in software starting from the last resolved template or the
+ * zero initialized PCR. The result is checked against a single read of the PCR.
+ */
+static int
+ml_measurement_list_resolve_templates(void)
+{
+	const EVP_MD *md;
+	uint8_t pcr[EVP_MAX_MD_SIZE] = { 0 };
+	ml_elem_t *last = NULL;
+
+	IF_TRUE_RETVAL(measurement_list_resolved == measurement_list_len, 0);
+	if (measurement_list_resolved > 0)
+		last = measurement_list[measurement_list_resolved - 1];
+
+	switch (TPM2D_HASH_ALGORITHM) {
+	case TPM_ALG_SHA1:
+		md = EVP_sha1();
+		break;
+	case TPM_ALG_SHA256:
+		md = EVP_sha256();
+		break;
+	case TPM_ALG_SHA384:
+		md = EVP_sha384();
+		break;
+	default:
+		ERROR("Unsupported PCR hash algorithm");
+		return -1;
+	}
+	size_t md_size = EVP_MD_size(md);
+
+	if (last)
+		memcpy(pcr, last->template->pcr_value, MIN(last->template->pcr_size, md_size));
+
+	for (size_t i = measurement_list_resolved; i < measurement_list_len; i++) {
+		ml_elem_t *ml_elem = measurement_list[i];
+		// tpm2_pcrextend() zero-pads the digest to the size of the bank
+		uint8_t digest[EVP_MAX_MD_SIZE] = { 0 };
+		memcpy(digest, ml_elem->datahash, MIN((size_t)ml_elem->hash_len, md_size));
+
+		EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+		IF_NULL_RETVAL_ERROR(mdctx, -1);
+		if (!EVP_DigestInit(mdctx, md) || !EVP_DigestUpdate(mdctx, pcr, md_size) ||
+		    !EVP_DigestUpdate(mdctx, digest, md_size) ||
+		    !EVP_DigestFinal(mdctx, pcr, NULL)) {
+			ERROR("Failed to replay measurement of %s", ml_elem->filename);
+			EVP_MD_CTX_free(mdctx);
+			return -1;
+		}
+		EVP_MD_CTX_free(mdctx);
+
+		ml_elem->template = mem_new0(tpm2d_pcr_t, 1);
+		ml_elem->template->halg_id = TPM2D_HASH_ALGORITHM;
+		ml_elem->template->pcr_size = md_size;
+		ml_elem->template->pcr_value = mem_memcpy(pcr, md_size);
+		last = ml_elem;
+		measurement_list_resolved++;
+	}
+
+	tpm2d_pcr_t *pcr_read = tpm2_pcrread_new(CONTAINER_PCR_INDEX, TPM2D_HASH_ALGORITHM);
+	if (!pcr_read) {
+		WARN("Could not read PCR %d to check the measurement list", CONTAINER_PCR_INDEX);
+		return 0;
+	}
+	if (pcr_read->pcr_size != md_size || memcmp(pcr_read->pcr_value, pcr, md_size)) {
+		WARN("PCR %d does not match the replayed measurement list", CONTAINER_PCR_INDEX);
+		tpm2_pcrread_free(last->template);
+		last->template = pcr_read;
+		return 0;
+	}
+	tpm2_pcrread_free(pcr_read);
 
 	return 0;
 }
@@ -109,6 +228,18 @@ halg_id_to_ima_string(TPM_ALG_ID alg_id)
 	}
 }
 
+/*
+ * The IMA measurement list only grows until reboot, thus its content is cached and only
+ * entries appended since the last call are read. The file is a seq_file whose size cannot
+ * be determined beforehand, therefore it is read in chunks into a geometrically growing
+ * buffer.
+ */
+#define IMA_LIST_READ_CHUNK (64 * 1024)
+
+static uint8_t *ima_list_cache = NULL;
+static size_t ima_list_cache_len = 0;
+static size_t ima_list_cache_size = 0;
+
 uint8_t *
 ml_get_ima_list_new(size_t *len)
 {
@@ -121,80 +252,80 @@ ml_get_ima_list_new(size_t *len)
 		return NULL;
 	}
 
-	int ret = 0;
-	uint8_t *buf = NULL;
-	size_t l = 0;
+	// continue after the cached entries, seq_file offsets are stable for this list
+	if (ima_list_cache_len > 0 &&
+	    lseek(fd, ima_list_cache_len, SEEK_SET) != (off_t)ima_list_cache_len) {
+		WARN_ERRNO("Could not seek behind cached IMA entries, reading whole list");
+		ima_list_cache_len = 0;
+		if (lseek(fd, 0, SEEK_SET) < 0) {
+			ERROR_ERRNO("Failed to rewind binary_runtime_measurements");
+			close(fd);
+			*len = 0;
+			return NULL;
+		}
+	}
 
-	// The binary measurement file in /sys is a special file where the file size cannot
-	// be determined. Therefore it must be read byte by byte
 	while (true) {
-		buf = (uint8_t *)mem_realloc(buf, l + 1);
-		ret = read(fd, buf + l, 1);
-
-		if (ret == 0) {
-			goto out;
+		if (ima_list_cache_size - ima_list_cache_len < IMA_LIST_READ_CHUNK) {
+			ima_list_cache_size = MAX(2 * ima_list_cache_size,
+						  ima_list_cache_len + IMA_LIST_READ_CHUNK);
+			ima_list_cache = mem_realloc(ima_list_cache, ima_list_cache_size);
 		}
+
+		ssize_t ret = read(fd, ima_list_cache + ima_list_cache_len,
+				   ima_list_cache_size - ima_list_cache_len);
+		if (ret == 0)
+			break;
 		if (ret < 0) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
 				TRACE("Reading from fd %d: Blocked, retrying...", fd);
 				continue;
 			}
-			mem_free0(buf);
-			l = 0;
-			ERROR("Failed to read binary_runtime_measurements");
-			goto out;
+			ERROR_ERRNO("Failed to read binary_runtime_measurements");
+			// drop a possibly partial record, read the whole list next time
+			ima_list_cache_len = 0;
+			close(fd);
+			*len = 0;
+			return NULL;
 		}
-		l++;
+		ima_list_cache_len += ret;
 	}
-
-out:
 	close(fd);
-	*len = l;
-	return buf;
-}
 
-void
-ml_container_list_free(MlContainerEntry **entries, size_t len)
-{
-	for (size_t i = 0; i < len; i++) {
-		mem_free0(entries[i]->filename);
-		mem_free0(entries[i]->template_hash_alg);
-		mem_free0(entries[i]->template_hash.data);
-		mem_free0(entries[i]->data_hash_alg);
-		mem_free0(entries[i]->data_hash.data);
-	}
-	mem_free0(entries);
+	// an empty list is no error, thus always return a buffer
+	uint8_t *buf = mem_alloc0(MAX(ima_list_cache_len, (size_t)1));
+	memcpy(buf, ima_list_cache, ima_list_cache_len);
+	*len = ima_list_cache_len;
+	return buf;
 }
 
 MlContainerEntry **
-ml_get_container_list_new(size_t *len)
+ml_get_container_list(size_t *len)
 {
-	MlContainerEntry **entries = mem_new(MlContainerEntry *, measurement_list_len);
-	*len = measurement_list_len;
+	if (ml_measurement_list_resolve_templates() < 0) {
+		ERROR("Could not resolve templates of the container measurement list");
+		*len = 0;
+		return NULL;
+	}
 
-	size_t i = 0;
-	for (list_t *l = measurement_list; l; l = l->next, i++) {
-		ml_elem_t *ml_elem = l->data;
-		MlContainerEntry *entry = mem_new(MlContainerEntry, 1);
+	// the entries only reference the elements, they are built once after resolving
+	for (; measurement_list_n_entries < measurement_list_resolved;
+	     measurement_list_n_entries++) {
+		ml_elem_t *ml_elem = measurement_list[measurement_list_n_entries];
+		MlContainerEntry *entry = &ml_elem->entry;
 		ml_container_entry__init(entry);
 		entry->pcr_index = CONTAINER_PCR_INDEX;
-		entry->filename = mem_strdup(ml_elem->filename);
+		entry->filename = ml_elem->filename;
 		entry->template_hash_alg =
-			mem_strdup(halg_id_to_ima_string(ml_elem->template->halg_id));
-		entry->template_hash.data =
-			mem_memcpy(ml_elem->template->pcr_value, ml_elem->template->pcr_size);
+			(char *)halg_id_to_ima_string(ml_elem->template->halg_id);
+		entry->template_hash.data = ml_elem->template->pcr_value;
 		entry->template_hash.len = ml_elem->template->pcr_size;
-		entry->data_hash_alg = mem_strdup(halg_id_to_ima_string(ml_elem->algid));
-		entry->data_hash.data = mem_memcpy(ml_elem->datahash, ml_elem->hash_len);
+		entry->data_hash_alg = (char *)halg_id_to_ima_string(ml_elem->algid);
+		entry->data_hash.data = ml_elem->datahash;
 		entry->data_hash.len = ml_elem->hash_len;
-
-		if (i >= measurement_list_len) {
-			WARN("Measurement List out of range. Abort");
-			break;
-		}
-
-		entries[i] = entry;
+		measurement_list_entries[measurement_list_n_entries] = entry;
 	}
 
-	return entries;
+	*len = measurement_list_n_entries;
+	return measurement_list_entries;
 }
@@ -40,18 +40,13 @@ ml_get_ima_list_new(size_t *len);
 
 /**
  * Return the container measurement list in protobuf format
+ *
+ * The list is owned by the ml module and only extended by subsequent calls, the entries
+ * stay valid and must neither be modified nor freed by the caller.
  * @param len A pointer to the variable where the length of the list should be stored in
- * @return The protobuf measurement list
+ * @return The protobuf measurement list or NULL on error
  */
 MlContainerEntry **
-ml_get_container_list_new(size_t *len);
-
-/**
- * Free the container measurement list allocated by ml_get_container_list_new
- * @param entries The list to be freed
- * @param len The length of the list
- */
-void
-ml_container_list_free(MlContainerEntry **entries, size_t len);
+ml_get_container_list(size_t *len);
 
 #endif /* ML_H */
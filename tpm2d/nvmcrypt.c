@@ -32,11 +32,21 @@
 #include "common/mem.h"
 #include "common/file.h"
 #include "common/cryptfs.h"
+#include "common/hex.h"
+
+#include <pthread.h>
 
 static nvmcrypt_fde_state_t fde_state = FDE_RESET;
 static bool secure_boot = false;
 static uint8_t *nvmcrypt_nvindex_policy = NULL;
 
+// device mapping started by nvmcrypt_dm_prefetch() in the background
+static char *nvmcrypt_prefetch_device = NULL;
+static uint8_t *nvmcrypt_prefetch_key = NULL;
+static pthread_t nvmcrypt_prefetch_thread;
+static bool nvmcrypt_prefetch_joinable = false;
+static nvmcrypt_fde_state_t nvmcrypt_prefetch_state = FDE_RESET;
+
 static TPM_RC
 nvmcrypt_start_policy_session(TPM_SE session_type, TPMI_SH_AUTH_SESSION *session_handle,
 			      TPMI_DH_OBJECT bind_handle, const char *bind_pwd)
@@ -210,29 +220,100 @@ err:
 	return NULL;
 }
 
-nvmcrypt_fde_state_t
-nvmcrypt_dm_setup(const char *device_path, const char *fde_pw)
+/*
+ * Maps the device with the loaded key. This does not access the TPM and thus may also run
+ * in the prefetch thread.
+ */
+static nvmcrypt_fde_state_t
+nvmcrypt_dm_map(const char *device_path, const uint8_t *key)
 {
-	IF_TRUE_RETVAL(device_path == NULL || !file_exists(device_path), FDE_NO_DEVICE);
+	nvmcrypt_fde_state_t state = FDE_OK;
 	char *dev_name = basename(device_path);
 
-	uint8_t *key = nvmcrypt_load_key_new(fde_pw);
-	IF_NULL_RETVAL(key, fde_state);
-
 	// cryptfs_setup_volume_new expects an ascii string as key
 	char *ascii_key = convert_bin_to_hex_new(key, CRYPTFS_FDE_KEY_LEN);
 
 	INFO("Setting up crypto device mapping for %s to %s", device_path, dev_name);
 
-	char *mapped_path = cryptfs_setup_volume_new(dev_name, device_path, ascii_key, NULL);
+	char *mapped_path = cryptfs_setup_volume_new(dev_name, device_path, ascii_key, NULL, NULL);
 
 	if (mapped_path == NULL) {
 		ERROR("Failed to setup device mapping for %s", device_path);
-		fde_state = FDE_NO_DEVICE;
+		state = FDE_NO_DEVICE;
 	}
 
 	mem_free0(mapped_path);
 	mem_free0(ascii_key);
+	return state;
+}
+
+static void *
+nvmcrypt_prefetch_thread_main(UNUSED void *arg)
+{
+	nvmcrypt_prefetch_state = nvmcrypt_dm_map(nvmcrypt_prefetch_device, nvmcrypt_prefetch_key);
+	mem_memset0(nvmcrypt_prefetch_key, CRYPTFS_FDE_KEY_LEN);
+	mem_free0(nvmcrypt_prefetch_key);
+	return NULL;
+}
+
+void
+nvmcrypt_dm_prefetch(const char *device_path)
+{
+	IF_TRUE_RETURN_WARN(device_path == NULL || !file_exists(device_path));
+	IF_TRUE_RETURN_WARN(nvmcrypt_prefetch_device != NULL);
+
+	// a new key would be bound to an empty password, leave this to an explicit setup
+	if (tpm2_nv_get_data_size(TPM2D_FDE_NV_HANDLE) == 0) {
+		INFO("No FDE key in NVRAM yet, skipping prefetch of %s", device_path);
+		return;
+	}
+
+	nvmcrypt_fde_state_t prev_state = fde_state;
+	uint8_t *key = nvmcrypt_load_key_new(NULL);
+	if (key == NULL) {
+		WARN("Failed to load FDE key for prefetch of %s", device_path);
+		fde_state = prev_state;
+		return;
+	}
+
+	nvmcrypt_prefetch_device = mem_strdup(device_path);
+	nvmcrypt_prefetch_key = key;
+	if (pthread_create(&nvmcrypt_prefetch_thread, NULL, nvmcrypt_prefetch_thread_main, NULL)) {
+		WARN("Failed to start prefetch thread, mapping %s synchronously", device_path);
+		nvmcrypt_prefetch_thread_main(NULL);
+		return;
+	}
+	nvmcrypt_prefetch_joinable = true;
+	DEBUG("Started prefetch of FDE device mapping for %s", device_path);
+}
+
+nvmcrypt_fde_state_t
+nvmcrypt_dm_setup(const char *device_path, const char *fde_pw)
+{
+	IF_TRUE_RETVAL(device_path == NULL || !file_exists(device_path), FDE_NO_DEVICE);
+
+	if (nvmcrypt_prefetch_device) {
+		// wait for the prefetch, which must not run concurrently to another setup
+		if (nvmcrypt_prefetch_joinable)
+			pthread_join(nvmcrypt_prefetch_thread, NULL);
+		nvmcrypt_prefetch_joinable = false;
+
+		bool hit = fde_pw == NULL && !strcmp(device_path, nvmcrypt_prefetch_device);
+		mem_free0(nvmcrypt_prefetch_device);
+		if (hit) {
+			INFO("Using prefetched device mapping for %s", device_path);
+			fde_state = nvmcrypt_prefetch_state;
+			return fde_state;
+		}
+	}
+
+	uint8_t *key = nvmcrypt_load_key_new(fde_pw);
+	IF_NULL_RETVAL(key, fde_state);
+
+	nvmcrypt_fde_state_t state = nvmcrypt_dm_map(device_path, key);
+	if (state != FDE_OK)
+		fde_state = state;
+
 	mem_free0(key);
 	return fde_state;
 }
@@ -78,6 +78,21 @@ nvmcrypt_init(bool use_secure_boot_policy);
 nvmcrypt_fde_state_t
 nvmcrypt_dm_setup(const char *device_path, const char *fde_pw);
 
+/**
+ * Starts the setup of the encrypted device mapping for the given
+ * block device at startup, before it is requested by nvmcrypt_dm_setup().
+ *
+ * The key is loaded from the TPM's nvram right away, the device mapping
+ * itself is set up in a background thread. A later nvmcrypt_dm_setup()
+ * for the same device without password waits for and returns the result
+ * of the prefetch. Only use this if the nvindex of the key is not bound
+ * to a password, a new key is never created by the prefetch.
+ *
+ *  @param device_path path to the real blockdevice
+ */
+void
+nvmcrypt_dm_prefetch(const char *device_path);
+
 /**
  * This function locks the nvm key inside the TPM for further reading
  *
@@ -33,25 +33,60 @@
 
 #include "tpm2d.h"
 #include "tpm2d_shared.h"
+#include "tpm2d_sched.h"
 #include "ml.h"
 #include "ek.h"
 
 #include "common/macro.h"
 #include "common/mem.h"
-#include "common/fd.h"
 #include "common/event.h"
 #include "common/file.h"
+#include "common/list.h"
 #include "common/protobuf.h"
+#include "common/protobuf_conn.h"
 #include "common/protobuf-text.h"
 
 #include <google/protobuf-c/protobuf-c-text.h>
 
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x)[0])
 
+// time to collect attestation requests which allow nonce batching before quoting them
+#define TPM2D_RCONTROL_BATCH_WINDOW_MS 50
+// maximum number of requests answered by one batch quote
+#define TPM2D_RCONTROL_BATCH_MAX 64
+
+// domain separation prefixes and hash length of the nonce Merkle tree
+#define TPM2D_RCONTROL_MERKLE_LEAF 0x00
+#define TPM2D_RCONTROL_MERKLE_NODE 0x01
+#define TPM2D_RCONTROL_MERKLE_HASH_LEN SHA256_DIGEST_LENGTH
+
 struct tpm2d_rcontrol {
 	int sock; // listen ip socket fd
+	list_t *batch; // pending tpm2d_rcontrol_att_req_t which allow nonce batching
+	unsigned int batch_len;
+	event_timer_t *batch_timer;
+	bool batch_queued; // the quote of the batch is queued in the scheduler
 };
 
+typedef struct tpm2d_rcontrol_att_req {
+	protobuf_conn_t *conn; // NULL if the client disconnected meanwhile
+	RemoteToTpm2d *msg;
+	uint8_t pcr_bitmap[3];
+	int pcr_regs;
+} tpm2d_rcontrol_att_req_t;
+
+/*
+ * PCR values sent with the last attestation. As long as the PCR digest of a following
+ * quote over the same selection matches, none of the PCRs has changed and the values
+ * are reused instead of reading each PCR again.
+ */
+static uint8_t tpm2d_rcontrol_pcr_cache_bitmap[3];
+static tpm2d_pcr_t **tpm2d_rcontrol_pcr_cache = NULL;
+static int tpm2d_rcontrol_pcr_cache_len = 0;
+
 /**
  * Returns the HashAlgLen (proto) for the given TPM_ALG_ID alg_id.
  */
@@ -71,146 +106,373 @@ tpm2d_rcontrol_hash_algo_get_len_proto(TPM_ALG_ID alg_id)
 	}
 }
 
-static void
-tpm2d_rcontrol_handle_message(const RemoteToTpm2d *msg, int fd, tpm2d_rcontrol_t *rcontrol)
+static const EVP_MD *
+tpm2d_rcontrol_hash_algo_get_md(TPM_ALG_ID alg_id)
 {
-	ASSERT(rcontrol);
+	switch (alg_id) {
+	case TPM_ALG_SHA1:
+		return EVP_sha1();
+	case TPM_ALG_SHA256:
+		return EVP_sha256();
+	case TPM_ALG_SHA384:
+		return EVP_sha384();
+	default:
+		ERROR("Unsupported value for TPM_ALG_ID: %d", alg_id);
+		return NULL;
+	}
+}
 
-	TRACE("Handle message from client fd=%d", fd);
+/**
+ * Fills pcr_bitmap with the PCR selection of the attestation request msg.
+ *
+ * @return the number of selected PCRs or -1 for an unknown attestation type
+ */
+static int
+tpm2d_rcontrol_get_pcr_bitmap(const RemoteToTpm2d *msg, uint8_t pcr_bitmap[3])
+{
+	int pcr_regs = 0;
 
-	if (NULL == msg) {
-		WARN("msg=NULL, returning");
-		return;
+	memset(pcr_bitmap, 0, 3);
+
+	switch (msg->atype) {
+	case IDS_ATTESTATION_TYPE__BASIC:
+		TRACE("atype BASIC");
+		pcr_regs = 12;
+		for (int i = 0; i < pcr_regs; ++i) {
+			pcr_bitmap[i / 8] |= 1 << (i % 8);
+		}
+		break;
+	case IDS_ATTESTATION_TYPE__ALL:
+		TRACE("atype ALL");
+		pcr_regs = 24;
+		for (int i = 0; i < pcr_regs; ++i) {
+			pcr_bitmap[i / 8] |= 1 << (i % 8);
+		}
+		break;
+	case IDS_ATTESTATION_TYPE__ADVANCED:
+		TRACE("atype ADVANCED");
+		memcpy(pcr_bitmap, &msg->pcrs, 3);
+		for (size_t i = 0; i < 3; i++) {
+			for (size_t j = 0; j < 8; j++) {
+				if (pcr_bitmap[i] & (1 << j)) {
+					pcr_regs++;
+				}
+			}
+		}
+		break;
+	default:
+		return -1;
 	}
 
-	if (LOGF_PRIO_TRACE >= LOGF_LOG_MIN_PRIO) {
-		char *msg_text;
-		size_t msg_len =
-			protobuf_string_from_message(&msg_text, (ProtobufCMessage *)msg, NULL);
-		TRACE("Handling RemoteToTpmd message:\n%s", msg_len > 0 ? msg_text : "NULL");
-		if (msg_text)
-			mem_free0(msg_text);
+	return pcr_regs;
+}
+
+static void
+tpm2d_rcontrol_pcr_cache_clear(void)
+{
+	for (int i = 0; i < tpm2d_rcontrol_pcr_cache_len; ++i) {
+		if (tpm2d_rcontrol_pcr_cache[i])
+			tpm2_pcrread_free(tpm2d_rcontrol_pcr_cache[i]);
 	}
+	if (tpm2d_rcontrol_pcr_cache)
+		mem_free0(tpm2d_rcontrol_pcr_cache);
+	tpm2d_rcontrol_pcr_cache_len = 0;
+}
 
-	tss2_init();
+/**
+ * Checks if the cached PCR values match the selection and the PCR digest of the quote.
+ */
+static bool
+tpm2d_rcontrol_pcr_cache_is_valid(const uint8_t pcr_bitmap[3], const tpm2d_quote_t *quote)
+{
+	uint8_t digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len = 0;
+	bool valid = false;
 
-	switch (msg->code) {
-	case REMOTE_TO_TPM2D__CODE__ATTESTATION_REQ: {
-		Pcr **out_pcrs = NULL;
-		tpm2d_pcr_t **pcr_array = NULL;
-		tpm2d_quote_t *quote = NULL;
-		uint8_t *attestation_cert = NULL;
-		size_t att_cert_len = 0;
-		uint8_t pcr_bitmap[3];
-		int pcr_regs = 0;
-		int index = 0;
+	IF_NULL_RETVAL(tpm2d_rcontrol_pcr_cache, false);
+	IF_TRUE_RETVAL(memcmp(tpm2d_rcontrol_pcr_cache_bitmap, pcr_bitmap, 3), false);
 
-		TPMI_DH_OBJECT att_key_handle = tpm2d_get_as_key_handle();
-		if (att_key_handle == TPM_RH_NULL)
-			goto err_att_req;
+	const EVP_MD *md = tpm2d_rcontrol_hash_algo_get_md(quote->halg_id);
+	IF_NULL_RETVAL(md, false);
 
-		Tpm2dToRemote out = TPM2D_TO_REMOTE__INIT;
-		out.code = TPM2D_TO_REMOTE__CODE__ATTESTATION_RES;
+	EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+	IF_NULL_RETVAL_ERROR(mdctx, false);
 
-		switch (msg->atype) {
-		case IDS_ATTESTATION_TYPE__BASIC:
-			TRACE("atype BASIC");
-			pcr_regs = 12;
-			for (int i = 0; i < pcr_regs; ++i) {
-				pcr_bitmap[i / 8] |= 1 << (i % 8);
-			}
-			break;
-		case IDS_ATTESTATION_TYPE__ALL:
-			TRACE("atype ALL");
-			pcr_regs = 24;
-			for (int i = 0; i < pcr_regs; ++i) {
-				pcr_bitmap[i / 8] |= 1 << (i % 8);
-			}
-			break;
-		case IDS_ATTESTATION_TYPE__ADVANCED:
-			TRACE("atype ADVANCED");
-			memcpy(pcr_bitmap, &msg->pcrs, sizeof(pcr_bitmap));
-			for (size_t i = 0; i < ARRAY_SIZE(pcr_bitmap); i++) {
-				for (size_t j = 0; j < 8; j++) {
-					if (pcr_bitmap[i] & (1 << j)) {
-						pcr_regs++;
-					}
+	IF_FALSE_GOTO(EVP_DigestInit(mdctx, md), out);
+	for (int i = 0; i < tpm2d_rcontrol_pcr_cache_len; ++i) {
+		IF_FALSE_GOTO(EVP_DigestUpdate(mdctx, tpm2d_rcontrol_pcr_cache[i]->pcr_value,
+					       tpm2d_rcontrol_pcr_cache[i]->pcr_size),
+			      out);
+	}
+	IF_FALSE_GOTO(EVP_DigestFinal(mdctx, digest, &digest_len), out);
+
+	valid = digest_len == quote->pcr_digest_size &&
+		!memcmp(digest, quote->pcr_digest, digest_len);
+out:
+	EVP_MD_CTX_free(mdctx);
+	return valid;
+}
+
+/**
+ * Reads the selected PCRs into the PCR cache.
+ */
+static int
+tpm2d_rcontrol_pcr_cache_update(const uint8_t pcr_bitmap[3], int pcr_regs)
+{
+	int index = 0;
+
+	tpm2d_rcontrol_pcr_cache_clear();
+
+	tpm2d_rcontrol_pcr_cache =
+		mem_alloc0(MUL_WITH_OVERFLOW_CHECK((size_t)sizeof(tpm2d_pcr_t *), pcr_regs));
+	tpm2d_rcontrol_pcr_cache_len = pcr_regs;
+	memcpy(tpm2d_rcontrol_pcr_cache_bitmap, pcr_bitmap, 3);
+
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 8; j++) {
+			if (pcr_bitmap[i] & (1 << j)) {
+				int pcr_num = i * 8 + j;
+				tpm2d_rcontrol_pcr_cache[index] =
+					tpm2_pcrread_new(pcr_num, TPM2D_HASH_ALGORITHM);
+				if (!tpm2d_rcontrol_pcr_cache[index]) {
+					ERROR("Failed to read PCR%d", pcr_num);
+					tpm2d_rcontrol_pcr_cache_clear();
+					return -1;
 				}
+				INFO("PCR%d: size %zu", pcr_num,
+				     tpm2d_rcontrol_pcr_cache[index]->pcr_size);
+				index++;
 			}
-			break;
-		default:
-			goto err_att_req;
-			break;
 		}
+	}
 
-		pcr_array = mem_alloc0(
-			MUL_WITH_OVERFLOW_CHECK((size_t)sizeof(tpm2d_pcr_t *), pcr_regs));
-		index = 0;
-		for (int i = 0; i < (int)ARRAY_SIZE(pcr_bitmap); ++i) {
-			for (int j = 0; j < 8; j++) {
-				if (pcr_bitmap[i] & (1 << j)) {
-					int pcr_num = i * 8 + j;
-					pcr_array[index] =
-						tpm2_pcrread_new(pcr_num, TPM2D_HASH_ALGORITHM);
-					IF_NULL_GOTO_ERROR(pcr_array[index], err_att_req);
-					INFO("PCR%d: size %zu", pcr_num,
-					     pcr_array[index]->pcr_size);
-					index++;
-				}
-			}
+	return 0;
+}
+
+static uint8_t *
+tpm2d_rcontrol_read_cert_new(size_t *att_cert_len)
+{
+	FILE *fp;
+	struct stat stat_buf;
+	uint8_t *attestation_cert = NULL;
+
+	if (!(fp = fopen(TPM2D_ATT_CERT_FILE, "rb"))) {
+		ERROR("Error opening device cert file");
+		return NULL;
+	}
+	if (fstat(fileno(fp), &stat_buf) == -1) {
+		ERROR("Error accessing device cert file");
+		fclose(fp);
+		return NULL;
+	}
+	*att_cert_len = stat_buf.st_size;
+	attestation_cert = mem_new(uint8_t, *att_cert_len);
+
+	if ((fread(attestation_cert, sizeof(uint8_t), *att_cert_len, fp)) != *att_cert_len) {
+		ERROR("Error reading out device cert file");
+		fclose(fp);
+		mem_free0(attestation_cert);
+		return NULL;
+	}
+	fclose(fp);
+
+	INFO("att cert done: size=%zu", *att_cert_len);
+	return attestation_cert;
+}
+
+static int
+tpm2d_rcontrol_merkle_hash(uint8_t prefix, const uint8_t *a, size_t a_len, const uint8_t *b,
+			   size_t b_len, uint8_t *out)
+{
+	int ret = -1;
+	EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+	IF_NULL_RETVAL_ERROR(mdctx, -1);
+
+	IF_FALSE_GOTO(EVP_DigestInit(mdctx, EVP_sha256()), out);
+	IF_FALSE_GOTO(EVP_DigestUpdate(mdctx, &prefix, 1), out);
+	IF_FALSE_GOTO(EVP_DigestUpdate(mdctx, a, a_len), out);
+	if (b) {
+		IF_FALSE_GOTO(EVP_DigestUpdate(mdctx, b, b_len), out);
+	}
+	IF_FALSE_GOTO(EVP_DigestFinal(mdctx, out, NULL), out);
+	ret = 0;
+out:
+	EVP_MD_CTX_free(mdctx);
+	return ret;
+}
+
+/**
+ * Builds the Merkle tree over the qualifying data of the n requests reqs. The nodes are
+ * stored level by level starting with the leaves, thus the root is the last node.
+ *
+ * @param tree_len returns the number of nodes in the tree
+ * @return the newly allocated tree or NULL on error
+ */
+static uint8_t *
+tpm2d_rcontrol_merkle_tree_new(tpm2d_rcontrol_att_req_t **reqs, size_t n, size_t *tree_len)
+{
+	const size_t hlen = TPM2D_RCONTROL_MERKLE_HASH_LEN;
+	size_t len = n;
+
+	for (size_t w = n; w > 1; w = (w + 1) / 2)
+		len += (w + 1) / 2;
+
+	uint8_t *tree = mem_new(uint8_t, len * hlen);
+
+	for (size_t i = 0; i < n; ++i) {
+		ProtobufCBinaryData *nonce = &reqs[i]->msg->qualifyingdata;
+		IF_TRUE_GOTO(tpm2d_rcontrol_merkle_hash(TPM2D_RCONTROL_MERKLE_LEAF, nonce->data,
+							nonce->len, NULL, 0, tree + i * hlen),
+			     err);
+	}
+
+	for (size_t off = 0, w = n; w > 1; off += w, w = (w + 1) / 2) {
+		for (size_t i = 0; i < w; i += 2) {
+			const uint8_t *left = tree + (off + i) * hlen;
+			// an odd last node is paired with itself
+			const uint8_t *right = (i + 1 < w) ? left + hlen : left;
+			IF_TRUE_GOTO(tpm2d_rcontrol_merkle_hash(TPM2D_RCONTROL_MERKLE_NODE, left,
+								hlen, right, hlen,
+								tree + (off + w + i / 2) * hlen),
+				     err);
 		}
+	}
+
+	*tree_len = len;
+	return tree;
+err:
+	ERROR("Failed to build nonce Merkle tree");
+	mem_free0(tree);
+	return NULL;
+}
+
+/**
+ * Fills proof with the sibling hashes on the path from leaf index up to the root.
+ *
+ * @return the number of hashes in the proof
+ */
+static size_t
+tpm2d_rcontrol_merkle_proof(uint8_t *tree, size_t n, size_t index, ProtobufCBinaryData *proof)
+{
+	const size_t hlen = TPM2D_RCONTROL_MERKLE_HASH_LEN;
+	size_t depth = 0;
+
+	for (size_t off = 0, w = n; w > 1; off += w, w = (w + 1) / 2, index /= 2) {
+		size_t sibling = index ^ 1;
+		if (sibling >= w)
+			sibling = index;
+		proof[depth].data = tree + (off + sibling) * hlen;
+		proof[depth].len = hlen;
+		depth++;
+	}
+
+	return depth;
+}
+
+/**
+ * Answers the n attestation requests reqs, which all select the same PCRs, with a single
+ * quote. If batched is set, the quote covers the root of a Merkle tree over the requests'
+ * qualifying data and each response carries the inclusion proof for its request.
+ * Measurement lists, PCR values and the device certificate are gathered once and shared
+ * by all responses.
+ */
+static void
+tpm2d_rcontrol_attest(tpm2d_rcontrol_att_req_t **reqs, size_t n, bool batched)
+{
+	Pcr **out_pcrs = NULL;
+	Pcr *out_pcr_values = NULL;
+	tpm2d_quote_t *quote = NULL;
+	uint8_t *attestation_cert = NULL;
+	size_t att_cert_len = 0;
+	uint8_t *tree = NULL;
+	size_t tree_len = 0;
+	uint8_t *qualifying_data = reqs[0]->msg->qualifyingdata.data;
+	size_t qualifying_data_len = reqs[0]->msg->qualifyingdata.len;
+	int pcr_regs = reqs[0]->pcr_regs;
+	bool attest_ima = false, attest_containers = false;
+	uint8_t *ml_ima_entry = NULL;
+	size_t ml_ima_entry_len = 0;
+	MlContainerEntry **ml_container_entry = NULL;
+	size_t n_ml_container_entry = 0;
+
+	TPMI_DH_OBJECT att_key_handle = tpm2d_get_as_key_handle();
+	if (att_key_handle == TPM_RH_NULL)
+		goto out;
+
+	if (batched) {
+		tree = tpm2d_rcontrol_merkle_tree_new(reqs, n, &tree_len);
+		IF_NULL_GOTO(tree, out);
+		qualifying_data = tree + (tree_len - 1) * TPM2D_RCONTROL_MERKLE_HASH_LEN;
+		qualifying_data_len = TPM2D_RCONTROL_MERKLE_HASH_LEN;
+		DEBUG("Quoting batch of %zu attestation requests", n);
+	}
 
-		quote = tpm2_quote_new(pcr_bitmap, sizeof(pcr_bitmap), att_key_handle,
-				       TPM2D_ATT_KEY_PW, msg->qualifyingdata.data,
-				       msg->qualifyingdata.len);
-		IF_NULL_GOTO_ERROR(quote, err_att_req);
-
-		// add device certificate to quote
-		FILE *fp;
-		struct stat stat_buf;
-		if (!(fp = fopen(TPM2D_ATT_CERT_FILE, "rb"))) {
-			ERROR("Error opening device cert file");
-			goto err_att_req;
+	quote = tpm2_quote_new(reqs[0]->pcr_bitmap, sizeof(reqs[0]->pcr_bitmap), att_key_handle,
+			       TPM2D_ATT_KEY_PW, qualifying_data, qualifying_data_len);
+	IF_NULL_GOTO_ERROR(quote, out);
+
+	if (tpm2d_rcontrol_pcr_cache_is_valid(reqs[0]->pcr_bitmap, quote)) {
+		DEBUG("PCRs unchanged since last attestation, reusing PCR values");
+	} else if (tpm2d_rcontrol_pcr_cache_update(reqs[0]->pcr_bitmap, pcr_regs) < 0) {
+		goto out;
+	}
+
+	// add device certificate to quote
+	attestation_cert = tpm2d_rcontrol_read_cert_new(&att_cert_len);
+	IF_NULL_GOTO_ERROR(attestation_cert, out);
+
+	out_pcrs = mem_new(Pcr *, pcr_regs);
+	out_pcr_values = mem_new(Pcr, pcr_regs);
+	for (int index = 0, i = 0; i < (int)ARRAY_SIZE(reqs[0]->pcr_bitmap); ++i) {
+		for (int j = 0; j < 8; j++) {
+			if (reqs[0]->pcr_bitmap[i] & (1 << j)) {
+				Pcr *out_pcr = &out_pcr_values[index];
+				pcr__init(out_pcr);
+				out_pcr->has_value = true;
+				out_pcr->value.data = tpm2d_rcontrol_pcr_cache[index]->pcr_value;
+				out_pcr->value.len = tpm2d_rcontrol_pcr_cache[index]->pcr_size;
+				out_pcr->has_number = true;
+				out_pcr->number = (i * 8) + j;
+				INFO("PCR_%d: %zu", index, out_pcr->value.len);
+				out_pcrs[index] = out_pcr;
+				index++;
+			}
 		}
-		if (fstat(fileno(fp), &stat_buf) == -1) {
-			ERROR("Error accessing device cert file");
-			fclose(fp);
-			goto err_att_req;
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		attest_ima |= reqs[i]->msg->attest_ima;
+		attest_containers |= reqs[i]->msg->attest_containers;
+	}
+
+	if (attest_ima) {
+		ml_ima_entry = ml_get_ima_list_new(&ml_ima_entry_len);
+		if (!ml_ima_entry) {
+			WARN("Failed to retrieve IMA measurement list");
+			goto out;
 		}
-		att_cert_len = stat_buf.st_size;
-		attestation_cert = mem_new(uint8_t, att_cert_len);
+	}
 
-		if ((fread(attestation_cert, sizeof(uint8_t), att_cert_len, fp)) != att_cert_len) {
-			ERROR("Error reading out device cert file");
-			fclose(fp);
-			goto err_att_req;
+	if (attest_containers) {
+		ml_container_entry = ml_get_container_list(&n_ml_container_entry);
+		if (!ml_container_entry) {
+			WARN("Failed to retrieve container measurement list");
+			goto out;
 		}
-		fclose(fp);
+	}
 
-		IF_NULL_GOTO_ERROR(attestation_cert, err_att_req);
-		INFO("att cert done: size=%zu", att_cert_len);
+	for (size_t i = 0; i < n; ++i) {
+		ProtobufCBinaryData proof[sizeof(size_t) * 8];
+		Tpm2dToRemote out = TPM2D_TO_REMOTE__INIT;
 
-		Pcr out_pcr = PCR__INIT;
-		out_pcrs = mem_new(Pcr *, pcr_regs);
-		index = 0;
-		for (int i = 0; i < (int)ARRAY_SIZE(pcr_bitmap); ++i) {
-			for (int j = 0; j < 8; j++) {
-				if (pcr_bitmap[i] & (1 << j)) {
-					out_pcr.has_value = true;
-					out_pcr.value.data = pcr_array[index]->pcr_value;
-					out_pcr.value.len = pcr_array[index]->pcr_size;
-					out_pcr.has_number = true;
-					out_pcr.number = (i * 8) + j;
-					INFO("PCR_%d: %zu", index, out_pcr.value.len);
-					out_pcrs[index] = mem_alloc(sizeof(Pcr));
-					memcpy(out_pcrs[index], &out_pcr, sizeof(Pcr));
-					index++;
-				}
-			}
+		if (!reqs[i]->conn) {
+			DEBUG("Client of batched attestation request disconnected, skipping");
+			continue;
 		}
 
+		out.code = TPM2D_TO_REMOTE__CODE__ATTESTATION_RES;
 		out.has_atype = true;
-		out.atype = msg->atype;
+		out.atype = reqs[i]->msg->atype;
 		out.has_halg = true;
 		out.halg = tpm2d_rcontrol_hash_algo_get_len_proto(quote->halg_id);
 		out.has_quoted = true;
@@ -227,100 +489,297 @@ tpm2d_rcontrol_handle_message(const RemoteToTpm2d *msg, int fd, tpm2d_rcontrol_t
 		out.certificate.data = attestation_cert;
 		out.certificate.len = att_cert_len;
 
-		if (msg->attest_ima) {
+		// only send the entries appended after the offsets already verified by the
+		// remote, if the offsets are still within the lists
+		if (reqs[i]->msg->attest_ima) {
+			uint64_t off = reqs[i]->msg->ml_ima_offset;
+			if (off > ml_ima_entry_len)
+				off = 0;
 			out.has_ml_ima_entry = true;
-			out.ml_ima_entry.data = ml_get_ima_list_new(&out.ml_ima_entry.len);
-			if (!out.ml_ima_entry.data) {
-				WARN("Failed to retrieve IMA measurement list");
-				goto err_att_req;
-			}
-		} else {
-			out.has_ml_ima_entry = false;
+			out.ml_ima_entry.data = ml_ima_entry + off;
+			out.ml_ima_entry.len = ml_ima_entry_len - off;
+			out.has_ml_ima_offset = true;
+			out.ml_ima_offset = off;
 		}
 
-		if (msg->attest_containers) {
-			out.ml_container_entry =
-				ml_get_container_list_new(&out.n_ml_container_entry);
-			if (!out.ml_container_entry) {
-				WARN("Failed to retrieve container measurement list");
-				goto err_att_req;
-			}
-		} else {
-			out.n_ml_container_entry = 0;
+		if (reqs[i]->msg->attest_containers) {
+			uint32_t off = reqs[i]->msg->ml_container_offset;
+			if (off > n_ml_container_entry)
+				off = 0;
+			out.ml_container_entry = ml_container_entry + off;
+			out.n_ml_container_entry = n_ml_container_entry - off;
+			out.has_ml_container_offset = true;
+			out.ml_container_offset = off;
 		}
 
-		DEBUG("Received INTERNAL_ATTESTATION_RES, now sending reply");
-		protobuf_send_message(fd, (ProtobufCMessage *)&out);
+		if (batched) {
+			out.has_nonce_batch_index = true;
+			out.nonce_batch_index = i;
+			out.nonce_batch_proof = proof;
+			out.n_nonce_batch_proof = tpm2d_rcontrol_merkle_proof(tree, n, i, proof);
+		}
 
-		mem_free0(out.ml_ima_entry.data);
-		ml_container_list_free(out.ml_container_entry, out.n_ml_container_entry);
+		DEBUG("Received INTERNAL_ATTESTATION_RES, now sending reply");
+		protobuf_send_message(protobuf_conn_get_fd(reqs[i]->conn),
+				      (ProtobufCMessage *)&out);
+	}
 
-	err_att_req:
+out:
+	// keep the attestation key loaded for subsequent quotes, unless quoting failed
+	if (!quote)
 		tpm2d_flush_as_key_handle();
 
-		if (pcr_array)
-			for (int i = 0; i < pcr_regs; ++i) {
-				if (pcr_array[i])
-					tpm2_pcrread_free(pcr_array[i]);
-				if (out_pcrs && out_pcrs[i])
-					mem_free0(out_pcrs[i]);
-			}
-		if (out_pcrs)
-			mem_free0(out_pcrs);
-		if (pcr_array)
-			mem_free0(pcr_array);
-		if (quote)
-			tpm2_quote_free(quote);
-		if (attestation_cert)
-			mem_free0(attestation_cert);
+	if (ml_ima_entry)
+		mem_free0(ml_ima_entry);
+	if (out_pcrs)
+		mem_free0(out_pcrs);
+	if (out_pcr_values)
+		mem_free0(out_pcr_values);
+	if (quote)
+		tpm2_quote_free(quote);
+	if (attestation_cert)
+		mem_free0(attestation_cert);
+	if (tree)
+		mem_free0(tree);
+}
+
+static void
+tpm2d_rcontrol_att_req_free(tpm2d_rcontrol_att_req_t *req)
+{
+	protobuf_free_message((ProtobufCMessage *)req->msg);
+	mem_free0(req);
+}
+
+/**
+ * Answers all pending batched attestation requests, with one quote per PCR selection.
+ */
+static void
+tpm2d_rcontrol_batch_flush(tpm2d_rcontrol_t *rcontrol)
+{
+	tpm2d_rcontrol_att_req_t *group[TPM2D_RCONTROL_BATCH_MAX];
+	list_t *batch = rcontrol->batch;
+
+	rcontrol->batch = NULL;
+	rcontrol->batch_len = 0;
+	rcontrol->batch_queued = false;
+	if (rcontrol->batch_timer) {
+		event_remove_timer(rcontrol->batch_timer);
+		event_timer_free(rcontrol->batch_timer);
+		rcontrol->batch_timer = NULL;
+	}
+
+	while (batch) {
+		tpm2d_rcontrol_att_req_t *first = batch->data;
+		size_t n = 0;
+
+		for (list_t *l = batch; l && n < TPM2D_RCONTROL_BATCH_MAX;) {
+			tpm2d_rcontrol_att_req_t *req = l->data;
+			l = l->next;
+			if (memcmp(req->pcr_bitmap, first->pcr_bitmap, sizeof(req->pcr_bitmap)))
+				continue;
+			group[n++] = req;
+			batch = list_remove(batch, req);
+		}
+
+		tpm2d_rcontrol_attest(group, n, true);
+
+		for (size_t i = 0; i < n; ++i)
+			tpm2d_rcontrol_att_req_free(group[i]);
+	}
+}
+
+static void
+tpm2d_rcontrol_batch_run_job(UNUSED protobuf_conn_t *conn, void *data)
+{
+	tpm2d_rcontrol_batch_flush(data);
+}
+
+/**
+ * Queues the quote of the pending batch, requests added meanwhile are still part of it.
+ */
+static void
+tpm2d_rcontrol_batch_submit(tpm2d_rcontrol_t *rcontrol)
+{
+	IF_TRUE_RETURN(rcontrol->batch_queued);
+
+	rcontrol->batch_queued = true;
+	tpm2d_sched_submit(TPM2D_SCHED_ATTEST, NULL, tpm2d_rcontrol_batch_run_job, NULL, rcontrol);
+}
+
+static void
+tpm2d_rcontrol_batch_timer_cb(event_timer_t *timer, void *data)
+{
+	tpm2d_rcontrol_t *rcontrol = data;
+	ASSERT(rcontrol);
+	ASSERT(rcontrol->batch_timer == timer);
+
+	// the one-shot timer was already removed from the event loop
+	event_timer_free(timer);
+	rcontrol->batch_timer = NULL;
+
+	tpm2d_rcontrol_batch_submit(rcontrol);
+}
+
+/**
+ * Queues a copy of the attestation request msg for the next batch quote.
+ */
+static void
+tpm2d_rcontrol_batch_add(tpm2d_rcontrol_t *rcontrol, protobuf_conn_t *conn,
+			 const RemoteToTpm2d *msg, const uint8_t pcr_bitmap[3], int pcr_regs)
+{
+	RemoteToTpm2d *copy = (RemoteToTpm2d *)protobuf_dup_message((ProtobufCMessage *)msg);
+	IF_NULL_RETURN_ERROR(copy);
+
+	tpm2d_rcontrol_att_req_t *req = mem_new0(tpm2d_rcontrol_att_req_t, 1);
+	req->conn = conn;
+	req->msg = copy;
+	memcpy(req->pcr_bitmap, pcr_bitmap, sizeof(req->pcr_bitmap));
+	req->pcr_regs = pcr_regs;
+
+	rcontrol->batch = list_append(rcontrol->batch, req);
+	rcontrol->batch_len++;
+
+	if (rcontrol->batch_len >= TPM2D_RCONTROL_BATCH_MAX) {
+		tpm2d_rcontrol_batch_submit(rcontrol);
+		return;
+	}
+
+	if (!rcontrol->batch_timer && !rcontrol->batch_queued) {
+		rcontrol->batch_timer = event_timer_new(TPM2D_RCONTROL_BATCH_WINDOW_MS, 1,
+							tpm2d_rcontrol_batch_timer_cb, rcontrol);
+		event_add_timer(rcontrol->batch_timer);
+	}
+}
+
+static void
+tpm2d_rcontrol_attest_run_job(protobuf_conn_t *conn, void *data)
+{
+	tpm2d_rcontrol_att_req_t *req = data;
+
+	if (!conn) {
+		DEBUG("Client of queued attestation request disconnected, skipping");
+		return;
+	}
+	req->conn = conn;
+	tpm2d_rcontrol_attest(&req, 1, false);
+}
+
+static void
+tpm2d_rcontrol_attest_free_job(void *data)
+{
+	tpm2d_rcontrol_att_req_free(data);
+}
+
+/**
+ * Queues a quote for the attestation request msg, which cannot be batched.
+ */
+static void
+tpm2d_rcontrol_attest_submit(protobuf_conn_t *conn, const RemoteToTpm2d *msg,
+			     const uint8_t pcr_bitmap[3], int pcr_regs)
+{
+	RemoteToTpm2d *copy = (RemoteToTpm2d *)protobuf_dup_message((ProtobufCMessage *)msg);
+	IF_NULL_RETURN_ERROR(copy);
+
+	tpm2d_rcontrol_att_req_t *req = mem_new0(tpm2d_rcontrol_att_req_t, 1);
+	req->msg = copy;
+	memcpy(req->pcr_bitmap, pcr_bitmap, sizeof(req->pcr_bitmap));
+	req->pcr_regs = pcr_regs;
+
+	tpm2d_sched_submit(TPM2D_SCHED_ATTEST, conn, tpm2d_rcontrol_attest_run_job,
+			   tpm2d_rcontrol_attest_free_job, req);
+}
+
+static void
+tpm2d_rcontrol_handle_message(const RemoteToTpm2d *msg, protobuf_conn_t *conn,
+			      tpm2d_rcontrol_t *rcontrol)
+{
+	ASSERT(rcontrol);
+
+	TRACE("Handle message from client fd=%d", protobuf_conn_get_fd(conn));
+
+	if (NULL == msg) {
+		WARN("msg=NULL, returning");
+		return;
+	}
+
+	if (LOGF_PRIO_TRACE >= LOGF_LOG_MIN_PRIO) {
+		char *msg_text;
+		size_t msg_len =
+			protobuf_string_from_message(&msg_text, (ProtobufCMessage *)msg, NULL);
+		TRACE("Handling RemoteToTpmd message:\n%s", msg_len > 0 ? msg_text : "NULL");
+		if (msg_text)
+			mem_free0(msg_text);
+	}
+
+	switch (msg->code) {
+	case REMOTE_TO_TPM2D__CODE__ATTESTATION_REQ: {
+		uint8_t pcr_bitmap[3];
+		int pcr_regs = tpm2d_rcontrol_get_pcr_bitmap(msg, pcr_bitmap);
+		if (pcr_regs < 0) {
+			WARN("Unknown attestation type %d", msg->atype);
+			break;
+		}
+
+		if (msg->allow_nonce_batching && msg->has_qualifyingdata)
+			tpm2d_rcontrol_batch_add(rcontrol, conn, msg, pcr_bitmap, pcr_regs);
+		else
+			tpm2d_rcontrol_attest_submit(conn, msg, pcr_bitmap, pcr_regs);
 	} break;
 	default:
 		WARN("RemoteToTpm2d command %d unknown or not implemented yet", msg->code);
 		break;
 	}
-	tss2_destroy();
 }
 
 /**
- * Event callback for incoming data that a ControllerToTpm message.
+ * Callback for a RemoteToTpm2d message received on a remote control connection.
  *
  * The handle_message function will be called to handle the received message.
  *
- * @param fd	    file descriptor of the client connection
- *		    from which the incoming message is read
- * @param events    event flags
- * @param io	    pointer to associated event_io_t struct
+ * @param conn	    the client connection from which the message was received
+ * @param msg	    the received RemoteToTpm2d message
  * @param data	    pointer to this tpm2d_rcontrol_t struct
  */
 static void
-tpm2d_rcontrol_cb_recv_message(int fd, unsigned events, event_io_t *io, void *data)
+tpm2d_rcontrol_cb_recv_message(protobuf_conn_t *conn, ProtobufCMessage *msg, void *data)
 {
 	tpm2d_rcontrol_t *rcontrol = data;
 	ASSERT(rcontrol);
+	int fd = protobuf_conn_get_fd(conn);
 
-	if (events & EVENT_IO_READ) {
-		RemoteToTpm2d *msg =
-			(RemoteToTpm2d *)protobuf_recv_message(fd, &remote_to_tpm2d__descriptor);
-		// close connection if client EOF, or protocol parse error
-		IF_NULL_GOTO_TRACE(msg, connection_err);
+	tpm2d_rcontrol_handle_message((RemoteToTpm2d *)msg, conn, rcontrol);
+	DEBUG("Handled remote control connection %d", fd);
+}
 
-		tpm2d_rcontrol_handle_message(msg, fd, rcontrol);
-		protobuf_free_message((ProtobufCMessage *)msg);
-		DEBUG("Handled remote control connection %d", fd);
-	}
-	if (events & EVENT_IO_EXCEPT) {
-		INFO("Remote client closed connection; disconnecting rcontrol socket.");
-		goto connection_err;
+/**
+ * Callback for a remote control connection which was closed by the client or
+ * which had to be closed due to an I/O or protocol parse error.
+ *
+ * @param conn	    the client connection to be closed
+ * @param data	    pointer to this tpm2d_rcontrol_t struct
+ */
+static void
+tpm2d_rcontrol_cb_close(protobuf_conn_t *conn, void *data)
+{
+	tpm2d_rcontrol_t *rcontrol = data;
+	ASSERT(rcontrol);
+	int fd = protobuf_conn_get_fd(conn);
+
+	// pending batched requests of this client are still quoted, but not answered
+	for (list_t *l = rcontrol->batch; l; l = l->next) {
+		tpm2d_rcontrol_att_req_t *req = l->data;
+		if (req->conn == conn)
+			req->conn = NULL;
 	}
-	return;
 
-connection_err:
-	event_remove_io(io);
-	event_io_free(io);
+	tpm2d_sched_detach_conn(conn);
+
+	INFO("Remote client closed connection; disconnecting rcontrol socket.");
+	protobuf_conn_free(conn);
 	if (close(fd) < 0)
 		WARN_ERRNO("Failed to close connected rcontrol socket");
-	return;
 }
+
 /**
  * Event callback for accepting incoming connections on the listening socket.
  *
@@ -353,11 +812,11 @@ tpm2d_rcontrol_cb_accept(int fd, unsigned events, event_io_t *io, void *data)
 	}
 	DEBUG("Accepted remote control connection %d", cfd);
 
-	fd_make_non_blocking(cfd);
-
-	event_io_t *event =
-		event_io_new(cfd, EVENT_IO_READ, tpm2d_rcontrol_cb_recv_message, rcontrol);
-	event_add_io(event);
+	if (!protobuf_conn_new(cfd, &remote_to_tpm2d__descriptor, tpm2d_rcontrol_cb_recv_message,
+			       tpm2d_rcontrol_cb_close, rcontrol)) {
+		WARN("Could not set up remote control connection %d", cfd);
+		close(cfd);
+	}
 }
 
 static event_io_t *event;
@@ -385,5 +844,15 @@ tpm2d_rcontrol_free(tpm2d_rcontrol_t *rcontrol)
 {
 	event_remove_io(event);
 	event_io_free(event);
+
+	if (rcontrol->batch_timer) {
+		event_remove_timer(rcontrol->batch_timer);
+		event_timer_free(rcontrol->batch_timer);
+	}
+	for (list_t *l = rcontrol->batch; l; l = l->next)
+		tpm2d_rcontrol_att_req_free(l->data);
+	list_delete(rcontrol->batch);
+	tpm2d_rcontrol_pcr_cache_clear();
+
 	mem_free0(rcontrol);
 }
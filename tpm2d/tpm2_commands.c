@@ -26,6 +26,8 @@
 #include "common/mem.h"
 #include "common/macro.h"
 #include "common/file.h"
+#include "common/hex.h"
+#include "common/probe.h"
 
 #include <ibmtss/tss.h>
 #include <ibmtss/tssutils.h>
@@ -42,6 +44,50 @@
 
 static TSS_CONTEXT *tss_context = NULL;
 
+/*
+ * Salted, unbound HMAC session which is kept open for the lifetime of the tss context
+ * and used with TPMA_SESSION_CONTINUESESSION for parameter encryption. Since it is not
+ * bound to any entity, the entity's auth value is still part of every command HMAC, so
+ * the session can be shared across entities and passwords.
+ */
+static TPMI_SH_AUTH_SESSION tss_hmac_session = TPM_RH_NULL;
+
+/*
+ * Data sizes from the public areas of the NV indices. The indices are only defined and
+ * undefined by tpm2d itself, which drops the corresponding entry. An index of 0 marks
+ * an unused entry, since NV index handles always have TPM_HT_NV_INDEX set.
+ */
+#define TSS_NV_SIZE_CACHE_LEN 8
+static struct {
+	TPMI_RH_NV_INDEX nv_index_handle;
+	size_t data_size;
+} tss_nv_size_cache[TSS_NV_SIZE_CACHE_LEN];
+static size_t tss_nv_size_cache_next = 0;
+
+// TPM_PT_NV_BUFFER_MAX of the TPM, queried once
+static size_t tss_nv_buffer_max = 0;
+
+static TPM_CC
+tss_probe_cc(TPM_CC cc)
+{
+	PROBE1(tpm2_cmd, cc);
+	return cc;
+}
+
+static TPM_RC
+tss_probe_rc(TPM_CC cc, TPM_RC rc)
+{
+	PROBE2(tpm2_cmd_done, cc, rc);
+	return rc;
+}
+
+/*
+ * TSS_Execute() with the tpm2_cmd and tpm2_cmd_done probes around the submission of the
+ * command, the probes fire right before and after the TPM processed command cc.
+ */
+#define TSS_EXECUTE(ctx, out, in, extra, cc, ...)                                                  \
+	tss_probe_rc(cc, TSS_Execute(ctx, out, in, extra, tss_probe_cc(cc), __VA_ARGS__))
+
 #define TSS_TPM_CMD_ERROR(rc, cc_string)                                                           \
 	{                                                                                          \
 		const char *msg;                                                                   \
@@ -53,6 +99,34 @@ static TSS_CONTEXT *tss_context = NULL;
 
 /************************************************************************************/
 
+static bool
+tss_nv_size_cache_get(TPMI_RH_NV_INDEX nv_index_handle, size_t *data_size)
+{
+	for (size_t i = 0; i < TSS_NV_SIZE_CACHE_LEN; ++i) {
+		if (tss_nv_size_cache[i].nv_index_handle == nv_index_handle) {
+			*data_size = tss_nv_size_cache[i].data_size;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+tss_nv_size_cache_put(TPMI_RH_NV_INDEX nv_index_handle, size_t data_size)
+{
+	tss_nv_size_cache[tss_nv_size_cache_next].nv_index_handle = nv_index_handle;
+	tss_nv_size_cache[tss_nv_size_cache_next].data_size = data_size;
+	tss_nv_size_cache_next = (tss_nv_size_cache_next + 1) % TSS_NV_SIZE_CACHE_LEN;
+}
+
+static void
+tss_nv_size_cache_drop(TPMI_RH_NV_INDEX nv_index_handle)
+{
+	for (size_t i = 0; i < TSS_NV_SIZE_CACHE_LEN; ++i)
+		if (tss_nv_size_cache[i].nv_index_handle == nv_index_handle)
+			tss_nv_size_cache[i].nv_index_handle = 0;
+}
+
 void
 tss2_init(void)
 {
@@ -69,58 +143,55 @@ tss2_init(void)
 	TSS_SetProperty(NULL, TPM_TRACE_LEVEL, "1");
 }
 
-void
-tss2_destroy(void)
+/**
+ * Returns the cached HMAC session, starting a new one if none is open yet.
+ */
+static TPM_RC
+tss2_hmac_session_get(TPMI_SH_AUTH_SESSION *out_session_handle)
 {
-	int ret;
-	IF_NULL_RETURN_ERROR(tss_context);
+	TPM_RC rc;
 
-	if (TPM_RC_SUCCESS != (ret = TSS_Delete(tss_context)))
-		FATAL("Cannot destroy tss context error code: %08x", ret);
+	if (TPM_RH_NULL == tss_hmac_session) {
+		rc = tpm2_startauthsession(TPM_SE_HMAC, &tss_hmac_session, TPM_RH_NULL, NULL);
+		if (TPM_RC_SUCCESS != rc) {
+			tss_hmac_session = TPM_RH_NULL;
+			return rc;
+		}
+		DEBUG("Started cached hmac session %08x", tss_hmac_session);
+	}
 
-	tss_context = NULL;
+	*out_session_handle = tss_hmac_session;
+	return TPM_RC_SUCCESS;
 }
 
-char *
-convert_bin_to_hex_new(const uint8_t *bin, int length)
+/**
+ * Flushes the cached HMAC session, e.g., after a failed command left its state unknown.
+ * The next call to tss2_hmac_session_get() starts a fresh one.
+ */
+static void
+tss2_hmac_session_drop(void)
 {
-	size_t len = MUL_WITH_OVERFLOW_CHECK(length, (size_t)2);
-	len = MUL_WITH_OVERFLOW_CHECK(len, sizeof(char));
-	len = ADD_WITH_OVERFLOW_CHECK(len, 1);
-	char *hex = mem_alloc0(len);
-
-	for (int i = 0; i < length; ++i) {
-		// remember snprintf additionally writs a '0' byte
-		snprintf(hex + i * 2, 3, "%.2x", bin[i]);
-	}
+	if (TPM_RH_NULL == tss_hmac_session)
+		return;
+
+	if (TPM_RC_SUCCESS != tpm2_flushcontext(tss_hmac_session))
+		WARN("Flush failed, maybe session handle was allready flushed.");
 
-	return hex;
+	tss_hmac_session = TPM_RH_NULL;
 }
 
-uint8_t *
-convert_hex_to_bin_new(const char *hex_str, int *out_length)
+void
+tss2_destroy(void)
 {
-	int len = strlen(hex_str);
-	int i = 0, j = 0;
-	*out_length = (len + 1) / 2;
-
-	uint8_t *bin = mem_alloc0(*out_length);
+	int ret;
+	IF_NULL_RETURN_ERROR(tss_context);
 
-	if (len % 2 == 1) {
-		// odd length -> we need to pad
-		IF_FALSE_GOTO(sscanf(&(hex_str[0]), "%1hhx", &(bin[0])) == 1, err);
-		i = j = 1;
-	}
+	tss2_hmac_session_drop();
 
-	for (; i < len; i += 2, j++) {
-		IF_FALSE_GOTO(sscanf(&(hex_str[i]), "%2hhx", &(bin[j])) == 1, err);
-	}
+	if (TPM_RC_SUCCESS != (ret = TSS_Delete(tss_context)))
+		FATAL("Cannot destroy tss context error code: %08x", ret);
 
-	return bin;
-err:
-	ERROR("Converstion of hex string to bin failed!");
-	mem_free0(bin);
-	return NULL;
+	tss_context = NULL;
 }
 
 #ifndef TPM2D_NVMCRYPT_ONLY
@@ -177,7 +248,7 @@ tpm2_startup(TPM_SU startup_type)
 
 	in.startupType = startup_type;
 
-	rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_Startup,
+	rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_Startup,
 			 TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_INITIALIZE == rc) {
@@ -200,7 +271,7 @@ tpm2_selftest(void)
 
 	in.fullTest = YES;
 
-	rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_SelfTest,
+	rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_SelfTest,
 			 TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc)
@@ -219,9 +290,12 @@ tpm2_clear(const char *lockout_pwd)
 
 	in.authHandle = TPM_RH_LOCKOUT;
 
-	rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_Clear,
+	rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_Clear,
 			 TPM_RS_PW, lockout_pwd, 0, TPM_RH_NULL, NULL, 0);
 
+	// the clear undefines the owner's NV indices
+	memset(tss_nv_size_cache, 0, sizeof(tss_nv_size_cache));
+
 	if (TPM_RC_SUCCESS != rc)
 		TSS_TPM_CMD_ERROR(rc, "CC_Clear");
 
@@ -238,7 +312,7 @@ tpm2_dictionaryattacklockreset(const char *lockout_pwd)
 
 	in.lockHandle = TPM_RH_LOCKOUT;
 
-	rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
+	rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
 			 TPM_CC_DictionaryAttackLockReset, TPM_RS_PW, lockout_pwd, 0, TPM_RH_NULL,
 			 NULL, 0);
 
@@ -293,7 +367,7 @@ tpm2_startauthsession(TPM_SE session_type, TPMI_SH_AUTH_SESSION *out_session_han
 	/* authHash */
 	in.authHash = TPM2D_HASH_ALGORITHM;
 
-	rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in,
+	rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in,
 			 (EXTRA_PARAMETERS *)&extra, TPM_CC_StartAuthSession, TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc) {
@@ -317,7 +391,7 @@ tpm2_policyauthvalue(TPMI_SH_POLICY se_handle)
 
 	in.policySession = se_handle;
 
-	rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_PolicyAuthValue,
+	rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_PolicyAuthValue,
 			 TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc)
@@ -383,7 +457,7 @@ tpm2_policypcr(TPMI_SH_AUTH_SESSION se_handle, uint32_t pcr_mask, tpm2d_pcr_t *p
 		TSS_PrintAll("PCR digest: ", in.pcrDigest.b.buffer, in.pcrDigest.b.size);
 	}
 
-	rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_PolicyPCR,
+	rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_PolicyPCR,
 			 TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc)
@@ -407,7 +481,7 @@ tpm2_policygetdigest(TPMI_SH_POLICY se_handle, uint8_t *out_digest, size_t out_d
 
 	in.policySession = se_handle;
 
-	rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in, NULL,
+	rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in, NULL,
 			 TPM_CC_PolicyGetDigest, TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc) {
@@ -440,7 +514,7 @@ tpm2_policyrestart(TPMI_SH_POLICY se_handle)
 
 	in.sessionHandle = se_handle;
 
-	rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_PolicyRestart,
+	rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_PolicyRestart,
 			 TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc)
@@ -457,7 +531,7 @@ tpm2_flushcontext(TPMI_DH_CONTEXT handle)
 
 	in.flushHandle = handle;
 
-	rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_FlushContext,
+	rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_FlushContext,
 			 TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc)
@@ -668,7 +742,7 @@ tpm2_createprimary_asym(TPMI_RH_HIERARCHY hierachy, tpm2d_key_type_t key_type,
 	// Table 102 - TPML_PCR_SELECTION creationPCR
 	in.creationPCR.count = 0;
 
-	rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in, NULL,
+	rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in, NULL,
 			 TPM_CC_CreatePrimary, TPM_RS_PW, hierachy_pwd, 0, TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc) {
@@ -723,7 +797,7 @@ tpm2_create_asym(TPMI_DH_OBJECT parent_handle, tpm2d_key_type_t key_type, uint32
 	// Table 102 - TPML_PCR_SELECTION creationPCR
 	in.creationPCR.count = 0;
 
-	rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in, NULL,
+	rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in, NULL,
 			 TPM_CC_Create, TPM_RS_PW, parent_pwd, 0, TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc) {
@@ -794,7 +868,7 @@ tpm2_load(TPMI_DH_OBJECT parent_handle, const char *parent_pwd, const char *file
 					     false, file_name_pub_key)))
 		return rc;
 
-	rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in, NULL,
+	rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out, (COMMAND_PARAMETERS *)&in, NULL,
 			 TPM_CC_Load, TPM_RS_PW, parent_pwd, 0, TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc) {
@@ -831,7 +905,7 @@ tpm2_pcrextend(TPMI_DH_PCR pcr_index, TPMI_ALG_HASH hash_alg, const uint8_t *dat
 	mem_memset((uint8_t *)&in.digests.digests[0].digest, 0, sizeof(TPMU_HA));
 	memcpy((uint8_t *)&in.digests.digests[0].digest, data, data_len);
 
-	rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_PCR_Extend,
+	rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_PCR_Extend,
 			 TPM_RS_PW, NULL, 0, TPM_RH_NULL, NULL, 0);
 
 	if (TPM_RC_SUCCESS != rc)
@@ -883,7 +957,7 @@ tpm2_quote_new(uint8_t *pcr_bitmap, size_t size_pcr_bitmap, TPMI_DH_OBJECT sig_k
 		in.qualifyingData.t.size = 0;
 
 	do {
-		rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out,
+		rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out,
 				 (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_Quote, TPM_RS_PW,
 				 sig_key_pwd, 0, TPM_RH_NULL, NULL, 0);
 	} while (TPM_RC_RETRY == rc);
@@ -909,6 +983,9 @@ tpm2_quote_new(uint8_t *pcr_bitmap, size_t size_pcr_bitmap, TPMI_DH_OBJECT sig_k
 	quote->signature_value = tpm2d_marshal_structure_new(
 		&out.signature, (MarshalFunction_t)TSS_TPMT_SIGNATURE_Marshalu, &signature_size);
 	quote->signature_size = signature_size;
+	quote->pcr_digest_size = tpms_attest.attested.quote.pcrDigest.t.size;
+	quote->pcr_digest = mem_memcpy(tpms_attest.attested.quote.pcrDigest.t.buffer,
+				       quote->pcr_digest_size);
 
 	if (in.inScheme.scheme == TPM_ALG_RSASSA) {
 		TSS_PrintAll("RSA signature", out.signature.signature.rsassa.sig.t.buffer,
@@ -927,6 +1004,8 @@ tpm2_quote_free(tpm2d_quote_t *quote)
 		mem_free0(quote->quoted_value);
 	if (quote->signature_value)
 		mem_free0(quote->signature_value);
+	if (quote->pcr_digest)
+		mem_free0(quote->pcr_digest);
 	mem_free0(quote);
 }
 
@@ -944,7 +1023,7 @@ tpm2_evictcontrol(TPMI_RH_HIERARCHY auth, char *auth_pwd, TPMI_DH_OBJECT obj_han
 	in.persistentHandle = persist_handle;
 
 	do {
-		rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
+		rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
 				 TPM_CC_EvictControl, TPM_RS_PW, auth_pwd, 0, TPM_RH_NULL, NULL, 0);
 	} while (TPM_RC_RETRY == rc);
 
@@ -980,7 +1059,7 @@ tpm2_rsaencrypt(TPMI_DH_OBJECT key_handle, uint8_t *in_buffer, size_t in_length,
 	in.label.t.size = 0;
 
 	do {
-		rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out,
+		rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out,
 				 (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_RSA_Encrypt, TPM_RH_NULL,
 				 NULL, 0);
 	} while (TPM_RC_RETRY == rc);
@@ -1029,7 +1108,7 @@ tpm2_rsadecrypt(TPMI_DH_OBJECT key_handle, const char *key_pwd, uint8_t *in_buff
 	in.label.t.size = 0;
 
 	do {
-		rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out,
+		rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out,
 				 (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_RSA_Decrypt, TPM_RS_PW,
 				 key_pwd, 0, TPM_RH_NULL, NULL, 0);
 	} while (TPM_RC_RETRY == rc);
@@ -1077,7 +1156,7 @@ tpm2_hierarchychangeauth(TPMI_RH_HIERARCHY hierarchy, const char *old_pwd, const
 		goto err;
 
 	do {
-		rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
+		rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
 				 TPM_CC_HierarchyChangeAuth, se_handle, 0,
 				 TPMA_SESSION_DECRYPT | TPMA_SESSION_CONTINUESESSION, TPM_RH_NULL,
 				 NULL, 0);
@@ -1103,8 +1182,8 @@ tpm2_getrandom_new(size_t rand_length)
 
 	IF_NULL_RETVAL_ERROR(tss_context, NULL);
 
-	// since we use this to generate symetric keys, start an encrypted transport */
-	rc = tpm2_startauthsession(TPM_SE_HMAC, &se_handle, TPM_RH_NULL, NULL);
+	// since we use this to generate symetric keys, use an encrypted transport */
+	rc = tss2_hmac_session_get(&se_handle);
 	if (TPM_RC_SUCCESS != rc)
 		return NULL;
 
@@ -1112,7 +1191,7 @@ tpm2_getrandom_new(size_t rand_length)
 	size_t recv_bytes = 0;
 	do {
 		in.bytesRequested = rand_length - recv_bytes;
-		rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out,
+		rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out,
 				 (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_GetRandom, se_handle, NULL,
 				 TPMA_SESSION_ENCRYPT | TPMA_SESSION_CONTINUESESSION, TPM_RH_NULL,
 				 NULL, 0);
@@ -1124,6 +1203,7 @@ tpm2_getrandom_new(size_t rand_length)
 
 	if (TPM_RC_SUCCESS != rc) {
 		TSS_TPM_CMD_ERROR(rc, "CC_GetRandom");
+		tss2_hmac_session_drop();
 		mem_free0(rand);
 		return NULL;
 	}
@@ -1133,9 +1213,6 @@ tpm2_getrandom_new(size_t rand_length)
 
 	mem_free0(rand_hex);
 
-	if (TPM_RC_SUCCESS != tpm2_flushcontext(se_handle))
-		WARN("Flush failed, maybe session handle was allready flushed.");
-
 	return rand;
 }
 
@@ -1160,7 +1237,7 @@ tpm2_pcrread_new(TPMI_DH_PCR pcr_index, TPMI_ALG_HASH hash_alg)
 	in.pcrSelectionIn.pcrSelections[0].pcrSelect[pcr_index / 8] = 1 << (pcr_index % 8);
 
 	do {
-		rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out,
+		rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out,
 				 (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_PCR_Read, TPM_RH_NULL,
 				 NULL, 0);
 	} while (TPM_RC_RETRY == rc);
@@ -1209,9 +1286,12 @@ tpm2_nv_get_data_size(TPMI_RH_NV_INDEX nv_index_handle)
 		return -1;
 	}
 
+	if (tss_nv_size_cache_get(nv_index_handle, &data_size))
+		return data_size;
+
 	in.nvIndex = nv_index_handle;
 
-	if (TPM_RC_SUCCESS != TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out,
+	if (TPM_RC_SUCCESS != TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out,
 					  (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_NV_ReadPublic,
 					  TPM_RH_NULL, NULL, 0))
 		return 0;
@@ -1224,6 +1304,10 @@ tpm2_nv_get_data_size(TPMI_RH_NV_INDEX nv_index_handle)
 	}
 	INFO("Data size of NV index %x is %zd", nv_index_handle, data_size);
 
+	// an index which does not exist yet is not cached, it may be defined by someone else
+	if (data_size > 0)
+		tss_nv_size_cache_put(nv_index_handle, data_size);
+
 	return data_size;
 }
 
@@ -1240,9 +1324,12 @@ tpm2_nv_get_max_buffer_size(TSS_CONTEXT *tss_context)
 	// set a small default fallback value;
 	size_t buffer_size = 512;
 
+	if (tss_nv_buffer_max > 0)
+		return tss_nv_buffer_max;
+
 	IF_NULL_RETVAL_WARN(tss_context, buffer_size);
 
-	if (TPM_RC_SUCCESS != TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out,
+	if (TPM_RC_SUCCESS != TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out,
 					  (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_GetCapability,
 					  TPM_RH_NULL, NULL, 0)) {
 		ERROR("GetCapability failed, returning default value %zd", buffer_size);
@@ -1255,7 +1342,11 @@ tpm2_nv_get_max_buffer_size(TSS_CONTEXT *tss_context)
 	else
 		ERROR("GetCapability failed, returning default value %zd", buffer_size);
 
+	// chunks also have to fit into the marshalling buffers of the tss
+	buffer_size = MIN(buffer_size, (size_t)MAX_NV_BUFFER_SIZE);
+
 	INFO("NV buffer maximum size is set to %zd", buffer_size);
+	tss_nv_buffer_max = buffer_size;
 	return buffer_size;
 }
 
@@ -1335,7 +1426,7 @@ tpm2_nv_definespace(TPMI_RH_HIERARCHY hierarchy, TPMI_RH_NV_INDEX nv_index_handl
 		goto err;
 
 	do {
-		rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
+		rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
 				 TPM_CC_NV_DefineSpace,
 				 //TPM_RS_PW, hierarchy_pwd, 0,
 				 se_handle, 0, TPMA_SESSION_DECRYPT | TPMA_SESSION_CONTINUESESSION,
@@ -1343,6 +1434,7 @@ tpm2_nv_definespace(TPMI_RH_HIERARCHY hierarchy, TPMI_RH_NV_INDEX nv_index_handl
 	} while (TPM_RC_RETRY == rc);
 
 	rc_flush = tpm2_flushcontext(se_handle);
+	tss_nv_size_cache_drop(nv_index_handle);
 err:
 	if (TPM_RC_SUCCESS != rc) {
 		TSS_TPM_CMD_ERROR(rc, "CC_NV_DefineSpace");
@@ -1377,13 +1469,14 @@ tpm2_nv_undefinespace(TPMI_RH_HIERARCHY hierarchy, TPMI_RH_NV_INDEX nv_index_han
 		goto err;
 
 	do {
-		rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
+		rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
 				 TPM_CC_NV_UndefineSpace,
 				 //TPM_RS_PW, hierarchy_pwd, 0,
 				 se_handle, 0, TPMA_SESSION_CONTINUESESSION, TPM_RH_NULL, NULL, 0);
 	} while (TPM_RC_RETRY == rc);
 
 	rc_flush = tpm2_flushcontext(se_handle);
+	tss_nv_size_cache_drop(nv_index_handle);
 err:
 	if (TPM_RC_SUCCESS != rc) {
 		TSS_TPM_CMD_ERROR(rc, "CC_NV_UndefineSpace");
@@ -1398,7 +1491,7 @@ TPM_RC
 tpm2_nv_write(TPMI_RH_NV_INDEX nv_index_handle, const char *nv_pwd, uint8_t *data,
 	      size_t data_length)
 {
-	TPM_RC rc, rc_flush = TPM_RC_SUCCESS;
+	TPM_RC rc;
 	TPMI_SH_AUTH_SESSION se_handle;
 	NV_Write_In in;
 
@@ -1413,33 +1506,34 @@ tpm2_nv_write(TPMI_RH_NV_INDEX nv_index_handle, const char *nv_pwd, uint8_t *dat
 	in.offset = 0;
 
 	size_t buffer_max = tpm2_nv_get_max_buffer_size(tss_context);
-	if (data_length > buffer_max) {
-		INFO("Only one chunk is supported by this implementation!");
-		rc = TSS_RC_INSUFFICIENT_BUFFER;
-		goto err;
-	}
-	memcpy(in.data.b.buffer, data, data_length);
-	in.data.b.size = data_length;
 
-	// since we use this to read symetric keys, start an encrypted transport */
-	rc = tpm2_startauthsession(TPM_SE_HMAC, &se_handle, nv_index_handle, nv_pwd);
+	// since we use this to write symetric keys, use an encrypted transport */
+	rc = tss2_hmac_session_get(&se_handle);
 	if (TPM_RC_SUCCESS != rc)
 		goto err;
 
+	// write in chunks of the maximum NV buffer size, all within the cached session
 	do {
-		rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
-				 TPM_CC_NV_Write, se_handle, NULL,
-				 TPMA_SESSION_DECRYPT | TPMA_SESSION_CONTINUESESSION, TPM_RH_NULL,
-				 NULL, 0);
-	} while (TPM_RC_RETRY == rc);
+		in.data.b.size = MIN(data_length - in.offset, buffer_max);
+		memcpy(in.data.b.buffer, data + in.offset, in.data.b.size);
+		TRACE("Writing chunk of size=%d at offset=%d", in.data.b.size, in.offset);
 
-	rc_flush = tpm2_flushcontext(se_handle);
+		do {
+			rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
+					 TPM_CC_NV_Write, se_handle, nv_pwd,
+					 TPMA_SESSION_DECRYPT | TPMA_SESSION_CONTINUESESSION,
+					 TPM_RH_NULL, NULL, 0);
+		} while (TPM_RC_RETRY == rc);
+
+		in.offset += in.data.b.size;
+	} while (TPM_RC_SUCCESS == rc && in.offset < data_length);
+
+	if (TPM_RC_SUCCESS != rc)
+		tss2_hmac_session_drop();
 err:
-	if (TPM_RC_SUCCESS != rc) {
+	if (TPM_RC_SUCCESS != rc)
 		TSS_TPM_CMD_ERROR(rc, "CC_NV_Write");
-	} else {
-		rc = rc_flush;
-	}
+
 	return rc;
 }
 
@@ -1473,9 +1567,9 @@ tpm2_nv_read(TPMI_SH_POLICY se_handle, TPMI_RH_NV_INDEX nv_index_handle, const c
 		goto err;
 	}
 
-	// since we use this to read symetric keys, start an encrypted transport
+	// since we use this to read symetric keys, use an encrypted transport
 	if (se_handle == TPM_RH_NULL) {
-		rc = tpm2_startauthsession(TPM_SE_HMAC, &auth_se_handle, nv_index_handle, nv_pwd);
+		rc = tss2_hmac_session_get(&auth_se_handle);
 		if (TPM_RC_SUCCESS != rc)
 			goto err;
 	} else {
@@ -1486,12 +1580,12 @@ tpm2_nv_read(TPMI_SH_POLICY se_handle, TPMI_RH_NV_INDEX nv_index_handle, const c
 	in.offset = *out_length = 0;
 	do {
 		in.size = (data_size > buffer_max) ? buffer_max : data_size;
-		INFO("Reading chunk of size=%d", in.size);
+		TRACE("Reading chunk of size=%d", in.size);
 
 		do {
-			rc = TSS_Execute(tss_context, (RESPONSE_PARAMETERS *)&out,
+			rc = TSS_EXECUTE(tss_context, (RESPONSE_PARAMETERS *)&out,
 					 (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_NV_Read,
-					 auth_se_handle, NULL,
+					 auth_se_handle, nv_pwd,
 					 TPMA_SESSION_ENCRYPT | TPMA_SESSION_CONTINUESESSION,
 					 TPM_RH_NULL, NULL, 0);
 		} while (TPM_RC_RETRY == rc);
@@ -1510,7 +1604,11 @@ tpm2_nv_read(TPMI_SH_POLICY se_handle, TPMI_RH_NV_INDEX nv_index_handle, const c
 	TSS_PrintAll("nv_read data: ", out_buffer, *out_length);
 
 flush:
-	rc_flush = tpm2_flushcontext(auth_se_handle);
+	// the cached hmac session stays open unless the command failed
+	if (auth_se_handle != tss_hmac_session)
+		rc_flush = tpm2_flushcontext(auth_se_handle);
+	else if (TPM_RC_SUCCESS != rc)
+		tss2_hmac_session_drop();
 
 err:
 	if (TPM_RC_SUCCESS != rc) {
@@ -1524,7 +1622,7 @@ err:
 TPM_RC
 tpm2_nv_readlock(TPMI_RH_NV_INDEX nv_index_handle, const char *nv_pwd)
 {
-	TPM_RC rc, rc_flush = TPM_RC_SUCCESS;
+	TPM_RC rc;
 	TPMI_SH_AUTH_SESSION se_handle;
 	NV_ReadLock_In in;
 
@@ -1538,25 +1636,24 @@ tpm2_nv_readlock(TPMI_RH_NV_INDEX nv_index_handle, const char *nv_pwd)
 	in.authHandle = nv_index_handle;
 	in.nvIndex = nv_index_handle;
 
-	// since we use this to read symetric keys, start an encrypted transport
-	rc = tpm2_startauthsession(TPM_SE_HMAC, &se_handle, nv_index_handle, nv_pwd);
+	rc = tss2_hmac_session_get(&se_handle);
 	if (TPM_RC_SUCCESS != rc)
 		goto err;
 
 	do {
-		rc = TSS_Execute(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
+		rc = TSS_EXECUTE(tss_context, NULL, (COMMAND_PARAMETERS *)&in, NULL,
 				 TPM_CC_NV_ReadLock,
 				 //TPM_RS_PW, nv_pwd, 0,
-				 se_handle, 0, TPMA_SESSION_CONTINUESESSION, TPM_RH_NULL, NULL, 0);
+				 se_handle, nv_pwd, TPMA_SESSION_CONTINUESESSION, TPM_RH_NULL, NULL,
+				 0);
 	} while (TPM_RC_RETRY == rc);
 
-	rc_flush = tpm2_flushcontext(se_handle);
+	if (TPM_RC_SUCCESS != rc)
+		tss2_hmac_session_drop();
 
 err:
-	if (TPM_RC_SUCCESS != rc) {
+	if (TPM_RC_SUCCESS != rc)
 		TSS_TPM_CMD_ERROR(rc, "CC_NV_ReadLock");
-	} else {
-		rc = rc_flush;
-	}
+
 	return rc;
 }
@@ -27,26 +27,32 @@
 
 #include "control.h"
 #include "rcontrol.h"
+#include "tpm2d_sched.h"
 
 #include "common/macro.h"
 #include "common/mem.h"
 #include "common/event.h"
 #include "common/logf.h"
+#include "common/logrotate.h"
 #include "common/file.h"
 #include "common/dir.h"
 #include "common/sock.h"
 #include "common/protobuf.h"
+#include "common/metrics.h"
 
 #include <signal.h>
 #include <getopt.h>
 
 // clang-format off
 #define TPM2D_CONTROL_SOCKET SOCK_PATH(tpm2d-control)
+#define TPM2D_METRICS_SOCKET SOCK_PATH(tpm2d-metrics)
 // clang-format on
 #define TPM2D_RCONTROL_PORT 9505
 
 static bool use_simulator = false;
 static bool no_setup_keys = false;
+static bool serve_metrics = false;
+static const char *fde_device = NULL;
 
 static tpm2d_control_t *tpm2d_control_cmld = NULL;
 static tpm2d_rcontrol_t *tpm2d_rcontrol_attest = NULL;
@@ -67,13 +73,13 @@ static char *tpm2d_as_key_pwd_pt = TPM2D_PRIMARY_STORAGE_KEY_PW;
 #endif
 
 static void
-tpm2d_logfile_rename_cb(UNUSED event_timer_t *timer, UNUSED void *data)
+tpm2d_logfile_rotate_cb(FILE *file, UNUSED void *data)
 {
 	INFO("Logfile must be closed and a new file opened");
 	logf_unregister(tpm2d_logfile_handler);
 	logf_file_close(tpm2d_logfile_p);
 
-	tpm2d_logfile_p = logf_file_new(LOGFILE_DIR "/cml-tpm2d");
+	tpm2d_logfile_p = file;
 	tpm2d_logfile_handler = logf_register(&logf_file_write, tpm2d_logfile_p);
 	logf_handler_set_prio(tpm2d_logfile_handler, LOGF_PRIO_TRACE);
 }
@@ -246,14 +252,14 @@ tpm2d_init(void)
 
 	mem_free0(session_dir);
 	INFO("Sucessfully initialized TPM2.0");
-	tss2_destroy();
+	// keep the tss context, its cached sessions and loaded keys until tpm2d_exit()
 }
 
 void
 tpm2d_exit(void)
 {
 	INFO("Cleaning up tss2 and exit");
-	// When called tss2 library context may not be
+	// tss2 library context is normally kept open, but may not exist if init failed
 	tss2_init();
 	if (tpm2d_salt_key_handle != TPM_RH_NULL)
 		tpm2_flushcontext(tpm2d_salt_key_handle);
@@ -288,12 +294,16 @@ print_usage(const char *cmd)
 	printf("\n");
 	printf("\t use -s option to connect to simulator, otherwise /dev/tpm0 ist used");
 	printf("\t use -n option to disable setup keys for attestation");
+	printf("\t use -f <device> option to set up the FDE device mapping at startup");
+	printf("\t use -m option to export metrics, e.g., of the command queue, on a socket");
 	printf("\n");
 	exit(-1);
 }
 
 static const struct option global_options[] = { { "sim", no_argument, 0, 's' },
 						{ "nokeys", no_argument, 0, 'n' },
+						{ "fde", required_argument, 0, 'f' },
+						{ "metrics", no_argument, 0, 'm' },
 						{ "help", no_argument, 0, 'h' },
 						{ 0, 0, 0, 0 } };
 
@@ -303,7 +313,7 @@ main(UNUSED int argc, char **argv)
 	logf_register(&logf_file_write, stdout);
 
 	for (int c, option_index = 0;
-	     - 1 != (c = getopt_long(argc, argv, ":snh", global_options, &option_index));) {
+	     - 1 != (c = getopt_long(argc, argv, ":snhmf:", global_options, &option_index));) {
 		switch (c) {
 		case 's':
 			use_simulator = true;
@@ -311,6 +321,12 @@ main(UNUSED int argc, char **argv)
 		case 'n':
 			no_setup_keys = true;
 			break;
+		case 'f':
+			fde_device = optarg;
+			break;
+		case 'm':
+			serve_metrics = true;
+			break;
 		default: // includes cases 'h' and '?'
 			print_usage(argv[0]);
 		}
@@ -329,10 +345,9 @@ main(UNUSED int argc, char **argv)
 	event_signal_t *sig_term = event_signal_new(SIGTERM, &main_sigterm_cb, NULL);
 	event_add_signal(sig_term);
 
-	event_timer_t *logfile_timer =
-		event_timer_new(HOURS_TO_MILLISECONDS(24), EVENT_TIMER_REPEAT_FOREVER,
-				tpm2d_logfile_rename_cb, NULL);
-	event_add_timer(logfile_timer);
+	if (!logrotate_new(LOGFILE_DIR "/cml-tpm2d", tpm2d_logfile_p, LOGFILE_MAX_SIZE,
+			   LOGFILE_MAX_AGE, LOGFILE_KEEP, &tpm2d_logfile_rotate_cb, NULL))
+		WARN("Could not rotate the log file");
 
 	tpm2d_init();
 
@@ -341,6 +356,11 @@ main(UNUSED int argc, char **argv)
 		FATAL("Could not create directory for tpm2d_control socket");
 	}
 
+	tpm2d_sched_init();
+	metrics_server_t *metrics_server = NULL;
+	if (serve_metrics && !(metrics_server = metrics_server_new(TPM2D_METRICS_SOCKET)))
+		WARN("Could not create metrics socket %s", TPM2D_METRICS_SOCKET);
+
 	tpm2d_control_cmld = tpm2d_control_new(TPM2D_CONTROL_SOCKET);
 	if (!tpm2d_control_cmld) {
 		FATAL("Could not init tpm2d_control socket");
@@ -354,8 +374,16 @@ main(UNUSED int argc, char **argv)
 
 	INFO("created control socket.");
 
+	// the control socket already accepts connections, e.g., of cmld's tss_init()
+	if (fde_device)
+		nvmcrypt_dm_prefetch(fde_device);
+
 	event_loop();
 
+	// queued jobs may refer to the control modules
+	tpm2d_sched_cleanup();
+	if (metrics_server)
+		metrics_server_free(metrics_server);
 	tss2_destroy();
 	tpm2d_control_free(tpm2d_control_cmld);
 	if (!no_setup_keys) {
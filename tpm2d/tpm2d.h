@@ -53,6 +53,8 @@ typedef struct tpm2d_quote {
 	uint8_t *quoted_value;
 	size_t signature_size;
 	uint8_t *signature_value;
+	size_t pcr_digest_size;
+	uint8_t *pcr_digest; // digest over the quoted PCR values
 } tpm2d_quote_t;
 
 #endif // ifndef TPM2D_NVMCRYPT_ONLY
@@ -84,31 +86,6 @@ tss2_init(void);
 void
 tss2_destroy(void);
 
-/**
- * Helper function to convert a binary buffer to an hex string
- *
- * This function allocates a new buffer containing the
- * resulting hex representation containing a terminating '\0'
- * of the binary buffer.
- *
- * @param bin binary buffer
- * @param length of the binary buffer
- */
-char *
-convert_bin_to_hex_new(const uint8_t *bin, int length);
-
-/**
- * Helper function to convert a hex string into binary
- *
- * This function allocates a new buffer containing the
- * resulting binary representation of the string.
- *
- * @param hex_str buffer containing the hex string representation
- * @param out_length in this pointer the size of result is returned
- */
-uint8_t *
-convert_hex_to_bin_new(const char *hex_str, int *out_length);
-
 /**
  * Function to powerup the simulator
  *
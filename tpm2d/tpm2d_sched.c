@@ -0,0 +1,235 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+#include "tpm2d_sched.h"
+
+#include "common/macro.h"
+#include "common/mem.h"
+#include "common/event.h"
+#include "common/list.h"
+#include "common/metrics.h"
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+typedef struct tpm2d_sched_job {
+	tpm2d_sched_class_t class;
+	// order of submission
+	uint64_t seq;
+	// connection whose jobs are kept in order, also after the connection was detached
+	const void *owner;
+	// connection to reply on, NULL if the client disconnected meanwhile
+	protobuf_conn_t *conn;
+	tpm2d_sched_run_t run;
+	void (*free_data)(void *data);
+	void *data;
+	struct timespec queued;
+} tpm2d_sched_job_t;
+
+static const char *tpm2d_sched_class_names[TPM2D_SCHED_CLASSES] = { "key", "extend", "attest" };
+
+// queued tpm2d_sched_job_t of each class in the order of submission
+static list_t *tpm2d_sched_queue[TPM2D_SCHED_CLASSES];
+static unsigned int tpm2d_sched_queue_len[TPM2D_SCHED_CLASSES];
+static uint64_t tpm2d_sched_seq = 0;
+
+// one-shot timer which runs the next job once the event loop is idle
+static event_timer_t *tpm2d_sched_timer = NULL;
+
+static metrics_t *tpm2d_sched_depth_metrics[TPM2D_SCHED_CLASSES];
+static metrics_t *tpm2d_sched_wait_metrics[TPM2D_SCHED_CLASSES];
+
+static void
+tpm2d_sched_job_free(tpm2d_sched_job_t *job)
+{
+	if (job->free_data)
+		job->free_data(job->data);
+	mem_free0(job);
+}
+
+static void
+tpm2d_sched_update_depth(tpm2d_sched_class_t class)
+{
+	if (tpm2d_sched_depth_metrics[class])
+		metrics_gauge_set(tpm2d_sched_depth_metrics[class], tpm2d_sched_queue_len[class]);
+}
+
+/**
+ * Checks if an older job of the same connection is queued, e.g., a key operation
+ * behind a measurement, whose reply has to be sent first.
+ */
+static bool
+tpm2d_sched_job_is_blocked(const tpm2d_sched_job_t *job)
+{
+	IF_NULL_RETVAL(job->owner, false);
+
+	for (int c = 0; c < TPM2D_SCHED_CLASSES; c++) {
+		for (list_t *l = tpm2d_sched_queue[c]; l; l = l->next) {
+			const tpm2d_sched_job_t *other = l->data;
+			if (other->owner == job->owner && other->seq < job->seq)
+				return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Dequeues the first job of the highest class which is not blocked. The oldest job of
+ * all classes is never blocked, thus a job is returned as long as any is queued.
+ */
+static tpm2d_sched_job_t *
+tpm2d_sched_dequeue(void)
+{
+	for (int c = 0; c < TPM2D_SCHED_CLASSES; c++) {
+		for (list_t *l = tpm2d_sched_queue[c]; l; l = l->next) {
+			tpm2d_sched_job_t *job = l->data;
+			if (tpm2d_sched_job_is_blocked(job))
+				continue;
+
+			tpm2d_sched_queue[c] = list_unlink(tpm2d_sched_queue[c], l);
+			tpm2d_sched_queue_len[c]--;
+			tpm2d_sched_update_depth(c);
+			return job;
+		}
+	}
+	return NULL;
+}
+
+static void
+tpm2d_sched_arm(void);
+
+static void
+tpm2d_sched_timer_cb(event_timer_t *timer, UNUSED void *data)
+{
+	ASSERT(tpm2d_sched_timer == timer);
+
+	// the one-shot timer was already removed from the event loop
+	event_timer_free(timer);
+	tpm2d_sched_timer = NULL;
+
+	tpm2d_sched_job_t *job = tpm2d_sched_dequeue();
+	if (job) {
+		if (tpm2d_sched_wait_metrics[job->class])
+			metrics_histogram_observe_since(tpm2d_sched_wait_metrics[job->class],
+							&job->queued);
+		TRACE("Running %s job %" PRIu64, tpm2d_sched_class_names[job->class], job->seq);
+		job->run(job->conn, job->data);
+		tpm2d_sched_job_free(job);
+	}
+
+	// read new requests before the next job, which may be of a higher class
+	tpm2d_sched_arm();
+}
+
+static void
+tpm2d_sched_arm(void)
+{
+	IF_TRUE_RETURN(tpm2d_sched_timer);
+
+	bool queued = false;
+	for (int c = 0; c < TPM2D_SCHED_CLASSES; c++)
+		queued |= tpm2d_sched_queue[c] != NULL;
+	IF_FALSE_RETURN(queued);
+
+	tpm2d_sched_timer = event_timer_new(0, 1, tpm2d_sched_timer_cb, NULL);
+	event_add_timer(tpm2d_sched_timer);
+}
+
+void
+tpm2d_sched_init(void)
+{
+	for (int c = 0; c < TPM2D_SCHED_CLASSES; c++) {
+		char *labels = mem_printf("class=\"%s\"", tpm2d_sched_class_names[c]);
+		tpm2d_sched_depth_metrics[c] =
+			metrics_gauge_new("cml_tpm2d_queue_depth", labels,
+					  "Number of TPM commands waiting in the queue of tpm2d");
+		tpm2d_sched_wait_metrics[c] = metrics_histogram_new(
+			"cml_tpm2d_queue_wait_seconds", labels,
+			"Time TPM commands waited in the queue of tpm2d", metrics_latency_buckets,
+			metrics_latency_buckets_len);
+		mem_free0(labels);
+	}
+}
+
+void
+tpm2d_sched_submit(tpm2d_sched_class_t class, protobuf_conn_t *conn, tpm2d_sched_run_t run,
+		   void (*free_data)(void *data), void *data)
+{
+	ASSERT(class < TPM2D_SCHED_CLASSES);
+	ASSERT(run);
+
+	tpm2d_sched_job_t *job = mem_new0(tpm2d_sched_job_t, 1);
+	job->class = class;
+	job->seq = tpm2d_sched_seq++;
+	job->owner = conn;
+	job->conn = conn;
+	job->run = run;
+	job->free_data = free_data;
+	job->data = data;
+	clock_gettime(CLOCK_MONOTONIC, &job->queued);
+
+	tpm2d_sched_queue[class] = list_append(tpm2d_sched_queue[class], job);
+	tpm2d_sched_queue_len[class]++;
+	tpm2d_sched_update_depth(class);
+
+	tpm2d_sched_arm();
+}
+
+void
+tpm2d_sched_detach_conn(const protobuf_conn_t *conn)
+{
+	for (int c = 0; c < TPM2D_SCHED_CLASSES; c++) {
+		for (list_t *l = tpm2d_sched_queue[c]; l; l = l->next) {
+			tpm2d_sched_job_t *job = l->data;
+			if (job->conn == conn)
+				job->conn = NULL;
+		}
+	}
+}
+
+void
+tpm2d_sched_cleanup(void)
+{
+	if (tpm2d_sched_timer) {
+		event_remove_timer(tpm2d_sched_timer);
+		event_timer_free(tpm2d_sched_timer);
+		tpm2d_sched_timer = NULL;
+	}
+
+	for (int c = 0; c < TPM2D_SCHED_CLASSES; c++) {
+		for (list_t *l = tpm2d_sched_queue[c]; l; l = l->next)
+			tpm2d_sched_job_free(l->data);
+		list_delete(tpm2d_sched_queue[c]);
+		tpm2d_sched_queue[c] = NULL;
+		tpm2d_sched_queue_len[c] = 0;
+
+		if (tpm2d_sched_depth_metrics[c])
+			metrics_free(tpm2d_sched_depth_metrics[c]);
+		if (tpm2d_sched_wait_metrics[c])
+			metrics_free(tpm2d_sched_wait_metrics[c]);
+		tpm2d_sched_depth_metrics[c] = NULL;
+		tpm2d_sched_wait_metrics[c] = NULL;
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is part of GyroidOS
+ * Copyright(c) 2013 - 2024 Fraunhofer AISEC
+ * Fraunhofer-Gesellschaft zur Förderung der angewandten Forschung e.V.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 (GPL 2), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GPL 2 license for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, see <http://www.gnu.org/licenses/>
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Contact Information:
+ * Fraunhofer AISEC <gyroidos@aisec.fraunhofer.de>
+ */
+
+
+/**
+ * @file tpm2d_sched.h
+ *
+ * Queue of the TPM commands of the control and remote control clients of tpm2d.
+ *
+ * The TPM executes one command at a time and each of them takes milliseconds, thus
+ * commands which are waited for interactively or on the start path of containers
+ * shall not wait behind a burst of remote attestation quotes. Clients submit jobs in
+ * a priority class instead of executing them in their message callbacks. The event
+ * loop runs one job at a time, the first job of the highest class, and reads new
+ * requests in between. Jobs of the same class run in the order of submission, and the
+ * jobs of a connection, whose replies the client matches in order, run in the order
+ * of submission, regardless of their class.
+ */
+
+#ifndef TPM2D_SCHED_H
+#define TPM2D_SCHED_H
+
+#include "common/protobuf_conn.h"
+
+/**
+ * Priority classes of the jobs, the lowest value is executed first
+ */
+typedef enum tpm2d_sched_class {
+	TPM2D_SCHED_KEY = 0, // interactive key, FDE and NV operations
+	TPM2D_SCHED_EXTEND,  // measurements, e.g., on the start path of containers
+	TPM2D_SCHED_ATTEST,  // remote attestation quotes
+	TPM2D_SCHED_CLASSES
+} tpm2d_sched_class_t;
+
+/**
+ * Callback which executes a job.
+ *
+ * @param conn The connection to reply on, NULL if the client disconnected meanwhile.
+ * @param data The data passed to tpm2d_sched_submit().
+ */
+typedef void (*tpm2d_sched_run_t)(protobuf_conn_t *conn, void *data);
+
+/**
+ * Registers the metrics of the queue, i.e., its depth and the time jobs wait in it
+ * per class.
+ */
+void
+tpm2d_sched_init(void);
+
+/**
+ * Queues a job which is executed from the event loop.
+ *
+ * @param class The priority class of the job.
+ * @param conn The connection the job replies on, its jobs are kept in order. May be NULL.
+ * @param run The callback executing the job.
+ * @param free_data Callback which frees data after the job ran or was dropped, may be NULL.
+ * @param data Data passed to the callbacks.
+ */
+void
+tpm2d_sched_submit(tpm2d_sched_class_t class, protobuf_conn_t *conn, tpm2d_sched_run_t run,
+		   void (*free_data)(void *data), void *data);
+
+/**
+ * Detaches the queued jobs of a connection which is about to be freed. The jobs still run,
+ * e.g., measurements are still extended, but get NULL as connection.
+ */
+void
+tpm2d_sched_detach_conn(const protobuf_conn_t *conn);
+
+/**
+ * Drops all queued jobs without running them.
+ */
+void
+tpm2d_sched_cleanup(void);
+
+#endif /* TPM2D_SCHED_H */